@@ -7,15 +7,18 @@
     APIs: gl=3.3, gles2=3.0
     Profile: core
     Extensions:
-        
+        GL_ARB_buffer_storage,
+        GL_ARB_compute_shader,
+        GL_ARB_shader_image_load_store,
+        GL_ARB_shader_storage_buffer_object
     Loader: True
     Local files: False
     Omit khrplatform: False
 
     Commandline:
-        --profile="core" --api="gl=3.3,gles2=3.0" --generator="c" --spec="gl" --extensions=""
+        --profile="core" --api="gl=3.3,gles2=3.0" --generator="c" --spec="gl" --extensions="GL_ARB_buffer_storage,GL_ARB_compute_shader,GL_ARB_shader_image_load_store,GL_ARB_shader_storage_buffer_object"
     Online:
-        http://glad.dav1d.de/#profile=core&language=c&specification=gl&loader=on&api=gl%3D3.3&api=gles2%3D3.0
+        http://glad.dav1d.de/#profile=core&language=c&specification=gl&loader=on&api=gl%3D3.3&api=gles2%3D3.0&extensions=GL_ARB_buffer_storage&extensions=GL_ARB_compute_shader&extensions=GL_ARB_shader_image_load_store&extensions=GL_ARB_shader_storage_buffer_object
 */
 
 #include <stdio.h>
@@ -362,6 +365,16 @@ PFNGLVERTEXATTRIBPOINTERPROC glad_glVertexAttribPointer;
 PFNGLFRAMEBUFFERTEXTURELAYERPROC glad_glFramebufferTextureLayer;
 PFNGLFLUSHMAPPEDBUFFERRANGEPROC glad_glFlushMappedBufferRange;
 PFNGLTEXSTORAGE2DPROC glad_glTexStorage2D;
+int GLAD_GL_ARB_buffer_storage;
+int GLAD_GL_ARB_compute_shader;
+int GLAD_GL_ARB_shader_image_load_store;
+int GLAD_GL_ARB_shader_storage_buffer_object;
+PFNGLBUFFERSTORAGEPROC glad_glBufferStorage;
+PFNGLDISPATCHCOMPUTEPROC glad_glDispatchCompute;
+PFNGLDISPATCHCOMPUTEINDIRECTPROC glad_glDispatchComputeIndirect;
+PFNGLBINDIMAGETEXTUREPROC glad_glBindImageTexture;
+PFNGLMEMORYBARRIERPROC glad_glMemoryBarrier;
+PFNGLSHADERSTORAGEBLOCKBINDINGPROC glad_glShaderStorageBlockBinding;
 PFNGLGENQUERIESPROC glad_glGenQueries;
 PFNGLVERTEXATTRIBP1UIPROC glad_glVertexAttribP1ui;
 PFNGLTEXSUBIMAGE3DPROC glad_glTexSubImage3D;
@@ -1040,9 +1053,30 @@ static void load_GL_VERSION_3_3(GLADloadproc load) {
 	glad_glSecondaryColorP3ui = (PFNGLSECONDARYCOLORP3UIPROC)load("glSecondaryColorP3ui");
 	glad_glSecondaryColorP3uiv = (PFNGLSECONDARYCOLORP3UIVPROC)load("glSecondaryColorP3uiv");
 }
+static void load_GL_ARB_buffer_storage(GLADloadproc load) {
+	if(!GLAD_GL_ARB_buffer_storage) return;
+	glad_glBufferStorage = (PFNGLBUFFERSTORAGEPROC)load("glBufferStorage");
+}
+static void load_GL_ARB_compute_shader(GLADloadproc load) {
+	if(!GLAD_GL_ARB_compute_shader) return;
+	glad_glDispatchCompute = (PFNGLDISPATCHCOMPUTEPROC)load("glDispatchCompute");
+	glad_glDispatchComputeIndirect = (PFNGLDISPATCHCOMPUTEINDIRECTPROC)load("glDispatchComputeIndirect");
+}
+static void load_GL_ARB_shader_image_load_store(GLADloadproc load) {
+	if(!GLAD_GL_ARB_shader_image_load_store) return;
+	glad_glBindImageTexture = (PFNGLBINDIMAGETEXTUREPROC)load("glBindImageTexture");
+	glad_glMemoryBarrier = (PFNGLMEMORYBARRIERPROC)load("glMemoryBarrier");
+}
+static void load_GL_ARB_shader_storage_buffer_object(GLADloadproc load) {
+	if(!GLAD_GL_ARB_shader_storage_buffer_object) return;
+	glad_glShaderStorageBlockBinding = (PFNGLSHADERSTORAGEBLOCKBINDINGPROC)load("glShaderStorageBlockBinding");
+}
 static int find_extensionsGL(void) {
 	if (!get_exts()) return 0;
-	(void)&has_ext;
+	GLAD_GL_ARB_buffer_storage = has_ext("GL_ARB_buffer_storage");
+	GLAD_GL_ARB_compute_shader = has_ext("GL_ARB_compute_shader");
+	GLAD_GL_ARB_shader_image_load_store = has_ext("GL_ARB_shader_image_load_store");
+	GLAD_GL_ARB_shader_storage_buffer_object = has_ext("GL_ARB_shader_storage_buffer_object");
 	free_exts();
 	return 1;
 }
@@ -1121,6 +1155,10 @@ int gladLoadGLLoader(GLADloadproc load) {
 	load_GL_VERSION_3_3(load);
 
 	if (!find_extensionsGL()) return 0;
+	load_GL_ARB_buffer_storage(load);
+	load_GL_ARB_compute_shader(load);
+	load_GL_ARB_shader_image_load_store(load);
+	load_GL_ARB_shader_storage_buffer_object(load);
 	return GLVersion.major != 0 || GLVersion.minor != 0;
 }
 
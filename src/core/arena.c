@@ -0,0 +1,111 @@
+#include "core/arena.h"
+#include "core/core.h"
+
+/* allocations are rounded up to a power of two size class, the smallest of
+   which must be able to hold the free list pointer */
+#define ARENA_MIN_SHIFT 4
+#define ARENA_NUM_CLASSES 32
+
+struct arena_chunk {
+  struct arena_chunk *next;
+  uint8_t data[];
+};
+
+struct arena {
+  int chunk_size;
+
+  /* chunks are kept allocated across resets */
+  struct arena_chunk *chunks;
+  struct arena_chunk *curr;
+  int curr_offset;
+
+  /* singly-linked free list per size class, the next pointer is stored in
+     the freed allocation itself */
+  void *free[ARENA_NUM_CLASSES];
+};
+
+static int arena_size_class(int size) {
+  int shift = ARENA_MIN_SHIFT;
+
+  while ((1 << shift) < size) {
+    shift++;
+  }
+
+  return shift;
+}
+
+static struct arena_chunk *arena_alloc_chunk(struct arena *arena) {
+  struct arena_chunk *chunk =
+      malloc(sizeof(struct arena_chunk) + arena->chunk_size);
+  chunk->next = NULL;
+  return chunk;
+}
+
+void arena_reset(struct arena *arena) {
+  arena->curr = arena->chunks;
+  arena->curr_offset = 0;
+
+  memset(arena->free, 0, sizeof(arena->free));
+}
+
+void arena_free(struct arena *arena, void *ptr, int size) {
+  int shift = arena_size_class(size);
+
+  *(void **)ptr = arena->free[shift];
+  arena->free[shift] = ptr;
+}
+
+void *arena_alloc(struct arena *arena, int size) {
+  int shift = arena_size_class(size);
+  int class_size = 1 << shift;
+  CHECK_LE(class_size, arena->chunk_size);
+
+  /* reuse a previously freed allocation if available */
+  void *ptr = arena->free[shift];
+
+  if (ptr) {
+    arena->free[shift] = *(void **)ptr;
+    memset(ptr, 0, size);
+    return ptr;
+  }
+
+  /* else, carve it out of the current chunk, moving on to the next chunk if
+     there isn't enough room left */
+  if (arena->curr_offset + class_size > arena->chunk_size) {
+    if (!arena->curr->next) {
+      arena->curr->next = arena_alloc_chunk(arena);
+    }
+
+    arena->curr = arena->curr->next;
+    arena->curr_offset = 0;
+  }
+
+  ptr = arena->curr->data + arena->curr_offset;
+  arena->curr_offset += class_size;
+
+  memset(ptr, 0, size);
+  return ptr;
+}
+
+void arena_destroy(struct arena *arena) {
+  struct arena_chunk *chunk = arena->chunks;
+
+  while (chunk) {
+    struct arena_chunk *next = chunk->next;
+    free(chunk);
+    chunk = next;
+  }
+
+  free(arena);
+}
+
+struct arena *arena_create(int chunk_size) {
+  struct arena *arena = calloc(1, sizeof(struct arena));
+
+  arena->chunk_size = chunk_size;
+  arena->chunks = arena_alloc_chunk(arena);
+
+  arena_reset(arena);
+
+  return arena;
+}
@@ -0,0 +1,19 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+/*
+ * simple arena allocator. allocations are carved out of large chunks, and
+ * freed allocations are kept on per size class free lists for reuse. the
+ * entire arena can be reset at once, without freeing each allocation
+ */
+
+struct arena;
+
+struct arena *arena_create(int chunk_size);
+void arena_destroy(struct arena *arena);
+
+void *arena_alloc(struct arena *arena, int size);
+void arena_free(struct arena *arena, void *ptr, int size);
+void arena_reset(struct arena *arena);
+
+#endif
@@ -1,25 +1,104 @@
 #include "core/exception_handler.h"
 #include "core/core.h"
+#include "core/interval_tree.h"
 #include "core/list.h"
+#include "core/profiler.h"
+#include "core/sort.h"
+#include "core/thread.h"
+#include "core/time.h"
 
 #define MAX_EXCEPTION_HANDLERS 32
 
+/* most handlers claiming an address that could be called for one exception */
+#define MAX_EXCEPTION_CANDIDATES 8
+
+/* profiler counters are never unregistered, so they're shared by every
+   handler added with the same name */
+struct exception_counters {
+  char name[32];
+  prof_token_t count;
+  prof_token_t time;
+};
+
 struct exception_handler {
   void *data;
   exception_handler_cb cb;
+  struct list ranges;
   struct list_node it;
+  struct exception_counters *counters;
+  struct exception_stats stats;
 };
 
+/* handlers are added and removed by multiple instances, each on their own
+   thread, while other threads may be faulting. the lists and range trees are
+   only accessed with the mutex held */
+static mutex_t handlers_mutex;
 static struct exception_handler handlers[MAX_EXCEPTION_HANDLERS];
 static struct list live_handlers;
 static struct list free_handlers;
 
-static void exception_handler_install() {
+/* the address ranges owned by each handler, indexed by the exception's pc or
+   fault address respectively */
+static struct rb_tree range_trees[EX_NUM_RANGE_TYPES];
+
+static struct exception_counters counters[MAX_EXCEPTION_HANDLERS];
+static int num_counters;
+
+static struct exception_counters *exception_counters_get(const char *name) {
+  for (int i = 0; i < num_counters; i++) {
+    if (!strncmp(counters[i].name, name, sizeof(counters[i].name) - 1)) {
+      return &counters[i];
+    }
+  }
+
+  CHECK_LT(num_counters, MAX_EXCEPTION_HANDLERS);
+
+  struct exception_counters *c = &counters[num_counters++];
+  strncpy(c->name, name, sizeof(c->name) - 1);
+  c->count = prof_get_aggregate_token(name);
+  c->time = prof_get_aggregate_token(name);
+  return c;
+}
+
+/* track the most frequent sites with the space-saving algorithm, replacing
+   the least frequent site when a new one doesn't fit */
+static void exception_record_site(struct exception_site *sites,
+                                  uintptr_t addr) {
+  struct exception_site *min = &sites[0];
+
+  for (int i = 0; i < EXCEPTION_MAX_SITES; i++) {
+    struct exception_site *site = &sites[i];
+
+    if (site->count && site->addr == addr) {
+      site->count++;
+      return;
+    }
+
+    if (site->count < min->count) {
+      min = site;
+    }
+  }
+
+  min->addr = addr;
+  min->count++;
+}
+
+static int exception_site_cmp(const void *a, const void *b) {
+  const struct exception_site *lhs = a;
+  const struct exception_site *rhs = b;
+  return lhs->count >= rhs->count;
+}
+
+CONSTRUCTOR(exception_handler_init) {
+  handlers_mutex = mutex_create();
+
   for (int i = 0; i < MAX_EXCEPTION_HANDLERS; i++) {
     struct exception_handler *handler = &handlers[i];
     list_add(&free_handlers, &handler->it);
   }
+}
 
+static void exception_handler_install() {
   int res = exception_handler_install_platform();
   CHECK(res);
 }
@@ -28,8 +107,39 @@ static void exception_handler_uninstall() {
   exception_handler_uninstall_platform();
 }
 
-struct exception_handler *exception_handler_add(void *data,
+static void exception_range_unlink(struct exception_range *range) {
+  interval_tree_remove(&range_trees[range->type], &range->tree_it);
+  list_remove(&range->handler->ranges, &range->list_it);
+  range->handler = NULL;
+}
+
+void exception_handler_add_range(struct exception_handler *handler,
+                                 struct exception_range *range,
+                                 enum exception_range_type type,
+                                 uintptr_t begin, uintptr_t end) {
+  CHECK_LT(begin, end);
+
+  range->handler = handler;
+  range->type = type;
+  range->tree_it.low = begin;
+  range->tree_it.high = end - 1;
+
+  mutex_lock(handlers_mutex);
+  interval_tree_insert(&range_trees[type], &range->tree_it);
+  list_add(&handler->ranges, &range->list_it);
+  mutex_unlock(handlers_mutex);
+}
+
+void exception_handler_remove_range(struct exception_range *range) {
+  mutex_lock(handlers_mutex);
+  exception_range_unlink(range);
+  mutex_unlock(handlers_mutex);
+}
+
+struct exception_handler *exception_handler_add(const char *name, void *data,
                                                 exception_handler_cb cb) {
+  mutex_lock(handlers_mutex);
+
   if (list_empty(&live_handlers)) {
     exception_handler_install();
   }
@@ -43,26 +153,141 @@ struct exception_handler *exception_handler_add(void *data,
   /* add to live list */
   handler->data = data;
   handler->cb = cb;
+  list_clear(&handler->ranges);
+  handler->counters = exception_counters_get(name);
+  memset(&handler->stats, 0, sizeof(handler->stats));
+  handler->stats.name = handler->counters->name;
   list_add(&live_handlers, &handler->it);
 
+  mutex_unlock(handlers_mutex);
+
   return handler;
 }
 
 void exception_handler_remove(struct exception_handler *handler) {
+  mutex_lock(handlers_mutex);
+
+  list_for_each_entry_safe(range, &handler->ranges, struct exception_range,
+                           list_it) {
+    exception_range_unlink(range);
+  }
+
   list_remove(&live_handlers, &handler->it);
   list_add(&free_handlers, &handler->it);
 
   if (list_empty(&live_handlers)) {
     exception_handler_uninstall();
   }
+
+  mutex_unlock(handlers_mutex);
+}
+
+static int exception_add_candidate(struct exception_handler **candidates,
+                                   int num_candidates,
+                                   struct exception_handler *handler) {
+  for (int i = 0; i < num_candidates; i++) {
+    if (candidates[i] == handler) {
+      return num_candidates;
+    }
+  }
+
+  if (num_candidates >= MAX_EXCEPTION_CANDIDATES) {
+    return num_candidates;
+  }
+
+  candidates[num_candidates++] = handler;
+  return num_candidates;
+}
+
+static int exception_find_candidates(struct exception_state *ex,
+                                     struct exception_handler **candidates) {
+  uintptr_t addrs[EX_NUM_RANGE_TYPES];
+  addrs[EX_RANGE_PC] = ex->pc;
+  addrs[EX_RANGE_FAULT_ADDR] = ex->fault_addr;
+  int n = 0;
+
+  /* handlers owning the faulting code come first, then those owning the
+     faulting address */
+  for (int type = 0; type < EX_NUM_RANGE_TYPES; type++) {
+    struct interval_tree_it it;
+    struct interval_node *node =
+        interval_tree_iter_first(&range_trees[type], addrs[type], addrs[type],
+                                 &it);
+
+    while (node) {
+      struct exception_range *range =
+          container_of(node, struct exception_range, tree_it);
+      n = exception_add_candidate(candidates, n, range->handler);
+      node = interval_tree_iter_next(&it);
+    }
+  }
+
+  return n;
 }
 
 int exception_handler_handle(struct exception_state *ex) {
-  list_for_each_entry(handler, &live_handlers, struct exception_handler, it) {
-    if (handler->cb(handler->data, ex)) {
-      return 1;
+  int64_t start = time_nanoseconds();
+  ex->guest_pc = 0;
+
+  /* exceptions are raised synchronously by the faulting thread, which never
+     holds the mutex at that point. the callbacks are made after releasing it,
+     leaving them free to add and remove ranges. the handlers found belong to
+     the faulting instance, so they aren't removed while being called */
+  struct exception_handler *candidates[MAX_EXCEPTION_CANDIDATES];
+  mutex_lock(handlers_mutex);
+  int num_candidates = exception_find_candidates(ex, candidates);
+  mutex_unlock(handlers_mutex);
+
+  for (int i = 0; i < num_candidates; i++) {
+    struct exception_handler *handler = candidates[i];
+
+    if (!handler->cb(handler->data, ex)) {
+      continue;
+    }
+
+    int64_t elapsed = time_nanoseconds() - start;
+    struct exception_stats *stats = &handler->stats;
+    stats->count++;
+    stats->time += elapsed;
+    exception_record_site(stats->pcs, ex->pc);
+    exception_record_site(stats->fault_addrs, ex->fault_addr);
+    if (ex->guest_pc) {
+      exception_record_site(stats->guest_pcs, ex->guest_pc);
     }
+
+    prof_counter_add(handler->counters->count, 1);
+    prof_counter_add(handler->counters->time, elapsed);
+
+    return 1;
   }
 
   return 0;
 }
+
+int exception_handler_stats(struct exception_stats *stats, int max) {
+  int n = 0;
+
+  mutex_lock(handlers_mutex);
+
+  list_for_each_entry(handler, &live_handlers, struct exception_handler, it) {
+    if (n >= max) {
+      break;
+    }
+
+    struct exception_stats *s = &stats[n++];
+    *s = handler->stats;
+    s->count_per_sec = prof_counter_load(handler->counters->count);
+    s->time_per_sec = prof_counter_load(handler->counters->time);
+
+    msort(s->pcs, EXCEPTION_MAX_SITES, sizeof(s->pcs[0]),
+          &exception_site_cmp);
+    msort(s->guest_pcs, EXCEPTION_MAX_SITES, sizeof(s->guest_pcs[0]),
+          &exception_site_cmp);
+    msort(s->fault_addrs, EXCEPTION_MAX_SITES, sizeof(s->fault_addrs[0]),
+          &exception_site_cmp);
+  }
+
+  mutex_unlock(handlers_mutex);
+
+  return n;
+}
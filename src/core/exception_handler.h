@@ -2,6 +2,8 @@
 #define EXCEPTION_HANDLER_H
 
 #include <stdint.h>
+#include "core/interval_tree.h"
+#include "core/list.h"
 
 struct exception_state;
 struct exception_handler;
@@ -43,15 +45,71 @@ struct exception_state {
   enum exception_type type;
   uintptr_t fault_addr;
   uintptr_t pc;
+  /* set by handlers able to attribute the exception to a guest instruction,
+     for the statistics below */
+  uint32_t guest_pc;
   struct thread_state thread_state;
 };
 
+/* each handler counts the exceptions it handled and the time spent handling
+   them, as well as the sites faulting most often. the time doesn't include
+   the cost of delivering the signal and returning from it, which is often
+   the larger part. counts are approximate when multiple threads fault at
+   once */
+#define EXCEPTION_MAX_SITES 8
+
+struct exception_site {
+  uintptr_t addr;
+  int64_t count;
+};
+
+struct exception_stats {
+  const char *name;
+  int64_t count;
+  int64_t time;
+  /* exceptions handled during the last second, from the profiler */
+  int64_t count_per_sec;
+  int64_t time_per_sec;
+  struct exception_site pcs[EXCEPTION_MAX_SITES];
+  struct exception_site guest_pcs[EXCEPTION_MAX_SITES];
+  struct exception_site fault_addrs[EXCEPTION_MAX_SITES];
+};
+
 int exception_handler_install_platform();
 void exception_handler_uninstall_platform();
 
-struct exception_handler *exception_handler_add(void *data,
+/* handlers register the host address ranges they own, either the code which
+   may fault or the memory which may be faulted on. exceptions are dispatched
+   through a lookup of these ranges, so a handler is only called for its own
+   exceptions */
+enum exception_range_type {
+  EX_RANGE_PC,
+  EX_RANGE_FAULT_ADDR,
+  EX_NUM_RANGE_TYPES,
+};
+
+struct exception_range {
+  struct exception_handler *handler;
+  enum exception_range_type type;
+  struct interval_node tree_it;
+  struct list_node list_it;
+};
+
+struct exception_handler *exception_handler_add(const char *name, void *data,
                                                 exception_handler_cb cb);
 void exception_handler_remove(struct exception_handler *handler);
+
+/* the range is owned by the caller, and covers [begin, end). any ranges left
+   when the handler is removed are removed with it */
+void exception_handler_add_range(struct exception_handler *handler,
+                                 struct exception_range *range,
+                                 enum exception_range_type type,
+                                 uintptr_t begin, uintptr_t end);
+void exception_handler_remove_range(struct exception_range *range);
 int exception_handler_handle(struct exception_state *ex);
 
+/* copy out the statistics of up to max live handlers, returning how many
+   were copied. sites are sorted by count, unused ones having a zero count */
+int exception_handler_stats(struct exception_stats *stats, int max);
+
 #endif
@@ -1,6 +1,7 @@
 #ifndef FILES_H
 #define FILES_H
 
+#include <stdint.h>
 #include <stdio.h>
 
 #if PLATFORM_ANDROID || PLATFORM_DARWIN || PLATFORM_LINUX
@@ -42,6 +43,8 @@ void fs_realpath(const char *path, char *resolved, size_t size);
 int fs_exists(const char *path);
 int fs_isdir(const char *path);
 int fs_isfile(const char *path);
+/* get the size and modification time of a file */
+int fs_stat(const char *path, int64_t *size, int64_t *mtime);
 int fs_mkdir(const char *path);
 
 #endif
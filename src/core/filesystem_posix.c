@@ -20,6 +20,16 @@ int fs_isfile(const char *path) {
   return (buffer.st_mode & S_IFREG) == S_IFREG;
 }
 
+int fs_stat(const char *path, int64_t *size, int64_t *mtime) {
+  struct stat buffer;
+  if (stat(path, &buffer) != 0) {
+    return 0;
+  }
+  *size = (int64_t)buffer.st_size;
+  *mtime = (int64_t)buffer.st_mtime;
+  return 1;
+}
+
 int fs_isdir(const char *path) {
   struct stat buffer;
   if (stat(path, &buffer) != 0) {
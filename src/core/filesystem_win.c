@@ -19,6 +19,16 @@ int fs_isfile(const char *path) {
   return (buffer.st_mode & S_IFREG) == S_IFREG;
 }
 
+int fs_stat(const char *path, int64_t *size, int64_t *mtime) {
+  struct _stat64 buffer;
+  if (_stat64(path, &buffer) != 0) {
+    return 0;
+  }
+  *size = (int64_t)buffer.st_size;
+  *mtime = (int64_t)buffer.st_mtime;
+  return 1;
+}
+
 int fs_isdir(const char *path) {
   struct _stat buffer;
   if (_stat(path, &buffer) != 0) {
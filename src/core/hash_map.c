@@ -0,0 +1,293 @@
+#include "core/hash_map.h"
+#include "core/simd.h"
+
+#define HASH_MAP_GROUP_SIZE 16
+
+/* control bytes of slots without a node. full slots store the low 7 bits of
+   their key's hash, so the sign bit alone tells them apart */
+#define HASH_MAP_EMPTY ((int8_t)-128)
+#define HASH_MAP_DELETED ((int8_t)-2)
+
+/* groups are matched into a mask with a bit per slot, or a nibble per slot on
+   neon, which lacks a movemask instruction */
+#if SIMD_NEON
+#define HASH_MAP_MASK_SHIFT 2
+#else
+#define HASH_MAP_MASK_SHIFT 0
+#endif
+
+static inline uint64_t hash_map_hash(uint64_t key) {
+  /* murmur3's finalizer, the map's capacity is a power of two so every bit of
+     the key needs to affect the low bits of the hash */
+  key ^= key >> 33;
+  key *= UINT64_C(0xff51afd7ed558ccd);
+  key ^= key >> 33;
+  key *= UINT64_C(0xc4ceb9fe1a85ec53);
+  key ^= key >> 33;
+  return key;
+}
+
+static inline int8_t hash_map_h2(uint64_t hash) {
+  return (int8_t)(hash & 0x7f);
+}
+
+static inline int hash_map_h1(uint64_t hash) {
+  return (int)(hash >> 7);
+}
+
+static inline uint64_t hash_map_match(const int8_t *group, int8_t h2) {
+#if SIMD_SSE2
+  __m128i ctrl = _mm_loadu_si128((const __m128i *)group);
+  __m128i cmp = _mm_cmpeq_epi8(ctrl, _mm_set1_epi8(h2));
+  return (uint64_t)_mm_movemask_epi8(cmp);
+#elif SIMD_NEON
+  uint8x16_t cmp = vceqq_s8(vld1q_s8(group), vdupq_n_s8(h2));
+  uint8x8_t nibbles = vshrn_n_u16(vreinterpretq_u16_u8(cmp), 4);
+  return vget_lane_u64(vreinterpret_u64_u8(nibbles), 0) &
+         UINT64_C(0x8888888888888888);
+#else
+  uint64_t mask = 0;
+  for (int i = 0; i < HASH_MAP_GROUP_SIZE; i++) {
+    mask |= (uint64_t)(group[i] == h2) << i;
+  }
+  return mask;
+#endif
+}
+
+static inline uint64_t hash_map_match_free(const int8_t *group) {
+  /* matches empty and deleted slots */
+#if SIMD_SSE2
+  __m128i ctrl = _mm_loadu_si128((const __m128i *)group);
+  return (uint64_t)_mm_movemask_epi8(ctrl);
+#elif SIMD_NEON
+  uint8x16_t cmp = vcltzq_s8(vld1q_s8(group));
+  uint8x8_t nibbles = vshrn_n_u16(vreinterpretq_u16_u8(cmp), 4);
+  return vget_lane_u64(vreinterpret_u64_u8(nibbles), 0) &
+         UINT64_C(0x8888888888888888);
+#else
+  uint64_t mask = 0;
+  for (int i = 0; i < HASH_MAP_GROUP_SIZE; i++) {
+    mask |= (uint64_t)(group[i] < 0) << i;
+  }
+  return mask;
+#endif
+}
+
+static inline int hash_map_mask_index(uint64_t mask) {
+  return ctz64(mask) >> HASH_MAP_MASK_SHIFT;
+}
+
+static inline int hash_map_capacity(const struct hash_map *map) {
+  return map->num_groups * HASH_MAP_GROUP_SIZE;
+}
+
+/* the map is kept at most 7/8 full, so each probe sequence hits an empty
+   slot before wrapping around */
+static inline int hash_map_max_size(int num_groups) {
+  return num_groups * HASH_MAP_GROUP_SIZE * 7 / 8;
+}
+
+static int hash_map_find_slot(const struct hash_map *map, uint64_t key) {
+  if (!map->num_groups) {
+    return -1;
+  }
+
+  uint64_t hash = hash_map_hash(key);
+  int8_t h2 = hash_map_h2(hash);
+  int group_mask = map->num_groups - 1;
+  int group = hash_map_h1(hash) & group_mask;
+
+  /* groups are probed triangularly, visiting every group once */
+  for (int i = 1;; i++) {
+    const int8_t *ctrl = &map->ctrl[group * HASH_MAP_GROUP_SIZE];
+    uint64_t mask = hash_map_match(ctrl, h2);
+
+    while (mask) {
+      int slot = group * HASH_MAP_GROUP_SIZE + hash_map_mask_index(mask);
+
+      if (map->slots[slot].key == key) {
+        return slot;
+      }
+
+      mask &= mask - 1;
+    }
+
+    /* the key would have been inserted into the first free slot found, stop
+       once an empty one is found */
+    if (hash_map_match(ctrl, HASH_MAP_EMPTY)) {
+      return -1;
+    }
+
+    group = (group + i) & group_mask;
+  }
+}
+
+static int hash_map_find_free_slot(const struct hash_map *map, uint64_t hash) {
+  int group_mask = map->num_groups - 1;
+  int group = hash_map_h1(hash) & group_mask;
+
+  for (int i = 1;; i++) {
+    const int8_t *ctrl = &map->ctrl[group * HASH_MAP_GROUP_SIZE];
+    uint64_t mask = hash_map_match_free(ctrl);
+
+    if (mask) {
+      return group * HASH_MAP_GROUP_SIZE + hash_map_mask_index(mask);
+    }
+
+    group = (group + i) & group_mask;
+  }
+}
+
+static void hash_map_set_slot(struct hash_map *map, int slot, uint64_t hash,
+                              uint64_t key, struct hash_map_node *n) {
+  if (map->ctrl[slot] == HASH_MAP_EMPTY) {
+    map->growth_left--;
+  }
+
+  map->ctrl[slot] = hash_map_h2(hash);
+  map->slots[slot].key = key;
+  map->slots[slot].node = n;
+  map->size++;
+}
+
+static void hash_map_resize(struct hash_map *map, int num_groups) {
+  int8_t *old_ctrl = map->ctrl;
+  struct hash_map_slot *old_slots = map->slots;
+  int old_capacity = hash_map_capacity(map);
+
+  int capacity = num_groups * HASH_MAP_GROUP_SIZE;
+
+  /* the slots and their control bytes share an allocation */
+  map->slots = malloc(capacity * (sizeof(struct hash_map_slot) + 1));
+  map->ctrl = (int8_t *)(map->slots + capacity);
+  memset(map->ctrl, HASH_MAP_EMPTY, capacity);
+  map->num_groups = num_groups;
+  map->size = 0;
+  map->growth_left = hash_map_max_size(num_groups);
+
+  for (int i = 0; i < old_capacity; i++) {
+    if (old_ctrl[i] < 0) {
+      continue;
+    }
+
+    struct hash_map_slot *old = &old_slots[i];
+    uint64_t hash = hash_map_hash(old->key);
+    int slot = hash_map_find_free_slot(map, hash);
+    hash_map_set_slot(map, slot, hash, old->key, old->node);
+  }
+
+  free(old_slots);
+}
+
+static void hash_map_grow(struct hash_map *map) {
+  /* when the map is mostly deleted slots, rehash it in place to reclaim them
+     rather than growing it */
+  int num_groups = MAX(map->num_groups, 1);
+
+  if (map->size > hash_map_max_size(num_groups) / 2) {
+    num_groups *= 2;
+  }
+
+  hash_map_resize(map, num_groups);
+}
+
+struct hash_map_node *hash_map_next(const struct hash_map *map,
+                                    const struct hash_map_node *n) {
+  int capacity = hash_map_capacity(map);
+  int slot = hash_map_find_slot(map, n->key);
+  CHECK_NE(slot, -1);
+
+  for (slot = slot + 1; slot < capacity; slot++) {
+    if (map->ctrl[slot] >= 0) {
+      return map->slots[slot].node;
+    }
+  }
+
+  return NULL;
+}
+
+struct hash_map_node *hash_map_first(const struct hash_map *map) {
+  int capacity = hash_map_capacity(map);
+
+  for (int slot = 0; slot < capacity; slot++) {
+    if (map->ctrl[slot] >= 0) {
+      return map->slots[slot].node;
+    }
+  }
+
+  return NULL;
+}
+
+struct hash_map_node *hash_map_find(const struct hash_map *map, uint64_t key) {
+  int slot = hash_map_find_slot(map, key);
+  return slot == -1 ? NULL : map->slots[slot].node;
+}
+
+void hash_map_remove(struct hash_map *map, struct hash_map_node *n) {
+  int slot = hash_map_find_slot(map, n->key);
+  CHECK_NE(slot, -1);
+  CHECK_EQ(map->slots[slot].node, n);
+
+  /* if the slot's group has an empty slot, no probe sequence for another key
+     could have continued on past it, so it can be emptied. otherwise, it's
+     marked deleted to keep those sequences going */
+  int group = slot / HASH_MAP_GROUP_SIZE;
+  const int8_t *ctrl = &map->ctrl[group * HASH_MAP_GROUP_SIZE];
+
+  if (hash_map_match(ctrl, HASH_MAP_EMPTY)) {
+    map->ctrl[slot] = HASH_MAP_EMPTY;
+    map->growth_left++;
+  } else {
+    map->ctrl[slot] = HASH_MAP_DELETED;
+  }
+
+  map->size--;
+}
+
+struct hash_map_node *hash_map_insert(struct hash_map *map, uint64_t key,
+                                      struct hash_map_node *n) {
+  int existing = hash_map_find_slot(map, key);
+
+  if (existing != -1) {
+    return map->slots[existing].node;
+  }
+
+  if (!map->growth_left) {
+    hash_map_grow(map);
+  }
+
+  uint64_t hash = hash_map_hash(key);
+  int slot = hash_map_find_free_slot(map, hash);
+
+  n->key = key;
+  hash_map_set_slot(map, slot, hash, key, n);
+
+  return n;
+}
+
+void hash_map_reserve(struct hash_map *map, int size) {
+  int num_groups = MAX(map->num_groups, 1);
+
+  while (hash_map_max_size(num_groups) < size) {
+    num_groups *= 2;
+  }
+
+  if (num_groups != map->num_groups) {
+    hash_map_resize(map, num_groups);
+  }
+}
+
+void hash_map_clear(struct hash_map *map) {
+  if (!map->num_groups) {
+    return;
+  }
+
+  memset(map->ctrl, HASH_MAP_EMPTY, hash_map_capacity(map));
+  map->size = 0;
+  map->growth_left = hash_map_max_size(map->num_groups);
+}
+
+void hash_map_destroy(struct hash_map *map) {
+  free(map->slots);
+  memset(map, 0, sizeof(*map));
+}
@@ -0,0 +1,77 @@
+#ifndef HASH_MAP_H
+#define HASH_MAP_H
+
+#include "core/core.h"
+
+/*
+ * intrusive open-addressing hash map, keyed by 64-bit integers
+ *
+ * entries embed a hash_map_node, and the map stores each entry's key and node
+ * pointer inline in a flat slot array, so lookups compare keys without
+ * touching the entries and nothing is allocated per entry. slots are probed a
+ * group at a time, using a byte of metadata per slot holding 7 bits of the
+ * key's hash, which are compared for the entire group at once with simd
+ *
+ * entries don't move when others are removed, so they may be removed while
+ * iterating. inserting may rehash the map, invalidating any iteration
+ */
+
+struct hash_map_node {
+  uint64_t key;
+};
+
+struct hash_map_slot {
+  uint64_t key;
+  struct hash_map_node *node;
+};
+
+/* a zeroed hash_map is a valid empty map */
+struct hash_map {
+  int8_t *ctrl;
+  struct hash_map_slot *slots;
+  int num_groups;
+  int size;
+  /* inserts left before the map must be rehashed */
+  int growth_left;
+};
+
+void hash_map_destroy(struct hash_map *map);
+void hash_map_clear(struct hash_map *map);
+void hash_map_reserve(struct hash_map *map, int size);
+
+/* inserts the node under key, unless another node already has it, in which
+   case that node is returned instead */
+struct hash_map_node *hash_map_insert(struct hash_map *map, uint64_t key,
+                                      struct hash_map_node *n);
+void hash_map_remove(struct hash_map *map, struct hash_map_node *n);
+struct hash_map_node *hash_map_find(const struct hash_map *map, uint64_t key);
+
+struct hash_map_node *hash_map_first(const struct hash_map *map);
+struct hash_map_node *hash_map_next(const struct hash_map *map,
+                                    const struct hash_map_node *n);
+
+#define hash_map_size(map) ((map)->size)
+
+#define hash_map_entry(n, type, member) container_of_safe(n, type, member)
+
+#define hash_map_find_entry(map, key, type, member) \
+  hash_map_entry(hash_map_find(map, key), type, member)
+
+#define hash_map_first_entry(map, type, member) \
+  hash_map_entry(hash_map_first(map), type, member)
+
+#define hash_map_next_entry(map, entry, type, member) \
+  hash_map_entry(hash_map_next(map, &(entry)->member), type, member)
+
+#define hash_map_for_each_entry(it, map, type, member)         \
+  for (type *it = hash_map_first_entry(map, type, member); it; \
+       it = hash_map_next_entry(map, it, type, member))
+
+#define hash_map_for_each_entry_safe(it, map, type, member)                   \
+  for (type *it = hash_map_first_entry(map, type, member),                    \
+            *it##_next = it ? hash_map_next_entry(map, it, type, member)      \
+                            : NULL;                                           \
+       it; it = it##_next,                                                    \
+            it##_next = it ? hash_map_next_entry(map, it, type, member) : NULL)
+
+#endif
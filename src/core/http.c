@@ -0,0 +1,492 @@
+#include "core/http.h"
+#include "core/core.h"
+
+#if PLATFORM_WINDOWS
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+typedef int SOCKET;
+#define INVALID_SOCKET -1
+#define closesocket close
+#endif
+
+#define HTTP_MAX_HEADERS 8192
+#define HTTP_BUFFER_SIZE 65536
+#define HTTP_TIMEOUT_MS 10000
+/* a kept-alive connection may have been closed by the server since the last
+   request, so requests are retried on a new connection */
+#define HTTP_MAX_ATTEMPTS 3
+
+/* largest object http_get reads whole, it's meant for small objects such as a
+   gdi rather than the tracks it lists */
+#define HTTP_MAX_GET_SIZE (64 * 1024 * 1024)
+
+struct http_response {
+  int status;
+  /* size of the body, or -1 if it runs until the connection is closed */
+  int64_t length;
+  /* offset of the body's first byte into the object */
+  int64_t start;
+  /* size of the entire object, or -1 if unknown */
+  int64_t total;
+  int close;
+  char etag[128];
+};
+
+struct http {
+  char host[256];
+  int port;
+  SOCKET sock;
+
+  /* data received past the end of what's been consumed */
+  uint8_t buf[HTTP_BUFFER_SIZE];
+  int buf_pos;
+  int buf_len;
+};
+
+static void http_close(struct http *http) {
+  if (http->sock != INVALID_SOCKET) {
+    closesocket(http->sock);
+    http->sock = INVALID_SOCKET;
+  }
+
+  http->buf_pos = 0;
+  http->buf_len = 0;
+}
+
+static int http_connect(struct http *http) {
+  char port[16];
+  snprintf(port, sizeof(port), "%d", http->port);
+
+  struct addrinfo hints = {0};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+
+  struct addrinfo *info = NULL;
+  if (getaddrinfo(http->host, port, &hints, &info) || !info) {
+    LOG_WARNING("http_connect failed to resolve %s", http->host);
+    return 0;
+  }
+
+  for (struct addrinfo *it = info; it; it = it->ai_next) {
+    SOCKET sock = socket(it->ai_family, it->ai_socktype, it->ai_protocol);
+
+    if (sock == INVALID_SOCKET) {
+      continue;
+    }
+
+    if (connect(sock, it->ai_addr, (int)it->ai_addrlen)) {
+      closesocket(sock);
+      continue;
+    }
+
+    http->sock = sock;
+    break;
+  }
+
+  freeaddrinfo(info);
+
+  if (http->sock == INVALID_SOCKET) {
+    LOG_WARNING("http_connect failed to connect to %s:%d", http->host,
+                http->port);
+    return 0;
+  }
+
+  /* don't hang forever on a server which stops responding */
+#if PLATFORM_WINDOWS
+  DWORD timeout = HTTP_TIMEOUT_MS;
+#else
+  struct timeval timeout = {HTTP_TIMEOUT_MS / 1000, 0};
+#endif
+  setsockopt(http->sock, SOL_SOCKET, SO_RCVTIMEO, (const char *)&timeout,
+             sizeof(timeout));
+  setsockopt(http->sock, SOL_SOCKET, SO_SNDTIMEO, (const char *)&timeout,
+             sizeof(timeout));
+
+  int nodelay = 1;
+  setsockopt(http->sock, IPPROTO_TCP, TCP_NODELAY, (const char *)&nodelay,
+             sizeof(nodelay));
+
+  return 1;
+}
+
+static int http_send(struct http *http, const char *data, int size) {
+  while (size > 0) {
+    int n = (int)send(http->sock, data, size, 0);
+
+    if (n <= 0) {
+      return 0;
+    }
+
+    data += n;
+    size -= n;
+  }
+
+  return 1;
+}
+
+static int http_fill(struct http *http) {
+  if (http->buf_pos < http->buf_len) {
+    return 1;
+  }
+
+  int n = (int)recv(http->sock, (char *)http->buf, sizeof(http->buf), 0);
+
+  if (n <= 0) {
+    return 0;
+  }
+
+  http->buf_pos = 0;
+  http->buf_len = n;
+
+  return 1;
+}
+
+/* reads up to size bytes of the body, returning 0 once the connection is
+   closed */
+static int http_recv(struct http *http, uint8_t *dst, int64_t size) {
+  if (!http_fill(http)) {
+    return 0;
+  }
+
+  int n = (int)MIN(size, (int64_t)(http->buf_len - http->buf_pos));
+
+  if (dst) {
+    memcpy(dst, http->buf + http->buf_pos, n);
+  }
+
+  http->buf_pos += n;
+
+  return n;
+}
+
+static int http_read_headers(struct http *http, char *headers, int size) {
+  int len = 0;
+
+  while (1) {
+    if (!http_fill(http)) {
+      return 0;
+    }
+
+    /* copy byte by byte so the body following the headers is left buffered */
+    while (http->buf_pos < http->buf_len) {
+      if (len == size - 1) {
+        LOG_WARNING("http_read_headers headers are too large");
+        return 0;
+      }
+
+      headers[len++] = (char)http->buf[http->buf_pos++];
+
+      if (len >= 4 && !memcmp(headers + len - 4, "\r\n\r\n", 4)) {
+        headers[len] = 0;
+        return 1;
+      }
+    }
+  }
+}
+
+static const char *http_find_header(const char *headers, const char *name) {
+  int len = (int)strlen(name);
+
+  for (const char *line = strstr(headers, "\r\n"); line;
+       line = strstr(line + 2, "\r\n")) {
+    const char *key = line + 2;
+
+    if (!strncasecmp(key, name, len) && key[len] == ':') {
+      const char *value = key + len + 1;
+
+      while (*value == ' ') {
+        value++;
+      }
+
+      return value;
+    }
+  }
+
+  return NULL;
+}
+
+static int http_parse_response(const char *headers,
+                               struct http_response *res) {
+  memset(res, 0, sizeof(*res));
+  res->length = -1;
+  res->total = -1;
+
+  if (sscanf(headers, "HTTP/%*d.%*d %d", &res->status) != 1) {
+    return 0;
+  }
+
+  /* http/1.0 servers close the connection after each response */
+  res->close = !strncmp(headers, "HTTP/1.0", 8);
+
+  const char *value = http_find_header(headers, "Connection");
+  if (value) {
+    res->close = !strncasecmp(value, "close", 5);
+  }
+
+  value = http_find_header(headers, "Transfer-Encoding");
+  if (value && strncasecmp(value, "identity", 8)) {
+    LOG_WARNING("http_parse_response unsupported transfer encoding");
+    return 0;
+  }
+
+  value = http_find_header(headers, "Content-Length");
+  if (value) {
+    res->length = strtoll(value, NULL, 10);
+  }
+
+  /* partial responses say where the body is in the object */
+  value = http_find_header(headers, "Content-Range");
+  if (value) {
+    const char *total = strchr(value, '/');
+
+    sscanf(value, "bytes %" SCNd64, &res->start);
+
+    if (total && total[1] != '*') {
+      res->total = strtoll(total + 1, NULL, 10);
+    }
+  } else if (res->status == 200) {
+    res->total = res->length;
+  }
+
+  value = http_find_header(headers, "ETag");
+  if (value) {
+    int n = (int)strcspn(value, "\r\n");
+    n = MIN(n, (int)sizeof(res->etag) - 1);
+    memcpy(res->etag, value, n);
+    res->etag[n] = 0;
+  }
+
+  return 1;
+}
+
+static int http_request(struct http *http, const char *path, int64_t offset,
+                        int64_t size, struct http_response *res) {
+  if (http->sock == INVALID_SOCKET && !http_connect(http)) {
+    return 0;
+  }
+
+  char req[2048];
+  int len = snprintf(req, sizeof(req),
+                     "GET %s HTTP/1.1\r\n"
+                     "Host: %s\r\n"
+                     "Accept-Encoding: identity\r\n",
+                     path, http->host);
+
+  if (size >= 0) {
+    len += snprintf(req + len, sizeof(req) - len,
+                    "Range: bytes=%" PRId64 "-%" PRId64 "\r\n", offset,
+                    offset + size - 1);
+  }
+
+  len += snprintf(req + len, sizeof(req) - len, "\r\n");
+
+  if (len >= (int)sizeof(req)) {
+    LOG_WARNING("http_request path is too long");
+    return 0;
+  }
+
+  char headers[HTTP_MAX_HEADERS];
+
+  if (!http_send(http, req, len) ||
+      !http_read_headers(http, headers, sizeof(headers)) ||
+      !http_parse_response(headers, res)) {
+    http_close(http);
+    return 0;
+  }
+
+  return 1;
+}
+
+/* copies the part of the body overlapping [offset, offset + size) to dst,
+   discarding the rest */
+static int64_t http_read_body(struct http *http, struct http_response *res,
+                              int64_t offset, int64_t size, uint8_t *dst) {
+  int64_t pos = res->start;
+  int64_t end = res->length >= 0 ? res->start + res->length : INT64_MAX;
+  int64_t read = 0;
+
+  while (pos < end) {
+    int64_t want = end - pos;
+    uint8_t *ptr = NULL;
+
+    if (pos < offset) {
+      want = MIN(want, offset - pos);
+    } else if (pos < offset + size) {
+      want = MIN(want, offset + size - pos);
+      ptr = dst + (pos - offset);
+    }
+
+    int n = http_recv(http, ptr, want);
+
+    if (!n) {
+      break;
+    }
+
+    if (ptr) {
+      read += n;
+    }
+
+    pos += n;
+  }
+
+  /* the connection can only be reused once the body has been consumed */
+  if (pos < end && res->length >= 0) {
+    http_close(http);
+    return -1;
+  }
+
+  if (res->close || res->length < 0) {
+    http_close(http);
+  }
+
+  return read;
+}
+
+int64_t http_get_range(struct http *http, const char *path, int64_t offset,
+                       int64_t size, void *dst, struct http_object *obj) {
+  for (int attempt = 0; attempt < HTTP_MAX_ATTEMPTS; attempt++) {
+    struct http_response res;
+
+    if (!http_request(http, path, offset, size, &res)) {
+      continue;
+    }
+
+    /* reading past the end of the object */
+    if (res.status == 416) {
+      http_read_body(http, &res, 0, 0, NULL);
+
+      if (obj) {
+        obj->size = res.total;
+        snprintf(obj->etag, sizeof(obj->etag), "%s", res.etag);
+      }
+
+      return 0;
+    }
+
+    if (res.status != 200 && res.status != 206) {
+      LOG_WARNING("http_get_range %s failed with status %d", path, res.status);
+      http_read_body(http, &res, 0, 0, NULL);
+      return -1;
+    }
+
+    int64_t read = http_read_body(http, &res, offset, size, dst);
+
+    if (read < 0) {
+      continue;
+    }
+
+    if (obj) {
+      obj->size = res.total;
+      snprintf(obj->etag, sizeof(obj->etag), "%s", res.etag);
+    }
+
+    return read;
+  }
+
+  LOG_WARNING("http_get_range failed to read %s", path);
+
+  return -1;
+}
+
+uint8_t *http_get(struct http *http, const char *path, int64_t *size) {
+  struct http_object obj;
+
+  /* find out the size with a single byte read first */
+  uint8_t first;
+  if (http_get_range(http, path, 0, 1, &first, &obj) < 0 || obj.size < 0) {
+    return NULL;
+  }
+
+  /* the size comes from the server, don't trust it with an allocation of any
+     size */
+  if (obj.size > HTTP_MAX_GET_SIZE) {
+    LOG_WARNING("http_get %s is too large, %" PRId64 " bytes", path,
+                obj.size);
+    return NULL;
+  }
+
+  uint8_t *data = malloc(obj.size + 1);
+  if (!data) {
+    return NULL;
+  }
+
+  int64_t read = http_get_range(http, path, 0, obj.size, data, NULL);
+
+  if (read != obj.size) {
+    free(data);
+    return NULL;
+  }
+
+  data[obj.size] = 0;
+  *size = obj.size;
+
+  return data;
+}
+
+int http_parse_url(const char *url, char *host, int host_size, int *port,
+                   char *path, int path_size) {
+  const char *scheme = "http://";
+
+  if (strncmp(url, scheme, strlen(scheme))) {
+    return 0;
+  }
+
+  const char *begin = url + strlen(scheme);
+  const char *end = begin + strcspn(begin, ":/");
+
+  if (end == begin || end - begin >= host_size) {
+    return 0;
+  }
+
+  memcpy(host, begin, end - begin);
+  host[end - begin] = 0;
+
+  *port = 80;
+
+  if (*end == ':') {
+    *port = (int)strtol(end + 1, (char **)&end, 10);
+  }
+
+  if (*end && *end != '/') {
+    return 0;
+  }
+
+  snprintf(path, path_size, "%s", *end ? end : "/");
+
+  return 1;
+}
+
+void http_destroy(struct http *http) {
+  http_close(http);
+
+#if PLATFORM_WINDOWS
+  WSACleanup();
+#endif
+
+  free(http);
+}
+
+struct http *http_create(const char *host, int port) {
+#if PLATFORM_WINDOWS
+  WSADATA wsadata;
+  if (WSAStartup(MAKEWORD(2, 2), &wsadata)) {
+    LOG_WARNING("http_create failed to initialize winsock");
+    return NULL;
+  }
+#endif
+
+  struct http *http = calloc(1, sizeof(struct http));
+
+  snprintf(http->host, sizeof(http->host), "%s", host);
+  http->port = port;
+  http->sock = INVALID_SOCKET;
+
+  return http;
+}
@@ -0,0 +1,37 @@
+#ifndef HTTP_H
+#define HTTP_H
+
+#include <stdint.h>
+
+/*
+ * minimal blocking http/1.1 client, reading byte ranges of objects over a
+ * connection that's kept alive between requests. connections aren't
+ * thread-safe, each thread making requests needs its own
+ */
+struct http;
+
+struct http_object {
+  /* size of the entire object */
+  int64_t size;
+  /* etag the server identified the object's contents with, if any */
+  char etag[128];
+};
+
+/* splits an http:// url into its host, port and path */
+int http_parse_url(const char *url, char *host, int host_size, int *port,
+                   char *path, int path_size);
+
+struct http *http_create(const char *host, int port);
+void http_destroy(struct http *http);
+
+/* reads [offset, offset + size) of the object at path into dst, returning the
+   number of bytes read or -1 on failure. reads are only short at the end of
+   the object */
+int64_t http_get_range(struct http *http, const char *path, int64_t offset,
+                       int64_t size, void *dst, struct http_object *obj);
+
+/* reads an entire object, returning a null terminated copy of it to be freed
+   by the caller */
+uint8_t *http_get(struct http *http, const char *path, int64_t *size);
+
+#endif
@@ -1,30 +1,62 @@
 #include <stdarg.h>
 #include <stdio.h>
+#include <string.h>
 #include "core/log.h"
+#include "core/assert.h"
+#include "core/thread.h"
+#include "core/time.h"
 
 #if PLATFORM_ANDROID
 #include <android/log.h>
 #endif
 
-void log_line(enum log_level level, const char *format, ...) {
-  static char sbuffer[0x1000];
-  int buffer_size = sizeof(sbuffer);
-  char *buffer = sbuffer;
+/*
+ * when async, messages are formatted into slots of a bounded lock-free queue
+ * by the calling thread, and written out in order by a background thread.
+ * messages too long for a slot, and fatal messages, are written out directly
+ * after flushing the queue
+ */
+#define LOG_NUM_SLOTS 512
+#define LOG_SLOT_SIZE 512
 
-  /* allocate a temporary buffer if need be to fit the string */
-  va_list args;
-  va_start(args, format);
-  int len = vsnprintf(0, 0, format, args);
-  if (len >= buffer_size) {
-    buffer_size = len + 1;
-    buffer = malloc(buffer_size);
-  }
-  va_end(args);
+/* background thread's polling interval, it's also woken early after every
+   half queue's worth of messages */
+#define LOG_FLUSH_MS 10
 
-  va_start(args, format);
-  vsnprintf(buffer, buffer_size, format, args);
-  va_end(args);
+/* messages logged from the same call site beyond the burst in each window are
+   dropped while async, with a count of them written once the window ends */
+#define LOG_RATE_SLOTS 64
+#define LOG_RATE_BURST 16
+#define LOG_RATE_WINDOW NS_PER_SEC
+
+struct log_slot {
+  volatile int seq;
+  enum log_level level;
+  char text[LOG_SLOT_SIZE];
+};
+
+struct log_rate {
+  const char *format;
+  int64_t window_start;
+  int count;
+  int suppressed;
+};
+
+static struct log_slot log_slots[LOG_NUM_SLOTS];
+static volatile int log_head;
+static volatile int log_dropped;
+
+/* consumer state, guarded by log_mutex */
+static int log_tail;
+static mutex_t log_mutex;
+static cond_t log_cond;
+static thread_t log_thread;
+static int log_shutdown;
+
+static volatile int log_async;
+static _Thread_local struct log_rate log_rates[LOG_RATE_SLOTS];
 
+static void log_write(enum log_level level, const char *buffer) {
 #if PLATFORM_ANDROID
   static const char *LOG_TAG = "redream";
 
@@ -54,6 +86,209 @@ void log_line(enum log_level level, const char *format, ...) {
 #else
   printf("%s\n", buffer);
 #endif
+}
+
+static void log_drain() {
+  /* called with log_mutex held */
+  while (1) {
+    struct log_slot *slot = &log_slots[(unsigned)log_tail % LOG_NUM_SLOTS];
+
+    if (atomic_load_int(&slot->seq) != log_tail + 1) {
+      break;
+    }
+
+    log_write(slot->level, slot->text);
+
+    atomic_store_int(&slot->seq, log_tail + LOG_NUM_SLOTS);
+    log_tail++;
+  }
+
+  int dropped = atomic_load_int(&log_dropped);
+
+  if (dropped) {
+    atomic_fetch_add_int(&log_dropped, -dropped);
+
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "log dropped %d messages", dropped);
+    log_write(LOG_LEVEL_WARNING, buffer);
+  }
+
+  fflush(stdout);
+}
+
+static int log_enqueue(enum log_level level, const char *text, int len) {
+  int pos = atomic_load_int(&log_head);
+  struct log_slot *slot;
+
+  while (1) {
+    slot = &log_slots[(unsigned)pos % LOG_NUM_SLOTS];
+    int diff = atomic_load_int(&slot->seq) - pos;
+
+    if (diff == 0) {
+      if (atomic_cas_int(&log_head, pos, pos + 1)) {
+        break;
+      }
+      pos = atomic_load_int(&log_head);
+    } else if (diff < 0) {
+      /* the queue is full */
+      return 0;
+    } else {
+      pos = atomic_load_int(&log_head);
+    }
+  }
+
+  slot->level = level;
+  memcpy(slot->text, text, len + 1);
+  atomic_store_int(&slot->seq, pos + 1);
+
+  /* wake the background thread early rather than dropping messages */
+  if ((unsigned)pos % (LOG_NUM_SLOTS / 2) == 0) {
+    cond_signal(log_cond);
+  }
+
+  return 1;
+}
+
+static void *log_thread_main(void *data) {
+  mutex_lock(log_mutex);
+
+  while (!log_shutdown) {
+    cond_timedwait(log_cond, log_mutex, LOG_FLUSH_MS);
+    log_drain();
+  }
+
+  mutex_unlock(log_mutex);
+
+  return NULL;
+}
+
+static int log_rate_limit(const char *format) {
+  struct log_rate *rate =
+      &log_rates[((uintptr_t)format >> 3) % LOG_RATE_SLOTS];
+  int64_t now = time_nanoseconds();
+
+  if (rate->format != format || now - rate->window_start >= LOG_RATE_WINDOW) {
+    if (rate->suppressed) {
+      char buffer[LOG_SLOT_SIZE];
+      snprintf(buffer, sizeof(buffer), "log suppressed %d repeats of \"%s\"",
+               rate->suppressed, rate->format);
+      int len = (int)strlen(buffer);
+
+      if (!log_enqueue(LOG_LEVEL_WARNING, buffer, len)) {
+        atomic_fetch_add_int(&log_dropped, 1);
+      }
+    }
+
+    rate->format = format;
+    rate->window_start = now;
+    rate->count = 0;
+    rate->suppressed = 0;
+  }
+
+  if (rate->count >= LOG_RATE_BURST) {
+    rate->suppressed++;
+    return 1;
+  }
+
+  rate->count++;
+  return 0;
+}
+
+void log_flush() {
+  if (!log_async) {
+    fflush(stdout);
+    return;
+  }
+
+  mutex_lock(log_mutex);
+  log_drain();
+  mutex_unlock(log_mutex);
+}
+
+void log_set_async(int async) {
+  if (async == log_async) {
+    return;
+  }
+
+  if (async) {
+    static int initialized;
+
+    if (!initialized) {
+      for (int i = 0; i < LOG_NUM_SLOTS; i++) {
+        log_slots[i].seq = i;
+      }
+
+      log_mutex = mutex_create();
+      log_cond = cond_create();
+
+      /* write out whatever is still queued on exit */
+      atexit(&log_flush);
+      initialized = 1;
+    }
+
+    log_shutdown = 0;
+    log_thread = thread_create(&log_thread_main, "log", NULL);
+    CHECK_NOTNULL(log_thread);
+
+    atomic_store_int(&log_async, 1);
+  } else {
+    atomic_store_int(&log_async, 0);
+
+    mutex_lock(log_mutex);
+    log_shutdown = 1;
+    cond_signal(log_cond);
+    mutex_unlock(log_mutex);
+
+    void *result;
+    thread_join(log_thread, &result);
+    log_thread = NULL;
+
+    /* messages may have been queued after the thread's last drain */
+    mutex_lock(log_mutex);
+    log_drain();
+    mutex_unlock(log_mutex);
+  }
+}
+
+void log_line(enum log_level level, const char *format, ...) {
+  int async = atomic_load_int(&log_async);
+
+  if (async && level != LOG_LEVEL_FATAL && log_rate_limit(format)) {
+    return;
+  }
+
+  char sbuffer[LOG_SLOT_SIZE];
+  int buffer_size = sizeof(sbuffer);
+  char *buffer = sbuffer;
+
+  /* allocate a temporary buffer if need be to fit the string */
+  va_list args;
+  va_start(args, format);
+  int len = vsnprintf(buffer, buffer_size, format, args);
+  va_end(args);
+
+  if (len >= buffer_size) {
+    buffer_size = len + 1;
+    buffer = malloc(buffer_size);
+
+    va_start(args, format);
+    vsnprintf(buffer, buffer_size, format, args);
+    va_end(args);
+  }
+
+  if (async && buffer == sbuffer && level != LOG_LEVEL_FATAL) {
+    if (!log_enqueue(level, buffer, len)) {
+      atomic_fetch_add_int(&log_dropped, 1);
+    }
+  } else if (async) {
+    /* write out the queued messages first to keep them in order */
+    mutex_lock(log_mutex);
+    log_drain();
+    log_write(level, buffer);
+    mutex_unlock(log_mutex);
+  } else {
+    log_write(level, buffer);
+  }
 
   /* cleanup the temporary buffer */
   if (buffer != sbuffer) {
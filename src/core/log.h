@@ -20,6 +20,11 @@ enum log_level {
 
 void log_line(enum log_level level, const char *format, ...);
 
+/* when async, messages are written out from a background thread and repeated
+   messages are rate limited. log_flush writes out any queued messages */
+void log_set_async(int async);
+void log_flush();
+
 #ifndef NDEBUG
 #if COMPILER_MSVC
 #define DEBUGBREAK() __debugbreak()
@@ -4,6 +4,42 @@
 #include "core/exception_handler.h"
 #include "core/interval_tree.h"
 #include "core/list.h"
+#include "core/thread.h"
+
+/* distance between each address tried by alloc_pages_near */
+#define NEAR_SEARCH_STEP (16 * 1024 * 1024)
+
+void *alloc_pages_near(const void *near, size_t range, size_t size,
+                       enum page_access access) {
+  uintptr_t origin = ALIGN_DOWN((uintptr_t)near, NEAR_SEARCH_STEP);
+
+  /* near may be up to a step above the aligned origin */
+  if (size + NEAR_SEARCH_STEP > range) {
+    return NULL;
+  }
+
+  /* search outwards from near, alternating between the addresses below and
+     above it. the allocation mustn't wrap around either end of the address
+     space */
+  for (uintptr_t offset = NEAR_SEARCH_STEP;
+       offset <= range - size - NEAR_SEARCH_STEP; offset += NEAR_SEARCH_STEP) {
+    if (origin >= offset + size) {
+      void *ptr = alloc_pages((void *)(origin - offset - size), size, access);
+      if (ptr) {
+        return ptr;
+      }
+    }
+
+    if (origin + offset + size > origin) {
+      void *ptr = alloc_pages((void *)(origin + offset), size, access);
+      if (ptr) {
+        return ptr;
+      }
+    }
+  }
+
+  return NULL;
+}
 
 #define MAX_WATCHES 8192
 
@@ -13,103 +49,283 @@ struct memory_watch {
   void *data;
   struct interval_node tree_it;
   struct list_node list_it;
+  /* the watched pages are registered with the exception handler, so only
+     faults on them are routed to the watcher */
+  struct exception_range exc_range;
+
+  /* set while the watch's pages are waiting on flush_memory_watches to be
+     protected */
+  int pending;
+  struct interval_node pending_it;
 };
 
 struct memory_watcher {
   struct exception_handler *exc_handler;
+  /* when set, watches are serviced by poll_memory_watches rather than by
+     faults */
+  struct write_tracker *tracker;
+  /* watches are added and removed by the owning instance, while faults may
+     be serviced on any of its threads */
+  mutex_t mutex;
   struct rb_tree tree;
   struct memory_watch watches[MAX_WATCHES];
   struct list free_watches;
   struct list live_watches;
-};
 
-static struct memory_watcher *watcher;
+  /* watches whose pages haven't been protected yet. protecting is deferred
+     such that the watches added each frame can be coalesced into as few
+     mprotect calls as possible */
+  struct rb_tree pending_tree;
 
-static int watcher_handle_exception(void *ctx, struct exception_state *ex);
-
-static void watcher_create() {
-  watcher = calloc(1, sizeof(struct memory_watcher));
+  /* scratch space for the coalesced ranges of the live watches, which are
+     gathered before polling as firing a watch unlinks it from the tree */
+  struct interval_node ranges[MAX_WATCHES];
+};
 
-  watcher->exc_handler = exception_handler_add(NULL, &watcher_handle_exception);
+static void watcher_unlink(struct memory_watcher *watcher,
+                           struct memory_watch *watch) {
+  /* remove from interval trees */
+  interval_tree_remove(&watcher->tree, &watch->tree_it);
+  if (!watcher->tracker) {
+    exception_handler_remove_range(&watch->exc_range);
+  }
 
-  for (int i = 0; i < MAX_WATCHES; i++) {
-    struct memory_watch *watch = &watcher->watches[i];
-    list_add(&watcher->free_watches, &watch->list_it);
+  if (watch->pending) {
+    interval_tree_remove(&watcher->pending_tree, &watch->pending_it);
+    watch->pending = 0;
   }
+
+  /* remove from live list */
+  list_remove(&watcher->live_watches, &watch->list_it);
+
+  /* add to free list */
+  list_add(&watcher->free_watches, &watch->list_it);
 }
 
-static void watcher_destroy() {
-  exception_handler_remove(watcher->exc_handler);
+/* restore write access to the pages in [low, high] which are no longer
+   covered by any live watch. pages shared with other watches must stay
+   protected for them */
+static void watcher_unprotect(struct memory_watcher *watcher, uintptr_t low,
+                              uintptr_t high) {
+  uintptr_t begin = low;
 
-  free(watcher);
+  /* the iterator visits overlapping watches in ascending order of their low
+     address, so the uncovered gaps can be found in a single pass */
+  struct interval_tree_it it;
+  struct interval_node *n =
+      interval_tree_iter_first(&watcher->tree, low, high, &it);
+
+  while (n) {
+    if (n->low > begin) {
+      CHECK(protect_pages((void *)begin, n->low - begin, ACC_READWRITE));
+    }
 
-  watcher = NULL;
+    begin = MAX(begin, n->high + 1);
+
+    /* the last watch extends past the end of the range */
+    if (begin > high || !begin) {
+      return;
+    }
+
+    n = interval_tree_iter_next(&it);
+  }
+
+  CHECK(protect_pages((void *)begin, (high - begin) + 1, ACC_READWRITE));
 }
 
 static int watcher_handle_exception(void *ctx, struct exception_state *ex) {
+  struct memory_watcher *watcher = ctx;
   int handled = 0;
+  uintptr_t low = UINTPTR_MAX;
+  uintptr_t high = 0;
 
-  struct interval_tree_it it;
-  struct interval_node *n = interval_tree_iter_first(
-      &watcher->tree, ex->fault_addr, ex->fault_addr, &it);
+  mutex_lock(watcher->mutex);
 
-  while (n) {
+  /* every watch is page aligned, so each watch overlapping the faulting page
+     is found here and serviced by this single fault */
+  struct interval_node *n;
+
+  while ((n = interval_tree_find(&watcher->tree, ex->fault_addr,
+                                 ex->fault_addr))) {
     handled = 1;
 
-    struct interval_node *next = interval_tree_iter_next(&it);
     struct memory_watch *watch = container_of(n, struct memory_watch, tree_it);
 
+    low = MIN(low, n->low);
+    high = MAX(high, n->high);
+
     /* call callback for this access watch */
     watch->cb(ex, watch->data);
 
-    if (watch->type == WATCH_SINGLE_WRITE) {
-      /* restore page permissions */
-      uintptr_t aligned_begin = n->low;
-      size_t aligned_size = (n->high - n->low) + 1;
-      CHECK(protect_pages((void *)aligned_begin, aligned_size, ACC_READWRITE));
+    watcher_unlink(watcher, watch);
+  }
+
+  if (handled) {
+    /* restore page permissions */
+    watcher_unprotect(watcher, low, high);
+  }
+
+  mutex_unlock(watcher->mutex);
+
+  return handled;
+}
+
+/* fire each flushed watch overlapping the written pages in [begin, end) */
+static void watcher_handle_written(void *data, uintptr_t begin,
+                                   uintptr_t end) {
+  struct memory_watcher *watcher = data;
+
+  while (1) {
+    /* unlinking a watch invalidates the iterator, restart after each one */
+    struct interval_tree_it it;
+    struct interval_node *n =
+        interval_tree_iter_first(&watcher->tree, begin, end - 1, &it);
+    struct memory_watch *watch = NULL;
+
+    while (n) {
+      watch = container_of(n, struct memory_watch, tree_it);
+
+      if (!watch->pending) {
+        break;
+      }
+
+      n = interval_tree_iter_next(&it);
+    }
+
+    if (!n) {
+      break;
+    }
+
+    watch->cb(NULL, watch->data);
+    watcher_unlink(watcher, watch);
+  }
+}
+
+static void watcher_poll(struct memory_watcher *watcher) {
+  /* coalesce the ranges of the flushed watches, scanning each once. the
+     pages of pending watches haven't started being tracked yet */
+  int num_ranges = 0;
+
+  rb_for_each_entry(n, &watcher->tree, struct interval_node, rb) {
+    struct memory_watch *watch = container_of(n, struct memory_watch, tree_it);
+
+    if (watch->pending) {
+      continue;
+    }
+
+    struct interval_node *last =
+        num_ranges ? &watcher->ranges[num_ranges - 1] : NULL;
 
-      remove_memory_watch(watch);
+    if (last && n->low <= last->high + 1) {
+      last->high = MAX(last->high, n->high);
+      continue;
     }
 
-    n = next;
+    watcher->ranges[num_ranges].low = n->low;
+    watcher->ranges[num_ranges].high = n->high;
+    num_ranges++;
+  }
+
+  for (int i = 0; i < num_ranges; i++) {
+    struct interval_node *range = &watcher->ranges[i];
+    CHECK(write_tracker_scan(watcher->tracker, (void *)range->low,
+                             (range->high - range->low) + 1,
+                             &watcher_handle_written, watcher));
   }
+}
 
-  if (watcher && !watcher->tree.root) {
-    watcher_destroy();
+void poll_memory_watches(struct memory_watcher *watcher) {
+  if (!watcher->tracker) {
+    return;
   }
 
-  return handled;
+  mutex_lock(watcher->mutex);
+  watcher_poll(watcher);
+  mutex_unlock(watcher->mutex);
 }
 
-void remove_memory_watch(struct memory_watch *watch) {
-  /* remove from interval tree */
-  interval_tree_remove(&watcher->tree, &watch->tree_it);
+static void watcher_protect(struct memory_watcher *watcher, uintptr_t begin,
+                            uintptr_t end) {
+  size_t size = (end - begin) + 1;
 
-  /* remove from live list */
-  list_remove(&watcher->live_watches, &watch->list_it);
+  if (watcher->tracker) {
+    CHECK(write_tracker_reset(watcher->tracker, (void *)begin, size));
+  } else {
+    CHECK(protect_pages((void *)begin, size, ACC_READONLY));
+  }
+}
 
-  /* add to free list */
-  list_add(&watcher->free_watches, &watch->list_it);
+void flush_memory_watches(struct memory_watcher *watcher) {
+  mutex_lock(watcher->mutex);
+
+  /* resetting the pending pages also resets any they share with flushed
+     watches, so fire those for writes made since the last poll first */
+  if (watcher->tracker) {
+    watcher_poll(watcher);
+  }
+
+  /* walk the pending watches in address order, merging overlapping and
+     adjacent page ranges into a single mprotect call */
+  uintptr_t begin = 0;
+  uintptr_t end = 0;
+  int have_range = 0;
+
+  rb_for_each_entry(n, &watcher->pending_tree, struct interval_node, rb) {
+    struct memory_watch *watch =
+        container_of(n, struct memory_watch, pending_it);
+    watch->pending = 0;
+
+    if (have_range && n->low <= end + 1) {
+      end = MAX(end, n->high);
+      continue;
+    }
+
+    if (have_range) {
+      watcher_protect(watcher, begin, end);
+    }
 
-  if (!watcher->tree.root) {
-    watcher_destroy();
+    begin = n->low;
+    end = n->high;
+    have_range = 1;
   }
+
+  if (have_range) {
+    watcher_protect(watcher, begin, end);
+  }
+
+  interval_tree_clear(&watcher->pending_tree);
+
+  mutex_unlock(watcher->mutex);
 }
 
-struct memory_watch *add_single_write_watch(const void *ptr, size_t size,
-                                            memory_watch_cb cb, void *data) {
-  if (!watcher) {
-    watcher_create();
+void remove_memory_watch(struct memory_watcher *watcher,
+                         struct memory_watch *watch) {
+  mutex_lock(watcher->mutex);
+
+  int pending = watch->pending;
+  uintptr_t low = watch->tree_it.low;
+  uintptr_t high = watch->tree_it.high;
+
+  watcher_unlink(watcher, watch);
+
+  /* a pending watch never had its pages protected. tracked pages are left
+     protected, the kernel resolves writes to them without faulting */
+  if (!pending && !watcher->tracker) {
+    watcher_unprotect(watcher, low, high);
   }
 
+  mutex_unlock(watcher->mutex);
+}
+
+struct memory_watch *add_single_write_watch(struct memory_watcher *watcher,
+                                            const void *ptr, size_t size,
+                                            memory_watch_cb cb, void *data) {
   /* page align the range to be watched */
   size_t page_size = get_page_size();
   uintptr_t aligned_begin = ALIGN_DOWN((uintptr_t)ptr, page_size);
   uintptr_t aligned_end = ALIGN_UP((uintptr_t)ptr + size, page_size) - 1;
-  size_t aligned_size = (aligned_end - aligned_begin) + 1;
 
-  /* disable writing to the pages */
-  CHECK(protect_pages((void *)aligned_begin, aligned_size, ACC_READONLY));
+  mutex_lock(watcher->mutex);
 
   /* allocate new access watch */
   struct memory_watch *watch =
@@ -130,6 +346,68 @@ struct memory_watch *add_single_write_watch(const void *ptr, size_t size,
   watch->tree_it.high = aligned_end;
 
   interval_tree_insert(&watcher->tree, &watch->tree_it);
+  if (!watcher->tracker) {
+    exception_handler_add_range(watcher->exc_handler, &watch->exc_range,
+                                EX_RANGE_FAULT_ADDR, aligned_begin,
+                                aligned_end + 1);
+  }
+
+  /* disabling writes to the pages is deferred until flush_memory_watches */
+  watch->pending = 1;
+  watch->pending_it.low = aligned_begin;
+  watch->pending_it.high = aligned_end;
+
+  interval_tree_insert(&watcher->pending_tree, &watch->pending_it);
+
+  mutex_unlock(watcher->mutex);
 
   return watch;
 }
+
+void memory_watcher_destroy(struct memory_watcher *watcher) {
+  /* restore access to the pages of any remaining watches */
+  while (!list_empty(&watcher->live_watches)) {
+    struct memory_watch *watch = list_first_entry(
+        &watcher->live_watches, struct memory_watch, list_it);
+    remove_memory_watch(watcher, watch);
+  }
+
+  if (watcher->tracker) {
+    write_tracker_destroy(watcher->tracker);
+  } else {
+    exception_handler_remove(watcher->exc_handler);
+  }
+
+  mutex_destroy(watcher->mutex);
+
+  free(watcher);
+}
+
+struct memory_watcher *memory_watcher_create(int poll) {
+  struct memory_watcher *watcher = calloc(1, sizeof(struct memory_watcher));
+
+  watcher->mutex = mutex_create();
+
+  for (int i = 0; i < MAX_WATCHES; i++) {
+    struct memory_watch *watch = &watcher->watches[i];
+    list_add(&watcher->free_watches, &watch->list_it);
+  }
+
+  if (poll) {
+    watcher->tracker = write_tracker_create();
+
+    if (!watcher->tracker) {
+      LOG_WARNING("memory_watcher_create write tracking unsupported, "
+                  "falling back to faulting on writes");
+    }
+  }
+
+  /* the watched pages may be written by any code, so each watch registers
+     its pages as a range of fault addresses */
+  if (!watcher->tracker) {
+    watcher->exc_handler = exception_handler_add("memory watch", watcher,
+                                                 &watcher_handle_exception);
+  }
+
+  return watcher;
+}
@@ -2,6 +2,7 @@
 #define SYS_MEMORY_H
 
 #include <stddef.h>
+#include <stdint.h>
 
 struct exception_state;
 
@@ -16,10 +17,25 @@ enum page_access {
 };
 
 size_t get_page_size();
+size_t get_huge_page_size();
 size_t get_allocation_granularity();
 int protect_pages(void *ptr, size_t size, enum page_access access);
 void *reserve_pages(void *ptr, size_t size);
 int release_pages(void *ptr, size_t size);
+/* allocate pages at ptr, or anywhere when ptr is NULL. like reserve_pages, this
+   fails rather than allocating at a different address than requested. pages
+   allocated by either are freed with release_pages */
+void *alloc_pages(void *ptr, size_t size, enum page_access access);
+/* allocate pages with every byte of the allocation within range bytes of near,
+   e.g. to keep generated code within reach of rel32 calls into the image */
+void *alloc_pages_near(const void *near, size_t range, size_t size,
+                       enum page_access access);
+
+/* let the host merge identical pages of the private allocation with those of
+   any other allocation so advised, including in other processes. on linux
+   this is done by ksm, once enabled through /sys/kernel/mm/ksm/run. shared
+   memory objects can't be merged */
+int advise_mergeable(void *ptr, size_t size);
 
 /*
  * shared memory objects
@@ -30,24 +46,83 @@ typedef void *shmem_handle_t;
 
 shmem_handle_t create_shared_memory(const char *filename, size_t size,
                                     enum page_access access);
+/* create a shared memory object backed by huge pages where the host supports
+   them, returning SHMEM_INVALID otherwise. mappings of the object should be
+   aligned to get_huge_page_size(), while their pages can still be protected
+   individually */
+shmem_handle_t create_huge_shared_memory(const char *filename, size_t size,
+                                         enum page_access access);
 void *map_shared_memory(shmem_handle_t handle, size_t offset, void *start,
                         size_t size, enum page_access access);
 int unmap_shared_memory(shmem_handle_t handle, void *start, size_t size);
 int destroy_shared_memory(shmem_handle_t handle);
 
+/*
+ * read-only file mappings
+ */
+/* map the entire file into memory, returning NULL on failure */
+void *map_file(const char *filename, size_t *size);
+int unmap_file(void *ptr, size_t size);
+
+/*
+ * executable image
+ */
+/* bounds of the code of the image, executable or shared library, this
+   function is linked into. the host randomizes where the image is loaded as
+   a whole, so offsets from begin stay the same between runs. returns 0 when
+   the host doesn't expose them */
+int get_image_code(uintptr_t *begin, uintptr_t *end);
+
+/*
+ * write tracking
+ */
+/* tracks writes to pages through the host's page tables, such that the pages
+   written since they were last reset are queried in bulk, rather than each
+   write faulting to a handler. returns NULL when the host can't do this */
+struct write_tracker;
+
+typedef void (*write_tracker_cb)(void *, uintptr_t begin, uintptr_t end);
+
+struct write_tracker *write_tracker_create();
+void write_tracker_destroy(struct write_tracker *tracker);
+
+/* start tracking writes to the pages in the range, clearing their state */
+int write_tracker_reset(struct write_tracker *tracker, void *ptr, size_t size);
+/* pass each run of pages in the range written since they were last reset to
+   cb as [begin, end), resetting them again */
+int write_tracker_scan(struct write_tracker *tracker, void *ptr, size_t size,
+                       write_tracker_cb cb, void *data);
+
 /*
  * access watches
  */
 struct memory_watch;
+struct memory_watcher;
 
 enum memory_watch_type {
   WATCH_SINGLE_WRITE,
 };
 
+/* the exception state is NULL for watches fired by poll_memory_watches */
 typedef void (*memory_watch_cb)(const struct exception_state *, void *);
 
-struct memory_watch *add_single_write_watch(const void *ptr, size_t size,
+/* each instance owns a watcher for the memory it watches, which only handles
+   faults inside of its own watches. when poll is set and the host supports
+   write tracking, watched pages are never faulted on. instead, the watches
+   whose pages were written fire from poll_memory_watches */
+struct memory_watcher *memory_watcher_create(int poll);
+void memory_watcher_destroy(struct memory_watcher *watcher);
+
+struct memory_watch *add_single_write_watch(struct memory_watcher *watcher,
+                                            const void *ptr, size_t size,
                                             memory_watch_cb cb, void *data);
-void remove_memory_watch(struct memory_watch *watch);
+void remove_memory_watch(struct memory_watcher *watcher,
+                         struct memory_watch *watch);
+/* protect the pages of any watches added since the last flush, coalescing
+   contiguous ranges. watches don't fire until they've been flushed */
+void flush_memory_watches(struct memory_watcher *watcher);
+/* fire the watches whose pages were written since the last poll, when write
+   tracking is in use */
+void poll_memory_watches(struct memory_watcher *watcher);
 
 #endif
@@ -11,11 +11,72 @@
 #include <linux/ashmem.h>
 #endif
 
+#if PLATFORM_LINUX || PLATFORM_ANDROID
+#include <link.h>
+#endif
+
+#if PLATFORM_LINUX
+#include <linux/fs.h>
+#include <linux/userfaultfd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+/* asynchronous write protection and the pagemap scan ioctl were added in
+   linux 6.7, define their abi when building against older headers */
+#ifndef UFFD_FEATURE_WP_ASYNC
+#define UFFD_FEATURE_WP_UNPOPULATED (1 << 13)
+#define UFFD_FEATURE_WP_ASYNC (1 << 15)
+#endif
+
+#ifndef UFFD_USER_MODE_ONLY
+#define UFFD_USER_MODE_ONLY 1
+#endif
+
+#ifndef PAGEMAP_SCAN
+#define PAGE_IS_WRITTEN (1 << 1)
+#define PM_SCAN_WP_MATCHING (1 << 0)
+#define PM_SCAN_CHECK_WPASYNC (1 << 1)
+
+struct page_region {
+  uint64_t start;
+  uint64_t end;
+  uint64_t categories;
+};
+
+struct pm_scan_arg {
+  uint64_t size;
+  uint64_t flags;
+  uint64_t start;
+  uint64_t end;
+  uint64_t walk_end;
+  uint64_t vec;
+  uint64_t vec_len;
+  uint64_t max_pages;
+  uint64_t category_inverted;
+  uint64_t category_mask;
+  uint64_t category_anyof_mask;
+  uint64_t return_mask;
+};
+
+#define PAGEMAP_SCAN _IOWR('f', 16, struct pm_scan_arg)
+#endif
+
+#define HAVE_WRITE_TRACKER 1
+#endif
+
 #define MAX_SHMEM 128
 
+enum {
+  SHMEM_PAGES_DEFAULT,
+  /* backed by a normal shared memory object, each mapping is advised to use
+     transparent huge pages */
+  SHMEM_PAGES_ADVISE,
+};
+
 struct shmem {
   char filename[PATH_MAX];
   int handle;
+  int pages;
   struct list_node free_it;
 };
 
@@ -91,6 +152,41 @@ int protect_pages(void *ptr, size_t size, enum page_access access) {
   return mprotect(ptr, size, prot) == 0;
 }
 
+void *alloc_pages(void *ptr, size_t size, enum page_access access) {
+  int prot = access_to_protect_flags(access);
+  int flags = MAP_PRIVATE | MAP_ANON;
+
+#if PLATFORM_DARWIN
+  /* hardened runtimes only allow executable pages which are writable to be
+     mapped for jit use */
+  if (access == ACC_READWRITEEXEC) {
+    flags |= MAP_JIT;
+  }
+#endif
+
+  /* see reserve_pages for why MAP_FIXED isn't used */
+  void *res = mmap(ptr, size, prot, flags, -1, 0);
+
+  if (res == MAP_FAILED) {
+    return NULL;
+  }
+
+  if (ptr && res != ptr) {
+    munmap(res, size);
+    return NULL;
+  }
+
+  return res;
+}
+
+int advise_mergeable(void *ptr, size_t size) {
+#ifdef MADV_MERGEABLE
+  return madvise(ptr, size, MADV_MERGEABLE) == 0;
+#else
+  return 0;
+#endif
+}
+
 size_t get_allocation_granularity() {
   return get_page_size();
 }
@@ -99,6 +195,10 @@ size_t get_page_size() {
   return getpagesize();
 }
 
+size_t get_huge_page_size() {
+  return 2 * 1024 * 1024;
+}
+
 static void init_shared_memory_entries() {
   if (initialized) {
     return;
@@ -144,17 +244,33 @@ void *map_shared_memory(shmem_handle_t handle, size_t offset, void *start,
   struct shmem *shmem = (struct shmem *)handle;
   int prot = access_to_protect_flags(access);
   int flags = start ? MAP_SHARED | MAP_FIXED : MAP_SHARED;
+
+  /* inaccessible mappings are never faulted in, don't reserve huge pages for
+     them */
+  if (access == ACC_NONE) {
+    flags |= MAP_NORESERVE;
+  }
+
   void *ptr = mmap(start, size, prot, flags, shmem->handle, offset);
 
   if (ptr == MAP_FAILED) {
     return SHMEM_MAP_FAILED;
   }
 
+#ifdef MADV_HUGEPAGE
+  if (shmem->pages == SHMEM_PAGES_ADVISE && access != ACC_NONE) {
+    /* failure here only means the mapping stays on normal pages */
+    madvise(ptr, size, MADV_HUGEPAGE);
+  }
+#endif
+
   return ptr;
 }
 
-shmem_handle_t create_shared_memory(const char *filename, size_t size,
-                                    enum page_access access) {
+static shmem_handle_t create_shared_memory_ex(const char *filename,
+                                             size_t size,
+                                             enum page_access access,
+                                             int pages) {
   init_shared_memory_entries();
 
   /* find unused shmem entry (wrapper for both shmem object name and file
@@ -204,7 +320,229 @@ shmem_handle_t create_shared_memory(const char *filename, size_t size,
   /* update entry, remove from free list */
   strncpy(shmem->filename, filename, sizeof(shmem->filename));
   shmem->handle = handle;
+  shmem->pages = pages;
   list_remove(&free_shmem, &shmem->free_it);
 
   return (shmem_handle_t)shmem;
 }
+
+shmem_handle_t create_shared_memory(const char *filename, size_t size,
+                                    enum page_access access) {
+  return create_shared_memory_ex(filename, size, access, SHMEM_PAGES_DEFAULT);
+}
+
+shmem_handle_t create_huge_shared_memory(const char *filename, size_t size,
+                                         enum page_access access) {
+#if defined(MADV_HUGEPAGE) && !PLATFORM_ANDROID
+  /* use transparent huge pages rather than a hugetlbfs memfd. the kernel
+     splits a transparent huge page when part of it is protected, whereas
+     hugetlbfs mappings can only be protected a whole huge page at a time,
+     which memory watches can't work with */
+  return create_shared_memory_ex(filename, size, access, SHMEM_PAGES_ADVISE);
+#else
+  return SHMEM_INVALID;
+#endif
+}
+
+#if HAVE_WRITE_TRACKER
+/* written page runs returned per scan */
+#define WRITE_TRACKER_MAX_REGIONS 256
+
+/* userfaultfd's asynchronous write protection lets the kernel resolve writes
+   to protected pages by itself, only recording that they were written. the
+   pagemap scan ioctl then finds the written pages and protects them again in
+   a single call */
+struct write_tracker {
+  int uffd;
+  int pagemap;
+};
+
+static int write_tracker_ioctl(struct write_tracker *tracker, uintptr_t begin,
+                               uintptr_t end, write_tracker_cb cb,
+                               void *data) {
+  struct page_region regions[WRITE_TRACKER_MAX_REGIONS];
+
+  while (begin < end) {
+    struct pm_scan_arg arg = {0};
+    arg.size = sizeof(arg);
+    arg.flags = PM_SCAN_WP_MATCHING | PM_SCAN_CHECK_WPASYNC;
+    arg.start = begin;
+    arg.end = end;
+    arg.vec = (uintptr_t)regions;
+    arg.vec_len = cb ? ARRAY_SIZE(regions) : 0;
+    arg.category_mask = PAGE_IS_WRITTEN;
+    arg.return_mask = PAGE_IS_WRITTEN;
+
+    int n = ioctl(tracker->pagemap, PAGEMAP_SCAN, &arg);
+    if (n < 0) {
+      return 0;
+    }
+
+    for (int i = 0; i < n; i++) {
+      cb(data, (uintptr_t)regions[i].start, (uintptr_t)regions[i].end);
+    }
+
+    /* the walk stops early once the regions are full */
+    begin = (uintptr_t)arg.walk_end;
+  }
+
+  return 1;
+}
+
+int write_tracker_scan(struct write_tracker *tracker, void *ptr, size_t size,
+                       write_tracker_cb cb, void *data) {
+  uintptr_t begin = (uintptr_t)ptr;
+  return write_tracker_ioctl(tracker, begin, begin + size, cb, data);
+}
+
+int write_tracker_reset(struct write_tracker *tracker, void *ptr,
+                        size_t size) {
+  /* registering a range is idempotent, and splits the mapping as mprotect
+     would. ranges stay registered until the tracker is destroyed */
+  struct uffdio_register reg = {0};
+  reg.range.start = (uintptr_t)ptr;
+  reg.range.len = size;
+  reg.mode = UFFDIO_REGISTER_MODE_WP;
+
+  if (ioctl(tracker->uffd, UFFDIO_REGISTER, &reg) == -1) {
+    return 0;
+  }
+
+  /* protect the pages written since they were last reset, discarding them */
+  uintptr_t begin = (uintptr_t)ptr;
+  return write_tracker_ioctl(tracker, begin, begin + size, NULL, NULL);
+}
+
+void write_tracker_destroy(struct write_tracker *tracker) {
+  /* closing the userfaultfd unregisters every range */
+  close(tracker->uffd);
+  close(tracker->pagemap);
+  free(tracker);
+}
+
+struct write_tracker *write_tracker_create() {
+  /* only faults from user mode need handling, which doesn't require the
+     privilege unrestricted userfaultfds do */
+  int uffd = (int)syscall(SYS_userfaultfd,
+                          O_CLOEXEC | O_NONBLOCK | UFFD_USER_MODE_ONLY);
+  if (uffd == -1) {
+    return NULL;
+  }
+
+  struct uffdio_api api = {0};
+  api.api = UFFD_API;
+  api.features = UFFD_FEATURE_WP_ASYNC | UFFD_FEATURE_WP_UNPOPULATED |
+                 UFFD_FEATURE_WP_HUGETLBFS_SHMEM;
+
+  if (ioctl(uffd, UFFDIO_API, &api) == -1) {
+    close(uffd);
+    return NULL;
+  }
+
+  int pagemap = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+  if (pagemap == -1) {
+    close(uffd);
+    return NULL;
+  }
+
+  struct write_tracker *tracker = calloc(1, sizeof(struct write_tracker));
+  tracker->uffd = uffd;
+  tracker->pagemap = pagemap;
+
+  return tracker;
+}
+#else
+int write_tracker_scan(struct write_tracker *tracker, void *ptr, size_t size,
+                       write_tracker_cb cb, void *data) {
+  return 0;
+}
+
+int write_tracker_reset(struct write_tracker *tracker, void *ptr,
+                        size_t size) {
+  return 0;
+}
+
+void write_tracker_destroy(struct write_tracker *tracker) {}
+
+struct write_tracker *write_tracker_create() {
+  return NULL;
+}
+#endif
+
+void *map_file(const char *filename, size_t *size) {
+  int fd = open(filename, O_RDONLY);
+  if (fd == -1) {
+    return NULL;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) == -1 || !st.st_size) {
+    close(fd);
+    return NULL;
+  }
+
+  void *ptr = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+  /* the mapping keeps its own reference to the file */
+  close(fd);
+
+  if (ptr == MAP_FAILED) {
+    return NULL;
+  }
+
+  *size = (size_t)st.st_size;
+
+  return ptr;
+}
+
+int unmap_file(void *ptr, size_t size) {
+  return munmap(ptr, size) == 0;
+}
+
+#if PLATFORM_LINUX || PLATFORM_ANDROID
+struct image_code_search {
+  uintptr_t addr;
+  uintptr_t begin;
+  uintptr_t end;
+};
+
+static int image_code_cb(struct dl_phdr_info *info, size_t size, void *data) {
+  struct image_code_search *search = data;
+
+  for (int i = 0; i < info->dlpi_phnum; i++) {
+    const ElfW(Phdr) *phdr = &info->dlpi_phdr[i];
+
+    if (phdr->p_type != PT_LOAD || !(phdr->p_flags & PF_X)) {
+      continue;
+    }
+
+    uintptr_t begin = info->dlpi_addr + phdr->p_vaddr;
+    uintptr_t end = begin + phdr->p_memsz;
+
+    if (search->addr >= begin && search->addr < end) {
+      search->begin = begin;
+      search->end = end;
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+int get_image_code(uintptr_t *begin, uintptr_t *end) {
+  struct image_code_search search = {0};
+  search.addr = (uintptr_t)&get_image_code;
+
+  if (!dl_iterate_phdr(&image_code_cb, &search)) {
+    return 0;
+  }
+
+  *begin = search.begin;
+  *end = search.end;
+  return 1;
+}
+#else
+int get_image_code(uintptr_t *begin, uintptr_t *end) {
+  return 0;
+}
+#endif
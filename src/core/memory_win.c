@@ -46,12 +46,33 @@ void *reserve_pages(void *ptr, size_t size) {
   return res;
 }
 
+void *alloc_pages(void *ptr, size_t size, enum page_access access) {
+  DWORD protect = access_to_protection_flags(access);
+  void *res = VirtualAlloc(ptr, size, MEM_RESERVE | MEM_COMMIT, protect);
+
+  if (!res) {
+    return NULL;
+  }
+
+  if (ptr && res != ptr) {
+    VirtualFree(res, 0, MEM_RELEASE);
+    return NULL;
+  }
+
+  return res;
+}
+
 int protect_pages(void *ptr, size_t size, enum page_access access) {
   DWORD new_protect = access_to_protection_flags(access);
   DWORD old_protect;
   return VirtualProtect(ptr, size, new_protect, &old_protect) != 0;
 }
 
+int advise_mergeable(void *ptr, size_t size) {
+  /* windows only combines identical pages of its own accord */
+  return 0;
+}
+
 size_t get_allocation_granularity() {
   SYSTEM_INFO si;
   GetSystemInfo(&si);
@@ -64,6 +85,10 @@ size_t get_page_size() {
   return si.dwPageSize;
 }
 
+size_t get_huge_page_size() {
+  return GetLargePageMinimum();
+}
+
 int destroy_shared_memory(shmem_handle_t handle) {
   return CloseHandle(handle) != 0;
 }
@@ -98,3 +123,84 @@ shmem_handle_t create_shared_memory(const char *filename, size_t size,
   return CreateFileMapping(INVALID_HANDLE_VALUE, NULL, protect | SEC_RESERVE,
                            (DWORD)(size >> 32), (DWORD)(size), filename);
 }
+
+shmem_handle_t create_huge_shared_memory(const char *filename, size_t size,
+                                         enum page_access access) {
+  /* views of large page sections can only be protected a whole large page at
+     a time, which memory watches can't work with */
+  return SHMEM_INVALID;
+}
+
+/* GetWriteWatch only covers allocations made with MEM_WRITE_WATCH, which
+   shared memory views can't be */
+int write_tracker_scan(struct write_tracker *tracker, void *ptr, size_t size,
+                       write_tracker_cb cb, void *data) {
+  return 0;
+}
+
+int write_tracker_reset(struct write_tracker *tracker, void *ptr,
+                        size_t size) {
+  return 0;
+}
+
+void write_tracker_destroy(struct write_tracker *tracker) {}
+
+struct write_tracker *write_tracker_create() {
+  return NULL;
+}
+
+void *map_file(const char *filename, size_t *size) {
+  HANDLE file = CreateFile(filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+                           OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    return NULL;
+  }
+
+  LARGE_INTEGER file_size;
+  if (!GetFileSizeEx(file, &file_size) || !file_size.QuadPart) {
+    CloseHandle(file);
+    return NULL;
+  }
+
+  HANDLE mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  CloseHandle(file);
+
+  if (!mapping) {
+    return NULL;
+  }
+
+  void *ptr = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+
+  /* the view keeps its own reference to the mapping */
+  CloseHandle(mapping);
+
+  if (!ptr) {
+    return NULL;
+  }
+
+  *size = (size_t)file_size.QuadPart;
+
+  return ptr;
+}
+
+int unmap_file(void *ptr, size_t size) {
+  return UnmapViewOfFile(ptr) != 0;
+}
+
+int get_image_code(uintptr_t *begin, uintptr_t *end) {
+  HMODULE module;
+
+  if (!GetModuleHandleEx(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS |
+                             GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+                         (LPCSTR)&get_image_code, &module)) {
+    return 0;
+  }
+
+  uint8_t *base = (uint8_t *)module;
+  IMAGE_DOS_HEADER *dos = (IMAGE_DOS_HEADER *)base;
+  IMAGE_NT_HEADERS *nt = (IMAGE_NT_HEADERS *)(base + dos->e_lfanew);
+
+  *begin = (uintptr_t)(base + nt->OptionalHeader.BaseOfCode);
+  *end = *begin + nt->OptionalHeader.SizeOfCode;
+  return 1;
+}
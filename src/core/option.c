@@ -87,6 +87,41 @@ static void options_print_help() {
   }
 }
 
+int option_set(const char *name, const char *value) {
+  struct option *opt = options_find(name);
+
+  if (!opt) {
+    return 0;
+  }
+
+  options_parse_value(opt, value);
+  *opt->dirty = 1;
+
+  return 1;
+}
+
+int option_get(const char *name, char *value, int size) {
+  struct option *opt = options_find(name);
+
+  if (!opt) {
+    return 0;
+  }
+
+  snprintf(value, size, "%s", options_format_value(opt));
+
+  return 1;
+}
+
+int option_persistent(const char *name) {
+  struct option *opt = options_find(name);
+
+  if (!opt) {
+    return 0;
+  }
+
+  return (opt->flags & OPTION_PERSIST) != 0;
+}
+
 int options_write(const char *filename) {
   FILE *output = fopen(filename, "wt");
 
@@ -110,19 +145,22 @@ int options_read(const char *filename) {
 }
 
 int options_parse(int *argc, char ***argv) {
-  int end = *argc;
+  int num_opts = 0;
 
-  for (int i = 1; i < end;) {
+  for (int i = 1; i < *argc; i++) {
     char *arg = (*argv)[i];
 
-    /* move non-option to the end for parsing by the application */
+    /* leave non-options for parsing by the application */
     if (arg[0] != '-') {
-      (*argv)[i] = (*argv)[end - 1];
-      (*argv)[end - 1] = arg;
-      end--;
       continue;
     }
 
+    /* move options to the front, keeping the non-options in their original
+       order after them */
+    memmove(&(*argv)[num_opts + 2], &(*argv)[num_opts + 1],
+            (i - num_opts - 1) * sizeof(char *));
+    (*argv)[++num_opts] = arg;
+
     /* chomp leading - */
     while (arg[0] == '-') {
       arg++;
@@ -145,12 +183,10 @@ int options_parse(int *argc, char ***argv) {
     if (opt) {
       options_parse_value(opt, value);
     }
-
-    i++;
   }
 
-  *argc -= end - 1;
-  *argv += end - 1;
+  *argc -= num_opts;
+  *argv += num_opts;
 
   if (OPTION_help) {
     options_print_help();
@@ -73,6 +73,15 @@ struct option {
 void option_register(struct option *option);
 void option_unregister(struct option *option);
 
+/* assign the named option from its string form and mark it dirty, returning 0
+   when no option has the name */
+int option_set(const char *name, const char *value);
+/* copy the string form of the named option's value to value, returning 0 when
+   no option has the name */
+int option_get(const char *name, char *value, int size);
+/* returns 1 when the named option is written back to the config file */
+int option_persistent(const char *name);
+
 int options_parse(int *argc, char ***argv);
 int options_read(const char *filename);
 int options_write(const char *filename);
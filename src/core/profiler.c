@@ -1,75 +1,284 @@
 #include "core/profiler.h"
 #include "core/core.h"
+#include "core/thread.h"
 #include "core/time.h"
 
-#define PROFILER_MAX_COUNTERS 32
+#define PROF_MAX_EVENTS 16384
+
+/* each thread's counter values are allocated in chunks as they're first
+   written, so the shards never move while being summed by another thread */
+#define PROF_COUNTER_CHUNK 64
+#define PROF_MAX_COUNTER_CHUNKS 64
+#define PROF_MAX_COUNTERS (PROF_COUNTER_CHUNK * PROF_MAX_COUNTER_CHUNKS)
+
+enum {
+  PROF_EVENT_ENTER,
+  PROF_EVENT_LEAVE,
+};
+
+struct prof_event {
+  const char *name;
+  int64_t time;
+  int type;
+};
+
+/* events are only written by the owning thread. the exporter reads them from
+   another thread without synchronizing, so the oldest few events of a busy
+   thread may be torn, which is acceptable for a debugging aid. the same goes
+   for the thread's counter shard, which is only written by the owning thread
+   and summed by readers without locking */
+struct prof_thread {
+  int id;
+  /* tracks which don't belong to a thread are named in the trace */
+  const char *name;
+  struct prof_event events[PROF_MAX_EVENTS];
+  volatile uint32_t head;
+  int64_t *volatile counters[PROF_MAX_COUNTER_CHUNKS];
+  struct list_node it;
+};
+
+static _Thread_local struct prof_thread *prof_current;
 
 struct counter {
   int aggregate;
-  int64_t value[2];
+  /* sum of all shards as of the last aggregation, and the amount added
+     during the second leading up to it */
+  int64_t last_total;
+  int64_t value;
 };
 
 static struct {
-  struct counter counters[PROFILER_MAX_COUNTERS];
+  /* counters are shared by every instance in the process. most tokens are
+     registered by constructors, but some are registered later on by whichever
+     thread needs them, so the registry is a fixed array which is never moved
+     while being read. registration and aggregation take the mutex, with only
+     one of the instances calling prof_flip aggregating each second */
+  mutex_t counters_mutex;
+  struct counter counters[PROF_MAX_COUNTERS];
   int num_counters;
 
   int64_t last_aggregation;
+
+  /* thread buffers are never freed, threads may exit while being exported or
+     while their counters are being summed */
+  mutex_t threads_mutex;
+  struct list threads;
+  int num_threads;
+
+  /* track gpu zones are recorded onto, only written by the render thread */
+  struct prof_thread *gpu;
 } prof;
 
-prof_token_t prof_get_next_token() {
-  prof_token_t tok = prof.num_counters++;
-  CHECK_LT(tok, PROFILER_MAX_COUNTERS);
+static struct prof_thread *prof_create_thread(const char *name) {
+  struct prof_thread *thread = calloc(1, sizeof(struct prof_thread));
+  thread->name = name;
+
+  mutex_lock(prof.threads_mutex);
+  thread->id = prof.num_threads++;
+  list_add(&prof.threads, &thread->it);
+  mutex_unlock(prof.threads_mutex);
+
+  return thread;
+}
+
+CONSTRUCTOR(prof_init_threads) {
+  prof.counters_mutex = mutex_create();
+  prof.threads_mutex = mutex_create();
+  prof.gpu = prof_create_thread("gpu");
+}
+
+static struct prof_thread *prof_get_thread() {
+  if (!prof_current) {
+    prof_current = prof_create_thread(NULL);
+  }
+
+  return prof_current;
+}
+
+static void prof_add_event(struct prof_thread *thread, const char *name,
+                           int64_t time, int type) {
+  struct prof_event *ev = &thread->events[thread->head % PROF_MAX_EVENTS];
+  ev->name = name;
+  ev->time = time;
+  ev->type = type;
+  thread->head++;
+}
+
+void prof_gpu_zone(const char *name, int64_t begin, int64_t end) {
+  prof_add_event(prof.gpu, name, begin, PROF_EVENT_ENTER);
+  prof_add_event(prof.gpu, NULL, end, PROF_EVENT_LEAVE);
+}
+
+void prof_enter(const char *name) {
+  prof_add_event(prof_get_thread(), name, time_nanoseconds(),
+                 PROF_EVENT_ENTER);
+}
+
+void prof_leave() {
+  prof_add_event(prof_get_thread(), NULL, time_nanoseconds(),
+                 PROF_EVENT_LEAVE);
+}
+
+static void prof_export_thread(FILE *file, struct prof_thread *thread,
+                               int *first) {
+  uint32_t head = thread->head;
+  uint32_t num_events = MIN(head, PROF_MAX_EVENTS);
+  int depth = 0;
+
+  if (thread->name) {
+    fprintf(file,
+            "%s\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":0,"
+            "\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+            *first ? "" : ",", thread->id, thread->name);
+    *first = 0;
+  }
+
+  for (uint32_t i = head - num_events; i != head; i++) {
+    struct prof_event *ev = &thread->events[i % PROF_MAX_EVENTS];
+    int enter = ev->type == PROF_EVENT_ENTER;
+
+    /* skip leaves whose enter has already been overwritten */
+    if (!enter && !depth) {
+      continue;
+    }
+
+    depth += enter ? 1 : -1;
+
+    fprintf(file, "%s\n{\"ph\":\"%s\",\"ts\":%.3f,\"pid\":0,\"tid\":%d",
+            *first ? "" : ",", enter ? "B" : "E", ev->time / 1000.0,
+            thread->id);
+
+    if (enter) {
+      fprintf(file, ",\"name\":\"%s\"", ev->name);
+    }
+
+    fprintf(file, "}");
+    *first = 0;
+  }
+}
+
+int prof_export_trace(const char *path) {
+  FILE *file = fopen(path, "w");
+
+  if (!file) {
+    return 0;
+  }
+
+  int first = 1;
+
+  fprintf(file, "{\"traceEvents\":[");
+
+  mutex_lock(prof.threads_mutex);
+  list_for_each_entry(thread, &prof.threads, struct prof_thread, it) {
+    prof_export_thread(file, thread, &first);
+  }
+  mutex_unlock(prof.threads_mutex);
+
+  fprintf(file, "\n]}\n");
+
+  return !fclose(file);
+}
+
+static int64_t prof_counter_sum(prof_token_t tok) {
+  int chunk = tok / PROF_COUNTER_CHUNK;
+  int index = tok % PROF_COUNTER_CHUNK;
+  int64_t sum = 0;
+
+  mutex_lock(prof.threads_mutex);
+  list_for_each_entry(thread, &prof.threads, struct prof_thread, it) {
+    int64_t *values = thread->counters[chunk];
+
+    if (values) {
+      sum += values[index];
+    }
+  }
+  mutex_unlock(prof.threads_mutex);
+
+  return sum;
+}
+
+static prof_token_t prof_get_next_token(int aggregate) {
+  /* constructors may run before prof_init_threads */
+  if (prof.counters_mutex) {
+    mutex_lock(prof.counters_mutex);
+  }
+
+  prof_token_t tok = prof.num_counters;
+  CHECK_LT(tok, PROF_MAX_COUNTERS);
+
+  memset(&prof.counters[tok], 0, sizeof(struct counter));
+  prof.counters[tok].aggregate = aggregate;
+  prof.num_counters++;
+
+  if (prof.counters_mutex) {
+    mutex_unlock(prof.counters_mutex);
+  }
+
   return tok;
 }
 
 prof_token_t prof_get_counter_token(const char *name) {
-  prof_token_t tok = prof_get_next_token();
-  struct counter *c = &prof.counters[tok];
-  c->aggregate = 0;
-  return tok;
+  return prof_get_next_token(0);
 }
 
 prof_token_t prof_get_aggregate_token(const char *name) {
-  prof_token_t tok = prof_get_next_token();
-  struct counter *c = &prof.counters[tok];
-  c->aggregate = 1;
-  return tok;
+  return prof_get_next_token(1);
 }
 
 void prof_flip(int64_t now) {
+  /* another instance is already aggregating */
+  if (!mutex_trylock(prof.counters_mutex)) {
+    return;
+  }
+
   /* update time-based aggregate counters every second */
   int64_t next_aggregation = prof.last_aggregation + NS_PER_SEC;
 
   if (now > next_aggregation) {
-    for (int i = 0; i < PROFILER_MAX_COUNTERS; i++) {
+    for (int i = 0; i < prof.num_counters; i++) {
       struct counter *c = &prof.counters[i];
 
       if (c->aggregate) {
-        c->value[0] = c->value[1];
-        c->value[1] = 0;
+        int64_t total = prof_counter_sum(i);
+        c->value = total - c->last_total;
+        c->last_total = total;
       }
     }
 
     prof.last_aggregation = now;
   }
+
+  mutex_unlock(prof.counters_mutex);
 }
 
 void prof_counter_set(prof_token_t tok, int64_t count) {
-  struct counter *c = &prof.counters[tok];
-  c->value[1] = count;
+  /* the calling thread's shard absorbs the difference */
+  prof_counter_add(tok, count - prof_counter_sum(tok));
 }
 
 void prof_counter_add(prof_token_t tok, int64_t count) {
-  struct counter *c = &prof.counters[tok];
-  c->value[1] += count;
+  struct prof_thread *thread = prof_get_thread();
+  int chunk = tok / PROF_COUNTER_CHUNK;
+  int64_t *values = thread->counters[chunk];
+
+  if (!values) {
+    values = calloc(PROF_COUNTER_CHUNK, sizeof(int64_t));
+    thread->counters[chunk] = values;
+  }
+
+  values[tok % PROF_COUNTER_CHUNK] += count;
+}
+
+int64_t prof_counter_total(prof_token_t tok) {
+  return prof_counter_sum(tok);
 }
 
 int64_t prof_counter_load(prof_token_t tok) {
   struct counter *c = &prof.counters[tok];
   if (c->aggregate) {
     /* return the last aggregated value */
-    return c->value[0];
+    return c->value;
   } else {
-    return c->value[1];
+    return prof_counter_sum(tok);
   }
 }
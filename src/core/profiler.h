@@ -27,9 +27,29 @@ prof_token_t prof_get_counter_token(const char *name);
 prof_token_t prof_get_aggregate_token(const char *name);
 
 int64_t prof_counter_load(prof_token_t tok);
+/* everything added to the counter since startup, regardless of aggregation */
+int64_t prof_counter_total(prof_token_t tok);
 void prof_counter_add(prof_token_t tok, int64_t count);
 void prof_counter_set(prof_token_t tok, int64_t count);
 
 void prof_flip(int64_t now);
 
+/* scoped timing zones. each thread records the zones it enters and leaves
+   into its own ring buffer, only the most recent PROF_MAX_EVENTS of which are
+   kept. name must be a string literal */
+#define PROF_ENTER(name) prof_enter(name)
+#define PROF_LEAVE() prof_leave()
+
+void prof_enter(const char *name);
+void prof_leave();
+
+/* zones timed on the gpu, added once their queries have been read back. they
+   are recorded onto a track of their own, with begin and end converted to the
+   time_nanoseconds timebase. name must be a string literal */
+void prof_gpu_zone(const char *name, int64_t begin, int64_t end);
+
+/* write out the zones currently held by each thread in the chrome trace event
+   format, which can be loaded by chrome://tracing or perfetto */
+int prof_export_trace(const char *path);
+
 #endif
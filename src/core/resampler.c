@@ -0,0 +1,239 @@
+#include "core/resampler.h"
+#include "core/core.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define RS_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define RS_NEON 1
+#endif
+
+/* taps per output frame, must be a multiple of 4 for the vectorized dot
+   products */
+#define RS_TAPS 32
+/* number of filter phases between two input frames. the filter for positions
+   in between phases is linearly interpolated from its two neighbors */
+#define RS_PHASES 128
+/* input frames converted to float per pass */
+#define RS_BLOCK 1024
+#define RS_HISTORY (RS_TAPS + RS_BLOCK)
+#define RS_KAISER_BETA 8.0
+
+struct resampler {
+  double base_step;
+  /* input frames advanced per output frame */
+  double step;
+  /* position of the next output frame's first tap in the history */
+  double pos;
+
+  /* RS_PHASES + 1 rows of RS_TAPS coefficients, the extra row letting the last
+     phase be interpolated without wrapping */
+  float coefs[(RS_PHASES + 1) * RS_TAPS];
+
+  /* channels are deinterleaved so each tap window is contiguous */
+  float hist[2][RS_HISTORY];
+  int num_hist;
+};
+
+static double bessel_i0(double x) {
+  double sum = 1.0;
+  double term = 1.0;
+
+  for (int k = 1; k < 32; k++) {
+    double t = x / (2.0 * k);
+    term *= t * t;
+    sum += term;
+  }
+
+  return sum;
+}
+
+static void resampler_init_coefs(struct resampler *rs, double cutoff) {
+  const double half = RS_TAPS / 2;
+
+  for (int p = 0; p <= RS_PHASES; p++) {
+    float *row = &rs->coefs[p * RS_TAPS];
+    double frac = (double)p / RS_PHASES;
+    double sum = 0.0;
+
+    for (int k = 0; k < RS_TAPS; k++) {
+      /* distance from the output frame to this tap, in input frames */
+      double x = (half - 1 - k) + frac;
+      double s = cutoff;
+
+      if (x != 0.0) {
+        s = sin(M_PI * cutoff * x) / (M_PI * x);
+      }
+
+      double w = 0.0;
+      double r = x / half;
+      if (r > -1.0 && r < 1.0) {
+        w = bessel_i0(RS_KAISER_BETA * sqrt(1.0 - r * r)) /
+            bessel_i0(RS_KAISER_BETA);
+      }
+
+      row[k] = (float)(s * w);
+      sum += row[k];
+    }
+
+    /* normalize each phase for unity gain at dc */
+    for (int k = 0; k < RS_TAPS; k++) {
+      row[k] = (float)(row[k] / sum);
+    }
+  }
+}
+
+static inline int16_t resampler_clamp(float v) {
+  v = v >= 0.0f ? v + 0.5f : v - 0.5f;
+  v = MAX(MIN(v, 32767.0f), -32768.0f);
+  return (int16_t)v;
+}
+
+/* filters both channels at the window starting at l and r, using the phase
+   coefficients c0 blended towards c1 by t */
+static inline void resampler_filter(const float *l, const float *r,
+                                    const float *c0, const float *c1, float t,
+                                    float *out_l, float *out_r) {
+#if RS_SSE2
+  __m128 vt = _mm_set1_ps(t);
+  __m128 acc_l = _mm_setzero_ps();
+  __m128 acc_r = _mm_setzero_ps();
+
+  for (int k = 0; k < RS_TAPS; k += 4) {
+    __m128 a = _mm_loadu_ps(c0 + k);
+    __m128 b = _mm_loadu_ps(c1 + k);
+    __m128 c = _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), vt));
+    acc_l = _mm_add_ps(acc_l, _mm_mul_ps(_mm_loadu_ps(l + k), c));
+    acc_r = _mm_add_ps(acc_r, _mm_mul_ps(_mm_loadu_ps(r + k), c));
+  }
+
+  /* reduce both accumulators at once, leaving l in lane 0 and r in lane 1 */
+  __m128 lo = _mm_unpacklo_ps(acc_l, acc_r);
+  __m128 hi = _mm_unpackhi_ps(acc_l, acc_r);
+  __m128 sum = _mm_add_ps(lo, hi);
+  sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+
+  float res[4];
+  _mm_storeu_ps(res, sum);
+  *out_l = res[0];
+  *out_r = res[1];
+#elif RS_NEON
+  float32x4_t acc_l = vdupq_n_f32(0.0f);
+  float32x4_t acc_r = vdupq_n_f32(0.0f);
+
+  for (int k = 0; k < RS_TAPS; k += 4) {
+    float32x4_t a = vld1q_f32(c0 + k);
+    float32x4_t b = vld1q_f32(c1 + k);
+    float32x4_t c = vmlaq_n_f32(a, vsubq_f32(b, a), t);
+    acc_l = vmlaq_f32(acc_l, vld1q_f32(l + k), c);
+    acc_r = vmlaq_f32(acc_r, vld1q_f32(r + k), c);
+  }
+
+  float32x2_t sum_l = vadd_f32(vget_low_f32(acc_l), vget_high_f32(acc_l));
+  float32x2_t sum_r = vadd_f32(vget_low_f32(acc_r), vget_high_f32(acc_r));
+  float32x2_t sum = vpadd_f32(sum_l, sum_r);
+  *out_l = vget_lane_f32(sum, 0);
+  *out_r = vget_lane_f32(sum, 1);
+#else
+  float sum_l = 0.0f;
+  float sum_r = 0.0f;
+
+  for (int k = 0; k < RS_TAPS; k++) {
+    float c = c0[k] + (c1[k] - c0[k]) * t;
+    sum_l += l[k] * c;
+    sum_r += r[k] * c;
+  }
+
+  *out_l = sum_l;
+  *out_r = sum_r;
+#endif
+}
+
+int resampler_process(struct resampler *rs, const int16_t *in, int num_frames,
+                      int16_t *out) {
+  int written = 0;
+
+  while (1) {
+    /* produce frames for as long as their entire window is buffered */
+    while (1) {
+      int i = (int)rs->pos;
+
+      if (i + RS_TAPS > rs->num_hist) {
+        break;
+      }
+
+      float phase = (float)(rs->pos - i) * RS_PHASES;
+      /* rounding to float may land the phase on the extra row */
+      int p = MIN((int)phase, RS_PHASES - 1);
+      const float *c0 = &rs->coefs[p * RS_TAPS];
+
+      float l, r;
+      resampler_filter(&rs->hist[0][i], &rs->hist[1][i], c0, c0 + RS_TAPS,
+                       phase - p, &l, &r);
+
+      out[written * 2 + 0] = resampler_clamp(l);
+      out[written * 2 + 1] = resampler_clamp(r);
+      written++;
+
+      rs->pos += rs->step;
+    }
+
+    if (!num_frames) {
+      break;
+    }
+
+    /* drop the frames no longer needed by any window */
+    int consumed = MIN((int)rs->pos, rs->num_hist);
+    int remaining = rs->num_hist - consumed;
+    memmove(rs->hist[0], rs->hist[0] + consumed, remaining * sizeof(float));
+    memmove(rs->hist[1], rs->hist[1] + consumed, remaining * sizeof(float));
+    rs->num_hist = remaining;
+    rs->pos -= consumed;
+
+    int n = MIN(num_frames, RS_HISTORY - rs->num_hist);
+
+    for (int j = 0; j < n; j++) {
+      rs->hist[0][rs->num_hist + j] = in[j * 2 + 0];
+      rs->hist[1][rs->num_hist + j] = in[j * 2 + 1];
+    }
+
+    rs->num_hist += n;
+    in += n * 2;
+    num_frames -= n;
+  }
+
+  return written;
+}
+
+int resampler_max_frames(struct resampler *rs, int num_frames) {
+  /* a frame is produced for each position whose window ends in the history */
+  double span = rs->num_hist + num_frames - RS_TAPS + 1 - rs->pos;
+  return MAX((int)ceil(span / rs->step), 0);
+}
+
+void resampler_set_ratio(struct resampler *rs, double ratio) {
+  rs->step = rs->base_step / ratio;
+}
+
+void resampler_destroy(struct resampler *rs) {
+  free(rs);
+}
+
+struct resampler *resampler_create(int in_rate, int out_rate) {
+  struct resampler *rs = calloc(1, sizeof(struct resampler));
+
+  rs->base_step = (double)in_rate / out_rate;
+  rs->step = rs->base_step;
+
+  /* when downsampling, band-limit to the output's nyquist frequency. leave
+     some room for the transition band to avoid aliasing */
+  double cutoff = 0.9 * MIN(1.0, (double)out_rate / in_rate);
+  resampler_init_coefs(rs, cutoff);
+
+  /* prime the history with silence so the first output frame is centered on
+     the first input frame */
+  rs->num_hist = RS_TAPS / 2 - 1;
+
+  return rs;
+}
@@ -0,0 +1,27 @@
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include <stdint.h>
+
+/* polyphase windowed sinc resampler for interleaved stereo pcm16 frames. the
+   ratio can be nudged at any time without artifacts, letting it also serve to
+   control the rate frames are produced at for synchronization */
+struct resampler;
+
+struct resampler *resampler_create(int in_rate, int out_rate);
+void resampler_destroy(struct resampler *rs);
+
+/* scales the number of frames produced per input frame, e.g. 1.001 produces
+   0.1% more frames than the nominal ratio */
+void resampler_set_ratio(struct resampler *rs, double ratio);
+
+/* upper bound on the frames produced for num_frames input frames, which out
+   must have room for */
+int resampler_max_frames(struct resampler *rs, int num_frames);
+
+/* converts num_frames input frames, returning the number of frames written to
+   out. input is delayed by half of the filter's length */
+int resampler_process(struct resampler *rs, const int16_t *in, int num_frames,
+                      int16_t *out);
+
+#endif
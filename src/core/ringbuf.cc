@@ -16,8 +16,9 @@ struct ringbuf {
 };
 
 void ringbuf_advance_write_ptr(struct ringbuf *rb, int n) {
-  /* perform release to prevent the advance from occurring before the data is
-     is written to the ring buffer, for example:
+  /* only the producer writes to write_offset, so its own load can be relaxed.
+     the store is a release to prevent the advance from occurring before the
+     data is written to the ring buffer, for example:
 
      void *write_ptr = ringbuf_write_ptr(rb);
      memcpy(write_ptr, data, size);
@@ -25,20 +26,22 @@ void ringbuf_advance_write_ptr(struct ringbuf *rb, int n) {
 
      without the release, the memcpy could be reordered to occur after the
      advance, leaving the consumer to read garbage data */
-  rb->write_offset.fetch_add(n, std::memory_order_release);
+  int64_t write_offset = rb->write_offset.load(std::memory_order_relaxed);
+  rb->write_offset.store(write_offset + n, std::memory_order_release);
   DCHECK(ringbuf_remaining(rb) >= 0);
 }
 
 void *ringbuf_write_ptr(struct ringbuf *rb) {
   /* relaxed ordering is fine here as there is only a single thread writing to
      write_offset  */
-  int64_t write_offset = rb->write_offset.load();
+  int64_t write_offset = rb->write_offset.load(std::memory_order_relaxed);
   return rb->data + (write_offset % rb->size);
 }
 
 void ringbuf_advance_read_ptr(struct ringbuf *rb, int n) {
-  /* perform release to prevent the advance from occurring before the data is
-     is read from the ring buffer, for example:
+  /* only the consumer writes to read_offset. the store is a release to
+     prevent the advance from occurring before the data is read from the ring
+     buffer, for example:
 
      void *read_ptr = ringbuf_read_ptr(rb);
      memcpy(data, read_ptr, size);
@@ -47,14 +50,15 @@ void ringbuf_advance_read_ptr(struct ringbuf *rb, int n) {
      without the release, the advance could be reordered to occur before the
      memcpy, at which point the producer could start writing over data that's
      not yet been read */
-  rb->read_offset.fetch_add(n, std::memory_order_release);
+  int64_t read_offset = rb->read_offset.load(std::memory_order_relaxed);
+  rb->read_offset.store(read_offset + n, std::memory_order_release);
   DCHECK(ringbuf_remaining(rb) >= 0);
 }
 
 void *ringbuf_read_ptr(struct ringbuf *rb) {
   /* relaxed ordering is fine here as there is only a single thread writing to
      read_offset */
-  int64_t read_offset = rb->read_offset.load();
+  int64_t read_offset = rb->read_offset.load(std::memory_order_relaxed);
   return rb->data + (read_offset % rb->size);
 }
 
@@ -63,16 +67,14 @@ int ringbuf_remaining(struct ringbuf *rb) {
 }
 
 int ringbuf_available(struct ringbuf *rb) {
-  /* it should be safe to perform both of these loads with relaxed ordering as
-     both offsets only advance forward
-
-     in the case that the producer reads an old value for read_offset, it'd
-     think there was less room to write data than there actually is
-
-     in the case that the consumer reads an old value for the write_offset, it'd
-     think there was less data to be read than there actually is */
-  int64_t read = rb->read_offset.load();
-  int64_t write = rb->write_offset.load();
+  /* both offsets are loaded with acquire ordering, pairing with the release
+     in the advance functions. this way the consumer is guaranteed to see the
+     data written before write_offset was advanced, and the producer is
+     guaranteed the consumer has finished reading before read_offset was
+     advanced. as both offsets only advance forward, a stale value only ever
+     makes it look like there is less data / room than there actually is */
+  int64_t read = rb->read_offset.load(std::memory_order_acquire);
+  int64_t write = rb->write_offset.load(std::memory_order_acquire);
   int available = (int)(write - read);
   DCHECK(available >= 0 && available <= rb->size);
   return available;
@@ -1,6 +1,19 @@
 #ifndef RINGBUF_H
 #define RINGBUF_H
 
+/* single producer, single consumer ring buffer
+
+   exactly one thread may call the write functions, and exactly one thread may
+   call the read functions, without any further locking. the producer writes
+   directly into the memory returned by ringbuf_write_ptr and then publishes it
+   with ringbuf_advance_write_ptr, which has release semantics. the consumer
+   observes the new write offset with acquire semantics through
+   ringbuf_available, after which the published data is visible to it. the
+   same applies in the other direction for freeing space once it's been read
+
+   the buffer is mapped twice back to back, so the up to ringbuf_remaining
+   bytes following ringbuf_write_ptr (and ringbuf_available bytes following
+   ringbuf_read_ptr) are always contiguous */
 struct ringbuf;
 
 struct ringbuf *ringbuf_create(int size);
@@ -0,0 +1,16 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+/* SSE2 and NEON are part of the baseline x64 and arm64 instruction sets, so
+   vectorized routines are selected at compile time rather than by checking
+   the host's features at runtime. code using them checks SIMD_SSE2 and
+   SIMD_NEON, keeping a scalar fallback for other hosts */
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define SIMD_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define SIMD_NEON 1
+#endif
+
+#endif
@@ -1,30 +1,106 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include "core/core.h"
 #include "core/sort.h"
+#include "core/task_pool.h"
+#include "core/thread.h"
 
-static void merge(uint8_t *in, uint8_t *out, size_t size, int l, int m, int r,
-                  sort_cmp cmp) {
-  int i = l;
-  int j = m;
-  int k = l;
-
-  while (k < r) {
-    if (i < m && ((j >= r) || cmp(in + i * size, in + j * size))) {
-      memcpy(out + k * size, in + i * size, size);
-      k++;
+/* runs this short are insertion sorted rather than merged */
+#define MSORT_SMALL_SIZE 16
+
+/* inputs smaller than this aren't worth distributing across the task pool */
+#define MSORT_PARALLEL_MIN 16384
+
+struct msort_task {
+  uint8_t *in;
+  uint8_t *out;
+  size_t size;
+  sort_cmp cmp;
+
+  /* bounds of the chunk being sorted, or of the two runs being merged */
+  int l;
+  int m;
+  int r;
+
+  /* range of the merged output written by the task */
+  int begin;
+  int end;
+};
+
+static void merge_runs(const uint8_t *a, int na, const uint8_t *b, int nb,
+                       uint8_t *out, size_t size, sort_cmp cmp) {
+  int i = 0;
+  int j = 0;
+
+  while (i < na && j < nb) {
+    if (cmp(a + i * size, b + j * size)) {
+      memcpy(out, a + i * size, size);
       i++;
     } else {
-      memcpy(out + k * size, in + j * size, size);
-      k++;
+      memcpy(out, b + j * size, size);
       j++;
     }
+    out += size;
+  }
+
+  memcpy(out, a + i * size, (na - i) * size);
+  out += (na - i) * size;
+  memcpy(out, b + j * size, (nb - j) * size);
+}
+
+static void merge(uint8_t *in, uint8_t *out, size_t size, int l, int m, int r,
+                  sort_cmp cmp) {
+  merge_runs(in + l * size, m - l, in + m * size, r - m, out + l * size, size,
+             cmp);
+}
+
+/* returns how many of the first k elements of the merged output come from
+   a, with ties going to a to keep the merge stable */
+static int merge_corank(const uint8_t *a, int na, const uint8_t *b, int nb,
+                        int k, size_t size, sort_cmp cmp) {
+  int lo = MAX(k - nb, 0);
+  int hi = MIN(k, na);
+
+  while (lo < hi) {
+    int i = lo + (hi - lo) / 2;
+    int j = k - i;
+
+    /* if a[i] comes before b[j - 1], more than i elements come from a */
+    if (cmp(a + i * size, b + (j - 1) * size)) {
+      lo = i + 1;
+    } else {
+      hi = i;
+    }
+  }
+
+  return lo;
+}
+
+static void insertion_sort(uint8_t *in, uint8_t *out, size_t size, int l,
+                           int r, sort_cmp cmp) {
+  /* in is left untouched, so each element is read from it while shifting
+     the sorted elements in out */
+  memcpy(out + l * size, in + l * size, size);
+
+  for (int i = l + 1; i < r; i++) {
+    const uint8_t *elem = in + i * size;
+    int j = i;
+
+    while (j > l && !cmp(out + (j - 1) * size, elem)) {
+      memcpy(out + j * size, out + (j - 1) * size, size);
+      j--;
+    }
+
+    memcpy(out + j * size, elem, size);
   }
 }
 
 static void msort_r(uint8_t *in, uint8_t *out, size_t size, int l, int r,
                     sort_cmp cmp) {
-  if ((r - l) < 2) {
+  /* in and out hold the same elements for [l, r) until it's sorted */
+  if ((r - l) <= MSORT_SMALL_SIZE) {
+    insertion_sort(in, out, size, l, r, cmp);
     return;
   }
 
@@ -39,6 +115,235 @@ void msort_noalloc(void *data, void *tmp, int num, size_t size, sort_cmp cmp) {
   msort_r(tmp, data, size, 0, num, cmp);
 }
 
+static void msort_chunk_task(void *data) {
+  struct msort_task *task = data;
+  size_t size = task->size;
+
+  msort_noalloc(task->out + task->l * size, task->in + task->l * size,
+                task->r - task->l, size, task->cmp);
+}
+
+static void msort_merge_task(void *data) {
+  struct msort_task *task = data;
+  size_t size = task->size;
+
+  const uint8_t *a = task->in + task->l * size;
+  const uint8_t *b = task->in + task->m * size;
+  int na = task->m - task->l;
+  int nb = task->r - task->m;
+
+  /* find where the task's range of the output begins and ends in each run */
+  int k0 = task->begin - task->l;
+  int k1 = task->end - task->l;
+  int i0 = merge_corank(a, na, b, nb, k0, size, task->cmp);
+  int i1 = merge_corank(a, na, b, nb, k1, size, task->cmp);
+  int j0 = k0 - i0;
+  int j1 = k1 - i1;
+
+  merge_runs(a + i0 * size, i1 - i0, b + j0 * size, j1 - j0,
+             task->out + task->begin * size, size, task->cmp);
+}
+
+static int msort_chunk_bound(int num, int num_chunks, int i) {
+  return (int)((int64_t)num * i / num_chunks);
+}
+
+void msort_parallel(void *data, int num, size_t size, sort_cmp cmp) {
+  struct task_pool *pool = task_pool_shared();
+
+  /* the pool always has a worker, even on a single cpu host */
+  int num_threads = MIN(task_pool_num_workers(pool) + 1, thread_num_cpus());
+
+  if (num < MSORT_PARALLEL_MIN || num_threads < 2) {
+    msort(data, num, size, cmp);
+    return;
+  }
+
+  /* split the input into a power of two number of chunks, such that they
+     merge back together evenly */
+  int num_chunks = 1;
+  while (num_chunks < num_threads) {
+    num_chunks <<= 1;
+  }
+
+  uint8_t *tmp = malloc(num * size);
+  struct msort_task *tasks = malloc(num_chunks * sizeof(struct msort_task));
+  struct task_group *group = task_group_create(pool);
+
+  for (int i = 0; i < num_chunks; i++) {
+    struct msort_task *task = &tasks[i];
+    task->in = tmp;
+    task->out = data;
+    task->size = size;
+    task->cmp = cmp;
+    task->l = msort_chunk_bound(num, num_chunks, i);
+    task->r = msort_chunk_bound(num, num_chunks, i + 1);
+    task_group_run(group, &msort_chunk_task, task, TASK_PRIO_NORMAL);
+  }
+
+  task_group_wait(group);
+
+  /* merge pairs of runs, splitting each merge across as many tasks as needed
+     to keep num_chunks tasks running at every level */
+  uint8_t *src = data;
+  uint8_t *dst = tmp;
+
+  for (int width = 1; width < num_chunks; width *= 2) {
+    int num_pieces = width * 2;
+    int n = 0;
+
+    for (int i = 0; i < num_chunks; i += width * 2) {
+      int l = msort_chunk_bound(num, num_chunks, i);
+      int m = msort_chunk_bound(num, num_chunks, i + width);
+      int r = msort_chunk_bound(num, num_chunks, i + width * 2);
+
+      for (int j = 0; j < num_pieces; j++) {
+        struct msort_task *task = &tasks[n++];
+        task->in = src;
+        task->out = dst;
+        task->l = l;
+        task->m = m;
+        task->r = r;
+        task->begin = l + (int)((int64_t)(r - l) * j / num_pieces);
+        task->end = l + (int)((int64_t)(r - l) * (j + 1) / num_pieces);
+        task_group_run(group, &msort_merge_task, task, TASK_PRIO_NORMAL);
+      }
+    }
+
+    task_group_wait(group);
+
+    uint8_t *swap = src;
+    src = dst;
+    dst = swap;
+  }
+
+  if (src != data) {
+    memcpy(data, src, num * size);
+  }
+
+  task_group_destroy(group);
+  free(tasks);
+  free(tmp);
+}
+
+static inline void nsort_swap(uint64_t *v, int i, int j) {
+  uint64_t a = v[i];
+  uint64_t b = v[j];
+  v[i] = a < b ? a : b;
+  v[j] = a < b ? b : a;
+}
+
+void nsort(uint32_t *keys, int *values, int num) {
+  /* the network isn't stable on its own, so each key is extended with its
+     position to break ties. the network is padded to a power of two with
+     keys that sort last */
+  uint64_t v[NSORT_MAX_SIZE];
+  int tmp_values[NSORT_MAX_SIZE];
+  int n = 1;
+
+  while (n < num) {
+    n <<= 1;
+  }
+
+  for (int i = 0; i < num; i++) {
+    v[i] = ((uint64_t)keys[i] << 32) | (uint32_t)i;
+    tmp_values[i] = values[i];
+  }
+
+  for (int i = num; i < n; i++) {
+    v[i] = UINT64_MAX;
+  }
+
+  /* bitonic network, each pass is a fixed sequence of branchless
+     compare-exchanges */
+  for (int k = 2; k <= n; k <<= 1) {
+    for (int j = k >> 1; j > 0; j >>= 1) {
+      for (int i = 0; i < n; i++) {
+        int l = i ^ j;
+
+        if (l <= i) {
+          continue;
+        }
+
+        if (i & k) {
+          nsort_swap(v, l, i);
+        } else {
+          nsort_swap(v, i, l);
+        }
+      }
+    }
+  }
+
+  for (int i = 0; i < num; i++) {
+    keys[i] = (uint32_t)(v[i] >> 32);
+    values[i] = tmp_values[(uint32_t)v[i]];
+  }
+}
+
+void rsort_noalloc(uint32_t *keys, int *values, uint32_t *tmp_keys,
+                   int *tmp_values, int num) {
+  /* the histograms cost more than sorting short inputs outright */
+  if (num <= NSORT_MAX_SIZE) {
+    nsort(keys, values, num);
+    return;
+  }
+
+  /* histogram each of the key's bytes in a single pass */
+  int counts[4][256] = {{0}};
+
+  for (int i = 0; i < num; i++) {
+    uint32_t key = keys[i];
+    counts[0][key & 0xff]++;
+    counts[1][(key >> 8) & 0xff]++;
+    counts[2][(key >> 16) & 0xff]++;
+    counts[3][key >> 24]++;
+  }
+
+  uint32_t *src_keys = keys;
+  int *src_values = values;
+  uint32_t *dst_keys = tmp_keys;
+  int *dst_values = tmp_values;
+
+  for (int pass = 0; pass < 4; pass++) {
+    int *count = counts[pass];
+    int shift = pass * 8;
+
+    /* skip the pass if every key has the same byte, which is common for the
+       upper bytes of keys that are close together */
+    if (num && count[(src_keys[0] >> shift) & 0xff] == num) {
+      continue;
+    }
+
+    int offset = 0;
+
+    for (int i = 0; i < 256; i++) {
+      int n = count[i];
+      count[i] = offset;
+      offset += n;
+    }
+
+    for (int i = 0; i < num; i++) {
+      uint32_t key = src_keys[i];
+      int dst = count[(key >> shift) & 0xff]++;
+      dst_keys[dst] = key;
+      dst_values[dst] = src_values[i];
+    }
+
+    uint32_t *swap_keys = src_keys;
+    int *swap_values = src_values;
+    src_keys = dst_keys;
+    src_values = dst_values;
+    dst_keys = swap_keys;
+    dst_values = swap_values;
+  }
+
+  /* copy back if the result ended up in the temporary buffers */
+  if (src_keys != keys) {
+    memcpy(keys, src_keys, num * sizeof(uint32_t));
+    memcpy(values, src_values, num * sizeof(int));
+  }
+}
+
 void msort(void *data, int num, size_t size, sort_cmp cmp) {
   void *tmp = malloc(num * size);
   msort_noalloc(data, tmp, num, size, cmp);
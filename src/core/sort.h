@@ -2,6 +2,8 @@
 #define SORT_H
 
 #include <stddef.h>
+#include <stdint.h>
+#include <string.h>
 
 /* returns if a is <= b */
 typedef int (*sort_cmp)(const void *, const void *);
@@ -10,4 +12,35 @@ typedef int (*sort_cmp)(const void *, const void *);
 void msort_noalloc(void *data, void *tmp, int num, size_t size, sort_cmp cmp);
 void msort(void *data, int num, size_t size, sort_cmp cmp);
 
+/* stable mergesort spreading large inputs across the shared task pool. the
+   chunks are sorted in parallel, and each merge is split into independent
+   ranges of the output, so every level of merges runs in parallel */
+void msort_parallel(void *data, int num, size_t size, sort_cmp cmp);
+
+/* stable sort of at most NSORT_MAX_SIZE (key, value) pairs in ascending key
+   order, using a bitonic sorting network */
+#define NSORT_MAX_SIZE 16
+
+void nsort(uint32_t *keys, int *values, int num);
+
+/* stable lsd radix sort of (key, value) pairs in ascending key order. tmp_keys
+   and tmp_values must each have room for num elements. short inputs are
+   handed off to nsort */
+void rsort_noalloc(uint32_t *keys, int *values, uint32_t *tmp_keys,
+                   int *tmp_values, int num);
+
+/* maps a float to a key whose unsigned order matches the float's order */
+static inline uint32_t rsort_float_key(float f) {
+  /* fold -0.0 into 0.0 so the two compare equal */
+  f += 0.0f;
+
+  uint32_t u;
+  memcpy(&u, &f, sizeof(u));
+
+  /* flip every bit of negative numbers, and only the sign bit of positive
+     ones */
+  uint32_t mask = (uint32_t)(-(int32_t)(u >> 31)) | 0x80000000;
+  return u ^ mask;
+}
+
 #endif
@@ -15,6 +15,7 @@
 
 #ifndef HAVE_STRCASECMP
 #define strcasecmp _stricmp
+#define strncasecmp _strnicmp
 #endif
 
 #ifndef HAVE_STRNLEN
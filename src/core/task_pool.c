@@ -0,0 +1,422 @@
+#include "core/task_pool.h"
+#include "core/core.h"
+#include "core/thread.h"
+
+#define TASK_MAX_WORKERS 64
+#define TASK_QUEUE_INIT_SIZE 64
+
+struct task {
+  task_fn fn;
+  void *data;
+  struct task_group *group;
+};
+
+struct task_queue {
+  mutex_t mutex;
+  struct task *tasks;
+  int capacity;
+  int head;
+  /* read without the mutex to skip over empty queues */
+  volatile int count;
+};
+
+struct task_worker {
+  struct task_pool *pool;
+  int index;
+  thread_t thread;
+  struct task_queue queues[TASK_NUM_PRIOS];
+};
+
+struct task_group {
+  struct task_pool *pool;
+  volatile int pending;
+  volatile int done;
+  task_fn cont_fn;
+  void *cont_data;
+};
+
+struct task_pool {
+  void (*thread_init)();
+
+  struct task_worker *workers;
+  int num_workers;
+
+  /* tasks submitted from outside of the pool */
+  struct task_queue queues[TASK_NUM_PRIOS];
+
+  /* idle workers and threads waiting on a group sleep on the pool's cond,
+     and are woken as tasks are queued and groups finish */
+  volatile int num_queued;
+  volatile int sleepers;
+  int shutdown;
+  mutex_t mutex;
+  cond_t cond;
+};
+
+static _Thread_local struct task_worker *task_current_worker;
+static struct task_pool *volatile task_shared_pool;
+
+/*
+ * task queues
+ */
+static void task_queue_push(struct task_queue *queue, struct task *task) {
+  mutex_lock(queue->mutex);
+
+  if (queue->count == queue->capacity) {
+    int capacity = MAX(queue->capacity * 2, TASK_QUEUE_INIT_SIZE);
+    struct task *tasks = malloc(capacity * sizeof(struct task));
+
+    for (int i = 0; i < queue->count; i++) {
+      tasks[i] = queue->tasks[(queue->head + i) % queue->capacity];
+    }
+
+    free(queue->tasks);
+    queue->tasks = tasks;
+    queue->capacity = capacity;
+    queue->head = 0;
+  }
+
+  int tail = (queue->head + queue->count) % queue->capacity;
+  queue->tasks[tail] = *task;
+  atomic_store_int(&queue->count, queue->count + 1);
+
+  mutex_unlock(queue->mutex);
+}
+
+static int task_queue_pop(struct task_queue *queue, int newest,
+                          struct task *task) {
+  if (!atomic_load_int(&queue->count)) {
+    return 0;
+  }
+
+  mutex_lock(queue->mutex);
+
+  int count = queue->count;
+
+  if (count) {
+    if (newest) {
+      *task = queue->tasks[(queue->head + count - 1) % queue->capacity];
+    } else {
+      *task = queue->tasks[queue->head];
+      queue->head = (queue->head + 1) % queue->capacity;
+    }
+
+    atomic_store_int(&queue->count, count - 1);
+  }
+
+  mutex_unlock(queue->mutex);
+
+  return count > 0;
+}
+
+static void task_queue_destroy(struct task_queue *queue) {
+  free(queue->tasks);
+  mutex_destroy(queue->mutex);
+}
+
+static void task_queue_init(struct task_queue *queue) {
+  queue->mutex = mutex_create();
+}
+
+/*
+ * task pool
+ */
+static struct task_worker *task_pool_current_worker(struct task_pool *pool) {
+  struct task_worker *worker = task_current_worker;
+  return worker && worker->pool == pool ? worker : NULL;
+}
+
+static int task_pool_pop(struct task_pool *pool, struct task_worker *worker,
+                         struct task *task) {
+  for (int prio = 0; prio < TASK_NUM_PRIOS; prio++) {
+    /* prefer the worker's own most recent task, whose data is likely still
+       in cache */
+    if (worker && task_queue_pop(&worker->queues[prio], 1, task)) {
+      goto found;
+    }
+
+    if (task_queue_pop(&pool->queues[prio], 0, task)) {
+      goto found;
+    }
+
+    /* steal the oldest task from another worker, starting with the next one
+       over to spread out contention */
+    int start = worker ? worker->index + 1 : 0;
+
+    for (int i = 0; i < pool->num_workers; i++) {
+      struct task_worker *victim =
+          &pool->workers[(start + i) % pool->num_workers];
+
+      if (victim == worker) {
+        continue;
+      }
+
+      if (task_queue_pop(&victim->queues[prio], 0, task)) {
+        goto found;
+      }
+    }
+  }
+
+  return 0;
+
+found:
+  atomic_fetch_add_int(&pool->num_queued, -1);
+  return 1;
+}
+
+static void task_group_finish(struct task_group *group);
+
+static void task_pool_run(struct task *task) {
+  task->fn(task->data);
+  task_group_finish(task->group);
+}
+
+static void *task_pool_worker_thread(void *data) {
+  struct task_worker *worker = data;
+  struct task_pool *pool = worker->pool;
+
+  task_current_worker = worker;
+
+  if (pool->thread_init) {
+    pool->thread_init();
+  }
+
+  while (1) {
+    struct task task;
+
+    if (task_pool_pop(pool, worker, &task)) {
+      task_pool_run(&task);
+      continue;
+    }
+
+    /* the sleeper count is raised before checking for tasks, and submitters
+       bump the queued count before checking for sleepers, so at least one
+       of the two sees the other */
+    mutex_lock(pool->mutex);
+    atomic_fetch_add_int(&pool->sleepers, 1);
+
+    while (atomic_load_int(&pool->num_queued) <= 0 && !pool->shutdown) {
+      cond_wait(pool->cond, pool->mutex);
+    }
+
+    atomic_fetch_add_int(&pool->sleepers, -1);
+    int shutdown = pool->shutdown;
+    mutex_unlock(pool->mutex);
+
+    if (shutdown) {
+      break;
+    }
+  }
+
+  return NULL;
+}
+
+int task_pool_num_workers(struct task_pool *pool) {
+  return pool->num_workers;
+}
+
+void task_pool_destroy(struct task_pool *pool) {
+  mutex_lock(pool->mutex);
+  pool->shutdown = 1;
+  cond_broadcast(pool->cond);
+  mutex_unlock(pool->mutex);
+
+  for (int i = 0; i < pool->num_workers; i++) {
+    struct task_worker *worker = &pool->workers[i];
+
+    void *result;
+    thread_join(worker->thread, &result);
+
+    for (int j = 0; j < TASK_NUM_PRIOS; j++) {
+      task_queue_destroy(&worker->queues[j]);
+    }
+  }
+
+  for (int i = 0; i < TASK_NUM_PRIOS; i++) {
+    task_queue_destroy(&pool->queues[i]);
+  }
+
+  cond_destroy(pool->cond);
+  mutex_destroy(pool->mutex);
+  free(pool->workers);
+  free(pool);
+}
+
+struct task_pool *task_pool_create(int num_workers, void (*thread_init)()) {
+  struct task_pool *pool = calloc(1, sizeof(struct task_pool));
+
+  if (num_workers < 0) {
+    num_workers = MAX(thread_num_cpus() - 1, 1);
+  }
+  num_workers = MIN(num_workers, TASK_MAX_WORKERS);
+
+  pool->thread_init = thread_init;
+  pool->mutex = mutex_create();
+  pool->cond = cond_create();
+
+  for (int i = 0; i < TASK_NUM_PRIOS; i++) {
+    task_queue_init(&pool->queues[i]);
+  }
+
+  /* initialize every worker before starting any, as they steal from each
+     other as soon as they're running */
+  pool->workers = calloc(num_workers, sizeof(struct task_worker));
+  pool->num_workers = num_workers;
+
+  for (int i = 0; i < num_workers; i++) {
+    struct task_worker *worker = &pool->workers[i];
+    worker->pool = pool;
+    worker->index = i;
+
+    for (int j = 0; j < TASK_NUM_PRIOS; j++) {
+      task_queue_init(&worker->queues[j]);
+    }
+  }
+
+  for (int i = 0; i < num_workers; i++) {
+    struct task_worker *worker = &pool->workers[i];
+    worker->thread = thread_create(&task_pool_worker_thread, "task", worker);
+    CHECK_NOTNULL(worker->thread);
+  }
+
+  return pool;
+}
+
+void task_pool_init_shared(int num_workers, void (*thread_init)()) {
+  struct task_pool *pool = task_pool_create(num_workers, thread_init);
+
+  /* the pool lives until the process exits */
+  if (!atomic_cas_ptr((void *volatile *)&task_shared_pool, NULL, pool)) {
+    task_pool_destroy(pool);
+  }
+}
+
+struct task_pool *task_pool_shared() {
+  struct task_pool *pool =
+      atomic_load_ptr((void *volatile *)&task_shared_pool);
+
+  if (!pool) {
+    task_pool_init_shared(-1, NULL);
+    pool = atomic_load_ptr((void *volatile *)&task_shared_pool);
+  }
+
+  return pool;
+}
+
+/*
+ * task groups
+ */
+static void task_group_finish(struct task_group *group) {
+  struct task_pool *pool = group->pool;
+
+  if (atomic_fetch_add_int(&group->pending, -1) != 1) {
+    return;
+  }
+
+  task_fn cont_fn = group->cont_fn;
+
+  if (cont_fn) {
+    group->cont_fn = NULL;
+    cont_fn(group->cont_data);
+  }
+
+  /* the continuation may have run more tasks in the group. once done is set
+     a waiter may destroy the group, so it's not touched after */
+  mutex_lock(pool->mutex);
+
+  if (!atomic_load_int(&group->pending)) {
+    atomic_store_int(&group->done, 1);
+    cond_broadcast(pool->cond);
+  }
+
+  mutex_unlock(pool->mutex);
+}
+
+int task_group_done(struct task_group *group) {
+  return atomic_load_int(&group->done);
+}
+
+void task_group_wait(struct task_group *group) {
+  struct task_pool *pool = group->pool;
+  struct task_worker *worker = task_pool_current_worker(pool);
+
+  while (!atomic_load_int(&group->done)) {
+    struct task task;
+
+    /* help out rather than block, the tasks being waited on may be queued
+       behind others */
+    if (task_pool_pop(pool, worker, &task)) {
+      task_pool_run(&task);
+      continue;
+    }
+
+    mutex_lock(pool->mutex);
+    atomic_fetch_add_int(&pool->sleepers, 1);
+
+    while (!atomic_load_int(&group->done) &&
+           atomic_load_int(&pool->num_queued) <= 0) {
+      cond_wait(pool->cond, pool->mutex);
+    }
+
+    atomic_fetch_add_int(&pool->sleepers, -1);
+
+    /* a task may have been queued with this thread being the one signaled,
+       pass the wakeup on to a worker */
+    if (atomic_load_int(&group->done) &&
+        atomic_load_int(&pool->num_queued) > 0) {
+      cond_signal(pool->cond);
+    }
+
+    mutex_unlock(pool->mutex);
+  }
+}
+
+void task_group_continue(struct task_group *group, task_fn fn, void *data) {
+  /* hold the group open while the continuation is set, so it runs here if
+     every task has already finished */
+  if (atomic_fetch_add_int(&group->pending, 1) == 0) {
+    atomic_store_int(&group->done, 0);
+  }
+
+  group->cont_fn = fn;
+  group->cont_data = data;
+
+  task_group_finish(group);
+}
+
+void task_group_run(struct task_group *group, task_fn fn, void *data,
+                    int prio) {
+  struct task_pool *pool = group->pool;
+  struct task_worker *worker = task_pool_current_worker(pool);
+
+  CHECK(prio >= 0 && prio < TASK_NUM_PRIOS);
+
+  if (atomic_fetch_add_int(&group->pending, 1) == 0) {
+    atomic_store_int(&group->done, 0);
+  }
+
+  struct task task = {fn, data, group};
+  struct task_queue *queue =
+      worker ? &worker->queues[prio] : &pool->queues[prio];
+  task_queue_push(queue, &task);
+
+  atomic_fetch_add_int(&pool->num_queued, 1);
+
+  if (atomic_load_int(&pool->sleepers)) {
+    mutex_lock(pool->mutex);
+    cond_signal(pool->cond);
+    mutex_unlock(pool->mutex);
+  }
+}
+
+void task_group_destroy(struct task_group *group) {
+  task_group_wait(group);
+  free(group);
+}
+
+struct task_group *task_group_create(struct task_pool *pool) {
+  struct task_group *group = calloc(1, sizeof(struct task_group));
+  group->pool = pool;
+  group->done = 1;
+  return group;
+}
@@ -0,0 +1,58 @@
+#ifndef TASK_POOL_H
+#define TASK_POOL_H
+
+/*
+ * work-stealing task pool
+ *
+ * tasks are short functions run on a fixed set of worker threads. each worker
+ * keeps its own queue per priority, which tasks it spawns are pushed to and
+ * popped from in lifo order, while idle workers steal the oldest tasks from
+ * each other's queues. tasks submitted from outside of the pool go through a
+ * shared queue per priority
+ *
+ * tasks are tracked through groups, which can be waited on or continued once
+ * each of their tasks has finished. threads waiting on a group run queued
+ * tasks until it's done, so waiting from inside of a task doesn't deadlock,
+ * even on a pool without any workers
+ */
+
+enum {
+  TASK_PRIO_HIGH,
+  TASK_PRIO_NORMAL,
+  TASK_PRIO_LOW,
+  TASK_NUM_PRIOS,
+};
+
+typedef void (*task_fn)(void *data);
+
+struct task_pool;
+struct task_group;
+
+/* a negative num_workers sizes the pool to one worker for each host cpu
+   besides the calling thread's. thread_init, if set, is called on each worker
+   as it starts */
+struct task_pool *task_pool_create(int num_workers, void (*thread_init)());
+void task_pool_destroy(struct task_pool *pool);
+
+int task_pool_num_workers(struct task_pool *pool);
+
+/* the pool shared by each subsystem. it's created with the default size on
+   first use, unless task_pool_init_shared is called before then */
+void task_pool_init_shared(int num_workers, void (*thread_init)());
+struct task_pool *task_pool_shared();
+
+struct task_group *task_group_create(struct task_pool *pool);
+void task_group_destroy(struct task_group *group);
+
+void task_group_run(struct task_group *group, task_fn fn, void *data,
+                    int prio);
+
+/* runs fn once each task in the group has finished, on the thread finishing
+   the last of them, or immediately if none are running. fn may run more
+   tasks in the group, which waiting on it then also waits for */
+void task_group_continue(struct task_group *group, task_fn fn, void *data);
+
+void task_group_wait(struct task_group *group);
+int task_group_done(struct task_group *group);
+
+#endif
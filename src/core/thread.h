@@ -1,15 +1,37 @@
 #ifndef THREAD_H
 #define THREAD_H
 
+#include <stdint.h>
+
 /*
  * threads
  */
 typedef void *thread_t;
 typedef void *(*thread_fn)(void *);
 
+enum {
+  THREAD_PRIO_LOW = -1,
+  THREAD_PRIO_NORMAL,
+  THREAD_PRIO_HIGH,
+  THREAD_PRIO_REALTIME,
+};
+
 thread_t thread_create(thread_fn fn, const char *name, void *data);
 void thread_join(thread_t thread, void **result);
 
+/* number of cpus available to the process */
+int thread_num_cpus();
+
+/* names the calling thread for debuggers and profilers, threads created with
+   thread_create are named on startup */
+void thread_set_name(const char *name);
+
+/* cpus is a mask of the cpus the thread may run on, and a NULL thread refers
+   to the calling thread. each return 0 when the platform or the process'
+   privileges don't allow the change */
+int thread_set_affinity(thread_t thread, uint64_t cpus);
+int thread_set_priority(thread_t thread, int priority);
+
 /*
  * synchronization
  */
@@ -27,8 +49,93 @@ cond_t cond_create();
 void cond_wait(cond_t cond, mutex_t mutex);
 int cond_timedwait(cond_t cond, mutex_t mutex, int ms);
 void cond_signal(cond_t cond);
+void cond_broadcast(cond_t cond);
 void cond_destroy(cond_t cond);
 
+/*
+ * atomics. each operation is sequentially consistent, and operates on a
+ * naturally aligned value
+ */
+#if PLATFORM_WINDOWS
+#include <windows.h>
+
+static inline int atomic_load_int(volatile int *ptr) {
+  return InterlockedOr((volatile LONG *)ptr, 0);
+}
+
+static inline void atomic_store_int(volatile int *ptr, int value) {
+  InterlockedExchange((volatile LONG *)ptr, value);
+}
+
+static inline int atomic_fetch_add_int(volatile int *ptr, int value) {
+  return InterlockedExchangeAdd((volatile LONG *)ptr, value);
+}
+
+static inline int atomic_cas_int(volatile int *ptr, int expected,
+                                 int desired) {
+  return InterlockedCompareExchange((volatile LONG *)ptr, desired,
+                                    expected) == expected;
+}
+
+static inline void *atomic_load_ptr(void *volatile *ptr) {
+  return InterlockedCompareExchangePointer(ptr, NULL, NULL);
+}
+
+static inline void *atomic_exchange_ptr(void *volatile *ptr, void *value) {
+  return InterlockedExchangePointer(ptr, value);
+}
+
+static inline int atomic_cas_ptr(void *volatile *ptr, void *expected,
+                                 void *desired) {
+  return InterlockedCompareExchangePointer(ptr, desired, expected) ==
+         expected;
+}
+
+static inline void cpu_relax() {
+  YieldProcessor();
+}
+#else
+static inline int atomic_load_int(volatile int *ptr) {
+  return __atomic_load_n(ptr, __ATOMIC_SEQ_CST);
+}
+
+static inline void atomic_store_int(volatile int *ptr, int value) {
+  __atomic_store_n(ptr, value, __ATOMIC_SEQ_CST);
+}
+
+static inline int atomic_fetch_add_int(volatile int *ptr, int value) {
+  return __atomic_fetch_add(ptr, value, __ATOMIC_SEQ_CST);
+}
+
+static inline int atomic_cas_int(volatile int *ptr, int expected,
+                                 int desired) {
+  return __atomic_compare_exchange_n(ptr, &expected, desired, 0,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+static inline void *atomic_load_ptr(void *volatile *ptr) {
+  return __atomic_load_n(ptr, __ATOMIC_SEQ_CST);
+}
+
+static inline void *atomic_exchange_ptr(void *volatile *ptr, void *value) {
+  return __atomic_exchange_n(ptr, value, __ATOMIC_SEQ_CST);
+}
+
+static inline int atomic_cas_ptr(void *volatile *ptr, void *expected,
+                                 void *desired) {
+  return __atomic_compare_exchange_n(ptr, &expected, desired, 0,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+static inline void cpu_relax() {
+#if ARCH_X64
+  __builtin_ia32_pause();
+#elif ARCH_A64
+  __asm__ volatile("yield");
+#endif
+}
+#endif
+
 /*
  * tls
  */
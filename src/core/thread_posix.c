@@ -1,31 +1,130 @@
 #include <errno.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdlib.h>
 #include <time.h>
+#include <unistd.h>
 #include "core/core.h"
 #include "core/thread.h"
 
-static void thread_destroy(pthread_t *pthread) {
-  free(pthread);
+/* linux limits thread names to 16 bytes, including the null terminator */
+#define THREAD_MAX_NAME 16
+
+struct thread_wrapper {
+  thread_fn fn;
+  void *data;
+  char name[THREAD_MAX_NAME];
+  pthread_t pthread;
+};
+
+static void *thread_thunk(void *data) {
+  struct thread_wrapper *wrapper = data;
+
+  if (wrapper->name[0]) {
+    thread_set_name(wrapper->name);
+  }
+
+  return wrapper->fn(wrapper->data);
+}
+
+static void thread_destroy(struct thread_wrapper *wrapper) {
+  free(wrapper);
+}
+
+static pthread_t thread_handle(thread_t thread) {
+  struct thread_wrapper *wrapper = (struct thread_wrapper *)thread;
+
+  return wrapper ? wrapper->pthread : pthread_self();
+}
+
+int thread_set_priority(thread_t thread, int priority) {
+  struct sched_param param = {0};
+  int policy = SCHED_OTHER;
+
+  switch (priority) {
+    case THREAD_PRIO_LOW:
+#ifdef SCHED_BATCH
+      policy = SCHED_BATCH;
+#endif
+      break;
+    case THREAD_PRIO_NORMAL:
+      break;
+    case THREAD_PRIO_HIGH:
+      policy = SCHED_RR;
+      param.sched_priority = sched_get_priority_min(policy);
+      break;
+    case THREAD_PRIO_REALTIME:
+      policy = SCHED_FIFO;
+      param.sched_priority =
+          (sched_get_priority_min(policy) + sched_get_priority_max(policy)) /
+          2;
+      break;
+    default:
+      return 0;
+  }
+
+  return pthread_setschedparam(thread_handle(thread), policy, &param) == 0;
+}
+
+int thread_set_affinity(thread_t thread, uint64_t cpus) {
+#if PLATFORM_LINUX
+  cpu_set_t set;
+  CPU_ZERO(&set);
+
+  for (int i = 0; i < 64 && i < CPU_SETSIZE; i++) {
+    if (cpus & (1ull << i)) {
+      CPU_SET(i, &set);
+    }
+  }
+
+  return pthread_setaffinity_np(thread_handle(thread), sizeof(set), &set) ==
+         0;
+#else
+  /* darwin only offers affinity hints between threads, not pinning */
+  return 0;
+#endif
+}
+
+void thread_set_name(const char *name) {
+#if PLATFORM_DARWIN
+  pthread_setname_np(name);
+#elif PLATFORM_LINUX || PLATFORM_ANDROID
+  char truncated[THREAD_MAX_NAME];
+  strncpy(truncated, name, sizeof(truncated) - 1);
+  truncated[sizeof(truncated) - 1] = 0;
+
+  pthread_setname_np(pthread_self(), truncated);
+#endif
 }
 
 thread_t thread_create(thread_fn fn, const char *name, void *data) {
-  pthread_t *pthread = calloc(1, sizeof(pthread_t));
+  struct thread_wrapper *wrapper = calloc(1, sizeof(struct thread_wrapper));
+
+  wrapper->fn = fn;
+  wrapper->data = data;
+  if (name) {
+    strncpy(wrapper->name, name, sizeof(wrapper->name) - 1);
+  }
 
-  if (pthread_create(pthread, NULL, fn, data)) {
-    thread_destroy(pthread);
+  if (pthread_create(&wrapper->pthread, NULL, &thread_thunk, wrapper)) {
+    thread_destroy(wrapper);
     return NULL;
   }
 
-  return (thread_t)pthread;
+  return (thread_t)wrapper;
 }
 
 void thread_join(thread_t thread, void **result) {
-  pthread_t *pthread = (pthread_t *)thread;
+  struct thread_wrapper *wrapper = (struct thread_wrapper *)thread;
 
-  CHECK_EQ(pthread_join(*pthread, result), 0);
+  CHECK_EQ(pthread_join(wrapper->pthread, result), 0);
 
-  thread_destroy(pthread);
+  thread_destroy(wrapper);
+}
+
+int thread_num_cpus() {
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? (int)n : 1;
 }
 
 mutex_t mutex_create() {
@@ -96,7 +195,11 @@ int cond_timedwait(cond_t cond, mutex_t mutex, int ms) {
   struct timespec wait;
   clock_gettime(CLOCK_REALTIME, &wait);
   wait.tv_sec += ms / 1000;
-  wait.tv_nsec += ms % 1000;
+  wait.tv_nsec += (ms % 1000) * 1000000;
+  if (wait.tv_nsec >= 1000000000) {
+    wait.tv_sec += 1;
+    wait.tv_nsec -= 1000000000;
+  }
 
   int res = pthread_cond_timedwait(pcond, pmutex, &wait);
   if (res == 0) {
@@ -114,6 +217,13 @@ void cond_signal(cond_t cond) {
   CHECK_EQ(res, 0);
 }
 
+void cond_broadcast(cond_t cond) {
+  pthread_cond_t *pcond = (pthread_cond_t *)cond;
+
+  int res = pthread_cond_broadcast(pcond);
+  CHECK_EQ(res, 0);
+}
+
 void cond_destroy(cond_t cond) {
   pthread_cond_t *pcond = (pthread_cond_t *)cond;
 
@@ -3,15 +3,24 @@
 #include "core/core.h"
 #include "core/thread.h"
 
+#define THREAD_MAX_NAME 64
+
 struct thread_wrapper {
   thread_fn fn;
   void *data;
+  char name[THREAD_MAX_NAME];
   HANDLE handle;
 };
 
+typedef HRESULT(WINAPI *set_thread_description_fn)(HANDLE, PCWSTR);
+
 static DWORD thread_thunk(LPVOID data) {
   struct thread_wrapper *wrapper = data;
 
+  if (wrapper->name[0]) {
+    thread_set_name(wrapper->name);
+  }
+
   return (DWORD)(intptr_t)wrapper->fn(wrapper->data);
 }
 
@@ -19,11 +28,64 @@ static void thread_destroy(struct thread_wrapper *wrapper) {
   free(wrapper);
 }
 
+static HANDLE thread_handle(thread_t thread) {
+  struct thread_wrapper *wrapper = (struct thread_wrapper *)thread;
+
+  return wrapper ? wrapper->handle : GetCurrentThread();
+}
+
+int thread_set_priority(thread_t thread, int priority) {
+  int wpriority;
+
+  switch (priority) {
+    case THREAD_PRIO_LOW:
+      wpriority = THREAD_PRIORITY_BELOW_NORMAL;
+      break;
+    case THREAD_PRIO_NORMAL:
+      wpriority = THREAD_PRIORITY_NORMAL;
+      break;
+    case THREAD_PRIO_HIGH:
+      wpriority = THREAD_PRIORITY_HIGHEST;
+      break;
+    case THREAD_PRIO_REALTIME:
+      wpriority = THREAD_PRIORITY_TIME_CRITICAL;
+      break;
+    default:
+      return 0;
+  }
+
+  return SetThreadPriority(thread_handle(thread), wpriority) != 0;
+}
+
+int thread_set_affinity(thread_t thread, uint64_t cpus) {
+  return SetThreadAffinityMask(thread_handle(thread), (DWORD_PTR)cpus) != 0;
+}
+
+void thread_set_name(const char *name) {
+  /* SetThreadDescription is only available on windows 10 1607 and later */
+  set_thread_description_fn set_description =
+      (set_thread_description_fn)GetProcAddress(GetModuleHandleA("kernel32"),
+                                                "SetThreadDescription");
+  if (!set_description) {
+    return;
+  }
+
+  WCHAR wname[THREAD_MAX_NAME];
+  if (!MultiByteToWideChar(CP_UTF8, 0, name, -1, wname, THREAD_MAX_NAME)) {
+    return;
+  }
+
+  set_description(GetCurrentThread(), wname);
+}
+
 thread_t thread_create(thread_fn fn, const char *name, void *data) {
   struct thread_wrapper *wrapper = calloc(1, sizeof(struct thread_wrapper));
 
   wrapper->fn = fn;
   wrapper->data = data;
+  if (name) {
+    strncpy(wrapper->name, name, sizeof(wrapper->name) - 1);
+  }
   wrapper->handle = CreateThread(NULL, 0, &thread_thunk, wrapper, 0, NULL);
 
   if (!wrapper->handle) {
@@ -42,6 +104,12 @@ void thread_join(thread_t thread, void **result) {
   thread_destroy(wrapper);
 }
 
+int thread_num_cpus() {
+  SYSTEM_INFO si;
+  GetSystemInfo(&si);
+  return si.dwNumberOfProcessors > 0 ? (int)si.dwNumberOfProcessors : 1;
+}
+
 mutex_t mutex_create() {
   CRITICAL_SECTION *wmutex = calloc(1, sizeof(CRITICAL_SECTION));
 
@@ -105,6 +173,12 @@ void cond_signal(cond_t cond) {
   WakeConditionVariable(wcond);
 }
 
+void cond_broadcast(cond_t cond) {
+  CONDITION_VARIABLE *wcond = (CONDITION_VARIABLE *)cond;
+
+  WakeAllConditionVariable(wcond);
+}
+
 void cond_destroy(cond_t cond) {
   CONDITION_VARIABLE *wcond = (CONDITION_VARIABLE *)cond;
 
@@ -0,0 +1,108 @@
+/*
+ * implementation of the 64-bit variant of Yann Collet's xxHash algorithm:
+ * https://github.com/Cyan4973/xxHash
+ *
+ * it's not a cryptographic hash, but it's fast enough to be used for
+ * detecting changes in guest data that's about to be reprocessed
+ */
+
+#include <string.h>
+#include "core/xxhash.h"
+
+#define PRIME64_1 UINT64_C(0x9e3779b185ebca87)
+#define PRIME64_2 UINT64_C(0xc2b2ae3d27d4eb4f)
+#define PRIME64_3 UINT64_C(0x165667b19e3779f9)
+#define PRIME64_4 UINT64_C(0x85ebca77c2b2ae63)
+#define PRIME64_5 UINT64_C(0x27d4eb2f165667c5)
+
+static inline uint64_t xxh_rotl64(uint64_t x, int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t xxh_read64(const uint8_t *ptr) {
+  uint64_t v;
+  memcpy(&v, ptr, sizeof(v));
+  return v;
+}
+
+static inline uint32_t xxh_read32(const uint8_t *ptr) {
+  uint32_t v;
+  memcpy(&v, ptr, sizeof(v));
+  return v;
+}
+
+static inline uint64_t xxh_round(uint64_t acc, uint64_t input) {
+  acc += input * PRIME64_2;
+  acc = xxh_rotl64(acc, 31);
+  acc *= PRIME64_1;
+  return acc;
+}
+
+static inline uint64_t xxh_merge_round(uint64_t acc, uint64_t val) {
+  val = xxh_round(0, val);
+  acc ^= val;
+  acc = acc * PRIME64_1 + PRIME64_4;
+  return acc;
+}
+
+uint64_t xxh64(const void *data, size_t size, uint64_t seed) {
+  const uint8_t *ptr = data;
+  const uint8_t *end = ptr + size;
+  uint64_t h;
+
+  if (size >= 32) {
+    const uint8_t *limit = end - 32;
+    uint64_t v1 = seed + PRIME64_1 + PRIME64_2;
+    uint64_t v2 = seed + PRIME64_2;
+    uint64_t v3 = seed;
+    uint64_t v4 = seed - PRIME64_1;
+
+    /* process 32 byte stripes with 4 independent accumulators */
+    do {
+      v1 = xxh_round(v1, xxh_read64(ptr));
+      v2 = xxh_round(v2, xxh_read64(ptr + 8));
+      v3 = xxh_round(v3, xxh_read64(ptr + 16));
+      v4 = xxh_round(v4, xxh_read64(ptr + 24));
+      ptr += 32;
+    } while (ptr <= limit);
+
+    h = xxh_rotl64(v1, 1) + xxh_rotl64(v2, 7) + xxh_rotl64(v3, 12) +
+        xxh_rotl64(v4, 18);
+    h = xxh_merge_round(h, v1);
+    h = xxh_merge_round(h, v2);
+    h = xxh_merge_round(h, v3);
+    h = xxh_merge_round(h, v4);
+  } else {
+    h = seed + PRIME64_5;
+  }
+
+  h += (uint64_t)size;
+
+  /* process the remaining tail */
+  while (ptr + 8 <= end) {
+    h ^= xxh_round(0, xxh_read64(ptr));
+    h = xxh_rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+    ptr += 8;
+  }
+
+  if (ptr + 4 <= end) {
+    h ^= (uint64_t)xxh_read32(ptr) * PRIME64_1;
+    h = xxh_rotl64(h, 23) * PRIME64_2 + PRIME64_3;
+    ptr += 4;
+  }
+
+  while (ptr < end) {
+    h ^= (*ptr) * PRIME64_5;
+    h = xxh_rotl64(h, 11) * PRIME64_1;
+    ptr++;
+  }
+
+  /* final avalanche */
+  h ^= h >> 33;
+  h *= PRIME64_2;
+  h ^= h >> 29;
+  h *= PRIME64_3;
+  h ^= h >> 32;
+
+  return h;
+}
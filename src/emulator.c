@@ -12,9 +12,14 @@
  */
 
 #include "emulator.h"
+#include "core/exception_handler.h"
+#include "core/filesystem.h"
+#include "core/hash_map.h"
 #include "core/memory.h"
 #include "core/thread.h"
 #include "core/time.h"
+#include "core/xxhash.h"
+#include "file/pacing_log.h"
 #include "file/trace.h"
 #include "guest/aica/aica.h"
 #include "guest/arm7/arm7.h"
@@ -23,13 +28,18 @@
 #include "guest/gdrom/gdrom.h"
 #include "guest/holly/holly.h"
 #include "guest/maple/maple.h"
+#include "guest/memory.h"
 #include "guest/pvr/pvr.h"
 #include "guest/pvr/ta.h"
 #include "guest/pvr/tr.h"
+#include "guest/rom/boot.h"
 #include "guest/scheduler.h"
 #include "guest/sh4/sh4.h"
+#include "guest/snapshot.h"
 #include "host/host.h"
 #include "imgui.h"
+#include "jit/pass_stats.h"
+#include "netplay.h"
 #include "options.h"
 #include "render/render_backend.h"
 #include "stats.h"
@@ -40,6 +50,11 @@ enum {
   ASPECT_RATIO_4BY3,
 };
 
+#define EMU_NUM_CONT_INPUTS (K_CONT_RTRIG - K_CONT_C + 1)
+
+/* how often host input is polled while waiting on the guest to run a frame */
+#define EMU_INPUT_POLL_MS 1
+
 /* emulation thread state */
 enum {
   EMU_SHUTDOWN,
@@ -49,12 +64,106 @@ enum {
   EMU_ENDFRAME,
 };
 
+/* state of the mailbox pending contexts are handed to the video thread
+   through */
+enum {
+  EMU_CTX_EMPTY,
+  EMU_CTX_POSTED,
+  EMU_CTX_CLAIMED,
+};
+
+/* iterations spent polling for the other thread before going to sleep. most
+   handoffs complete well within this, avoiding the latency of a wakeup */
+#define EMU_SPIN_ITERS 1024
+
+/* wakes a thread waiting on shared state to change. the state is updated
+   with atomics, after which the signal is notified. waiters spin on the
+   sequence number for a short while before sleeping on the condition
+   variable, and notifying only takes the lock when a waiter is asleep */
+struct emu_signal {
+  volatile int seq;
+  volatile int sleepers;
+  mutex_t mutex;
+  cond_t cond;
+};
+
+/* readbacks of frames rendered to textures that may be in flight at once, and
+   the largest render target they're supported for */
+#define EMU_MAX_WRITEBACKS 2
+#define EMU_WRITEBACK_SIZE (1024 * 1024 * 4)
+
 enum {
   EMU_SOURCE_NONE,
   EMU_SOURCE_CTX,
   EMU_SOURCE_PXL,
 };
 
+/* categories of the per-frame time breakdown, each backed by a time counter */
+enum {
+  EMU_TIME_SH4,
+  EMU_TIME_ARM7,
+  EMU_TIME_TIMERS,
+  EMU_TIME_JIT,
+  EMU_TIME_TA,
+  EMU_TIME_TEXTURES,
+  EMU_TIME_RENDER,
+  EMU_TIME_SWAP,
+  EMU_NUM_TIMES,
+};
+
+static const char *EMU_TIME_NAMES[EMU_NUM_TIMES] = {
+    "sh4", "arm7", "timers", "jit compile",
+    "ta parse", "textures", "render", "swap",
+};
+
+static const uint32_t EMU_TIME_COLORS[EMU_NUM_TIMES] = {
+    0xff4a8cf0, 0xff4ad0f0, 0xff4af08c, 0xff2020e0,
+    0xfff0a04a, 0xfff04ad0, 0xffd0d0d0, 0xff808080,
+};
+
+#define EMU_TIMES_HISTORY 120
+
+/* texture cache statistics shown under the breakdown, each backed by a
+   counter. the last is the live size, not a per-frame delta */
+enum {
+  EMU_TEX_HITS,
+  EMU_TEX_MISSES,
+  EMU_TEX_DECODES,
+  EMU_TEX_UPLOADS,
+  EMU_TEX_UPDATES,
+  EMU_TEX_EVICTIONS,
+  EMU_TEX_BYTES,
+  EMU_NUM_TEX_STATS,
+};
+
+/* gpu time of each render stage, shown apart from the breakdown as it runs
+   in parallel with the cpu. the queries are read back a few frames late, so
+   these trail the breakdown slightly */
+enum {
+  EMU_GPU_BACKGROUND,
+  EMU_GPU_OPAQUE,
+  EMU_GPU_PUNCH_THROUGH,
+  EMU_GPU_TRANSLUCENT,
+  EMU_GPU_UI,
+  EMU_NUM_GPU_TIMES,
+};
+
+static const char *EMU_GPU_TIME_NAMES[EMU_NUM_GPU_TIMES] = {
+    "gpu bg", "gpu opaque", "gpu punch", "gpu trans", "gpu ui",
+};
+
+#define EMU_MAX_TEXTURES 8192
+
+/* textures not referenced by a context for this many renders are evicted,
+   releasing their memory watches and backend handles. the live set is
+   scanned for them every EMU_TEXTURE_EVICT_INTERVAL frames */
+#define EMU_TEXTURE_MAX_AGE 3600
+#define EMU_TEXTURE_EVICT_INTERVAL 60
+
+/* minimum time between traces captured for frames over budget, as exporting
+   a trace blows the budget of the frames following it */
+#define EMU_CAPTURE_INTERVAL (5 * NS_PER_SEC)
+
 struct emu_framebuffer {
   uint8_t data[PVR_FRAMEBUFFER_SIZE];
   int width;
@@ -65,12 +174,16 @@ struct emu_texture {
   struct tr_texture;
   struct emu *emu;
   struct list_node free_it;
-  struct rb_node live_it;
+  struct hash_map_node live_it;
 
   struct memory_watch *texture_watch;
   struct memory_watch *palette_watch;
-  struct list_node modified_it;
+  struct emu_texture *modified_next;
   int modified;
+
+  /* set when the trace writer dropped the texture, it's retried the next time
+     the texture is registered */
+  int trace_pending;
 };
 
 struct emu {
@@ -87,30 +200,92 @@ struct emu {
      upwards of doubles the performance */
   int multi_threaded;
 
-  /* emulation thread synchronization primitives */
+  /* emulation thread synchronization. the video thread requests frames and
+     the emulation thread responds with their progress by atomically updating
+     state and the pending context's mailbox, each notifying the other's
+     signal */
   volatile int state;
   volatile unsigned frame;
   thread_t run_thread;
-  mutex_t req_mutex;
-  cond_t req_cond;
-  mutex_t res_mutex;
-  cond_t res_cond;
+  struct emu_signal req_signal;
+  struct emu_signal res_signal;
 
   /* latest video state pushed by the dreamcast */
   volatile int vid_disabled;
+  /* guest time of the latest vblank_in, which the frame is presented at */
+  int64_t vid_time;
   volatile int vid_source;
-  struct tr_context vid_rc;
+  struct tr_converter *vid_cv;
+  struct tr_context vid_rcs[2];
+  int vid_rc;
   struct emu_framebuffer vid_fb;
 
-  /* latest context submitted to emu_start_render */
+  /* set when the current render context is new, and hasn't been written back
+     to its render target yet */
+  int vid_writeback;
+
+  /* when the reuse_frames option is enabled, the hash of the context last
+     converted into the current render context. contexts submitted with the
+     same hash and no dirty textures are identical to it, so converting them
+     is skipped and the frame last rendered is presented again */
+  uint64_t vid_hash;
+  int vid_hash_valid;
+  int vid_reused;
+
+  /* position in the current frameskip period while fast forwarding */
+  int vid_skip_frame;
+
+  /* set by the host when the next frame won't be shown */
+  int vid_hidden;
+
+  /* when enabled, frames rendered to textures are read back without stalling
+     and written to vram before the guest next runs once available, normally a
+     frame later. titles in the fb_writeback_sync list instead wait on their
+     readbacks, ensuring they're written before the next frame */
+  int wb_sync;
+  struct ta_render_target wb_targets[EMU_MAX_WRITEBACKS];
+  int wb_head;
+  int wb_num;
+  uint8_t wb_pixels[EMU_WRITEBACK_SIZE];
+
+  /* latest context submitted to emu_start_render. when multi-threaded, the
+     video thread claims the context before converting it, and the emulation
+     thread waits for the claim to be released before touching the texture
+     cache again */
   struct ta_context *pending_ctx;
+  volatile int pending_state;
+  uint64_t pending_hash;
+  int pending_dirty;
+
+  /* when pipelined, the main thread only uploads the pending context's
+     textures, handing it off to the parse thread to be converted into the
+     back render context while the front one is submitted. once finished,
+     the two are swapped before the next frame is rendered */
+  int pipelined;
+  thread_t parse_thread;
+  mutex_t parse_mutex;
+  cond_t parse_cond;
+  cond_t parse_done_cond;
+  int parse_shutdown;
+  struct ta_context *parse_ctx;
+  int parse_ready;
 
   /* texture cache. the dreamcast interface calls into us when new contexts are
      available to be rendered. parsing the contexts, uploading their textures to
      the render backend, and managing the texture cache is our responsibility */
-  struct emu_texture textures[8192];
+  struct emu_texture textures[EMU_MAX_TEXTURES];
   struct list free_textures;
-  struct rb_tree live_textures;
+  struct hash_map live_textures;
+  /* write watches on the guest memory backing the textures */
+  struct memory_watcher *watcher;
+
+  /* when the pool is exhausted, the emulation thread steals the least
+     recently used texture. its handle may still be in use by the video
+     thread, so it's released by the video thread at the next eviction */
+  struct tr_texture *dead_textures;
+  int num_dead_textures;
+  int max_dead_textures;
+  int evict_countdown;
 
   /* textures for the current context are uploaded to the render backend by the
      video thread in parallel to the emulation thread executing. normally, this
@@ -118,96 +293,241 @@ struct emu {
      some games will be naughty and modify a texture before receiving the end of
      render interrupt. in order to avoid race conditions around accessing the
      texture's dirty state, textures are not immediately marked dirty by the
-     emulation thread when modified. instead, they are added to this modified
-     list which will be processed the next time the threads are synchronized */
-  struct list modified_textures;
+     emulation thread when modified. instead, they are pushed to this lock-free
+     queue which will be drained the next time the threads are synchronized */
+  struct emu_texture *volatile modified_textures;
+
+  /* snapshots taken at the end of each frame for rewinding */
+  struct snapshots *snapshots;
+
+  /* when running ahead, the frames between the guest's real timeline and the
+     frame displayed are hidden. they're ran without any video or audio being
+     output, and end on vblank_out rather than by handshaking with the main
+     thread. the real timeline is restored from the snapshot before the next
+     frame is ran */
+  struct snapshots *runahead;
+  int runahead_valid;
+  int runahead_hidden;
+  int runahead_done;
+  int audio_muted;
+
+  /* when playing online, frames are ran by the netplay session, which may
+     re-simulate previous frames as hidden frames */
+  struct netplay *netplay;
+  int64_t vblanks;
+
+  /* path the disc's boot snapshot is saved to once it has booted, empty once
+     saved or if it was restored from one */
+  char boot_state[PATH_MAX];
+
+  /* latest controller state from the host. it's only applied to the guest
+     when the guest polls the controllers, so it's sampled as late as
+     possible */
+  mutex_t input_mutex;
+  int input_dirty;
+  int16_t input[MAPLE_NUM_PORTS][EMU_NUM_CONT_INPUTS];
+  int16_t input_applied[MAPLE_NUM_PORTS][EMU_NUM_CONT_INPUTS];
 
   /* debugging */
   struct trace_writer *trace_writer;
+  int trace_dropping;
+  struct pacing_log *pacing_log;
+
+  /* per-frame breakdown of where time went, sampled from the time counters at
+     the start of each frame. the work of multiple threads is summed, so the
+     breakdown of a frame may exceed its wall time */
+  int show_times;
+  int show_jit_stats;
+  int show_exceptions;
+  int show_memory;
+  int64_t times_start;
+  int64_t times_total[EMU_NUM_TIMES];
+  float times[EMU_TIMES_HISTORY][EMU_NUM_TIMES];
+  float times_wall[EMU_TIMES_HISTORY];
+  int times_head;
+  int64_t last_capture;
+  int num_captures;
+  int64_t tex_total[EMU_NUM_TEX_STATS];
+  int64_t tex_stats[EMU_NUM_TEX_STATS];
+  int64_t gpu_total[EMU_NUM_GPU_TIMES];
+  float gpu_times[EMU_NUM_GPU_TIMES];
+
+  /* cpu clocks the emulator was created with, restored for titles without
+     their own saved in the clock speed menu */
+  int sh4_clock;
+  int arm7_clock;
+  int clocks_dirty;
 };
 
 /*
  * texture cache
  */
-static int emu_texture_cmp(const struct rb_node *rb_lhs,
-                           const struct rb_node *rb_rhs) {
-  const struct emu_texture *lhs =
-      rb_entry(rb_lhs, const struct emu_texture, live_it);
-  tr_texture_key_t lhs_key = tr_texture_key(lhs->tsp, lhs->tcw);
-
-  const struct emu_texture *rhs =
-      rb_entry(rb_rhs, const struct emu_texture, live_it);
-  tr_texture_key_t rhs_key = tr_texture_key(rhs->tsp, rhs->tcw);
-
-  if (lhs_key < rhs_key) {
-    return -1;
-  } else if (lhs_key > rhs_key) {
-    return 1;
-  } else {
-    return 0;
-  }
-}
-
-static struct rb_callbacks emu_texture_cb = {&emu_texture_cmp, NULL, NULL};
+static void emu_sync_parse(struct emu *emu);
 
 static void emu_dirty_textures(struct emu *emu) {
   LOG_INFO("emu_dirty_textures");
 
-  struct rb_node *it = rb_first(&emu->live_textures);
-
-  while (it) {
-    struct rb_node *next = rb_next(it);
-    struct emu_texture *tex = rb_entry(it, struct emu_texture, live_it);
-
+  hash_map_for_each_entry(tex, &emu->live_textures, struct emu_texture,
+                          live_it) {
     tex->dirty = 1;
-
-    it = next;
   }
 }
 
 static void emu_dirty_modified_textures(struct emu *emu) {
-  list_for_each_entry(tex, &emu->modified_textures, struct emu_texture,
-                      modified_it) {
+  /* the consumer takes the entire queue at once */
+  struct emu_texture *tex =
+      atomic_exchange_ptr((void *volatile *)&emu->modified_textures, NULL);
+
+  while (tex) {
+    struct emu_texture *next = tex->modified_next;
+    tex->modified_next = NULL;
     tex->dirty = 1;
     tex->modified = 0;
+    tex = next;
+  }
+}
+
+static void emu_push_modified_texture(struct emu_texture *tex) {
+  if (tex->modified) {
+    return;
   }
 
-  list_clear(&emu->modified_textures);
+  tex->modified = 1;
+
+  /* producers push onto the head of the queue */
+  struct emu *emu = tex->emu;
+  struct emu_texture *head;
+
+  do {
+    head = emu->modified_textures;
+    tex->modified_next = head;
+  } while (!atomic_cas_ptr((void *volatile *)&emu->modified_textures, head,
+                           tex));
 }
 
 static void emu_texture_modified(const struct exception_state *ex, void *data) {
   struct emu_texture *tex = data;
   tex->texture_watch = NULL;
 
-  if (!tex->modified) {
-    list_add(&tex->emu->modified_textures, &tex->modified_it);
-    tex->modified = 1;
-  }
+  emu_push_modified_texture(tex);
 }
 
 static void emu_palette_modified(const struct exception_state *ex, void *data) {
   struct emu_texture *tex = data;
   tex->palette_watch = NULL;
 
-  if (!tex->modified) {
-    list_add(&tex->emu->modified_textures, &tex->modified_it);
-    tex->modified = 1;
-  }
+  emu_push_modified_texture(tex);
 }
 
 static void emu_free_texture(struct emu *emu, struct emu_texture *tex) {
-  /* remove from live tree */
-  rb_unlink(&emu->live_textures, &tex->live_it, &emu_texture_cb);
+  /* remove from live map */
+  hash_map_remove(&emu->live_textures, &tex->live_it);
 
   /* add back to free list */
   list_add(&emu->free_textures, &tex->free_it);
 }
 
+static void emu_evict_texture(struct emu *emu, struct emu_texture *tex,
+                              int defer) {
+  if (tex->texture_watch) {
+    remove_memory_watch(emu->watcher, tex->texture_watch);
+    tex->texture_watch = NULL;
+  }
+
+  if (tex->palette_watch) {
+    remove_memory_watch(emu->watcher, tex->palette_watch);
+    tex->palette_watch = NULL;
+  }
+
+  /* entries can't be unlinked from the middle of the queue, drain it
+     instead. textures are only evicted while the video thread isn't
+     converting a context, so marking the others dirty early is safe */
+  if (tex->modified) {
+    emu_dirty_modified_textures(emu);
+  }
+
+  if (tex->handle && defer) {
+    if (emu->num_dead_textures >= emu->max_dead_textures) {
+      emu->max_dead_textures = MAX(emu->max_dead_textures * 2, 64);
+      emu->dead_textures =
+          realloc(emu->dead_textures,
+                  emu->max_dead_textures * sizeof(*emu->dead_textures));
+    }
+    emu->dead_textures[emu->num_dead_textures++] = *(struct tr_texture *)tex;
+  } else if (tex->handle) {
+    tr_release_texture(emu->vid_cv, emu->r, (struct tr_texture *)tex);
+  }
+
+  emu_free_texture(emu, tex);
+}
+
+static void emu_release_dead_textures(struct emu *emu) {
+  for (int i = 0; i < emu->num_dead_textures; i++) {
+    tr_release_texture(emu->vid_cv, emu->r, &emu->dead_textures[i]);
+  }
+
+  emu->num_dead_textures = 0;
+}
+
+/* called on the video thread while the emulation thread is idle */
+static void emu_evict_textures(struct emu *emu) {
+  emu_release_dead_textures(emu);
+
+  if (--emu->evict_countdown > 0) {
+    return;
+  }
+  emu->evict_countdown = EMU_TEXTURE_EVICT_INTERVAL;
+
+  /* the parse thread looks textures up while converting the back context */
+  emu_sync_parse(emu);
+
+  int evicted = 0;
+
+  hash_map_for_each_entry_safe(tex, &emu->live_textures, struct emu_texture,
+                               live_it) {
+    if (emu->frame - tex->frame <= EMU_TEXTURE_MAX_AGE) {
+      continue;
+    }
+
+    emu_evict_texture(emu, tex, 0);
+    evicted++;
+  }
+
+  prof_counter_add(COUNTER_texture_evictions, evicted);
+}
+
+static struct emu_texture *emu_steal_texture(struct emu *emu) {
+  struct emu_texture *lru = NULL;
+
+  hash_map_for_each_entry(tex, &emu->live_textures, struct emu_texture,
+                          live_it) {
+    if (!lru || emu->frame - tex->frame > emu->frame - lru->frame) {
+      lru = tex;
+    }
+  }
+
+  /* the front and back contexts may reference textures registered for the
+     previous two renders */
+  if (!lru || emu->frame - lru->frame <= 2) {
+    LOG_FATAL("emu_steal_texture texture cache exhausted");
+  }
+
+  emu_sync_parse(emu);
+  emu_evict_texture(emu, lru, 1);
+  prof_counter_add(COUNTER_texture_evictions, 1);
+
+  return list_first_entry(&emu->free_textures, struct emu_texture, free_it);
+}
+
 static struct emu_texture *emu_alloc_texture(struct emu *emu, union tsp tsp,
                                              union tcw tcw) {
-  /* remove from free list */
+  /* remove from free list, evicting the least recently used texture when
+     there are no free ones */
   struct emu_texture *tex =
       list_first_entry(&emu->free_textures, struct emu_texture, free_it);
+  if (!tex) {
+    tex = emu_steal_texture(emu);
+  }
   CHECK_NOTNULL(tex);
   list_remove(&emu->free_textures, &tex->free_it);
 
@@ -217,8 +537,8 @@ static struct emu_texture *emu_alloc_texture(struct emu *emu, union tsp tsp,
   tex->tsp = tsp;
   tex->tcw = tcw;
 
-  /* add to live tree */
-  rb_insert(&emu->live_textures, &tex->live_it, &emu_texture_cb);
+  /* add to live map */
+  hash_map_insert(&emu->live_textures, tr_texture_key(tsp, tcw), &tex->live_it);
 
   return tex;
 }
@@ -227,13 +547,9 @@ static struct tr_texture *emu_find_texture(void *userdata, union tsp tsp,
                                            union tcw tcw) {
   struct emu *emu = userdata;
 
-  struct emu_texture search;
-  search.tsp = tsp;
-  search.tcw = tcw;
-
   struct emu_texture *tex =
-      rb_find_entry(&emu->live_textures, &search, struct emu_texture, live_it,
-                    &emu_texture_cb);
+      hash_map_find_entry(&emu->live_textures, tr_texture_key(tsp, tcw),
+                          struct emu_texture, live_it);
   return (struct tr_texture *)tex;
 }
 
@@ -258,25 +574,43 @@ static void emu_register_texture_source(struct emu *emu, union tsp tsp,
                     &entry->palette_size);
   }
 
+  if (OPTION_reuse_frames) {
+    emu->pending_dirty |= entry->dirty;
+
+    /* palettes looked up on the gpu are reuploaded with each context rather
+       than dirtying their textures, so they're part of its hash */
+    if (OPTION_gpu_palette && entry->palette && first_registration_this_frame) {
+      emu->pending_hash =
+          xxh64(entry->palette, entry->palette_size, emu->pending_hash);
+    }
+  }
+
 #ifdef NDEBUG
   /* add write callback in order to invalidate on future writes. the callback
      address will be page aligned, therefore it will be triggered falsely in
      some cases. over invalidate in these cases */
   if (!entry->texture_watch) {
-    entry->texture_watch = add_single_write_watch(
-        entry->texture, entry->texture_size, &emu_texture_modified, entry);
+    entry->texture_watch =
+        add_single_write_watch(emu->watcher, entry->texture,
+                               entry->texture_size, &emu_texture_modified,
+                               entry);
   }
 
-  if (entry->palette && !entry->palette_watch) {
-    entry->palette_watch = add_single_write_watch(
-        entry->palette, entry->palette_size, &emu_palette_modified, entry);
+  /* when paletted textures are looked up on the gpu, palette writes don't
+     invalidate them */
+  if (entry->palette && !entry->palette_watch && !OPTION_gpu_palette) {
+    entry->palette_watch =
+        add_single_write_watch(emu->watcher, entry->palette,
+                               entry->palette_size, &emu_palette_modified,
+                               entry);
   }
 #endif
 
-  if (emu->trace_writer && entry->dirty && first_registration_this_frame) {
-    trace_writer_insert_texture(emu->trace_writer, tsp, tcw, entry->frame,
-                                entry->palette, entry->palette_size,
-                                entry->texture, entry->texture_size);
+  if (emu->trace_writer && (entry->dirty || entry->trace_pending) &&
+      first_registration_this_frame) {
+    entry->trace_pending = !trace_writer_insert_texture(
+        emu->trace_writer, tsp, tcw, entry->frame, entry->palette,
+        entry->palette_size, entry->texture, entry->texture_size);
   }
 }
 
@@ -321,10 +655,14 @@ static void emu_stop_tracing(struct emu *emu) {
     return;
   }
 
+  struct trace_stats stats;
+  trace_writer_stats(emu->trace_writer, &stats);
+
   trace_writer_close(emu->trace_writer);
   emu->trace_writer = NULL;
 
-  LOG_INFO("end tracing");
+  LOG_INFO("end tracing, %d frames and %d textures dropped",
+           stats.dropped_frames, stats.dropped_textures);
 }
 
 static void emu_start_tracing(struct emu *emu) {
@@ -336,6 +674,7 @@ static void emu_start_tracing(struct emu *emu) {
   get_next_trace_filename(filename, sizeof(filename));
 
   emu->trace_writer = trace_writer_open(filename);
+  emu->trace_dropping = 0;
 
   if (!emu->trace_writer) {
     LOG_INFO("failed to start tracing");
@@ -349,194 +688,931 @@ static void emu_start_tracing(struct emu *emu) {
   LOG_INFO("begin tracing to %s", filename);
 }
 
-/*
- * dreamcast guest interface
- */
-static void emu_vblank_in(void *userdata, int vid_disabled) {
-  struct emu *emu = userdata;
+static void emu_export_profile(struct emu *emu) {
+  char filename[PATH_MAX];
+  snprintf(filename, sizeof(filename), "%s" PATH_SEPARATOR "redream.trace.json",
+           fs_appdir());
 
-  if (emu->multi_threaded) {
-    mutex_lock(emu->res_mutex);
+  if (!prof_export_trace(filename)) {
+    LOG_WARNING("failed to export profile to %s", filename);
+    return;
   }
 
-  emu->state = EMU_DRAWFRAME;
-  emu->vid_disabled = vid_disabled;
+  LOG_INFO("exported profile to %s", filename);
+}
 
-  if (emu->multi_threaded) {
-    cond_signal(emu->res_cond);
-    mutex_unlock(emu->res_mutex);
+static void emu_capture_frame(struct emu *emu, int64_t now) {
+  if (now - emu->last_capture < EMU_CAPTURE_INTERVAL) {
+    return;
   }
-}
 
-static void emu_vblank_out(void *userdata) {
-  struct emu *emu = userdata;
+  char filename[PATH_MAX];
+  snprintf(filename, sizeof(filename),
+           "%s" PATH_SEPARATOR "redream.slow.%d.trace.json", fs_appdir(),
+           emu->num_captures++);
+
+  if (!prof_export_trace(filename)) {
+    LOG_WARNING("failed to export slow frame profile to %s", filename);
+  } else {
+    LOG_INFO("exported slow frame profile to %s", filename);
+  }
 
-  emu->state = EMU_ENDFRAME;
+  emu->last_capture = time_nanoseconds();
 }
 
-static void emu_finish_render(void *userdata) {
-  struct emu *emu = userdata;
+static void emu_sample_times(struct emu *emu) {
+  prof_token_t tokens[EMU_NUM_TIMES] = {
+      COUNTER_sh4_time,         COUNTER_arm7_time,     COUNTER_timer_time,
+      COUNTER_jit_compile_time, COUNTER_ta_parse_time, COUNTER_texture_time,
+      COUNTER_render_time,      COUNTER_swap_time,
+  };
+
+  prof_token_t tex_tokens[EMU_NUM_TEX_STATS] = {
+      COUNTER_texture_hits,      COUNTER_texture_misses,
+      COUNTER_texture_decodes,   COUNTER_texture_uploads,
+      COUNTER_texture_updates,   COUNTER_texture_evictions,
+      COUNTER_texture_bytes,
+  };
+
+  prof_token_t gpu_tokens[EMU_NUM_GPU_TIMES] = {
+      COUNTER_gpu_background_time,    COUNTER_gpu_opaque_time,
+      COUNTER_gpu_punch_through_time, COUNTER_gpu_translucent_time,
+      COUNTER_gpu_ui_time,
+  };
+
+  int64_t now = time_nanoseconds();
+  int head = emu->times_head % EMU_TIMES_HISTORY;
+  int first = !emu->times_start;
+
+  for (int i = 0; i < EMU_NUM_TIMES; i++) {
+    int64_t total = prof_counter_total(tokens[i]);
+    emu->times[head][i] = (float)(total - emu->times_total[i]) / NS_PER_MS;
+    emu->times_total[i] = total;
+  }
 
-  if (emu->multi_threaded) {
-    /* ideally, the video thread has parsed the pending context, uploaded its
-       textures, etc. during the estimated render time. however, if it hasn't
-       finished, the emulation thread must be paused to avoid altering
-       the yet-to-be-uploaded texture memory */
-    mutex_lock(emu->res_mutex);
+  for (int i = 0; i < EMU_NUM_TEX_STATS; i++) {
+    int64_t total = prof_counter_total(tex_tokens[i]);
+    emu->tex_stats[i] = total - emu->tex_total[i];
+    emu->tex_total[i] = total;
+  }
+  emu->tex_stats[EMU_TEX_BYTES] = emu->tex_total[EMU_TEX_BYTES];
+
+  for (int i = 0; i < EMU_NUM_GPU_TIMES; i++) {
+    int64_t total = prof_counter_total(gpu_tokens[i]);
+    emu->gpu_times[i] = (float)(total - emu->gpu_total[i]) / NS_PER_MS;
+    emu->gpu_total[i] = total;
+  }
+
+  float wall = (float)(now - emu->times_start) / NS_PER_MS;
+  emu->times_start = now;
 
-    /* if pending_ctx is non-NULL here, a frame is being skipped */
-    emu->pending_ctx = NULL;
-    cond_signal(emu->res_cond);
+  /* the first sample only establishes the baseline */
+  if (first) {
+    return;
+  }
 
-    mutex_unlock(emu->res_mutex);
+  emu->times_wall[head] = wall;
+  emu->times_head++;
+
+  if (OPTION_frame_budget && wall > OPTION_frame_budget) {
+    emu_capture_frame(emu, now);
   }
 }
 
-static void emu_start_render(void *userdata, struct ta_context *ctx) {
-  struct emu *emu = userdata;
+#ifdef HAVE_IMGUI
+static void emu_times_window(struct emu *emu) {
+  bool opened = true;
+
+  if (igBegin("frame breakdown", &opened, ImGuiWindowFlags_AlwaysAutoResize)) {
+    int num_frames = MIN(emu->times_head, EMU_TIMES_HISTORY);
+    int last = (emu->times_head + EMU_TIMES_HISTORY - 1) % EMU_TIMES_HISTORY;
+    float max_ms = 1000.0f / 30.0f;
+
+    /* stacked bar per frame, oldest on the left */
+    struct ImDrawList *list = igGetWindowDrawList();
+    struct ImVec2 pos;
+    struct ImVec2 size = {EMU_TIMES_HISTORY * 3.0f, 100.0f};
+    igGetCursorScreenPos(&pos);
+
+    struct ImVec2 bg_max = {pos.x + size.x, pos.y + size.y};
+    ImDrawList_AddRectFilled(list, pos, bg_max, 0xa0000000, 0.0f, 0);
+
+    for (int n = 0; n < num_frames; n++) {
+      int i = (emu->times_head - num_frames + n) % EMU_TIMES_HISTORY;
+      float x = pos.x + (EMU_TIMES_HISTORY - num_frames + n) * 3.0f;
+      float y = pos.y + size.y;
+
+      for (int j = 0; j < EMU_NUM_TIMES; j++) {
+        float h = emu->times[i][j] / max_ms * size.y;
+        float top = MAX(y - h, pos.y);
+        struct ImVec2 min = {x, top};
+        struct ImVec2 max = {x + 2.0f, y};
+        ImDrawList_AddRectFilled(list, min, max, EMU_TIME_COLORS[j], 0.0f, 0);
+        y = top;
+      }
+    }
 
-  /* incement internal frame number. this frame number is assigned to the each
-     texture source registered to assert synchronization between the emulator
-     and video thread is working as expected */
-  emu->frame++;
+    /* 60hz and budget lines */
+    float budgets[] = {1000.0f / 60.0f, (float)OPTION_frame_budget};
+    uint32_t budget_colors[] = {0x80ffffff, 0xff0000ff};
 
-  /* now that the video thread is sure to not be accessing the texture data,
-     mark any textures dirty that were invalidated by a memory watch */
-  emu_dirty_modified_textures(emu);
+    for (int i = 0; i < (int)ARRAY_SIZE(budgets); i++) {
+      if (!budgets[i] || budgets[i] > max_ms) {
+        continue;
+      }
+      float y = pos.y + size.y - budgets[i] / max_ms * size.y;
+      struct ImVec2 a = {pos.x, y};
+      struct ImVec2 b = {pos.x + size.x, y};
+      ImDrawList_AddLine(list, a, b, budget_colors[i], 1.0f);
+    }
 
-  /* register the source of each texture referenced by the context with the
-     tile renderer. note, uploading the texture to the render backend happens
-     lazily while converting the context. this registration just lets the
-     backend know where the texture's source data is */
-  emu_register_texture_sources(emu, ctx);
+    igDummy(&size);
 
-  if (emu->trace_writer) {
-    trace_writer_render_context(emu->trace_writer, ctx);
-  }
+    /* legend with the latest frame's times and the average over the graph */
+    for (int j = 0; j < EMU_NUM_TIMES; j++) {
+      float avg = 0.0f;
+      for (int n = 0; n < num_frames; n++) {
+        int i = (last + EMU_TIMES_HISTORY - n) % EMU_TIMES_HISTORY;
+        avg += emu->times[i][j];
+      }
+      avg /= MAX(num_frames, 1);
 
-  if (emu->multi_threaded) {
-    /* save off context and notify video thread that it's available */
-    mutex_lock(emu->res_mutex);
+      struct ImVec4 col;
+      igColorConvertU32ToFloat4(&col, EMU_TIME_COLORS[j]);
+      igTextColored(col, "%-12s %6.2f ms  avg %6.2f ms", EMU_TIME_NAMES[j],
+                    num_frames ? emu->times[last][j] : 0.0f, avg);
+    }
 
-    emu->pending_ctx = ctx;
-    cond_signal(emu->res_cond);
+    igText("%-12s %6.2f ms", "frame",
+           num_frames ? emu->times_wall[last] : 0.0f);
 
-    mutex_unlock(emu->res_mutex);
-  } else {
-    emu->pending_ctx = ctx;
+    igSeparator();
+
+    int64_t *tex = emu->tex_stats;
+    igText("textures     %d hits %d misses %d decodes %d uploads",
+           (int)tex[EMU_TEX_HITS], (int)tex[EMU_TEX_MISSES],
+           (int)tex[EMU_TEX_DECODES], (int)tex[EMU_TEX_UPLOADS]);
+    igText("texture mem  %.2f MB, %d evicted, %d partly updated",
+           tex[EMU_TEX_BYTES] / (1024.0f * 1024.0f),
+           (int)tex[EMU_TEX_EVICTIONS], (int)tex[EMU_TEX_UPDATES]);
+
+    igSeparator();
+
+    for (int j = 0; j < EMU_NUM_GPU_TIMES; j++) {
+      igText("%-12s %6.2f ms", EMU_GPU_TIME_NAMES[j], emu->gpu_times[j]);
+    }
   }
+  igEnd();
+
+  emu->show_times = (int)opened;
 }
 
-static void emu_push_pixels(void *userdata, const uint8_t *data, int w, int h) {
-  struct emu *emu = userdata;
+static void emu_exceptions_window(struct emu *emu) {
+  bool opened = true;
 
-  memcpy(emu->vid_fb.data, data, w * h * 4);
-  emu->vid_fb.width = w;
-  emu->vid_fb.height = h;
+  if (igBegin("exceptions", &opened, ImGuiWindowFlags_AlwaysAutoResize)) {
+    struct exception_stats stats[8];
+    int num_stats = exception_handler_stats(stats, ARRAY_SIZE(stats));
 
-  emu->vid_source = EMU_SOURCE_PXL;
+    for (int i = 0; i < num_stats; i++) {
+      struct exception_stats *s = &stats[i];
+      int64_t count = MAX(s->count, 1);
+
+      igText("%-12s %6d/s %8.3f ms/s  total %d avg %.2f us", s->name,
+             (int)s->count_per_sec, (float)s->time_per_sec / NS_PER_MS,
+             (int)s->count, (float)s->time / count / 1000.0f);
+
+      for (int j = 0; j < EXCEPTION_MAX_SITES && s->pcs[j].count; j++) {
+        igText("  pc    0x%016" PRIxPTR " %d", s->pcs[j].addr,
+               (int)s->pcs[j].count);
+      }
+      for (int j = 0; j < EXCEPTION_MAX_SITES && s->guest_pcs[j].count;
+           j++) {
+        igText("  guest 0x%08x %d", (uint32_t)s->guest_pcs[j].addr,
+               (int)s->guest_pcs[j].count);
+      }
+      for (int j = 0; j < EXCEPTION_MAX_SITES && s->fault_addrs[j].count;
+           j++) {
+        igText("  addr  0x%016" PRIxPTR " %d", s->fault_addrs[j].addr,
+               (int)s->fault_addrs[j].count);
+      }
+    }
+  }
+  igEnd();
+
+  emu->show_exceptions = (int)opened;
 }
 
-static void emu_push_audio(void *userdata, const int16_t *data, int frames) {
-  struct emu *emu = userdata;
-  audio_push(emu->host, data, frames);
+static void emu_memory_window(struct emu *emu) {
+  bool opened = true;
+
+  if (igBegin("memory", &opened, ImGuiWindowFlags_AlwaysAutoResize)) {
+    struct mem_usage usage[MAX_MEM_USAGE];
+    int num_usage = stats_memory_usage(usage);
+    int64_t total = 0;
+
+    for (int i = 0; i < num_usage; i++) {
+      igText("%-12s %8.2f MB", usage[i].name,
+             usage[i].bytes / (1024.0f * 1024.0f));
+      total += usage[i].bytes;
+    }
+
+    igSeparator();
+
+    igText("%-12s %8.2f MB", "total", total / (1024.0f * 1024.0f));
+  }
+  igEnd();
+
+  emu->show_memory = (int)opened;
 }
+#endif
 
 /*
- * options
+ * thread synchronization
  */
-static void emu_set_aspect_ratio(struct emu *emu, const char *new_ratio) {
-  int i;
+static void emu_signal_notify(struct emu_signal *s) {
+  atomic_fetch_add_int(&s->seq, 1);
 
-  for (i = 0; i < NUM_ASPECT_RATIOS; i++) {
-    const char *aspect_ratio = ASPECT_RATIOS[i];
+  if (atomic_load_int(&s->sleepers)) {
+    mutex_lock(s->mutex);
+    cond_broadcast(s->cond);
+    mutex_unlock(s->mutex);
+  }
+}
 
-    if (!strcmp(aspect_ratio, new_ratio)) {
-      break;
+/* waits for the signal to be notified after seq was read from it, giving up
+   after ms milliseconds when ms isn't negative. returns 0 on timeout. the
+   caller is expected to check its condition again either way */
+static int emu_signal_wait(struct emu_signal *s, int seq, int ms) {
+  for (int i = 0; i < EMU_SPIN_ITERS; i++) {
+    if (atomic_load_int(&s->seq) != seq) {
+      return 1;
     }
+
+    cpu_relax();
   }
 
-  /* force to stretch if the new ratio isn't a valid one */
-  if (i == NUM_ASPECT_RATIOS) {
-    i = ASPECT_RATIO_STRETCH;
+  int notified = 1;
+
+  /* the notifier checks for sleepers after bumping the sequence number, and
+     the sequence number is checked again here after registering as one, so
+     one of the two always sees the other */
+  mutex_lock(s->mutex);
+  atomic_fetch_add_int(&s->sleepers, 1);
+
+  if (atomic_load_int(&s->seq) == seq) {
+    if (ms < 0) {
+      cond_wait(s->cond, s->mutex);
+    } else {
+      notified = cond_timedwait(s->cond, s->mutex, ms);
+    }
   }
 
-  /* update persistent option as well as this session's aspect ratio */
-  strncpy(OPTION_aspect, ASPECT_RATIOS[i], sizeof(OPTION_aspect));
-  emu->aspect_ratio = i;
+  atomic_fetch_add_int(&s->sleepers, -1);
+  mutex_unlock(s->mutex);
+
+  return notified;
 }
 
-/*
- * frame running logic
- */
-static void emu_run_until_vblank(struct emu *emu);
+static void emu_signal_init(struct emu_signal *s) {
+  s->mutex = mutex_create();
+  s->cond = cond_create();
+}
 
-static void *emu_run_thread(void *data) {
-  struct emu *emu = data;
+static void emu_signal_destroy(struct emu_signal *s) {
+  mutex_destroy(s->mutex);
+  cond_destroy(s->cond);
+}
+
+static void emu_set_state(struct emu *emu, int state,
+                          struct emu_signal *signal) {
+  atomic_store_int(&emu->state, state);
+  emu_signal_notify(signal);
+}
 
+static void emu_wait_state(struct emu *emu, int state) {
+  /* called on the video thread, waiting for the emulation thread to reach
+     state */
   while (1) {
-    /* wait for video thread to request a frame to be ran */
-    mutex_lock(emu->req_mutex);
+    int seq = atomic_load_int(&emu->res_signal.seq);
 
-    while (emu->state == EMU_WAITING) {
-      cond_wait(emu->req_cond, emu->req_mutex);
+    if (atomic_load_int(&emu->state) == state) {
+      break;
     }
 
-    if (emu->state == EMU_SHUTDOWN) {
-      mutex_unlock(emu->req_mutex);
+    emu_signal_wait(&emu->res_signal, seq, -1);
+  }
+}
+
+static void emu_drop_pending(struct emu *emu) {
+  /* called on the emulation thread. takes back a context the video thread
+     hasn't claimed yet, or waits for it to finish with one it has */
+  while (1) {
+    int seq = atomic_load_int(&emu->req_signal.seq);
+    int state = atomic_load_int(&emu->pending_state);
+
+    if (state == EMU_CTX_EMPTY) {
       break;
     }
 
-    emu_run_until_vblank(emu);
+    if (state == EMU_CTX_POSTED &&
+        atomic_cas_int(&emu->pending_state, EMU_CTX_POSTED, EMU_CTX_EMPTY)) {
+      break;
+    }
 
-    emu->state = EMU_WAITING;
+    if (state == EMU_CTX_CLAIMED) {
+      emu_signal_wait(&emu->req_signal, seq, -1);
+    }
+  }
+}
 
-    mutex_unlock(emu->req_mutex);
+static struct ta_context *emu_claim_pending(struct emu *emu) {
+  /* called on the video thread */
+  if (!atomic_cas_int(&emu->pending_state, EMU_CTX_POSTED, EMU_CTX_CLAIMED)) {
+    return NULL;
   }
 
-  return NULL;
+  return emu->pending_ctx;
 }
 
-static void emu_run_until_vblank(struct emu *emu) {
-  const int64_t MACHINE_STEP = HZ_TO_NANO(1000);
-
-  emu->state = EMU_RUNFRAME;
+static void emu_release_pending(struct emu *emu) {
+  atomic_store_int(&emu->pending_state, EMU_CTX_EMPTY);
+  emu_signal_notify(&emu->req_signal);
+}
 
-  while (emu->state == EMU_RUNFRAME || emu->state == EMU_DRAWFRAME) {
-    dc_tick(emu->dc, MACHINE_STEP);
+/*
+ * context parsing
+ */
+static void emu_wait_parse(struct emu *emu) {
+  /* called with parse_mutex held */
+  while (emu->parse_ctx) {
+    cond_wait(emu->parse_done_cond, emu->parse_mutex);
   }
 }
 
-void emu_render_frame(struct emu *emu) {
-  prof_counter_add(COUNTER_frames, 1);
-
-  if (OPTION_aspect_dirty) {
-    emu_set_aspect_ratio(emu, OPTION_aspect);
-    OPTION_aspect_dirty = 0;
+static void emu_sync_parse(struct emu *emu) {
+  if (!emu->pipelined) {
+    return;
   }
 
-  r_clear(emu->r);
+  mutex_lock(emu->parse_mutex);
+  emu_wait_parse(emu);
+  mutex_unlock(emu->parse_mutex);
+}
 
-  if (!dc_running(emu->dc)) {
-    /* since the host times itself based off of our audio output, it's important
-       to pump out silent audio frames even when not running the dreamcast, else
-       the host will render the ui completely unthrottled  */
-    uint32_t silence[AICA_SAMPLE_FREQ / 60] = {0};
-    audio_push(emu->host, (int16_t *)silence, ARRAY_SIZE(silence));
+static void emu_swap_parse(struct emu *emu) {
+  /* called with parse_mutex held */
+  if (!emu->parse_ready) {
     return;
   }
 
-  int width = r_width(emu->r);
-  int height = r_height(emu->r);
-  int frame_width;
-  int frame_height;
-  int frame_x;
-  int frame_y;
+  emu->vid_rc ^= 1;
+  emu->vid_source = EMU_SOURCE_CTX;
+  emu->vid_writeback = 1;
+  emu->parse_ready = 0;
+}
 
-  if (emu->aspect_ratio == ASPECT_RATIO_STRETCH) {
-    frame_height = height;
-    frame_width = width;
-    frame_x = 0;
+static void *emu_parse_thread(void *data) {
+  struct emu *emu = data;
+
+  configure_thread(THREAD_ROLE_VIDEO);
+
+  mutex_lock(emu->parse_mutex);
+
+  while (1) {
+    while (!emu->parse_ctx && !emu->parse_shutdown) {
+      cond_wait(emu->parse_cond, emu->parse_mutex);
+    }
+
+    if (emu->parse_shutdown) {
+      break;
+    }
+
+    /* the back context is only swapped once parse_ready is set, so it's safe
+       to write to without holding the lock */
+    struct ta_context *ctx = emu->parse_ctx;
+    struct tr_context *rc = &emu->vid_rcs[emu->vid_rc ^ 1];
+
+    mutex_unlock(emu->parse_mutex);
+
+    tr_parse_context(emu->vid_cv, emu, &emu_find_texture, ctx, rc);
+
+    mutex_lock(emu->parse_mutex);
+
+    emu->parse_ctx = NULL;
+    emu->parse_ready = 1;
+    cond_broadcast(emu->parse_done_cond);
+  }
+
+  mutex_unlock(emu->parse_mutex);
+
+  return NULL;
+}
+
+/*
+ * dreamcast guest interface
+ */
+static void emu_log_pacing(struct emu *emu, enum pacing_event event) {
+  if (!emu->pacing_log) {
+    return;
+  }
+
+  pacing_log_record(emu->pacing_log, event, (uint32_t)emu->vblanks,
+                    sched_base_time(emu->dc->sched), audio_buffered(emu->host));
+}
+
+static void emu_vblank_in(void *userdata, int vid_disabled) {
+  struct emu *emu = userdata;
+
+  if (emu->runahead_hidden) {
+    return;
+  }
+
+  emu_log_pacing(emu, PACING_VBLANK_IN);
+
+  emu->vid_disabled = vid_disabled;
+  emu->vid_time = sched_base_time(emu->dc->sched);
+  emu_set_state(emu, EMU_DRAWFRAME, &emu->res_signal);
+}
+
+static void emu_vblank_out(void *userdata) {
+  struct emu *emu = userdata;
+
+  if (emu->runahead_hidden) {
+    emu->runahead_done = 1;
+    return;
+  }
+
+  emu_log_pacing(emu, PACING_VBLANK_OUT);
+
+  atomic_store_int(&emu->state, EMU_ENDFRAME);
+}
+
+static void emu_poll_input(void *userdata) {
+  struct emu *emu = userdata;
+
+  if (!emu->input_dirty) {
+    return;
+  }
+
+  int16_t input[MAPLE_NUM_PORTS][EMU_NUM_CONT_INPUTS];
+
+  mutex_lock(emu->input_mutex);
+  memcpy(input, emu->input, sizeof(input));
+  emu->input_dirty = 0;
+  mutex_unlock(emu->input_mutex);
+
+  for (int port = 0; port < MAPLE_NUM_PORTS; port++) {
+    for (int i = 0; i < EMU_NUM_CONT_INPUTS; i++) {
+      if (input[port][i] == emu->input_applied[port][i]) {
+        continue;
+      }
+
+      dc_input(emu->dc, port, i, input[port][i]);
+      emu->input_applied[port][i] = input[port][i];
+    }
+  }
+}
+
+static void emu_finish_render(void *userdata) {
+  struct emu *emu = userdata;
+
+  if (!emu->runahead_hidden) {
+    emu_log_pacing(emu, PACING_FINISH_RENDER);
+  }
+
+  if (emu->multi_threaded) {
+    /* ideally, the video thread has parsed the pending context, uploaded its
+       textures, etc. during the estimated render time. however, if it hasn't
+       finished, the emulation thread must be paused to avoid altering
+       the yet-to-be-uploaded texture memory. if the context hasn't been
+       claimed at all, a frame is being skipped */
+    emu_drop_pending(emu);
+
+    /* the parse thread reads the context and texture cache as well */
+    emu_sync_parse(emu);
+  }
+}
+
+static void emu_start_render(void *userdata, struct ta_context *ctx) {
+  struct emu *emu = userdata;
+
+  /* hidden frames are never drawn, skip registering their textures as well */
+  if (emu->runahead_hidden) {
+    return;
+  }
+
+  emu_log_pacing(emu, PACING_START_RENDER);
+
+  /* incement internal frame number. this frame number is assigned to the each
+     texture source registered to assert synchronization between the emulator
+     and video thread is working as expected */
+  emu->frame++;
+
+  /* now that the video thread is sure to not be accessing the texture data,
+     mark any textures dirty that were invalidated by a memory watch */
+  poll_memory_watches(emu->watcher);
+  emu_dirty_modified_textures(emu);
+
+  /* hash the params along with the pvr state they're converted with, from
+     autosort through the background vertices */
+  emu->pending_dirty = 0;
+  emu->pending_hash = 0;
+
+  if (OPTION_reuse_frames) {
+    const uint8_t *state = (const uint8_t *)&ctx->autosort;
+    const uint8_t *state_end = ctx->bg_vertices + sizeof(ctx->bg_vertices);
+    emu->pending_hash = xxh64(state, state_end - state, 0);
+    emu->pending_hash = xxh64(ctx->params, ctx->size, emu->pending_hash);
+  }
+
+  /* register the source of each texture referenced by the context with the
+     tile renderer. note, uploading the texture to the render backend happens
+     lazily while converting the context. this registration just lets the
+     backend know where the texture's source data is */
+  emu_register_texture_sources(emu, ctx);
+
+  /* write protect the sources registered above in one pass before the guest
+     resumes */
+  flush_memory_watches(emu->watcher);
+
+  if (emu->trace_writer) {
+    /* report when the writer starts and stops falling behind, rather than
+       stalling the guest on it */
+    int written = trace_writer_render_context(emu->trace_writer, ctx);
+
+    if (!written && !emu->trace_dropping) {
+      LOG_WARNING("trace writer can't keep up, dropping frames");
+    } else if (written && emu->trace_dropping) {
+      LOG_INFO("trace writer caught up");
+    }
+
+    emu->trace_dropping = !written;
+  }
+
+  /* save off context and notify video thread that it's available, replacing
+     any context it hasn't claimed */
+  emu_drop_pending(emu);
+
+  emu->pending_ctx = ctx;
+  atomic_store_int(&emu->pending_state, EMU_CTX_POSTED);
+  emu_signal_notify(&emu->res_signal);
+}
+
+static int emu_reuse_frame(struct emu *emu) {
+  /* called from the video thread with the pending context claimed */
+  return OPTION_reuse_frames && emu->vid_hash_valid &&
+         emu->vid_source == EMU_SOURCE_CTX && !emu->pending_dirty &&
+         emu->pending_hash == emu->vid_hash;
+}
+
+static void emu_set_frame_hash(struct emu *emu) {
+  emu->vid_hash = emu->pending_hash;
+  emu->vid_hash_valid = OPTION_reuse_frames;
+  emu->vid_reused = 0;
+}
+
+static void emu_push_pixels(void *userdata, const uint8_t *data, int w, int h) {
+  struct emu *emu = userdata;
+
+  if (emu->runahead_hidden) {
+    return;
+  }
+
+  memcpy(emu->vid_fb.data, data, w * h * 4);
+  emu->vid_fb.width = w;
+  emu->vid_fb.height = h;
+
+  emu->vid_source = EMU_SOURCE_PXL;
+}
+
+static int emu_finish_writeback(struct emu *emu, int wait) {
+  if (!emu->wb_num) {
+    return 0;
+  }
+
+  if (!r_end_readback(emu->r, emu->wb_pixels, wait)) {
+    return 0;
+  }
+
+  struct ta_render_target *rt = &emu->wb_targets[emu->wb_head];
+  ta_write_render_target(emu->dc->ta, rt, emu->wb_pixels);
+
+  emu->wb_head = (emu->wb_head + 1) % EMU_MAX_WRITEBACKS;
+  emu->wb_num--;
+
+  prof_counter_add(COUNTER_fb_writebacks, 1);
+
+  return 1;
+}
+
+static void emu_finish_writebacks(struct emu *emu) {
+  /* called while the emulation thread is waiting, as vram is written to */
+  while (emu_finish_writeback(emu, emu->wb_sync)) {
+  }
+}
+
+static void emu_start_writeback(struct emu *emu, const struct tr_context *rc) {
+  const struct ta_render_target *rt = &rc->target;
+
+  if (!OPTION_fb_writeback || !emu->vid_writeback ||
+      !ta_render_to_texture(rt)) {
+    return;
+  }
+
+  emu->vid_writeback = 0;
+
+  if (rt->x_min >= rt->width || rt->y_min >= rt->height ||
+      rt->width * rt->height * 4 > EMU_WRITEBACK_SIZE) {
+    return;
+  }
+
+  /* don't let readbacks pile up, wait on the oldest if the queue is full */
+  if (emu->wb_num == EMU_MAX_WRITEBACKS) {
+    emu_finish_writeback(emu, 1);
+  }
+
+  r_begin_readback(emu->r, 0, 0, rt->width, rt->height);
+
+  int i = (emu->wb_head + emu->wb_num) % EMU_MAX_WRITEBACKS;
+  emu->wb_targets[i] = *rt;
+  emu->wb_num++;
+}
+
+static void emu_push_audio(void *userdata, const int16_t *data, int frames) {
+  struct emu *emu = userdata;
+
+  if (emu->audio_muted) {
+    return;
+  }
+
+  audio_push(emu->host, data, frames);
+}
+
+static int16_t *emu_reserve_audio(void *userdata, int frames) {
+  struct emu *emu = userdata;
+
+  /* have muted audio pushed by copy, where it's dropped */
+  if (emu->audio_muted) {
+    return NULL;
+  }
+
+  return audio_reserve(emu->host, frames);
+}
+
+static void emu_commit_audio(void *userdata, int frames) {
+  struct emu *emu = userdata;
+  audio_commit(emu->host, frames);
+}
+
+/*
+ * options
+ */
+static void emu_set_aspect_ratio(struct emu *emu, const char *new_ratio) {
+  int i;
+
+  for (i = 0; i < NUM_ASPECT_RATIOS; i++) {
+    const char *aspect_ratio = ASPECT_RATIOS[i];
+
+    if (!strcmp(aspect_ratio, new_ratio)) {
+      break;
+    }
+  }
+
+  /* force to stretch if the new ratio isn't a valid one */
+  if (i == NUM_ASPECT_RATIOS) {
+    i = ASPECT_RATIO_STRETCH;
+  }
+
+  /* update persistent option as well as this session's aspect ratio */
+  strncpy(OPTION_aspect, ASPECT_RATIOS[i], sizeof(OPTION_aspect));
+  emu->aspect_ratio = i;
+}
+
+/*
+ * frame running logic
+ */
+static void emu_run_until_vblank(struct emu *emu);
+
+static void *emu_run_thread(void *data) {
+  struct emu *emu = data;
+
+  configure_thread(THREAD_ROLE_EMU);
+
+  while (1) {
+    /* wait for video thread to request a frame to be ran */
+    while (1) {
+      int seq = atomic_load_int(&emu->req_signal.seq);
+
+      if (atomic_load_int(&emu->state) != EMU_WAITING) {
+        break;
+      }
+
+      emu_signal_wait(&emu->req_signal, seq, -1);
+    }
+
+    if (atomic_load_int(&emu->state) == EMU_SHUTDOWN) {
+      break;
+    }
+
+    emu_run_until_vblank(emu);
+
+    emu_set_state(emu, EMU_WAITING, &emu->res_signal);
+  }
+
+  return NULL;
+}
+
+static int emu_skip_frame(struct emu *emu) {
+  if (emu->vid_hidden) {
+    emu->vid_hidden = 0;
+    return 1;
+  }
+
+  if (!OPTION_fast_forward || OPTION_frameskip_period <= 0) {
+    emu->vid_skip_frame = 0;
+    return 0;
+  }
+
+  /* skip the first frameskip frames of each period, always rendering at least
+     its last frame */
+  int frameskip = MIN(OPTION_frameskip, OPTION_frameskip_period - 1);
+  int frame = emu->vid_skip_frame;
+  emu->vid_skip_frame = (frame + 1) % OPTION_frameskip_period;
+
+  return frame < frameskip;
+}
+
+static void emu_run_frame(struct emu *emu, int hidden) {
+  const int64_t MACHINE_STEP = HZ_TO_NANO(1000);
+
+  if (hidden) {
+    emu->runahead_hidden = 1;
+    emu->runahead_done = 0;
+
+    while (!emu->runahead_done) {
+      dc_tick(emu->dc, MACHINE_STEP);
+    }
+
+    emu->runahead_hidden = 0;
+    return;
+  }
+
+  atomic_store_int(&emu->state, EMU_RUNFRAME);
+
+  while (emu->state == EMU_RUNFRAME || emu->state == EMU_DRAWFRAME) {
+    dc_tick(emu->dc, MACHINE_STEP);
+  }
+}
+
+static void emu_take_snapshot(struct emu *emu) {
+  if (!emu->snapshots) {
+    return;
+  }
+
+  int64_t start = time_nanoseconds();
+  snapshots_take(emu->snapshots);
+  prof_counter_add(COUNTER_snapshots, 1);
+  prof_counter_add(COUNTER_snapshot_time, time_nanoseconds() - start);
+}
+
+static void emu_save_boot_state(struct emu *emu) {
+  if (!emu->boot_state[0] || !dc_booted(emu->dc)) {
+    return;
+  }
+
+  dc_save_state(emu->dc, emu->boot_state);
+  emu->boot_state[0] = 0;
+}
+
+static void emu_run_netplay_frame(void *data, int hidden) {
+  struct emu *emu = data;
+
+  emu->audio_muted = hidden;
+  emu_run_frame(emu, hidden);
+  emu->audio_muted = 0;
+}
+
+static void emu_check_determinism(struct emu *emu) {
+  /* offline, the hashes are logged to be compared between runs */
+  if (OPTION_determinism_check <= 0 || emu->netplay) {
+    return;
+  }
+
+  if ((emu->vblanks % OPTION_determinism_check) == 0) {
+    LOG_INFO("emu_check_determinism frame %" PRId64 " hash 0x%016" PRIx64,
+             emu->vblanks, dc_hash_memory(emu->dc));
+  }
+}
+
+static void emu_run_until_vblank(struct emu *emu) {
+  emu_check_determinism(emu);
+  emu->vblanks++;
+
+  if (emu->netplay) {
+    /* rolling back replaces the context the parse thread may be reading */
+    emu_sync_parse(emu);
+
+    if (netplay_run_frame(emu->netplay, &emu_run_netplay_frame, emu)) {
+      return;
+    }
+
+    LOG_WARNING("emu_run_until_vblank netplay session ended, continuing "
+                "offline");
+    netplay_destroy(emu->netplay);
+    emu->netplay = NULL;
+  }
+
+  if (!emu->runahead) {
+    emu_run_frame(emu, 0);
+    emu_take_snapshot(emu);
+    emu_save_boot_state(emu);
+    return;
+  }
+
+  /* return to the real timeline. the parse thread may still be reading the
+     previous frame's context, which is about to be replaced */
+  if (emu->runahead_valid) {
+    emu_sync_parse(emu);
+    snapshots_restore(emu->runahead, 0);
+  }
+
+  /* advance the real timeline by a frame, whose audio is the only audio
+     output */
+  emu_run_frame(emu, 1);
+  emu_take_snapshot(emu);
+  emu_save_boot_state(emu);
+  emu->runahead_valid = snapshots_take(emu->runahead);
+
+  /* then run ahead of it, only displaying the last frame */
+  emu->audio_muted = 1;
+
+  for (int i = 1; i < OPTION_runahead; i++) {
+    emu_run_frame(emu, 1);
+  }
+
+  emu_run_frame(emu, 0);
+
+  emu->audio_muted = 0;
+}
+
+static void emu_wait_frame(struct emu *emu, int seq) {
+  if (emu_signal_wait(&emu->res_signal, seq, EMU_INPUT_POLL_MS)) {
+    return;
+  }
+
+  /* keep polling the host for input while the guest runs, so the guest reads
+     the latest state whenever it polls the controllers */
+  input_poll(emu->host);
+}
+
+void emu_hide_frame(struct emu *emu) {
+  emu->vid_hidden = 1;
+}
+
+int64_t emu_frame_time(struct emu *emu) {
+  return emu->vid_time;
+}
+
+int emu_render_frame(struct emu *emu) {
+  /* skipped frames are counted as well, the counter reflecting the guest's
+     frame rate when fast forwarding */
+  prof_counter_add(COUNTER_frames, 1);
+
+  emu_sample_times(emu);
+
+  if (OPTION_aspect_dirty) {
+    emu_set_aspect_ratio(emu, OPTION_aspect);
+    OPTION_aspect_dirty = 0;
+  }
+
+  r_clear(emu->r);
+
+  if (!dc_running(emu->dc)) {
+    /* since the host times itself based off of our audio output, it's important
+       to pump out silent audio frames even when not running the dreamcast, else
+       the host will render the ui completely unthrottled  */
+    uint32_t silence[AICA_SAMPLE_FREQ / 60] = {0};
+    audio_push(emu->host, (int16_t *)silence, ARRAY_SIZE(silence));
+    return 1;
+  }
+
+  /* when skipped, the frame is still ran and its context's textures are still
+     registered by emu_start_render, keeping the texture cache coherent. only
+     converting and rendering the context is skipped */
+  int skip = emu_skip_frame(emu);
+
+  int width = r_width(emu->r);
+  int height = r_height(emu->r);
+  int frame_width;
+  int frame_height;
+  int frame_x;
+  int frame_y;
+
+  if (emu->aspect_ratio == ASPECT_RATIO_STRETCH) {
+    frame_height = height;
+    frame_width = width;
+    frame_x = 0;
     frame_y = 0;
   } else if (emu->aspect_ratio == ASPECT_RATIO_16BY9) {
     frame_width = width;
@@ -554,6 +1630,9 @@ void emu_render_frame(struct emu *emu) {
 
   r_viewport(emu->r, frame_x, frame_y, frame_width, frame_height);
 
+  /* write back frames previously rendered to textures before the guest runs */
+  emu_finish_writebacks(emu);
+
   /* an overview of each frames lifecycle looks like:
 
      main thread                        | emulation thread
@@ -563,12 +1642,15 @@ void emu_render_frame(struct emu *emu) {
                                         | see EMU_RUNFRAME, start running frame
      ---------------------------------------------------------------------------
      wait for EMU_DRAWFRAME / or for    |
-     pending_ctx to be set              |
+     pending_ctx to be posted           |
      ---------------------------------------------------------------------------
-                                        | emu_start_render sets pending_ctx or
+                                        | emu_start_render posts pending_ctx or
                                         | emu_push_pixels copies off framebuffer
      ---------------------------------------------------------------------------
-     convert pending_ctx if set         |
+     claim and convert pending_ctx if   | emu_finish_render waits for a claimed
+     posted, or upload its textures and | pending_ctx to be released
+     hand it off to the parse thread    |
+     when pipelined                     |
      ---------------------------------------------------------------------------
                                         | emu_vblank_in sets EMU_DRAWFRAME
      ---------------------------------------------------------------------------
@@ -576,49 +1658,105 @@ void emu_render_frame(struct emu *emu) {
      ---------------------------------------------------------------------------
                                         | emu_vblank_out sets EMU_ENDFRAME */
 
-  /* request a frame to be ran */
-  if (emu->multi_threaded) {
-    mutex_lock(emu->req_mutex);
-
-    CHECK_EQ(emu->state, EMU_WAITING);
-    emu->state = EMU_RUNFRAME;
-    cond_signal(emu->req_cond);
+  emu_log_pacing(emu, PACING_FRAME);
 
-    mutex_unlock(emu->req_mutex);
+  /* request a frame to be ran, once the emulation thread has finished
+     running the end of the previous one */
+  if (emu->multi_threaded) {
+    emu_wait_state(emu, EMU_WAITING);
+    emu_evict_textures(emu);
+    emu_set_state(emu, EMU_RUNFRAME, &emu->req_signal);
   } else {
+    emu_evict_textures(emu);
     emu_run_until_vblank(emu);
   }
 
-  /* process any context submitted during the frame */
+  /* process any context submitted during the frame. the emulation thread is
+     paused in emu_finish_render or emu_start_render while it's claimed */
   if (emu->multi_threaded) {
-    mutex_lock(emu->res_mutex);
+    while (1) {
+      int seq = atomic_load_int(&emu->res_signal.seq);
+
+      if (atomic_load_int(&emu->state) != EMU_RUNFRAME ||
+          atomic_load_int(&emu->pending_state) == EMU_CTX_POSTED) {
+        break;
+      }
 
-    while (emu->state == EMU_RUNFRAME && !emu->pending_ctx) {
-      cond_wait(emu->res_cond, emu->res_mutex);
+      emu_wait_frame(emu, seq);
     }
   }
 
-  if (emu->pending_ctx) {
-    tr_convert_context(emu->r, emu, &emu_find_texture, emu->pending_ctx,
-                       &emu->vid_rc);
-    emu->pending_ctx = NULL;
+  struct ta_context *ctx = emu_claim_pending(emu);
+
+  if (ctx && skip) {
+    /* dropped */
+  } else if (ctx && emu_reuse_frame(emu)) {
+    /* make the last context handed off to the parse thread current, it's
+       identical to this one */
+    if (emu->pipelined) {
+      mutex_lock(emu->parse_mutex);
+      emu_wait_parse(emu);
+      emu_swap_parse(emu);
+      mutex_unlock(emu->parse_mutex);
+    }
+
+    emu->vid_writeback = 1;
+    emu->vid_reused = 1;
+
+    prof_counter_add(COUNTER_frames_reused, 1);
+  } else if (ctx && emu->pipelined) {
+    /* textures must be uploaded from this thread, only parsing is handed off.
+       make a finished parse current first, as its buffer is reused */
+    mutex_lock(emu->parse_mutex);
+    emu_wait_parse(emu);
+    emu_swap_parse(emu);
+    mutex_unlock(emu->parse_mutex);
+
+    tr_convert_textures(emu->vid_cv, emu->r, emu, &emu_find_texture, ctx);
+
+    mutex_lock(emu->parse_mutex);
+    emu->parse_ctx = ctx;
+    cond_signal(emu->parse_cond);
+    mutex_unlock(emu->parse_mutex);
+
+    emu_set_frame_hash(emu);
+  } else if (ctx) {
+    tr_convert_context(emu->vid_cv, emu->r, emu, &emu_find_texture, ctx,
+                       &emu->vid_rcs[emu->vid_rc]);
 
     emu->vid_source = EMU_SOURCE_CTX;
+    emu->vid_writeback = 1;
+
+    emu_set_frame_hash(emu);
   }
 
-  if (emu->multi_threaded) {
-    mutex_unlock(emu->res_mutex);
+  if (ctx) {
+    emu_release_pending(emu);
   }
 
   /* wait for vblank_in */
   if (emu->multi_threaded) {
-    mutex_lock(emu->res_mutex);
+    while (1) {
+      int seq = atomic_load_int(&emu->res_signal.seq);
 
-    while (emu->state == EMU_RUNFRAME) {
-      cond_wait(emu->res_cond, emu->res_mutex);
+      if (atomic_load_int(&emu->state) != EMU_RUNFRAME) {
+        break;
+      }
+
+      emu_wait_frame(emu, seq);
+    }
+
+    /* rather than waiting on the parse thread, the previous context is
+       rendered again if it hasn't finished */
+    if (emu->pipelined) {
+      mutex_lock(emu->parse_mutex);
+      emu_swap_parse(emu);
+      mutex_unlock(emu->parse_mutex);
     }
+  }
 
-    mutex_unlock(emu->res_mutex);
+  if (skip) {
+    return 0;
   }
 
   /* render the latest video source */
@@ -627,33 +1765,319 @@ void emu_render_frame(struct emu *emu) {
       r_draw_pixels(emu->r, emu->vid_fb.data, 0, 0, emu->vid_fb.width,
                     emu->vid_fb.height);
     } else if (emu->vid_source == EMU_SOURCE_CTX) {
-      tr_render_context(emu->r, &emu->vid_rc);
+      struct tr_context *rc = &emu->vid_rcs[emu->vid_rc];
+
+      if (!emu->vid_reused || !r_present_ta_target(emu->r)) {
+        tr_render_context(emu->r, rc);
+      }
+
+      emu_start_writeback(emu, rc);
     }
   }
 
   /* note, the emulation thread may still be running the code between vblank_in
      and vblank_out at this point, but there's no need to wait for it */
+
+  return 1;
+}
+
+/*
+ * save states
+ */
+static void emu_state_path(struct emu *emu, char *path, int size) {
+  struct disc *disc = gdrom_get_disc(emu->dc->gdrom);
+  char dir[PATH_MAX];
+
+  snprintf(dir, sizeof(dir), "%s" PATH_SEPARATOR "states", fs_appdir());
+  fs_mkdir(dir);
+
+  snprintf(path, size, "%s" PATH_SEPARATOR "%s.state", dir,
+           disc ? disc->prodnum : "bios");
+}
+
+static void emu_begin_state(struct emu *emu) {
+  /* the emulation thread may still be finishing the previous frame, and the
+     parse thread reading a context out of the ta */
+  if (emu->multi_threaded) {
+    emu_wait_state(emu, EMU_WAITING);
+  }
+
+  emu_sync_parse(emu);
+
+  /* make sure frames rendered to textures have made it to vram */
+  emu_finish_writebacks(emu);
+}
+
+static void emu_state_loaded(struct emu *emu) {
+  emu->runahead_valid = 0;
+
+  /* vram was replaced wholesale */
+  emu_dirty_textures(emu);
+}
+
+static void emu_save_state(struct emu *emu, const char *path) {
+  emu_begin_state(emu);
+
+  dc_save_state(emu->dc, path);
+}
+
+static void emu_load_state(struct emu *emu, const char *path) {
+  emu_begin_state(emu);
+
+  if (!dc_load_state(emu->dc, path)) {
+    return;
+  }
+
+  emu_state_loaded(emu);
+}
+
+/*
+ * boot snapshots
+ *
+ * booting a disc runs the bios (or its hle bootstrap) for several seconds
+ * before the game's boot file is entered. the machine is snapshotted as it's
+ * first entered, and later launches of the disc restore the snapshot instead.
+ * what the bios leaves behind depends on the system settings and on the bios
+ * itself, each combination is snapshotted separately
+ */
+static void emu_boot_state_path(struct emu *emu, char *path, int size) {
+  struct disc *disc = gdrom_get_disc(emu->dc->gdrom);
+  char dir[PATH_MAX];
+
+  snprintf(dir, sizeof(dir), "%s" PATH_SEPARATOR "boot", fs_appdir());
+  fs_mkdir(dir);
+
+  uint64_t key = boot_rom_hash(emu->dc->boot);
+  key = xxh64(disc->uid, strlen(disc->uid), key);
+  key = xxh64(OPTION_region, strlen(OPTION_region), key);
+  key = xxh64(OPTION_language, strlen(OPTION_language), key);
+  key = xxh64(OPTION_broadcast, strlen(OPTION_broadcast), key);
+
+  snprintf(path, size, "%s" PATH_SEPARATOR "%s.%016" PRIx64 ".state", dir,
+           disc->prodnum, key);
+}
+
+static void emu_load_boot_state(struct emu *emu) {
+  struct disc *disc = gdrom_get_disc(emu->dc->gdrom);
+  int movie = *OPTION_record_movie || *OPTION_play_movie;
+  int netplay = OPTION_netplay_listen > 0 || *OPTION_netplay_connect;
+
+  /* movies, netplay peers and determinism checks all expect the machine to
+     have been booted from power on */
+  if (!OPTION_boot_cache || !disc || movie || netplay ||
+      OPTION_determinism_check > 0) {
+    return;
+  }
+
+  char path[PATH_MAX];
+  emu_boot_state_path(emu, path, sizeof(path));
+
+  if (fs_exists(path)) {
+    /* the clock was set to the current time on init, keep it rather than the
+       time the snapshot was taken at */
+    uint32_t clock = aica_get_clock(emu->dc->aica);
+
+    emu_begin_state(emu);
+
+    if (dc_load_state(emu->dc, path)) {
+      aica_set_clock(emu->dc->aica, clock);
+      emu_state_loaded(emu);
+      return;
+    }
+
+    /* the snapshot is from an older version or was cut short, replace it */
+    LOG_WARNING("emu_load_boot_state failed to load %s, booting", path);
+  }
+
+  strncpy(emu->boot_state, path, sizeof(emu->boot_state));
+  dc_watch_boot(emu->dc);
+}
+
+int64_t emu_state_max_size(struct emu *emu) {
+  emu_begin_state(emu);
+
+  return dc_state_max_size(emu->dc);
+}
+
+int64_t emu_save_state_buffer(struct emu *emu, void *data, int64_t size) {
+  emu_begin_state(emu);
+
+  return dc_save_state_buffer(emu->dc, data, size);
+}
+
+int emu_load_state_buffer(struct emu *emu, const void *data, int64_t size) {
+  emu_begin_state(emu);
+
+  if (!dc_load_state_buffer(emu->dc, data, size)) {
+    return 0;
+  }
+
+  emu_state_loaded(emu);
+
+  return 1;
+}
+
+static void emu_rewind(struct emu *emu, int frames) {
+  int n = MIN(frames, snapshots_count(emu->snapshots) - 1);
+
+  emu_finish_writebacks(emu);
+
+  if (!snapshots_restore(emu->snapshots, n)) {
+    return;
+  }
+
+  emu->runahead_valid = 0;
+  emu_dirty_textures(emu);
+}
+
+/*
+ * clock scaling
+ */
+static void emu_clocks_path(struct emu *emu, char *path, int size) {
+  struct disc *disc = gdrom_get_disc(emu->dc->gdrom);
+  char dir[PATH_MAX];
+
+  snprintf(dir, sizeof(dir), "%s" PATH_SEPARATOR "clocks", fs_appdir());
+  fs_mkdir(dir);
+
+  snprintf(path, size, "%s" PATH_SEPARATOR "%s.cfg", dir,
+           disc ? disc->prodnum : "bios");
+}
+
+static void emu_save_clocks(struct emu *emu) {
+  char path[PATH_MAX];
+  emu_clocks_path(emu, path, sizeof(path));
+
+  FILE *fp = fopen(path, "wt");
+
+  if (!fp) {
+    LOG_WARNING("emu_save_clocks failed to open %s", path);
+    return;
+  }
+
+  fprintf(fp, "sh4_clock: %d\n", OPTION_sh4_clock);
+  fprintf(fp, "arm7_clock: %d\n", OPTION_arm7_clock);
+  fclose(fp);
+}
+
+static void emu_load_clocks(struct emu *emu) {
+  int movie = *OPTION_record_movie || *OPTION_play_movie;
+  int netplay = OPTION_netplay_listen > 0 || *OPTION_netplay_connect;
+
+  /* movies, netplay peers and determinism checks expect every run to use the
+     same clocks, so only those given on the command line apply */
+  if (movie || netplay || OPTION_determinism_check > 0) {
+    return;
+  }
+
+  char path[PATH_MAX];
+  emu_clocks_path(emu, path, sizeof(path));
+
+  if (fs_exists(path) && options_read(path)) {
+    LOG_INFO("emu_load_clocks sh4 %d%%, arm7 %d%%", OPTION_sh4_clock,
+             OPTION_arm7_clock);
+  }
+}
+
+#ifdef HAVE_IMGUI
+static void emu_clocks_menu(struct emu *emu) {
+  int changed = 0;
+
+  changed |= igSliderInt("sh4", &OPTION_sh4_clock, SCHED_MIN_CLOCK,
+                         SCHED_MAX_CLOCK, "%.0f%%");
+  changed |= igSliderInt("arm7", &OPTION_arm7_clock, SCHED_MIN_CLOCK,
+                         SCHED_MAX_CLOCK, "%.0f%%");
+
+  if (changed) {
+    emu->clocks_dirty = 1;
+  }
+
+  /* save once the slider is released, not on every step of dragging it */
+  if (emu->clocks_dirty && !igIsAnyItemActive()) {
+    emu_save_clocks(emu);
+    emu->clocks_dirty = 0;
+  }
+
+  /* host time spent executing each cpu over the last frame, as a share of a
+     host core */
+  if (emu->times_head) {
+    int last = (emu->times_head - 1) % EMU_TIMES_HISTORY;
+    float wall = MAX(emu->times_wall[last], 0.001f);
+
+    for (int i = EMU_TIME_SH4; i <= EMU_TIME_ARM7; i++) {
+      float ms = emu->times[last][i];
+      igText("%-4s %6.2f ms per frame, %3d%% of a core", EMU_TIME_NAMES[i],
+             ms, (int)(ms * 100.0f / wall));
+    }
+  }
 }
+#endif
 
 void emu_debug_menu(struct emu *emu) {
 #ifdef HAVE_IMGUI
   /* ensure the emulation thread isn't still executing a previous frame */
   if (emu->multi_threaded) {
-    mutex_lock(emu->req_mutex);
-    CHECK_EQ(emu->state, EMU_WAITING);
-    mutex_unlock(emu->req_mutex);
+    emu_wait_state(emu, EMU_WAITING);
   }
 
+  /* nor is the parse thread reading the texture cache */
+  emu_sync_parse(emu);
+
   if (igBeginMainMenuBar()) {
     if (igBeginMenu("EMU", 1)) {
       if (igMenuItem("clear texture cache", NULL, 0, 1)) {
         emu_dirty_textures(emu);
       }
+      if (igMenuItem("frame breakdown", NULL, emu->show_times, 1)) {
+        emu->show_times = !emu->show_times;
+      }
+      if (igMenuItem("jit pass stats", NULL, emu->show_jit_stats, 1)) {
+        emu->show_jit_stats = !emu->show_jit_stats;
+      }
+      if (igMenuItem("exceptions", NULL, emu->show_exceptions, 1)) {
+        emu->show_exceptions = !emu->show_exceptions;
+      }
+      if (igMenuItem("memory", NULL, emu->show_memory, 1)) {
+        emu->show_memory = !emu->show_memory;
+      }
+      if (igBeginMenu("clock speed", !emu->netplay)) {
+        emu_clocks_menu(emu);
+        igEndMenu();
+      }
+      if (igMenuItem("export profile", NULL, 0, 1)) {
+        emu_export_profile(emu);
+      }
       if (!emu->trace_writer && igMenuItem("start trace", NULL, 0, 1)) {
         emu_start_tracing(emu);
       }
-      if (emu->trace_writer && igMenuItem("stop trace", NULL, 1, 1)) {
-        emu_stop_tracing(emu);
+      if (emu->trace_writer) {
+        struct trace_stats stats;
+        trace_writer_stats(emu->trace_writer, &stats);
+
+        char label[128];
+        snprintf(label, sizeof(label),
+                 "stop trace (%.1f MB, %d%% queued, %d dropped)",
+                 stats.written / (1024.0f * 1024.0f),
+                 (int)((int64_t)stats.queued * 100 / stats.capacity),
+                 stats.dropped_frames + stats.dropped_textures);
+
+        if (igMenuItem(label, NULL, 1, 1)) {
+          emu_stop_tracing(emu);
+        }
+      }
+      if (igMenuItem("save state", NULL, 0, 1)) {
+        char path[PATH_MAX];
+        emu_state_path(emu, path, sizeof(path));
+        emu_save_state(emu, path);
+      }
+      if (!emu->netplay && igMenuItem("load state", NULL, 0, 1)) {
+        char path[PATH_MAX];
+        emu_state_path(emu, path, sizeof(path));
+        emu_load_state(emu, path);
+      }
+      if (emu->snapshots && !emu->netplay &&
+          igMenuItem("rewind", NULL, 0, 1)) {
+        emu_rewind(emu, 60);
       }
       igEndMenu();
     }
@@ -661,6 +2085,23 @@ void emu_debug_menu(struct emu *emu) {
     igEndMainMenuBar();
   }
 
+  if (emu->show_times) {
+    emu_times_window(emu);
+  }
+
+  if (emu->show_jit_stats) {
+    pass_stats_debug_window(&emu->show_jit_stats);
+  }
+
+  if (emu->show_exceptions) {
+    emu_exceptions_window(emu);
+  }
+
+  if (emu->show_memory) {
+    emu_memory_window(emu);
+  }
+
+  mem_debug_menu(emu->dc->mem);
   holly_debug_menu(emu->dc->holly);
   aica_debug_menu(emu->dc->aica);
   arm7_debug_menu(emu->dc->arm7);
@@ -668,16 +2109,32 @@ void emu_debug_menu(struct emu *emu) {
 
   /* add status */
   if (igBeginMainMenuBar()) {
-    char status[128];
+    char status[160];
     int frames = (int)prof_counter_load(COUNTER_frames);
     int ta_renders = (int)prof_counter_load(COUNTER_ta_renders);
     int pvr_vblanks = (int)prof_counter_load(COUNTER_pvr_vblanks);
     int sh4_instrs = (int)(prof_counter_load(COUNTER_sh4_instrs) / 1000000.0f);
     int arm7_instrs =
         (int)(prof_counter_load(COUNTER_arm7_instrs) / 1000000.0f);
-
-    snprintf(status, sizeof(status), "FPS %3d RPS %3d VBS %3d SH4 %4d ARM %d",
-             frames, ta_renders, pvr_vblanks, sh4_instrs, arm7_instrs);
+    int64_t slices = MAX(prof_counter_load(COUNTER_sched_slices), 1);
+    int slice_us =
+        (int)(prof_counter_load(COUNTER_sched_slice_time) / slices / 1000);
+    int textures = (int)prof_counter_load(COUNTER_textures_decoded);
+
+    int len = snprintf(
+        status, sizeof(status),
+        "FPS %3d RPS %3d VBS %3d SH4 %4d ARM %d SLC %dus TEX %3d", frames,
+        ta_renders, pvr_vblanks, sh4_instrs, arm7_instrs, slice_us, textures);
+
+    if (emu->snapshots) {
+      int64_t snaps = MAX(prof_counter_load(COUNTER_snapshots), 1);
+      int snap_us =
+          (int)(prof_counter_load(COUNTER_snapshot_time) / snaps / 1000);
+      int rewind_mb = (int)(snapshots_size(emu->snapshots) >> 20);
+
+      snprintf(status + len, sizeof(status) - len, " RWD %dMB %dus",
+               rewind_mb, snap_us);
+    }
 
     /* right align */
     struct ImVec2 content;
@@ -693,22 +2150,117 @@ void emu_debug_menu(struct emu *emu) {
 }
 
 int emu_load(struct emu *emu, const char *path) {
-  return dc_load(emu->dc, path);
+  /* titles without clocks of their own, saved or from their profile, run at
+     the ones the emulator was created with */
+  OPTION_sh4_clock = emu->sh4_clock;
+  OPTION_arm7_clock = emu->arm7_clock;
+
+  if (!dc_load(emu->dc, path)) {
+    return 0;
+  }
+
+  struct disc *disc = gdrom_get_disc(emu->dc->gdrom);
+  emu->wb_sync = disc_in_list(disc, OPTION_fb_writeback_sync);
+
+  emu_load_clocks(emu);
+
+  if (*OPTION_state) {
+    emu_load_state(emu, OPTION_state);
+  } else {
+    emu_load_boot_state(emu);
+  }
+
+  if (OPTION_netplay_listen > 0 || *OPTION_netplay_connect) {
+    emu->netplay =
+        netplay_create(emu->dc, OPTION_netplay_connect, OPTION_netplay_listen,
+                       OPTION_netplay_delay, OPTION_determinism_check);
+
+    if (!emu->netplay) {
+      LOG_WARNING("emu_load failed to start netplay, playing offline");
+    }
+  }
+
+  int movie = *OPTION_record_movie || *OPTION_play_movie;
+
+  /* offline, the real-time clock is the only input besides the controllers
+     that differs between runs. start it at 2000-01-01 for the hashes to be
+     comparable, and for movies to play back as they were recorded */
+  if ((OPTION_determinism_check > 0 || movie) && !emu->netplay) {
+    aica_set_clock(emu->dc->aica, 0x5e0be100);
+  }
+
+  /* netplay restores its own snapshots, and rewinding or running ahead would
+     desync the peers */
+  if (emu->netplay) {
+    if (movie) {
+      LOG_WARNING("emu_load movies aren't supported during netplay");
+    }
+    return 1;
+  }
+
+  /* the same goes for movies, which only record the real timeline */
+  if (*OPTION_play_movie) {
+    if (!dc_play_movie(emu->dc, OPTION_play_movie)) {
+      LOG_WARNING("emu_load failed to play movie %s", OPTION_play_movie);
+    }
+    return 1;
+  }
+
+  if (*OPTION_record_movie) {
+    if (!dc_record_movie(emu->dc, OPTION_record_movie)) {
+      LOG_WARNING("emu_load failed to record movie %s", OPTION_record_movie);
+    }
+    return 1;
+  }
+
+  if (OPTION_rewind > 0) {
+    int max_snapshots = OPTION_rewind * 60;
+    int64_t max_size = (int64_t)MAX(OPTION_rewind_size, 1) << 20;
+    emu->snapshots = snapshots_create(emu->dc, max_snapshots, max_size, 1);
+  }
+
+  /* only the real timeline is ever restored, a single snapshot is needed */
+  if (OPTION_runahead > 0) {
+    emu->runahead = snapshots_create(emu->dc, 1, INT64_MAX, 0);
+  }
+
+  return 1;
 }
 
 int emu_keydown(struct emu *emu, int port, int key, int16_t value) {
-  if (key >= K_CONT_C && key <= K_CONT_RTRIG) {
-    dc_input(emu->dc, port, key - K_CONT_C, value);
+  if (key < K_CONT_C || key > K_CONT_RTRIG) {
+    return 0;
+  }
+
+  /* during netplay, the first controller plays as the local player, and
+     input is applied at frame boundaries by the session */
+  if (emu->netplay) {
+    if (port == 0) {
+      netplay_input(emu->netplay, key - K_CONT_C, value);
+    }
+    return 0;
   }
 
+  mutex_lock(emu->input_mutex);
+  emu->input[port][key - K_CONT_C] = value;
+  emu->input_dirty = 1;
+  mutex_unlock(emu->input_mutex);
+
   return 0;
 }
 
 void emu_vid_destroyed(struct emu *emu) {
-  rb_for_each_entry_safe(tex, &emu->live_textures, struct emu_texture,
-                         live_it) {
-    r_destroy_texture(emu->r, tex->handle);
-    emu_free_texture(emu, tex);
+  emu_sync_parse(emu);
+
+  /* pending readbacks are lost along with the render backend */
+  emu->wb_num = 0;
+  emu->vid_hash_valid = 0;
+
+  emu_release_dead_textures(emu);
+
+  hash_map_for_each_entry_safe(tex, &emu->live_textures, struct emu_texture,
+                               live_it) {
+    emu_evict_texture(emu, tex, 0);
   }
 
   emu->r = NULL;
@@ -721,23 +2273,56 @@ void emu_vid_created(struct emu *emu, struct render_backend *r) {
 void emu_destroy(struct emu *emu) {
   /* shutdown the emulation thread */
   if (emu->multi_threaded) {
-    mutex_lock(emu->req_mutex);
-    emu->state = EMU_SHUTDOWN;
-    cond_signal(emu->req_cond);
-    mutex_unlock(emu->req_mutex);
+    emu_wait_state(emu, EMU_WAITING);
+    emu_set_state(emu, EMU_SHUTDOWN, &emu->req_signal);
 
     void *result;
     thread_join(emu->run_thread, &result);
 
-    mutex_destroy(emu->req_mutex);
-    cond_destroy(emu->req_cond);
-    mutex_destroy(emu->res_mutex);
-    cond_destroy(emu->res_cond);
+    /* shutdown the parse thread, letting it finish any pending context */
+    if (emu->pipelined) {
+      mutex_lock(emu->parse_mutex);
+      emu_wait_parse(emu);
+      emu->parse_shutdown = 1;
+      cond_signal(emu->parse_cond);
+      mutex_unlock(emu->parse_mutex);
+
+      thread_join(emu->parse_thread, &result);
+
+      mutex_destroy(emu->parse_mutex);
+      cond_destroy(emu->parse_cond);
+      cond_destroy(emu->parse_done_cond);
+      emu->pipelined = 0;
+    }
+
+    emu_signal_destroy(&emu->req_signal);
+    emu_signal_destroy(&emu->res_signal);
   }
 
   emu_stop_tracing(emu);
   emu_vid_destroyed(emu);
+  hash_map_destroy(&emu->live_textures);
+  memory_watcher_destroy(emu->watcher);
+  tr_destroy_context(&emu->vid_rcs[0]);
+  tr_destroy_context(&emu->vid_rcs[1]);
+  tr_destroy_converter(emu->vid_cv);
+  if (emu->snapshots) {
+    snapshots_destroy(emu->snapshots);
+  }
+  if (emu->runahead) {
+    snapshots_destroy(emu->runahead);
+  }
+  if (emu->netplay) {
+    netplay_destroy(emu->netplay);
+  }
+  if (emu->pacing_log) {
+    pacing_log_close(emu->pacing_log);
+  }
   dc_destroy(emu->dc);
+  mutex_destroy(emu->input_mutex);
+  free(emu->dead_textures);
+  prof_counter_add(COUNTER_mem_textures,
+                   -(int64_t)(sizeof(emu->textures) + sizeof(emu->wb_pixels)));
   free(emu);
 }
 
@@ -745,16 +2330,42 @@ struct emu *emu_create(struct host *host) {
   struct emu *emu = calloc(1, sizeof(struct emu));
 
   emu->host = host;
+  emu->sh4_clock = OPTION_sh4_clock;
+  emu->arm7_clock = OPTION_arm7_clock;
+
+  /* guest execution must only depend on its input during netplay, when
+     recording or playing back movies, and when checking that it does */
+  if (OPTION_netplay_listen > 0 || *OPTION_netplay_connect ||
+      *OPTION_record_movie || *OPTION_play_movie ||
+      OPTION_determinism_check > 0) {
+    OPTION_arm7_threaded = 0;
+    OPTION_fb_writeback = 0;
+    OPTION_gdrom_async = 0;
+  }
 
   /* create dreamcast, bind client callbacks */
   emu->dc = dc_create();
   emu->dc->userdata = emu;
   emu->dc->push_audio = &emu_push_audio;
+  emu->dc->reserve_audio = &emu_reserve_audio;
+  emu->dc->commit_audio = &emu_commit_audio;
   emu->dc->push_pixels = &emu_push_pixels;
   emu->dc->start_render = &emu_start_render;
   emu->dc->finish_render = &emu_finish_render;
   emu->dc->vblank_in = &emu_vblank_in;
   emu->dc->vblank_out = &emu_vblank_out;
+  emu->dc->poll_input = &emu_poll_input;
+
+  emu->input_mutex = mutex_create();
+
+  /* the parse thread and the video thread take turns converting contexts,
+     never converting at the same time, so they share a converter */
+  emu->vid_cv = tr_create_converter();
+  emu->watcher = memory_watcher_create(OPTION_watch_polling);
+
+  if (*OPTION_pacing_log) {
+    emu->pacing_log = pacing_log_open(OPTION_pacing_log);
+  }
 
   /* add all textures to free list by default */
   for (int i = 0; i < ARRAY_SIZE(emu->textures); i++) {
@@ -762,20 +2373,35 @@ struct emu *emu_create(struct host *host) {
     list_add(&emu->free_textures, &tex->free_it);
   }
 
+  /* the texture cache's entries and the buffer render to texture results are
+     read back into are held for the emulator's lifetime */
+  prof_counter_add(COUNTER_mem_textures,
+                   sizeof(emu->textures) + sizeof(emu->wb_pixels));
+
   /* enable the cpu / gpu to be emulated in parallel */
   emu->multi_threaded = 1;
 
   if (emu->multi_threaded) {
     emu->state = EMU_WAITING;
-    emu->req_mutex = mutex_create();
-    emu->req_cond = cond_create();
-    emu->res_mutex = mutex_create();
-    emu->res_cond = cond_create();
+    emu_signal_init(&emu->req_signal);
+    emu_signal_init(&emu->res_signal);
 
-    emu->run_thread = thread_create(&emu_run_thread, NULL, emu);
+    emu->run_thread = thread_create(&emu_run_thread, "emu", emu);
     CHECK_NOTNULL(emu->run_thread);
   }
 
+  /* parse contexts on their own thread */
+  emu->pipelined = emu->multi_threaded && OPTION_video_pipelined;
+
+  if (emu->pipelined) {
+    emu->parse_mutex = mutex_create();
+    emu->parse_cond = cond_create();
+    emu->parse_done_cond = cond_create();
+
+    emu->parse_thread = thread_create(&emu_parse_thread, "emu_parse", emu);
+    CHECK_NOTNULL(emu->parse_thread);
+  }
+
   /* set initial aspect ratio */
   emu_set_aspect_ratio(emu, OPTION_aspect);
 
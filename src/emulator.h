@@ -1,6 +1,7 @@
 #ifndef EMULATOR_H
 #define EMULATOR_H
 
+#include <stdint.h>
 #include "host/keycode.h"
 
 struct emu;
@@ -16,6 +17,18 @@ int emu_keydown(struct emu *emu, int port, int key, int16_t value);
 
 int emu_load(struct emu *emu, const char *path);
 void emu_debug_menu(struct emu *emu);
-void emu_render_frame(struct emu *emu);
+int emu_render_frame(struct emu *emu);
+/* guest time in nanoseconds of the vblank the last frame rendered was
+   presented at */
+int64_t emu_frame_time(struct emu *emu);
+
+/* the next frame rendered is never shown, only the guest is ran for it */
+void emu_hide_frame(struct emu *emu);
+
+/* save states kept in memory by the host, to be saved and loaded between
+   calls to emu_render_frame */
+int64_t emu_state_max_size(struct emu *emu);
+int64_t emu_save_state_buffer(struct emu *emu, void *data, int64_t size);
+int emu_load_state_buffer(struct emu *emu, const void *data, int64_t size);
 
 #endif
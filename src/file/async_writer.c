@@ -0,0 +1,202 @@
+/*
+ * asynchronous file writer
+ *
+ * data written by the producer (generally the emulation thread) is copied
+ * into a ring buffer, and a dedicated thread drains the ring buffer out to
+ * disk in large writes. this keeps file i/o, and the jitter it causes, off
+ * of the producer
+ *
+ * non-blocking writers drop data when the ring buffer is full, which is
+ * preferable for streams such as audio that are captured in real-time.
+ * blocking writers instead wait for the thread to free up space, for streams
+ * such as traces which are useless if incomplete
+ */
+
+#include "file/async_writer.h"
+#include "core/core.h"
+#include "core/ringbuf.h"
+#include "core/thread.h"
+
+/* the writer thread wakes up to flush whenever this much data is buffered, or
+   every ASYNC_WRITER_FLUSH_MS otherwise */
+#define ASYNC_WRITER_FLUSH_SIZE (64 * 1024)
+#define ASYNC_WRITER_FLUSH_MS 100
+
+struct async_writer {
+  FILE *file;
+  struct ringbuf *buffer;
+  int blocking;
+
+  thread_t thread;
+  mutex_t mutex;
+  /* signalled when data is queued or the writer is closing */
+  cond_t queued_cond;
+  /* signalled when data has been written out, freeing space */
+  cond_t written_cond;
+  int closing;
+
+  int64_t size;
+  int64_t dropped;
+};
+
+static void *async_writer_thread(void *data) {
+  struct async_writer *writer = data;
+
+  while (1) {
+    mutex_lock(writer->mutex);
+
+    while (!writer->closing &&
+           ringbuf_available(writer->buffer) < ASYNC_WRITER_FLUSH_SIZE) {
+      if (!cond_timedwait(writer->queued_cond, writer->mutex,
+                          ASYNC_WRITER_FLUSH_MS)) {
+        break;
+      }
+    }
+
+    int closing = writer->closing;
+
+    mutex_unlock(writer->mutex);
+
+    /* the ring buffer is mapped such that all of the available data is
+       contiguous, so it can be written out in a single call */
+    int available = ringbuf_available(writer->buffer);
+
+    if (available) {
+      void *ptr = ringbuf_read_ptr(writer->buffer);
+      if (fwrite(ptr, available, 1, writer->file) != 1) {
+        LOG_WARNING("async_writer_thread failed to write %d bytes", available);
+      }
+      ringbuf_advance_read_ptr(writer->buffer, available);
+
+      mutex_lock(writer->mutex);
+      cond_signal(writer->written_cond);
+      mutex_unlock(writer->mutex);
+    }
+
+    if (closing && !ringbuf_available(writer->buffer)) {
+      break;
+    }
+  }
+
+  return NULL;
+}
+
+static void async_writer_wait(struct async_writer *writer, int size) {
+  mutex_lock(writer->mutex);
+
+  while (ringbuf_remaining(writer->buffer) < size) {
+    /* make sure the thread is awake to free up space */
+    cond_signal(writer->queued_cond);
+    cond_wait(writer->written_cond, writer->mutex);
+  }
+
+  mutex_unlock(writer->mutex);
+}
+
+int64_t async_writer_size(struct async_writer *writer) {
+  return writer->size;
+}
+
+int async_writer_write(struct async_writer *writer, const void *data,
+                       int size) {
+  const uint8_t *src = data;
+  int max_size = ringbuf_size(writer->buffer);
+
+  if (!writer->blocking && ringbuf_remaining(writer->buffer) < size) {
+    writer->dropped += size;
+    return 0;
+  }
+
+  /* blocking writes larger than the ring buffer are queued in pieces */
+  while (size) {
+    int n = MIN(size, max_size);
+
+    if (ringbuf_remaining(writer->buffer) < n) {
+      async_writer_wait(writer, n);
+    }
+
+    memcpy(ringbuf_write_ptr(writer->buffer), src, n);
+    ringbuf_advance_write_ptr(writer->buffer, n);
+
+    writer->size += n;
+    src += n;
+    size -= n;
+  }
+
+  if (ringbuf_available(writer->buffer) >= ASYNC_WRITER_FLUSH_SIZE) {
+    mutex_lock(writer->mutex);
+    cond_signal(writer->queued_cond);
+    mutex_unlock(writer->mutex);
+  }
+
+  return 1;
+}
+
+void async_writer_close(struct async_writer *writer, const void *header,
+                        int header_size) {
+  if (writer->thread) {
+    mutex_lock(writer->mutex);
+    writer->closing = 1;
+    cond_signal(writer->queued_cond);
+    mutex_unlock(writer->mutex);
+
+    void *result;
+    thread_join(writer->thread, &result);
+  }
+
+  /* optionally rewrite the file's header once the final size is known */
+  if (writer->file && header) {
+    fseek(writer->file, 0, SEEK_SET);
+    fwrite(header, header_size, 1, writer->file);
+  }
+
+  if (writer->dropped) {
+    LOG_WARNING("async_writer_close dropped %" PRId64 " bytes",
+                writer->dropped);
+  }
+
+  if (writer->file) {
+    fclose(writer->file);
+  }
+
+  if (writer->buffer) {
+    ringbuf_destroy(writer->buffer);
+  }
+
+  if (writer->written_cond) {
+    cond_destroy(writer->written_cond);
+  }
+
+  if (writer->queued_cond) {
+    cond_destroy(writer->queued_cond);
+  }
+
+  if (writer->mutex) {
+    mutex_destroy(writer->mutex);
+  }
+
+  free(writer);
+}
+
+struct async_writer *async_writer_open(const char *filename, int buffer_size,
+                                       int blocking) {
+  struct async_writer *writer = calloc(1, sizeof(struct async_writer));
+
+  writer->file = fopen(filename, "wb");
+
+  if (!writer->file) {
+    async_writer_close(writer, NULL, 0);
+    return NULL;
+  }
+
+  writer->buffer = ringbuf_create(buffer_size);
+  writer->blocking = blocking;
+  writer->mutex = mutex_create();
+  writer->queued_cond = cond_create();
+  writer->written_cond = cond_create();
+
+  writer->thread = thread_create(&async_writer_thread, "async_writer", writer);
+  CHECK_NOTNULL(writer->thread);
+
+  return writer;
+}
@@ -0,0 +1,17 @@
+#ifndef ASYNC_WRITER_H
+#define ASYNC_WRITER_H
+
+#include <stdint.h>
+
+struct async_writer;
+
+struct async_writer *async_writer_open(const char *filename, int buffer_size,
+                                       int blocking);
+void async_writer_close(struct async_writer *writer, const void *header,
+                        int header_size);
+
+int async_writer_write(struct async_writer *writer, const void *data,
+                       int size);
+int64_t async_writer_size(struct async_writer *writer);
+
+#endif
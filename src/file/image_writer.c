@@ -0,0 +1,191 @@
+/*
+ * asynchronous image writer
+ *
+ * keeps a copy of a fixed-size file that's modified in place by the guest,
+ * such as a vmu or the flash rom, and writes it back on a dedicated thread.
+ * guests tend to write many small pieces in quick succession, so the write
+ * back is delayed until the writes settle
+ *
+ * writes are tracked by the sectors they touch, which are the only part of
+ * the image copied out by the thread. the image is written to a temporary
+ * file which is then renamed over the original, so a crash mid-write can't
+ * corrupt it
+ */
+
+#include "file/image_writer.h"
+#include "core/core.h"
+#include "core/filesystem.h"
+#include "core/thread.h"
+#include "core/time.h"
+
+struct image_writer {
+  char filename[PATH_MAX];
+  int size;
+  int sector_size;
+  int delay_ms;
+
+  thread_t thread;
+  mutex_t mutex;
+  cond_t dirty_cond;
+  int shutdown;
+
+  /* image as written by the producer, and the sectors modified since the
+     thread last copied them out */
+  uint8_t *data;
+  uint8_t *dirty;
+  int num_dirty;
+  int64_t dirty_time;
+
+  /* the thread's own copy of the image, written out to disk */
+  uint8_t *flush;
+};
+
+static int image_writer_save(struct image_writer *writer) {
+  char tmp[PATH_MAX];
+  snprintf(tmp, sizeof(tmp), "%s.tmp", writer->filename);
+
+  FILE *file = fopen(tmp, "wb");
+  if (!file) {
+    return 0;
+  }
+
+  int res = (int)fwrite(writer->flush, 1, writer->size, file) == writer->size;
+  res &= !fclose(file);
+
+#if PLATFORM_WINDOWS
+  /* rename doesn't replace existing files on windows */
+  if (res) {
+    remove(writer->filename);
+  }
+#endif
+
+  if (!res || rename(tmp, writer->filename)) {
+    remove(tmp);
+    return 0;
+  }
+
+  return 1;
+}
+
+static void *image_writer_thread(void *data) {
+  struct image_writer *writer = data;
+  int num_sectors = writer->size / writer->sector_size;
+
+  mutex_lock(writer->mutex);
+
+  while (1) {
+    while (!writer->num_dirty && !writer->shutdown) {
+      cond_wait(writer->dirty_cond, writer->mutex);
+    }
+
+    /* wait for the writes to settle, unless shutting down */
+    while (writer->num_dirty && !writer->shutdown) {
+      int64_t elapsed = (time_nanoseconds() - writer->dirty_time) / NS_PER_MS;
+
+      if (elapsed >= writer->delay_ms) {
+        break;
+      }
+
+      cond_timedwait(writer->dirty_cond, writer->mutex,
+                     writer->delay_ms - (int)elapsed);
+    }
+
+    if (!writer->num_dirty) {
+      break;
+    }
+
+    for (int i = 0; i < num_sectors; i++) {
+      if (!writer->dirty[i]) {
+        continue;
+      }
+
+      int offset = i * writer->sector_size;
+      memcpy(&writer->flush[offset], &writer->data[offset],
+             writer->sector_size);
+      writer->dirty[i] = 0;
+    }
+
+    writer->num_dirty = 0;
+
+    mutex_unlock(writer->mutex);
+
+    if (!image_writer_save(writer)) {
+      LOG_WARNING("image_writer_thread failed to write %s", writer->filename);
+    }
+
+    mutex_lock(writer->mutex);
+  }
+
+  mutex_unlock(writer->mutex);
+
+  return NULL;
+}
+
+void image_writer_write(struct image_writer *writer, int offset,
+                        const void *data, int n) {
+  CHECK(offset >= 0 && n >= 0 && offset + n <= writer->size);
+
+  if (!n) {
+    return;
+  }
+
+  int first = offset / writer->sector_size;
+  int last = (offset + n - 1) / writer->sector_size;
+
+  mutex_lock(writer->mutex);
+
+  memcpy(&writer->data[offset], data, n);
+
+  for (int i = first; i <= last; i++) {
+    writer->num_dirty += !writer->dirty[i];
+    writer->dirty[i] = 1;
+  }
+
+  writer->dirty_time = time_nanoseconds();
+  cond_signal(writer->dirty_cond);
+
+  mutex_unlock(writer->mutex);
+}
+
+void image_writer_destroy(struct image_writer *writer) {
+  /* the thread writes back any pending changes before exiting */
+  mutex_lock(writer->mutex);
+  writer->shutdown = 1;
+  cond_signal(writer->dirty_cond);
+  mutex_unlock(writer->mutex);
+
+  void *result;
+  thread_join(writer->thread, &result);
+
+  cond_destroy(writer->dirty_cond);
+  mutex_destroy(writer->mutex);
+  free(writer->flush);
+  free(writer->dirty);
+  free(writer->data);
+  free(writer);
+}
+
+struct image_writer *image_writer_create(const char *filename,
+                                         const void *data, int size,
+                                         int sector_size, int delay_ms) {
+  CHECK(sector_size > 0 && (size % sector_size) == 0);
+
+  struct image_writer *writer = calloc(1, sizeof(struct image_writer));
+
+  snprintf(writer->filename, sizeof(writer->filename), "%s", filename);
+  writer->size = size;
+  writer->sector_size = sector_size;
+  writer->delay_ms = delay_ms;
+  writer->data = malloc(size);
+  writer->dirty = calloc(size / sector_size, 1);
+  writer->flush = malloc(size);
+  memcpy(writer->data, data, size);
+  memcpy(writer->flush, data, size);
+  writer->mutex = mutex_create();
+  writer->dirty_cond = cond_create();
+
+  writer->thread = thread_create(&image_writer_thread, "image_writer", writer);
+  CHECK_NOTNULL(writer->thread);
+
+  return writer;
+}
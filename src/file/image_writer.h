@@ -0,0 +1,18 @@
+#ifndef IMAGE_WRITER_H
+#define IMAGE_WRITER_H
+
+#include <stdint.h>
+
+struct image_writer;
+
+/* data is the image's current contents on disk. it's written back once no
+   sector has been written for delay_ms, and when the writer is destroyed */
+struct image_writer *image_writer_create(const char *filename,
+                                         const void *data, int size,
+                                         int sector_size, int delay_ms);
+void image_writer_destroy(struct image_writer *writer);
+
+void image_writer_write(struct image_writer *writer, int offset,
+                        const void *data, int n);
+
+#endif
@@ -0,0 +1,124 @@
+/*
+ * input movies
+ *
+ * records each input event stamped with the guest time it was seen at, so
+ * that playing it back reproduces the guest's execution exactly, regardless
+ * of how fast the host runs it
+ */
+
+#include "file/movie.h"
+#include "core/core.h"
+
+struct movie {
+  FILE *file;
+  int64_t start_time;
+
+  /* events loaded for playback */
+  struct movie_event *events;
+  int num_events;
+  int next_event;
+};
+
+struct movie *movie_record(const char *filename, int64_t start_time) {
+  FILE *file = fopen(filename, "wb");
+  if (!file) {
+    LOG_WARNING("movie_record failed to open %s", filename);
+    return NULL;
+  }
+
+  struct movie_header header = {0};
+  header.magic = MOVIE_MAGIC;
+  header.version = MOVIE_VERSION;
+  header.event_size = sizeof(struct movie_event);
+  fwrite(&header, sizeof(header), 1, file);
+
+  struct movie *movie = calloc(1, sizeof(struct movie));
+  movie->file = file;
+  movie->start_time = start_time;
+
+  LOG_INFO("movie_record writing %s", filename);
+
+  return movie;
+}
+
+struct movie *movie_play(const char *filename, int64_t start_time) {
+  FILE *file = fopen(filename, "rb");
+  if (!file) {
+    LOG_WARNING("movie_play failed to open %s", filename);
+    return NULL;
+  }
+
+  struct movie_header header;
+  if (fread(&header, sizeof(header), 1, file) != 1 ||
+      header.magic != MOVIE_MAGIC || header.version != MOVIE_VERSION ||
+      header.event_size != sizeof(struct movie_event)) {
+    LOG_WARNING("movie_play %s isn't a valid movie", filename);
+    fclose(file);
+    return NULL;
+  }
+
+  struct movie *movie = calloc(1, sizeof(struct movie));
+  movie->start_time = start_time;
+
+  int max_events = 0;
+  struct movie_event event;
+
+  /* a movie cut short by a crash may end in a partial event, ignore it */
+  while (fread(&event, sizeof(event), 1, file) == 1) {
+    if (movie->num_events == max_events) {
+      max_events = MAX(max_events * 2, 1024);
+      movie->events = realloc(movie->events, max_events * sizeof(event));
+    }
+    movie->events[movie->num_events++] = event;
+  }
+
+  fclose(file);
+
+  LOG_INFO("movie_play loaded %d events from %s", movie->num_events, filename);
+
+  return movie;
+}
+
+void movie_close(struct movie *movie) {
+  if (movie->file) {
+    fclose(movie->file);
+  }
+  free(movie->events);
+  free(movie);
+}
+
+int movie_playing(struct movie *movie) {
+  return !movie->file;
+}
+
+int movie_finished(struct movie *movie) {
+  return movie_playing(movie) && movie->next_event >= movie->num_events;
+}
+
+void movie_write(struct movie *movie, int64_t guest_time, int port, int button,
+                 int16_t value) {
+  struct movie_event event = {0};
+  event.guest_time = guest_time - movie->start_time;
+  event.port = port;
+  event.button = button;
+  event.value = value;
+  fwrite(&event, sizeof(event), 1, movie->file);
+}
+
+int movie_next(struct movie *movie, int64_t guest_time,
+               struct movie_event *event) {
+  if (movie->next_event >= movie->num_events) {
+    return 0;
+  }
+
+  struct movie_event *next = &movie->events[movie->next_event];
+
+  if (next->guest_time > guest_time - movie->start_time) {
+    return 0;
+  }
+
+  *event = *next;
+  movie->next_event++;
+
+  return 1;
+}
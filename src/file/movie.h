@@ -0,0 +1,44 @@
+#ifndef MOVIE_H
+#define MOVIE_H
+
+#include <stdint.h>
+
+#define MOVIE_MAGIC 0x49564f4d /* 'MOVI' */
+#define MOVIE_VERSION 1
+
+struct movie_header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t event_size;
+  uint32_t reserved;
+};
+
+struct movie_event {
+  /* guest time in ns since the movie was started */
+  int64_t guest_time;
+  int32_t port;
+  int32_t button;
+  int32_t value;
+  int32_t reserved;
+};
+
+struct movie;
+
+/* start_time is the scheduler's time when the recording or playback starts,
+   event times are stored relative to it */
+struct movie *movie_record(const char *filename, int64_t start_time);
+struct movie *movie_play(const char *filename, int64_t start_time);
+void movie_close(struct movie *movie);
+
+int movie_playing(struct movie *movie);
+int movie_finished(struct movie *movie);
+
+void movie_write(struct movie *movie, int64_t guest_time, int port, int button,
+                 int16_t value);
+
+/* pops the next event due at or before guest_time, returns 0 when there are
+   none */
+int movie_next(struct movie *movie, int64_t guest_time,
+               struct movie_event *event);
+
+#endif
@@ -0,0 +1,88 @@
+/*
+ * frame pacing log
+ *
+ * records the guest and host time of each event affecting frame pacing, so
+ * stalls in emulation, rendering and syncing to the host can be told apart
+ * after the fact. see tools/repace for the analyzer
+ */
+
+#include "file/pacing_log.h"
+#include "core/core.h"
+#include "core/time.h"
+
+struct pacing_log {
+  FILE *file;
+};
+
+struct pacing_log *pacing_log_open(const char *filename) {
+  FILE *file = fopen(filename, "wb");
+  if (!file) {
+    LOG_WARNING("pacing_log_open failed to open %s", filename);
+    return NULL;
+  }
+
+  struct pacing_header header = {0};
+  header.magic = PACING_LOG_MAGIC;
+  header.version = PACING_LOG_VERSION;
+  header.record_size = sizeof(struct pacing_record);
+  fwrite(&header, sizeof(header), 1, file);
+
+  struct pacing_log *log = calloc(1, sizeof(struct pacing_log));
+  log->file = file;
+
+  LOG_INFO("pacing_log_open writing %s", filename);
+
+  return log;
+}
+
+void pacing_log_close(struct pacing_log *log) {
+  fclose(log->file);
+  free(log);
+}
+
+void pacing_log_record(struct pacing_log *log, enum pacing_event event,
+                       uint32_t frame, int64_t guest_time, int audio_frames) {
+  struct pacing_record rec = {0};
+  rec.event = event;
+  rec.frame = frame;
+  rec.guest_time = guest_time;
+  rec.host_time = time_nanoseconds();
+  rec.audio_frames = audio_frames;
+  fwrite(&rec, sizeof(rec), 1, log->file);
+}
+
+int pacing_log_read(const char *filename, struct pacing_record **records,
+                    int *num_records) {
+  *records = NULL;
+  *num_records = 0;
+
+  FILE *file = fopen(filename, "rb");
+  if (!file) {
+    return 0;
+  }
+
+  struct pacing_header header;
+  if (fread(&header, sizeof(header), 1, file) != 1 ||
+      header.magic != PACING_LOG_MAGIC ||
+      header.version != PACING_LOG_VERSION ||
+      header.record_size != sizeof(struct pacing_record)) {
+    fclose(file);
+    return 0;
+  }
+
+  int max_records = 0;
+  struct pacing_record rec;
+
+  /* a log cut short by a crash may end in a partial record, ignore it */
+  while (fread(&rec, sizeof(rec), 1, file) == 1) {
+    if (*num_records == max_records) {
+      max_records = MAX(max_records * 2, 4096);
+      *records = realloc(*records, max_records * sizeof(rec));
+    }
+    (*records)[(*num_records)++] = rec;
+  }
+
+  fclose(file);
+
+  return 1;
+}
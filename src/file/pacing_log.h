@@ -0,0 +1,52 @@
+#ifndef PACING_LOG_H
+#define PACING_LOG_H
+
+#include <stdint.h>
+
+#define PACING_LOG_MAGIC 0x50434c47 /* 'PCLG' */
+#define PACING_LOG_VERSION 1
+
+enum pacing_event {
+  /* the video thread starting a frame */
+  PACING_FRAME,
+  PACING_VBLANK_IN,
+  PACING_VBLANK_OUT,
+  PACING_START_RENDER,
+  PACING_FINISH_RENDER,
+  PACING_NUM_EVENTS,
+};
+
+struct pacing_header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t record_size;
+  uint32_t reserved;
+};
+
+struct pacing_record {
+  uint32_t event;
+  /* guest frame, counted in vblanks */
+  uint32_t frame;
+  /* the scheduler's time in ns */
+  int64_t guest_time;
+  int64_t host_time;
+  /* audio frames buffered by the host waiting to be played */
+  int32_t audio_frames;
+  int32_t reserved;
+};
+
+struct pacing_log;
+
+struct pacing_log *pacing_log_open(const char *filename);
+void pacing_log_close(struct pacing_log *log);
+
+/* safe to call from multiple threads, each record is written with a single
+   buffered write */
+void pacing_log_record(struct pacing_log *log, enum pacing_event event,
+                       uint32_t frame, int64_t guest_time, int audio_frames);
+
+/* read back every record of a log, returns 0 if it isn't a valid log */
+int pacing_log_read(const char *filename, struct pacing_record **records,
+                    int *num_records);
+
+#endif
@@ -1,66 +1,436 @@
+/*
+ * ta traces
+ *
+ * traces record each texture registered and each context rendered, so the
+ * render path can be replayed and debugged without the rest of the machine
+ *
+ * version 2 traces start with a trace_header, followed by a stream of chunks.
+ * texture data is content-addressed, each unique palette or texture is written
+ * once as a blob chunk and referenced by hash from texture chunks. contexts
+ * are deflated. an index of frame offsets is appended when the trace is
+ * closed, and the header is rewritten to point to it
+ *
+ * compressing, hashing and disk i/o happen on the writer's own thread, so
+ * recording doesn't perturb the timing being captured. the producer only
+ * copies the data it's handed into a bounded ring buffer. rather than stall
+ * when the writer can't keep up, the write is dropped and reported back to
+ * the producer, which is free to retry textures later. a dropped context only
+ * loses that frame
+ *
+ * version 1 traces have no header, and are a stream of uncompressed records.
+ * they're no longer written, but can still be read
+ */
+
 #include <limits.h>
+#include <zlib.h>
 #include "file/trace.h"
 #include "core/core.h"
 #include "core/filesystem.h"
+#include "core/memory.h"
+#include "core/ringbuf.h"
+#include "core/thread.h"
+#include "core/xxhash.h"
+#include "guest/pvr/ta.h"
 #include "guest/pvr/tr.h"
 
+#define TRACE_MAGIC 0x32435254 /* 'TRC2' */
+#define TRACE_VERSION 2
+
+/* size of the ring buffer jobs are queued in for the writer thread */
+#define TRACE_WRITER_BUFFER_SIZE (64 * 1024 * 1024)
+
+enum {
+  TRACE_CHUNK_BLOB,
+  TRACE_CHUNK_TEXTURE,
+  TRACE_CHUNK_CONTEXT,
+  TRACE_CHUNK_INDEX,
+};
+
+struct trace_header {
+  uint32_t magic;
+  uint32_t version;
+  /* offset of the frame index chunk, 0 if the trace wasn't closed */
+  int64_t index_offset;
+};
+
+struct trace_chunk {
+  uint32_t type;
+  /* size of the payload following the chunk header */
+  uint32_t size;
+};
+
+/* followed by the blob's data */
+struct trace_blob_chunk {
+  uint64_t hash;
+};
+
+struct trace_texture_chunk {
+  union tsp tsp;
+  union tcw tcw;
+  uint32_t frame;
+  int32_t palette_size;
+  int32_t texture_size;
+  int32_t reserved;
+  uint64_t palette_hash;
+  uint64_t texture_hash;
+};
+
+/* followed by the deflated bg vertices and params */
+struct trace_context_chunk {
+  uint32_t frame;
+  int32_t autosort;
+  int32_t stride;
+  int32_t palette_fmt;
+  int32_t video_width;
+  int32_t video_height;
+  int32_t alpha_ref;
+  union isp bg_isp;
+  union tsp bg_tsp;
+  union tcw bg_tcw;
+  float bg_depth;
+  int32_t bg_vertices_size;
+  int32_t params_size;
+  int32_t packed_size;
+};
+
+/* the layout of version 1 records. the data pointers are written out relative
+   to the start of the record. the reserved pointers were once list pointers
+   patched in on read */
+struct trace_record {
+  enum trace_cmd_type type;
+  void *reserved[3];
+  union {
+    struct trace_texture_cmd texture;
+    struct trace_context_cmd context;
+  };
+};
+
+/*
+ * writer
+ */
+
+/* queued in the ring buffer, followed by the job's data padded to 8 bytes */
+struct trace_job {
+  int type;
+  /* palette followed by texture, or bg vertices followed by params */
+  int size;
+  union {
+    struct trace_texture_chunk texture;
+    struct trace_context_chunk context;
+  };
+};
+
+struct trace_writer {
+  FILE *file;
+  int64_t offset;
+
+  /* written only by the producer, read by the writer thread */
+  struct ringbuf *jobs;
+  int dropped_frames;
+  int dropped_textures;
+
+  thread_t thread;
+  mutex_t mutex;
+  /* signalled when a job is queued or the writer is closing */
+  cond_t queued_cond;
+  int closing;
+
+  /* hashes of the blobs already written */
+  uint64_t *blobs;
+  int num_blobs;
+  int max_blobs;
+
+  /* offset of each context chunk */
+  int64_t *frames;
+  int num_frames;
+  int max_frames;
+
+  uint8_t *packed;
+  uLongf max_packed;
+};
+
+static int trace_writer_add_blob(struct trace_writer *writer, uint64_t hash) {
+  if (writer->num_blobs >= writer->max_blobs / 2) {
+    uint64_t *old = writer->blobs;
+    int old_max = writer->max_blobs;
+
+    writer->max_blobs = MAX(old_max * 2, 1024);
+    writer->blobs = calloc(writer->max_blobs, sizeof(uint64_t));
+    writer->num_blobs = 0;
+
+    for (int i = 0; i < old_max; i++) {
+      if (old[i]) {
+        trace_writer_add_blob(writer, old[i]);
+      }
+    }
+
+    free(old);
+  }
+
+  /* a zero hash is remapped, leaving 0 for empty slots */
+  hash = hash ? hash : 1;
+
+  int mask = writer->max_blobs - 1;
+  int i = (int)(hash >> 32) & mask;
+
+  while (writer->blobs[i]) {
+    if (writer->blobs[i] == hash) {
+      return 0;
+    }
+    i = (i + 1) & mask;
+  }
+
+  writer->blobs[i] = hash;
+  writer->num_blobs++;
+
+  return 1;
+}
+
+static void trace_writer_chunk(struct trace_writer *writer, uint32_t type,
+                               const void *header, int header_size,
+                               const void *data, int size) {
+  struct trace_chunk chunk;
+  chunk.type = type;
+  chunk.size = header_size + size;
+
+  int res = fwrite(&chunk, sizeof(chunk), 1, writer->file) == 1;
+  res &= fwrite(header, header_size, 1, writer->file) == 1;
+  if (size) {
+    res &= fwrite(data, size, 1, writer->file) == 1;
+  }
+
+  if (!res) {
+    LOG_WARNING("trace_writer_chunk failed to write %d bytes",
+                (int)sizeof(chunk) + header_size + size);
+  }
+
+  writer->offset += sizeof(chunk) + header_size + size;
+}
+
+static uint64_t trace_writer_blob(struct trace_writer *writer,
+                                  const uint8_t *data, int size) {
+  uint64_t hash = xxh64(data, size, 0);
+
+  if (size && trace_writer_add_blob(writer, hash)) {
+    struct trace_blob_chunk blob;
+    blob.hash = hash;
+    trace_writer_chunk(writer, TRACE_CHUNK_BLOB, &blob, sizeof(blob), data,
+                       size);
+  }
+
+  return hash;
+}
+
+static void trace_writer_write_job(struct trace_writer *writer,
+                                   struct trace_job *job) {
+  const uint8_t *data = (const uint8_t *)(job + 1);
+
+  if (job->type == TRACE_CHUNK_TEXTURE) {
+    struct trace_texture_chunk *tex = &job->texture;
+    tex->palette_hash = trace_writer_blob(writer, data, tex->palette_size);
+    tex->texture_hash = trace_writer_blob(writer, data + tex->palette_size,
+                                          tex->texture_size);
+    trace_writer_chunk(writer, TRACE_CHUNK_TEXTURE, tex, sizeof(*tex), NULL,
+                       0);
+    return;
+  }
+
+  uLongf max_packed = compressBound((uLong)job->size);
+  if (max_packed > writer->max_packed) {
+    writer->max_packed = max_packed;
+    writer->packed = realloc(writer->packed, max_packed);
+  }
+
+  /* favor speed, the params are already fairly small */
+  uLongf packed_size = max_packed;
+  int res = compress2(writer->packed, &packed_size, data, job->size,
+                      Z_BEST_SPEED);
+  CHECK_EQ(res, Z_OK);
+
+  if (writer->num_frames == writer->max_frames) {
+    writer->max_frames = MAX(writer->max_frames * 2, 1024);
+    writer->frames =
+        realloc(writer->frames, writer->max_frames * sizeof(int64_t));
+  }
+  writer->frames[writer->num_frames++] = writer->offset;
+
+  struct trace_context_chunk *ctx = &job->context;
+  ctx->packed_size = (int32_t)packed_size;
+  trace_writer_chunk(writer, TRACE_CHUNK_CONTEXT, ctx, sizeof(*ctx),
+                     writer->packed, (int)packed_size);
+}
+
+static int trace_job_size(int data_size) {
+  return (int)sizeof(struct trace_job) + ALIGN_UP(data_size, 8);
+}
+
+static void *trace_writer_thread(void *data) {
+  struct trace_writer *writer = data;
+
+  while (1) {
+    mutex_lock(writer->mutex);
+
+    while (!writer->closing && !ringbuf_available(writer->jobs)) {
+      cond_wait(writer->queued_cond, writer->mutex);
+    }
+
+    int closing = writer->closing;
+
+    mutex_unlock(writer->mutex);
+
+    /* drain everything queued so far, freeing space as each job is written */
+    while (ringbuf_available(writer->jobs)) {
+      struct trace_job *job = ringbuf_read_ptr(writer->jobs);
+      trace_writer_write_job(writer, job);
+      ringbuf_advance_read_ptr(writer->jobs, trace_job_size(job->size));
+    }
+
+    if (closing) {
+      break;
+    }
+  }
+
+  return NULL;
+}
+
+/* reserve space for a job in the ring buffer, returning NULL rather than
+   waiting on the writer thread when it's full */
+static struct trace_job *trace_writer_reserve(struct trace_writer *writer,
+                                              int type, int size) {
+  if (ringbuf_remaining(writer->jobs) < trace_job_size(size)) {
+    return NULL;
+  }
+
+  struct trace_job *job = ringbuf_write_ptr(writer->jobs);
+  memset(job, 0, sizeof(*job));
+  job->type = type;
+  job->size = size;
+  return job;
+}
+
+static void trace_writer_commit(struct trace_writer *writer,
+                                struct trace_job *job) {
+  ringbuf_advance_write_ptr(writer->jobs, trace_job_size(job->size));
+
+  mutex_lock(writer->mutex);
+  cond_signal(writer->queued_cond);
+  mutex_unlock(writer->mutex);
+}
+
+void trace_writer_stats(struct trace_writer *writer,
+                        struct trace_stats *stats) {
+  stats->written = writer->offset;
+  stats->queued = ringbuf_available(writer->jobs);
+  stats->capacity = ringbuf_size(writer->jobs);
+  stats->dropped_frames = writer->dropped_frames;
+  stats->dropped_textures = writer->dropped_textures;
+}
+
 void trace_writer_close(struct trace_writer *writer) {
+  if (writer->thread) {
+    mutex_lock(writer->mutex);
+    writer->closing = 1;
+    cond_signal(writer->queued_cond);
+    mutex_unlock(writer->mutex);
+
+    void *result;
+    thread_join(writer->thread, &result);
+  }
+
   if (writer->file) {
+    /* append the frame index, and point the header at it */
+    struct trace_header header;
+    header.magic = TRACE_MAGIC;
+    header.version = TRACE_VERSION;
+    header.index_offset = writer->offset;
+
+    int64_t num_frames = writer->num_frames;
+    trace_writer_chunk(writer, TRACE_CHUNK_INDEX, &num_frames,
+                       sizeof(num_frames), writer->frames,
+                       writer->num_frames * (int)sizeof(int64_t));
+
+    fseek(writer->file, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, writer->file);
     fclose(writer->file);
   }
 
+  if (writer->mutex) {
+    cond_destroy(writer->queued_cond);
+    mutex_destroy(writer->mutex);
+  }
+
+  if (writer->jobs) {
+    ringbuf_destroy(writer->jobs);
+  }
+
+  free(writer->packed);
+  free(writer->frames);
+  free(writer->blobs);
   free(writer);
 }
 
-void trace_writer_render_context(struct trace_writer *writer,
-                                 struct ta_context *ctx) {
-  struct trace_cmd cmd = {0};
-  cmd.type = TRACE_CMD_CONTEXT;
-  cmd.context.autosort = ctx->autosort;
-  cmd.context.stride = ctx->stride;
-  cmd.context.palette_fmt = ctx->palette_fmt;
-  cmd.context.video_width = ctx->video_width;
-  cmd.context.video_height = ctx->video_height;
-  cmd.context.alpha_ref = ctx->alpha_ref;
-  cmd.context.bg_isp = ctx->bg_isp;
-  cmd.context.bg_tsp = ctx->bg_tsp;
-  cmd.context.bg_tcw = ctx->bg_tcw;
-  cmd.context.bg_depth = ctx->bg_depth;
-  cmd.context.bg_vertices_size = sizeof(ctx->bg_vertices);
-  cmd.context.bg_vertices = (const uint8_t *)(intptr_t)sizeof(cmd);
-  cmd.context.params_size = ctx->size;
-  cmd.context.params =
-      (const uint8_t *)(intptr_t)(sizeof(cmd) + sizeof(ctx->bg_vertices));
-
-  CHECK_EQ(fwrite(&cmd, sizeof(cmd), 1, writer->file), 1);
-  CHECK_EQ(fwrite(ctx->bg_vertices, sizeof(ctx->bg_vertices), 1, writer->file),
-           1);
-  if (ctx->size) {
-    CHECK_EQ(fwrite(ctx->params, ctx->size, 1, writer->file), 1);
-  }
-}
-
-void trace_writer_insert_texture(struct trace_writer *writer, union tsp tsp,
-                                 union tcw tcw, unsigned frame,
-                                 const uint8_t *palette, int palette_size,
-                                 const uint8_t *texture, int texture_size) {
-  struct trace_cmd cmd = {0};
-  cmd.type = TRACE_CMD_TEXTURE;
-  cmd.texture.tsp = tsp;
-  cmd.texture.tcw = tcw;
-  cmd.texture.frame = frame;
-  cmd.texture.palette_size = palette_size;
-  cmd.texture.palette = (const uint8_t *)(intptr_t)sizeof(cmd);
-  cmd.texture.texture_size = texture_size;
-  cmd.texture.texture = (const uint8_t *)(intptr_t)(sizeof(cmd) + palette_size);
-
-  CHECK_EQ(fwrite(&cmd, sizeof(cmd), 1, writer->file), 1);
+int trace_writer_render_context(struct trace_writer *writer,
+                                struct ta_context *ctx) {
+  int size = (int)sizeof(ctx->bg_vertices) + ctx->size;
+  struct trace_job *job =
+      trace_writer_reserve(writer, TRACE_CHUNK_CONTEXT, size);
+
+  if (!job) {
+    writer->dropped_frames++;
+    return 0;
+  }
+
+  job->context.autosort = ctx->autosort;
+  job->context.stride = ctx->stride;
+  job->context.palette_fmt = ctx->palette_fmt;
+  job->context.video_width = ctx->video_width;
+  job->context.video_height = ctx->video_height;
+  job->context.alpha_ref = ctx->alpha_ref;
+  job->context.bg_isp = ctx->bg_isp;
+  job->context.bg_tsp = ctx->bg_tsp;
+  job->context.bg_tcw = ctx->bg_tcw;
+  job->context.bg_depth = ctx->bg_depth;
+  job->context.bg_vertices_size = sizeof(ctx->bg_vertices);
+  job->context.params_size = ctx->size;
+
+  uint8_t *data = (uint8_t *)(job + 1);
+  memcpy(data, ctx->bg_vertices, sizeof(ctx->bg_vertices));
+  memcpy(data + sizeof(ctx->bg_vertices), ctx->params, ctx->size);
+
+  trace_writer_commit(writer, job);
+
+  return 1;
+}
+
+int trace_writer_insert_texture(struct trace_writer *writer, union tsp tsp,
+                                union tcw tcw, unsigned frame,
+                                const uint8_t *palette, int palette_size,
+                                const uint8_t *texture, int texture_size) {
+  struct trace_job *job = trace_writer_reserve(
+      writer, TRACE_CHUNK_TEXTURE, palette_size + texture_size);
+
+  if (!job) {
+    writer->dropped_textures++;
+    return 0;
+  }
+
+  job->texture.tsp = tsp;
+  job->texture.tcw = tcw;
+  job->texture.frame = frame;
+  job->texture.palette_size = palette_size;
+  job->texture.texture_size = texture_size;
+
+  uint8_t *data = (uint8_t *)(job + 1);
   if (palette_size) {
-    CHECK_EQ(fwrite(palette, palette_size, 1, writer->file), 1);
+    memcpy(data, palette, palette_size);
   }
   if (texture_size) {
-    CHECK_EQ(fwrite(texture, texture_size, 1, writer->file), 1);
+    memcpy(data + palette_size, texture, texture_size);
   }
+
+  trace_writer_commit(writer, job);
+
+  return 1;
 }
 
 struct trace_writer *trace_writer_open(const char *filename) {
@@ -73,92 +443,389 @@ struct trace_writer *trace_writer_open(const char *filename) {
     return NULL;
   }
 
+  /* the header is rewritten with the index offset on close */
+  struct trace_header header = {0};
+  if (fwrite(&header, sizeof(header), 1, writer->file) != 1) {
+    trace_writer_close(writer);
+    return NULL;
+  }
+  writer->offset = sizeof(header);
+
+  writer->jobs = ringbuf_create(TRACE_WRITER_BUFFER_SIZE);
+  writer->mutex = mutex_create();
+  writer->queued_cond = cond_create();
+  writer->thread = thread_create(&trace_writer_thread, "trace_writer", writer);
+
+  if (!writer->thread) {
+    trace_writer_close(writer);
+    return NULL;
+  }
+
   return writer;
 }
 
-/* for commands which mutate global state, the previous state needs to be
-   tracked in order to support unwinding. To do so, each command is iterated
-   and tagged with the previous command that it overrides */
-static int trace_patch_overrides(struct trace_cmd *cmd) {
-  while (cmd) {
-    if (cmd->type == TRACE_CMD_TEXTURE) {
-      tr_texture_key_t texture_key =
-          tr_texture_key(cmd->texture.tsp, cmd->texture.tcw);
-
-      /* walk backwards and see if this texture overrode a previous command
-         TODO could cache this information in a map */
-      struct trace_cmd *prev = cmd->prev;
-
-      while (prev) {
-        if (prev->type == TRACE_CMD_TEXTURE) {
-          tr_texture_key_t prev_texture_key =
-              tr_texture_key(prev->texture.tsp, prev->texture.tcw);
-
-          if (prev_texture_key == texture_key) {
-            cmd->override = prev;
-            break;
-          }
-        }
-
-        prev = prev->prev;
+/*
+ * reader
+ */
+struct trace_index {
+  int64_t offset;
+  int override;
+  /* for version 2 textures, the offsets of their blobs' data */
+  int64_t palette_offset;
+  int64_t texture_offset;
+};
+
+/* open addressed map of 64-bit keys, storing value + 1 to leave 0 for empty
+   slots */
+struct trace_slot {
+  uint64_t key;
+  int64_t value;
+};
+
+struct trace_map {
+  struct trace_slot *slots;
+  int num_slots;
+  int max_slots;
+};
+
+struct trace {
+  uint8_t *data;
+  size_t size;
+  int version;
+
+  /* commands indexed so far, and the offset of the next one to index */
+  struct trace_index *index;
+  int num_cmds;
+  int max_cmds;
+  int64_t next_offset;
+  int num_frames;
+
+  /* the last command written to each texture */
+  struct trace_map textures;
+  /* offset of each blob's data */
+  struct trace_map blobs;
+
+  /* inflated data of the most recently resolved context */
+  uint8_t *scratch;
+  int scratch_size;
+};
+
+static int64_t *trace_map_slot(struct trace_map *map, uint64_t key) {
+  if (map->num_slots >= map->max_slots / 2) {
+    struct trace_slot *old = map->slots;
+    int old_max = map->max_slots;
+
+    map->max_slots = MAX(old_max * 2, 1024);
+    map->slots = calloc(map->max_slots, sizeof(struct trace_slot));
+    map->num_slots = 0;
+
+    for (int i = 0; i < old_max; i++) {
+      if (old[i].value) {
+        *trace_map_slot(map, old[i].key) = old[i].value;
       }
     }
 
-    cmd = cmd->next;
+    free(old);
+  }
+
+  int mask = map->max_slots - 1;
+  int i = (int)((key * 0x9e3779b97f4a7c15ull) >> 32) & mask;
+
+  while (map->slots[i].value && map->slots[i].key != key) {
+    i = (i + 1) & mask;
+  }
+
+  if (!map->slots[i].value) {
+    map->slots[i].key = key;
+    map->num_slots++;
+  }
+
+  return &map->slots[i].value;
+}
+
+static struct trace_index *trace_add_index(struct trace *trace,
+                                           int64_t offset,
+                                           tr_texture_key_t *texture_key) {
+  if (trace->num_cmds == trace->max_cmds) {
+    trace->max_cmds = MAX(trace->max_cmds * 2, 1024);
+    trace->index = realloc(trace->index,
+                           trace->max_cmds * sizeof(struct trace_index));
+  }
+
+  struct trace_index *entry = &trace->index[trace->num_cmds];
+  memset(entry, 0, sizeof(*entry));
+  entry->offset = offset;
+  entry->override = -1;
+
+  if (texture_key) {
+    int64_t *slot = trace_map_slot(&trace->textures, *texture_key);
+    entry->override = (int)(*slot - 1);
+    *slot = trace->num_cmds + 1;
+  } else {
+    trace->num_frames++;
+  }
+
+  trace->num_cmds++;
+
+  return entry;
+}
+
+static int trace_index_next_v1(struct trace *trace) {
+  int64_t offset = trace->next_offset;
+  int64_t remaining = (int64_t)trace->size - offset;
+
+  if (remaining < (int64_t)sizeof(struct trace_record)) {
+    return 0;
+  }
+
+  const struct trace_record *rec =
+      (const struct trace_record *)(trace->data + offset);
+  int64_t size = sizeof(struct trace_record);
+
+  if (rec->type == TRACE_CMD_TEXTURE) {
+    size += (int64_t)rec->texture.palette_size + rec->texture.texture_size;
+  } else if (rec->type == TRACE_CMD_CONTEXT) {
+    size += (int64_t)rec->context.bg_vertices_size + rec->context.params_size;
+  } else {
+    LOG_WARNING("unexpected trace command type %d at 0x%" PRIx64, rec->type,
+                offset);
+    trace->next_offset = trace->size;
+    return 0;
+  }
+
+  if (size < (int64_t)sizeof(struct trace_record) || size > remaining) {
+    LOG_WARNING("truncated trace command at 0x%" PRIx64, offset);
+    trace->next_offset = trace->size;
+    return 0;
+  }
+
+  if (rec->type == TRACE_CMD_TEXTURE) {
+    tr_texture_key_t key = tr_texture_key(rec->texture.tsp, rec->texture.tcw);
+    trace_add_index(trace, offset, &key);
+  } else {
+    trace_add_index(trace, offset, NULL);
+  }
+
+  trace->next_offset = offset + size;
+
+  return 1;
+}
+
+static int trace_find_blob(struct trace *trace, uint64_t hash, int size,
+                           int64_t *offset) {
+  if (!size) {
+    *offset = 0;
+    return 1;
+  }
+
+  *offset = *trace_map_slot(&trace->blobs, hash) - 1;
+
+  if (*offset < 0) {
+    LOG_WARNING("trace references missing blob 0x%" PRIx64, hash);
+    return 0;
   }
 
   return 1;
 }
 
-/* commands are written out with null list pointers, and pointers to data
-   are written out relative to the command itself. Set the list pointers,
-   and make the data pointers absolute */
-static int trace_patch_pointers(void *begin, int size) {
-  struct trace_cmd *prev_cmd = NULL;
-  struct trace_cmd *curr_cmd = NULL;
-  uint8_t *ptr = begin;
-  uint8_t *end = ptr + size;
+static int trace_index_next_v2(struct trace *trace) {
+  /* blobs aren't commands, keep going until a command is indexed */
+  while (1) {
+    int64_t offset = trace->next_offset;
+    int64_t remaining = (int64_t)trace->size - offset;
+
+    if (remaining < (int64_t)sizeof(struct trace_chunk)) {
+      return 0;
+    }
 
-  while (ptr < end) {
-    prev_cmd = curr_cmd;
-    curr_cmd = (struct trace_cmd *)ptr;
+    const struct trace_chunk *chunk =
+        (const struct trace_chunk *)(trace->data + offset);
+    const uint8_t *payload = (const uint8_t *)(chunk + 1);
+    int64_t size = sizeof(struct trace_chunk) + (int64_t)chunk->size;
 
-    /* set prev / next pointers */
-    if (prev_cmd) {
-      prev_cmd->next = curr_cmd;
+    if (size > remaining) {
+      LOG_WARNING("truncated trace chunk at 0x%" PRIx64, offset);
+      trace->next_offset = trace->size;
+      return 0;
     }
-    curr_cmd->prev = prev_cmd;
-    curr_cmd->next = NULL;
-    curr_cmd->override = NULL;
-
-    /* patch relative data pointers */
-    switch (curr_cmd->type) {
-      case TRACE_CMD_TEXTURE: {
-        curr_cmd->texture.palette += (intptr_t)ptr;
-        curr_cmd->texture.texture += (intptr_t)ptr;
-        ptr += sizeof(*curr_cmd) + curr_cmd->texture.palette_size +
-               curr_cmd->texture.texture_size;
-      } break;
 
-      case TRACE_CMD_CONTEXT: {
-        curr_cmd->context.bg_vertices += (intptr_t)ptr;
-        curr_cmd->context.params += (intptr_t)ptr;
-        ptr += sizeof(*curr_cmd) + curr_cmd->context.bg_vertices_size +
-               curr_cmd->context.params_size;
+    trace->next_offset = offset + size;
+
+    switch (chunk->type) {
+      case TRACE_CHUNK_BLOB: {
+        const struct trace_blob_chunk *blob =
+            (const struct trace_blob_chunk *)payload;
+        *trace_map_slot(&trace->blobs, blob->hash) =
+            (int64_t)(payload - trace->data) + sizeof(*blob) + 1;
       } break;
 
+      case TRACE_CHUNK_TEXTURE: {
+        const struct trace_texture_chunk *tex =
+            (const struct trace_texture_chunk *)payload;
+        int64_t palette_offset, texture_offset;
+
+        if (!trace_find_blob(trace, tex->palette_hash, tex->palette_size,
+                             &palette_offset) ||
+            !trace_find_blob(trace, tex->texture_hash, tex->texture_size,
+                             &texture_offset)) {
+          trace->next_offset = trace->size;
+          return 0;
+        }
+
+        tr_texture_key_t key = tr_texture_key(tex->tsp, tex->tcw);
+        struct trace_index *entry = trace_add_index(trace, offset, &key);
+        entry->palette_offset = palette_offset;
+        entry->texture_offset = texture_offset;
+        return 1;
+      }
+
+      case TRACE_CHUNK_CONTEXT:
+        trace_add_index(trace, offset, NULL);
+        return 1;
+
+      case TRACE_CHUNK_INDEX:
+        trace->next_offset = trace->size;
+        return 0;
+
       default:
-        LOG_INFO("Unexpected trace command type %d", curr_cmd->type);
+        LOG_WARNING("unexpected trace chunk type %d at 0x%" PRIx64,
+                    chunk->type, offset);
+        trace->next_offset = trace->size;
         return 0;
     }
   }
+}
+
+static int trace_index_next(struct trace *trace) {
+  if (trace->version == 1) {
+    return trace_index_next_v1(trace);
+  }
+  return trace_index_next_v2(trace);
+}
+
+int trace_num_frames(struct trace *trace) {
+  /* use the frame index if the trace was closed cleanly */
+  if (trace->version == 2) {
+    const struct trace_header *header =
+        (const struct trace_header *)trace->data;
+
+    if (header->index_offset &&
+        header->index_offset + sizeof(struct trace_chunk) + sizeof(int64_t) <=
+            trace->size) {
+      const int64_t *num_frames =
+          (const int64_t *)(trace->data + header->index_offset +
+                            sizeof(struct trace_chunk));
+      return (int)*num_frames;
+    }
+  }
+
+  while (trace_index_next(trace)) {
+  }
+
+  return trace->num_frames;
+}
+
+static int trace_get_cmd_v1(struct trace *trace,
+                            const struct trace_index *entry,
+                            struct trace_cmd *cmd) {
+  const uint8_t *base = trace->data + entry->offset;
+  const struct trace_record *rec = (const struct trace_record *)base;
+
+  cmd->type = rec->type;
+
+  /* resolve the relative data pointers */
+  if (rec->type == TRACE_CMD_TEXTURE) {
+    cmd->texture = rec->texture;
+    cmd->texture.palette = base + (intptr_t)rec->texture.palette;
+    cmd->texture.texture = base + (intptr_t)rec->texture.texture;
+  } else {
+    cmd->context = rec->context;
+    cmd->context.bg_vertices = base + (intptr_t)rec->context.bg_vertices;
+    cmd->context.params = base + (intptr_t)rec->context.params;
+  }
 
   return 1;
 }
 
-void trace_destroy(struct trace *trace) {
-  free(trace->cmds);
-  free(trace);
+static int trace_get_cmd_v2(struct trace *trace,
+                            const struct trace_index *entry,
+                            struct trace_cmd *cmd) {
+  const struct trace_chunk *chunk =
+      (const struct trace_chunk *)(trace->data + entry->offset);
+
+  if (chunk->type == TRACE_CHUNK_TEXTURE) {
+    const struct trace_texture_chunk *tex =
+        (const struct trace_texture_chunk *)(chunk + 1);
+
+    cmd->type = TRACE_CMD_TEXTURE;
+    cmd->texture.tsp = tex->tsp;
+    cmd->texture.tcw = tex->tcw;
+    cmd->texture.frame = tex->frame;
+    cmd->texture.palette_size = tex->palette_size;
+    cmd->texture.palette = trace->data + entry->palette_offset;
+    cmd->texture.texture_size = tex->texture_size;
+    cmd->texture.texture = trace->data + entry->texture_offset;
+    return 1;
+  }
+
+  const struct trace_context_chunk *ctx =
+      (const struct trace_context_chunk *)(chunk + 1);
+  int raw_size = ctx->bg_vertices_size + ctx->params_size;
+
+  if (raw_size > trace->scratch_size) {
+    trace->scratch_size = raw_size;
+    trace->scratch = realloc(trace->scratch, raw_size);
+  }
+
+  uLongf size = raw_size;
+  int res = uncompress(trace->scratch, &size, (const Bytef *)(ctx + 1),
+                       ctx->packed_size);
+
+  if (res != Z_OK || (int)size != raw_size) {
+    LOG_WARNING("failed to inflate trace context at 0x%" PRIx64,
+                entry->offset);
+    return 0;
+  }
+
+  cmd->type = TRACE_CMD_CONTEXT;
+  cmd->context.frame = ctx->frame;
+  cmd->context.autosort = ctx->autosort;
+  cmd->context.stride = ctx->stride;
+  cmd->context.palette_fmt = ctx->palette_fmt;
+  cmd->context.video_width = ctx->video_width;
+  cmd->context.video_height = ctx->video_height;
+  cmd->context.alpha_ref = ctx->alpha_ref;
+  cmd->context.bg_isp = ctx->bg_isp;
+  cmd->context.bg_tsp = ctx->bg_tsp;
+  cmd->context.bg_tcw = ctx->bg_tcw;
+  cmd->context.bg_depth = ctx->bg_depth;
+  cmd->context.bg_vertices_size = ctx->bg_vertices_size;
+  cmd->context.bg_vertices = trace->scratch;
+  cmd->context.params_size = ctx->params_size;
+  cmd->context.params = trace->scratch + ctx->bg_vertices_size;
+
+  return 1;
+}
+
+int trace_get_cmd(struct trace *trace, int n, struct trace_cmd *cmd) {
+  if (n < 0) {
+    return 0;
+  }
+
+  while (n >= trace->num_cmds) {
+    if (!trace_index_next(trace)) {
+      return 0;
+    }
+  }
+
+  const struct trace_index *entry = &trace->index[n];
+  cmd->index = n;
+  cmd->override = entry->override;
+
+  if (trace->version == 1) {
+    return trace_get_cmd_v1(trace, entry, cmd);
+  }
+  return trace_get_cmd_v2(trace, entry, cmd);
 }
 
 void trace_copy_context(const struct trace_cmd *cmd, struct ta_context *ctx) {
@@ -176,50 +843,54 @@ void trace_copy_context(const struct trace_cmd *cmd, struct ta_context *ctx) {
   ctx->bg_depth = cmd->context.bg_depth;
   memcpy(ctx->bg_vertices, cmd->context.bg_vertices,
          cmd->context.bg_vertices_size);
+  ta_reserve_params(ctx, cmd->context.params_size);
   memcpy(ctx->params, cmd->context.params, cmd->context.params_size);
   ctx->size = cmd->context.params_size;
 }
 
+void trace_destroy(struct trace *trace) {
+  if (trace->data) {
+    unmap_file(trace->data, trace->size);
+  }
+
+  free(trace->scratch);
+  free(trace->blobs.slots);
+  free(trace->textures.slots);
+  free(trace->index);
+  free(trace);
+}
+
 struct trace *trace_parse(const char *filename) {
   struct trace *trace = calloc(1, sizeof(struct trace));
 
-  FILE *fp = fopen(filename, "rb");
-  if (!fp) {
+  trace->data = map_file(filename, &trace->size);
+
+  if (!trace->data) {
     trace_destroy(trace);
     return NULL;
   }
 
-  fseek(fp, 0, SEEK_END);
-  int size = (int)ftell(fp);
-  fseek(fp, 0, SEEK_SET);
+  const struct trace_header *header = (const struct trace_header *)trace->data;
 
-  trace->cmds = malloc(size);
-  CHECK_EQ(fread(trace->cmds, size, 1, fp), 1);
-  fclose(fp);
+  if (trace->size >= sizeof(*header) && header->magic == TRACE_MAGIC) {
+    if (header->version != TRACE_VERSION) {
+      LOG_WARNING("unsupported trace version %d", header->version);
+      trace_destroy(trace);
+      return NULL;
+    }
 
-  if (!trace_patch_pointers(trace->cmds, size)) {
-    trace_destroy(trace);
-    return NULL;
+    trace->version = TRACE_VERSION;
+    trace->next_offset = sizeof(*header);
+  } else {
+    trace->version = 1;
   }
 
-  if (!trace_patch_overrides(trace->cmds)) {
+  /* make sure it at least starts with a valid command */
+  if (!trace_index_next(trace)) {
     trace_destroy(trace);
     return NULL;
   }
 
-  /* count max frames */
-  {
-    struct trace_cmd *cmd = trace->cmds;
-
-    while (cmd) {
-      if (cmd->type == TRACE_CMD_CONTEXT) {
-        trace->num_frames++;
-      }
-
-      cmd = cmd->next;
-    }
-  }
-
   return trace;
 }
 
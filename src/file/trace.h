@@ -10,71 +10,92 @@ enum trace_cmd_type {
   TRACE_CMD_CONTEXT,
 };
 
+struct trace_texture_cmd {
+  union tsp tsp;
+  union tcw tcw;
+  uint32_t frame;
+  int32_t palette_size;
+  const uint8_t *palette;
+  int32_t texture_size;
+  const uint8_t *texture;
+};
+
+/* slimmed down version of the ta_context structure, will need to be in sync */
+struct trace_context_cmd {
+  uint32_t frame;
+  int32_t autosort;
+  int32_t stride;
+  int32_t palette_fmt;
+  int32_t video_width;
+  int32_t video_height;
+  int32_t alpha_ref;
+  union isp bg_isp;
+  union tsp bg_tsp;
+  union tcw bg_tcw;
+  float bg_depth;
+  int32_t bg_vertices_size;
+  const uint8_t *bg_vertices;
+  int32_t params_size;
+  const uint8_t *params;
+};
+
+/* a command resolved from the mapped trace. texture data points directly into
+   the mapping and remains valid until the trace is destroyed. context data may
+   have been inflated, and is only valid until the next command is resolved */
 struct trace_cmd {
   enum trace_cmd_type type;
 
-  /* set on read */
-  struct trace_cmd *prev;
-  struct trace_cmd *next;
-  struct trace_cmd *override;
+  /* index of the command in the trace */
+  int index;
+
+  /* for textures, index of the previous command writing the same texture,
+     -1 if there isn't one */
+  int override;
 
-  /* the data pointers in these structs are written out relative to the cmd,
-     and patched to absolute pointers on read */
   union {
-    struct {
-      union tsp tsp;
-      union tcw tcw;
-      uint32_t frame;
-      int32_t palette_size;
-      const uint8_t *palette;
-      int32_t texture_size;
-      const uint8_t *texture;
-    } texture;
-
-    /* slimmed down version of the ta_context structure, will need to be in
-       sync */
-    struct {
-      uint32_t frame;
-      int32_t autosort;
-      int32_t stride;
-      int32_t palette_fmt;
-      int32_t video_width;
-      int32_t video_height;
-      int32_t alpha_ref;
-      union isp bg_isp;
-      union tsp bg_tsp;
-      union tcw bg_tcw;
-      float bg_depth;
-      int32_t bg_vertices_size;
-      const uint8_t *bg_vertices;
-      int32_t params_size;
-      const uint8_t *params;
-    } context;
+    struct trace_texture_cmd texture;
+    struct trace_context_cmd context;
   };
 };
 
-struct trace {
-  struct trace_cmd *cmds;
-  int num_frames;
-};
+struct trace;
+struct trace_writer;
 
-struct trace_writer {
-  FILE *file;
+struct trace_stats {
+  /* bytes written out to disk */
+  int64_t written;
+  /* bytes waiting on the writer thread, out of capacity */
+  int queued;
+  int capacity;
+  int dropped_frames;
+  int dropped_textures;
 };
 
 void get_next_trace_filename(char *filename, size_t size);
 
+/* maps the trace without reading it, commands are indexed lazily as they're
+   accessed */
 struct trace *trace_parse(const char *filename);
-void trace_copy_context(const struct trace_cmd *cmd, struct ta_context *ctx);
 void trace_destroy(struct trace *trace);
 
+/* resolve the nth command, returning 0 if there aren't that many */
+int trace_get_cmd(struct trace *trace, int n, struct trace_cmd *cmd);
+
+/* indexes the entire trace, only touching each command's header */
+int trace_num_frames(struct trace *trace);
+
+void trace_copy_context(const struct trace_cmd *cmd, struct ta_context *ctx);
+
+/* writes are queued for a background thread, and dropped rather than
+   blocking when too much is queued. each returns 0 if it was dropped */
 struct trace_writer *trace_writer_open(const char *filename);
-void trace_writer_insert_texture(struct trace_writer *writer, union tsp tsp,
-                                 union tcw tcw, unsigned frame,
-                                 const uint8_t *palette, int palette_size,
-                                 const uint8_t *texture, int texture_size);
-void trace_writer_render_context(struct trace_writer *writer,
-                                 struct ta_context *ctx);
+int trace_writer_insert_texture(struct trace_writer *writer, union tsp tsp,
+                                union tcw tcw, unsigned frame,
+                                const uint8_t *palette, int palette_size,
+                                const uint8_t *texture, int texture_size);
+int trace_writer_render_context(struct trace_writer *writer,
+                                struct ta_context *ctx);
+void trace_writer_stats(struct trace_writer *writer, struct trace_stats *stats);
 void trace_writer_close(struct trace_writer *writer);
 
 #endif
@@ -0,0 +1,41 @@
+#ifndef WAV_H
+#define WAV_H
+
+#include <stdint.h>
+#include <string.h>
+
+/* canonical 44-byte header for 16-bit pcm wav files */
+struct wav_header {
+  char riff[4];
+  uint32_t riff_size;
+  char wave[4];
+  char fmt[4];
+  uint32_t fmt_size;
+  uint16_t format;
+  uint16_t channels;
+  uint32_t sample_rate;
+  uint32_t byte_rate;
+  uint16_t block_align;
+  uint16_t bits_per_sample;
+  char data[4];
+  uint32_t data_size;
+};
+
+static inline void wav_init_header(struct wav_header *header, int channels,
+                                   int sample_rate, int data_size) {
+  memcpy(header->riff, "RIFF", 4);
+  header->riff_size = sizeof(*header) - 8 + data_size;
+  memcpy(header->wave, "WAVE", 4);
+  memcpy(header->fmt, "fmt ", 4);
+  header->fmt_size = 16;
+  header->format = 1; /* pcm */
+  header->channels = channels;
+  header->sample_rate = sample_rate;
+  header->byte_rate = sample_rate * channels * 2;
+  header->block_align = channels * 2;
+  header->bits_per_sample = 16;
+  memcpy(header->data, "data", 4);
+  header->data_size = data_size;
+}
+
+#endif
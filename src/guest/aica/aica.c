@@ -1,11 +1,15 @@
 #include "guest/aica/aica.h"
 #include "core/core.h"
 #include "core/filesystem.h"
+#include "file/async_writer.h"
+#include "file/wav.h"
+#include "guest/aica/aica_dsp.h"
 #include "guest/aica/aica_types.h"
 #include "guest/arm7/arm7.h"
 #include "guest/dreamcast.h"
 #include "guest/holly/holly.h"
 #include "guest/memory.h"
+#include "guest/savestate.h"
 #include "guest/scheduler.h"
 #include "guest/sh4/sh4.h"
 #include "imgui.h"
@@ -18,9 +22,25 @@
 #endif
 
 #define AICA_NUM_CHANNELS 64
-#define AICA_BATCH_SIZE 10
+
+/* samples are generated in batches, each raising a single sample interrupt.
+   batches are kept small while the guest is observing channel progress, either
+   by polling the CA / LP registers or through sample interrupts, and grow
+   otherwise to cut down on scheduler overhead. polling keeps them small until
+   AICA_POLL_BATCHES batches pass without any position reads */
+#define AICA_MIN_BATCH_SIZE 10
+#define AICA_MAX_BATCH_SIZE 100
+#define AICA_POLL_BATCHES 64
 #define AICA_TIMER_PERIOD 0xff
 
+/* effect output levels and pans, one per EFREG followed by one per EXTS */
+#define AICA_EFSDL_BEGIN 0x2000
+#define AICA_MPRO_BEGIN 0x3400
+#define AICA_MPRO_END 0x3c00
+
+/* buffer a few seconds of audio for the recording's writer thread */
+#define AICA_RECORDING_BUFFER_SIZE (AICA_SAMPLE_FREQ * 4 * 4)
+
 /* register access is performed with either 1 or 4 byte memory accesses. the
    physical registers however are only 2 bytes wide, with each one packing
    multiple values inside of it. align the offset to a 4 byte address and
@@ -38,6 +58,9 @@
 #define ADPCM_QUANT_MIN 0x7f
 #define ADPCM_QUANT_MAX 0x6000
 
+/* number of adpcm samples decoded ahead of the current phase at a time */
+#define ADPCM_BLOCK_SIZE 64
+
 /* work with samples as 64-bit ints to avoid dealing with overflow issues
    during intermediate steps */
 typedef int64_t sample_t;
@@ -73,6 +96,20 @@ struct aica_channel {
   sample_t next_sample, next_quant;
   sample_t loop_sample, loop_quant;
 
+  /* adpcm samples predecoded from adpcm_phase onwards, along with a copy of
+     the source data they were decoded from. aram may be written by the arm7
+     directly through fastmem, so the copy is compared against as each sample
+     is consumed rather than relying on writes to invalidate the block */
+  uint32_t adpcm_phase;
+  int adpcm_num;
+  int16_t adpcm_samples[ADPCM_BLOCK_SIZE];
+  int16_t adpcm_quants[ADPCM_BLOCK_SIZE];
+  uint8_t adpcm_data[ADPCM_BLOCK_SIZE / 2 + 1];
+
+  /* output gains with 15 bits of fraction, cached from TL, DISDL, DIPAN and
+     IMXL whenever they're written */
+  int32_t gain_l, gain_r, gain_send;
+
   /* signals the the current channel has looped */
   int looped;
 
@@ -103,16 +140,25 @@ struct aica {
      go through the g2 bus's fifo buffer */
   struct aica_channel channels[AICA_NUM_CHANNELS];
   struct common_data *common_data;
+
+  /* effects dsp, fed by each channel's ISEL / IMXL send */
+  struct aica_dsp *dsp;
+
+  /* bitmask of keyed on channels, only these are stepped when mixing */
+  uint64_t active_channels;
   struct timer *sample_timer;
+  int batch_size;
+  int poll_batches;
 
   /* debugging */
-  FILE *recording;
+  struct async_writer *recording;
   int stream_stats;
 };
 
 /* approximated lookup tables for MVOL / TL scaling */
 static sample_t mvol_scale[16];
 static sample_t tl_scale[256];
+static sample_t pan_scale[16];
 
 static char *aica_fmt_names[] = {
     "PCMS16",       /* AICA_FMT_PCMS16 */
@@ -184,6 +230,45 @@ static void aica_init_tables() {
     /* a 32-bit int is used for the scale, leaving 15 bits for the fraction */
     tl_scale[i] = (sample_t)((1 << 15) / pow(2.0f, i / 16.0f));
   }
+
+  /* the lower 4 bits of each DIPAN / EFPAN register attenuate one side of the
+     output based on the table:
+
+     DIPAN       ∆level
+     --------------
+     bit 0      -3 db
+     bit 1      -6 db
+     bit 2      -12 db
+     bit 3      -24 db
+
+     with 0xf muting the side entirely. this can be approximated as:
+     out = in / pow(2, DIPAN / 2) */
+
+  for (int i = 0; i < 15; i++) {
+    pan_scale[i] = (sample_t)((1 << 15) / pow(2.0f, i / 2.0f));
+  }
+}
+
+static void aica_pan_gains(sample_t level, int pan, int32_t *l, int32_t *r) {
+  /* bit 4 selects the side being attenuated, right when set */
+  sample_t attenuated = (level * pan_scale[pan & 0xf]) >> 15;
+
+  if (pan & 0x10) {
+    *l = (int32_t)level;
+    *r = (int32_t)attenuated;
+  } else {
+    *l = (int32_t)attenuated;
+    *r = (int32_t)level;
+  }
+}
+
+static void aica_channel_update_gains(struct aica_channel *ch) {
+  /* DISDL and IMXL use the same 3db steps as MVOL */
+  sample_t tl = tl_scale[ch->data->TL];
+  sample_t direct = (tl * mvol_scale[ch->data->DISDL]) >> 15;
+
+  aica_pan_gains(direct, ch->data->DIPAN, &ch->gain_l, &ch->gain_r);
+  ch->gain_send = (int32_t)((tl * mvol_scale[ch->data->IMXL]) >> 15);
 }
 
 static inline sample_t aica_adjust_master_volume(struct aica *aica,
@@ -193,13 +278,6 @@ static inline sample_t aica_adjust_master_volume(struct aica *aica,
   return (in * y) >> 15;
 }
 
-static inline sample_t aica_adjust_channel_volume(struct aica_channel *ch,
-                                                  sample_t in) {
-  sample_t y = tl_scale[ch->data->TL];
-  /* truncate fraction */
-  return (in * y) >> 15;
-}
-
 static void aica_decode_adpcm(uint8_t data, sample_t prev, sample_t prev_quant,
                               sample_t *next, sample_t *next_quant) {
   /* the decoded value (n) = (1 - 2 * l4) * (l3 + l2/2 + l1/4 + 1/8) * quantized
@@ -223,9 +301,10 @@ static void aica_decode_adpcm(uint8_t data, sample_t prev, sample_t prev_quant,
 
   int l4 = data >> 3;
   int l321 = data & 0x7;
-  int sign = 1 - 2 * l4;
 
-  *next = sign * ((adpcm_scale[l321] * prev_quant) >> 3) + prev;
+  /* negate the difference without a branch when l4 is set */
+  sample_t diff = (adpcm_scale[l321] * prev_quant) >> 3;
+  *next = ((diff ^ -l4) + l4) + prev;
   *next = CLAMP(*next, INT16_MIN, INT16_MAX);
 
   /* the quantized width (n+1) = f(l3, l2, l1) * quantized width (n).
@@ -250,6 +329,53 @@ static void aica_decode_adpcm(uint8_t data, sample_t prev, sample_t prev_quant,
   *next_quant = CLAMP(*next_quant, ADPCM_QUANT_MIN, ADPCM_QUANT_MAX);
 }
 
+static void aica_predecode_adpcm(struct aica_channel *ch) {
+  uint32_t end = ch->data->LEA;
+  int num = ADPCM_BLOCK_SIZE;
+
+  /* don't decode past the loop end, the decoding state is reset there */
+  if (end > ch->phase && end - ch->phase < (uint32_t)num) {
+    num = (int)(end - ch->phase);
+  }
+
+  const uint8_t *src = &ch->base[ch->phase >> 1];
+  int src_size = (((ch->phase + num - 1) >> 1) - (ch->phase >> 1)) + 1;
+  memcpy(ch->adpcm_data, src, src_size);
+
+  sample_t prev = ch->prev_sample;
+  sample_t prev_quant = ch->prev_quant;
+
+  for (int i = 0; i < num; i++) {
+    uint32_t phase = ch->phase + i;
+    int shift = (phase & 1) << 2;
+    uint8_t data = (ch->base[phase >> 1] >> shift) & 0xf;
+    sample_t next, next_quant;
+    aica_decode_adpcm(data, prev, prev_quant, &next, &next_quant);
+    ch->adpcm_samples[i] = (int16_t)next;
+    ch->adpcm_quants[i] = (int16_t)next_quant;
+    prev = next;
+    prev_quant = next_quant;
+  }
+
+  ch->adpcm_phase = ch->phase;
+  ch->adpcm_num = num;
+}
+
+void aica_decode_adpcm_stream(const uint8_t *data, int num, int16_t *out) {
+  sample_t prev = 0;
+  sample_t prev_quant = ADPCM_QUANT_MIN;
+
+  for (int i = 0; i < num; i++) {
+    int shift = (i & 1) << 2;
+    uint8_t nibble = (data[i >> 1] >> shift) & 0xf;
+    sample_t next, next_quant;
+    aica_decode_adpcm(nibble, prev, prev_quant, &next, &next_quant);
+    out[i] = (int16_t)next;
+    prev = next;
+    prev_quant = next_quant;
+  }
+}
+
 static void aica_raise_interrupt(struct aica *aica, int intr) {
   aica->common_data->MCIPD |= (1 << intr);
   aica->common_data->SCIPD |= (1 << intr);
@@ -427,7 +553,12 @@ static void aica_rtc_timer(void *data) {
   struct aica *aica = data;
   struct scheduler *sched = aica->dc->sched;
   aica->rtc++;
-  aica->rtc_timer = sched_start_timer(sched, &aica_rtc_timer, aica, NS_PER_SEC);
+
+  /* the expired timer is still valid inside its callback. it may have fired
+     late, don't let the clock drift */
+  int64_t late = -sched_remaining_time(sched, aica->rtc_timer);
+  aica->rtc_timer =
+      sched_start_lazy_timer(sched, &aica_rtc_timer, aica, NS_PER_SEC - late);
 }
 
 static float aica_channel_hz(struct aica_channel *ch) {
@@ -472,6 +603,7 @@ static void aica_channel_key_off(struct aica *aica, struct aica_channel *ch) {
   }
 
   ch->active = 0;
+  aica->active_channels &= ~((uint64_t)1 << ch->id);
 
   /* this will already be cleared if the channel is stopped due to a key event.
      however, it will not be set when a non-looping channel is stopped */
@@ -486,6 +618,7 @@ static void aica_channel_key_on(struct aica *aica, struct aica_channel *ch) {
   }
 
   ch->active = 1;
+  aica->active_channels |= (uint64_t)1 << ch->id;
   ch->base = aica_channel_base(aica, ch);
   ch->phase = 0;
   ch->phasefrc = 0;
@@ -497,6 +630,7 @@ static void aica_channel_key_on(struct aica *aica, struct aica_channel *ch) {
   ch->next_quant = ADPCM_QUANT_MIN;
   ch->loop_sample = 0;
   ch->loop_quant = ADPCM_QUANT_MIN;
+  ch->adpcm_num = 0;
 
   LOG_AICA("aica_channel_key_on [%d] %s, %s, %.2f hz, %.2f sec", ch->id,
            aica_fmt_names[ch->data->PCMS], aica_loop_names[ch->data->LPCTL],
@@ -542,10 +676,17 @@ static void aica_channel_step_one(struct aica *aica, struct aica_channel *ch) {
 
       case AICA_FMT_ADPCM:
       case AICA_FMT_ADPCM_STREAM: {
-        int shift = (ch->phase & 1) << 2;
-        uint8_t data = (ch->base[ch->phase >> 1] >> shift) & 0xf;
-        aica_decode_adpcm(data, ch->prev_sample, ch->prev_quant,
-                          &ch->next_sample, &ch->next_quant);
+        /* the block is only valid when stepped through sequentially, and
+           while the source data it was decoded from is unchanged */
+        uint32_t i = ch->phase - ch->adpcm_phase;
+        if (i >= (uint32_t)ch->adpcm_num ||
+            ch->base[ch->phase >> 1] !=
+                ch->adpcm_data[(ch->phase >> 1) - (ch->adpcm_phase >> 1)]) {
+          aica_predecode_adpcm(ch);
+          i = 0;
+        }
+        ch->next_sample = ch->adpcm_samples[i];
+        ch->next_quant = ch->adpcm_quants[i];
       } break;
 
       default:
@@ -580,6 +721,7 @@ static void aica_channel_step_one(struct aica *aica, struct aica_channel *ch) {
       case AICA_LOOP_FORWARD: {
         /* restart channel */
         ch->phase = ch->data->LSA;
+        ch->adpcm_num = 0;
 
         /* in ADPCM streaming mode, the loop is a ring buffer. don't reset the
            decoding state in this case
@@ -618,36 +760,204 @@ static sample_t aica_channel_step(struct aica *aica, struct aica_channel *ch) {
   return result;
 }
 
-static void aica_generate_frames(struct aica *aica) {
+static int aica_channel_generate_pcm(struct aica *aica,
+                                     struct aica_channel *ch, int32_t *out,
+                                     int num_frames) {
+  struct channel_data *data = ch->data;
+
+  if (data->SSCTL ||
+      (data->PCMS != AICA_FMT_PCMS16 && data->PCMS != AICA_FMT_PCMS8)) {
+    return 0;
+  }
+
+  /* the previous and next samples are only different immediately after a
+     loop restores the decoding state, in which case the interpolation is
+     left to aica_channel_step */
+  if (ch->prev_sample != ch->next_sample) {
+    return 0;
+  }
+
+  /* source samples stepped over by the entire batch */
+  uint64_t phasefrc = ch->phasefrc;
+  uint64_t phaseinc = ch->phaseinc;
+  uint64_t end_frc = phasefrc + phaseinc * num_frames;
+  uint32_t num_steps = (uint32_t)(end_frc >> AICA_PHASE_FRAC_BITS);
+  uint32_t phase = ch->phase;
+  uint32_t end_phase = phase + num_steps;
+
+  /* fall back to stepping one sample at a time around the loop boundaries,
+     where aica_channel_step_one saves and restores the loop state */
+  if (end_phase >= data->LEA) {
+    return 0;
+  }
+  if (data->LSA >= phase && data->LSA < end_phase) {
+    return 0;
+  }
+
+  CHECK_NOTNULL(ch->base);
+
+  /* with the previous and next samples equal, the interpolation in
+     aica_channel_step reduces to the last sample stepped over. compute the
+     number of samples stepped over before each frame up front, and then
+     gather the samples in a separate pass */
+  int32_t steps[AICA_MAX_BATCH_SIZE];
+  int32_t prev = (int32_t)ch->prev_sample;
+
+  for (int frame = 0; frame < num_frames; frame++) {
+    steps[frame] =
+        (int32_t)((phasefrc + phaseinc * frame) >> AICA_PHASE_FRAC_BITS);
+  }
+
+  if (data->PCMS == AICA_FMT_PCMS16) {
+    const int16_t *src = (const int16_t *)ch->base + phase - 1;
+
+    for (int frame = 0; frame < num_frames; frame++) {
+      out[frame] = steps[frame] ? src[steps[frame]] : prev;
+    }
+
+    if (num_steps) {
+      prev = src[num_steps];
+    }
+  } else {
+    const int8_t *src = (const int8_t *)ch->base + phase - 1;
+
+    for (int frame = 0; frame < num_frames; frame++) {
+      out[frame] = steps[frame] ? src[steps[frame]] << 8 : prev;
+    }
+
+    if (num_steps) {
+      prev = src[num_steps] << 8;
+    }
+  }
+
+  ch->phase = end_phase;
+  ch->phasefrc = (uint32_t)(end_frc & (AICA_PHASE_BASE - 1));
+  ch->prev_sample = prev;
+  ch->next_sample = prev;
+
+  return 1;
+}
+
+static void aica_channel_generate(struct aica *aica, struct aica_channel *ch,
+                                  int32_t *out, int num_frames) {
+  /* pcm channels not crossing a loop boundary this batch take a fast path */
+  if (aica_channel_generate_pcm(aica, ch, out, num_frames)) {
+    return;
+  }
+
+  for (int frame = 0; frame < num_frames; frame++) {
+    out[frame] = (int32_t)aica_channel_step(aica, ch);
+  }
+}
+
+static void aica_generate_frames(struct aica *aica, int num_frames) {
   struct dreamcast *dc = aica->dc;
-  int16_t buffer[AICA_BATCH_SIZE * 2];
+  int16_t buffer[AICA_MAX_BATCH_SIZE * 2];
 
-  for (int frame = 0; frame < AICA_BATCH_SIZE; frame++) {
-    sample_t l = 0;
-    sample_t r = 0;
+  /* channel volume adjusted samples are 16-bit, so the sum of all 64 channels
+     comfortably fits in 32-bits */
+  int32_t mix_l[AICA_MAX_BATCH_SIZE] = {0};
+  int32_t mix_r[AICA_MAX_BATCH_SIZE] = {0};
+  int32_t scratch[AICA_MAX_BATCH_SIZE];
+  int32_t mixs[AICA_DSP_NUM_MIXS][AICA_MAX_BATCH_SIZE];
+  int dsp_enabled = aica_dsp_enabled(aica->dsp);
 
-    for (int i = 0; i < AICA_NUM_CHANNELS; i++) {
-      struct aica_channel *ch = &aica->channels[i];
-      sample_t s = aica_channel_step(aica, ch);
-      l += aica_adjust_channel_volume(ch, s);
-      r += aica_adjust_channel_volume(ch, s);
+  PROF_ENTER("aica_generate_frames");
+
+  if (dsp_enabled) {
+    memset(mixs, 0, sizeof(mixs));
+  }
+
+  /* generate the entire batch for one active channel at a time, rather than
+     stepping every channel for each frame. channels don't affect each other
+     while stepping, so this is equivalent, and the mix is a simple loop the
+     compiler vectorizes */
+  uint64_t active = aica->active_channels;
+
+  while (active) {
+    int i = ctz64(active);
+    active &= active - 1;
+
+    struct aica_channel *ch = &aica->channels[i];
+    aica_channel_generate(aica, ch, scratch, num_frames);
+
+    /* apply the channel's cached gains, each a single multiply */
+    int32_t gain_l = ch->gain_l;
+    int32_t gain_r = ch->gain_r;
+
+    for (int frame = 0; frame < num_frames; frame++) {
+      mix_l[frame] += (scratch[frame] * gain_l) >> 15;
+      mix_r[frame] += (scratch[frame] * gain_r) >> 15;
+    }
+
+    /* send to the dsp */
+    int32_t gain_send = ch->gain_send;
+    if (dsp_enabled && gain_send) {
+      int32_t *send = mixs[ch->data->ISEL];
+
+      for (int frame = 0; frame < num_frames; frame++) {
+        send[frame] += (scratch[frame] * gain_send) >> 15;
+      }
+    }
+  }
+
+  if (dsp_enabled) {
+    /* effect outputs are mixed back in at their EFSDL level and EFPAN pan */
+    int32_t ef_l[AICA_DSP_NUM_EFREG];
+    int32_t ef_r[AICA_DSP_NUM_EFREG];
+
+    for (int j = 0; j < AICA_DSP_NUM_EFREG; j++) {
+      uint8_t *efreg = &aica->reg[AICA_EFSDL_BEGIN + j * 4];
+      aica_pan_gains(mvol_scale[efreg[1] & 0xf], efreg[0] & 0x1f, &ef_l[j],
+                     &ef_r[j]);
     }
 
-    l = aica_adjust_master_volume(aica, l);
-    r = aica_adjust_master_volume(aica, r);
+    for (int frame = 0; frame < num_frames; frame++) {
+      int32_t in[AICA_DSP_NUM_MIXS];
+      int32_t efreg[AICA_DSP_NUM_EFREG];
+
+      for (int j = 0; j < AICA_DSP_NUM_MIXS; j++) {
+        in[j] = mixs[j][frame];
+      }
+
+      aica_dsp_step(aica->dsp, in, efreg);
 
-    buffer[frame * 2 + 0] = (int16_t)CLAMP(l, INT16_MIN, INT16_MAX);
-    buffer[frame * 2 + 1] = (int16_t)CLAMP(r, INT16_MIN, INT16_MAX);
+      for (int j = 0; j < AICA_DSP_NUM_EFREG; j++) {
+        mix_l[frame] += (efreg[j] * ef_l[j]) >> 15;
+        mix_r[frame] += (efreg[j] * ef_r[j]) >> 15;
+      }
+    }
+  }
+
+  /* write the final frames straight into the host's audio buffer when it
+     has room, else into a local buffer which is pushed by copy */
+  int16_t *out = dc_reserve_audio(dc, num_frames);
+  if (!out) {
+    out = buffer;
   }
 
-  dc_push_audio(dc, buffer, AICA_BATCH_SIZE);
+  for (int frame = 0; frame < num_frames; frame++) {
+    sample_t l = aica_adjust_master_volume(aica, mix_l[frame]);
+    sample_t r = aica_adjust_master_volume(aica, mix_r[frame]);
+
+    out[frame * 2 + 0] = (int16_t)CLAMP(l, INT16_MIN, INT16_MAX);
+    out[frame * 2 + 1] = (int16_t)CLAMP(r, INT16_MIN, INT16_MAX);
+  }
 
-  /* save raw audio out while recording */
+  /* queue audio for the recording's writer thread */
   if (aica->recording) {
-    fwrite(buffer, 4, AICA_BATCH_SIZE, aica->recording);
+    async_writer_write(aica->recording, out, num_frames * 4);
   }
 
-  prof_counter_add(COUNTER_aica_samples, AICA_BATCH_SIZE);
+  if (out == buffer) {
+    dc_push_audio(dc, buffer, num_frames);
+  } else {
+    dc_commit_audio(dc, num_frames);
+  }
+
+  prof_counter_add(COUNTER_aica_samples, num_frames);
+
+  PROF_LEAVE();
 }
 
 static uint32_t aica_channel_reg_read(struct aica *aica, uint32_t addr,
@@ -678,6 +988,7 @@ static void aica_channel_reg_write(struct aica *aica, uint32_t addr,
     case 0x0: { /* SA_hi, KYONB, KYONEX */
       if (lo) {
         ch->base = aica_channel_base(aica, ch);
+        ch->adpcm_num = 0;
       }
       if (hi) {
         aica_channel_key_on_execute(aica, ch);
@@ -686,11 +997,18 @@ static void aica_channel_reg_write(struct aica *aica, uint32_t addr,
 
     case 0x4: { /* SA_lo */
       ch->base = aica_channel_base(aica, ch);
+      ch->adpcm_num = 0;
     } break;
 
     case 0x18: { /* FNS, OCT */
       ch->phaseinc = aica_channel_phaseinc(ch);
     } break;
+
+    case 0x20:   /* ISEL, IMXL */
+    case 0x24:   /* DIPAN, DISDL */
+    case 0x28: { /* Q, TL */
+      aica_channel_update_gains(ch);
+    } break;
   }
 }
 
@@ -718,12 +1036,14 @@ static uint32_t aica_common_reg_read(struct aica *aica, uint32_t addr,
       if (hi) {
         aica->common_data->LP = ch->looped;
         ch->looped = 0;
+        aica->poll_batches = AICA_POLL_BATCHES;
       }
     } break;
 
     case 0x14: { /* CA */
       struct aica_channel *ch = &aica->channels[aica->common_data->MSLC];
       aica->common_data->CA = ch->phase;
+      aica->poll_batches = AICA_POLL_BATCHES;
     } break;
 
     case 0x90: { /* TIMA, TACTL */
@@ -835,37 +1155,160 @@ static void aica_common_reg_write(struct aica *aica, uint32_t addr,
   }
 }
 
+static int aica_batch_size(struct aica *aica) {
+  uint32_t sample_intr = 1 << AICA_INT_SAMPLE;
+
+  if (aica->poll_batches) {
+    aica->poll_batches--;
+    return AICA_MIN_BATCH_SIZE;
+  }
+
+  if ((aica->common_data->SCIEB | aica->common_data->MCIEB) & sample_intr) {
+    return AICA_MIN_BATCH_SIZE;
+  }
+
+  return AICA_MAX_BATCH_SIZE;
+}
+
+static void aica_next_sample(void *data);
+
+static void aica_schedule_batch(struct aica *aica, int num_frames) {
+  struct scheduler *sched = aica->dc->sched;
+
+  aica->batch_size = num_frames;
+  aica->sample_timer =
+      sched_start_timer(sched, &aica_next_sample, aica,
+                        CYCLES_TO_NANO(num_frames, AICA_SAMPLE_FREQ));
+}
+
 static void aica_next_sample(void *data) {
   struct aica *aica = data;
-  struct scheduler *sched = aica->dc->sched;
 
-  aica_generate_frames(aica);
+  aica_generate_frames(aica, aica->batch_size);
   aica_raise_interrupt(aica, AICA_INT_SAMPLE);
   aica_update_arm(aica);
   aica_update_sh(aica);
 
   /* reschedule */
-  aica->sample_timer =
-      sched_start_timer(sched, &aica_next_sample, aica,
-                        HZ_TO_NANO(AICA_SAMPLE_FREQ / AICA_BATCH_SIZE));
+  aica_schedule_batch(aica, aica_batch_size(aica));
 }
 
-static void aica_toggle_recording(struct aica *aica) {
+static void aica_stop_recording(struct aica *aica) {
   if (!aica->recording) {
-    char filename[PATH_MAX];
-    snprintf(filename, sizeof(filename), "%s" PATH_SEPARATOR "aica.pcm",
-             fs_appdir());
+    return;
+  }
+
+  /* now that the final size is known, rewrite the header */
+  struct wav_header header;
+  int data_size = (int)(async_writer_size(aica->recording) - sizeof(header));
+  wav_init_header(&header, 2, AICA_SAMPLE_FREQ, data_size);
+
+  async_writer_close(aica->recording, &header, sizeof(header));
+  aica->recording = NULL;
+
+  LOG_INFO("stopped recording audio");
+}
+
+static void aica_start_recording(struct aica *aica) {
+  if (aica->recording) {
+    return;
+  }
 
-    aica->recording = fopen(filename, "w");
-    CHECK_NOTNULL(aica->recording, "Failed to open %s", filename);
+  char filename[PATH_MAX];
+  snprintf(filename, sizeof(filename), "%s" PATH_SEPARATOR "aica.wav",
+           fs_appdir());
 
-    LOG_INFO("started recording audio to %s", filename);
+  aica->recording =
+      async_writer_open(filename, AICA_RECORDING_BUFFER_SIZE, 0);
+  CHECK_NOTNULL(aica->recording, "Failed to open %s", filename);
+
+  /* write a placeholder header, it's rewritten once recording stops */
+  struct wav_header header;
+  wav_init_header(&header, 2, AICA_SAMPLE_FREQ, 0);
+  async_writer_write(aica->recording, &header, sizeof(header));
+
+  LOG_INFO("started recording audio to %s", filename);
+}
+
+static void aica_toggle_recording(struct aica *aica) {
+  if (!aica->recording) {
+    aica_start_recording(aica);
   } else {
-    fclose(aica->recording);
-    aica->recording = NULL;
+    aica_stop_recording(aica);
+  }
+}
+
+static void aica_save(struct device *dev, struct savestate *ss) {
+  struct aica *aica = (struct aica *)dev;
+  struct scheduler *sched = aica->dc->sched;
+
+  SS_WRITE(ss, aica->reg);
+  SS_WRITE(ss, aica->arm_resetting);
 
-    LOG_INFO("stopped recording audio");
+  for (int i = 0; i < 3; i++) {
+    ss_write_timer(ss, sched, aica->timers[i]);
   }
+
+  ss_write_timer(ss, sched, aica->rtc_timer);
+  SS_WRITE(ss, aica->rtc_write);
+  SS_WRITE(ss, aica->rtc);
+
+  /* channels point into the registers and aram, their pointers are fixed up
+     when loaded */
+  for (int i = 0; i < AICA_NUM_CHANNELS; i++) {
+    struct aica_channel ch = aica->channels[i];
+    uint32_t base = ch.base ? (uint32_t)(ch.base - aica->aram) : 0;
+    ch.data = NULL;
+    ch.base = NULL;
+    SS_WRITE(ss, ch);
+    SS_WRITE(ss, base);
+  }
+
+  SS_WRITE(ss, aica->active_channels);
+  ss_write_timer(ss, sched, aica->sample_timer);
+  SS_WRITE(ss, aica->batch_size);
+  SS_WRITE(ss, aica->poll_batches);
+
+  aica_dsp_save(aica->dsp, ss);
+}
+
+static void aica_load(struct device *dev, struct savestate *ss) {
+  struct aica *aica = (struct aica *)dev;
+  struct scheduler *sched = aica->dc->sched;
+  static timer_cb timer_cbs[3] = {&aica_timer_expire_0, &aica_timer_expire_1,
+                                  &aica_timer_expire_2};
+
+  SS_READ(ss, aica->reg);
+  SS_READ(ss, aica->arm_resetting);
+
+  for (int i = 0; i < 3; i++) {
+    aica->timers[i] =
+        ss_read_timer(ss, sched, aica->timers[i], timer_cbs[i], aica, 0);
+  }
+
+  aica->rtc_timer =
+      ss_read_timer(ss, sched, aica->rtc_timer, &aica_rtc_timer, aica, 1);
+  SS_READ(ss, aica->rtc_write);
+  SS_READ(ss, aica->rtc);
+
+  for (int i = 0; i < AICA_NUM_CHANNELS; i++) {
+    struct aica_channel *ch = &aica->channels[i];
+    struct channel_data *data = ch->data;
+    uint32_t base;
+    SS_READ(ss, *ch);
+    SS_READ(ss, base);
+    ch->data = data;
+    ch->base = &aica->aram[base & (ARM7_AICA_MEM_END - ARM7_AICA_MEM_BEGIN)];
+    ch->id = i;
+  }
+
+  SS_READ(ss, aica->active_channels);
+  aica->sample_timer = ss_read_timer(ss, sched, aica->sample_timer,
+                                     &aica_next_sample, aica, 0);
+  SS_READ(ss, aica->batch_size);
+  SS_READ(ss, aica->poll_batches);
+
+  aica_dsp_load(aica->dsp, ss);
 }
 
 static int aica_init(struct device *dev) {
@@ -874,6 +1317,7 @@ static int aica_init(struct device *dev) {
   struct scheduler *sched = aica->dc->sched;
 
   aica->aram = mem_aram(mem, 0x0);
+  aica->dsp = aica_dsp_create(aica->reg, aica->aram);
 
   /* init channels */
   {
@@ -881,11 +1325,10 @@ static int aica_init(struct device *dev) {
       struct aica_channel *ch = &aica->channels[i];
       ch->data =
           (struct channel_data *)(aica->reg + sizeof(struct channel_data) * i);
+      aica_channel_update_gains(ch);
     }
     aica->common_data = (struct common_data *)(aica->reg + 0x2800);
-    aica->sample_timer =
-        sched_start_timer(sched, &aica_next_sample, aica,
-                          HZ_TO_NANO(AICA_SAMPLE_FREQ / AICA_BATCH_SIZE));
+    aica_schedule_batch(aica, AICA_MIN_BATCH_SIZE);
   }
 
   /* init timers */
@@ -899,7 +1342,7 @@ static int aica_init(struct device *dev) {
   {
     /* increment clock every second */
     aica->rtc_timer =
-        sched_start_timer(sched, &aica_rtc_timer, aica, NS_PER_SEC);
+        sched_start_lazy_timer(sched, &aica_rtc_timer, aica, NS_PER_SEC);
   }
 
   return 1;
@@ -919,6 +1362,10 @@ void aica_reg_write(struct aica *aica, uint32_t addr, uint32_t data,
   }
 
   WRITE_DATA(&aica->reg[addr]);
+
+  if (addr >= AICA_MPRO_BEGIN && addr < AICA_MPRO_END) {
+    aica_dsp_invalidate(aica->dsp);
+  }
 }
 
 uint32_t aica_reg_read(struct aica *aica, uint32_t addr, uint32_t mask) {
@@ -945,6 +1392,10 @@ void aica_set_clock(struct aica *aica, uint32_t time) {
   aica->rtc = time;
 }
 
+uint32_t aica_get_clock(struct aica *aica) {
+  return aica->rtc;
+}
+
 #ifdef HAVE_IMGUI
 
 #define CHANNEL_COLUMN(...)                       \
@@ -1024,6 +1475,15 @@ void aica_destroy(struct aica *aica) {
     }
   }
 
+  aica_stop_recording(aica);
+
+  /* shutdown dsp */
+  {
+    if (aica->dsp) {
+      aica_dsp_destroy(aica->dsp);
+    }
+  }
+
   dc_destroy_device((struct device *)aica);
 }
 
@@ -1039,5 +1499,10 @@ struct aica *aica_create(struct dreamcast *dc) {
     ch->id = i;
   }
 
+  /* setup state interface */
+  aica->stateif.enabled = 1;
+  aica->stateif.save = &aica_save;
+  aica->stateif.load = &aica_load;
+
   return aica;
 }
@@ -14,6 +14,7 @@ void aica_destroy(struct aica *aica);
 void aica_debug_menu(struct aica *aica);
 
 void aica_set_clock(struct aica *aica, uint32_t time);
+uint32_t aica_get_clock(struct aica *aica);
 
 uint32_t aica_mem_read(struct aica *aica, uint32_t addr, uint32_t mask);
 void aica_mem_write(struct aica *aica, uint32_t addr, uint32_t data,
@@ -23,4 +24,8 @@ uint32_t aica_reg_read(struct aica *aica, uint32_t addr, uint32_t mask);
 void aica_reg_write(struct aica *aica, uint32_t addr, uint32_t data,
                     uint32_t mask);
 
+/* decode num 4-bit adpcm samples, starting from the state a channel is keyed
+   on with */
+void aica_decode_adpcm_stream(const uint8_t *data, int num, int16_t *out);
+
 #endif
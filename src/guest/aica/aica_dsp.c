@@ -0,0 +1,347 @@
+/*
+ * aica effects dsp
+ *
+ * the dsp runs a microprogram of up to 128 steps once per output sample,
+ * reading the channels mixed into MIXS and writing effect outputs to EFREG,
+ * using a ring buffer in aram for delay lines
+ *
+ * rather than decoding each 64-bit step from MPRO on every sample, the
+ * program is decoded once into a list of steps whenever MPRO is written to.
+ * trailing steps which are entirely zero have no visible effects and are
+ * dropped, which leaves nothing to run for games that never program the dsp
+ *
+ * the step semantics follow the scsp / aica dsp as documented by mame
+ */
+
+#include "guest/aica/aica_dsp.h"
+#include "core/core.h"
+#include "guest/savestate.h"
+
+#define AICA_DSP_NUM_STEPS 128
+#define AICA_DSP_ARAM_MASK 0x1ffffe
+
+/* offsets of the dsp registers in the aica register space */
+#define AICA_DSP_COEF 0x3000
+#define AICA_DSP_MADRS 0x3200
+#define AICA_DSP_MPRO 0x3400
+#define AICA_DSP_EXTS 0x45c0
+#define AICA_COMMON_RBP 0x2804
+
+#define AICA_DSP_REG(dsp, offset, i) \
+  (*(uint32_t *)&(dsp)->reg[(offset) + (i)*4] & 0xffff)
+
+struct aica_dsp_op {
+  uint8_t tra, twt, twa;
+  uint8_t xsel, ysel, ira, iwt, iwa;
+  uint8_t table, mwt, mrd, ewt, ewa, adrl, frcl, shift, yrl, negb, zero, bsel;
+  uint8_t nofl, masa, adreb, nxadr;
+};
+
+struct aica_dsp {
+  uint8_t *reg;
+  uint8_t *aram;
+
+  /* decoded program, rebuilt when dirty */
+  int dirty;
+  int num_ops;
+  struct aica_dsp_op ops[AICA_DSP_NUM_STEPS];
+
+  /* internal state */
+  int32_t temp[128];
+  int32_t mems[32];
+  uint32_t mdec_ct;
+};
+
+/* aram is written to and read from in a 16-bit floating point format of 1
+   sign bit, 4 exponent bits and 11 mantissa bits */
+static uint16_t aica_dsp_pack(int32_t val) {
+  int sign = (val >> 23) & 0x1;
+  uint32_t temp = (val ^ (val << 1)) & 0xffffff;
+  int exponent = 0;
+
+  for (int k = 0; k < 12; k++) {
+    if (temp & 0x800000) {
+      break;
+    }
+    temp <<= 1;
+    exponent++;
+  }
+
+  if (exponent < 12) {
+    val = (val << exponent) & 0x3fffff;
+  } else {
+    val <<= 11;
+  }
+  val >>= 11;
+  val &= 0x7ff;
+  val |= sign << 15;
+  val |= exponent << 11;
+
+  return (uint16_t)val;
+}
+
+static int32_t aica_dsp_unpack(uint16_t val) {
+  int sign = (val >> 15) & 0x1;
+  int exponent = (val >> 11) & 0xf;
+  int mantissa = val & 0x7ff;
+  int32_t uval = mantissa << 11;
+
+  if (exponent > 11) {
+    exponent = 11;
+    uval |= sign << 22;
+  } else {
+    uval |= (sign ^ 1) << 22;
+  }
+  uval |= sign << 23;
+  uval = (uval << 8) >> 8;
+  uval >>= exponent;
+
+  return uval;
+}
+
+static inline int32_t aica_dsp_sext(int32_t v, int bits) {
+  return (int32_t)((uint32_t)v << (32 - bits)) >> (32 - bits);
+}
+
+static void aica_dsp_compile(struct aica_dsp *dsp) {
+  dsp->num_ops = 0;
+
+  for (int step = 0; step < AICA_DSP_NUM_STEPS; step++) {
+    uint32_t i0 = AICA_DSP_REG(dsp, AICA_DSP_MPRO, step * 4 + 0);
+    uint32_t i1 = AICA_DSP_REG(dsp, AICA_DSP_MPRO, step * 4 + 1);
+    uint32_t i2 = AICA_DSP_REG(dsp, AICA_DSP_MPRO, step * 4 + 2);
+    uint32_t i3 = AICA_DSP_REG(dsp, AICA_DSP_MPRO, step * 4 + 3);
+    struct aica_dsp_op *op = &dsp->ops[step];
+
+    op->tra = (i0 >> 9) & 0x7f;
+    op->twt = (i0 >> 8) & 0x1;
+    op->twa = (i0 >> 1) & 0x7f;
+
+    op->xsel = (i1 >> 15) & 0x1;
+    op->ysel = (i1 >> 13) & 0x3;
+    op->ira = (i1 >> 7) & 0x3f;
+    op->iwt = (i1 >> 6) & 0x1;
+    op->iwa = (i1 >> 1) & 0x1f;
+
+    op->table = (i2 >> 15) & 0x1;
+    op->mwt = (i2 >> 14) & 0x1;
+    op->mrd = (i2 >> 13) & 0x1;
+    op->ewt = (i2 >> 12) & 0x1;
+    op->ewa = (i2 >> 8) & 0xf;
+    op->adrl = (i2 >> 7) & 0x1;
+    op->frcl = (i2 >> 6) & 0x1;
+    op->shift = (i2 >> 4) & 0x3;
+    op->yrl = (i2 >> 3) & 0x1;
+    op->negb = (i2 >> 2) & 0x1;
+    op->zero = (i2 >> 1) & 0x1;
+    op->bsel = i2 & 0x1;
+
+    op->nofl = (i3 >> 15) & 0x1;
+    op->masa = (i3 >> 9) & 0x3f;
+    op->adreb = (i3 >> 8) & 0x1;
+    op->nxadr = (i3 >> 7) & 0x1;
+
+    if (i0 | i1 | i2 | i3) {
+      dsp->num_ops = step + 1;
+    }
+  }
+
+  dsp->dirty = 0;
+}
+
+void aica_dsp_step(struct aica_dsp *dsp, const int32_t *mixs, int32_t *efreg) {
+  uint32_t rbp = (*(uint32_t *)&dsp->reg[AICA_COMMON_RBP] & 0xfff) << 11;
+  uint32_t rbl = (*(uint32_t *)&dsp->reg[AICA_COMMON_RBP] >> 13) & 0x3;
+  uint32_t rb_mask = ((8 * 1024) << rbl) - 1;
+
+  int32_t acc = 0;
+  int32_t shifted = 0;
+  int32_t inputs = 0;
+  int32_t frc_reg = 0;
+  int32_t y_reg = 0;
+  uint32_t adrs_reg = 0;
+  int32_t memval[4] = {0};
+
+  memset(efreg, 0, sizeof(int32_t) * AICA_DSP_NUM_EFREG);
+
+  for (int step = 0; step < dsp->num_ops; step++) {
+    const struct aica_dsp_op *op = &dsp->ops[step];
+    int32_t x, y, b;
+
+    /* input read / write */
+    if (op->ira <= 0x1f) {
+      inputs = dsp->mems[op->ira];
+    } else if (op->ira <= 0x2f) {
+      /* MIXS is 20-bit */
+      inputs = mixs[op->ira - 0x20] << 4;
+    } else if (op->ira <= 0x31) {
+      /* EXTS is 16-bit */
+      inputs = (int16_t)AICA_DSP_REG(dsp, AICA_DSP_EXTS, op->ira - 0x30) << 8;
+    } else {
+      inputs = 0;
+    }
+    inputs = aica_dsp_sext(inputs, 24);
+
+    if (op->iwt) {
+      dsp->mems[op->iwa] = memval[step & 3];
+    }
+
+    /* operand selection */
+    if (op->zero) {
+      b = 0;
+    } else {
+      if (op->bsel) {
+        b = acc;
+      } else {
+        b = aica_dsp_sext(dsp->temp[(op->tra + dsp->mdec_ct) & 0x7f], 24);
+      }
+      if (op->negb) {
+        b = -b;
+      }
+    }
+
+    if (op->xsel) {
+      x = inputs;
+    } else {
+      x = aica_dsp_sext(dsp->temp[(op->tra + dsp->mdec_ct) & 0x7f], 24);
+    }
+
+    switch (op->ysel) {
+      case 0:
+        y = frc_reg;
+        break;
+      case 1:
+        /* COEF is 13-bit, stored in the upper bits of the register */
+        y = (int16_t)AICA_DSP_REG(dsp, AICA_DSP_COEF, step) >> 3;
+        break;
+      case 2:
+        y = (y_reg >> 11) & 0x1fff;
+        break;
+      default:
+        y = (y_reg >> 4) & 0xfff;
+        break;
+    }
+    y = aica_dsp_sext(y, 13);
+
+    if (op->yrl) {
+      y_reg = inputs;
+    }
+
+    /* the shifter sees the accumulator from the previous step */
+    switch (op->shift) {
+      case 0:
+        shifted = CLAMP(acc, -0x800000, 0x7fffff);
+        break;
+      case 1:
+        shifted = CLAMP(acc * 2, -0x800000, 0x7fffff);
+        break;
+      case 2:
+        shifted = aica_dsp_sext(acc * 2, 24);
+        break;
+      default:
+        shifted = aica_dsp_sext(acc, 24);
+        break;
+    }
+
+    acc = (int32_t)(((int64_t)x * y) >> 12) + b;
+    acc = aica_dsp_sext(acc, 26);
+
+    if (op->twt) {
+      dsp->temp[(op->twa + dsp->mdec_ct) & 0x7f] = shifted;
+    }
+
+    if (op->frcl) {
+      if (op->shift == 3) {
+        frc_reg = shifted & 0xfff;
+      } else {
+        frc_reg = (shifted >> 11) & 0x1fff;
+      }
+    }
+
+    /* memory is only accessed on odd steps */
+    if ((step & 1) && (op->mrd || op->mwt)) {
+      uint32_t addr = AICA_DSP_REG(dsp, AICA_DSP_MADRS, op->masa);
+      if (!op->table) {
+        addr += dsp->mdec_ct;
+      }
+      if (op->adreb) {
+        addr += adrs_reg & 0xfff;
+      }
+      if (op->nxadr) {
+        addr++;
+      }
+      addr &= op->table ? 0xffff : rb_mask;
+      addr = ((addr << 1) + rbp) & AICA_DSP_ARAM_MASK;
+
+      if (op->mrd) {
+        uint16_t data = *(uint16_t *)&dsp->aram[addr];
+        memval[(step + 2) & 3] =
+            op->nofl ? (int16_t)data << 8 : aica_dsp_unpack(data);
+      }
+
+      if (op->mwt) {
+        *(uint16_t *)&dsp->aram[addr] =
+            op->nofl ? (uint16_t)(shifted >> 8) : aica_dsp_pack(shifted);
+      }
+    }
+
+    if (op->adrl) {
+      if (op->shift == 3) {
+        adrs_reg = (shifted >> 12) & 0xfff;
+      } else {
+        adrs_reg = inputs >> 16;
+      }
+    }
+
+    if (op->ewt) {
+      efreg[op->ewa] += shifted >> 8;
+    }
+  }
+
+  /* EFREG is 16-bit */
+  for (int i = 0; i < AICA_DSP_NUM_EFREG; i++) {
+    efreg[i] = CLAMP(efreg[i], INT16_MIN, INT16_MAX);
+  }
+
+  dsp->mdec_ct--;
+}
+
+int aica_dsp_enabled(struct aica_dsp *dsp) {
+  if (dsp->dirty) {
+    aica_dsp_compile(dsp);
+  }
+  return dsp->num_ops > 0;
+}
+
+void aica_dsp_invalidate(struct aica_dsp *dsp) {
+  dsp->dirty = 1;
+}
+
+void aica_dsp_save(struct aica_dsp *dsp, struct savestate *ss) {
+  SS_WRITE(ss, dsp->temp);
+  SS_WRITE(ss, dsp->mems);
+  SS_WRITE(ss, dsp->mdec_ct);
+}
+
+void aica_dsp_load(struct aica_dsp *dsp, struct savestate *ss) {
+  SS_READ(ss, dsp->temp);
+  SS_READ(ss, dsp->mems);
+  SS_READ(ss, dsp->mdec_ct);
+
+  /* the program is decoded again from MPRO */
+  dsp->dirty = 1;
+}
+
+void aica_dsp_destroy(struct aica_dsp *dsp) {
+  free(dsp);
+}
+
+struct aica_dsp *aica_dsp_create(uint8_t *reg, uint8_t *aram) {
+  struct aica_dsp *dsp = calloc(1, sizeof(struct aica_dsp));
+
+  dsp->reg = reg;
+  dsp->aram = aram;
+  dsp->dirty = 1;
+
+  return dsp;
+}
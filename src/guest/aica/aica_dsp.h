@@ -0,0 +1,25 @@
+#ifndef AICA_DSP_H
+#define AICA_DSP_H
+
+#include <stdint.h>
+
+struct aica_dsp;
+struct savestate;
+
+#define AICA_DSP_NUM_MIXS 16
+#define AICA_DSP_NUM_EFREG 16
+
+struct aica_dsp *aica_dsp_create(uint8_t *reg, uint8_t *aram);
+void aica_dsp_destroy(struct aica_dsp *dsp);
+
+void aica_dsp_invalidate(struct aica_dsp *dsp);
+int aica_dsp_enabled(struct aica_dsp *dsp);
+
+/* the program is rebuilt from the registers, only its internal state is
+   saved */
+void aica_dsp_save(struct aica_dsp *dsp, struct savestate *ss);
+void aica_dsp_load(struct aica_dsp *dsp, struct savestate *ss);
+
+void aica_dsp_step(struct aica_dsp *dsp, const int32_t *mixs, int32_t *efreg);
+
+#endif
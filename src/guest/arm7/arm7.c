@@ -1,8 +1,11 @@
 #include "guest/arm7/arm7.h"
 #include "core/core.h"
+#include "core/thread.h"
+#include "core/time.h"
 #include "guest/aica/aica.h"
 #include "guest/dreamcast.h"
 #include "guest/memory.h"
+#include "guest/savestate.h"
 #include "guest/scheduler.h"
 #include "imgui.h"
 #include "jit/frontend/armv3/armv3_context.h"
@@ -11,10 +14,14 @@
 #include "jit/frontend/armv3/armv3_guest.h"
 #include "jit/ir/ir.h"
 #include "jit/jit.h"
+#include "options.h"
 #include "stats.h"
 
 #if ARCH_X64
 #include "jit/backend/x64/x64_backend.h"
+#elif ARCH_A64
+#include "jit/backend/a64/a64_backend.h"
+#include "jit/backend/interp/interp_backend.h"
 #else
 #include "jit/backend/interp/interp_backend.h"
 #endif
@@ -32,8 +39,32 @@ struct arm7 {
 
   /* interrupts */
   uint32_t requested_interrupts;
+
+  /* when threaded, the arm7 runs on its own thread one quantum behind the rest
+     of the system. aica register accesses made by the arm7 are forwarded to
+     the emulation thread, which services them between scheduler slices */
+  thread_t thread;
+  mutex_t mutex;
+  cond_t run_cond;
+  cond_t done_cond;
+  int thread_running;
+  int busy;
+  int servicing;
+  int64_t pending_ns;
+  int64_t run_ns;
+  int64_t ran_instrs;
+
+  struct {
+    int pending;
+    int write;
+    uint32_t addr;
+    uint32_t data;
+    uint32_t mask;
+  } req;
 };
 
+static _Thread_local int arm7_on_thread;
+
 static void arm7_update_pending_interrupts(struct arm7 *arm);
 
 static void arm7_swap_registers(struct arm7 *arm, int old_mode, int new_mode) {
@@ -121,6 +152,154 @@ static void arm7_check_interrupts(void *data) {
   }
 }
 
+static void arm7_service_request(struct arm7 *arm) {
+  struct aica *aica = arm->dc->aica;
+
+  /* the arm7 thread is parked until the request completes, making it safe for
+     the register handlers to call back into the arm7 */
+  arm->servicing = 1;
+  mutex_unlock(arm->mutex);
+
+  uint32_t addr = arm->req.addr - ARM7_AICA_REG_BEGIN;
+  if (arm->req.write) {
+    aica_reg_write(aica, addr, arm->req.data, arm->req.mask);
+  } else {
+    arm->req.data = aica_reg_read(aica, addr, arm->req.mask);
+  }
+
+  mutex_lock(arm->mutex);
+  arm->servicing = 0;
+  arm->req.pending = 0;
+  cond_signal(arm->run_cond);
+}
+
+static uint32_t arm7_forward_request(struct arm7 *arm, int write, uint32_t addr,
+                                     uint32_t data, uint32_t mask) {
+  mutex_lock(arm->mutex);
+
+  arm->req.pending = 1;
+  arm->req.write = write;
+  arm->req.addr = addr;
+  arm->req.data = data;
+  arm->req.mask = mask;
+  cond_signal(arm->done_cond);
+
+  while (arm->req.pending) {
+    cond_wait(arm->run_cond, arm->mutex);
+  }
+
+  data = arm->req.data;
+
+  mutex_unlock(arm->mutex);
+
+  return data;
+}
+
+static void arm7_poll_requests(struct arm7 *arm) {
+  mutex_lock(arm->mutex);
+  if (arm->req.pending) {
+    arm7_service_request(arm);
+  }
+  mutex_unlock(arm->mutex);
+}
+
+/* wait for the arm7 thread to finish its current quantum. called before the
+   emulation thread touches any state owned by the arm7 */
+void arm7_sync(struct arm7 *arm) {
+  if (!arm->thread || arm->servicing || arm7_on_thread) {
+    return;
+  }
+
+  mutex_lock(arm->mutex);
+
+  while (arm->busy || arm->req.pending) {
+    if (arm->req.pending) {
+      arm7_service_request(arm);
+    } else {
+      cond_wait(arm->done_cond, arm->mutex);
+    }
+  }
+
+  prof_counter_add(COUNTER_arm7_instrs, arm->ran_instrs);
+  arm->ran_instrs = 0;
+
+  mutex_unlock(arm->mutex);
+}
+
+static void arm7_run_quantum(struct arm7 *arm, int64_t ns) {
+  static int64_t ARM7_CLOCK_FREQ = INT64_C(20000000);
+  int64_t freq = sched_clock_freq(ARM7_CLOCK_FREQ, OPTION_arm7_clock);
+  int cycles = (int)NANO_TO_CYCLES(ns, freq);
+
+  int64_t start = time_nanoseconds();
+  int64_t compile_start = arm->jit->compile_time;
+
+  jit_run(arm->jit, cycles);
+
+  int64_t compile = arm->jit->compile_time - compile_start;
+  prof_counter_add(COUNTER_arm7_time, time_nanoseconds() - start - compile);
+}
+
+static void *arm7_thread(void *data) {
+  struct arm7 *arm = data;
+
+  arm7_on_thread = 1;
+
+  configure_thread(THREAD_ROLE_EMU);
+
+  mutex_lock(arm->mutex);
+
+  while (1) {
+    while (arm->thread_running && !arm->busy) {
+      cond_wait(arm->run_cond, arm->mutex);
+    }
+
+    if (!arm->thread_running) {
+      break;
+    }
+
+    int64_t ns = arm->run_ns;
+    mutex_unlock(arm->mutex);
+
+    arm7_run_quantum(arm, ns);
+
+    mutex_lock(arm->mutex);
+    arm->ran_instrs += arm->ctx.ran_instrs;
+    arm->busy = 0;
+    cond_signal(arm->done_cond);
+  }
+
+  mutex_unlock(arm->mutex);
+
+  return NULL;
+}
+
+static void arm7_destroy_thread(struct arm7 *arm) {
+  arm7_sync(arm);
+
+  mutex_lock(arm->mutex);
+  arm->thread_running = 0;
+  cond_signal(arm->run_cond);
+  mutex_unlock(arm->mutex);
+
+  void *result;
+  thread_join(arm->thread, &result);
+  arm->thread = NULL;
+
+  mutex_destroy(arm->mutex);
+  cond_destroy(arm->run_cond);
+  cond_destroy(arm->done_cond);
+}
+
+static void arm7_create_thread(struct arm7 *arm) {
+  arm->mutex = mutex_create();
+  arm->run_cond = cond_create();
+  arm->done_cond = cond_create();
+  arm->thread_running = 1;
+  arm->thread = thread_create(&arm7_thread, "arm7", arm);
+  CHECK_NOTNULL(arm->thread);
+}
+
 static void arm7_link_code(struct arm7 *arm, void *branch, uint32_t target) {
   jit_link_code(arm->jit, branch, target);
 }
@@ -136,18 +315,29 @@ void arm7_mem_write(struct arm7 *arm, uint32_t addr, uint32_t data,
   if (/*addr >= ARM7_AICA_MEM_BEGIN &&*/ addr <= ARM7_AICA_MEM_END) {
     aica_mem_write(aica, addr, data, mask);
   } else if (addr >= ARM7_AICA_REG_BEGIN && addr <= ARM7_AICA_REG_END) {
+    if (arm7_on_thread) {
+      arm7_forward_request(arm, 1, addr, data, mask);
+      return;
+    }
     aica_reg_write(aica, addr - ARM7_AICA_REG_BEGIN, data, mask);
   } else {
     LOG_FATAL("arm7_mem_write addr=0x%08x", addr);
   }
 }
 
+uint32_t arm7_pc(struct arm7 *arm) {
+  return arm->ctx.r[15];
+}
+
 uint32_t arm7_mem_read(struct arm7 *arm, uint32_t addr, uint32_t mask) {
   struct aica *aica = arm->dc->aica;
 
   if (/*addr >= ARM7_AICA_MEM_BEGIN &&*/ addr <= ARM7_AICA_MEM_END) {
     return aica_mem_read(aica, addr, mask);
   } else if (addr >= ARM7_AICA_REG_BEGIN && addr <= ARM7_AICA_REG_END) {
+    if (arm7_on_thread) {
+      return arm7_forward_request(arm, 0, addr, 0, mask);
+    }
     return aica_reg_read(aica, addr - ARM7_AICA_REG_BEGIN, mask);
   } else {
     LOG_FATAL("arm7_mem_read addr=0x%08x", addr);
@@ -155,6 +345,8 @@ uint32_t arm7_mem_read(struct arm7 *arm, uint32_t addr, uint32_t mask) {
 }
 
 void arm7_raise_interrupt(struct arm7 *arm, enum arm7_interrupt intr) {
+  arm7_sync(arm);
+
   arm->requested_interrupts |= intr;
   arm7_update_pending_interrupts(arm);
 }
@@ -162,6 +354,8 @@ void arm7_raise_interrupt(struct arm7 *arm, enum arm7_interrupt intr) {
 void arm7_reset(struct arm7 *arm) {
   LOG_INFO("arm7_reset");
 
+  arm7_sync(arm);
+
   jit_free_code(arm->jit);
 
   /* reset context */
@@ -172,21 +366,72 @@ void arm7_reset(struct arm7 *arm) {
   arm->ctx.r[R13_SVC] = 0x03007fe0;
   arm->ctx.r[CPSR] = F_MASK | MODE_SYS;
 
+  arm->pending_ns = 0;
   arm->runif.running = 1;
 }
 
 void arm7_suspend(struct arm7 *arm) {
+  arm7_sync(arm);
+
   arm->runif.running = 0;
 }
 
 static void arm7_run(struct device *dev, int64_t ns) {
   struct arm7 *arm = (struct arm7 *)dev;
-  static int64_t ARM7_CLOCK_FREQ = INT64_C(20000000);
-  int cycles = (int)NANO_TO_CYCLES(ns, ARM7_CLOCK_FREQ);
 
-  jit_run(arm->jit, cycles);
+  if (!arm->thread) {
+    arm7_run_quantum(arm, ns);
+    prof_counter_add(COUNTER_arm7_instrs, arm->ctx.ran_instrs);
+    return;
+  }
+
+  /* time is accumulated until a full quantum is available, at which point the
+     previous quantum is waited on and the new one handed off */
+  arm->pending_ns += ns;
+
+  if (arm->pending_ns < (int64_t)OPTION_arm7_quantum * 1000) {
+    arm7_poll_requests(arm);
+    return;
+  }
+
+  arm7_sync(arm);
+
+  mutex_lock(arm->mutex);
+  arm->run_ns = arm->pending_ns;
+  arm->pending_ns = 0;
+  arm->busy = 1;
+  cond_signal(arm->run_cond);
+  mutex_unlock(arm->mutex);
+}
+
+static void arm7_save(struct device *dev, struct savestate *ss) {
+  struct arm7 *arm = (struct arm7 *)dev;
+
+  arm7_sync(arm);
 
-  prof_counter_add(COUNTER_arm7_instrs, arm->ctx.ran_instrs);
+  /* the rusr pointers only depend on the mode, which is part of r */
+  SS_WRITE(ss, arm->ctx.r);
+  SS_WRITE(ss, arm->requested_interrupts);
+  SS_WRITE(ss, arm->pending_ns);
+}
+
+static void arm7_load(struct device *dev, struct savestate *ss) {
+  struct arm7 *arm = (struct arm7 *)dev;
+
+  arm7_sync(arm);
+
+  jit_free_code(arm->jit);
+
+  SS_READ(ss, arm->ctx.r);
+  SS_READ(ss, arm->requested_interrupts);
+  SS_READ(ss, arm->pending_ns);
+
+  int mode = arm->ctx.r[CPSR] & M_MASK;
+  for (int n = 0; n < 16; n++) {
+    arm->ctx.rusr[n] = &arm->ctx.r[armv3_reg_table[mode][n]];
+  }
+
+  arm7_update_pending_interrupts(arm);
 }
 
 static void arm7_guest_destroy(struct jit_guest *guest) {
@@ -211,8 +456,13 @@ static struct jit_guest *arm7_guest_create(struct arm7 *arm) {
   guest->w16 = &arm7_write16;
   guest->w32 = &arm7_write32;
 
+  if (OPTION_jit_fastmem_checks) {
+    guest->page_table = arm7_page_table(guest->mem, &guest->page_shift);
+  }
+
   /* runtime interface */
   guest->data = arm;
+  guest->data_size = (int)sizeof(*arm);
   guest->offset_pc = (int)offsetof(struct armv3_context, r[15]);
   guest->offset_cycles = (int)offsetof(struct armv3_context, run_cycles);
   guest->offset_instrs = (int)offsetof(struct armv3_context, ran_instrs);
@@ -234,22 +484,48 @@ static int arm7_init(struct device *dev) {
   arm->guest = arm7_guest_create(arm);
   arm->frontend = armv3_frontend_create(arm->guest);
 #if ARCH_X64
-  DEFINE_JIT_CODE_BUFFER(arm7_code);
-  arm->backend = x64_backend_create(arm->guest, arm7_code, sizeof(arm7_code));
+  arm->backend = x64_backend_create(arm->guest, NULL, JIT_CODE_BUFFER_SIZE);
+#elif ARCH_A64
+  /* the a64 backend is opt-in until it's been proven on hardware */
+  if (OPTION_jit_a64) {
+    arm->backend = a64_backend_create(arm->guest, NULL, JIT_CODE_BUFFER_SIZE);
+  } else {
+    arm->backend = interp_backend_create(arm->guest, arm->frontend);
+  }
 #else
   arm->backend = interp_backend_create(arm->guest, arm->frontend);
 #endif
   arm->jit = jit_create("arm7", arm->frontend, arm->backend);
 
+  if (OPTION_arm7_threaded) {
+    arm7_create_thread(arm);
+  }
+
   return 1;
 }
 
 #ifdef HAVE_IMGUI
 void arm7_debug_menu(struct arm7 *arm) {
+  struct jit *jit = arm->jit;
+
+  arm7_sync(arm);
+
   if (igBeginMainMenuBar()) {
     if (igBeginMenu("ARM7", 1)) {
       if (igMenuItem("clear cache", NULL, 0, 1)) {
-        jit_invalidate_code(arm->jit);
+        jit_invalidate_code(jit);
+      }
+
+      if (!jit->profile) {
+        if (igMenuItem("start block profile", NULL, 0, 1)) {
+          jit->profile = 1;
+          jit_invalidate_code(jit);
+        }
+      } else {
+        if (igMenuItem("stop block profile", NULL, 1, 1)) {
+          jit->profile = 0;
+          jit_invalidate_code(jit);
+        }
       }
 
       igEndMenu();
@@ -257,10 +533,18 @@ void arm7_debug_menu(struct arm7 *arm) {
 
     igEndMainMenuBar();
   }
+
+  if (jit->profile) {
+    jit_profile_debug_menu(jit);
+  }
 }
 #endif
 
 void arm7_destroy(struct arm7 *arm) {
+  if (arm->thread) {
+    arm7_destroy_thread(arm);
+  }
+
   jit_destroy(arm->jit);
   arm7_guest_destroy(arm->guest);
   arm->frontend->destroy(arm->frontend);
@@ -276,5 +560,10 @@ struct arm7 *arm7_create(struct dreamcast *dc) {
   arm->runif.enabled = 1;
   arm->runif.run = &arm7_run;
 
+  /* setup state interface */
+  arm->stateif.enabled = 1;
+  arm->stateif.save = &arm7_save;
+  arm->stateif.load = &arm7_load;
+
   return arm;
 }
@@ -26,6 +26,12 @@ void arm7_suspend(struct arm7 *arm);
 void arm7_reset(struct arm7 *arm);
 void arm7_raise_interrupt(struct arm7 *arm, enum arm7_interrupt intr);
 
+/* wait for the arm7 thread to finish its current quantum */
+void arm7_sync(struct arm7 *arm);
+
+/* pc of the block currently executing */
+uint32_t arm7_pc(struct arm7 *arm);
+
 uint32_t arm7_mem_read(struct arm7 *arm, uint32_t addr, uint32_t mask);
 void arm7_mem_write(struct arm7 *arm, uint32_t addr, uint32_t data,
                     uint32_t mask);
@@ -287,6 +287,9 @@ void bios_boot(struct bios *bios) {
 
     sh4_memcpy_to_guest(dc->mem, BOOT2_ADDR, tmp, read);
     free(tmp);
+
+    /* compile the game's code ahead of the bootstrap jumping to it */
+    sh4_prescan_code(sh4, BOOT2_ADDR);
   }
 
   /* write system info */
@@ -367,6 +370,16 @@ int bios_invalid_instr(struct bios *bios) {
   return handled;
 }
 
+static void bios_save(struct device *dev, struct savestate *ss) {
+  struct bios *bios = (struct bios *)dev;
+  bios_gdrom_save(bios, ss);
+}
+
+static void bios_load(struct device *dev, struct savestate *ss) {
+  struct bios *bios = (struct bios *)dev;
+  bios_gdrom_load(bios, ss);
+}
+
 void bios_destroy(struct bios *bios) {
   free(bios);
 }
@@ -374,5 +387,11 @@ void bios_destroy(struct bios *bios) {
 struct bios *bios_create(struct dreamcast *dc) {
   struct bios *bios =
       dc_create_device(dc, sizeof(struct bios), "bios", NULL, &bios_post_init);
+
+  /* setup state interface */
+  bios->stateif.enabled = 1;
+  bios->stateif.save = &bios_save;
+  bios->stateif.load = &bios_load;
+
   return bios;
 }
@@ -13,6 +13,13 @@ struct bios {
   uint32_t cmd_code;
   uint32_t params[4];
   uint32_t result[4];
+  /* reads wait on this while the drive seeks to and reads the sectors when
+     gd-rom timing is accurate */
+  struct timer *cmd_timer;
+  int cmd_timed;
+  /* sectors of the current read transferred so far. async reads transfer
+     them over several mainloop polls, as the read-ahead thread reads them */
+  int read_sectors;
 };
 
 struct bios *bios_create(struct dreamcast *dc);
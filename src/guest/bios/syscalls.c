@@ -5,7 +5,10 @@
 #include "guest/holly/holly.h"
 #include "guest/memory.h"
 #include "guest/rom/flash.h"
+#include "guest/savestate.h"
+#include "guest/scheduler.h"
 #include "guest/sh4/sh4.h"
+#include "options.h"
 
 #if 0
 #define LOG_SYSCALL LOG_INFO
@@ -153,6 +156,8 @@ static uint32_t bios_gdrom_send_cmd(struct bios *bios, uint32_t cmd_code,
   bios->status = GDC_STATUS_ACTIVE;
   bios->cmd_id = next_id;
   bios->cmd_code = cmd_code;
+  bios->cmd_timed = 0;
+  bios->read_sectors = 0;
 
   memset(bios->params, 0, sizeof(bios->params));
   memset(bios->result, 0, sizeof(bios->result));
@@ -165,6 +170,88 @@ static uint32_t bios_gdrom_send_cmd(struct bios *bios, uint32_t cmd_code,
   return bios->cmd_id;
 }
 
+static void bios_gdrom_cmd_timer(void *data) {
+  struct bios *bios = data;
+  bios->cmd_timer = NULL;
+}
+
+void bios_gdrom_save(struct bios *bios, struct savestate *ss) {
+  struct scheduler *sched = bios->dc->sched;
+
+  SS_WRITE(ss, bios->status);
+  SS_WRITE(ss, bios->cmd_id);
+  SS_WRITE(ss, bios->cmd_code);
+  SS_WRITE(ss, bios->params);
+  SS_WRITE(ss, bios->result);
+  ss_write_timer(ss, sched, bios->cmd_timer);
+  SS_WRITE(ss, bios->cmd_timed);
+  SS_WRITE(ss, bios->read_sectors);
+}
+
+void bios_gdrom_load(struct bios *bios, struct savestate *ss) {
+  struct scheduler *sched = bios->dc->sched;
+
+  SS_READ(ss, bios->status);
+  SS_READ(ss, bios->cmd_id);
+  SS_READ(ss, bios->cmd_code);
+  SS_READ(ss, bios->params);
+  SS_READ(ss, bios->result);
+  bios->cmd_timer = ss_read_timer(ss, sched, bios->cmd_timer,
+                                  &bios_gdrom_cmd_timer, bios, 0);
+  SS_READ(ss, bios->cmd_timed);
+  SS_READ(ss, bios->read_sectors);
+}
+
+/* max number of sectors read from the disc at once */
+#define GDC_READ_CHUNK_SECTORS 16
+
+static int bios_gdrom_is_read(struct bios *bios) {
+  return bios->cmd_code == GDC_PIOREAD || bios->cmd_code == GDC_DMAREAD;
+}
+
+static int bios_gdrom_read(struct bios *bios) {
+  struct dreamcast *dc = bios->dc;
+  struct gdrom *gd = dc->gdrom;
+
+  int fad = bios->params[0];
+  int num_sectors = bios->params[1];
+  uint32_t dst = bios->params[2];
+  uint32_t unknown = bios->params[3];
+  int fmt = GD_SECTOR_ANY;
+  int mask = GD_MASK_DATA;
+
+  LOG_SYSCALL("GDC_DMAREAD fad=0x%x n=0x%x dst=0x%x unknown=0x%x", fad,
+              num_sectors, dst, unknown);
+
+  /* dma read functionality changes somehow when this in non-zero */
+  CHECK_EQ(unknown, 0);
+
+  uint8_t tmp[DISC_MAX_SECTOR_SIZE * GDC_READ_CHUNK_SECTORS];
+  int max_sectors = GDC_READ_CHUNK_SECTORS;
+
+  /* read as many sectors from the disc at once as will fit. async reads stop
+     at the first sectors the read-ahead thread is still reading, picking up
+     from there on the next poll */
+  while (bios->read_sectors < num_sectors) {
+    int i = fad + bios->read_sectors;
+    int count = MIN(num_sectors - bios->read_sectors, max_sectors);
+
+    if (OPTION_gdrom_async && !gdrom_prefetch_sectors(gd, i, count)) {
+      return 0;
+    }
+
+    int n = gdrom_read_sectors(gd, i, count, fmt, mask, tmp, sizeof(tmp));
+    sh4_memcpy_to_guest(dc->mem, dst + bios->result[2], tmp, n);
+    bios->read_sectors += count;
+
+    /* record size transferred */
+    bios->result[2] += n;
+    bios->result[3] -= n;
+  }
+
+  return 1;
+}
+
 static void bios_gdrom_mainloop(struct bios *bios) {
   struct dreamcast *dc = bios->dc;
   struct gdrom *gd = dc->gdrom;
@@ -174,39 +261,35 @@ static void bios_gdrom_mainloop(struct bios *bios) {
     return;
   }
 
+  /* reads stay active for as long as the drive takes to read the sectors */
+  if (bios_gdrom_is_read(bios)) {
+    if (bios->cmd_timer) {
+      return;
+    }
+
+    if (!bios->cmd_timed) {
+      int64_t delay = gdrom_access_time(gd, bios->params[0], bios->params[1]);
+      bios->cmd_timed = 1;
+
+      if (delay) {
+        bios->cmd_timer =
+            sched_start_timer(dc->sched, &bios_gdrom_cmd_timer, bios, delay);
+        return;
+      }
+    }
+
+    if (!bios_gdrom_read(bios)) {
+      return;
+    }
+  }
+
   /* by default, all commands report that they've completed successfully */
   bios->status = GDC_STATUS_COMPLETE;
 
   switch (bios->cmd_code) {
     case GDC_PIOREAD:
     case GDC_DMAREAD: {
-      int fad = bios->params[0];
-      int num_sectors = bios->params[1];
-      uint32_t dst = bios->params[2];
-      uint32_t unknown = bios->params[3];
-      int fmt = GD_SECTOR_ANY;
-      int mask = GD_MASK_DATA;
-
-      LOG_SYSCALL("GDC_DMAREAD fad=0x%x n=0x%x dst=0x%x unknown=0x%x", fad,
-                  num_sectors, dst, unknown);
-
-      /* dma read functionality changes somehow when this in non-zero */
-      CHECK_EQ(unknown, 0);
-
-      int read = 0;
-      int rem = 0;
-      uint8_t tmp[DISC_MAX_SECTOR_SIZE];
-
-      for (int i = fad; i < fad + num_sectors; i++) {
-        int n = gdrom_read_sectors(gd, i, 1, fmt, mask, tmp, sizeof(tmp));
-        sh4_memcpy_to_guest(dc->mem, dst + read, tmp, n);
-        read += n;
-        rem -= n;
-      }
-
-      /* record size transferred */
-      bios->result[2] = read;
-      bios->result[3] = rem;
+      /* transferred above */
     } break;
 
     case GDC_GETTOC: {
@@ -544,6 +627,14 @@ void bios_gdrom_vector(struct bios *bios) {
         LOG_SYSCALL("GDROM_SEND_COMMAND cmd_code=0x%x params=0x%x cmd_id=0x%x",
                     cmd_code, params, cmd_id);
 
+        /* start reading the first sectors in the background right away, for
+           them to be ready by the time the game polls the drive */
+        if (cmd_id && OPTION_gdrom_async && bios_gdrom_is_read(bios)) {
+          gdrom_prefetch_sectors(gd, bios->params[0],
+                                 MIN((int)bios->params[1],
+                                     GDC_READ_CHUNK_SECTORS));
+        }
+
         ctx->r[0] = cmd_id;
       } break;
 
@@ -579,9 +670,12 @@ void bios_gdrom_vector(struct bios *bios) {
                               sizeof(bios->result));
           ctx->r[0] = bios->status;
 
-          /* clear result so nothing is returned if queried a second time */
-          bios->status = GDC_STATUS_INACTIVE;
-          memset(bios->result, 0, sizeof(bios->result));
+          /* clear result so nothing is returned if queried a second time,
+             commands still active carry on */
+          if (bios->status != GDC_STATUS_ACTIVE) {
+            bios->status = GDC_STATUS_INACTIVE;
+            memset(bios->result, 0, sizeof(bios->result));
+          }
         }
       } break;
 
@@ -710,10 +804,23 @@ void bios_gdrom_vector(struct bios *bios) {
          *
          * r0: zero if successful, nonzero if failure
          */
-        LOG_SYSCALL("GDROM_ABORT_COMMAND");
+        uint32_t cmd_id = ctx->r[4];
 
-        /* all commands are performed immediately, there's nothing to cancel */
-        ctx->r[0] = -1;
+        LOG_SYSCALL("GDROM_ABORT_COMMAND 0x%x", cmd_id);
+
+        /* only reads waiting on the drive can be cancelled, all other commands
+           are performed immediately */
+        if (cmd_id == bios->cmd_id && bios->status == GDC_STATUS_ACTIVE &&
+            bios_gdrom_is_read(bios)) {
+          if (bios->cmd_timer) {
+            sched_cancel_timer(dc->sched, bios->cmd_timer);
+            bios->cmd_timer = NULL;
+          }
+          bios->status = GDC_STATUS_ABORT;
+          ctx->r[0] = 0;
+        } else {
+          ctx->r[0] = -1;
+        }
       } break;
 
       case GDROM_RESET: {
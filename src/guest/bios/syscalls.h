@@ -2,6 +2,7 @@
 #define SYSCALLS_H
 
 struct bios;
+struct savestate;
 
 void bios_fontrom_vector(struct bios *bios);
 void bios_sysinfo_vector(struct bios *bios);
@@ -9,4 +10,7 @@ void bios_flashrom_vector(struct bios *bios);
 void bios_gdrom_vector(struct bios *bios);
 void bios_system_vector(struct bios *bios);
 
+void bios_gdrom_save(struct bios *bios, struct savestate *ss);
+void bios_gdrom_load(struct bios *bios, struct savestate *ss);
+
 #endif
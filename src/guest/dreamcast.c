@@ -1,17 +1,22 @@
 #include "guest/dreamcast.h"
 #include "core/core.h"
+#include "core/xxhash.h"
+#include "file/movie.h"
 #include "guest/aica/aica.h"
 #include "guest/arm7/arm7.h"
 #include "guest/bios/bios.h"
 #include "guest/debugger.h"
+#include "guest/gdrom/disc.h"
 #include "guest/gdrom/gdrom.h"
 #include "guest/holly/holly.h"
 #include "guest/maple/maple.h"
 #include "guest/memory.h"
+#include "guest/profile.h"
 #include "guest/pvr/pvr.h"
 #include "guest/pvr/ta.h"
 #include "guest/rom/boot.h"
 #include "guest/rom/flash.h"
+#include "guest/savestate.h"
 #include "guest/scheduler.h"
 #include "guest/sh4/sh4.h"
 
@@ -23,6 +28,37 @@ void dc_vblank_out(struct dreamcast *dc) {
   dc->vblank_out(dc->userdata);
 }
 
+static void dc_play_movie_input(struct dreamcast *dc) {
+  struct movie_event event;
+  int64_t now = sched_base_time(dc->sched);
+
+  while (movie_next(dc->movie, now, &event)) {
+    maple_handle_input(dc->maple, event.port, event.button,
+                       (int16_t)event.value);
+  }
+
+  /* hand control back to the client once the movie has played out */
+  if (movie_finished(dc->movie)) {
+    LOG_INFO("dc_play_movie_input movie finished");
+    dc_stop_movie(dc);
+  }
+}
+
+void dc_poll_input(struct dreamcast *dc) {
+  if (dc->movie && movie_playing(dc->movie)) {
+    dc_play_movie_input(dc);
+    return;
+  }
+
+  if (!dc->poll_input) {
+    return;
+  }
+
+  dc->polling = 1;
+  dc->poll_input(dc->userdata);
+  dc->polling = 0;
+}
+
 void dc_vblank_in(struct dreamcast *dc, int video_disabled) {
   if (!dc->vblank_in) {
     return;
@@ -63,6 +99,22 @@ void dc_push_audio(struct dreamcast *dc, const int16_t *data, int frames) {
   dc->push_audio(dc->userdata, data, frames);
 }
 
+int16_t *dc_reserve_audio(struct dreamcast *dc, int frames) {
+  if (!dc->reserve_audio) {
+    return NULL;
+  }
+
+  return dc->reserve_audio(dc->userdata, frames);
+}
+
+void dc_commit_audio(struct dreamcast *dc, int frames) {
+  if (!dc->commit_audio) {
+    return;
+  }
+
+  dc->commit_audio(dc->userdata, frames);
+}
+
 void dc_destroy_device(struct device *dev) {
   list_remove(&dev->dc->devices, &dev->it);
 
@@ -101,9 +153,44 @@ void dc_add_serial_device(struct dreamcast *dc, struct serial *serial) {
 }
 
 void dc_input(struct dreamcast *dc, int port, int button, int16_t value) {
+  if (dc->movie) {
+    /* live input is ignored while a movie plays back */
+    if (movie_playing(dc->movie)) {
+      return;
+    }
+
+    /* input made outside of a poll is first seen by the next poll, which
+       always runs at a later guest time than the current one. stamp it as
+       such, so playback doesn't apply it to a poll made at the current time
+       that never saw it */
+    int64_t time = sched_base_time(dc->sched) + (dc->polling ? 0 : 1);
+    movie_write(dc->movie, time, port, button, value);
+  }
+
   maple_handle_input(dc->maple, port, button, value);
 }
 
+void dc_stop_movie(struct dreamcast *dc) {
+  if (!dc->movie) {
+    return;
+  }
+
+  movie_close(dc->movie);
+  dc->movie = NULL;
+}
+
+int dc_play_movie(struct dreamcast *dc, const char *path) {
+  dc_stop_movie(dc);
+  dc->movie = movie_play(path, sched_base_time(dc->sched));
+  return dc->movie != NULL;
+}
+
+int dc_record_movie(struct dreamcast *dc, const char *path) {
+  dc_stop_movie(dc);
+  dc->movie = movie_record(path, sched_base_time(dc->sched));
+  return dc->movie != NULL;
+}
+
 void dc_tick(struct dreamcast *dc, int64_t ns) {
   if (dc->debugger) {
     debugger_tick(dc->debugger);
@@ -126,6 +213,26 @@ int dc_running(struct dreamcast *dc) {
   return dc->running;
 }
 
+static void dc_boot_entered(void *data) {
+  struct dreamcast *dc = data;
+
+  LOG_INFO("dc_boot_entered entered boot file");
+
+  dc->booted = 1;
+}
+
+void dc_watch_boot(struct dreamcast *dc) {
+  /* 1ST_READ.BIN is loaded to and entered at the start of area 3 ram */
+  const uint32_t BOOTFILE_ADDR = 0x0c010000;
+
+  dc->booted = 0;
+  sh4_set_entry_trap(dc->sh4, BOOTFILE_ADDR, &dc_boot_entered, dc);
+}
+
+int dc_booted(struct dreamcast *dc) {
+  return dc->booted;
+}
+
 static int dc_load_bin(struct dreamcast *dc, const char *path) {
   FILE *fp = fopen(path, "rb");
   if (!fp) {
@@ -148,6 +255,7 @@ static int dc_load_bin(struct dreamcast *dc, const char *path) {
 
   /* boot to bios bootstrap */
   sh4_reset(dc->sh4, 0x0c010000);
+  sh4_prescan_code(dc->sh4, 0x0c010000);
   dc_resume(dc);
 
   return 1;
@@ -160,6 +268,9 @@ static int dc_load_disc(struct dreamcast *dc, const char *path) {
     return 0;
   }
 
+  /* the title's profile may change how the disc is read */
+  profile_apply(disc);
+
   /* boot to bios bootstrap */
   gdrom_set_disc(dc->gdrom, disc);
   sh4_reset(dc->sh4, 0xa0000000);
@@ -169,6 +280,9 @@ static int dc_load_disc(struct dreamcast *dc, const char *path) {
 }
 
 int dc_load(struct dreamcast *dc, const char *path) {
+  /* drop the overrides of any title loaded previously */
+  profile_apply(NULL);
+
   if (!path) {
     LOG_INFO("dc_load no path supplied, loading bios");
 
@@ -183,6 +297,315 @@ int dc_load(struct dreamcast *dc, const char *path) {
   return dc_load_disc(dc, path) || dc_load_bin(dc, path);
 }
 
+/*
+ * save states
+ *
+ * a state is a header identifying the disc it was saved with, followed by a
+ * section for guest memory and one for each device implementing the state
+ * interface. sections are tagged with the device's name and size, so a state
+ * is validated in full before any of it is applied
+ */
+#define DC_STATE_MAGIC 0x54534452 /* RDST */
+#define DC_STATE_VERSION 5
+#define DC_STATE_MEMORY "memory"
+#define DC_STATE_PADDING "padding"
+
+struct dc_state_header {
+  uint32_t magic;
+  uint32_t version;
+  char uid[DISC_UID_SIZE];
+};
+
+struct dc_state_section {
+  char name[16];
+  int32_t running;
+  int32_t reserved;
+  int64_t size;
+};
+
+static void dc_state_uid(struct dreamcast *dc, char *uid) {
+  struct disc *disc = gdrom_get_disc(dc->gdrom);
+
+  memset(uid, 0, DISC_UID_SIZE);
+  snprintf(uid, DISC_UID_SIZE, "%s", disc ? disc->uid : "");
+}
+
+static int64_t dc_begin_section(struct savestate *ss, const char *name,
+                                int running) {
+  struct dc_state_section section = {0};
+  int64_t offset = ss->pos;
+
+  strncpy(section.name, name, sizeof(section.name) - 1);
+  section.running = running;
+  SS_WRITE(ss, section);
+
+  return offset;
+}
+
+static void dc_end_section(struct savestate *ss, int64_t offset) {
+  int64_t size = ss->pos - offset - (int64_t)sizeof(struct dc_state_section);
+
+  /* patch in the size now that it's known */
+  ss_patch(ss, offset + offsetof(struct dc_state_section, size), &size,
+           (int)sizeof(size));
+}
+
+static struct device *dc_state_device(struct dreamcast *dc,
+                                      const struct dc_state_section *section) {
+  list_for_each_entry(dev, &dc->devices, struct device, it) {
+    if (dev->stateif.enabled && !strcmp(dev->name, section->name)) {
+      return dev;
+    }
+  }
+
+  return NULL;
+}
+
+static void dc_write_state(struct dreamcast *dc, struct savestate *ss,
+                           int memory) {
+  /* renders and dma transfers in flight can't be resumed from a state,
+     complete them before anything is written out */
+  arm7_sync(dc->arm7);
+  sh4_dmac_complete(dc->sh4);
+  ta_finish_renders(dc->ta);
+
+  struct dc_state_header header = {0};
+  header.magic = DC_STATE_MAGIC;
+  header.version = DC_STATE_VERSION;
+  dc_state_uid(dc, header.uid);
+  SS_WRITE(ss, header);
+
+  if (memory) {
+    int64_t offset = dc_begin_section(ss, DC_STATE_MEMORY, 0);
+    mem_save(dc->mem, ss);
+    dc_end_section(ss, offset);
+  }
+
+  list_for_each_entry(dev, &dc->devices, struct device, it) {
+    if (!dev->stateif.enabled) {
+      continue;
+    }
+
+    int64_t offset = dc_begin_section(ss, dev->name, dev->runif.running);
+    dev->stateif.save(dev, ss);
+    dc_end_section(ss, offset);
+  }
+}
+
+int dc_save_state(struct dreamcast *dc, const char *path) {
+  FILE *file = fopen(path, "wb");
+
+  if (!file) {
+    LOG_WARNING("dc_save_state failed to open %s", path);
+    return 0;
+  }
+
+  struct savestate ss = {0};
+  ss.file = file;
+  dc_write_state(dc, &ss, 1);
+
+  fclose(file);
+
+  if (ss.error) {
+    LOG_WARNING("dc_save_state failed to write %s", path);
+    return 0;
+  }
+
+  LOG_INFO("dc_save_state saved %s", path);
+
+  return 1;
+}
+
+int64_t dc_state_max_size(struct dreamcast *dc) {
+  /* measure the current state, only the ta's state varies in size */
+  struct savestate ss = {0};
+  ss.fixed = 1;
+  dc_write_state(dc, &ss, 1);
+
+  return ss.pos + ta_state_headroom(dc->ta) +
+         (int64_t)sizeof(struct dc_state_section);
+}
+
+int64_t dc_save_state_buffer(struct dreamcast *dc, void *data, int64_t size) {
+  struct savestate ss = {0};
+  ss.buffer = data;
+  ss.capacity = size;
+  ss.fixed = 1;
+  dc_write_state(dc, &ss, 1);
+
+  if (ss.error) {
+    LOG_WARNING("dc_save_state_buffer state doesn't fit in %" PRId64 " bytes",
+                size);
+    return 0;
+  }
+
+  /* the buffer is handed back at its full size on load, cover the unused
+     tail with a section that's skipped over */
+  if (size - ss.pos >= (int64_t)sizeof(struct dc_state_section)) {
+    int64_t offset = dc_begin_section(&ss, DC_STATE_PADDING, 0);
+    ss.pos = size;
+    dc_end_section(&ss, offset);
+  }
+
+  return ss.pos;
+}
+
+static int dc_validate_state(struct dreamcast *dc, const uint8_t *data,
+                             int64_t size) {
+  struct dc_state_header header;
+  char uid[DISC_UID_SIZE];
+
+  if (size < (int64_t)sizeof(header)) {
+    LOG_WARNING("dc_validate_state state is truncated");
+    return 0;
+  }
+
+  memcpy(&header, data, sizeof(header));
+
+  if (header.magic != DC_STATE_MAGIC || header.version != DC_STATE_VERSION) {
+    LOG_WARNING("dc_validate_state unsupported state version");
+    return 0;
+  }
+
+  dc_state_uid(dc, uid);
+
+  if (strncmp(header.uid, uid, sizeof(uid))) {
+    LOG_WARNING("dc_validate_state state was saved with a different disc");
+    return 0;
+  }
+
+  int64_t pos = sizeof(header);
+
+  while (pos < size) {
+    struct dc_state_section section;
+
+    if (size - pos < (int64_t)sizeof(section)) {
+      LOG_WARNING("dc_validate_state state is truncated");
+      return 0;
+    }
+
+    memcpy(&section, data + pos, sizeof(section));
+    section.name[sizeof(section.name) - 1] = 0;
+    pos += sizeof(section);
+
+    if (section.size < 0 || section.size > size - pos) {
+      LOG_WARNING("dc_validate_state section '%s' is truncated", section.name);
+      return 0;
+    }
+
+    if (strcmp(section.name, DC_STATE_MEMORY) &&
+        strcmp(section.name, DC_STATE_PADDING) &&
+        !dc_state_device(dc, &section)) {
+      LOG_WARNING("dc_validate_state unknown section '%s'", section.name);
+      return 0;
+    }
+
+    pos += section.size;
+  }
+
+  return 1;
+}
+
+static int dc_apply_state(struct dreamcast *dc, const uint8_t *data,
+                          int64_t size) {
+  int64_t pos = sizeof(struct dc_state_header);
+  int res = 1;
+
+  while (pos < size) {
+    struct dc_state_section section;
+    memcpy(&section, data + pos, sizeof(section));
+    section.name[sizeof(section.name) - 1] = 0;
+    pos += sizeof(section);
+
+    struct savestate ss = {0};
+    ss.data = data + pos;
+    ss.size = section.size;
+
+    if (!strcmp(section.name, DC_STATE_PADDING)) {
+      ss.pos = ss.size;
+    } else if (!strcmp(section.name, DC_STATE_MEMORY)) {
+      mem_load(dc->mem, &ss);
+    } else {
+      struct device *dev = dc_state_device(dc, &section);
+
+      if (dev->runif.enabled) {
+        dev->runif.running = section.running;
+      }
+
+      dev->stateif.load(dev, &ss);
+    }
+
+    if (ss.error || ss.pos != ss.size) {
+      LOG_WARNING("dc_apply_state section '%s' is invalid", section.name);
+      res = 0;
+    }
+
+    pos += section.size;
+  }
+
+  return res;
+}
+
+static int dc_read_state(struct dreamcast *dc, const uint8_t *data,
+                         int64_t size) {
+  if (!dc_validate_state(dc, data, size)) {
+    return 0;
+  }
+
+  /* nothing may still be touching the state being replaced */
+  arm7_sync(dc->arm7);
+  ta_finish_renders(dc->ta);
+
+  return dc_apply_state(dc, data, size);
+}
+
+int dc_load_state(struct dreamcast *dc, const char *path) {
+  size_t size;
+  uint8_t *data = map_file(path, &size);
+
+  if (!data) {
+    LOG_WARNING("dc_load_state failed to open %s", path);
+    return 0;
+  }
+
+  int res = dc_read_state(dc, data, (int64_t)size);
+
+  unmap_file(data, size);
+
+  if (!res) {
+    LOG_WARNING("dc_load_state failed to load %s", path);
+    return 0;
+  }
+
+  LOG_INFO("dc_load_state loaded %s", path);
+
+  return 1;
+}
+
+int dc_load_state_buffer(struct dreamcast *dc, const void *data, int64_t size) {
+  return dc_read_state(dc, data, size);
+}
+
+void dc_save_devices(struct dreamcast *dc, struct savestate *ss) {
+  dc_write_state(dc, ss, 0);
+}
+
+int dc_load_devices(struct dreamcast *dc, const uint8_t *data, int64_t size) {
+  return dc_read_state(dc, data, size);
+}
+
+uint64_t dc_hash_memory(struct dreamcast *dc) {
+  uint64_t hash = 0;
+
+  for (int i = 0; i < MEM_NUM_REGIONS; i++) {
+    int size;
+    uint8_t *ptr = mem_region(dc->mem, i, &size);
+    hash = xxh64(ptr, size, hash);
+  }
+
+  return hash;
+}
+
 int dc_init(struct dreamcast *dc) {
   if (dc->debugger && !debugger_init(dc->debugger)) {
     LOG_WARNING("dc_init failed to initialize debugger");
@@ -213,6 +636,11 @@ int dc_init(struct dreamcast *dc) {
 }
 
 void dc_destroy(struct dreamcast *dc) {
+  dc_stop_movie(dc);
+
+  /* restore the options the loaded title's profile overrode */
+  profile_apply(NULL);
+
   ta_destroy(dc->ta);
   pvr_destroy(dc->pvr);
   maple_destroy(dc->maple);
@@ -19,7 +19,9 @@ struct gdrom;
 struct holly;
 struct maple;
 struct memory;
+struct movie;
 struct pvr;
+struct savestate;
 struct scheduler;
 struct sh4;
 struct ta;
@@ -81,6 +83,17 @@ struct runif {
   device_run_cb run;
 };
 
+/* save state interface. devices write out whatever state can't be rebuilt
+   from guest memory, and restart any timers they own when loaded */
+typedef void (*device_save_cb)(struct device *, struct savestate *);
+typedef void (*device_load_cb)(struct device *, struct savestate *);
+
+struct stateif {
+  int enabled;
+  device_save_cb save;
+  device_load_cb load;
+};
+
 /*
  * device
  */
@@ -103,6 +116,7 @@ struct device {
   /* optional interfaces */
   struct dbgif dbgif;
   struct runif runif;
+  struct stateif stateif;
 
   struct list_node it;
 };
@@ -111,15 +125,26 @@ struct device {
  * machine
  */
 typedef void (*push_audio_cb)(void *, const int16_t *, int);
+typedef int16_t *(*reserve_audio_cb)(void *, int);
+typedef void (*commit_audio_cb)(void *, int);
 typedef void (*push_pixels_cb)(void *, const uint8_t *, int, int);
 typedef void (*start_render_cb)(void *, struct ta_context *);
 typedef void (*finish_render_cb)(void *);
 typedef void (*vblank_in_cb)(void *, int);
 typedef void (*vblank_out_cb)(void *);
+typedef void (*poll_input_cb)(void *);
 
 struct dreamcast {
   int running;
 
+  /* set once the boot file is entered, see dc_watch_boot */
+  int booted;
+
+  /* input movie being recorded or played back */
+  struct movie *movie;
+  /* set while the client is polled for input */
+  int polling;
+
   /* systems */
   struct debugger *debugger;
   struct memory *mem;
@@ -143,11 +168,14 @@ struct dreamcast {
   /* client callbacks */
   void *userdata;
   push_audio_cb push_audio;
+  reserve_audio_cb reserve_audio;
+  commit_audio_cb commit_audio;
   push_pixels_cb push_pixels;
   start_render_cb start_render;
   finish_render_cb finish_render;
   vblank_in_cb vblank_in;
   vblank_out_cb vblank_out;
+  poll_input_cb poll_input;
 };
 
 struct dreamcast *dc_create();
@@ -163,6 +191,41 @@ void dc_input(struct dreamcast *dc, int port, int button, int16_t value);
 void dc_add_serial_device(struct dreamcast *dc, struct serial *serial);
 void dc_remove_serial_device(struct dreamcast *dc);
 
+/* the boot file is entered once the bios, or its hle bootstrap, has finished
+   booting the disc. once watched for after dc_load, dc_booted returns if it
+   has been, from the end of the tick it was entered during */
+void dc_watch_boot(struct dreamcast *dc);
+int dc_booted(struct dreamcast *dc);
+
+/* movies record each call to dc_input stamped with guest time, and playing one
+   back applies the same input at the same guest time, ignoring live input
+   until it finishes. like states, they must be started after dc_load, and
+   played back from the same point they were recorded from */
+int dc_record_movie(struct dreamcast *dc, const char *path);
+int dc_play_movie(struct dreamcast *dc, const char *path);
+void dc_stop_movie(struct dreamcast *dc);
+
+/* states must be saved and loaded after dc_load, between calls to dc_tick, and
+   can only be loaded into a machine running the disc they were saved with */
+int dc_save_state(struct dreamcast *dc, const char *path);
+int dc_load_state(struct dreamcast *dc, const char *path);
+
+/* the same, to and from a buffer in memory. dc_state_max_size returns a size
+   any state of the running machine fits in, and dc_save_state_buffer the size
+   written, or 0 if it didn't fit */
+int64_t dc_state_max_size(struct dreamcast *dc);
+int64_t dc_save_state_buffer(struct dreamcast *dc, void *data, int64_t size);
+int dc_load_state_buffer(struct dreamcast *dc, const void *data, int64_t size);
+
+/* the same, without guest memory, for callers that track guest memory
+   themselves */
+void dc_save_devices(struct dreamcast *dc, struct savestate *ss);
+int dc_load_devices(struct dreamcast *dc, const uint8_t *data, int64_t size);
+
+/* hash of guest memory, where any divergence between two runs of the same
+   disc with the same input ends up */
+uint64_t dc_hash_memory(struct dreamcast *dc);
+
 /* device registration */
 void *dc_create_device(struct dreamcast *dc, size_t size, const char *name,
                        device_init_cb init, device_post_init_cb post_init);
@@ -171,10 +234,13 @@ void dc_destroy_device(struct device *dev);
 
 /* client interface */
 void dc_push_audio(struct dreamcast *dc, const int16_t *data, int frames);
+int16_t *dc_reserve_audio(struct dreamcast *dc, int frames);
+void dc_commit_audio(struct dreamcast *dc, int frames);
 void dc_push_pixels(struct dreamcast *dc, const uint8_t *data, int w, int h);
 void dc_start_render(struct dreamcast *dc, struct ta_context *ctx);
 void dc_finish_render(struct dreamcast *dc);
 void dc_vblank_in(struct dreamcast *dc, int video_disabled);
 void dc_vblank_out(struct dreamcast *dc);
+void dc_poll_input(struct dreamcast *dc);
 
 #endif
@@ -1,4 +1,5 @@
 #include "core/core.h"
+#include "core/memory.h"
 #include "guest/gdrom/disc.h"
 #include "guest/gdrom/gdrom_types.h"
 
@@ -21,28 +22,46 @@ static const uint8_t cdi_start_mark[] = {0, 0, 1, 0, 0, 0, 255, 255, 255, 255};
 
 struct cdi {
   struct disc;
+  /* only open while parsing, sectors are read from the mapping */
   FILE *fp;
+  uint8_t *file;
+  size_t file_size;
   struct session sessions[DISC_MAX_SESSIONS];
   int num_sessions;
   struct track tracks[DISC_MAX_TRACKS];
   int num_tracks;
 };
 
-static void cdi_read_sector(struct disc *disc, struct track *track, int fad,
-                            void *dst) {
+static void cdi_read_sectors(struct disc *disc, struct track *track, int fad,
+                             int num_sectors, void *dst) {
   struct cdi *cdi = (struct cdi *)disc;
 
-  /* seek the to the starting fad */
-  int offset = track->file_offset + fad * track->sector_size;
-  int res = fseek(cdi->fp, offset, SEEK_SET);
-  CHECK_EQ(res, 0);
+  int64_t offset = track->file_offset + (int64_t)fad * track->sector_size;
+  int64_t size = (int64_t)num_sectors * track->sector_size;
+  CHECK(offset >= 0 && offset + size <= (int64_t)cdi->file_size,
+        "cdi_read_sectors [%d, %d) is out of bounds", fad, fad + num_sectors);
+
+  const uint8_t *src = cdi->file + offset;
+
+  /* tracks with nothing but data in each sector can be copied as one run */
+  if (!track->header_size && !track->error_size) {
+    memcpy(dst, src, num_sectors * track->data_size);
+    return;
+  }
+
+  /* else, only copy the data portion of each sector */
+  uint8_t *ptr = dst;
 
-  /* only read the data portion of the track */
-  res = fseek(cdi->fp, track->header_size, SEEK_CUR);
-  CHECK_EQ(res, 0);
+  for (int i = 0; i < num_sectors; i++) {
+    memcpy(ptr, src + track->header_size, track->data_size);
+    src += track->sector_size;
+    ptr += track->data_size;
+  }
+}
 
-  res = (int)fread(dst, 1, track->data_size, cdi->fp);
-  CHECK_EQ(res, track->data_size);
+static void cdi_read_sector(struct disc *disc, struct track *track, int fad,
+                            void *dst) {
+  cdi_read_sectors(disc, track, fad, 1, dst);
 }
 
 static void cdi_get_toc(struct disc *disc, int area, struct track **first_track,
@@ -92,13 +111,18 @@ static int cdi_get_format(struct disc *disc) {
 static void cdi_destroy(struct disc *disc) {
   struct cdi *cdi = (struct cdi *)disc;
 
+  if (cdi->file) {
+    unmap_file(cdi->file, cdi->file_size);
+  }
+
   if (cdi->fp) {
     fclose(cdi->fp);
   }
 }
 
 static int cdi_parse_track(struct disc *disc, uint32_t version,
-                           int *track_offset, int *leadout_fad, int verbose) {
+                           int64_t *track_offset, int *leadout_fad,
+                           int verbose) {
   struct cdi *cdi = (struct cdi *)disc;
   FILE *fp = cdi->fp;
 
@@ -174,7 +198,7 @@ static int cdi_parse_track(struct disc *disc, uint32_t version,
   }
 
   int sector_size = cdi_sector_sizes[sector_type];
-  int data_offset = *track_offset + pregap_len * sector_size;
+  int64_t data_offset = *track_offset + (int64_t)pregap_len * sector_size;
 
   if (!track_set_layout(track, sector_mode, sector_size)) {
     LOG_WARNING("cdi_parse unsupported track layout mode=%d size=%d",
@@ -183,24 +207,26 @@ static int cdi_parse_track(struct disc *disc, uint32_t version,
   }
 
   track->fad = pregap_len + lba;
+  track->num_sectors = track_len;
   track->adr = 0;
   track->ctrl = sector_mode == 0 ? 0 : 4;
-  track->file_offset = data_offset - track->fad * track->sector_size;
+  track->file_offset =
+      data_offset - (int64_t)track->fad * track->sector_size;
 
   if (verbose) {
-    LOG_INFO("cdi_parse_track track=%d fad=%d off=%d mode=%s/%d", track->num,
-             track->fad, data_offset, cdi_sector_modes[sector_mode],
+    LOG_INFO("cdi_parse_track track=%d fad=%d off=%" PRId64 " mode=%s/%d",
+             track->num, track->fad, data_offset, cdi_sector_modes[sector_mode],
              track->sector_size);
   }
 
-  *track_offset += total_len * sector_size;
+  *track_offset += (int64_t)total_len * sector_size;
   *leadout_fad = track->fad + track_len;
 
   return 1;
 }
 
 static int cdi_parse_session(struct disc *disc, uint32_t version,
-                             int *track_offset, int verbose) {
+                             int64_t *track_offset, int verbose) {
   struct cdi *cdi = (struct cdi *)disc;
   FILE *fp = cdi->fp;
 
@@ -317,7 +343,7 @@ static int cdi_parse(struct disc *disc, const char *filename, int verbose) {
   }
 
   /* tracks the current track's data offset from the file start */
-  int track_offset = 0;
+  int64_t track_offset = 0;
 
   while (num_sessions--) {
     if (!cdi_parse_session(disc, version, &track_offset, verbose)) {
@@ -332,6 +358,16 @@ static int cdi_parse(struct disc *disc, const char *filename, int verbose) {
     fseek(fp, offset, SEEK_CUR);
   }
 
+  /* done parsing, map the image for reading sectors */
+  fclose(cdi->fp);
+  cdi->fp = NULL;
+
+  cdi->file = map_file(filename, &cdi->file_size);
+  if (!cdi->file) {
+    LOG_WARNING("cdi_parse failed to map %s", filename);
+    return 0;
+  }
+
   return 1;
 }
 
@@ -346,6 +382,7 @@ struct disc *cdi_create(const char *filename, int verbose) {
   cdi->get_track = &cdi_get_track;
   cdi->get_toc = &cdi_get_toc;
   cdi->read_sector = &cdi_read_sector;
+  cdi->read_sectors = &cdi_read_sectors;
 
   struct disc *disc = (struct disc *)cdi;
 
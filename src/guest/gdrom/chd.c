@@ -1,7 +1,41 @@
+/*
+ * chd disc images
+ *
+ * chd images are compressed in hunks of ~8 sectors. decompressed hunks are
+ * kept in a small lru cache, so seeking back and forth between streamed
+ * audio / video and other files on the disc doesn't repeatedly decompress the
+ * same hunks
+ *
+ * when prefetching is enabled, the hunks following the one last read are
+ * queued up to be decompressed on a separate thread, so sequential reads
+ * generally find their hunk already decompressed. chd_file handles aren't
+ * thread-safe, so the prefetch thread reads through its own handle
+ */
+
 #include <chd.h>
 #include "core/core.h"
+#include "core/thread.h"
 #include "guest/gdrom/disc.h"
 #include "guest/gdrom/gdrom_types.h"
+#include "options.h"
+#include "stats.h"
+
+enum {
+  HUNK_EMPTY,
+  /* waiting to be picked up by the prefetch thread */
+  HUNK_QUEUED,
+  /* being decompressed by either thread */
+  HUNK_DECODING,
+  HUNK_READY,
+};
+
+struct chd_hunk {
+  int num;
+  int state;
+  /* value of the cache clock when last used, for lru eviction */
+  uint64_t used;
+  uint8_t *data;
+};
 
 struct chd {
   struct disc;
@@ -12,28 +46,183 @@ struct chd {
   int num_tracks;
 
   chd_file *chd;
-  /* hunk data cache */
-  uint8_t *hunkmem;
-  /* last hunknum read */
-  int oldhunk;
+
+  /* decompressed hunk cache. entries are only evicted and queued by the
+     thread reading sectors, the prefetch thread only ever moves queued
+     entries to ready */
+  struct chd_hunk *hunks;
+  int num_hunks;
+  int hunk_size;
+  uint64_t clock;
+
+  int prefetch;
+  chd_file *prefetch_chd;
+  thread_t prefetch_thread;
+  mutex_t mutex;
+  cond_t queued_cond;
+  cond_t ready_cond;
+  int shutdown;
 };
 
+static struct chd_hunk *chd_find_hunk(struct chd *chd, int num) {
+  for (int i = 0; i < chd->num_hunks; i++) {
+    struct chd_hunk *hunk = &chd->hunks[i];
+
+    if (hunk->state != HUNK_EMPTY && hunk->num == num) {
+      return hunk;
+    }
+  }
+
+  return NULL;
+}
+
+static struct chd_hunk *chd_evict_hunk(struct chd *chd) {
+  struct chd_hunk *lru = NULL;
+
+  for (int i = 0; i < chd->num_hunks; i++) {
+    struct chd_hunk *hunk = &chd->hunks[i];
+
+    if (hunk->state == HUNK_EMPTY) {
+      return hunk;
+    }
+
+    if (hunk->state == HUNK_READY && (!lru || hunk->used < lru->used)) {
+      lru = hunk;
+    }
+  }
+
+  return lru;
+}
+
+static void *chd_prefetch_thread(void *data) {
+  struct chd *chd = data;
+
+  mutex_lock(chd->mutex);
+
+  while (1) {
+    /* decompress queued hunks in order */
+    struct chd_hunk *next = NULL;
+
+    for (int i = 0; i < chd->num_hunks; i++) {
+      struct chd_hunk *hunk = &chd->hunks[i];
+
+      if (hunk->state == HUNK_QUEUED && (!next || hunk->num < next->num)) {
+        next = hunk;
+      }
+    }
+
+    if (chd->shutdown) {
+      break;
+    }
+
+    if (!next) {
+      cond_wait(chd->queued_cond, chd->mutex);
+      continue;
+    }
+
+    next->state = HUNK_DECODING;
+    mutex_unlock(chd->mutex);
+
+    int err = chd_read(chd->prefetch_chd, next->num, next->data);
+
+    mutex_lock(chd->mutex);
+
+    /* on failure, leave it to the reading thread to decompress the hunk and
+       report the error */
+    next->state = err == CHDERR_NONE ? HUNK_READY : HUNK_EMPTY;
+    cond_broadcast(chd->ready_cond);
+  }
+
+  mutex_unlock(chd->mutex);
+
+  return NULL;
+}
+
+static void chd_queue_prefetch(struct chd *chd, int hunknum) {
+  const chd_header *head = chd_get_header(chd->chd);
+  int first = hunknum + 1;
+  int last = MIN(hunknum + chd->prefetch, (int)head->totalhunks - 1);
+  int queued = 0;
+
+  /* drop queued hunks outside of the new window, e.g. after a seek */
+  for (int i = 0; i < chd->num_hunks; i++) {
+    struct chd_hunk *hunk = &chd->hunks[i];
+
+    if (hunk->state == HUNK_QUEUED && (hunk->num < first || hunk->num > last)) {
+      hunk->state = HUNK_EMPTY;
+    }
+  }
+
+  for (int num = first; num <= last; num++) {
+    if (chd_find_hunk(chd, num)) {
+      continue;
+    }
+
+    struct chd_hunk *hunk = chd_evict_hunk(chd);
+    if (!hunk) {
+      break;
+    }
+
+    hunk->num = num;
+    hunk->state = HUNK_QUEUED;
+    hunk->used = chd->clock;
+    queued = 1;
+  }
+
+  if (queued) {
+    cond_signal(chd->queued_cond);
+  }
+}
+
 static void chd_read_sector(struct disc *disc, struct track *track, int fad,
                             void *dst) {
   struct chd *chd = (struct chd *)disc;
   const chd_header *head = chd_get_header(chd->chd);
 
-  int cad = fad - track->file_offset;
+  int cad = fad - (int)track->file_offset;
   int hunknum = (cad * head->unitbytes) / head->hunkbytes;
   int hunkofs = (cad * head->unitbytes) % head->hunkbytes;
 
-  /* each hunk holds ~8 sectors, optimize when reading contiguous sectors */
-  if (hunknum != chd->oldhunk) {
-    int err = chd_read(chd->chd, hunknum, chd->hunkmem);
+  mutex_lock(chd->mutex);
+
+  struct chd_hunk *hunk = chd_find_hunk(chd, hunknum);
+
+  /* wait on the prefetch thread if it's already decompressing the hunk */
+  while (hunk && hunk->state == HUNK_DECODING) {
+    cond_wait(chd->ready_cond, chd->mutex);
+    hunk = chd_find_hunk(chd, hunknum);
+  }
+
+  /* decompress the hunk on this thread if it isn't cached, or if it's queued
+     but the prefetch thread hasn't gotten to it yet */
+  if (!hunk || hunk->state != HUNK_READY) {
+    if (!hunk) {
+      hunk = chd_evict_hunk(chd);
+      CHECK_NOTNULL(hunk);
+    }
+
+    hunk->num = hunknum;
+    hunk->state = HUNK_DECODING;
+    mutex_unlock(chd->mutex);
+
+    int err = chd_read(chd->chd, hunknum, hunk->data);
     CHECK_EQ(err, CHDERR_NONE, "chd_read_sector failed fad=%d", fad);
+
+    mutex_lock(chd->mutex);
+    hunk->state = HUNK_READY;
   }
 
-  memcpy(dst, chd->hunkmem + hunkofs + track->header_size, 2048);
+  hunk->used = ++chd->clock;
+
+  if (chd->prefetch_thread) {
+    chd_queue_prefetch(chd, hunknum);
+  }
+
+  mutex_unlock(chd->mutex);
+
+  /* the hunk can't be evicted by the prefetch thread, so it's safe to read
+     without the lock held */
+  memcpy(dst, hunk->data + hunkofs + track->header_size, 2048);
 }
 
 static void chd_get_toc(struct disc *disc, int area, struct track **first_track,
@@ -79,9 +268,45 @@ static int chd_get_format(struct disc *disc) {
 static void chd_destroy(struct disc *disc) {
   struct chd *chd = (struct chd *)disc;
 
-  free(chd->hunkmem);
+  if (chd->prefetch_thread) {
+    mutex_lock(chd->mutex);
+    chd->shutdown = 1;
+    cond_signal(chd->queued_cond);
+    mutex_unlock(chd->mutex);
+
+    void *result;
+    thread_join(chd->prefetch_thread, &result);
+  }
+
+  if (chd->prefetch_chd) {
+    chd_close(chd->prefetch_chd);
+  }
+
+  if (chd->hunks) {
+    for (int i = 0; i < chd->num_hunks; i++) {
+      free(chd->hunks[i].data);
+    }
+    free(chd->hunks);
+
+    prof_counter_add(COUNTER_mem_disc_cache,
+                     -(int64_t)chd->num_hunks * chd->hunk_size);
+  }
+
+  if (chd->ready_cond) {
+    cond_destroy(chd->ready_cond);
+  }
+
+  if (chd->queued_cond) {
+    cond_destroy(chd->queued_cond);
+  }
 
-  chd_close(chd->chd);
+  if (chd->mutex) {
+    mutex_destroy(chd->mutex);
+  }
+
+  if (chd->chd) {
+    chd_close(chd->chd);
+  }
 }
 
 static int chd_parse(struct disc *disc, const char *filename, int verbose) {
@@ -92,10 +317,38 @@ static int chd_parse(struct disc *disc, const char *filename, int verbose) {
     return 0;
   }
 
-  /* allocate storage for sector reads */
+  /* allocate the hunk cache, large enough that hunks being prefetched never
+     evict the hunk being read */
   const chd_header *head = chd_get_header(chd->chd);
-  chd->hunkmem = malloc(head->hunkbytes);
-  chd->oldhunk = -1;
+  chd->prefetch = MAX(OPTION_chd_prefetch, 0);
+  chd->num_hunks = MAX(OPTION_chd_cache, chd->prefetch + 3);
+  chd->hunks = calloc(chd->num_hunks, sizeof(struct chd_hunk));
+
+  chd->hunk_size = head->hunkbytes;
+
+  for (int i = 0; i < chd->num_hunks; i++) {
+    chd->hunks[i].data = malloc(chd->hunk_size);
+  }
+
+  prof_counter_add(COUNTER_mem_disc_cache,
+                   (int64_t)chd->num_hunks * chd->hunk_size);
+
+  chd->mutex = mutex_create();
+  chd->queued_cond = cond_create();
+  chd->ready_cond = cond_create();
+
+  if (chd->prefetch) {
+    err = chd_open(filename, CHD_OPEN_READ, 0, &chd->prefetch_chd);
+
+    if (err == CHDERR_NONE) {
+      chd->prefetch_thread =
+          thread_create(&chd_prefetch_thread, "chd_prefetch", chd);
+      CHECK_NOTNULL(chd->prefetch_thread);
+    } else {
+      LOG_WARNING("chd_parse failed to open %s for prefetching", filename);
+      chd->prefetch_chd = NULL;
+    }
+  }
 
   /* parse tracks */
   char tmp[512];
@@ -179,6 +432,7 @@ static int chd_parse(struct disc *disc, const char *filename, int verbose) {
 
     track->num = chd->num_tracks;
     track->fad = fad;
+    track->num_sectors = frames;
     track->ctrl = strcmp(type, "AUDIO") == 0 ? 0 : 4;
     track->file_offset = fad - cad;
 
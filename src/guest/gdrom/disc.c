@@ -1,9 +1,13 @@
 #include "guest/gdrom/disc.h"
 #include "core/core.h"
+#include "core/hash.h"
+#include "core/xxhash.h"
 #include "guest/gdrom/cdi.h"
 #include "guest/gdrom/chd.h"
 #include "guest/gdrom/gdi.h"
 #include "guest/gdrom/iso.h"
+#include "guest/gdrom/rdz.h"
+#include "guest/gdrom/remote.h"
 
 /* ip.bin layout */
 #define IP_OFFSET_META 0x0000    /* meta information */
@@ -13,6 +17,22 @@
 #define IP_OFFSET_BOOT1 0x3800   /* bootstrap 1 */
 #define IP_OFFSET_BOOT2 0x6000   /* bootstrap 2 */
 
+/* iso 9660 allows directories to be nested up to 8 levels deep */
+#define ISO_MAX_DEPTH 8
+
+struct disc_file {
+  char path[DISC_MAX_PATH];
+  uint64_t hash;
+  int fad;
+  int len;
+  struct list_node it;
+};
+
+struct disc_index {
+  DECLARE_HASHTABLE(files, 10);
+  int num_files;
+};
+
 /* meta information found in the ip.bin */
 struct disc_meta {
   char hwareid[DISC_HWAREID_SIZE];
@@ -153,6 +173,18 @@ int disc_read_sectors(struct disc *disc, int fad, int num_sectors,
   int read = 0;
   int endfad = fad + num_sectors;
 
+  if (disc->read_sectors) {
+    CHECK_LE(num_sectors * track->data_size, dst_size);
+    disc->read_sectors(disc, track, fad, num_sectors, dst);
+
+    for (int i = fad; i < endfad; i++) {
+      disc_patch_sector(disc, i, dst + read);
+      read += track->data_size;
+    }
+
+    return read;
+  }
+
   for (int i = fad; i < endfad; i++) {
     CHECK_LE(read + track->data_size, dst_size);
     disc->read_sector(disc, track, i, dst + read);
@@ -165,63 +197,174 @@ int disc_read_sectors(struct disc *disc, int fad, int num_sectors,
   return read;
 }
 
-int disc_find_file(struct disc *disc, const char *filename, int *fad,
-                   int *len) {
-  uint8_t tmp[0x10000];
+/* paths are stored upper case, without leading separators or version
+   suffixes */
+static void disc_normalize_path(const char *path, int len, char *out,
+                                int size) {
+  int n = 0;
 
-  /* get the session for the main data track */
-  struct session *session = disc_get_session(disc, 1);
-  struct track *track = disc_get_track(disc, session->first_track);
+  while (len && *path == '/') {
+    path++;
+    len--;
+  }
 
-  /* read primary volume descriptor */
-  int read = disc_read_sectors(disc, track->fad + ISO_PVD_SECTOR, 1,
-                               GD_SECTOR_ANY, GD_MASK_DATA, tmp, sizeof(tmp));
-  if (!read) {
-    return 0;
+  for (int i = 0; i < len && path[i] && path[i] != ';'; i++) {
+    if (n < size - 1) {
+      out[n++] = toupper(path[i]);
+    }
   }
 
-  struct iso_pvd *pvd = (struct iso_pvd *)tmp;
-  CHECK(pvd->type == 1);
-  CHECK(memcmp(pvd->id, "CD001", 5) == 0);
-  CHECK(pvd->version == 1);
+  /* names without extensions are recorded with a trailing period */
+  while (n && (out[n - 1] == '.' || out[n - 1] == ' ')) {
+    n--;
+  }
 
-  /* check root directory for the file
-     FIXME recurse subdirectories */
-  struct iso_dir *root = &pvd->root_directory_record;
-  int root_len = root->size.le;
-  int root_fad = GDROM_PREGAP + root->extent.le;
-  read = disc_read_bytes(disc, root_fad, root_len, tmp, sizeof(tmp));
-  if (!read) {
-    return 0;
+  out[n] = 0;
+}
+
+static struct disc_file *disc_index_lookup(struct disc_index *index,
+                                           const char *path) {
+  uint64_t hash = xxh64(path, strlen(path), 0);
+  struct list *bkt = hash_bkt(index->files, hash);
+
+  hash_bkt_for_each_entry(file, bkt, struct disc_file, it) {
+    if (file->hash == hash && !strcmp(file->path, path)) {
+      return file;
+    }
+  }
+
+  return NULL;
+}
+
+static void disc_index_add(struct disc_index *index, const char *path, int fad,
+                           int len) {
+  struct disc_file *file = calloc(1, sizeof(struct disc_file));
+  snprintf(file->path, sizeof(file->path), "%s", path);
+  file->hash = xxh64(file->path, strlen(file->path), 0);
+  file->fad = fad;
+  file->len = len;
+
+  struct list *bkt = hash_bkt(index->files, file->hash);
+  hash_add(bkt, &file->it);
+  index->num_files++;
+}
+
+static void disc_index_dir(struct disc *disc, struct disc_index *index,
+                           const char *prefix, int fad, int len, int depth) {
+  if (depth >= ISO_MAX_DEPTH) {
+    LOG_WARNING("disc_index_dir %s is nested too deeply", prefix);
+    return;
+  }
+
+  uint8_t *data = malloc(len);
+  if (!disc_read_bytes(disc, fad, len, data, len)) {
+    free(data);
+    return;
   }
 
-  uint8_t *ptr = tmp;
-  uint8_t *end = tmp + root_len;
-  struct iso_dir *found = NULL;
+  uint8_t *ptr = data;
+  uint8_t *end = data + len;
 
-  while (ptr < end) {
+  while (ptr + sizeof(struct iso_dir) <= end) {
     struct iso_dir *dir = (struct iso_dir *)ptr;
 
+    /* records don't span sectors, the rest of the sector is zero padded */
     if (!dir->length) {
-      /* no more entries */
-      break;
+      int offset = (int)(ptr - data);
+      ptr = data + ALIGN_UP(offset + 1, 2048);
+      continue;
     }
 
-    const char *name = (const char *)(ptr + sizeof(*dir));
-    if (memcmp(name, filename, strlen(filename)) == 0) {
-      found = dir;
+    ptr += dir->length;
+
+    if (ptr > end || dir->name_len + sizeof(*dir) > dir->length) {
       break;
     }
 
-    ptr += dir->length;
+    /* skip the entries for the current and parent directories */
+    const char *name = (const char *)dir + sizeof(*dir);
+    if (dir->name_len == 1 && (name[0] == 0 || name[0] == 1)) {
+      continue;
+    }
+
+    char base[DISC_MAX_PATH];
+    char path[DISC_MAX_PATH];
+    disc_normalize_path(name, dir->name_len, base, sizeof(base));
+    snprintf(path, sizeof(path), "%s%s%s", prefix, prefix[0] ? "/" : "", base);
+
+    int entry_fad = GDROM_PREGAP + dir->extent.le;
+    int entry_len = dir->size.le;
+
+    if (dir->file_flags & ISO_DIRECTORY) {
+      disc_index_dir(disc, index, path, entry_fad, entry_len, depth + 1);
+    } else if (!disc_index_lookup(index, path)) {
+      disc_index_add(index, path, entry_fad, entry_len);
+    }
+  }
+
+  free(data);
+}
+
+static void disc_destroy_index(struct disc *disc) {
+  struct disc_index *index = disc->index;
+
+  if (!index) {
+    return;
+  }
+
+  for (int i = 0; i < HASH_SIZE(index->files); i++) {
+    list_for_each_entry_safe(file, &index->files[i], struct disc_file, it) {
+      free(file);
+    }
   }
 
-  if (!found) {
+  free(index);
+  disc->index = NULL;
+}
+
+static void disc_build_index(struct disc *disc) {
+  struct disc_index *index = calloc(1, sizeof(struct disc_index));
+  disc->index = index;
+
+  /* get the session for the main data track */
+  struct session *session = disc_get_session(disc, 1);
+  struct track *track = disc_get_track(disc, session->first_track);
+
+  /* read primary volume descriptor */
+  uint8_t tmp[DISC_MAX_SECTOR_SIZE];
+  int read = disc_read_sectors(disc, track->fad + ISO_PVD_SECTOR, 1,
+                               GD_SECTOR_ANY, GD_MASK_DATA, tmp, sizeof(tmp));
+  if (!read) {
+    return;
+  }
+
+  struct iso_pvd *pvd = (struct iso_pvd *)tmp;
+  if (pvd->type != 1 || memcmp(pvd->id, "CD001", 5) || pvd->version != 1) {
+    LOG_WARNING("disc_build_index no primary volume descriptor found");
+    return;
+  }
+
+  struct iso_dir *root = &pvd->root_directory_record;
+  disc_index_dir(disc, index, "", GDROM_PREGAP + root->extent.le,
+                 root->size.le, 0);
+}
+
+int disc_find_file(struct disc *disc, const char *filename, int *fad,
+                   int *len) {
+  if (!disc->index) {
+    disc_build_index(disc);
+  }
+
+  char path[DISC_MAX_PATH];
+  disc_normalize_path(filename, (int)strlen(filename), path, sizeof(path));
+
+  struct disc_file *file = disc_index_lookup(disc->index, path);
+  if (!file) {
     return 0;
   }
 
-  *fad = GDROM_PREGAP + found->extent.le;
-  *len = found->size.le;
+  *fad = file->fad;
+  *len = file->len;
 
   return 1;
 }
@@ -276,19 +419,47 @@ int disc_get_format(struct disc *disc) {
   return disc->get_format(disc);
 }
 
+int disc_in_list(struct disc *disc, const char *list) {
+  if (!disc || !disc->prodnum[0]) {
+    return 0;
+  }
+
+  int len = (int)strlen(disc->prodnum);
+  const char *ptr = list;
+
+  while ((ptr = strstr(ptr, disc->prodnum))) {
+    int start = ptr == list || ptr[-1] == ',' || ptr[-1] == ' ';
+    int end = !ptr[len] || ptr[len] == ',' || ptr[len] == ' ';
+
+    if (start && end) {
+      return 1;
+    }
+
+    ptr += len;
+  }
+
+  return 0;
+}
+
 void disc_destroy(struct disc *disc) {
+  disc_destroy_index(disc);
   disc->destroy(disc);
 }
 
 struct disc *disc_create(const char *filename, int verbose) {
   struct disc *disc = NULL;
 
-  if (strstr(filename, ".cdi")) {
+  /* urls are checked first, as they likely end in one of the extensions */
+  if (!strncmp(filename, "http://", 7) || !strncmp(filename, "https://", 8)) {
+    disc = remote_create(filename, verbose);
+  } else if (strstr(filename, ".cdi")) {
     disc = cdi_create(filename, verbose);
   } else if (strstr(filename, ".chd")) {
     disc = chd_create(filename, verbose);
   } else if (strstr(filename, ".gdi")) {
     disc = gdi_create(filename, verbose);
+  } else if (strstr(filename, ".rdz")) {
+    disc = rdz_create(filename, verbose);
   }
 
   if (!disc) {
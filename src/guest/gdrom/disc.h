@@ -8,6 +8,7 @@
 #define DISC_MAX_SESSIONS 2
 #define DISC_MAX_TRACKS 128
 #define DISC_UID_SIZE 256
+#define DISC_MAX_PATH 256
 
 #define DISC_HWAREID_SIZE 16
 #define DISC_MAKERID_SIZE 16
@@ -32,6 +33,8 @@ struct track {
   int num;
   /* frame adddress, equal to lba + 150 */
   int fad;
+  /* number of sectors backed by the image */
+  int num_sectors;
   /* type of information encoded in the sub q channel */
   int adr;
   /* type of track */
@@ -44,7 +47,7 @@ struct track {
   int data_size;
   /* backing file */
   char filename[PATH_MAX];
-  int file_offset;
+  int64_t file_offset;
 };
 
 struct session {
@@ -54,7 +57,12 @@ struct session {
   int last_track;
 };
 
+struct disc_index;
+
 struct disc {
+  /* index of the iso filesystem's paths, built on first use */
+  struct disc_index *index;
+
   /* information about the IP.BIN location on disc, cached to quickly patch
      region information */
   int meta_fad;
@@ -83,6 +91,8 @@ struct disc {
   void (*get_toc)(struct disc *, int, struct track **, struct track **, int *,
                   int *);
   void (*read_sector)(struct disc *, struct track *, int, void *);
+  /* optional, reads a run of sectors from the same track at once */
+  void (*read_sectors)(struct disc *, struct track *, int, int, void *);
 };
 
 struct disc *disc_create(const char *filename, int verbose);
@@ -97,6 +107,9 @@ struct track *disc_lookup_track(struct disc *disc, int fad);
 void disc_get_toc(struct disc *disc, int area, struct track **first_track,
                   struct track **last_track, int *leadin_fad, int *leadout_fad);
 
+/* look up a file by its path from the root directory, e.g. "1ST_READ.BIN" or
+   "DATA/STAGE1.BIN". paths are case-insensitive, and version suffixes are
+   optional */
 int disc_find_file(struct disc *disc, const char *filename, int *fad, int *len);
 int disc_read_sectors(struct disc *disc, int fad, int num_sectors,
                       int sector_fmt, int sector_mask, uint8_t *dst,
@@ -104,6 +117,9 @@ int disc_read_sectors(struct disc *disc, int fad, int num_sectors,
 int disc_read_bytes(struct disc *disc, int fad, int len, uint8_t *dst,
                     int dst_size);
 
+/* check if the disc's product number is in a comma separated list of them */
+int disc_in_list(struct disc *disc, const char *list);
+
 int track_set_layout(struct track *track, int sector_mode, int sector_size);
 
 #endif
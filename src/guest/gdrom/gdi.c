@@ -1,44 +1,56 @@
 #include "guest/gdrom/gdi.h"
 #include "core/core.h"
+#include "core/memory.h"
 #include "guest/gdrom/disc.h"
 
 struct gdi {
   struct disc;
-  FILE *files[DISC_MAX_TRACKS];
+  /* read-only mappings of the files backing each track */
+  uint8_t *files[DISC_MAX_TRACKS];
+  size_t file_sizes[DISC_MAX_TRACKS];
   struct session sessions[DISC_MAX_SESSIONS];
   int num_sessions;
   struct track tracks[DISC_MAX_TRACKS];
   int num_tracks;
 };
 
-static void gdi_read_sector(struct disc *disc, struct track *track, int fad,
-                            void *dst) {
-  struct gdi *gdi = (struct gdi *)disc;
-
+static const uint8_t *gdi_map_sectors(struct gdi *gdi, struct track *track,
+                                      int fad, int num_sectors) {
   int n = (int)(track - gdi->tracks);
-  FILE *fp = gdi->files[n];
+  uint8_t *file = gdi->files[n];
 
-  /* lazily open the file backing the track */
-  if (!fp) {
-    fp = fopen(track->filename, "rb");
-    CHECK_NOTNULL(fp, "gdi_read_sector failed to open %s", track->filename);
-    gdi->files[n] = fp;
-  }
+  int64_t offset = track->file_offset + (int64_t)fad * track->sector_size;
+  int64_t size = (int64_t)num_sectors * track->sector_size;
+  CHECK(offset >= 0 && offset + size <= (int64_t)gdi->file_sizes[n],
+        "gdi_map_sectors [%d, %d) is out of bounds", fad, fad + num_sectors);
 
-  /* seek the to the starting fad */
-  int offset = track->file_offset + fad * track->sector_size;
-  int res = fseek(fp, offset, SEEK_SET);
-  CHECK_EQ(res, 0);
+  return file + offset;
+}
+
+static void gdi_read_sectors(struct disc *disc, struct track *track, int fad,
+                             int num_sectors, void *dst) {
+  struct gdi *gdi = (struct gdi *)disc;
+  const uint8_t *src = gdi_map_sectors(gdi, track, fad, num_sectors);
+
+  /* tracks with nothing but data in each sector can be copied as one run */
+  if (!track->header_size && !track->error_size) {
+    memcpy(dst, src, num_sectors * track->data_size);
+    return;
+  }
 
-  /* only read the data portion of the track */
-  res = fseek(fp, track->header_size, SEEK_CUR);
-  CHECK_EQ(res, 0);
+  /* else, only copy the data portion of each sector */
+  uint8_t *ptr = dst;
 
-  res = (int)fread(dst, 1, track->data_size, fp);
-  CHECK_EQ(res, track->data_size);
+  for (int i = 0; i < num_sectors; i++) {
+    memcpy(ptr, src + track->header_size, track->data_size);
+    src += track->sector_size;
+    ptr += track->data_size;
+  }
+}
 
-  res = fseek(fp, track->error_size, SEEK_CUR);
-  CHECK_EQ(res, 0);
+static void gdi_read_sector(struct disc *disc, struct track *track, int fad,
+                            void *dst) {
+  gdi_read_sectors(disc, track, fad, 1, dst);
 }
 
 static void gdi_get_toc(struct disc *disc, int area, struct track **first_track,
@@ -84,12 +96,12 @@ static int gdi_get_format(struct disc *disc) {
 static void gdi_destroy(struct disc *disc) {
   struct gdi *gdi = (struct gdi *)disc;
 
-  /* cleanup file handles */
+  /* cleanup file mappings */
   for (int i = 0; i < gdi->num_tracks; i++) {
-    FILE *fp = gdi->files[i];
+    uint8_t *file = gdi->files[i];
 
-    if (fp) {
-      fclose(fp);
+    if (file) {
+      unmap_file(file, gdi->file_sizes[i]);
     }
   }
 }
@@ -115,7 +127,8 @@ static int gdi_parse(struct disc *disc, const char *filename, int verbose) {
   }
 
   for (int i = 0; i < num_tracks; i++) {
-    int num, lba, ctrl, sector_size, file_offset;
+    int num, lba, ctrl, sector_size;
+    int64_t file_offset;
     char filename[PATH_MAX];
 
     /* parse track information, including filenames which may include single or
@@ -134,7 +147,7 @@ static int gdi_parse(struct disc *disc, const char *filename, int verbose) {
       }
     }
 
-    n = fscanf(fp, " %d", &file_offset);
+    n = fscanf(fp, " %" SCNd64, &file_offset);
     parse_err |= (n != 1);
 
     if (parse_err) {
@@ -159,10 +172,23 @@ static int gdi_parse(struct disc *disc, const char *filename, int verbose) {
     track->num = gdi->num_tracks;
     track->fad = lba + GDROM_PREGAP;
     track->ctrl = ctrl;
-    track->file_offset = file_offset - track->fad * track->sector_size;
+    track->file_offset =
+        file_offset - (int64_t)track->fad * track->sector_size;
     snprintf(track->filename, sizeof(track->filename), "%s" PATH_SEPARATOR "%s",
              dirname, filename);
 
+    /* map the file backing the track, its size gives the track's length */
+    gdi->files[i] = map_file(track->filename, &gdi->file_sizes[i]);
+
+    if (!gdi->files[i]) {
+      LOG_WARNING("gdi_parse failed to map %s", track->filename);
+      fclose(fp);
+      return 0;
+    }
+
+    track->num_sectors =
+        (int)(((int64_t)gdi->file_sizes[i] - file_offset) / sector_size);
+
     if (verbose) {
       LOG_INFO("gdi_parse track=%d filename='%s' fad=%d secsz=%d", track->num,
                track->filename, track->fad, track->sector_size);
@@ -205,6 +231,7 @@ struct disc *gdi_create(const char *filename, int verbose) {
   gdi->get_track = &gdi_get_track;
   gdi->get_toc = &gdi_get_toc;
   gdi->read_sector = &gdi_read_sector;
+  gdi->read_sectors = &gdi_read_sectors;
 
   struct disc *disc = (struct disc *)gdi;
 
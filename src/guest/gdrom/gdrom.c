@@ -3,8 +3,13 @@
 #include "guest/dreamcast.h"
 #include "guest/gdrom/gdrom_replies.inc"
 #include "guest/gdrom/gdrom_types.h"
+#include "guest/gdrom/preload.h"
+#include "guest/gdrom/readahead.h"
 #include "guest/holly/holly.h"
+#include "guest/savestate.h"
+#include "guest/scheduler.h"
 #include "imgui.h"
+#include "options.h"
 
 #if 0
 #define LOG_GDROM LOG_INFO
@@ -12,6 +17,18 @@
 #define LOG_GDROM(...)
 #endif
 
+/* in accurate mode, the drive is modelled as transferring sectors at a
+   constant rate, roughly the average of the 12x cav drive across the disc,
+   with seeks taking a fixed time to settle plus a time proportional to the
+   distance travelled */
+#define GD_SECTORS_PER_SEC (75 * 10)
+#define GD_SEEK_MIN_NS (NS_PER_MS * 20)
+#define GD_SEEK_MAX_NS (NS_PER_MS * 200)
+#define GD_MAX_FAD 0x861b4
+
+/* max number of sectors filled into the dma buffer at once */
+#define GD_MAX_DMA_SECTORS 512
+
 /* internal gdrom state machine */
 enum gd_event {
   EVENT_ATA_CMD,
@@ -28,6 +45,7 @@ enum gd_state {
   STATE_READ_SPI_DATA,
   STATE_WRITE_SPI_DATA,
   STATE_WRITE_DMA_DATA,
+  STATE_READ_DISC,
   MAX_STATES,
 };
 
@@ -47,6 +65,7 @@ gd_event_cb gd_transitions[MAX_STATES][MAX_EVENTS] = {
   { &gdrom_ata_cmd, &gdrom_pio_write, NULL,           NULL,            &gdrom_spi_data, },
   { &gdrom_ata_cmd, NULL,             NULL,           &gdrom_pio_read, NULL,            },
   { &gdrom_ata_cmd, NULL,             NULL,           NULL,            NULL,            },
+  { &gdrom_ata_cmd, NULL,             NULL,           NULL,            NULL,            },
 };
 /* clang-format on */
 
@@ -56,6 +75,21 @@ struct gdrom {
   enum gd_state state;
   struct gd_hw_info hw_info;
   struct disc *disc;
+  /* sectors are read from the preloaded disc once loaded, and otherwise
+     through the read-ahead buffer. the disc itself is only accessed by one
+     thread at a time */
+  struct preload *preload;
+  struct readahead *readahead;
+  mutex_t disc_mutex;
+
+  /* sector reads are logged here when tracing, to be replayed by rebench */
+  FILE *trace;
+
+  /* when accurate, cd reads complete after the time it'd take the drive to
+     seek to and read the sectors, else they complete immediately */
+  int accurate;
+  int head_fad;
+  struct timer *read_timer;
 
   /* internal registers */
   union gd_error error;
@@ -79,7 +113,7 @@ struct gdrom {
   int pio_offset;
 
   /* dma state */
-  uint8_t dma_buffer[0x10000];
+  uint8_t dma_buffer[GD_MAX_DMA_SECTORS * DISC_MAX_SECTOR_SIZE];
   int dma_head;
   int dma_size;
 };
@@ -114,31 +148,69 @@ static void gdrom_spi_end(struct gdrom *gd) {
   gd->state = STATE_READ_ATA_CMD;
 }
 
-static void gdrom_spi_cdread(struct gdrom *gd) {
+static int gdrom_cdread_sectors(struct gdrom *gd) {
+  int size = gd->cdr_dma ? sizeof(gd->dma_buffer) : sizeof(gd->pio_buffer);
+  return MIN(gd->cdr_num_sectors, size / DISC_MAX_SECTOR_SIZE);
+}
+
+static void gdrom_dma_fill(struct gdrom *gd) {
+  /* fill DMA buffer with as many sectors as possible */
+  int num_sectors = gdrom_cdread_sectors(gd);
+  int res = gdrom_read_sectors(gd, gd->cdr_first_sector, num_sectors,
+                               gd->cdr_secfmt, gd->cdr_secmask, gd->dma_buffer,
+                               sizeof(gd->dma_buffer));
+  gd->dma_size = res;
+  gd->dma_head = 0;
+
+  /* update sector read state */
+  gd->cdr_first_sector += num_sectors;
+  gd->cdr_num_sectors -= num_sectors;
+}
+
+static int gdrom_dma_direct(struct gdrom *gd, uint8_t *data, int n) {
+  /* only sectors containing nothing but user data have a known size */
+  if (!gd->disc || gd->cdr_secmask != GD_MASK_DATA) {
+    return 0;
+  }
+
+  struct track *track = disc_lookup_track(gd->disc, gd->cdr_first_sector);
+
+  if (!track) {
+    return 0;
+  }
+
+  /* read as many whole sectors as fit, without crossing into the next track */
+  int track_end = track->fad + track->num_sectors;
+  int num_sectors = MIN(gd->cdr_num_sectors, n / track->data_size);
+  num_sectors = MIN(num_sectors, track_end - gd->cdr_first_sector);
+
+  if (num_sectors <= 0) {
+    return 0;
+  }
+
+  int res = gdrom_read_sectors(gd, gd->cdr_first_sector, num_sectors,
+                               gd->cdr_secfmt, gd->cdr_secmask, data, n);
+
+  /* update sector read state */
+  gd->cdr_first_sector += num_sectors;
+  gd->cdr_num_sectors -= num_sectors;
+
+  return res;
+}
+
+static void gdrom_cdread_fill(struct gdrom *gd) {
   struct holly *hl = gd->dc->holly;
 
   if (gd->cdr_dma) {
-    int max_dma_sectors = sizeof(gd->dma_buffer) / DISC_MAX_SECTOR_SIZE;
-
-    /* fill DMA buffer with as many sectors as possible */
-    int num_sectors = MIN(gd->cdr_num_sectors, max_dma_sectors);
-    int res = gdrom_read_sectors(gd, gd->cdr_first_sector, num_sectors,
-                                 gd->cdr_secfmt, gd->cdr_secmask,
-                                 gd->dma_buffer, sizeof(gd->dma_buffer));
-    gd->dma_size = res;
+    /* sectors are read as the transfer consumes them, see gdrom_dma_read */
+    gd->dma_size = 0;
     gd->dma_head = 0;
 
-    /* update sector read state */
-    gd->cdr_first_sector += num_sectors;
-    gd->cdr_num_sectors -= num_sectors;
-
     /* gdrom state won't be updated until DMA transfer is completed */
     gd->state = STATE_WRITE_DMA_DATA;
   } else {
-    int max_pio_sectors = sizeof(gd->pio_buffer) / DISC_MAX_SECTOR_SIZE;
-
     /* fill PIO buffer with as many sectors as possible */
-    int num_sectors = MIN(gd->cdr_num_sectors, max_pio_sectors);
+    int num_sectors = gdrom_cdread_sectors(gd);
     int res = gdrom_read_sectors(gd, gd->cdr_first_sector, num_sectors,
                                  gd->cdr_secfmt, gd->cdr_secmask,
                                  gd->pio_buffer, sizeof(gd->pio_buffer));
@@ -162,6 +234,51 @@ static void gdrom_spi_cdread(struct gdrom *gd) {
   }
 }
 
+static void gdrom_cdread_timer(void *data) {
+  struct gdrom *gd = data;
+  struct holly *hl = gd->dc->holly;
+
+  gd->read_timer = NULL;
+
+  gdrom_cdread_fill(gd);
+
+  /* start any dma transfer that was waiting on the sectors */
+  if (gd->cdr_dma) {
+    holly_resume_gdrom_dma(hl);
+  }
+}
+
+static void gdrom_cancel_read(struct gdrom *gd) {
+  struct scheduler *sched = gd->dc->sched;
+
+  if (gd->read_timer) {
+    sched_cancel_timer(sched, gd->read_timer);
+    gd->read_timer = NULL;
+  }
+}
+
+static void gdrom_spi_cdread(struct gdrom *gd) {
+  struct scheduler *sched = gd->dc->sched;
+
+  if (!gd->accurate) {
+    gdrom_cdread_fill(gd);
+    return;
+  }
+
+  /* dma transfers aren't paced by the drive once started, so the time to read
+     the entire request is spent before the first sector is available */
+  int num_sectors =
+      gd->cdr_dma ? gd->cdr_num_sectors : gdrom_cdread_sectors(gd);
+  int64_t delay = gdrom_access_time(gd, gd->cdr_first_sector, num_sectors);
+
+  gd->status.DRQ = 0;
+  gd->status.BSY = 1;
+  gd->state = STATE_READ_DISC;
+
+  CHECK(!gd->read_timer);
+  gd->read_timer = sched_start_timer(sched, &gdrom_cdread_timer, gd, delay);
+}
+
 static void gdrom_spi_read(struct gdrom *gd, int offset, int size) {
   struct holly *hl = gd->dc->holly;
 
@@ -545,6 +662,9 @@ static void gdrom_ata_cmd(struct gdrom *gd, int cmd) {
 
   LOG_GDROM("gdrom_ata_cmd 0x%x", cmd);
 
+  /* a new command aborts any read in progress */
+  gdrom_cancel_read(gd);
+
   gd->status.DRDY = 0;
   gd->status.BSY = 1;
 
@@ -634,7 +754,11 @@ int gdrom_read_bytes(struct gdrom *gd, int fad, int len, uint8_t *dst,
     return 0;
   }
 
-  return disc_read_bytes(gd->disc, fad, len, dst, dst_size);
+  mutex_lock(gd->disc_mutex);
+  int read = disc_read_bytes(gd->disc, fad, len, dst, dst_size);
+  mutex_unlock(gd->disc_mutex);
+
+  return read;
 }
 
 int gdrom_read_sectors(struct gdrom *gd, int fad, int num_sectors, int fmt,
@@ -646,21 +770,47 @@ int gdrom_read_sectors(struct gdrom *gd, int fad, int num_sectors, int fmt,
 
   LOG_GDROM("gdrom_read_sectors [%d, %d)", fad, fad + num_sectors);
 
-  return disc_read_sectors(gd->disc, fad, num_sectors, fmt, mask, dst,
-                           dst_size);
+  if (gd->trace) {
+    fprintf(gd->trace, "%d %d %d %d\n", fad, num_sectors, fmt, mask);
+  }
+
+  if (gd->preload) {
+    int res = preload_read_sectors(gd->preload, fad, num_sectors, fmt, mask,
+                                   dst, dst_size);
+    if (res) {
+      return res;
+    }
+  }
+
+  return readahead_read_sectors(gd->readahead, fad, num_sectors, fmt, mask,
+                                dst, dst_size);
+}
+
+int gdrom_prefetch_sectors(struct gdrom *gd, int fad, int num_sectors) {
+  if (!gd->disc) {
+    return 1;
+  }
+
+  return readahead_prefetch(gd->readahead, fad, num_sectors);
 }
 
 int gdrom_find_file(struct gdrom *gd, const char *filename, int *fad,
                     int *len) {
   CHECK_NOTNULL(gd->disc);
 
-  return disc_find_file(gd->disc, filename, fad, len);
+  mutex_lock(gd->disc_mutex);
+  int res = disc_find_file(gd->disc, filename, fad, len);
+  mutex_unlock(gd->disc_mutex);
+
+  return res;
 }
 
 void gdrom_get_bootfile(struct gdrom *gd, int *fad, int *len) {
   CHECK_NOTNULL(gd->disc);
 
+  mutex_lock(gd->disc_mutex);
   int res = disc_find_file(gd->disc, gd->disc->bootnme, fad, len);
+  mutex_unlock(gd->disc_mutex);
   CHECK(res);
 }
 
@@ -786,15 +936,52 @@ int gdrom_is_busy(struct gdrom *gd) {
   return gd->status.BSY;
 }
 
+int gdrom_dma_ready(struct gdrom *gd) {
+  return gd->state != STATE_READ_DISC;
+}
+
+int64_t gdrom_access_time(struct gdrom *gd, int fad, int num_sectors) {
+  if (!gd->accurate) {
+    return 0;
+  }
+
+  /* no seek is needed when reading on from the previous read */
+  int64_t seek = 0;
+
+  if (fad != gd->head_fad) {
+    int64_t distance = ABS(fad - gd->head_fad);
+    seek = GD_SEEK_MIN_NS +
+           (GD_SEEK_MAX_NS - GD_SEEK_MIN_NS) * MIN(distance, GD_MAX_FAD) /
+               GD_MAX_FAD;
+  }
+
+  int64_t transfer = (int64_t)num_sectors * NS_PER_SEC / GD_SECTORS_PER_SEC;
+
+  gd->head_fad = fad + num_sectors;
+
+  return seek + transfer;
+}
+
 void gdrom_dma_end(struct gdrom *gd) {
   LOG_GDROM("gd_dma_end");
 }
 
 int gdrom_dma_read(struct gdrom *gd, uint8_t *data, int n) {
-  /* read more if the current dma buffer has been completely exhausted */
+  /* read more if the current dma buffer has been completely exhausted. the
+     time taken to read these was already accounted for when the request was
+     made, so they're read immediately */
   if (gd->dma_head >= gd->dma_size) {
     if (gd->cdr_num_sectors) {
-      gdrom_spi_cdread(gd);
+      /* when the destination has room for whole sectors, decode them straight
+         into it rather than through the dma buffer */
+      int res = gdrom_dma_direct(gd, data, n);
+
+      if (res) {
+        LOG_GDROM("gdrom_dma_read %d bytes direct", res);
+        return res;
+      }
+
+      gdrom_dma_fill(gd);
     } else {
       gdrom_spi_end(gd);
     }
@@ -813,18 +1000,71 @@ int gdrom_dma_read(struct gdrom *gd, uint8_t *data, int n) {
 }
 
 void gdrom_dma_begin(struct gdrom *gd) {
-  CHECK(gd->dma_size);
+  CHECK(gd->dma_head < gd->dma_size || gd->cdr_num_sectors);
 
   LOG_GDROM("gd_dma_begin");
 }
 
+static void gdrom_open_trace(struct gdrom *gd) {
+  gd->trace = fopen(OPTION_gdrom_trace, "w");
+
+  if (!gd->trace) {
+    LOG_WARNING("gdrom_open_trace failed to open %s", OPTION_gdrom_trace);
+    return;
+  }
+
+  fprintf(gd->trace, "# %s %s\n", gd->disc->prodnum, gd->disc->prodnme);
+}
+
 void gdrom_set_disc(struct gdrom *gd, struct disc *disc) {
+  gdrom_cancel_read(gd);
+
   if (gd->disc != disc) {
+    /* stop reading from the old disc before destroying it */
+    if (gd->preload) {
+      preload_destroy(gd->preload);
+      gd->preload = NULL;
+    }
+
+    if (gd->readahead) {
+      readahead_destroy(gd->readahead);
+      gd->readahead = NULL;
+    }
+
+    if (gd->trace) {
+      fclose(gd->trace);
+      gd->trace = NULL;
+    }
+
     if (gd->disc) {
       disc_destroy(gd->disc);
     }
 
     gd->disc = disc;
+
+    if (gd->disc) {
+      gd->readahead = readahead_create(gd->disc, gd->disc_mutex,
+                                       OPTION_gdrom_readahead);
+
+      if (*OPTION_gdrom_trace) {
+        gdrom_open_trace(gd);
+      }
+
+      if (OPTION_disc_preload) {
+        gd->preload = preload_create(gd->disc, gd->disc_mutex);
+      }
+    }
+
+    /* titles can be listed to override the default timing mode */
+    if (disc_in_list(gd->disc, OPTION_gdrom_accurate)) {
+      gd->accurate = 1;
+    } else if (disc_in_list(gd->disc, OPTION_gdrom_instant)) {
+      gd->accurate = 0;
+    } else {
+      gd->accurate = !strcmp(OPTION_gdrom_timing, "accurate");
+    }
+
+    gd->head_fad = 0;
   }
 
   /* perform "soft reset" of internal state */
@@ -849,17 +1089,113 @@ struct disc *gdrom_get_disc(struct gdrom *gd) {
   return gd->disc;
 }
 
+static void gdrom_save(struct device *dev, struct savestate *ss) {
+  struct gdrom *gd = (struct gdrom *)dev;
+  struct scheduler *sched = gd->dc->sched;
+
+  SS_WRITE(ss, gd->state);
+  SS_WRITE(ss, gd->hw_info);
+  SS_WRITE(ss, gd->head_fad);
+  ss_write_timer(ss, sched, gd->read_timer);
+
+  SS_WRITE(ss, gd->error);
+  SS_WRITE(ss, gd->features);
+  SS_WRITE(ss, gd->ireason);
+  SS_WRITE(ss, gd->sectnum);
+  SS_WRITE(ss, gd->byte_count);
+  SS_WRITE(ss, gd->status);
+
+  SS_WRITE(ss, gd->cdr_dma);
+  SS_WRITE(ss, gd->cdr_secfmt);
+  SS_WRITE(ss, gd->cdr_secmask);
+  SS_WRITE(ss, gd->cdr_first_sector);
+  SS_WRITE(ss, gd->cdr_num_sectors);
+
+  SS_WRITE(ss, gd->pio_buffer);
+  SS_WRITE(ss, gd->pio_head);
+  SS_WRITE(ss, gd->pio_size);
+  SS_WRITE(ss, gd->pio_offset);
+
+  /* only the filled part of the dma buffer is saved */
+  SS_WRITE(ss, gd->dma_head);
+  SS_WRITE(ss, gd->dma_size);
+  ss_write(ss, gd->dma_buffer, gd->dma_size);
+}
+
+static void gdrom_load(struct device *dev, struct savestate *ss) {
+  struct gdrom *gd = (struct gdrom *)dev;
+  struct scheduler *sched = gd->dc->sched;
+
+  SS_READ(ss, gd->state);
+  SS_READ(ss, gd->hw_info);
+  SS_READ(ss, gd->head_fad);
+  gd->read_timer = ss_read_timer(ss, sched, gd->read_timer,
+                                 &gdrom_cdread_timer, gd, 0);
+
+  SS_READ(ss, gd->error);
+  SS_READ(ss, gd->features);
+  SS_READ(ss, gd->ireason);
+  SS_READ(ss, gd->sectnum);
+  SS_READ(ss, gd->byte_count);
+  SS_READ(ss, gd->status);
+
+  SS_READ(ss, gd->cdr_dma);
+  SS_READ(ss, gd->cdr_secfmt);
+  SS_READ(ss, gd->cdr_secmask);
+  SS_READ(ss, gd->cdr_first_sector);
+  SS_READ(ss, gd->cdr_num_sectors);
+
+  SS_READ(ss, gd->pio_buffer);
+  SS_READ(ss, gd->pio_head);
+  SS_READ(ss, gd->pio_size);
+  SS_READ(ss, gd->pio_offset);
+
+  SS_READ(ss, gd->dma_head);
+  SS_READ(ss, gd->dma_size);
+
+  if (gd->dma_size < 0 || gd->dma_size > (int)sizeof(gd->dma_buffer)) {
+    ss->error = 1;
+    gd->dma_size = 0;
+  }
+
+  ss_read(ss, gd->dma_buffer, gd->dma_size);
+}
+
 void gdrom_destroy(struct gdrom *gd) {
+  gdrom_cancel_read(gd);
+
+  if (gd->preload) {
+    preload_destroy(gd->preload);
+  }
+
+  if (gd->readahead) {
+    readahead_destroy(gd->readahead);
+  }
+
+  if (gd->trace) {
+    fclose(gd->trace);
+  }
+
   if (gd->disc) {
     disc_destroy(gd->disc);
   }
 
+  mutex_destroy(gd->disc_mutex);
+
   dc_destroy_device((struct device *)gd);
 }
 
 struct gdrom *gdrom_create(struct dreamcast *dc) {
   struct gdrom *gd =
       dc_create_device(dc, sizeof(struct gdrom), "gdrom", &gdrom_init, NULL);
+
+  gd->disc_mutex = mutex_create();
+
+  /* setup state interface */
+  gd->stateif.enabled = 1;
+  gd->stateif.save = &gdrom_save;
+  gd->stateif.load = &gdrom_load;
+
   return gd;
 }
 
@@ -15,11 +15,17 @@ void gdrom_debug_menu(struct gdrom *gd);
 struct disc *gdrom_get_disc(struct gdrom *gd);
 void gdrom_set_disc(struct gdrom *gd, struct disc *disc);
 
+/* returns 0 while the drive is still reading the sectors for a dma transfer,
+   holly_resume_gdrom_dma is called once they've been read */
+int gdrom_dma_ready(struct gdrom *gd);
 void gdrom_dma_begin(struct gdrom *gd);
 int gdrom_dma_read(struct gdrom *gd, uint8_t *data, int n);
 void gdrom_dma_end(struct gdrom *gd);
 
 int gdrom_is_busy(struct gdrom *gd);
+/* time for the drive to seek to and read the sectors, moving the drive head to
+   the end of them. always 0 unless accurate timing is enabled */
+int64_t gdrom_access_time(struct gdrom *gd, int fad, int num_sectors);
 void gdrom_get_mode(struct gdrom *gd, struct gd_hw_info *info);
 void gdrom_set_mode(struct gdrom *gd, struct gd_hw_info *info);
 void gdrom_get_status(struct gdrom *gd, struct gd_status_info *stat);
@@ -36,5 +42,8 @@ int gdrom_read_sectors(struct gdrom *gd, int fad, int num_sectors, int fmt,
                        int mask, uint8_t *dst, int dst_size);
 int gdrom_read_bytes(struct gdrom *gd, int fad, int len, uint8_t *dst,
                      int dst_size);
+/* start reading the sectors on the read-ahead thread, returning 1 once
+   gdrom_read_sectors can read them without blocking on the host's file i/o */
+int gdrom_prefetch_sectors(struct gdrom *gd, int fad, int num_sectors);
 
 #endif
@@ -0,0 +1,308 @@
+/*
+ * full disc preload
+ *
+ * loads the entire disc into memory on a background thread, removing disc
+ * i/o from the emulation thread once it's done. sectors are loaded in chunks,
+ * starting with the boot file, then any region the guest reads from that
+ * hasn't loaded yet, and finally the rest of the disc in order
+ *
+ * each chunk is only ever written to by the thread before being marked
+ * resident, so resident chunks are safe to read from without a lock held
+ */
+
+#include "guest/gdrom/preload.h"
+#include "core/core.h"
+#include "core/memory.h"
+#include "core/time.h"
+#include "guest/gdrom/disc.h"
+#include "options.h"
+
+#define PRELOAD_CHUNK_SECTORS 32
+
+struct preload_track {
+  struct track *track;
+  uint8_t *data;
+  size_t data_size;
+  uint8_t *resident;
+  int num_chunks;
+};
+
+struct preload {
+  struct disc *disc;
+  mutex_t disc_mutex;
+
+  thread_t thread;
+  mutex_t mutex;
+  int shutdown;
+
+  struct preload_track tracks[DISC_MAX_TRACKS];
+  int num_tracks;
+  int remaining;
+
+  /* regions to load before the rest of the disc */
+  int boot_fad;
+  int boot_end;
+  int hint_fad;
+
+  /* position of the in-order load through the rest of the disc */
+  int next_track;
+  int next_chunk;
+};
+
+static struct preload_track *preload_lookup_track(struct preload *pl,
+                                                  int fad) {
+  struct track *track = disc_lookup_track(pl->disc, fad);
+
+  for (int i = 0; i < pl->num_tracks; i++) {
+    if (pl->tracks[i].track == track) {
+      return &pl->tracks[i];
+    }
+  }
+
+  return NULL;
+}
+
+/* find the first chunk in [fad, end) that isn't resident */
+static int preload_find_chunk(struct preload *pl, int fad, int end,
+                              struct preload_track **pt, int *chunk) {
+  struct preload_track *t = preload_lookup_track(pl, fad);
+
+  if (!t) {
+    return 0;
+  }
+
+  int first = (fad - t->track->fad) / PRELOAD_CHUNK_SECTORS;
+  int last = (end - 1 - t->track->fad) / PRELOAD_CHUNK_SECTORS;
+  last = MIN(last, t->num_chunks - 1);
+
+  for (int i = first; i <= last; i++) {
+    if (!t->resident[i]) {
+      *pt = t;
+      *chunk = i;
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static int preload_next_chunk(struct preload *pl, struct preload_track **pt,
+                              int *chunk) {
+  /* regions the guest is reading from */
+  if (pl->hint_fad >= 0) {
+    struct preload_track *t = preload_lookup_track(pl, pl->hint_fad);
+    int end = t ? t->track->fad + t->track->num_sectors : 0;
+
+    if (t && preload_find_chunk(pl, pl->hint_fad, end, pt, chunk)) {
+      return 1;
+    }
+
+    pl->hint_fad = -1;
+  }
+
+  /* the boot file */
+  if (pl->boot_fad >= 0) {
+    if (preload_find_chunk(pl, pl->boot_fad, pl->boot_end, pt, chunk)) {
+      return 1;
+    }
+
+    pl->boot_fad = -1;
+  }
+
+  /* everything else */
+  while (pl->next_track < pl->num_tracks) {
+    struct preload_track *t = &pl->tracks[pl->next_track];
+
+    while (pl->next_chunk < t->num_chunks) {
+      int i = pl->next_chunk++;
+
+      if (!t->resident[i]) {
+        *pt = t;
+        *chunk = i;
+        return 1;
+      }
+    }
+
+    pl->next_track++;
+    pl->next_chunk = 0;
+  }
+
+  return 0;
+}
+
+static void *preload_thread(void *data) {
+  struct preload *pl = data;
+  int64_t start = time_nanoseconds();
+
+  mutex_lock(pl->mutex);
+
+  while (!pl->shutdown) {
+    struct preload_track *t = NULL;
+    int chunk = 0;
+
+    if (!preload_next_chunk(pl, &t, &chunk)) {
+      break;
+    }
+
+    mutex_unlock(pl->mutex);
+
+    struct track *track = t->track;
+    int offset = chunk * PRELOAD_CHUNK_SECTORS;
+    int n = MIN(PRELOAD_CHUNK_SECTORS, track->num_sectors - offset);
+    uint8_t *dst = t->data + (int64_t)offset * track->data_size;
+
+    mutex_lock(pl->disc_mutex);
+    disc_read_sectors(pl->disc, track->fad + offset, n, GD_SECTOR_ANY,
+                      GD_MASK_DATA, dst, n * track->data_size);
+    mutex_unlock(pl->disc_mutex);
+
+    mutex_lock(pl->mutex);
+
+    t->resident[chunk] = 1;
+    pl->remaining--;
+  }
+
+  int remaining = pl->remaining;
+
+  mutex_unlock(pl->mutex);
+
+  if (!remaining) {
+    int64_t elapsed = time_nanoseconds() - start;
+    LOG_INFO("preload_thread finished in %d ms", (int)(elapsed / NS_PER_MS));
+  }
+
+  return NULL;
+}
+
+int preload_read_sectors(struct preload *pl, int fad, int num_sectors,
+                         int sector_fmt, int sector_mask, uint8_t *dst,
+                         int dst_size) {
+  struct preload_track *t = preload_lookup_track(pl, fad);
+
+  if (!t) {
+    return 0;
+  }
+
+  struct track *track = t->track;
+  int offset = fad - track->fad;
+
+  /* let the caller handle anything not backed by the image */
+  if (offset + num_sectors > track->num_sectors) {
+    return 0;
+  }
+
+  int first = offset / PRELOAD_CHUNK_SECTORS;
+  int last = (offset + num_sectors - 1) / PRELOAD_CHUNK_SECTORS;
+  int resident = 1;
+
+  mutex_lock(pl->mutex);
+
+  for (int i = first; i <= last && resident; i++) {
+    resident = t->resident[i];
+  }
+
+  /* have the thread load this region next */
+  if (!resident) {
+    pl->hint_fad = fad;
+  }
+
+  mutex_unlock(pl->mutex);
+
+  if (!resident) {
+    return 0;
+  }
+
+  CHECK(sector_fmt == GD_SECTOR_ANY || sector_fmt == track->sector_fmt);
+  CHECK(sector_mask == GD_MASK_DATA);
+
+  int size = num_sectors * track->data_size;
+  CHECK_LE(size, dst_size);
+  memcpy(dst, t->data + (int64_t)offset * track->data_size, size);
+
+  return size;
+}
+
+void preload_destroy(struct preload *pl) {
+  if (pl->thread) {
+    mutex_lock(pl->mutex);
+    pl->shutdown = 1;
+    mutex_unlock(pl->mutex);
+
+    void *result;
+    thread_join(pl->thread, &result);
+  }
+
+  for (int i = 0; i < pl->num_tracks; i++) {
+    struct preload_track *t = &pl->tracks[i];
+
+    if (t->data) {
+      release_pages(t->data, t->data_size);
+    }
+    free(t->resident);
+  }
+
+  mutex_destroy(pl->mutex);
+
+  free(pl);
+}
+
+struct preload *preload_create(struct disc *disc, mutex_t disc_mutex) {
+  struct preload *pl = calloc(1, sizeof(struct preload));
+
+  pl->disc = disc;
+  pl->disc_mutex = disc_mutex;
+  pl->mutex = mutex_create();
+  pl->hint_fad = -1;
+  pl->boot_fad = -1;
+
+  int64_t total = 0;
+
+  for (int i = 0; i < disc_get_num_tracks(disc); i++) {
+    struct track *track = disc_get_track(disc, i);
+    struct preload_track *t = &pl->tracks[pl->num_tracks++];
+    int64_t size = (int64_t)track->num_sectors * track->data_size;
+
+    t->track = track;
+    t->num_chunks =
+        (track->num_sectors + PRELOAD_CHUNK_SECTORS - 1) / PRELOAD_CHUNK_SECTORS;
+    t->data_size = ALIGN_UP((size_t)size, get_page_size());
+    t->data = t->data_size ? alloc_pages(NULL, t->data_size, ACC_READWRITE)
+                           : NULL;
+    t->resident = calloc(t->num_chunks, 1);
+
+    if (t->num_chunks && (!t->data || !t->resident)) {
+      LOG_WARNING("preload_create failed to allocate %" PRId64 " bytes", size);
+      preload_destroy(pl);
+      return NULL;
+    }
+
+    /* every instance running the same disc preloads identical sectors */
+    if (t->data && OPTION_page_merging) {
+      advise_mergeable(t->data, t->data_size);
+    }
+
+    pl->remaining += t->num_chunks;
+    total += size;
+  }
+
+  /* load the boot file first */
+  if (disc->bootnme[0]) {
+    int boot_fad, boot_len;
+
+    mutex_lock(disc_mutex);
+    int found = disc_find_file(disc, disc->bootnme, &boot_fad, &boot_len);
+    mutex_unlock(disc_mutex);
+
+    if (found) {
+      pl->boot_fad = boot_fad;
+      pl->boot_end = boot_fad + (boot_len + 2047) / 2048;
+    }
+  }
+
+  LOG_INFO("preload_create loading %" PRId64 " MB", total >> 20);
+
+  pl->thread = thread_create(&preload_thread, "gdrom_preload", pl);
+  CHECK_NOTNULL(pl->thread);
+
+  return pl;
+}
@@ -0,0 +1,19 @@
+#ifndef PRELOAD_H
+#define PRELOAD_H
+
+#include <stdint.h>
+#include "core/thread.h"
+
+struct disc;
+struct preload;
+
+/* disc_mutex serializes access to the disc with other threads */
+struct preload *preload_create(struct disc *disc, mutex_t disc_mutex);
+void preload_destroy(struct preload *pl);
+
+/* returns 0 if any of the sectors haven't been loaded yet */
+int preload_read_sectors(struct preload *pl, int fad, int num_sectors,
+                         int sector_fmt, int sector_mask, uint8_t *dst,
+                         int dst_size);
+
+#endif
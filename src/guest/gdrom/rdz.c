@@ -0,0 +1,506 @@
+/*
+ * seekable compressed disc images
+ *
+ * rdz images store only the data portion of each sector, split into blocks of
+ * a fixed number of sectors which are each deflated independently. an index
+ * of block offsets at the end of the file lets any sector be read by
+ * inflating just the block containing it, without having to decompress the
+ * image from the start
+ *
+ * the file layout is:
+ *
+ *   struct rdz_header
+ *   struct rdz_session[num_sessions]
+ *   struct rdz_session[num_tocs], the toc of each area
+ *   struct rdz_track[num_tracks]
+ *   block data
+ *   uint64_t index[num_blocks + 1], 8-byte aligned, the offset of each block
+ *   followed by the end of the last block
+ *
+ * blocks never span multiple tracks, and blocks which don't shrink when
+ * compressed are stored as is
+ */
+
+#include <zlib.h>
+#include "guest/gdrom/rdz.h"
+#include "core/core.h"
+#include "core/memory.h"
+#include "guest/gdrom/disc.h"
+
+#define RDZ_MAGIC 0x315a4452 /* "RDZ1" */
+
+enum {
+  RDZ_CODEC_NONE,
+  RDZ_CODEC_DEFLATE,
+};
+
+struct rdz_header {
+  uint32_t magic;
+  uint32_t codec;
+  uint32_t format;
+  uint32_t block_sectors;
+  uint32_t num_sessions;
+  uint32_t num_tracks;
+  uint32_t num_blocks;
+  uint32_t num_tocs;
+  uint64_t index_offset;
+};
+
+struct rdz_session {
+  int32_t leadin_fad;
+  int32_t leadout_fad;
+  int32_t first_track;
+  int32_t last_track;
+};
+
+struct rdz_track {
+  int32_t num;
+  int32_t fad;
+  int32_t num_sectors;
+  int32_t adr;
+  int32_t ctrl;
+  int32_t sector_fmt;
+  int32_t sector_size;
+  int32_t header_size;
+  int32_t error_size;
+  int32_t data_size;
+  int32_t first_block;
+  int32_t reserved;
+};
+
+struct rdz {
+  struct disc;
+  uint8_t *file;
+  size_t file_size;
+  const struct rdz_header *header;
+  /* offset of each block, followed by the end of the last block */
+  const uint64_t *blocks;
+
+  struct session sessions[DISC_MAX_SESSIONS];
+  int num_sessions;
+  struct session tocs[DISC_MAX_SESSIONS];
+  int num_tocs;
+  struct track tracks[DISC_MAX_TRACKS];
+  int first_blocks[DISC_MAX_TRACKS];
+  int num_tracks;
+
+  /* most recently inflated block */
+  z_stream strm;
+  int block;
+  uint8_t *block_data;
+};
+
+static const uint8_t *rdz_load_block(struct rdz *rdz, int block, int size) {
+  if (block == rdz->block) {
+    return rdz->block_data;
+  }
+
+  const uint8_t *src = rdz->file + rdz->blocks[block];
+  int src_size = (int)(rdz->blocks[block + 1] - rdz->blocks[block]);
+
+  /* blocks which didn't compress are stored as is */
+  if (src_size == size) {
+    return src;
+  }
+
+  z_stream *strm = &rdz->strm;
+  int res = inflateReset(strm);
+  CHECK_EQ(res, Z_OK);
+
+  strm->next_in = (Bytef *)src;
+  strm->avail_in = src_size;
+  strm->next_out = rdz->block_data;
+  strm->avail_out = size;
+
+  res = inflate(strm, Z_FINISH);
+  CHECK(res == Z_STREAM_END && !strm->avail_out,
+        "rdz_load_block failed to inflate block %d", block);
+
+  rdz->block = block;
+
+  return rdz->block_data;
+}
+
+static void rdz_read_sectors(struct disc *disc, struct track *track, int fad,
+                             int num_sectors, void *dst) {
+  struct rdz *rdz = (struct rdz *)disc;
+  int n = (int)(track - rdz->tracks);
+  int block_sectors = rdz->header->block_sectors;
+  int offset = fad - track->fad;
+  uint8_t *ptr = dst;
+
+  CHECK(offset >= 0 && offset + num_sectors <= track->num_sectors,
+        "rdz_read_sectors [%d, %d) is out of bounds", fad, fad + num_sectors);
+
+  while (num_sectors) {
+    int block = offset / block_sectors;
+    int block_offset = offset % block_sectors;
+    int block_size =
+        MIN(block_sectors, track->num_sectors - block * block_sectors);
+    int count = MIN(num_sectors, block_size - block_offset);
+
+    const uint8_t *src = rdz_load_block(rdz, rdz->first_blocks[n] + block,
+                                        block_size * track->data_size);
+    memcpy(ptr, src + block_offset * track->data_size,
+           count * track->data_size);
+
+    ptr += count * track->data_size;
+    offset += count;
+    num_sectors -= count;
+  }
+}
+
+static void rdz_read_sector(struct disc *disc, struct track *track, int fad,
+                            void *dst) {
+  rdz_read_sectors(disc, track, fad, 1, dst);
+}
+
+static void rdz_get_toc(struct disc *disc, int area, struct track **first_track,
+                        struct track **last_track, int *leadin_fad,
+                        int *leadout_fad) {
+  struct rdz *rdz = (struct rdz *)disc;
+
+  /* the toc of each area is stored as it was reported by the original image */
+  CHECK_LT(area, rdz->num_tocs);
+  struct session *session = &rdz->tocs[area];
+
+  *first_track = &rdz->tracks[session->first_track];
+  *last_track = &rdz->tracks[session->last_track];
+  *leadin_fad = session->leadin_fad;
+  *leadout_fad = session->leadout_fad;
+}
+
+static struct track *rdz_get_track(struct disc *disc, int n) {
+  struct rdz *rdz = (struct rdz *)disc;
+  CHECK_LT(n, rdz->num_tracks);
+  return &rdz->tracks[n];
+}
+
+static int rdz_get_num_tracks(struct disc *disc) {
+  struct rdz *rdz = (struct rdz *)disc;
+  return rdz->num_tracks;
+}
+
+static struct session *rdz_get_session(struct disc *disc, int n) {
+  struct rdz *rdz = (struct rdz *)disc;
+  CHECK_LT(n, rdz->num_sessions);
+  return &rdz->sessions[n];
+}
+
+static int rdz_get_num_sessions(struct disc *disc) {
+  struct rdz *rdz = (struct rdz *)disc;
+  return rdz->num_sessions;
+}
+
+static int rdz_get_format(struct disc *disc) {
+  struct rdz *rdz = (struct rdz *)disc;
+  return rdz->header->format;
+}
+
+static void rdz_destroy(struct disc *disc) {
+  struct rdz *rdz = (struct rdz *)disc;
+
+  inflateEnd(&rdz->strm);
+  free(rdz->block_data);
+
+  if (rdz->file) {
+    unmap_file(rdz->file, rdz->file_size);
+  }
+}
+
+static void rdz_parse_session(const struct rdz_session *src,
+                              struct session *session) {
+  session->leadin_fad = src->leadin_fad;
+  session->leadout_fad = src->leadout_fad;
+  session->first_track = src->first_track;
+  session->last_track = src->last_track;
+}
+
+static int rdz_parse(struct disc *disc, const char *filename, int verbose) {
+  struct rdz *rdz = (struct rdz *)disc;
+
+  rdz->file = map_file(filename, &rdz->file_size);
+  if (!rdz->file) {
+    return 0;
+  }
+
+  const struct rdz_header *header = (const struct rdz_header *)rdz->file;
+  int64_t tables_size = sizeof(*header);
+
+  if (rdz->file_size < sizeof(*header) || header->magic != RDZ_MAGIC) {
+    LOG_WARNING("rdz_parse invalid header");
+    return 0;
+  }
+
+  tables_size += (header->num_sessions + header->num_tocs) *
+                     sizeof(struct rdz_session) +
+                 header->num_tracks * sizeof(struct rdz_track);
+
+  if (header->codec != RDZ_CODEC_DEFLATE ||
+      header->num_sessions > DISC_MAX_SESSIONS ||
+      !header->num_tocs || header->num_tocs > DISC_MAX_SESSIONS ||
+      header->num_tracks > DISC_MAX_TRACKS || !header->block_sectors ||
+      tables_size > (int64_t)rdz->file_size ||
+      header->index_offset + (header->num_blocks + 1) * sizeof(uint64_t) >
+          rdz->file_size) {
+    LOG_WARNING("rdz_parse unsupported image");
+    return 0;
+  }
+
+  rdz->header = header;
+  rdz->blocks = (const uint64_t *)(rdz->file + header->index_offset);
+
+  const struct rdz_session *sessions =
+      (const struct rdz_session *)(rdz->file + sizeof(*header));
+  const struct rdz_session *tocs = sessions + header->num_sessions;
+  const struct rdz_track *tracks =
+      (const struct rdz_track *)(tocs + header->num_tocs);
+
+  for (int i = 0; i < (int)header->num_sessions; i++) {
+    rdz_parse_session(&sessions[i], &rdz->sessions[rdz->num_sessions++]);
+  }
+
+  for (int i = 0; i < (int)header->num_tocs; i++) {
+    struct session *toc = &rdz->tocs[rdz->num_tocs++];
+    rdz_parse_session(&tocs[i], toc);
+
+    if (toc->first_track < 0 || toc->last_track >= (int)header->num_tracks) {
+      LOG_WARNING("rdz_parse invalid toc for area %d", i);
+      return 0;
+    }
+  }
+
+  uint32_t max_block_size = 0;
+
+  for (int i = 0; i < (int)header->num_tracks; i++) {
+    const struct rdz_track *src = &tracks[i];
+    struct track *track = &rdz->tracks[rdz->num_tracks++];
+
+    track->num = src->num;
+    track->fad = src->fad;
+    track->num_sectors = src->num_sectors;
+    track->adr = src->adr;
+    track->ctrl = src->ctrl;
+    track->sector_fmt = src->sector_fmt;
+    track->sector_size = src->sector_size;
+    track->header_size = src->header_size;
+    track->error_size = src->error_size;
+    track->data_size = src->data_size;
+    strncpy(track->filename, filename, sizeof(track->filename));
+    rdz->first_blocks[i] = src->first_block;
+
+    int num_blocks = (track->num_sectors + header->block_sectors - 1) /
+                     header->block_sectors;
+
+    if (src->first_block + num_blocks > (int)header->num_blocks ||
+        track->data_size > DISC_MAX_SECTOR_SIZE) {
+      LOG_WARNING("rdz_parse invalid track %d", track->num);
+      return 0;
+    }
+
+    max_block_size =
+        MAX(max_block_size, header->block_sectors * track->data_size);
+
+    if (verbose) {
+      LOG_INFO("rdz_parse track=%d fad=%d secsz=%d sectors=%d", track->num,
+               track->fad, track->sector_size, track->num_sectors);
+    }
+  }
+
+  rdz->block = -1;
+  rdz->block_data = malloc(max_block_size);
+
+  int res = inflateInit2(&rdz->strm, -MAX_WBITS);
+  CHECK_EQ(res, Z_OK);
+
+  return 1;
+}
+
+struct disc *rdz_create(const char *filename, int verbose) {
+  struct rdz *rdz = calloc(1, sizeof(struct rdz));
+
+  rdz->destroy = &rdz_destroy;
+  rdz->get_format = &rdz_get_format;
+  rdz->get_num_sessions = &rdz_get_num_sessions;
+  rdz->get_session = &rdz_get_session;
+  rdz->get_num_tracks = &rdz_get_num_tracks;
+  rdz->get_track = &rdz_get_track;
+  rdz->get_toc = &rdz_get_toc;
+  rdz->read_sector = &rdz_read_sector;
+  rdz->read_sectors = &rdz_read_sectors;
+
+  struct disc *disc = (struct disc *)rdz;
+
+  if (!rdz_parse(disc, filename, verbose)) {
+    rdz_destroy(disc);
+    return NULL;
+  }
+
+  return disc;
+}
+
+/*
+ * conversion
+ */
+static void rdz_read_raw(struct disc *disc, struct track *track, int fad,
+                         int num_sectors, uint8_t *dst) {
+  /* read the sectors as stored by the image, without the patches applied by
+     disc_read_sectors */
+  if (disc->read_sectors) {
+    disc->read_sectors(disc, track, fad, num_sectors, dst);
+    return;
+  }
+
+  for (int i = 0; i < num_sectors; i++) {
+    disc->read_sector(disc, track, fad + i, dst + i * track->data_size);
+  }
+}
+
+int rdz_write(struct disc *disc, const char *filename, int block_sectors,
+              int level) {
+  FILE *fp = fopen(filename, "wb");
+  if (!fp) {
+    LOG_WARNING("rdz_write failed to open %s", filename);
+    return 0;
+  }
+
+  struct rdz_header header = {0};
+  header.magic = RDZ_MAGIC;
+  header.codec = RDZ_CODEC_DEFLATE;
+  header.format = disc_get_format(disc);
+  header.block_sectors = block_sectors;
+  header.num_sessions = disc_get_num_sessions(disc);
+  header.num_tracks = disc_get_num_tracks(disc);
+  /* only gd-roms have a high density area */
+  header.num_tocs = header.format == GD_DISC_GDROM ? 2 : 1;
+
+  /* tables are written once the block layout is known */
+  struct rdz_session sessions[DISC_MAX_SESSIONS] = {0};
+  struct rdz_session tocs[DISC_MAX_SESSIONS] = {0};
+  struct rdz_track tracks[DISC_MAX_TRACKS] = {0};
+
+  for (int i = 0; i < (int)header.num_sessions; i++) {
+    struct session *session = disc_get_session(disc, i);
+
+    sessions[i].leadin_fad = session->leadin_fad;
+    sessions[i].leadout_fad = session->leadout_fad;
+    sessions[i].first_track = session->first_track;
+    sessions[i].last_track = session->last_track;
+  }
+
+  for (int i = 0; i < (int)header.num_tocs; i++) {
+    struct track *first_track, *last_track;
+    int leadin_fad, leadout_fad;
+    disc_get_toc(disc, i, &first_track, &last_track, &leadin_fad,
+                 &leadout_fad);
+
+    tocs[i].leadin_fad = leadin_fad;
+    tocs[i].leadout_fad = leadout_fad;
+    tocs[i].first_track = first_track->num - disc_get_track(disc, 0)->num;
+    tocs[i].last_track = last_track->num - disc_get_track(disc, 0)->num;
+  }
+
+  int num_blocks = 0;
+
+  for (int i = 0; i < (int)header.num_tracks; i++) {
+    struct track *track = disc_get_track(disc, i);
+    struct rdz_track *dst = &tracks[i];
+
+    dst->num = track->num;
+    dst->fad = track->fad;
+    dst->num_sectors = track->num_sectors;
+    dst->adr = track->adr;
+    dst->ctrl = track->ctrl;
+    dst->sector_fmt = track->sector_fmt;
+    dst->sector_size = track->sector_size;
+    dst->header_size = track->header_size;
+    dst->error_size = track->error_size;
+    dst->data_size = track->data_size;
+    dst->first_block = num_blocks;
+
+    num_blocks += (track->num_sectors + block_sectors - 1) / block_sectors;
+  }
+
+  header.num_blocks = num_blocks;
+
+  int64_t tables_size =
+      sizeof(header) +
+      (header.num_sessions + header.num_tocs) * sizeof(struct rdz_session) +
+      header.num_tracks * sizeof(struct rdz_track);
+  fseek(fp, (long)tables_size, SEEK_SET);
+
+  /* compress each block */
+  z_stream strm = {0};
+  int res = deflateInit2(&strm, level, Z_DEFLATED, -MAX_WBITS, 8,
+                         Z_DEFAULT_STRATEGY);
+  CHECK_EQ(res, Z_OK);
+
+  int max_size = block_sectors * DISC_MAX_SECTOR_SIZE;
+  uint8_t *raw = malloc(max_size);
+  uint8_t *packed = malloc(deflateBound(&strm, max_size));
+  uint64_t *index = malloc((num_blocks + 1) * sizeof(uint64_t));
+  uint64_t offset = tables_size;
+  int block = 0;
+
+  for (int i = 0; i < (int)header.num_tracks; i++) {
+    struct track *track = disc_get_track(disc, i);
+
+    for (int j = 0; j < track->num_sectors; j += block_sectors) {
+      int n = MIN(block_sectors, track->num_sectors - j);
+      int size = n * track->data_size;
+
+      rdz_read_raw(disc, track, track->fad + j, n, raw);
+
+      res = deflateReset(&strm);
+      CHECK_EQ(res, Z_OK);
+
+      strm.next_in = raw;
+      strm.avail_in = size;
+      strm.next_out = packed;
+      strm.avail_out = (uInt)deflateBound(&strm, size);
+
+      res = deflate(&strm, Z_FINISH);
+      CHECK_EQ(res, Z_STREAM_END);
+
+      /* store blocks which didn't shrink as is */
+      int packed_size = (int)strm.total_out;
+      const uint8_t *data = packed;
+
+      if (packed_size >= size) {
+        packed_size = size;
+        data = raw;
+      }
+
+      fwrite(data, 1, packed_size, fp);
+
+      index[block++] = offset;
+      offset += packed_size;
+    }
+  }
+
+  index[block] = offset;
+
+  /* pad out the index so it can be read in place */
+  static const uint8_t padding[8];
+  int padding_size = (int)(ALIGN_UP(offset, 8) - offset);
+  fwrite(padding, 1, padding_size, fp);
+
+  header.index_offset = offset + padding_size;
+  fwrite(index, sizeof(uint64_t), num_blocks + 1, fp);
+
+  fseek(fp, 0, SEEK_SET);
+  fwrite(&header, sizeof(header), 1, fp);
+  fwrite(sessions, sizeof(struct rdz_session), header.num_sessions, fp);
+  fwrite(tocs, sizeof(struct rdz_session), header.num_tocs, fp);
+  fwrite(tracks, sizeof(struct rdz_track), header.num_tracks, fp);
+
+  int success = !ferror(fp);
+
+  deflateEnd(&strm);
+  free(index);
+  free(packed);
+  free(raw);
+  fclose(fp);
+
+  return success;
+}
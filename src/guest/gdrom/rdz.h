@@ -0,0 +1,13 @@
+#ifndef RDZ_H
+#define RDZ_H
+
+struct disc;
+
+struct disc *rdz_create(const char *filename, int verbose);
+
+/* convert any disc to rdz, compressing each block of block_sectors sectors
+   independently with the given deflate level */
+int rdz_write(struct disc *disc, const char *filename, int block_sectors,
+              int level);
+
+#endif
@@ -0,0 +1,269 @@
+/*
+ * gd-rom read-ahead
+ *
+ * games streaming audio or video from disc issue a steady series of reads,
+ * each starting where the previous one ended. once a read continues on from
+ * the previous one, a background thread starts reading the sectors following
+ * it into a ring buffer, so subsequent reads are served from memory instead
+ * of waiting on the host's file i/o
+ *
+ * the ring buffer holds a window [start, end) of sectors from a single track.
+ * the thread only ever writes sectors past the end of the window, while the
+ * emulation thread only reads from inside of it
+ */
+
+#include "guest/gdrom/readahead.h"
+#include "core/core.h"
+#include "guest/gdrom/disc.h"
+#include "stats.h"
+
+/* max number of sectors read by the thread at once */
+#define READAHEAD_CHUNK_SECTORS 16
+
+struct readahead {
+  struct disc *disc;
+  mutex_t disc_mutex;
+
+  thread_t thread;
+  mutex_t mutex;
+  /* signalled when there's room in the window, or on shutdown */
+  cond_t wake_cond;
+  /* signalled when sectors are added to the window */
+  cond_t filled_cond;
+  int shutdown;
+
+  /* sector data, indexed by fad % max_sectors */
+  uint8_t *data;
+  int max_sectors;
+  struct track *track;
+  int start;
+  int end;
+  /* incremented whenever the window is reset, so that reads in flight at the
+     time are discarded */
+  int generation;
+
+  /* end of the previous read, to detect sequential reads */
+  int next_fad;
+};
+
+static int readahead_room(struct readahead *ra) {
+  if (!ra->track) {
+    return 0;
+  }
+
+  int track_end = ra->track->fad + ra->track->num_sectors;
+  int room = MIN(ra->max_sectors - (ra->end - ra->start), track_end - ra->end);
+  return MAX(room, 0);
+}
+
+static void *readahead_thread(void *data) {
+  struct readahead *ra = data;
+
+  mutex_lock(ra->mutex);
+
+  while (!ra->shutdown) {
+    int room = readahead_room(ra);
+
+    if (!room) {
+      cond_wait(ra->wake_cond, ra->mutex);
+      continue;
+    }
+
+    /* don't read past the end of the buffer, the next chunk wraps around */
+    struct track *track = ra->track;
+    int generation = ra->generation;
+    int fad = ra->end;
+    int slot = fad % ra->max_sectors;
+    int n = MIN(MIN(room, READAHEAD_CHUNK_SECTORS), ra->max_sectors - slot);
+    uint8_t *dst = ra->data + slot * track->data_size;
+
+    mutex_unlock(ra->mutex);
+
+    mutex_lock(ra->disc_mutex);
+    disc_read_sectors(ra->disc, fad, n, GD_SECTOR_ANY, GD_MASK_DATA, dst,
+                      n * track->data_size);
+    mutex_unlock(ra->disc_mutex);
+
+    mutex_lock(ra->mutex);
+
+    if (ra->generation == generation) {
+      ra->end += n;
+      cond_signal(ra->filled_cond);
+    }
+  }
+
+  mutex_unlock(ra->mutex);
+
+  return NULL;
+}
+
+static void readahead_copy(struct readahead *ra, int fad, int num_sectors,
+                           uint8_t *dst) {
+  int data_size = ra->track->data_size;
+
+  while (num_sectors) {
+    int slot = fad % ra->max_sectors;
+    int n = MIN(num_sectors, ra->max_sectors - slot);
+    memcpy(dst, ra->data + slot * data_size, n * data_size);
+    dst += n * data_size;
+    fad += n;
+    num_sectors -= n;
+  }
+}
+
+int readahead_read_sectors(struct readahead *ra, int fad, int num_sectors,
+                           int sector_fmt, int sector_mask, uint8_t *dst,
+                           int dst_size) {
+  if (!ra->thread) {
+    mutex_lock(ra->disc_mutex);
+    int read = disc_read_sectors(ra->disc, fad, num_sectors, sector_fmt,
+                                 sector_mask, dst, dst_size);
+    mutex_unlock(ra->disc_mutex);
+    return read;
+  }
+
+  struct track *track = disc_lookup_track(ra->disc, fad);
+  CHECK_NOTNULL(track);
+  CHECK(sector_fmt == GD_SECTOR_ANY || sector_fmt == track->sector_fmt);
+  CHECK(sector_mask == GD_MASK_DATA);
+  CHECK_LE(num_sectors * track->data_size, dst_size);
+
+  int end = fad + num_sectors;
+  int track_end = track->fad + track->num_sectors;
+
+  mutex_lock(ra->mutex);
+
+  int sequential = fad == ra->next_fad;
+  int hit = track == ra->track && fad >= ra->start && fad <= ra->end;
+  ra->next_fad = end;
+
+  if (hit) {
+    /* sectors before the read are no longer needed, free up their room */
+    ra->start = fad;
+    cond_signal(ra->wake_cond);
+
+    /* wait on the thread if it's still reading the requested sectors */
+    while (ra->end < end && end - ra->start <= ra->max_sectors &&
+           end <= track_end) {
+      cond_wait(ra->filled_cond, ra->mutex);
+    }
+
+    hit = ra->end >= end;
+  }
+
+  if (hit) {
+    readahead_copy(ra, fad, num_sectors, dst);
+
+    ra->start = end;
+    cond_signal(ra->wake_cond);
+
+    mutex_unlock(ra->mutex);
+
+    prof_counter_add(COUNTER_gdrom_readahead_hits, 1);
+
+    return num_sectors * track->data_size;
+  }
+
+  /* reset the window to start after this read, only reading ahead into it if
+     this read continued on from the previous one */
+  ra->generation++;
+  ra->track = sequential ? track : NULL;
+  ra->start = end;
+  ra->end = end;
+  cond_signal(ra->wake_cond);
+
+  mutex_unlock(ra->mutex);
+
+  prof_counter_add(COUNTER_gdrom_readahead_misses, 1);
+
+  mutex_lock(ra->disc_mutex);
+  int read = disc_read_sectors(ra->disc, fad, num_sectors, sector_fmt,
+                               sector_mask, dst, dst_size);
+  mutex_unlock(ra->disc_mutex);
+
+  return read;
+}
+
+int readahead_prefetch(struct readahead *ra, int fad, int num_sectors) {
+  if (!ra->thread) {
+    return 1;
+  }
+
+  /* reads the window can't hold go straight to the disc */
+  struct track *track = disc_lookup_track(ra->disc, fad);
+  int end = fad + num_sectors;
+
+  if (!track || num_sectors > ra->max_sectors ||
+      end > track->fad + track->num_sectors) {
+    return 1;
+  }
+
+  mutex_lock(ra->mutex);
+
+  int hit = track == ra->track && fad >= ra->start && fad <= ra->end;
+
+  if (hit) {
+    /* sectors before the read are no longer needed, free up their room */
+    ra->start = fad;
+  } else {
+    /* move the window to the requested sectors */
+    ra->generation++;
+    ra->track = track;
+    ra->start = fad;
+    ra->end = fad;
+  }
+
+  int ready = ra->end >= end;
+  ra->next_fad = fad;
+  cond_signal(ra->wake_cond);
+
+  mutex_unlock(ra->mutex);
+
+  return ready;
+}
+
+void readahead_destroy(struct readahead *ra) {
+  if (ra->thread) {
+    mutex_lock(ra->mutex);
+    ra->shutdown = 1;
+    cond_signal(ra->wake_cond);
+    mutex_unlock(ra->mutex);
+
+    void *result;
+    thread_join(ra->thread, &result);
+  }
+
+  cond_destroy(ra->filled_cond);
+  cond_destroy(ra->wake_cond);
+  mutex_destroy(ra->mutex);
+
+  free(ra->data);
+  prof_counter_add(COUNTER_mem_disc_cache,
+                   -(int64_t)ra->max_sectors * DISC_MAX_SECTOR_SIZE);
+  free(ra);
+}
+
+struct readahead *readahead_create(struct disc *disc, mutex_t disc_mutex,
+                                   int max_sectors) {
+  struct readahead *ra = calloc(1, sizeof(struct readahead));
+
+  ra->disc = disc;
+  ra->disc_mutex = disc_mutex;
+  ra->mutex = mutex_create();
+  ra->wake_cond = cond_create();
+  ra->filled_cond = cond_create();
+  ra->next_fad = -1;
+
+  /* with no room to read ahead into, reads go straight to the disc */
+  if (max_sectors > 0) {
+    ra->max_sectors = max_sectors;
+    ra->data = malloc(max_sectors * DISC_MAX_SECTOR_SIZE);
+    prof_counter_add(COUNTER_mem_disc_cache,
+                     (int64_t)max_sectors * DISC_MAX_SECTOR_SIZE);
+
+    ra->thread = thread_create(&readahead_thread, "gdrom_readahead", ra);
+    CHECK_NOTNULL(ra->thread);
+  }
+
+  return ra;
+}
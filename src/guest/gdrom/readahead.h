@@ -0,0 +1,23 @@
+#ifndef READAHEAD_H
+#define READAHEAD_H
+
+#include <stdint.h>
+#include "core/thread.h"
+
+struct disc;
+struct readahead;
+
+/* disc_mutex serializes access to the disc with other threads */
+struct readahead *readahead_create(struct disc *disc, mutex_t disc_mutex,
+                                   int max_sectors);
+void readahead_destroy(struct readahead *ra);
+
+int readahead_read_sectors(struct readahead *ra, int fad, int num_sectors,
+                           int sector_fmt, int sector_mask, uint8_t *dst,
+                           int dst_size);
+
+/* start reading the sectors ahead of them being read, returning 1 once
+   readahead_read_sectors can read them without waiting on the disc */
+int readahead_prefetch(struct readahead *ra, int fad, int num_sectors);
+
+#endif
@@ -0,0 +1,703 @@
+/*
+ * remote disc images
+ *
+ * gdi images served over http, with each track's sectors fetched on demand
+ * through range requests. the tracks are read in large, aligned blocks to
+ * amortize the round trip of each request, and the blocks following a
+ * sequential read are fetched ahead of time on a separate thread
+ *
+ * fetched blocks are kept in a small lru cache in memory, and written out to
+ * a cache on disk which persists between runs and is shared between
+ * instances. cached blocks are keyed by the url, size and etag of the object
+ * they were read from, so a modified image doesn't read stale blocks
+ */
+
+#include "guest/gdrom/remote.h"
+#include "core/core.h"
+#include "core/http.h"
+#include "core/thread.h"
+#include "core/time.h"
+#include "core/xxhash.h"
+#include "guest/gdrom/disc.h"
+#include "options.h"
+#include "stats.h"
+
+#define REMOTE_BLOCK_SIZE (1024 * 1024)
+
+/* longest track filename read from a gdi, the widths of the conversions in
+   remote_parse must match it */
+#define REMOTE_MAX_FILENAME 4096
+
+enum {
+  BLOCK_EMPTY,
+  /* waiting to be picked up by the prefetch thread */
+  BLOCK_QUEUED,
+  /* being fetched by either thread */
+  BLOCK_FETCHING,
+  BLOCK_READY,
+};
+
+struct remote_block {
+  int file;
+  int num;
+  int state;
+  /* value of the cache clock when last used, for lru eviction */
+  uint64_t used;
+  uint8_t *data;
+};
+
+struct remote_file {
+  char path[PATH_MAX];
+  int64_t size;
+  /* identifies the object's contents in the disk cache */
+  uint64_t key;
+};
+
+struct remote {
+  struct disc;
+
+  struct session sessions[DISC_MAX_SESSIONS];
+  int num_sessions;
+  struct track tracks[DISC_MAX_TRACKS];
+  int num_tracks;
+
+  struct remote_file files[DISC_MAX_TRACKS];
+  struct http *http;
+  char cache_dir[PATH_MAX];
+
+  /* block cache. entries are only evicted and queued by the thread reading
+     sectors, the prefetch thread only ever moves queued entries to ready */
+  struct remote_block *blocks;
+  int num_blocks;
+  uint64_t clock;
+
+  /* last block read, to detect sequential reads */
+  int last_file;
+  int last_num;
+
+  int prefetch;
+  struct http *prefetch_http;
+  thread_t prefetch_thread;
+  mutex_t mutex;
+  cond_t queued_cond;
+  cond_t ready_cond;
+  int shutdown;
+};
+
+static int remote_num_blocks(struct remote_file *file) {
+  return (int)((file->size + REMOTE_BLOCK_SIZE - 1) / REMOTE_BLOCK_SIZE);
+}
+
+static int remote_block_size(struct remote_file *file, int num) {
+  int64_t offset = (int64_t)num * REMOTE_BLOCK_SIZE;
+  return (int)MIN(file->size - offset, (int64_t)REMOTE_BLOCK_SIZE);
+}
+
+static void remote_block_path(struct remote *remote, struct remote_file *file,
+                              int num, char *path, size_t size) {
+  snprintf(path, size, "%s" PATH_SEPARATOR "%016" PRIx64 "-%d.blk",
+           remote->cache_dir, file->key, num);
+}
+
+static int remote_load_cached(struct remote *remote, struct remote_file *file,
+                              int num, uint8_t *data) {
+  if (!remote->cache_dir[0]) {
+    return 0;
+  }
+
+  char path[PATH_MAX];
+  remote_block_path(remote, file, num, path, sizeof(path));
+
+  FILE *fp = fopen(path, "rb");
+  if (!fp) {
+    return 0;
+  }
+
+  int size = remote_block_size(file, num);
+  int n = (int)fread(data, 1, size, fp);
+  fclose(fp);
+
+  return n == size;
+}
+
+static void remote_save_cached(struct remote *remote, struct remote_file *file,
+                               int num, const uint8_t *data) {
+  if (!remote->cache_dir[0]) {
+    return;
+  }
+
+  char path[PATH_MAX];
+  remote_block_path(remote, file, num, path, sizeof(path));
+
+  /* write to a uniquely named file and rename it into place, so other
+     instances never see a partially written block */
+  char tmp[PATH_MAX];
+  snprintf(tmp, sizeof(tmp), "%s.%" PRIx64 ".tmp", path,
+           (uint64_t)time_nanoseconds() ^ (uint64_t)(uintptr_t)data);
+
+  FILE *fp = fopen(tmp, "wb");
+  if (!fp) {
+    return;
+  }
+
+  int size = remote_block_size(file, num);
+  int n = (int)fwrite(data, 1, size, fp);
+  fclose(fp);
+
+  /* the rename fails if another instance already cached the block */
+  if (n != size || rename(tmp, path)) {
+    remove(tmp);
+  }
+}
+
+static int remote_fetch_block(struct remote *remote, struct http *http,
+                              int file_num, int num, uint8_t *data) {
+  struct remote_file *file = &remote->files[file_num];
+
+  if (remote_load_cached(remote, file, num, data)) {
+    return 1;
+  }
+
+  int64_t offset = (int64_t)num * REMOTE_BLOCK_SIZE;
+  int size = remote_block_size(file, num);
+
+  if (http_get_range(http, file->path, offset, size, data, NULL) != size) {
+    return 0;
+  }
+
+  remote_save_cached(remote, file, num, data);
+
+  return 1;
+}
+
+static struct remote_block *remote_find_block(struct remote *remote, int file,
+                                              int num) {
+  for (int i = 0; i < remote->num_blocks; i++) {
+    struct remote_block *block = &remote->blocks[i];
+
+    if (block->state != BLOCK_EMPTY && block->file == file &&
+        block->num == num) {
+      return block;
+    }
+  }
+
+  return NULL;
+}
+
+static struct remote_block *remote_evict_block(struct remote *remote) {
+  struct remote_block *lru = NULL;
+
+  for (int i = 0; i < remote->num_blocks; i++) {
+    struct remote_block *block = &remote->blocks[i];
+
+    if (block->state == BLOCK_EMPTY) {
+      return block;
+    }
+
+    if (block->state == BLOCK_READY && (!lru || block->used < lru->used)) {
+      lru = block;
+    }
+  }
+
+  return lru;
+}
+
+static void *remote_prefetch_thread(void *data) {
+  struct remote *remote = data;
+
+  mutex_lock(remote->mutex);
+
+  while (1) {
+    /* fetch queued blocks in order */
+    struct remote_block *next = NULL;
+
+    for (int i = 0; i < remote->num_blocks; i++) {
+      struct remote_block *block = &remote->blocks[i];
+
+      if (block->state == BLOCK_QUEUED && (!next || block->num < next->num)) {
+        next = block;
+      }
+    }
+
+    if (remote->shutdown) {
+      break;
+    }
+
+    if (!next) {
+      cond_wait(remote->queued_cond, remote->mutex);
+      continue;
+    }
+
+    next->state = BLOCK_FETCHING;
+    mutex_unlock(remote->mutex);
+
+    int res = remote_fetch_block(remote, remote->prefetch_http, next->file,
+                                 next->num, next->data);
+
+    mutex_lock(remote->mutex);
+
+    /* on failure, leave it to the reading thread to fetch the block and
+       report the error */
+    next->state = res ? BLOCK_READY : BLOCK_EMPTY;
+    cond_broadcast(remote->ready_cond);
+  }
+
+  mutex_unlock(remote->mutex);
+
+  return NULL;
+}
+
+static void remote_queue_prefetch(struct remote *remote, int file, int num) {
+  int first = num + 1;
+  int last = MIN(num + remote->prefetch,
+                 remote_num_blocks(&remote->files[file]) - 1);
+  int queued = 0;
+
+  /* drop queued blocks outside of the new window, e.g. after a seek */
+  for (int i = 0; i < remote->num_blocks; i++) {
+    struct remote_block *block = &remote->blocks[i];
+
+    if (block->state == BLOCK_QUEUED &&
+        (block->file != file || block->num < first || block->num > last)) {
+      block->state = BLOCK_EMPTY;
+    }
+  }
+
+  for (int n = first; n <= last; n++) {
+    if (remote_find_block(remote, file, n)) {
+      continue;
+    }
+
+    struct remote_block *block = remote_evict_block(remote);
+    if (!block) {
+      break;
+    }
+
+    block->file = file;
+    block->num = n;
+    block->state = BLOCK_QUEUED;
+    block->used = remote->clock;
+    queued = 1;
+  }
+
+  if (queued) {
+    cond_signal(remote->queued_cond);
+  }
+}
+
+static struct remote_block *remote_get_block(struct remote *remote, int file,
+                                             int num) {
+  mutex_lock(remote->mutex);
+
+  struct remote_block *block = remote_find_block(remote, file, num);
+
+  /* wait on the prefetch thread if it's already fetching the block */
+  while (block && block->state == BLOCK_FETCHING) {
+    cond_wait(remote->ready_cond, remote->mutex);
+    block = remote_find_block(remote, file, num);
+  }
+
+  /* fetch the block on this thread if it isn't cached, or if it's queued but
+     the prefetch thread hasn't gotten to it yet */
+  if (!block || block->state != BLOCK_READY) {
+    if (!block) {
+      block = remote_evict_block(remote);
+      CHECK_NOTNULL(block);
+    }
+
+    block->file = file;
+    block->num = num;
+    block->state = BLOCK_FETCHING;
+    mutex_unlock(remote->mutex);
+
+    int res = remote_fetch_block(remote, remote->http, file, num, block->data);
+    CHECK(res, "remote_get_block failed to fetch block %d of %s", num,
+          remote->files[file].path);
+
+    mutex_lock(remote->mutex);
+    block->state = BLOCK_READY;
+  }
+
+  block->used = ++remote->clock;
+
+  /* only read ahead while the track is being read sequentially, random
+     accesses would just waste bandwidth */
+  int sequential = file == remote->last_file &&
+                   (num == remote->last_num || num == remote->last_num + 1);
+
+  if (remote->prefetch_thread && sequential) {
+    remote_queue_prefetch(remote, file, num);
+  }
+
+  remote->last_file = file;
+  remote->last_num = num;
+
+  mutex_unlock(remote->mutex);
+
+  return block;
+}
+
+static void remote_read_bytes(struct remote *remote, int file, int64_t offset,
+                              int size, uint8_t *dst) {
+  CHECK(offset >= 0 && offset + size <= remote->files[file].size,
+        "remote_read_bytes [%" PRId64 ", %" PRId64 ") is out of bounds",
+        offset, offset + size);
+
+  while (size) {
+    int num = (int)(offset / REMOTE_BLOCK_SIZE);
+    int block_offset = (int)(offset % REMOTE_BLOCK_SIZE);
+    int n = MIN(size, REMOTE_BLOCK_SIZE - block_offset);
+
+    /* the block can't be evicted by the prefetch thread, so it's safe to read
+       without the lock held */
+    struct remote_block *block = remote_get_block(remote, file, num);
+    memcpy(dst, block->data + block_offset, n);
+
+    offset += n;
+    size -= n;
+    dst += n;
+  }
+}
+
+static void remote_read_sectors(struct disc *disc, struct track *track,
+                                int fad, int num_sectors, void *dst) {
+  struct remote *remote = (struct remote *)disc;
+  int file = (int)(track - remote->tracks);
+  int64_t offset = track->file_offset + (int64_t)fad * track->sector_size;
+
+  /* tracks with nothing but data in each sector can be copied as one run */
+  if (!track->header_size && !track->error_size) {
+    remote_read_bytes(remote, file, offset, num_sectors * track->data_size,
+                      dst);
+    return;
+  }
+
+  /* else, only copy the data portion of each sector */
+  uint8_t *ptr = dst;
+
+  for (int i = 0; i < num_sectors; i++) {
+    remote_read_bytes(remote, file, offset + track->header_size,
+                      track->data_size, ptr);
+    offset += track->sector_size;
+    ptr += track->data_size;
+  }
+}
+
+static void remote_read_sector(struct disc *disc, struct track *track, int fad,
+                               void *dst) {
+  remote_read_sectors(disc, track, fad, 1, dst);
+}
+
+static void remote_get_toc(struct disc *disc, int area,
+                           struct track **first_track,
+                           struct track **last_track, int *leadin_fad,
+                           int *leadout_fad) {
+  struct remote *remote = (struct remote *)disc;
+
+  /* gdi's have one toc per area, and there is one session per area */
+  struct session *session = &remote->sessions[area];
+
+  *first_track = &remote->tracks[session->first_track];
+  *last_track = &remote->tracks[session->last_track];
+  *leadin_fad = session->leadin_fad;
+  *leadout_fad = session->leadout_fad;
+}
+
+static struct track *remote_get_track(struct disc *disc, int n) {
+  struct remote *remote = (struct remote *)disc;
+  CHECK_LT(n, remote->num_tracks);
+  return &remote->tracks[n];
+}
+
+static int remote_get_num_tracks(struct disc *disc) {
+  struct remote *remote = (struct remote *)disc;
+  return remote->num_tracks;
+}
+
+static struct session *remote_get_session(struct disc *disc, int n) {
+  struct remote *remote = (struct remote *)disc;
+  CHECK_LT(n, remote->num_sessions);
+  return &remote->sessions[n];
+}
+
+static int remote_get_num_sessions(struct disc *disc) {
+  struct remote *remote = (struct remote *)disc;
+  return remote->num_sessions;
+}
+
+static int remote_get_format(struct disc *disc) {
+  return GD_DISC_GDROM;
+}
+
+static void remote_destroy(struct disc *disc) {
+  struct remote *remote = (struct remote *)disc;
+
+  if (remote->prefetch_thread) {
+    mutex_lock(remote->mutex);
+    remote->shutdown = 1;
+    cond_signal(remote->queued_cond);
+    mutex_unlock(remote->mutex);
+
+    void *result;
+    thread_join(remote->prefetch_thread, &result);
+  }
+
+  if (remote->prefetch_http) {
+    http_destroy(remote->prefetch_http);
+  }
+
+  if (remote->blocks) {
+    for (int i = 0; i < remote->num_blocks; i++) {
+      free(remote->blocks[i].data);
+    }
+    free(remote->blocks);
+
+    prof_counter_add(COUNTER_mem_disc_cache,
+                     -(int64_t)remote->num_blocks * REMOTE_BLOCK_SIZE);
+  }
+
+  if (remote->ready_cond) {
+    cond_destroy(remote->ready_cond);
+  }
+
+  if (remote->queued_cond) {
+    cond_destroy(remote->queued_cond);
+  }
+
+  if (remote->mutex) {
+    mutex_destroy(remote->mutex);
+  }
+
+  if (remote->http) {
+    http_destroy(remote->http);
+  }
+}
+
+static int remote_open_file(struct remote *remote, int n, const char *url) {
+  struct remote_file *file = &remote->files[n];
+
+  /* a single byte read returns the object's size and etag */
+  struct http_object obj;
+  uint8_t tmp;
+
+  if (http_get_range(remote->http, file->path, 0, 1, &tmp, &obj) < 0 ||
+      obj.size < 0) {
+    LOG_WARNING("remote_open_file failed to read %s", file->path);
+    return 0;
+  }
+
+  file->size = obj.size;
+  file->key = xxh64(url, strlen(url), 0);
+  file->key = xxh64(&obj.size, sizeof(obj.size), file->key);
+  file->key = xxh64(obj.etag, strlen(obj.etag), file->key);
+
+  return 1;
+}
+
+static int remote_parse(struct disc *disc, const char *url, int verbose) {
+  struct remote *remote = (struct remote *)disc;
+
+  char host[256];
+  char path[PATH_MAX];
+  int port;
+
+  if (!http_parse_url(url, host, sizeof(host), &port, path, sizeof(path))) {
+    /* there's no tls implementation to serve https with */
+    LOG_WARNING("remote_parse unsupported url %s, only http is supported", url);
+    return 0;
+  }
+
+  remote->http = http_create(host, port);
+  if (!remote->http) {
+    return 0;
+  }
+
+  /* fetch the gdi itself, the tracks it lists are relative to it */
+  int64_t size;
+  char *gdi = (char *)http_get(remote->http, path, &size);
+  if (!gdi) {
+    LOG_WARNING("remote_parse failed to read %s", url);
+    return 0;
+  }
+
+  char dirname[PATH_MAX];
+  snprintf(dirname, sizeof(dirname), "%s", path);
+  *(strrchr(dirname, '/') + 1) = 0;
+
+  char url_dirname[PATH_MAX];
+  snprintf(url_dirname, sizeof(url_dirname), "%s", url);
+  *(strrchr(url_dirname, '/') + 1) = 0;
+
+  /* parse tracks */
+  const char *ptr = gdi;
+  int num_tracks;
+  int n;
+
+  if (sscanf(ptr, "%d%n", &num_tracks, &n) != 1 || num_tracks < 3 ||
+      num_tracks > (int)ARRAY_SIZE(remote->tracks)) {
+    LOG_WARNING("remote_parse invalid track count");
+    free(gdi);
+    return 0;
+  }
+  ptr += n;
+
+  for (int i = 0; i < num_tracks; i++) {
+    int num, lba, ctrl, sector_size;
+    int64_t file_offset;
+    char filename[REMOTE_MAX_FILENAME];
+
+    /* parse track information, including filenames which may include single or
+       double quotes. the gdi comes from the server, so the filenames are
+       bounded */
+    int parse_err = 0;
+
+    parse_err |= sscanf(ptr, "%d %d %d %d%n", &num, &lba, &ctrl, &sector_size,
+                        &n) != 4;
+    ptr += parse_err ? 0 : n;
+
+    if (sscanf(ptr, " \"%4095[^\"]\"%n", filename, &n) == 1 ||
+        sscanf(ptr, " '%4095[^']'%n", filename, &n) == 1 ||
+        sscanf(ptr, " %4095s%n", filename, &n) == 1) {
+      ptr += n;
+    } else {
+      parse_err = 1;
+    }
+
+    if (sscanf(ptr, " %" SCNd64 "%n", &file_offset, &n) == 1) {
+      ptr += n;
+    } else {
+      parse_err = 1;
+    }
+
+    /* tracks are listed in order */
+    if (parse_err || num != remote->num_tracks + 1) {
+      LOG_WARNING("remote_parse failed to parse track information");
+      free(gdi);
+      return 0;
+    }
+
+    /* add track */
+    struct track *track = &remote->tracks[remote->num_tracks++];
+
+    if (!track_set_layout(track, 1, sector_size)) {
+      LOG_WARNING("remote_parse unsupported track layout sector_size=%d",
+                  sector_size);
+      free(gdi);
+      return 0;
+    }
+
+    track->num = remote->num_tracks;
+    track->fad = lba + GDROM_PREGAP;
+    track->ctrl = ctrl;
+    track->file_offset =
+        file_offset - (int64_t)track->fad * track->sector_size;
+    snprintf(track->filename, sizeof(track->filename), "%s%s", url_dirname,
+             filename);
+
+    /* request the object backing the track, its size gives the track's
+       length */
+    struct remote_file *file = &remote->files[i];
+    snprintf(file->path, sizeof(file->path), "%s%s", dirname, filename);
+
+    if (!remote_open_file(remote, i, track->filename)) {
+      free(gdi);
+      return 0;
+    }
+
+    track->num_sectors = (int)((file->size - file_offset) / sector_size);
+
+    if (verbose) {
+      LOG_INFO("remote_parse track=%d filename='%s' fad=%d secsz=%d",
+               track->num, track->filename, track->fad, track->sector_size);
+    }
+  }
+
+  free(gdi);
+
+  /* gdroms contains two sessions, one for the single density area (tracks 0-1)
+     and one for the high density area (tracks 3+) */
+  remote->num_sessions = 2;
+
+  /* single density area starts at 00:00:00 (fad 0x0) and can hold up to 4
+     minutes of data (18,000 sectors at 75 sectors per second) */
+  struct session *single = &remote->sessions[0];
+  single->leadin_fad = 0x0;
+  single->leadout_fad = 0x4650;
+  single->first_track = 0;
+  single->last_track = 0;
+
+  /* high density area starts at 10:00:00 (fad 0xb05e) and can hold up to
+     504,300 sectors (112 minutes, 4 seconds at 75 sectors per second) */
+  struct session *high = &remote->sessions[1];
+  high->leadin_fad = 0xb05e;
+  high->leadout_fad = 0x861b4;
+  high->first_track = 2;
+  high->last_track = num_tracks - 1;
+
+  /* allocate the block cache, large enough that blocks being prefetched never
+     evict the blocks being read */
+  remote->prefetch = MAX(OPTION_remote_prefetch, 0);
+  remote->num_blocks = MAX(OPTION_remote_cache, remote->prefetch + 3);
+  remote->blocks = calloc(remote->num_blocks, sizeof(struct remote_block));
+
+  for (int i = 0; i < remote->num_blocks; i++) {
+    remote->blocks[i].data = malloc(REMOTE_BLOCK_SIZE);
+  }
+
+  prof_counter_add(COUNTER_mem_disc_cache,
+                   (int64_t)remote->num_blocks * REMOTE_BLOCK_SIZE);
+
+  remote->last_file = -1;
+  remote->mutex = mutex_create();
+  remote->queued_cond = cond_create();
+  remote->ready_cond = cond_create();
+
+  if (remote->prefetch) {
+    remote->prefetch_http = http_create(host, port);
+
+    if (remote->prefetch_http) {
+      remote->prefetch_thread =
+          thread_create(&remote_prefetch_thread, "remote_prefetch", remote);
+      CHECK_NOTNULL(remote->prefetch_thread);
+    }
+  }
+
+  /* blocks are still read without a disk cache if it can't be created, e.g.
+     by tools which don't set up an appdir */
+  const char *appdir = fs_appdir();
+
+  if (appdir[0]) {
+    snprintf(remote->cache_dir, sizeof(remote->cache_dir),
+             "%s" PATH_SEPARATOR "remote-cache", appdir);
+  }
+
+  if (remote->cache_dir[0] && !fs_mkdir(remote->cache_dir)) {
+    LOG_WARNING("remote_parse failed to create %s", remote->cache_dir);
+    remote->cache_dir[0] = 0;
+  }
+
+  return 1;
+}
+
+struct disc *remote_create(const char *url, int verbose) {
+  struct remote *remote = calloc(1, sizeof(struct remote));
+
+  remote->destroy = &remote_destroy;
+  remote->get_format = &remote_get_format;
+  remote->get_num_sessions = &remote_get_num_sessions;
+  remote->get_session = &remote_get_session;
+  remote->get_num_tracks = &remote_get_num_tracks;
+  remote->get_track = &remote_get_track;
+  remote->get_toc = &remote_get_toc;
+  remote->read_sector = &remote_read_sector;
+  remote->read_sectors = &remote_read_sectors;
+
+  struct disc *disc = (struct disc *)remote;
+
+  if (!remote_parse(disc, url, verbose)) {
+    remote_destroy(disc);
+    return NULL;
+  }
+
+  return disc;
+}
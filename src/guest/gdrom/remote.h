@@ -0,0 +1,8 @@
+#ifndef REMOTE_H
+#define REMOTE_H
+
+struct disc;
+
+struct disc *remote_create(const char *url, int verbose);
+
+#endif
@@ -3,9 +3,12 @@
 #include "guest/gdrom/gdrom.h"
 #include "guest/maple/maple.h"
 #include "guest/memory.h"
+#include "guest/savestate.h"
 #include "guest/scheduler.h"
 #include "guest/sh4/sh4.h"
 #include "imgui.h"
+#include "jit/jit.h"
+#include "options.h"
 
 #if 0
 #define LOG_HOLLY LOG_INFO
@@ -18,18 +21,25 @@ struct reg_cb holly_cb[NUM_HOLLY_REGS];
 /*
  * ch2 dma
  */
+static void holly_ch2_dma_end(void *data) {
+  struct holly *hl = data;
+
+  *hl->SB_C2DLEN = 0;
+  *hl->SB_C2DST = 0;
+  holly_raise_interrupt(hl, HOLLY_INT_DTDE2INT);
+}
+
 static void holly_ch2_dma(struct holly *hl) {
   struct sh4 *sh4 = hl->dc->sh4;
 
+  /* SB_C2DST remains set until the transfer completes */
   struct sh4_dtr dtr = {0};
   dtr.channel = 2;
   dtr.dir = SH4_DMA_TO_ADDR;
   dtr.addr = *hl->SB_C2DSTAT;
+  dtr.end = &holly_ch2_dma_end;
+  dtr.end_data = hl;
   sh4_dmac_ddt(sh4, &dtr);
-
-  *hl->SB_C2DLEN = 0;
-  *hl->SB_C2DST = 0;
-  holly_raise_interrupt(hl, HOLLY_INT_DTDE2INT);
 }
 
 /*
@@ -43,10 +53,16 @@ static void holly_gdrom_dma(struct holly *hl) {
 
   struct gdrom *gd = hl->dc->gdrom;
   struct sh4 *sh4 = hl->dc->sh4;
+  struct memory *mem = hl->dc->mem;
 
   /* only gdrom -> sh4 supported for now */
   CHECK_EQ(*hl->SB_GDDIR, 1);
 
+  /* leave the transfer pending until the drive has read the sectors */
+  if (!gdrom_dma_ready(gd)) {
+    return;
+  }
+
   int transfer_size = *hl->SB_GDLEN;
   int remaining = transfer_size;
   uint32_t addr = *hl->SB_GDSTAR;
@@ -55,21 +71,38 @@ static void holly_gdrom_dma(struct holly *hl) {
   gdrom_dma_begin(gd);
 
   while (1) {
-    /* read a single sector at a time from the gdrom */
-    int n = MIN(remaining, (int)sizeof(sector_data));
-    n = gdrom_dma_read(gd, sector_data, n);
+    uint32_t area = addr & SH4_ADDR_MASK;
+    uint32_t ram_offset = area & SH4_AREA3_ADDR_MASK;
+    int n;
 
-    if (!n) {
-      break;
-    }
+    if (area >= SH4_AREA3_BEGIN && area <= SH4_AREA3_END) {
+      /* transfers to ram are read straight into it, letting the gdrom decode
+         whole sectors directly into guest memory */
+      n = MIN(remaining, (int)(SH4_AREA3_ADDR_MASK + 1 - ram_offset));
+      n = gdrom_dma_read(gd, mem_ram(mem, ram_offset), n);
+
+      if (!n) {
+        break;
+      }
+
+      sh4_ccn_invalidate_code(sh4, addr, n);
+    } else {
+      /* else, read a single sector at a time from the gdrom */
+      n = MIN(remaining, (int)sizeof(sector_data));
+      n = gdrom_dma_read(gd, sector_data, n);
 
-    struct sh4_dtr dtr = {0};
-    dtr.channel = 0;
-    dtr.dir = SH4_DMA_TO_ADDR;
-    dtr.data = sector_data;
-    dtr.addr = addr;
-    dtr.size = n;
-    sh4_dmac_ddt(sh4, &dtr);
+      if (!n) {
+        break;
+      }
+
+      struct sh4_dtr dtr = {0};
+      dtr.channel = 0;
+      dtr.dir = SH4_DMA_TO_ADDR;
+      dtr.data = sector_data;
+      dtr.addr = addr;
+      dtr.size = n;
+      sh4_dmac_ddt(sh4, &dtr);
+    }
 
     remaining -= n;
     addr += n;
@@ -83,6 +116,12 @@ static void holly_gdrom_dma(struct holly *hl) {
   holly_raise_interrupt(hl, HOLLY_INT_G1DEINT);
 }
 
+void holly_resume_gdrom_dma(struct holly *hl) {
+  if (*hl->SB_GDST) {
+    holly_gdrom_dma(hl);
+  }
+}
+
 /*
  * maple dma
  */
@@ -158,29 +197,35 @@ static void holly_maple_dma(struct holly *hl) {
 #define SB_SUSP(ch) (hl->SB_ADSUSP + ((ch)*HOLLY_G2_NUM_REGS))
 #define HOLLY_INT_G2INT(ch) HOLLY_INTERRUPT(HOLLY_INT_NRM, (0x8000 << ch))
 
+/* g2 bus runs at 16-bits x 25mhz */
+#define G2_BUS_FREQ UINT64_C(25000000)
+#define G2_BYTES_TO_NANO(bytes) CYCLES_TO_NANO((bytes) / 2, G2_BUS_FREQ)
+
 static void (*g2_timers[4])(void *);
 
-#define DEFINE_G2_DMA_TIMER(ch)                                       \
-  static void holly_g2_dma_timer_channel##ch(void *data) {            \
-    struct holly *hl = data;                                          \
-    struct memory *mem = hl->dc->mem;                                 \
-    struct scheduler *sched = hl->dc->sched;                          \
-    struct holly_g2_dma *dma = &hl->dma[ch];                          \
-    int chunk_size = 0x1000;                                          \
-    int n = MIN(dma->len, chunk_size);                                \
-    sh4_memcpy(mem, dma->dst, dma->src, n);                           \
-    dma->dst += n;                                                    \
-    dma->src += n;                                                    \
-    dma->len -= n;                                                    \
-    if (!dma->len) {                                                  \
-      *SB_EN(ch) = dma->restart;                                      \
-      *SB_ST(ch) = 0;                                                 \
-      holly_raise_interrupt(hl, HOLLY_INT_G2INT(ch));                 \
-      return;                                                         \
-    }                                                                 \
-    /* g2 bus runs at 16-bits x 25mhz, loosely simulate this */       \
-    int64_t end = CYCLES_TO_NANO(chunk_size / 2, UINT64_C(25000000)); \
-    sched_start_timer(sched, g2_timers[ch], hl, end);                 \
+#define DEFINE_G2_DMA_TIMER(ch)                                         \
+  static void holly_g2_dma_timer_channel##ch(void *data) {              \
+    struct holly *hl = data;                                            \
+    struct memory *mem = hl->dc->mem;                                   \
+    struct scheduler *sched = hl->dc->sched;                            \
+    struct holly_g2_dma *dma = &hl->dma[ch];                            \
+    dma->timer = NULL;                                                  \
+    dma->bulk_len = 0;                                                  \
+    int chunk_size = 0x1000;                                            \
+    int n = MIN(dma->len, chunk_size);                                  \
+    sh4_memcpy(mem, dma->dst, dma->src, n);                             \
+    dma->dst += n;                                                      \
+    dma->src += n;                                                      \
+    dma->len -= n;                                                      \
+    if (!dma->len) {                                                    \
+      *SB_EN(ch) = dma->restart;                                        \
+      *SB_ST(ch) = 0;                                                   \
+      holly_raise_interrupt(hl, HOLLY_INT_G2INT(ch));                   \
+      return;                                                           \
+    }                                                                   \
+    /* loosely simulate the bus's speed */                              \
+    int64_t end = G2_BYTES_TO_NANO(chunk_size);                         \
+    dma->timer = sched_start_lazy_timer(sched, g2_timers[ch], hl, end); \
   }
 
 DEFINE_G2_DMA_TIMER(0);
@@ -204,6 +249,63 @@ static void holly_g2_dma_suspend(struct holly *hl, int ch) {
   LOG_HOLLY("holly_g2_dma_suspend ignored");
 }
 
+/* copies transfers from system ram to aram in one go, scheduling a single
+   timer for when the bus would have finished with them. anything else, e.g.
+   transfers to the modem or expansion devices, is left to be chunked */
+static int holly_g2_dma_bulk(struct holly *hl, int ch) {
+  struct memory *mem = hl->dc->mem;
+  struct scheduler *sched = hl->dc->sched;
+  struct holly_g2_dma *dma = &hl->dma[ch];
+
+  uint32_t dst = dma->dst & 0x1fffffff;
+  uint32_t src = dma->src & 0x1fffffff;
+
+  if (dst < SH4_AICA_MEM_BEGIN || dst + dma->len > SH4_AICA_MEM_END + 1) {
+    return 0;
+  }
+
+  if (src < SH4_AREA3_BEGIN || src > SH4_AREA3_END) {
+    return 0;
+  }
+
+  /* the ram is mirrored through area 3, don't wrap around it */
+  uint32_t src_offset = src & SH4_AREA3_ADDR_MASK;
+  if (src_offset + dma->len > SH4_AREA3_ADDR_MASK + 1) {
+    return 0;
+  }
+
+  memcpy(mem_aram(mem, dst - SH4_AICA_MEM_BEGIN), mem_ram(mem, src_offset),
+         dma->len);
+
+  dma->bulk_len = dma->len;
+  dma->dst += dma->len;
+  dma->src += dma->len;
+  dma->len = 0;
+
+  /* with nothing left to copy, the timer only signals completion */
+  int64_t end = G2_BYTES_TO_NANO(dma->bulk_len);
+  dma->timer = sched_start_lazy_timer(sched, g2_timers[ch], hl, end);
+
+  return 1;
+}
+
+/* bytes of a bulk transfer which would still be in flight on the bus */
+static int holly_g2_dma_pending(struct holly *hl, int ch) {
+  struct scheduler *sched = hl->dc->sched;
+  struct holly_g2_dma *dma = &hl->dma[ch];
+
+  if (!dma->timer || !dma->bulk_len) {
+    return 0;
+  }
+
+  int64_t remaining = sched_remaining_time(sched, dma->timer);
+  int64_t pending = NANO_TO_CYCLES(remaining, G2_BUS_FREQ) * 2;
+  pending = CLAMP(pending, 0, (int64_t)dma->bulk_len);
+
+  /* transfers are made in units of 32 bytes */
+  return (int)pending & ~0x1f;
+}
+
 static void holly_g2_dma(struct holly *hl, int ch) {
   if (!*SB_EN(ch)) {
     *SB_ST(ch) = 0;
@@ -223,6 +325,10 @@ static void holly_g2_dma(struct holly *hl, int ch) {
   LOG_HOLLY("holly_g2_dma dst=0x%08x src=0x%08x len=0x%08x", dma->dst, dma->src,
             dma->len);
 
+  if (OPTION_g2_bulk_dma && holly_g2_dma_bulk(hl, ch)) {
+    return;
+  }
+
   /* kick off async dma */
   g2_timers[ch](hl);
 }
@@ -342,12 +448,30 @@ uint32_t holly_reg_read(struct holly *hl, uint32_t addr, uint32_t mask) {
   return data;
 }
 
+uint32_t *holly_reg_ptr(struct holly *hl, uint32_t addr, int write) {
+  uint32_t offset = addr >> 2;
+
+  /* logged accesses must go through holly_reg_read / holly_reg_write */
+  if (hl->log_regs) {
+    return NULL;
+  }
+
+  if (write ? holly_cb[offset].write != NULL : holly_cb[offset].read != NULL) {
+    return NULL;
+  }
+
+  return &hl->reg[offset];
+}
+
 #ifdef HAVE_IMGUI
 void holly_debug_menu(struct holly *hl) {
   if (igBeginMainMenuBar()) {
     if (igBeginMenu("HOLLY", 1)) {
       if (igMenuItem("log reg access", NULL, hl->log_regs, 1)) {
         hl->log_regs = !hl->log_regs;
+
+        /* drop code accessing the registers directly */
+        jit_invalidate_code(hl->dc->sh4->jit);
       }
 
       if (igMenuItem("raise all HOLLY_INT_NRM", NULL, 0, 1)) {
@@ -380,6 +504,40 @@ void holly_debug_menu(struct holly *hl) {
 }
 #endif
 
+static void holly_save(struct device *dev, struct savestate *ss) {
+  struct holly *hl = (struct holly *)dev;
+  struct scheduler *sched = hl->dc->sched;
+
+  SS_WRITE(ss, hl->reg);
+
+  for (int i = 0; i < HOLLY_G2_NUM_CHAN; i++) {
+    struct holly_g2_dma *dma = &hl->dma[i];
+    ss_write_timer(ss, sched, dma->timer);
+    SS_WRITE(ss, dma->dst);
+    SS_WRITE(ss, dma->src);
+    SS_WRITE(ss, dma->restart);
+    SS_WRITE(ss, dma->len);
+  }
+}
+
+static void holly_load(struct device *dev, struct savestate *ss) {
+  struct holly *hl = (struct holly *)dev;
+  struct scheduler *sched = hl->dc->sched;
+
+  SS_READ(ss, hl->reg);
+
+  for (int i = 0; i < HOLLY_G2_NUM_CHAN; i++) {
+    struct holly_g2_dma *dma = &hl->dma[i];
+    dma->timer = ss_read_timer(ss, sched, dma->timer, g2_timers[i], hl, 1);
+    SS_READ(ss, dma->dst);
+    SS_READ(ss, dma->src);
+    SS_READ(ss, dma->restart);
+    SS_READ(ss, dma->len);
+    /* the progress of bulk transfers isn't saved, they report being done */
+    dma->bulk_len = 0;
+  }
+}
+
 void holly_destroy(struct holly *hl) {
   dc_destroy_device((struct device *)hl);
 }
@@ -395,6 +553,11 @@ struct holly *holly_create(struct dreamcast *dc) {
 #include "guest/holly/holly_regs.inc"
 #undef HOLLY_REG
 
+  /* setup state interface */
+  hl->stateif.enabled = 1;
+  hl->stateif.save = &holly_save;
+  hl->stateif.load = &holly_load;
+
   return hl;
 }
 
@@ -583,19 +746,19 @@ REG_W32(holly_cb, SB_ADTSEL) {
 REG_R32(holly_cb, SB_ADSTAGD) {
   struct holly *hl = dc->holly;
   struct holly_g2_dma *dma = &hl->dma[0];
-  return dma->dst;
+  return dma->dst - holly_g2_dma_pending(hl, 0);
 }
 
 REG_R32(holly_cb, SB_ADSTARD) {
   struct holly *hl = dc->holly;
   struct holly_g2_dma *dma = &hl->dma[0];
-  return dma->src;
+  return dma->src - holly_g2_dma_pending(hl, 0);
 }
 
 REG_R32(holly_cb, SB_ADLEND) {
   struct holly *hl = dc->holly;
   struct holly_g2_dma *dma = &hl->dma[0];
-  return dma->len;
+  return dma->len + holly_g2_dma_pending(hl, 0);
 }
 
 REG_W32(holly_cb, SB_E1ST) {
@@ -632,19 +795,19 @@ REG_W32(holly_cb, SB_E1TSEL) {
 REG_R32(holly_cb, SB_E1STAGD) {
   struct holly *hl = dc->holly;
   struct holly_g2_dma *dma = &hl->dma[1];
-  return dma->dst;
+  return dma->dst - holly_g2_dma_pending(hl, 1);
 }
 
 REG_R32(holly_cb, SB_E1STARD) {
   struct holly *hl = dc->holly;
   struct holly_g2_dma *dma = &hl->dma[1];
-  return dma->src;
+  return dma->src - holly_g2_dma_pending(hl, 1);
 }
 
 REG_R32(holly_cb, SB_E1LEND) {
   struct holly *hl = dc->holly;
   struct holly_g2_dma *dma = &hl->dma[1];
-  return dma->len;
+  return dma->len + holly_g2_dma_pending(hl, 1);
 }
 
 REG_W32(holly_cb, SB_E2ST) {
@@ -681,19 +844,19 @@ REG_W32(holly_cb, SB_E2TSEL) {
 REG_R32(holly_cb, SB_E2STAGD) {
   struct holly *hl = dc->holly;
   struct holly_g2_dma *dma = &hl->dma[2];
-  return dma->dst;
+  return dma->dst - holly_g2_dma_pending(hl, 2);
 }
 
 REG_R32(holly_cb, SB_E2STARD) {
   struct holly *hl = dc->holly;
   struct holly_g2_dma *dma = &hl->dma[2];
-  return dma->src;
+  return dma->src - holly_g2_dma_pending(hl, 2);
 }
 
 REG_R32(holly_cb, SB_E2LEND) {
   struct holly *hl = dc->holly;
   struct holly_g2_dma *dma = &hl->dma[2];
-  return dma->len;
+  return dma->len + holly_g2_dma_pending(hl, 2);
 }
 
 REG_W32(holly_cb, SB_DDST) {
@@ -730,19 +893,19 @@ REG_W32(holly_cb, SB_DDTSEL) {
 REG_R32(holly_cb, SB_DDSTAGD) {
   struct holly *hl = dc->holly;
   struct holly_g2_dma *dma = &hl->dma[3];
-  return dma->dst;
+  return dma->dst - holly_g2_dma_pending(hl, 3);
 }
 
 REG_R32(holly_cb, SB_DDSTARD) {
   struct holly *hl = dc->holly;
   struct holly_g2_dma *dma = &hl->dma[3];
-  return dma->src;
+  return dma->src - holly_g2_dma_pending(hl, 3);
 }
 
 REG_R32(holly_cb, SB_DDLEND) {
   struct holly *hl = dc->holly;
   struct holly_g2_dma *dma = &hl->dma[3];
-  return dma->len;
+  return dma->len + holly_g2_dma_pending(hl, 3);
 }
 
 REG_W32(holly_cb, SB_PDST) {
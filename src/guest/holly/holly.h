@@ -12,10 +12,15 @@ struct sh4;
 #define HOLLY_G2_NUM_REGS 8
 
 struct holly_g2_dma {
+  struct timer *timer;
   uint32_t dst;
   uint32_t src;
   int restart;
   int len;
+  /* size of a transfer copied in bulk when it was started. until its
+     completion timer expires, the registers report the progress a chunked
+     transfer would have made */
+  int bulk_len;
 };
 
 struct holly {
@@ -43,7 +48,14 @@ uint32_t holly_reg_read(struct holly *hl, uint32_t addr, uint32_t mask);
 void holly_reg_write(struct holly *hl, uint32_t addr, uint32_t data,
                      uint32_t mask);
 
+/* backing storage for a register whose reads (or writes) have no side
+   effects, letting the jit access it directly. NULL otherwise */
+uint32_t *holly_reg_ptr(struct holly *hl, uint32_t addr, int write);
+
 void holly_raise_interrupt(struct holly *hl, holly_interrupt_t intr);
 void holly_clear_interrupt(struct holly *hl, holly_interrupt_t intr);
 
+/* run a gd-rom dma transfer that was waiting on the drive */
+void holly_resume_gdrom_dma(struct holly *hl);
+
 #endif
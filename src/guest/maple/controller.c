@@ -69,6 +69,8 @@ static int controller_frame(struct maple_device *dev,
     } break;
 
     case MAPLE_REQ_GETCOND: {
+      maple_poll_input(dev->mp);
+
       res->cmd = MAPLE_RES_TRANSFER;
       res->num_words = sizeof(ctrl->cnd) >> 2;
       memcpy(res->params, &ctrl->cnd, sizeof(ctrl->cnd));
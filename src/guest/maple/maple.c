@@ -76,6 +76,10 @@ void maple_handle_input(struct maple *mp, int port, int button, int16_t value) {
   }
 }
 
+void maple_poll_input(struct maple *mp) {
+  dc_poll_input(mp->dc);
+}
+
 struct maple_device *maple_get_device(struct maple *mp, int port, int unit) {
   return mp->devs[port][unit];
 }
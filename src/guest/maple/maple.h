@@ -23,6 +23,9 @@ void maple_destroy(struct maple *mp);
 
 struct maple_device *maple_get_device(struct maple *mp, int port, int unit);
 void maple_handle_input(struct maple *mp, int port, int button, int16_t value);
+
+/* ask the client for the latest input, right before a device reports it */
+void maple_poll_input(struct maple *mp);
 int maple_handle_frame(struct maple *mp, int port, union maple_frame *frame,
                        union maple_frame *res);
 
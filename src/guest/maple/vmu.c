@@ -1,5 +1,6 @@
 #include "core/core.h"
 #include "core/filesystem.h"
+#include "file/image_writer.h"
 #include "guest/maple/maple.h"
 #include "guest/maple/vmu_default.inc"
 
@@ -10,39 +11,46 @@
 #define LCD_WIDTH 48
 #define LCD_HEIGHT 32
 
+#define VMU_SIZE ((int)sizeof(vmu_default))
+
+/* saves write many blocks in quick succession, the image is only written
+   back once they settle */
+#define VMU_FLUSH_DELAY_MS 500
+
 struct vmu {
   struct maple_device;
 
-  /* note, a persistent file handle isn't kept open here, writes are instead
-     performed immediately to avoid corrupt saves in the event of a crash */
+  /* the image is served from memory, and written back to disk on a thread to
+     keep file i/o off of the emulation thread */
   char filename[PATH_MAX];
+  uint8_t data[VMU_SIZE];
+  struct image_writer *writer;
 };
 
 static void vmu_write_bin(struct vmu *vmu, int block, int phase,
                           const void *buffer, int num_words) {
   int offset = BLK_OFFSET(block, phase);
   int size = num_words << 2;
+  CHECK(offset >= 0 && size >= 0 && offset + size <= VMU_SIZE);
 
-  FILE *file = fopen(vmu->filename, "r+b");
-  CHECK_NOTNULL(file, "failed to open %s", vmu->filename);
-  int r = fseek(file, offset, SEEK_SET);
-  CHECK_NE(r, -1);
-  r = (int)fwrite(buffer, 1, size, file);
-  CHECK_EQ(r, size);
-  fclose(file);
+  memcpy(&vmu->data[offset], buffer, size);
+  image_writer_write(vmu->writer, offset, buffer, size);
 }
 
 static void vmu_read_bin(struct vmu *vmu, int block, int phase, void *buffer,
                          int num_words) {
   int offset = BLK_OFFSET(block, phase);
   int size = num_words << 2;
+  CHECK(offset >= 0 && size >= 0 && offset + size <= VMU_SIZE);
 
+  memcpy(buffer, &vmu->data[offset], size);
+}
+
+static void vmu_load_image(struct vmu *vmu) {
   FILE *file = fopen(vmu->filename, "rb");
   CHECK_NOTNULL(file, "failed to open %s", vmu->filename);
-  int r = fseek(file, offset, SEEK_SET);
-  CHECK_NE(r, -1);
-  r = (int)fread(buffer, 1, size, file);
-  CHECK_EQ(r, size);
+  int r = (int)fread(vmu->data, 1, VMU_SIZE, file);
+  CHECK_EQ(r, VMU_SIZE);
   fclose(file);
 }
 
@@ -203,6 +211,7 @@ static int vmu_frame(struct maple_device *dev, const union maple_frame *req,
 
 static void vmu_destroy(struct maple_device *dev) {
   struct vmu *vmu = (struct vmu *)dev;
+  image_writer_destroy(vmu->writer);
   free(vmu);
 }
 
@@ -227,5 +236,10 @@ struct maple_device *vmu_create(struct maple *mp, int port) {
     fclose(file);
   }
 
+  vmu_load_image(vmu);
+
+  vmu->writer = image_writer_create(vmu->filename, vmu->data, VMU_SIZE,
+                                    BLK_SIZE, VMU_FLUSH_DELAY_MS);
+
   return (struct maple_device *)vmu;
 }
@@ -25,9 +25,15 @@
 #include <stdint.h>
 #include "guest/memory.h"
 #include "core/core.h"
+#include "core/filesystem.h"
+#include "core/sort.h"
 #include "guest/arm7/arm7.h"
 #include "guest/dreamcast.h"
+#include "guest/savestate.h"
 #include "guest/sh4/sh4.h"
+#include "imgui.h"
+#include "options.h"
+#include "stats.h"
 
 /* physical memory constants */
 #define RAM_SIZE 16 * 1024 * 1024
@@ -36,7 +42,16 @@
 #define VRAM_OFFSET RAM_SIZE
 #define ARAM_SIZE 2 * 1024 * 1024
 #define ARAM_OFFSET VRAM_OFFSET + VRAM_SIZE
-#define PHYSICAL_SIZE RAM_SIZE + VRAM_SIZE + ARAM_SIZE
+/* the sh4's operand cache ram, padded out to keep the mapping 2mb aligned */
+#define OCRAM_SIZE 2 * 1024 * 1024
+#define OCRAM_OFFSET ARAM_OFFSET + ARAM_SIZE
+#define PHYSICAL_SIZE RAM_SIZE + VRAM_SIZE + ARAM_SIZE + OCRAM_SIZE
+
+/* the operand cache ram's 4kb banks are mirrored throughout the cache area.
+   only the start of each 32mb half is mapped directly for fastmem accesses,
+   anything past it faults into the mmio handlers */
+#define OCRAM_BANK_SIZE 0x1000
+#define OCRAM_MIRROR_SIZE 0x10000
 
 /* page table constants */
 #define MEM_PAGE_BITS 11
@@ -45,6 +60,25 @@
 #define MEM_PAGE_SHIFT MEM_OFFSET_BITS
 #define MEM_OFFSET_MASK ((1 << MEM_OFFSET_BITS) - 1)
 
+/* mmio histogram constants */
+#define MEM_MAX_STATS 4096
+#define MEM_STAT_PCS 4
+#define MEM_STATS_SHOWN 32
+
+/* accesses made to a single mmio register. the guest pcs making the most
+   accesses are tracked approximately, the least frequent one being replaced
+   once all slots are taken. note, the jit only writes the pc back to the
+   context at block boundaries, so for jitted code it's the address of the
+   block containing the access */
+struct mmio_stat {
+  int used;
+  uint32_t addr;
+  int64_t reads;
+  int64_t writes;
+  uint32_t pcs[MEM_STAT_PCS];
+  int64_t pc_counts[MEM_STAT_PCS];
+};
+
 /* address spaces provide different views of the same physical memory */
 struct address_space {
   uint8_t *base;
@@ -55,6 +89,10 @@ struct address_space {
   mmio_write_cb write[MEM_MAX_PAGES];
   mmio_read_string_cb read_string[MEM_MAX_PAGES];
   mmio_write_string_cb write_string[MEM_MAX_PAGES];
+
+  /* open addressed table of mmio access counts, only allocated when the
+     histogram is enabled */
+  struct mmio_stat *stats;
 };
 
 struct memory {
@@ -64,16 +102,32 @@ struct memory {
   /* shared memory object that backs the ram / vram / aram when using
      fastmem */
   shmem_handle_t shmem;
+
+  /* the operand cache ram is mirrored with 4kb mappings, which isn't possible
+     on hosts with a larger allocation granularity */
+  int ocram_mirrors;
 #endif
 
+  /* bytes allocated to back the physical memory */
+  int64_t size;
+
   /* the machine's physical memory */
   uint8_t *ram;
   uint8_t *vram;
   uint8_t *aram;
+  uint8_t *ocram;
 
   /* each cpu has a different address space */
   struct address_space arm7;
   struct address_space sh4;
+
+  /* tracks writes to system ram for sh4_scan_ram_writes, ram_tracking is
+     set once every mapping of it has been registered */
+  struct write_tracker *ram_tracker;
+  int ram_tracking;
+  int ram_untracked;
+
+  int show_stats;
 };
 
 static int reserve_address_space(uint8_t **base) {
@@ -113,6 +167,96 @@ static void mem_unhandled_write(struct memory *mem, uint32_t addr,
   LOG_WARNING("mem_unhandled_write addr=0x%08x", addr);
 }
 
+/*
+ * mmio histogram
+ */
+static void mem_record_pc(struct mmio_stat *stat, uint32_t pc) {
+  int min = 0;
+
+  for (int i = 0; i < MEM_STAT_PCS; i++) {
+    if (stat->pc_counts[i] && stat->pcs[i] == pc) {
+      stat->pc_counts[i]++;
+      return;
+    }
+    if (stat->pc_counts[i] < stat->pc_counts[min]) {
+      min = i;
+    }
+  }
+
+  /* the new pc inherits the replaced count, bounding how much any entry's
+     count can be overestimated by */
+  stat->pcs[min] = pc;
+  stat->pc_counts[min]++;
+}
+
+static void mem_record_mmio(struct address_space *space, uint32_t addr,
+                            uint32_t pc, int write) {
+  uint32_t mask = MEM_MAX_STATS - 1;
+  uint32_t i = ((addr >> 2) * 2654435761u) & mask;
+
+  for (int n = 0; n < MEM_MAX_STATS; n++, i = (i + 1) & mask) {
+    struct mmio_stat *stat = &space->stats[i];
+
+    if (stat->used && stat->addr != addr) {
+      continue;
+    }
+
+    stat->used = 1;
+    stat->addr = addr;
+
+    if (write) {
+      stat->writes++;
+    } else {
+      stat->reads++;
+    }
+
+    mem_record_pc(stat, pc);
+    return;
+  }
+
+  /* table is full, the access goes unrecorded */
+}
+
+/* the pc and a canonical address for each register, folding the sh4's
+   mirrors in p0-p3 onto one another */
+static inline uint32_t mem_arm7_pc(struct memory *mem) {
+  return arm7_pc(mem->dc->arm7);
+}
+
+static inline uint32_t mem_arm7_reg(uint32_t addr) {
+  return addr;
+}
+
+static inline uint32_t mem_sh4_pc(struct memory *mem) {
+  return mem->dc->sh4->ctx.pc;
+}
+
+static inline uint32_t mem_sh4_reg(uint32_t addr) {
+  return addr < 0xe0000000 ? addr & 0x1fffffff : addr;
+}
+
+static int mem_stat_cmp(const void *a, const void *b) {
+  const struct mmio_stat *lhs = *(const struct mmio_stat **)a;
+  const struct mmio_stat *rhs = *(const struct mmio_stat **)b;
+  return lhs->reads + lhs->writes >= rhs->reads + rhs->writes;
+}
+
+/* returns the used entries sorted by total accesses, most accessed first */
+static int mem_sorted_stats(struct address_space *space,
+                            struct mmio_stat **sorted) {
+  int num = 0;
+
+  for (int i = 0; i < MEM_MAX_STATS; i++) {
+    if (space->stats[i].used) {
+      sorted[num++] = &space->stats[i];
+    }
+  }
+
+  msort(sorted, num, sizeof(struct mmio_stat *), &mem_stat_cmp);
+
+  return num;
+}
+
 /*
  * address space common
  */
@@ -123,6 +267,81 @@ enum {
   MAP_ARAM,
 };
 
+/* bytes left in the page containing addr. the memcpy helpers split copies at
+   page boundaries, as each page may be backed by a different mapping */
+static inline uint32_t mem_page_remaining(uint32_t addr) {
+  return (MEM_OFFSET_MASK + 1) - (addr & MEM_OFFSET_MASK);
+}
+
+/* copy helpers for mmio pages without a string callback. 32-bit accesses are
+   used whenever the guest address is aligned, falling back to byte accesses
+   for the unaligned head and tail */
+static void mem_read_mmio(void *userdata, mmio_read_cb read,
+                          mmio_read_string_cb read_string, uint8_t *ptr,
+                          uint32_t src, int size) {
+  if (read_string) {
+    read_string(userdata, ptr, src, size);
+    return;
+  }
+
+  while (size > 0) {
+    if (size >= 4 && !(src & 3)) {
+      *(uint32_t *)ptr = read(userdata, src, 0xffffffff);
+      ptr += 4;
+      src += 4;
+      size -= 4;
+    } else {
+      *ptr = read(userdata, src, 0xff);
+      ptr++;
+      src++;
+      size--;
+    }
+  }
+}
+
+static void mem_write_mmio(void *userdata, mmio_write_cb write,
+                           mmio_write_string_cb write_string, uint32_t dst,
+                           const uint8_t *ptr, int size) {
+  if (write_string) {
+    write_string(userdata, dst, ptr, size);
+    return;
+  }
+
+  while (size > 0) {
+    if (size >= 4 && !(dst & 3)) {
+      write(userdata, dst, *(const uint32_t *)ptr, 0xffffffff);
+      ptr += 4;
+      dst += 4;
+      size -= 4;
+    } else {
+      write(userdata, dst, *ptr, 0xff);
+      ptr++;
+      dst++;
+      size--;
+    }
+  }
+}
+
+static void mem_copy_mmio(void *userdata, mmio_read_cb read,
+                          mmio_write_cb write, uint32_t dst, uint32_t src,
+                          int size) {
+  while (size > 0) {
+    if (size >= 4 && !(src & 3) && !(dst & 3)) {
+      uint32_t data = read(userdata, src, 0xffffffff);
+      write(userdata, dst, data, 0xffffffff);
+      src += 4;
+      dst += 4;
+      size -= 4;
+    } else {
+      uint8_t data = read(userdata, src, 0xff);
+      write(userdata, dst, data, 0xff);
+      src++;
+      dst++;
+      size--;
+    }
+  }
+}
+
 #define DEFINE_ADDRESS_SPACE(space)             \
   define_lookup_ex(space);                      \
   define_lookup(space);                         \
@@ -135,7 +354,8 @@ enum {
   define_read_bytes(space, read32, uint32_t);   \
   define_read_bytes(space, read16, uint16_t);   \
   define_read_bytes(space, read8, uint8_t);     \
-  define_base(space);
+  define_base(space);                           \
+  define_page_table(space);
 
 #define define_lookup_ex(space)                                               \
   static void space##_lookup_ex(                                              \
@@ -163,103 +383,110 @@ enum {
     }                                                                         \
   }
 
+/* while recording the mmio histogram, the jit isn't handed the callbacks to
+   invoke directly, routing its accesses through the generic handlers */
 #define define_lookup(space)                                              \
   void space##_lookup(struct memory *mem, uint32_t addr, void **userdata, \
                       uint8_t **ptr, mmio_read_cb *read,                  \
                       mmio_write_cb *write) {                             \
     space##_lookup_ex(mem, addr, userdata, ptr, read, write, NULL, NULL); \
+    if (mem->space.stats && read) {                                       \
+      *read = NULL;                                                       \
+    }                                                                     \
+    if (mem->space.stats && write) {                                      \
+      *write = NULL;                                                      \
+    }                                                                     \
   }
 
 #define define_memcpy(space)                                                   \
   void space##_memcpy(struct memory *mem, uint32_t dst, uint32_t src,          \
                       int size) {                                              \
-    uint8_t *pdst = NULL;                                                      \
-    mmio_write_cb write = NULL;                                                \
-    mmio_write_string_cb write_string = NULL;                                  \
-    space##_lookup_ex(mem, dst, NULL, &pdst, NULL, &write, NULL,               \
-                      &write_string);                                          \
+    void *userdata = mem->dc->space;                                           \
                                                                                \
-    uint8_t *psrc = NULL;                                                      \
-    mmio_read_cb read = NULL;                                                  \
-    mmio_read_string_cb read_string = NULL;                                    \
-    space##_lookup_ex(mem, src, NULL, &psrc, &read, NULL, &read_string, NULL); \
+    while (size > 0) {                                                         \
+      uint8_t *pdst = NULL;                                                    \
+      mmio_write_cb write = NULL;                                              \
+      mmio_write_string_cb write_string = NULL;                                \
+      space##_lookup_ex(mem, dst, NULL, &pdst, NULL, &write, NULL,             \
+                        &write_string);                                        \
                                                                                \
-    if (pdst && psrc) {                                                        \
-      memcpy(pdst, psrc, size);                                                \
-    } else if (pdst && read_string) {                                          \
-      read_string(mem->dc->space, pdst, src, size);                            \
-    } else if (psrc && write_string) {                                         \
-      write_string(mem->dc->space, dst, psrc, size);                           \
-    } else if (pdst) {                                                         \
-      uint32_t end = src + size;                                               \
-      while (src < end) {                                                      \
-        *pdst = read(mem->dc->space, src, 0xff);                               \
-        pdst++;                                                                \
-        src++;                                                                 \
-      }                                                                        \
-    } else if (psrc) {                                                         \
-      uint32_t end = dst + size;                                               \
-      while (dst < end) {                                                      \
-        write(mem->dc->space, dst, *psrc, 0xff);                               \
-        psrc++;                                                                \
-        dst++;                                                                 \
-      }                                                                        \
-    } else {                                                                   \
-      uint32_t end = src + size;                                               \
-      while (src < end) {                                                      \
-        uint8_t data = read(mem->dc->space, src, 0xff);                        \
-        write(mem->dc->space, dst, data, 0xff);                                \
-        src++;                                                                 \
-        dst++;                                                                 \
+      uint8_t *psrc = NULL;                                                    \
+      mmio_read_cb read = NULL;                                                \
+      mmio_read_string_cb read_string = NULL;                                  \
+      space##_lookup_ex(mem, src, NULL, &psrc, &read, NULL, &read_string,      \
+                        NULL);                                                 \
+                                                                               \
+      int n = MIN(size, (int)MIN(mem_page_remaining(dst),                      \
+                                 mem_page_remaining(src)));                    \
+                                                                               \
+      if (pdst && psrc) {                                                      \
+        memcpy(pdst, psrc, n);                                                 \
+      } else if (pdst) {                                                       \
+        mem_read_mmio(userdata, read, read_string, pdst, src, n);              \
+      } else if (psrc) {                                                       \
+        mem_write_mmio(userdata, write, write_string, dst, psrc, n);           \
+      } else {                                                                 \
+        mem_copy_mmio(userdata, read, write, dst, src, n);                     \
       }                                                                        \
+                                                                               \
+      dst += n;                                                                \
+      src += n;                                                                \
+      size -= n;                                                               \
     }                                                                          \
   }
 
-#define define_memcpy_to_host(space)                                           \
-  void space##_memcpy_to_host(struct memory *mem, void *ptr, uint32_t src,     \
-                              int size) {                                      \
-    uint8_t *pdst = ptr;                                                       \
-    uint8_t *psrc = NULL;                                                      \
-    mmio_read_cb read = NULL;                                                  \
-    mmio_read_string_cb read_string = NULL;                                    \
-    space##_lookup_ex(mem, src, NULL, &psrc, &read, NULL, &read_string, NULL); \
-                                                                               \
-    if (psrc) {                                                                \
-      memcpy(pdst, psrc, size);                                                \
-    } else if (read_string) {                                                  \
-      read_string(mem->dc->space, pdst, src, size);                            \
-    } else {                                                                   \
-      uint32_t end = src + size;                                               \
-      while (src < end) {                                                      \
-        *pdst = read(mem->dc->space, src, 0xff);                               \
-        pdst++;                                                                \
-        src++;                                                                 \
-      }                                                                        \
-    }                                                                          \
+#define define_memcpy_to_host(space)                                         \
+  void space##_memcpy_to_host(struct memory *mem, void *ptr, uint32_t src,   \
+                              int size) {                                    \
+    void *userdata = mem->dc->space;                                         \
+    uint8_t *pdst = ptr;                                                     \
+                                                                             \
+    while (size > 0) {                                                       \
+      uint8_t *psrc = NULL;                                                  \
+      mmio_read_cb read = NULL;                                              \
+      mmio_read_string_cb read_string = NULL;                                \
+      space##_lookup_ex(mem, src, NULL, &psrc, &read, NULL, &read_string,    \
+                        NULL);                                               \
+                                                                             \
+      int n = MIN(size, (int)mem_page_remaining(src));                       \
+                                                                             \
+      if (psrc) {                                                            \
+        memcpy(pdst, psrc, n);                                               \
+      } else {                                                               \
+        mem_read_mmio(userdata, read, read_string, pdst, src, n);            \
+      }                                                                      \
+                                                                             \
+      pdst += n;                                                             \
+      src += n;                                                              \
+      size -= n;                                                             \
+    }                                                                        \
   }
 
-#define define_memcpy_to_guest(space)                            \
-  void space##_memcpy_to_guest(struct memory *mem, uint32_t dst, \
-                               const void *ptr, int size) {      \
-    const uint8_t *psrc = ptr;                                   \
-    uint8_t *pdst = NULL;                                        \
-    mmio_write_cb write = NULL;                                  \
-    mmio_write_string_cb write_string = NULL;                    \
-    space##_lookup_ex(mem, dst, NULL, &pdst, NULL, &write, NULL, \
-                      &write_string);                            \
-                                                                 \
-    if (pdst) {                                                  \
-      memcpy(pdst, psrc, size);                                  \
-    } else if (write_string) {                                   \
-      write_string(mem->dc->space, dst, psrc, size);             \
-    } else {                                                     \
-      uint32_t end = dst + size;                                 \
-      while (dst < end) {                                        \
-        write(mem->dc->space, dst, *psrc, 0xff);                 \
-        psrc++;                                                  \
-        dst++;                                                   \
-      }                                                          \
-    }                                                            \
+#define define_memcpy_to_guest(space)                                 \
+  void space##_memcpy_to_guest(struct memory *mem, uint32_t dst,      \
+                               const void *ptr, int size) {           \
+    void *userdata = mem->dc->space;                                  \
+    const uint8_t *psrc = ptr;                                        \
+                                                                      \
+    while (size > 0) {                                                \
+      uint8_t *pdst = NULL;                                           \
+      mmio_write_cb write = NULL;                                     \
+      mmio_write_string_cb write_string = NULL;                       \
+      space##_lookup_ex(mem, dst, NULL, &pdst, NULL, &write, NULL,    \
+                        &write_string);                               \
+                                                                      \
+      int n = MIN(size, (int)mem_page_remaining(dst));                \
+                                                                      \
+      if (pdst) {                                                     \
+        memcpy(pdst, psrc, n);                                        \
+      } else {                                                        \
+        mem_write_mmio(userdata, write, write_string, dst, psrc, n);  \
+      }                                                               \
+                                                                      \
+      psrc += n;                                                      \
+      dst += n;                                                       \
+      size -= n;                                                      \
+    }                                                                 \
   }
 
 #define define_write_bytes(space, name, data_type)                           \
@@ -271,6 +498,10 @@ enum {
       *(data_type *)(ptr + addr) = data;                                     \
       return;                                                                \
     }                                                                        \
+    if (mem->space.stats) {                                                  \
+      mem_record_mmio(&mem->space, mem_##space##_reg(addr),                  \
+                      mem_##space##_pc(mem), 1);                             \
+    }                                                                        \
     const uint32_t data_mask = (UINT64_C(1) << (sizeof(data_type) * 8)) - 1; \
     mmio_write_cb write = mem->space.write[page];                            \
     write(mem->dc->space, addr, data, data_mask);                            \
@@ -284,6 +515,10 @@ enum {
       addr &= MEM_OFFSET_MASK;                                               \
       return *(data_type *)(ptr + addr);                                     \
     }                                                                        \
+    if (mem->space.stats) {                                                  \
+      mem_record_mmio(&mem->space, mem_##space##_reg(addr),                  \
+                      mem_##space##_pc(mem), 0);                             \
+    }                                                                        \
     const uint32_t data_mask = (UINT64_C(1) << (sizeof(data_type) * 8)) - 1; \
     mmio_read_cb read = mem->space.read[page];                               \
     return read(mem->dc->space, addr, data_mask);                            \
@@ -294,6 +529,12 @@ enum {
     return mem->space.base;                   \
   }
 
+#define define_page_table(space)                                   \
+  uint8_t **space##_page_table(struct memory *mem, int *shift) { \
+    *shift = MEM_PAGE_SHIFT;                                     \
+    return mem->space.ptrs;                                      \
+  }
+
 static void as_map(struct memory *mem, struct address_space *space,
                    uint32_t begin, uint32_t size, int type, mmio_read_cb read,
                    mmio_write_cb write, mmio_read_string_cb read_string,
@@ -366,6 +607,10 @@ static int as_init(struct address_space *space) {
     space->write[i] = (mmio_write_cb)&mem_unhandled_write;
   }
 
+  if (OPTION_mmio_histogram) {
+    space->stats = calloc(MEM_MAX_STATS, sizeof(struct mmio_stat));
+  }
+
 #ifdef HAVE_FASTMEM
   if (!reserve_address_space(&space->base)) {
     return 0;
@@ -404,6 +649,23 @@ int arm7_init(struct memory *mem) {
  */
 DEFINE_ADDRESS_SPACE(sh4);
 
+/* only the sh4's area 0 has registers backed by plain storage. as with
+   sh4_lookup, the histogram needs every access to go through the handlers */
+uint32_t *sh4_lookup_reg(struct memory *mem, uint32_t addr, int write) {
+  int page = addr >> MEM_PAGE_SHIFT;
+
+  if (mem->sh4.stats || (addr & 3)) {
+    return NULL;
+  }
+
+  if (write ? mem->sh4.write[page] != (mmio_write_cb)&sh4_area0_write
+            : mem->sh4.read[page] != (mmio_read_cb)&sh4_area0_read) {
+    return NULL;
+  }
+
+  return sh4_area0_reg(mem->dc->sh4, addr, write);
+}
+
 /* physical memory mirrors */
 enum {
   P0 = 0x01,
@@ -453,6 +715,151 @@ static void sh4_map(struct memory *mem, uint32_t begin, uint32_t end,
   }
 }
 
+#ifdef HAVE_FASTMEM
+static int sh4_map_ocram_mirrors(struct memory *mem, int oix) {
+  struct address_space *space = &mem->sh4;
+  uint32_t half = (SH4_CACHE_END - SH4_CACHE_BEGIN + 1) >> 1;
+
+  for (uint32_t begin = 0; begin < 2 * half; begin += half) {
+    for (uint32_t offset = 0; offset < OCRAM_MIRROR_SIZE;
+         offset += OCRAM_BANK_SIZE) {
+      uint32_t addr = begin + offset;
+      uint8_t *target = space->base + SH4_CACHE_BEGIN + addr;
+      int bank = SH4_CACHE_OFFSET(addr, oix);
+      void *res = map_shared_memory(mem->shmem, OCRAM_OFFSET + bank, target,
+                                    OCRAM_BANK_SIZE, ACC_READWRITE);
+
+      if (res == SHMEM_MAP_FAILED) {
+        return 0;
+      }
+    }
+  }
+
+  return 1;
+}
+#endif
+
+void sh4_map_ocram(struct memory *mem, int enabled, int oix) {
+#ifdef HAVE_FASTMEM
+  struct address_space *space = &mem->sh4;
+  uint32_t half = (SH4_CACHE_END - SH4_CACHE_BEGIN + 1) >> 1;
+
+  if (enabled && mem->ocram_mirrors) {
+    if (sh4_map_ocram_mirrors(mem, oix)) {
+      return;
+    }
+
+    LOG_WARNING("sh4_map_ocram failed to mirror operand cache ram, falling "
+                "back to mmio handlers");
+    mem->ocram_mirrors = 0;
+  }
+
+  /* disable access, leaving the mmio handlers to service any accesses */
+  for (uint32_t begin = 0; begin < 2 * half; begin += half) {
+    uint8_t *target = space->base + SH4_CACHE_BEGIN + begin;
+    void *res = map_shared_memory(mem->shmem, 0x0, target, OCRAM_MIRROR_SIZE,
+                                  ACC_NONE);
+    CHECK_NE(res, SHMEM_MAP_FAILED);
+  }
+#endif
+}
+
+/* host mappings of system ram, each spanning its 4 mirrors in area 3 when
+   using fastmem */
+static int sh4_ram_mappings(struct memory *mem, uint8_t **ptrs, int *sizes) {
+  int n = 0;
+
+  ptrs[n] = mem->ram;
+  sizes[n++] = RAM_SIZE;
+
+#ifdef HAVE_FASTMEM
+  static const uint32_t regions[] = {
+      SH4_P0_00_BEGIN, SH4_P0_01_BEGIN, SH4_P0_10_BEGIN, SH4_P0_11_BEGIN,
+      SH4_P1_BEGIN,    SH4_P2_BEGIN,    SH4_P3_BEGIN,    SH4_P4_BEGIN,
+  };
+
+  for (int i = 0; i < (int)ARRAY_SIZE(regions); i++) {
+    ptrs[n] = mem->sh4.base + (regions[i] | SH4_AREA3_RAM0_BEGIN);
+    sizes[n++] = SH4_AREA3_RAM3_END - SH4_AREA3_RAM0_BEGIN + 1;
+  }
+#endif
+
+  return n;
+}
+
+#define SH4_MAX_RAM_MAPPINGS 9
+
+struct ram_scan {
+  ram_write_cb cb;
+  void *data;
+  uint8_t *base;
+};
+
+static void sh4_scan_ram_run(void *data, uintptr_t begin, uintptr_t end) {
+  struct ram_scan *scan = data;
+
+  /* split the run at each mirror, passing on offsets into ram */
+  while (begin < end) {
+    uint32_t offset = (uint32_t)(begin - (uintptr_t)scan->base) % (RAM_SIZE);
+    int size = (int)MIN(end - begin, (uintptr_t)(RAM_SIZE) - offset);
+
+    scan->cb(scan->data, SH4_AREA3_RAM0_BEGIN + offset, size);
+
+    begin += size;
+  }
+}
+
+int sh4_scan_ram_writes(struct memory *mem, ram_write_cb cb, void *data) {
+  if (!mem->ram_tracking) {
+    return 0;
+  }
+
+  uint8_t *ptrs[SH4_MAX_RAM_MAPPINGS];
+  int sizes[SH4_MAX_RAM_MAPPINGS];
+  int n = sh4_ram_mappings(mem, ptrs, sizes);
+
+  for (int i = 0; i < n; i++) {
+    struct ram_scan scan = {cb, data, ptrs[i]};
+
+    if (!write_tracker_scan(mem->ram_tracker, ptrs[i], sizes[i],
+                            &sh4_scan_ram_run, &scan)) {
+      mem->ram_tracking = 0;
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+int sh4_track_ram_writes(struct memory *mem) {
+  if (mem->ram_untracked) {
+    return 0;
+  }
+
+  if (!mem->ram_tracker) {
+    mem->ram_tracker = write_tracker_create();
+  }
+
+  uint8_t *ptrs[SH4_MAX_RAM_MAPPINGS];
+  int sizes[SH4_MAX_RAM_MAPPINGS];
+  int n = sh4_ram_mappings(mem, ptrs, sizes);
+
+  mem->ram_tracking = mem->ram_tracker != NULL;
+
+  for (int i = 0; i < n && mem->ram_tracking; i++) {
+    mem->ram_tracking = write_tracker_reset(mem->ram_tracker, ptrs[i],
+                                            sizes[i]);
+  }
+
+  /* don't keep trying on hosts without support */
+  if (!mem->ram_tracking) {
+    LOG_WARNING("sh4_track_ram_writes failed to track writes to ram");
+    mem->ram_untracked = 1;
+  }
+
+  return mem->ram_tracking;
+}
+
 int sh4_init(struct memory *mem) {
   struct address_space *space = &mem->sh4;
 
@@ -544,36 +951,270 @@ uint8_t *mem_ram(struct memory *mem, uint32_t offset) {
   return mem->ram + offset;
 }
 
+uint8_t *mem_ocram(struct memory *mem, uint32_t offset) {
+  return mem->ocram + offset;
+}
+
+uint8_t *mem_region(struct memory *mem, int n, int *size) {
+  switch (n) {
+    case 0:
+      *size = RAM_SIZE;
+      return mem->ram;
+    case 1:
+      *size = VRAM_SIZE;
+      return mem->vram;
+    case 2:
+      *size = ARAM_SIZE;
+      return mem->aram;
+    default:
+      LOG_FATAL("mem_region unexpected region %d", n);
+  }
+}
+
+int mem_dump_mmio_stats(struct memory *mem, const char *path) {
+  if (!mem->sh4.stats) {
+    return 0;
+  }
+
+  FILE *file = fopen(path, "w");
+
+  if (!file) {
+    return 0;
+  }
+
+  struct address_space *spaces[] = {&mem->sh4, &mem->arm7};
+  const char *names[] = {"sh4", "arm7"};
+  struct mmio_stat **sorted = malloc(MEM_MAX_STATS * sizeof(*sorted));
+
+  fprintf(file, "space,page,addr,reads,writes");
+  for (int i = 0; i < MEM_STAT_PCS; i++) {
+    fprintf(file, ",pc%d,pc%d_count", i, i);
+  }
+  fprintf(file, "\n");
+
+  for (int i = 0; i < (int)ARRAY_SIZE(spaces); i++) {
+    int num = mem_sorted_stats(spaces[i], sorted);
+
+    for (int j = 0; j < num; j++) {
+      struct mmio_stat *stat = sorted[j];
+
+      fprintf(file, "%s,0x%08x,0x%08x,%" PRId64 ",%" PRId64, names[i],
+              stat->addr & ~MEM_OFFSET_MASK, stat->addr, stat->reads,
+              stat->writes);
+
+      for (int k = 0; k < MEM_STAT_PCS; k++) {
+        fprintf(file, ",0x%08x,%" PRId64, stat->pcs[k], stat->pc_counts[k]);
+      }
+
+      fprintf(file, "\n");
+    }
+  }
+
+  free(sorted);
+
+  return !fclose(file);
+}
+
+#ifdef HAVE_IMGUI
+static void mem_stats_table(struct address_space *space, const char *name,
+                            struct mmio_stat **sorted) {
+  int num = MIN(mem_sorted_stats(space, sorted), MEM_STATS_SHOWN);
+
+  if (!igCollapsingHeader(name, ImGuiTreeNodeFlags_DefaultOpen)) {
+    return;
+  }
+
+  igColumns(4, name, false);
+  igText("addr");
+  igNextColumn();
+  igText("reads");
+  igNextColumn();
+  igText("writes");
+  igNextColumn();
+  igText("top pc");
+  igNextColumn();
+
+  for (int i = 0; i < num; i++) {
+    struct mmio_stat *stat = sorted[i];
+    int top = 0;
+
+    for (int j = 1; j < MEM_STAT_PCS; j++) {
+      if (stat->pc_counts[j] > stat->pc_counts[top]) {
+        top = j;
+      }
+    }
+
+    igText("0x%08x", stat->addr);
+    igNextColumn();
+    igText("%" PRId64, stat->reads);
+    igNextColumn();
+    igText("%" PRId64, stat->writes);
+    igNextColumn();
+    igText("0x%08x (%" PRId64 ")", stat->pcs[top], stat->pc_counts[top]);
+    igNextColumn();
+  }
+
+  igColumns(1, NULL, false);
+}
+
+void mem_debug_menu(struct memory *mem) {
+  if (!mem->sh4.stats) {
+    return;
+  }
+
+  if (igBeginMainMenuBar()) {
+    if (igBeginMenu("MEM", 1)) {
+      if (igMenuItem("mmio histogram", NULL, mem->show_stats, 1)) {
+        mem->show_stats = !mem->show_stats;
+      }
+
+      if (igMenuItem("reset mmio histogram", NULL, 0, 1)) {
+        memset(mem->sh4.stats, 0, MEM_MAX_STATS * sizeof(struct mmio_stat));
+        memset(mem->arm7.stats, 0, MEM_MAX_STATS * sizeof(struct mmio_stat));
+      }
+
+      if (igMenuItem("dump mmio histogram", NULL, 0, 1)) {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s" PATH_SEPARATOR "redream.mmio.csv",
+                 fs_appdir());
+
+        if (mem_dump_mmio_stats(mem, path)) {
+          LOG_INFO("dumped mmio histogram to %s", path);
+        } else {
+          LOG_WARNING("failed to dump mmio histogram to %s", path);
+        }
+      }
+
+      igEndMenu();
+    }
+
+    igEndMainMenuBar();
+  }
+
+  if (mem->show_stats) {
+    bool opened = true;
+
+    if (igBegin("mmio histogram", &opened, 0)) {
+      struct mmio_stat **sorted = malloc(MEM_MAX_STATS * sizeof(*sorted));
+      mem_stats_table(&mem->sh4, "sh4", sorted);
+      mem_stats_table(&mem->arm7, "arm7", sorted);
+      free(sorted);
+    }
+    igEnd();
+
+    mem->show_stats = (int)opened;
+  }
+}
+#endif
+
+void mem_save(struct memory *mem, struct savestate *ss) {
+  for (int i = 0; i < MEM_NUM_REGIONS; i++) {
+    int size;
+    uint8_t *ptr = mem_region(mem, i, &size);
+    ss_write(ss, ptr, size);
+  }
+}
+
+void mem_load(struct memory *mem, struct savestate *ss) {
+  for (int i = 0; i < MEM_NUM_REGIONS; i++) {
+    int size;
+    uint8_t *ptr = mem_region(mem, i, &size);
+    ss_read(ss, ptr, size);
+  }
+}
+
+#ifdef HAVE_FASTMEM
+static int mem_map_physical(struct memory *mem) {
+  mem->ram =
+      map_shared_memory(mem->shmem, RAM_OFFSET, NULL, RAM_SIZE, ACC_READWRITE);
+  mem->vram = map_shared_memory(mem->shmem, VRAM_OFFSET, NULL, VRAM_SIZE,
+                                ACC_READWRITE);
+  mem->aram = map_shared_memory(mem->shmem, ARAM_OFFSET, NULL, ARAM_SIZE,
+                                ACC_READWRITE);
+  mem->ocram = map_shared_memory(mem->shmem, OCRAM_OFFSET, NULL, OCRAM_SIZE,
+                                 ACC_READWRITE);
+
+  if (mem->ram == SHMEM_MAP_FAILED || mem->vram == SHMEM_MAP_FAILED ||
+      mem->aram == SHMEM_MAP_FAILED || mem->ocram == SHMEM_MAP_FAILED) {
+    if (mem->ram != SHMEM_MAP_FAILED) {
+      unmap_shared_memory(mem->shmem, mem->ram, RAM_SIZE);
+    }
+    if (mem->vram != SHMEM_MAP_FAILED) {
+      unmap_shared_memory(mem->shmem, mem->vram, VRAM_SIZE);
+    }
+    if (mem->aram != SHMEM_MAP_FAILED) {
+      unmap_shared_memory(mem->shmem, mem->aram, ARAM_SIZE);
+    }
+    if (mem->ocram != SHMEM_MAP_FAILED) {
+      unmap_shared_memory(mem->shmem, mem->ocram, OCRAM_SIZE);
+    }
+    return 0;
+  }
+
+  return 1;
+}
+#endif
+
 int mem_init(struct memory *mem) {
 #ifdef HAVE_FASTMEM
   /* create the shared memory object to back the physical memory. note, because
      mmio regions also map this shared memory object when disabling permissions,
      the object has to at least be the size of an entire mmio region */
   size_t shmem_size = MAX(PHYSICAL_SIZE, SH4_AREA_SIZE);
-  mem->shmem = create_shared_memory("/redream", shmem_size, ACC_READWRITE);
 
-  if (mem->shmem == SHMEM_INVALID) {
-    LOG_WARNING("mem_init failed to create shared memory object");
-    return 0;
+  /* optionally back the physical memory with huge pages to cut down on tlb
+     misses from fastmem accesses and texture decoding. each region and every
+     mirror of it is aligned to the page table's 2mb granularity, so the
+     mirrored mappings work unchanged */
+  if (OPTION_huge_pages) {
+    mem->shmem =
+        create_huge_shared_memory("/redream", shmem_size, ACC_READWRITE);
+
+    if (mem->shmem != SHMEM_INVALID && !mem_map_physical(mem)) {
+      destroy_shared_memory(mem->shmem);
+      mem->shmem = SHMEM_INVALID;
+    }
+
+    if (mem->shmem == SHMEM_INVALID) {
+      LOG_WARNING("mem_init failed to allocate huge pages, falling back to "
+                  "normal pages");
+    }
   }
 
-  mem->ram =
-      map_shared_memory(mem->shmem, RAM_OFFSET, NULL, RAM_SIZE, ACC_READWRITE);
-  CHECK_NE(mem->ram, SHMEM_MAP_FAILED);
+  if (mem->shmem == SHMEM_INVALID) {
+    mem->shmem = create_shared_memory("/redream", shmem_size, ACC_READWRITE);
 
-  mem->vram = map_shared_memory(mem->shmem, VRAM_OFFSET, NULL, VRAM_SIZE,
-                                ACC_READWRITE);
-  CHECK_NE(mem->vram, SHMEM_MAP_FAILED);
+    if (mem->shmem == SHMEM_INVALID) {
+      LOG_WARNING("mem_init failed to create shared memory object");
+      return 0;
+    }
 
-  mem->aram = map_shared_memory(mem->shmem, ARAM_OFFSET, NULL, ARAM_SIZE,
-                                ACC_READWRITE);
-  CHECK_NE(mem->aram, SHMEM_MAP_FAILED);
+    CHECK(mem_map_physical(mem));
+  }
+
+  mem->ocram_mirrors = get_allocation_granularity() <= OCRAM_BANK_SIZE;
 #else
-  mem->ram = calloc(RAM_SIZE, 1);
-  mem->vram = calloc(VRAM_SIZE, 1);
-  mem->aram = calloc(ARAM_SIZE, 1);
+  mem->ram = alloc_pages(NULL, RAM_SIZE, ACC_READWRITE);
+  mem->vram = alloc_pages(NULL, VRAM_SIZE, ACC_READWRITE);
+  mem->aram = alloc_pages(NULL, ARAM_SIZE, ACC_READWRITE);
+  mem->ocram = alloc_pages(NULL, OCRAM_SIZE, ACC_READWRITE);
+  CHECK(mem->ram && mem->vram && mem->aram && mem->ocram);
+
+  /* unlike the shared memory object backing fastmem, these private pages can
+     be merged with identical ones of other instances */
+  if (OPTION_page_merging) {
+    advise_mergeable(mem->ram, RAM_SIZE);
+    advise_mergeable(mem->vram, VRAM_SIZE);
+    advise_mergeable(mem->aram, ARAM_SIZE);
+    advise_mergeable(mem->ocram, OCRAM_SIZE);
+  }
 #endif
 
+  /* the shared memory object is larger than the physical memory, but the rest
+     of it is only ever mapped without access and never touched */
+  mem->size = PHYSICAL_SIZE;
+  prof_counter_add(COUNTER_mem_guest, mem->size);
+
   if (!sh4_init(mem)) {
     return 0;
   }
@@ -586,14 +1227,24 @@ int mem_init(struct memory *mem) {
 }
 
 void mem_destroy(struct memory *mem) {
+  free(mem->arm7.stats);
+  free(mem->sh4.stats);
+
+  if (mem->ram_tracker) {
+    write_tracker_destroy(mem->ram_tracker);
+  }
+
 #ifdef HAVE_FASTMEM
   destroy_shared_memory(mem->shmem);
 #else
-  free(mem->ram);
-  free(mem->vram);
-  free(mem->aram);
+  release_pages(mem->ram, RAM_SIZE);
+  release_pages(mem->vram, VRAM_SIZE);
+  release_pages(mem->aram, ARAM_SIZE);
+  release_pages(mem->ocram, OCRAM_SIZE);
 #endif
 
+  prof_counter_add(COUNTER_mem_guest, -mem->size);
+
   free(mem);
 }
 
@@ -6,6 +6,7 @@
 
 struct dreamcast;
 struct memory;
+struct savestate;
 
 /*
  * mmio callbacks and helpers
@@ -20,6 +21,8 @@ typedef void (*mmio_write_cb)(void *, uint32_t, uint32_t, uint32_t);
 typedef void (*mmio_read_string_cb)(void *, uint8_t *, uint32_t, int);
 typedef void (*mmio_write_string_cb)(void *, uint32_t, const uint8_t *, int);
 
+typedef void (*ram_write_cb)(void *, uint32_t, int);
+
 #define DECLARE_ADDRESS_SPACE(space)                                       \
   uint8_t *space##_base(struct memory *mem);                               \
   uint8_t space##_read8(struct memory *mem, uint32_t addr);                \
@@ -36,11 +39,28 @@ typedef void (*mmio_write_string_cb)(void *, uint32_t, const uint8_t *, int);
                       int size);                                           \
   void space##_lookup(struct memory *mem, uint32_t addr, void **userdata,  \
                       uint8_t **ptr, mmio_read_cb *read,                   \
-                      mmio_write_cb *write);
+                      mmio_write_cb *write);                         \
+  uint8_t **space##_page_table(struct memory *mem, int *shift);
 
 DECLARE_ADDRESS_SPACE(sh4);
 DECLARE_ADDRESS_SPACE(arm7);
 
+/* storage for side-effect free mmio registers the jit may access directly */
+uint32_t *sh4_lookup_reg(struct memory *mem, uint32_t addr, int write);
+
+/* mirror the operand cache ram directly into the fastmem address space while
+   it's enabled, called whenever CCR.ORA or CCR.OIX change */
+void sh4_map_ocram(struct memory *mem, int enabled, int oix);
+
+/* start tracking the pages of system ram written through any of its
+   mappings, clearing their state. returns 0 if the host can't track writes */
+int sh4_track_ram_writes(struct memory *mem);
+
+/* pass each run of system ram written since the last scan to cb, as an area 3
+   address and size. returns 0 if writes aren't being tracked, in which case
+   any of ram may have been written */
+int sh4_scan_ram_writes(struct memory *mem, ram_write_cb cb, void *data);
+
 struct memory *mem_create(struct dreamcast *dc);
 void mem_destroy(struct memory *mem);
 
@@ -49,5 +69,21 @@ int mem_init(struct memory *mem);
 uint8_t *mem_ram(struct memory *mem, uint32_t offset);
 uint8_t *mem_aram(struct memory *mem, uint32_t offset);
 uint8_t *mem_vram(struct memory *mem, uint32_t offset);
+uint8_t *mem_ocram(struct memory *mem, uint32_t offset);
+
+/* physical memory regions, ram, vram and aram in that order */
+#define MEM_NUM_REGIONS 3
+
+uint8_t *mem_region(struct memory *mem, int n, int *size);
+
+/* when the mmio_histogram option is enabled, every mmio access made by the
+   guests is counted per register. dumps the counts as csv, failing if the
+   histogram isn't enabled */
+int mem_dump_mmio_stats(struct memory *mem, const char *path);
+void mem_debug_menu(struct memory *mem);
+
+/* ram, vram and aram, written out as-is */
+void mem_save(struct memory *mem, struct savestate *ss);
+void mem_load(struct memory *mem, struct savestate *ss);
 
 #endif
@@ -0,0 +1,210 @@
+/*
+ * per-title performance profiles
+ *
+ * the database named by the profiles option, profiles.ini in the application
+ * directory by default, overrides options for individual titles, trading
+ * speed and accuracy differently for each. each section is named after a
+ * title's product number, optionally followed by its version, and lists
+ * options the same way as the config file:
+ *
+ *   [T-9501N]
+ *   gdrom_timing: accurate
+ *
+ *   [MK-51000 V1.004]
+ *   texture_hash: 1
+ *
+ * a section naming the version applies on top of one that doesn't. profiles
+ * are applied as each disc is loaded, before it's inserted, so they cover the
+ * options read from then on. options only read while the machine is created,
+ * e.g. jit_fastmem_checks or video_pipelined, are unaffected. options saved to
+ * the config file, e.g. region or aspect, can't be overridden, as the title's
+ * values would end up saved in place of the user's
+ */
+
+#include <ini.h>
+#include "guest/profile.h"
+#include "core/core.h"
+#include "core/filesystem.h"
+#include "core/option.h"
+#include "guest/gdrom/disc.h"
+#include "options.h"
+
+#define PROFILE_MAX_OPTIONS 64
+#define PROFILE_NAME_SIZE 64
+
+struct profile_option {
+  char name[PROFILE_NAME_SIZE];
+  char value[OPTION_MAX_LENGTH];
+  /* 1 for the section naming only the product number, 2 for the one naming
+     its version too */
+  int priority;
+};
+
+struct profile_match {
+  const char *prodnum;
+  const char *section;
+  struct profile_option options[PROFILE_MAX_OPTIONS];
+  int num_options;
+};
+
+struct profile_check {
+  char section[PROFILE_NAME_SIZE];
+  int num_sections;
+  int num_unknown;
+  int num_persistent;
+};
+
+/* values of the options overridden by the applied profile, from before it
+   was applied. options are global, so this is shared by every machine */
+static struct profile_option profile_saved[PROFILE_MAX_OPTIONS];
+static int profile_num_saved;
+
+const char *profile_path() {
+  static char filename[PATH_MAX];
+
+  snprintf(filename, sizeof(filename), "%s" PATH_SEPARATOR "%s", fs_appdir(),
+           OPTION_profiles);
+
+  return filename;
+}
+
+void profile_section(struct disc *disc, char *section, int size) {
+  if (!disc->prodver[0]) {
+    snprintf(section, size, "%s", disc->prodnum);
+    return;
+  }
+
+  snprintf(section, size, "%s %s", disc->prodnum, disc->prodver);
+}
+
+static int profile_match_handler(void *user, const char *section,
+                                 const char *name, const char *value) {
+  struct profile_match *match = user;
+  int priority = 0;
+
+  if (!strcmp(section, match->section)) {
+    priority = 2;
+  } else if (!strcmp(section, match->prodnum)) {
+    priority = 1;
+  }
+
+  if (!priority) {
+    return 1;
+  }
+
+  if (match->num_options >= PROFILE_MAX_OPTIONS) {
+    LOG_WARNING("profile_apply too many options for %s", section);
+    return 1;
+  }
+
+  struct profile_option *opt = &match->options[match->num_options++];
+  strncpy(opt->name, name, sizeof(opt->name) - 1);
+  strncpy(opt->value, value, sizeof(opt->value) - 1);
+  opt->priority = priority;
+
+  return 1;
+}
+
+static void profile_restore() {
+  /* restore in reverse, an option overridden by both sections ends up with
+     the value it had before either */
+  for (int i = profile_num_saved - 1; i >= 0; i--) {
+    struct profile_option *saved = &profile_saved[i];
+    option_set(saved->name, saved->value);
+  }
+
+  profile_num_saved = 0;
+}
+
+static void profile_override(const struct profile_option *opt) {
+  struct profile_option *saved = &profile_saved[profile_num_saved];
+
+  if (!option_get(opt->name, saved->value, sizeof(saved->value))) {
+    LOG_WARNING("profile_apply unknown option %s", opt->name);
+    return;
+  }
+
+  if (option_persistent(opt->name)) {
+    LOG_WARNING("profile_apply can't override saved option %s", opt->name);
+    return;
+  }
+
+  strncpy(saved->name, opt->name, sizeof(saved->name) - 1);
+  profile_num_saved++;
+
+  option_set(opt->name, opt->value);
+
+  LOG_INFO("profile_apply %s: %s", opt->name, opt->value);
+}
+
+int profile_apply(struct disc *disc) {
+  profile_restore();
+
+  if (!*OPTION_profiles || !disc || !disc->prodnum[0]) {
+    return 0;
+  }
+
+  struct profile_match *match = calloc(1, sizeof(struct profile_match));
+  char section[PROFILE_NAME_SIZE];
+  profile_section(disc, section, sizeof(section));
+  match->prodnum = disc->prodnum;
+  match->section = section;
+
+  ini_parse(profile_path(), &profile_match_handler, match);
+
+  for (int priority = 1; priority <= 2; priority++) {
+    for (int i = 0; i < match->num_options; i++) {
+      struct profile_option *opt = &match->options[i];
+
+      if (opt->priority == priority) {
+        profile_override(opt);
+      }
+    }
+  }
+
+  int num_applied = profile_num_saved;
+
+  free(match);
+
+  return num_applied;
+}
+
+static int profile_check_handler(void *user, const char *section,
+                                 const char *name, const char *value) {
+  struct profile_check *check = user;
+  char current[OPTION_MAX_LENGTH];
+
+  if (strcmp(section, check->section)) {
+    strncpy(check->section, section, sizeof(check->section) - 1);
+    check->num_sections++;
+  }
+
+  if (!option_get(name, current, sizeof(current))) {
+    LOG_WARNING("profile_validate [%s] names unknown option %s", section,
+                name);
+    check->num_unknown++;
+  } else if (option_persistent(name)) {
+    LOG_WARNING("profile_validate [%s] names saved option %s", section, name);
+    check->num_persistent++;
+  }
+
+  return 1;
+}
+
+int profile_validate(const char *filename) {
+  struct profile_check check = {0};
+
+  int res = ini_parse(filename, &profile_check_handler, &check);
+
+  if (res) {
+    LOG_WARNING("profile_validate failed to parse %s at line %d", filename,
+                res);
+    return -1;
+  }
+
+  if (check.num_unknown || check.num_persistent) {
+    return -1;
+  }
+
+  return check.num_sections;
+}
@@ -0,0 +1,23 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+struct disc;
+
+/* restore the options overridden by the last profile applied, then apply the
+   profile matching the disc, if any. returns the number of options the new
+   profile overrode */
+int profile_apply(struct disc *disc);
+
+/* name of the profile section matching the disc's product number and
+   version, as written by a benchmark generating profiles */
+void profile_section(struct disc *disc, char *section, int size);
+
+/* check that every option named in the database exists and isn't saved to
+   the config file, logging those that aren't. returns the number of sections
+   in the database, or -1 when it names such options or can't be parsed */
+int profile_validate(const char *filename);
+
+/* path of the database named by the profiles option */
+const char *profile_path();
+
+#endif
@@ -4,6 +4,7 @@
 #include "guest/holly/holly.h"
 #include "guest/memory.h"
 #include "guest/pvr/ta.h"
+#include "guest/savestate.h"
 #include "guest/scheduler.h"
 #include "guest/sh4/sh4.h"
 #include "stats.h"
@@ -227,13 +228,113 @@ static void pvr_vblank_in(struct pvr *pvr) {
   dc_vblank_in(pvr->dc, pvr->VO_CONTROL->blank_video);
 }
 
-static void pvr_next_scanline(void *data) {
+/* the raster position isn't stepped every line. instead, current_line is the
+   line which started at line_time, and later lines are derived from how much
+   guest time has passed since. timers only fire for lines where something
+   has to happen */
+static int64_t pvr_line_period(struct pvr *pvr) {
+  return HZ_TO_NANO(pvr->line_clock);
+}
+
+static int pvr_line_vsync(struct pvr *pvr, uint32_t line) {
+  if (pvr->SPG_VBLANK->vbstart < pvr->SPG_VBLANK->vbend) {
+    return line >= pvr->SPG_VBLANK->vbstart && line < pvr->SPG_VBLANK->vbend;
+  }
+  return line >= pvr->SPG_VBLANK->vbstart || line < pvr->SPG_VBLANK->vbend;
+}
+
+static void pvr_advance_lines(struct pvr *pvr, int64_t lines) {
+  uint32_t num_lines = pvr->SPG_LOAD->vcount + 1;
+
+  pvr->current_line = (uint32_t)((pvr->current_line + lines) % num_lines);
+  pvr->line_time += lines * pvr_line_period(pvr);
+  pvr->SPG_STATUS->scanline = pvr->current_line;
+}
+
+/* bring the raster position up to date for a register access. accesses made
+   while the cpu runs see the position at the start of its slice, as they did
+   when each line had a timer ending the slice */
+static void pvr_sync_line(struct pvr *pvr) {
+  int64_t elapsed = sched_slice_start(pvr->dc->sched) - pvr->line_time;
+
+  if (elapsed > 0) {
+    pvr_advance_lines(pvr, elapsed / pvr_line_period(pvr));
+  }
+}
+
+static int pvr_line_event(struct pvr *pvr, uint32_t line, int *vsync) {
+  int event = 0;
+
+  /* hblank interrupts, the unsupported modes fail when handled */
+  if (pvr->SPG_HBLANK_INT->hblank_int_mode != 0x0 ||
+      line == pvr->SPG_HBLANK_INT->line_comp_val) {
+    event = 1;
+  }
+
+  /* vblank interrupts */
+  if (line == pvr->SPG_VBLANK_INT->vblank_in_line_number ||
+      line == pvr->SPG_VBLANK_INT->vblank_out_line_number) {
+    event = 1;
+  }
+
+  /* vblank in / out */
+  int next_vsync = pvr_line_vsync(pvr, line);
+  if (next_vsync != *vsync) {
+    *vsync = next_vsync;
+    event = 1;
+  }
+
+  return event;
+}
+
+/* lines from the current one until the next with an event */
+static int64_t pvr_next_event_lines(struct pvr *pvr) {
+  uint32_t num_lines = pvr->SPG_LOAD->vcount + 1;
+  int vsync = pvr->SPG_STATUS->vsync;
+  int64_t lines = 1;
+
+  while (lines < num_lines) {
+    uint32_t line = (uint32_t)((pvr->current_line + lines) % num_lines);
+
+    if (pvr_line_event(pvr, line, &vsync)) {
+      break;
+    }
+
+    lines++;
+  }
+
+  return lines;
+}
+
+static void pvr_next_line_event(void *data);
+
+static void pvr_schedule_line_event(struct pvr *pvr) {
+  struct scheduler *sched = pvr->dc->sched;
+
+  if (pvr->line_timer) {
+    sched_cancel_timer(sched, pvr->line_timer);
+    pvr->line_timer = NULL;
+  }
+
+  /* when rescheduled by a register write, the line may have already passed
+     by the end of the current slice. the timer then expires late, but the
+     line's events are still handled */
+  int64_t lines = pvr_next_event_lines(pvr);
+  int64_t expire = pvr->line_time + lines * pvr_line_period(pvr);
+  pvr->line_timer = sched_start_timer(sched, &pvr_next_line_event, pvr,
+                                      expire - sched_base_time(sched));
+}
+
+static void pvr_next_line_event(void *data) {
   struct pvr *pvr = data;
   struct holly *hl = pvr->dc->holly;
   struct scheduler *sched = pvr->dc->sched;
 
-  uint32_t num_lines = pvr->SPG_LOAD->vcount + 1;
-  pvr->current_line = (pvr->current_line + 1) % num_lines;
+  pvr->line_timer = NULL;
+
+  pvr_advance_lines(pvr, pvr_next_event_lines(pvr));
+
+  prof_counter_add(COUNTER_pvr_line_events, 1);
 
   /* hblank in */
   switch (pvr->SPG_HBLANK_INT->hblank_int_mode) {
@@ -261,14 +362,7 @@ static void pvr_next_scanline(void *data) {
   }
 
   int was_vsync = pvr->SPG_STATUS->vsync;
-  if (pvr->SPG_VBLANK->vbstart < pvr->SPG_VBLANK->vbend) {
-    pvr->SPG_STATUS->vsync = pvr->current_line >= pvr->SPG_VBLANK->vbstart &&
-                             pvr->current_line < pvr->SPG_VBLANK->vbend;
-  } else {
-    pvr->SPG_STATUS->vsync = pvr->current_line >= pvr->SPG_VBLANK->vbstart ||
-                             pvr->current_line < pvr->SPG_VBLANK->vbend;
-  }
-  pvr->SPG_STATUS->scanline = pvr->current_line;
+  pvr->SPG_STATUS->vsync = pvr_line_vsync(pvr, pvr->current_line);
 
   if (!was_vsync && pvr->SPG_STATUS->vsync) {
     pvr_vblank_in(pvr);
@@ -276,9 +370,11 @@ static void pvr_next_scanline(void *data) {
     pvr_vblank_out(pvr);
   }
 
-  /* reschedule */
-  pvr->line_timer = sched_start_timer(sched, &pvr_next_scanline, pvr,
-                                      HZ_TO_NANO(pvr->line_clock));
+  /* the timer may have been restarted by a register write made while
+     handling the events */
+  if (!pvr->line_timer) {
+    pvr_schedule_line_event(pvr);
+  }
 }
 
 static void pvr_reconfigure_spg(struct pvr *pvr) {
@@ -310,13 +406,41 @@ static void pvr_reconfigure_spg(struct pvr *pvr) {
       pvr->SPG_LOAD->hcount, pvr->SPG_HBLANK->hbstart, pvr->SPG_HBLANK->hbend,
       pvr->SPG_LOAD->vcount, pvr->SPG_VBLANK->vbstart, pvr->SPG_VBLANK->vbend);
 
-  if (pvr->line_timer) {
-    sched_cancel_timer(sched, pvr->line_timer);
-    pvr->line_timer = NULL;
-  }
+  /* the current line restarts with the new timings */
+  pvr->line_time = sched_slice_start(sched);
 
-  pvr->line_timer = sched_start_timer(sched, &pvr_next_scanline, pvr,
-                                      HZ_TO_NANO(pvr->line_clock));
+  pvr_schedule_line_event(pvr);
+}
+
+static void pvr_save(struct device *dev, struct savestate *ss) {
+  struct pvr *pvr = (struct pvr *)dev;
+  struct scheduler *sched = pvr->dc->sched;
+
+  int64_t line_elapsed = sched_base_time(sched) - pvr->line_time;
+
+  SS_WRITE(ss, pvr->reg);
+  ss_write_timer(ss, sched, pvr->line_timer);
+  SS_WRITE(ss, pvr->line_clock);
+  SS_WRITE(ss, pvr->current_line);
+  SS_WRITE(ss, line_elapsed);
+  SS_WRITE(ss, pvr->got_startrender);
+}
+
+static void pvr_load(struct device *dev, struct savestate *ss) {
+  struct pvr *pvr = (struct pvr *)dev;
+  struct scheduler *sched = pvr->dc->sched;
+
+  int64_t line_elapsed;
+
+  SS_READ(ss, pvr->reg);
+  pvr->line_timer = ss_read_timer(ss, sched, pvr->line_timer,
+                                  &pvr_next_line_event, pvr, 0);
+  SS_READ(ss, pvr->line_clock);
+  SS_READ(ss, pvr->current_line);
+  SS_READ(ss, line_elapsed);
+  SS_READ(ss, pvr->got_startrender);
+
+  pvr->line_time = sched_base_time(sched) - line_elapsed;
 }
 
 static int pvr_init(struct device *dev) {
@@ -391,6 +515,17 @@ uint32_t pvr_reg_read(struct pvr *pvr, uint32_t addr, uint32_t mask) {
   return pvr->reg[offset];
 }
 
+uint32_t *pvr_reg_ptr(struct pvr *pvr, uint32_t addr, int write) {
+  uint32_t offset = addr >> 2;
+
+  if (write ? (offset == ID || pvr_cb[offset].write != NULL)
+            : pvr_cb[offset].read != NULL) {
+    return NULL;
+  }
+
+  return &pvr->reg[offset];
+}
+
 void pvr_video_size(struct pvr *pvr, int *width, int *height) {
   /* calculate the original internal resolution used by the game based on the
      framebuffer size. this is used to scale the screen space x,y coordinates
@@ -427,6 +562,11 @@ struct pvr *pvr_create(struct dreamcast *dc) {
   struct pvr *pvr =
       dc_create_device(dc, sizeof(struct pvr), "pvr", &pvr_init, NULL);
 
+  /* setup state interface */
+  pvr->stateif.enabled = 1;
+  pvr->stateif.save = &pvr_save;
+  pvr->stateif.load = &pvr_load;
+
   return pvr;
 }
 
@@ -487,9 +627,42 @@ REG_W32(pvr_cb, TA_YUV_TEX_BASE) {
   ta_yuv_init(ta);
 }
 
+REG_R32(pvr_cb, SPG_STATUS) {
+  struct pvr *pvr = dc->pvr;
+
+  pvr_sync_line(pvr);
+
+  return pvr->SPG_STATUS->full;
+}
+
+REG_W32(pvr_cb, SPG_HBLANK_INT) {
+  struct pvr *pvr = dc->pvr;
+
+  pvr_sync_line(pvr);
+  pvr->SPG_HBLANK_INT->full = value;
+  pvr_schedule_line_event(pvr);
+}
+
+REG_W32(pvr_cb, SPG_VBLANK_INT) {
+  struct pvr *pvr = dc->pvr;
+
+  pvr_sync_line(pvr);
+  pvr->SPG_VBLANK_INT->full = value;
+  pvr_schedule_line_event(pvr);
+}
+
+REG_W32(pvr_cb, SPG_VBLANK) {
+  struct pvr *pvr = dc->pvr;
+
+  pvr_sync_line(pvr);
+  pvr->SPG_VBLANK->full = value;
+  pvr_schedule_line_event(pvr);
+}
+
 REG_W32(pvr_cb, SPG_LOAD) {
   struct pvr *pvr = dc->pvr;
 
+  pvr_sync_line(pvr);
   pvr->SPG_LOAD->full = value;
 
   pvr_reconfigure_spg(pvr);
@@ -498,6 +671,7 @@ REG_W32(pvr_cb, SPG_LOAD) {
 REG_W32(pvr_cb, FB_R_CTRL) {
   struct pvr *pvr = dc->pvr;
 
+  pvr_sync_line(pvr);
   pvr->FB_R_CTRL->full = value;
 
   pvr_reconfigure_spg(pvr);
@@ -15,10 +15,11 @@ struct pvr {
   uint8_t *vram;
   uint32_t reg[PVR_NUM_REGS];
 
-  /* raster progress */
+  /* raster progress, current_line began at line_time */
   struct timer *line_timer;
   int line_clock;
   uint32_t current_line;
+  int64_t line_time;
 
   /* copy of deinterlaced framebuffer from texture memory */
   uint8_t framebuffer[PVR_FRAMEBUFFER_SIZE];
@@ -41,6 +42,7 @@ void pvr_video_size(struct pvr *pvr, int *video_width, int *video_height);
 uint32_t pvr_reg_read(struct pvr *pvr, uint32_t addr, uint32_t mask);
 void pvr_reg_write(struct pvr *pvr, uint32_t addr, uint32_t data,
                    uint32_t mask);
+uint32_t *pvr_reg_ptr(struct pvr *pvr, uint32_t addr, int write);
 
 uint32_t pvr_vram64_read(struct pvr *pvr, uint32_t addr, uint32_t mask);
 void pvr_vram64_write(struct pvr *pvr, uint32_t addr, uint32_t data,
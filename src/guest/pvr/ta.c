@@ -22,13 +22,17 @@
 #include "core/core.h"
 #include "core/exception_handler.h"
 #include "core/filesystem.h"
+#include "core/hash.h"
 #include "core/list.h"
+#include "core/simd.h"
 #include "guest/holly/holly.h"
 #include "guest/memory.h"
 #include "guest/pvr/pvr.h"
 #include "guest/pvr/tr.h"
+#include "guest/savestate.h"
 #include "guest/scheduler.h"
 #include "guest/sh4/sh4.h"
+#include "options.h"
 #include "stats.h"
 
 struct ta {
@@ -42,12 +46,18 @@ struct ta {
   int yuv_macroblock_size;
   int yuv_macroblock_count;
 
-  /* tile context pool */
+  /* tile context pool, indexed by their PARAM_BASE address */
   struct ta_context contexts[8];
+  struct timer *render_timers[8];
   struct ta_context *curr_context;
   int num_contexts;
+  DECLARE_HASHTABLE(live_contexts, 4);
 };
 
+/* parameter buffers are grown in chunks, such that contexts only hold onto
+   as much memory as the largest frame they've been used for */
+#define TA_PARAMS_CHUNK_SIZE (64 * 1024)
+
 /*
  * texture info helpers
  */
@@ -349,12 +359,14 @@ static holly_interrupt_t list_interrupts[] = {
 };
 
 static struct ta_context *ta_get_context(struct ta *ta, uint32_t addr) {
-  for (int i = 0; i < ta->num_contexts; i++) {
-    struct ta_context *ctx = &ta->contexts[i];
+  struct list *bkt = hash_bkt(ta->live_contexts, addr);
+
+  hash_bkt_for_each_entry(ctx, bkt, struct ta_context, it) {
     if (ctx->addr == addr) {
       return ctx;
     }
   }
+
   return NULL;
 }
 
@@ -369,6 +381,9 @@ static struct ta_context *ta_demand_context(struct ta *ta, uint32_t addr) {
   ctx = &ta->contexts[ta->num_contexts++];
   ctx->addr = addr;
 
+  struct list *bkt = hash_bkt(ta->live_contexts, addr);
+  hash_add(bkt, &ctx->it);
+
   return ctx;
 }
 
@@ -388,24 +403,43 @@ static void ta_init_context(struct ta *ta, struct ta_context *ctx) {
   ctx->size = 0;
   ctx->list_type = TA_NUM_LISTS;
   ctx->vert_type = TA_NUM_VERTS;
+
+  if (OPTION_ta_stream && !ctx->stream) {
+    ctx->stream = tr_create_stream();
+  }
+
+  if (ctx->stream) {
+    tr_reset_stream(ctx->stream);
+  }
 }
 
 static void ta_write_context(struct ta *ta, struct ta_context *ctx,
                              const void *ptr, int size) {
   struct holly *hl = ta->dc->holly;
 
-  CHECK_LT(ctx->size + size, (int)sizeof(ctx->params));
+  /* the incoming data is copied straight into the parameter buffer once, and
+     then parsed in place */
+  ta_reserve_params(ctx, ctx->size + size);
   memcpy(&ctx->params[ctx->size], ptr, size);
   ctx->size += size;
 
   /* each TA command is either 32 or 64 bytes, with the pcw being in the first
-     32 bytes always. check every 32 bytes to see if the command has been
-     completely received or not */
-  if (ctx->size % 32 == 0) {
+     32 bytes always. process each command that has been completely
+     received */
+  while (ctx->size - ctx->cursor >= 32) {
     void *param = &ctx->params[ctx->cursor];
     union pcw pcw = *(union pcw *)param;
 
-    int size = ta_param_size(pcw, ctx->vert_type);
+    /* global params are sized by the vertex type they specify, not the
+       previous one, matching how tr walks the param buffer */
+    int vert_type = ctx->vert_type;
+
+    if (pcw.para_type == TA_PARAM_POLY_OR_VOL ||
+        pcw.para_type == TA_PARAM_SPRITE) {
+      vert_type = ta_vert_type(pcw);
+    }
+
+    int size = ta_param_size(pcw, vert_type);
     int recv = ctx->size - ctx->cursor;
 
     if (recv < size) {
@@ -451,10 +485,38 @@ static void ta_write_context(struct ta *ta, struct ta_context *ctx,
         break;
     }
 
-    ctx->cursor += recv;
+    /* convert the command now while the sh4 is busy producing the next one,
+       rather than all at once when the context is rendered */
+    if (ctx->stream) {
+      tr_stream_param(ctx->stream, ctx, param);
+    }
+
+    ctx->cursor += size;
   }
 }
 
+void ta_free_params(struct ta_context *ctx) {
+  prof_counter_add(COUNTER_mem_ta_contexts, -ctx->capacity);
+
+  free(ctx->params);
+  ctx->params = NULL;
+  ctx->capacity = 0;
+}
+
+void ta_reserve_params(struct ta_context *ctx, int size) {
+  CHECK_LE(size, TA_MAX_PARAMS_SIZE);
+
+  if (size <= ctx->capacity) {
+    return;
+  }
+
+  int capacity = ALIGN_UP(size, TA_PARAMS_CHUNK_SIZE);
+  ctx->params = realloc(ctx->params, capacity);
+  CHECK_NOTNULL(ctx->params);
+  prof_counter_add(COUNTER_mem_ta_contexts, capacity - ctx->capacity);
+  ctx->capacity = capacity;
+}
+
 /*
  * ta rendering flow
  *
@@ -493,6 +555,18 @@ static void ta_save_state(struct ta *ta, struct ta_context *ctx) {
   /* get the punch through polygon alpha test value */
   ctx->alpha_ref = pvr->PT_ALPHA_REF->alpha_ref;
 
+  /* save off where and how the frame is written once rendered. FB_W_LINESTRIDE
+     is in 64-bit units, the clip registers hold the min and max coordinates in
+     their low and high halves */
+  struct ta_render_target *rt = &ctx->target;
+  rt->addr = *pvr->FB_W_SOF1;
+  rt->ctrl = pvr->FB_W_CTRL->full;
+  rt->stride = (*pvr->FB_W_LINESTRIDE & 0x1ff) * 8;
+  rt->x_min = *pvr->FB_X_CLIP & 0x7ff;
+  rt->y_min = *pvr->FB_Y_CLIP & 0x3ff;
+  rt->width = ((*pvr->FB_X_CLIP >> 16) & 0x7ff) + 1;
+  rt->height = ((*pvr->FB_Y_CLIP >> 16) & 0x3ff) + 1;
+
   /* according to the hardware docs, this is the correct calculation of the
      background ISP address. however, in practice, the second TA buffer's ISP
      address comes out to be 0x800000 when booting the bios and the vram is
@@ -543,6 +617,8 @@ static void ta_render_context_end(void *data) {
   struct ta *ta = ctx->userdata;
   struct holly *hl = ta->dc->holly;
 
+  ta->render_timers[ctx - ta->contexts] = NULL;
+
   /* ensure the client has finished rendering */
   dc_finish_render(ta->dc);
 
@@ -572,7 +648,23 @@ static void ta_render_context(struct ta *ta, struct ta_context *ctx) {
      TODO figure out a heuristic involving the number of polygons rendered */
   int64_t end = INT64_C(10000000);
   ctx->userdata = ta;
-  sched_start_timer(sched, &ta_render_context_end, ctx, end);
+  ta->render_timers[ctx - ta->contexts] =
+      sched_start_lazy_timer(sched, &ta_render_context_end, ctx, end);
+}
+
+void ta_finish_renders(struct ta *ta) {
+  struct scheduler *sched = ta->dc->sched;
+
+  for (int i = 0; i < ARRAY_SIZE(ta->render_timers); i++) {
+    struct timer *timer = ta->render_timers[i];
+
+    if (!timer) {
+      continue;
+    }
+
+    sched_cancel_timer(sched, timer);
+    ta_render_context_end(&ta->contexts[i]);
+  }
 }
 
 /*
@@ -611,37 +703,46 @@ static void ta_yuv_process_block(struct ta *ta, const uint8_t *in_uv,
   uint8_t *out_row0 = out_uyvy;
   uint8_t *out_row1 = out_uyvy + (ta->yuv_width << 1);
 
-  /* reencode 8x8 subblock of YUV420 data as UYVY422 */
+  /* reencode 8x8 subblock of YUV420 data as UYVY422. each pair of rows shares
+     a row of 4 u and 4 v samples, which are interleaved with the 8 luma
+     samples of each row */
   for (int j = 0; j < 8; j += 2) {
-    for (int i = 0; i < 8; i += 2) {
-      uint8_t u = in_uv[0];
-      uint8_t v = in_uv[64];
-      uint8_t y0 = in_y[0];
-      uint8_t y1 = in_y[1];
-      uint8_t y2 = in_y[8];
-      uint8_t y3 = in_y[9];
-
-      out_row0[0] = u;
-      out_row0[1] = y0;
-      out_row0[2] = v;
-      out_row0[3] = y1;
-
-      out_row1[0] = u;
-      out_row1[1] = y2;
-      out_row1[2] = v;
-      out_row1[3] = y3;
-
-      in_uv += 1;
-      in_y += 2;
-      out_row0 += 4;
-      out_row1 += 4;
+#if SIMD_SSE2
+    uint32_t u, v;
+    memcpy(&u, in_uv, 4);
+    memcpy(&v, in_uv + 64, 4);
+    __m128i uv = _mm_unpacklo_epi8(_mm_cvtsi32_si128(u), _mm_cvtsi32_si128(v));
+    __m128i y0 = _mm_loadl_epi64((const __m128i *)(in_y + 0));
+    __m128i y1 = _mm_loadl_epi64((const __m128i *)(in_y + 8));
+    _mm_storeu_si128((__m128i *)out_row0, _mm_unpacklo_epi8(uv, y0));
+    _mm_storeu_si128((__m128i *)out_row1, _mm_unpacklo_epi8(uv, y1));
+#elif SIMD_NEON
+    /* only the low 4 u and v samples are used, the upper half belongs to the
+       adjacent subblock */
+    uint8x8_t uv = vzip_u8(vld1_u8(in_uv), vld1_u8(in_uv + 64)).val[0];
+    uint8x8x2_t row0 = {{uv, vld1_u8(in_y + 0)}};
+    uint8x8x2_t row1 = {{uv, vld1_u8(in_y + 8)}};
+    vst2_u8(out_row0, row0);
+    vst2_u8(out_row1, row1);
+#else
+    for (int i = 0; i < 4; i++) {
+      out_row0[i * 4 + 0] = in_uv[i];
+      out_row0[i * 4 + 1] = in_y[i * 2 + 0];
+      out_row0[i * 4 + 2] = in_uv[i + 64];
+      out_row0[i * 4 + 3] = in_y[i * 2 + 1];
+
+      out_row1[i * 4 + 0] = in_uv[i];
+      out_row1[i * 4 + 1] = in_y[i * 2 + 8];
+      out_row1[i * 4 + 2] = in_uv[i + 64];
+      out_row1[i * 4 + 3] = in_y[i * 2 + 9];
     }
+#endif
 
     /* skip past adjacent 8x8 subblock */
-    in_uv += 4;
-    in_y += 8;
-    out_row0 += (ta->yuv_width << 2) - 16;
-    out_row1 += (ta->yuv_width << 2) - 16;
+    in_uv += 8;
+    in_y += 16;
+    out_row0 += ta->yuv_width << 2;
+    out_row1 += ta->yuv_width << 2;
   }
 }
 
@@ -682,6 +783,116 @@ static void ta_yuv_process_macroblock(struct ta *ta, const void *data) {
 /*
  * ta device interface
  */
+static void ta_save(struct device *dev, struct savestate *ss) {
+  struct ta *ta = (struct ta *)dev;
+  int64_t yuv_offset = ta->yuv_data ? ta->yuv_data - ta->vram : -1;
+  int curr_context =
+      ta->curr_context ? (int)(ta->curr_context - ta->contexts) : -1;
+
+  SS_WRITE(ss, yuv_offset);
+  SS_WRITE(ss, ta->yuv_width);
+  SS_WRITE(ss, ta->yuv_height);
+  SS_WRITE(ss, ta->yuv_macroblock_size);
+  SS_WRITE(ss, ta->yuv_macroblock_count);
+
+  SS_WRITE(ss, ta->num_contexts);
+  SS_WRITE(ss, curr_context);
+
+  for (int i = 0; i < ta->num_contexts; i++) {
+    struct ta_context ctx = ta->contexts[i];
+
+    /* renders are always finished before saving, and the pointers are fixed
+       up when loaded */
+    ctx.userdata = NULL;
+    ctx.params = NULL;
+    ctx.capacity = 0;
+    ctx.stream = NULL;
+    memset(&ctx.it, 0, sizeof(ctx.it));
+    SS_WRITE(ss, ctx);
+
+    ss_write(ss, ta->contexts[i].params, ctx.size);
+  }
+}
+
+int64_t ta_state_headroom(struct ta *ta) {
+  /* each context's params are saved, and can fill the entire buffer */
+  int64_t headroom = 0;
+
+  for (int i = 0; i < ARRAY_SIZE(ta->contexts); i++) {
+    if (i < ta->num_contexts) {
+      headroom += TA_MAX_PARAMS_SIZE - ta->contexts[i].size;
+    } else {
+      headroom += sizeof(struct ta_context) + TA_MAX_PARAMS_SIZE;
+    }
+  }
+
+  return headroom;
+}
+
+static void ta_load(struct device *dev, struct savestate *ss) {
+  struct ta *ta = (struct ta *)dev;
+  int64_t yuv_offset;
+  int num_contexts, curr_context;
+
+  SS_READ(ss, yuv_offset);
+  SS_READ(ss, ta->yuv_width);
+  SS_READ(ss, ta->yuv_height);
+  SS_READ(ss, ta->yuv_macroblock_size);
+  SS_READ(ss, ta->yuv_macroblock_count);
+  ta->yuv_data = yuv_offset >= 0 ? &ta->vram[yuv_offset] : NULL;
+
+  SS_READ(ss, num_contexts);
+  SS_READ(ss, curr_context);
+
+  if (num_contexts < 0 || num_contexts > ARRAY_SIZE(ta->contexts)) {
+    ss->error = 1;
+    num_contexts = 0;
+  }
+
+  /* streams don't survive the load, contexts rendered before being written
+     to again are converted in full */
+  for (int i = 0; i < ARRAY_SIZE(ta->contexts); i++) {
+    struct ta_context *ctx = &ta->contexts[i];
+
+    if (ctx->stream) {
+      tr_destroy_stream(ctx->stream);
+      ctx->stream = NULL;
+    }
+
+    if (i >= num_contexts) {
+      ta_free_params(ctx);
+      memset(ctx, 0, sizeof(*ctx));
+    }
+  }
+
+  memset(ta->live_contexts, 0, sizeof(ta->live_contexts));
+  ta->num_contexts = num_contexts;
+
+  for (int i = 0; i < num_contexts; i++) {
+    struct ta_context *ctx = &ta->contexts[i];
+    uint8_t *params = ctx->params;
+    int capacity = ctx->capacity;
+
+    SS_READ(ss, *ctx);
+    ctx->params = params;
+    ctx->capacity = capacity;
+
+    if (ctx->size < 0 || ctx->size > TA_MAX_PARAMS_SIZE) {
+      ss->error = 1;
+      ctx->size = 0;
+    }
+
+    ta_reserve_params(ctx, ctx->size);
+    ss_read(ss, ctx->params, ctx->size);
+
+    hash_add(hash_bkt(ta->live_contexts, ctx->addr), &ctx->it);
+  }
+
+  ta->curr_context = curr_context >= 0 && curr_context < num_contexts
+                         ? &ta->contexts[curr_context]
+                         : NULL;
+}
+
 static int ta_init(struct device *dev) {
   struct ta *ta = (struct ta *)dev;
   struct dreamcast *dc = ta->dc;
@@ -698,8 +909,6 @@ void ta_init_tables() {
     return;
   }
 
-  initialized = 1;
-
   for (int i = 0; i < 0x100; i++) {
     union pcw pcw = *(union pcw *)&i;
 
@@ -730,6 +939,66 @@ void ta_init_tables() {
       }
     }
   }
+
+  /* only flag the tables as ready once they're filled, threads racing to
+     initialize them write the same values */
+  initialized = 1;
+}
+
+/* writes a frame rendered for the context back to its render target, packing
+   each rgba pixel into the target's format */
+void ta_write_render_target(struct ta *ta, const struct ta_render_target *rt,
+                            const uint8_t *rgba) {
+  union fb_w_ctrl ctrl = {rt->ctrl};
+  int kbit = ctrl.fb_kval >> 7;
+  int alpha_threshold = ctrl.fb_alpha_threshhold;
+
+  for (int y = rt->y_min; y < rt->height; y++) {
+    const uint8_t *src = &rgba[(y * rt->width + rt->x_min) * 4];
+    uint32_t line = rt->addr + y * rt->stride;
+
+    for (int x = rt->x_min; x < rt->width; x++, src += 4) {
+      int r = src[0], g = src[1], b = src[2], a = src[3];
+
+      switch (ctrl.fb_packmode) {
+        case 0: {
+          uint16_t *dst = (uint16_t *)&ta->vram[(line + x * 2) & 0x7ffffe];
+          *dst = (kbit << 15) | ((r >> 3) << 10) | ((g >> 3) << 5) | (b >> 3);
+        } break;
+        case 1: {
+          uint16_t *dst = (uint16_t *)&ta->vram[(line + x * 2) & 0x7ffffe];
+          *dst = ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+        } break;
+        case 2: {
+          uint16_t *dst = (uint16_t *)&ta->vram[(line + x * 2) & 0x7ffffe];
+          *dst = ((a >> 4) << 12) | ((r >> 4) << 8) | ((g >> 4) << 4) | (b >> 4);
+        } break;
+        case 3: {
+          uint16_t *dst = (uint16_t *)&ta->vram[(line + x * 2) & 0x7ffffe];
+          *dst = ((a >= alpha_threshold) << 15) | ((r >> 3) << 10) |
+                 ((g >> 3) << 5) | (b >> 3);
+        } break;
+        case 4: {
+          uint8_t *dst = &ta->vram[(line + x * 3) & 0x7fffff];
+          dst[0] = b;
+          dst[1] = g;
+          dst[2] = r;
+        } break;
+        case 5: {
+          uint32_t *dst = (uint32_t *)&ta->vram[(line + x * 4) & 0x7ffffc];
+          *dst = ((uint32_t)ctrl.fb_kval << 24) | (r << 16) | (g << 8) | b;
+        } break;
+        case 6: {
+          uint32_t *dst = (uint32_t *)&ta->vram[(line + x * 4) & 0x7ffffc];
+          *dst = ((uint32_t)a << 24) | (r << 16) | (g << 8) | b;
+        } break;
+        default:
+          LOG_WARNING("ta_write_render_target unsupported packmode %d",
+                      ctrl.fb_packmode);
+          return;
+      }
+    }
+  }
 }
 
 /* ta data handlers
@@ -768,11 +1037,7 @@ void ta_poly_write(struct ta *ta, uint32_t dst, const uint8_t *src, int size) {
   CHECK(*hl->SB_LMMODE0 == 0);
   CHECK(size % 32 == 0);
 
-  const uint8_t *end = src + size;
-  while (src < end) {
-    ta_write_context(ta, ta->curr_context, src, 32);
-    src += 32;
-  }
+  ta_write_context(ta, ta->curr_context, src, size);
 }
 
 void ta_texture_info(struct ta *ta, union tsp tsp, union tcw tcw,
@@ -820,6 +1085,16 @@ void ta_soft_reset(struct ta *ta) {
 }
 
 void ta_destroy(struct ta *ta) {
+  for (int i = 0; i < ta->num_contexts; i++) {
+    struct ta_context *ctx = &ta->contexts[i];
+
+    if (ctx->stream) {
+      tr_destroy_stream(ctx->stream);
+    }
+
+    ta_free_params(ctx);
+  }
+
   dc_destroy_device((struct device *)ta);
 }
 
@@ -828,5 +1103,10 @@ struct ta *ta_create(struct dreamcast *dc) {
 
   struct ta *ta = dc_create_device(dc, sizeof(struct ta), "ta", &ta_init, NULL);
 
+  /* setup state interface */
+  ta->stateif.enabled = 1;
+  ta->stateif.save = &ta_save;
+  ta->stateif.load = &ta_load;
+
   return ta;
 }
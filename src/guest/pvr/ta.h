@@ -12,6 +12,10 @@ void ta_destroy(struct ta *ta);
 
 void ta_soft_reset(struct ta *ta);
 void ta_start_render(struct ta *ta);
+/* complete any renders in progress immediately */
+void ta_finish_renders(struct ta *ta);
+/* most the ta's saved state could grow by from its current size */
+int64_t ta_state_headroom(struct ta *ta);
 void ta_list_init(struct ta *ta);
 void ta_list_cont(struct ta *ta);
 void ta_yuv_init(struct ta *ta);
@@ -19,6 +23,12 @@ void ta_texture_info(struct ta *ta, union tsp tsp, union tcw tcw,
                      const uint8_t **texture, int *texture_size,
                      const uint8_t **palette, int *palette_size);
 
+void ta_write_render_target(struct ta *ta, const struct ta_render_target *rt,
+                            const uint8_t *rgba);
+
+void ta_reserve_params(struct ta_context *ctx, int size);
+void ta_free_params(struct ta_context *ctx);
+
 void ta_poly_write(struct ta *ta, uint32_t dst, const uint8_t *src, int size);
 void ta_yuv_write(struct ta *ta, uint32_t dst, const uint8_t *src, int size);
 void ta_texture_write(struct ta *ta, uint32_t dst, const uint8_t *src,
@@ -4,7 +4,10 @@
 #include <stdint.h>
 #include "core/list.h"
 
+struct tr_stream;
+
 #define TA_MAX_PARAMS 0x10000
+#define TA_MAX_PARAMS_SIZE (TA_MAX_PARAMS * 32)
 
 /* worst case background vertex size, see ISP_BACKGND_T field */
 #define TA_BG_VERTEX_SIZE ((0b111 * 2 + 3) * 4 * 3)
@@ -416,6 +419,24 @@ union vert_param {
   } sprite1;
 };
 
+/* framebuffer state a context is rendered with, needed to write the rendered
+   frame back to vram */
+struct ta_render_target {
+  uint32_t addr;
+  uint32_t ctrl;
+  int stride;
+  int x_min;
+  int y_min;
+  int width;
+  int height;
+};
+
+/* contexts rendered to an address in the 64-bit access area are being rendered
+   to a texture, which is expected to be read by the game afterwards */
+static inline int ta_render_to_texture(const struct ta_render_target *rt) {
+  return (rt->addr & 0x01000000) != 0;
+}
+
 struct ta_context {
   uint32_t addr;
   void *userdata;
@@ -428,21 +449,26 @@ struct ta_context {
   int video_width;
   int video_height;
   int alpha_ref;
+  struct ta_render_target target;
   union isp bg_isp;
   union tsp bg_tsp;
   union tcw bg_tcw;
   float bg_depth;
   uint8_t bg_vertices[TA_BG_VERTEX_SIZE];
 
-  /* parameter buffer */
-  uint8_t params[TA_MAX_PARAMS * 32];
+  /* parameter buffer, grown in chunks as params are written */
+  uint8_t *params;
   int cursor;
   int size;
+  int capacity;
 
   /* current global state */
   int list_type;
   int vert_type;
 
+  /* params converted as they're written, when enabled */
+  struct tr_stream *stream;
+
   struct list_node it;
 };
 
@@ -1,5 +1,6 @@
 #include "guest/pvr/tex.h"
 #include "core/core.h"
+#include "core/simd.h"
 #include "render/render_backend.h"
 
 /*
@@ -46,6 +47,28 @@ static inline uint8_t COLOR_EXTEND_6(uint8_t c) {
   return c | (c >> 6);
 }
 
+#if SIMD_SSE2
+/* interleave 8 texels worth of 8-bit components stored in 16-bit lanes into
+   rgba order */
+static inline void RGBA_interleave8(__m128i r, __m128i g, __m128i b, __m128i a,
+                                    uint8_t *rgba) {
+  __m128i rg = _mm_or_si128(r, _mm_slli_epi16(g, 8));
+  __m128i ba = _mm_or_si128(b, _mm_slli_epi16(a, 8));
+  _mm_storeu_si128((__m128i *)(rgba + 0x00), _mm_unpacklo_epi16(rg, ba));
+  _mm_storeu_si128((__m128i *)(rgba + 0x10), _mm_unpackhi_epi16(rg, ba));
+}
+#elif SIMD_NEON
+static inline void RGBA_interleave8(uint16x8_t r, uint16x8_t g, uint16x8_t b,
+                                    uint16x8_t a, uint8_t *rgba) {
+  uint8x8x4_t out;
+  out.val[0] = vmovn_u16(r);
+  out.val[1] = vmovn_u16(g);
+  out.val[2] = vmovn_u16(b);
+  out.val[3] = vmovn_u16(a);
+  vst4_u8(rgba, out);
+}
+#endif
+
 /* ARGB1555 */
 typedef uint16_t ARGB1555_type;
 
@@ -58,34 +81,40 @@ static inline void ARGB1555_unpack(ARGB1555_type src, uint8_t *rgba) {
 
 static inline void ARGB1555_unpack_bitmap(const ARGB1555_type *src,
                                           uint8_t *rgba) {
-  ARGB1555_unpack(src[0], rgba + 0x0);
-  ARGB1555_unpack(src[1], rgba + 0x4);
-  ARGB1555_unpack(src[2], rgba + 0x8);
-  ARGB1555_unpack(src[3], rgba + 0xc);
+#if SIMD_SSE2
+  __m128i v = _mm_loadu_si128((const __m128i *)src);
+  __m128i mask = _mm_set1_epi16(0x1f);
+  __m128i r = _mm_and_si128(_mm_srli_epi16(v, 10), mask);
+  __m128i g = _mm_and_si128(_mm_srli_epi16(v, 5), mask);
+  __m128i b = _mm_and_si128(v, mask);
+  __m128i a = _mm_srai_epi16(v, 15);
+  r = _mm_or_si128(_mm_slli_epi16(r, 3), _mm_srli_epi16(r, 2));
+  g = _mm_or_si128(_mm_slli_epi16(g, 3), _mm_srli_epi16(g, 2));
+  b = _mm_or_si128(_mm_slli_epi16(b, 3), _mm_srli_epi16(b, 2));
+  RGBA_interleave8(r, g, b, a, rgba);
+#elif SIMD_NEON
+  uint16x8_t v = vld1q_u16(src);
+  uint16x8_t mask = vdupq_n_u16(0x1f);
+  uint16x8_t r = vandq_u16(vshrq_n_u16(v, 10), mask);
+  uint16x8_t g = vandq_u16(vshrq_n_u16(v, 5), mask);
+  uint16x8_t b = vandq_u16(v, mask);
+  uint16x8_t a =
+      vreinterpretq_u16_s16(vshrq_n_s16(vreinterpretq_s16_u16(v), 15));
+  r = vorrq_u16(vshlq_n_u16(r, 3), vshrq_n_u16(r, 2));
+  g = vorrq_u16(vshlq_n_u16(g, 3), vshrq_n_u16(g, 2));
+  b = vorrq_u16(vshlq_n_u16(b, 3), vshrq_n_u16(b, 2));
+  RGBA_interleave8(r, g, b, a, rgba);
+#else
+  for (int i = 0; i < 8; i++) {
+    ARGB1555_unpack(src[i], rgba + i * 4);
+  }
+#endif
 }
 
 static inline void ARGB1555_unpack_twiddled(const ARGB1555_type *src,
                                             uint8_t *rgba) {
-  ARGB1555_unpack(src[0], rgba + 0x0);
-  ARGB1555_unpack(src[1], rgba + 0x4);
-  ARGB1555_unpack(src[2], rgba + 0x8);
-  ARGB1555_unpack(src[3], rgba + 0xc);
-}
-
-static inline void ARGB1555_unpack_pal4(const uint8_t *src, const uint32_t *pal,
-                                        uint8_t *rgba) {
-  ARGB1555_unpack((ARGB1555_type)pal[src[0] & 15], rgba + 0x0);
-  ARGB1555_unpack((ARGB1555_type)pal[src[0] >> 4], rgba + 0x4);
-  ARGB1555_unpack((ARGB1555_type)pal[src[1] & 15], rgba + 0x8);
-  ARGB1555_unpack((ARGB1555_type)pal[src[1] >> 4], rgba + 0xc);
-}
-
-static inline void ARGB1555_unpack_pal8(const uint8_t *src, const uint32_t *pal,
-                                        uint8_t *rgba) {
-  ARGB1555_unpack((ARGB1555_type)pal[src[0]], rgba + 0x0);
-  ARGB1555_unpack((ARGB1555_type)pal[src[1]], rgba + 0x4);
-  ARGB1555_unpack((ARGB1555_type)pal[src[2]], rgba + 0x8);
-  ARGB1555_unpack((ARGB1555_type)pal[src[3]], rgba + 0xc);
+  ARGB1555_unpack_bitmap(src + 0, rgba + 0x00);
+  ARGB1555_unpack_bitmap(src + 8, rgba + 0x20);
 }
 
 /* RGB565 */
@@ -99,34 +128,37 @@ static inline void RGB565_unpack(const RGB565_type src, uint8_t *rgba) {
 }
 
 static inline void RGB565_unpack_bitmap(const RGB565_type *src, uint8_t *rgba) {
-  RGB565_unpack(src[0], rgba + 0x0);
-  RGB565_unpack(src[1], rgba + 0x4);
-  RGB565_unpack(src[2], rgba + 0x8);
-  RGB565_unpack(src[3], rgba + 0xc);
+#if SIMD_SSE2
+  __m128i v = _mm_loadu_si128((const __m128i *)src);
+  __m128i r = _mm_srli_epi16(v, 11);
+  __m128i g = _mm_and_si128(_mm_srli_epi16(v, 5), _mm_set1_epi16(0x3f));
+  __m128i b = _mm_and_si128(v, _mm_set1_epi16(0x1f));
+  __m128i a = _mm_set1_epi16(0xff);
+  r = _mm_or_si128(_mm_slli_epi16(r, 3), _mm_srli_epi16(r, 2));
+  g = _mm_or_si128(_mm_slli_epi16(g, 2), _mm_srli_epi16(g, 4));
+  b = _mm_or_si128(_mm_slli_epi16(b, 3), _mm_srli_epi16(b, 2));
+  RGBA_interleave8(r, g, b, a, rgba);
+#elif SIMD_NEON
+  uint16x8_t v = vld1q_u16(src);
+  uint16x8_t r = vshrq_n_u16(v, 11);
+  uint16x8_t g = vandq_u16(vshrq_n_u16(v, 5), vdupq_n_u16(0x3f));
+  uint16x8_t b = vandq_u16(v, vdupq_n_u16(0x1f));
+  uint16x8_t a = vdupq_n_u16(0xff);
+  r = vorrq_u16(vshlq_n_u16(r, 3), vshrq_n_u16(r, 2));
+  g = vorrq_u16(vshlq_n_u16(g, 2), vshrq_n_u16(g, 4));
+  b = vorrq_u16(vshlq_n_u16(b, 3), vshrq_n_u16(b, 2));
+  RGBA_interleave8(r, g, b, a, rgba);
+#else
+  for (int i = 0; i < 8; i++) {
+    RGB565_unpack(src[i], rgba + i * 4);
+  }
+#endif
 }
 
 static inline void RGB565_unpack_twiddled(const RGB565_type *src,
                                           uint8_t *rgba) {
-  RGB565_unpack(src[0], rgba + 0x0);
-  RGB565_unpack(src[1], rgba + 0x4);
-  RGB565_unpack(src[2], rgba + 0x8);
-  RGB565_unpack(src[3], rgba + 0xc);
-}
-
-static inline void RGB565_unpack_pal4(const uint8_t *src, const uint32_t *pal,
-                                      uint8_t *rgba) {
-  RGB565_unpack((RGB565_type)pal[src[0] & 15], rgba + 0x0);
-  RGB565_unpack((RGB565_type)pal[src[0] >> 4], rgba + 0x4);
-  RGB565_unpack((RGB565_type)pal[src[1] & 15], rgba + 0x8);
-  RGB565_unpack((RGB565_type)pal[src[1] >> 4], rgba + 0xc);
-}
-
-static inline void RGB565_unpack_pal8(const uint8_t *src, const uint32_t *pal,
-                                      uint8_t *rgba) {
-  RGB565_unpack((RGB565_type)pal[src[0]], rgba + 0x0);
-  RGB565_unpack((RGB565_type)pal[src[1]], rgba + 0x4);
-  RGB565_unpack((RGB565_type)pal[src[2]], rgba + 0x8);
-  RGB565_unpack((RGB565_type)pal[src[3]], rgba + 0xc);
+  RGB565_unpack_bitmap(src + 0, rgba + 0x00);
+  RGB565_unpack_bitmap(src + 8, rgba + 0x20);
 }
 
 /* UYVY422 */
@@ -163,16 +195,107 @@ static inline void UYVY422_unpack(UYVY422_type src0, UYVY422_type src1,
   b[3] = 0xff;
 }
 
+#if SIMD_SSE2
+/* signed division by a power of two, truncating towards zero like the scalar
+   yuv_to_* routines do */
+static inline __m128i UYVY422_div(__m128i x, int shift) {
+  __m128i bias =
+      _mm_and_si128(_mm_srai_epi16(x, 15), _mm_set1_epi16((1 << shift) - 1));
+  return _mm_srai_epi16(_mm_add_epi16(x, bias), shift);
+}
+
+/* convert 8 texels worth of luma and chroma, each stored in 16-bit lanes */
+static inline void UYVY422_convert8(__m128i y, __m128i u, __m128i v,
+                                    uint8_t *rgba) {
+  __m128i zero = _mm_setzero_si128();
+  __m128i max = _mm_set1_epi16(0xff);
+  u = _mm_sub_epi16(u, _mm_set1_epi16(128));
+  v = _mm_sub_epi16(v, _mm_set1_epi16(128));
+  __m128i dr = UYVY422_div(_mm_mullo_epi16(v, _mm_set1_epi16(11)), 3);
+  __m128i dg = UYVY422_div(_mm_add_epi16(_mm_mullo_epi16(u, _mm_set1_epi16(11)),
+                                         _mm_mullo_epi16(v, _mm_set1_epi16(22))),
+                           5);
+  __m128i db = UYVY422_div(_mm_mullo_epi16(u, _mm_set1_epi16(55)), 5);
+  __m128i r = _mm_min_epi16(_mm_max_epi16(_mm_add_epi16(y, dr), zero), max);
+  __m128i g = _mm_min_epi16(_mm_max_epi16(_mm_sub_epi16(y, dg), zero), max);
+  __m128i b = _mm_min_epi16(_mm_max_epi16(_mm_add_epi16(y, db), zero), max);
+  RGBA_interleave8(r, g, b, max, rgba);
+}
+#elif SIMD_NEON
+#define UYVY422_div(x, shift)                                          \
+  vshrq_n_s16(vaddq_s16(x, vandq_s16(vshrq_n_s16(x, 15),               \
+                                     vdupq_n_s16((1 << shift) - 1))), \
+              shift)
+
+static inline void UYVY422_convert8(uint16x8_t y, uint16x8_t u, uint16x8_t v,
+                                    uint8_t *rgba) {
+  int16x8_t sy = vreinterpretq_s16_u16(y);
+  int16x8_t su = vsubq_s16(vreinterpretq_s16_u16(u), vdupq_n_s16(128));
+  int16x8_t sv = vsubq_s16(vreinterpretq_s16_u16(v), vdupq_n_s16(128));
+  int16x8_t dr = UYVY422_div(vmulq_n_s16(sv, 11), 3);
+  int16x8_t dg =
+      UYVY422_div(vaddq_s16(vmulq_n_s16(su, 11), vmulq_n_s16(sv, 22)), 5);
+  int16x8_t db = UYVY422_div(vmulq_n_s16(su, 55), 5);
+  int16x8_t zero = vdupq_n_s16(0);
+  int16x8_t max = vdupq_n_s16(0xff);
+  int16x8_t r = vminq_s16(vmaxq_s16(vaddq_s16(sy, dr), zero), max);
+  int16x8_t g = vminq_s16(vmaxq_s16(vsubq_s16(sy, dg), zero), max);
+  int16x8_t b = vminq_s16(vmaxq_s16(vaddq_s16(sy, db), zero), max);
+  RGBA_interleave8(vreinterpretq_u16_s16(r), vreinterpretq_u16_s16(g),
+                   vreinterpretq_u16_s16(b), vreinterpretq_u16_s16(max), rgba);
+}
+#endif
+
 static inline void UYVY422_unpack_bitmap(const UYVY422_type *src,
                                          uint8_t *rgba) {
-  UYVY422_unpack(src[0], src[1], rgba + 0x0, rgba + 0x4);
-  UYVY422_unpack(src[2], src[3], rgba + 0x8, rgba + 0xc);
+#if SIMD_SSE2
+  /* each texel pair shares the u of its first and the v of its second texel */
+  __m128i v = _mm_loadu_si128((const __m128i *)src);
+  __m128i y = _mm_srli_epi16(v, 8);
+  __m128i c = _mm_and_si128(v, _mm_set1_epi16(0xff));
+  __m128i cu = _mm_shufflehi_epi16(_mm_shufflelo_epi16(c, 0xa0), 0xa0);
+  __m128i cv = _mm_shufflehi_epi16(_mm_shufflelo_epi16(c, 0xf5), 0xf5);
+  UYVY422_convert8(y, cu, cv, rgba);
+#elif SIMD_NEON
+  uint16x8_t v = vld1q_u16(src);
+  uint16x8_t c = vandq_u16(v, vdupq_n_u16(0xff));
+  uint16x8x2_t uv = vtrnq_u16(c, c);
+  UYVY422_convert8(vshrq_n_u16(v, 8), uv.val[0], uv.val[1], rgba);
+#else
+  for (int i = 0; i < 8; i += 2) {
+    UYVY422_unpack(src[i], src[i + 1], rgba + i * 4, rgba + i * 4 + 4);
+  }
+#endif
 }
 
 static inline void UYVY422_unpack_twiddled(const UYVY422_type *src,
                                            uint8_t *rgba) {
-  UYVY422_unpack(src[0], src[2], rgba + 0x0, rgba + 0x8);
-  UYVY422_unpack(src[1], src[3], rgba + 0x4, rgba + 0xc);
+  /* each 2x2 quad pairs its horizontally adjacent texels */
+#if SIMD_SSE2
+  for (int i = 0; i < 16; i += 8) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+    __m128i y = _mm_srli_epi16(v, 8);
+    __m128i c = _mm_and_si128(v, _mm_set1_epi16(0xff));
+    __m128i cu = _mm_shufflehi_epi16(_mm_shufflelo_epi16(c, 0x44), 0x44);
+    __m128i cv = _mm_shufflehi_epi16(_mm_shufflelo_epi16(c, 0xee), 0xee);
+    UYVY422_convert8(y, cu, cv, rgba + i * 4);
+  }
+#elif SIMD_NEON
+  for (int i = 0; i < 16; i += 8) {
+    uint16x8_t v = vld1q_u16(src + i);
+    uint32x4_t c = vreinterpretq_u32_u16(vandq_u16(v, vdupq_n_u16(0xff)));
+    uint32x4x2_t uv = vtrnq_u32(c, c);
+    UYVY422_convert8(vshrq_n_u16(v, 8), vreinterpretq_u16_u32(uv.val[0]),
+                     vreinterpretq_u16_u32(uv.val[1]), rgba + i * 4);
+  }
+#else
+  for (int i = 0; i < 16; i += 4) {
+    UYVY422_unpack(src[i + 0], src[i + 2], rgba + i * 4 + 0x0,
+                   rgba + i * 4 + 0x8);
+    UYVY422_unpack(src[i + 1], src[i + 3], rgba + i * 4 + 0x4,
+                   rgba + i * 4 + 0xc);
+  }
+#endif
 }
 
 /* ARGB4444 */
@@ -187,34 +310,41 @@ static inline void ARGB4444_unpack(const ARGB4444_type src, uint8_t *rgba) {
 
 static inline void ARGB4444_unpack_bitmap(const ARGB4444_type *src,
                                           uint8_t *rgba) {
-  ARGB4444_unpack(src[0], rgba + 0x0);
-  ARGB4444_unpack(src[1], rgba + 0x4);
-  ARGB4444_unpack(src[2], rgba + 0x8);
-  ARGB4444_unpack(src[3], rgba + 0xc);
+#if SIMD_SSE2
+  __m128i v = _mm_loadu_si128((const __m128i *)src);
+  __m128i mask = _mm_set1_epi16(0xf);
+  __m128i r = _mm_and_si128(_mm_srli_epi16(v, 8), mask);
+  __m128i g = _mm_and_si128(_mm_srli_epi16(v, 4), mask);
+  __m128i b = _mm_and_si128(v, mask);
+  __m128i a = _mm_srli_epi16(v, 12);
+  r = _mm_or_si128(_mm_slli_epi16(r, 4), r);
+  g = _mm_or_si128(_mm_slli_epi16(g, 4), g);
+  b = _mm_or_si128(_mm_slli_epi16(b, 4), b);
+  a = _mm_or_si128(_mm_slli_epi16(a, 4), a);
+  RGBA_interleave8(r, g, b, a, rgba);
+#elif SIMD_NEON
+  uint16x8_t v = vld1q_u16(src);
+  uint16x8_t mask = vdupq_n_u16(0xf);
+  uint16x8_t r = vandq_u16(vshrq_n_u16(v, 8), mask);
+  uint16x8_t g = vandq_u16(vshrq_n_u16(v, 4), mask);
+  uint16x8_t b = vandq_u16(v, mask);
+  uint16x8_t a = vshrq_n_u16(v, 12);
+  r = vorrq_u16(vshlq_n_u16(r, 4), r);
+  g = vorrq_u16(vshlq_n_u16(g, 4), g);
+  b = vorrq_u16(vshlq_n_u16(b, 4), b);
+  a = vorrq_u16(vshlq_n_u16(a, 4), a);
+  RGBA_interleave8(r, g, b, a, rgba);
+#else
+  for (int i = 0; i < 8; i++) {
+    ARGB4444_unpack(src[i], rgba + i * 4);
+  }
+#endif
 }
 
 static inline void ARGB4444_unpack_twiddled(const ARGB4444_type *src,
                                             uint8_t *rgba) {
-  ARGB4444_unpack(src[0], rgba + 0x0);
-  ARGB4444_unpack(src[1], rgba + 0x4);
-  ARGB4444_unpack(src[2], rgba + 0x8);
-  ARGB4444_unpack(src[3], rgba + 0xc);
-}
-
-static inline void ARGB4444_unpack_pal4(const uint8_t *src, const uint32_t *pal,
-                                        uint8_t *rgba) {
-  ARGB4444_unpack((ARGB4444_type)pal[src[0] & 15], rgba + 0x0);
-  ARGB4444_unpack((ARGB4444_type)pal[src[0] >> 4], rgba + 0x4);
-  ARGB4444_unpack((ARGB4444_type)pal[src[1] & 15], rgba + 0x8);
-  ARGB4444_unpack((ARGB4444_type)pal[src[1] >> 4], rgba + 0xc);
-}
-
-static inline void ARGB4444_unpack_pal8(const uint8_t *src, const uint32_t *pal,
-                                        uint8_t *rgba) {
-  ARGB4444_unpack((ARGB4444_type)pal[src[0]], rgba + 0x0);
-  ARGB4444_unpack((ARGB4444_type)pal[src[1]], rgba + 0x4);
-  ARGB4444_unpack((ARGB4444_type)pal[src[2]], rgba + 0x8);
-  ARGB4444_unpack((ARGB4444_type)pal[src[3]], rgba + 0xc);
+  ARGB4444_unpack_bitmap(src + 0, rgba + 0x00);
+  ARGB4444_unpack_bitmap(src + 8, rgba + 0x20);
 }
 
 /* ARGB8888 */
@@ -227,38 +357,6 @@ static inline void ARGB8888_unpack(ARGB8888_type src, uint8_t *rgba) {
   rgba[3] = (src >> 24) & 0xff;
 }
 
-static inline void ARGB8888_unpack_bitmap(const ARGB8888_type *src,
-                                          uint8_t *rgba) {
-  ARGB8888_unpack(src[0], rgba + 0x0);
-  ARGB8888_unpack(src[1], rgba + 0x4);
-  ARGB8888_unpack(src[2], rgba + 0x8);
-  ARGB8888_unpack(src[3], rgba + 0xc);
-}
-
-static inline void ARGB8888_unpack_twiddled(const ARGB8888_type *src,
-                                            uint8_t *rgba) {
-  ARGB8888_unpack(src[0], rgba + 0x0);
-  ARGB8888_unpack(src[1], rgba + 0x4);
-  ARGB8888_unpack(src[2], rgba + 0x8);
-  ARGB8888_unpack(src[3], rgba + 0xc);
-}
-
-static inline void ARGB8888_unpack_pal4(const uint8_t *src, const uint32_t *pal,
-                                        uint8_t *rgba) {
-  ARGB8888_unpack((ARGB8888_type)pal[src[0] & 15], rgba + 0x0);
-  ARGB8888_unpack((ARGB8888_type)pal[src[0] >> 4], rgba + 0x4);
-  ARGB8888_unpack((ARGB8888_type)pal[src[1] & 15], rgba + 0x8);
-  ARGB8888_unpack((ARGB8888_type)pal[src[1] >> 4], rgba + 0xc);
-}
-
-static inline void ARGB8888_unpack_pal8(const uint8_t *src, const uint32_t *pal,
-                                        uint8_t *rgba) {
-  ARGB8888_unpack((ARGB8888_type)pal[src[0]], rgba + 0x0);
-  ARGB8888_unpack((ARGB8888_type)pal[src[1]], rgba + 0x4);
-  ARGB8888_unpack((ARGB8888_type)pal[src[2]], rgba + 0x8);
-  ARGB8888_unpack((ARGB8888_type)pal[src[3]], rgba + 0xc);
-}
-
 /* RGBA */
 typedef uint32_t RGBA_type;
 
@@ -268,18 +366,128 @@ static inline void RGBA_pack(RGBA_type *dst, uint8_t *rgba) {
 
 static inline void RGBA_pack_bitmap(RGBA_type *dst, int x, int y, int stride,
                                     uint8_t *rgba) {
-  RGBA_pack(&dst[y * stride + (x + 0)], rgba + 0x0);
-  RGBA_pack(&dst[y * stride + (x + 1)], rgba + 0x4);
-  RGBA_pack(&dst[y * stride + (x + 2)], rgba + 0x8);
-  RGBA_pack(&dst[y * stride + (x + 3)], rgba + 0xc);
+  memcpy(&dst[y * stride + x], rgba, 8 * sizeof(RGBA_type));
 }
 
 static inline void RGBA_pack_twiddled(RGBA_type *dst, int x, int y, int stride,
                                       uint8_t *rgba) {
-  RGBA_pack(&dst[(y + 0) * stride + (x + 0)], rgba + 0x0);
-  RGBA_pack(&dst[(y + 1) * stride + (x + 0)], rgba + 0x4);
-  RGBA_pack(&dst[(y + 0) * stride + (x + 1)], rgba + 0x8);
-  RGBA_pack(&dst[(y + 1) * stride + (x + 1)], rgba + 0xc);
+  /* the 4x4 block is made up of four 2x2 quads stored in reverse N order:
+
+     q0 = 00 01 02 03   q1 = 04 05 06 07
+     q2 = 08 09 10 11   q3 = 12 13 14 15
+
+     rows 0 and 1 are the even and odd texels of q0 and q2, rows 2 and 3 the
+     even and odd texels of q1 and q3 */
+  RGBA_type *row = &dst[y * stride + x];
+#if SIMD_SSE2
+  __m128i q0 = _mm_loadu_si128((const __m128i *)(rgba + 0x00));
+  __m128i q1 = _mm_loadu_si128((const __m128i *)(rgba + 0x10));
+  __m128i q2 = _mm_loadu_si128((const __m128i *)(rgba + 0x20));
+  __m128i q3 = _mm_loadu_si128((const __m128i *)(rgba + 0x30));
+  q0 = _mm_shuffle_epi32(q0, _MM_SHUFFLE(3, 1, 2, 0));
+  q1 = _mm_shuffle_epi32(q1, _MM_SHUFFLE(3, 1, 2, 0));
+  q2 = _mm_shuffle_epi32(q2, _MM_SHUFFLE(3, 1, 2, 0));
+  q3 = _mm_shuffle_epi32(q3, _MM_SHUFFLE(3, 1, 2, 0));
+  _mm_storeu_si128((__m128i *)(row + 0 * stride), _mm_unpacklo_epi64(q0, q2));
+  _mm_storeu_si128((__m128i *)(row + 1 * stride), _mm_unpackhi_epi64(q0, q2));
+  _mm_storeu_si128((__m128i *)(row + 2 * stride), _mm_unpacklo_epi64(q1, q3));
+  _mm_storeu_si128((__m128i *)(row + 3 * stride), _mm_unpackhi_epi64(q1, q3));
+#elif SIMD_NEON
+  uint32x4x2_t q02 = vuzpq_u32(vld1q_u32((const uint32_t *)(rgba + 0x00)),
+                               vld1q_u32((const uint32_t *)(rgba + 0x20)));
+  uint32x4x2_t q13 = vuzpq_u32(vld1q_u32((const uint32_t *)(rgba + 0x10)),
+                               vld1q_u32((const uint32_t *)(rgba + 0x30)));
+  vst1q_u32(row + 0 * stride, q02.val[0]);
+  vst1q_u32(row + 1 * stride, q02.val[1]);
+  vst1q_u32(row + 2 * stride, q13.val[0]);
+  vst1q_u32(row + 3 * stride, q13.val[1]);
+#else
+  for (int i = 0; i < 16; i++) {
+    int quad = i >> 2;
+    int qx = ((quad >> 1) << 1) | ((i >> 1) & 1);
+    int qy = ((quad & 1) << 1) | (i & 1);
+    RGBA_pack(&row[qy * stride + qx], rgba + i * 4);
+  }
+#endif
+}
+
+/* RGBA5551, RGB565 and RGBA4444
+
+   the 16-bit formats can be uploaded natively, only needing their channels
+   rotated into the order gl expects. RGB565 already matches */
+typedef uint16_t RGBA5551_type;
+typedef uint16_t RGBA4444_type;
+
+static inline void rotate16_8(const uint16_t *src, uint16_t *dst, int n) {
+#if SIMD_SSE2
+  __m128i v = _mm_loadu_si128((const __m128i *)src);
+  __m128i l = _mm_sll_epi16(v, _mm_cvtsi32_si128(n));
+  __m128i r = _mm_srl_epi16(v, _mm_cvtsi32_si128(16 - n));
+  _mm_storeu_si128((__m128i *)dst, _mm_or_si128(l, r));
+#elif SIMD_NEON
+  uint16x8_t v = vld1q_u16(src);
+  uint16x8_t l = vshlq_u16(v, vdupq_n_s16(n));
+  uint16x8_t r = vshlq_u16(v, vdupq_n_s16(n - 16));
+  vst1q_u16(dst, vorrq_u16(l, r));
+#else
+  for (int i = 0; i < 8; i++) {
+    dst[i] = (uint16_t)((src[i] << n) | (src[i] >> (16 - n)));
+  }
+#endif
+}
+
+static inline void ARGB1555_to_RGBA5551(const ARGB1555_type *src,
+                                        RGBA5551_type *dst) {
+  rotate16_8(src, dst, 1);
+}
+
+static inline void RGB565_to_RGB565(const RGB565_type *src,
+                                    RGB565_type *dst) {
+  memcpy(dst, src, 8 * sizeof(RGB565_type));
+}
+
+static inline void ARGB4444_to_RGBA4444(const ARGB4444_type *src,
+                                        RGBA4444_type *dst) {
+  rotate16_8(src, dst, 4);
+}
+
+static inline void pack_twiddled16(uint16_t *dst, int x, int y, int stride,
+                                   const uint16_t *texels) {
+  /* same reverse N order as RGBA_pack_twiddled, with rows 0 and 1 being the
+     even and odd texels of 0-3 and 8-11, rows 2 and 3 those of 4-7 and
+     12-15 */
+  uint16_t *row = &dst[y * stride + x];
+#if SIMD_SSE2
+  __m128i lo = _mm_loadu_si128((const __m128i *)(texels + 0));
+  __m128i hi = _mm_loadu_si128((const __m128i *)(texels + 8));
+  lo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(lo, _MM_SHUFFLE(3, 1, 2, 0)),
+                           _MM_SHUFFLE(3, 1, 2, 0));
+  hi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(hi, _MM_SHUFFLE(3, 1, 2, 0)),
+                           _MM_SHUFFLE(3, 1, 2, 0));
+  __m128i r01 = _mm_unpacklo_epi32(lo, hi);
+  __m128i r23 = _mm_unpackhi_epi32(lo, hi);
+  _mm_storel_epi64((__m128i *)(row + 0 * stride), r01);
+  _mm_storel_epi64((__m128i *)(row + 1 * stride), _mm_srli_si128(r01, 8));
+  _mm_storel_epi64((__m128i *)(row + 2 * stride), r23);
+  _mm_storel_epi64((__m128i *)(row + 3 * stride), _mm_srli_si128(r23, 8));
+#elif SIMD_NEON
+  uint16x8x2_t eo = vuzpq_u16(vld1q_u16(texels + 0), vld1q_u16(texels + 8));
+  uint32x4_t even = vreinterpretq_u32_u16(eo.val[0]);
+  uint32x4_t odd = vreinterpretq_u32_u16(eo.val[1]);
+  uint32x4x2_t r02 = vuzpq_u32(even, even);
+  uint32x4x2_t r13 = vuzpq_u32(odd, odd);
+  vst1_u16(row + 0 * stride, vreinterpret_u16_u32(vget_low_u32(r02.val[0])));
+  vst1_u16(row + 1 * stride, vreinterpret_u16_u32(vget_low_u32(r13.val[0])));
+  vst1_u16(row + 2 * stride, vreinterpret_u16_u32(vget_low_u32(r02.val[1])));
+  vst1_u16(row + 3 * stride, vreinterpret_u16_u32(vget_low_u32(r13.val[1])));
+#else
+  for (int i = 0; i < 16; i++) {
+    int quad = i >> 2;
+    int qx = ((quad >> 1) << 1) | ((i >> 1) & 1);
+    int qy = ((quad & 1) << 1) | (i & 1);
+    row[qy * stride + qx] = texels[i];
+  }
+#endif
 }
 
 /*
@@ -288,11 +496,16 @@ static inline void RGBA_pack_twiddled(RGBA_type *dst, int x, int y, int stride,
  * functions for converting from twiddled, compressed and paletted textures into
  * bitmaps to be registered with the render backend
  *
- * note, all pixel pack routines operate on 4 texels at a time, optimizing and
- * simplifying the logic for converting from twidddled and compressed textures
- * which both fundamentally work with 4 texels at a time. further, this allows
- * the UYVY422 unpacking routines (which work on 2 texels at a time) to not
+ * note, bitmap textures are unpacked 8 texels at a time, while twiddled,
+ * compressed and paletted textures are unpacked a 4x4 block (16 texels) at a
+ * time. these are contiguous in the source data, letting the 16-bit formats be
+ * expanded with simd routines and the twiddled order be undone with a fixed
+ * shuffle, leaving only a single twiddle table lookup per block. further, this
+ * lets the UYVY422 unpacking routines (which work on 2 texels at a time) not
  * need any additional special casing
+ *
+ * paletted and compressed textures unpack their palette / codebook once per
+ * texture, reducing the per-texel work to a table lookup
  */
 
 /* twiddled-format textures are stored in a reverse N order like:
@@ -332,10 +545,10 @@ static int pvr_twiddle_pos(int x, int y) {
 #define define_convert_bitmap(FROM, TO)                                     \
   void convert_bitmap_##FROM##_##TO(const FROM##_type *src, TO##_type *dst, \
                                     int width, int height, int stride) {    \
-    uint8_t rgba[4 * 4];                                                    \
+    ALIGNED(16) uint8_t rgba[8 * 4];                                        \
                                                                             \
     for (int y = 0; y < height; y++) {                                      \
-      for (int x = 0; x < width; x += 4) {                                  \
+      for (int x = 0; x < width; x += 8) {                                  \
         FROM##_unpack_bitmap(&src[y * stride + x], rgba);                   \
         TO##_pack_bitmap(dst, x, y, width, rgba);                           \
       }                                                                     \
@@ -347,14 +560,14 @@ static int pvr_twiddle_pos(int x, int y) {
                                       int width, int height) {                \
     pvr_init_twiddle_table();                                                 \
                                                                               \
-    uint8_t rgba[4 * 4];                                                      \
+    ALIGNED(16) uint8_t rgba[16 * 4];                                         \
     int size = MIN(width, height);                                            \
     int base = 0;                                                             \
                                                                               \
     for (int y = 0; y < height; y += size) {                                  \
       for (int x = 0; x < width; x += size) {                                 \
-        for (int y2 = 0; y2 < size; y2 += 2) {                                \
-          for (int x2 = 0; x2 < size; x2 += 2) {                              \
+        for (int y2 = 0; y2 < size; y2 += 4) {                                \
+          for (int x2 = 0; x2 < size; x2 += 4) {                              \
             int pos = base + pvr_twiddle_pos(x2, y2);                         \
             FROM##_unpack_twiddled(&src[pos], rgba);                          \
             TO##_pack_twiddled(dst, x + x2, y + y2, width, rgba);             \
@@ -371,17 +584,27 @@ static int pvr_twiddle_pos(int x, int y) {
                                   int height) {                       \
     pvr_init_twiddle_table();                                         \
                                                                       \
-    uint8_t rgba[4 * 4];                                              \
+    uint32_t lut[16];                                                 \
+    for (int i = 0; i < 16; i++) {                                    \
+      FROM##_unpack((FROM##_type)palette[i], (uint8_t *)&lut[i]);     \
+    }                                                                 \
+                                                                      \
+    ALIGNED(16) uint32_t rgba[16];                                    \
     int size = MIN(width, height);                                    \
     int base = 0;                                                     \
                                                                       \
     for (int y = 0; y < height; y += size) {                          \
       for (int x = 0; x < width; x += size) {                         \
-        for (int y2 = 0; y2 < size; y2 += 2) {                        \
-          for (int x2 = 0; x2 < size; x2 += 2) {                      \
+        for (int y2 = 0; y2 < size; y2 += 4) {                        \
+          for (int x2 = 0; x2 < size; x2 += 4) {                      \
             int pos = base + pvr_twiddle_pos(x2, y2);                 \
-            FROM##_unpack_pal4(&src[pos >> 1], palette, rgba);        \
-            TO##_pack_twiddled(dst, x + x2, y + y2, width, rgba);     \
+            const uint8_t *idx = &src[pos >> 1];                      \
+            for (int i = 0; i < 8; i++) {                             \
+              rgba[i * 2 + 0] = lut[idx[i] & 15];                     \
+              rgba[i * 2 + 1] = lut[idx[i] >> 4];                     \
+            }                                                         \
+            TO##_pack_twiddled(dst, x + x2, y + y2, width,            \
+                               (uint8_t *)rgba);                      \
           }                                                           \
         }                                                             \
         base += size * size;                                          \
@@ -395,17 +618,26 @@ static int pvr_twiddle_pos(int x, int y) {
                                   int height) {                       \
     pvr_init_twiddle_table();                                         \
                                                                       \
-    uint8_t rgba[4 * 4];                                              \
+    uint32_t lut[256];                                                \
+    for (int i = 0; i < 256; i++) {                                   \
+      FROM##_unpack((FROM##_type)palette[i], (uint8_t *)&lut[i]);     \
+    }                                                                 \
+                                                                      \
+    ALIGNED(16) uint32_t rgba[16];                                    \
     int size = MIN(width, height);                                    \
     int base = 0;                                                     \
                                                                       \
     for (int y = 0; y < height; y += size) {                          \
       for (int x = 0; x < width; x += size) {                         \
-        for (int y2 = 0; y2 < size; y2 += 2) {                        \
-          for (int x2 = 0; x2 < size; x2 += 2) {                      \
+        for (int y2 = 0; y2 < size; y2 += 4) {                        \
+          for (int x2 = 0; x2 < size; x2 += 4) {                      \
             int pos = base + pvr_twiddle_pos(x2, y2);                 \
-            FROM##_unpack_pal8(&src[pos], palette, rgba);             \
-            TO##_pack_twiddled(dst, x + x2, y + y2, width, rgba);     \
+            const uint8_t *idx = &src[pos];                           \
+            for (int i = 0; i < 16; i++) {                            \
+              rgba[i] = lut[idx[i]];                                  \
+            }                                                         \
+            TO##_pack_twiddled(dst, x + x2, y + y2, width,            \
+                               (uint8_t *)rgba);                      \
           }                                                           \
         }                                                             \
         base += size * size;                                          \
@@ -418,19 +650,29 @@ static int pvr_twiddle_pos(int x, int y) {
                                 TO##_type *dst, int width, int height) {     \
     pvr_init_twiddle_table();                                                \
                                                                              \
-    uint8_t rgba[4 * 4];                                                     \
+    /* each codebook entry is a 2x2 quad, 4x2 bytes long. unpack all 256     \
+       entries up front, 4 at a time */                                      \
+    ALIGNED(16) uint8_t lut[256 * 4 * 4];                                    \
+    for (int i = 0; i < 256; i += 4) {                                       \
+      const FROM##_type *code = (const FROM##_type *)&codebook[i * 8];       \
+      FROM##_unpack_twiddled(code, &lut[i * 16]);                            \
+    }                                                                        \
+                                                                             \
+    ALIGNED(16) uint8_t rgba[16 * 4];                                        \
     int size = MIN(width, height);                                           \
     int base = 0;                                                            \
                                                                              \
     for (int y = 0; y < height; y += size) {                                 \
       for (int x = 0; x < width; x += size) {                                \
-        for (int y2 = 0; y2 < size; y2 += 2) {                               \
-          for (int x2 = 0; x2 < size; x2 += 2) {                             \
+        for (int y2 = 0; y2 < size; y2 += 4) {                               \
+          for (int x2 = 0; x2 < size; x2 += 4) {                             \
             int pos = base + pvr_twiddle_pos(x2, y2);                        \
-            /* each codebook entry is 4x2 bytes long */                      \
-            int idx = src[pos / 4] * 8;                                      \
-            const FROM##_type *code = (const FROM##_type *)&codebook[idx];   \
-            FROM##_unpack_twiddled(code, rgba);                              \
+            /* each index selects the codebook entry for a 2x2 quad */       \
+            const uint8_t *idx = &src[pos / 4];                              \
+            memcpy(rgba + 0x00, &lut[idx[0] * 16], 16);                      \
+            memcpy(rgba + 0x10, &lut[idx[1] * 16], 16);                      \
+            memcpy(rgba + 0x20, &lut[idx[2] * 16], 16);                      \
+            memcpy(rgba + 0x30, &lut[idx[3] * 16], 16);                      \
             TO##_pack_twiddled(dst, x + x2, y + y2, width, rgba);            \
           }                                                                  \
         }                                                                    \
@@ -439,6 +681,76 @@ static int pvr_twiddle_pos(int x, int y) {
     }                                                                        \
   }
 
+#define define_convert_bitmap16(FROM, TO)                                   \
+  void convert_bitmap_##FROM##_##TO(const FROM##_type *src, TO##_type *dst, \
+                                    int width, int height, int stride) {    \
+    for (int y = 0; y < height; y++) {                                      \
+      for (int x = 0; x < width; x += 8) {                                  \
+        FROM##_to_##TO(&src[y * stride + x], &dst[y * width + x]);          \
+      }                                                                     \
+    }                                                                       \
+  }
+
+#define define_convert_twiddled16(FROM, TO)                                   \
+  void convert_twiddled_##FROM##_##TO(const FROM##_type *src, TO##_type *dst, \
+                                      int width, int height) {                \
+    pvr_init_twiddle_table();                                                 \
+                                                                              \
+    ALIGNED(16) TO##_type texels[16];                                         \
+    int size = MIN(width, height);                                            \
+    int base = 0;                                                             \
+                                                                              \
+    for (int y = 0; y < height; y += size) {                                  \
+      for (int x = 0; x < width; x += size) {                                 \
+        for (int y2 = 0; y2 < size; y2 += 4) {                                \
+          for (int x2 = 0; x2 < size; x2 += 4) {                              \
+            int pos = base + pvr_twiddle_pos(x2, y2);                         \
+            FROM##_to_##TO(&src[pos + 0], texels + 0);                        \
+            FROM##_to_##TO(&src[pos + 8], texels + 8);                        \
+            pack_twiddled16(dst, x + x2, y + y2, width, texels);              \
+          }                                                                   \
+        }                                                                     \
+        base += size * size;                                                  \
+      }                                                                       \
+    }                                                                         \
+  }
+
+#define define_convert_vq16(FROM, TO)                                        \
+  void convert_vq_##FROM##_##TO(const uint8_t *src, const uint8_t *codebook, \
+                                TO##_type *dst, int width, int height) {     \
+    pvr_init_twiddle_table();                                                \
+                                                                             \
+    /* each codebook entry is a 2x2 quad of 4 texels, convert all 256        \
+       entries up front, 2 at a time */                                      \
+    const FROM##_type *codes = (const FROM##_type *)codebook;                \
+    ALIGNED(16) TO##_type lut[256 * 4];                                      \
+    for (int i = 0; i < 256 * 4; i += 8) {                                   \
+      FROM##_to_##TO(&codes[i], &lut[i]);                                    \
+    }                                                                        \
+                                                                             \
+    ALIGNED(16) TO##_type texels[16];                                        \
+    int size = MIN(width, height);                                           \
+    int base = 0;                                                            \
+                                                                             \
+    for (int y = 0; y < height; y += size) {                                 \
+      for (int x = 0; x < width; x += size) {                                \
+        for (int y2 = 0; y2 < size; y2 += 4) {                               \
+          for (int x2 = 0; x2 < size; x2 += 4) {                             \
+            int pos = base + pvr_twiddle_pos(x2, y2);                        \
+            /* each index selects the codebook entry for a 2x2 quad */       \
+            const uint8_t *idx = &src[pos / 4];                              \
+            memcpy(texels + 0x0, &lut[idx[0] * 4], 8);                       \
+            memcpy(texels + 0x4, &lut[idx[1] * 4], 8);                       \
+            memcpy(texels + 0x8, &lut[idx[2] * 4], 8);                       \
+            memcpy(texels + 0xc, &lut[idx[3] * 4], 8);                       \
+            pack_twiddled16(dst, x + x2, y + y2, width, texels);             \
+          }                                                                  \
+        }                                                                    \
+        base += size * size;                                                 \
+      }                                                                      \
+    }                                                                        \
+  }
+
 define_convert_bitmap(ARGB1555, RGBA);
 define_convert_bitmap(RGB565, RGBA);
 define_convert_bitmap(UYVY422, RGBA);
@@ -464,6 +776,18 @@ define_convert_vq(RGB565, RGBA);
 define_convert_vq(ARGB4444, RGBA);
 define_convert_vq(UYVY422, RGBA);
 
+define_convert_bitmap16(ARGB1555, RGBA5551);
+define_convert_bitmap16(RGB565, RGB565);
+define_convert_bitmap16(ARGB4444, RGBA4444);
+
+define_convert_twiddled16(ARGB1555, RGBA5551);
+define_convert_twiddled16(RGB565, RGB565);
+define_convert_twiddled16(ARGB4444, RGBA4444);
+
+define_convert_vq16(ARGB1555, RGBA5551);
+define_convert_vq16(RGB565, RGB565);
+define_convert_vq16(ARGB4444, RGBA4444);
+
 /*
  * texture loading
  */
@@ -574,9 +898,24 @@ const uint8_t *pvr_tex_data(const uint8_t *src) {
   return data;
 }
 
+enum pxl_format pvr_tex_native_format(int pixel_fmt) {
+  switch (pixel_fmt) {
+    case PVR_PXL_ARGB1555:
+    case PVR_PXL_RESERVED:
+      return PXL_RGBA5551;
+    case PVR_PXL_RGB565:
+      return PXL_RGB565;
+    case PVR_PXL_ARGB4444:
+      return PXL_RGBA4444;
+    default:
+      return PXL_RGBA;
+  }
+}
+
 void pvr_tex_decode(const uint8_t *src, int width, int height, int stride,
                     int texture_fmt, int pixel_fmt, const uint8_t *palette,
-                    int palette_fmt, uint8_t *dst, int size) {
+                    int palette_fmt, enum pxl_format dst_fmt, uint8_t *dst,
+                    int size) {
   int twiddled = pvr_tex_twiddled(texture_fmt);
   int compressed = pvr_tex_compressed(texture_fmt);
   int mipmaps = pvr_tex_mipmaps(texture_fmt);
@@ -606,8 +945,54 @@ void pvr_tex_decode(const uint8_t *src, int width, int height, int stride,
   /* aliases to cut down on copy and paste */
   const uint16_t *src16 = (const uint16_t *)src;
   const uint32_t *pal32 = (const uint32_t *)palette;
+  uint16_t *dst16 = (uint16_t *)dst;
   uint32_t *dst32 = (uint32_t *)dst;
 
+  /* the 16-bit formats may be left as 16 bits per texel */
+  if (dst_fmt != PXL_RGBA) {
+    CHECK_EQ(dst_fmt, pvr_tex_native_format(pixel_fmt));
+
+    switch (dst_fmt) {
+      case PXL_RGBA5551:
+        if (compressed) {
+          convert_vq_ARGB1555_RGBA5551(index, codebook, dst16, width, height);
+        } else if (twiddled) {
+          convert_twiddled_ARGB1555_RGBA5551(src16, dst16, width, height);
+        } else {
+          convert_bitmap_ARGB1555_RGBA5551(src16, dst16, width, height,
+                                           stride);
+        }
+        break;
+
+      case PXL_RGB565:
+        if (compressed) {
+          convert_vq_RGB565_RGB565(index, codebook, dst16, width, height);
+        } else if (twiddled) {
+          convert_twiddled_RGB565_RGB565(src16, dst16, width, height);
+        } else {
+          convert_bitmap_RGB565_RGB565(src16, dst16, width, height, stride);
+        }
+        break;
+
+      case PXL_RGBA4444:
+        if (compressed) {
+          convert_vq_ARGB4444_RGBA4444(index, codebook, dst16, width, height);
+        } else if (twiddled) {
+          convert_twiddled_ARGB4444_RGBA4444(src16, dst16, width, height);
+        } else {
+          convert_bitmap_ARGB4444_RGBA4444(src16, dst16, width, height,
+                                           stride);
+        }
+        break;
+
+      default:
+        LOG_FATAL("pvr_tex_decode unsupported native format %d", dst_fmt);
+        break;
+    }
+
+    return;
+  }
+
   switch (pixel_fmt) {
     case PVR_PXL_ARGB1555:
     case PVR_PXL_RESERVED:
@@ -707,3 +1092,33 @@ void pvr_tex_decode(const uint8_t *src, int width, int height, int stride,
       break;
   }
 }
+
+void pvr_pal_decode(const uint8_t *palette, int palette_fmt, uint8_t *dst,
+                    int num_entries) {
+  const uint32_t *pal32 = (const uint32_t *)palette;
+
+  for (int i = 0; i < num_entries; i++) {
+    switch (palette_fmt) {
+      case PVR_PAL_ARGB1555:
+        ARGB1555_unpack((ARGB1555_type)pal32[i], dst + i * 4);
+        break;
+
+      case PVR_PAL_RGB565:
+        RGB565_unpack((RGB565_type)pal32[i], dst + i * 4);
+        break;
+
+      case PVR_PAL_ARGB4444:
+        ARGB4444_unpack((ARGB4444_type)pal32[i], dst + i * 4);
+        break;
+
+      case PVR_PAL_ARGB8888:
+        ARGB8888_unpack((ARGB8888_type)pal32[i], dst + i * 4);
+        break;
+
+      default:
+        LOG_FATAL("pvr_pal_decode unsupported palette format %d",
+                  palette_fmt);
+        break;
+    }
+  }
+}
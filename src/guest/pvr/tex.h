@@ -2,6 +2,7 @@
 #define TEX_H
 
 #include <stdint.h>
+#include "render/render_backend.h"
 
 #define PVR_CODEBOOK_SIZE (256 * 8)
 
@@ -71,11 +72,21 @@ static inline int pvr_tex_mipmaps(int texture_fmt) {
          texture_fmt == PVR_TEX_PALETTE_8BPP_MIPMAPS;
 }
 
+void pvr_init_twiddle_table();
+
 const struct pvr_tex_header *pvr_tex_header(const uint8_t *src);
 const uint8_t *pvr_tex_data(const uint8_t *src);
 
+/* the 16-bit pixel formats can be decoded to the matching PXL_RGBA5551,
+   PXL_RGB565 or PXL_RGBA4444 format, only reordering their channels. any
+   other pixel format is decoded to PXL_RGBA */
+enum pxl_format pvr_tex_native_format(int pixel_fmt);
+
 void pvr_tex_decode(const uint8_t *data, int width, int height, int stride,
                     int texture_fmt, int pixel_fmt, const uint8_t *palette,
-                    int pal_pixel_fmt, uint8_t *out, int size);
+                    int pal_pixel_fmt, enum pxl_format dst_fmt, uint8_t *out,
+                    int size);
+void pvr_pal_decode(const uint8_t *palette, int palette_fmt, uint8_t *out,
+                    int num_entries);
 
 #endif
@@ -0,0 +1,269 @@
+/*
+ * persistent texture cache
+ *
+ * decoded textures are written out to the application directory, keyed by the
+ * hash of their source data and the parameters used to decode them (see
+ * tr_texture_hash). on future sessions, textures hashing to the same value
+ * are read back from disk instead of being decoded again
+ *
+ * the cache is accessed by each of the tile renderer's decode threads, so all
+ * of its operations are serialized by a mutex
+ */
+
+#include <inttypes.h>
+#include "guest/pvr/tex_cache.h"
+#include "core/core.h"
+#include "core/filesystem.h"
+#include "core/rb_tree.h"
+#include "core/thread.h"
+
+#define TEX_CACHE_MAGIC 0x58455452 /* RTEX */
+#define TEX_CACHE_VERSION 1
+
+struct tex_cache_header {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t hash;
+  int32_t size;
+  int32_t reserved;
+};
+
+struct tex_cache_entry {
+  uint64_t hash;
+  int size;
+  struct rb_node it;
+};
+
+struct tex_cache {
+  char path[PATH_MAX];
+  mutex_t mutex;
+  struct rb_tree entries;
+};
+
+static int tex_cache_entry_cmp(const struct rb_node *rb_lhs,
+                               const struct rb_node *rb_rhs) {
+  const struct tex_cache_entry *lhs =
+      container_of(rb_lhs, const struct tex_cache_entry, it);
+  const struct tex_cache_entry *rhs =
+      container_of(rb_rhs, const struct tex_cache_entry, it);
+
+  if (lhs->hash < rhs->hash) {
+    return -1;
+  } else if (lhs->hash > rhs->hash) {
+    return 1;
+  } else {
+    return 0;
+  }
+}
+
+static struct rb_callbacks tex_cache_entry_cb = {
+    &tex_cache_entry_cmp, NULL, NULL,
+};
+
+static void tex_cache_texture_path(struct tex_cache *cache, uint64_t hash,
+                                   char *path, size_t size) {
+  snprintf(path, size, "%s" PATH_SEPARATOR "%016" PRIx64 ".rgba", cache->path,
+           hash);
+}
+
+static int tex_cache_read_header(FILE *file, uint64_t *hash, int *size) {
+  struct tex_cache_header header;
+
+  if (fread(&header, sizeof(header), 1, file) != 1) {
+    return 0;
+  }
+
+  if (header.magic != TEX_CACHE_MAGIC ||
+      header.version != TEX_CACHE_VERSION || header.size <= 0) {
+    return 0;
+  }
+
+  *hash = header.hash;
+  *size = header.size;
+
+  return 1;
+}
+
+static void tex_cache_free_entry(struct tex_cache *cache,
+                                 struct tex_cache_entry *entry) {
+  rb_unlink(&cache->entries, &entry->it, &tex_cache_entry_cb);
+  free(entry);
+}
+
+static struct tex_cache_entry *tex_cache_get_entry(struct tex_cache *cache,
+                                                   uint64_t hash) {
+  struct tex_cache_entry search = {0};
+  search.hash = hash;
+
+  return rb_find_entry(&cache->entries, &search, struct tex_cache_entry, it,
+                       &tex_cache_entry_cb);
+}
+
+static void tex_cache_add_entry(struct tex_cache *cache, uint64_t hash,
+                                int size) {
+  struct tex_cache_entry *entry = tex_cache_get_entry(cache, hash);
+
+  if (entry) {
+    entry->size = size;
+    return;
+  }
+
+  entry = calloc(1, sizeof(struct tex_cache_entry));
+  entry->hash = hash;
+  entry->size = size;
+
+  rb_insert(&cache->entries, &entry->it, &tex_cache_entry_cb);
+}
+
+static void tex_cache_load_index(struct tex_cache *cache) {
+  DIR *dir = opendir(cache->path);
+
+  if (!dir) {
+    return;
+  }
+
+  int num_entries = 0;
+  struct dirent *ent = NULL;
+
+  while ((ent = readdir(dir)) != NULL) {
+    const char *dname = ent->d_name;
+
+    /* ignore special directories */
+    if (!strcmp(dname, "..") || !strcmp(dname, ".")) {
+      continue;
+    }
+
+    char filename[PATH_MAX];
+    snprintf(filename, sizeof(filename), "%s" PATH_SEPARATOR "%s", cache->path,
+             dname);
+
+    FILE *file = fopen(filename, "rb");
+    if (!file) {
+      continue;
+    }
+
+    uint64_t hash;
+    int size;
+
+    if (tex_cache_read_header(file, &hash, &size)) {
+      tex_cache_add_entry(cache, hash, size);
+      num_entries++;
+    }
+
+    fclose(file);
+  }
+
+  closedir(dir);
+
+  LOG_INFO("tex_cache_load_index loaded %d cached textures", num_entries);
+}
+
+void tex_cache_save(struct tex_cache *cache, uint64_t hash,
+                    const uint8_t *data, int size) {
+  mutex_lock(cache->mutex);
+
+  if (tex_cache_get_entry(cache, hash)) {
+    mutex_unlock(cache->mutex);
+    return;
+  }
+
+  char filename[PATH_MAX];
+  tex_cache_texture_path(cache, hash, filename, sizeof(filename));
+
+  FILE *file = fopen(filename, "wb");
+  if (!file) {
+    LOG_WARNING("tex_cache_save failed to open %s", filename);
+    mutex_unlock(cache->mutex);
+    return;
+  }
+
+  struct tex_cache_header header = {0};
+  header.magic = TEX_CACHE_MAGIC;
+  header.version = TEX_CACHE_VERSION;
+  header.hash = hash;
+  header.size = size;
+
+  int res = fwrite(&header, sizeof(header), 1, file) == 1 &&
+            fwrite(data, size, 1, file) == 1;
+  fclose(file);
+
+  /* don't leave behind a truncated texture */
+  if (!res) {
+    LOG_WARNING("tex_cache_save failed to write %s", filename);
+    remove(filename);
+  } else {
+    tex_cache_add_entry(cache, hash, size);
+  }
+
+  mutex_unlock(cache->mutex);
+}
+
+int tex_cache_load(struct tex_cache *cache, uint64_t hash, uint8_t *data,
+                   int size) {
+  mutex_lock(cache->mutex);
+
+  struct tex_cache_entry *entry = tex_cache_get_entry(cache, hash);
+
+  if (!entry || entry->size != size) {
+    mutex_unlock(cache->mutex);
+    return 0;
+  }
+
+  char filename[PATH_MAX];
+  tex_cache_texture_path(cache, hash, filename, sizeof(filename));
+
+  int res = 0;
+  FILE *file = fopen(filename, "rb");
+
+  if (file) {
+    uint64_t file_hash;
+    int file_size;
+
+    res = tex_cache_read_header(file, &file_hash, &file_size) &&
+          file_hash == hash && file_size == size &&
+          fread(data, size, 1, file) == 1;
+
+    fclose(file);
+  }
+
+  if (!res) {
+    LOG_WARNING("tex_cache_load failed to load %s", filename);
+    tex_cache_free_entry(cache, entry);
+  }
+
+  mutex_unlock(cache->mutex);
+
+  return res;
+}
+
+void tex_cache_destroy(struct tex_cache *cache) {
+  while (!rb_empty_tree(&cache->entries)) {
+    struct tex_cache_entry *entry =
+        rb_first_entry(&cache->entries, struct tex_cache_entry, it);
+    tex_cache_free_entry(cache, entry);
+  }
+
+  mutex_destroy(cache->mutex);
+
+  free(cache);
+}
+
+struct tex_cache *tex_cache_create() {
+  struct tex_cache *cache = calloc(1, sizeof(struct tex_cache));
+
+  const char *appdir = fs_appdir();
+  snprintf(cache->path, sizeof(cache->path),
+           "%s" PATH_SEPARATOR "texture-cache", appdir);
+
+  if (!fs_mkdir(cache->path)) {
+    LOG_WARNING("tex_cache_create failed to create %s", cache->path);
+    free(cache);
+    return NULL;
+  }
+
+  cache->mutex = mutex_create();
+
+  tex_cache_load_index(cache);
+
+  return cache;
+}
@@ -0,0 +1,16 @@
+#ifndef TEX_CACHE_H
+#define TEX_CACHE_H
+
+#include <stdint.h>
+
+struct tex_cache;
+
+struct tex_cache *tex_cache_create();
+void tex_cache_destroy(struct tex_cache *cache);
+
+int tex_cache_load(struct tex_cache *cache, uint64_t hash, uint8_t *data,
+                   int size);
+void tex_cache_save(struct tex_cache *cache, uint64_t hash,
+                    const uint8_t *data, int size);
+
+#endif
@@ -7,17 +7,114 @@
 
 #include "guest/pvr/tr.h"
 #include "core/core.h"
+#include "core/hash.h"
 #include "core/sort.h"
+#include "core/task_pool.h"
+#include "core/thread.h"
+#include "core/time.h"
+#include "core/xxhash.h"
 #include "guest/pvr/ta.h"
 #include "guest/pvr/tex.h"
+#include "guest/pvr/tex_cache.h"
+#include "options.h"
+#include "stats.h"
+
+/* dirty textures referenced by a context are decoded in parallel on the
+   shared task pool (and the calling thread) before the context is parsed. the
+   lists of large contexts are sorted and indexed in parallel there too */
+#define TR_MAX_TEXTURE_JOBS 1024
+
+/* contexts with fewer surfaces than this finish their lists on the calling
+   thread, running them as tasks would cost more than it saves */
+#define TR_PARALLEL_SURFS 2048
+
+struct tr_texture_job {
+  struct tr_texture *entry;
+  uint8_t *data;
+  uint64_t hash;
+  /* set when only rows [first_row, first_row + num_rows) were decoded */
+  int partial;
+  int first_row;
+  int num_rows;
+};
+
+struct tr_sort_buffers {
+  uint32_t keys[TR_MAX_SURFS];
+  uint32_t tmp_keys[TR_MAX_SURFS];
+  int tmp[TR_MAX_SURFS];
+};
+
+typedef void (*tr_job_cb)(struct tr_converter *, int);
+
+struct tr_converter {
+  struct task_pool *pool;
+  struct task_group *group;
+
+  /* batch of jobs currently being run, each task claims the next job until
+     none are left */
+  tr_job_cb run_job;
+  int num_jobs;
+  volatile int next_job;
+
+  /* dirty textures of the context currently being converted */
+  const struct ta_context *ctx;
+  struct tr_texture_job texture_jobs[TR_MAX_TEXTURE_JOBS];
+  int num_queued;
+
+  /* lists of the context currently being parsed, each writing its indices
+     starting at list_indices */
+  struct tr_context *rc;
+  int list_indices[TA_NUM_LISTS];
+  int list_strips[TA_NUM_LISTS];
+  int sort_lists;
+
+  /* scratch space for sorting each list, allocated on first use */
+  struct tr_sort_buffers *sort[TA_NUM_LISTS];
+
+  /* textures shared between entries, allocated on first use. the handles
+     belong to the render backend the converter is used with */
+  struct tr_texture_cache *cache;
+};
+
+/* when the texture_hash option is enabled, textures are shared between all
+   entries whose source data hashes the same, regardless of their address */
+#define TR_MAX_SHARED_TEXTURES 8192
+
+struct tr_shared_texture {
+  uint64_t hash;
+  texture_handle_t handle;
+  int refs;
+  struct list_node it;
+};
+
+struct tr_texture_cache {
+  struct tr_shared_texture textures[TR_MAX_SHARED_TEXTURES];
+  struct list free_textures;
+  DECLARE_HASHTABLE(live_textures, 12);
+};
+
+/* when the texture_cache option is enabled, decoded textures are persisted to
+   disk between sessions. the disk cache is shared by every converter in the
+   process, and is created by the first one to need it */
+static mutex_t tr_disk_cache_mutex;
+static struct tex_cache *tr_disk_cache;
+static int tr_disk_cache_init;
+
+CONSTRUCTOR(tr_init_disk_cache) {
+  tr_disk_cache_mutex = mutex_create();
+}
 
 struct tr {
+  struct tr_converter *cv;
   struct render_backend *r;
   void *userdata;
   tr_find_texture_cb find_texture;
 
   /* current global state */
-  const union vert_param *last_vertex;
+  /* end of strip flag of the previous vertex param. a flag is kept rather
+     than a pointer to the param, as the param buffer may be reallocated while
+     streaming */
+  int last_end_of_strip;
   int list_type;
   int vert_type;
   /* poly params */
@@ -26,6 +123,46 @@ struct tr {
   /* sprite params */
   uint8_t sprite_color[4];
   uint8_t sprite_offset_color[4];
+
+  /* number of textures decoded while converting the context */
+  int num_decoded;
+
+  /* palette entries referenced by the context, when the gpu_palette option
+     is enabled */
+  uint8_t palette[MAX_PALETTE_ENTRIES * 4];
+  int num_palettes;
+
+  /* render state saved off when the context is rendered. when streaming,
+     these aren't known yet and are patched in by tr_finish_stream */
+  int alpha_ref;
+  int autosort;
+
+  /* set when params are being converted as they're written to the ta */
+  struct tr_stream *stream;
+};
+
+/* surfaces converted while streaming reference an index into the stream's
+   texture list rather than a texture handle, which is only resolved once
+   the context is rendered */
+#define TR_MAX_STREAM_TEXTURES 8191
+
+struct tr_stream_texture {
+  union tsp tsp;
+  union tcw tcw;
+};
+
+struct tr_stream {
+  struct tr tr;
+  struct tr_context rc;
+
+  /* cleared once the converted context has been handed off, or when the
+     stream couldn't be converted incrementally. the next render will fall
+     back to parsing the entire context */
+  int valid;
+
+  struct tr_stream_texture textures[TR_MAX_STREAM_TEXTURES + 1];
+  texture_handle_t handles[TR_MAX_STREAM_TEXTURES + 1];
+  int num_textures;
 };
 
 static int compressed_mipmap_offsets[] = {
@@ -109,70 +246,662 @@ static inline enum shade_mode translate_shade_mode(uint32_t shade_mode) {
   return shade_modes[shade_mode];
 }
 
-static texture_handle_t tr_convert_texture(struct tr *tr,
-                                           const struct ta_context *ctx,
-                                           union tsp tsp, union tcw tcw) {
-  /* TODO it's bad that textures are only cached based off tsp / tcw yet the
-     TEXT_CONTROL registers and PAL_RAM_CTRL registers are used here to control
-     texture generation */
+static int tr_gpu_palette(union tcw tcw) {
+  /* when the gpu_palette option is enabled, paletted textures are decoded to
+     their palette indices, and the palette lookup is performed in the shader.
+     this way, palette changes don't require the texture to be redecoded */
+  return OPTION_gpu_palette &&
+         (tcw.pixel_fmt == PVR_PXL_4BPP || tcw.pixel_fmt == PVR_PXL_8BPP);
+}
 
-  struct tr_texture *entry = tr->find_texture(tr->userdata, tsp, tcw);
-  CHECK_NOTNULL(entry);
+static const uint8_t *tr_index_palette() {
+  /* ARGB8888 palette mapping each index to a texel with a red component of
+     the same value */
+  static uint32_t palette[256];
 
-  /* if there's a non-dirty handle, return it */
-  if (entry->handle && !entry->dirty) {
-    return entry->handle;
+  if (!palette[255]) {
+    for (int i = 0; i < 256; i++) {
+      palette[i] = 0xff000000 | (i << 16);
+    }
   }
 
-  /* if there's a dirty handle, destroy it before creating the new one */
-  if (entry->handle && entry->dirty) {
-    r_destroy_texture(tr->r, entry->handle);
-    entry->handle = 0;
+  return (const uint8_t *)palette;
+}
+
+static enum pxl_format tr_texture_format(union tcw tcw) {
+  /* when the native_textures option is enabled, the 16-bit formats are only
+     detwiddled, halving the decode work, upload bandwidth and texture memory
+     compared to expanding them to 32 bits */
+  if (!OPTION_native_textures) {
+    return PXL_RGBA;
   }
 
-  static uint8_t converted[1024 * 1024 * 4];
-  const uint8_t *palette = entry->palette;
-  const uint8_t *texture = entry->texture;
+  return pvr_tex_native_format(tcw.pixel_fmt);
+}
+
+static int tr_texture_size(const struct tr_texture *entry) {
+  int width = ta_texture_width(entry->tsp, entry->tcw);
+  int height = ta_texture_height(entry->tsp, entry->tcw);
+  int bpp = tr_texture_format(entry->tcw) == PXL_RGBA ? 4 : 2;
+  return width * height * bpp;
+}
+
+/* bytes of texture memory held by the entry's handle, including its mip
+   chain */
+static int tr_texture_gpu_size(const struct tr_texture *entry) {
+  int size = tr_texture_size(entry);
+
+  if (ta_texture_mipmaps(entry->tcw) && !tr_gpu_palette(entry->tcw)) {
+    size += size / 3;
+  }
+
+  return size;
+}
+
+static void tr_decode_texture(const struct ta_context *ctx,
+                              const struct tr_texture *entry, uint8_t *dst,
+                              int size) {
+  union tsp tsp = entry->tsp;
+  union tcw tcw = entry->tcw;
 
   /* get texture dimensions */
   int texture_fmt = ta_texture_format(tcw);
-  int mipmaps = ta_texture_mipmaps(tcw);
   int width = ta_texture_width(tsp, tcw);
   int height = ta_texture_height(tsp, tcw);
   int stride = ta_texture_stride(tsp, tcw, ctx->stride);
 
-  /* figure out the texture format */
-  pvr_tex_decode(texture, width, height, stride, texture_fmt, tcw.pixel_fmt,
-                 palette, ctx->palette_fmt, converted, sizeof(converted));
+  if (tr_gpu_palette(tcw)) {
+    pvr_tex_decode(entry->texture, width, height, stride, texture_fmt,
+                   tcw.pixel_fmt, tr_index_palette(), PVR_PAL_ARGB8888,
+                   PXL_RGBA, dst, size);
+    return;
+  }
+
+  pvr_tex_decode(entry->texture, width, height, stride, texture_fmt,
+                 tcw.pixel_fmt, entry->palette, ctx->palette_fmt,
+                 tr_texture_format(tcw), dst, size);
+}
+
+static int tr_hash_textures() {
+  /* the disk cache is keyed by each texture's hash */
+  return OPTION_texture_hash || OPTION_texture_cache;
+}
+
+static struct tr_texture_cache *tr_cache_get(struct tr_converter *cv) {
+  if (cv->cache) {
+    return cv->cache;
+  }
+
+  cv->cache = calloc(1, sizeof(struct tr_texture_cache));
+
+  for (int i = 0; i < TR_MAX_SHARED_TEXTURES; i++) {
+    struct tr_shared_texture *shared = &cv->cache->textures[i];
+    list_add(&cv->cache->free_textures, &shared->it);
+  }
+
+  return cv->cache;
+}
+
+static struct tr_shared_texture *tr_cache_find(struct tr_converter *cv,
+                                               uint64_t hash,
+                                               texture_handle_t handle) {
+  struct tr_texture_cache *cache = tr_cache_get(cv);
+  struct list *bkt = hash_bkt(cache->live_textures, hash);
+
+  hash_bkt_for_each_entry(shared, bkt, struct tr_shared_texture, it) {
+    if (shared->hash == hash && (!handle || shared->handle == handle)) {
+      return shared;
+    }
+  }
+
+  return NULL;
+}
+
+static void tr_cache_add(struct tr_converter *cv, uint64_t hash,
+                         texture_handle_t handle) {
+  struct tr_texture_cache *cache = tr_cache_get(cv);
+  struct tr_shared_texture *shared = list_first_entry(
+      &cache->free_textures, struct tr_shared_texture, it);
+
+  /* if the cache is full, the texture just won't be shared */
+  if (!shared) {
+    return;
+  }
+
+  list_remove(&cache->free_textures, &shared->it);
+
+  shared->hash = hash;
+  shared->handle = handle;
+  shared->refs = 1;
+
+  struct list *bkt = hash_bkt(cache->live_textures, hash);
+  hash_add(bkt, &shared->it);
+}
+
+static uint64_t tr_texture_hash(const struct ta_context *ctx,
+                                const struct tr_texture *entry) {
+  union tsp tsp = entry->tsp;
+  union tcw tcw = entry->tcw;
+
+  /* seed the hash with each parameter affecting the decoded texture, such
+     that only entries producing identical textures end up sharing one */
+  uint32_t params[] = {
+      ta_texture_format(tcw),
+      tcw.pixel_fmt,
+      ta_texture_mipmaps(tcw),
+      ta_texture_width(tsp, tcw),
+      ta_texture_height(tsp, tcw),
+      ta_texture_stride(tsp, tcw, ctx->stride),
+      tsp.filter_mode,
+      tsp.clamp_u,
+      tsp.clamp_v,
+      tsp.flip_u,
+      tsp.flip_v,
+      entry->palette ? ctx->palette_fmt : 0,
+      tr_gpu_palette(tcw),
+      tr_texture_format(tcw),
+  };
+
+  uint64_t hash = xxh64(params, sizeof(params), 0);
+  hash = xxh64(entry->texture, entry->texture_size, hash);
+
+  if (entry->palette && !tr_gpu_palette(tcw)) {
+    hash = xxh64(entry->palette, entry->palette_size, hash);
+  }
+
+  return hash;
+}
+
+static void tr_init_texture_info(struct tr_texture *entry) {
+  union tsp tsp = entry->tsp;
+  union tcw tcw = entry->tcw;
 
   /* ignore trilinear filtering for now */
-  enum filter_mode filter =
-      tsp.filter_mode == 0 ? FILTER_NEAREST : FILTER_BILINEAR;
-  enum wrap_mode wrap_u =
+  entry->filter = tsp.filter_mode == 0 ? FILTER_NEAREST : FILTER_BILINEAR;
+  entry->wrap_u =
       tsp.clamp_u ? WRAP_CLAMP_TO_EDGE
                   : (tsp.flip_u ? WRAP_MIRRORED_REPEAT : WRAP_REPEAT);
-  enum wrap_mode wrap_v =
+  entry->wrap_v =
       tsp.clamp_v ? WRAP_CLAMP_TO_EDGE
                   : (tsp.flip_v ? WRAP_MIRRORED_REPEAT : WRAP_REPEAT);
+  entry->format = ta_texture_format(tcw);
+  entry->width = ta_texture_width(tsp, tcw);
+  entry->height = ta_texture_height(tsp, tcw);
+}
+
+static int tr_share_texture(struct tr_converter *cv, struct tr_texture *entry,
+                            uint64_t hash) {
+  struct tr_shared_texture *shared = tr_cache_find(cv, hash, 0);
+
+  if (!shared) {
+    return 0;
+  }
+
+  tr_init_texture_info(entry);
+
+  shared->refs++;
+  entry->handle = shared->handle;
+  entry->hash = hash;
+  entry->dirty = 0;
+
+  return 1;
+}
+
+static int tr_texture_valid(struct tr *tr, const struct ta_context *ctx,
+                            struct tr_texture *entry, uint64_t *hash) {
+  *hash = 0;
+
+  if (entry->handle && !entry->dirty) {
+    return 1;
+  }
+
+  if (!tr_hash_textures()) {
+    return 0;
+  }
+
+  *hash = tr_texture_hash(ctx, entry);
+
+  /* write watches are page granular, and will mark the texture dirty when
+     neighbouring data on the same page is written to. if its contents didn't
+     actually change, keep using the existing handle */
+  if (entry->handle && entry->hash == *hash) {
+    entry->dirty = 0;
+    return 1;
+  }
+
+  /* reuse an identical texture uploaded for a different entry */
+  if (tr_cache_find(tr->cv, *hash, 0)) {
+    tr_release_texture(tr->cv, tr->r, entry);
+    return tr_share_texture(tr->cv, entry, *hash);
+  }
+
+  return 0;
+}
+
+static void tr_load_texture(const struct ta_context *ctx,
+                            const struct tr_texture *entry, uint8_t *dst,
+                            uint64_t hash) {
+  int size = tr_texture_size(entry);
+
+  if (tr_disk_cache && tex_cache_load(tr_disk_cache, hash, dst, size)) {
+    return;
+  }
+
+  PROF_ENTER("tr_decode_texture");
+  tr_decode_texture(ctx, entry, dst, size);
+  PROF_LEAVE();
+  prof_counter_add(COUNTER_texture_decodes, 1);
+
+  if (tr_disk_cache) {
+    tex_cache_save(tr_disk_cache, hash, dst, size);
+  }
+}
+
+/* only bitmap textures store each row of texels as a contiguous run of source
+   data which can be decoded on its own. shared handles mustn't be modified in
+   place, so texture hashing disables this */
+static int tr_texture_rows_hashable(const struct tr_texture *entry) {
+  return !ta_texture_twiddled(entry->tcw) &&
+         !ta_texture_compressed(entry->tcw) &&
+         !ta_texture_mipmaps(entry->tcw) && !tr_hash_textures();
+}
+
+static int tr_texture_block_rows(const struct tr_texture *entry) {
+  int height = ta_texture_height(entry->tsp, entry->tcw);
+  return (height + TR_ROW_BLOCKS - 1) / TR_ROW_BLOCKS;
+}
+
+static int tr_hash_texture_rows(const struct ta_context *ctx,
+                                const struct tr_texture *entry,
+                                uint32_t *hashes) {
+  int width = ta_texture_width(entry->tsp, entry->tcw);
+  int height = ta_texture_height(entry->tsp, entry->tcw);
+  int stride = ta_texture_stride(entry->tsp, entry->tcw, ctx->stride);
+  int block_rows = tr_texture_block_rows(entry);
+  int pitch = stride * 2;
+  int num_blocks = 0;
+
+  /* the stride is hashed too, as changing it moves each row's source */
+  for (int y = 0; y < height; y += block_rows) {
+    int rows = MIN(block_rows, height - y);
+    int size = (rows - 1) * pitch + width * 2;
+    size = MIN(size, entry->texture_size - y * pitch);
+    hashes[num_blocks++] = (uint32_t)xxh64(entry->texture + y * pitch, size,
+                                           (uint64_t)stride);
+  }
+
+  return num_blocks;
+}
+
+/* when the entry's handle is being reused, decode only the rows of the blocks
+   whose source changed since it was last updated. returns 0 when the entire
+   texture needs to be decoded into a new handle instead */
+static int tr_load_texture_rows(const struct ta_context *ctx,
+                                struct tr_texture *entry, uint8_t *dst,
+                                int *first_row, int *num_rows) {
+  if (!tr_texture_rows_hashable(entry)) {
+    entry->rows_hashed = 0;
+    return 0;
+  }
+
+  uint32_t hashes[TR_ROW_BLOCKS];
+  int num_blocks = tr_hash_texture_rows(ctx, entry, hashes);
+  int partial = entry->handle && entry->rows_hashed;
+  int first = num_blocks;
+  int last = -1;
+
+  for (int i = 0; partial && i < num_blocks; i++) {
+    if (hashes[i] != entry->row_hashes[i]) {
+      first = MIN(first, i);
+      last = i;
+    }
+  }
+
+  memcpy(entry->row_hashes, hashes, sizeof(hashes));
+  entry->rows_hashed = 1;
+
+  if (!partial) {
+    return 0;
+  }
+
+  *first_row = 0;
+  *num_rows = 0;
+
+  /* the write watch fired on a neighbouring write */
+  if (last < 0) {
+    return 1;
+  }
+
+  union tcw tcw = entry->tcw;
+  int width = ta_texture_width(entry->tsp, tcw);
+  int height = ta_texture_height(entry->tsp, tcw);
+  int stride = ta_texture_stride(entry->tsp, tcw, ctx->stride);
+  int block_rows = tr_texture_block_rows(entry);
+  enum pxl_format format = tr_texture_format(tcw);
+  int bpp = format == PXL_RGBA ? 4 : 2;
+
+  *first_row = first * block_rows;
+  *num_rows = MIN((last + 1) * block_rows, height) - *first_row;
+
+  PROF_ENTER("tr_decode_texture");
+  pvr_tex_decode(entry->texture + *first_row * stride * 2, width, *num_rows,
+                 stride, ta_texture_format(tcw), tcw.pixel_fmt, NULL, 0,
+                 format, dst, width * *num_rows * bpp);
+  PROF_LEAVE();
+  prof_counter_add(COUNTER_texture_decodes, 1);
+
+  return 1;
+}
 
-  entry->handle = r_create_texture(tr->r, PXL_RGBA, filter, wrap_u, wrap_v,
-                                   mipmaps, width, height, converted);
-  entry->filter = filter;
-  entry->wrap_u = wrap_u;
-  entry->wrap_v = wrap_v;
-  entry->format = texture_fmt;
-  entry->width = width;
-  entry->height = height;
+static void tr_update_texture(struct tr *tr, struct tr_texture *entry,
+                              const uint8_t *data, int first_row,
+                              int num_rows) {
+  if (num_rows) {
+    r_update_texture(tr->r, entry->handle, first_row, num_rows, data);
+    prof_counter_add(COUNTER_texture_updates, 1);
+    tr->num_decoded++;
+  }
+
+  entry->dirty = 0;
+}
+
+static texture_handle_t tr_upload_texture(struct tr *tr,
+                                          struct tr_texture *entry,
+                                          const uint8_t *data, uint64_t hash) {
+  /* if there's a dirty handle, release it before creating the new one */
+  if (entry->handle && entry->dirty) {
+    tr_release_texture(tr->cv, tr->r, entry);
+  }
+
+  /* an identical texture may have been uploaded for another entry converted
+     in the same batch */
+  if (tr_hash_textures() && tr_share_texture(tr->cv, entry, hash)) {
+    return entry->handle;
+  }
+
+  tr_init_texture_info(entry);
+
+  enum filter_mode filter = entry->filter;
+  int mipmaps = ta_texture_mipmaps(entry->tcw);
+
+  /* palette indices can't be filtered, the shader filters the colors they
+     look up instead. note, this means only the base level of a mipmapped
+     paletted texture is sampled */
+  if (tr_gpu_palette(entry->tcw)) {
+    filter = FILTER_NEAREST;
+    mipmaps = 0;
+  }
+
+  entry->handle = r_create_texture(tr->r, tr_texture_format(entry->tcw),
+                                   filter, entry->wrap_u, entry->wrap_v,
+                                   mipmaps, entry->width, entry->height, data);
+  entry->hash = hash;
   entry->dirty = 0;
 
+  prof_counter_add(COUNTER_texture_uploads, 1);
+  prof_counter_add(COUNTER_texture_bytes, tr_texture_gpu_size(entry));
+
+  if (tr_hash_textures()) {
+    tr_cache_add(tr->cv, hash, entry->handle);
+  }
+
+  tr->num_decoded++;
+
   return entry->handle;
 }
 
+static texture_handle_t tr_convert_texture(struct tr *tr,
+                                           const struct ta_context *ctx,
+                                           union tsp tsp, union tcw tcw) {
+  /* TODO it's bad that textures are only cached based off tsp / tcw yet the
+     TEXT_CONTROL registers and PAL_RAM_CTRL registers are used here to control
+     texture generation */
+
+  struct tr_texture *entry = tr->find_texture(tr->userdata, tsp, tcw);
+  CHECK_NOTNULL(entry);
+
+  /* if there's a valid handle, return it. this is the common case, as
+     tr_convert_textures has already converted any dirty textures up front */
+  uint64_t hash;
+
+  if (tr_texture_valid(tr, ctx, entry, &hash)) {
+    return entry->handle;
+  }
+
+  uint8_t *converted = malloc(tr_texture_size(entry));
+  int first_row, num_rows;
+
+  if (tr_load_texture_rows(ctx, entry, converted, &first_row, &num_rows)) {
+    tr_update_texture(tr, entry, converted, first_row, num_rows);
+    free(converted);
+    return entry->handle;
+  }
+
+  tr_load_texture(ctx, entry, converted, hash);
+  texture_handle_t handle = tr_upload_texture(tr, entry, converted, hash);
+  free(converted);
+
+  return handle;
+}
+
+static void tr_run_job_task(void *data) {
+  struct tr_converter *cv = data;
+
+  while (1) {
+    int job = atomic_fetch_add_int(&cv->next_job, 1);
+
+    if (job >= cv->num_jobs) {
+      break;
+    }
+
+    cv->run_job(cv, job);
+  }
+}
+
+static void tr_run_jobs(struct tr_converter *cv, tr_job_cb run_job,
+                        int num_jobs) {
+  /* run the jobs in parallel, with this thread helping out. they're needed
+     to render the next frame, so they take priority over other tasks */
+  cv->run_job = run_job;
+  cv->num_jobs = num_jobs;
+  cv->next_job = 0;
+
+  int num_tasks = MIN(num_jobs - 1, task_pool_num_workers(cv->pool));
+
+  for (int i = 0; i < num_tasks; i++) {
+    task_group_run(cv->group, &tr_run_job_task, cv, TASK_PRIO_HIGH);
+  }
+
+  tr_run_job_task(cv);
+
+  task_group_wait(cv->group);
+}
+
+static void tr_decode_texture_job(struct tr_converter *cv, int i) {
+  struct tr_texture_job *job = &cv->texture_jobs[i];
+
+  job->partial = tr_load_texture_rows(cv->ctx, job->entry, job->data,
+                                      &job->first_row, &job->num_rows);
+
+  if (!job->partial) {
+    tr_load_texture(cv->ctx, job->entry, job->data, job->hash);
+  }
+}
+
+static void tr_decode_textures(struct tr *tr) {
+  struct tr_converter *cv = tr->cv;
+
+  if (!cv->num_queued) {
+    return;
+  }
+
+  tr_run_jobs(cv, &tr_decode_texture_job, cv->num_queued);
+
+  /* upload them in the order they're referenced */
+  for (int i = 0; i < cv->num_queued; i++) {
+    struct tr_texture_job *job = &cv->texture_jobs[i];
+
+    if (job->partial) {
+      tr_update_texture(tr, job->entry, job->data, job->first_row,
+                        job->num_rows);
+    } else {
+      tr_upload_texture(tr, job->entry, job->data, job->hash);
+    }
+    job->entry->queued = 0;
+
+    free(job->data);
+    job->data = NULL;
+  }
+
+  cv->num_queued = 0;
+}
+
+static void tr_queue_texture(struct tr *tr, const struct ta_context *ctx,
+                             union tsp tsp, union tcw tcw) {
+  struct tr_converter *cv = tr->cv;
+  struct tr_texture *entry = tr->find_texture(tr->userdata, tsp, tcw);
+  CHECK_NOTNULL(entry);
+
+  /* gather the palette entries the shader will look up */
+  if (tr_gpu_palette(tcw) && entry->palette) {
+    uint32_t palette_addr = ta_palette_addr(tcw, NULL);
+    memcpy(&tr->palette[palette_addr], entry->palette, entry->palette_size);
+    tr->num_palettes++;
+  }
+
+  if (entry->queued) {
+    return;
+  }
+
+  uint64_t hash;
+
+  if (tr_texture_valid(tr, ctx, entry, &hash)) {
+    prof_counter_add(COUNTER_texture_hits, 1);
+    return;
+  }
+
+  prof_counter_add(COUNTER_texture_misses, 1);
+
+  /* decode the current batch to make room when the job array is full, every
+     dirty texture must be converted before the context is parsed */
+  if (cv->num_queued >= TR_MAX_TEXTURE_JOBS) {
+    tr_decode_textures(tr);
+  }
+
+  struct tr_texture_job *job = &cv->texture_jobs[cv->num_queued++];
+  job->entry = entry;
+  job->data = malloc(tr_texture_size(entry));
+  job->hash = hash;
+  entry->queued = 1;
+}
+
+void tr_convert_textures(struct tr_converter *cv, struct render_backend *r,
+                         void *userdata, tr_find_texture_cb find_texture,
+                         const struct ta_context *ctx) {
+  struct tr tr = {0};
+  tr.cv = cv;
+  tr.r = r;
+  tr.userdata = userdata;
+  tr.find_texture = find_texture;
+
+  if (OPTION_texture_cache) {
+    mutex_lock(tr_disk_cache_mutex);
+    if (!tr_disk_cache_init) {
+      tr_disk_cache = tex_cache_create();
+      tr_disk_cache_init = 1;
+    }
+    mutex_unlock(tr_disk_cache_mutex);
+  }
+
+  int64_t start = time_nanoseconds();
+
+  /* no jobs are running until the queued textures are decoded */
+  cv->ctx = ctx;
+  cv->num_queued = 0;
+
+  /* collect each dirty texture referenced by the context */
+  const uint8_t *data = ctx->params;
+  const uint8_t *end = ctx->params + ctx->size;
+  int vert_type = 0;
+
+  if (ctx->bg_isp.texture) {
+    tr_queue_texture(&tr, ctx, ctx->bg_tsp, ctx->bg_tcw);
+  }
+
+  while (data < end) {
+    union pcw pcw = *(union pcw *)data;
+
+    switch (pcw.para_type) {
+      case TA_PARAM_POLY_OR_VOL:
+      case TA_PARAM_SPRITE: {
+        const union poly_param *param = (const union poly_param *)data;
+
+        vert_type = ta_vert_type(param->type0.pcw);
+
+        if (param->type0.pcw.texture) {
+          tr_queue_texture(&tr, ctx, param->type0.tsp, param->type0.tcw);
+        }
+      } break;
+
+      default:
+        break;
+    }
+
+    data += ta_param_size(pcw, vert_type);
+  }
+
+  tr_decode_textures(&tr);
+
+  /* the palette is small enough that it's simply reuploaded each frame */
+  if (tr.num_palettes) {
+    uint8_t rgba[MAX_PALETTE_ENTRIES * 4];
+    pvr_pal_decode(tr.palette, ctx->palette_fmt, rgba, MAX_PALETTE_ENTRIES);
+    r_set_palette(r, rgba, MAX_PALETTE_ENTRIES);
+  }
+
+  prof_counter_set(COUNTER_textures_decoded, tr.num_decoded);
+  prof_counter_add(COUNTER_texture_time, time_nanoseconds() - start);
+}
+
+static void *tr_grow_array(void *data, int *capacity, int size,
+                           int elem_size) {
+  if (size <= *capacity) {
+    return data;
+  }
+
+  int new_capacity = MAX(*capacity * 2, 1024);
+
+  while (new_capacity < size) {
+    new_capacity *= 2;
+  }
+
+  data = realloc(data, (size_t)new_capacity * elem_size);
+  CHECK_NOTNULL(data);
+  prof_counter_add(COUNTER_mem_tr_contexts,
+                   (int64_t)(new_capacity - *capacity) * elem_size);
+  *capacity = new_capacity;
+
+  return data;
+}
+
+/* note, growing an array invalidates any pointers previously taken into it */
+#define TR_GROW_ARRAY(arr, capacity, size) \
+  (arr) = tr_grow_array((arr), &(capacity), (size), (int)sizeof(*(arr)))
+
+static void tr_reserve_verts(struct tr *tr, struct tr_context *rc, int n) {
+  struct ta_surface *curr_surf = &rc->surfs[rc->num_surfs];
+
+  int num_verts = rc->num_verts + curr_surf->num_verts + n;
+  CHECK_LE(num_verts, TR_MAX_SURFS);
+  TR_GROW_ARRAY(rc->verts, rc->max_verts, num_verts);
+}
+
 static struct ta_surface *tr_reserve_surf(struct tr *tr, struct tr_context *rc,
                                           int copy_from_prev) {
   int surf_index = rc->num_surfs;
 
-  CHECK_LT(surf_index, ARRAY_SIZE(rc->surfs));
+  CHECK_LT(surf_index, TR_MAX_SURFS);
+  TR_GROW_ARRAY(rc->surfs, rc->max_surfs, surf_index + 1);
   struct ta_surface *surf = &rc->surfs[surf_index];
 
   if (copy_from_prev) {
@@ -192,7 +921,8 @@ static struct ta_vertex *tr_reserve_vert(struct tr *tr, struct tr_context *rc) {
   struct ta_surface *curr_surf = &rc->surfs[rc->num_surfs];
 
   int vert_index = rc->num_verts + curr_surf->num_verts;
-  CHECK_LT(vert_index, ARRAY_SIZE(rc->verts));
+  CHECK_LT(vert_index, TR_MAX_SURFS);
+  TR_GROW_ARRAY(rc->verts, rc->max_verts, vert_index + 1);
   struct ta_vertex *vert = &rc->verts[vert_index];
 
   memset(vert, 0, sizeof(*vert));
@@ -209,8 +939,9 @@ static void tr_commit_surf(struct tr *tr, struct tr_context *rc) {
   /* track original number of surfaces, before sorting, merging, etc. */
   list->num_orig_surfs++;
 
-  /* for translucent lists, commit a surf for each tri to make sorting easier */
-  if (tr->list_type == TA_LIST_TRANSLUCENT ||
+  /* for translucent lists, commit a surf for each tri to make sorting easier.
+     when sorted per pixel by the render backend, polygons are left whole */
+  if ((tr->list_type == TA_LIST_TRANSLUCENT && !rc->oit) ||
       tr->list_type == TA_LIST_PUNCH_THROUGH) {
     /* ignore the last two verts as polygons are fed to the TA as tristrips */
     int num_verts = new_surf->num_verts;
@@ -230,6 +961,7 @@ static void tr_commit_surf(struct tr *tr, struct tr_context *rc) {
       surf->num_verts = 3;
 
       /* default sort the new surface */
+      TR_GROW_ARRAY(list->surfs, list->max_surfs, list->num_surfs + 1);
       list->surfs[list->num_surfs++] = rc->num_surfs;
 
       /* commit the new surface */
@@ -243,6 +975,7 @@ static void tr_commit_surf(struct tr *tr, struct tr_context *rc) {
   /* for opaque lists, commit surface as is */
   else {
     /* default sort the new surface */
+    TR_GROW_ARRAY(list->surfs, list->max_surfs, list->num_surfs + 1);
     list->surfs[list->num_surfs++] = rc->num_surfs;
 
     /* commit the new surface */
@@ -341,7 +1074,18 @@ static int tr_parse_bg_vert(const struct ta_context *ctx, struct tr_context *rc,
     offset += 4;
   }
 
-  return offset;
+  return offset;
+}
+
+static void tr_parse_palette(struct ta_surface *surf, union tsp tsp,
+                             union tcw tcw) {
+  if (!tr_gpu_palette(tcw)) {
+    return;
+  }
+
+  surf->params.palette = 1;
+  surf->params.palette_filter = tsp.filter_mode != 0;
+  surf->params.palette_base = ta_palette_addr(tcw, NULL) >> 2;
 }
 
 static void tr_parse_bg(struct tr *tr, const struct ta_context *ctx,
@@ -351,10 +1095,12 @@ static void tr_parse_bg(struct tr *tr, const struct ta_context *ctx,
   /* translate the surface */
   struct ta_surface *surf = tr_reserve_surf(tr, rc, 0);
 
-  surf->params.texture =
-      ctx->bg_isp.texture
-          ? tr_convert_texture(tr, ctx, ctx->bg_tsp, ctx->bg_tcw)
-          : 0;
+  if (ctx->bg_isp.texture) {
+    surf->params.texture =
+        tr_convert_texture(tr, ctx, ctx->bg_tsp, ctx->bg_tcw);
+    tr_parse_palette(surf, ctx->bg_tsp, ctx->bg_tcw);
+  }
+
   surf->params.depth_write = !ctx->bg_isp.z_write_disable;
   surf->params.depth_func =
       translate_depth_func(ctx->bg_isp.depth_compare_mode);
@@ -362,7 +1108,10 @@ static void tr_parse_bg(struct tr *tr, const struct ta_context *ctx,
   surf->params.src_blend = BLEND_NONE;
   surf->params.dst_blend = BLEND_NONE;
 
-  /* translate the first 3 vertices */
+  /* translate the first 3 vertices, reserving room for all four up front such
+     that the pointers remain valid */
+  tr_reserve_verts(tr, rc, 4);
+
   struct ta_vertex *va = tr_reserve_vert(tr, rc);
   struct ta_vertex *vb = tr_reserve_vert(tr, rc);
   struct ta_vertex *vd = tr_reserve_vert(tr, rc);
@@ -442,6 +1191,28 @@ static void tr_parse_bg(struct tr *tr, const struct ta_context *ctx,
   tr->list_type = TA_NUM_LISTS;
 }
 
+static int tr_stream_texture(struct tr_stream *stream, union tsp tsp,
+                             union tcw tcw) {
+  /* consecutive polygons commonly share the same texture */
+  struct tr_stream_texture *last = &stream->textures[stream->num_textures];
+
+  if (stream->num_textures && last->tsp.full == tsp.full &&
+      last->tcw.full == tcw.full) {
+    return stream->num_textures;
+  }
+
+  if (stream->num_textures >= TR_MAX_STREAM_TEXTURES) {
+    stream->valid = 0;
+    return 0;
+  }
+
+  struct tr_stream_texture *tex = &stream->textures[++stream->num_textures];
+  tex->tsp = tsp;
+  tex->tcw = tcw;
+
+  return stream->num_textures;
+}
+
 /* this offset color implementation is not correct at all, see the
    Texture/Shading Instruction in the union tsp instruction word */
 static void tr_parse_poly_param(struct tr *tr, const struct ta_context *ctx,
@@ -449,7 +1220,7 @@ static void tr_parse_poly_param(struct tr *tr, const struct ta_context *ctx,
   const union poly_param *param = (const union poly_param *)data;
 
   /* reset state */
-  tr->last_vertex = NULL;
+  tr->last_end_of_strip = 0;
   tr->vert_type = ta_vert_type(param->type0.pcw);
 
   int poly_type = ta_poly_type(param->type0.pcw);
@@ -504,7 +1275,7 @@ static void tr_parse_poly_param(struct tr *tr, const struct ta_context *ctx,
   surf->params.ignore_texture_alpha = param->type0.tsp.ignore_tex_alpha;
   surf->params.offset_color = param->type0.pcw.offset;
   surf->params.alpha_test = tr->list_type == TA_LIST_PUNCH_THROUGH;
-  surf->params.alpha_ref = ctx->alpha_ref;
+  surf->params.alpha_ref = tr->alpha_ref;
 
   /* override a few surface parameters based on the list type */
   if (tr->list_type != TA_LIST_TRANSLUCENT &&
@@ -513,16 +1284,56 @@ static void tr_parse_poly_param(struct tr *tr, const struct ta_context *ctx,
     surf->params.dst_blend = BLEND_NONE;
   } else if ((tr->list_type == TA_LIST_TRANSLUCENT ||
               tr->list_type == TA_LIST_TRANSLUCENT_MODVOL) &&
-             ctx->autosort) {
+             tr->autosort) {
     surf->params.depth_func = DEPTH_LEQUAL;
   } else if (tr->list_type == TA_LIST_PUNCH_THROUGH) {
     surf->params.depth_func = DEPTH_GEQUAL;
   }
 
-  surf->params.texture =
-      param->type0.pcw.texture
-          ? tr_convert_texture(tr, ctx, param->type0.tsp, param->type0.tcw)
-          : 0;
+  if (!param->type0.pcw.texture) {
+    return;
+  }
+
+  if (tr->stream) {
+    surf->params.texture =
+        tr_stream_texture(tr->stream, param->type0.tsp, param->type0.tcw);
+  } else {
+    surf->params.texture =
+        tr_convert_texture(tr, ctx, param->type0.tsp, param->type0.tcw);
+  }
+
+  tr_parse_palette(surf, param->type0.tsp, param->type0.tcw);
+}
+
+static void tr_encode_vert_param(struct tr *tr, const struct ta_context *ctx,
+                                 struct tr_context *rc, const uint8_t *data) {
+  const union vert_param *param = (const union vert_param *)data;
+  struct ta_vertex_param *vert =
+      (struct ta_vertex_param *)tr_reserve_vert(tr, rc);
+
+  /* the position is still needed on the cpu to sort surfaces */
+  PARSE_XYZ(param->type0.xyz, vert->xyz);
+  vert->offset = (uint32_t)(data - ctx->params);
+  vert->vert_type = (uint32_t)tr->vert_type;
+  memcpy(&vert->face_color, tr->face_color, sizeof(vert->face_color));
+  memcpy(&vert->face_offset_color, tr->face_offset_color,
+         sizeof(vert->face_offset_color));
+
+  if (!param->type0.pcw.end_of_strip) {
+    return;
+  }
+
+  /* vertices are only queued for decoding once their surface is committed,
+     as the vertices of discarded surfaces are reused */
+  struct ta_surface *surf = &rc->surfs[rc->num_surfs];
+  int num_encoded = rc->num_encoded_verts + surf->num_verts;
+  TR_GROW_ARRAY(rc->encoded_verts, rc->max_encoded_verts, num_encoded);
+
+  for (int i = 0; i < surf->num_verts; i++) {
+    rc->encoded_verts[rc->num_encoded_verts++] = surf->first_vert + i;
+  }
+
+  tr_commit_surf(tr, rc);
 }
 
 static void tr_parse_vert_param(struct tr *tr, const struct ta_context *ctx,
@@ -537,10 +1348,17 @@ static void tr_parse_vert_param(struct tr *tr, const struct ta_context *ctx,
   /* if there is no need to change the Global Parameters, a Vertex Parameter
      for the next polygon may be input immediately after inputting a Vertex
      Parameter for which "End of Strip" was specified */
-  if (tr->last_vertex && tr->last_vertex->type0.pcw.end_of_strip) {
+  if (tr->last_end_of_strip) {
     tr_reserve_surf(tr, rc, 1);
   }
-  tr->last_vertex = param;
+  tr->last_end_of_strip = param->type0.pcw.end_of_strip;
+
+  /* polygon vertices may be decoded by the render backend. sprites are still
+     decoded here, as their missing corner is solved for on the cpu */
+  if (rc->gpu_verts && tr->vert_type <= 8) {
+    tr_encode_vert_param(tr, ctx, rc, data);
+    return;
+  }
 
   switch (tr->vert_type) {
     case 0: {
@@ -629,6 +1447,8 @@ static void tr_parse_vert_param(struct tr *tr, const struct ta_context *ctx,
        * these need to be calculated, and the quad needs to be converted into a
        * tristrip to match the rest of the ta input
        */
+      tr_reserve_verts(tr, rc, 4);
+
       struct ta_vertex *va = tr_reserve_vert(tr, rc); /* bottom left */
       struct ta_vertex *vb = tr_reserve_vert(tr, rc); /* top left */
       struct ta_vertex *vd = tr_reserve_vert(tr, rc); /* bottom right */
@@ -706,7 +1526,7 @@ static void tr_parse_vert_param(struct tr *tr, const struct ta_context *ctx,
 
 static void tr_parse_eol(struct tr *tr, const struct ta_context *ctx,
                          struct tr_context *rc, const uint8_t *data) {
-  tr->last_vertex = NULL;
+  tr->last_end_of_strip = 0;
   tr->list_type = TA_NUM_LISTS;
   tr->vert_type = TA_NUM_VERTS;
 }
@@ -716,8 +1536,72 @@ static inline int tr_can_merge_surfs(struct ta_surface *a,
   return a->params.full == b->params.full;
 }
 
-static void tr_generate_indices(struct tr *tr, struct tr_context *rc,
-                                int list_type) {
+static int tr_strip_indices(const struct ta_surface *surf) {
+  /* translucent and punch-through polygons are committed as a surface per
+     triangle. when they're not sorted, the triangles of each strip remain
+     adjacent, and only the first starts a new strip */
+  if (surf->num_verts < 3) {
+    return 0;
+  }
+
+  return surf->strip_offset ? 1 : surf->num_verts + 1;
+}
+
+static void tr_generate_strip_indices(struct tr_context *rc, int list_type,
+                                      int first) {
+  /* polygons are fed to the TA as triangle strips in a CW order, which are
+     drawn as is with primitive restart, starting each strip with the restart
+     index. the backend accounts for the strips' winding being the reverse of
+     the triangle lists' */
+  struct tr_list *list = &rc->lists[list_type];
+  uint16_t *indices = rc->indices;
+  int num_indices = first;
+  int num_merged = 0;
+
+  for (int i = 0, j = 0; i < list->num_surfs; i = j) {
+    struct ta_surface *root = &rc->surfs[list->surfs[i]];
+    int first_index = num_indices;
+
+    for (j = i; j < list->num_surfs; j++) {
+      struct ta_surface *surf = &rc->surfs[list->surfs[j]];
+
+      if (surf != root) {
+        if (!tr_can_merge_surfs(root, surf)) {
+          break;
+        }
+
+        num_merged++;
+      }
+
+      if (surf->num_verts < 3) {
+        continue;
+      }
+
+      /* continue the strip of the previous triangle with the new vertex */
+      if (surf->strip_offset) {
+        indices[num_indices++] = surf->first_vert + 2;
+        continue;
+      }
+
+      indices[num_indices++] = RESTART_INDEX;
+
+      for (int k = 0; k < surf->num_verts; k++) {
+        indices[num_indices++] = surf->first_vert + k;
+      }
+    }
+
+    root->first_vert = first_index;
+    root->num_verts = num_indices - first_index;
+    root->params.strip = 1;
+
+    list->surfs[j - num_merged - 1] = list->surfs[i];
+  }
+
+  list->num_surfs -= num_merged;
+}
+
+static void tr_generate_indices(struct tr_context *rc, int list_type,
+                                int first) {
   /* polygons are fed to the TA as triangle strips, with the vertices being fed
      in a CW order, so a given quad looks like:
 
@@ -729,14 +1613,16 @@ static void tr_generate_indices(struct tr *tr, struct tr_context *rc,
      0----2----4
 
      convert from these triangle strips to triangles, and convert to CCW to
-     match OpenGL defaults */
+     match OpenGL defaults. the list's indices are written starting at first,
+     the index buffer has already been sized to fit every list */
   struct tr_list *list = &rc->lists[list_type];
-
+  uint16_t *indices = rc->indices;
+  int num_indices = first;
   int num_merged = 0;
 
   for (int i = 0, j = 0; i < list->num_surfs; i = j) {
     struct ta_surface *root = &rc->surfs[list->surfs[i]];
-    int first_index = rc->num_indices;
+    int first_index = num_indices;
 
     /* merge adjacent surfaces at this time */
     for (j = i; j < list->num_surfs; j++) {
@@ -750,29 +1636,26 @@ static void tr_generate_indices(struct tr *tr, struct tr_context *rc,
         num_merged++;
       }
 
-      int num_indices = (surf->num_verts - 2) * 3;
-      CHECK_LT(rc->num_indices + num_indices, ARRAY_SIZE(rc->indices));
-
       for (int j = 0; j < surf->num_verts - 2; j++) {
         int strip_offset = surf->strip_offset + j;
         int vertex_offset = surf->first_vert + j;
 
         /* be careful to maintain a CCW winding order */
         if (strip_offset & 1) {
-          rc->indices[rc->num_indices++] = vertex_offset + 0;
-          rc->indices[rc->num_indices++] = vertex_offset + 1;
-          rc->indices[rc->num_indices++] = vertex_offset + 2;
+          indices[num_indices++] = vertex_offset + 0;
+          indices[num_indices++] = vertex_offset + 1;
+          indices[num_indices++] = vertex_offset + 2;
         } else {
-          rc->indices[rc->num_indices++] = vertex_offset + 0;
-          rc->indices[rc->num_indices++] = vertex_offset + 2;
-          rc->indices[rc->num_indices++] = vertex_offset + 1;
+          indices[num_indices++] = vertex_offset + 0;
+          indices[num_indices++] = vertex_offset + 2;
+          indices[num_indices++] = vertex_offset + 1;
         }
       }
     }
 
     /* update to point at triangle indices instead of the raw tristrip verts */
     root->first_vert = first_index;
-    root->num_verts = rc->num_indices - first_index;
+    root->num_verts = num_indices - first_index;
 
     /* shift the list to account for merges */
     list->surfs[j - num_merged - 1] = list->surfs[i];
@@ -781,39 +1664,35 @@ static void tr_generate_indices(struct tr *tr, struct tr_context *rc,
   list->num_surfs -= num_merged;
 }
 
-static int sort_tmp[TR_MAX_SURFS];
-static float sort_minz[TR_MAX_SURFS];
-
-static int tr_compare_surf(const void *a, const void *b) {
-  int i = *(const int *)a;
-  int j = *(const int *)b;
-  return sort_minz[i] <= sort_minz[j];
-}
-
-static void tr_sort_surfaces(struct tr *tr, struct tr_context *rc,
+static void tr_sort_surfaces(struct tr_converter *cv, struct tr_context *rc,
                              int list_type) {
   struct tr_list *list = &rc->lists[list_type];
 
+  if (!cv->sort[list_type]) {
+    cv->sort[list_type] = malloc(sizeof(struct tr_sort_buffers));
+  }
+
+  struct tr_sort_buffers *sort = cv->sort[list_type];
+
   /* sort each surface from back to front based on its minz */
   for (int i = 0; i < list->num_surfs; i++) {
-    int surf_index = list->surfs[i];
-    struct ta_surface *surf = &rc->surfs[surf_index];
-    float *minz = &sort_minz[surf_index];
-
+    struct ta_surface *surf = &rc->surfs[list->surfs[i]];
     struct ta_vertex *verts = &rc->verts[surf->first_vert];
     CHECK_EQ(surf->num_verts, 3);
 
-    *minz = MIN(verts[0].xyz[2], verts[1].xyz[2]);
-    *minz = MIN(*minz, verts[2].xyz[2]);
+    float minz = MIN(verts[0].xyz[2], verts[1].xyz[2]);
+    minz = MIN(minz, verts[2].xyz[2]);
+
+    sort->keys[i] = rsort_float_key(minz);
   }
 
-  msort_noalloc(list->surfs, sort_tmp, list->num_surfs, sizeof(int),
-                &tr_compare_surf);
+  rsort_noalloc(sort->keys, list->surfs, sort->tmp_keys, sort->tmp,
+                list->num_surfs);
 }
 
 static void tr_reset(struct tr *tr, struct tr_context *rc) {
   /* reset global state */
-  tr->last_vertex = NULL;
+  tr->last_end_of_strip = 0;
   tr->list_type = TA_NUM_LISTS;
   tr->vert_type = TA_NUM_VERTS;
   memset(tr->face_color, 0, sizeof(tr->face_color));
@@ -826,6 +1705,10 @@ static void tr_reset(struct tr *tr, struct tr_context *rc) {
   rc->num_surfs = 0;
   rc->num_verts = 0;
   rc->num_indices = 0;
+  rc->oit = OPTION_oit_layers > 0;
+  rc->gpu_verts = OPTION_gpu_verts > 0;
+  rc->num_encoded_verts = 0;
+  rc->raw_size = 0;
   for (int i = 0; i < TA_NUM_LISTS; i++) {
     struct tr_list *list = &rc->lists[i];
     list->num_surfs = 0;
@@ -849,6 +1732,11 @@ static void tr_render_list(struct render_backend *r,
 
     r_draw_ta_surface(r, &rc->surfs[surf]);
 
+    /* the background is always the first opaque surface */
+    if (!surf && list_type == TA_LIST_OPAQUE) {
+      r_begin_ta_stage(r, TA_STAGE_OPAQUE);
+    }
+
     if (surf == end_surf) {
       *stopped = 1;
       break;
@@ -856,31 +1744,385 @@ static void tr_render_list(struct render_backend *r,
   }
 }
 
+static void tr_render_layers(struct render_backend *r,
+                             const struct tr_context *rc, int list_type,
+                             int end_surf, int *stopped) {
+  if (*stopped) {
+    return;
+  }
+
+  /* the options may have changed since the context was converted, in which
+     case the list is drawn as is */
+  int layer = 0;
+
+  if (!r_begin_ta_layer(r, layer)) {
+    tr_render_list(r, rc, list_type, end_surf, stopped);
+    return;
+  }
+
+  /* each layer is peeled by drawing the entire list again */
+  do {
+    int layer_stopped = 0;
+    tr_render_list(r, rc, list_type, end_surf, &layer_stopped);
+    r_end_ta_layer(r);
+    *stopped = layer_stopped;
+  } while (r_begin_ta_layer(r, ++layer));
+}
+
 void tr_render_context_until(struct render_backend *r,
                              const struct tr_context *rc, int end_surf) {
   int stopped = 0;
 
+  PROF_ENTER("tr_render_context");
+  int64_t start = time_nanoseconds();
+
   r_begin_ta_surfaces(r, rc->width, rc->height, rc->verts, rc->num_verts,
                       rc->indices, rc->num_indices);
 
+  if (rc->num_encoded_verts) {
+    r_decode_ta_vertices(r, rc->raw_params, rc->raw_size, rc->encoded_verts,
+                         rc->num_encoded_verts);
+  }
+
+  r_begin_ta_stage(r, TA_STAGE_BACKGROUND);
   tr_render_list(r, rc, TA_LIST_OPAQUE, end_surf, &stopped);
+
+  r_begin_ta_stage(r, TA_STAGE_PUNCH_THROUGH);
   tr_render_list(r, rc, TA_LIST_PUNCH_THROUGH, end_surf, &stopped);
-  tr_render_list(r, rc, TA_LIST_TRANSLUCENT, end_surf, &stopped);
+
+  r_begin_ta_stage(r, TA_STAGE_TRANSLUCENT);
+
+  if (rc->oit) {
+    tr_render_layers(r, rc, TA_LIST_TRANSLUCENT, end_surf, &stopped);
+  } else {
+    tr_render_list(r, rc, TA_LIST_TRANSLUCENT, end_surf, &stopped);
+  }
 
   r_end_ta_surfaces(r);
+
+  prof_counter_add(COUNTER_render_time, time_nanoseconds() - start);
+  PROF_LEAVE();
 }
 
 void tr_render_context(struct render_backend *r, const struct tr_context *rc) {
   tr_render_context_until(r, rc, -1);
 }
 
-void tr_convert_context(struct render_backend *r, void *userdata,
-                        tr_find_texture_cb find_texture,
-                        const struct ta_context *ctx, struct tr_context *rc) {
-  struct tr tr;
-  tr.r = r;
+void tr_release_texture(struct tr_converter *cv, struct render_backend *r,
+                        struct tr_texture *entry) {
+  if (!entry->handle) {
+    return;
+  }
+
+  /* shared textures are only destroyed once the last entry releases them */
+  struct tr_shared_texture *shared =
+      tr_cache_find(cv, entry->hash, entry->handle);
+
+  if (shared) {
+    if (--shared->refs) {
+      entry->handle = 0;
+      return;
+    }
+
+    struct list *bkt = hash_bkt(cv->cache->live_textures, shared->hash);
+    hash_del(bkt, &shared->it);
+    list_add(&cv->cache->free_textures, &shared->it);
+  }
+
+  r_destroy_texture(r, entry->handle);
+  entry->handle = 0;
+
+  prof_counter_add(COUNTER_texture_bytes, -tr_texture_gpu_size(entry));
+}
+
+static int tr_parse_param(struct tr *tr, const struct ta_context *ctx,
+                          struct tr_context *rc, const uint8_t *data) {
+  union pcw pcw = *(union pcw *)data;
+
+  if (ta_pcw_list_type_valid(pcw, tr->list_type)) {
+    tr->list_type = pcw.list_type;
+  }
+
+  switch (pcw.para_type) {
+    /* control params */
+    case TA_PARAM_END_OF_LIST:
+      tr_parse_eol(tr, ctx, rc, data);
+      break;
+
+    case TA_PARAM_USER_TILE_CLIP:
+      break;
+
+    case TA_PARAM_OBJ_LIST_SET:
+      LOG_FATAL("TA_PARAM_OBJ_LIST_SET unsupported");
+      break;
+
+    /* global params */
+    case TA_PARAM_POLY_OR_VOL:
+    case TA_PARAM_SPRITE:
+      tr_parse_poly_param(tr, ctx, rc, data);
+      break;
+
+    /* vertex params */
+    case TA_PARAM_VERTEX:
+      tr_parse_vert_param(tr, ctx, rc, data);
+      break;
+  }
+
+  /* track info about the parse state for tracer debugging */
+  CHECK_LT(rc->num_params, TA_MAX_PARAMS);
+  TR_GROW_ARRAY(rc->params, rc->max_params, rc->num_params + 1);
+  struct tr_param *rp = &rc->params[rc->num_params++];
+  rp->offset = (int)(data - ctx->params);
+  rp->list_type = tr->list_type;
+  rp->vert_type = tr->vert_type;
+  rp->last_surf = rc->num_surfs - 1;
+  rp->last_vert = rc->num_verts - 1;
+
+  return ta_param_size(pcw, tr->vert_type);
+}
+
+static void tr_tag_verts(struct tr_context *rc) {
+  /* surfaces don't share vertices, so each vertex can be tagged with the
+     texture of the one surface referencing it */
+  for (int i = 0; i < rc->num_surfs; i++) {
+    const struct ta_surface *surf = &rc->surfs[i];
+    struct ta_vertex *v = &rc->verts[surf->first_vert];
+    struct ta_vertex *end = v + surf->num_verts;
+
+    for (; v < end; v++) {
+      v->texture = surf->params.texture;
+    }
+  }
+}
+
+static int tr_list_sorted(struct tr_converter *cv, int list_type) {
+  /* translucent lists sorted per pixel are left in their original order */
+  if (list_type == TA_LIST_TRANSLUCENT) {
+    return cv->sort_lists && !cv->rc->oit;
+  }
+
+  return cv->sort_lists && list_type == TA_LIST_PUNCH_THROUGH;
+}
+
+static void tr_finish_list(struct tr_converter *cv, int list_type) {
+  struct tr_context *rc = cv->rc;
+
+  /* sort surfaces if requested */
+  if (tr_list_sorted(cv, list_type)) {
+    tr_sort_surfaces(cv, rc, list_type);
+  }
+
+  if (cv->list_strips[list_type]) {
+    tr_generate_strip_indices(rc, list_type, cv->list_indices[list_type]);
+  } else {
+    tr_generate_indices(rc, list_type, cv->list_indices[list_type]);
+  }
+}
+
+static void tr_finish_context(struct tr *tr, const struct ta_context *ctx,
+                              struct tr_context *rc) {
+  struct tr_converter *cv = tr->cv;
+
+  tr_tag_verts(rc);
+
+  if (rc->num_encoded_verts) {
+    TR_GROW_ARRAY(rc->raw_params, rc->max_raw_size, ctx->size);
+    memcpy(rc->raw_params, ctx->params, ctx->size);
+    rc->raw_size = ctx->size;
+  }
+
+  /* merging surfaces doesn't change the number of indices they generate, so
+     each list's range of the index buffer is known up front. with the lists
+     not sharing any surfaces, this lets them be finished in parallel */
+  int num_indices = rc->num_indices;
+  int num_surfs = 0;
+
+  cv->rc = rc;
+  cv->sort_lists = ctx->autosort;
+
+  /* translucent polygons only need sorting when the ta was autosorting */
+  rc->oit = rc->oit && ctx->autosort;
+
+  for (int i = 0; i < TA_NUM_LISTS; i++) {
+    struct tr_list *list = &rc->lists[i];
+
+    /* when the ta_strips option is enabled, only sorted lists are expanded
+       to triangle lists. lists sorted per pixel are too, as the backend
+       identifies each triangle by its primitive id. the last vertex index is
+       reserved for restarts */
+    int oit = i == TA_LIST_TRANSLUCENT && rc->oit;
+    cv->list_strips[i] = OPTION_ta_strips && !tr_list_sorted(cv, i) && !oit &&
+                         rc->num_verts <= RESTART_INDEX;
+    cv->list_indices[i] = num_indices;
+
+    for (int j = 0; j < list->num_surfs; j++) {
+      struct ta_surface *surf = &rc->surfs[list->surfs[j]];
+
+      if (cv->list_strips[i]) {
+        num_indices += tr_strip_indices(surf);
+      } else {
+        num_indices += MAX(surf->num_verts - 2, 0) * 3;
+      }
+    }
+
+    num_surfs += list->num_surfs;
+  }
+
+  CHECK_LT(num_indices, TR_MAX_SURFS * 3);
+  TR_GROW_ARRAY(rc->indices, rc->max_indices, num_indices);
+  rc->num_indices = num_indices;
+
+  if (num_surfs >= TR_PARALLEL_SURFS) {
+    tr_run_jobs(cv, &tr_finish_list, TA_NUM_LISTS);
+  } else {
+    for (int i = 0; i < TA_NUM_LISTS; i++) {
+      tr_finish_list(cv, i);
+    }
+  }
+
+  cv->rc = NULL;
+}
+
+static int tr_finish_stream(struct tr_converter *cv, struct tr_stream *stream,
+                            void *userdata, tr_find_texture_cb find_texture,
+                            const struct ta_context *ctx,
+                            struct tr_context *rc) {
+  if (!stream->valid) {
+    return 0;
+  }
+
+  struct tr tr = {0};
+  tr.cv = cv;
+  tr.userdata = userdata;
+  tr.find_texture = find_texture;
+
+  struct tr_context *src = &stream->rc;
+  src->width = ctx->video_width;
+  src->height = ctx->video_height;
+  src->target = ctx->target;
+
+  /* convert the background into the surface reserved for it by
+     tr_reset_stream */
+  int num_surfs = src->num_surfs;
+  int num_verts = src->num_verts;
+  struct tr_list *opaque = &src->lists[TA_LIST_OPAQUE];
+  int num_opaque = opaque->num_surfs;
+  int num_orig_opaque = opaque->num_orig_surfs;
+
+  src->num_surfs = 0;
+  src->num_verts = 0;
+  opaque->num_surfs = 0;
+  opaque->num_orig_surfs = 0;
+
+  tr_parse_bg(&tr, ctx, src);
+
+  src->num_surfs = num_surfs;
+  src->num_verts = num_verts;
+  opaque->num_surfs = num_opaque;
+  opaque->num_orig_surfs = num_orig_opaque;
+
+  /* resolve the texture handles and render state that weren't known while
+     the params were written */
+  texture_handle_t *handles = stream->handles;
+
+  for (int i = 1; i <= stream->num_textures; i++) {
+    struct tr_stream_texture *tex = &stream->textures[i];
+    handles[i] = tr_convert_texture(&tr, ctx, tex->tsp, tex->tcw);
+  }
+
+  for (int i = 1; i < src->num_surfs; i++) {
+    struct ta_surface *surf = &src->surfs[i];
+    surf->params.texture = handles[surf->params.texture];
+    surf->params.alpha_ref = ctx->alpha_ref;
+  }
+
+  if (ctx->autosort) {
+    for (int i = TA_LIST_TRANSLUCENT; i <= TA_LIST_TRANSLUCENT_MODVOL; i++) {
+      struct tr_list *list = &src->lists[i];
+
+      for (int j = 0; j < list->num_surfs; j++) {
+        src->surfs[list->surfs[j]].params.depth_func = DEPTH_LEQUAL;
+      }
+    }
+  }
+
+  tr_finish_context(&tr, ctx, src);
+
+  /* hand off the converted context by swapping it with the output, the
+     output's arrays are reused by the next stream */
+  struct tr_context tmp = *rc;
+  *rc = *src;
+  *src = tmp;
+
+  stream->valid = 0;
+
+  return 1;
+}
+
+void tr_stream_param(struct tr_stream *stream, const struct ta_context *ctx,
+                     const uint8_t *data) {
+  if (!stream->valid) {
+    return;
+  }
+
+  tr_parse_param(&stream->tr, ctx, &stream->rc, data);
+}
+
+void tr_reset_stream(struct tr_stream *stream) {
+  struct tr *tr = &stream->tr;
+  struct tr_context *rc = &stream->rc;
+
+  tr_reset(tr, rc);
+  stream->num_textures = 0;
+  stream->valid = 1;
+
+  /* the background isn't known until the context is rendered, reserve its
+     surface up front such that the surfaces are ordered the same as when
+     parsing the entire context */
+  tr->list_type = TA_LIST_OPAQUE;
+
+  tr_reserve_surf(tr, rc, 0);
+  tr_reserve_verts(tr, rc, 4);
+
+  for (int i = 0; i < 4; i++) {
+    tr_reserve_vert(tr, rc);
+  }
+
+  tr_commit_surf(tr, rc);
+
+  tr->list_type = TA_NUM_LISTS;
+}
+
+void tr_destroy_stream(struct tr_stream *stream) {
+  tr_destroy_context(&stream->rc);
+  free(stream);
+}
+
+struct tr_stream *tr_create_stream() {
+  struct tr_stream *stream = calloc(1, sizeof(struct tr_stream));
+
+  stream->tr.stream = stream;
+
+  return stream;
+}
+
+static void tr_parse_params(struct tr_converter *cv, void *userdata,
+                            tr_find_texture_cb find_texture,
+                            const struct ta_context *ctx,
+                            struct tr_context *rc) {
+  /* if the params were already converted as they were written, only the
+     state known at render time needs to be filled in */
+  if (ctx->stream &&
+      tr_finish_stream(cv, ctx->stream, userdata, find_texture, ctx, rc)) {
+    return;
+  }
+
+  struct tr tr = {0};
+  tr.cv = cv;
   tr.userdata = userdata;
   tr.find_texture = find_texture;
+  tr.alpha_ref = ctx->alpha_ref;
+  tr.autosort = ctx->autosort;
 
   const uint8_t *data = ctx->params;
   const uint8_t *end = ctx->params + ctx->size;
@@ -891,59 +2133,92 @@ void tr_convert_context(struct render_backend *r, void *userdata,
 
   rc->width = ctx->video_width;
   rc->height = ctx->video_height;
+  rc->target = ctx->target;
 
   tr_parse_bg(&tr, ctx, rc);
 
   while (data < end) {
-    union pcw pcw = *(union pcw *)data;
+    data += tr_parse_param(&tr, ctx, rc, data);
+  }
 
-    if (ta_pcw_list_type_valid(pcw, tr.list_type)) {
-      tr.list_type = pcw.list_type;
-    }
+  tr_finish_context(&tr, ctx, rc);
+}
 
-    switch (pcw.para_type) {
-      /* control params */
-      case TA_PARAM_END_OF_LIST:
-        tr_parse_eol(&tr, ctx, rc, data);
-        break;
+void tr_parse_context(struct tr_converter *cv, void *userdata,
+                      tr_find_texture_cb find_texture,
+                      const struct ta_context *ctx, struct tr_context *rc) {
+  PROF_ENTER("tr_parse_context");
+  int64_t start = time_nanoseconds();
 
-      case TA_PARAM_USER_TILE_CLIP:
-        break;
+  tr_parse_params(cv, userdata, find_texture, ctx, rc);
 
-      case TA_PARAM_OBJ_LIST_SET:
-        LOG_FATAL("TA_PARAM_OBJ_LIST_SET unsupported");
-        break;
+  prof_counter_add(COUNTER_ta_parse_time, time_nanoseconds() - start);
+  PROF_LEAVE();
+}
 
-      /* global params */
-      case TA_PARAM_POLY_OR_VOL:
-      case TA_PARAM_SPRITE:
-        tr_parse_poly_param(&tr, ctx, rc, data);
-        break;
+void tr_destroy_context(struct tr_context *rc) {
+  int64_t size = (int64_t)rc->max_surfs * sizeof(*rc->surfs) +
+                 (int64_t)rc->max_verts * sizeof(*rc->verts) +
+                 (int64_t)rc->max_indices * sizeof(*rc->indices) +
+                 (int64_t)rc->max_params * sizeof(*rc->params) +
+                 (int64_t)rc->max_encoded_verts * sizeof(*rc->encoded_verts) +
+                 (int64_t)rc->max_raw_size * sizeof(*rc->raw_params);
 
-      /* vertex params */
-      case TA_PARAM_VERTEX:
-        tr_parse_vert_param(&tr, ctx, rc, data);
-        break;
-    }
+  for (int i = 0; i < TA_NUM_LISTS; i++) {
+    size += (int64_t)rc->lists[i].max_surfs * sizeof(*rc->lists[i].surfs);
+  }
 
-    /* track info about the parse state for tracer debugging */
-    struct tr_param *rp = &rc->params[rc->num_params++];
-    rp->offset = (int)(data - ctx->params);
-    rp->list_type = tr.list_type;
-    rp->vert_type = tr.vert_type;
-    rp->last_surf = rc->num_surfs - 1;
-    rp->last_vert = rc->num_verts - 1;
+  prof_counter_add(COUNTER_mem_tr_contexts, -size);
 
-    data += ta_param_size(pcw, tr.vert_type);
+  free(rc->surfs);
+  free(rc->verts);
+  free(rc->indices);
+  free(rc->params);
+  free(rc->encoded_verts);
+  free(rc->raw_params);
+
+  for (int i = 0; i < TA_NUM_LISTS; i++) {
+    free(rc->lists[i].surfs);
   }
 
-  /* sort surfaces if requested */
-  if (ctx->autosort) {
-    tr_sort_surfaces(&tr, rc, TA_LIST_TRANSLUCENT);
-    tr_sort_surfaces(&tr, rc, TA_LIST_PUNCH_THROUGH);
+  memset(rc, 0, sizeof(*rc));
+}
+
+void tr_convert_context(struct tr_converter *cv, struct render_backend *r,
+                        void *userdata, tr_find_texture_cb find_texture,
+                        const struct ta_context *ctx, struct tr_context *rc) {
+  PROF_ENTER("tr_convert_context");
+
+  /* the render backend is null when contexts are only being parsed */
+  if (r) {
+    tr_convert_textures(cv, r, userdata, find_texture, ctx);
   }
 
+  tr_parse_context(cv, userdata, find_texture, ctx, rc);
+
+  PROF_LEAVE();
+}
+
+void tr_destroy_converter(struct tr_converter *cv) {
   for (int i = 0; i < TA_NUM_LISTS; i++) {
-    tr_generate_indices(&tr, rc, i);
+    free(cv->sort[i]);
   }
+
+  task_group_destroy(cv->group);
+
+  free(cv->cache);
+  free(cv);
+}
+
+struct tr_converter *tr_create_converter() {
+  /* the twiddle table and param tables are lazily initialized, make sure
+     they're ready before they're used from multiple threads */
+  pvr_init_twiddle_table();
+  ta_init_tables();
+
+  struct tr_converter *cv = calloc(1, sizeof(struct tr_converter));
+  cv->pool = task_pool_shared();
+  cv->group = task_group_create(cv->pool);
+
+  return cv;
 }
@@ -5,9 +5,15 @@
 #include "render/render_backend.h"
 
 struct tr;
+struct tr_converter;
+struct tr_stream;
 
 #define TR_MAX_SURFS (1024 * 64)
 
+/* the source of bitmap textures is hashed in this many blocks of rows, such
+   that only the rows of blocks which changed are redecoded and uploaded */
+#define TR_ROW_BLOCKS 32
+
 typedef uint64_t tr_texture_key_t;
 
 struct tr_texture {
@@ -15,6 +21,8 @@ struct tr_texture {
   union tcw tcw;
   unsigned frame;
   int dirty;
+  /* set while queued for conversion by tr_convert_context */
+  int queued;
 
   /* source info */
   const uint8_t *texture;
@@ -30,6 +38,13 @@ struct tr_texture {
   int width;
   int height;
   texture_handle_t handle;
+  /* hash of the source data the handle was created from, only valid when
+     the texture_hash option is enabled */
+  uint64_t hash;
+  /* hashes of each block of source rows the handle holds, only valid when
+     rows_hashed is set */
+  int rows_hashed;
+  uint32_t row_hashes[TR_ROW_BLOCKS];
 };
 
 struct tr_param {
@@ -46,8 +61,9 @@ struct tr_param {
 };
 
 struct tr_list {
-  int surfs[TR_MAX_SURFS];
+  int *surfs;
   int num_surfs;
+  int max_surfs;
 
   /* debug info */
   int num_orig_surfs;
@@ -58,22 +74,49 @@ struct tr_context {
   int width;
   int height;
 
-  /* parsed surfaces and vertices, ready to be passed to the render backend */
-  struct ta_surface surfs[TR_MAX_SURFS];
+  /* where the rendered frame is written on the original hardware */
+  struct ta_render_target target;
+
+  /* parsed surfaces and vertices, ready to be passed to the render backend.
+     each array is grown as needed while parsing, and kept around between
+     frames such that it's sized to fit the largest frame seen */
+  struct ta_surface *surfs;
   int num_surfs;
+  int max_surfs;
 
-  struct ta_vertex verts[TR_MAX_SURFS];
+  struct ta_vertex *verts;
   int num_verts;
+  int max_verts;
 
-  uint16_t indices[TR_MAX_SURFS * 3];
+  uint16_t *indices;
   int num_indices;
+  int max_indices;
 
   /* sorted list of surfaces corresponding to each of the ta's polygon lists */
   struct tr_list lists[TA_NUM_LISTS];
 
+  /* set when the translucent list is left unsorted, to be sorted per pixel by
+     the render backend */
+  int oit;
+
+  /* when the gpu_verts option is enabled, polygon vertices are left encoded
+     as ta_vertex_params for the render backend to decode. the raw params they
+     reference are copied out of the ta context, as it may be reused before
+     this context is rendered */
+  int gpu_verts;
+
+  uint32_t *encoded_verts;
+  int num_encoded_verts;
+  int max_encoded_verts;
+
+  uint8_t *raw_params;
+  int raw_size;
+  int max_raw_size;
+
   /* debug structures for stepping through the param stream in the tracer */
-  struct tr_param params[TA_MAX_PARAMS];
+  struct tr_param *params;
   int num_params;
+  int max_params;
 };
 
 static inline tr_texture_key_t tr_texture_key(union tsp tsp, union tcw tcw) {
@@ -82,9 +125,35 @@ static inline tr_texture_key_t tr_texture_key(union tsp tsp, union tcw tcw) {
 
 typedef struct tr_texture *(*tr_find_texture_cb)(void *, union tsp, union tcw);
 
-void tr_convert_context(struct render_backend *r, void *userdata,
-                        tr_find_texture_cb find_texture,
+/* owns the task group and scratch space used while converting contexts.
+   each converter converts one context at a time, contexts may be converted
+   in parallel through separate converters */
+struct tr_converter *tr_create_converter();
+void tr_destroy_converter(struct tr_converter *cv);
+
+/* converts each dirty texture referenced by the context, must be called from
+   the render backend's thread */
+void tr_convert_textures(struct tr_converter *cv, struct render_backend *r,
+                         void *userdata, tr_find_texture_cb find_texture,
+                         const struct ta_context *ctx);
+/* parses the context into render commands without touching the render
+   backend, the context's textures must have already been converted */
+void tr_parse_context(struct tr_converter *cv, void *userdata,
+                      tr_find_texture_cb find_texture,
+                      const struct ta_context *ctx, struct tr_context *rc);
+/* incrementally converts params as they're written to the ta, leaving only
+   the state known at render time to be filled in by tr_parse_context */
+struct tr_stream *tr_create_stream();
+void tr_destroy_stream(struct tr_stream *stream);
+void tr_reset_stream(struct tr_stream *stream);
+void tr_stream_param(struct tr_stream *stream, const struct ta_context *ctx,
+                     const uint8_t *data);
+void tr_convert_context(struct tr_converter *cv, struct render_backend *r,
+                        void *userdata, tr_find_texture_cb find_texture,
                         const struct ta_context *ctx, struct tr_context *rc);
+void tr_destroy_context(struct tr_context *rc);
+void tr_release_texture(struct tr_converter *cv, struct render_backend *r,
+                        struct tr_texture *entry);
 void tr_render_context(struct render_backend *r, const struct tr_context *rc);
 void tr_render_context_until(struct render_backend *r,
                              const struct tr_context *rc, int end_surf);
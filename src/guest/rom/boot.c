@@ -1,12 +1,25 @@
 #include "guest/rom/boot.h"
 #include "core/filesystem.h"
 #include "core/md5.h"
+#include "core/xxhash.h"
 #include "guest/dreamcast.h"
 #include "guest/memory.h"
 
+#define BOOT_ROM_SIZE 0x00200000
+
+/* stands in for the rom when boot.bin can't be loaded, leaving the bios to be
+   hle'd. it's never written, so every instance reads the same zero pages */
+static uint8_t boot_empty_rom[BOOT_ROM_SIZE];
+
 struct boot {
   struct device;
-  uint8_t rom[0x00200000];
+  /* boot.bin is mapped read-only rather than copied, so every instance on
+     the host shares the file's pages */
+  uint8_t *rom;
+  uint8_t *mapped;
+  size_t mapped_size;
+  /* private copy made the first time the rom is patched */
+  uint8_t *copy;
 };
 
 static const char *boot_bin_path() {
@@ -32,7 +45,7 @@ static int boot_validate(struct boot *boot) {
   /* compare the rom's md5 against known good bios roms */
   MD5_CTX md5_ctx;
   MD5_Init(&md5_ctx);
-  MD5_Update(&md5_ctx, boot->rom, sizeof(boot->rom));
+  MD5_Update(&md5_ctx, boot->rom, BOOT_ROM_SIZE);
   char result[33];
   MD5_Final(result, &md5_ctx);
 
@@ -50,32 +63,32 @@ static int boot_load_rom(struct boot *boot) {
 
   LOG_INFO("boot_load_rom path=%s", filename);
 
-  FILE *fp = fopen(filename, "rb");
-  if (!fp) {
+  size_t size;
+  uint8_t *data = map_file(filename, &size);
+  if (!data) {
     LOG_WARNING("boot_load_rom failed to open");
     return 0;
   }
 
-  fseek(fp, 0, SEEK_END);
-  int size = ftell(fp);
-  fseek(fp, 0, SEEK_SET);
-
-  if (size != (int)sizeof(boot->rom)) {
-    LOG_WARNING("boot_load_rom size mismatch size=%d expected=%d", size,
-                sizeof(boot->rom));
-    fclose(fp);
+  if (size != BOOT_ROM_SIZE) {
+    LOG_WARNING("boot_load_rom size mismatch size=%d expected=%d", (int)size,
+                BOOT_ROM_SIZE);
+    unmap_file(data, size);
     return 0;
   }
 
-  int n = (int)fread(boot->rom, sizeof(uint8_t), size, fp);
-  CHECK_EQ(n, size);
-  fclose(fp);
+  boot->rom = data;
 
   if (!boot_validate(boot)) {
     LOG_WARNING("boot_load_rom failed to validate");
+    boot->rom = boot_empty_rom;
+    unmap_file(data, size);
     return 0;
   }
 
+  boot->mapped = data;
+  boot->mapped_size = size;
+
   return 1;
 }
 
@@ -90,6 +103,12 @@ static int boot_init(struct device *dev) {
 
 void boot_rom_write(struct boot *boot, uint32_t addr, uint32_t data,
                     uint32_t mask) {
+  if (!boot->copy) {
+    boot->copy = malloc(BOOT_ROM_SIZE);
+    memcpy(boot->copy, boot->rom, BOOT_ROM_SIZE);
+    boot->rom = boot->copy;
+  }
+
   WRITE_DATA(&boot->rom[addr]);
 }
 
@@ -97,12 +116,22 @@ uint32_t boot_rom_read(struct boot *boot, uint32_t addr, uint32_t mask) {
   return READ_DATA(&boot->rom[addr]);
 }
 
+uint64_t boot_rom_hash(struct boot *boot) {
+  return xxh64(boot->rom, BOOT_ROM_SIZE, 0);
+}
+
 void boot_destroy(struct boot *boot) {
+  if (boot->mapped) {
+    unmap_file(boot->mapped, boot->mapped_size);
+  }
+  free(boot->copy);
+
   dc_destroy_device((struct device *)boot);
 }
 
 struct boot *boot_create(struct dreamcast *dc) {
   struct boot *boot =
       dc_create_device(dc, sizeof(struct boot), "boot", &boot_init, NULL);
+  boot->rom = boot_empty_rom;
   return boot;
 }
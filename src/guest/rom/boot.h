@@ -13,4 +13,7 @@ uint32_t boot_rom_read(struct boot *boot, uint32_t addr, uint32_t mask);
 void boot_rom_write(struct boot *boot, uint32_t addr, uint32_t data,
                     uint32_t mask);
 
+/* hash of the loaded rom, identifying which bios (if any) is booting */
+uint64_t boot_rom_hash(struct boot *boot);
+
 #endif
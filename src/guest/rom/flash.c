@@ -1,10 +1,15 @@
 #include "guest/rom/flash.h"
 #include "core/filesystem.h"
+#include "file/image_writer.h"
 #include "guest/dreamcast.h"
 #include "guest/memory.h"
 
 #define FLASH_SECTOR_SIZE 0x4000
 
+/* the bios writes its settings a few bytes at a time, the rom is only written
+   back once they settle */
+#define FLASH_FLUSH_DELAY_MS 500
+
 /* there doesn't seem to be any documentation on the flash rom used by the
    dreamcast, but it appears to implement the JEDEC CFI standard */
 #define FLASH_CMD_NONE 0x0
@@ -18,6 +23,9 @@ struct flash {
 
   uint8_t rom[0x00020000];
 
+  /* writes back modified sectors to disk, off of the emulation thread */
+  struct image_writer *writer;
+
   /* cmd parsing state */
   int cmd;
   int cmd_state;
@@ -35,13 +43,8 @@ static const char *flash_bin_path() {
   return filename;
 }
 
-static void flash_save_rom(struct flash *flash) {
-  const char *filename = flash_bin_path();
-
-  FILE *fp = fopen(filename, "wb");
-  int n = (int)fwrite(flash->rom, 1, sizeof(flash->rom), fp);
-  CHECK_EQ(n, (int)sizeof(flash->rom));
-  fclose(fp);
+static void flash_save_rom(struct flash *flash, int offset, int n) {
+  image_writer_write(flash->writer, offset, &flash->rom[offset], n);
 }
 
 static int flash_load_rom(struct flash *flash) {
@@ -103,6 +106,10 @@ static int flash_init(struct device *dev) {
   /* attempt to load the flash rom, if this fails the bios will reset it */
   flash_load_rom(flash);
 
+  flash->writer =
+      image_writer_create(flash_bin_path(), flash->rom, sizeof(flash->rom),
+                          FLASH_SECTOR_SIZE, FLASH_FLUSH_DELAY_MS);
+
   return 1;
 }
 
@@ -111,6 +118,7 @@ void flash_erase(struct flash *flash, int offset, int n) {
 
   /* erasing resets bits to 1 */
   memset(&flash->rom[offset], 0xff, n);
+  flash_save_rom(flash, offset, n);
 }
 
 void flash_program(struct flash *flash, int offset, const void *data, int n) {
@@ -122,12 +130,15 @@ void flash_program(struct flash *flash, int offset, const void *data, int n) {
   for (int i = 0; i < n; i++) {
     flash->rom[offset + i] &= bytes[i];
   }
+
+  flash_save_rom(flash, offset, n);
 }
 
 void flash_write(struct flash *flash, int offset, const void *data, int n) {
   CHECK(offset >= 0 && (offset + n) <= (int)sizeof(flash->rom));
 
   memcpy(&flash->rom[offset], data, n);
+  flash_save_rom(flash, offset, n);
 }
 
 void flash_read(struct flash *flash, int offset, void *data, int n) {
@@ -195,7 +206,9 @@ uint32_t flash_rom_read(struct flash *flash, uint32_t addr, uint32_t mask) {
 }
 
 void flash_destroy(struct flash *flash) {
-  flash_save_rom(flash);
+  if (flash->writer) {
+    image_writer_destroy(flash->writer);
+  }
   dc_destroy_device((struct device *)flash);
 }
 
@@ -0,0 +1,100 @@
+#include "guest/savestate.h"
+#include "core/core.h"
+
+void ss_write(struct savestate *ss, const void *ptr, int size) {
+  if (ss->file) {
+    if (size && fwrite(ptr, size, 1, ss->file) != 1) {
+      ss->error = 1;
+    }
+
+    ss->pos += size;
+    return;
+  }
+
+  if (!ss->error && ss->pos + size > ss->capacity && ss->fixed) {
+    ss->error = 1;
+  }
+
+  if (!ss->error && ss->pos + size > ss->capacity) {
+    int64_t capacity = MAX(ss->capacity * 2, 65536);
+
+    while (ss->pos + size > capacity) {
+      capacity *= 2;
+    }
+
+    uint8_t *buffer = realloc(ss->buffer, (size_t)capacity);
+
+    if (buffer) {
+      ss->buffer = buffer;
+      ss->capacity = capacity;
+    } else {
+      ss->error = 1;
+    }
+  }
+
+  if (!ss->error) {
+    memcpy(ss->buffer + ss->pos, ptr, size);
+  }
+
+  ss->pos += size;
+}
+
+void ss_patch(struct savestate *ss, int64_t offset, const void *ptr,
+              int size) {
+  CHECK_LE(offset + size, ss->pos);
+
+  if (!ss->file) {
+    /* a failed write may have left the buffer short */
+    if (!ss->error) {
+      memcpy(ss->buffer + offset, ptr, size);
+    }
+    return;
+  }
+
+  fseek(ss->file, (long)offset, SEEK_SET);
+  if (fwrite(ptr, size, 1, ss->file) != 1) {
+    ss->error = 1;
+  }
+  fseek(ss->file, (long)ss->pos, SEEK_SET);
+}
+
+void ss_read(struct savestate *ss, void *ptr, int size) {
+  CHECK_NOTNULL(ss->data);
+
+  if (ss->pos + size > ss->size) {
+    memset(ptr, 0, size);
+    ss->pos = ss->size;
+    ss->error = 1;
+    return;
+  }
+
+  memcpy(ptr, ss->data + ss->pos, size);
+  ss->pos += size;
+}
+
+void ss_write_timer(struct savestate *ss, struct scheduler *sched,
+                    struct timer *timer) {
+  int64_t remaining = timer ? MAX(sched_remaining_time(sched, timer), 0) : -1;
+  SS_WRITE(ss, remaining);
+}
+
+struct timer *ss_read_timer(struct savestate *ss, struct scheduler *sched,
+                            struct timer *timer, timer_cb cb, void *data,
+                            int lazy) {
+  int64_t remaining = -1;
+  SS_READ(ss, remaining);
+
+  if (timer) {
+    sched_cancel_timer(sched, timer);
+  }
+
+  if (remaining < 0 || ss->error) {
+    return NULL;
+  }
+
+  if (lazy) {
+    return sched_start_lazy_timer(sched, cb, data, remaining);
+  }
+
+  return sched_start_timer(sched, cb, data, remaining);
+}
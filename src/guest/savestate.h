@@ -0,0 +1,44 @@
+#ifndef SAVESTATE_H
+#define SAVESTATE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "guest/scheduler.h"
+
+/* stream each device's state is written to and read back from. states are
+   written either straight to a file or to a growable buffer, and read back
+   from memory */
+struct savestate {
+  FILE *file;
+  uint8_t *buffer;
+  int64_t capacity;
+  /* the buffer belongs to the caller and is never grown, writes past its
+     capacity fail instead. the position still advances, so writing to a
+     fixed buffer without any capacity measures the stream */
+  int fixed;
+  const uint8_t *data;
+  int64_t size;
+  int64_t pos;
+  /* set if a read ran past the end of the stream or a write failed */
+  int error;
+};
+
+void ss_write(struct savestate *ss, const void *ptr, int size);
+void ss_read(struct savestate *ss, void *ptr, int size);
+
+/* overwrite data already written at offset */
+void ss_patch(struct savestate *ss, int64_t offset, const void *ptr,
+              int size);
+
+#define SS_WRITE(ss, value) ss_write(ss, &(value), (int)sizeof(value))
+#define SS_READ(ss, value) ss_read(ss, &(value), (int)sizeof(value))
+
+/* timers are saved as the time remaining until they expire. when read back,
+   the existing timer is cancelled and a new one started in its place */
+void ss_write_timer(struct savestate *ss, struct scheduler *sched,
+                    struct timer *timer);
+struct timer *ss_read_timer(struct savestate *ss, struct scheduler *sched,
+                            struct timer *timer, timer_cb cb, void *data,
+                            int lazy);
+
+#endif
@@ -2,88 +2,269 @@
 #include "guest/scheduler.h"
 #include "core/core.h"
 #include "core/list.h"
+#include "core/time.h"
 #include "guest/dreamcast.h"
+#include "stats.h"
 
-#define MAX_TIMERS 128
+/* timers are allocated in chunks which are never freed until the scheduler is
+   destroyed, keeping the pointers handed out to devices stable */
+#define TIMERS_PER_CHUNK 64
 
 struct timer {
   int active;
   int64_t expire;
   timer_cb cb;
   void *data;
+
+  /* timers expiring at the same time run in the order they were started */
+  uint64_t seq;
+
+  /* index in the live heap while active, linked into the free list otherwise */
+  int lazy;
+  int index;
   struct list_node it;
 };
 
+struct timer_chunk {
+  struct timer_chunk *next;
+  struct timer timers[TIMERS_PER_CHUNK];
+};
+
+/* binary min-heap of live timers, ordered by expiration */
+struct timer_heap {
+  struct timer **timers;
+  int num_timers;
+  int max_timers;
+};
+
 struct scheduler {
   struct dreamcast *dc;
-  struct timer timers[MAX_TIMERS];
+  struct timer_chunk *chunks;
   struct list free_timers;
-  struct list live_timers;
+
+  /* lazy timers are kept apart from the rest, as they don't end the current
+     slice until they're SCHED_LAZY_SLACK past their expiration */
+  struct timer_heap live_timers;
+  struct timer_heap lazy_timers;
+
+  uint64_t next_seq;
   int64_t base_time;
+  int64_t slice_start;
 };
 
+static inline int sched_timer_before(struct timer *a, struct timer *b) {
+  if (a->expire != b->expire) {
+    return a->expire < b->expire;
+  }
+  return a->seq < b->seq;
+}
+
+static inline void sched_heap_set(struct timer_heap *heap, int i,
+                                  struct timer *timer) {
+  heap->timers[i] = timer;
+  timer->index = i;
+}
+
+static void sched_heap_up(struct timer_heap *heap, int i) {
+  struct timer *timer = heap->timers[i];
+
+  while (i > 0) {
+    int parent = (i - 1) / 2;
+    struct timer *entry = heap->timers[parent];
+
+    if (!sched_timer_before(timer, entry)) {
+      break;
+    }
+
+    sched_heap_set(heap, i, entry);
+    i = parent;
+  }
+
+  sched_heap_set(heap, i, timer);
+}
+
+static void sched_heap_down(struct timer_heap *heap, int i) {
+  struct timer *timer = heap->timers[i];
+  int n = heap->num_timers;
+
+  while (1) {
+    int child = 2 * i + 1;
+
+    if (child >= n) {
+      break;
+    }
+
+    if (child + 1 < n &&
+        sched_timer_before(heap->timers[child + 1], heap->timers[child])) {
+      child++;
+    }
+
+    struct timer *entry = heap->timers[child];
+
+    if (!sched_timer_before(entry, timer)) {
+      break;
+    }
+
+    sched_heap_set(heap, i, entry);
+    i = child;
+  }
+
+  sched_heap_set(heap, i, timer);
+}
+
+static void sched_heap_push(struct timer_heap *heap, struct timer *timer) {
+  if (heap->num_timers == heap->max_timers) {
+    heap->max_timers = MAX(heap->max_timers * 2, TIMERS_PER_CHUNK);
+    heap->timers =
+        realloc(heap->timers, heap->max_timers * sizeof(struct timer *));
+    CHECK_NOTNULL(heap->timers);
+  }
+
+  int i = heap->num_timers++;
+  sched_heap_set(heap, i, timer);
+  sched_heap_up(heap, i);
+}
+
+static void sched_heap_remove(struct timer_heap *heap, struct timer *timer) {
+  int i = timer->index;
+  int last = --heap->num_timers;
+
+  if (i == last) {
+    return;
+  }
+
+  /* move the last timer into the hole and restore the heap property */
+  sched_heap_set(heap, i, heap->timers[last]);
+
+  if (i > 0 &&
+      sched_timer_before(heap->timers[i], heap->timers[(i - 1) / 2])) {
+    sched_heap_up(heap, i);
+  } else {
+    sched_heap_down(heap, i);
+  }
+}
+
+static struct timer *sched_heap_min(struct timer_heap *heap) {
+  if (!heap->num_timers) {
+    return NULL;
+  }
+  return heap->timers[0];
+}
+
+static struct timer *sched_next_timer(struct scheduler *sched) {
+  struct timer *next = sched_heap_min(&sched->live_timers);
+  struct timer *lazy = sched_heap_min(&sched->lazy_timers);
+
+  if (!next || (lazy && sched_timer_before(lazy, next))) {
+    return lazy;
+  }
+  return next;
+}
+
+/* the time the current slice must end by to keep every timer within its
+   allowed latency */
+static int64_t sched_next_deadline(struct scheduler *sched,
+                                   int64_t target_time) {
+  struct timer *next = sched_heap_min(&sched->live_timers);
+  struct timer *lazy = sched_heap_min(&sched->lazy_timers);
+
+  if (next && next->expire < target_time) {
+    target_time = next->expire;
+  }
+  if (lazy && lazy->expire + SCHED_LAZY_SLACK < target_time) {
+    target_time = lazy->expire + SCHED_LAZY_SLACK;
+  }
+
+  return target_time;
+}
+
+static void sched_alloc_chunk(struct scheduler *sched) {
+  struct timer_chunk *chunk = calloc(1, sizeof(struct timer_chunk));
+  CHECK_NOTNULL(chunk);
+
+  chunk->next = sched->chunks;
+  sched->chunks = chunk;
+
+  for (int i = 0; i < TIMERS_PER_CHUNK; i++) {
+    struct timer *timer = &chunk->timers[i];
+    list_add(&sched->free_timers, &timer->it);
+  }
+}
+
 void sched_cancel_timer(struct scheduler *sched, struct timer *timer) {
   if (!timer->active) {
     return;
   }
 
   timer->active = 0;
-  list_remove(&sched->live_timers, &timer->it);
+  sched_heap_remove(timer->lazy ? &sched->lazy_timers : &sched->live_timers,
+                    timer);
   list_add(&sched->free_timers, &timer->it);
 }
 
+int64_t sched_base_time(struct scheduler *sched) {
+  return sched->base_time;
+}
+
+int64_t sched_slice_start(struct scheduler *sched) {
+  return sched->slice_start;
+}
+
 int64_t sched_remaining_time(struct scheduler *sched, struct timer *timer) {
   return timer->expire - sched->base_time;
 }
 
-struct timer *sched_start_timer(struct scheduler *sched, timer_cb cb,
-                                void *data, int64_t ns) {
+static struct timer *sched_add_timer(struct scheduler *sched, timer_cb cb,
+                                     void *data, int64_t ns, int lazy) {
+  if (list_empty(&sched->free_timers)) {
+    sched_alloc_chunk(sched);
+  }
+
   struct timer *timer = list_first_entry(&sched->free_timers, struct timer, it);
-  CHECK_NOTNULL(timer);
   timer->active = 1;
   timer->expire = sched->base_time + ns;
   timer->cb = cb;
   timer->data = data;
+  timer->seq = sched->next_seq++;
+  timer->lazy = lazy;
 
   /* remove from free list */
   list_remove(&sched->free_timers, &timer->it);
 
-  /* add to sorted live list */
-  struct list_node *after = NULL;
-
-  list_for_each(&sched->live_timers, it) {
-    struct timer *entry = list_entry(it, struct timer, it);
-
-    if (entry->expire > timer->expire) {
-      break;
-    }
+  /* add to live heap */
+  sched_heap_push(lazy ? &sched->lazy_timers : &sched->live_timers, timer);
 
-    after = it;
-  }
+  return timer;
+}
 
-  list_add_after(&sched->live_timers, after, &timer->it);
+struct timer *sched_start_lazy_timer(struct scheduler *sched, timer_cb cb,
+                                     void *data, int64_t ns) {
+  return sched_add_timer(sched, cb, data, ns, 1);
+}
 
-  return timer;
+struct timer *sched_start_timer(struct scheduler *sched, timer_cb cb,
+                                void *data, int64_t ns) {
+  return sched_add_timer(sched, cb, data, ns, 0);
 }
 
 void sched_tick(struct scheduler *sched, int64_t ns) {
   int64_t target_time = sched->base_time + ns;
 
+  PROF_ENTER("sched_tick");
+
   while (sched->dc->running && sched->base_time < target_time) {
     /* run devices up to the next timer */
-    int64_t next_time = target_time;
-    struct timer *next_timer =
-        list_first_entry(&sched->live_timers, struct timer, it);
-
-    if (next_timer && next_timer->expire < next_time) {
-      next_time = next_timer->expire;
-    }
+    int64_t next_time = sched_next_deadline(sched, target_time);
 
     /* update base time before running devices and expiring timers in case one
        of them schedules a new timer */
     int64_t slice = next_time - sched->base_time;
+    sched->slice_start = sched->base_time;
     sched->base_time += slice;
 
+    prof_counter_add(COUNTER_sched_slices, 1);
+    prof_counter_add(COUNTER_sched_slice_time, slice);
+
     /* execute each device */
     list_for_each_entry(dev, &sched->dc->devices, struct device, it) {
       if (dev->runif.enabled && dev->runif.running) {
@@ -91,25 +272,49 @@ void sched_tick(struct scheduler *sched, int64_t ns) {
       }
     }
 
+    sched->slice_start = sched->base_time;
+
     /* execute expired timers */
-    while (1) {
-      struct timer *timer =
-          list_first_entry(&sched->live_timers, struct timer, it);
+    struct timer *timer = sched_next_timer(sched);
 
-      if (!timer || timer->expire > sched->base_time) {
-        break;
-      }
+    if (!timer || timer->expire > sched->base_time) {
+      continue;
+    }
+
+    int64_t start = time_nanoseconds();
 
+    do {
       sched_cancel_timer(sched, timer);
 
       /* run the timer */
       timer->cb(timer->data);
-    }
+
+      timer = sched_next_timer(sched);
+    } while (timer && timer->expire <= sched->base_time);
+
+    prof_counter_add(COUNTER_timer_time, time_nanoseconds() - start);
   }
+
+  PROF_LEAVE();
 }
 
-void sched_destroy(struct scheduler *sch) {
-  free(sch);
+int64_t sched_clock_freq(int64_t hz, int percent) {
+  percent = MIN(MAX(percent, SCHED_MIN_CLOCK), SCHED_MAX_CLOCK);
+  return hz * percent / 100;
+}
+
+void sched_destroy(struct scheduler *sched) {
+  struct timer_chunk *chunk = sched->chunks;
+
+  while (chunk) {
+    struct timer_chunk *next = chunk->next;
+    free(chunk);
+    chunk = next;
+  }
+
+  free(sched->live_timers.timers);
+  free(sched->lazy_timers.timers);
+  free(sched);
 }
 
 struct scheduler *sched_create(struct dreamcast *dc) {
@@ -117,11 +322,8 @@ struct scheduler *sched_create(struct dreamcast *dc) {
 
   sched->dc = dc;
 
-  /* add all timers to the free list initially */
-  for (int i = 0; i < MAX_TIMERS; i++) {
-    struct timer *timer = &sched->timers[i];
-    list_add(&sched->free_timers, &timer->it);
-  }
+  /* allocate the initial set of timers */
+  sched_alloc_chunk(sched);
 
   return sched;
 }
@@ -15,6 +15,13 @@ struct scheduler;
 
 typedef void (*timer_cb)(void *);
 
+/* range of the percentages a cpu's clock may be scaled by */
+#define SCHED_MIN_CLOCK 25
+#define SCHED_MAX_CLOCK 400
+
+/* how late a lazy timer may expire */
+#define SCHED_LAZY_SLACK HZ_TO_NANO(1000)
+
 struct scheduler *sched_create(struct dreamcast *dc);
 void sched_destroy(struct scheduler *sch);
 
@@ -22,7 +29,22 @@ void sched_tick(struct scheduler *sch, int64_t ns);
 
 struct timer *sched_start_timer(struct scheduler *sch, timer_cb cb, void *data,
                                 int64_t ns);
+/* lazy timers are for events which are latency-tolerant. they may expire up
+   to SCHED_LAZY_SLACK late, letting the devices run for longer slices */
+struct timer *sched_start_lazy_timer(struct scheduler *sch, timer_cb cb,
+                                     void *data, int64_t ns);
 int64_t sched_remaining_time(struct scheduler *sch, struct timer *);
+/* guest time elapsed since the machine was created */
+int64_t sched_base_time(struct scheduler *sch);
+/* while devices are running, the base time has already been moved to the end
+   of their slice. this is the time the slice started at, and the base time
+   otherwise */
+int64_t sched_slice_start(struct scheduler *sch);
 void sched_cancel_timer(struct scheduler *sch, struct timer *);
 
+/* frequency of a cpu whose clock of hz is scaled by percent, for converting
+   its slices to cycles. this changes how much the cpu executes in a slice,
+   guest time and the timers driven by it are unaffected */
+int64_t sched_clock_freq(int64_t hz, int percent);
+
 #endif
@@ -1,18 +1,24 @@
 #include "guest/sh4/sh4.h"
 #include "core/core.h"
+#include "core/time.h"
 #include "guest/bios/bios.h"
 #include "guest/dreamcast.h"
 #include "guest/memory.h"
+#include "guest/savestate.h"
 #include "guest/scheduler.h"
 #include "imgui.h"
 #include "jit/frontend/sh4/sh4_fallback.h"
 #include "jit/frontend/sh4/sh4_frontend.h"
 #include "jit/frontend/sh4/sh4_guest.h"
 #include "jit/jit.h"
+#include "options.h"
 #include "stats.h"
 
 #if ARCH_X64
 #include "jit/backend/x64/x64_backend.h"
+#elif ARCH_A64
+#include "jit/backend/a64/a64_backend.h"
+#include "jit/backend/interp/interp_backend.h"
 #else
 #include "jit/backend/interp/interp_backend.h"
 #endif
@@ -41,6 +47,11 @@ static void sh4_sr_updated(struct sh4 *sh4, uint32_t old_sr) {
     sh4_swap_gpr_bank(ctx);
   }
 
+  /* privileged accesses ignore the asid in single virtual memory mode */
+  if ((ctx->sr & MD_MASK) != (old_sr & MD_MASK) && sh4->MMUCR->SV) {
+    sh4_mmu_flush(sh4);
+  }
+
   if ((ctx->sr & I_MASK) != (old_sr & I_MASK) ||
       (ctx->sr & BL_MASK) != (old_sr & BL_MASK)) {
     sh4_intc_update_pending(sh4);
@@ -118,9 +129,20 @@ static void sh4_link_code(struct sh4 *sh4, void *branch, uint32_t target) {
 }
 
 static void sh4_compile_code(struct sh4 *sh4, uint32_t addr) {
+  sh4_mmu_touch_code(sh4, addr);
   jit_compile_code(sh4->jit, addr);
 }
 
+void sh4_prescan_code(struct sh4 *sh4, uint32_t addr) {
+  /* code compiled through the mmu must be tracked by sh4_mmu_touch_code,
+     binaries are only prescanned as they're loaded, before it's enabled */
+  if (sh4->guest->mmu_enabled) {
+    return;
+  }
+
+  jit_prescan_code(sh4->jit, addr);
+}
+
 static void sh4_invalid_instr(struct sh4 *sh4) {
   struct memory *mem = sh4->dc->mem;
   struct bios *bios = sh4->dc->bios;
@@ -136,18 +158,15 @@ static void sh4_invalid_instr(struct sh4 *sh4) {
     return;
   }
 
-  if (sh4_dbg_invalid_instr(sh4)) {
-    return;
-  }
-
+  struct sh4_guest *guest = (struct sh4_guest *)sh4->guest;
   uint32_t pc = sh4->ctx.pc;
-  uint16_t data = sh4_read16(mem, pc);
+  uint16_t data = sh4_read16(mem, sh4_guest_translate(guest, pc));
   struct jit_opdef *def = sh4_get_opdef(data);
   enum sh4_exception exc = SH4_EXC_ILLINSTR;
 
   /* op may be valid if the delay slot raised this */
   if (def->op != SH4_OP_INVALID) {
-    data = sh4_read16(mem, pc + 2);
+    data = sh4_read16(mem, sh4_guest_translate(guest, pc + 2));
     def = sh4_get_opdef(data);
     exc = SH4_EXC_ILLSLOT;
   }
@@ -166,14 +185,64 @@ static void sh4_run(struct device *dev, int64_t ns) {
   struct sh4_context *ctx = &sh4->ctx;
   struct jit *jit = sh4->jit;
 
-  int cycles = (int)NANO_TO_CYCLES(ns, SH4_CLOCK_FREQ);
+  int64_t freq = sched_clock_freq(SH4_CLOCK_FREQ, OPTION_sh4_clock);
+  int cycles = (int)NANO_TO_CYCLES(ns, freq);
   cycles = MAX(cycles, 1);
 
-  jit_run(sh4->jit, cycles);
+  int64_t start = time_nanoseconds();
+  int64_t compile_start = jit->compile_time;
+
+  jit_run(jit, cycles);
 
+  int64_t compile = jit->compile_time - compile_start;
+  prof_counter_add(COUNTER_sh4_time, time_nanoseconds() - start - compile);
   prof_counter_add(COUNTER_sh4_instrs, sh4->ctx.ran_instrs);
 }
 
+static int sh4_breakpoint(struct sh4 *sh4, uint32_t addr) {
+  if (sh4->entry_trap && (addr & SH4_ADDR_MASK) == sh4->entry_addr) {
+    return 1;
+  }
+
+  return sh4_dbg_breakpoint(sh4, addr);
+}
+
+static void sh4_trap(struct sh4 *sh4) {
+  uint32_t addr = sh4->ctx.pc;
+
+  if (!sh4->entry_trap || (addr & SH4_ADDR_MASK) != sh4->entry_addr) {
+    sh4_dbg_trap(sh4);
+    return;
+  }
+
+  sh4_entry_trap_cb handler = sh4->entry_trap;
+  void *data = sh4->entry_trap_data;
+
+  sh4->entry_trap = NULL;
+  sh4->guest->num_breakpoints--;
+
+  /* recompile the block without the trap, and break from dispatch such that
+     the handler runs between slices */
+  jit_invalidate_range(sh4->jit, addr, 2);
+  sh4->ctx.run_cycles = -1;
+
+  handler(data);
+}
+
+static int sh4_fold_literal(struct sh4 *sh4, uint32_t addr) {
+  /* system ram is only modified through paths which invalidate the code
+     covering it (dma, store queues and cache resets), and the boot rom is
+     never modified */
+  if (addr >= SH4_P4_BEGIN) {
+    return 0;
+  }
+
+  uint32_t area_addr = addr & SH4_ADDR_MASK;
+
+  return (area_addr >= SH4_AREA3_BEGIN && area_addr <= SH4_AREA3_END) ||
+         area_addr <= SH4_BOOT_ROM_END;
+}
+
 static void sh4_guest_destroy(struct jit_guest *guest) {
   free((struct sh4_guest *)guest);
 }
@@ -189,6 +258,7 @@ static struct jit_guest *sh4_guest_create(struct sh4 *sh4) {
   guest->membase = sh4_base(sh4->dc->mem);
   guest->mem = sh4->dc->mem;
   guest->lookup = &sh4_lookup;
+  guest->lookup_reg = &sh4_lookup_reg;
   guest->r8 = &sh4_read8;
   guest->r16 = &sh4_read16;
   guest->r32 = &sh4_read32;
@@ -198,6 +268,7 @@ static struct jit_guest *sh4_guest_create(struct sh4 *sh4) {
 
   /* runtime interface */
   guest->data = sh4;
+  guest->data_size = (int)sizeof(*sh4);
   guest->offset_pc = (int)offsetof(struct sh4_context, pc);
   guest->offset_cycles = (int)offsetof(struct sh4_context, run_cycles);
   guest->offset_instrs = (int)offsetof(struct sh4_context, ran_instrs);
@@ -211,7 +282,19 @@ static struct jit_guest *sh4_guest_create(struct sh4 *sh4) {
   guest->pref = (sh4_pref_cb)&sh4_ccn_pref;
   guest->sleep = (sh4_sleep_cb)&sh4_sleep;
   guest->sr_updated = (sh4_sr_updated_cb)&sh4_sr_updated;
+  guest->tlb_cache = sh4->tlb_cache;
+  guest->translate_addr = (sh4_translate_addr_cb)&sh4_mmu_translate;
   guest->fpscr_updated = (sh4_fpscr_updated_cb)&sh4_fpscr_updated;
+  guest->breakpoint = (sh4_breakpoint_cb)&sh4_breakpoint;
+  guest->trap = (sh4_trap_cb)&sh4_trap;
+
+  if (OPTION_jit_fastmem_checks) {
+    guest->page_table = sh4_page_table(guest->mem, &guest->page_shift);
+  }
+
+  if (OPTION_jit_fold_literals) {
+    guest->fold_literal = (sh4_fold_literal_cb)&sh4_fold_literal;
+  }
 
   return (struct jit_guest *)guest;
 }
@@ -224,8 +307,16 @@ static int sh4_init(struct device *dev) {
   sh4->guest = sh4_guest_create(sh4);
   sh4->frontend = sh4_frontend_create(sh4->guest);
 #if ARCH_X64
-  DEFINE_JIT_CODE_BUFFER(sh4_code);
-  sh4->backend = x64_backend_create(sh4->guest, sh4_code, sizeof(sh4_code));
+  /* large games overflow smaller buffers, evicting code which is still hot */
+  int code_size = CLAMP(OPTION_jit_code_size, 8, 1024) * 1024 * 1024;
+  sh4->backend = x64_backend_create(sh4->guest, NULL, code_size);
+#elif ARCH_A64
+  /* the a64 backend is opt-in until it's been proven on hardware */
+  if (OPTION_jit_a64) {
+    sh4->backend = a64_backend_create(sh4->guest, NULL, JIT_CODE_BUFFER_SIZE);
+  } else {
+    sh4->backend = interp_backend_create(sh4->guest, sh4->frontend);
+  }
 #else
   sh4->backend = interp_backend_create(sh4->guest, sh4->frontend);
 #endif
@@ -234,6 +325,83 @@ static int sh4_init(struct device *dev) {
   return 1;
 }
 
+static void sh4_save(struct device *dev, struct savestate *ss) {
+  struct sh4 *sh4 = (struct sh4 *)dev;
+
+  SS_WRITE(ss, sh4->ctx);
+  SS_WRITE(ss, sh4->reg);
+
+  /* ccn */
+  SS_WRITE(ss, sh4->sq);
+  ss_write(ss, mem_ocram(sh4->dc->mem, 0), SH4_CACHE_RAM_SIZE);
+
+  /* intc */
+  SS_WRITE(ss, sh4->sorted_interrupts);
+  SS_WRITE(ss, sh4->sort_id);
+  SS_WRITE(ss, sh4->priority_mask);
+  SS_WRITE(ss, sh4->requested_interrupts);
+
+  /* mmu, the store queue destinations are resolved again when loaded */
+  SS_WRITE(ss, sh4->utlb);
+  for (int i = 0; i < ARRAY_SIZE(sh4->utlb_sq_map); i++) {
+    SS_WRITE(ss, sh4->utlb_sq_map[i].base);
+  }
+
+  /* scif */
+  SS_WRITE(ss, sh4->SCFSR2_last_read);
+  SS_WRITE(ss, sh4->receive_fifo);
+  SS_WRITE(ss, sh4->transmit_fifo);
+
+  /* tmu */
+  sh4_tmu_save(sh4, ss);
+}
+
+static void sh4_load(struct device *dev, struct savestate *ss) {
+  struct sh4 *sh4 = (struct sh4 *)dev;
+  struct sh4_guest *guest = (struct sh4_guest *)sh4->guest;
+
+  jit_free_code(sh4->jit);
+
+  SS_READ(ss, sh4->ctx);
+  SS_READ(ss, sh4->reg);
+
+  /* ccn */
+  SS_READ(ss, sh4->sq);
+  ss_read(ss, mem_ocram(sh4->dc->mem, 0), SH4_CACHE_RAM_SIZE);
+  sh4_ccn_map_ocram(sh4);
+  sh4_ccn_resolve_sq(sh4, &sh4->sq_dest[0], (*sh4->QACR0 & 0x1c) << 24);
+  sh4_ccn_resolve_sq(sh4, &sh4->sq_dest[1], (*sh4->QACR1 & 0x1c) << 24);
+
+  /* dmac, transfers are always completed before saving */
+  sh4_dmac_reset(sh4);
+
+  /* intc */
+  SS_READ(ss, sh4->sorted_interrupts);
+  SS_READ(ss, sh4->sort_id);
+  SS_READ(ss, sh4->priority_mask);
+  SS_READ(ss, sh4->requested_interrupts);
+  sh4_intc_update_pending(sh4);
+
+  /* mmu */
+  SS_READ(ss, sh4->utlb);
+  for (int i = 0; i < ARRAY_SIZE(sh4->utlb_sq_map); i++) {
+    uint32_t base;
+    SS_READ(ss, base);
+    sh4_ccn_resolve_sq(sh4, &sh4->utlb_sq_map[i], base);
+  }
+  sh4->utlb_code = 0;
+  sh4_mmu_flush(sh4);
+  guest->mmu_enabled = sh4_mmu_enabled(sh4);
+
+  /* scif */
+  SS_READ(ss, sh4->SCFSR2_last_read);
+  SS_READ(ss, sh4->receive_fifo);
+  SS_READ(ss, sh4->transmit_fifo);
+
+  /* tmu */
+  sh4_tmu_load(sh4, ss);
+}
+
 void sh4_clear_interrupt(struct sh4 *sh4, enum sh4_interrupt intr) {
   sh4->requested_interrupts &= ~sh4->sort_id[intr];
   sh4_intc_update_pending(sh4);
@@ -250,6 +418,19 @@ void sh4_set_exception_handler(struct sh4 *sh4,
   sh4->exc_handler_data = data;
 }
 
+void sh4_set_entry_trap(struct sh4 *sh4, uint32_t addr,
+                        sh4_entry_trap_cb handler, void *data) {
+  if (!sh4->entry_trap) {
+    sh4->guest->num_breakpoints++;
+  }
+
+  sh4->entry_addr = addr & SH4_ADDR_MASK;
+  sh4->entry_trap = handler;
+  sh4->entry_trap_data = data;
+
+  jit_invalidate_range(sh4->jit, addr, 2);
+}
+
 void sh4_reset(struct sh4 *sh4, uint32_t pc) {
   jit_free_code(sh4->jit);
 
@@ -269,9 +450,19 @@ void sh4_reset(struct sh4 *sh4, uint32_t pc) {
 #include "guest/sh4/sh4_regs.inc"
 #undef SH4_REG
 
+  /* the operand cache ram starts out disabled */
+  memset(mem_ocram(sh4->dc->mem, 0), 0, SH4_CACHE_RAM_SIZE);
+  sh4_ccn_map_ocram(sh4);
+
+  /* resolve the default store queue destinations */
+  sh4_ccn_resolve_sq(sh4, &sh4->sq_dest[0], (*sh4->QACR0 & 0x1c) << 24);
+  sh4_ccn_resolve_sq(sh4, &sh4->sq_dest[1], (*sh4->QACR1 & 0x1c) << 24);
+
   /* reset tlb */
-  memset(sh4->utlb_sq_map, 0, sizeof(sh4->utlb_sq_map));
-  memset(sh4->utlb, 0, sizeof(sh4->utlb));
+  sh4_mmu_reset(sh4);
+
+  /* cancel any in-flight dma transfers */
+  sh4_dmac_reset(sh4);
 
   /* reset interrupts */
   sh4_intc_reprioritize(sh4);
@@ -300,6 +491,18 @@ void sh4_debug_menu(struct sh4 *sh4) {
         }
       }
 
+      if (!jit->profile) {
+        if (igMenuItem("start block profile", NULL, 0, 1)) {
+          jit->profile = 1;
+          jit_invalidate_code(jit);
+        }
+      } else {
+        if (igMenuItem("stop block profile", NULL, 1, 1)) {
+          jit->profile = 0;
+          jit_invalidate_code(jit);
+        }
+      }
+
       if (igMenuItem("log reg access", NULL, sh4->log_regs, 1)) {
         sh4->log_regs = !sh4->log_regs;
       }
@@ -308,6 +511,10 @@ void sh4_debug_menu(struct sh4 *sh4) {
         sh4->tmu_stats = !sh4->tmu_stats;
       }
 
+      if (jit->sampler && igMenuItem("export pc samples", NULL, 0, 1)) {
+        jit_export_samples(jit);
+      }
+
       igEndMenu();
     }
 
@@ -317,6 +524,10 @@ void sh4_debug_menu(struct sh4 *sh4) {
   if (sh4->tmu_stats) {
     sh4_tmu_debug_menu(sh4);
   }
+
+  if (jit->profile) {
+    jit_profile_debug_menu(jit);
+  }
 }
 #endif
 
@@ -345,6 +556,11 @@ struct sh4 *sh4_create(struct dreamcast *dc) {
   sh4->runif.enabled = 1;
   sh4->runif.run = &sh4_run;
 
+  /* setup state interface */
+  sh4->stateif.enabled = 1;
+  sh4->stateif.save = &sh4_save;
+  sh4->stateif.load = &sh4_load;
+
   return sh4;
 }
 
@@ -23,6 +23,7 @@ struct jit_guest;
 #define SH4_CLOCK_FREQ INT64_C(200000000)
 
 typedef int (*sh4_exception_handler_cb)(void *, enum sh4_exception);
+typedef void (*sh4_entry_trap_cb)(void *);
 
 struct sh4 {
   struct device;
@@ -48,8 +49,17 @@ struct sh4 {
   int tmu_stats;
   struct list breakpoints;
 
+  /* one-shot trap on entering an address, see sh4_set_entry_trap */
+  uint32_t entry_addr;
+  sh4_entry_trap_cb entry_trap;
+  void *entry_trap_data;
+
   /* ccn */
   uint32_t sq[2][8];
+  struct sh4_sq_dest sq_dest[2];
+
+  /* dmac */
+  struct sh4_dma_channel dma[SH4_NUM_DMA_CHANNELS];
 
   /* intc */
   enum sh4_interrupt sorted_interrupts[SH4_NUM_INTERRUPTS];
@@ -59,8 +69,11 @@ struct sh4 {
   /* pending interrupts moved to context for fast jit access */
 
   /* mmu */
-  uint32_t utlb_sq_map[64];
+  struct sh4_sq_dest utlb_sq_map[64];
   struct sh4_tlb_entry utlb[64];
+  struct sh4_tlb_cache_entry tlb_cache[SH4_TLB_CACHE_SIZE];
+  /* utlb entries code has been compiled through */
+  uint64_t utlb_code;
 
   /* scif */
   uint32_t SCFSR2_last_read;
@@ -80,9 +93,18 @@ void sh4_destroy(struct sh4 *sh4);
 void sh4_debug_menu(struct sh4 *sh4);
 void sh4_reset(struct sh4 *sh4, uint32_t pc);
 
+/* compile the code reachable from addr ahead of it being executed */
+void sh4_prescan_code(struct sh4 *sh4, uint32_t addr);
+
 void sh4_set_exception_handler(struct sh4 *sh4,
                                sh4_exception_handler_cb handler, void *data);
 
+/* call handler the first time execution enters addr, in any of its mirrors,
+   ending the current slice. it's compiled in like a breakpoint, costing
+   nothing once hit */
+void sh4_set_entry_trap(struct sh4 *sh4, uint32_t addr,
+                        sh4_entry_trap_cb handler, void *data);
+
 void sh4_raise_interrupt(struct sh4 *sh4, enum sh4_interrupt intr);
 void sh4_clear_interrupt(struct sh4 *sh4, enum sh4_interrupt intr);
 
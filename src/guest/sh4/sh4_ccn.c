@@ -8,9 +8,10 @@
 #define LOG_CCN(...)
 #endif
 
-/* with OIX, bit 25, rather than bit 13, determines which 4kb bank to use */
-#define CACHE_OFFSET(addr, OIX) \
-  ((OIX ? ((addr & 0x2000000) >> 13) : ((addr & 0x2000) >> 1)) | (addr & 0xfff))
+static void sh4_ccn_invalidate_written(void *data, uint32_t addr, int size) {
+  struct sh4 *sh4 = data;
+  jit_invalidate_range(sh4->jit, addr, size);
+}
 
 static void sh4_ccn_reset(struct sh4 *sh4) {
   /* FIXME this isn't right. when the IC is reset a pending flag is set and the
@@ -26,7 +27,53 @@ static void sh4_ccn_reset(struct sh4 *sh4) {
      end the block */
   LOG_INFO("sh4_ccn_reset");
 
+  /* only the blocks in ram written since the previous reset can be stale, so
+     while writes are tracked just those are invalidated. otherwise, every
+     block is invalidated and tracking is started for the next reset */
+  struct memory *mem = sh4->dc->mem;
+
+  if (sh4_scan_ram_writes(mem, &sh4_ccn_invalidate_written, sh4)) {
+    return;
+  }
+
   jit_invalidate_code(sh4->jit);
+
+  sh4_track_ram_writes(mem);
+}
+
+void sh4_ccn_map_ocram(struct sh4 *sh4) {
+  sh4_map_ocram(sh4->dc->mem, sh4->CCR->ORA, sh4->CCR->OIX);
+}
+
+void sh4_ccn_invalidate_code(struct sh4 *sh4, uint32_t addr, int size) {
+  /* code only runs from system ram, so ignore writes to other areas. without
+     this, writes to the ta / pvr, which are frequent, would end up
+     invalidating blocks at aliased addresses */
+  uint32_t area_addr = addr & SH4_ADDR_MASK;
+
+  if (area_addr < SH4_AREA3_BEGIN || area_addr > SH4_AREA3_END) {
+    return;
+  }
+
+  jit_invalidate_range(sh4->jit, addr, size);
+}
+
+void sh4_ccn_resolve_sq(struct sh4 *sh4, struct sh4_sq_dest *dest,
+                        uint32_t base) {
+  struct memory *mem = sh4->dc->mem;
+  uint32_t area_addr = base & SH4_ADDR_MASK;
+
+  dest->base = base;
+  dest->ram = NULL;
+
+  if (area_addr >= SH4_AREA3_BEGIN && area_addr <= SH4_AREA3_END) {
+    dest->type = SH4_SQ_DEST_RAM;
+    dest->ram = mem_ram(mem, 0);
+  } else if (area_addr >= SH4_AREA4_BEGIN && area_addr <= SH4_AREA4_END) {
+    dest->type = SH4_SQ_DEST_TA;
+  } else {
+    dest->type = SH4_SQ_DEST_MEM;
+  }
 }
 
 void sh4_ccn_pref(struct sh4 *sh4, uint32_t addr) {
@@ -35,29 +82,39 @@ void sh4_ccn_pref(struct sh4 *sh4, uint32_t addr) {
   /* make sure this is a sq related prefetch */
   DCHECK(addr >= 0xe0000000 && addr <= 0xe3ffffff);
 
-  uint32_t dst = 0x0;
   uint32_t sqi = (addr & 0x20) >> 5;
+  struct sh4_sq_dest *dest;
+  uint32_t dst;
 
   if (sh4->MMUCR->AT) {
-    /* get upper 12 bits from UTLB */
-    uint32_t vpn = addr >> 20;
-    dst = sh4->utlb_sq_map[vpn & 0x3f];
-
-    /* get lower 20 bits from original address */
-    dst |= addr & 0xfffe0;
+    /* get upper 12 bits from UTLB, lower 20 bits from original address */
+    dest = &sh4->utlb_sq_map[(addr >> 20) & 0x3f];
+    dst = dest->base | (addr & 0xfffe0);
   } else {
-    /* get upper 6 bits from QACR* registers */
-    if (sqi) {
-      dst = (*sh4->QACR1 & 0x1c) << 24;
-    } else {
-      dst = (*sh4->QACR0 & 0x1c) << 24;
-    }
-
-    /* get lower 26 bits from original address */
-    dst |= addr & 0x3ffffe0;
+    /* get upper 6 bits from QACR* registers, lower 26 bits from original
+       address */
+    dest = &sh4->sq_dest[sqi];
+    dst = dest->base | (addr & 0x3ffffe0);
   }
 
-  sh4_memcpy_to_guest(mem, dst, sh4->sq[sqi], 32);
+  const uint8_t *src = (const uint8_t *)sh4->sq[sqi];
+
+  switch (dest->type) {
+    case SH4_SQ_DEST_RAM: {
+      uint8_t *ptr = dest->ram + (dst & SH4_AREA3_ADDR_MASK);
+      memcpy(ptr, src, 32);
+      sh4_ccn_invalidate_code(sh4, dst, 32);
+    } break;
+
+    case SH4_SQ_DEST_TA:
+      sh4_area4_write(sh4, dst, src, 32);
+      break;
+
+    default:
+      sh4_memcpy_to_guest(mem, dst, src, 32);
+      sh4_ccn_invalidate_code(sh4, dst, 32);
+      break;
+  }
 }
 
 uint32_t sh4_ccn_cache_read(struct sh4 *sh4, uint32_t addr, uint32_t mask) {
@@ -68,8 +125,8 @@ uint32_t sh4_ccn_cache_read(struct sh4 *sh4, uint32_t addr, uint32_t mask) {
     return 0x0;
   }
 
-  addr = CACHE_OFFSET(addr, sh4->CCR->OIX);
-  return READ_DATA(&sh4->ctx.cache[addr]);
+  addr = SH4_CACHE_OFFSET(addr, sh4->CCR->OIX);
+  return READ_DATA(mem_ocram(sh4->dc->mem, addr));
 }
 
 void sh4_ccn_cache_write(struct sh4 *sh4, uint32_t addr, uint32_t data,
@@ -80,8 +137,8 @@ void sh4_ccn_cache_write(struct sh4 *sh4, uint32_t addr, uint32_t data,
   }
 
   CHECK_EQ(sh4->CCR->ORA, 1u);
-  addr = CACHE_OFFSET(addr, sh4->CCR->OIX);
-  WRITE_DATA(&sh4->ctx.cache[addr]);
+  addr = SH4_CACHE_OFFSET(addr, sh4->CCR->OIX);
+  WRITE_DATA(mem_ocram(sh4->dc->mem, addr));
 }
 
 uint32_t sh4_ccn_sq_read(struct sh4 *sh4, uint32_t addr, uint32_t mask) {
@@ -127,23 +184,29 @@ void sh4_ccn_ocache_write(struct sh4 *sh4, uint32_t addr, uint32_t data,
   /* ignore */
 }
 
-REG_W32(sh4_cb, MMUCR) {
+REG_W32(sh4_cb, QACR0) {
   struct sh4 *sh4 = dc->sh4;
+  *sh4->QACR0 = value;
+  sh4_ccn_resolve_sq(sh4, &sh4->sq_dest[0], (value & 0x1c) << 24);
+}
 
-  sh4->MMUCR->full = value;
-
-  if (sh4->MMUCR->AT) {
-    LOG_WARNING("MMU not fully supported");
-  }
+REG_W32(sh4_cb, QACR1) {
+  struct sh4 *sh4 = dc->sh4;
+  *sh4->QACR1 = value;
+  sh4_ccn_resolve_sq(sh4, &sh4->sq_dest[1], (value & 0x1c) << 24);
 }
 
 REG_W32(sh4_cb, CCR) {
   struct sh4 *sh4 = dc->sh4;
 
-  /* TODO check for cache toggle
-  union ccr CCR_OLD = *sh4->CCR;*/
+  /* TODO check for cache toggle */
+  union ccr old = *sh4->CCR;
   sh4->CCR->full = value;
 
+  if (sh4->CCR->ORA != old.ORA || sh4->CCR->OIX != old.OIX) {
+    sh4_ccn_map_ocram(sh4);
+  }
+
   if (sh4->CCR->ICI) {
     sh4_ccn_reset(sh4);
   }
@@ -1,6 +1,37 @@
 #ifndef SH4_CCN_H
 #define SH4_CCN_H
 
+#include <stdint.h>
+
+struct sh4;
+
+/* the operand cache ram is made up of two 4kb banks mirrored throughout
+   SH4_CACHE_BEGIN-SH4_CACHE_END. with OIX, bit 25, rather than bit 13,
+   determines which bank to use */
+#define SH4_CACHE_RAM_SIZE 0x2000
+#define SH4_CACHE_OFFSET(addr, OIX) \
+  ((OIX ? ((addr & 0x2000000) >> 13) : ((addr & 0x2000) >> 1)) | (addr & 0xfff))
+
+/* the destination of a store queue window, resolved whenever the registers
+   or utlb entries mapping it change, avoiding a full memory lookup on each
+   pref */
+enum {
+  SH4_SQ_DEST_MEM,
+  SH4_SQ_DEST_RAM,
+  SH4_SQ_DEST_TA,
+};
+
+struct sh4_sq_dest {
+  int type;
+  uint32_t base;
+  uint8_t *ram;
+};
+
+void sh4_ccn_resolve_sq(struct sh4 *sh4, struct sh4_sq_dest *dest,
+                        uint32_t base);
+
+void sh4_ccn_map_ocram(struct sh4 *sh4);
+void sh4_ccn_invalidate_code(struct sh4 *sh4, uint32_t addr, int size);
 void sh4_ccn_pref(struct sh4 *sh4, uint32_t addr);
 uint32_t sh4_ccn_cache_read(struct sh4 *sh4, uint32_t addr, uint32_t mask);
 void sh4_ccn_cache_write(struct sh4 *sh4, uint32_t addr, uint32_t data,
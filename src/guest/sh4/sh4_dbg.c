@@ -6,7 +6,6 @@
 
 struct breakpoint {
   uint32_t addr;
-  uint16_t instr;
   struct list_node it;
 };
 
@@ -24,32 +23,29 @@ static void destroy_breakpoint(struct sh4 *sh4, struct breakpoint *bp) {
   free(bp);
 }
 
-static struct breakpoint *create_breakpoint(struct sh4 *sh4, uint32_t addr,
-                                            uint16_t instr) {
+static struct breakpoint *create_breakpoint(struct sh4 *sh4, uint32_t addr) {
   struct breakpoint *bp = calloc(1, sizeof(struct breakpoint));
   bp->addr = addr;
-  bp->instr = instr;
   list_add(&sh4->breakpoints, &bp->it);
   return bp;
 }
 
-int sh4_dbg_invalid_instr(struct sh4 *sh4) {
-  uint32_t pc = sh4->ctx.pc;
-
-  /* ensure a breakpoint exists for this address */
-  struct breakpoint *bp = lookup_breakpoint(sh4, pc);
+static int is_watchpoint(int type) {
+  /* gdb's write, read and access watchpoint types */
+  return type >= 2;
+}
 
-  if (!bp) {
-    return 0;
-  }
+int sh4_dbg_breakpoint(struct sh4 *sh4, uint32_t addr) {
+  return lookup_breakpoint(sh4, addr) != NULL;
+}
 
-  /* force a break from dispatch */
-  sh4->ctx.run_cycles = 0;
+void sh4_dbg_trap(struct sh4 *sh4) {
+  /* force a break from dispatch, which only exits once the remaining cycles
+     go negative */
+  sh4->ctx.run_cycles = -1;
 
   /* let the debugger know execution has stopped */
   debugger_trap(sh4->dc->debugger);
-
-  return 1;
 }
 
 void sh4_dbg_read_register(struct device *dev, int n, uint64_t *value,
@@ -105,32 +101,35 @@ void sh4_dbg_read_memory(struct device *dev, uint32_t addr, uint8_t *buffer,
 
 void sh4_dbg_remove_breakpoint(struct device *dev, int type, uint32_t addr) {
   struct sh4 *sh4 = (struct sh4 *)dev;
-  struct memory *mem = sh4->dc->mem;
+
+  if (is_watchpoint(type)) {
+    return;
+  }
 
   struct breakpoint *bp = lookup_breakpoint(sh4, addr);
   CHECK_NOTNULL(bp);
 
-  /* restore the original instruction */
-  sh4_write16(mem, addr, bp->instr);
-
-  /* free code cache to remove block containing the invalid instruction  */
-  jit_free_code(sh4->jit);
-
   destroy_breakpoint(sh4, bp);
+  sh4->guest->num_breakpoints--;
+
+  /* recompile the block which trapped on the breakpoint */
+  jit_invalidate_range(sh4->jit, addr, 2);
 }
 
 void sh4_dbg_add_breakpoint(struct device *dev, int type, uint32_t addr) {
   struct sh4 *sh4 = (struct sh4 *)dev;
-  struct memory *mem = sh4->dc->mem;
 
-  uint16_t instr = sh4_read16(mem, addr);
-  struct breakpoint *bp = create_breakpoint(sh4, addr, instr);
+  if (is_watchpoint(type)) {
+    LOG_WARNING("sh4_dbg_add_breakpoint watchpoints aren't supported");
+    return;
+  }
 
-  /* write out an invalid instruction */
-  sh4_write16(mem, addr, 0);
+  create_breakpoint(sh4, addr);
+  sh4->guest->num_breakpoints++;
 
-  /* free code cache to remove block containing the original instruction  */
-  jit_free_code(sh4->jit);
+  /* breakpoints are compiled into the code rather than patched into guest
+     memory, recompile only the blocks covering the instruction */
+  jit_invalidate_range(sh4->jit, addr, 2);
 }
 
 void sh4_dbg_step(struct device *dev) {
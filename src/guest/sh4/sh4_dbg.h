@@ -9,6 +9,7 @@ void sh4_dbg_read_memory(struct device *dev, uint32_t addr, uint8_t *buffer,
                          int size);
 void sh4_dbg_read_register(struct device *dev, int n, uint64_t *value,
                            int *size);
-int sh4_dbg_invalid_instr(struct sh4 *sh4);
+int sh4_dbg_breakpoint(struct sh4 *sh4, uint32_t addr);
+void sh4_dbg_trap(struct sh4 *sh4);
 
 #endif
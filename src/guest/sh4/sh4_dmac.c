@@ -1,6 +1,9 @@
 #include "guest/memory.h"
+#include "guest/scheduler.h"
 #include "guest/sh4/sh4.h"
 
+static void sh4_dmac_flush(struct sh4 *sh4, int channel);
+
 static void sh4_dmac_check(struct sh4 *sh4, int channel) {
   union chcr *chcr = NULL;
 
@@ -24,81 +27,217 @@ static void sh4_dmac_check(struct sh4 *sh4, int channel) {
 
   CHECK(sh4->DMAOR->DDT || !sh4->DMAOR->DME || !chcr->DE,
         "sh4_dmac_check only DDT DMA unsupported");
+
+  /* disabling the channel halts any transfer in progress */
+  if (!sh4->DMAOR->DME || !chcr->DE) {
+    sh4_dmac_flush(sh4, channel);
+  }
 }
 
-void sh4_dmac_ddt(struct sh4 *sh4, struct sh4_dtr *dtr) {
+/* ddt transfers are performed over the 64-bit external bus at 100mhz, loosely
+   simulate this by moving a chunk at a time */
+#define SH4_DMA_CHUNK_SIZE 0x1000
+#define SH4_DMA_BUS_HZ UINT64_C(100000000)
+
+static void sh4_dmac_channel_regs(struct sh4 *sh4, int channel, uint32_t **sar,
+                                  uint32_t **dar, uint32_t **dmatcr,
+                                  union chcr **chcr, enum sh4_interrupt *dmte) {
+  switch (channel) {
+    case 0:
+      *sar = sh4->SAR0;
+      *dar = sh4->DAR0;
+      *dmatcr = sh4->DMATCR0;
+      *chcr = sh4->CHCR0;
+      *dmte = SH4_INT_DMTE0;
+      break;
+    case 1:
+      *sar = sh4->SAR1;
+      *dar = sh4->DAR1;
+      *dmatcr = sh4->DMATCR1;
+      *chcr = sh4->CHCR1;
+      *dmte = SH4_INT_DMTE1;
+      break;
+    case 2:
+      *sar = sh4->SAR2;
+      *dar = sh4->DAR2;
+      *dmatcr = sh4->DMATCR2;
+      *chcr = sh4->CHCR2;
+      *dmte = SH4_INT_DMTE2;
+      break;
+    case 3:
+      *sar = sh4->SAR3;
+      *dar = sh4->DAR3;
+      *dmatcr = sh4->DMATCR3;
+      *chcr = sh4->CHCR3;
+      *dmte = SH4_INT_DMTE3;
+      break;
+    default:
+      LOG_FATAL("Unexpected DMA channel");
+      break;
+  }
+}
+
+/* move the next chunk of a dual address mode transfer, returning non-zero
+   once the transfer has completed */
+static int sh4_dmac_step(struct sh4 *sh4, int channel, int max_size) {
   struct memory *mem = sh4->dc->mem;
+  struct sh4_dma_channel *dma = &sh4->dma[channel];
+
+  uint32_t *sar, *dar, *dmatcr;
+  union chcr *chcr;
+  enum sh4_interrupt dmte;
+  sh4_dmac_channel_regs(sh4, channel, &sar, &dar, &dmatcr, &chcr, &dmte);
+
+  int n = MIN(dma->remaining, max_size);
+  uint32_t src_area = dma->src & SH4_ADDR_MASK;
+  uint32_t dst_area = dma->dst & SH4_ADDR_MASK;
+
+  uint32_t ram_offset = src_area & SH4_AREA3_ADDR_MASK;
+
+  if (src_area >= SH4_AREA3_BEGIN && src_area <= SH4_AREA3_END &&
+      ram_offset + n <= SH4_AREA3_ADDR_MASK + 1 &&
+      dst_area >= SH4_AREA4_BEGIN && dst_area <= SH4_AREA4_END) {
+    /* ram -> ta transfers (e.g. ch2 polygon data) hand the source ram
+       directly to the ta, avoiding the generic memory lookups */
+    const uint8_t *ptr = mem_ram(mem, ram_offset);
+    sh4_area4_write(sh4, dma->dst, ptr, n);
+  } else {
+    sh4_memcpy(mem, dma->dst, dma->src, n);
+    sh4_ccn_invalidate_code(sh4, dma->dst, n);
+  }
+  dma->src += n;
+  dma->dst += n;
+  dma->remaining -= n;
+
+  /* update src / dst addresses as well as remaining count as the transfer
+     progresses */
+  *sar = dma->src;
+  *dar = dma->dst;
+  *dmatcr = dma->remaining / 32;
+
+  if (dma->remaining) {
+    return 0;
+  }
 
-  /* FIXME this should be made asynchronous, at which point the significance
-     of the registers / interrupts should be more obvious */
+  /* signal transfer end */
+  chcr->TE = 1;
+
+  /* raise interrupt if requested */
+  if (chcr->IE) {
+    sh4_raise_interrupt(sh4, dmte);
+  }
+
+  /* clear the transfer before notifying the requester, which may start a new
+     one */
+  sh4_dtr_cb end = dma->end;
+  void *end_data = dma->end_data;
+  memset(dma, 0, sizeof(*dma));
+
+  if (end) {
+    end(end_data);
+  }
+
+  return 1;
+}
+
+static void (*dma_timers[SH4_NUM_DMA_CHANNELS])(void *);
+
+#define DEFINE_DMA_TIMER(ch)                                              \
+  static void sh4_dmac_timer_channel##ch(void *data) {                    \
+    struct sh4 *sh4 = data;                                               \
+    struct scheduler *sched = sh4->dc->sched;                             \
+    struct sh4_dma_channel *dma = &sh4->dma[ch];                          \
+    dma->timer = NULL;                                                    \
+    if (sh4_dmac_step(sh4, ch, SH4_DMA_CHUNK_SIZE)) {                     \
+      return;                                                             \
+    }                                                                     \
+    int64_t end = CYCLES_TO_NANO(SH4_DMA_CHUNK_SIZE / 8, SH4_DMA_BUS_HZ); \
+    dma->timer = sched_start_timer(sched, dma_timers[ch], sh4, end);      \
+  }
+
+DEFINE_DMA_TIMER(0);
+DEFINE_DMA_TIMER(1);
+DEFINE_DMA_TIMER(2);
+DEFINE_DMA_TIMER(3);
+
+static void (*dma_timers[SH4_NUM_DMA_CHANNELS])(void *) = {
+    &sh4_dmac_timer_channel0, &sh4_dmac_timer_channel1,
+    &sh4_dmac_timer_channel2, &sh4_dmac_timer_channel3,
+};
+
+static void sh4_dmac_flush(struct sh4 *sh4, int channel) {
+  struct scheduler *sched = sh4->dc->sched;
+  struct sh4_dma_channel *dma = &sh4->dma[channel];
+
+  if (!dma->timer) {
+    return;
+  }
+
+  /* the transfer timing is only loosely modeled, rather than leaving the
+     transfer stranded when the channel is disabled, complete it now */
+  sched_cancel_timer(sched, dma->timer);
+  dma->timer = NULL;
+  sh4_dmac_step(sh4, channel, dma->remaining);
+}
+
+void sh4_dmac_complete(struct sh4 *sh4) {
+  for (int i = 0; i < SH4_NUM_DMA_CHANNELS; i++) {
+    sh4_dmac_flush(sh4, i);
+  }
+}
+
+void sh4_dmac_reset(struct sh4 *sh4) {
+  struct scheduler *sched = sh4->dc->sched;
+
+  for (int i = 0; i < SH4_NUM_DMA_CHANNELS; i++) {
+    struct sh4_dma_channel *dma = &sh4->dma[i];
+
+    if (dma->timer) {
+      sched_cancel_timer(sched, dma->timer);
+    }
+
+    memset(dma, 0, sizeof(*dma));
+  }
+}
+
+void sh4_dmac_ddt(struct sh4 *sh4, struct sh4_dtr *dtr) {
+  struct memory *mem = sh4->dc->mem;
 
   if (dtr->data) {
-    /* single address mode transfer */
+    /* single address mode transfers are performed immediately, the external
+       device's buffer is only valid for the duration of the call */
     if (dtr->dir == SH4_DMA_FROM_ADDR) {
       sh4_memcpy_to_host(mem, dtr->data, dtr->addr, dtr->size);
     } else {
       sh4_memcpy_to_guest(mem, dtr->addr, dtr->data, dtr->size);
+      sh4_ccn_invalidate_code(sh4, dtr->addr, dtr->size);
     }
-  } else {
-    /* dual address mode transfer */
-    uint32_t *sar;
-    uint32_t *dar;
-    uint32_t *dmatcr;
-    union chcr *chcr;
-    enum sh4_interrupt dmte;
-
-    switch (dtr->channel) {
-      case 0:
-        sar = sh4->SAR0;
-        dar = sh4->DAR0;
-        dmatcr = sh4->DMATCR0;
-        chcr = sh4->CHCR0;
-        dmte = SH4_INT_DMTE0;
-        break;
-      case 1:
-        sar = sh4->SAR1;
-        dar = sh4->DAR1;
-        dmatcr = sh4->DMATCR1;
-        chcr = sh4->CHCR1;
-        dmte = SH4_INT_DMTE1;
-        break;
-      case 2:
-        sar = sh4->SAR2;
-        dar = sh4->DAR2;
-        dmatcr = sh4->DMATCR2;
-        chcr = sh4->CHCR2;
-        dmte = SH4_INT_DMTE2;
-        break;
-      case 3:
-        sar = sh4->SAR3;
-        dar = sh4->DAR3;
-        dmatcr = sh4->DMATCR3;
-        chcr = sh4->CHCR3;
-        dmte = SH4_INT_DMTE3;
-        break;
-      default:
-        LOG_FATAL("Unexpected DMA channel");
-        break;
+
+    if (dtr->end) {
+      dtr->end(dtr->end_data);
     }
+    return;
+  }
 
-    uint32_t src = dtr->dir == SH4_DMA_FROM_ADDR ? dtr->addr : *sar;
-    uint32_t dst = dtr->dir == SH4_DMA_FROM_ADDR ? *dar : dtr->addr;
-    int size = *dmatcr * 32;
-    sh4_memcpy(mem, dst, src, size);
+  /* dual address mode transfer */
+  uint32_t *sar, *dar, *dmatcr;
+  union chcr *chcr;
+  enum sh4_interrupt dmte;
+  sh4_dmac_channel_regs(sh4, dtr->channel, &sar, &dar, &dmatcr, &chcr, &dmte);
 
-    /* update src / addresses as well as remaining count */
-    *sar = src + size;
-    *dar = dst + size;
-    *dmatcr = 0;
+  /* finish off any transfer still in flight on the channel */
+  sh4_dmac_flush(sh4, dtr->channel);
 
-    /* signal transfer end */
-    chcr->TE = 1;
+  /* latch register state */
+  struct sh4_dma_channel *dma = &sh4->dma[dtr->channel];
+  dma->src = dtr->dir == SH4_DMA_FROM_ADDR ? dtr->addr : *sar;
+  dma->dst = dtr->dir == SH4_DMA_FROM_ADDR ? *dar : dtr->addr;
+  dma->remaining = *dmatcr * 32;
+  dma->end = dtr->end;
+  dma->end_data = dtr->end_data;
 
-    /* raise interrupt if requested */
-    if (chcr->IE) {
-      sh4_raise_interrupt(sh4, dmte);
-    }
-  }
+  /* kick off async dma */
+  dma_timers[dtr->channel](sh4);
 }
 
 REG_W32(sh4_cb, CHCR0) {
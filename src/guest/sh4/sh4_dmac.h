@@ -1,11 +1,20 @@
 #ifndef SH4_DMAC_H
 #define SH4_DMAC_H
 
+#include <stdint.h>
+
+struct sh4;
+struct timer;
+
+#define SH4_NUM_DMA_CHANNELS 4
+
 enum {
   SH4_DMA_FROM_ADDR,
   SH4_DMA_TO_ADDR,
 };
 
+typedef void (*sh4_dtr_cb)(void *);
+
 struct sh4_dtr {
   int channel;
   int dir;
@@ -19,8 +28,25 @@ struct sh4_dtr {
   /* size is only valid for single address mode transfers, dual address mode
      transfers honor DMATCR */
   int size;
+  /* dual address mode transfers complete asynchronously, end is called once
+     the transfer has completed */
+  sh4_dtr_cb end;
+  void *end_data;
+};
+
+/* state of an in-flight dual address mode transfer */
+struct sh4_dma_channel {
+  struct timer *timer;
+  uint32_t src;
+  uint32_t dst;
+  int remaining;
+  sh4_dtr_cb end;
+  void *end_data;
 };
 
+void sh4_dmac_reset(struct sh4 *sh4);
+/* complete any in-flight transfers immediately */
+void sh4_dmac_complete(struct sh4 *sh4);
 void sh4_dmac_ddt(struct sh4 *sh, struct sh4_dtr *dtr);
 
 #endif
@@ -209,6 +209,22 @@ void sh4_area0_write(struct sh4 *sh4, uint32_t addr, uint32_t data,
   }
 }
 
+uint32_t *sh4_area0_reg(struct sh4 *sh4, uint32_t addr, int write) {
+  struct dreamcast *dc = sh4->dc;
+
+  /* create the p0-p4 and area 0 mirrors */
+  addr &= SH4_ADDR_MASK;
+  addr &= SH4_AREA0_ADDR_MASK;
+
+  if (addr >= SH4_HOLLY_REG_BEGIN && addr <= SH4_HOLLY_REG_END) {
+    return holly_reg_ptr(dc->holly, addr - SH4_HOLLY_REG_BEGIN, write);
+  } else if (addr >= SH4_PVR_REG_BEGIN && addr <= SH4_PVR_REG_END) {
+    return pvr_reg_ptr(dc->pvr, addr - SH4_PVR_REG_BEGIN, write);
+  }
+
+  return NULL;
+}
+
 uint32_t sh4_area0_read(struct sh4 *sh4, uint32_t addr, uint32_t mask) {
   struct dreamcast *dc = sh4->dc;
 
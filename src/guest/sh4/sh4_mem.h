@@ -120,6 +120,7 @@
 /* clang-format on */
 
 uint32_t sh4_area0_read(struct sh4 *sh4, uint32_t addr, uint32_t mask);
+uint32_t *sh4_area0_reg(struct sh4 *sh4, uint32_t addr, int write);
 void sh4_area0_write(struct sh4 *sh4, uint32_t addr, uint32_t data,
                      uint32_t mask);
 
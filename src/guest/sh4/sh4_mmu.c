@@ -1,4 +1,6 @@
 #include "guest/sh4/sh4.h"
+#include "jit/jit.h"
+#include "options.h"
 
 #if 0
 #define LOG_MMU LOG_INFO
@@ -8,7 +10,7 @@
 
 #define TLB_INDEX(addr) (((addr) >> 8) & 0x3f)
 
-/*#define PAGE_SIZE(entry) (((entry)->lo.SZ1 << 1) | (entry)->lo.SZ0)*/
+#define PAGE_SIZE(entry) (((entry)->lo.SZ1 << 1) | (entry)->lo.SZ0)
 
 enum {
   PAGE_SIZE_1KB,
@@ -17,6 +19,122 @@ enum {
   PAGE_SIZE_1MB,
 };
 
+static uint32_t sh4_mmu_page_mask(struct sh4_tlb_entry *entry) {
+  switch (PAGE_SIZE(entry)) {
+    case PAGE_SIZE_1KB:
+      return 0xfffffc00;
+    case PAGE_SIZE_4KB:
+      return 0xfffff000;
+    case PAGE_SIZE_64KB:
+      return 0xffff0000;
+    default:
+      return 0xfff00000;
+  }
+}
+
+static int sh4_mmu_translated(uint32_t addr) {
+  /* only the p0 / u0 and p3 areas are translated */
+  uint32_t area = addr >> 29;
+  return area < 4 || area == 6;
+}
+
+static struct sh4_tlb_entry *sh4_mmu_lookup(struct sh4 *sh4, uint32_t addr) {
+  uint32_t asid = sh4->PTEH->ASID;
+
+  /* in single virtual memory mode, privileged accesses ignore the asid */
+  int ignore_asid = sh4->MMUCR->SV && (sh4->ctx.sr & MD_MASK);
+
+  for (int i = 0; i < ARRAY_SIZE(sh4->utlb); i++) {
+    struct sh4_tlb_entry *entry = &sh4->utlb[i];
+
+    if (!entry->lo.V) {
+      continue;
+    }
+
+    uint32_t vpn = entry->hi.VPN << 10;
+    if ((addr ^ vpn) & sh4_mmu_page_mask(entry)) {
+      continue;
+    }
+
+    if (!entry->lo.SH && !ignore_asid && entry->hi.ASID != asid) {
+      continue;
+    }
+
+    return entry;
+  }
+
+  return NULL;
+}
+
+int sh4_mmu_enabled(struct sh4 *sh4) {
+  /* without tlb miss exceptions, titles relying on them can't run with
+     translation enabled. unless opted in, MMUCR.AT is ignored and addresses
+     are mapped as if it were clear */
+  return sh4->MMUCR->AT && OPTION_sh4_mmu;
+}
+
+void sh4_mmu_flush(struct sh4 *sh4) {
+  memset(sh4->tlb_cache, 0, sizeof(sh4->tlb_cache));
+}
+
+uint32_t sh4_mmu_translate(struct sh4 *sh4, uint32_t addr) {
+  uint32_t page = addr & SH4_TLB_PAGE_MASK;
+  uint32_t tag = page | 1;
+  int n = (addr >> SH4_TLB_PAGE_BITS) & (SH4_TLB_CACHE_SIZE - 1);
+  struct sh4_tlb_cache_entry *cached = &sh4->tlb_cache[n];
+
+  if (cached->tag == tag) {
+    return addr + cached->delta;
+  }
+
+  /* translated pages are mapped to their p2 mirror, which is never translated
+     itself, and is backed by the same memory as p0 when using fastmem */
+  uint32_t paddr = page;
+
+  if (sh4_mmu_translated(addr)) {
+    struct sh4_tlb_entry *entry = sh4_mmu_lookup(sh4, addr);
+
+    if (entry) {
+      uint32_t mask = sh4_mmu_page_mask(entry);
+      paddr = ((entry->lo.PPN << 10) & mask) | (page & ~mask);
+    } else {
+      /* raising a tlb miss exception needs the faulting access to be
+         restartable, which compiled blocks aren't. rather than silently
+         falling through to the identity mapping, which would read and write
+         the wrong memory, stop here. translation is only enabled through the
+         sh4_mmu option until then
+         FIXME raise tlb miss exceptions */
+      LOG_FATAL("sh4_mmu_translate tlb miss 0x%08x, tlb miss exceptions "
+                "aren't supported",
+                addr);
+    }
+
+    paddr = 0xa0000000 | (paddr & 0x1fffffff);
+  }
+
+  LOG_MMU("sh4_mmu_translate refill 0x%08x -> 0x%08x", page, paddr);
+
+  cached->tag = tag;
+  cached->delta = paddr - page;
+
+  return addr + cached->delta;
+}
+
+void sh4_mmu_touch_code(struct sh4 *sh4, uint32_t addr) {
+  if (!sh4->guest->mmu_enabled || !sh4_mmu_translated(addr)) {
+    return;
+  }
+
+  /* remember which entries code has been compiled through, so the code can be
+     invalidated if the mapping changes */
+  struct sh4_tlb_entry *entry = sh4_mmu_lookup(sh4, addr);
+
+  if (entry) {
+    int n = (int)(entry - sh4->utlb);
+    sh4->utlb_code |= UINT64_C(1) << n;
+  }
+}
+
 static void sh4_mmu_utlb_sync(struct sh4 *sh4, struct sh4_tlb_entry *entry) {
   int n = (int)(entry - sh4->utlb);
 
@@ -27,15 +145,32 @@ static void sh4_mmu_utlb_sync(struct sh4 *sh4, struct sh4_tlb_entry *entry) {
     uint32_t vpn = entry->hi.VPN >> 10;
     uint32_t ppn = entry->lo.PPN << 10;
 
-    sh4->utlb_sq_map[vpn & 0x3f] = ppn;
+    sh4_ccn_resolve_sq(sh4, &sh4->utlb_sq_map[vpn & 0x3f], ppn);
 
     LOG_INFO("sh4_mmu_utlb_sync sq map (%d) 0x%x -> 0x%x", n, vpn, ppn);
-  } else {
-    LOG_WARNING("sh4_mmu_utlb_sync memory mapping not supported");
+  }
+
+  /* any cached translation may have come from the previous mapping */
+  sh4_mmu_flush(sh4);
+
+  if (sh4->utlb_code & (UINT64_C(1) << n)) {
+    jit_invalidate_code(sh4->jit);
+    sh4->utlb_code = 0;
   }
 }
 
-static void sh4_mmu_translate(struct sh4 *sh4, uint32_t addr) {}
+void sh4_mmu_reset(struct sh4 *sh4) {
+  struct sh4_guest *guest = (struct sh4_guest *)sh4->guest;
+
+  for (int i = 0; i < ARRAY_SIZE(sh4->utlb_sq_map); i++) {
+    sh4_ccn_resolve_sq(sh4, &sh4->utlb_sq_map[i], 0);
+  }
+  memset(sh4->utlb, 0, sizeof(sh4->utlb));
+  sh4->utlb_code = 0;
+  sh4_mmu_flush(sh4);
+
+  guest->mmu_enabled = sh4_mmu_enabled(sh4);
+}
 
 void sh4_mmu_ltlb(struct sh4 *sh4) {
   uint32_t n = sh4->MMUCR->URC;
@@ -119,3 +254,43 @@ void sh4_mmu_utlb_write(struct sh4 *sh4, uint32_t addr, uint32_t data,
     }
   }
 }
+
+REG_W32(sh4_cb, PTEH) {
+  struct sh4 *sh4 = dc->sh4;
+  union pteh old = *sh4->PTEH;
+
+  sh4->PTEH->full = value;
+
+  if (sh4->PTEH->ASID != old.ASID) {
+    sh4_mmu_flush(sh4);
+  }
+}
+
+REG_W32(sh4_cb, MMUCR) {
+  struct sh4 *sh4 = dc->sh4;
+  struct sh4_guest *guest = (struct sh4_guest *)sh4->guest;
+
+  sh4->MMUCR->full = value;
+
+  /* code compiled with translation enabled probes the tlb cache inline, and
+     code compiled without it doesn't */
+  int invalidate = sh4_mmu_enabled(sh4) != guest->mmu_enabled;
+
+  if (sh4->MMUCR->TI) {
+    /* invalidate all entries, TI always reads back as 0 */
+    for (int i = 0; i < ARRAY_SIZE(sh4->utlb); i++) {
+      sh4->utlb[i].lo.V = 0;
+    }
+    sh4->MMUCR->TI = 0;
+
+    invalidate |= sh4->utlb_code != 0;
+  }
+
+  sh4_mmu_flush(sh4);
+
+  if (invalidate) {
+    guest->mmu_enabled = sh4_mmu_enabled(sh4);
+    sh4->utlb_code = 0;
+    jit_invalidate_code(sh4->jit);
+  }
+}
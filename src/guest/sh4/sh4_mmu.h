@@ -3,11 +3,19 @@
 
 #include "guest/sh4/sh4_types.h"
 
+struct sh4;
+
 struct sh4_tlb_entry {
   union pteh hi;
   union ptel lo;
 };
 
+void sh4_mmu_reset(struct sh4 *sh4);
+int sh4_mmu_enabled(struct sh4 *sh4);
+void sh4_mmu_flush(struct sh4 *sh4);
+uint32_t sh4_mmu_translate(struct sh4 *sh4, uint32_t addr);
+void sh4_mmu_touch_code(struct sh4 *sh4, uint32_t addr);
+
 void sh4_mmu_ltlb(struct sh4 *sh4);
 uint32_t sh4_mmu_itlb_read(struct sh4 *sh4, uint32_t addr, uint32_t mask);
 uint32_t sh4_mmu_utlb_read(struct sh4 *sh4, uint32_t addr, uint32_t mask);
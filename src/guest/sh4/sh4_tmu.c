@@ -1,4 +1,5 @@
 #include "guest/sh4/sh4_tmu.h"
+#include "guest/savestate.h"
 #include "guest/scheduler.h"
 #include "guest/sh4/sh4.h"
 #include "imgui.h"
@@ -94,6 +95,25 @@ static void sh4_tmu_reschedule(struct sh4 *sh4, int n, uint32_t tcnt,
   *timer = sched_start_timer(sched, cb, sh4, remaining);
 }
 
+void sh4_tmu_save(struct sh4 *sh4, struct savestate *ss) {
+  struct scheduler *sched = sh4->dc->sched;
+
+  for (int i = 0; i < 3; i++) {
+    ss_write_timer(ss, sched, sh4->tmu_timers[i]);
+  }
+}
+
+void sh4_tmu_load(struct sh4 *sh4, struct savestate *ss) {
+  struct scheduler *sched = sh4->dc->sched;
+  static timer_cb cbs[3] = {&sh4_tmu_expire_0, &sh4_tmu_expire_1,
+                            &sh4_tmu_expire_2};
+
+  for (int i = 0; i < 3; i++) {
+    sh4->tmu_timers[i] =
+        ss_read_timer(ss, sched, sh4->tmu_timers[i], cbs[i], sh4, 0);
+  }
+}
+
 static void sh4_tmu_update_tstr(struct sh4 *sh4) {
   struct scheduler *sched = sh4->dc->sched;
 
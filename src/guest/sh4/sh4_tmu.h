@@ -1,8 +1,14 @@
 #ifndef SH4_TMU_H
 #define SH4_TMU_H
 
+struct savestate;
 struct sh4;
 
 void sh4_tmu_debug_menu(struct sh4 *sh4);
 
+/* TCNT values are only updated when read, the state of each running timer
+   is saved instead */
+void sh4_tmu_save(struct sh4 *sh4, struct savestate *ss);
+void sh4_tmu_load(struct sh4 *sh4, struct savestate *ss);
+
 #endif
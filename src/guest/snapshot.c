@@ -0,0 +1,447 @@
+/*
+ * in-memory snapshots
+ *
+ * cheap enough to be taken every frame. device state is small and saved in
+ * full, but rather than copying all of guest memory each time, memory is
+ * compared page by page against a copy of it as of the latest snapshot, and
+ * only the pages written in between are stored
+ *
+ * the pages are stored with their previous contents, so each snapshot is a
+ * delta taking the memory copy one snapshot back. restoring a snapshot rolls
+ * the copy back through each newer snapshot before copying it to the guest,
+ * which lets the oldest snapshot be dropped at any time
+ *
+ * write watches would avoid the comparison, but the guest writes through the
+ * fastmem mappings rather than the host mappings a watch can protect, and
+ * faults in those are already claimed by the jit
+ *
+ * when compressed, snapshots are deflated by a worker thread once taken,
+ * leaving the thread taking them to only pay for the comparison and copies
+ */
+
+#include <zlib.h>
+#include "guest/snapshot.h"
+#include "core/core.h"
+#include "core/thread.h"
+#include "guest/dreamcast.h"
+#include "guest/memory.h"
+#include "guest/savestate.h"
+
+#define SNAPSHOT_PAGE_SIZE 4096
+
+enum {
+  /* waiting on the worker */
+  SNAPSHOT_QUEUED,
+  SNAPSHOT_PACKING,
+  SNAPSHOT_PACKED,
+  /* left as-is after failing to pack */
+  SNAPSHOT_RAW,
+};
+
+struct snapshot {
+  int state;
+
+  /* device state, followed by the previous contents of each page written
+     since the previous snapshot */
+  uint8_t *data;
+  int64_t data_size;
+  int64_t data_capacity;
+  int64_t raw_size;
+  int64_t devices_size;
+
+  int *pages;
+  int num_pages;
+  int max_pages;
+};
+
+struct snapshots {
+  struct dreamcast *dc;
+  int64_t max_size;
+
+  /* guest memory as of the latest snapshot, kept even once it's dropped */
+  uint8_t *mem;
+  int mem_size;
+  int mem_valid;
+
+  /* snapshots, oldest first. the ring, and the state and data of the
+     snapshots in it, are guarded by the mutex */
+  struct snapshot *ring;
+  int max_snapshots;
+  int head;
+  int num_snapshots;
+  int64_t size;
+
+  /* scratch space packed snapshots are inflated to when restored */
+  uint8_t *scratch;
+  int64_t scratch_size;
+
+  thread_t thread;
+  mutex_t mutex;
+  /* signalled when a snapshot is taken or the worker is shutting down */
+  cond_t queued_cond;
+  /* signalled when the worker finishes packing a snapshot */
+  cond_t packed_cond;
+  struct snapshot *packing;
+  int shutdown;
+};
+
+static struct snapshot *snapshots_get(struct snapshots *snaps, int i) {
+  return &snaps->ring[(snaps->head + i) % snaps->max_snapshots];
+}
+
+static int64_t snapshot_size(struct snapshot *snap) {
+  return snap->data_size + (int64_t)snap->num_pages * sizeof(int);
+}
+
+static void *snapshots_thread(void *data) {
+  struct snapshots *snaps = data;
+
+  mutex_lock(snaps->mutex);
+
+  while (!snaps->shutdown) {
+    struct snapshot *snap = NULL;
+
+    for (int i = 0; i < snaps->num_snapshots && !snap; i++) {
+      struct snapshot *it = snapshots_get(snaps, i);
+
+      if (it->state == SNAPSHOT_QUEUED) {
+        snap = it;
+      }
+    }
+
+    if (!snap) {
+      cond_wait(snaps->queued_cond, snaps->mutex);
+      continue;
+    }
+
+    /* the snapshot can't be dropped or restored while it's being packed */
+    snap->state = SNAPSHOT_PACKING;
+    snaps->packing = snap;
+
+    mutex_unlock(snaps->mutex);
+
+    uLongf size = compressBound((uLong)snap->raw_size);
+    uint8_t *packed = malloc(size);
+    int res = packed && compress2(packed, &size, snap->data,
+                                  (uLong)snap->raw_size, Z_BEST_SPEED) == Z_OK;
+
+    mutex_lock(snaps->mutex);
+
+    if (res) {
+      snaps->size -= snap->data_size;
+      free(snap->data);
+      snap->data = packed;
+      snap->data_size = (int64_t)size;
+      snap->data_capacity = (int64_t)size;
+      snaps->size += snap->data_size;
+      snap->state = SNAPSHOT_PACKED;
+    } else {
+      free(packed);
+      snap->state = SNAPSHOT_RAW;
+    }
+
+    snaps->packing = NULL;
+    cond_broadcast(snaps->packed_cond);
+  }
+
+  mutex_unlock(snaps->mutex);
+
+  return NULL;
+}
+
+/* returns the raw contents of the snapshot, inflating them if needed. the
+   mutex must be held, and the snapshot not be packing */
+static const uint8_t *snapshot_unpack(struct snapshots *snaps,
+                                      struct snapshot *snap) {
+  if (snap->state != SNAPSHOT_PACKED) {
+    return snap->data;
+  }
+
+  if (snaps->scratch_size < snap->raw_size) {
+    free(snaps->scratch);
+    snaps->scratch = malloc(snap->raw_size);
+    snaps->scratch_size = snaps->scratch ? snap->raw_size : 0;
+  }
+
+  uLongf size = (uLongf)snap->raw_size;
+
+  if (!snaps->scratch ||
+      uncompress(snaps->scratch, &size, snap->data,
+                 (uLong)snap->data_size) != Z_OK ||
+      size != (uLongf)snap->raw_size) {
+    LOG_WARNING("snapshot_unpack failed to inflate snapshot");
+    return NULL;
+  }
+
+  return snaps->scratch;
+}
+
+/* the mutex must be held */
+static void snapshots_drop_oldest(struct snapshots *snaps) {
+  struct snapshot *snap = snapshots_get(snaps, 0);
+
+  while (snaps->packing == snap) {
+    cond_wait(snaps->packed_cond, snaps->mutex);
+  }
+
+  snaps->size -= snapshot_size(snap);
+  snaps->head = (snaps->head + 1) % snaps->max_snapshots;
+  snaps->num_snapshots--;
+}
+
+static void snapshot_add_page(struct snapshot *snap, struct savestate *ss,
+                              int page, const uint8_t *data) {
+  if (snap->num_pages == snap->max_pages) {
+    snap->max_pages = MAX(snap->max_pages * 2, 64);
+    snap->pages = realloc(snap->pages, snap->max_pages * sizeof(int));
+    CHECK_NOTNULL(snap->pages);
+  }
+
+  snap->pages[snap->num_pages++] = page;
+  ss_write(ss, data, SNAPSHOT_PAGE_SIZE);
+}
+
+static void snapshot_diff_memory(struct snapshots *snaps,
+                                 struct snapshot *snap, struct savestate *ss,
+                                 int first) {
+  struct memory *mem = snaps->dc->mem;
+  int offset = 0;
+
+  for (int i = 0; i < MEM_NUM_REGIONS; i++) {
+    int size;
+    uint8_t *ptr = mem_region(mem, i, &size);
+
+    if (first) {
+      memcpy(snaps->mem + offset, ptr, size);
+      offset += size;
+      continue;
+    }
+
+    for (int j = 0; j < size; j += SNAPSHOT_PAGE_SIZE) {
+      uint8_t *prev = snaps->mem + offset + j;
+
+      if (memcmp(prev, ptr + j, SNAPSHOT_PAGE_SIZE)) {
+        snapshot_add_page(snap, ss, (offset + j) / SNAPSHOT_PAGE_SIZE, prev);
+        memcpy(prev, ptr + j, SNAPSHOT_PAGE_SIZE);
+      }
+    }
+
+    offset += size;
+  }
+}
+
+int snapshots_take(struct snapshots *snaps) {
+  mutex_lock(snaps->mutex);
+
+  if (snaps->num_snapshots == snaps->max_snapshots) {
+    snapshots_drop_oldest(snaps);
+  }
+
+  mutex_unlock(snaps->mutex);
+
+  /* the slot isn't visible to the worker until the snapshot is added to the
+     ring, so it's safe to fill in without the mutex held */
+  struct snapshot *snap = snapshots_get(snaps, snaps->num_snapshots);
+
+  /* reuse the previous buffer in this slot unless it was replaced by a
+     packed one */
+  struct savestate ss = {0};
+
+  if (snap->state == SNAPSHOT_PACKED) {
+    free(snap->data);
+  } else {
+    ss.buffer = snap->data;
+    ss.capacity = snap->data_capacity;
+  }
+
+  dc_save_devices(snaps->dc, &ss);
+  snap->devices_size = ss.pos;
+  snap->num_pages = 0;
+
+  if (!ss.error) {
+    snapshot_diff_memory(snaps, snap, &ss, !snaps->mem_valid);
+    snaps->mem_valid = !ss.error;
+  }
+
+  snap->state = SNAPSHOT_QUEUED;
+  snap->data = ss.buffer;
+  snap->data_capacity = ss.capacity;
+  snap->data_size = ss.error ? 0 : ss.pos;
+  snap->raw_size = snap->data_size;
+
+  mutex_lock(snaps->mutex);
+
+  if (ss.error) {
+    /* memory may have been partially compared, leaving the memory copy out
+       of sync with the existing snapshots */
+    LOG_WARNING("snapshots_take failed to allocate snapshot");
+
+    while (snaps->num_snapshots) {
+      snapshots_drop_oldest(snaps);
+    }
+
+    mutex_unlock(snaps->mutex);
+    return 0;
+  }
+
+  snaps->num_snapshots++;
+  snaps->size += snapshot_size(snap);
+
+  /* stay within the size limit, always keeping the latest snapshot */
+  while (snaps->size > snaps->max_size && snaps->num_snapshots > 1) {
+    snapshots_drop_oldest(snaps);
+  }
+
+  if (snaps->thread) {
+    cond_signal(snaps->queued_cond);
+  } else {
+    snap->state = SNAPSHOT_RAW;
+  }
+
+  mutex_unlock(snaps->mutex);
+
+  return 1;
+}
+
+int snapshots_restore(struct snapshots *snaps, int n) {
+  int res = 0;
+
+  mutex_lock(snaps->mutex);
+
+  /* keep the worker from touching any snapshots while restoring */
+  while (snaps->packing) {
+    cond_wait(snaps->packed_cond, snaps->mutex);
+  }
+
+  if (n < 0 || n >= snaps->num_snapshots) {
+    goto done;
+  }
+
+  struct snapshot *target = snapshots_get(snaps, snaps->num_snapshots - 1 - n);
+  const uint8_t *data = snapshot_unpack(snaps, target);
+
+  if (!data || !dc_load_devices(snaps->dc, data, target->devices_size)) {
+    goto done;
+  }
+
+  /* roll the memory copy back through each newer snapshot */
+  while (n--) {
+    struct snapshot *snap = snapshots_get(snaps, snaps->num_snapshots - 1);
+    data = snapshot_unpack(snaps, snap);
+    CHECK_NOTNULL(data);
+    data += snap->devices_size;
+
+    for (int i = 0; i < snap->num_pages; i++) {
+      memcpy(snaps->mem + (size_t)snap->pages[i] * SNAPSHOT_PAGE_SIZE,
+             data + (size_t)i * SNAPSHOT_PAGE_SIZE, SNAPSHOT_PAGE_SIZE);
+    }
+
+    snaps->size -= snapshot_size(snap);
+    snaps->num_snapshots--;
+  }
+
+  /* only write the pages that differ, leaving any write watches on the rest
+     of guest memory intact */
+  struct memory *mem = snaps->dc->mem;
+  int offset = 0;
+
+  for (int i = 0; i < MEM_NUM_REGIONS; i++) {
+    int size;
+    uint8_t *ptr = mem_region(mem, i, &size);
+
+    for (int j = 0; j < size; j += SNAPSHOT_PAGE_SIZE) {
+      const uint8_t *prev = snaps->mem + offset + j;
+
+      if (memcmp(ptr + j, prev, SNAPSHOT_PAGE_SIZE)) {
+        memcpy(ptr + j, prev, SNAPSHOT_PAGE_SIZE);
+      }
+    }
+
+    offset += size;
+  }
+
+  res = 1;
+
+done:
+  mutex_unlock(snaps->mutex);
+
+  return res;
+}
+
+int64_t snapshots_size(struct snapshots *snaps) {
+  mutex_lock(snaps->mutex);
+  int64_t size = snaps->size;
+  mutex_unlock(snaps->mutex);
+
+  return size;
+}
+
+int snapshots_count(struct snapshots *snaps) {
+  mutex_lock(snaps->mutex);
+  int num_snapshots = snaps->num_snapshots;
+  mutex_unlock(snaps->mutex);
+
+  return num_snapshots;
+}
+
+void snapshots_destroy(struct snapshots *snaps) {
+  if (snaps->thread) {
+    mutex_lock(snaps->mutex);
+    snaps->shutdown = 1;
+    cond_signal(snaps->queued_cond);
+    mutex_unlock(snaps->mutex);
+
+    void *result;
+    thread_join(snaps->thread, &result);
+  }
+
+  for (int i = 0; snaps->ring && i < snaps->max_snapshots; i++) {
+    struct snapshot *snap = &snaps->ring[i];
+    free(snap->data);
+    free(snap->pages);
+  }
+
+  cond_destroy(snaps->packed_cond);
+  cond_destroy(snaps->queued_cond);
+  mutex_destroy(snaps->mutex);
+
+  free(snaps->scratch);
+  free(snaps->ring);
+  free(snaps->mem);
+  free(snaps);
+}
+
+struct snapshots *snapshots_create(struct dreamcast *dc, int max_snapshots,
+                                   int64_t max_size, int compress) {
+  struct snapshots *snaps = calloc(1, sizeof(struct snapshots));
+
+  snaps->dc = dc;
+  snaps->max_size = max_size;
+  snaps->max_snapshots = MAX(max_snapshots, 1);
+  snaps->ring = calloc(snaps->max_snapshots, sizeof(struct snapshot));
+  snaps->mutex = mutex_create();
+  snaps->queued_cond = cond_create();
+  snaps->packed_cond = cond_create();
+
+  for (int i = 0; i < MEM_NUM_REGIONS; i++) {
+    int size;
+    mem_region(dc->mem, i, &size);
+    snaps->mem_size += size;
+  }
+
+  snaps->mem = malloc(snaps->mem_size);
+
+  if (!snaps->ring || !snaps->mem) {
+    LOG_WARNING("snapshots_create failed to allocate %d snapshots",
+                max_snapshots);
+    snapshots_destroy(snaps);
+    return NULL;
+  }
+
+  if (compress) {
+    snaps->thread = thread_create(&snapshots_thread, "snapshots", snaps);
+    CHECK_NOTNULL(snaps->thread);
+  }
+
+  return snaps;
+}
@@ -0,0 +1,31 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+
+struct dreamcast;
+struct snapshots;
+
+/* at most max_snapshots are kept, as long as their combined size doesn't
+   exceed max_size bytes. when compress is set, snapshots are compressed in
+   the background after being taken */
+struct snapshots *snapshots_create(struct dreamcast *dc, int max_snapshots,
+                                   int64_t max_size, int compress);
+void snapshots_destroy(struct snapshots *snaps);
+
+int snapshots_count(struct snapshots *snaps);
+
+/* bytes held by the retained snapshots, excluding the copy of guest memory.
+   shrinks as snapshots are compressed in the background */
+int64_t snapshots_size(struct snapshots *snaps);
+
+/* snapshots follow the same rules as states, they must be taken and restored
+   after dc_load and between calls to dc_tick. once either limit is reached,
+   the oldest snapshots are dropped to make room for each new one */
+int snapshots_take(struct snapshots *snaps);
+
+/* restore the snapshot taken n snapshots ago, 0 being the latest. snapshots
+   newer than it are dropped */
+int snapshots_restore(struct snapshots *snaps, int n);
+
+#endif
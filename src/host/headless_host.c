@@ -0,0 +1,795 @@
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <errno.h>
+#include <glad/glad.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "core/core.h"
+#include "core/filesystem.h"
+#include "core/task_pool.h"
+#include "core/version.h"
+#include "emulator.h"
+#include "host/host.h"
+#include "options.h"
+#include "render/render_backend.h"
+
+/* frames are read back through a ring of pixel buffers, so the readback of one
+   frame overlaps rendering the next ones instead of stalling on the gpu */
+#define NUM_READBACKS 3
+
+/* frames are rendered directly into a ring of targets shared with the
+   encoder, which holds on to each one until it's done encoding it */
+#define NUM_TARGETS 4
+
+DEFINE_OPTION_INT(width, 640, "Width of the offscreen framebuffer");
+DEFINE_OPTION_INT(height, 480, "Height of the offscreen framebuffer");
+DEFINE_OPTION_INT(frames, 0, "Exit after rendering this many frames");
+DEFINE_OPTION_INT(egl_device, -1,
+                  "EGL device to render on, or -1 for the default");
+DEFINE_OPTION_STRING(frame_output, "",
+                     "File or fifo to stream raw rgba frames to");
+DEFINE_OPTION_STRING(frame_sink, "",
+                     "Unix socket of an encoder to share frames with");
+
+/*
+ * frame sink protocol. rather than reading frames back, the render targets
+ * are exported as dma-bufs and handed to a hardware encoder process (e.g. a
+ * vaapi or nvenc pipeline importing them) listening on the frame_sink socket.
+ * each target's buffer is sent once with SINK_BUFFER, its file descriptor
+ * attached as SCM_RIGHTS. then, for each frame, SINK_FRAME says which buffer
+ * it was rendered to and the guest time it was presented at. buffers are
+ * rendered bottom up, as gl does. the encoder gives a buffer back by writing
+ * its index as a uint32_t once done with it, until then it isn't rendered to
+ */
+enum {
+  SINK_BUFFER,
+  SINK_FRAME,
+};
+
+struct sink_msg {
+  uint32_t type;
+  uint32_t index;
+  /* SINK_BUFFER */
+  uint32_t width;
+  uint32_t height;
+  uint32_t fourcc;
+  uint32_t stride;
+  uint32_t offset;
+  uint32_t reserved;
+  uint64_t modifier;
+  /* SINK_FRAME, guest time in nanoseconds */
+  int64_t time;
+};
+
+struct target {
+  GLuint fbo;
+  GLuint tex;
+  GLsync fence;
+  int64_t time;
+  /* set from when the target is rendered to until the encoder gives it back */
+  int busy;
+};
+
+struct readback {
+  GLuint pbo;
+  GLsync fence;
+};
+
+struct host {
+  struct emu *emu;
+
+  struct {
+    EGLDisplay display;
+    EGLContext ctx;
+    EGLSurface surface;
+    struct render_backend *r;
+    int width;
+    int height;
+
+    GLuint depth_rb;
+    struct target targets[NUM_TARGETS];
+    int num_targets;
+    int target;
+
+    struct readback readbacks[NUM_READBACKS];
+    int readback_head;
+    int readback_tail;
+    uint8_t *frame;
+    FILE *output;
+
+    int sink;
+    /* target rendered to last, sent to the sink once the gpu is done with it */
+    int sink_pending;
+  } video;
+
+  int closed;
+};
+
+/*
+ * audio
+ */
+void audio_push(struct host *host, const int16_t *data, int frames) {}
+
+int16_t *audio_reserve(struct host *host, int frames) {
+  return NULL;
+}
+
+void audio_commit(struct host *host, int frames) {}
+
+int audio_buffered(struct host *host) {
+  /* there's no audio device to sync against, emulation runs unthrottled */
+  return 0;
+}
+
+/*
+ * input
+ */
+void input_poll(struct host *host) {}
+
+int input_max_controllers(struct host *host) {
+  return 0;
+}
+
+const char *input_controller_name(struct host *host, int port) {
+  return "";
+}
+
+/*
+ * ui
+ */
+void ui_closed(struct host *host) {}
+
+void ui_opened(struct host *host) {}
+
+int ui_load_game(struct host *host, const char *path) {
+  return emu_load(host->emu, path);
+}
+
+/*
+ * video
+ */
+static void video_write_frame(struct host *host) {
+  struct readback *rb =
+      &host->video.readbacks[host->video.readback_tail % NUM_READBACKS];
+  int width = host->video.width;
+  int height = host->video.height;
+  int stride = width * 4;
+
+  glClientWaitSync(rb->fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+  glDeleteSync(rb->fence);
+  rb->fence = NULL;
+
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, rb->pbo);
+  const uint8_t *pixels =
+      glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, stride * height,
+                       GL_MAP_READ_BIT);
+
+  /* gl's origin is the bottom left, frames are written out top down */
+  if (pixels) {
+    for (int y = 0; y < height; y++) {
+      memcpy(host->video.frame + y * stride,
+             pixels + (height - 1 - y) * stride, stride);
+    }
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+  }
+
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+  host->video.readback_tail++;
+
+  if (pixels && host->video.output) {
+    fwrite(host->video.frame, stride, height, host->video.output);
+    fflush(host->video.output);
+  }
+}
+
+static void video_read_frame(struct host *host, struct target *t) {
+  if (!host->video.output) {
+    return;
+  }
+
+  /* only wait on the oldest readback once the ring is full */
+  if (host->video.readback_head - host->video.readback_tail ==
+      NUM_READBACKS) {
+    video_write_frame(host);
+  }
+
+  struct readback *rb =
+      &host->video.readbacks[host->video.readback_head % NUM_READBACKS];
+
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, t->fbo);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, rb->pbo);
+  glReadPixels(0, 0, host->video.width, host->video.height, GL_RGBA,
+               GL_UNSIGNED_BYTE, NULL);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  rb->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+  host->video.readback_head++;
+}
+
+static void video_flush_frames(struct host *host) {
+  while (host->video.readback_tail != host->video.readback_head) {
+    video_write_frame(host);
+  }
+}
+
+static int sink_send(struct host *host, struct sink_msg *msg, int fd) {
+  struct iovec iov = {msg, sizeof(*msg)};
+  char control[CMSG_SPACE(sizeof(int))] = {0};
+  struct msghdr hdr = {0};
+  hdr.msg_iov = &iov;
+  hdr.msg_iovlen = 1;
+
+  if (fd >= 0) {
+    hdr.msg_control = control;
+    hdr.msg_controllen = sizeof(control);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+  }
+
+  if (sendmsg(host->video.sink, &hdr, MSG_NOSIGNAL) != sizeof(*msg)) {
+    LOG_WARNING("sink_send encoder disconnected");
+    host->closed = 1;
+    return 0;
+  }
+
+  return 1;
+}
+
+/* reads back the buffers the encoder is done with, waiting for at least one
+   when block is set */
+static void sink_recv(struct host *host, int block) {
+  uint32_t indices[NUM_TARGETS];
+  int n = (int)recv(host->video.sink, indices, sizeof(indices),
+                    block ? 0 : MSG_DONTWAIT);
+
+  if (n < 0 && !block && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+    return;
+  }
+
+  if (n <= 0 || n % sizeof(uint32_t)) {
+    LOG_WARNING("sink_recv encoder disconnected");
+    host->closed = 1;
+    return;
+  }
+
+  for (int i = 0; i < n / (int)sizeof(uint32_t); i++) {
+    if (indices[i] < NUM_TARGETS) {
+      host->video.targets[indices[i]].busy = 0;
+    }
+  }
+}
+
+static void sink_send_frame(struct host *host, int index) {
+  struct target *t = &host->video.targets[index];
+
+  /* the encoder reads the buffer straight from the gpu, only wait for the
+     rendering to have finished */
+  glClientWaitSync(t->fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+  glDeleteSync(t->fence);
+  t->fence = NULL;
+
+  struct sink_msg msg = {0};
+  msg.type = SINK_FRAME;
+  msg.index = index;
+  msg.time = t->time;
+  sink_send(host, &msg, -1);
+}
+
+static void sink_push_frame(struct host *host, int index) {
+  if (host->video.sink < 0) {
+    return;
+  }
+
+  struct target *t = &host->video.targets[index];
+  t->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  t->time = emu_frame_time(host->emu);
+  t->busy = 1;
+
+  /* hand off the previous frame while the gpu works on this one */
+  if (host->video.sink_pending >= 0) {
+    sink_send_frame(host, host->video.sink_pending);
+  }
+
+  host->video.sink_pending = index;
+}
+
+static void sink_flush_frames(struct host *host) {
+  if (host->video.sink_pending >= 0 && !host->closed) {
+    sink_send_frame(host, host->video.sink_pending);
+  }
+
+  host->video.sink_pending = -1;
+}
+
+static int sink_export_targets(struct host *host) {
+  const char *exts = eglQueryString(host->video.display, EGL_EXTENSIONS);
+
+  if (!exts || !strstr(exts, "EGL_KHR_gl_texture_2D_image") ||
+      !strstr(exts, "EGL_MESA_image_dma_buf_export")) {
+    LOG_WARNING("sink_export_targets dma-buf export isn't supported");
+    return 0;
+  }
+
+  PFNEGLCREATEIMAGEKHRPROC create_image =
+      (PFNEGLCREATEIMAGEKHRPROC)eglGetProcAddress("eglCreateImageKHR");
+  PFNEGLDESTROYIMAGEKHRPROC destroy_image =
+      (PFNEGLDESTROYIMAGEKHRPROC)eglGetProcAddress("eglDestroyImageKHR");
+  PFNEGLEXPORTDMABUFIMAGEQUERYMESAPROC export_query =
+      (PFNEGLEXPORTDMABUFIMAGEQUERYMESAPROC)eglGetProcAddress(
+          "eglExportDMABUFImageQueryMESA");
+  PFNEGLEXPORTDMABUFIMAGEMESAPROC export_image =
+      (PFNEGLEXPORTDMABUFIMAGEMESAPROC)eglGetProcAddress(
+          "eglExportDMABUFImageMESA");
+
+  for (int i = 0; i < host->video.num_targets; i++) {
+    struct target *t = &host->video.targets[i];
+    EGLImageKHR image = create_image(host->video.display, host->video.ctx,
+                                     EGL_GL_TEXTURE_2D_KHR,
+                                     (EGLClientBuffer)(uintptr_t)t->tex, NULL);
+
+    if (image == EGL_NO_IMAGE_KHR) {
+      LOG_WARNING("sink_export_targets failed to create image");
+      return 0;
+    }
+
+    int fourcc = 0, num_planes = 0, fd = -1;
+    EGLuint64KHR modifier = 0;
+    EGLint stride = 0, offset = 0;
+
+    /* the buffer remains valid after the image is destroyed, it's owned by
+       the texture and the exported file descriptor */
+    int res = export_query(host->video.display, image, &fourcc, &num_planes,
+                           &modifier) &&
+              num_planes == 1 &&
+              export_image(host->video.display, image, &fd, &stride, &offset);
+    destroy_image(host->video.display, image);
+
+    if (!res) {
+      LOG_WARNING("sink_export_targets failed to export image");
+      return 0;
+    }
+
+    struct sink_msg msg = {0};
+    msg.type = SINK_BUFFER;
+    msg.index = i;
+    msg.width = host->video.width;
+    msg.height = host->video.height;
+    msg.fourcc = fourcc;
+    msg.stride = stride;
+    msg.offset = offset;
+    msg.modifier = modifier;
+    res = sink_send(host, &msg, fd);
+    close(fd);
+
+    if (!res) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+static void sink_destroy(struct host *host) {
+  if (host->video.sink >= 0) {
+    close(host->video.sink);
+  }
+}
+
+static int sink_create(struct host *host) {
+  host->video.sink = -1;
+  host->video.sink_pending = -1;
+
+  if (!*OPTION_frame_sink) {
+    return 1;
+  }
+
+  struct sockaddr_un addr = {0};
+  addr.sun_family = AF_UNIX;
+  snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", OPTION_frame_sink);
+
+  host->video.sink = socket(AF_UNIX, SOCK_STREAM, 0);
+
+  if (host->video.sink < 0 ||
+      connect(host->video.sink, (struct sockaddr *)&addr, sizeof(addr))) {
+    LOG_WARNING("sink_create failed to connect to %s", OPTION_frame_sink);
+    return 0;
+  }
+
+  return 1;
+}
+
+static struct target *video_next_target(struct host *host) {
+  struct target *t = &host->video.targets[host->video.target];
+
+  if (host->video.sink >= 0) {
+    sink_recv(host, 0);
+
+    while (t->busy && !host->closed) {
+      sink_recv(host, 1);
+    }
+  }
+
+  return t;
+}
+
+static void video_destroy_framebuffer(struct host *host) {
+  for (int i = 0; i < NUM_READBACKS; i++) {
+    struct readback *rb = &host->video.readbacks[i];
+
+    if (rb->fence) {
+      glDeleteSync(rb->fence);
+    }
+
+    glDeleteBuffers(1, &rb->pbo);
+  }
+
+  for (int i = 0; i < host->video.num_targets; i++) {
+    struct target *t = &host->video.targets[i];
+
+    if (t->fence) {
+      glDeleteSync(t->fence);
+    }
+
+    glDeleteFramebuffers(1, &t->fbo);
+    glDeleteTextures(1, &t->tex);
+  }
+
+  glDeleteRenderbuffers(1, &host->video.depth_rb);
+
+  free(host->video.frame);
+}
+
+static int video_create_framebuffer(struct host *host) {
+  int width = host->video.width;
+  int height = host->video.height;
+
+  /* 24-bit depth for the same reasons the windowed host requests it. the
+     depth buffer is shared between the targets, as it isn't encoded */
+  glGenRenderbuffers(1, &host->video.depth_rb);
+  glBindRenderbuffer(GL_RENDERBUFFER, host->video.depth_rb);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+  glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+  /* a single target is enough when nothing else is reading from them */
+  host->video.num_targets = host->video.sink >= 0 ? NUM_TARGETS : 1;
+
+  for (int i = 0; i < host->video.num_targets; i++) {
+    struct target *t = &host->video.targets[i];
+
+    glGenTextures(1, &t->tex);
+    glBindTexture(GL_TEXTURE_2D, t->tex);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA,
+                 GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glGenFramebuffers(1, &t->fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, t->fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                           t->tex, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT,
+                              GL_RENDERBUFFER, host->video.depth_rb);
+
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+      LOG_WARNING("video_create_framebuffer incomplete framebuffer 0x%x",
+                  status);
+      return 0;
+    }
+  }
+
+  for (int i = 0; i < NUM_READBACKS; i++) {
+    struct readback *rb = &host->video.readbacks[i];
+
+    glGenBuffers(1, &rb->pbo);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, rb->pbo);
+    glBufferData(GL_PIXEL_PACK_BUFFER, width * height * 4, NULL,
+                 GL_STREAM_READ);
+  }
+
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+  host->video.frame = malloc(width * height * 4);
+
+  return 1;
+}
+
+static EGLDisplay video_get_display() {
+  const char *exts = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+
+  if (!exts) {
+    return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+  }
+
+  PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+      (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress(
+          "eglGetPlatformDisplayEXT");
+
+  /* pick a specific gpu, letting instances on a multi-gpu server be spread
+     across them. any number of instances can share the same device */
+  if (OPTION_egl_device >= 0 && get_platform_display &&
+      strstr(exts, "EGL_EXT_platform_device")) {
+    PFNEGLQUERYDEVICESEXTPROC query_devices =
+        (PFNEGLQUERYDEVICESEXTPROC)eglGetProcAddress("eglQueryDevicesEXT");
+    EGLDeviceEXT devices[16];
+    EGLint num_devices = 0;
+
+    if (query_devices &&
+        query_devices(ARRAY_SIZE(devices), devices, &num_devices) &&
+        OPTION_egl_device < num_devices) {
+      return get_platform_display(EGL_PLATFORM_DEVICE_EXT,
+                                  devices[OPTION_egl_device], NULL);
+    }
+
+    LOG_WARNING("video_get_display egl device %d not found, %d available",
+                OPTION_egl_device, num_devices);
+  }
+
+  /* render without any window system */
+  if (get_platform_display && strstr(exts, "EGL_MESA_platform_surfaceless")) {
+    EGLDisplay display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA,
+                                              EGL_DEFAULT_DISPLAY, NULL);
+
+    if (display != EGL_NO_DISPLAY) {
+      return display;
+    }
+  }
+
+  return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+static void video_destroy_context(struct host *host) {
+  eglMakeCurrent(host->video.display, EGL_NO_SURFACE, EGL_NO_SURFACE,
+                 EGL_NO_CONTEXT);
+
+  if (host->video.surface != EGL_NO_SURFACE) {
+    eglDestroySurface(host->video.display, host->video.surface);
+  }
+
+  if (host->video.ctx != EGL_NO_CONTEXT) {
+    eglDestroyContext(host->video.display, host->video.ctx);
+  }
+
+  eglTerminate(host->video.display);
+}
+
+static int video_create_context(struct host *host) {
+  host->video.display = video_get_display();
+  host->video.ctx = EGL_NO_CONTEXT;
+  host->video.surface = EGL_NO_SURFACE;
+
+  if (host->video.display == EGL_NO_DISPLAY ||
+      !eglInitialize(host->video.display, NULL, NULL)) {
+    LOG_WARNING("video_create_context failed to initialize egl display");
+    return 0;
+  }
+
+  if (!eglBindAPI(EGL_OPENGL_API)) {
+    LOG_WARNING("video_create_context failed to bind opengl api");
+    return 0;
+  }
+
+  static const EGLint config_attrs[] = {EGL_SURFACE_TYPE,
+                                        EGL_PBUFFER_BIT,
+                                        EGL_RENDERABLE_TYPE,
+                                        EGL_OPENGL_BIT,
+                                        EGL_NONE};
+  EGLConfig config;
+  EGLint num_configs = 0;
+
+  if (!eglChooseConfig(host->video.display, config_attrs, &config, 1,
+                       &num_configs) ||
+      !num_configs) {
+    LOG_WARNING("video_create_context failed to choose config");
+    return 0;
+  }
+
+  static const EGLint ctx_attrs[] = {EGL_CONTEXT_MAJOR_VERSION,
+                                     3,
+                                     EGL_CONTEXT_MINOR_VERSION,
+                                     3,
+                                     EGL_CONTEXT_OPENGL_PROFILE_MASK,
+                                     EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+                                     EGL_NONE};
+
+  host->video.ctx = eglCreateContext(host->video.display, config,
+                                     EGL_NO_CONTEXT, ctx_attrs);
+
+  if (host->video.ctx == EGL_NO_CONTEXT) {
+    LOG_WARNING("video_create_context failed to create context");
+    return 0;
+  }
+
+  /* everything is rendered to the offscreen framebuffer, a surface is only
+     created for drivers which can't make a context current without one */
+  const char *exts = eglQueryString(host->video.display, EGL_EXTENSIONS);
+
+  if (!exts || !strstr(exts, "EGL_KHR_surfaceless_context")) {
+    static const EGLint surface_attrs[] = {EGL_WIDTH, 1, EGL_HEIGHT, 1,
+                                           EGL_NONE};
+    host->video.surface =
+        eglCreatePbufferSurface(host->video.display, config, surface_attrs);
+  }
+
+  if (!eglMakeCurrent(host->video.display, host->video.surface,
+                      host->video.surface, host->video.ctx)) {
+    LOG_WARNING("video_create_context failed to make context current");
+    return 0;
+  }
+
+  /* link in gl functions at runtime */
+  int res = gladLoadGLLoader((GLADloadproc)&eglGetProcAddress);
+  CHECK_EQ(res, 1, "video_create_context failed to link");
+
+  return 1;
+}
+
+static void video_shutdown(struct host *host) {
+  video_flush_frames(host);
+  sink_flush_frames(host);
+
+  if (host->video.output) {
+    fclose(host->video.output);
+  }
+
+  if (host->emu) {
+    emu_vid_destroyed(host->emu);
+  }
+
+  r_destroy(host->video.r);
+
+  video_destroy_framebuffer(host);
+  video_destroy_context(host);
+  sink_destroy(host);
+}
+
+static int video_init(struct host *host) {
+  host->video.width = OPTION_width;
+  host->video.height = OPTION_height;
+
+  if (!sink_create(host) || !video_create_context(host) ||
+      !video_create_framebuffer(host)) {
+    return 0;
+  }
+
+  if (host->video.sink >= 0 && !sink_export_targets(host)) {
+    return 0;
+  }
+
+  if (*OPTION_frame_output) {
+    host->video.output = fopen(OPTION_frame_output, "wb");
+
+    if (!host->video.output) {
+      LOG_WARNING("video_init failed to open %s", OPTION_frame_output);
+      return 0;
+    }
+  }
+
+  host->video.r = r_create(host->video.width, host->video.height);
+
+  if (host->emu) {
+    emu_vid_created(host->emu, host->video.r);
+  }
+
+  LOG_INFO("video_init %dx%d on %s", host->video.width, host->video.height,
+           glGetString(GL_RENDERER));
+
+  return 1;
+}
+
+/*
+ * internal
+ */
+static void host_shutdown(struct host *host) {
+  video_shutdown(host);
+}
+
+static int host_init(struct host *host) {
+  return video_init(host);
+}
+
+static int host_render_frame(struct host *host) {
+  struct target *t = video_next_target(host);
+
+  if (host->closed) {
+    return 0;
+  }
+
+  glBindFramebuffer(GL_FRAMEBUFFER, t->fbo);
+
+  int rendered = emu_render_frame(host->emu);
+
+  if (rendered) {
+    video_read_frame(host, t);
+    sink_push_frame(host, host->video.target);
+
+    host->video.target = (host->video.target + 1) % host->video.num_targets;
+  }
+
+  return rendered;
+}
+
+static void host_init_worker_thread() {
+  configure_thread(THREAD_ROLE_WORKER);
+}
+
+static void host_destroy(struct host *host) {
+  free(host);
+}
+
+static struct host *host_create() {
+  struct host *host = calloc(1, sizeof(struct host));
+  return host;
+}
+
+int main(int argc, char **argv) {
+  LOG_INFO("redream " GIT_VERSION);
+
+  char userdir[PATH_MAX];
+  int r = fs_userdir(userdir, sizeof(userdir));
+  CHECK(r);
+
+  char appdir[PATH_MAX];
+  snprintf(appdir, sizeof(appdir), "%s" PATH_SEPARATOR ".redream", userdir);
+  fs_set_appdir(appdir);
+
+  /* load base options from config. the config is never written back, as any
+     number of instances may be sharing it */
+  char config[PATH_MAX] = {0};
+  snprintf(config, sizeof(config), "%s" PATH_SEPARATOR "config", appdir);
+  options_read(config);
+
+  /* override options from the command line */
+  if (!options_parse(&argc, &argv)) {
+    return EXIT_FAILURE;
+  }
+
+  if (argc < 2 && !OPTION_bios) {
+    LOG_INFO("usage: redream_headless [options] <game>");
+    return EXIT_FAILURE;
+  }
+
+  log_set_async(OPTION_log_async);
+
+  /* the main thread drives the video output */
+  configure_thread(THREAD_ROLE_VIDEO);
+
+  /* create the shared task pool up front so its workers are configured */
+  task_pool_init_shared(-1, &host_init_worker_thread);
+
+  const char *load = argc > 1 ? argv[1] : NULL;
+  struct host *host = host_create();
+  host->emu = emu_create(host);
+
+  int res = EXIT_FAILURE;
+
+  if (host_init(host)) {
+    if (emu_load(host->emu, load)) {
+      int frames = 0;
+
+      while (!host->closed && (!OPTION_frames || frames < OPTION_frames)) {
+        frames += host_render_frame(host);
+      }
+
+      res = EXIT_SUCCESS;
+    }
+
+    host_shutdown(host);
+  }
+
+  emu_destroy(host->emu);
+  host_destroy(host);
+
+  return res;
+}
@@ -7,10 +7,15 @@ struct host;
 
 /* audio */
 void audio_push(struct host *host, const int16_t *data, int frames);
+int16_t *audio_reserve(struct host *host, int frames);
+void audio_commit(struct host *host, int frames);
+/* frames waiting to be played, safe to call from any thread */
+int audio_buffered(struct host *host);
 
 /* video */
 
 /* input */
+void input_poll(struct host *host);
 int input_max_controllers(struct host *host);
 const char *input_controller_name(struct host *host, int port);
 
@@ -6,6 +6,16 @@
  */
 void audio_push(struct host *base, const int16_t *data, int num_frames) {}
 
+int16_t *audio_reserve(struct host *base, int num_frames) {
+  return NULL;
+}
+
+void audio_commit(struct host *base, int num_frames) {}
+
+int audio_buffered(struct host *base) {
+  return 0;
+}
+
 /*
  * video
  */
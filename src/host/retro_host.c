@@ -4,16 +4,27 @@
 #include <stdlib.h>
 #include "core/core.h"
 #include "core/filesystem.h"
+#include "core/ringbuf.h"
 #include "emulator.h"
 #include "guest/aica/aica.h"
 #include "host/host.h"
 #include "options.h"
 #include "render/render_backend.h"
+#include "stats.h"
 
 #define AUDIO_FREQ AICA_SAMPLE_FREQ
+#define AUDIO_FRAME_SIZE 4 /* stereo / pcm16 */
 #define VIDEO_WIDTH 640
 #define VIDEO_HEIGHT 480
 
+/* newer than the bundled libretro.h, lets the frontend say when a frame's
+   audio or video won't be used, e.g. the frames ran ahead of the displayed
+   one */
+#ifndef RETRO_ENVIRONMENT_GET_AUDIO_VIDEO_ENABLE
+#define RETRO_ENVIRONMENT_GET_AUDIO_VIDEO_ENABLE \
+  (47 | RETRO_ENVIRONMENT_EXPERIMENTAL)
+#endif
+
 static struct retro_hw_render_callback hw_render;
 static retro_environment_t env_cb;
 static retro_audio_sample_t audio_cb;
@@ -82,9 +93,20 @@ struct host {
     struct render_backend *r;
   } video;
 
+  struct {
+    /* audio is produced on the emulation thread, but the frontend only
+       accepts it from the thread calling retro_run. it's queued up here and
+       handed off at the end of each call */
+    struct ringbuf *frames;
+  } audio;
+
   struct {
     int16_t state[NUM_CONTROLLER_DESC];
   } input;
+
+  /* size reported to the frontend for save states, computed once as it must
+     not change between calls */
+  int64_t state_size;
 };
 
 struct host *g_host;
@@ -93,13 +115,53 @@ struct host *g_host;
  * audio
  */
 void audio_push(struct host *host, const int16_t *data, int frames) {
-  audio_batch_cb(data, frames);
+  int remaining = ringbuf_remaining(host->audio.frames);
+  int size = MIN(remaining, frames * AUDIO_FRAME_SIZE);
+  size = ALIGN_DOWN(size, AUDIO_FRAME_SIZE);
+
+  void *write_ptr = ringbuf_write_ptr(host->audio.frames);
+  memcpy(write_ptr, data, size);
+  ringbuf_advance_write_ptr(host->audio.frames, size);
+}
+
+int16_t *audio_reserve(struct host *host, int frames) {
+  int remaining = ringbuf_remaining(host->audio.frames);
+
+  if (remaining < frames * AUDIO_FRAME_SIZE) {
+    return NULL;
+  }
+
+  return ringbuf_write_ptr(host->audio.frames);
+}
+
+void audio_commit(struct host *host, int frames) {
+  ringbuf_advance_write_ptr(host->audio.frames, frames * AUDIO_FRAME_SIZE);
+}
+
+static void audio_flush(struct host *host, int enabled) {
+  int available = ringbuf_available(host->audio.frames);
+  int frames = available / AUDIO_FRAME_SIZE;
+
+  if (!frames) {
+    return;
+  }
+
+  if (enabled) {
+    audio_batch_cb(ringbuf_read_ptr(host->audio.frames), frames);
+  }
+
+  ringbuf_advance_read_ptr(host->audio.frames, frames * AUDIO_FRAME_SIZE);
+}
+
+int audio_buffered(struct host *host) {
+  /* the frontend owns the audio buffer */
+  return 0;
 }
 
 /*
  * input
  */
-static void input_poll(struct host *host) {
+void input_poll(struct host *host) {
   input_poll_cb();
 
   /* send updates for any inputs that've changed */
@@ -178,11 +240,15 @@ static int host_init(struct host *host) {
 }
 
 static void host_destroy(struct host *host) {
+  ringbuf_destroy(host->audio.frames);
+  prof_counter_add(COUNTER_mem_audio, -AUDIO_FREQ * AUDIO_FRAME_SIZE);
   free(host);
 }
 
 struct host *host_create() {
   struct host *host = calloc(1, sizeof(struct host));
+  host->audio.frames = ringbuf_create(AUDIO_FREQ * AUDIO_FRAME_SIZE);
+  prof_counter_add(COUNTER_mem_audio, AUDIO_FREQ * AUDIO_FRAME_SIZE);
   return host;
 }
 
@@ -260,27 +326,60 @@ void retro_reset() {}
 void retro_run() {
   input_poll(g_host);
 
+  /* frames ran ahead of the displayed one are never shown, and their audio is
+     dropped. bit 0 enables video, bit 1 audio */
+  int av_enable = 3;
+  if (!env_cb(RETRO_ENVIRONMENT_GET_AUDIO_VIDEO_ENABLE, &av_enable)) {
+    av_enable = 3;
+  }
+
+  if (!(av_enable & 1)) {
+    emu_hide_frame(g_host->emu);
+  }
+
   /* bind the framebuffer provided by retroarch before calling into the
      emulator */
   uintptr_t fb = hw_render.get_current_framebuffer();
   glBindFramebuffer(GL_FRAMEBUFFER, fb);
 
-  emu_render_frame(g_host->emu);
+  int rendered = emu_render_frame(g_host->emu);
+
+  audio_flush(g_host, av_enable & 2);
 
-  /* call back into retroarch, letting it know a frame has been rendered */
-  video_cb(RETRO_HW_FRAME_BUFFER_VALID, VIDEO_WIDTH, VIDEO_HEIGHT, 0);
+  /* call back into retroarch, letting it know a frame has been rendered. when
+     skipped, the previous frame is duplicated */
+  video_cb(rendered ? RETRO_HW_FRAME_BUFFER_VALID : NULL, VIDEO_WIDTH,
+           VIDEO_HEIGHT, 0);
 }
 
 size_t retro_serialize_size() {
-  return 0;
+  if (!g_host || !g_host->emu) {
+    return 0;
+  }
+
+  if (!g_host->state_size) {
+    g_host->state_size = emu_state_max_size(g_host->emu);
+  }
+
+  return (size_t)g_host->state_size;
 }
 
 bool retro_serialize(void *data, size_t size) {
-  return false;
+  if (!g_host || !g_host->emu) {
+    return false;
+  }
+
+  /* the state is written straight into the frontend's buffer, which is
+     called for every frame when running ahead or rewinding */
+  return emu_save_state_buffer(g_host->emu, data, (int64_t)size) > 0;
 }
 
 bool retro_unserialize(const void *data, size_t size) {
-  return false;
+  if (!g_host || !g_host->emu) {
+    return false;
+  }
+
+  return emu_load_state_buffer(g_host->emu, data, (int64_t)size);
 }
 
 void retro_cheat_reset() {}
@@ -301,6 +400,11 @@ bool retro_load_game(const struct retro_game_info *info) {
     return false;
   }
 
+  /* states are the devices' structs written out as-is */
+  uint64_t quirks = RETRO_SERIALIZATION_QUIRK_ENDIAN_DEPENDENT |
+                    RETRO_SERIALIZATION_QUIRK_PLATFORM_DEPENDENT;
+  env_cb(RETRO_ENVIRONMENT_SET_SERIALIZATION_QUIRKS, &quirks);
+
   return emu_load(g_host->emu, info->path);
 }
 
@@ -4,7 +4,10 @@
 #include "core/core.h"
 #include "core/filesystem.h"
 #include "core/profiler.h"
+#include "core/resampler.h"
 #include "core/ringbuf.h"
+#include "core/task_pool.h"
+#include "core/thread.h"
 #include "core/time.h"
 #include "core/version.h"
 #include "emulator.h"
@@ -13,6 +16,7 @@
 #include "imgui.h"
 #include "options.h"
 #include "render/render_backend.h"
+#include "stats.h"
 #include "tracer.h"
 #include "ui.h"
 
@@ -25,10 +29,26 @@
 #define INPUT_MAX_CONTROLLERS 4
 
 #define AUDIO_FRAME_SIZE 4 /* stereo / pcm16 */
-#define AUDIO_FRAMES_TO_MS(frames) \
-  (int)(((float)frames * 1000.0f) / (float)AUDIO_FREQ)
-#define MS_TO_AUDIO_FRAMES(ms) (int)(((float)(ms) / 1000.0f) * AUDIO_FREQ)
-#define NS_TO_AUDIO_FRAMES(ns) (int)(((float)(ns) / NS_PER_SEC) * AUDIO_FREQ)
+#define AUDIO_FRAMES_TO_MS(frames, freq) \
+  (int)(((float)frames * 1000.0f) / (float)(freq))
+#define MS_TO_AUDIO_FRAMES(ms, freq) (int)(((float)(ms) / 1000.0f) * (freq))
+#define NS_TO_AUDIO_FRAMES(ns, freq) \
+  (int)(((float)(ns) / NS_PER_SEC) * (freq))
+
+/* device buffer sizes in frames, SDL expects these to be a power of two */
+#define AUDIO_DEFAULT_SAMPLES (1 << 12)
+#define AUDIO_LOW_LATENCY_SAMPLES (1 << 9)
+
+/* in low latency mode, the rate at which frames are written to the ring
+   buffer is adjusted by up to this fraction to keep it at its target fill */
+#define AUDIO_DRC_MAX_DELTA 0.005
+
+/* input frames resampled per pass, bounding the size of the output */
+#define AUDIO_RESAMPLE_FRAMES 256
+
+/* upper bound on how long the main loop sleeps waiting on the audio buffer
+   to drain, so it keeps polling for events */
+#define AUDIO_MAX_WAIT_MS 8
 
 struct host {
   struct SDL_Window *win;
@@ -45,6 +65,20 @@ struct host {
     int playing;
     struct ringbuf *frames;
     volatile int64_t last_cb;
+    /* signalled by the callback each time it drains the ring buffer */
+    mutex_t mutex;
+    cond_t drained;
+    /* set by the callback the first time it runs on sdl's audio thread */
+    int thread_configured;
+
+    /* converts frames from the guest's rate to the device's, created when
+       they differ or when in low latency mode */
+    struct resampler *resampler;
+
+    /* dynamic rate control state for low latency mode */
+    int low_latency;
+    int target_frames;
+    double rate;
   } audio;
 
   struct {
@@ -59,9 +93,23 @@ struct host {
     SDL_GameController *controllers[INPUT_MAX_CONTROLLERS];
   } input;
 
+  /* when pacing frames, the start of each frame is delayed such that it's
+     ready just before the next present, rather than ready early and waiting
+     on the swap. the present interval and the time taken to produce a frame
+     are measured rather than assumed, as vrr and high refresh rate displays
+     don't present at the guest's rate */
+  struct {
+    int64_t frame_start;
+    int64_t last_present;
+    int64_t interval;
+    int64_t work;
+    int64_t delay;
+  } pacer;
+
   struct {
     int show_menu;
     int show_times;
+    int show_audio;
     unsigned frame;
     float swap_times[360];
     int64_t last_swap;
@@ -99,8 +147,54 @@ static int audio_buffered_frames(struct host *host) {
   return buffered / AUDIO_FRAME_SIZE;
 }
 
+static int audio_estimated_frames(struct host *host) {
+  /* see audio_buffer_low for why the host clock is used to interpolate the
+     amount of buffered data between callbacks */
+  int64_t now = time_nanoseconds();
+  int64_t since_last_cb = now - host->audio.last_cb;
+  int frames_buffered = audio_buffered_frames(host);
+  frames_buffered -= NS_TO_AUDIO_FRAMES(since_last_cb, host->audio.spec.freq);
+  return MAX(frames_buffered, 0);
+}
+
+static int audio_latency_ms(struct host *host) {
+  /* frames queued in the ring buffer must first drain through the device's
+     own buffer before they're heard */
+  int frames = audio_estimated_frames(host) + host->audio.spec.samples;
+  return AUDIO_FRAMES_TO_MS(frames, host->audio.spec.freq);
+}
+
+static void audio_write_resampled(struct host *host, const int16_t *data,
+                                  int num_frames) {
+  /* rather than stalling or dropping frames when the ring buffer drifts from
+     its target fill, nudge the rate frames are produced at by a fraction of a
+     percent, which is inaudible */
+  if (host->audio.low_latency) {
+    int fill = audio_estimated_frames(host);
+    double error =
+        (double)(host->audio.target_frames - fill) / host->audio.target_frames;
+    error = CLAMP(error, -1.0, 1.0);
+    host->audio.rate = 1.0 + AUDIO_DRC_MAX_DELTA * error;
+    resampler_set_ratio(host->audio.resampler, host->audio.rate);
+  }
+
+  static int16_t tmp[AUDIO_RESAMPLE_FRAMES * 16 * 2];
+
+  while (num_frames) {
+    int n = MIN(num_frames, AUDIO_RESAMPLE_FRAMES);
+    CHECK_LE(resampler_max_frames(host->audio.resampler, n),
+             (int)ARRAY_SIZE(tmp) / 2);
+
+    int out = resampler_process(host->audio.resampler, data, n, tmp);
+    audio_write_frames(host, tmp, out);
+
+    data += n * 2;
+    num_frames -= n;
+  }
+}
+
 static int audio_buffer_low(struct host *host) {
-  if (!host->audio.dev) {
+  if (!host->audio.dev || OPTION_fast_forward) {
     /* lie and say the audio buffer is low, forcing the emulator to run as fast
        as possible */
     return 1;
@@ -123,35 +217,61 @@ static int audio_buffer_low(struct host *host) {
      in order to smooth out the video frame timings when the audio latency is
      high, the host clock is used to interpolate the amount of buffered audio
      data between callbacks */
-  int64_t now = time_nanoseconds();
-  int64_t since_last_cb = now - host->audio.last_cb;
-  int frames_buffered = audio_buffered_frames(host);
-  frames_buffered -= NS_TO_AUDIO_FRAMES(since_last_cb);
+  int frames_buffered = audio_estimated_frames(host);
 
   int low_water_mark = host->audio.spec.samples / 2;
   return frames_buffered < low_water_mark;
 }
 
+static void audio_wait_buffer_low(struct host *host) {
+  /* sleep until audio_buffer_low is expected to flip, instead of spinning on
+     it. the callback cuts the wait short, as it changes the estimate */
+  int64_t last_cb = host->audio.last_cb;
+  int low_water_mark = host->audio.spec.samples / 2;
+  int frames = audio_estimated_frames(host) - low_water_mark + 1;
+  int64_t wait = (int64_t)frames * NS_PER_SEC / host->audio.spec.freq;
+  int ms;
+
+  /* timed waits may oversleep, when precise the main loop spins through the
+     final millisecond */
+  if (OPTION_precise_throttle) {
+    ms = (int)((wait - NS_PER_MS) / NS_PER_MS);
+  } else {
+    ms = (int)((wait + NS_PER_MS - 1) / NS_PER_MS);
+  }
+
+  ms = MIN(ms, AUDIO_MAX_WAIT_MS);
+
+  if (ms <= 0) {
+    return;
+  }
+
+  mutex_lock(host->audio.mutex);
+  if (host->audio.last_cb == last_cb) {
+    cond_timedwait(host->audio.drained, host->audio.mutex, ms);
+  }
+  mutex_unlock(host->audio.mutex);
+}
+
 static void audio_write_cb(void *userdata, Uint8 *stream, int len) {
   struct host *host = userdata;
   Sint32 *buf = (Sint32 *)stream;
   int frame_count_max = len / AUDIO_FRAME_SIZE;
 
-  static uint32_t tmp[AUDIO_FREQ];
-  int frames_buffered = audio_buffered_frames(host);
-  int frames_remaining = MIN(frames_buffered, frame_count_max);
-
-  while (frames_remaining > 0) {
-    /* batch read frames from ring buffer */
-    int n = MIN(frames_remaining, ARRAY_SIZE(tmp));
-    n = audio_read_frames(host, tmp, n);
-    frames_remaining -= n;
-
-    /* copy frames to output stream */
-    memcpy(buf, tmp, n * AUDIO_FRAME_SIZE);
+  if (!host->audio.thread_configured) {
+    configure_thread(THREAD_ROLE_AUDIO);
+    host->audio.thread_configured = 1;
   }
 
+  /* the ring buffer's contents are always contiguous, so read straight into
+     the output stream, filling whatever couldn't be read with silence */
+  int n = audio_read_frames(host, buf, frame_count_max);
+  memset(buf + n, 0, (frame_count_max - n) * AUDIO_FRAME_SIZE);
+
+  mutex_lock(host->audio.mutex);
   host->audio.last_cb = time_nanoseconds();
+  cond_signal(host->audio.drained);
+  mutex_unlock(host->audio.mutex);
 }
 
 static void audio_destroy_device(struct host *host) {
@@ -161,43 +281,60 @@ static void audio_destroy_device(struct host *host) {
 
   SDL_CloseAudioDevice(host->audio.dev);
   host->audio.dev = 0;
+
+  if (host->audio.resampler) {
+    resampler_destroy(host->audio.resampler);
+    host->audio.resampler = NULL;
+  }
 }
 
 static int audio_create_device(struct host *host) {
-  /* SDL expects the number of buffered frames to be a power of two */
-  int target_frames = 1 << 12;
+  int target_frames = OPTION_audio_low_latency ? AUDIO_LOW_LATENCY_SAMPLES
+                                                : AUDIO_DEFAULT_SAMPLES;
 
-  /* match AICA output format */
+  /* match AICA output format, except for the rate. few devices run at 44.1 khz
+     natively, and letting the mixer convert each buffer is both slower and
+     lower quality than resampling here. SDL has no way to query the device's
+     own rate, so ask for the configured one and accept whatever is offered */
   SDL_AudioSpec want;
   SDL_zero(want);
-  want.freq = AUDIO_FREQ;
+  want.freq = OPTION_audio_rate > 0 ? OPTION_audio_rate : AUDIO_FREQ;
   want.format = AUDIO_S16LSB;
   want.channels = 2;
   want.samples = target_frames;
   want.userdata = host;
   want.callback = audio_write_cb;
 
-  host->audio.dev = SDL_OpenAudioDevice(NULL, 0, &want, &host->audio.spec, 0);
+  host->audio.dev = SDL_OpenAudioDevice(NULL, 0, &want, &host->audio.spec,
+                                        SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
   if (!host->audio.dev) {
     LOG_WARNING("audio_create_device failed to open device: %s",
                 SDL_GetError());
     return 0;
   }
 
-  LOG_INFO("audio_create_device latency=%d ms/%d frames",
-           AUDIO_FRAMES_TO_MS(host->audio.spec.samples),
+  int freq = host->audio.spec.freq;
+
+  LOG_INFO("audio_create_device freq=%d latency=%d ms/%d frames", freq,
+           AUDIO_FRAMES_TO_MS(host->audio.spec.samples, freq),
            host->audio.spec.samples);
 
-  return 1;
-}
+  /* in low latency mode, aim to keep the ring buffer filled past the low
+     water mark by about half of a video frame's worth of audio, which the
+     main loop produces in one go */
+  host->audio.low_latency = OPTION_audio_low_latency;
+  host->audio.target_frames = host->audio.spec.samples / 2 +
+                              MS_TO_AUDIO_FRAMES(1000.0f / 60.0f / 2.0f, freq);
+  host->audio.rate = 1.0;
 
-void audio_push(struct host *host, const int16_t *data, int num_frames) {
-  if (!host->audio.dev) {
-    return;
+  if (freq != AUDIO_FREQ || host->audio.low_latency) {
+    host->audio.resampler = resampler_create(AUDIO_FREQ, freq);
   }
 
-  audio_write_frames(host, data, num_frames);
+  return 1;
+}
 
+static void audio_start_playback(struct host *host) {
   /* start playback once some audio is queued */
   if (!host->audio.playing) {
     SDL_PauseAudioDevice(host->audio.dev, 0);
@@ -205,13 +342,64 @@ void audio_push(struct host *host, const int16_t *data, int num_frames) {
   }
 }
 
-static void audio_shutdown(struct host *host) {
-  if (host->audio.dev) {
-    SDL_CloseAudioDevice(host->audio.dev);
+void audio_commit(struct host *host, int num_frames) {
+  ringbuf_advance_write_ptr(host->audio.frames, num_frames * AUDIO_FRAME_SIZE);
+
+  audio_start_playback(host);
+}
+
+int audio_buffered(struct host *host) {
+  if (!host->audio.dev) {
+    return 0;
+  }
+
+  /* report the frames in terms of the guest's rate */
+  int64_t frames = audio_buffered_frames(host);
+  return (int)(frames * AUDIO_FREQ / host->audio.spec.freq);
+}
+
+int16_t *audio_reserve(struct host *host, int num_frames) {
+  /* resampled frames have to be written through audio_push */
+  if (!host->audio.dev || host->audio.resampler) {
+    return NULL;
   }
 
+  int remaining = ringbuf_remaining(host->audio.frames);
+  if (remaining < num_frames * AUDIO_FRAME_SIZE) {
+    return NULL;
+  }
+
+  return ringbuf_write_ptr(host->audio.frames);
+}
+
+void audio_push(struct host *host, const int16_t *data, int num_frames) {
+  if (!host->audio.dev) {
+    return;
+  }
+
+  if (host->audio.resampler) {
+    audio_write_resampled(host, data, num_frames);
+  } else {
+    audio_write_frames(host, data, num_frames);
+  }
+
+  audio_start_playback(host);
+}
+
+static void audio_shutdown(struct host *host) {
+  audio_destroy_device(host);
+
   if (host->audio.frames) {
     ringbuf_destroy(host->audio.frames);
+    prof_counter_add(COUNTER_mem_audio, -AUDIO_FREQ * AUDIO_FRAME_SIZE);
+  }
+
+  if (host->audio.drained) {
+    cond_destroy(host->audio.drained);
+  }
+
+  if (host->audio.mutex) {
+    mutex_destroy(host->audio.mutex);
   }
 }
 
@@ -230,6 +418,9 @@ static int audio_init(struct host *host) {
      synchronization used by the main loop, where an entire guest video frame is
      ran when the buffered audio data is deemed low */
   host->audio.frames = ringbuf_create(AUDIO_FREQ * AUDIO_FRAME_SIZE);
+  prof_counter_add(COUNTER_mem_audio, AUDIO_FREQ * AUDIO_FRAME_SIZE);
+  host->audio.mutex = mutex_create();
+  host->audio.drained = cond_create();
 
   int success = audio_create_device(host);
   if (!success) {
@@ -275,8 +466,8 @@ static SDL_GLContext video_create_context(struct host *host) {
   SDL_GLContext ctx = SDL_GL_CreateContext(host->win);
   CHECK_NOTNULL(ctx, "video_create_context failed: %s", SDL_GetError());
 
-  /* force vsync */
-  int vsync = video_sync_enabled();
+  /* force vsync, unless fast forwarding */
+  int vsync = video_sync_enabled() && !OPTION_fast_forward;
   int res = SDL_GL_SetSwapInterval(vsync);
   CHECK_EQ(res, 0, "video_create_context failed to set swap interval");
 
@@ -284,6 +475,24 @@ static SDL_GLContext video_create_context(struct host *host) {
   res = gladLoadGLLoader((GLADloadproc)&SDL_GL_GetProcAddress);
   CHECK_EQ(res, 1, "video_create_context failed to link");
 
+  /* glad only links glTexStorage2D for gles contexts, but it's commonly
+     available on desktop through GL_ARB_texture_storage */
+  if (!glTexStorage2D && SDL_GL_ExtensionSupported("GL_ARB_texture_storage")) {
+    glad_glTexStorage2D =
+        (PFNGLTEXSTORAGE2DPROC)SDL_GL_GetProcAddress("glTexStorage2D");
+  }
+
+  /* the same goes for program binaries through GL_ARB_get_program_binary */
+  if (!glGetProgramBinary &&
+      SDL_GL_ExtensionSupported("GL_ARB_get_program_binary")) {
+    glad_glGetProgramBinary =
+        (PFNGLGETPROGRAMBINARYPROC)SDL_GL_GetProcAddress("glGetProgramBinary");
+    glad_glProgramBinary =
+        (PFNGLPROGRAMBINARYPROC)SDL_GL_GetProcAddress("glProgramBinary");
+    glad_glProgramParameteri = (PFNGLPROGRAMPARAMETERIPROC)SDL_GL_GetProcAddress(
+        "glProgramParameteri");
+  }
+
   return ctx;
 }
 
@@ -667,15 +876,77 @@ int ui_load_game(struct host *host, const char *path) {
   return emu_load(host->emu, path);
 }
 
+/*
+ * frame pacing
+ */
+static int pacer_enabled(struct host *host) {
+  return OPTION_frame_pacing && video_sync_enabled() && !OPTION_fast_forward;
+}
+
+static void pacer_start_frame(struct host *host) {
+  int64_t now = time_nanoseconds();
+
+  host->pacer.delay = 0;
+
+  if (pacer_enabled(host) && host->pacer.interval) {
+    /* leave a margin for the estimate being off, a late frame costs a whole
+       present interval */
+    int64_t margin = host->pacer.interval / 8;
+    int64_t next_present = host->pacer.last_present + host->pacer.interval;
+    int64_t start = next_present - host->pacer.work - margin;
+
+    /* only wait whole milliseconds, the remainder is left to the swap */
+    int ms = (int)((start - now) / NS_PER_MS);
+
+    if (ms > 0) {
+      SDL_Delay(ms);
+      host->pacer.delay = time_nanoseconds() - now;
+      now += host->pacer.delay;
+    }
+  }
+
+  host->pacer.frame_start = now;
+}
+
+static void pacer_end_frame(struct host *host, int64_t present) {
+  /* the estimate of the work per frame jumps up to the latest time, but only
+     slowly decays, as being late is costlier than being early */
+  int64_t work = present - host->pacer.frame_start - host->pacer.delay;
+
+  if (work > host->pacer.work) {
+    host->pacer.work = work;
+  } else {
+    host->pacer.work -= (host->pacer.work - work) / 16;
+  }
+
+  /* presents returning late are counted as a single missed present */
+  int64_t interval = present - host->pacer.last_present;
+
+  if (host->pacer.last_present && host->pacer.interval &&
+      interval < host->pacer.interval * 3 / 2) {
+    host->pacer.interval += (interval - host->pacer.interval) / 16;
+  } else if (host->pacer.last_present && !host->pacer.interval) {
+    host->pacer.interval = interval;
+  }
+
+  host->pacer.last_present = present;
+}
+
 /*
  * internal
  */
 static void host_swap_window(struct host *host) {
+  int64_t start = time_nanoseconds();
+
   SDL_GL_SwapWindow(host->win);
 
   /* keep track of the time between swaps */
   int64_t now = time_nanoseconds();
 
+  prof_counter_add(COUNTER_swap_time, now - start);
+
+  pacer_end_frame(host, now);
+
   if (host->dbg.last_swap) {
     float swap_time_ms = (float)(now - host->dbg.last_swap) / 1000000.0f;
     int num_times = ARRAY_SIZE(host->dbg.swap_times);
@@ -698,6 +969,10 @@ static void host_debug_menu(struct host *host) {
         host->dbg.show_times = !host->dbg.show_times;
       }
 
+      if (igMenuItem("audio latency", NULL, host->dbg.show_audio, 1)) {
+        host->dbg.show_audio = !host->dbg.show_audio;
+      }
+
       igEndMenu();
     }
 
@@ -722,9 +997,26 @@ static void host_debug_menu(struct host *host) {
       }
       avg_time /= num_times;
 
+      float variance = 0.0f;
+      for (int i = 0; i < num_times; i++) {
+        float delta = host->dbg.swap_times[i] - avg_time;
+        variance += delta * delta;
+      }
+      variance /= num_times;
+
       igValueFloat("min frame time", min_time, "%.2f");
       igValueFloat("max frame time", max_time, "%.2f");
       igValueFloat("avg frame time", avg_time, "%.2f");
+      igValueFloat("frame time stddev", sqrtf(variance), "%.3f");
+
+      if (pacer_enabled(host)) {
+        igValueFloat("present interval",
+                     (float)host->pacer.interval / NS_PER_MS, "%.2f");
+        igValueFloat("frame work", (float)host->pacer.work / NS_PER_MS,
+                     "%.2f");
+        igValueFloat("start delay", (float)host->pacer.delay / NS_PER_MS,
+                     "%.2f");
+      }
       igPlotLines("", host->dbg.swap_times, num_times,
                   host->dbg.frame % num_times, NULL, 0.0f, 60.0f, graph_size,
                   sizeof(float));
@@ -734,169 +1026,212 @@ static void host_debug_menu(struct host *host) {
     host->dbg.show_times = (int)opened;
   }
 
+  if (host->dbg.show_audio) {
+    bool opened = true;
+
+    if (igBegin("audio latency", &opened, ImGuiWindowFlags_AlwaysAutoResize)) {
+      if (host->audio.dev) {
+        igValueInt("device rate", host->audio.spec.freq);
+        igValueInt("device frames", host->audio.spec.samples);
+        igValueInt("buffered frames", audio_estimated_frames(host));
+        igValueInt("latency ms", audio_latency_ms(host));
+        if (host->audio.low_latency) {
+          igValueInt("target frames", host->audio.target_frames);
+          igValueFloat("rate", (float)host->audio.rate, "%.4f");
+        }
+      } else {
+        igText("no audio device");
+      }
+    }
+    igEnd();
+
+    host->dbg.show_audio = (int)opened;
+  }
+
   emu_debug_menu(host->emu);
 #endif
 }
 
-static void host_poll_events(struct host *host) {
-  SDL_Event ev;
+static void host_handle_event(struct host *host, const SDL_Event *ev) {
+  switch (ev->type) {
+    case SDL_KEYDOWN: {
+      int keycode = translate_sdl_key(ev->key.keysym);
 
-  while (SDL_PollEvent(&ev)) {
-    switch (ev.type) {
-      case SDL_KEYDOWN: {
-        int keycode = translate_sdl_key(ev.key.keysym);
+      if (keycode != K_UNKNOWN) {
+        input_keydown(host, 0, keycode, INT16_MAX);
+      }
+    } break;
 
-        if (keycode != K_UNKNOWN) {
-          input_keydown(host, 0, keycode, INT16_MAX);
-        }
-      } break;
+    case SDL_KEYUP: {
+      int keycode = translate_sdl_key(ev->key.keysym);
 
-      case SDL_KEYUP: {
-        int keycode = translate_sdl_key(ev.key.keysym);
+      if (keycode != K_UNKNOWN) {
+        input_keydown(host, 0, keycode, 0);
+      }
+    } break;
+
+    case SDL_MOUSEBUTTONDOWN:
+    case SDL_MOUSEBUTTONUP: {
+      int keycode;
+
+      switch (ev->button.button) {
+        case SDL_BUTTON_LEFT:
+          keycode = K_MOUSE1;
+          break;
+        case SDL_BUTTON_RIGHT:
+          keycode = K_MOUSE2;
+          break;
+        case SDL_BUTTON_MIDDLE:
+          keycode = K_MOUSE3;
+          break;
+        case SDL_BUTTON_X1:
+          keycode = K_MOUSE4;
+          break;
+        case SDL_BUTTON_X2:
+          keycode = K_MOUSE5;
+          break;
+        default:
+          keycode = K_UNKNOWN;
+          break;
+      }
 
-        if (keycode != K_UNKNOWN) {
-          input_keydown(host, 0, keycode, 0);
-        }
-      } break;
-
-      case SDL_MOUSEBUTTONDOWN:
-      case SDL_MOUSEBUTTONUP: {
-        int keycode;
-
-        switch (ev.button.button) {
-          case SDL_BUTTON_LEFT:
-            keycode = K_MOUSE1;
-            break;
-          case SDL_BUTTON_RIGHT:
-            keycode = K_MOUSE2;
-            break;
-          case SDL_BUTTON_MIDDLE:
-            keycode = K_MOUSE3;
-            break;
-          case SDL_BUTTON_X1:
-            keycode = K_MOUSE4;
-            break;
-          case SDL_BUTTON_X2:
-            keycode = K_MOUSE5;
-            break;
-          default:
-            keycode = K_UNKNOWN;
-            break;
-        }
+      if (keycode != K_UNKNOWN) {
+        int16_t value = ev->type == SDL_MOUSEBUTTONDOWN ? INT16_MAX : 0;
+        input_keydown(host, 0, keycode, value);
+      }
+    } break;
+
+    case SDL_MOUSEWHEEL:
+      if (ev->wheel.y > 0) {
+        input_keydown(host, 0, K_MWHEELUP, INT16_MAX);
+        input_keydown(host, 0, K_MWHEELUP, 0);
+      } else {
+        input_keydown(host, 0, K_MWHEELDOWN, INT16_MAX);
+        input_keydown(host, 0, K_MWHEELDOWN, 0);
+      }
+      break;
 
-        if (keycode != K_UNKNOWN) {
-          int16_t value = ev.type == SDL_MOUSEBUTTONDOWN ? INT16_MAX : 0;
-          input_keydown(host, 0, keycode, value);
-        }
-      } break;
-
-      case SDL_MOUSEWHEEL:
-        if (ev.wheel.y > 0) {
-          input_keydown(host, 0, K_MWHEELUP, INT16_MAX);
-          input_keydown(host, 0, K_MWHEELUP, 0);
-        } else {
-          input_keydown(host, 0, K_MWHEELDOWN, INT16_MAX);
-          input_keydown(host, 0, K_MWHEELDOWN, 0);
-        }
-        break;
+    case SDL_MOUSEMOTION:
+      input_mousemove(host, 0, ev->motion.x, ev->motion.y);
+      break;
 
-      case SDL_MOUSEMOTION:
-        input_mousemove(host, 0, ev.motion.x, ev.motion.y);
-        break;
+    case SDL_CONTROLLERDEVICEADDED: {
+      input_controller_added(host, ev->cdevice.which);
+    } break;
 
-      case SDL_CONTROLLERDEVICEADDED: {
-        input_controller_added(host, ev.cdevice.which);
-      } break;
+    case SDL_CONTROLLERDEVICEREMOVED: {
+      int port = input_find_controller_port(host, ev->cdevice.which);
 
-      case SDL_CONTROLLERDEVICEREMOVED: {
-        int port = input_find_controller_port(host, ev.cdevice.which);
+      if (port != -1) {
+        input_controller_removed(host, port);
+      }
+    } break;
+
+    case SDL_CONTROLLERAXISMOTION: {
+      int port = input_find_controller_port(host, ev->caxis.which);
+      int key = K_UNKNOWN;
+
+
+      switch (ev->caxis.axis) {
+        case SDL_CONTROLLER_AXIS_LEFTX:
+          key = K_CONT_JOYX;
+          break;
+        case SDL_CONTROLLER_AXIS_LEFTY:
+          key = K_CONT_JOYY;
+          break;
+        case SDL_CONTROLLER_AXIS_TRIGGERLEFT:
+          key = K_CONT_LTRIG;
+          break;
+        case SDL_CONTROLLER_AXIS_TRIGGERRIGHT:
+          key = K_CONT_RTRIG;
+          break;
+      }
 
-        if (port != -1) {
-          input_controller_removed(host, port);
-        }
-      } break;
-
-      case SDL_CONTROLLERAXISMOTION: {
-        int port = input_find_controller_port(host, ev.caxis.which);
-        int key = K_UNKNOWN;
-
-
-        switch (ev.caxis.axis) {
-          case SDL_CONTROLLER_AXIS_LEFTX:
-            key = K_CONT_JOYX;
-            break;
-          case SDL_CONTROLLER_AXIS_LEFTY:
-            key = K_CONT_JOYY;
-            break;
-          case SDL_CONTROLLER_AXIS_TRIGGERLEFT:
-            key = K_CONT_LTRIG;
-            break;
-          case SDL_CONTROLLER_AXIS_TRIGGERRIGHT:
-            key = K_CONT_RTRIG;
-            break;
-        }
+      if (port != -1 && key != K_UNKNOWN) {
+        int16_t value = filter_sdl_motion(ev->caxis.value, *DEADZONES[port]);
+        input_keydown(host, port, key, value);
+      }
+    } break;
+
+    case SDL_CONTROLLERBUTTONDOWN:
+    case SDL_CONTROLLERBUTTONUP: {
+      int port = input_find_controller_port(host, ev->cbutton.which);
+      int key = K_UNKNOWN;
+      int16_t value = ev->type == SDL_CONTROLLERBUTTONDOWN ? INT16_MAX : 0;
+
+      switch (ev->cbutton.button) {
+        case SDL_CONTROLLER_BUTTON_A:
+          key = K_CONT_A;
+          break;
+        case SDL_CONTROLLER_BUTTON_B:
+          key = K_CONT_B;
+          break;
+        case SDL_CONTROLLER_BUTTON_X:
+          key = K_CONT_X;
+          break;
+        case SDL_CONTROLLER_BUTTON_Y:
+          key = K_CONT_Y;
+          break;
+        case SDL_CONTROLLER_BUTTON_START:
+          key = K_CONT_START;
+          break;
+        case SDL_CONTROLLER_BUTTON_DPAD_UP:
+          key = K_CONT_DPAD_UP;
+          break;
+        case SDL_CONTROLLER_BUTTON_DPAD_DOWN:
+          key = K_CONT_DPAD_DOWN;
+          break;
+        case SDL_CONTROLLER_BUTTON_DPAD_LEFT:
+          key = K_CONT_DPAD_LEFT;
+          break;
+        case SDL_CONTROLLER_BUTTON_DPAD_RIGHT:
+          key = K_CONT_DPAD_RIGHT;
+          break;
+      }
 
-        if (port != -1 && key != K_UNKNOWN) {
-          int16_t value = filter_sdl_motion(ev.caxis.value, *DEADZONES[port]);
-          input_keydown(host, port, key, value);
-        }
-      } break;
-
-      case SDL_CONTROLLERBUTTONDOWN:
-      case SDL_CONTROLLERBUTTONUP: {
-        int port = input_find_controller_port(host, ev.cbutton.which);
-        int key = K_UNKNOWN;
-        int16_t value = ev.type == SDL_CONTROLLERBUTTONDOWN ? INT16_MAX : 0;
-
-        switch (ev.cbutton.button) {
-          case SDL_CONTROLLER_BUTTON_A:
-            key = K_CONT_A;
-            break;
-          case SDL_CONTROLLER_BUTTON_B:
-            key = K_CONT_B;
-            break;
-          case SDL_CONTROLLER_BUTTON_X:
-            key = K_CONT_X;
-            break;
-          case SDL_CONTROLLER_BUTTON_Y:
-            key = K_CONT_Y;
-            break;
-          case SDL_CONTROLLER_BUTTON_START:
-            key = K_CONT_START;
-            break;
-          case SDL_CONTROLLER_BUTTON_DPAD_UP:
-            key = K_CONT_DPAD_UP;
-            break;
-          case SDL_CONTROLLER_BUTTON_DPAD_DOWN:
-            key = K_CONT_DPAD_DOWN;
-            break;
-          case SDL_CONTROLLER_BUTTON_DPAD_LEFT:
-            key = K_CONT_DPAD_LEFT;
-            break;
-          case SDL_CONTROLLER_BUTTON_DPAD_RIGHT:
-            key = K_CONT_DPAD_RIGHT;
-            break;
-        }
+      if (port != -1 && key != K_UNKNOWN) {
+        input_keydown(host, port, key, value);
+      }
+    } break;
 
-        if (port != -1 && key != K_UNKNOWN) {
-          input_keydown(host, port, key, value);
-        }
-      } break;
+    case SDL_WINDOWEVENT:
+      if (ev->window.event == SDL_WINDOWEVENT_RESIZED) {
+        host->video.width = ev->window.data1;
+        host->video.height = ev->window.data2;
+
+        int res = video_restart(host);
+        CHECK(res, "video_restart failed");
+      }
+      break;
 
-      case SDL_WINDOWEVENT:
-        if (ev.window.event == SDL_WINDOWEVENT_RESIZED) {
-          host->video.width = ev.window.data1;
-          host->video.height = ev.window.data2;
+    case SDL_QUIT:
+      host->closed = 1;
+      break;
+  }
+}
 
-          int res = video_restart(host);
-          CHECK(res, "video_restart failed");
-        }
-        break;
+void input_poll(struct host *host) {
+  /* only input events are handled, anything else is left queued for the main
+     loop to handle */
+  SDL_Event ev;
 
-      case SDL_QUIT:
-        host->closed = 1;
-        break;
-    }
+  SDL_PumpEvents();
+
+  while (SDL_PeepEvents(&ev, 1, SDL_GETEVENT, SDL_KEYDOWN, SDL_KEYUP) > 0) {
+    host_handle_event(host, &ev);
+  }
+
+  while (SDL_PeepEvents(&ev, 1, SDL_GETEVENT, SDL_CONTROLLERAXISMOTION,
+                        SDL_CONTROLLERBUTTONUP) > 0) {
+    host_handle_event(host, &ev);
+  }
+}
+
+static void host_poll_events(struct host *host) {
+  SDL_Event ev;
+
+  while (SDL_PollEvent(&ev)) {
+    host_handle_event(host, &ev);
   }
 
   /* check for option changes at this time as well */
@@ -905,6 +1240,17 @@ static void host_poll_events(struct host *host) {
     OPTION_fullscreen_dirty = 0;
   }
 
+  if (OPTION_fast_forward_dirty) {
+    SDL_GL_SetSwapInterval(video_sync_enabled() && !OPTION_fast_forward);
+    OPTION_fast_forward_dirty = 0;
+  }
+
+  if (OPTION_audio_low_latency_dirty) {
+    int res = audio_restart(host);
+    CHECK(res, "audio_restart failed");
+    OPTION_audio_low_latency_dirty = 0;
+  }
+
   if (OPTION_sync_dirty) {
     int res = audio_restart(host);
     CHECK(res, "audio_restart failed");
@@ -983,6 +1329,10 @@ void host_destroy(struct host *host) {
   free(host);
 }
 
+static void host_init_worker_thread() {
+  configure_thread(THREAD_ROLE_WORKER);
+}
+
 struct host *host_create() {
   struct host *host = calloc(1, sizeof(struct host));
   return host;
@@ -1014,6 +1364,14 @@ int main(int argc, char **argv) {
     return EXIT_FAILURE;
   }
 
+  log_set_async(OPTION_log_async);
+
+  /* the main thread drives the video output */
+  configure_thread(THREAD_ROLE_VIDEO);
+
+  /* create the shared task pool up front so its workers are configured */
+  task_pool_init_shared(-1, &host_init_worker_thread);
+
   const char *load = argc > 1 ? argv[1] : NULL;
   struct host *host = host_create();
 
@@ -1068,15 +1426,18 @@ int main(int argc, char **argv) {
            syncs the emulation speed with the host audio clock. note however,
            if audio is disabled, the emulator will run unthrottled */
         if (!audio_buffer_low(host)) {
+          audio_wait_buffer_low(host);
           continue;
         }
 
+        pacer_start_frame(host);
+
         /* reset vertex buffers */
         imgui_begin_frame(host->imgui);
 
         /* render emulator output and build up imgui buffers */
         host_debug_menu(host);
-        emu_render_frame(host->emu);
+        int rendered = emu_render_frame(host->emu);
         ui_build_menus(host->ui);
 
         /* overlay imgui */
@@ -1086,7 +1447,10 @@ int main(int argc, char **argv) {
         int64_t now = time_nanoseconds();
         prof_flip(time_nanoseconds());
 
-        host_swap_window(host);
+        /* skipped frames aren't presented */
+        if (rendered) {
+          host_swap_window(host);
+        }
       }
     }
   }
@@ -1113,5 +1477,7 @@ int main(int argc, char **argv) {
   /* persist options for next run */
   options_write(config);
 
+  log_set_async(0);
+
   return EXIT_SUCCESS;
 }
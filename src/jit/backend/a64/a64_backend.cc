@@ -0,0 +1,1007 @@
+#include "jit/backend/a64/a64_local.h"
+
+extern "C" {
+#include "core/exception_handler.h"
+#include "core/memory.h"
+#include "jit/backend/a64/a64_backend.h"
+#include "jit/ir/ir.h"
+#include "jit/jit.h"
+#include "jit/jit_backend.h"
+#include "jit/jit_guest.h"
+}
+
+using namespace vixl::aarch64;
+
+/*
+ * a64 register layout
+ */
+
+/* clang-format off */
+const Register arg0 = x0;
+const Register arg1 = x1;
+const Register arg2 = x2;
+const Register arg3 = x3;
+const Register tmp0 = x8;
+const Register tmp1 = x9;
+const Register guestctx = x27;
+const Register guestmem = x28;
+const VRegister vtmp0 = v0;
+const VRegister vtmp1 = v1;
+
+/* x16 and x17 are used as scratch registers by vixl's macro instructions, x18
+   is reserved by the platform and x29 / x30 are saved and restored by the
+   dispatch thunks. note, only the low 64-bits of v8-v15 are preserved across
+   calls, so they're left out of the vector register pool */
+const struct jit_register a64_registers[] = {
+    {"x0",  JIT_RESERVED | JIT_CALLER_SAVE | JIT_REG_I64,                (const void *)&x0},
+    {"x1",  JIT_RESERVED | JIT_CALLER_SAVE | JIT_REG_I64,                (const void *)&x1},
+    {"x2",  JIT_RESERVED | JIT_CALLER_SAVE | JIT_REG_I64,                (const void *)&x2},
+    {"x3",  JIT_RESERVED | JIT_CALLER_SAVE | JIT_REG_I64,                (const void *)&x3},
+    {"x4",  JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_I64,                (const void *)&x4},
+    {"x5",  JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_I64,                (const void *)&x5},
+    {"x6",  JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_I64,                (const void *)&x6},
+    {"x7",  JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_I64,                (const void *)&x7},
+    {"x8",  JIT_RESERVED | JIT_CALLER_SAVE | JIT_REG_I64,                (const void *)&x8},
+    {"x9",  JIT_RESERVED | JIT_CALLER_SAVE | JIT_REG_I64,                (const void *)&x9},
+    {"x10", JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_I64,                (const void *)&x10},
+    {"x11", JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_I64,                (const void *)&x11},
+    {"x12", JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_I64,                (const void *)&x12},
+    {"x13", JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_I64,                (const void *)&x13},
+    {"x14", JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_I64,                (const void *)&x14},
+    {"x15", JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_I64,                (const void *)&x15},
+    {"x16", JIT_RESERVED | JIT_CALLER_SAVE | JIT_REG_I64,                (const void *)&x16},
+    {"x17", JIT_RESERVED | JIT_CALLER_SAVE | JIT_REG_I64,                (const void *)&x17},
+    {"x18", JIT_RESERVED | JIT_REG_I64,                                  (const void *)&x18},
+    {"x19", JIT_ALLOCATE | JIT_CALLEE_SAVE | JIT_REG_I64,                (const void *)&x19},
+    {"x20", JIT_ALLOCATE | JIT_CALLEE_SAVE | JIT_REG_I64,                (const void *)&x20},
+    {"x21", JIT_ALLOCATE | JIT_CALLEE_SAVE | JIT_REG_I64,                (const void *)&x21},
+    {"x22", JIT_ALLOCATE | JIT_CALLEE_SAVE | JIT_REG_I64,                (const void *)&x22},
+    {"x23", JIT_ALLOCATE | JIT_CALLEE_SAVE | JIT_REG_I64,                (const void *)&x23},
+    {"x24", JIT_ALLOCATE | JIT_CALLEE_SAVE | JIT_REG_I64,                (const void *)&x24},
+    {"x25", JIT_ALLOCATE | JIT_CALLEE_SAVE | JIT_REG_I64,                (const void *)&x25},
+    {"x26", JIT_ALLOCATE | JIT_CALLEE_SAVE | JIT_REG_I64,                (const void *)&x26},
+    {"x27", JIT_RESERVED | JIT_CALLEE_SAVE | JIT_REG_I64,                (const void *)&x27},
+    {"x28", JIT_RESERVED | JIT_CALLEE_SAVE | JIT_REG_I64,                (const void *)&x28},
+    {"x29", JIT_RESERVED | JIT_REG_I64,                                  (const void *)&x29},
+    {"x30", JIT_RESERVED | JIT_REG_I64,                                  (const void *)&x30},
+    {"v0",  JIT_RESERVED | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v0},
+    {"v1",  JIT_RESERVED | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v1},
+    {"v2",  JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v2},
+    {"v3",  JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v3},
+    {"v4",  JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v4},
+    {"v5",  JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v5},
+    {"v6",  JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v6},
+    {"v7",  JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v7},
+    {"v8",  JIT_ALLOCATE | JIT_CALLEE_SAVE | JIT_REG_F64,                (const void *)&v8},
+    {"v9",  JIT_ALLOCATE | JIT_CALLEE_SAVE | JIT_REG_F64,                (const void *)&v9},
+    {"v10", JIT_ALLOCATE | JIT_CALLEE_SAVE | JIT_REG_F64,                (const void *)&v10},
+    {"v11", JIT_ALLOCATE | JIT_CALLEE_SAVE | JIT_REG_F64,                (const void *)&v11},
+    {"v12", JIT_ALLOCATE | JIT_CALLEE_SAVE | JIT_REG_F64,                (const void *)&v12},
+    {"v13", JIT_ALLOCATE | JIT_CALLEE_SAVE | JIT_REG_F64,                (const void *)&v13},
+    {"v14", JIT_ALLOCATE | JIT_CALLEE_SAVE | JIT_REG_F64,                (const void *)&v14},
+    {"v15", JIT_ALLOCATE | JIT_CALLEE_SAVE | JIT_REG_F64,                (const void *)&v15},
+    {"v16", JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v16},
+    {"v17", JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v17},
+    {"v18", JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v18},
+    {"v19", JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v19},
+    {"v20", JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v20},
+    {"v21", JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v21},
+    {"v22", JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v22},
+    {"v23", JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v23},
+    {"v24", JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v24},
+    {"v25", JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v25},
+    {"v26", JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v26},
+    {"v27", JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v27},
+    {"v28", JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v28},
+    {"v29", JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v29},
+    {"v30", JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v30},
+    {"v31", JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v31},
+};
+
+const int a64_num_registers = ARRAY_SIZE(a64_registers);
+/* clang-format on */
+
+Register a64_backend_reg(struct a64_backend *backend,
+                         const struct ir_value *v) {
+  CHECK(v->reg >= 0 && v->reg < a64_num_registers);
+  const CPURegister *reg = (const CPURegister *)a64_registers[v->reg].data;
+  CHECK(reg->IsRegister());
+
+  /* i8 and i16 values are kept zero-extended in the 32-bit registers */
+  switch (v->type) {
+    case VALUE_I8:
+    case VALUE_I16:
+    case VALUE_I32:
+      return Register(reg->GetCode(), kWRegSize);
+    case VALUE_I64:
+      return Register(reg->GetCode(), kXRegSize);
+    default:
+      LOG_FATAL("unexpected value type");
+      break;
+  }
+}
+
+VRegister a64_backend_vreg(struct a64_backend *backend,
+                           const struct ir_value *v) {
+  CHECK(v->reg >= 0 && v->reg < a64_num_registers);
+  const CPURegister *reg = (const CPURegister *)a64_registers[v->reg].data;
+  CHECK(reg->IsVRegister());
+
+  switch (v->type) {
+    case VALUE_F32:
+      return VRegister(reg->GetCode(), kSRegSize);
+    case VALUE_F64:
+      return VRegister(reg->GetCode(), kDRegSize);
+    case VALUE_V128:
+      return VRegister(reg->GetCode(), kQRegSize, 4);
+    default:
+      LOG_FATAL("unexpected value type");
+      break;
+  }
+}
+
+static int a64_backend_reg_size(const struct jit_register *r) {
+  /* only the low 64-bits of registers which can't hold vectors are live */
+  return (r->flags & JIT_REG_V128) ? 16 : 8;
+}
+
+static CPURegister a64_backend_reg_save(const struct jit_register *r) {
+  const CPURegister *reg = (const CPURegister *)r->data;
+
+  if (reg->IsVRegister()) {
+    return VRegister(reg->GetCode(), a64_backend_reg_size(r) * 8);
+  }
+
+  return Register(reg->GetCode(), kXRegSize);
+}
+
+int a64_backend_push_regs(struct a64_backend *backend, int mask) {
+  int size = 0;
+
+  auto &e = *backend->codegen;
+
+  for (int i = 0; i < a64_num_registers; i++) {
+    const struct jit_register *r = &a64_registers[i];
+
+    if ((r->flags & mask) != mask) {
+      continue;
+    }
+
+    size += a64_backend_reg_size(r);
+  }
+
+  /* there's no red zone on aarch64, the stack pointer must be decremented
+     before anything is stored below it, and must remain 16-byte aligned */
+  size = ALIGN_UP(size, 16);
+
+  if (!size) {
+    return 0;
+  }
+
+  e.Sub(sp, sp, size);
+
+  int offset = 0;
+
+  for (int i = 0; i < a64_num_registers; i++) {
+    const struct jit_register *r = &a64_registers[i];
+
+    if ((r->flags & mask) != mask) {
+      continue;
+    }
+
+    e.Str(a64_backend_reg_save(r), MemOperand(sp, offset));
+    offset += a64_backend_reg_size(r);
+  }
+
+  return size;
+}
+
+void a64_backend_pop_regs(struct a64_backend *backend, int mask) {
+  int size = 0;
+
+  auto &e = *backend->codegen;
+
+  for (int i = 0; i < a64_num_registers; i++) {
+    const struct jit_register *r = &a64_registers[i];
+
+    if ((r->flags & mask) != mask) {
+      continue;
+    }
+
+    e.Ldr(a64_backend_reg_save(r), MemOperand(sp, size));
+    size += a64_backend_reg_size(r);
+  }
+
+  size = ALIGN_UP(size, 16);
+
+  if (!size) {
+    return;
+  }
+
+  e.Add(sp, sp, size);
+}
+
+void a64_backend_load_mem(struct a64_backend *backend,
+                          const struct ir_value *dst,
+                          const MemOperand &src_mem) {
+  auto &e = *backend->codegen;
+
+  switch (dst->type) {
+    case VALUE_I8:
+      e.Ldrb(a64_backend_reg(backend, dst), src_mem);
+      break;
+    case VALUE_I16:
+      e.Ldrh(a64_backend_reg(backend, dst), src_mem);
+      break;
+    case VALUE_I32:
+    case VALUE_I64:
+      e.Ldr(a64_backend_reg(backend, dst), src_mem);
+      break;
+    case VALUE_F32:
+    case VALUE_F64:
+      e.Ldr(a64_backend_vreg(backend, dst), src_mem);
+      break;
+    case VALUE_V128:
+      e.Ldr(a64_backend_vreg(backend, dst).Q(), src_mem);
+      break;
+    default:
+      LOG_FATAL("unexpected load result type");
+      break;
+  }
+}
+
+void a64_backend_store_mem(struct a64_backend *backend,
+                           const MemOperand &dst_mem,
+                           const struct ir_value *src) {
+  auto &e = *backend->codegen;
+
+  if (ir_is_constant(src)) {
+    /* there is no store immediate, move the constant through tmp1. note, tmp0
+       isn't used as it may be the base register of the memory operand */
+    int size = ir_type_size(src->type);
+    uint64_t value = ir_zext_constant(src);
+    int data_size = size == 8 ? kXRegSize : kWRegSize;
+    Register data(value ? tmp1.GetCode() : kZeroRegCode, data_size);
+
+    if (value) {
+      e.Mov(data, value);
+    }
+
+    switch (size) {
+      case 1:
+        e.Strb(data, dst_mem);
+        break;
+      case 2:
+        e.Strh(data, dst_mem);
+        break;
+      case 4:
+      case 8:
+        e.Str(data, dst_mem);
+        break;
+      default:
+        LOG_FATAL("unexpected value type");
+        break;
+    }
+    return;
+  }
+
+  switch (src->type) {
+    case VALUE_I8:
+      e.Strb(a64_backend_reg(backend, src), dst_mem);
+      break;
+    case VALUE_I16:
+      e.Strh(a64_backend_reg(backend, src), dst_mem);
+      break;
+    case VALUE_I32:
+    case VALUE_I64:
+      e.Str(a64_backend_reg(backend, src), dst_mem);
+      break;
+    case VALUE_F32:
+    case VALUE_F64:
+      e.Str(a64_backend_vreg(backend, src), dst_mem);
+      break;
+    case VALUE_V128:
+      e.Str(a64_backend_vreg(backend, src).Q(), dst_mem);
+      break;
+    default:
+      LOG_FATAL("unexpected store value type");
+      break;
+  }
+}
+
+void a64_backend_mov_value(struct a64_backend *backend, const Register &dst,
+                           const struct ir_value *v) {
+  auto &e = *backend->codegen;
+
+  Register rd = v->type == VALUE_I64 ? dst.X() : dst.W();
+
+  if (ir_is_constant(v)) {
+    e.Mov(rd, ir_zext_constant(v));
+    return;
+  }
+
+  e.Mov(rd, a64_backend_reg(backend, v));
+}
+
+void a64_backend_call(struct a64_backend *backend, const void *fn) {
+  auto &e = *backend->codegen;
+
+  /* the code buffer isn't guaranteed to be within range of a bl, so always
+     call through a register */
+  e.Mov(tmp0, (uint64_t)fn);
+  e.Blr(tmp0);
+}
+
+void a64_backend_branch(struct a64_backend *backend, const void *dst,
+                        Condition cond) {
+  auto &e = *backend->codegen;
+
+  /* branch directly to a thunk. the code buffer is limited to 1 MB so that
+     these are always within range of a conditional branch */
+  vixl::ExactAssemblyScope scope(&e, kInstructionSize);
+  int64_t offset =
+      ((const uint8_t *)dst - e.GetCursorAddress<const uint8_t *>()) >>
+      kInstructionSizeLog2;
+
+  if (cond == al) {
+    e.b(offset);
+  } else {
+    e.b(offset, cond);
+  }
+}
+
+Label *a64_backend_block_label(struct a64_backend *backend,
+                               struct ir_block *block) {
+  CHECK(block->tag >= 0 && block->tag < backend->num_block_labels);
+  return &backend->block_labels[block->tag];
+}
+
+static void a64_backend_emit_thunks(struct a64_backend *backend) {
+  auto &e = *backend->codegen;
+
+  /* the exception handler redirects faulting fastmem accesses to these thunks
+     with the following state:
+     x0-x2 - arguments for the mmio handler
+     x16   - address of the mmio handler
+     x17   - mask for the loaded value
+     x30   - return address (the instruction after the faulting access) */
+  {
+    for (int i = 0; i < 31; i++) {
+      Register dst(i, kXRegSize);
+
+      backend->load_thunk[i] = e.GetCursorAddress<void (*)()>();
+
+      /* save caller-saved registers that our code uses */
+      e.Stp(x30, x17, MemOperand(sp, -16, PreIndex));
+      int save_mask = JIT_ALLOCATE | JIT_CALLER_SAVE;
+      a64_backend_push_regs(backend, save_mask);
+
+      /* call the mmio handler */
+      e.Blr(x16);
+
+      /* restore caller-saved registers */
+      a64_backend_pop_regs(backend, save_mask);
+      e.Ldp(x30, x17, MemOperand(sp, 16, PostIndex));
+
+      /* save mmio handler result. the handlers aren't required to zero the
+         upper bits of narrow results, so mask them off here */
+      e.And(dst, x0, x17);
+
+      /* return to jit code */
+      e.Ret();
+    }
+  }
+
+  {
+    backend->store_thunk = e.GetCursorAddress<void (*)()>();
+
+    /* save caller-saved registers that our code uses */
+    e.Stp(x30, x17, MemOperand(sp, -16, PreIndex));
+    int save_mask = JIT_ALLOCATE | JIT_CALLER_SAVE;
+    a64_backend_push_regs(backend, save_mask);
+
+    /* call the mmio handler */
+    e.Blr(x16);
+
+    /* restore caller-saved registers */
+    a64_backend_pop_regs(backend, save_mask);
+    e.Ldp(x30, x17, MemOperand(sp, 16, PostIndex));
+
+    /* return to jit code */
+    e.Ret();
+  }
+}
+
+/* fastmem accesses are always emitted as a load / store with a register
+   offset, e.g. ldr w10, [x28, w11, uxtw]. decode the access size, direction
+   and transfer register from one of these */
+static int a64_backend_decode_ldst(uint32_t instr, int *is_load,
+                                   int *operand_size, int *reg) {
+  /* size:2 111 0 00 opc:2 1 Rm:5 option:3 S 10 Rn:5 Rt:5 */
+  if ((instr & 0x3f200c00) != 0x38200800) {
+    return 0;
+  }
+
+  int opc = (instr >> 22) & 0x3;
+
+  if (opc != 0 && opc != 1) {
+    return 0;
+  }
+
+  *is_load = opc == 1;
+  *operand_size = 1 << (instr >> 30);
+  *reg = instr & 0x1f;
+
+  return 1;
+}
+
+static int a64_backend_handle_exception(struct jit_backend *base,
+                                        struct exception_state *ex) {
+  struct a64_backend *backend = container_of(base, struct a64_backend, base);
+  struct jit_guest *guest = backend->base.guest;
+
+  const uint32_t *data = (const uint32_t *)ex->thread_state.pc;
+
+  /* figure out the guest address that was being accessed */
+  const uint8_t *fault_addr = (const uint8_t *)ex->fault_addr;
+  const uint8_t *protected_start =
+      (const uint8_t *)ex->thread_state.r[guestmem.GetCode()];
+  uint32_t guest_addr = (uint32_t)(fault_addr - protected_start);
+
+  /* ensure it was an mmio address that caused the exception */
+  uint8_t *ptr;
+  guest->lookup(guest->mem, guest_addr, NULL, &ptr, NULL, NULL);
+
+  if (ptr) {
+    return 0;
+  }
+
+  /* it's assumed a fastmem ldr / str has triggered the exception */
+  int is_load, operand_size, reg;
+  if (!a64_backend_decode_ldst(*data, &is_load, &operand_size, &reg)) {
+    return 0;
+  }
+
+  /* instead of handling the mmio callback from inside of the exception
+     handler, force pc to the beginning of a thunk which will invoke the
+     callback once the exception handler has exited. this frees the callbacks
+     from any restrictions imposed by an exception handler, and also prevents
+     a possible recursive exception
+
+     set the link register to the next instruction after the current access.
+     the jit code only ever enters blocks through br, so the link register
+     isn't live at this point. each thunk will be responsible for saving /
+     restoring caller-saved registers */
+  ex->thread_state.r30 = ex->thread_state.pc + 4;
+
+  if (is_load) {
+    /* prep argument registers (memory object, guest_addr) for read function */
+    ex->thread_state.r[arg0.GetCode()] = (uint64_t)guest->mem;
+    ex->thread_state.r[arg1.GetCode()] = (uint64_t)guest_addr;
+
+    /* prep function call address and result mask for thunk */
+    switch (operand_size) {
+      case 1:
+        ex->thread_state.r16 = (uint64_t)guest->r8;
+        ex->thread_state.r17 = 0xff;
+        break;
+      case 2:
+        ex->thread_state.r16 = (uint64_t)guest->r16;
+        ex->thread_state.r17 = 0xffff;
+        break;
+      case 4:
+        ex->thread_state.r16 = (uint64_t)guest->r32;
+        ex->thread_state.r17 = 0xffffffff;
+        break;
+      case 8:
+        ex->thread_state.r16 = (uint64_t)guest->r64;
+        ex->thread_state.r17 = UINT64_C(0xffffffffffffffff);
+        break;
+    }
+
+    /* resume execution in the thunk once the exception handler exits */
+    ex->thread_state.pc = (uint64_t)backend->load_thunk[reg];
+  } else {
+    /* prep argument registers (memory object, guest_addr, value) for write
+       function. note, register 31 is the zero register for ldr / str */
+    ex->thread_state.r[arg0.GetCode()] = (uint64_t)guest->mem;
+    ex->thread_state.r[arg1.GetCode()] = (uint64_t)guest_addr;
+    ex->thread_state.r[arg2.GetCode()] =
+        reg == 31 ? 0 : ex->thread_state.r[reg];
+
+    /* prep function call address for thunk */
+    switch (operand_size) {
+      case 1:
+        ex->thread_state.r16 = (uint64_t)guest->w8;
+        break;
+      case 2:
+        ex->thread_state.r16 = (uint64_t)guest->w16;
+        break;
+      case 4:
+        ex->thread_state.r16 = (uint64_t)guest->w32;
+        break;
+      case 8:
+        ex->thread_state.r16 = (uint64_t)guest->w64;
+        break;
+    }
+
+    /* resume execution in the thunk once the exception handler exits */
+    ex->thread_state.pc = (uint64_t)backend->store_thunk;
+  }
+
+  return 1;
+}
+
+static void a64_backend_dump_code(struct jit_backend *base, const uint8_t *addr,
+                                  int size, FILE *output) {
+  struct a64_backend *backend = container_of(base, struct a64_backend, base);
+
+  fprintf(output, "#==--------------------------------------------------==#\n");
+  fprintf(output, "# a64\n");
+  fprintf(output, "#==--------------------------------------------------==#\n");
+
+  const Instruction *begin = (const Instruction *)addr;
+  const Instruction *end = (const Instruction *)(addr + size);
+
+  for (const Instruction *instr = begin; instr < end;
+       instr = instr->GetNextInstruction()) {
+    backend->decoder->Decode(instr);
+    fprintf(output, "# 0x%08" PRIxPTR "  %s\n", (uintptr_t)instr,
+            backend->disasm->GetOutput());
+  }
+}
+
+void a64_backend_emit_branch(struct a64_backend *backend, struct ir *ir,
+                             const ir_value *target) {
+  struct jit_guest *guest = backend->base.guest;
+  auto &e = *backend->codegen;
+
+  Label *block_label = NULL;
+  int dispatch_type = 0;
+
+  /* update guest pc */
+  if (target) {
+    if (ir_is_constant(target)) {
+      if (target->type == VALUE_BLOCK) {
+        block_label = a64_backend_block_label(backend, target->blk);
+
+        struct ir_value *addr = ir_get_meta(ir, target->blk, IR_META_ADDR);
+        e.Mov(tmp0.W(), (uint32_t)addr->i32);
+        e.Str(tmp0.W(), MemOperand(guestctx, guest->offset_pc));
+        dispatch_type = 0;
+      } else {
+        uint32_t addr = target->i32;
+        e.Mov(tmp0.W(), addr);
+        e.Str(tmp0.W(), MemOperand(guestctx, guest->offset_pc));
+        dispatch_type = 1;
+      }
+    } else {
+      Register addr = a64_backend_reg(backend, target);
+      e.Str(addr, MemOperand(guestctx, guest->offset_pc));
+      dispatch_type = 3;
+    }
+  } else {
+    dispatch_type = 2;
+  }
+
+  /* jump directly to the block / to dispatch */
+  switch (dispatch_type) {
+    case 0:
+      e.B(block_label);
+      break;
+    case 1: {
+      /* the static dispatch thunk patches this bl directly, so it must be a
+         single instruction */
+      vixl::ExactAssemblyScope scope(&e, kInstructionSize);
+      int64_t offset = ((const uint8_t *)backend->dispatch_static -
+                        e.GetCursorAddress<const uint8_t *>()) >>
+                       kInstructionSizeLog2;
+      e.bl(offset);
+    } break;
+    case 2:
+      a64_backend_branch(backend, backend->dispatch_dynamic, al);
+      break;
+    case 3: {
+      /* the inline cache's tag is emitted after the bl to the miss thunk,
+         letting the thunk find it through the link register. the hit path's
+         bl is patched by the static dispatch thunk, so the exact layout is
+         fixed */
+      Register addr = a64_backend_reg(backend, target);
+
+      vixl::ExactAssemblyScope scope(&e, 6 * kInstructionSize);
+      e.ldr(tmp1.W(), 5);
+      e.cmp(addr, tmp1.W());
+      e.b(2, ne);
+      int64_t offset = ((const uint8_t *)backend->dispatch_static -
+                        e.GetCursorAddress<const uint8_t *>()) >>
+                       kInstructionSizeLog2;
+      e.bl(offset);
+      offset = ((const uint8_t *)backend->dispatch_ic -
+                e.GetCursorAddress<const uint8_t *>()) >>
+               kInstructionSizeLog2;
+      e.bl(offset);
+      e.dc32(JIT_IC_EMPTY);
+    } break;
+  }
+}
+
+static void a64_backend_emit_epilog(struct a64_backend *backend, struct ir *ir,
+                                    struct ir_block *block) {
+  /* if the block didn't branch to another address, return to dispatch */
+  struct ir_instr *last_instr =
+      list_last_entry(&block->instrs, struct ir_instr, it);
+
+  if (last_instr->op != OP_BRANCH && last_instr->op != OP_BRANCH_COND) {
+    a64_backend_emit_branch(backend, ir, NULL);
+  }
+}
+
+static void a64_backend_emit_prolog(struct a64_backend *backend, struct ir *ir,
+                                    struct ir_block *block,
+                                    jit_emit_cb emit_cb, void *emit_data) {
+  struct jit_guest *guest = backend->base.guest;
+
+  auto &e = *backend->codegen;
+
+  /* count number of instrs / cycles in the block, along with each block it
+     runs straight into. those blocks don't update the counts themselves */
+  int num_instrs = 0;
+  int num_cycles = 0;
+
+  struct ir_block *pred = ir_get_extended_pred(ir, block);
+  struct ir_block *counted = block;
+
+  if (pred && ir_get_straight_succ(ir, pred) == block) {
+    counted = NULL;
+  }
+
+  while (counted) {
+    list_for_each_entry(instr, &counted->instrs, struct ir_instr, it) {
+      if (instr->op == OP_SOURCE_INFO) {
+        num_instrs += 1;
+        num_cycles += instr->arg[1]->i32;
+      }
+    }
+
+    counted = ir_get_straight_succ(ir, counted);
+  }
+
+  int yield = ir_is_yield_point(ir, block);
+
+  if (yield || num_instrs) {
+    e.Ldr(tmp0.W(), MemOperand(guestctx, guest->offset_cycles));
+  }
+
+  if (yield) {
+    /* yield control once remaining cycles are executed */
+    e.Cmp(tmp0.W(), 0);
+    a64_backend_branch(backend, backend->dispatch_exit, mi);
+
+    /* yield control to any pending interrupts */
+    e.Ldr(tmp1, MemOperand(guestctx, guest->offset_interrupts));
+    e.Cmp(tmp1, 0);
+    a64_backend_branch(backend, backend->dispatch_interrupt, ne);
+  }
+
+  /* branches linked from other code may enter past the checks, reload the
+     cycles for them */
+  if (emit_cb && block == list_first_entry(&ir->blocks, struct ir_block, it)) {
+    emit_cb(emit_data, JIT_EMIT_LINK, 0, e.GetCursorAddress<uint8_t *>());
+    e.Ldr(tmp0.W(), MemOperand(guestctx, guest->offset_cycles));
+  }
+
+  if (!num_instrs) {
+    return;
+  }
+
+  /* update debug run counts */
+  e.Sub(tmp0.W(), tmp0.W(), num_cycles);
+  e.Str(tmp0.W(), MemOperand(guestctx, guest->offset_cycles));
+  e.Ldr(tmp1.W(), MemOperand(guestctx, guest->offset_instrs));
+  e.Add(tmp1.W(), tmp1.W(), num_instrs);
+  e.Str(tmp1.W(), MemOperand(guestctx, guest->offset_instrs));
+}
+
+void a64_backend_add_stub(struct a64_backend *backend,
+                          const struct ir_instr *instr) {
+  auto &e = *backend->codegen;
+
+  if (backend->num_stubs >= A64_MAX_STUBS) {
+    return;
+  }
+
+  /* the access is always the last instruction emitted */
+  struct a64_stub *stub = &backend->stubs[backend->num_stubs++];
+  stub->instr = instr;
+  stub->site = e.GetCursorAddress<uint8_t *>() - kInstructionSize;
+}
+
+static void a64_backend_emit_stub(struct a64_backend *backend,
+                                  struct a64_stub *stub) {
+  struct jit_guest *guest = backend->base.guest;
+  auto &e = *backend->codegen;
+  const struct ir_instr *instr = stub->instr;
+
+  /* perform the same call the exception handler would have forced, going
+     through the thunks to preserve the caller-saved registers */
+  e.Mov(arg0, (uint64_t)guest->mem);
+  a64_backend_mov_value(backend, arg1, instr->arg[0]);
+
+  if (instr->op == OP_LOAD_FAST) {
+    void *fn = nullptr;
+    uint64_t mask = 0;
+    switch (instr->result->type) {
+      case VALUE_I8:
+        fn = (void *)guest->r8;
+        mask = 0xff;
+        break;
+      case VALUE_I16:
+        fn = (void *)guest->r16;
+        mask = 0xffff;
+        break;
+      case VALUE_I32:
+        fn = (void *)guest->r32;
+        mask = 0xffffffff;
+        break;
+      case VALUE_I64:
+        fn = (void *)guest->r64;
+        mask = UINT64_C(0xffffffffffffffff);
+        break;
+      default:
+        LOG_FATAL("unexpected load result type");
+        break;
+    }
+
+    Register dst = a64_backend_reg(backend, instr->result);
+    e.Mov(x16, (uint64_t)fn);
+    e.Mov(x17, mask);
+    a64_backend_call(backend, (void *)backend->load_thunk[dst.GetCode()]);
+  } else {
+    void *fn = nullptr;
+    switch (instr->arg[1]->type) {
+      case VALUE_I8:
+        fn = (void *)guest->w8;
+        break;
+      case VALUE_I16:
+        fn = (void *)guest->w16;
+        break;
+      case VALUE_I32:
+        fn = (void *)guest->w32;
+        break;
+      case VALUE_I64:
+        fn = (void *)guest->w64;
+        break;
+      default:
+        LOG_FATAL("unexpected store value type");
+        break;
+    }
+
+    a64_backend_mov_value(backend, arg2, instr->arg[1]);
+    e.Mov(x16, (uint64_t)fn);
+    a64_backend_call(backend, (void *)backend->store_thunk);
+  }
+
+  a64_backend_branch(backend, stub->site + kInstructionSize, al);
+}
+
+static void a64_backend_emit(struct a64_backend *backend, struct ir *ir,
+                             jit_emit_cb emit_cb, void *emit_data) {
+  auto &e = *backend->codegen;
+
+  CHECK_LT(ir->locals_size, A64_STACK_SIZE);
+
+  backend->num_stubs = 0;
+
+  /* vixl labels aren't named, allocate one for each block for local branches
+     and stash its index in the block's tag */
+  int num_blocks = 0;
+  list_for_each_entry(block, &ir->blocks, struct ir_block, it) {
+    block->tag = num_blocks++;
+  }
+
+  backend->block_labels = new Label[num_blocks];
+  backend->num_block_labels = num_blocks;
+
+  list_for_each_entry(block, &ir->blocks, struct ir_block, it) {
+    int first = 1;
+
+    e.Bind(a64_backend_block_label(backend, block));
+    uint8_t *block_addr = e.GetCursorAddress<uint8_t *>();
+
+    a64_backend_emit_prolog(backend, ir, block, emit_cb, emit_data);
+
+    list_for_each_entry(instr, &block->instrs, struct ir_instr, it) {
+      /* call emit callback for each guest block / instruction enabling users
+         to map each to their corresponding host address */
+      if (emit_cb && instr->op == OP_SOURCE_INFO) {
+        uint32_t guest_addr = instr->arg[0]->i32;
+
+        if (first) {
+          emit_cb(emit_data, JIT_EMIT_BLOCK, guest_addr, block_addr);
+          first = 0;
+        }
+
+        uint8_t *instr_addr = e.GetCursorAddress<uint8_t *>();
+        emit_cb(emit_data, JIT_EMIT_INSTR, guest_addr, instr_addr);
+      }
+
+      struct jit_emitter *emitter = &a64_emitters[instr->op];
+      a64_emit_cb emit = (a64_emit_cb)emitter->func;
+      CHECK_NOTNULL(emit);
+      emit(backend, e, ir, instr);
+    }
+
+    a64_backend_emit_epilog(backend, ir, block);
+  }
+
+  /* emit the slow paths for each fastmem access after all of the blocks */
+  for (int i = 0; i < backend->num_stubs; i++) {
+    struct a64_stub *stub = &backend->stubs[i];
+    uint8_t *stub_addr = e.GetCursorAddress<uint8_t *>();
+
+    a64_backend_emit_stub(backend, stub);
+
+    if (emit_cb) {
+      emit_cb(emit_data, JIT_EMIT_SITE, 0, stub->site);
+      emit_cb(emit_data, JIT_EMIT_STUB, 0, stub_addr);
+    }
+  }
+
+  /* flush any pending literal / veneer pools */
+  e.FinalizeCode(MacroAssembler::kFallThrough);
+}
+
+static int a64_backend_assemble_code(struct jit_backend *base, struct ir *ir,
+                                     uint8_t **addr, int *size,
+                                     uint8_t **cold_addr, int *cold_size,
+                                     jit_emit_cb emit_cb, void *emit_data) {
+  struct a64_backend *backend = container_of(base, struct a64_backend, base);
+  auto &e = *backend->codegen;
+
+  int res = 1;
+  uint8_t *code = e.GetCursorAddress<uint8_t *>();
+
+  /* try to generate the a64 code. vixl is built with a static code buffer,
+     which throws when it overflows. if that happens, or the code ran past the
+     end of the current region, let the jit know so it can evict the next
+     region and try again
+
+     note, vixl's buffer can't be limited to the region, so code overflowing
+     it spills into the next region. this is fine, as the jit evicts that
+     region before any of its code can run again */
+  try {
+    a64_backend_emit(backend, ir, emit_cb, emit_data);
+  } catch (const std::runtime_error &) {
+    res = 0;
+  }
+
+  if (e.GetCursorAddress<uint8_t *>() > backend->codegen_end) {
+    res = 0;
+  }
+
+  /* labels must be resolved before they're destroyed. if the emit failed
+     midway, bind the stragglers to the current position, the code is about to
+     be discarded anyways */
+  for (int i = 0; i < backend->num_block_labels; i++) {
+    Label *label = &backend->block_labels[i];
+
+    if (!label->IsBound()) {
+      e.Bind(label);
+    }
+  }
+
+  delete[] backend->block_labels;
+  backend->block_labels = NULL;
+  backend->num_block_labels = 0;
+
+  /* return code address */
+  *addr = code;
+  *size = (int)(e.GetCursorAddress<uint8_t *>() - code);
+  *cold_addr = NULL;
+  *cold_size = 0;
+
+  /* the instruction cache isn't coherent with the data cache on arm */
+  if (res) {
+    __builtin___clear_cache((char *)code, (char *)code + *size);
+  }
+
+  return res;
+}
+
+static void a64_backend_reset(struct jit_backend *base, uint8_t *region,
+                              int region_size) {
+  struct a64_backend *backend = container_of(base, struct a64_backend, base);
+  vixl::CodeBuffer *buffer = backend->codegen->GetBuffer();
+
+  /* the thunks live before the region, so there's no need to reemit them.
+     just move the cursor to the start of the region */
+  buffer->Rewind(region - buffer->GetStartAddress<uint8_t *>());
+  backend->codegen_end = region + region_size;
+}
+
+static void a64_backend_destroy(struct jit_backend *base) {
+  struct a64_backend *backend = container_of(base, struct a64_backend, base);
+
+  delete backend->disasm;
+  delete backend->decoder;
+
+  delete backend->codegen;
+
+  a64_dispatch_shutdown(backend);
+
+  if (backend->code_alloc) {
+    release_pages(backend->code_alloc, backend->code_alloc_size);
+  }
+
+  free(backend);
+}
+
+struct jit_backend *a64_backend_create(struct jit_guest *guest, void *code,
+                                       int code_size) {
+  struct a64_backend *backend =
+      (struct a64_backend *)calloc(1, sizeof(struct a64_backend));
+
+  backend->base.guest = guest;
+  backend->base.name = "a64";
+  backend->base.destroy = &a64_backend_destroy;
+
+  /* compile interface */
+  backend->base.registers = a64_registers;
+  backend->base.num_registers = ARRAY_SIZE(a64_registers);
+  backend->base.emitters = a64_emitters;
+  backend->base.num_emitters = ARRAY_SIZE(a64_emitters);
+  backend->base.reset = &a64_backend_reset;
+  backend->base.assemble_code = &a64_backend_assemble_code;
+  backend->base.dump_code = &a64_backend_dump_code;
+  backend->base.handle_exception = &a64_backend_handle_exception;
+
+  /* dispatch interface */
+  backend->base.run_code = &a64_dispatch_run_code;
+  backend->base.lookup_code = &a64_dispatch_lookup_code;
+  backend->base.cache_code = &a64_dispatch_cache_code;
+  backend->base.invalidate_code = &a64_dispatch_invalidate_code;
+  backend->base.patch_edge = &a64_dispatch_patch_edge;
+  backend->base.restore_edge = &a64_dispatch_restore_edge;
+
+  /* setup codegen buffer */
+  if (!code) {
+    code_size = ALIGN_UP(code_size, (int)get_allocation_granularity());
+    code = alloc_pages(NULL, code_size, ACC_READWRITEEXEC);
+    CHECK_NOTNULL(code, "failed to allocate %d byte code buffer", code_size);
+
+    backend->code_alloc = code;
+    backend->code_alloc_size = code_size;
+  } else {
+    int r = protect_pages(code, code_size, ACC_READWRITEEXEC);
+    CHECK(r);
+  }
+
+  /* conditional branches to the thunks have a range of +-1 MB */
+  CHECK_LE(code_size, 0x100000);
+
+  backend->codegen = new MacroAssembler((vixl::byte *)code, code_size);
+  backend->codegen_end = (uint8_t *)code + code_size;
+  backend->base.code = (uint8_t *)code + A64_THUNK_SIZE;
+  backend->base.code_size = code_size - A64_THUNK_SIZE;
+
+  /* create disassembler */
+  backend->decoder = new Decoder();
+  backend->disasm = new Disassembler();
+  backend->decoder->AppendVisitor(backend->disasm);
+
+  /* emit initial thunks */
+  a64_dispatch_init(backend);
+  a64_dispatch_emit_thunks(backend);
+  a64_backend_emit_thunks(backend);
+  backend->codegen->FinalizeCode(MacroAssembler::kFallThrough);
+  CHECK_LT(backend->codegen->GetCursorOffset(), A64_THUNK_SIZE);
+
+  /* pad out the thunks so the cursor can always be rewound to them */
+  while (backend->codegen->GetCursorOffset() < A64_THUNK_SIZE) {
+    backend->codegen->Brk(0);
+  }
+
+  __builtin___clear_cache((char *)code, (char *)code + A64_THUNK_SIZE);
+
+  return &backend->base;
+}
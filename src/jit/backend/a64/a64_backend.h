@@ -0,0 +1,13 @@
+#ifndef A64_BACKEND_H
+#define A64_BACKEND_H
+
+#include "jit/jit_backend.h"
+
+struct jit_guest;
+
+/* when code is NULL, a buffer of code_size bytes is allocated, and freed along
+   with the backend */
+struct jit_backend *a64_backend_create(struct jit_guest *guest, void *code,
+                                       int code_size);
+
+#endif
@@ -0,0 +1,227 @@
+#include "jit/backend/a64/a64_local.h"
+
+extern "C" {
+#include "core/core.h"
+#include "jit/jit.h"
+#include "jit/jit_guest.h"
+#include "stats.h"
+}
+
+using namespace vixl::aarch64;
+
+/* controls if edges are added and managed between static branches. the first
+   time each branch is hit, its destination block will be dynamically looked
+   up. if this is enabled, an edge will be added between the two blocks, and
+   the branch will be patched to directly jmp to the destination block,
+   avoiding the need for redundant lookups */
+#define LINK_STATIC_BRANCHES 1
+
+static inline void **a64_dispatch_code_ptr(struct a64_backend *backend,
+                                           uint32_t addr) {
+  return &backend->cache[(addr & backend->cache_mask) >> backend->cache_shift];
+}
+
+/* encode an unconditional b / bl at code to dst */
+static void a64_dispatch_patch_branch(void *code, const void *dst, int link) {
+  int64_t offset = ((const uint8_t *)dst - (const uint8_t *)code) >>
+                   kInstructionSizeLog2;
+  CHECK(vixl::IsInt26(offset));
+
+  uint32_t instr = (link ? BL : B) | Assembler::ImmUncondBranch(offset);
+  *(uint32_t *)code = instr;
+
+  __builtin___clear_cache((char *)code, (char *)code + kInstructionSize);
+}
+
+void a64_dispatch_restore_edge(struct jit_backend *base, void *code,
+                               uint32_t dst) {
+  struct a64_backend *backend = container_of(base, struct a64_backend, base);
+  a64_dispatch_patch_branch(code, backend->dispatch_static, 1);
+}
+
+void a64_dispatch_patch_edge(struct jit_backend *base, void *code, void *dst) {
+  a64_dispatch_patch_branch(code, dst, 0);
+}
+
+void a64_dispatch_invalidate_code(struct jit_backend *base, uint32_t addr) {
+  struct a64_backend *backend = container_of(base, struct a64_backend, base);
+  void **entry = a64_dispatch_code_ptr(backend, addr);
+  *entry = backend->dispatch_compile;
+}
+
+void a64_dispatch_cache_code(struct jit_backend *base, uint32_t addr,
+                             void *code) {
+  struct a64_backend *backend = container_of(base, struct a64_backend, base);
+  void **entry = a64_dispatch_code_ptr(backend, addr);
+  CHECK_EQ(*entry, backend->dispatch_compile);
+  *entry = code;
+}
+
+void *a64_dispatch_lookup_code(struct jit_backend *base, uint32_t addr) {
+  struct a64_backend *backend = container_of(base, struct a64_backend, base);
+  void **entry = a64_dispatch_code_ptr(backend, addr);
+  return *entry;
+}
+
+void a64_dispatch_run_code(struct jit_backend *base, int cycles) {
+  struct a64_backend *backend = container_of(base, struct a64_backend, base);
+  backend->dispatch_enter(cycles);
+}
+
+void a64_dispatch_emit_thunks(struct a64_backend *backend) {
+  struct jit_guest *guest = backend->base.guest;
+
+  auto &e = *backend->codegen;
+  Label dispatch_dynamic;
+  Label dispatch_interrupt;
+  Label dispatch_exit;
+
+  /* emit dispatch thunks */
+  {
+    /* called after a dynamic branch instruction stores the next pc to the
+       context. looks up the host block for it jumps to it */
+    e.Bind(&dispatch_dynamic);
+
+    backend->dispatch_dynamic = e.GetCursorAddress<void *>();
+
+    /* invasively look into the jit's cache */
+    e.Mov(tmp0, (uint64_t)backend->cache);
+    e.Ldr(tmp1.W(), MemOperand(guestctx, guest->offset_pc));
+    e.And(tmp1.W(), tmp1.W(), backend->cache_mask);
+    e.Lsr(tmp1.W(), tmp1.W(), backend->cache_shift);
+    e.Ldr(tmp0, MemOperand(tmp0, tmp1, LSL, kXRegSizeInBytesLog2));
+    e.Br(tmp0);
+  }
+
+  {
+    /* called after a static branch instruction stores the next pc to the
+       context. the thunk calls jit_add_edge which adds an edge between the
+       calling block and the branch destination block, and then falls through
+       to the above dynamic branch thunk. on the second run through this code
+       jit_add_edge will call a64_dispatch_patch_edge, patching the caller to
+       directly jump to the destination block */
+    backend->dispatch_static = e.GetCursorAddress<void *>();
+
+#if LINK_STATIC_BRANCHES
+    e.Mov(arg0, (uint64_t)guest->data);
+    e.Sub(arg1, lr, kInstructionSize /* sizeof bl instr */);
+    e.Ldr(arg2.W(), MemOperand(guestctx, guest->offset_pc));
+    e.Mov(tmp0, (uint64_t)guest->link_code);
+    e.Blr(tmp0);
+#endif
+    e.B(&dispatch_dynamic);
+  }
+
+  {
+    /* called when a dynamic branch misses its inline cache. if the cache is
+       still empty, the current pc is recorded as its tag, else the site is
+       treated as polymorphic and always goes through dynamic dispatch. the
+       tag is only ever read as data, so no cache maintenance is needed */
+    backend->dispatch_ic = e.GetCursorAddress<void *>();
+
+    e.Ldr(tmp0.W(), MemOperand(lr));
+    e.Cmp(tmp0.W(), JIT_IC_EMPTY);
+    e.B(ne, &dispatch_dynamic);
+    e.Ldr(tmp0.W(), MemOperand(guestctx, guest->offset_pc));
+    e.Str(tmp0.W(), MemOperand(lr));
+    e.B(&dispatch_dynamic);
+  }
+
+  {
+    /* processes the pending interrupt request, and then jumps to the new pc
+       through the dynamic dispatch thunk */
+    e.Bind(&dispatch_interrupt);
+
+    backend->dispatch_interrupt = e.GetCursorAddress<void *>();
+
+    e.Mov(arg0, (uint64_t)guest->data);
+    e.Mov(tmp0, (uint64_t)guest->check_interrupts);
+    e.Blr(tmp0);
+    e.B(&dispatch_dynamic);
+  }
+
+  {
+    /* entry point to the compiled a64 code. sets up the stack frame, sets up
+       fixed registers (context and memory base) and then jumps to the current
+       pc through the dynamic dispatch thunk */
+    backend->dispatch_enter = e.GetCursorAddress<void (*)(int)>();
+
+    /* create stack frame. the frame pointer and link register aren't part of
+       the register table, so save them explicitly */
+    e.Stp(x29, x30, MemOperand(sp, -16, PreIndex));
+    e.Mov(x29, sp);
+    a64_backend_push_regs(backend, JIT_CALLEE_SAVE);
+    e.Sub(sp, sp, A64_STACK_SIZE);
+
+    /* assign fixed registers */
+    e.Mov(guestctx, (uint64_t)guest->ctx);
+    e.Mov(guestmem, (uint64_t)guest->membase);
+
+    /* reset run state */
+    e.Str(arg0.W(), MemOperand(guestctx, guest->offset_cycles));
+    e.Str(wzr, MemOperand(guestctx, guest->offset_instrs));
+
+    e.B(&dispatch_dynamic);
+  }
+
+  {
+    /* exit point for the compiled a64 code, tears down the stack frame and
+       returns */
+    e.Bind(&dispatch_exit);
+
+    backend->dispatch_exit = e.GetCursorAddress<void *>();
+
+    /* destroy stack frame */
+    e.Add(sp, sp, A64_STACK_SIZE);
+    a64_backend_pop_regs(backend, JIT_CALLEE_SAVE);
+    e.Ldp(x29, x30, MemOperand(sp, 16, PostIndex));
+
+    e.Ret();
+  }
+
+  {
+    /* default cache entry for all blocks. compiles the desired pc before
+       jumping to the block through the dynamic dispatch thunk
+
+       note, when compiling in the background, the block may have instead been
+       interpreted by the compile callback. in that case, no block prologue
+       has run to check the remaining cycles or pending interrupts, so check
+       them here before dispatching to the next block */
+    backend->dispatch_compile = e.GetCursorAddress<void *>();
+
+    e.Mov(arg0, (uint64_t)guest->data);
+    e.Ldr(arg1.W(), MemOperand(guestctx, guest->offset_pc));
+    e.Mov(tmp0, (uint64_t)guest->compile_code);
+    e.Blr(tmp0);
+    e.Ldr(tmp0.W(), MemOperand(guestctx, guest->offset_cycles));
+    e.Tbnz(tmp0.W(), 31, &dispatch_exit);
+    e.Ldr(tmp0, MemOperand(guestctx, guest->offset_interrupts));
+    e.Cbnz(tmp0, &dispatch_interrupt);
+    e.B(&dispatch_dynamic);
+  }
+
+  /* reset cache entries to point to the new compile thunk */
+  for (int i = 0; i < backend->cache_size; i++) {
+    backend->cache[i] = backend->dispatch_compile;
+  }
+}
+
+void a64_dispatch_shutdown(struct a64_backend *backend) {
+  free(backend->cache);
+
+  prof_counter_add(COUNTER_mem_jit_dispatch,
+                   -(int64_t)(backend->cache_size * sizeof(void *)));
+}
+
+void a64_dispatch_init(struct a64_backend *backend) {
+  struct jit_guest *guest = backend->base.guest;
+
+  /* initialize code cache, one entry per possible block begin */
+  backend->cache_mask = guest->addr_mask;
+  backend->cache_shift = ctz32(guest->addr_mask);
+  backend->cache_size = (backend->cache_mask >> backend->cache_shift) + 1;
+  backend->cache = (void **)malloc(backend->cache_size * sizeof(void *));
+
+  prof_counter_add(COUNTER_mem_jit_dispatch,
+                   backend->cache_size * sizeof(void *));
+}
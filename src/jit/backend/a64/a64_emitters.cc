@@ -0,0 +1,956 @@
+#include "jit/backend/a64/a64_local.h"
+
+extern "C" {
+#include "jit/ir/ir.h"
+#include "jit/jit.h"
+#include "jit/jit_guest.h"
+}
+
+using namespace vixl::aarch64;
+
+#define EMITTER(op, constraints)                                            \
+  void a64_emit_##op(struct a64_backend *, MacroAssembler &, struct ir *,   \
+                     struct ir_instr *);                                    \
+  static struct _a64_##op##_init {                                          \
+    _a64_##op##_init() {                                                    \
+      a64_emitters[OP_##op] = {(void *)&a64_emit_##op, constraints};        \
+    }                                                                       \
+  } a64_##op##_init;                                                        \
+  void a64_emit_##op(struct a64_backend *backend, MacroAssembler &e,        \
+                     struct ir *ir, struct ir_instr *instr)
+
+#define CONSTRAINTS(result_flags, ...) \
+  result_flags, {                      \
+    __VA_ARGS__                        \
+  }
+
+#define RES instr->result
+#define ARG0 instr->arg[0]
+#define ARG1 instr->arg[1]
+#define ARG2 instr->arg[2]
+#define ARG3 instr->arg[3]
+
+#define RES_REG a64_backend_reg(backend, RES)
+#define ARG0_REG a64_backend_reg(backend, ARG0)
+#define ARG1_REG a64_backend_reg(backend, ARG1)
+#define ARG2_REG a64_backend_reg(backend, ARG2)
+#define ARG3_REG a64_backend_reg(backend, ARG3)
+
+#define RES_VREG a64_backend_vreg(backend, RES)
+#define ARG0_VREG a64_backend_vreg(backend, ARG0)
+#define ARG1_VREG a64_backend_vreg(backend, ARG1)
+#define ARG2_VREG a64_backend_vreg(backend, ARG2)
+#define ARG3_VREG a64_backend_vreg(backend, ARG3)
+
+/* unlike x64, all arithmetic ops take three operands, so no results are
+   constrained to reuse arg0 */
+enum {
+  NONE = 0,
+  REG_I64 = JIT_REG_I64,
+  REG_F64 = JIT_REG_F64,
+  REG_V128 = JIT_REG_V128,
+  REG_ALL = REG_I64 | REG_F64 | REG_V128,
+  IMM_I32 = JIT_IMM_I32,
+  IMM_I64 = JIT_IMM_I64,
+  IMM_F32 = JIT_IMM_F32,
+  IMM_F64 = JIT_IMM_F64,
+  IMM_BLK = JIT_IMM_BLK,
+  IMM_ALL = IMM_I32 | IMM_I64 | IMM_F32 | IMM_F64 | IMM_BLK,
+  VAL_I64 = REG_I64 | IMM_I64,
+  VAL_ALL = REG_ALL | IMM_ALL,
+  OPT = JIT_OPTIONAL,
+  OPT_I64 = OPT | VAL_I64,
+};
+
+struct jit_emitter a64_emitters[IR_NUM_OPS];
+
+/* i8 and i16 values are kept zero-extended in their 32-bit registers. ops
+   which may carry into the upper bits must truncate their result */
+static void a64_emit_normalize(MacroAssembler &e, const Register &rd,
+                               enum ir_type type) {
+  switch (type) {
+    case VALUE_I8:
+      e.Uxtb(rd, rd);
+      break;
+    case VALUE_I16:
+      e.Uxth(rd, rd);
+      break;
+    default:
+      break;
+  }
+}
+
+static Operand a64_emit_operand(struct a64_backend *backend,
+                                const struct ir_value *v) {
+  if (ir_is_constant(v)) {
+    return Operand(ir_zext_constant(v));
+  }
+
+  return Operand(a64_backend_reg(backend, v));
+}
+
+/* sign-extend a narrow value into tmp so it can be used in signed ops */
+static Register a64_emit_sext(struct a64_backend *backend, MacroAssembler &e,
+                              const Register &tmp, const struct ir_value *v) {
+  Register rd = v->type == VALUE_I64 ? tmp.X() : tmp.W();
+
+  if (ir_is_constant(v)) {
+    switch (v->type) {
+      case VALUE_I8:
+        e.Mov(rd, (int64_t)v->i8);
+        break;
+      case VALUE_I16:
+        e.Mov(rd, (int64_t)v->i16);
+        break;
+      case VALUE_I32:
+        e.Mov(rd, (int64_t)v->i32);
+        break;
+      default:
+        e.Mov(rd, v->i64);
+        break;
+    }
+    return rd;
+  }
+
+  Register ra = a64_backend_reg(backend, v);
+
+  switch (v->type) {
+    case VALUE_I8:
+      e.Sxtb(rd, ra);
+      return rd;
+    case VALUE_I16:
+      e.Sxth(rd, ra);
+      return rd;
+    default:
+      return ra;
+  }
+}
+
+EMITTER(SOURCE_INFO, CONSTRAINTS(NONE, IMM_I32, IMM_I32)) {}
+
+EMITTER(FALLBACK, CONSTRAINTS(NONE, IMM_I64, IMM_I32, IMM_I32)) {
+  struct jit_guest *guest = backend->base.guest;
+  void *fallback = (void *)ARG0->i64;
+  uint32_t addr = ARG1->i32;
+  uint32_t raw_instr = ARG2->i32;
+
+  e.Mov(arg0, (uint64_t)guest);
+  e.Mov(arg1.W(), addr);
+  e.Mov(arg2.W(), raw_instr);
+  a64_backend_call(backend, fallback);
+}
+
+EMITTER(LOAD_HOST, CONSTRAINTS(REG_ALL, REG_I64)) {
+  struct ir_value *dst = RES;
+  Register src = ARG0_REG;
+
+  a64_backend_load_mem(backend, dst, MemOperand(src));
+}
+
+EMITTER(STORE_HOST, CONSTRAINTS(NONE, REG_I64, VAL_ALL)) {
+  Register dst = ARG0_REG;
+  struct ir_value *data = ARG1;
+
+  a64_backend_store_mem(backend, MemOperand(dst), data);
+}
+
+EMITTER(LOAD_GUEST, CONSTRAINTS(REG_ALL, REG_I64 | IMM_I32)) {
+  struct jit_guest *guest = backend->base.guest;
+  Register dst = RES_REG;
+  struct ir_value *addr = ARG0;
+
+  /* peel away one layer of abstraction and directly access the backing
+     memory or directly invoke the callback when the address is constant. the
+     mmio callbacks only deal with 32-bit values, so 64-bit mmio accesses still
+     go through the generic handler. registers without side effects are
+     accessed directly as well */
+  void *userdata = NULL;
+  uint8_t *ptr = NULL;
+  mem_read_cb read = NULL;
+  if (ir_is_constant(addr)) {
+    guest->lookup(guest->mem, addr->i32, &userdata, &ptr, &read, NULL);
+
+    if (!ptr && read && ir_type_size(RES->type) == 4 && guest->lookup_reg) {
+      ptr = (uint8_t *)guest->lookup_reg(guest->mem, addr->i32, 0);
+    }
+  }
+
+  if (ptr || (read && ir_type_size(RES->type) <= 4)) {
+    if (ptr) {
+      e.Mov(tmp0, (uint64_t)ptr);
+      a64_backend_load_mem(backend, RES, MemOperand(tmp0));
+    } else {
+      int data_size = ir_type_size(RES->type);
+      uint32_t data_mask = (uint32_t)((1ull << (data_size * 8)) - 1);
+
+      e.Mov(arg0, (uint64_t)userdata);
+      e.Mov(arg1.W(), (uint32_t)addr->i32);
+      e.Mov(arg2.W(), data_mask);
+      a64_backend_call(backend, (void *)read);
+      e.Mov(dst, Register(0, dst.GetSizeInBits()));
+      a64_emit_normalize(e, dst, RES->type);
+    }
+  } else {
+    void *fn = nullptr;
+    switch (RES->type) {
+      case VALUE_I8:
+        fn = (void *)guest->r8;
+        break;
+      case VALUE_I16:
+        fn = (void *)guest->r16;
+        break;
+      case VALUE_I32:
+        fn = (void *)guest->r32;
+        break;
+      case VALUE_I64:
+        fn = (void *)guest->r64;
+        break;
+      default:
+        LOG_FATAL("unexpected load result type");
+        break;
+    }
+
+    e.Mov(arg0, (uint64_t)guest->mem);
+    a64_backend_mov_value(backend, arg1, addr);
+    a64_backend_call(backend, fn);
+    e.Mov(dst, Register(0, dst.GetSizeInBits()));
+    a64_emit_normalize(e, dst, RES->type);
+  }
+}
+
+EMITTER(STORE_GUEST, CONSTRAINTS(NONE, REG_I64 | IMM_I32, VAL_ALL)) {
+  struct jit_guest *guest = backend->base.guest;
+  struct ir_value *addr = ARG0;
+  struct ir_value *data = ARG1;
+
+  /* peel away one layer of abstraction and directly access the backing
+     memory or directly invoke the callback when the address is constant. the
+     mmio callbacks only deal with 32-bit values, so 64-bit mmio accesses still
+     go through the generic handler. registers without side effects are
+     accessed directly as well */
+  void *userdata = NULL;
+  uint8_t *ptr = NULL;
+  mem_write_cb write = NULL;
+  if (ir_is_constant(addr)) {
+    guest->lookup(guest->mem, addr->i32, &userdata, &ptr, NULL, &write);
+
+    if (!ptr && write && ir_type_size(data->type) == 4 && guest->lookup_reg) {
+      ptr = (uint8_t *)guest->lookup_reg(guest->mem, addr->i32, 1);
+    }
+  }
+
+  if (ptr || (write && ir_type_size(data->type) <= 4)) {
+    if (ptr) {
+      e.Mov(tmp0, (uint64_t)ptr);
+      a64_backend_store_mem(backend, MemOperand(tmp0), data);
+    } else {
+      int data_size = ir_type_size(data->type);
+      uint32_t data_mask = (uint32_t)((1ull << (data_size * 8)) - 1);
+
+      e.Mov(arg0, (uint64_t)userdata);
+      e.Mov(arg1.W(), (uint32_t)addr->i32);
+      a64_backend_mov_value(backend, arg2, data);
+      e.Mov(arg3.W(), data_mask);
+      a64_backend_call(backend, (void *)write);
+    }
+  } else {
+    void *fn = nullptr;
+    switch (data->type) {
+      case VALUE_I8:
+        fn = (void *)guest->w8;
+        break;
+      case VALUE_I16:
+        fn = (void *)guest->w16;
+        break;
+      case VALUE_I32:
+        fn = (void *)guest->w32;
+        break;
+      case VALUE_I64:
+        fn = (void *)guest->w64;
+        break;
+      default:
+        LOG_FATAL("unexpected store value type");
+        break;
+    }
+
+    e.Mov(arg0, (uint64_t)guest->mem);
+    a64_backend_mov_value(backend, arg1, addr);
+    a64_backend_mov_value(backend, arg2, data);
+    a64_backend_call(backend, fn);
+  }
+}
+
+EMITTER(LOAD_FAST, CONSTRAINTS(REG_ALL, REG_I64)) {
+  struct ir_value *dst = RES;
+  Register addr = ARG0_REG;
+  MemOperand mem(guestmem, addr.W(), UXTW);
+
+  /* the exception handler and its thunks only deal with integer registers,
+     load float values through tmp0 */
+  if (ir_is_float(dst->type)) {
+    Register tmp = dst->type == VALUE_F64 ? tmp0.X() : tmp0.W();
+    CHECK(!ir_is_vector(dst->type));
+    e.Ldr(tmp, mem);
+    e.Fmov(RES_VREG, tmp);
+    return;
+  }
+
+  a64_backend_load_mem(backend, dst, mem);
+  a64_backend_add_stub(backend, instr);
+}
+
+EMITTER(STORE_FAST, CONSTRAINTS(NONE, REG_I64, VAL_ALL)) {
+  Register addr = ARG0_REG;
+  struct ir_value *data = ARG1;
+  MemOperand mem(guestmem, addr.W(), UXTW);
+
+  /* the exception handler and its thunks only deal with integer registers,
+     store float values through tmp0 */
+  if (ir_is_float(data->type) && !ir_is_constant(data)) {
+    Register tmp = data->type == VALUE_F64 ? tmp0.X() : tmp0.W();
+    CHECK(!ir_is_vector(data->type));
+    e.Fmov(tmp, ARG1_VREG);
+    e.Str(tmp, mem);
+    return;
+  }
+
+  a64_backend_store_mem(backend, mem, data);
+
+  if (ir_is_int(data->type)) {
+    a64_backend_add_stub(backend, instr);
+  }
+}
+
+EMITTER(LOAD_CONTEXT, CONSTRAINTS(REG_ALL, IMM_I32)) {
+  struct ir_value *dst = RES;
+  int offset = ARG0->i32;
+
+  a64_backend_load_mem(backend, dst, MemOperand(guestctx, offset));
+}
+
+EMITTER(STORE_CONTEXT, CONSTRAINTS(NONE, IMM_I32, VAL_ALL)) {
+  int offset = ARG0->i32;
+  struct ir_value *data = ARG1;
+
+  a64_backend_store_mem(backend, MemOperand(guestctx, offset), data);
+}
+
+EMITTER(LOAD_LOCAL, CONSTRAINTS(REG_ALL, IMM_I32)) {
+  struct ir_value *dst = RES;
+  int offset = A64_STACK_LOCALS + ARG0->i32;
+
+  a64_backend_load_mem(backend, dst, MemOperand(sp, offset));
+}
+
+EMITTER(STORE_LOCAL, CONSTRAINTS(NONE, IMM_I32, VAL_ALL)) {
+  int offset = A64_STACK_LOCALS + ARG0->i32;
+  struct ir_value *data = ARG1;
+
+  a64_backend_store_mem(backend, MemOperand(sp, offset), data);
+}
+
+EMITTER(FTOI, CONSTRAINTS(REG_I64, REG_F64)) {
+  Register rd = RES_REG;
+  VRegister ra = ARG0_VREG;
+
+  switch (RES->type) {
+    case VALUE_I32:
+      /* fcvtzs saturates underflows to INT32_MIN and overflows to INT32_MAX,
+         matching OP_FTOI, so no clamp is needed like on x64 */
+      e.Fcvtzs(rd, ra);
+      break;
+    default:
+      LOG_FATAL("unexpected result type");
+      break;
+  }
+}
+
+EMITTER(ITOF, CONSTRAINTS(REG_F64, REG_I64)) {
+  VRegister rd = RES_VREG;
+  Register ra = ARG0_REG;
+
+  switch (RES->type) {
+    case VALUE_F32:
+      CHECK_EQ(ARG0->type, VALUE_I32);
+      e.Scvtf(rd, ra);
+      break;
+    case VALUE_F64:
+      CHECK_EQ(ARG0->type, VALUE_I64);
+      e.Scvtf(rd, ra);
+      break;
+    default:
+      LOG_FATAL("unexpected result type");
+      break;
+  }
+}
+
+EMITTER(SEXT, CONSTRAINTS(REG_I64, REG_I64)) {
+  Register rd = RES_REG;
+  Register ra = ARG0_REG;
+
+  switch (ARG0->type) {
+    case VALUE_I8:
+      e.Sxtb(rd, Register(ra.GetCode(), rd.GetSizeInBits()));
+      break;
+    case VALUE_I16:
+      e.Sxth(rd, Register(ra.GetCode(), rd.GetSizeInBits()));
+      break;
+    case VALUE_I32:
+      if (rd.Is64Bits()) {
+        e.Sxtw(rd, ra);
+      } else if (!rd.Is(ra)) {
+        e.Mov(rd, ra);
+      }
+      break;
+    default:
+      LOG_FATAL("unexpected value type");
+      break;
+  }
+
+  a64_emit_normalize(e, rd, RES->type);
+}
+
+EMITTER(ZEXT, CONSTRAINTS(REG_I64, REG_I64)) {
+  Register rd = RES_REG;
+  Register ra = ARG0_REG;
+
+  /* narrow values are already zero-extended to 32-bits, and writing the 32-bit
+     register zero fills the upper 32-bits */
+  if (rd.GetCode() != ra.GetCode() || rd.Is64Bits()) {
+    e.Mov(rd.W(), ra.W());
+  }
+}
+
+EMITTER(TRUNC, CONSTRAINTS(REG_I64, REG_I64)) {
+  Register rd = RES_REG;
+  Register ra = ARG0_REG;
+
+  switch (RES->type) {
+    case VALUE_I8:
+      e.Uxtb(rd, ra.W());
+      break;
+    case VALUE_I16:
+      e.Uxth(rd, ra.W());
+      break;
+    case VALUE_I32:
+      e.Mov(rd, ra.W());
+      break;
+    default:
+      LOG_FATAL("unexpected value type");
+  }
+}
+
+EMITTER(FEXT, CONSTRAINTS(REG_F64, REG_F64)) {
+  VRegister rd = RES_VREG;
+  VRegister ra = ARG0_VREG;
+
+  e.Fcvt(rd, ra);
+}
+
+EMITTER(FTRUNC, CONSTRAINTS(REG_F64, REG_F64)) {
+  VRegister rd = RES_VREG;
+  VRegister ra = ARG0_VREG;
+
+  e.Fcvt(rd, ra);
+}
+
+EMITTER(SELECT, CONSTRAINTS(REG_I64, REG_I64, REG_I64, REG_I64)) {
+  Register rd = RES_REG;
+  Register t = ARG0_REG;
+  Register f = ARG1_REG;
+  Register cond = ARG2_REG;
+
+  e.Cmp(cond, 0);
+  e.Csel(rd, t, f, ne);
+}
+
+EMITTER(CMP, CONSTRAINTS(REG_I64, REG_I64, REG_I64 | IMM_I32, IMM_I32)) {
+  Register rd = RES_REG;
+  enum ir_cmp cmp = (enum ir_cmp)ARG2->i32;
+
+  int is_signed = cmp == CMP_SGE || cmp == CMP_SGT || cmp == CMP_SLE ||
+                  cmp == CMP_SLT;
+
+  if (is_signed && ir_type_size(ARG0->type) < 4) {
+    /* narrow values are zero-extended, sign-extend them for the compare */
+    Register ra = a64_emit_sext(backend, e, tmp0, ARG0);
+    Register rb = a64_emit_sext(backend, e, tmp1, ARG1);
+    e.Cmp(ra, rb);
+  } else {
+    Register ra = ARG0_REG;
+    e.Cmp(ra, a64_emit_operand(backend, ARG1));
+  }
+
+  switch (cmp) {
+    case CMP_EQ:
+      e.Cset(rd, eq);
+      break;
+    case CMP_NE:
+      e.Cset(rd, ne);
+      break;
+    case CMP_SGE:
+      e.Cset(rd, ge);
+      break;
+    case CMP_SGT:
+      e.Cset(rd, gt);
+      break;
+    case CMP_UGE:
+      e.Cset(rd, hs);
+      break;
+    case CMP_UGT:
+      e.Cset(rd, hi);
+      break;
+    case CMP_SLE:
+      e.Cset(rd, le);
+      break;
+    case CMP_SLT:
+      e.Cset(rd, lt);
+      break;
+    case CMP_ULE:
+      e.Cset(rd, ls);
+      break;
+    case CMP_ULT:
+      e.Cset(rd, lo);
+      break;
+    default:
+      LOG_FATAL("unexpected comparison type");
+  }
+}
+
+EMITTER(FCMP, CONSTRAINTS(REG_I64, REG_F64, REG_F64, IMM_I32)) {
+  Register rd = RES_REG;
+  VRegister ra = ARG0_VREG;
+  VRegister rb = ARG1_VREG;
+
+  e.Fcmp(ra, rb);
+
+  /* the conditions are chosen so each comparison is false when unordered,
+     except for CMP_NE */
+  enum ir_cmp cmp = (enum ir_cmp)ARG2->i32;
+  switch (cmp) {
+    case CMP_EQ:
+      e.Cset(rd, eq);
+      break;
+    case CMP_NE:
+      e.Cset(rd, ne);
+      break;
+    case CMP_SGE:
+      e.Cset(rd, ge);
+      break;
+    case CMP_SGT:
+      e.Cset(rd, gt);
+      break;
+    case CMP_SLE:
+      e.Cset(rd, ls);
+      break;
+    case CMP_SLT:
+      e.Cset(rd, mi);
+      break;
+    default:
+      LOG_FATAL("unexpected comparison type");
+  }
+}
+
+EMITTER(ADD, CONSTRAINTS(REG_I64, REG_I64, REG_I64 | IMM_I32)) {
+  Register rd = RES_REG;
+  Register ra = ARG0_REG;
+
+  e.Add(rd, ra, a64_emit_operand(backend, ARG1));
+  a64_emit_normalize(e, rd, RES->type);
+}
+
+EMITTER(SUB, CONSTRAINTS(REG_I64, REG_I64, REG_I64 | IMM_I32)) {
+  Register rd = RES_REG;
+  Register ra = ARG0_REG;
+
+  e.Sub(rd, ra, a64_emit_operand(backend, ARG1));
+  a64_emit_normalize(e, rd, RES->type);
+}
+
+EMITTER(SMUL, CONSTRAINTS(REG_I64, REG_I64, REG_I64)) {
+  Register rd = RES_REG;
+  Register ra = ARG0_REG;
+  Register rb = ARG1_REG;
+
+  e.Mul(rd, ra, rb);
+  a64_emit_normalize(e, rd, RES->type);
+}
+
+EMITTER(UMUL, CONSTRAINTS(REG_I64, REG_I64, REG_I64)) {
+  Register rd = RES_REG;
+  Register ra = ARG0_REG;
+  Register rb = ARG1_REG;
+
+  e.Mul(rd, ra, rb);
+  a64_emit_normalize(e, rd, RES->type);
+}
+
+EMITTER(DIV, CONSTRAINTS(NONE)) {
+  LOG_FATAL("unsupported");
+}
+
+EMITTER(NEG, CONSTRAINTS(REG_I64, REG_I64)) {
+  Register rd = RES_REG;
+  Register ra = ARG0_REG;
+
+  e.Neg(rd, ra);
+  a64_emit_normalize(e, rd, RES->type);
+}
+
+EMITTER(ABS, CONSTRAINTS(NONE)) {
+  LOG_FATAL("unsupported");
+}
+
+EMITTER(FADD, CONSTRAINTS(REG_F64, REG_F64, REG_F64)) {
+  VRegister rd = RES_VREG;
+  VRegister ra = ARG0_VREG;
+  VRegister rb = ARG1_VREG;
+
+  e.Fadd(rd, ra, rb);
+}
+
+EMITTER(FSUB, CONSTRAINTS(REG_F64, REG_F64, REG_F64)) {
+  VRegister rd = RES_VREG;
+  VRegister ra = ARG0_VREG;
+  VRegister rb = ARG1_VREG;
+
+  e.Fsub(rd, ra, rb);
+}
+
+EMITTER(FMUL, CONSTRAINTS(REG_F64, REG_F64, REG_F64)) {
+  VRegister rd = RES_VREG;
+  VRegister ra = ARG0_VREG;
+  VRegister rb = ARG1_VREG;
+
+  e.Fmul(rd, ra, rb);
+}
+
+EMITTER(FDIV, CONSTRAINTS(REG_F64, REG_F64, REG_F64)) {
+  VRegister rd = RES_VREG;
+  VRegister ra = ARG0_VREG;
+  VRegister rb = ARG1_VREG;
+
+  e.Fdiv(rd, ra, rb);
+}
+
+EMITTER(FNEG, CONSTRAINTS(REG_F64, REG_F64)) {
+  VRegister rd = RES_VREG;
+  VRegister ra = ARG0_VREG;
+
+  e.Fneg(rd, ra);
+}
+
+EMITTER(FABS, CONSTRAINTS(REG_F64, REG_F64)) {
+  VRegister rd = RES_VREG;
+  VRegister ra = ARG0_VREG;
+
+  e.Fabs(rd, ra);
+}
+
+EMITTER(SQRT, CONSTRAINTS(REG_F64, REG_F64)) {
+  VRegister rd = RES_VREG;
+  VRegister ra = ARG0_VREG;
+
+  e.Fsqrt(rd, ra);
+}
+
+EMITTER(VBROADCAST, CONSTRAINTS(REG_V128, REG_F64)) {
+  VRegister rd = RES_VREG;
+  VRegister ra = ARG0_VREG;
+
+  e.Dup(rd, ra.V4S(), 0);
+}
+
+EMITTER(VSPLAT, CONSTRAINTS(REG_V128, REG_V128, IMM_I32)) {
+  VRegister rd = RES_VREG;
+  VRegister ra = ARG0_VREG;
+  int lane = ARG1->i32;
+
+  e.Dup(rd.V4S(), ra.V4S(), lane);
+}
+
+EMITTER(VADD, CONSTRAINTS(REG_V128, REG_V128, REG_V128)) {
+  VRegister rd = RES_VREG;
+  VRegister ra = ARG0_VREG;
+  VRegister rb = ARG1_VREG;
+
+  e.Fadd(rd, ra, rb);
+}
+
+EMITTER(VDOT, CONSTRAINTS(REG_V128, REG_V128, REG_V128)) {
+  VRegister rd = RES_VREG;
+  VRegister ra = ARG0_VREG;
+  VRegister rb = ARG1_VREG;
+
+  /* multiply each lane and horizontally sum them into lane 0 */
+  e.Fmul(vtmp0.V4S(), ra.V4S(), rb.V4S());
+  e.Faddp(vtmp0.V4S(), vtmp0.V4S(), vtmp0.V4S());
+  e.Faddp(VRegister(rd.GetCode(), kSRegSize), vtmp0.V2S());
+}
+
+EMITTER(VMUL, CONSTRAINTS(REG_V128, REG_V128, REG_V128)) {
+  VRegister rd = RES_VREG;
+  VRegister ra = ARG0_VREG;
+  VRegister rb = ARG1_VREG;
+
+  e.Fmul(rd, ra, rb);
+}
+
+EMITTER(AND, CONSTRAINTS(REG_I64, REG_I64, REG_I64 | IMM_I32)) {
+  Register rd = RES_REG;
+  Register ra = ARG0_REG;
+
+  e.And(rd, ra, a64_emit_operand(backend, ARG1));
+}
+
+EMITTER(OR, CONSTRAINTS(REG_I64, REG_I64, REG_I64 | IMM_I32)) {
+  Register rd = RES_REG;
+  Register ra = ARG0_REG;
+
+  e.Orr(rd, ra, a64_emit_operand(backend, ARG1));
+}
+
+EMITTER(XOR, CONSTRAINTS(REG_I64, REG_I64, REG_I64 | IMM_I32)) {
+  Register rd = RES_REG;
+  Register ra = ARG0_REG;
+
+  e.Eor(rd, ra, a64_emit_operand(backend, ARG1));
+}
+
+EMITTER(NOT, CONSTRAINTS(REG_I64, REG_I64)) {
+  Register rd = RES_REG;
+  Register ra = ARG0_REG;
+
+  e.Mvn(rd, ra);
+  a64_emit_normalize(e, rd, RES->type);
+}
+
+EMITTER(SHL, CONSTRAINTS(REG_I64, REG_I64, REG_I64 | IMM_I32)) {
+  Register rd = RES_REG;
+  Register ra = ARG0_REG;
+
+  if (ir_is_constant(ARG1)) {
+    e.Lsl(rd, ra, (unsigned)ir_zext_constant(ARG1));
+  } else {
+    Register rb = ARG1_REG;
+    e.Lsl(rd, ra, Register(rb.GetCode(), rd.GetSizeInBits()));
+  }
+
+  a64_emit_normalize(e, rd, RES->type);
+}
+
+EMITTER(ASHR, CONSTRAINTS(REG_I64, REG_I64, REG_I64 | IMM_I32)) {
+  Register rd = RES_REG;
+  Register ra = a64_emit_sext(backend, e, tmp0, ARG0);
+
+  if (ir_is_constant(ARG1)) {
+    e.Asr(rd, ra, (unsigned)ir_zext_constant(ARG1));
+  } else {
+    Register rb = ARG1_REG;
+    e.Asr(rd, ra, Register(rb.GetCode(), rd.GetSizeInBits()));
+  }
+
+  a64_emit_normalize(e, rd, RES->type);
+}
+
+EMITTER(LSHR, CONSTRAINTS(REG_I64, REG_I64, REG_I64 | IMM_I32)) {
+  Register rd = RES_REG;
+  Register ra = ARG0_REG;
+
+  if (ir_is_constant(ARG1)) {
+    e.Lsr(rd, ra, (unsigned)ir_zext_constant(ARG1));
+  } else {
+    Register rb = ARG1_REG;
+    e.Lsr(rd, ra, Register(rb.GetCode(), rd.GetSizeInBits()));
+  }
+}
+
+EMITTER(ASHD, CONSTRAINTS(REG_I64, REG_I64, REG_I64)) {
+  Register rd = RES_REG;
+  Register ra = ARG0_REG;
+  Register rb = ARG1_REG;
+
+  Label shr, shr_overflow, end;
+
+  /* check if we're shifting left or right */
+  e.Tbnz(rb, 31, &shr);
+
+  /* perform shift left */
+  e.Lsl(rd, ra, rb);
+  e.B(&end);
+
+  /* perform right shift */
+  e.Bind(&shr);
+  e.Tst(rb, 0x1f);
+  e.B(eq, &shr_overflow);
+  e.Neg(tmp0.W(), rb);
+  e.Asr(rd, ra, tmp0.W());
+  e.B(&end);
+
+  /* right shift overflowed */
+  e.Bind(&shr_overflow);
+  e.Asr(rd, ra, 31);
+
+  /* shift is done */
+  e.Bind(&end);
+}
+
+EMITTER(LSHD, CONSTRAINTS(REG_I64, REG_I64, REG_I64)) {
+  Register rd = RES_REG;
+  Register ra = ARG0_REG;
+  Register rb = ARG1_REG;
+
+  Label shr, shr_overflow, end;
+
+  /* check if we're shifting left or right */
+  e.Tbnz(rb, 31, &shr);
+
+  /* perform shift left */
+  e.Lsl(rd, ra, rb);
+  e.B(&end);
+
+  /* perform right shift */
+  e.Bind(&shr);
+  e.Tst(rb, 0x1f);
+  e.B(eq, &shr_overflow);
+  e.Neg(tmp0.W(), rb);
+  e.Lsr(rd, ra, tmp0.W());
+  e.B(&end);
+
+  /* right shift overflowed */
+  e.Bind(&shr_overflow);
+  e.Mov(rd, 0x0);
+
+  /* shift is done */
+  e.Bind(&end);
+}
+
+EMITTER(BRANCH, CONSTRAINTS(NONE, REG_I64 | IMM_I32 | IMM_BLK)) {
+  a64_backend_emit_branch(backend, ir, ARG0);
+}
+
+EMITTER(BRANCH_COND, CONSTRAINTS(NONE, REG_I64 | IMM_I32 | IMM_BLK,
+                                 REG_I64 | IMM_I32 | IMM_BLK, REG_I64)) {
+  Register cond = ARG2_REG;
+  Label next;
+
+  e.Cbz(cond, &next);
+  a64_backend_emit_branch(backend, ir, ARG0);
+  e.Bind(&next);
+  a64_backend_emit_branch(backend, ir, ARG1);
+}
+
+EMITTER(CALL, CONSTRAINTS(NONE, VAL_I64, OPT_I64, OPT_I64)) {
+  if (ARG1) {
+    a64_backend_mov_value(backend, arg0, ARG1);
+  }
+  if (ARG2) {
+    a64_backend_mov_value(backend, arg1, ARG2);
+  }
+
+  if (ir_is_constant(ARG0)) {
+    void *addr = (void *)ARG0->i64;
+    a64_backend_call(backend, addr);
+  } else {
+    Register addr = ARG0_REG;
+    e.Blr(addr);
+  }
+}
+
+EMITTER(CALL_COND, CONSTRAINTS(NONE, VAL_I64, VAL_I64, OPT_I64, OPT_I64)) {
+  Register cond = ARG1_REG;
+  Label skip;
+
+  e.Cbz(cond, &skip);
+
+  if (ARG2) {
+    a64_backend_mov_value(backend, arg0, ARG2);
+  }
+  if (ARG3) {
+    a64_backend_mov_value(backend, arg1, ARG3);
+  }
+
+  if (ir_is_constant(ARG0)) {
+    void *addr = (void *)ARG0->i64;
+    a64_backend_call(backend, addr);
+  } else {
+    Register addr = ARG0_REG;
+    e.Blr(addr);
+  }
+
+  e.Bind(&skip);
+}
+
+EMITTER(DEBUG_BREAK, CONSTRAINTS(NONE)) {
+  e.Brk(0);
+}
+
+static void debug_log(uint64_t a, uint64_t b, uint64_t c) {
+  LOG_INFO("DEBUG_LOG a=0x%" PRIx64 " b=0x%" PRIx64 " c=0x%" PRIx64, a, b, c);
+}
+
+EMITTER(DEBUG_LOG, CONSTRAINTS(NONE, VAL_I64, OPT_I64, OPT_I64)) {
+  a64_backend_mov_value(backend, arg0, ARG0);
+  a64_backend_mov_value(backend, arg1, ARG1);
+  a64_backend_mov_value(backend, arg2, ARG2);
+  a64_backend_call(backend, (void *)&debug_log);
+}
+
+EMITTER(ASSERT_EQ, CONSTRAINTS(NONE, REG_I64, REG_I64)) {
+  Register ra = ARG0_REG;
+  Register rb = ARG1_REG;
+  Label skip;
+
+  e.Cmp(ra, rb);
+  e.B(eq, &skip);
+  e.Brk(0);
+  e.Bind(&skip);
+}
+
+EMITTER(ASSERT_LT, CONSTRAINTS(NONE, REG_I64, REG_I64)) {
+  Register ra = ARG0_REG;
+  Register rb = ARG1_REG;
+  Label skip;
+
+  e.Cmp(ra, rb);
+  e.B(lt, &skip);
+  e.Brk(0);
+  e.Bind(&skip);
+}
+
+EMITTER(COPY, CONSTRAINTS(REG_ALL, VAL_ALL)) {
+  if (ir_is_vector(RES->type)) {
+    VRegister rd = RES_VREG;
+    VRegister rn = ARG0_VREG;
+
+    e.Mov(rd.V16B(), rn.V16B());
+  } else if (ir_is_float(RES->type)) {
+    VRegister rd = RES_VREG;
+
+    if (ir_is_constant(ARG0)) {
+      /* copy constant into reg */
+      if (ARG0->type == VALUE_F32) {
+        e.Mov(tmp0.W(), (uint32_t)ARG0->i32);
+        e.Fmov(rd, tmp0.W());
+      } else {
+        e.Mov(tmp0, (uint64_t)ARG0->i64);
+        e.Fmov(rd, tmp0);
+      }
+    } else {
+      /* copy reg to reg */
+      VRegister rn = ARG0_VREG;
+      e.Fmov(rd, rn);
+    }
+  } else {
+    Register rd = RES_REG;
+
+    if (ir_is_constant(ARG0)) {
+      /* copy constant into reg */
+      e.Mov(rd, ir_zext_constant(ARG0));
+    } else {
+      /* copy reg to reg */
+      Register rn = ARG0_REG;
+      e.Mov(rd, rn);
+    }
+  }
+}
@@ -0,0 +1,130 @@
+#ifndef A64_LOCAL_H
+#define A64_LOCAL_H
+
+#include <inttypes.h>
+#include <stdexcept>
+
+#include <aarch64/disasm-aarch64.h>
+#include <aarch64/macro-assembler-aarch64.h>
+
+extern "C" {
+#include "jit/jit_backend.h"
+}
+
+/* out-of-line slow path for a fastmem access. these are emitted after the
+   block's code, and the access is only patched to branch to them once it has
+   faulted */
+#define A64_MAX_STUBS 256
+
+struct a64_stub {
+  const struct ir_instr *instr;
+  uint8_t *site;
+};
+
+struct a64_backend {
+  struct jit_backend base;
+
+  /* code cache */
+  uint32_t cache_mask;
+  int cache_shift;
+  int cache_size;
+  void **cache;
+
+  /* code buffer allocated by the backend, if one wasn't provided */
+  void *code_alloc;
+  int code_alloc_size;
+
+  /* codegen state */
+  vixl::aarch64::MacroAssembler *codegen;
+  uint8_t *codegen_end;
+  vixl::aarch64::Label *block_labels;
+  int num_block_labels;
+  void *dispatch_dynamic;
+  void *dispatch_static;
+  void *dispatch_ic;
+  void *dispatch_compile;
+  void *dispatch_interrupt;
+  void (*dispatch_enter)(int32_t);
+  void *dispatch_exit;
+  void (*load_thunk[32])();
+  void (*store_thunk)();
+  struct a64_stub stubs[A64_MAX_STUBS];
+  int num_stubs;
+
+  /* debug stats */
+  vixl::aarch64::Decoder *decoder;
+  vixl::aarch64::Disassembler *disasm;
+};
+
+/*
+ * backend functionality used by emitters
+ */
+#define A64_THUNK_SIZE 8192
+#define A64_STACK_SIZE 1024
+
+/* offset of the locals from the stack pointer. unlike x64, no shadow space
+   or return address lives at the bottom of the stack */
+#define A64_STACK_LOCALS 0
+
+struct ir_value;
+
+extern const vixl::aarch64::Register arg0;
+extern const vixl::aarch64::Register arg1;
+extern const vixl::aarch64::Register arg2;
+extern const vixl::aarch64::Register arg3;
+extern const vixl::aarch64::Register tmp0;
+extern const vixl::aarch64::Register tmp1;
+extern const vixl::aarch64::Register guestctx;
+extern const vixl::aarch64::Register guestmem;
+extern const vixl::aarch64::VRegister vtmp0;
+extern const vixl::aarch64::VRegister vtmp1;
+
+vixl::aarch64::Register a64_backend_reg(struct a64_backend *backend,
+                                        const struct ir_value *v);
+vixl::aarch64::VRegister a64_backend_vreg(struct a64_backend *backend,
+                                          const struct ir_value *v);
+int a64_backend_push_regs(struct a64_backend *backend, int mask);
+void a64_backend_pop_regs(struct a64_backend *backend, int mask);
+void a64_backend_load_mem(struct a64_backend *backend,
+                          const struct ir_value *dst,
+                          const vixl::aarch64::MemOperand &src_mem);
+void a64_backend_store_mem(struct a64_backend *backend,
+                           const vixl::aarch64::MemOperand &dst_mem,
+                           const struct ir_value *src);
+void a64_backend_mov_value(struct a64_backend *backend,
+                           const vixl::aarch64::Register &dst,
+                           const struct ir_value *v);
+void a64_backend_call(struct a64_backend *backend, const void *fn);
+void a64_backend_branch(struct a64_backend *backend, const void *dst,
+                        vixl::aarch64::Condition cond);
+vixl::aarch64::Label *a64_backend_block_label(struct a64_backend *backend,
+                                              struct ir_block *block);
+void a64_backend_emit_branch(struct a64_backend *backend, struct ir *ir,
+                             const ir_value *target);
+void a64_backend_add_stub(struct a64_backend *backend,
+                          const struct ir_instr *instr);
+
+/*
+ * dispatch
+ */
+void a64_dispatch_init(struct a64_backend *backend);
+void a64_dispatch_shutdown(struct a64_backend *backend);
+void a64_dispatch_emit_thunks(struct a64_backend *backend);
+void a64_dispatch_run_code(struct jit_backend *base, int cycles);
+void *a64_dispatch_lookup_code(struct jit_backend *base, uint32_t addr);
+void a64_dispatch_cache_code(struct jit_backend *base, uint32_t addr,
+                             void *code);
+void a64_dispatch_invalidate_code(struct jit_backend *base, uint32_t addr);
+void a64_dispatch_patch_edge(struct jit_backend *base, void *code, void *dst);
+void a64_dispatch_restore_edge(struct jit_backend *base, void *code,
+                               uint32_t dst);
+
+/*
+ * emitters
+ */
+typedef void (*a64_emit_cb)(struct a64_backend *,
+                            vixl::aarch64::MacroAssembler &, struct ir *,
+                            struct ir_instr *);
+extern struct jit_emitter a64_emitters[IR_NUM_OPS];
+
+#endif
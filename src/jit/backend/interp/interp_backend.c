@@ -1,19 +1,143 @@
 #include <stdlib.h>
+#include "core/core.h"
 #include "jit/jit.h"
 #include "jit/jit_backend.h"
 #include "jit/jit_frontend.h"
 #include "jit/jit_guest.h"
 
+/*
+ * interpreter backend
+ *
+ * rather than fetching and looking up the handler of each instruction as it's
+ * executed, blocks are decoded once into an array of fallback handlers and
+ * their operands, which are then dispatched straight through. blocks end
+ * where the frontend ends them for the jit, and are cached in a direct-mapped
+ * table indexed by guest address, the same as the x64 backend's dispatch
+ * cache. they are invalidated through the same calls which invalidate
+ * compiled code
+ */
+
+/* size of the buffer decoded blocks are allocated from. once full, every
+   block is discarded and decoded again as it's next executed */
+#define INTERP_BLOCK_BUFFER_SIZE (8 * 1024 * 1024)
+
+struct interp_instr {
+  jit_fallback fallback;
+  uint32_t addr;
+  uint32_t data;
+  int cycles;
+};
+
+struct interp_block {
+  uint32_t addr;
+  /* full invalidations bump the backend's generation rather than clearing
+     the cache, stale blocks are detected on lookup. blocks unlinked by a
+     range invalidation are marked stale by resetting theirs */
+  int generation;
+  int num_instrs;
+  struct interp_instr instrs[];
+};
+
 struct interp_backend {
   struct jit_backend;
 
-  /* used to resolve the fallback handler for each instruction */
+  /* used to find the end of each block and the handler of each instruction */
   struct jit_frontend *frontend;
+
+  struct interp_block **cache;
+  uint32_t cache_mask;
+  int cache_shift;
+  int cache_size;
+  int generation;
+
+  /* the largest block decoded, invalidating a range must search back this
+     many entries for blocks beginning before it which overlap it */
+  int max_block_instrs;
+
+  uint8_t *blocks;
+  int blocks_size;
+  int blocks_pos;
 };
 
+static inline struct interp_block **interp_backend_cache_entry(
+    struct interp_backend *backend, uint32_t addr) {
+  return &backend->cache[(addr & backend->cache_mask) >> backend->cache_shift];
+}
+
+static void interp_backend_clear_cache(struct interp_backend *backend) {
+  /* avoid touching the entire table when nothing has been decoded */
+  if (!backend->blocks_pos) {
+    return;
+  }
+
+  memset(backend->cache, 0, backend->cache_size * sizeof(backend->cache[0]));
+  backend->blocks_pos = 0;
+  backend->max_block_instrs = 0;
+}
+
+static struct interp_block *interp_backend_decode_block(
+    struct interp_backend *backend, uint32_t addr) {
+  struct jit_frontend *frontend = backend->frontend;
+
+  int size;
+  frontend->analyze_code(frontend, addr, 0, &size);
+
+  /* every instruction is aligned to, and as large as, the granularity of the
+     cache */
+  int num_instrs = size >> backend->cache_shift;
+  int block_size = (int)sizeof(struct interp_block) +
+                   num_instrs * (int)sizeof(struct interp_instr);
+  block_size = ALIGN_UP(block_size, (int)sizeof(void *));
+
+  /* no block is executing when a block is decoded, so it's safe to discard
+     them all to make room */
+  if (backend->blocks_pos + block_size > backend->blocks_size) {
+    interp_backend_clear_cache(backend);
+  }
+
+  struct interp_block *block =
+      (struct interp_block *)(backend->blocks + backend->blocks_pos);
+  backend->blocks_pos += block_size;
+
+  block->addr = addr;
+  block->generation = backend->generation;
+  block->num_instrs = num_instrs;
+
+  for (int i = 0; i < num_instrs; i++) {
+    struct interp_instr *instr = &block->instrs[i];
+    uint32_t instr_addr = addr + (i << backend->cache_shift);
+    uint32_t data;
+    const struct jit_opdef *def =
+        frontend->fetch_op(frontend, instr_addr, &data);
+
+    instr->fallback = def->fallback;
+    instr->addr = instr_addr;
+    instr->data = data;
+    instr->cycles = def->cycles;
+  }
+
+  backend->max_block_instrs = MAX(backend->max_block_instrs, num_instrs);
+
+  *interp_backend_cache_entry(backend, addr) = block;
+
+  return block;
+}
+
+static inline struct interp_block *interp_backend_lookup_block(
+    struct interp_backend *backend, uint32_t addr) {
+  struct interp_block *block = *interp_backend_cache_entry(backend, addr);
+
+  /* addresses which only differ outside of the cache mask share an entry */
+  if (!block || block->addr != addr ||
+      block->generation != backend->generation) {
+    block = interp_backend_decode_block(backend, addr);
+  }
+
+  return block;
+}
+
 static void interp_backend_run_code(struct jit_backend *base, int cycles) {
   struct interp_backend *backend = (struct interp_backend *)base;
-  struct jit_frontend *frontend = backend->frontend;
   struct jit_guest *guest = backend->guest;
   uint8_t *ctx = guest->ctx;
   uint32_t *pc = (uint32_t *)(ctx + guest->offset_pc);
@@ -29,13 +153,23 @@ static void interp_backend_run_code(struct jit_backend *base, int cycles) {
     int instrs = 0;
 
     do {
-      uint32_t addr = *pc;
-      uint32_t data = guest->r32(guest->mem, addr);
-      const struct jit_opdef *def = frontend->lookup_op(frontend, &data);
-      def->fallback(guest, addr, data);
-      cycles += def->cycles;
-      instrs += 1;
-    } while (cycles < RUN_SLICE);
+      struct interp_block *block = interp_backend_lookup_block(backend, *pc);
+      struct interp_instr *instr = block->instrs;
+      struct interp_instr *end = instr + block->num_instrs;
+
+      /* run through the block until an instruction doesn't continue on to
+         the next one, due to a branch, exception, etc. or until a store
+         invalidates the block, leaving the rest of its instructions stale */
+      do {
+        instr->fallback(guest, instr->addr, instr->data);
+        cycles += instr->cycles;
+        instrs += 1;
+        instr++;
+      } while (instr < end && *pc == instr->addr &&
+               block->generation == backend->generation);
+
+      /* traps break from dispatch by forcing the remaining cycles negative */
+    } while (cycles < RUN_SLICE && *run_cycles > 0);
 
     *run_cycles -= cycles;
     *ran_instrs += instrs;
@@ -44,6 +178,33 @@ static void interp_backend_run_code(struct jit_backend *base, int cycles) {
   }
 }
 
+static void interp_backend_invalidate_range(struct jit_backend *base,
+                                            uint32_t addr, int size) {
+  struct interp_backend *backend = (struct interp_backend *)base;
+
+  /* code may still be executing, so blocks are only unlinked from the cache
+     and their memory is reclaimed once the buffer fills up */
+  if (size == JIT_INVALIDATE_ALL) {
+    backend->generation++;
+    return;
+  }
+
+  int first = (int)((addr & backend->cache_mask) >> backend->cache_shift);
+  int end = first + ((size + (1 << backend->cache_shift) - 1) >>
+                     backend->cache_shift);
+  int begin = MAX(first - backend->max_block_instrs + 1, 0);
+  end = MIN(end, backend->cache_size);
+
+  for (int i = begin; i < end; i++) {
+    struct interp_block *block = backend->cache[i];
+
+    if (block && i + block->num_instrs > first) {
+      block->generation = -1;
+      backend->cache[i] = NULL;
+    }
+  }
+}
+
 static int interp_backend_handle_exception(struct jit_backend *base,
                                            struct exception_state *ex) {
   return 0;
@@ -53,11 +214,19 @@ static void interp_backend_dump_code(struct jit_backend *base,
                                      const uint8_t *addr, int size,
                                      FILE *output) {}
 
-static void interp_backend_reset(struct jit_backend *base) {}
+static void interp_backend_reset(struct jit_backend *base, uint8_t *region,
+                                 int region_size) {
+  struct interp_backend *backend = (struct interp_backend *)base;
+
+  /* only called when no code is executing */
+  interp_backend_clear_cache(backend);
+}
 
 static void interp_backend_destroy(struct jit_backend *base) {
   struct interp_backend *backend = (struct interp_backend *)base;
 
+  free(backend->blocks);
+  free(backend->cache);
   free(backend);
 }
 
@@ -66,9 +235,18 @@ struct jit_backend *interp_backend_create(struct jit_guest *guest,
   struct interp_backend *backend = calloc(1, sizeof(struct interp_backend));
 
   backend->guest = guest;
+  backend->name = "interp";
   backend->frontend = frontend;
   backend->destroy = &interp_backend_destroy;
 
+  backend->cache_mask = guest->addr_mask;
+  backend->cache_shift = ctz32(guest->addr_mask);
+  backend->cache_size = (backend->cache_mask >> backend->cache_shift) + 1;
+  backend->cache = calloc(backend->cache_size, sizeof(backend->cache[0]));
+
+  backend->blocks_size = INTERP_BLOCK_BUFFER_SIZE;
+  backend->blocks = malloc(backend->blocks_size);
+
   /* compile interface */
   backend->registers = NULL;
   backend->num_registers = 0;
@@ -82,6 +260,7 @@ struct jit_backend *interp_backend_create(struct jit_guest *guest,
   backend->lookup_code = NULL;
   backend->cache_code = NULL;
   backend->invalidate_code = NULL;
+  backend->invalidate_range = &interp_backend_invalidate_range;
   backend->patch_edge = NULL;
   backend->restore_edge = NULL;
 
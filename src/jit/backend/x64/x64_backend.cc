@@ -484,11 +484,18 @@ static int x64_backend_handle_exception(struct jit_backend *base,
      from any restrictions imposed by an exception handler, and also prevents
      a possible recursive exception
 
-     push the return address (the next instruction after the current mov) to
-     the stack. each thunk will be responsible for pushing / popping caller-
-     saved registers */
+     push the return address (the next instruction after the current mov and
+     any padding following it) to the stack. the jit may patch the access to
+     jump to its slow path before the thunk returns, overwriting the padding.
+     each thunk will be responsible for pushing / popping caller-saved
+     registers */
+  const uint8_t *resume = data + mov.length;
+  while (*resume == 0x90) {
+    resume++;
+  }
+
   ex->thread_state.rsp -= 8;
-  *(uint64_t *)(ex->thread_state.rsp) = ex->thread_state.rip + mov.length;
+  *(uint64_t *)(ex->thread_state.rsp) = (uint64_t)resume;
   CHECK(ex->thread_state.rsp % 16 == 8);
 
   if (mov.is_load) {
@@ -582,17 +589,17 @@ void x64_backend_emit_branch(struct x64_backend *backend, struct ir *ir,
         x64_backend_block_label(block_label, sizeof(block_label), target->blk);
 
         struct ir_value *addr = ir_get_meta(ir, target->blk, IR_META_ADDR);
-        e.mov(e.dword[guestctx + guest->offset_pc], addr->i32);
+        e.mov(e.dword[x64_ctx(guest->offset_pc)], addr->i32);
         dispatch_type = 0;
       } else {
         uint32_t addr = target->i32;
-        e.mov(e.dword[guestctx + guest->offset_pc], addr);
+        e.mov(e.dword[x64_ctx(guest->offset_pc)], addr);
         dispatch_type = 1;
       }
     } else {
       Xbyak::Reg addr = x64_backend_reg(backend, target);
-      e.mov(e.dword[guestctx + guest->offset_pc], addr);
-      dispatch_type = 2;
+      e.mov(e.dword[x64_ctx(guest->offset_pc)], addr);
+      dispatch_type = 3;
     }
   } else {
     dispatch_type = 2;
@@ -609,6 +616,21 @@ void x64_backend_emit_branch(struct x64_backend *backend, struct ir *ir,
     case 2:
       e.jmp(backend->dispatch_dynamic);
       break;
+    case 3: {
+      /* the inline cache's tag is emitted after the call to the miss thunk,
+         letting the thunk find it through the return address */
+      Xbyak::Reg addr = x64_backend_reg(backend, target);
+      Xbyak::Label tag;
+      Xbyak::Label miss;
+
+      e.cmp(addr, e.dword[e.rip + tag]);
+      e.jne(miss);
+      e.call(backend->dispatch_static);
+      e.L(miss);
+      e.call(backend->dispatch_ic);
+      e.L(tag);
+      e.dd(JIT_IC_EMPTY);
+    } break;
   }
 }
 
@@ -626,35 +648,281 @@ static void x64_backend_emit_epilog(struct x64_backend *backend, struct ir *ir,
 }
 
 static void x64_backend_emit_prolog(struct x64_backend *backend, struct ir *ir,
-                                    struct ir_block *block) {
+                                    struct ir_block *block,
+                                    jit_emit_cb emit_cb, void *emit_data) {
   struct jit_guest *guest = backend->base.guest;
 
   auto &e = *backend->codegen;
 
-  /* count number of instrs / cycles in the block */
+  /* count number of instrs / cycles in the block, along with each block it
+     runs straight into. those blocks don't update the counts themselves */
   int num_instrs = 0;
   int num_cycles = 0;
 
-  list_for_each_entry(instr, &block->instrs, struct ir_instr, it) {
-    if (instr->op == OP_SOURCE_INFO) {
-      num_instrs += 1;
-      num_cycles += instr->arg[1]->i32;
+  struct ir_block *pred = ir_get_extended_pred(ir, block);
+  struct ir_block *counted = block;
+
+  if (pred && ir_get_straight_succ(ir, pred) == block) {
+    counted = NULL;
+  }
+
+  while (counted) {
+    list_for_each_entry(instr, &counted->instrs, struct ir_instr, it) {
+      if (instr->op == OP_SOURCE_INFO) {
+        num_instrs += 1;
+        num_cycles += instr->arg[1]->i32;
+      }
     }
+
+    counted = ir_get_straight_succ(ir, counted);
   }
 
-  /* yield control once remaining cycles are executed */
-  e.mov(e.eax, e.dword[guestctx + guest->offset_cycles]);
-  e.test(e.eax, e.eax);
-  e.js(backend->dispatch_exit);
+  if (ir_is_yield_point(ir, block)) {
+    /* yield control once remaining cycles are executed */
+    e.mov(e.eax, e.dword[x64_ctx(guest->offset_cycles)]);
+    e.test(e.eax, e.eax);
+    e.js(backend->dispatch_exit);
 
-  /* yield control to any pending interrupts */
-  e.mov(e.rax, e.qword[guestctx + guest->offset_interrupts]);
-  e.test(e.rax, e.rax);
-  e.jnz(backend->dispatch_interrupt);
+    /* yield control to any pending interrupts */
+    e.mov(e.rax, e.qword[x64_ctx(guest->offset_interrupts)]);
+    e.test(e.rax, e.rax);
+    e.jnz(backend->dispatch_interrupt);
+  }
+
+  /* branches linked from other code may enter past the checks */
+  if (emit_cb && block == list_first_entry(&ir->blocks, struct ir_block, it)) {
+    emit_cb(emit_data, JIT_EMIT_LINK, 0, e.getCurr<uint8_t *>());
+  }
 
   /* update debug run counts */
-  e.sub(e.dword[guestctx + guest->offset_cycles], num_cycles);
-  e.add(e.dword[guestctx + guest->offset_instrs], num_instrs);
+  if (num_instrs) {
+    e.sub(e.dword[x64_ctx(guest->offset_cycles)], num_cycles);
+    e.add(e.dword[x64_ctx(guest->offset_instrs)], num_instrs);
+  }
+}
+
+void x64_backend_call(struct x64_backend *backend, const struct ir_value *fn,
+                      const struct ir_value *a0, const struct ir_value *a1) {
+  auto &e = *backend->codegen;
+
+  if (a0) {
+    x64_backend_mov_value(backend, arg0, a0);
+  }
+  if (a1) {
+    x64_backend_mov_value(backend, arg1, a1);
+  }
+
+  if (ir_is_constant(fn)) {
+    e.call((void *)fn->i64);
+  } else {
+    e.call(x64_backend_reg(backend, fn));
+  }
+}
+
+uint8_t *x64_backend_branch_cold(struct x64_backend *backend, int cc) {
+  auto &e = *backend->codegen;
+
+  if (backend->num_stubs >= X64_MAX_STUBS) {
+    return NULL;
+  }
+
+  /* emit a jcc rel32 on the condition code, its target is filled in once the
+     stub is emitted into the cold area */
+  e.db(0x0f);
+  e.db(0x80 | cc);
+  e.dd(0);
+
+  return e.getCurr<uint8_t *>();
+}
+
+uint8_t *x64_backend_emit_check(struct x64_backend *backend,
+                                const Xbyak::Reg &addr) {
+  struct jit_guest *guest = backend->base.guest;
+  auto &e = *backend->codegen;
+
+  /* without a stub to branch to, the access is left to fault */
+  if (!guest->page_table || backend->num_stubs >= X64_MAX_STUBS) {
+    return NULL;
+  }
+
+  /* branch to the slow path when the page has no host pointer */
+  e.mov(e.eax, addr.cvt32());
+  e.shr(e.eax, guest->page_shift);
+  e.mov(e.rcx, (uint64_t)guest->page_table);
+  e.cmp(e.qword[e.rcx + e.rax * 8], 0);
+
+  return x64_backend_branch_cold(backend, 0x4);
+}
+
+void x64_backend_add_stub(struct x64_backend *backend,
+                          const struct ir_instr *instr, uint8_t *site,
+                          uint8_t *branch) {
+  auto &e = *backend->codegen;
+
+  if (backend->num_stubs >= X64_MAX_STUBS) {
+    return;
+  }
+
+  /* pad the access so it can be overwritten by a jmp rel32 */
+  while (!branch && e.getCurr<uint8_t *>() - site < 5) {
+    e.nop();
+  }
+
+  struct x64_stub *stub = &backend->stubs[backend->num_stubs++];
+  stub->instr = instr;
+  stub->site = site;
+  stub->resume = e.getCurr<uint8_t *>();
+  stub->branch = branch;
+}
+
+static void x64_backend_emit_stub(struct x64_backend *backend,
+                                  struct x64_stub *stub) {
+  struct jit_guest *guest = backend->base.guest;
+  auto &e = *backend->codegen;
+  const struct ir_instr *instr = stub->instr;
+
+  if (instr->op == OP_CALL_COND) {
+    x64_backend_call(backend, instr->arg[0], instr->arg[2], instr->arg[3]);
+    e.jmp(stub->resume, Xbyak::CodeGenerator::T_NEAR);
+    return;
+  }
+
+  /* perform the same call the exception handler would have forced, going
+     through the thunks to preserve the caller-saved registers */
+  e.mov(arg0, (uint64_t)guest->mem);
+  x64_backend_mov_value(backend, arg1, instr->arg[0]);
+
+  if (instr->op == OP_LOAD_FAST) {
+    void *fn = nullptr;
+    switch (instr->result->type) {
+      case VALUE_I8:
+        fn = (void *)guest->r8;
+        break;
+      case VALUE_I16:
+        fn = (void *)guest->r16;
+        break;
+      case VALUE_I32:
+        fn = (void *)guest->r32;
+        break;
+      case VALUE_I64:
+        fn = (void *)guest->r64;
+        break;
+      default:
+        LOG_FATAL("unexpected load result type");
+        break;
+    }
+
+    Xbyak::Reg dst = x64_backend_reg(backend, instr->result);
+    e.mov(e.rax, (uint64_t)fn);
+    e.call((void *)backend->load_thunk[dst.getIdx()]);
+  } else {
+    void *fn = nullptr;
+    switch (instr->arg[1]->type) {
+      case VALUE_I8:
+        fn = (void *)guest->w8;
+        break;
+      case VALUE_I16:
+        fn = (void *)guest->w16;
+        break;
+      case VALUE_I32:
+        fn = (void *)guest->w32;
+        break;
+      case VALUE_I64:
+        fn = (void *)guest->w64;
+        break;
+      default:
+        LOG_FATAL("unexpected store value type");
+        break;
+    }
+
+    x64_backend_mov_value(backend, arg2, instr->arg[1]);
+    e.mov(e.rax, (uint64_t)fn);
+    e.call((void *)backend->store_thunk);
+  }
+
+  e.jmp(stub->resume, Xbyak::CodeGenerator::T_NEAR);
+}
+
+int x64_backend_use_shiftx(struct x64_backend *backend,
+                           const struct ir_instr *instr) {
+  /* bmi2's shlx, sarx and shrx take their count from any register rather than
+     cl, but only operate on 32 and 64-bit registers */
+  if (!X64_USE_BMI2 || ir_is_constant(instr->arg[1])) {
+    return 0;
+  }
+  return ir_type_size(instr->result->type) >= 4;
+}
+
+static int x64_backend_preserves_flags(struct x64_backend *backend,
+                                       const struct ir_instr *instr) {
+  /* instructions which are emitted purely as moves, and may sit between a
+     comparison and the branch consuming it (e.g. storing sh4's t bit back to
+     the context, or spills inserted by the register allocator) */
+  switch (instr->op) {
+    case OP_SHL:
+    case OP_ASHR:
+    case OP_LSHR:
+      /* variable shifts are emitted with bmi2, which doesn't touch the
+         flags */
+      return x64_backend_use_shiftx(backend, instr);
+    case OP_SOURCE_INFO:
+    case OP_LOAD_CONTEXT:
+    case OP_STORE_CONTEXT:
+    case OP_LOAD_LOCAL:
+    case OP_STORE_LOCAL:
+    case OP_ZEXT:
+    case OP_TRUNC:
+    case OP_COPY:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+static void x64_backend_emit_cold(struct x64_backend *backend,
+                                  jit_emit_cb emit_cb, void *emit_data) {
+  auto &e = *backend->codegen;
+
+  if (!backend->num_stubs) {
+    return;
+  }
+
+  /* the stubs are stacked downwards from the end of the region, so the hot
+     and cold code share whatever space is left between them. their size
+     isn't known up front, so they're first emitted just past the hot code to
+     measure it, and then emitted again at their final location */
+  size_t hot_size = e.getSize();
+
+  for (int i = 0; i < backend->num_stubs; i++) {
+    x64_backend_emit_stub(backend, &backend->stubs[i]);
+  }
+
+  size_t cold_begin = backend->cold_begin - (e.getSize() - hot_size);
+  e.setSize(cold_begin);
+  e.setMaxSize(backend->cold_begin);
+
+  for (int i = 0; i < backend->num_stubs; i++) {
+    struct x64_stub *stub = &backend->stubs[i];
+    uint8_t *stub_addr = e.getCurr<uint8_t *>();
+
+    x64_backend_emit_stub(backend, stub);
+
+    /* stubs reached through a branch never fault, only link the branch */
+    if (stub->branch) {
+      int32_t disp = (int32_t)(stub_addr - stub->branch);
+      memcpy(stub->branch - 4, &disp, sizeof(disp));
+    } else if (emit_cb) {
+      emit_cb(emit_data, JIT_EMIT_SITE, 0, stub->site);
+      emit_cb(emit_data, JIT_EMIT_STUB, 0, stub_addr);
+    }
+  }
+
+  CHECK_EQ(e.getSize(), backend->cold_begin);
+
+  /* limit the hot code to the start of the cold code */
+  backend->cold_begin = cold_begin;
+  e.setSize(hot_size);
+  e.setMaxSize(cold_begin);
 }
 
 static void x64_backend_emit(struct x64_backend *backend, struct ir *ir,
@@ -663,6 +931,8 @@ static void x64_backend_emit(struct x64_backend *backend, struct ir *ir,
 
   CHECK_LT(ir->locals_size, X64_STACK_SIZE);
 
+  backend->num_stubs = 0;
+
   e.inLocalLabel();
 
   list_for_each_entry(block, &ir->blocks, struct ir_block, it) {
@@ -674,7 +944,10 @@ static void x64_backend_emit(struct x64_backend *backend, struct ir *ir,
     x64_backend_block_label(block_label, sizeof(block_label), block);
     e.L(block_label);
 
-    x64_backend_emit_prolog(backend, ir, block);
+    x64_backend_emit_prolog(backend, ir, block, emit_cb, emit_data);
+
+    /* the prolog clobbers the flags */
+    backend->flags_cmp = NULL;
 
     list_for_each_entry(instr, &block->instrs, struct ir_instr, it) {
       /* call emit callback for each guest block / instruction enabling users
@@ -695,25 +968,35 @@ static void x64_backend_emit(struct x64_backend *backend, struct ir *ir,
       x64_emit_cb emit = (x64_emit_cb)emitter->func;
       CHECK_NOTNULL(emit);
       emit(backend, e, ir, instr);
+
+      if (instr->op == OP_CMP) {
+        backend->flags_cmp = instr;
+      } else if (!x64_backend_preserves_flags(backend, instr)) {
+        backend->flags_cmp = NULL;
+      }
     }
 
     x64_backend_emit_epilog(backend, ir, block);
   }
 
   e.outLocalLabel();
+
+  x64_backend_emit_cold(backend, emit_cb, emit_data);
 }
 
 static int x64_backend_assemble_code(struct jit_backend *base, struct ir *ir,
                                      uint8_t **addr, int *size,
+                                     uint8_t **cold_addr, int *cold_size,
                                      jit_emit_cb emit_cb, void *emit_data) {
   struct x64_backend *backend = container_of(base, struct x64_backend, base);
   auto &e = *backend->codegen;
 
   int res = 1;
   uint8_t *code = e.getCurr<uint8_t *>();
+  size_t cold_end = backend->cold_begin;
 
-  /* try to generate the x64 code. if the code buffer overflows let the backend
-     know so it can reset the cache and try again */
+  /* try to generate the x64 code. if the code buffer region overflows let the
+     jit know so it can evict the next region and try again */
   try {
     x64_backend_emit(backend, ir, emit_cb, emit_data);
   } catch (const Xbyak::Error &e) {
@@ -726,16 +1009,24 @@ static int x64_backend_assemble_code(struct jit_backend *base, struct ir *ir,
   /* return code address */
   *addr = code;
   *size = (int)(e.getCurr<uint8_t *>() - code);
+  *cold_size = (int)(cold_end - backend->cold_begin);
+  *cold_addr = *cold_size ? (uint8_t *)e.getCode() + backend->cold_begin : NULL;
 
   return res;
 }
 
-static void x64_backend_reset(struct jit_backend *base) {
+static void x64_backend_reset(struct jit_backend *base, uint8_t *region,
+                              int region_size) {
   struct x64_backend *backend = container_of(base, struct x64_backend, base);
+  auto &e = *backend->codegen;
 
-  /* avoid reemitting thunks by just resetting the size to a safe spot after
-     the thunks */
-  backend->codegen->setSize(X64_THUNK_SIZE);
+  /* the thunks live before the region, so there's no need to reemit them.
+     just move the cursor to the start of the region, and limit it to the end
+     of the region, where the cold code begins */
+  size_t begin = region - e.getCode();
+  backend->cold_begin = begin + region_size;
+  e.setMaxSize(backend->cold_begin);
+  e.setSize(begin);
 }
 
 static void x64_backend_destroy(struct jit_backend *base) {
@@ -747,6 +1038,10 @@ static void x64_backend_destroy(struct jit_backend *base) {
 
   x64_dispatch_shutdown(backend);
 
+  if (backend->code_alloc) {
+    release_pages(backend->code_alloc, backend->code_alloc_size);
+  }
+
   free(backend);
 }
 
@@ -757,6 +1052,7 @@ struct jit_backend *x64_backend_create(struct jit_guest *guest, void *code,
   Xbyak::util::Cpu cpu;
 
   backend->base.guest = guest;
+  backend->base.name = "x64";
   backend->base.destroy = &x64_backend_destroy;
 
   /* compile interface */
@@ -778,15 +1074,31 @@ struct jit_backend *x64_backend_create(struct jit_guest *guest, void *code,
   backend->base.restore_edge = &x64_dispatch_restore_edge;
 
   /* setup codegen buffer */
-  int r = protect_pages(code, code_size, ACC_READWRITEEXEC);
-  CHECK(r);
+  if (!code) {
+    code_size = ALIGN_UP(code_size, (int)get_allocation_granularity());
+    code = alloc_pages_near((const void *)&x64_backend_create, X64_NEAR_RANGE,
+                            code_size, ACC_READWRITEEXEC);
+    CHECK_NOTNULL(code, "failed to allocate %d byte code buffer", code_size);
+
+    backend->code_alloc = code;
+    backend->code_alloc_size = code_size;
+  } else {
+    int r = protect_pages(code, code_size, ACC_READWRITEEXEC);
+    CHECK(r);
+  }
 
   int have_avx2 = cpu.has(Xbyak::util::Cpu::tAVX2);
+  int have_sse41 = cpu.has(Xbyak::util::Cpu::tSSE41);
   int have_sse2 = cpu.has(Xbyak::util::Cpu::tSSE2);
+  int have_bmi2 = cpu.has(Xbyak::util::Cpu::tBMI2);
   CHECK(have_avx2 || have_sse2, "CPU must support either AVX2 or SSE2");
 
-  backend->codegen = new Xbyak::CodeGenerator(code_size, code);
+  backend->codegen = new x64_codegen(code_size, code);
+  backend->base.code = (uint8_t *)code + X64_THUNK_SIZE;
+  backend->base.code_size = code_size - X64_THUNK_SIZE;
   backend->use_avx = have_avx2;
+  backend->use_sse41 = have_sse41;
+  backend->use_bmi2 = have_bmi2;
 
   /* create disassembler */
   int res = cs_open(CS_ARCH_X86, CS_MODE_64, &backend->capstone_handle);
@@ -5,6 +5,8 @@
 
 struct jit_guest;
 
+/* when code is NULL, a buffer of code_size bytes is allocated within reach of
+   rel32 calls into the executable, and freed along with the backend */
 struct jit_backend *x64_backend_create(struct jit_guest *guest, void *code,
                                        int code_size);
 
@@ -4,6 +4,7 @@ extern "C" {
 #include "core/core.h"
 #include "jit/jit.h"
 #include "jit/jit_guest.h"
+#include "stats.h"
 }
 
 /* log out pc each time dispatch is entered for debugging */
@@ -16,9 +17,16 @@ extern "C" {
    avoiding the need for redundant lookups */
 #define LINK_STATIC_BRANCHES !LOG_DISPATCH_EVERY_N
 
-static inline void **x64_dispatch_code_ptr(struct x64_backend *backend,
-                                           uint32_t addr) {
-  return &backend->cache[(addr & backend->cache_mask) >> backend->cache_shift];
+/* each leaf of the code cache covers 4096 possible block begins */
+#define CACHE_LEAF_BITS 12
+#define CACHE_LEAF_SIZE (1 << CACHE_LEAF_BITS)
+#define CACHE_LEAF_MASK (CACHE_LEAF_SIZE - 1)
+
+static inline int32_t *x64_dispatch_code_ptr(struct x64_backend *backend,
+                                             uint32_t addr) {
+  uint32_t index = (addr & backend->cache_mask) >> backend->cache_shift;
+  int32_t *leaf = backend->cache_dir[index >> CACHE_LEAF_BITS];
+  return &leaf[index & CACHE_LEAF_MASK];
 }
 
 #if LOG_DISPATCH_EVERY_N
@@ -48,22 +56,32 @@ void x64_dispatch_patch_edge(struct jit_backend *base, void *code, void *dst) {
 
 void x64_dispatch_invalidate_code(struct jit_backend *base, uint32_t addr) {
   struct x64_backend *backend = container_of(base, struct x64_backend, base);
-  void **entry = x64_dispatch_code_ptr(backend, addr);
-  *entry = backend->dispatch_compile;
+  int32_t *entry = x64_dispatch_code_ptr(backend, addr);
+  *entry = 0;
 }
 
 void x64_dispatch_cache_code(struct jit_backend *base, uint32_t addr,
                              void *code) {
   struct x64_backend *backend = container_of(base, struct x64_backend, base);
-  void **entry = x64_dispatch_code_ptr(backend, addr);
-  CHECK_EQ(*entry, backend->dispatch_compile);
-  *entry = code;
+
+  /* allocate the leaf on its first write */
+  uint32_t index = (addr & backend->cache_mask) >> backend->cache_shift;
+  int32_t **leaf = &backend->cache_dir[index >> CACHE_LEAF_BITS];
+  if (*leaf == backend->cache_empty) {
+    *leaf = (int32_t *)calloc(CACHE_LEAF_SIZE, sizeof(int32_t));
+    prof_counter_add(COUNTER_mem_jit_dispatch,
+                     CACHE_LEAF_SIZE * sizeof(int32_t));
+  }
+
+  int32_t *entry = x64_dispatch_code_ptr(backend, addr);
+  CHECK_EQ(*entry, 0);
+  *entry = (int32_t)((uint8_t *)code - (uint8_t *)backend->dispatch_compile);
 }
 
 void *x64_dispatch_lookup_code(struct jit_backend *base, uint32_t addr) {
   struct x64_backend *backend = container_of(base, struct x64_backend, base);
-  void **entry = x64_dispatch_code_ptr(backend, addr);
-  return *entry;
+  int32_t *entry = x64_dispatch_code_ptr(backend, addr);
+  return (uint8_t *)backend->dispatch_compile + *entry;
 }
 
 void x64_dispatch_run_code(struct jit_backend *base, int cycles) {
@@ -76,6 +94,7 @@ void x64_dispatch_emit_thunks(struct x64_backend *backend) {
 
   auto &e = *backend->codegen;
   int stack_offset = 0;
+  Xbyak::Label compile;
 
   /* emit dispatch thunks */
   {
@@ -86,15 +105,26 @@ void x64_dispatch_emit_thunks(struct x64_backend *backend) {
     backend->dispatch_dynamic = e.getCurr<void *>();
 
 #if LOG_DISPATCH_EVERY_N
-    e.mov(arg0, guestctx);
+    e.lea(arg0, e.ptr[x64_ctx(0)]);
     e.call(&x64_dispatch_log);
 #endif
 
-    /* invasively look into the jit's cache */
-    e.mov(e.rax, (uint64_t)backend->cache);
-    e.mov(e.ecx, e.dword[guestctx + guest->offset_pc]);
+    /* invasively look into the jit's cache, first finding the leaf in the
+       directory, and then the entry inside of the leaf */
+    int leaf_shift = backend->cache_shift + CACHE_LEAF_BITS;
+    uint32_t leaf_mask = CACHE_LEAF_MASK << backend->cache_shift;
+    int scale = sizeof(int32_t) >> backend->cache_shift;
+    e.mov(e.ecx, e.dword[x64_ctx(guest->offset_pc)]);
     e.and_(e.ecx, backend->cache_mask);
-    e.jmp(e.qword[e.rax + e.rcx * (sizeof(void *) >> backend->cache_shift)]);
+    e.mov(e.eax, e.ecx);
+    e.shr(e.eax, leaf_shift);
+    e.mov(e.rdx, (uint64_t)backend->cache_dir);
+    e.mov(e.rax, e.qword[e.rdx + e.rax * 8]);
+    e.and_(e.ecx, leaf_mask);
+    e.movsxd(e.rax, e.dword[e.rax + e.rcx * scale]);
+    e.lea(e.rcx, e.ptr[e.rip + compile]);
+    e.add(e.rax, e.rcx);
+    e.jmp(e.rax);
   }
 
   {
@@ -112,7 +142,7 @@ void x64_dispatch_emit_thunks(struct x64_backend *backend) {
     e.mov(arg0, (uint64_t)guest->data);
     e.pop(arg1);
     e.sub(arg1, 5 /* sizeof jmp instr */);
-    e.mov(arg2, e.qword[guestctx + guest->offset_pc]);
+    e.mov(arg2, e.qword[x64_ctx(guest->offset_pc)]);
     e.call(guest->link_code);
 #else
     e.pop(arg1);
@@ -121,15 +151,18 @@ void x64_dispatch_emit_thunks(struct x64_backend *backend) {
   }
 
   {
-    /* default cache entry for all blocks. compiles the desired pc before
-       jumping to the block through the dynamic dispatch thunk */
+    /* called when a dynamic branch misses its inline cache. if the cache is
+       still empty, the current pc is recorded as its tag, else the site is
+       treated as polymorphic and always goes through dynamic dispatch */
     e.align(32);
 
-    backend->dispatch_compile = e.getCurr<void *>();
+    backend->dispatch_ic = e.getCurr<void *>();
 
-    e.mov(arg0, (uint64_t)guest->data);
-    e.mov(arg1, e.dword[guestctx + guest->offset_pc]);
-    e.call(guest->compile_code);
+    e.pop(e.rax);
+    e.cmp(e.dword[e.rax], JIT_IC_EMPTY);
+    e.jne(backend->dispatch_dynamic);
+    e.mov(e.ecx, e.dword[x64_ctx(guest->offset_pc)]);
+    e.mov(e.dword[e.rax], e.ecx);
     e.jmp(backend->dispatch_dynamic);
   }
 
@@ -161,12 +194,12 @@ void x64_dispatch_emit_thunks(struct x64_backend *backend) {
     e.sub(e.rsp, stack_offset);
 
     /* assign fixed registers */
-    e.mov(guestctx, (uint64_t)guest->ctx);
+    e.mov(guestctx, (uint64_t)guest->ctx + X64_CTX_BIAS);
     e.mov(guestmem, (uint64_t)guest->membase);
 
     /* reset run state */
-    e.mov(e.dword[guestctx + guest->offset_cycles], arg0);
-    e.mov(e.dword[guestctx + guest->offset_instrs], 0);
+    e.mov(e.dword[x64_ctx(guest->offset_cycles)], arg0);
+    e.mov(e.dword[x64_ctx(guest->offset_instrs)], 0);
 
     e.jmp(backend->dispatch_dynamic);
   }
@@ -185,14 +218,46 @@ void x64_dispatch_emit_thunks(struct x64_backend *backend) {
     e.ret();
   }
 
-  /* reset cache entries to point to the new compile thunk */
-  for (int i = 0; i < backend->cache_size; i++) {
-    backend->cache[i] = backend->dispatch_compile;
+  {
+    /* default cache entry for all blocks. compiles the desired pc before
+       jumping to the block through the dynamic dispatch thunk
+
+       note, when compiling in the background, the block may have instead been
+       interpreted by the compile callback. in that case, no block prologue
+       has run to check the remaining cycles or pending interrupts, so check
+       them here before dispatching to the next block */
+    e.align(32);
+
+    backend->dispatch_compile = e.getCurr<void *>();
+    e.L(compile);
+
+    e.mov(arg0, (uint64_t)guest->data);
+    e.mov(arg1, e.dword[x64_ctx(guest->offset_pc)]);
+    e.call(guest->compile_code);
+    e.mov(e.eax, e.dword[x64_ctx(guest->offset_cycles)]);
+    e.test(e.eax, e.eax);
+    e.js(backend->dispatch_exit);
+    e.mov(e.rax, e.qword[x64_ctx(guest->offset_interrupts)]);
+    e.test(e.rax, e.rax);
+    e.jnz(backend->dispatch_interrupt);
+    e.jmp(backend->dispatch_dynamic);
   }
 }
 
 void x64_dispatch_shutdown(struct x64_backend *backend) {
-  free(backend->cache);
+  int64_t size = backend->cache_dir_size * sizeof(int32_t *) +
+                 CACHE_LEAF_SIZE * sizeof(int32_t);
+
+  for (int i = 0; i < backend->cache_dir_size; i++) {
+    if (backend->cache_dir[i] != backend->cache_empty) {
+      free(backend->cache_dir[i]);
+      size += CACHE_LEAF_SIZE * sizeof(int32_t);
+    }
+  }
+  free(backend->cache_dir);
+  free(backend->cache_empty);
+
+  prof_counter_add(COUNTER_mem_jit_dispatch, -size);
 }
 
 void x64_dispatch_init(struct x64_backend *backend) {
@@ -201,6 +266,16 @@ void x64_dispatch_init(struct x64_backend *backend) {
   /* initialize code cache, one entry per possible block begin */
   backend->cache_mask = guest->addr_mask;
   backend->cache_shift = ctz32(guest->addr_mask);
-  backend->cache_size = (backend->cache_mask >> backend->cache_shift) + 1;
-  backend->cache = (void **)malloc(backend->cache_size * sizeof(void *));
+  int cache_size = (backend->cache_mask >> backend->cache_shift) + 1;
+  backend->cache_dir_size = MAX(cache_size >> CACHE_LEAF_BITS, 1);
+  backend->cache_dir =
+      (int32_t **)calloc(backend->cache_dir_size, sizeof(int32_t *));
+  backend->cache_empty = (int32_t *)calloc(CACHE_LEAF_SIZE, sizeof(int32_t));
+  for (int i = 0; i < backend->cache_dir_size; i++) {
+    backend->cache_dir[i] = backend->cache_empty;
+  }
+
+  prof_counter_add(COUNTER_mem_jit_dispatch,
+                   backend->cache_dir_size * sizeof(int32_t *) +
+                       CACHE_LEAF_SIZE * sizeof(int32_t));
 }
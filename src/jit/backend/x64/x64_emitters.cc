@@ -4,6 +4,7 @@ extern "C" {
 #include "jit/ir/ir.h"
 #include "jit/jit.h"
 #include "jit/jit_guest.h"
+#include "jit/pass_stats.h"
 }
 
 #define EMITTER(op, constraints)                                           \
@@ -103,20 +104,29 @@ EMITTER(LOAD_GUEST, CONSTRAINTS(REG_ALL, REG_I64 | IMM_I32)) {
   Xbyak::Reg dst = RES_REG;
   struct ir_value *addr = ARG0;
 
+  /* peel away one layer of abstraction and directly access the backing
+     memory or directly invoke the callback when the address is constant. the
+     mmio callbacks only deal with 32-bit values, so 64-bit mmio accesses still
+     go through the generic handler. registers without side effects are
+     accessed directly as well */
+  void *userdata = NULL;
+  uint8_t *ptr = NULL;
+  mem_read_cb read = NULL;
   if (ir_is_constant(addr)) {
-    /* peel away one layer of abstraction and directly access the backing
-       memory or directly invoke the callback when the address is constant */
-    void *userdata;
-    uint8_t *ptr;
-    mem_read_cb read;
     guest->lookup(guest->mem, addr->i32, &userdata, &ptr, &read, NULL);
 
+    if (!ptr && read && ir_type_size(RES->type) == 4 && guest->lookup_reg) {
+      ptr = (uint8_t *)guest->lookup_reg(guest->mem, addr->i32, 0);
+    }
+  }
+
+  if (ptr || (read && ir_type_size(RES->type) <= 4)) {
     if (ptr) {
       e.mov(e.rax, (uint64_t)ptr);
       x64_backend_load_mem(backend, RES, e.rax);
     } else {
       int data_size = ir_type_size(RES->type);
-      uint32_t data_mask = (1 << (data_size * 8)) - 1;
+      uint32_t data_mask = (uint32_t)((1ull << (data_size * 8)) - 1);
 
       e.mov(arg0, (uint64_t)userdata);
       e.mov(arg1, (uint32_t)addr->i32);
@@ -125,8 +135,6 @@ EMITTER(LOAD_GUEST, CONSTRAINTS(REG_ALL, REG_I64 | IMM_I32)) {
       e.mov(dst, e.rax);
     }
   } else {
-    Xbyak::Reg ra = x64_backend_reg(backend, addr);
-
     void *fn = nullptr;
     switch (RES->type) {
       case VALUE_I8:
@@ -147,7 +155,7 @@ EMITTER(LOAD_GUEST, CONSTRAINTS(REG_ALL, REG_I64 | IMM_I32)) {
     }
 
     e.mov(arg0, (uint64_t)guest->mem);
-    e.mov(arg1, ra);
+    x64_backend_mov_value(backend, arg1, addr);
     e.call((void *)fn);
     e.mov(dst, e.rax);
   }
@@ -158,20 +166,29 @@ EMITTER(STORE_GUEST, CONSTRAINTS(NONE, REG_I64 | IMM_I32, VAL_ALL)) {
   struct ir_value *addr = ARG0;
   struct ir_value *data = ARG1;
 
+  /* peel away one layer of abstraction and directly access the backing
+     memory or directly invoke the callback when the address is constant. the
+     mmio callbacks only deal with 32-bit values, so 64-bit mmio accesses still
+     go through the generic handler. registers without side effects are
+     accessed directly as well */
+  void *userdata = NULL;
+  uint8_t *ptr = NULL;
+  mem_write_cb write = NULL;
   if (ir_is_constant(addr)) {
-    /* peel away one layer of abstraction and directly access the backing
-       memory or directly invoke the callback when the address is constant */
-    void *userdata;
-    uint8_t *ptr;
-    mem_write_cb write;
     guest->lookup(guest->mem, addr->i32, &userdata, &ptr, NULL, &write);
 
+    if (!ptr && write && ir_type_size(data->type) == 4 && guest->lookup_reg) {
+      ptr = (uint8_t *)guest->lookup_reg(guest->mem, addr->i32, 1);
+    }
+  }
+
+  if (ptr || (write && ir_type_size(data->type) <= 4)) {
     if (ptr) {
       e.mov(e.rax, (uint64_t)ptr);
       x64_backend_store_mem(backend, e.rax, data);
     } else {
       int data_size = ir_type_size(data->type);
-      uint32_t data_mask = (1 << (data_size * 8)) - 1;
+      uint32_t data_mask = (uint32_t)((1ull << (data_size * 8)) - 1);
 
       e.mov(arg0, (uint64_t)userdata);
       e.mov(arg1, (uint32_t)addr->i32);
@@ -180,8 +197,6 @@ EMITTER(STORE_GUEST, CONSTRAINTS(NONE, REG_I64 | IMM_I32, VAL_ALL)) {
       e.call((void *)write);
     }
   } else {
-    Xbyak::Reg ra = x64_backend_reg(backend, addr);
-
     void *fn = nullptr;
     switch (data->type) {
       case VALUE_I8:
@@ -202,7 +217,7 @@ EMITTER(STORE_GUEST, CONSTRAINTS(NONE, REG_I64 | IMM_I32, VAL_ALL)) {
     }
 
     e.mov(arg0, (uint64_t)guest->mem);
-    e.mov(arg1, ra);
+    x64_backend_mov_value(backend, arg1, addr);
     x64_backend_mov_value(backend, arg2, data);
     e.call((void *)fn);
   }
@@ -212,28 +227,47 @@ EMITTER(LOAD_FAST, CONSTRAINTS(REG_ALL, REG_I64)) {
   struct ir_value *dst = RES;
   Xbyak::Reg addr = ARG0_REG;
 
+  /* the exception handler and its thunks only deal with integer registers */
+  int slow = ir_is_int(dst->type);
+  uint8_t *branch = slow ? x64_backend_emit_check(backend, addr) : NULL;
+  uint8_t *site = e.getCurr<uint8_t *>();
+
   x64_backend_load_mem(backend, dst, addr.cvt64() + guestmem);
+
+  if (slow) {
+    x64_backend_add_stub(backend, instr, site, branch);
+  }
 }
 
 EMITTER(STORE_FAST, CONSTRAINTS(NONE, REG_I64, VAL_ALL)) {
   Xbyak::Reg addr = ARG0_REG;
   struct ir_value *data = ARG1;
 
+  int slow = ir_is_int(data->type);
+  uint8_t *branch = slow ? x64_backend_emit_check(backend, addr) : NULL;
+  uint8_t *site = e.getCurr<uint8_t *>();
+
   x64_backend_store_mem(backend, addr.cvt64() + guestmem, data);
+
+  if (slow) {
+    x64_backend_add_stub(backend, instr, site, branch);
+  }
 }
 
 EMITTER(LOAD_CONTEXT, CONSTRAINTS(REG_ALL, IMM_I32)) {
   struct ir_value *dst = RES;
   int offset = ARG0->i32;
 
-  x64_backend_load_mem(backend, dst, guestctx + offset);
+  pass_stats_context(offset);
+  x64_backend_load_mem(backend, dst, x64_ctx(offset));
 }
 
 EMITTER(STORE_CONTEXT, CONSTRAINTS(NONE, IMM_I32, VAL_ALL)) {
   int offset = ARG0->i32;
   struct ir_value *data = ARG1;
 
-  x64_backend_store_mem(backend, guestctx + offset, data);
+  pass_stats_context(offset);
+  x64_backend_store_mem(backend, x64_ctx(offset), data);
 }
 
 EMITTER(LOAD_LOCAL, CONSTRAINTS(REG_ALL, IMM_I32)) {
@@ -738,6 +772,22 @@ EMITTER(VBROADCAST, CONSTRAINTS(REG_V128, REG_F64)) {
   }
 }
 
+EMITTER(VSPLAT, CONSTRAINTS(REG_V128, REG_V128, IMM_I32)) {
+  Xbyak::Xmm rd = RES_XMM;
+  Xbyak::Xmm ra = ARG0_XMM;
+  uint8_t lane = (uint8_t)ARG1->i32;
+  uint8_t mask = lane | (lane << 2) | (lane << 4) | (lane << 6);
+
+  if (X64_USE_AVX) {
+    e.vshufps(rd, ra, ra, mask);
+  } else {
+    if (rd != ra) {
+      e.movaps(rd, ra);
+    }
+    e.shufps(rd, rd, mask);
+  }
+}
+
 EMITTER(VADD, CONSTRAINTS(REG_V128, REG_V128, REG_V128)) {
   Xbyak::Xmm rd = RES_XMM;
   Xbyak::Xmm ra = ARG0_XMM;
@@ -760,6 +810,11 @@ EMITTER(VDOT, CONSTRAINTS(REG_V128, REG_V128, REG_V128)) {
 
   if (X64_USE_AVX) {
     e.vdpps(rd, ra, rb, 0b11110001);
+  } else if (X64_USE_SSE41) {
+    if (rd != ra) {
+      e.movaps(rd, ra);
+    }
+    e.dpps(rd, rb, 0b11110001);
   } else {
     if (rd != ra) {
       e.movaps(rd, ra);
@@ -829,6 +884,10 @@ EMITTER(SHL, CONSTRAINTS(REG_ARG0, REG_I64, REG_I64 | IMM_I32)) {
 
   if (ir_is_constant(ARG1)) {
     e.shl(rd, (int)ir_zext_constant(ARG1));
+  } else if (x64_backend_use_shiftx(backend, instr)) {
+    Xbyak::Reg32e d(rd.getIdx(), rd.getBit());
+    Xbyak::Reg32e b(ARG1_REG.getIdx(), rd.getBit());
+    e.shlx(d, d, b);
   } else {
     Xbyak::Reg rb = ARG1_REG;
     e.mov(e.cl, rb);
@@ -841,6 +900,10 @@ EMITTER(ASHR, CONSTRAINTS(REG_ARG0, REG_I64, REG_I64 | IMM_I32)) {
 
   if (ir_is_constant(ARG1)) {
     e.sar(rd, (int)ir_zext_constant(ARG1));
+  } else if (x64_backend_use_shiftx(backend, instr)) {
+    Xbyak::Reg32e d(rd.getIdx(), rd.getBit());
+    Xbyak::Reg32e b(ARG1_REG.getIdx(), rd.getBit());
+    e.sarx(d, d, b);
   } else {
     Xbyak::Reg rb = ARG1_REG;
     e.mov(e.cl, rb);
@@ -853,6 +916,10 @@ EMITTER(LSHR, CONSTRAINTS(REG_ARG0, REG_I64, REG_I64 | IMM_I32)) {
 
   if (ir_is_constant(ARG1)) {
     e.shr(rd, (int)ir_zext_constant(ARG1));
+  } else if (x64_backend_use_shiftx(backend, instr)) {
+    Xbyak::Reg32e d(rd.getIdx(), rd.getBit());
+    Xbyak::Reg32e b(ARG1_REG.getIdx(), rd.getBit());
+    e.shrx(d, d, b);
   } else {
     Xbyak::Reg rb = ARG1_REG;
     e.mov(e.cl, rb);
@@ -864,6 +931,22 @@ EMITTER(ASHD, CONSTRAINTS(REG_ARG0, REG_I64, REG_I64)) {
   Xbyak::Reg rd = RES_REG;
   Xbyak::Reg rb = ARG1_REG;
 
+  if (X64_USE_BMI2) {
+    /* compute both directions and select on the sign of the shift amount. a
+       right shift by (~rb + 1) & 0x1f is performed as a shift by ~rb & 0x1f
+       followed by a shift by 1, which also yields the overflowed result of
+       shifting by 32 when the low bits of rb are zero */
+    e.shlx(e.eax, rd.cvt32(), rb.cvt32());
+    e.mov(e.ecx, rb.cvt32());
+    e.not_(e.ecx);
+    e.sarx(e.ecx, rd.cvt32(), e.ecx);
+    e.sar(e.ecx, 1);
+    e.test(rb.cvt32(), rb.cvt32());
+    e.cmovs(e.eax, e.ecx);
+    e.mov(rd.cvt32(), e.eax);
+    return;
+  }
+
   e.inLocalLabel();
 
   /* check if we're shifting left or right */
@@ -898,6 +981,19 @@ EMITTER(LSHD, CONSTRAINTS(REG_ARG0, REG_I64, REG_I64)) {
   Xbyak::Reg rd = RES_REG;
   Xbyak::Reg rb = ARG1_REG;
 
+  if (X64_USE_BMI2) {
+    /* same as ASHD, shifting in zeroes on the right */
+    e.shlx(e.eax, rd.cvt32(), rb.cvt32());
+    e.mov(e.ecx, rb.cvt32());
+    e.not_(e.ecx);
+    e.shrx(e.ecx, rd.cvt32(), e.ecx);
+    e.shr(e.ecx, 1);
+    e.test(rb.cvt32(), rb.cvt32());
+    e.cmovs(e.eax, e.ecx);
+    e.mov(rd.cvt32(), e.eax);
+    return;
+  }
+
   e.inLocalLabel();
 
   /* check if we're shifting left or right */
@@ -936,58 +1032,85 @@ EMITTER(BRANCH_COND, CONSTRAINTS(NONE, REG_I64 | IMM_I32 | IMM_BLK,
                                  REG_I64 | IMM_I32 | IMM_BLK, REG_I64)) {
   struct jit_guest *guest = backend->base.guest;
 
-  Xbyak::Reg cond = ARG2_REG;
   Xbyak::Label next;
-  e.test(cond, cond);
-  e.jz(next);
+
+  /* look through the zero extension applied when the result of a comparison
+     is stored as a 32-bit flag, such as sh4's t bit */
+  const struct ir_value *cond = ARG2;
+  while (cond->def && cond->def->op == OP_ZEXT) {
+    cond = cond->def->arg[0];
+  }
+
+  if (backend->flags_cmp && cond == backend->flags_cmp->result) {
+    /* the flags from the comparison are still live, branch on them directly
+       instead of testing its result */
+    enum ir_cmp cmp = (enum ir_cmp)backend->flags_cmp->arg[2]->i32;
+    switch (cmp) {
+      case CMP_EQ:
+        e.jne(next);
+        break;
+      case CMP_NE:
+        e.je(next);
+        break;
+      case CMP_SGE:
+        e.jl(next);
+        break;
+      case CMP_SGT:
+        e.jle(next);
+        break;
+      case CMP_UGE:
+        e.jb(next);
+        break;
+      case CMP_UGT:
+        e.jbe(next);
+        break;
+      case CMP_SLE:
+        e.jg(next);
+        break;
+      case CMP_SLT:
+        e.jge(next);
+        break;
+      case CMP_ULE:
+        e.ja(next);
+        break;
+      case CMP_ULT:
+        e.jae(next);
+        break;
+      default:
+        LOG_FATAL("unexpected comparison type");
+    }
+  } else {
+    Xbyak::Reg reg = ARG2_REG;
+    e.test(reg, reg);
+    e.jz(next);
+  }
+
   x64_backend_emit_branch(backend, ir, ARG0);
   e.L(next);
   x64_backend_emit_branch(backend, ir, ARG1);
 }
 
 EMITTER(CALL, CONSTRAINTS(NONE, VAL_I64, OPT_I64, OPT_I64)) {
-  if (ARG1) {
-    x64_backend_mov_value(backend, arg0, ARG1);
-  }
-  if (ARG2) {
-    x64_backend_mov_value(backend, arg1, ARG2);
-  }
-
-  if (ir_is_constant(ARG0)) {
-    void *addr = (void *)ARG0->i64;
-    e.call(addr);
-  } else {
-    Xbyak::Reg addr = ARG0_REG;
-    e.call(addr);
-  }
+  x64_backend_call(backend, ARG0, ARG1, ARG2);
 }
 
 EMITTER(CALL_COND, CONSTRAINTS(NONE, VAL_I64, VAL_I64, OPT_I64, OPT_I64)) {
-  e.inLocalLabel();
-
   Xbyak::Reg cond = ARG1_REG;
 
   e.test(cond, cond);
 
-  e.jz(".skip");
+  /* the call is rarely made, move it out of line when there's room */
+  uint8_t *branch = x64_backend_branch_cold(backend, 0x5);
 
-  if (ARG2) {
-    x64_backend_mov_value(backend, arg0, ARG2);
-  }
-  if (ARG3) {
-    x64_backend_mov_value(backend, arg1, ARG3);
-  }
-
-  if (ir_is_constant(ARG0)) {
-    void *addr = (void *)ARG0->i64;
-    e.call(addr);
-  } else {
-    const Xbyak::Reg addr = ARG0_REG;
-    e.call(addr);
+  if (branch) {
+    x64_backend_add_stub(backend, instr, NULL, branch);
+    return;
   }
 
+  e.inLocalLabel();
+  e.jz(".skip");
+  x64_backend_call(backend, ARG0, ARG2, ARG3);
   e.L(".skip");
-
   e.outLocalLabel();
 }
 
@@ -22,27 +22,76 @@ enum xmm_constant {
   NUM_XMM_CONST,
 };
 
+/* code generator whose limit can be moved, restricting assembly to a single
+   region of the code buffer */
+class x64_codegen : public Xbyak::CodeGenerator {
+ public:
+  x64_codegen(size_t max_size, void *code)
+      : Xbyak::CodeGenerator(max_size, code) {}
+
+  void setMaxSize(size_t max_size) {
+    maxSize_ = max_size;
+  }
+};
+
+/* out-of-line slow path for a fastmem access or conditional call. these are
+   emitted into the region's cold code, away from the block's code. a
+   fastmem access is only patched to jump to its stub once it has faulted,
+   unless the guest provides a page table, in which case the access is guarded
+   by an inline check branching to it, same as a conditional call */
+#define X64_MAX_STUBS 256
+
+struct x64_stub {
+  const struct ir_instr *instr;
+  uint8_t *site;
+  uint8_t *resume;
+  uint8_t *branch;
+};
+
 struct x64_backend {
   struct jit_backend base;
 
-  /* code cache */
+  /* code cache, each entry is the offset of its block from the compile
+     thunk. this way, an entry is zero until its block is compiled. the cache
+     is split into a directory of leaf pages, with each leaf only allocated
+     once a block inside of it is compiled. until then, its directory entry
+     points to a shared leaf of zeroes */
   uint32_t cache_mask;
   int cache_shift;
-  int cache_size;
-  void **cache;
+  int cache_dir_size;
+  int32_t **cache_dir;
+  int32_t *cache_empty;
+
+  /* code buffer allocated by the backend, if one wasn't provided */
+  void *code_alloc;
+  int code_alloc_size;
 
   /* codegen state */
-  Xbyak::CodeGenerator *codegen;
+  x64_codegen *codegen;
   int use_avx;
+  int use_sse41;
+  int use_bmi2;
   Xbyak::Label xmm_const[NUM_XMM_CONST];
   void *dispatch_dynamic;
   void *dispatch_static;
+  void *dispatch_ic;
   void *dispatch_compile;
   void *dispatch_interrupt;
   void (*dispatch_enter)(int32_t);
   void *dispatch_exit;
   void (*load_thunk[16])();
   void (*store_thunk)();
+  struct x64_stub stubs[X64_MAX_STUBS];
+  int num_stubs;
+
+  /* offset into the code buffer of the current region's cold code, which
+     grows downwards from the end of the region */
+  size_t cold_begin;
+
+  /* the last comparison whose result is still held in the host's flags,
+     conditional branches on it jump on the flags directly rather than
+     testing the materialized result */
+  const struct ir_instr *flags_cmp;
 
   /* debug stats */
   csh capstone_handle;
@@ -52,6 +101,11 @@ struct x64_backend {
  * backend functionality used by emitters
  */
 #define X64_THUNK_SIZE 8192
+
+/* code buffers allocated by the backend are kept within this distance of the
+   executable's code, leaving the rest of the 2 GB rel32 range for the size of
+   the executable itself */
+#define X64_NEAR_RANGE 0x70000000
 #define X64_STACK_SIZE 1024
 
 #if PLATFORM_WINDOWS
@@ -62,7 +116,14 @@ struct x64_backend {
 
 #define X64_STACK_LOCALS (X64_STACK_SHADOW_SPACE + 8)
 
+/* guestctx points this far into the guest's context, so the 8-bit
+   displacements used to access it reach its first 256 bytes rather than only
+   its first 128 */
+#define X64_CTX_BIAS 128
+
 #define X64_USE_AVX backend->use_avx
+#define X64_USE_SSE41 backend->use_sse41
+#define X64_USE_BMI2 backend->use_bmi2
 
 struct ir_value;
 
@@ -75,6 +136,10 @@ extern const Xbyak::Reg64 tmp1;
 extern const Xbyak::Reg64 guestctx;
 extern const Xbyak::Reg64 guestmem;
 
+static inline Xbyak::RegExp x64_ctx(int offset) {
+  return guestctx + (offset - X64_CTX_BIAS);
+}
+
 Xbyak::Reg x64_backend_reg(struct x64_backend *backend,
                            const struct ir_value *v);
 Xbyak::Xmm x64_backend_xmm(struct x64_backend *backend,
@@ -94,6 +159,16 @@ const Xbyak::Address x64_backend_xmm_constant(struct x64_backend *backend,
 void x64_backend_block_label(char *name, size_t size, struct ir_block *block);
 void x64_backend_emit_branch(struct x64_backend *backend, struct ir *ir,
                              const ir_value *target);
+int x64_backend_use_shiftx(struct x64_backend *backend,
+                           const struct ir_instr *instr);
+void x64_backend_call(struct x64_backend *backend, const struct ir_value *fn,
+                      const struct ir_value *a0, const struct ir_value *a1);
+uint8_t *x64_backend_branch_cold(struct x64_backend *backend, int cc);
+uint8_t *x64_backend_emit_check(struct x64_backend *backend,
+                                const Xbyak::Reg &addr);
+void x64_backend_add_stub(struct x64_backend *backend,
+                          const struct ir_instr *instr, uint8_t *site,
+                          uint8_t *branch);
 
 /*
  * dispatch
@@ -73,6 +73,7 @@ enum {
 #define C_MASK (1u << C_BIT)
 #define Z_MASK (1u << Z_BIT)
 #define N_MASK (1u << N_BIT)
+#define NZCV_MASK (N_MASK | Z_MASK | C_MASK | V_MASK)
 
 #define F_SET(sr) (((sr)&F_MASK) == F_MASK)
 #define I_SET(sr) (((sr)&I_MASK) == I_MASK)
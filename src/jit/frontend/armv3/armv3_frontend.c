@@ -3,6 +3,7 @@
 #include "jit/frontend/armv3/armv3_disasm.h"
 #include "jit/frontend/armv3/armv3_fallback.h"
 #include "jit/frontend/armv3/armv3_guest.h"
+#include "jit/frontend/armv3/armv3_translate.h"
 #include "jit/ir/ir.h"
 #include "jit/jit.h"
 #include "jit/jit_guest.h"
@@ -11,9 +12,21 @@ struct armv3_frontend {
   struct jit_frontend;
 };
 
-static const struct jit_opdef *armv3_frontend_lookup_op(
-    struct jit_frontend *base, const void *instr) {
-  return armv3_get_opdef(*(const uint32_t *)instr);
+static const struct jit_opdef *armv3_frontend_fetch_op(
+    struct jit_frontend *base, uint32_t addr, uint32_t *data) {
+  struct jit_guest *guest = base->guest;
+
+  *data = guest->r32(guest->mem, addr);
+
+  return armv3_get_opdef(*data);
+}
+
+static int armv3_frontend_is_terminated(struct ir_block *block) {
+  struct ir_instr *last_instr =
+      list_last_entry(&block->instrs, struct ir_instr, it);
+
+  return last_instr &&
+         (last_instr->op == OP_BRANCH || last_instr->op == OP_BRANCH_COND);
 }
 
 static void armv3_frontend_dump_code(struct jit_frontend *base,
@@ -46,22 +59,86 @@ static void armv3_frontend_translate_code(struct jit_frontend *base,
   struct armv3_frontend *frontend = (struct armv3_frontend *)base;
   struct armv3_guest *guest = (struct armv3_guest *)frontend->guest;
 
-  int offset = 0;
+  int num_instrs = size / 4;
 
-  while (offset < size) {
-    uint32_t addr = begin_addr + offset;
+  /* find the flags live after each instruction, walking backwards from the end
+     of the block where any of them may be read by the next block. flags which
+     are overwritten before being read are never computed */
+  uint32_t *live = malloc(num_instrs * sizeof(uint32_t));
+  uint32_t live_out = NZCV_MASK;
+
+  for (int n = num_instrs - 1; n >= 0; n--) {
+    uint32_t addr = begin_addr + n * 4;
     uint32_t data = guest->r32(guest->mem, addr);
+    uint32_t use, def;
+    armv3_get_flag_usage(data, &use, &def);
+
+    live[n] = live_out;
+    live_out = use | (live_out & ~def);
+  }
+
+  /* append inital block */
+  struct ir_block *block = ir_append_block(ir);
+  ir_set_meta(ir, block, IR_META_ADDR, ir_alloc_i32(ir, begin_addr));
+
+  for (int n = 0; n < num_instrs; n++) {
+    uint32_t addr = begin_addr + n * 4;
+    uint32_t data = guest->r32(guest->mem, addr);
+    union armv3_instr i = {data};
     struct jit_opdef *def = armv3_get_opdef(data);
+    armv3_translate_cb cb = armv3_get_translator(data);
+    uint32_t cond = i.raw >> 28;
 
     ir_source_info(ir, addr, 12);
-    ir_fallback(ir, def->fallback, addr, data);
 
-    offset += 4;
+    if (!cb) {
+      /* the fallbacks check the condition themselves */
+      ir_fallback(ir, def->fallback, addr, data);
+    } else if (cond == COND_AL || def->op == ARMV3_OP_B) {
+      cb(guest, ir, addr, i, live[n]);
+    } else {
+      /* emit conditional instructions in their own block, which is skipped
+         over when the condition fails */
+      struct ir_value *taken = armv3_translate_cond(ir, cond);
+
+      struct ir_block *body = ir_insert_block(ir, block);
+      ir_set_meta(ir, body, IR_META_ADDR, ir_alloc_i32(ir, addr));
+      struct ir_block *skip = ir_insert_block(ir, body);
+      ir_set_meta(ir, skip, IR_META_ADDR, ir_alloc_i32(ir, addr + 4));
+
+      ir_branch_cond(ir, taken, ir_alloc_block_ref(ir, body),
+                     ir_alloc_block_ref(ir, skip));
+
+      ir_set_current_block(ir, body);
+      cb(guest, ir, addr, i, live[n]);
+
+      if (!armv3_frontend_is_terminated(body)) {
+        ir_branch(ir, ir_alloc_block_ref(ir, skip));
+      }
+
+      ir_set_current_block(ir, skip);
+      block = skip;
+    }
+  }
+
+  free(live);
+
+  /* fallbacks store the next pc to the context, letting the block return to
+     dispatch. translated instructions which write the pc branch to it
+     directly, for any others (e.g. a failed condition or a store of the pc)
+     branch to the next address */
+  struct ir_instr *last_instr =
+      list_last_entry(&block->instrs, struct ir_instr, it);
+
+  if (!armv3_frontend_is_terminated(block) &&
+      (!last_instr || last_instr->op != OP_FALLBACK)) {
+    ir_branch(ir, ir_alloc_i32(ir, begin_addr + size));
   }
 }
 
 static void armv3_frontend_analyze_code(struct jit_frontend *base,
-                                        uint32_t begin_addr, int *size) {
+                                        uint32_t begin_addr, int flags,
+                                        int *size) {
   struct armv3_frontend *frontend = (struct armv3_frontend *)base;
   struct armv3_guest *guest = (struct armv3_guest *)frontend->guest;
 
@@ -105,7 +182,7 @@ struct jit_frontend *armv3_frontend_create(struct jit_guest *guest) {
   frontend->analyze_code = &armv3_frontend_analyze_code;
   frontend->translate_code = &armv3_frontend_translate_code;
   frontend->dump_code = &armv3_frontend_dump_code;
-  frontend->lookup_op = &armv3_frontend_lookup_op;
+  frontend->fetch_op = &armv3_frontend_fetch_op;
 
   return (struct jit_frontend *)frontend;
 }
@@ -0,0 +1,852 @@
+#include "jit/frontend/armv3/armv3_translate.h"
+#include "core/core.h"
+#include "jit/frontend/armv3/armv3_context.h"
+#include "jit/frontend/armv3/armv3_guest.h"
+#include "jit/ir/ir.h"
+
+#define TRANSLATE(op)                                              \
+  static void armv3_translate_##op(struct armv3_guest *guest,      \
+                                   struct ir *ir, uint32_t addr,   \
+                                   union armv3_instr i, uint32_t live)
+
+/*
+ * register access
+ */
+static struct ir_value *load_reg(struct ir *ir, int n) {
+  return ir_load_context(ir, offsetof(struct armv3_context, r[n]), VALUE_I32);
+}
+
+static void store_reg(struct ir *ir, int n, struct ir_value *v) {
+  ir_store_context(ir, offsetof(struct armv3_context, r[n]), v);
+}
+
+static struct ir_value *load_rn(struct ir *ir, uint32_t addr, int rn) {
+  if (rn == 15) {
+    /* account for instruction prefetching if loading the pc */
+    return ir_alloc_i32(ir, addr + 8);
+  }
+
+  return load_reg(ir, rn);
+}
+
+static struct ir_value *load_rd(struct ir *ir, uint32_t addr, int rd) {
+  if (rd == 15) {
+    /* account for instruction prefetching if loading the pc */
+    return ir_alloc_i32(ir, addr + 12);
+  }
+
+  return load_reg(ir, rd);
+}
+
+static void store_rd(struct ir *ir, int rd, struct ir_value *v) {
+  if (rd == 15) {
+    /* writing the pc ends the block, branch to the new address */
+    ir_branch(ir, v);
+    return;
+  }
+
+  store_reg(ir, rd, v);
+}
+
+/*
+ * flags
+ *
+ * each flag-setting instruction is passed the set of flags which are read
+ * before being overwritten again, only these are computed and written back
+ */
+static struct ir_value *load_carry(struct ir *ir) {
+  struct ir_value *cpsr = load_reg(ir, CPSR);
+  return ir_and(ir, ir_lshri(ir, cpsr, C_BIT), ir_alloc_i32(ir, 1));
+}
+
+/* flags are passed as 0 / 1 values, or NULL to leave the flag unmodified */
+static void store_flags(struct ir *ir, struct ir_value *n, struct ir_value *z,
+                        struct ir_value *c, struct ir_value *v) {
+  uint32_t mask = 0;
+  mask |= n ? N_MASK : 0;
+  mask |= z ? Z_MASK : 0;
+  mask |= c ? C_MASK : 0;
+  mask |= v ? V_MASK : 0;
+
+  if (!mask) {
+    return;
+  }
+
+  struct ir_value *cpsr = load_reg(ir, CPSR);
+  cpsr = ir_and(ir, cpsr, ir_alloc_i32(ir, ~mask));
+
+  if (n) {
+    cpsr = ir_or(ir, cpsr, ir_shli(ir, n, N_BIT));
+  }
+  if (z) {
+    cpsr = ir_or(ir, cpsr, ir_shli(ir, z, Z_BIT));
+  }
+  if (c) {
+    cpsr = ir_or(ir, cpsr, ir_shli(ir, c, C_BIT));
+  }
+  if (v) {
+    cpsr = ir_or(ir, cpsr, ir_shli(ir, v, V_BIT));
+  }
+
+  store_reg(ir, CPSR, cpsr);
+}
+
+static struct ir_value *flag_n(struct ir *ir, uint32_t live,
+                               struct ir_value *res) {
+  if (!(live & N_MASK)) {
+    return NULL;
+  }
+  return ir_lshri(ir, res, 31);
+}
+
+static struct ir_value *flag_z(struct ir *ir, uint32_t live,
+                               struct ir_value *res) {
+  if (!(live & Z_MASK)) {
+    return NULL;
+  }
+  return ir_zext(ir, ir_cmp_eq(ir, res, ir_alloc_i32(ir, 0)), VALUE_I32);
+}
+
+static void update_flags_logical(struct ir *ir, uint32_t live,
+                                 struct ir_value *res, struct ir_value *carry) {
+  struct ir_value *n = flag_n(ir, live, res);
+  struct ir_value *z = flag_z(ir, live, res);
+  struct ir_value *c = (live & C_MASK) ? carry : NULL;
+  struct ir_value *v = (live & V_MASK) ? ir_alloc_i32(ir, 0) : NULL;
+  store_flags(ir, n, z, c, v);
+}
+
+static void update_flags_sub(struct ir *ir, uint32_t live, struct ir_value *lhs,
+                             struct ir_value *rhs, struct ir_value *res) {
+  struct ir_value *n = flag_n(ir, live, res);
+  struct ir_value *z = flag_z(ir, live, res);
+  struct ir_value *c = NULL;
+  struct ir_value *v = NULL;
+
+  if (live & C_MASK) {
+    /* ~((~lhs & rhs) | ((~lhs | rhs) & res)) >> 31 */
+    struct ir_value *not_lhs = ir_not(ir, lhs);
+    struct ir_value *borrow =
+        ir_or(ir, ir_and(ir, not_lhs, rhs),
+              ir_and(ir, ir_or(ir, not_lhs, rhs), res));
+    c = ir_lshri(ir, ir_not(ir, borrow), 31);
+  }
+
+  if (live & V_MASK) {
+    /* ((lhs ^ rhs) & (res ^ lhs)) >> 31 */
+    v = ir_lshri(
+        ir, ir_and(ir, ir_xor(ir, lhs, rhs), ir_xor(ir, res, lhs)), 31);
+  }
+
+  store_flags(ir, n, z, c, v);
+}
+
+static void update_flags_add(struct ir *ir, uint32_t live, struct ir_value *lhs,
+                             struct ir_value *rhs, struct ir_value *res) {
+  struct ir_value *n = flag_n(ir, live, res);
+  struct ir_value *z = flag_z(ir, live, res);
+  struct ir_value *c = NULL;
+  struct ir_value *v = NULL;
+
+  if (live & C_MASK) {
+    /* ((lhs & rhs) | ((lhs | rhs) & ~res)) >> 31 */
+    struct ir_value *carry =
+        ir_or(ir, ir_and(ir, lhs, rhs),
+              ir_and(ir, ir_or(ir, lhs, rhs), ir_not(ir, res)));
+    c = ir_lshri(ir, carry, 31);
+  }
+
+  if (live & V_MASK) {
+    /* ((res ^ lhs) & (res ^ rhs)) >> 31 */
+    v = ir_lshri(
+        ir, ir_and(ir, ir_xor(ir, res, lhs), ir_xor(ir, res, rhs)), 31);
+  }
+
+  store_flags(ir, n, z, c, v);
+}
+
+static void update_flags_mul(struct ir *ir, uint32_t live,
+                             struct ir_value *res) {
+  struct ir_value *n = flag_n(ir, live, res);
+  struct ir_value *z = flag_z(ir, live, res);
+  store_flags(ir, n, z, NULL, NULL);
+}
+
+struct ir_value *armv3_translate_cond(struct ir *ir, uint32_t cond) {
+  struct ir_value *cpsr = load_reg(ir, CPSR);
+  struct ir_value *zero = ir_alloc_i32(ir, 0);
+
+  switch (cond) {
+    case COND_EQ:
+      return ir_cmp_ne(ir, ir_and(ir, cpsr, ir_alloc_i32(ir, Z_MASK)), zero);
+    case COND_NE:
+      return ir_cmp_eq(ir, ir_and(ir, cpsr, ir_alloc_i32(ir, Z_MASK)), zero);
+    case COND_CS:
+      return ir_cmp_ne(ir, ir_and(ir, cpsr, ir_alloc_i32(ir, C_MASK)), zero);
+    case COND_CC:
+      return ir_cmp_eq(ir, ir_and(ir, cpsr, ir_alloc_i32(ir, C_MASK)), zero);
+    case COND_MI:
+      return ir_cmp_ne(ir, ir_and(ir, cpsr, ir_alloc_i32(ir, N_MASK)), zero);
+    case COND_PL:
+      return ir_cmp_eq(ir, ir_and(ir, cpsr, ir_alloc_i32(ir, N_MASK)), zero);
+    case COND_VS:
+      return ir_cmp_ne(ir, ir_and(ir, cpsr, ir_alloc_i32(ir, V_MASK)), zero);
+    case COND_VC:
+      return ir_cmp_eq(ir, ir_and(ir, cpsr, ir_alloc_i32(ir, V_MASK)), zero);
+    case COND_HI:
+    case COND_LS: {
+      struct ir_value *cz = ir_and(ir, cpsr, ir_alloc_i32(ir, C_MASK | Z_MASK));
+      struct ir_value *c = ir_alloc_i32(ir, C_MASK);
+      return cond == COND_HI ? ir_cmp_eq(ir, cz, c) : ir_cmp_ne(ir, cz, c);
+    }
+    case COND_GE:
+    case COND_LT:
+    case COND_GT:
+    case COND_LE: {
+      /* shift v up to n's position, n ^ v is set when they differ */
+      struct ir_value *nv = ir_xor(ir, cpsr, ir_shli(ir, cpsr, N_BIT - V_BIT));
+      nv = ir_and(ir, nv, ir_alloc_i32(ir, N_MASK));
+
+      if (cond == COND_GE) {
+        return ir_cmp_eq(ir, nv, zero);
+      } else if (cond == COND_LT) {
+        return ir_cmp_ne(ir, nv, zero);
+      }
+
+      struct ir_value *z = ir_and(ir, cpsr, ir_alloc_i32(ir, Z_MASK));
+      struct ir_value *znv = ir_or(ir, z, nv);
+      return cond == COND_GT ? ir_cmp_eq(ir, znv, zero)
+                             : ir_cmp_ne(ir, znv, zero);
+    }
+    default:
+      LOG_FATAL("armv3_translate_cond unexpected condition %u", cond);
+      return NULL;
+  }
+}
+
+/*
+ * barrel shifter
+ */
+static struct ir_value *shift_imm(struct ir *ir, struct ir_value *in,
+                                  enum armv3_shift_type type, uint32_t n,
+                                  struct ir_value **carry) {
+  /* a NULL carry out leaves the carry flag unmodified */
+  struct ir_value *out = in;
+  struct ir_value *c = NULL;
+  struct ir_value *one = ir_alloc_i32(ir, 1);
+
+  switch (type) {
+    case SHIFT_LSL:
+      if (n) {
+        out = ir_shli(ir, in, n);
+        c = ir_and(ir, ir_lshri(ir, in, 32 - n), one);
+      }
+      break;
+    case SHIFT_LSR:
+      out = n == 32 ? ir_alloc_i32(ir, 0) : ir_lshri(ir, in, n);
+      c = ir_and(ir, ir_lshri(ir, in, n - 1), one);
+      break;
+    case SHIFT_ASR:
+      out = ir_ashri(ir, in, MIN(n, 31));
+      c = ir_and(ir, ir_lshri(ir, in, n - 1), one);
+      break;
+    case SHIFT_ROR:
+      out = ir_or(ir, ir_lshri(ir, in, n), ir_shli(ir, in, 32 - n));
+      c = ir_lshri(ir, out, 31);
+      break;
+    case SHIFT_RRX:
+      out = ir_or(ir, ir_lshri(ir, in, 1), ir_shli(ir, load_carry(ir), 31));
+      c = ir_and(ir, in, one);
+      break;
+  }
+
+  if (carry) {
+    *carry = c;
+  }
+
+  return out;
+}
+
+static struct ir_value *parse_shift(struct ir *ir, uint32_t addr, uint32_t reg,
+                                    uint32_t shift, struct ir_value **carry) {
+  enum armv3_shift_source src;
+  enum armv3_shift_type type;
+  uint32_t n;
+  armv3_disasm_shift(shift, &src, &type, &n);
+
+  /* register specified shift amounts are left to the fallbacks */
+  CHECK_EQ(src, SHIFT_IMM);
+
+  struct ir_value *data = load_rn(ir, addr, reg);
+  return shift_imm(ir, data, type, n, carry);
+}
+
+static struct ir_value *parse_op2(struct ir *ir, uint32_t addr,
+                                  union armv3_instr i,
+                                  struct ir_value **carry) {
+  if (!i.data.i) {
+    /* op2 is a shifted register */
+    return parse_shift(ir, addr, i.data_reg.rm, i.data_reg.shift, carry);
+  }
+
+  /* op2 is an immediate, rotate it at compile time */
+  uint32_t imm = i.data_imm.imm;
+  uint32_t n = i.data_imm.rot << 1;
+
+  if (!n) {
+    *carry = NULL;
+    return ir_alloc_i32(ir, imm);
+  }
+
+  uint32_t value = (imm >> n) | (imm << (32 - n));
+  *carry = ir_alloc_i32(ir, value >> 31);
+  return ir_alloc_i32(ir, value);
+}
+
+/*
+ * branch and branch with link
+ */
+#define BRANCH_DEST() (addr + 8 + armv3_disasm_offset(i.branch.offset))
+
+TRANSLATE(B) {
+  uint32_t cond = i.raw >> 28;
+  struct ir_value *dst = ir_alloc_i32(ir, BRANCH_DEST());
+
+  /* unlike other instructions, the condition is translated directly into the
+     block's ending branch */
+  if (cond == COND_AL) {
+    ir_branch(ir, dst);
+  } else {
+    struct ir_value *taken = armv3_translate_cond(ir, cond);
+    ir_branch_cond(ir, taken, dst, ir_alloc_i32(ir, addr + 4));
+  }
+}
+
+TRANSLATE(BL) {
+  store_reg(ir, 14, ir_alloc_i32(ir, addr + 4));
+  ir_branch(ir, ir_alloc_i32(ir, BRANCH_DEST()));
+}
+
+/*
+ * data processing
+ */
+TRANSLATE(AND) {
+  struct ir_value *carry;
+  struct ir_value *lhs = load_rn(ir, addr, i.data.rn);
+  struct ir_value *rhs = parse_op2(ir, addr, i, &carry);
+  struct ir_value *res = ir_and(ir, lhs, rhs);
+
+  if (i.data.s) {
+    update_flags_logical(ir, live, res, carry);
+  }
+  store_rd(ir, i.data.rd, res);
+}
+
+TRANSLATE(EOR) {
+  struct ir_value *carry;
+  struct ir_value *lhs = load_rn(ir, addr, i.data.rn);
+  struct ir_value *rhs = parse_op2(ir, addr, i, &carry);
+  struct ir_value *res = ir_xor(ir, lhs, rhs);
+
+  if (i.data.s) {
+    update_flags_logical(ir, live, res, carry);
+  }
+  store_rd(ir, i.data.rd, res);
+}
+
+TRANSLATE(SUB) {
+  struct ir_value *carry;
+  struct ir_value *lhs = load_rn(ir, addr, i.data.rn);
+  struct ir_value *rhs = parse_op2(ir, addr, i, &carry);
+  struct ir_value *res = ir_sub(ir, lhs, rhs);
+
+  if (i.data.s) {
+    update_flags_sub(ir, live, lhs, rhs, res);
+  }
+  store_rd(ir, i.data.rd, res);
+}
+
+TRANSLATE(RSB) {
+  struct ir_value *carry;
+  struct ir_value *lhs = parse_op2(ir, addr, i, &carry);
+  struct ir_value *rhs = load_rn(ir, addr, i.data.rn);
+  struct ir_value *res = ir_sub(ir, lhs, rhs);
+
+  if (i.data.s) {
+    update_flags_sub(ir, live, lhs, rhs, res);
+  }
+  store_rd(ir, i.data.rd, res);
+}
+
+TRANSLATE(ADD) {
+  struct ir_value *carry;
+  struct ir_value *lhs = load_rn(ir, addr, i.data.rn);
+  struct ir_value *rhs = parse_op2(ir, addr, i, &carry);
+  struct ir_value *res = ir_add(ir, lhs, rhs);
+
+  if (i.data.s) {
+    update_flags_add(ir, live, lhs, rhs, res);
+  }
+  store_rd(ir, i.data.rd, res);
+}
+
+TRANSLATE(ADC) {
+  struct ir_value *carry;
+  struct ir_value *lhs = load_rn(ir, addr, i.data.rn);
+  struct ir_value *rhs = parse_op2(ir, addr, i, &carry);
+  struct ir_value *res = ir_add(ir, ir_add(ir, lhs, rhs), load_carry(ir));
+
+  if (i.data.s) {
+    update_flags_add(ir, live, lhs, rhs, res);
+  }
+  store_rd(ir, i.data.rd, res);
+}
+
+TRANSLATE(SBC) {
+  struct ir_value *carry;
+  struct ir_value *lhs = load_rn(ir, addr, i.data.rn);
+  struct ir_value *rhs = parse_op2(ir, addr, i, &carry);
+  struct ir_value *res = ir_sub(ir, lhs, rhs);
+  res = ir_sub(ir, ir_add(ir, res, load_carry(ir)), ir_alloc_i32(ir, 1));
+
+  if (i.data.s) {
+    update_flags_sub(ir, live, lhs, rhs, res);
+  }
+  store_rd(ir, i.data.rd, res);
+}
+
+TRANSLATE(RSC) {
+  struct ir_value *carry;
+  struct ir_value *lhs = parse_op2(ir, addr, i, &carry);
+  struct ir_value *rhs = load_rn(ir, addr, i.data.rn);
+  struct ir_value *res = ir_sub(ir, lhs, rhs);
+  res = ir_sub(ir, ir_add(ir, res, load_carry(ir)), ir_alloc_i32(ir, 1));
+
+  if (i.data.s) {
+    update_flags_sub(ir, live, lhs, rhs, res);
+  }
+  store_rd(ir, i.data.rd, res);
+}
+
+TRANSLATE(TST) {
+  struct ir_value *carry;
+  struct ir_value *lhs = load_rn(ir, addr, i.data.rn);
+  struct ir_value *rhs = parse_op2(ir, addr, i, &carry);
+  struct ir_value *res = ir_and(ir, lhs, rhs);
+
+  update_flags_logical(ir, live, res, carry);
+}
+
+TRANSLATE(TEQ) {
+  struct ir_value *carry;
+  struct ir_value *lhs = load_rn(ir, addr, i.data.rn);
+  struct ir_value *rhs = parse_op2(ir, addr, i, &carry);
+  struct ir_value *res = ir_xor(ir, lhs, rhs);
+
+  update_flags_logical(ir, live, res, carry);
+}
+
+TRANSLATE(CMP) {
+  struct ir_value *carry;
+  struct ir_value *lhs = load_rn(ir, addr, i.data.rn);
+  struct ir_value *rhs = parse_op2(ir, addr, i, &carry);
+  struct ir_value *res = ir_sub(ir, lhs, rhs);
+
+  update_flags_sub(ir, live, lhs, rhs, res);
+}
+
+TRANSLATE(CMN) {
+  struct ir_value *carry;
+  struct ir_value *lhs = load_rn(ir, addr, i.data.rn);
+  struct ir_value *rhs = parse_op2(ir, addr, i, &carry);
+  struct ir_value *res = ir_add(ir, lhs, rhs);
+
+  update_flags_add(ir, live, lhs, rhs, res);
+}
+
+TRANSLATE(ORR) {
+  struct ir_value *carry;
+  struct ir_value *lhs = load_rn(ir, addr, i.data.rn);
+  struct ir_value *rhs = parse_op2(ir, addr, i, &carry);
+  struct ir_value *res = ir_or(ir, lhs, rhs);
+
+  if (i.data.s) {
+    update_flags_logical(ir, live, res, carry);
+  }
+  store_rd(ir, i.data.rd, res);
+}
+
+TRANSLATE(MOV) {
+  struct ir_value *carry;
+  struct ir_value *res = parse_op2(ir, addr, i, &carry);
+
+  if (i.data.s) {
+    update_flags_logical(ir, live, res, carry);
+  }
+  store_rd(ir, i.data.rd, res);
+}
+
+TRANSLATE(BIC) {
+  struct ir_value *carry;
+  struct ir_value *lhs = load_rn(ir, addr, i.data.rn);
+  struct ir_value *rhs = parse_op2(ir, addr, i, &carry);
+  struct ir_value *res = ir_and(ir, lhs, ir_not(ir, rhs));
+
+  if (i.data.s) {
+    update_flags_logical(ir, live, res, carry);
+  }
+  store_rd(ir, i.data.rd, res);
+}
+
+TRANSLATE(MVN) {
+  struct ir_value *carry;
+  struct ir_value *rhs = parse_op2(ir, addr, i, &carry);
+  struct ir_value *res = ir_not(ir, rhs);
+
+  if (i.data.s) {
+    update_flags_logical(ir, live, res, carry);
+  }
+  store_rd(ir, i.data.rd, res);
+}
+
+/*
+ * multiply and multiply-accumulate
+ */
+TRANSLATE(MUL) {
+  struct ir_value *a = load_reg(ir, i.mul.rm);
+  struct ir_value *b = load_reg(ir, i.mul.rs);
+  struct ir_value *res = ir_smul(ir, a, b);
+
+  if (i.mul.s) {
+    update_flags_mul(ir, live, res);
+  }
+  store_reg(ir, i.mul.rd, res);
+}
+
+TRANSLATE(MLA) {
+  struct ir_value *a = load_reg(ir, i.mul.rm);
+  struct ir_value *b = load_reg(ir, i.mul.rs);
+  struct ir_value *c = load_reg(ir, i.mul.rn);
+  struct ir_value *res = ir_add(ir, ir_smul(ir, a, b), c);
+
+  if (i.mul.s) {
+    update_flags_mul(ir, live, res);
+  }
+  store_reg(ir, i.mul.rd, res);
+}
+
+/*
+ * single data transfer
+ */
+static void armv3_translate_memop(struct ir *ir, uint32_t addr,
+                                  union armv3_instr i) {
+  /* parse offset */
+  struct ir_value *offset = NULL;
+  if (i.xfr.i) {
+    offset = parse_shift(ir, addr, i.xfr_reg.rm, i.xfr_reg.shift, NULL);
+  } else {
+    offset = ir_alloc_i32(ir, i.xfr_imm.imm);
+  }
+
+  struct ir_value *base = load_rn(ir, addr, i.xfr.rn);
+  struct ir_value *final =
+      i.xfr.u ? ir_add(ir, base, offset) : ir_sub(ir, base, offset);
+  struct ir_value *ea = i.xfr.p ? final : base;
+
+  /*
+   * writeback is applied in pipeline before memory is read.
+   * note, post-increment mode always writes back
+   */
+  if (i.xfr.w || !i.xfr.p) {
+    store_reg(ir, i.xfr.rn, final);
+  }
+
+  if (i.xfr.l) {
+    struct ir_value *data = NULL;
+    if (i.xfr.b) {
+      data = ir_zext(ir, ir_load_guest(ir, ea, VALUE_I8), VALUE_I32);
+    } else {
+      data = ir_load_guest(ir, ea, VALUE_I32);
+    }
+
+    store_rd(ir, i.xfr.rd, data);
+  } else {
+    struct ir_value *data = load_rd(ir, addr, i.xfr.rd);
+    if (i.xfr.b) {
+      ir_store_guest(ir, ea, ir_trunc(ir, data, VALUE_I8));
+    } else {
+      ir_store_guest(ir, ea, data);
+    }
+  }
+}
+
+TRANSLATE(LDR) {
+  armv3_translate_memop(ir, addr, i);
+}
+
+TRANSLATE(STR) {
+  armv3_translate_memop(ir, addr, i);
+}
+
+/*
+ * block data transfer
+ */
+TRANSLATE(LDM) {
+  struct ir_value *base = load_reg(ir, i.blk.rn);
+  int offset = popcnt32(i.blk.rlist) * 4;
+  struct ir_value *final = i.blk.u
+                               ? ir_add(ir, base, ir_alloc_i32(ir, offset))
+                               : ir_sub(ir, base, ir_alloc_i32(ir, offset));
+  struct ir_value *pc = NULL;
+  int ea = 0;
+
+  /* writeback is applied in pipeline before memory is read */
+  if (i.blk.w) {
+    store_reg(ir, i.blk.rn, final);
+  }
+
+  for (int bit = 0; bit < 16; bit++) {
+    int reg = i.blk.u ? bit : 15 - bit;
+
+    if (!(i.blk.rlist & (1 << reg))) {
+      continue;
+    }
+
+    /* pre-increment */
+    if (i.blk.p) {
+      ea += i.blk.u ? 4 : -4;
+    }
+
+    struct ir_value *data =
+        ir_load_guest(ir, ir_add(ir, base, ir_alloc_i32(ir, ea)), VALUE_I32);
+
+    if (reg == 15) {
+      pc = data;
+    } else {
+      store_reg(ir, reg, data);
+    }
+
+    /* post-increment */
+    if (!i.blk.p) {
+      ea += i.blk.u ? 4 : -4;
+    }
+  }
+
+  if (pc) {
+    store_rd(ir, 15, pc);
+  }
+}
+
+TRANSLATE(STM) {
+  struct ir_value *base = load_reg(ir, i.blk.rn);
+  int offset = popcnt32(i.blk.rlist) * 4;
+  struct ir_value *final = i.blk.u
+                               ? ir_add(ir, base, ir_alloc_i32(ir, offset))
+                               : ir_sub(ir, base, ir_alloc_i32(ir, offset));
+  int wrote = 0;
+  int ea = 0;
+
+  for (int bit = 0; bit < 16; bit++) {
+    int reg = i.blk.u ? bit : 15 - bit;
+
+    if (!(i.blk.rlist & (1 << reg))) {
+      continue;
+    }
+
+    /* pre-increment */
+    if (i.blk.p) {
+      ea += i.blk.u ? 4 : -4;
+    }
+
+    struct ir_value *data = load_rd(ir, addr, reg);
+    ir_store_guest(ir, ir_add(ir, base, ir_alloc_i32(ir, ea)), data);
+
+    /* post-increment */
+    if (!i.blk.p) {
+      ea += i.blk.u ? 4 : -4;
+    }
+
+    /* see notes in armv3_fallback_STM regarding the writeback timing */
+    if (i.blk.w && !wrote) {
+      store_reg(ir, i.blk.rn, final);
+      wrote = 1;
+    }
+  }
+}
+
+/* psr transfers, swaps and software interrupts switch modes or are rare enough
+   to always fallback to the interpreter */
+static armv3_translate_cb armv3_translators[NUM_ARMV3_OPS] = {
+    [ARMV3_OP_B] = &armv3_translate_B,
+    [ARMV3_OP_BL] = &armv3_translate_BL,
+    [ARMV3_OP_AND] = &armv3_translate_AND,
+    [ARMV3_OP_EOR] = &armv3_translate_EOR,
+    [ARMV3_OP_SUB] = &armv3_translate_SUB,
+    [ARMV3_OP_RSB] = &armv3_translate_RSB,
+    [ARMV3_OP_ADD] = &armv3_translate_ADD,
+    [ARMV3_OP_ADC] = &armv3_translate_ADC,
+    [ARMV3_OP_SBC] = &armv3_translate_SBC,
+    [ARMV3_OP_RSC] = &armv3_translate_RSC,
+    [ARMV3_OP_TST] = &armv3_translate_TST,
+    [ARMV3_OP_TEQ] = &armv3_translate_TEQ,
+    [ARMV3_OP_CMP] = &armv3_translate_CMP,
+    [ARMV3_OP_CMN] = &armv3_translate_CMN,
+    [ARMV3_OP_ORR] = &armv3_translate_ORR,
+    [ARMV3_OP_MOV] = &armv3_translate_MOV,
+    [ARMV3_OP_BIC] = &armv3_translate_BIC,
+    [ARMV3_OP_MVN] = &armv3_translate_MVN,
+    [ARMV3_OP_MUL] = &armv3_translate_MUL,
+    [ARMV3_OP_MLA] = &armv3_translate_MLA,
+    [ARMV3_OP_LDR] = &armv3_translate_LDR,
+    [ARMV3_OP_STR] = &armv3_translate_STR,
+    [ARMV3_OP_LDM] = &armv3_translate_LDM,
+    [ARMV3_OP_STM] = &armv3_translate_STM,
+};
+
+static int armv3_is_logical_op(int op) {
+  switch (op) {
+    case ARMV3_OP_AND:
+    case ARMV3_OP_EOR:
+    case ARMV3_OP_TST:
+    case ARMV3_OP_TEQ:
+    case ARMV3_OP_ORR:
+    case ARMV3_OP_MOV:
+    case ARMV3_OP_BIC:
+    case ARMV3_OP_MVN:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+static enum armv3_shift_type armv3_shift_type(uint32_t shift, uint32_t *n) {
+  enum armv3_shift_source src;
+  enum armv3_shift_type type;
+  armv3_disasm_shift(shift, &src, &type, n);
+  return type;
+}
+
+static uint32_t armv3_cond_flags(uint32_t cond) {
+  static const uint32_t cond_flags[] = {
+      Z_MASK,                   /* EQ */
+      Z_MASK,                   /* NE */
+      C_MASK,                   /* CS */
+      C_MASK,                   /* CC */
+      N_MASK,                   /* MI */
+      N_MASK,                   /* PL */
+      V_MASK,                   /* VS */
+      V_MASK,                   /* VC */
+      C_MASK | Z_MASK,          /* HI */
+      C_MASK | Z_MASK,          /* LS */
+      N_MASK | V_MASK,          /* GE */
+      N_MASK | V_MASK,          /* LT */
+      N_MASK | Z_MASK | V_MASK, /* GT */
+      N_MASK | Z_MASK | V_MASK, /* LE */
+      0,                        /* AL */
+      0,                        /* NV */
+  };
+  return cond_flags[cond];
+}
+
+void armv3_get_flag_usage(uint32_t instr, uint32_t *use, uint32_t *def) {
+  union armv3_instr i = {instr};
+  int op = armv3_get_op(instr);
+  struct jit_opdef *opdef = &armv3_opdefs[op];
+  uint32_t cond = i.raw >> 28;
+
+  *use = 0;
+  *def = 0;
+
+  /* fallbacks may read or write any of the flags */
+  if (!armv3_get_translator(instr)) {
+    *use = NZCV_MASK;
+    return;
+  }
+
+  *use |= armv3_cond_flags(cond);
+
+  if (opdef->flags & FLAG_DATA) {
+    int carry_out = 0;
+
+    if (i.data.i) {
+      carry_out = i.data_imm.rot != 0;
+    } else {
+      uint32_t n;
+      enum armv3_shift_type type = armv3_shift_type(i.data_reg.shift, &n);
+      carry_out = type != SHIFT_LSL || n != 0;
+
+      if (type == SHIFT_RRX) {
+        *use |= C_MASK;
+      }
+    }
+
+    if (op == ARMV3_OP_ADC || op == ARMV3_OP_SBC || op == ARMV3_OP_RSC) {
+      *use |= C_MASK;
+    }
+
+    if (i.data.s) {
+      if (armv3_is_logical_op(op)) {
+        *def = N_MASK | Z_MASK | V_MASK | (carry_out ? C_MASK : 0);
+      } else {
+        *def = NZCV_MASK;
+      }
+    }
+  } else if (opdef->flags & FLAG_MUL) {
+    if (i.mul.s) {
+      *def = N_MASK | Z_MASK;
+    }
+  } else if (opdef->flags & FLAG_XFR) {
+    uint32_t n;
+    if (i.xfr.i && armv3_shift_type(i.xfr_reg.shift, &n) == SHIFT_RRX) {
+      *use |= C_MASK;
+    }
+  }
+
+  /* the instruction may not execute, leaving the previous flags intact */
+  if (cond != COND_AL) {
+    *def = 0;
+  }
+}
+
+armv3_translate_cb armv3_get_translator(uint32_t instr) {
+  union armv3_instr i = {instr};
+  int op = armv3_get_op(instr);
+  struct jit_opdef *def = &armv3_opdefs[op];
+
+  /* let the fallback skip over instructions which never execute */
+  if ((i.raw >> 28) == COND_NV) {
+    return NULL;
+  }
+
+  if (def->flags & FLAG_DATA) {
+    /* register specified shift amounts aren't translated */
+    if (!i.data.i && (i.data_reg.shift & 0x1)) {
+      return NULL;
+    }
+
+    /* writing the pc with the s bit set restores the cpsr from the spsr,
+       switching modes */
+    if (i.data.s && i.data.rd == 15) {
+      return NULL;
+    }
+  } else if (def->flags & FLAG_MUL) {
+    if (i.mul.rd == 15) {
+      return NULL;
+    }
+  } else if (def->flags & FLAG_XFR) {
+    if (i.xfr.i && (i.xfr_reg.shift & 0x1)) {
+      return NULL;
+    }
+
+    if ((i.xfr.w || !i.xfr.p) && i.xfr.rn == 15) {
+      return NULL;
+    }
+  } else if (def->flags & FLAG_BLK) {
+    /* user bank transfers and mode restores are left to the fallbacks */
+    if (i.blk.s || i.blk.rn == 15 || !i.blk.rlist) {
+      return NULL;
+    }
+  }
+
+  return armv3_translators[op];
+}
@@ -0,0 +1,21 @@
+#ifndef ARMV3_TRANSLATE_H
+#define ARMV3_TRANSLATE_H
+
+#include "jit/frontend/armv3/armv3_disasm.h"
+
+struct armv3_guest;
+struct ir;
+struct ir_value;
+
+typedef void (*armv3_translate_cb)(struct armv3_guest *, struct ir *, uint32_t,
+                                   union armv3_instr, uint32_t);
+
+/* returns NULL if the instruction must fallback to the interpreter */
+armv3_translate_cb armv3_get_translator(uint32_t instr);
+
+/* returns the cpsr flags read / unconditionally written by the instruction */
+void armv3_get_flag_usage(uint32_t instr, uint32_t *use, uint32_t *def);
+
+struct ir_value *armv3_translate_cond(struct ir *ir, uint32_t cond);
+
+#endif
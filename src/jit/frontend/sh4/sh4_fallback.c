@@ -60,7 +60,7 @@ typedef int32_t int128_t[4];
 
 #define DELAY_INSTR()                {                                                                   \
                                        uint32_t delay_addr = addr + 2;                                   \
-                                       uint16_t delay_data = guest->r16(guest->mem, delay_addr);       \
+                                       uint16_t delay_data = sh4_guest_read_code(guest, delay_addr);     \
                                        const struct jit_opdef *def = sh4_get_opdef(delay_data);          \
                                        def->fallback((struct jit_guest *)guest, delay_addr, delay_data); \
                                      }
@@ -161,19 +161,21 @@ typedef int32_t int128_t[4];
 #define STORE_SSR_I32(v)             (CTX->ssr = v)
 #define STORE_SSR_IMM_I32(v)         STORE_SSR_I32(v)
 
-#define LOAD_I8(addr)                guest->r8(guest->mem, addr)
-#define LOAD_I16(addr)               guest->r16(guest->mem, addr)
-#define LOAD_I32(addr)               guest->r32(guest->mem, addr)
-#define LOAD_I64(addr)               guest->r64(guest->mem, addr)
+#define LOAD_I8(addr)                guest->r8(guest->mem, sh4_guest_translate(guest, addr))
+#define LOAD_I16(addr)               guest->r16(guest->mem, sh4_guest_translate(guest, addr))
+#define LOAD_I32(addr)               guest->r32(guest->mem, sh4_guest_translate(guest, addr))
+#define LOAD_I64(addr)               guest->r64(guest->mem, sh4_guest_translate(guest, addr))
 #define LOAD_IMM_I8(addr)            LOAD_I8(addr)
 #define LOAD_IMM_I16(addr)           LOAD_I16(addr)
 #define LOAD_IMM_I32(addr)           LOAD_I32(addr)
 #define LOAD_IMM_I64(addr)           LOAD_I64(addr)
+#define LOAD_LITERAL_I16(addr)       LOAD_I16(addr)
+#define LOAD_LITERAL_I32(addr)       LOAD_I32(addr)
 
-#define STORE_I8(addr, v)            guest->w8(guest->mem, addr, v)
-#define STORE_I16(addr, v)           guest->w16(guest->mem, addr, v)
-#define STORE_I32(addr, v)           guest->w32(guest->mem, addr, v)
-#define STORE_I64(addr, v)           guest->w64(guest->mem, addr, v)
+#define STORE_I8(addr, v)            guest->w8(guest->mem, sh4_guest_translate(guest, addr), v)
+#define STORE_I16(addr, v)           guest->w16(guest->mem, sh4_guest_translate(guest, addr), v)
+#define STORE_I32(addr, v)           guest->w32(guest->mem, sh4_guest_translate(guest, addr), v)
+#define STORE_I64(addr, v)           guest->w64(guest->mem, sh4_guest_translate(guest, addr), v)
 
 #define LOAD_HOST_F32(addr)          (*(float *)(uintptr_t)addr)
 #define LOAD_HOST_F64(addr)          (*(double *)(uintptr_t)addr)
@@ -300,6 +302,7 @@ typedef int32_t int128_t[4];
 #define FRSQRT_F32(a)                (1.0f / sqrtf(a))
 
 #define VBROADCAST_F32(a)            {*(int32_t *)&(a), *(int32_t *)&(a), *(int32_t *)&(a), *(int32_t *)&(a)}
+#define VSPLAT_F32(a, lane)          {(a)[lane], (a)[lane], (a)[lane], (a)[lane]}
 #define VADD_F32(a, b)               {vadd_f32_el((a)[0], (b)[0]), \
                                       vadd_f32_el((a)[1], (b)[1]), \
                                       vadd_f32_el((a)[2], (b)[2]), \
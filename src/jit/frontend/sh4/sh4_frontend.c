@@ -19,9 +19,36 @@ struct sh4_frontend {
   struct jit_frontend;
 };
 
-static const struct jit_opdef *sh4_frontend_lookup_op(struct jit_frontend *base,
-                                                      const void *instr) {
-  return sh4_get_opdef(*(const uint16_t *)instr);
+static void sh4_frontend_trap(struct jit_guest *base, uint32_t addr,
+                              uint32_t data) {
+  struct sh4_guest *guest = (struct sh4_guest *)base;
+  struct sh4_context *ctx = (struct sh4_context *)guest->ctx;
+
+  /* same as the trap translate_code emits, leave it to dispatch to resume at
+     the breakpoint's address */
+  ctx->pc = addr;
+  guest->trap(guest->data);
+}
+
+/* fetched in place of an instruction with a breakpoint, for code which is
+   run without being translated */
+static struct jit_opdef sh4_trap_def = {
+    0, "trap", NULL, NULL, 0, 0, &sh4_frontend_trap,
+};
+
+static const struct jit_opdef *sh4_frontend_fetch_op(struct jit_frontend *base,
+                                                     uint32_t addr,
+                                                     uint32_t *data) {
+  struct sh4_guest *guest = (struct sh4_guest *)base->guest;
+
+  if (sh4_guest_breakpoint(guest, addr)) {
+    *data = 0;
+    return &sh4_trap_def;
+  }
+
+  *data = sh4_guest_read_code(guest, addr);
+
+  return sh4_get_opdef(*data);
 }
 
 static int sh4_frontend_is_terminator(struct jit_opdef *def) {
@@ -30,14 +57,223 @@ static int sh4_frontend_is_terminator(struct jit_opdef *def) {
     return 1;
   }
 
-  /* if fpscr changed, stop as the compile-time assumptions may be invalid */
-  if (def->flags & SH4_FLAG_STORE_FPSCR) {
+  /* if fpscr changed, stop as the compile-time assumptions may be invalid.
+     fschg and frchg are the exception, their effect on the fpscr is known at
+     compile time, so translation continues with the updated state */
+  if ((def->flags & SH4_FLAG_STORE_FPSCR) && def->op != SH4_OP_FSCHG &&
+      def->op != SH4_OP_FRCHG) {
     return 1;
   }
 
   return 0;
 }
 
+static int sh4_frontend_uses_fpscr(struct sh4_frontend *frontend,
+                                   uint32_t begin_addr, int size) {
+  struct sh4_guest *guest = (struct sh4_guest *)frontend->guest;
+
+  /* conservatively check every instruction in the block's extents, including
+     any skipped over by a trace */
+  for (int offset = 0; offset < size; offset += 2) {
+    uint16_t data = sh4_guest_read_code(guest, begin_addr + offset);
+    struct jit_opdef *def = sh4_get_opdef(data);
+
+    if ((def->flags & SH4_FLAG_USE_FPSCR) == SH4_FLAG_USE_FPSCR) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static int sh4_frontend_uses_mode(struct jit_frontend *base,
+                                  uint32_t begin_addr, int size) {
+  struct sh4_frontend *frontend = (struct sh4_frontend *)base;
+  return sh4_frontend_uses_fpscr(frontend, begin_addr, size);
+}
+
+static uint32_t sh4_frontend_current_mode(struct jit_frontend *base) {
+  struct sh4_frontend *frontend = (struct sh4_frontend *)base;
+  struct sh4_guest *guest = (struct sh4_guest *)frontend->guest;
+  struct sh4_context *ctx = (struct sh4_context *)guest->ctx;
+
+  /* the fpscr bits translation is specialized for */
+  return ctx->fpscr & (PR_MASK | SZ_MASK);
+}
+
+/* maximum span of guest code covered by a single trace */
+#define SH4_MAX_TRACE_SIZE 256
+
+static int sh4_frontend_continue_trace(struct sh4_frontend *frontend,
+                                       uint32_t begin_addr, uint32_t addr,
+                                       uint32_t end_addr, uint32_t *next_addr) {
+  struct sh4_guest *guest = (struct sh4_guest *)frontend->guest;
+  uint16_t data = sh4_guest_read_code(guest, addr);
+  union sh4_instr instr = {data};
+  struct jit_opdef *def = sh4_get_opdef(data);
+
+  /* if fpscr changed, the compile-time assumptions may be invalid */
+  if (!(def->flags & SH4_FLAG_STORE_PC)) {
+    return 0;
+  }
+
+  /* the branch needs to be translated to an ir branch for the trace to be
+     linked together, fallbacks write the pc directly */
+  if (!sh4_get_translator(data)) {
+    return 0;
+  }
+
+  int branch_type;
+  uint32_t branch_addr;
+  uint32_t fall_addr;
+  sh4_branch_info(addr, instr, &branch_type, &branch_addr, &fall_addr);
+
+  uint32_t target;
+
+  if (branch_type == SH4_BRANCH_STATIC_TRUE ||
+      branch_type == SH4_BRANCH_STATIC_FALSE) {
+    /* follow the fall-through path of conditional branches, leaving the taken
+       path as a side exit */
+    target = fall_addr;
+  } else if (branch_type == SH4_BRANCH_STATIC) {
+    /* follow unconditional branches as long as they skip forward, keeping the
+       trace's guest code contiguous */
+    target = branch_addr;
+
+    if (target < end_addr) {
+      return 0;
+    }
+  } else {
+    return 0;
+  }
+
+  if (target - begin_addr >= SH4_MAX_TRACE_SIZE) {
+    return 0;
+  }
+
+  *next_addr = target;
+
+  return 1;
+}
+
+static void sh4_frontend_link_trace(struct sh4_frontend *frontend,
+                                    struct ir *ir, int link_tail) {
+  struct ir_block *tail = list_last_entry(&ir->blocks, struct ir_block, it);
+
+  /* replace branches to guest addresses inside of the trace with branches
+     directly to the ir block */
+  list_for_each_entry(block, &ir->blocks, struct ir_block, it) {
+    /* the tail block may have been translated for a different sz mode than
+       the rest of the trace, in which case it can't branch back into it */
+    if (block == tail && !link_tail) {
+      continue;
+    }
+
+    struct ir_instr *last_instr =
+        list_last_entry(&block->instrs, struct ir_instr, it);
+
+    int num_targets = 0;
+
+    if (last_instr->op == OP_BRANCH) {
+      num_targets = 1;
+    } else if (last_instr->op == OP_BRANCH_COND) {
+      num_targets = 2;
+    }
+
+    for (int i = 0; i < num_targets; i++) {
+      struct ir_value *target = last_instr->arg[i];
+
+      if (!ir_is_constant(target) || target->type != VALUE_I32) {
+        continue;
+      }
+
+      list_for_each_entry(dst, &ir->blocks, struct ir_block, it) {
+        struct ir_value *addr = ir_get_meta(ir, dst, IR_META_ADDR);
+
+        if (addr && addr->i32 == target->i32) {
+          ir_set_arg(ir, last_instr, i, ir_alloc_block_ref(ir, dst));
+          break;
+        }
+      }
+    }
+  }
+}
+
+/* a block which branches back to its own beginning is compiled as a loop,
+   branching straight back to the top of its body instead of exiting through
+   dispatch on each iteration. the body is entered through a preheader block,
+   which loop invariant code is hoisted into, and as the body is branched back
+   to, the backend checks the cycle budget and interrupts on each iteration */
+static void sh4_frontend_link_loop(struct sh4_frontend *frontend,
+                                   struct ir *ir, uint32_t begin_addr,
+                                   struct ir_block *guard) {
+  struct ir_block *body = list_last_entry(&ir->blocks, struct ir_block, it);
+  struct ir_instr *last_instr =
+      list_last_entry(&body->instrs, struct ir_instr, it);
+
+  int num_targets = 0;
+
+  if (last_instr->op == OP_BRANCH) {
+    num_targets = 1;
+  } else if (last_instr->op == OP_BRANCH_COND) {
+    num_targets = 2;
+  }
+
+  int loops = 0;
+
+  for (int i = 0; i < num_targets; i++) {
+    struct ir_value *target = last_instr->arg[i];
+    loops |= ir_is_constant(target) && target->type == VALUE_I32 &&
+             (uint32_t)target->i32 == begin_addr;
+  }
+
+  if (!loops) {
+    return;
+  }
+
+  struct ir_block *preheader = guard;
+
+  if (guard) {
+    /* the fpscr guard is only checked on entry to the loop, it can only be
+       bypassed by the back edge if nothing in the body can change the fpscr */
+    int fpscr = (int)offsetof(struct sh4_context, fpscr);
+
+    list_for_each_entry(instr, &body->instrs, struct ir_instr, it) {
+      if (instr->op == OP_FALLBACK || instr->op == OP_CALL ||
+          instr->op == OP_CALL_COND) {
+        return;
+      }
+
+      if (instr->op == OP_STORE_CONTEXT && instr->arg[0]->i32 == fpscr) {
+        return;
+      }
+    }
+
+    /* move the guest marker for the first instruction into the body, so its
+       cycles are counted on each iteration */
+    struct ir_instr *marker =
+        list_first_entry(&guard->instrs, struct ir_instr, it);
+    struct ir_insert_point point = {body, NULL};
+    ir_move_instr(ir, marker, &point);
+  } else {
+    preheader = ir_insert_block(ir, NULL);
+    ir_set_meta(ir, preheader, IR_META_ADDR, ir_alloc_i32(ir, begin_addr));
+    ir_set_current_block(ir, preheader);
+    ir_branch(ir, ir_alloc_block_ref(ir, body));
+  }
+
+  for (int i = 0; i < num_targets; i++) {
+    struct ir_value *target = last_instr->arg[i];
+
+    if (ir_is_constant(target) && target->type == VALUE_I32 &&
+        (uint32_t)target->i32 == begin_addr) {
+      ir_set_arg(ir, last_instr, i, ir_alloc_block_ref(ir, body));
+    }
+  }
+
+  CHECK_EQ(ir_get_loop_preheader(ir, body), preheader);
+}
+
 static int sh4_frontend_is_idle_loop(struct sh4_frontend *frontend,
                                      uint32_t begin_addr) {
   struct sh4_guest *guest = (struct sh4_guest *)frontend->guest;
@@ -50,15 +286,20 @@ static int sh4_frontend_is_idle_loop(struct sh4_frontend *frontend,
 
   while (1) {
     uint32_t addr = begin_addr + offset;
-    uint16_t data = guest->r16(guest->mem, addr);
+    uint16_t data = sh4_guest_read_code(guest, addr);
     struct jit_opdef *def = sh4_get_opdef(data);
 
+    /* the loop is split up by the breakpoint */
+    if (sh4_guest_breakpoint(guest, addr)) {
+      return 0;
+    }
+
     offset += 2;
     all_flags |= def->flags;
 
     if (def->flags & SH4_FLAG_DELAYED) {
       uint32_t delay_addr = begin_addr + offset;
-      uint16_t delay_data = guest->r16(guest->mem, delay_addr);
+      uint16_t delay_data = sh4_guest_read_code(guest, delay_addr);
       struct jit_opdef *delay_def = sh4_get_opdef(delay_data);
 
       offset += 2;
@@ -88,11 +329,51 @@ static int sh4_frontend_is_idle_loop(struct sh4_frontend *frontend,
   return idle_loop;
 }
 
+/* idle loops just spin, waiting for an interrupt such as vblank before they'll
+   exit. rather than burning through the rest of the time slice iteration by
+   iteration, exhaust the remaining cycles whenever the loop branches back to
+   itself. the next block prolog then exits straight to the scheduler, which
+   fast-forwards to the next timer expiry where the interrupt is raised */
+static void sh4_frontend_emit_idle_skip(struct sh4_frontend *frontend,
+                                        struct ir *ir, uint32_t begin_addr) {
+  struct ir_block *block = list_first_entry(&ir->blocks, struct ir_block, it);
+  struct ir_instr *branch =
+      list_last_entry(&block->instrs, struct ir_instr, it);
+  struct ir_instr *prev = list_prev_entry(branch, struct ir_instr, it);
+  int offset = (int)offsetof(struct sh4_context, run_cycles);
+
+  ir_set_current_instr(ir, prev);
+
+  if (branch->op == OP_BRANCH) {
+    struct ir_value *dst = branch->arg[0];
+
+    if (ir_is_constant(dst) && (uint32_t)dst->i32 == begin_addr) {
+      ir_store_context(ir, offset, ir_alloc_i32(ir, -1));
+    }
+  } else if (branch->op == OP_BRANCH_COND) {
+    struct ir_value *t = branch->arg[0];
+    struct ir_value *f = branch->arg[1];
+    struct ir_value *cond = branch->arg[2];
+    int loops_t = ir_is_constant(t) && (uint32_t)t->i32 == begin_addr;
+    int loops_f = ir_is_constant(f) && (uint32_t)f->i32 == begin_addr;
+
+    if (loops_t || loops_f) {
+      struct ir_value *cycles = ir_load_context(ir, offset, VALUE_I32);
+      struct ir_value *skip = ir_alloc_i32(ir, -1);
+      cycles = loops_t ? ir_select(ir, cond, skip, cycles)
+                       : ir_select(ir, cond, cycles, skip);
+      ir_store_context(ir, offset, cycles);
+    }
+  }
+
+  ir_set_current_instr(ir, branch);
+}
+
 static void sh4_frontend_dump_code(struct jit_frontend *base,
                                    uint32_t begin_addr, int size,
                                    FILE *output) {
   struct sh4_frontend *frontend = (struct sh4_frontend *)base;
-  struct jit_guest *guest = frontend->guest;
+  struct sh4_guest *guest = (struct sh4_guest *)frontend->guest;
 
   int offset = 0;
   char buffer[128];
@@ -103,7 +384,7 @@ static void sh4_frontend_dump_code(struct jit_frontend *base,
 
   while (offset < size) {
     uint32_t addr = begin_addr + offset;
-    uint16_t data = guest->r16(guest->mem, addr);
+    uint16_t data = sh4_guest_read_code(guest, addr);
     union sh4_instr instr = {data};
     struct jit_opdef *def = sh4_get_opdef(data);
 
@@ -114,7 +395,7 @@ static void sh4_frontend_dump_code(struct jit_frontend *base,
 
     if (def->flags & SH4_FLAG_DELAYED) {
       uint32_t delay_addr = begin_addr + offset;
-      uint16_t delay_data = guest->r16(guest->mem, delay_addr);
+      uint16_t delay_data = sh4_guest_read_code(guest, delay_addr);
       union sh4_instr delay_instr = {delay_data};
 
       sh4_format(delay_addr, delay_instr, buffer, sizeof(buffer));
@@ -133,11 +414,13 @@ static void sh4_frontend_translate_code(struct jit_frontend *base,
   struct sh4_context *ctx = (struct sh4_context *)guest->ctx;
 
   int offset = 0;
-  int use_fpscr = 0;
   int was_delay = 0;
+  int toggled_sz = 0;
 
   /* append inital block */
   struct ir_block *block = ir_append_block(ir);
+  ir_set_meta(ir, block, IR_META_ADDR, ir_alloc_i32(ir, begin_addr));
+  int num_blocks = 1;
 
   /* generate code specialized for the current fpscr state */
   int flags = 0;
@@ -148,12 +431,8 @@ static void sh4_frontend_translate_code(struct jit_frontend *base,
     flags |= SH4_DOUBLE_SZ;
   }
 
-  /* cheap idle skip. in an idle loop, the block is just spinning, waiting for
-     an interrupt such as vblank before it'll exit. scale the block's number of
-     cycles in order to yield execution faster, enabling the interrupt to
-     actually be generated */
+  /* skip idle loops ahead to the next scheduler event */
   int idle_loop = sh4_frontend_is_idle_loop(frontend, begin_addr);
-  int cycle_scale = idle_loop ? 8 : 1;
 
   while (offset < size) {
     /* if a branch instruction / delay slot was just emitted, rewind and emit
@@ -164,16 +443,28 @@ static void sh4_frontend_translate_code(struct jit_frontend *base,
     }
 
     uint32_t addr = begin_addr + offset;
-    uint16_t data = guest->r16(guest->mem, addr);
+    uint16_t data = sh4_guest_read_code(guest, addr);
     union sh4_instr instr = {data};
     struct jit_opdef *def = sh4_get_opdef(data);
 
-    use_fpscr |= (def->flags & SH4_FLAG_USE_FPSCR) == SH4_FLAG_USE_FPSCR;
+    /* analysis ends blocks before any breakpoint, so one is only ever hit as
+       the first instruction. call the trap in place of the instruction, and
+       leave it to dispatch to resume at the breakpoint's address */
+    if (sh4_guest_breakpoint(guest, addr)) {
+      ir_source_info(ir, addr, 0);
+      ir_store_context(ir, offsetof(struct sh4_context, pc),
+                       ir_alloc_i32(ir, addr));
+
+      struct ir_value *trap = ir_alloc_i64(ir, (uint64_t)guest->trap);
+      struct ir_value *trap_data = ir_alloc_i64(ir, (uint64_t)guest->data);
+      ir_call_1(ir, trap, trap_data);
+      break;
+    }
 
     /* emit meta information for the current guest instruction. this info is
        essential to the jit, and is used to map guest instructions to host
        addresses for branching and fastmem access */
-    ir_source_info(ir, addr, def->cycles * cycle_scale);
+    ir_source_info(ir, addr, def->cycles);
 
     /* the pc is normally only written to the context at the end of the block,
        sync now for any instruction which needs to read the correct pc */
@@ -193,15 +484,18 @@ static void sh4_frontend_translate_code(struct jit_frontend *base,
 
       offset += 2;
 
+      /* translate the remainder of the block for the new transfer size */
+      if (def->op == SH4_OP_FSCHG) {
+        flags ^= SH4_DOUBLE_SZ;
+        toggled_sz = 1;
+      }
+
       if (def->flags & SH4_FLAG_DELAYED) {
         uint32_t delay_addr = begin_addr + offset;
-        uint32_t delay_data = guest->r16(guest->mem, delay_addr);
+        uint32_t delay_data = sh4_guest_read_code(guest, delay_addr);
         union sh4_instr delay_instr = {delay_data};
         struct jit_opdef *delay_def = sh4_get_opdef(delay_data);
 
-        use_fpscr |=
-            (delay_def->flags & SH4_FLAG_USE_FPSCR) == SH4_FLAG_USE_FPSCR;
-
         /* move insert point back to the middle of the preceding instruction */
         struct ir_insert_point original = ir_get_insert_point(ir);
         ir_set_insert_point(ir, &delay_point);
@@ -220,6 +514,11 @@ static void sh4_frontend_translate_code(struct jit_frontend *base,
           ir_fallback(ir, delay_def->fallback, delay_addr, delay_data);
         }
 
+        if (delay_def->op == SH4_OP_FSCHG) {
+          flags ^= SH4_DOUBLE_SZ;
+          toggled_sz = 1;
+        }
+
         /* restore insert point */
         ir_set_insert_point(ir, &original);
 
@@ -253,6 +552,28 @@ static void sh4_frontend_translate_code(struct jit_frontend *base,
     int store_pc = (def->flags & SH4_FLAG_STORE_PC) == SH4_FLAG_STORE_PC;
     int end_of_block = sh4_frontend_is_terminator(def) || offset >= size;
 
+    /* only the initial basic block can be an idle loop */
+    if (end_of_block && store_pc && idle_loop && num_blocks == 1) {
+      sh4_frontend_emit_idle_skip(frontend, ir, begin_addr);
+    }
+
+    /* if the analysis continued the trace past this instruction, start a new
+       ir block for the code being followed */
+    if (end_of_block && offset < size) {
+      uint32_t next_addr;
+      int res = sh4_frontend_continue_trace(frontend, begin_addr, addr,
+                                            begin_addr + offset, &next_addr);
+      CHECK(res);
+
+      offset = next_addr - begin_addr;
+      was_delay = 0;
+
+      struct ir_block *next_block = ir_append_block(ir);
+      ir_set_meta(ir, next_block, IR_META_ADDR, ir_alloc_i32(ir, next_addr));
+      num_blocks++;
+      continue;
+    }
+
     if (end_of_block) {
       if (!store_pc) {
         struct ir_block *tail_block =
@@ -267,10 +588,19 @@ static void sh4_frontend_translate_code(struct jit_frontend *base,
     }
   }
 
-  /* if the block makes optimizations based on the fpscr state, assert that the
-     run-time fpscr state matches the compile-time state */
-  if (use_fpscr) {
-    /* insert after the first guest marker */
+  if (num_blocks > 1) {
+    sh4_frontend_link_trace(frontend, ir, !toggled_sz);
+  }
+
+  /* if the block makes optimizations based on the fpscr state, guard that the
+     run-time fpscr state matches the compile-time state. the jit compiles a
+     variant of the block for each fpscr state it's run in, and on mismatch
+     the guard branches back to the block's own address, which dispatch
+     resolves to the variant for the current state */
+  struct ir_block *guard = NULL;
+
+  if (sh4_frontend_uses_fpscr(frontend, begin_addr, size)) {
+    /* split the block after the first guest marker */
     struct ir_instr *after = NULL;
     list_for_each_entry(instr, &block->instrs, struct ir_instr, it) {
       if (instr->op == OP_SOURCE_INFO) {
@@ -278,6 +608,11 @@ static void sh4_frontend_translate_code(struct jit_frontend *base,
         break;
       }
     }
+
+    struct ir_instr *before = list_next_entry(after, struct ir_instr, it);
+    struct ir_block *body = ir_split_block(ir, before);
+    ir_set_meta(ir, body, IR_META_ADDR, ir_alloc_i32(ir, begin_addr));
+
     ir_set_current_instr(ir, after);
 
     struct ir_value *actual =
@@ -285,41 +620,178 @@ static void sh4_frontend_translate_code(struct jit_frontend *base,
     actual = ir_and(ir, actual, ir_alloc_i32(ir, PR_MASK | SZ_MASK));
     struct ir_value *expected =
         ir_alloc_i32(ir, ctx->fpscr & (PR_MASK | SZ_MASK));
-    ir_assert_eq(ir, actual, expected);
+    struct ir_value *match = ir_cmp_eq(ir, actual, expected);
+    ir_branch_cond(ir, match, ir_alloc_block_ref(ir, body),
+                   ir_alloc_i32(ir, begin_addr));
+
+    guard = block;
+  }
+
+  /* idle loops exhaust the time slice on each iteration, there's nothing to
+     gain from looping inside of the ir */
+  if (num_blocks == 1 && !idle_loop && !toggled_sz) {
+    sh4_frontend_link_loop(frontend, ir, begin_addr, guard);
   }
 }
 
 static void sh4_frontend_analyze_code(struct jit_frontend *base,
-                                      uint32_t begin_addr, int *size) {
+                                      uint32_t begin_addr, int flags,
+                                      int *size) {
   struct sh4_frontend *frontend = (struct sh4_frontend *)base;
   struct sh4_guest *guest = (struct sh4_guest *)frontend->guest;
 
   *size = 0;
 
+  /* once the transfer size has been toggled, the code after it is translated
+     for a different mode than the code before it, and the trace must end */
+  int toggled_sz = 0;
+
   while (1) {
     uint32_t addr = begin_addr + *size;
-    uint16_t data = guest->r16(guest->mem, addr);
+    uint16_t data = sh4_guest_read_code(guest, addr);
     struct jit_opdef *def = sh4_get_opdef(data);
 
+    /* end the block before any breakpoint, such that it begins its own block
+       consisting of only the trap. breakpoints in delay slots aren't hit */
+    if (sh4_guest_breakpoint(guest, addr)) {
+      if (!*size) {
+        *size = 2;
+      }
+      break;
+    }
+
     *size += 2;
+    toggled_sz |= def->op == SH4_OP_FSCHG;
 
     if (def->flags & SH4_FLAG_DELAYED) {
       uint32_t delay_addr = begin_addr + *size;
-      uint16_t delay_data = guest->r16(guest->mem, delay_addr);
+      uint16_t delay_data = sh4_guest_read_code(guest, delay_addr);
       struct jit_opdef *delay_def = sh4_get_opdef(delay_data);
 
       *size += 2;
+      toggled_sz |= delay_def->op == SH4_OP_FSCHG;
 
       /* delay slots can't have another delay slot */
       CHECK(!(delay_def->flags & SH4_FLAG_DELAYED));
     }
 
     if (sh4_frontend_is_terminator(def)) {
+      uint32_t next_addr;
+
+      if ((flags & JIT_ANALYZE_TRACE) && !toggled_sz &&
+          sh4_frontend_continue_trace(frontend, begin_addr, addr,
+                                      begin_addr + *size, &next_addr) &&
+          !sh4_guest_breakpoint(guest, next_addr)) {
+        *size = next_addr - begin_addr;
+        continue;
+      }
+
       break;
     }
   }
 }
 
+static int sh4_frontend_branch_targets(struct jit_frontend *base,
+                                       uint32_t begin_addr, int size,
+                                       uint32_t *targets) {
+  struct sh4_frontend *frontend = (struct sh4_frontend *)base;
+  struct sh4_guest *guest = (struct sh4_guest *)frontend->guest;
+  uint32_t end_addr = begin_addr + size;
+
+  /* find the instruction ending the code */
+  uint32_t addr = begin_addr;
+  uint16_t data;
+  struct jit_opdef *def;
+
+  while (1) {
+    data = sh4_guest_read_code(guest, addr);
+    def = sh4_get_opdef(data);
+
+    uint32_t next_addr = addr + ((def->flags & SH4_FLAG_DELAYED) ? 4 : 2);
+
+    if (next_addr >= end_addr) {
+      break;
+    }
+
+    addr = next_addr;
+  }
+
+  uint32_t found[JIT_MAX_BRANCH_TARGETS];
+  int num_found = 0;
+
+  if (def->flags & SH4_FLAG_STORE_PC) {
+    union sh4_instr instr = {data};
+    int branch_type;
+    uint32_t branch_addr;
+    uint32_t fall_addr;
+    sh4_branch_info(addr, instr, &branch_type, &branch_addr, &fall_addr);
+
+    if (branch_type == SH4_BRANCH_STATIC ||
+        branch_type == SH4_BRANCH_STATIC_TRUE ||
+        branch_type == SH4_BRANCH_STATIC_FALSE) {
+      found[num_found++] = branch_addr;
+    }
+
+    /* conditional branches fall through, and calls are expected to return to
+       the instruction following their delay slot */
+    if (branch_type == SH4_BRANCH_STATIC_TRUE ||
+        branch_type == SH4_BRANCH_STATIC_FALSE || def->op == SH4_OP_BSR ||
+        def->op == SH4_OP_BSRF || def->op == SH4_OP_JSR) {
+      found[num_found++] = end_addr;
+    }
+  } else {
+    /* code ended by an fpscr write continues on past it */
+    found[num_found++] = end_addr;
+  }
+
+  /* data decoded as code produces garbage targets, only follow those staying
+     within the same memory area */
+  int num_targets = 0;
+
+  for (int i = 0; i < num_found; i++) {
+    if (((found[i] ^ begin_addr) & 0x1c000000) == 0) {
+      targets[num_targets++] = found[i];
+    }
+  }
+
+  return num_targets;
+}
+
+static int sh4_frontend_code_extent(struct jit_frontend *base,
+                                    uint32_t begin_addr, int size) {
+  struct sh4_frontend *frontend = (struct sh4_frontend *)base;
+  struct sh4_guest *guest = (struct sh4_guest *)frontend->guest;
+  int extent = size;
+
+  /* extend out over any literals read at compile time by MOVWL_PCR and
+     MOVLL_PCR. literal pools follow the code referencing them, so the
+     literals are always past the beginning of the code */
+  for (int offset = 0; offset < size; offset += 2) {
+    uint32_t addr = begin_addr + offset;
+    uint16_t data = sh4_guest_read_code(guest, addr);
+    union sh4_instr instr = {data};
+    struct jit_opdef *def = sh4_get_opdef(data);
+    uint32_t ea;
+    int n;
+
+    if (def->op == SH4_OP_MOVWL_PCR) {
+      ea = (instr.imm.imm * 2) + addr + 4;
+      n = 2;
+    } else if (def->op == SH4_OP_MOVLL_PCR) {
+      ea = (instr.imm.imm * 4) + (addr & ~3) + 4;
+      n = 4;
+    } else {
+      continue;
+    }
+
+    if (sh4_guest_fold_literal(guest, ea)) {
+      extent = MAX(extent, (int)(ea + n - begin_addr));
+    }
+  }
+
+  return extent;
+}
+
 static void sh4_frontend_destroy(struct jit_frontend *base) {
   struct sh4_frontend *frontend = (struct sh4_frontend *)base;
 
@@ -334,7 +806,11 @@ struct jit_frontend *sh4_frontend_create(struct jit_guest *guest) {
   frontend->analyze_code = &sh4_frontend_analyze_code;
   frontend->translate_code = &sh4_frontend_translate_code;
   frontend->dump_code = &sh4_frontend_dump_code;
-  frontend->lookup_op = &sh4_frontend_lookup_op;
+  frontend->fetch_op = &sh4_frontend_fetch_op;
+  frontend->current_mode = &sh4_frontend_current_mode;
+  frontend->uses_mode = &sh4_frontend_uses_mode;
+  frontend->branch_targets = &sh4_frontend_branch_targets;
+  frontend->code_extent = &sh4_frontend_code_extent;
 
   return (struct jit_frontend *)frontend;
 }
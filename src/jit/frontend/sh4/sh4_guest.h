@@ -69,11 +69,16 @@
    SZ_MASK | FR_MASK)
 
 struct sh4_context {
+  /* the fields accessed most by compiled code come first. the x64 backend
+     addresses the context with 8-bit displacements from a base biased into
+     it, which reach its first 256 bytes. fields past that take a 32-bit
+     displacement, making each access 3 bytes longer */
+
   /* there are 24 32-bit general registers, r0_bank0-r7_bank0, r0_bank1-r7_bank1
      and r8-r15. r contains the active bank's r0-r7 as well as r8-r15. ralt
      contains the inactive bank's r0-r7 and is swapped in when the processor
      mode changes */
-  uint32_t r[16], ralt[8];
+  uint32_t r[16];
 
   /* there are 32 32-bit floating point registers, fr0-fr15 and xf0-xf15. these
      registers are banked, and swapped with eachother when the bank bit of
@@ -97,7 +102,7 @@ struct sh4_context {
      be loaded as {fr0, fr1, fr2, fr3} but it's actually loaded as
      {fr1, fr0, fr3, fr2}. however, due to the way the FV registers are
      used (FIPR and FTRV) this doesn't actually affect the results */
-  uint32_t fr[16], xf[16];
+  uint32_t fr[16];
 
   /* sr_t and sr_s are the S and T bits from the status register, they are
      kept in their own unique context slots to avoid excessive shifting and
@@ -110,13 +115,8 @@ struct sh4_context {
   uint32_t pc, pr, sr, sr_t, sr_s, sr_m, sr_qm;
 
   uint32_t fpscr;
-  uint32_t dbr, gbr, vbr;
   uint32_t fpul, mach, macl;
-  uint32_t sgr, spc, ssr;
-  uint64_t pending_interrupts;
-
-  /* processor sleep state */
-  uint32_t sleep_mode;
+  uint32_t gbr;
 
   /* the main dispatch loop is ran until run_cycles is <= 0 */
   int32_t run_cycles;
@@ -124,7 +124,17 @@ struct sh4_context {
   /* debug information */
   int32_t ran_instrs;
 
-  uint8_t cache[0x2000];
+  uint64_t pending_interrupts;
+
+  /* inactive banks */
+  uint32_t ralt[8];
+  uint32_t xf[16];
+
+  uint32_t dbr, vbr;
+  uint32_t sgr, spc, ssr;
+
+  /* processor sleep state */
+  uint32_t sleep_mode;
 };
 
 static inline void sh4_swap_gpr_bank(struct sh4_context *ctx) {
@@ -158,15 +168,37 @@ static inline void sh4_explode_sr(struct sh4_context *ctx) {
   ctx->sr_qm = (sr_q == ctx->sr_m) << 31;
 }
 
+/*
+ * sh4 address translation
+ */
+
+/* while the mmu is enabled, the generated code probes a direct-mapped cache of
+   translations inline. each entry is tagged with the 1kb virtual page it maps
+   (with bit 0 set to mark it valid), and holds the delta that converts the
+   virtual address into an untranslated p2 address */
+#define SH4_TLB_PAGE_BITS 10
+#define SH4_TLB_PAGE_MASK (~((1u << SH4_TLB_PAGE_BITS) - 1))
+#define SH4_TLB_CACHE_BITS 10
+#define SH4_TLB_CACHE_SIZE (1 << SH4_TLB_CACHE_BITS)
+
+struct sh4_tlb_cache_entry {
+  uint32_t tag;
+  uint32_t delta;
+};
+
 /*
  * sh4 guest runtime interface
  */
 typedef void (*sh4_invalid_instr_cb)(void *);
+typedef int (*sh4_breakpoint_cb)(void *, uint32_t);
+typedef void (*sh4_trap_cb)(void *);
 typedef void (*sh4_ltlb_cb)(void *);
 typedef void (*sh4_pref_cb)(void *, uint32_t);
 typedef void (*sh4_sleep_cb)(void *);
 typedef void (*sh4_sr_updated_cb)(void *, uint32_t);
 typedef void (*sh4_fpscr_updated_cb)(void *, uint32_t);
+typedef uint32_t (*sh4_translate_addr_cb)(void *, uint32_t);
+typedef int (*sh4_fold_literal_cb)(void *, uint32_t);
 
 struct sh4_guest {
   struct jit_guest;
@@ -177,6 +209,51 @@ struct sh4_guest {
   sh4_sleep_cb sleep;
   sh4_sr_updated_cb sr_updated;
   sh4_fpscr_updated_cb fpscr_updated;
+
+  /* debugger breakpoints, queried for each instruction as it's translated.
+     trap is called in place of an instruction with a breakpoint */
+  sh4_breakpoint_cb breakpoint;
+  sh4_trap_cb trap;
+
+  /* address translation while mmu_enabled is set, translate_addr also
+     refills the tlb cache */
+  struct sh4_tlb_cache_entry *tlb_cache;
+  sh4_translate_addr_cb translate_addr;
+
+  /* optional, returns if the pc-relative literal at the given address can be
+     read at compile time. the literal must only ever be modified through
+     paths which invalidate the code covering it */
+  sh4_fold_literal_cb fold_literal;
 };
 
+static inline uint32_t sh4_guest_translate(struct sh4_guest *guest,
+                                           uint32_t addr) {
+  if (!guest->mmu_enabled) {
+    return addr;
+  }
+  return guest->translate_addr(guest->data, addr);
+}
+
+static inline uint16_t sh4_guest_read_code(struct sh4_guest *guest,
+                                           uint32_t addr) {
+  return guest->r16(guest->mem, sh4_guest_translate(guest, addr));
+}
+
+static inline int sh4_guest_fold_literal(struct sh4_guest *guest,
+                                         uint32_t addr) {
+  /* literals read through the mmu aren't tracked by sh4_mmu_touch_code */
+  if (!guest->fold_literal || guest->mmu_enabled) {
+    return 0;
+  }
+  return guest->fold_literal(guest->data, addr);
+}
+
+static inline int sh4_guest_breakpoint(struct sh4_guest *guest,
+                                       uint32_t addr) {
+  if (!guest->num_breakpoints) {
+    return 0;
+  }
+  return guest->breakpoint(guest->data, addr);
+}
+
 #endif
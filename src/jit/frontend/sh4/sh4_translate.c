@@ -5,6 +5,59 @@
 #include "jit/ir/ir.h"
 #include "jit/jit.h"
 
+static struct ir_value *translate_addr(struct sh4_guest *guest, struct ir *ir,
+                                      struct ir_value *addr) {
+  if (!guest->mmu_enabled) {
+    return addr;
+  }
+
+  /* only the p0 / u0 and p3 areas are translated */
+  if (ir_is_constant(addr)) {
+    uint32_t area = (uint32_t)addr->i32 >> 29;
+    if (area >= 4 && area != 6) {
+      return addr;
+    }
+  }
+
+  /* probe the tlb cache, refilling the entry on a miss */
+  struct ir_value *page_mask = ir_alloc_i32(ir, SH4_TLB_PAGE_MASK);
+  struct ir_value *page = ir_and(ir, addr, page_mask);
+  struct ir_value *tag = ir_or(ir, page, ir_alloc_i32(ir, 1));
+  struct ir_value *index = ir_and(ir, ir_lshri(ir, addr, SH4_TLB_PAGE_BITS),
+                                  ir_alloc_i32(ir, SH4_TLB_CACHE_SIZE - 1));
+  struct ir_value *offset = ir_zext(ir, ir_shli(ir, index, 3), VALUE_I64);
+  struct ir_value *cache = ir_alloc_ptr(ir, guest->tlb_cache);
+  struct ir_value *entry = ir_add(ir, cache, offset);
+
+  struct ir_value *entry_tag = ir_load_host(ir, entry, VALUE_I32);
+  struct ir_value *miss = ir_cmp_ne(ir, entry_tag, tag);
+  struct ir_value *refill = ir_alloc_ptr(ir, guest->translate_addr);
+  struct ir_value *data = ir_alloc_ptr(ir, guest->data);
+  ir_call_cond_2(ir, miss, refill, data, addr);
+
+  int delta_offset = (int)offsetof(struct sh4_tlb_cache_entry, delta);
+  struct ir_value *delta_addr =
+      ir_add(ir, entry, ir_alloc_i64(ir, delta_offset));
+  struct ir_value *delta = ir_load_host(ir, delta_addr, VALUE_I32);
+  return ir_add(ir, addr, delta);
+}
+
+static struct ir_value *load_literal(struct sh4_guest *guest, struct ir *ir,
+                                     uint32_t ea, enum ir_type type) {
+  /* read the literal now when possible, letting it be propagated as a
+     constant. the block's extent covers the literal, see
+     sh4_frontend_code_extent, so the block is invalidated along with it */
+  if (sh4_guest_fold_literal(guest, ea)) {
+    if (type == VALUE_I16) {
+      return ir_alloc_i16(ir, guest->r16(guest->mem, ea));
+    }
+    return ir_alloc_i32(ir, guest->r32(guest->mem, ea));
+  }
+
+  return ir_load_guest(ir, translate_addr(guest, ir, ir_alloc_i32(ir, ea)),
+                       type);
+}
+
 static struct ir_value *load_sr(struct ir *ir) {
   struct ir_value *sr =
       ir_load_context(ir, offsetof(struct sh4_context, sr), VALUE_I32);
@@ -208,16 +261,18 @@ static void store_fpscr(struct sh4_guest *guest, struct ir *ir,
 #define STORE_SSR_I32(v)             STORE_CTX_I32(ssr, v)
 #define STORE_SSR_IMM_I32(v)         STORE_CTX_IMM_I32(ssr, v)
 
-#define LOAD_I8(ea)                  ir_load_guest(ir, ea, VALUE_I8)
-#define LOAD_I16(ea)                 ir_load_guest(ir, ea, VALUE_I16)
-#define LOAD_I32(ea)                 ir_load_guest(ir, ea, VALUE_I32)
-#define LOAD_I64(ea)                 ir_load_guest(ir, ea, VALUE_I64)
+#define LOAD_I8(ea)                  ir_load_guest(ir, translate_addr(guest, ir, ea), VALUE_I8)
+#define LOAD_I16(ea)                 ir_load_guest(ir, translate_addr(guest, ir, ea), VALUE_I16)
+#define LOAD_I32(ea)                 ir_load_guest(ir, translate_addr(guest, ir, ea), VALUE_I32)
+#define LOAD_I64(ea)                 ir_load_guest(ir, translate_addr(guest, ir, ea), VALUE_I64)
 #define LOAD_IMM_I8(ea)              LOAD_I8(ir_alloc_i32(ir, ea))
 #define LOAD_IMM_I16(ea)             LOAD_I16(ir_alloc_i32(ir, ea))
 #define LOAD_IMM_I32(ea)             LOAD_I32(ir_alloc_i32(ir, ea))
 #define LOAD_IMM_I64(ea)             LOAD_I64(ir_alloc_i32(ir, ea))
+#define LOAD_LITERAL_I16(ea)         load_literal(guest, ir, ea, VALUE_I16)
+#define LOAD_LITERAL_I32(ea)         load_literal(guest, ir, ea, VALUE_I32)
 
-#define STORE_I8(ea, v)              ir_store_guest(ir, ea, v)
+#define STORE_I8(ea, v)              ir_store_guest(ir, translate_addr(guest, ir, ea), v)
 #define STORE_I16                    STORE_I8
 #define STORE_I32                    STORE_I8
 #define STORE_I64                    STORE_I8
@@ -348,6 +403,7 @@ static void store_fpscr(struct sh4_guest *guest, struct ir *ir,
 #define FRSQRT_F32(a)                FDIV_F32(ir_alloc_f32(ir, 1.0f), FSQRT_F32(a))
 
 #define VBROADCAST_F32(a)            ir_vbroadcast(ir, a)
+#define VSPLAT_F32(a, lane)          ir_vsplat(ir, a, lane)
 #define VADD_F32(a, b)               ir_vadd(ir, a, b, VALUE_F32)
 #define VMUL_F32(a, b)               ir_vmul(ir, a, b, VALUE_F32)
 #define VDOT_F32(a, b)               ir_vdot(ir, a, b, VALUE_F32)
@@ -32,9 +32,7 @@ static struct ir_instr *ir_alloc_instr(struct ir *ir, enum ir_op op) {
 
   /* initialize use links */
   for (int i = 0; i < IR_MAX_ARGS; i++) {
-    struct ir_use *use = &instr->used[i];
-    use->instr = instr;
-    use->parg = &instr->arg[i];
+    instr->used[i].n = i;
   }
 
   return instr;
@@ -153,6 +151,136 @@ void ir_add_edge(struct ir *ir, struct ir_block *src, struct ir_block *dst) {
   }
 }
 
+struct ir_block *ir_get_extended_pred(struct ir *ir, struct ir_block *block) {
+  /* only the first block is entered from outside of the ir, every other block
+     is entered through a branch to it from inside the ir */
+  struct ir_block *pred = list_prev_entry(block, struct ir_block, it);
+
+  if (!pred) {
+    return NULL;
+  }
+
+  int num_refs = 0;
+
+  list_for_each_entry(other, &ir->blocks, struct ir_block, it) {
+    struct ir_instr *last_instr =
+        list_last_entry(&other->instrs, struct ir_instr, it);
+
+    if (!last_instr ||
+        (last_instr->op != OP_BRANCH && last_instr->op != OP_BRANCH_COND)) {
+      continue;
+    }
+
+    for (int i = 0; i < 2; i++) {
+      struct ir_value *target = last_instr->arg[i];
+
+      if (!target || target->type != VALUE_BLOCK || target->blk != block) {
+        continue;
+      }
+
+      if (other != pred) {
+        return NULL;
+      }
+
+      num_refs++;
+    }
+  }
+
+  return num_refs ? pred : NULL;
+}
+
+int ir_is_yield_point(struct ir *ir, struct ir_block *block) {
+  if (block == list_first_entry(&ir->blocks, struct ir_block, it)) {
+    return 1;
+  }
+
+  /* look for a branch to the block from itself or a block after it */
+  int after = 0;
+
+  list_for_each_entry(other, &ir->blocks, struct ir_block, it) {
+    after |= other == block;
+
+    if (!after) {
+      continue;
+    }
+
+    struct ir_instr *last_instr =
+        list_last_entry(&other->instrs, struct ir_instr, it);
+
+    if (!last_instr ||
+        (last_instr->op != OP_BRANCH && last_instr->op != OP_BRANCH_COND)) {
+      continue;
+    }
+
+    for (int i = 0; i < 2; i++) {
+      struct ir_value *target = last_instr->arg[i];
+
+      if (target && target->type == VALUE_BLOCK && target->blk == block) {
+        return 1;
+      }
+    }
+  }
+
+  return 0;
+}
+
+struct ir_block *ir_get_straight_succ(struct ir *ir, struct ir_block *block) {
+  struct ir_instr *last_instr =
+      list_last_entry(&block->instrs, struct ir_instr, it);
+
+  if (!last_instr || last_instr->op != OP_BRANCH) {
+    return NULL;
+  }
+
+  struct ir_value *target = last_instr->arg[0];
+
+  if (target->type != VALUE_BLOCK ||
+      ir_get_extended_pred(ir, target->blk) != block) {
+    return NULL;
+  }
+
+  return target->blk;
+}
+
+struct ir_block *ir_get_loop_preheader(struct ir *ir, struct ir_block *block) {
+  struct ir_block *pred = list_prev_entry(block, struct ir_block, it);
+
+  if (!pred) {
+    return NULL;
+  }
+
+  int num_pred_refs = 0;
+  int num_self_refs = 0;
+
+  list_for_each_entry(other, &ir->blocks, struct ir_block, it) {
+    struct ir_instr *last_instr =
+        list_last_entry(&other->instrs, struct ir_instr, it);
+
+    if (!last_instr ||
+        (last_instr->op != OP_BRANCH && last_instr->op != OP_BRANCH_COND)) {
+      continue;
+    }
+
+    for (int i = 0; i < 2; i++) {
+      struct ir_value *target = last_instr->arg[i];
+
+      if (!target || target->type != VALUE_BLOCK || target->blk != block) {
+        continue;
+      }
+
+      if (other == pred) {
+        num_pred_refs++;
+      } else if (other == block) {
+        num_self_refs++;
+      } else {
+        return NULL;
+      }
+    }
+  }
+
+  return num_pred_refs && num_self_refs ? pred : NULL;
+}
+
 struct ir_instr *ir_append_instr(struct ir *ir, enum ir_op op,
                                  enum ir_type result_type) {
   /* allocate instruction and its result if needed */
@@ -188,6 +316,19 @@ struct ir_instr *ir_append_instr(struct ir *ir, enum ir_op op,
   return instr;
 }
 
+int ir_num_instrs(const struct ir *ir) {
+  int n = 0;
+
+  list_for_each_entry(block, &ir->blocks, struct ir_block, it) {
+    list_for_each_entry(instr, &block->instrs, struct ir_instr, it) {
+      ((void)instr);
+      n++;
+    }
+  }
+
+  return n;
+}
+
 void ir_remove_instr(struct ir *ir, struct ir_instr *instr) {
   /* remove arguments from the use lists of their values */
   for (int i = 0; i < IR_MAX_ARGS; i++) {
@@ -203,6 +344,15 @@ void ir_remove_instr(struct ir *ir, struct ir_instr *instr) {
   instr->block = NULL;
 }
 
+void ir_move_instr(struct ir *ir, struct ir_instr *instr,
+                   struct ir_insert_point *point) {
+  /* the instruction's uses are left untouched, only its position changes */
+  list_remove(&instr->block->instrs, &instr->it);
+
+  instr->block = point->block;
+  list_add_after_entry(&point->block->instrs, point->instr, instr, it);
+}
+
 struct ir_value *ir_alloc_int(struct ir *ir, int64_t c, enum ir_type type) {
   struct ir_value *v = ir_calloc(ir, sizeof(struct ir_value));
   v->type = type;
@@ -324,14 +474,16 @@ void ir_set_arg3(struct ir *ir, struct ir_instr *instr, struct ir_value *v) {
 }
 
 void ir_replace_use(struct ir_use *use, struct ir_value *other) {
-  if (*use->parg) {
-    ir_remove_use(*use->parg, use);
+  struct ir_value **arg = ir_use_arg(use);
+
+  if (*arg) {
+    ir_remove_use(*arg, use);
   }
 
-  *use->parg = other;
+  *arg = other;
 
-  if (*use->parg) {
-    ir_add_use(*use->parg, use);
+  if (*arg) {
+    ir_add_use(*arg, use);
   }
 }
 
@@ -805,6 +957,16 @@ struct ir_value *ir_vbroadcast(struct ir *ir, struct ir_value *a) {
   return instr->result;
 }
 
+struct ir_value *ir_vsplat(struct ir *ir, struct ir_value *a, int lane) {
+  CHECK(ir_is_vector(a->type));
+  CHECK(lane >= 0 && lane < 4);
+
+  struct ir_instr *instr = ir_append_instr(ir, OP_VSPLAT, a->type);
+  ir_set_arg0(ir, instr, a);
+  ir_set_arg1(ir, instr, ir_alloc_i32(ir, lane));
+  return instr->result;
+}
+
 struct ir_value *ir_vadd(struct ir *ir, struct ir_value *a, struct ir_value *b,
                          enum ir_type el_type) {
   CHECK(ir_is_vector(a->type) && ir_is_vector(b->type));
@@ -935,7 +1097,7 @@ struct ir_value *ir_lshd(struct ir *ir, struct ir_value *a,
 }
 
 void ir_branch(struct ir *ir, struct ir_value *dst) {
-  CHECK(dst->type == VALUE_I32);
+  CHECK(dst->type == VALUE_I32 || dst->type == VALUE_BLOCK);
 
   struct ir_instr *instr = ir_append_instr(ir, OP_BRANCH, VALUE_V);
   ir_set_arg0(ir, instr, dst);
@@ -62,22 +62,23 @@ struct ir_opdef {
 
 /* use is a layer of indirection between an instruction and the values it uses
    as arguments. this indirection makes it possible to maintain a list for each
-   value of the arguments that reference it */
+   value of the arguments that reference it. uses are embedded in their
+   instruction, so the instruction and its argument are found from the index
+   of the use rather than storing pointers to them, see ir_use_instr and
+   ir_use_arg */
 struct ir_use {
-  /* the instruction that's using the value */
-  struct ir_instr *instr;
-
-  /* pointer to the argument that's using the value. this is used to substitute
-     a new value for the argument in the case that the original value is
-     removed (e.g. due to constant propagation) */
-  struct ir_value **parg;
-
   struct list_node it;
+
+  /* index of the argument that's using the value */
+  int n;
 };
 
 struct ir_value {
   enum ir_type type;
 
+  /* host register allocated for this value */
+  int reg;
+
   union {
     int8_t i8;
     int16_t i16;
@@ -94,9 +95,6 @@ struct ir_value {
   /* instructions that use this value as an argument */
   struct list uses;
 
-  /* host register allocated for this value */
-  int reg;
-
   /* generic meta data used by optimization passes */
   intptr_t tag;
 };
@@ -129,6 +127,19 @@ struct ir_instr {
   struct list_node it;
 };
 
+/* the instruction that's using the value */
+static inline struct ir_instr *ir_use_instr(const struct ir_use *use) {
+  return (struct ir_instr *)((uint8_t *)(use - use->n) -
+                             offsetof(struct ir_instr, used));
+}
+
+/* the argument that's using the value, used to substitute a new value for the
+   argument in the case that the original value is removed (e.g. due to
+   constant propagation) */
+static inline struct ir_value **ir_use_arg(const struct ir_use *use) {
+  return &ir_use_instr(use)->arg[use->n];
+}
+
 /* control flow edge between blocks */
 struct ir_edge {
   struct ir_block *src;
@@ -228,6 +239,15 @@ static inline int ir_is_constant(const struct ir_value *v) {
 int ir_read(FILE *input, struct ir *ir);
 void ir_write(struct ir *ir, FILE *output);
 
+/* compact binary form of the ir. ir_write_binary returns the number of bytes
+   written, or 0 if they didn't fit in size bytes. ir_read_binary returns the
+   number of bytes read, or 0 if the data is malformed */
+#define IR_BINARY_REF 0x80
+int ir_read_binary(const uint8_t *data, int size, struct ir *ir);
+int ir_write_binary(struct ir *ir, uint8_t *data, int size);
+
+int ir_num_instrs(const struct ir *ir);
+
 struct ir_insert_point ir_get_insert_point(struct ir *ir);
 void ir_set_insert_point(struct ir *ir, struct ir_insert_point *point);
 void ir_set_current_block(struct ir *ir, struct ir_block *block);
@@ -239,9 +259,32 @@ struct ir_block *ir_split_block(struct ir *ir, struct ir_instr *before);
 void ir_remove_block(struct ir *ir, struct ir_block *block);
 void ir_add_edge(struct ir *ir, struct ir_block *src, struct ir_block *dst);
 
+/* returns the block preceding block if it's the only block which branches to
+   it. in this case, the two blocks form an extended basic block, and values
+   defined in the predecessor are available in block */
+struct ir_block *ir_get_extended_pred(struct ir *ir, struct ir_block *block);
+
+/* returns non-zero if the backend yields to the dispatcher on entry to block
+   when the guest's cycles are exhausted or interrupts are pending. this is
+   only done on entry to the ir and to blocks which may be branched back to,
+   code which only branches forward always terminates. the guest context must
+   be up to date on entry to these blocks and on exiting the ir */
+int ir_is_yield_point(struct ir *ir, struct ir_block *block);
+
+/* returns the block following block if block always branches to it, and is
+   the only block which does. the successor always runs after block */
+struct ir_block *ir_get_straight_succ(struct ir *ir, struct ir_block *block);
+
+/* returns the block preceding block if block is a loop, branching back to
+   itself, which is otherwise only entered from its predecessor. values defined
+   in the preheader are available in each iteration of the loop */
+struct ir_block *ir_get_loop_preheader(struct ir *ir, struct ir_block *block);
+
 struct ir_instr *ir_append_instr(struct ir *ir, enum ir_op op,
                                  enum ir_type result_type);
 void ir_remove_instr(struct ir *ir, struct ir_instr *instr);
+void ir_move_instr(struct ir *ir, struct ir_instr *instr,
+                   struct ir_insert_point *point);
 
 struct ir_value *ir_alloc_int(struct ir *ir, int64_t c, enum ir_type type);
 struct ir_value *ir_alloc_i8(struct ir *ir, int8_t c);
@@ -375,6 +418,7 @@ struct ir_value *ir_sqrt(struct ir *ir, struct ir_value *a);
 
 /* vector math operators */
 struct ir_value *ir_vbroadcast(struct ir *ir, struct ir_value *a);
+struct ir_value *ir_vsplat(struct ir *ir, struct ir_value *a, int lane);
 struct ir_value *ir_vadd(struct ir *ir, struct ir_value *a, struct ir_value *b,
                          enum ir_type el_type);
 struct ir_value *ir_vmul(struct ir *ir, struct ir_value *a, struct ir_value *b,
@@ -410,11 +454,11 @@ void ir_call_1(struct ir *ir, struct ir_value *fn, struct ir_value *arg0);
 void ir_call_2(struct ir *ir, struct ir_value *fn, struct ir_value *arg0,
                struct ir_value *arg1);
 
-void ir_call_cond(struct ir *ir, struct ir_value *fn, struct ir_value *cond);
-void ir_call_cond_1(struct ir *ir, struct ir_value *fn, struct ir_value *arg0,
-                    struct ir_value *cond);
-void ir_call_cond_2(struct ir *ir, struct ir_value *fn, struct ir_value *arg0,
-                    struct ir_value *arg1, struct ir_value *cond);
+void ir_call_cond(struct ir *ir, struct ir_value *cond, struct ir_value *fn);
+void ir_call_cond_1(struct ir *ir, struct ir_value *cond, struct ir_value *fn,
+                    struct ir_value *arg0);
+void ir_call_cond_2(struct ir *ir, struct ir_value *cond, struct ir_value *fn,
+                    struct ir_value *arg0, struct ir_value *arg1);
 
 /* debug */
 void ir_debug_break(struct ir *ir);
@@ -471,8 +471,8 @@ static int ir_parse_instr(struct ir_parser *p) {
         return 0;
       }
 
-      /* break if no comma */
-      if (p->tok != TOK_OPERATOR) {
+      /* break if no comma, the arguments may be followed by meta data */
+      if (p->tok != TOK_OPERATOR || p->val.s[0] != ',') {
         break;
       }
 
@@ -557,3 +557,248 @@ int ir_read(FILE *input, struct ir *ir) {
 
   return res;
 }
+
+/*
+ * binary format, see ir_write.c
+ */
+struct ir_binary_ref {
+  struct ir_instr *instr;
+  int arg;
+  enum ir_type type;
+  int label;
+};
+
+struct ir_binary_label {
+  void *obj;
+  int is_block;
+};
+
+struct ir_binary_reader {
+  const uint8_t *data;
+  int size;
+  int pos;
+  int error;
+
+  /* blocks and instructions, indexed by their label */
+  struct ir_binary_label *labels;
+  int num_labels;
+  int max_labels;
+
+  struct ir_binary_ref *refs;
+  int num_refs;
+  int max_refs;
+};
+
+static int ir_get_byte(struct ir_binary_reader *r) {
+  if (r->pos >= r->size) {
+    r->error = 1;
+    return 0;
+  }
+  return r->data[r->pos++];
+}
+
+static uint32_t ir_get_uint(struct ir_binary_reader *r) {
+  uint32_t v = 0;
+
+  for (int shift = 0; shift < 35 && !r->error; shift += 7) {
+    int byte = ir_get_byte(r);
+    v |= (uint32_t)(byte & 0x7f) << shift;
+
+    if (!(byte & 0x80)) {
+      return v;
+    }
+  }
+
+  r->error = 1;
+  return 0;
+}
+
+static int ir_get_type(struct ir_binary_reader *r, int *ref) {
+  int byte = ir_get_byte(r);
+  int type = byte & ~IR_BINARY_REF;
+
+  *ref = (byte & IR_BINARY_REF) != 0;
+
+  /* blocks are only ever referenced by label */
+  if (type <= VALUE_V || type >= VALUE_NUM || type == VALUE_V128 ||
+      (type == VALUE_BLOCK && !*ref)) {
+    r->error = 1;
+    return VALUE_I32;
+  }
+
+  return type;
+}
+
+static struct ir_value *ir_get_constant(struct ir_binary_reader *r,
+                                        struct ir *ir, enum ir_type type) {
+  uint64_t v = 0;
+  int n = ir_type_size(type);
+
+  for (int i = 0; i < n; i++) {
+    v |= (uint64_t)ir_get_byte(r) << (i * 8);
+  }
+
+  switch (type) {
+    case VALUE_I8:
+      return ir_alloc_i8(ir, (int8_t)v);
+    case VALUE_I16:
+      return ir_alloc_i16(ir, (int16_t)v);
+    case VALUE_I32:
+      return ir_alloc_i32(ir, (int32_t)v);
+    case VALUE_I64:
+      return ir_alloc_i64(ir, (int64_t)v);
+    case VALUE_F32: {
+      uint32_t u = (uint32_t)v;
+      return ir_alloc_f32(ir, *(float *)&u);
+    }
+    case VALUE_F64:
+      return ir_alloc_f64(ir, *(double *)&v);
+    default:
+      LOG_FATAL("unexpected value type");
+      return NULL;
+  }
+}
+
+static void ir_add_label(struct ir_binary_reader *r, void *obj,
+                         int is_block) {
+  if (r->num_labels == r->max_labels) {
+    r->max_labels = MAX(r->max_labels * 2, 256);
+    r->labels =
+        realloc(r->labels, r->max_labels * sizeof(struct ir_binary_label));
+  }
+
+  struct ir_binary_label *label = &r->labels[r->num_labels++];
+  label->obj = obj;
+  label->is_block = is_block;
+}
+
+static void ir_add_ref(struct ir_binary_reader *r, struct ir_instr *instr,
+                       int arg, enum ir_type type, int label) {
+  if (r->num_refs == r->max_refs) {
+    r->max_refs = MAX(r->max_refs * 2, 256);
+    r->refs = realloc(r->refs, r->max_refs * sizeof(struct ir_binary_ref));
+  }
+
+  struct ir_binary_ref *ref = &r->refs[r->num_refs++];
+  ref->instr = instr;
+  ref->arg = arg;
+  ref->type = type;
+  ref->label = label;
+}
+
+static void ir_get_meta_values(struct ir_binary_reader *r, struct ir *ir,
+                               void *obj) {
+  int mask = ir_get_byte(r);
+
+  for (int kind = 0; kind < IR_NUM_META && !r->error; kind++) {
+    if (!(mask & (1 << kind))) {
+      continue;
+    }
+
+    int ref;
+    enum ir_type type = ir_get_type(r, &ref);
+
+    if (ref) {
+      r->error = 1;
+      break;
+    }
+
+    ir_set_meta(ir, obj, kind, ir_get_constant(r, ir, type));
+  }
+}
+
+static void ir_get_instr(struct ir_binary_reader *r, struct ir *ir) {
+  int op = ir_get_byte(r);
+  int result_type = ir_get_byte(r);
+  int mask = ir_get_byte(r);
+
+  if (r->error || op >= IR_NUM_OPS || result_type >= VALUE_NUM) {
+    r->error = 1;
+    return;
+  }
+
+  struct ir_instr *instr = ir_append_instr(ir, op, result_type);
+  ir_add_label(r, instr, 0);
+
+  for (int i = 0; i < IR_MAX_ARGS && !r->error; i++) {
+    if (!(mask & (1 << i))) {
+      continue;
+    }
+
+    int ref;
+    enum ir_type type = ir_get_type(r, &ref);
+
+    if (ref) {
+      /* defer resolution until every block and instruction exists */
+      ir_add_ref(r, instr, i, type, ir_get_uint(r));
+    } else {
+      ir_set_arg(ir, instr, i, ir_get_constant(r, ir, type));
+    }
+  }
+
+  ir_get_meta_values(r, ir, instr);
+}
+
+static int ir_resolve_binary_refs(struct ir_binary_reader *r, struct ir *ir) {
+  for (int i = 0; i < r->num_refs; i++) {
+    struct ir_binary_ref *ref = &r->refs[i];
+
+    if (ref->label >= r->num_labels) {
+      return 0;
+    }
+
+    struct ir_binary_label *label = &r->labels[ref->label];
+    struct ir_value *value = NULL;
+
+    if (label->is_block != (ref->type == VALUE_BLOCK)) {
+      return 0;
+    }
+
+    if (label->is_block) {
+      value = ir_alloc_block_ref(ir, label->obj);
+    } else {
+      struct ir_instr *def = label->obj;
+      value = def->result;
+    }
+
+    if (!value || value->type != ref->type) {
+      return 0;
+    }
+
+    ir_set_arg(ir, ref->instr, ref->arg, value);
+  }
+
+  return 1;
+}
+
+int ir_read_binary(const uint8_t *data, int size, struct ir *ir) {
+  struct ir_binary_reader r = {0};
+  r.data = data;
+  r.size = size;
+
+  /* each block and instruction takes at least two bytes, use that to reject
+     counts that would otherwise exhaust the ir's buffer */
+  int num_blocks = ir_get_uint(&r);
+  r.error |= num_blocks > size / 2;
+
+  for (int i = 0; i < num_blocks && !r.error; i++) {
+    struct ir_block *block = ir_append_block(ir);
+    ir_set_current_block(ir, block);
+    ir_add_label(&r, block, 1);
+    ir_get_meta_values(&r, ir, block);
+
+    int num_instrs = ir_get_uint(&r);
+    r.error |= num_instrs > size / 2;
+
+    for (int j = 0; j < num_instrs && !r.error; j++) {
+      ir_get_instr(&r, ir);
+    }
+  }
+
+  int res = !r.error && ir_resolve_binary_refs(&r, ir);
+
+  free(r.labels);
+  free(r.refs);
+
+  return res ? r.pos : 0;
+}
@@ -4,6 +4,11 @@
 struct ir_writer {
   struct ir *ir;
   int *labels;
+
+  /* output buffer when writing the binary format */
+  uint8_t *data;
+  int size;
+  int pos;
 };
 
 static void ir_destroy_writer(struct ir_writer *w) {
@@ -245,3 +250,134 @@ void ir_write(struct ir *ir, FILE *output) {
 
   ir_destroy_writer(&w);
 }
+
+/*
+ * binary format
+ *
+ * a compact form of the same information written by ir_write, used to dump
+ * ir at runtime without the cost of formatting text. all integers other than
+ * constants are LEB128 encoded, constants are stored as their raw bytes
+ *
+ *   ir:     num_blocks, block*
+ *   block:  meta, num_instrs, instr*
+ *   instr:  op, result type, arg mask, arg*, meta
+ *   arg:    type (| IR_BINARY_REF), label if a reference, else constant
+ *   meta:   kind mask, (type, constant)*
+ */
+static void ir_emit_byte(struct ir_writer *w, int byte) {
+  if (w->pos < w->size) {
+    w->data[w->pos] = (uint8_t)byte;
+  }
+  w->pos++;
+}
+
+static void ir_emit_uint(struct ir_writer *w, uint32_t v) {
+  while (v >= 0x80) {
+    ir_emit_byte(w, (v & 0x7f) | 0x80);
+    v >>= 7;
+  }
+  ir_emit_byte(w, v);
+}
+
+static void ir_emit_constant(struct ir_writer *w,
+                             const struct ir_value *value) {
+  /* the value union is stored little-endian, the same as the host */
+  const uint8_t *bytes = (const uint8_t *)&value->i64;
+  int n = ir_type_size(value->type);
+
+  for (int i = 0; i < n; i++) {
+    ir_emit_byte(w, bytes[i]);
+  }
+}
+
+static void ir_emit_value(struct ir_writer *w, const struct ir_value *value) {
+  if (!ir_is_constant(value)) {
+    ir_emit_byte(w, value->type | IR_BINARY_REF);
+    ir_emit_uint(w, ir_get_instr_label(w, value->def));
+  } else if (value->type == VALUE_BLOCK) {
+    ir_emit_byte(w, value->type | IR_BINARY_REF);
+    ir_emit_uint(w, ir_get_block_label(w, value->blk));
+  } else {
+    ir_emit_byte(w, value->type);
+    ir_emit_constant(w, value);
+  }
+}
+
+static void ir_emit_meta(struct ir_writer *w, const void *obj) {
+  struct ir_value *values[IR_NUM_META];
+  int mask = 0;
+
+  for (int kind = 0; kind < IR_NUM_META; kind++) {
+    values[kind] = ir_get_meta(w->ir, obj, kind);
+
+    if (values[kind]) {
+      mask |= 1 << kind;
+    }
+  }
+
+  ir_emit_byte(w, mask);
+
+  for (int kind = 0; kind < IR_NUM_META; kind++) {
+    if (!values[kind]) {
+      continue;
+    }
+
+    ir_emit_byte(w, values[kind]->type);
+    ir_emit_constant(w, values[kind]);
+  }
+}
+
+static void ir_emit_instr(struct ir_writer *w, const struct ir_instr *instr) {
+  int mask = 0;
+
+  for (int i = 0; i < IR_MAX_ARGS; i++) {
+    if (instr->arg[i]) {
+      mask |= 1 << i;
+    }
+  }
+
+  ir_emit_byte(w, instr->op);
+  ir_emit_byte(w, instr->result ? instr->result->type : VALUE_V);
+  ir_emit_byte(w, mask);
+
+  for (int i = 0; i < IR_MAX_ARGS; i++) {
+    if (instr->arg[i]) {
+      ir_emit_value(w, instr->arg[i]);
+    }
+  }
+
+  ir_emit_meta(w, instr);
+}
+
+int ir_write_binary(struct ir *ir, uint8_t *data, int size) {
+  struct ir_writer w = {0};
+  w.ir = ir;
+  w.data = data;
+  w.size = size;
+
+  ir_assign_labels(&w);
+
+  int num_blocks = 0;
+  list_for_each_entry(block, &ir->blocks, struct ir_block, it) {
+    num_blocks++;
+  }
+  ir_emit_uint(&w, num_blocks);
+
+  list_for_each_entry(block, &ir->blocks, struct ir_block, it) {
+    int num_instrs = 0;
+    list_for_each_entry(instr, &block->instrs, struct ir_instr, it) {
+      num_instrs++;
+    }
+
+    ir_emit_meta(&w, block);
+    ir_emit_uint(&w, num_instrs);
+
+    list_for_each_entry(instr, &block->instrs, struct ir_instr, it) {
+      ir_emit_instr(&w, instr);
+    }
+  }
+
+  ir_destroy_writer(&w);
+
+  return w.pos <= w.size ? w.pos : 0;
+}
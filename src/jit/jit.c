@@ -1,100 +1,292 @@
 #include "jit/jit.h"
+#include "core/arena.h"
 #include "core/core.h"
 #include "core/exception_handler.h"
 #include "core/filesystem.h"
+#include "core/hash.h"
+#include "core/time.h"
+#include "imgui.h"
 #include "jit/ir/ir.h"
 #include "jit/jit_backend.h"
+#include "jit/jit_cache.h"
+#include "jit/jit_dump.h"
 #include "jit/jit_frontend.h"
+#include "jit/jit_guest.h"
+#include "jit/jit_perf.h"
+#include "jit/jit_prescan.h"
+#include "jit/jit_sampler.h"
+#include "jit/pass_stats.h"
+#include "jit/passes/common_subexpression_elimination_pass.h"
 #include "jit/passes/constant_propagation_pass.h"
 #include "jit/passes/control_flow_analysis_pass.h"
 #include "jit/passes/dead_code_elimination_pass.h"
 #include "jit/passes/expression_simplification_pass.h"
 #include "jit/passes/load_store_elimination_pass.h"
+#include "jit/passes/loop_invariant_code_motion_pass.h"
 #include "jit/passes/register_allocation_pass.h"
 #include "options.h"
+#include "stats.h"
 
 #if PLATFORM_DARWIN || PLATFORM_LINUX
 #include <unistd.h>
 #endif
 
-static int block_map_cmp(const struct rb_node *rb_lhs,
-                         const struct rb_node *rb_rhs) {
-  const struct jit_block *lhs =
-      container_of(rb_lhs, const struct jit_block, it);
-  const struct jit_block *rhs =
-      container_of(rb_rhs, const struct jit_block, it);
+/* number of executions before a first tier block is recompiled with the full
+   optimization pipeline */
+#define JIT_HOT_THRESHOLD 1024
 
-  if (lhs->guest_addr < rhs->guest_addr) {
-    return -1;
-  } else if (lhs->guest_addr > rhs->guest_addr) {
-    return 1;
-  } else {
-    return 0;
+/* initial number of entries in the guest address hash table, grown as blocks
+   are added to keep the load factor under 1/2 */
+#define JIT_BLOCK_MAP_BITS 12
+
+/* granularity of the host address reverse map */
+#define JIT_REVERSE_PAGE_SHIFT 12
+
+/* granularity of the guest code page map */
+#define JIT_CODE_PAGE_SHIFT 12
+
+/* size of each chunk in the block and edge arena */
+#define JIT_ARENA_CHUNK_SIZE (1024 * 1024)
+
+/* number of regions the code buffer is split into. when a region fills up,
+   only the blocks in the next region are evicted to make room */
+#define JIT_CODE_REGIONS 8
+
+static int jit_block_map_bucket(struct jit *jit, uint32_t guest_addr) {
+  return hash_key(guest_addr, ctz32(jit->block_map_size));
+}
+
+static void jit_block_map_insert(struct jit *jit, struct jit_block *block) {
+  int mask = jit->block_map_size - 1;
+  int i = jit_block_map_bucket(jit, block->guest_addr);
+
+  while (jit->block_map[i]) {
+    CHECK_NE(jit->block_map[i], block,
+             "code was already inserted in lookup tables");
+    i = (i + 1) & mask;
   }
+
+  jit->block_map[i] = block;
+  jit->num_blocks++;
 }
 
-static int reverse_block_map_cmp(const struct rb_node *rb_lhs,
-                                 const struct rb_node *rb_rhs) {
-  const struct jit_block *lhs =
-      container_of(rb_lhs, const struct jit_block, rit);
-  const struct jit_block *rhs =
-      container_of(rb_rhs, const struct jit_block, rit);
+static void jit_block_map_grow(struct jit *jit) {
+  struct jit_block **old_map = jit->block_map;
+  int old_size = jit->block_map_size;
 
-  if (lhs->host_addr < rhs->host_addr) {
-    return -1;
-  } else if (lhs->host_addr > rhs->host_addr) {
-    return 1;
-  } else {
+  jit->block_map_size = old_size ? old_size * 2 : (1 << JIT_BLOCK_MAP_BITS);
+  jit->block_map = calloc(jit->block_map_size, sizeof(struct jit_block *));
+  jit->num_blocks = 0;
+
+  for (int i = 0; i < old_size; i++) {
+    if (old_map[i]) {
+      jit_block_map_insert(jit, old_map[i]);
+    }
+  }
+
+  free(old_map);
+}
+
+static void jit_block_map_remove(struct jit *jit, struct jit_block *block) {
+  int mask = jit->block_map_size - 1;
+  int i = jit_block_map_bucket(jit, block->guest_addr);
+
+  while (jit->block_map[i] != block) {
+    CHECK_NOTNULL(jit->block_map[i]);
+    i = (i + 1) & mask;
+  }
+
+  /* shift back any following entries which would no longer be reachable from
+     their bucket, avoiding the need for tombstones */
+  int j = i;
+
+  while (1) {
+    jit->block_map[i] = NULL;
+
+    struct jit_block *next;
+
+    do {
+      j = (j + 1) & mask;
+      next = jit->block_map[j];
+
+      if (!next) {
+        jit->num_blocks--;
+        return;
+      }
+
+      /* entry can fill the hole if its bucket isn't cyclically in (i, j] */
+      int k = jit_block_map_bucket(jit, next->guest_addr);
+      int dist_hole = (j - i) & mask;
+      int dist_bucket = (j - k) & mask;
+
+      if (dist_bucket >= dist_hole) {
+        break;
+      }
+    } while (1);
+
+    jit->block_map[i] = next;
+    i = j;
+  }
+}
+
+static uint32_t jit_current_mode(struct jit *jit) {
+  if (!jit->frontend->current_mode) {
     return 0;
   }
+
+  return jit->frontend->current_mode(jit->frontend);
 }
 
-static struct rb_callbacks block_map_cb = {
-    &block_map_cmp, NULL, NULL,
-};
+static int jit_block_matches(struct jit_block *block, uint32_t guest_addr,
+                             uint32_t guest_mode) {
+  return block->guest_addr == guest_addr &&
+         (block->guest_mode == JIT_MODE_ANY || block->guest_mode == guest_mode);
+}
 
-static struct rb_callbacks reverse_block_map_cb = {
-    &reverse_block_map_cmp, NULL, NULL,
-};
+static struct jit_block *jit_get_block(struct jit *jit, uint32_t guest_addr,
+                                       uint32_t guest_mode) {
+  int mask = jit->block_map_size - 1;
+  int i = jit_block_map_bucket(jit, guest_addr);
+
+  /* each variant of a block shares the same bucket. previously invalidated
+     variants may linger in the map until they're evicted, so prefer a valid
+     match over an invalid one */
+  struct jit_block *found = NULL;
+
+  while (jit->block_map[i]) {
+    struct jit_block *block = jit->block_map[i];
+
+    if (jit_block_matches(block, guest_addr, guest_mode)) {
+      if (block->state == JIT_STATE_VALID) {
+        return block;
+      }
 
-static struct jit_block *jit_get_block(struct jit *jit, uint32_t guest_addr) {
-  struct jit_block search;
-  search.guest_addr = guest_addr;
+      if (!found) {
+        found = block;
+      }
+    }
+
+    i = (i + 1) & mask;
+  }
 
-  return rb_find_entry(&jit->blocks, &search, struct jit_block, it,
-                       &block_map_cb);
+  return found;
+}
+
+static int jit_reverse_map_page(struct jit *jit, const uint8_t *host_addr) {
+  return (int)((host_addr - jit->backend->code) >> JIT_REVERSE_PAGE_SHIFT);
 }
 
 static struct jit_block *jit_lookup_block_reverse(struct jit *jit,
                                                   void *host_addr) {
-  struct jit_block search;
-  search.host_addr = host_addr;
+  uint8_t *code = jit->backend->code;
 
-  struct rb_node *first = rb_first(&jit->reverse_blocks);
-  struct rb_node *last = rb_last(&jit->reverse_blocks);
-  struct rb_node *rit =
-      rb_upper_bound(&jit->reverse_blocks, &search.rit, &reverse_block_map_cb);
+  if (!jit->reverse_map) {
+    return NULL;
+  }
 
-  if (rit == first) {
+  if ((uint8_t *)host_addr < code ||
+      (uint8_t *)host_addr >= code + jit->backend->code_size) {
     return NULL;
   }
 
-  rit = rit ? rb_prev(rit) : last;
+  /* blocks are only linked into the page their code begins in, so search
+     back as many pages as the largest block spans */
+  int page = jit_reverse_map_page(jit, host_addr);
+  int first_page = MAX(page - jit->max_host_pages, 0);
 
-  struct jit_block *block = container_of(rit, struct jit_block, rit);
-  if ((uint8_t *)host_addr < (uint8_t *)block->host_addr ||
-      (uint8_t *)host_addr >=
-          ((uint8_t *)block->host_addr + block->host_size)) {
-    return NULL;
+  for (int i = page; i >= first_page; i--) {
+    list_for_each_entry(block, &jit->reverse_map[i], struct jit_block, rit) {
+      if ((uint8_t *)host_addr >= block->host_addr &&
+          (uint8_t *)host_addr < (block->host_addr + block->host_size)) {
+        return block;
+      }
+    }
   }
 
-  return block;
+  /* the address may instead be in a block's cold code, which is mapped the
+     same way */
+  first_page = MAX(page - jit->max_cold_pages, 0);
+
+  for (int i = page; i >= first_page; i--) {
+    list_for_each_entry(block, &jit->cold_map[i], struct jit_block, crit) {
+      if ((uint8_t *)host_addr >= block->cold_addr &&
+          (uint8_t *)host_addr < (block->cold_addr + block->cold_size)) {
+        return block;
+      }
+    }
+  }
+
+  return NULL;
+}
+
+static void jit_reverse_map_insert(struct jit *jit, struct jit_block *block) {
+  int first_page = jit_reverse_map_page(jit, block->host_addr);
+  int last_page =
+      jit_reverse_map_page(jit, block->host_addr + block->host_size - 1);
+
+  list_add(&jit->reverse_map[first_page], &block->rit);
+  jit->max_host_pages = MAX(jit->max_host_pages, last_page - first_page);
+
+  if (block->cold_size) {
+    first_page = jit_reverse_map_page(jit, block->cold_addr);
+    last_page =
+        jit_reverse_map_page(jit, block->cold_addr + block->cold_size - 1);
+
+    list_add(&jit->cold_map[first_page], &block->crit);
+    jit->max_cold_pages = MAX(jit->max_cold_pages, last_page - first_page);
+  }
+}
+
+static void jit_reverse_map_remove(struct jit *jit, struct jit_block *block) {
+  int page = jit_reverse_map_page(jit, block->host_addr);
+
+  list_remove(&jit->reverse_map[page], &block->rit);
+
+  if (block->cold_size) {
+    page = jit_reverse_map_page(jit, block->cold_addr);
+    list_remove(&jit->cold_map[page], &block->crit);
+  }
+}
+
+static uint32_t jit_code_page(struct jit *jit, uint32_t guest_addr) {
+  /* mask off mirrors, as is done by the dispatch cache */
+  return (guest_addr & jit->frontend->guest->addr_mask) >> JIT_CODE_PAGE_SHIFT;
+}
+
+static void jit_code_page_insert(struct jit *jit, struct jit_block *block) {
+  uint32_t first_page = jit_code_page(jit, block->guest_addr);
+  uint32_t last_page =
+      jit_code_page(jit, block->guest_addr + block->guest_extent - 1);
+  struct list *bkt = hash_bkt(jit->code_pages, first_page);
+
+  hash_add(bkt, &block->pit);
+  jit->max_guest_pages =
+      MAX(jit->max_guest_pages, (int)(last_page - first_page));
+}
+
+static void jit_code_page_remove(struct jit *jit, struct jit_block *block) {
+  uint32_t page = jit_code_page(jit, block->guest_addr);
+  struct list *bkt = hash_bkt(jit->code_pages, page);
+
+  hash_del(bkt, &block->pit);
 }
 
 static int jit_is_stale(struct jit *jit, struct jit_block *block) {
   return block->state != JIT_STATE_VALID;
 }
 
+static uint8_t *jit_edge_target(struct jit_edge *edge) {
+  /* any cycle of linked blocks must contain a branch to a block at or before
+     the address of the branching block. only checking for cycle exhaustion
+     and interrupts on those branches and on dynamic branches is enough to
+     guarantee the guest returns to dispatch in a bounded amount of time */
+  if (edge->dst->link_addr && edge->dst->guest_addr > edge->src->guest_addr) {
+    return edge->dst->link_addr;
+  }
+
+  return edge->dst->host_addr;
+}
+
 static void jit_patch_edges(struct jit *jit, struct jit_block *block) {
   /* patch incoming edges to this block to directly jump to it instead of
      going through dispatch */
@@ -102,7 +294,7 @@ static void jit_patch_edges(struct jit *jit, struct jit_block *block) {
     if (!edge->patched) {
       edge->patched = 1;
       jit->backend->patch_edge(jit->backend, edge->branch,
-                               edge->dst->host_addr);
+                               jit_edge_target(edge));
     }
   }
 
@@ -111,7 +303,7 @@ static void jit_patch_edges(struct jit *jit, struct jit_block *block) {
     if (!edge->patched) {
       edge->patched = 1;
       jit->backend->patch_edge(jit->backend, edge->branch,
-                               edge->dst->host_addr);
+                               jit_edge_target(edge));
     }
   }
 }
@@ -140,57 +332,87 @@ static void jit_invalidate_block(struct jit *jit, struct jit_block *block,
   list_for_each_entry_safe(edge, &block->in_edges, struct jit_edge, in_it) {
     list_remove(&edge->src->out_edges, &edge->out_it);
     list_remove(&block->in_edges, &edge->in_it);
-    free(edge);
+    arena_free(jit->arena, edge, sizeof(struct jit_edge));
   }
 
   list_for_each_entry_safe(edge, &block->out_edges, struct jit_edge, out_it) {
     list_remove(&block->out_edges, &edge->out_it);
     list_remove(&edge->dst->in_edges, &edge->in_it);
-    free(edge);
+    arena_free(jit->arena, edge, sizeof(struct jit_edge));
   }
 }
 
 static void jit_cache_block(struct jit *jit, struct jit_block *block) {
+  /* the dispatch cache only holds a single variant of each block, replace
+     whichever variant is currently cached */
+  jit->backend->invalidate_code(jit->backend, block->guest_addr);
   jit->backend->cache_code(jit->backend, block->guest_addr, block->host_addr);
 
   CHECK(list_empty(&block->in_edges));
   CHECK(list_empty(&block->out_edges));
 }
 
+static int jit_block_alloc_size(int guest_size) {
+  /* the meta data for the guest code is packed in after the block header */
+  return (int)(sizeof(struct jit_block) + guest_size * sizeof(void *) +
+               guest_size * sizeof(int8_t));
+}
+
+static void jit_release_block(struct jit *jit, struct jit_block *block) {
+  list_for_each_entry_safe(stub, &block->stubs, struct jit_stub, it) {
+    list_remove(&block->stubs, &stub->it);
+    arena_free(jit->arena, stub, sizeof(struct jit_stub));
+  }
+
+  arena_free(jit->arena, block, jit_block_alloc_size(block->guest_size));
+}
+
 static void jit_free_block(struct jit *jit, struct jit_block *block) {
   jit_invalidate_block(jit, block, 0);
 
-  free(block->source_map);
-  free(block->fastmem);
+  list_remove(&jit->blocks, &block->it);
+  jit_block_map_remove(jit, block);
+  jit_code_page_remove(jit, block);
 
-  rb_unlink(&jit->blocks, &block->it, &block_map_cb);
-  rb_unlink(&jit->reverse_blocks, &block->rit, &reverse_block_map_cb);
+  if (jit->reverse_map) {
+    jit_reverse_map_remove(jit, block);
+  }
 
-  free(block);
+  jit_release_block(jit, block);
 }
 
 static void jit_finalize_block(struct jit *jit, struct jit_block *block) {
   CHECK(list_empty(&block->in_edges) && list_empty(&block->out_edges),
         "code shouldn't have any existing edges");
-  CHECK(rb_empty_node(&block->it) && rb_empty_node(&block->rit),
-        "code was already inserted in lookup tables");
 
   jit_cache_block(jit, block);
 
-  rb_insert(&jit->blocks, &block->it, &block_map_cb);
-  rb_insert(&jit->reverse_blocks, &block->rit, &reverse_block_map_cb);
+  if ((jit->num_blocks + 1) * 2 > jit->block_map_size) {
+    jit_block_map_grow(jit);
+  }
+
+  list_add(&jit->blocks, &block->it);
+  jit_block_map_insert(jit, block);
+  jit_code_page_insert(jit, block);
+
+  if (jit->reverse_map) {
+    jit_reverse_map_insert(jit, block);
+  }
 }
 
 static struct jit_block *jit_alloc_block(struct jit *jit, uint32_t guest_addr,
                                          int guest_size) {
-  struct jit_block *block = calloc(1, sizeof(struct jit_block));
+  struct jit_block *block =
+      arena_alloc(jit->arena, jit_block_alloc_size(guest_size));
 
   block->guest_addr = guest_addr;
   block->guest_size = guest_size;
+  block->guest_extent = guest_size;
 
-  /* allocate meta data structs for the original guest code */
-  block->source_map = calloc(block->guest_size, sizeof(void *));
-  block->fastmem = calloc(block->guest_size, sizeof(int8_t));
+  /* point the meta data structs for the original guest code at the storage
+     packed in after the block */
+  block->source_map = (void **)(block + 1);
+  block->fastmem = (int8_t *)(block->source_map + guest_size);
 
 #ifdef HAVE_FASTMEM
   /* enable fastmem for all accesses by default, falling back to the slow route
@@ -203,50 +425,150 @@ static struct jit_block *jit_alloc_block(struct jit *jit, uint32_t guest_addr,
   return block;
 }
 
+static void jit_reset_region(struct jit *jit, int region) {
+  uint8_t *begin = jit->backend->code + region * jit->code_region_size;
+
+  jit->code_region = region;
+  jit->backend->reset(jit->backend, begin, jit->code_region_size);
+}
+
+static void jit_evict_region(struct jit *jit, int region) {
+  /* free each block whose code begins in the region, restoring any branches
+     from other regions which were patched to jump to them */
+  int pages = jit->code_region_size >> JIT_REVERSE_PAGE_SHIFT;
+  int first_page = region * pages;
+
+  for (int i = first_page; i < first_page + pages; i++) {
+    list_for_each_entry_safe(block, &jit->reverse_map[i], struct jit_block,
+                             rit) {
+      jit_free_block(jit, block);
+    }
+  }
+
+  jit_reset_region(jit, region);
+}
+
 void jit_free_code(struct jit *jit) {
   /* invalidate code pointers and remove block entries from lookup maps. this
      is only safe to use when no code is currently executing */
-  struct rb_node *it = rb_first(&jit->blocks);
+  list_for_each_entry_safe(block, &jit->blocks, struct jit_block, it) {
+    jit_free_block(jit, block);
+  }
 
-  while (it) {
-    struct rb_node *next = rb_next(it);
+  jit->max_host_pages = 0;
+  jit->max_cold_pages = 0;
+  jit->max_guest_pages = 0;
 
-    struct jit_block *block = container_of(it, struct jit_block, it);
-    jit_free_block(jit, block);
+  /* with every block freed, the arena can be reset wholesale. blocks still
+     being compiled in the background live in it as well though, and are
+     only freed once their job finishes */
+  if (list_empty(&jit->pending)) {
+    arena_reset(jit->arena);
+  }
+
+  /* drop any blocks still being compiled in the background */
+  jit->generation++;
 
-    it = next;
+  /* the code being prescanned is about to be replaced */
+  if (jit->prescan) {
+    jit_prescan_clear(jit->prescan);
   }
 
   /* have the backend reset its code buffers */
-  jit->backend->reset(jit->backend);
+  jit_reset_region(jit, 0);
 }
 
 void jit_invalidate_code(struct jit *jit) {
   /* invalidate code pointers, but don't remove block entries from lookup maps.
      this is used when clearing the jit while code is currently executing */
-  struct rb_node *it = rb_first(&jit->blocks);
-
-  while (it) {
-    struct rb_node *next = rb_next(it);
-
-    struct jit_block *block = container_of(it, struct jit_block, it);
+  list_for_each_entry(block, &jit->blocks, struct jit_block, it) {
     jit_invalidate_block(jit, block, 0);
+  }
 
-    it = next;
+  if (jit->backend->invalidate_range) {
+    jit->backend->invalidate_range(jit->backend, 0, JIT_INVALIDATE_ALL);
   }
 
+  jit->generation++;
+
   /* don't reset backend code buffers, code is still running */
 }
 
+void jit_invalidate_range(struct jit *jit, uint32_t addr, int size) {
+  /* invalidate the code pointers of only the blocks overlapping the written
+     range. like jit_invalidate_code, this is safe to use while code is
+     executing. blocks are only hashed by the page they begin in, so search
+     back as many pages as the largest block spans */
+  if (size <= 0) {
+    return;
+  }
+
+  if (jit->backend->invalidate_range) {
+    jit->backend->invalidate_range(jit->backend, addr, size);
+  }
+
+  uint32_t mask = jit->frontend->guest->addr_mask;
+  uint32_t begin = addr & mask;
+  uint32_t end = begin + size;
+  uint32_t first_page = begin >> JIT_CODE_PAGE_SHIFT;
+  uint32_t last_page = (end - 1) >> JIT_CODE_PAGE_SHIFT;
+
+  first_page -= MIN((int)first_page, jit->max_guest_pages);
+
+  for (uint32_t page = first_page; page <= last_page; page++) {
+    struct list *bkt = hash_bkt(jit->code_pages, page);
+
+    hash_bkt_for_each_entry(block, bkt, struct jit_block, pit) {
+      uint32_t block_begin = block->guest_addr & mask;
+      uint32_t block_end = block_begin + block->guest_extent;
+
+      if (block->state != JIT_STATE_VALID || block_end <= begin ||
+          block_begin >= end) {
+        continue;
+      }
+
+      jit_invalidate_block(jit, block, 0);
+    }
+  }
+
+  /* blocks still being compiled in the background were translated from the
+     old code, have them discarded once their job finishes */
+  list_for_each_entry(block, &jit->pending, struct jit_block, it) {
+    uint32_t block_begin = block->guest_addr & mask;
+    uint32_t block_end = block_begin + block->guest_extent;
+
+    if (block_end > begin && block_begin < end) {
+      block->state = JIT_STATE_INVALID;
+    }
+  }
+}
+
 void jit_link_code(struct jit *jit, void *branch, uint32_t addr) {
   struct jit_block *src = jit_lookup_block_reverse(jit, branch);
-  struct jit_block *dst = jit_get_block(jit, addr);
+  struct jit_block *dst = jit_get_block(jit, addr, jit_current_mode(jit));
+
+  if (jit_is_stale(jit, src)) {
+    return;
+  }
+
+  /* if there is no valid variant for the current mode, the dispatch cache
+     may still hold a variant for another mode, which would just branch right
+     back here. reset the entry so dispatch compiles the right variant */
+  if (!dst || jit_is_stale(jit, dst)) {
+    jit->backend->invalidate_code(jit->backend, addr);
+    return;
+  }
 
-  if (jit_is_stale(jit, src) || !dst) {
+  /* branches between variants of the same block come from a variant's mode
+     guard. these are never linked, as the mode can change each time they're
+     taken. just switch the variant dispatch jumps to */
+  if (dst != src && dst->guest_addr == src->guest_addr) {
+    jit->backend->invalidate_code(jit->backend, addr);
+    jit->backend->cache_code(jit->backend, addr, dst->host_addr);
     return;
   }
 
-  struct jit_edge *edge = calloc(1, sizeof(struct jit_edge));
+  struct jit_edge *edge = arena_alloc(jit->arena, sizeof(struct jit_edge));
   edge->src = src;
   edge->dst = dst;
   edge->branch = branch;
@@ -256,36 +578,34 @@ void jit_link_code(struct jit *jit, void *branch, uint32_t addr) {
   jit_patch_edges(jit, src);
 }
 
-static void jit_write_block(struct jit *jit, struct jit_block *block,
-                            struct ir *ir, FILE *output) {
-  ir_write(ir, output);
-  fprintf(output, "\n");
+static void jit_dump_block(struct jit *jit, int type, struct jit_block *block,
+                           struct ir *ir) {
+  /* blocks are dumped to a single file for the session, opened the first
+     time dumping is enabled */
+  if (!jit->dump) {
+    const char *appdir = fs_appdir();
 
-  jit->frontend->dump_code(jit->frontend, block->guest_addr, block->guest_size,
-                           output);
-  fprintf(output, "\n");
+    for (int i = 0; i < INT_MAX; i++) {
+      snprintf(jit->dump_path, sizeof(jit->dump_path),
+               "%s" PATH_SEPARATOR "%s-%d.irdump", appdir, jit->tag, i);
 
-  jit->backend->dump_code(jit->backend, block->host_addr, block->host_size,
-                          output);
-}
+      if (!fs_exists(jit->dump_path)) {
+        break;
+      }
+    }
 
-static void jit_dump_block(struct jit *jit, const char *type,
-                           struct jit_block *block, struct ir *ir) {
-  const char *appdir = fs_appdir();
+    jit->dump = jit_dump_open(jit->dump_path, jit->tag);
 
-  char irdir[PATH_MAX];
-  snprintf(irdir, sizeof(irdir), "%s" PATH_SEPARATOR "%s-%s-ir", appdir,
-           jit->tag, type);
-  CHECK(fs_mkdir(irdir));
+    if (!jit->dump) {
+      LOG_WARNING("jit_dump_block failed to open %s", jit->dump_path);
+      jit->dump_code = 0;
+      return;
+    }
 
-  char filename[PATH_MAX];
-  snprintf(filename, sizeof(filename), "%s" PATH_SEPARATOR "0x%08x.ir", irdir,
-           block->guest_addr);
+    LOG_INFO("dumping %s ir to %s", jit->tag, jit->dump_path);
+  }
 
-  FILE *file = fopen(filename, "w");
-  CHECK_NOTNULL(file);
-  jit_write_block(jit, block, ir, file);
-  fclose(file);
+  jit_dump_write(jit->dump, type, block->guest_addr, block->guest_size, ir);
 }
 
 static void jit_emit_callback(struct jit *jit, int type, uint32_t guest_addr,
@@ -296,6 +616,23 @@ static void jit_emit_callback(struct jit *jit, int type, uint32_t guest_addr,
     case JIT_EMIT_INSTR:
       block->source_map[guest_addr - block->guest_addr] = host_addr;
       break;
+
+    case JIT_EMIT_LINK:
+      block->link_addr = host_addr;
+      break;
+
+    case JIT_EMIT_SITE: {
+      struct jit_stub *stub = arena_alloc(jit->arena, sizeof(struct jit_stub));
+      stub->site = host_addr;
+      list_add(&block->stubs, &stub->it);
+    } break;
+
+    case JIT_EMIT_STUB: {
+      struct jit_stub *stub =
+          list_last_entry(&block->stubs, struct jit_stub, it);
+      CHECK(stub && !stub->stub);
+      stub->stub = host_addr;
+    } break;
   }
 }
 
@@ -318,73 +655,198 @@ static void jit_promote_fastmem(struct jit *jit, struct jit_block *block,
   }
 }
 
-void jit_compile_code(struct jit *jit, uint32_t guest_addr) {
-#if 0
-  LOG_INFO("jit_compile_block %s 0x%08x", jit->tag, guest_addr);
-#endif
+static void jit_promote_block(struct jit *jit, struct jit_block *block) {
+  /* the block is still executing, so it can't be freed here. invalidate it
+     just as a fastmem exception would, and it will be compiled at the next
+     tier the next time it's dispatched to */
+  block->tier = JIT_TIER_OPT;
 
-  /* analyze the guest code to get its extents */
-  int guest_size;
-  jit->frontend->analyze_code(jit->frontend, guest_addr, &guest_size);
+  jit_invalidate_block(jit, block, 1);
+}
 
-  /* create block */
-  struct jit_block *block = jit_alloc_block(jit, guest_addr, guest_size);
-  jit->curr_block = block;
+static void jit_instrument_block(struct jit *jit, struct jit_block *block,
+                                 struct ir *ir) {
+  struct ir_block *head = list_first_entry(&ir->blocks, struct ir_block, it);
 
-  /* if the block had previously been invalidated, finish removing it now */
-  struct jit_block *existing = jit_get_block(jit, guest_addr);
+  /* insert after the first guest marker, or ahead of everything when the
+     block doesn't begin with one */
+  struct ir_instr *after = NULL;
+  list_for_each_entry(instr, &head->instrs, struct ir_instr, it) {
+    if (instr->op == OP_SOURCE_INFO) {
+      after = instr;
+      break;
+    }
+  }
 
-  if (existing) {
-    /* if the block was invalidated due to a fastmem exception, persist its
-       fastmem state */
-    if (existing->state != JIT_STATE_INVALID) {
-      CHECK_EQ(block->guest_size, existing->guest_size);
-      memcpy(block->fastmem, existing->fastmem,
-             block->guest_size * sizeof(int8_t));
+  if (after) {
+    ir_set_current_instr(ir, after);
+  } else {
+    ir_set_current_block(ir, head);
+  }
+
+  /* total up the cycles of the block for the profile. note, this overcounts
+     traces which exit early */
+  block->num_cycles = 0;
+
+  list_for_each_entry(blk, &ir->blocks, struct ir_block, it) {
+    list_for_each_entry(instr, &blk->instrs, struct ir_instr, it) {
+      if (instr->op == OP_SOURCE_INFO) {
+        block->num_cycles += instr->arg[1]->i32;
+      }
     }
+  }
 
-    jit_free_block(jit, existing);
+  /* count each execution of the block, promoting first tier blocks the first
+     time they cross the threshold */
+  struct ir_value *counter = ir_alloc_ptr(ir, &block->num_execs);
+  struct ir_value *num_execs = ir_load_host(ir, counter, VALUE_I32);
+  num_execs = ir_add(ir, num_execs, ir_alloc_i32(ir, 1));
+  ir_store_host(ir, counter, num_execs);
+
+  if (block->tier != JIT_TIER_FAST) {
+    return;
   }
 
-  /* translate guest code into ir */
-  struct ir ir = {0};
-  ir.buffer = jit->ir_buffer;
-  ir.capacity = sizeof(jit->ir_buffer);
-  jit->frontend->translate_code(jit->frontend, guest_addr, guest_size, &ir);
+  struct ir_value *hot =
+      ir_cmp_eq(ir, num_execs, ir_alloc_i32(ir, JIT_HOT_THRESHOLD));
+  ir_call_cond_2(ir, hot, ir_alloc_ptr(ir, &jit_promote_block),
+                 ir_alloc_ptr(ir, jit), ir_alloc_ptr(ir, block));
+}
 
-  /* dump raw ir */
-  if (jit->dump_code) {
-    jit_dump_block(jit, "raw", block, &ir);
+/* records the time since start for the pass which just ran, along with the
+   instructions it removed. the ir is walked to count them outside of the
+   timed region, restarting the clock for the next pass */
+static void jit_record_pass(struct ir *ir, const char *pass, int64_t *start,
+                            int *num_instrs) {
+  int64_t elapsed = time_nanoseconds() - *start;
+  int n = ir_num_instrs(ir);
+  pass_stats_time(pass, elapsed, *num_instrs, n);
+  *num_instrs = n;
+  *start = time_nanoseconds();
+}
+
+static void jit_destroy_passes(struct jit_passes *passes) {
+  if (passes->ra) {
+    ra_destroy(passes->ra);
+  }
+
+  if (passes->dce) {
+    dce_destroy(passes->dce);
+  }
+
+  if (passes->cse) {
+    cse_destroy(passes->cse);
+  }
+
+  if (passes->esimp) {
+    esimp_destroy(passes->esimp);
+  }
+
+  if (passes->cprop) {
+    cprop_destroy(passes->cprop);
+  }
+
+  if (passes->licm) {
+    licm_destroy(passes->licm);
+  }
+
+  if (passes->lse) {
+    lse_destroy(passes->lse);
+  }
+
+  if (passes->cfa) {
+    cfa_destroy(passes->cfa);
+  }
+
+  memset(passes, 0, sizeof(*passes));
+}
+
+static void jit_create_passes(struct jit *jit, struct jit_passes *passes) {
+  passes->cfa = cfa_create();
+  passes->lse = lse_create();
+  passes->licm = licm_create();
+  passes->cprop = cprop_create();
+  passes->esimp = esimp_create();
+  passes->cse = cse_create();
+  passes->dce = dce_create();
+  passes->ra = ra_create(jit->backend->registers, jit->backend->num_registers,
+                         jit->backend->emitters, jit->backend->num_emitters);
+}
+
+static void jit_optimize_code(struct jit_passes *passes, struct ir *ir,
+                              int tier) {
+  int num_instrs = ir_num_instrs(ir);
+  int64_t start = time_nanoseconds();
+
+  cfa_run(passes->cfa, ir);
+  jit_record_pass(ir, "cfa", &start, &num_instrs);
+
+  /* the first tier only runs the cheap passes */
+  if (tier == JIT_TIER_OPT) {
+    lse_run(passes->lse, ir);
+    jit_record_pass(ir, "lse", &start, &num_instrs);
+    licm_run(passes->licm, ir);
+    jit_record_pass(ir, "licm", &start, &num_instrs);
   }
 
-  /* run optimization passes */
-  jit_promote_fastmem(jit, block, &ir);
-  cfa_run(jit->cfa, &ir);
-  lse_run(jit->lse, &ir);
-  cprop_run(jit->cprop, &ir);
-  esimp_run(jit->esimp, &ir);
-  dce_run(jit->dce, &ir);
-  ra_run(jit->ra, &ir);
+  cprop_run(passes->cprop, ir);
+  jit_record_pass(ir, "cprop", &start, &num_instrs);
+
+  if (tier == JIT_TIER_OPT) {
+    esimp_run(passes->esimp, ir);
+    jit_record_pass(ir, "esimp", &start, &num_instrs);
+    cse_run(passes->cse, ir);
+    jit_record_pass(ir, "cse", &start, &num_instrs);
+  }
+
+  dce_run(passes->dce, ir);
+  jit_record_pass(ir, "dce", &start, &num_instrs);
+}
+
+static void jit_allocate_registers(struct jit_passes *passes, struct ir *ir) {
+  int num_instrs = ir_num_instrs(ir);
+  int64_t start = time_nanoseconds();
+
+  ra_run(passes->ra, ir);
+  jit_record_pass(ir, "ra", &start, &num_instrs);
+}
+
+static void jit_assemble_code(struct jit *jit, struct jit_block *block,
+                              struct ir *ir) {
+  jit->curr_block = block;
+  block->link_addr = NULL;
 
   /* assemble the ir into native code */
-  int res = jit->backend->assemble_code(jit->backend, &ir, &block->host_addr,
-                                        &block->host_size,
-                                        (jit_emit_cb)jit_emit_callback, jit);
+  int64_t start = time_nanoseconds();
+  int res = jit->backend->assemble_code(
+      jit->backend, ir, &block->host_addr, &block->host_size,
+      &block->cold_addr, &block->cold_size, (jit_emit_cb)jit_emit_callback,
+      jit);
+  int64_t elapsed = time_nanoseconds() - start;
 
   if (!res) {
-    /* if the backend overflowed, completely free the cache and let dispatch
-       try to compile again */
-    LOG_INFO("backend overflow, resetting code cache");
-    jit_free_code(jit);
+    /* if the backend overflowed the current region, move on to the next one,
+       evicting the blocks it contains. the partially assembled block is
+       discarded, and dispatch will try to compile it again */
+    int next_region = (jit->code_region + 1) % JIT_CODE_REGIONS;
+    LOG_INFO("backend overflow, evicting code region %d", next_region);
+    jit_evict_region(jit, next_region);
+
+    jit_release_block(jit, block);
     return;
   }
 
   /* finish by adding code to caches */
   jit_finalize_block(jit, block);
+  prof_counter_add(COUNTER_jit_blocks, 1);
+
+  int num_instrs = ir_num_instrs(ir);
+  pass_stats_time("assemble", elapsed, num_instrs, num_instrs);
+  pass_stats_code(block->guest_size, block->host_size + block->cold_size);
 
   /* dump optimized ir */
   if (jit->dump_code) {
-    jit_dump_block(jit, "opt", block, &ir);
+    jit_dump_block(jit, JIT_DUMP_OPT, block, ir);
   }
 
   /* write out to perf map if enabled */
@@ -392,7 +854,484 @@ void jit_compile_code(struct jit *jit, uint32_t guest_addr) {
     fprintf(jit->perf_map, "%" PRIxPTR " %x %s_0x%08x\n",
             (uintptr_t)block->host_addr, block->host_size, jit->tag,
             block->guest_addr);
+
+    if (block->cold_size) {
+      fprintf(jit->perf_map, "%" PRIxPTR " %x %s_0x%08x_cold\n",
+              (uintptr_t)block->cold_addr, block->cold_size, jit->tag,
+              block->guest_addr);
+    }
+  }
+
+  if (jit->perf) {
+    jit_perf_add_block(jit->perf, block);
+  }
+}
+
+static void jit_interpret_code(struct jit *jit, uint32_t guest_addr,
+                               int guest_size) {
+  struct jit_frontend *frontend = jit->frontend;
+  struct jit_guest *guest = frontend->guest;
+  uint8_t *ctx = guest->ctx;
+  uint32_t *pc = (uint32_t *)(ctx + guest->offset_pc);
+  int32_t *run_cycles = (int32_t *)(ctx + guest->offset_cycles);
+  int32_t *ran_instrs = (int32_t *)(ctx + guest->offset_instrs);
+
+  /* run the block through the fallback handlers until it either branches
+     backwards or leaves its extents, at which point control is returned to
+     dispatch (which checks for remaining cycles and pending interrupts) */
+  uint32_t end_addr = guest_addr + guest_size;
+  uint32_t addr = *pc;
+  uint32_t last_addr;
+
+  do {
+    uint32_t data;
+    const struct jit_opdef *def = frontend->fetch_op(frontend, addr, &data);
+    def->fallback(guest, addr, data);
+
+    *run_cycles -= def->cycles;
+    *ran_instrs += 1;
+
+    last_addr = addr;
+    addr = *pc;
+  } while (addr > last_addr && addr < end_addr);
+}
+
+static int jit_is_async(struct jit *jit) {
+  return jit->num_workers > 0;
+}
+
+static struct jit_block *jit_get_pending(struct jit *jit, uint32_t guest_addr,
+                                         uint32_t guest_mode) {
+  /* there are at most JIT_MAX_JOBS blocks in flight. blocks invalidated while
+     in flight are only waiting to be discarded */
+  list_for_each_entry(block, &jit->pending, struct jit_block, it) {
+    if (!jit_is_stale(jit, block) &&
+        jit_block_matches(block, guest_addr, guest_mode)) {
+      return block;
+    }
   }
+
+  return NULL;
+}
+
+static void jit_queue_job(struct jit *jit, struct jit_job *job) {
+  mutex_lock(jit->job_mutex);
+  list_add(&jit->queued_jobs, &job->it);
+  cond_signal(jit->job_cond);
+  mutex_unlock(jit->job_mutex);
+}
+
+static struct jit_job *jit_alloc_job(struct jit *jit) {
+  struct jit_job *job =
+      list_first_entry(&jit->free_jobs, struct jit_job, it);
+
+  if (!job) {
+    return NULL;
+  }
+
+  list_remove(&jit->free_jobs, &job->it);
+
+  job->block = NULL;
+  job->generation = jit->generation;
+  job->optimize = 0;
+  job->save = 0;
+
+  struct ir *ir = job->ir;
+  memset(ir, 0, sizeof(*ir));
+  ir->buffer = job->ir_buffer;
+  ir->capacity = sizeof(jit->ir_buffer);
+
+  return job;
+}
+
+static void jit_free_job(struct jit *jit, struct jit_job *job) {
+  list_add(&jit->free_jobs, &job->it);
+}
+
+static void jit_finish_jobs(struct jit *jit) {
+  while (1) {
+    mutex_lock(jit->job_mutex);
+    struct jit_job *job =
+        list_first_entry(&jit->done_jobs, struct jit_job, it);
+    if (job) {
+      list_remove(&jit->done_jobs, &job->it);
+    }
+    mutex_unlock(jit->job_mutex);
+
+    if (!job) {
+      break;
+    }
+
+    struct jit_block *block = job->block;
+
+    /* discard the job if the code was invalidated while it was in flight */
+    if (job->generation != jit->generation || jit_is_stale(jit, block)) {
+      list_remove(&jit->pending, &block->it);
+      jit_release_block(jit, block);
+      jit_free_job(jit, job);
+      continue;
+    }
+
+    /* the persistent cache is only touched from this thread. persist the
+       optimized ir and send the job back for register allocation */
+    if (job->save) {
+      jit_cache_save_block(jit->cache, block, job->ir);
+      job->save = 0;
+      jit_queue_job(jit, job);
+      continue;
+    }
+
+    list_remove(&jit->pending, &block->it);
+    jit_assemble_code(jit, block, job->ir);
+    jit_free_job(jit, job);
+  }
+}
+
+static void *jit_worker_thread(void *data) {
+  struct jit_worker *worker = data;
+  struct jit *jit = worker->jit;
+
+  configure_thread(THREAD_ROLE_WORKER);
+
+  while (1) {
+    mutex_lock(jit->job_mutex);
+
+    while (jit->worker_running && list_empty(&jit->queued_jobs)) {
+      cond_wait(jit->job_cond, jit->job_mutex);
+    }
+
+    if (!jit->worker_running) {
+      mutex_unlock(jit->job_mutex);
+      break;
+    }
+
+    struct jit_job *job =
+        list_first_entry(&jit->queued_jobs, struct jit_job, it);
+    list_remove(&jit->queued_jobs, &job->it);
+
+    mutex_unlock(jit->job_mutex);
+
+    /* only the ir owned by the job is accessed here, everything touching the
+       guest or the code cache runs on the emulation thread */
+    if (job->optimize) {
+      jit_optimize_code(&worker->passes, job->ir, job->block->tier);
+      job->optimize = 0;
+    }
+
+    if (!job->save) {
+      jit_allocate_registers(&worker->passes, job->ir);
+    }
+
+    mutex_lock(jit->job_mutex);
+    list_add(&jit->done_jobs, &job->it);
+    mutex_unlock(jit->job_mutex);
+  }
+
+  return NULL;
+}
+
+static void jit_destroy_workers(struct jit *jit) {
+  mutex_lock(jit->job_mutex);
+  jit->worker_running = 0;
+  cond_broadcast(jit->job_cond);
+  mutex_unlock(jit->job_mutex);
+
+  for (int i = 0; i < jit->num_workers; i++) {
+    struct jit_worker *worker = &jit->workers[i];
+    void *result;
+    thread_join(worker->thread, &result);
+    jit_destroy_passes(&worker->passes);
+  }
+  jit->num_workers = 0;
+
+  /* free any blocks still in flight */
+  for (int i = 0; i < JIT_MAX_JOBS; i++) {
+    struct jit_job *job = &jit->jobs[i];
+    free(job->ir);
+    free(job->ir_buffer);
+    prof_counter_add(COUNTER_mem_jit_ir, -(int64_t)sizeof(jit->ir_buffer));
+  }
+
+  list_for_each_entry_safe(block, &jit->pending, struct jit_block, it) {
+    list_remove(&jit->pending, &block->it);
+    jit_release_block(jit, block);
+  }
+
+  mutex_destroy(jit->job_mutex);
+  cond_destroy(jit->job_cond);
+}
+
+static void jit_create_workers(struct jit *jit, int num_workers) {
+  for (int i = 0; i < JIT_MAX_JOBS; i++) {
+    struct jit_job *job = &jit->jobs[i];
+    job->ir = calloc(1, sizeof(struct ir));
+    job->ir_buffer = malloc(sizeof(jit->ir_buffer));
+    prof_counter_add(COUNTER_mem_jit_ir, sizeof(jit->ir_buffer));
+    list_add(&jit->free_jobs, &job->it);
+  }
+
+  jit->job_mutex = mutex_create();
+  jit->job_cond = cond_create();
+  jit->worker_running = 1;
+
+  for (int i = 0; i < num_workers; i++) {
+    struct jit_worker *worker = &jit->workers[i];
+    worker->jit = jit;
+    jit_create_passes(jit, &worker->passes);
+    worker->thread = thread_create(&jit_worker_thread, "jit_worker", worker);
+    CHECK_NOTNULL(worker->thread);
+    jit->num_workers++;
+  }
+}
+
+/* compile the block at guest_addr. dispatch compiles blocks as they're about
+   to be executed, interpreting them while they're compiled in the background.
+   the prescan compiles blocks ahead of time, nothing is interpreted and 0 is
+   returned when there is no room to queue the block */
+static int jit_compile(struct jit *jit, uint32_t guest_addr, int prescan) {
+#if 0
+  LOG_INFO("jit_compile_block %s 0x%08x", jit->tag, guest_addr);
+#endif
+
+  uint32_t guest_mode = jit_current_mode(jit);
+
+  /* the block may be one of those just finished in the background */
+  if (jit_is_async(jit)) {
+    jit_finish_jobs(jit);
+  }
+
+  /* dispatch also ends up here when a variant of the block for another mode
+     is cached. if the variant for the current mode is still valid, switch
+     dispatch back to it instead of compiling again */
+  struct jit_block *existing = jit_get_block(jit, guest_addr, guest_mode);
+
+  if (existing && !jit_is_stale(jit, existing)) {
+    if (!prescan) {
+      jit->backend->invalidate_code(jit->backend, guest_addr);
+      jit->backend->cache_code(jit->backend, guest_addr, existing->host_addr);
+    }
+    return 1;
+  }
+
+  /* if the block is still in flight, interpret it in the meantime */
+  if (jit_is_async(jit)) {
+    struct jit_block *pending = jit_get_pending(jit, guest_addr, guest_mode);
+    if (pending) {
+      if (!prescan) {
+        jit_interpret_code(jit, guest_addr, pending->guest_size);
+      }
+      return 1;
+    }
+  }
+
+  /* blocks being recompiled keep their tier, everything else starts at the
+     first tier */
+  int tier = OPTION_jit_tiered ? JIT_TIER_FAST : JIT_TIER_OPT;
+
+  if (existing && existing->state != JIT_STATE_INVALID) {
+    tier = existing->tier;
+  }
+
+  /* only form traces for fully optimized code */
+  int flags = 0;
+
+  if (OPTION_jit_traces && tier == JIT_TIER_OPT) {
+    flags |= JIT_ANALYZE_TRACE;
+  }
+
+  /* analyze the guest code to get its extents */
+  int guest_size;
+  jit->frontend->analyze_code(jit->frontend, guest_addr, flags, &guest_size);
+
+  /* when compiling in the background, interpret the block if there is no
+     room to queue it. it'll be queued on a later run through dispatch. while
+     any breakpoints are set, code is compiled synchronously rather than
+     interpreted in the meantime */
+  struct jit_job *job = NULL;
+
+  if (jit_is_async(jit) && !jit->frontend->guest->num_breakpoints) {
+    job = jit_alloc_job(jit);
+
+    if (!job) {
+      if (!prescan) {
+        jit_interpret_code(jit, guest_addr, guest_size);
+      }
+      return 0;
+    }
+  }
+
+  /* create block */
+  struct jit_block *block = jit_alloc_block(jit, guest_addr, guest_size);
+  block->tier = tier;
+
+  if (jit->frontend->code_extent) {
+    block->guest_extent =
+        jit->frontend->code_extent(jit->frontend, guest_addr, guest_size);
+  }
+  block->guest_mode = JIT_MODE_ANY;
+
+  if (jit->frontend->uses_mode &&
+      jit->frontend->uses_mode(jit->frontend, guest_addr, guest_size)) {
+    block->guest_mode = guest_mode;
+  }
+
+  /* if the block had previously been invalidated, finish removing it now */
+  int recompile = 0;
+
+  if (existing) {
+    recompile = existing->state == JIT_STATE_RECOMPILE;
+
+    /* if the block was invalidated due to a fastmem exception or promotion,
+       persist its fastmem state. note, a block promoted to a trace covers
+       more code than the original, extending out past its end */
+    if (existing->state != JIT_STATE_INVALID) {
+      CHECK_GE(block->guest_size, existing->guest_size);
+      memcpy(block->fastmem, existing->fastmem,
+             existing->guest_size * sizeof(int8_t));
+      block->num_execs = existing->num_execs;
+    }
+
+    jit_free_block(jit, existing);
+  }
+
+  /* jobs compile into their own ir buffer */
+  struct ir sync_ir = {0};
+  struct ir *ir = &sync_ir;
+
+  if (job) {
+    job->block = block;
+    ir = job->ir;
+  } else {
+    ir->buffer = jit->ir_buffer;
+    ir->capacity = sizeof(jit->ir_buffer);
+  }
+
+  /* try to reload the optimized ir from the persistent cache. blocks being
+     recompiled due to a fastmem exception have new fastmem flags, and must
+     go through the full pipeline. blocks being promoted already missed the
+     cache on their first compile. the cache isn't keyed by mode, so only
+     blocks which don't depend on it are persisted. neither are blocks which
+     may have breakpoints compiled into them, or which were translated
+     through the guest's mmu */
+  int cached = 0;
+  int persist = jit->cache && block->guest_mode == JIT_MODE_ANY &&
+                !jit->frontend->guest->num_breakpoints &&
+                !jit->frontend->guest->mmu_enabled;
+
+  if (persist && !recompile) {
+    uint8_t *buffer = ir->buffer;
+    int capacity = ir->capacity;
+
+    cached = jit_cache_load_block(jit->cache, block, ir);
+
+    /* discard any partially parsed ir */
+    if (!cached) {
+      memset(ir, 0, sizeof(*ir));
+      ir->buffer = buffer;
+      ir->capacity = capacity;
+    }
+
+    /* cached ir is always fully optimized */
+    if (cached) {
+      block->tier = JIT_TIER_OPT;
+    }
+  }
+
+  if (!cached) {
+    /* translate guest code into ir */
+    jit->frontend->translate_code(jit->frontend, guest_addr, guest_size, ir);
+
+    /* dump raw ir */
+    if (jit->dump_code) {
+      jit_dump_block(jit, JIT_DUMP_RAW, block, ir);
+    }
+
+    jit_promote_fastmem(jit, block, ir);
+  }
+
+  /* first tier blocks are instrumented to detect when they're hot, all blocks
+     are instrumented while profiling */
+  if ((!cached && block->tier == JIT_TIER_FAST) || jit->profile) {
+    jit_instrument_block(jit, block, ir);
+  }
+
+  /* only fully optimized ir is persisted. the profile's instrumentation
+     references the block, so it's never persisted */
+  int save = !cached && persist && block->tier == JIT_TIER_OPT && !jit->profile;
+
+  /* hand the remaining passes off to the background thread, interpreting the
+     block until it's ready */
+  if (job) {
+    job->optimize = !cached;
+    job->save = save;
+    list_add(&jit->pending, &block->it);
+    jit_queue_job(jit, job);
+
+    if (!prescan) {
+      jit_interpret_code(jit, guest_addr, guest_size);
+    }
+    return 1;
+  }
+
+  if (!cached) {
+    /* run optimization passes */
+    jit_optimize_code(&jit->passes, ir, block->tier);
+
+    /* persist the optimized ir before register allocation rewrites it */
+    if (save) {
+      jit_cache_save_block(jit->cache, block, ir);
+    }
+  }
+
+  jit_allocate_registers(&jit->passes, ir);
+
+  jit_assemble_code(jit, block, ir);
+
+  return 1;
+}
+
+void jit_compile_code(struct jit *jit, uint32_t guest_addr) {
+  /* only the time the guest is stalled for is counted, optimizing on the
+     background thread isn't */
+  PROF_ENTER("jit_compile_code");
+  int64_t start = time_nanoseconds();
+  jit_compile(jit, guest_addr, 0);
+  int64_t elapsed = time_nanoseconds() - start;
+  jit->compile_time += elapsed;
+  prof_counter_add(COUNTER_jit_compile_time, elapsed);
+  PROF_LEAVE();
+}
+
+void jit_prescan_code(struct jit *jit, uint32_t guest_addr) {
+  if (!jit->prescan) {
+    return;
+  }
+
+  jit_prescan_walk(jit->prescan, guest_addr);
+}
+
+static void jit_compile_prescan(struct jit *jit) {
+  /* compile the queued blocks before running the guest. when compiling in the
+     background, only as many are compiled as there are free jobs, the rest
+     are compiled on later runs while the guest starts up */
+  PROF_ENTER("jit_compile_prescan");
+  int64_t start = time_nanoseconds();
+
+  uint32_t guest_addr;
+
+  while (jit_prescan_peek(jit->prescan, &guest_addr)) {
+    if (!jit_compile(jit, guest_addr, 1)) {
+      break;
+    }
+
+    jit_prescan_pop(jit->prescan);
+    prof_counter_add(COUNTER_jit_prescan_blocks, 1);
+  }
+
+  int64_t elapsed = time_nanoseconds() - start;
+  jit->compile_time += elapsed;
+  prof_counter_add(COUNTER_jit_compile_time, elapsed);
+  PROF_LEAVE();
 }
 
 static int jit_handle_exception(void *data, struct exception_state *ex) {
@@ -410,7 +1349,7 @@ static int jit_handle_exception(void *data, struct exception_state *ex) {
     return 0;
   }
 
-  /* disable fastmem optimizations for it on future compiles */
+  /* find the guest instruction the faulting host instruction belongs to */
   int found = 0;
   for (int i = 0; i < block->guest_size; i++) {
     /* ignore empty entries */
@@ -422,6 +1361,25 @@ static int jit_handle_exception(void *data, struct exception_state *ex) {
     }
     found = i;
   }
+  ex->guest_pc = block->guest_addr + found;
+
+  /* if the access has an out-of-line slow path, patch it to always jump there
+     instead of recompiling the entire block */
+  list_for_each_entry(stub, &block->stubs, struct jit_stub, it) {
+    if ((uintptr_t)stub->site != ex->pc) {
+      continue;
+    }
+
+    CHECK(!stub->patched);
+    jit->backend->patch_edge(jit->backend, stub->site, stub->stub);
+    stub->patched = 1;
+
+    prof_counter_add(COUNTER_fastmem_patches, 1);
+
+    return 1;
+  }
+
+  /* disable fastmem optimizations for it on future compiles */
   block->fastmem[found] = 0;
 
   /* invalidate the block so it's recompiled on the next access */
@@ -431,40 +1389,177 @@ static int jit_handle_exception(void *data, struct exception_state *ex) {
 }
 
 void jit_run(struct jit *jit, int cycles) {
+  if (jit_is_async(jit)) {
+    jit_finish_jobs(jit);
+  }
+
+  if (jit->prescan) {
+    jit_compile_prescan(jit);
+  }
+
   jit->backend->run_code(jit->backend, cycles);
 }
 
+#ifdef HAVE_IMGUI
+#define JIT_PROFILE_TOP 32
+
+enum {
+  JIT_PROFILE_SORT_EXECS,
+  JIT_PROFILE_SORT_CYCLES,
+};
+
+static int64_t jit_profile_weight(struct jit *jit, struct jit_block *block) {
+  if (jit->profile_sort == JIT_PROFILE_SORT_CYCLES) {
+    return (int64_t)block->num_execs * block->num_cycles;
+  }
+  return block->num_execs;
+}
+
+void jit_profile_debug_menu(struct jit *jit) {
+  char title[64];
+  snprintf(title, sizeof(title), "%s block profile", jit->tag);
+
+  if (igBegin(title, NULL, 0)) {
+    igRadioButton("execs", &jit->profile_sort, JIT_PROFILE_SORT_EXECS);
+    igSameLine(0.0f, -1.0f);
+    igRadioButton("cycles", &jit->profile_sort, JIT_PROFILE_SORT_CYCLES);
+
+    /* keep the hottest blocks sorted in a fixed size table */
+    struct jit_block *top[JIT_PROFILE_TOP];
+    int num_top = 0;
+    int64_t total_cycles = 0;
+
+    list_for_each_entry(block, &jit->blocks, struct jit_block, it) {
+      int64_t weight = jit_profile_weight(jit, block);
+      total_cycles += (int64_t)block->num_execs * block->num_cycles;
+
+      if (!weight) {
+        continue;
+      }
+
+      int i = MIN(num_top, JIT_PROFILE_TOP - 1);
+      if (num_top == JIT_PROFILE_TOP &&
+          weight <= jit_profile_weight(jit, top[i])) {
+        continue;
+      }
+
+      for (; i > 0 && weight > jit_profile_weight(jit, top[i - 1]); i--) {
+        top[i] = top[i - 1];
+      }
+      top[i] = block;
+      num_top = MIN(num_top + 1, JIT_PROFILE_TOP);
+    }
+
+    igColumns(5, NULL, 0);
+
+    igText("addr");
+    igNextColumn();
+    igText("tier");
+    igNextColumn();
+    igText("execs");
+    igNextColumn();
+    igText("cycles");
+    igNextColumn();
+    igText("%% cycles");
+    igNextColumn();
+
+    for (int i = 0; i < num_top; i++) {
+      struct jit_block *block = top[i];
+      int64_t cycles = (int64_t)block->num_execs * block->num_cycles;
+
+      /* clicking a block copies its address, to look up in the dump */
+      char label[32];
+      snprintf(label, sizeof(label), "0x%08x", block->guest_addr);
+
+      if (igSelectable(label, 0, ImGuiSelectableFlags_SpanAllColumns,
+                       (struct ImVec2){0.0f, 0.0f})) {
+        igSetClipboardText(label);
+      }
+
+      if (igIsItemHovered()) {
+        if (jit->dump) {
+          igSetTooltip("dumped to %s", jit->dump_path);
+        } else {
+          igSetTooltip("start dumping code to dump the block's ir");
+        }
+      }
+      igNextColumn();
+      igText(block->tier == JIT_TIER_FAST ? "fast" : "opt");
+      igNextColumn();
+      igText("%d", block->num_execs);
+      igNextColumn();
+      igText("%" PRId64, cycles);
+      igNextColumn();
+      igText("%.2f", total_cycles ? cycles * 100.0f / total_cycles : 0.0f);
+      igNextColumn();
+    }
+
+    igEnd();
+  }
+}
+#endif
+
+int jit_export_samples(struct jit *jit) {
+  if (!jit->sampler || !jit_sampler_num_samples(jit->sampler)) {
+    return 0;
+  }
+
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s" PATH_SEPARATOR "%s.samples.txt",
+           fs_appdir(), jit->tag);
+
+  return jit_sampler_export(jit->sampler, path, OPTION_jit_sample_map);
+}
+
 void jit_destroy(struct jit *jit) {
+  if (jit_is_async(jit)) {
+    jit_destroy_workers(jit);
+  }
+
   if (OPTION_perf) {
     if (jit->perf_map) {
       fclose(jit->perf_map);
     }
   }
 
+  if (jit->perf) {
+    jit_perf_destroy(jit->perf);
+  }
+
+  if (jit->sampler) {
+    jit_export_samples(jit);
+    jit_sampler_destroy(jit->sampler);
+  }
+
   if (jit->backend) {
     jit_free_code(jit);
   }
 
-  if (jit->dce) {
-    dce_destroy(jit->dce);
+  if (jit->backend && jit->backend->code) {
+    prof_counter_add(COUNTER_mem_jit_code, -(int64_t)jit->backend->code_size);
   }
 
-  if (jit->esimp) {
-    esimp_destroy(jit->esimp);
-  }
+  prof_counter_add(COUNTER_mem_jit_ir, -(int64_t)sizeof(jit->ir_buffer));
 
-  if (jit->cprop) {
-    cprop_destroy(jit->cprop);
+  free(jit->reverse_map);
+  free(jit->cold_map);
+  free(jit->block_map);
+  arena_destroy(jit->arena);
+
+  if (jit->cache) {
+    jit_cache_destroy(jit->cache);
   }
 
-  if (jit->lse) {
-    lse_destroy(jit->lse);
+  if (jit->prescan) {
+    jit_prescan_destroy(jit->prescan);
   }
 
-  if (jit->cfa) {
-    cfa_destroy(jit->cfa);
+  if (jit->dump) {
+    jit_dump_close(jit->dump);
   }
 
+  jit_destroy_passes(&jit->passes);
+
   if (jit->exc_handler) {
     exception_handler_remove(jit->exc_handler);
   }
@@ -480,18 +1575,62 @@ struct jit *jit_create(const char *tag, struct jit_frontend *frontend,
   jit->frontend = frontend;
   jit->backend = backend;
 
+  /* create block storage and lookup maps */
+  jit->arena = arena_create(JIT_ARENA_CHUNK_SIZE);
+  jit_block_map_grow(jit);
+
+  if (jit->backend->code) {
+    jit->reverse_map_size =
+        (jit->backend->code_size >> JIT_REVERSE_PAGE_SHIFT) + 1;
+    jit->reverse_map = calloc(jit->reverse_map_size, sizeof(struct list));
+    jit->cold_map = calloc(jit->reverse_map_size, sizeof(struct list));
+
+    int region_size = jit->backend->code_size / JIT_CODE_REGIONS;
+    jit->code_region_size = ALIGN_DOWN(region_size, 1 << JIT_REVERSE_PAGE_SHIFT);
+
+    prof_counter_add(COUNTER_mem_jit_code, jit->backend->code_size);
+  }
+
+  prof_counter_add(COUNTER_mem_jit_ir, sizeof(jit->ir_buffer));
+
+  jit_reset_region(jit, 0);
+
   /* create optimization passes */
-  jit->cfa = cfa_create();
-  jit->lse = lse_create();
-  jit->cprop = cprop_create();
-  jit->esimp = esimp_create();
-  jit->dce = dce_create();
-  jit->ra = ra_create(jit->backend->registers, jit->backend->num_registers,
-                      jit->backend->emitters, jit->backend->num_emitters);
+  jit_create_passes(jit, &jit->passes);
+
+  /* compile code in the background if enabled, with jit_async giving the
+     number of worker threads. the interpreter fallback relies on dispatch
+     calling back into jit_compile_code, which backends without an assembler
+     never do */
+  if (OPTION_jit_async > 0 && jit->backend->assemble_code) {
+    jit_create_workers(jit, MIN(OPTION_jit_async, JIT_MAX_WORKERS));
+  }
 
   /* setup exception handler to deal with self-modifying code and fastmem
-     related exceptions */
-  jit->exc_handler = exception_handler_add(jit, &jit_handle_exception);
+     related exceptions. blocks only fault inside of the code buffer, so the
+     handler owns the exceptions raised there. backends without a code buffer
+     never fault */
+  if (jit->backend->code) {
+    uintptr_t code_begin = (uintptr_t)jit->backend->code;
+    uintptr_t code_end = code_begin + jit->backend->code_size;
+    jit->exc_handler =
+        exception_handler_add(jit->tag, jit, &jit_handle_exception);
+    exception_handler_add_range(jit->exc_handler, &jit->exc_range, EX_RANGE_PC,
+                                code_begin, code_end);
+  }
+
+  /* load persistent code cache if enabled */
+  if (OPTION_jit_cache) {
+    jit->cache = jit_cache_create(jit);
+  }
+
+  /* compile code reachable from loaded binaries ahead of time if enabled.
+     like background compilation, this relies on a backend with an assembler,
+     and a frontend able to find the targets of its branches */
+  if (OPTION_jit_prescan && jit->backend->assemble_code &&
+      jit->frontend->branch_targets) {
+    jit->prescan = jit_prescan_create(jit->frontend, OPTION_jit_prescan);
+  }
 
   /* open perf map if enabled */
   if (OPTION_perf) {
@@ -504,5 +1643,15 @@ struct jit *jit_create(const char *tag, struct jit_frontend *frontend,
 #endif
   }
 
+  /* open perf jitdump if enabled */
+  if (OPTION_perf_jitdump) {
+    jit->perf = jit_perf_create(jit);
+  }
+
+  /* start sampling the guest pc if enabled */
+  if (OPTION_jit_sample_interval) {
+    jit->sampler = jit_sampler_create(jit, OPTION_jit_sample_interval);
+  }
+
   return jit;
 }
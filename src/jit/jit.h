@@ -2,15 +2,24 @@
 #define JIT_H
 
 #include <stdio.h>
+#include "core/exception_handler.h"
+#include "core/filesystem.h"
+#include "core/hash.h"
 #include "core/list.h"
-#include "core/rb_tree.h"
+#include "core/thread.h"
 
 struct address_space;
+struct arena;
 struct cfa;
 struct cprop;
 struct dce;
 struct ir;
+struct jit_cache;
+struct jit_dump;
+struct jit_perf;
+struct jit_prescan;
 struct lse;
+struct licm;
 struct ra;
 struct val;
 
@@ -20,12 +29,37 @@ enum {
   JIT_STATE_RECOMPILE,
 };
 
+enum {
+  /* cheap passes only, instrumented to detect hot blocks */
+  JIT_TIER_FAST,
+  /* full optimization pipeline */
+  JIT_TIER_OPT,
+};
+
+/* mode of blocks whose translation doesn't depend on the guest mode */
+#define JIT_MODE_ANY 0xffffffff
+
 struct jit_block {
   int state;
 
-  /* address of source block in guest memory */
+  /* optimization tier the block is compiled at */
+  int tier;
+
+  /* number of times the block has executed. only counted for first tier
+     blocks, or for every block while profiling */
+  int32_t num_execs;
+
+  /* guest cycles spent by each execution of the block */
+  int num_cycles;
+
+  /* address of source block in guest memory. the extent also covers any
+     guest data the translation depends on, see jit_frontend.code_extent */
   uint32_t guest_addr;
   int guest_size;
+  int guest_extent;
+
+  /* guest mode the block was compiled for, see jit_frontend.current_mode */
+  uint32_t guest_mode;
 
   /* maps guest instructions to host instructions */
   void **source_map;
@@ -37,13 +71,33 @@ struct jit_block {
   uint8_t *host_addr;
   int host_size;
 
+  /* rarely run paths the backend moved out of the block's code, within the
+     same code region */
+  uint8_t *cold_addr;
+  int cold_size;
+
+  /* entry point skipping the block's cycle and interrupt checks, branches
+     linked from blocks at lower guest addresses jump here instead */
+  uint8_t *link_addr;
+
   /* edges to other blocks */
   struct list in_edges;
   struct list out_edges;
 
-  /* lookup map iterators */
-  struct rb_node it;
-  struct rb_node rit;
+  /* out-of-line slow paths for the block's fastmem accesses */
+  struct list stubs;
+
+  /* iterator for the block list, or the pending list while in flight */
+  struct list_node it;
+
+  /* iterators for the reverse map pages this block's host code and cold
+     code begin in */
+  struct list_node rit;
+  struct list_node crit;
+
+  /* iterator for the code page map bucket of the guest page this block
+     begins in */
+  struct list_node pit;
 };
 
 struct jit_edge {
@@ -61,34 +115,142 @@ struct jit_edge {
   struct list_node out_it;
 };
 
-struct jit {
-  char tag[32];
+struct jit_stub {
+  /* location of the fastmem access and its slow path in host memory */
+  void *site;
+  void *stub;
 
-  struct jit_frontend *frontend;
-  struct jit_backend *backend;
-  struct exception_handler *exc_handler;
+  /* has the access been patched to jump to its slow path */
+  int patched;
+
+  /* iterator for the block's stub list */
+  struct list_node it;
+};
+
+/* blocks compiled on background threads are queued up as jobs, each with
+   their own ir buffer */
+#define JIT_MAX_JOBS 8
+#define JIT_MAX_WORKERS 4
+
+struct jit_job {
+  struct jit_block *block;
+
+  /* value of jit->generation when the job was queued, used to discard the job
+     if the code cache has since been invalidated */
+  int generation;
+
+  /* work remaining for the background thread */
+  int optimize;
+  int save;
+
+  struct ir *ir;
+  uint8_t *ir_buffer;
 
-  /* passes */
+  struct list_node it;
+};
+
+/* the passes keep scratch state between runs, each thread optimizing code
+   runs its own instance of them */
+struct jit_passes {
   struct cfa *cfa;
   struct lse *lse;
+  struct licm *licm;
   struct cprop *cprop;
   struct esimp *esimp;
+  struct cse *cse;
   struct dce *dce;
   struct ra *ra;
+};
+
+struct jit_worker {
+  struct jit *jit;
+  thread_t thread;
+  struct jit_passes passes;
+};
+
+struct jit {
+  char tag[32];
+
+  /* total time the guest has been stalled compiling code, letting the time
+     spent running the guest be measured separately */
+  int64_t compile_time;
+
+  struct jit_frontend *frontend;
+  struct jit_backend *backend;
+  struct exception_handler *exc_handler;
+  struct exception_range exc_range;
+
+  /* passes run by blocks compiled on the emulation thread */
+  struct jit_passes passes;
 
   /* scratch compilation buffer */
   uint8_t ir_buffer[1024 * 1024 * 2];
 
-  /* compiled blocks */
+  /* compiled blocks. blocks are looked up by guest address through an open
+     addressing hash table, and by host address through a table with a list
+     of blocks per page of the backend's code buffer. blocks and their edges
+     are allocated from the arena */
   struct jit_block *curr_block;
-  struct rb_tree blocks;
-  struct rb_tree reverse_blocks;
+  struct arena *arena;
+  struct list blocks;
+  struct jit_block **block_map;
+  int block_map_size;
+  int num_blocks;
+  struct list *reverse_map;
+  struct list *cold_map;
+  int reverse_map_size;
+  int max_host_pages;
+  int max_cold_pages;
+
+  /* compiled blocks hashed by the guest page they begin in, used to find the
+     blocks overlapping a write to guest memory */
+  DECLARE_HASHTABLE(code_pages, 12);
+  int max_guest_pages;
+
+  /* the backend's code buffer is split into regions, which are filled and
+     evicted in fifo order when assembly overflows */
+  int code_region;
+  int code_region_size;
+
+  /* background compilation. blocks are owned by the pending list while their
+     job is in flight, and are interpreted until the job is finished. workers
+     only touch the ir owned by their job, finished jobs are assembled and
+     published to the code cache on the emulation thread */
+  struct jit_worker workers[JIT_MAX_WORKERS];
+  int num_workers;
+  mutex_t job_mutex;
+  cond_t job_cond;
+  int worker_running;
+  int generation;
+  struct jit_job jobs[JIT_MAX_JOBS];
+  struct list free_jobs;
+  struct list queued_jobs;
+  struct list done_jobs;
+  struct list pending;
+
+  /* persistent cache of optimized ir */
+  struct jit_cache *cache;
+
+  /* blocks queued to be compiled ahead of their execution */
+  struct jit_prescan *prescan;
 
   /* compiled block perf map */
   FILE *perf_map;
 
-  /* dump ir to application directory as blocks compile */
+  /* compiled block perf jitdump */
+  struct jit_perf *perf;
+
+  /* guest pc sampling profiler */
+  struct jit_sampler *sampler;
+
+  /* dump ir to a file in the application directory as blocks compile */
   int dump_code;
+  struct jit_dump *dump;
+  char dump_path[PATH_MAX];
+
+  /* count the executions of every block, see jit_profile_debug_menu */
+  int profile;
+  int profile_sort;
 };
 
 struct jit *jit_create(const char *tag, struct jit_frontend *frontend,
@@ -98,8 +260,19 @@ void jit_destroy(struct jit *jit);
 void jit_run(struct jit *jit, int cycles);
 
 void jit_compile_code(struct jit *jit, uint32_t guest_addr);
+/* queue up the code reachable from guest_addr to be compiled before the guest
+   next runs, e.g. the entry point of a freshly loaded binary */
+void jit_prescan_code(struct jit *jit, uint32_t guest_addr);
 void jit_link_code(struct jit *jit, void *code, uint32_t target);
 void jit_invalidate_code(struct jit *jit);
+void jit_invalidate_range(struct jit *jit, uint32_t addr, int size);
 void jit_free_code(struct jit *jit);
 
+/* write the guest pc samples out to <appdir>/<tag>.samples.txt */
+int jit_export_samples(struct jit *jit);
+
+#ifdef HAVE_IMGUI
+void jit_profile_debug_menu(struct jit *jit);
+#endif
+
 #endif
@@ -9,23 +9,27 @@ struct exception_state;
 struct jit_block;
 struct jit_guest;
 
-/* macro to help declare a code buffer for the backends to use
-
-   note, the code buffer needs to be placed in the data segment (as opposed to
-   allocating on the heap) to keep it within 2 GB of the code segment, enabling
-   the x64 backend to use RIP-relative offsets when calling functions
-
-   further, the code buffer needs to be no greater than 1 MB in size so the a64
-   backend can use conditional branches to thunks without trampolining
-
-   finally, the code buffer needs to be aligned to a 4kb page so it's easy to
-   mprotect */
+/* default size of the code buffer each backend allocates for itself. every
+   instance owns its buffer, so multiple guests of the same type can coexist
+   in one process
+
+   note, the x64 backend searches for free pages within 2 GB of the code
+   segment, enabling it to use RIP-relative offsets when calling functions.
+   the a64 backend's buffer needs to be no greater than 1 MB in size so it can
+   use conditional branches to thunks without trampolining */
 #if ARCH_A64
-#define DEFINE_JIT_CODE_BUFFER(name) static uint8_t ALIGNED(4096) name[0x100000]
+#define JIT_CODE_BUFFER_SIZE 0x100000
 #else
-#define DEFINE_JIT_CODE_BUFFER(name) static uint8_t ALIGNED(4096) name[0x800000]
+#define JIT_CODE_BUFFER_SIZE 0x800000
 #endif
 
+/* dynamic branches are emitted with an inline cache, comparing the branch
+   target against the first target seen at that site, and falling back to the
+   dynamic dispatch thunk on a miss. on a hit, the site branches through a
+   linkable edge, same as a static branch. guest code addresses are always
+   aligned, so an empty cache entry uses an odd address to never match */
+#define JIT_IC_EMPTY 0xffffffff
+
 enum {
   /* allocate to this register */
   JIT_ALLOCATE = 0x1,
@@ -63,14 +67,22 @@ enum {
 };
 
 /* the assemble_code function is passed this callback to map guest blocks and
-   instructions to host addresses */
+   instructions to host addresses. backends which emit out-of-line slow paths
+   for fastmem accesses report each one as a site immediately followed by its
+   stub. backends may also report a link entry, the address just past the
+   cycle and interrupt checks made on entry to the code */
 enum {
   JIT_EMIT_BLOCK,
   JIT_EMIT_INSTR,
+  JIT_EMIT_SITE,
+  JIT_EMIT_STUB,
+  JIT_EMIT_LINK,
 };
 
 typedef void (*jit_emit_cb)(void *, int, uint32_t, uint8_t *);
 
+#define JIT_INVALIDATE_ALL -1
+
 /* backend-specific register definition */
 struct jit_register {
   const char *name;
@@ -88,18 +100,28 @@ struct jit_emitter {
 struct jit_backend {
   struct jit_guest *guest;
 
+  /* identifies the backend, e.g. to the persistent cache */
+  const char *name;
+
   const struct jit_register *registers;
   int num_registers;
 
   const struct jit_emitter *emitters;
   int num_emitters;
 
+  /* area of the code buffer blocks are assembled into, NULL for backends
+     that don't generate host code */
+  uint8_t *code;
+  int code_size;
+
   void (*destroy)(struct jit_backend *);
 
   /* compile interface */
-  void (*reset)(struct jit_backend *);
+  void (*reset)(struct jit_backend *, uint8_t *, int);
+  /* returns the block's code, along with any rarely run paths the backend
+     moved into a cold area of the region last passed to reset */
   int (*assemble_code)(struct jit_backend *, struct ir *, uint8_t **, int *,
-                       jit_emit_cb, void *);
+                       uint8_t **, int *, jit_emit_cb, void *);
   void (*dump_code)(struct jit_backend *, const uint8_t *, int, FILE *);
   int (*handle_exception)(struct jit_backend *, struct exception_state *);
 
@@ -108,6 +130,10 @@ struct jit_backend {
   void *(*lookup_code)(struct jit_backend *, uint32_t);
   void (*cache_code)(struct jit_backend *, uint32_t, void *);
   void (*invalidate_code)(struct jit_backend *, uint32_t);
+  /* optional, for backends which cache code outside of jit blocks. called
+     with the range of each jit_invalidate_range, and with a size of
+     JIT_INVALIDATE_ALL for jit_invalidate_code */
+  void (*invalidate_range)(struct jit_backend *, uint32_t, int);
   void (*patch_edge)(struct jit_backend *, void *, void *);
   void (*restore_edge)(struct jit_backend *, void *, uint32_t);
 };
@@ -0,0 +1,639 @@
+/*
+ * persistent code cache
+ *
+ * the optimized ir for each compiled block is written out to the application
+ * directory, in a file named after the md5 of the guest code it was
+ * translated from (and any guest data read while translating it, see
+ * jit_block.guest_extent). the ir also depends on where the code lives, so
+ * the block's address and size are hashed along with it. on future sessions,
+ * blocks whose guest code hashes to an existing entry are reloaded from disk,
+ * skipping translation and all optimization passes except register
+ * allocation
+ *
+ * entries are only valid for the build, backend and options which produced
+ * them, so each combination writes to its own directory. the ir contains
+ * absolute host addresses (fallbacks, callbacks, guest context pointers,
+ * etc.) which move between runs when the host randomizes the address space.
+ * these are relocated, by saving the offset of each from the start of the
+ * image's code or the guest's data, and rebasing them when loading. blocks
+ * with constants which look like any other host address aren't persisted
+ *
+ * files are written by a background thread, the emulation thread only
+ * serializes each block's ir into a ring buffer for it
+ */
+
+#include "jit/jit_cache.h"
+#include "core/core.h"
+#include "core/filesystem.h"
+#include "core/md5.h"
+#include "core/memory.h"
+#include "core/rb_tree.h"
+#include "core/ringbuf.h"
+#include "core/thread.h"
+#include "core/version.h"
+#include "jit/ir/ir.h"
+#include "jit/jit.h"
+#include "jit/jit_backend.h"
+#include "jit/jit_frontend.h"
+#include "jit/jit_guest.h"
+#include "options.h"
+
+#define JIT_CACHE_MAGIC 0x52454331
+#define JIT_CACHE_VERSION 2
+#define JIT_CACHE_HASH_SIZE 33
+#define JIT_CACHE_BUFFER_SIZE (8 * 1024 * 1024)
+#define JIT_CACHE_MAX_RELOCS 1024
+
+enum {
+  JIT_CACHE_CODE,
+  JIT_CACHE_DATA,
+  JIT_CACHE_NUM_REGIONS,
+};
+
+struct jit_cache_region {
+  uintptr_t begin;
+  uintptr_t end;
+};
+
+/* each file begins with this header, followed by the block's fastmem flags,
+   its relocations and then the ir in the binary format */
+struct jit_cache_header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t guest_addr;
+  int32_t guest_size;
+  int32_t guest_extent;
+  int32_t num_relocs;
+  int32_t ir_size;
+};
+
+/* constant argument of an instruction, numbered in the order they're written,
+   holding an offset from the start of a region */
+struct jit_cache_reloc {
+  uint32_t instr;
+  uint8_t arg;
+  uint8_t region;
+  uint16_t pad;
+};
+
+/* precedes each file's contents in the ring buffer */
+struct jit_cache_record {
+  int32_t size;
+  char key[JIT_CACHE_HASH_SIZE];
+};
+
+/* constant modified while saving a block, restored once it's serialized */
+struct jit_cache_fixup {
+  struct ir_value *value;
+  int64_t i64;
+};
+
+struct jit_cache_entry {
+  char key[JIT_CACHE_HASH_SIZE];
+  struct rb_node it;
+};
+
+struct jit_cache {
+  struct jit *jit;
+  struct jit_guest *guest;
+  char path[PATH_MAX];
+  struct jit_cache_region regions[JIT_CACHE_NUM_REGIONS];
+
+  /* keys of the entries on disk, or queued to be written */
+  struct rb_tree entries;
+
+  struct ringbuf *records;
+  int dropped;
+  thread_t thread;
+  mutex_t mutex;
+  /* signalled when a record is queued or the cache is closing */
+  cond_t queued_cond;
+  int closing;
+};
+
+static int jit_cache_entry_cmp(const struct rb_node *rb_lhs,
+                               const struct rb_node *rb_rhs) {
+  const struct jit_cache_entry *lhs =
+      container_of(rb_lhs, const struct jit_cache_entry, it);
+  const struct jit_cache_entry *rhs =
+      container_of(rb_rhs, const struct jit_cache_entry, it);
+
+  return strcmp(lhs->key, rhs->key);
+}
+
+static struct rb_callbacks jit_cache_entry_cb = {
+    &jit_cache_entry_cmp, NULL, NULL,
+};
+
+static int jit_cache_record_size(int size) {
+  return (int)sizeof(struct jit_cache_record) + ALIGN_UP(size, 8);
+}
+
+static void jit_cache_block_path(struct jit_cache *cache, const char *key,
+                                 const char *ext, char *path, size_t size) {
+  snprintf(path, size, "%s" PATH_SEPARATOR "%s.%s", cache->path, key, ext);
+}
+
+static void *jit_cache_thread(void *data) {
+  struct jit_cache *cache = data;
+
+  while (1) {
+    mutex_lock(cache->mutex);
+
+    while (!cache->closing && !ringbuf_available(cache->records)) {
+      cond_wait(cache->queued_cond, cache->mutex);
+    }
+
+    int closing = cache->closing;
+
+    mutex_unlock(cache->mutex);
+
+    /* write each file under a temporary name first, so the emulation thread
+       never loads one which is partially written */
+    while (ringbuf_available(cache->records)) {
+      struct jit_cache_record *rec = ringbuf_read_ptr(cache->records);
+      char tmp[PATH_MAX];
+      char filename[PATH_MAX];
+      jit_cache_block_path(cache, rec->key, "tmp", tmp, sizeof(tmp));
+      jit_cache_block_path(cache, rec->key, "ir", filename, sizeof(filename));
+
+      FILE *file = fopen(tmp, "wb");
+
+      if (file) {
+        int res = fwrite(rec + 1, rec->size, 1, file) == 1;
+        fclose(file);
+
+        if (!res || rename(tmp, filename)) {
+          remove(tmp);
+        }
+      }
+
+      ringbuf_advance_read_ptr(cache->records,
+                               jit_cache_record_size(rec->size));
+    }
+
+    if (closing) {
+      break;
+    }
+  }
+
+  return NULL;
+}
+
+/* hash of everything, besides the guest code, the optimized ir depends on */
+static void jit_cache_host_hash(struct jit_cache *cache, char *hash) {
+  struct jit *jit = cache->jit;
+  struct jit_guest *guest = cache->guest;
+
+  char desc[256];
+  snprintf(desc, sizeof(desc), "%d %s %s %s %d %d %d %d", JIT_CACHE_VERSION,
+           GIT_VERSION, jit->tag, jit->backend->name, guest->data_size,
+           OPTION_jit_traces, OPTION_jit_fold_literals,
+           guest->page_table != NULL);
+
+  MD5_CTX md5_ctx;
+  MD5_Init(&md5_ctx);
+  MD5_Update(&md5_ctx, desc, (unsigned long)strlen(desc));
+  MD5_Final(hash, &md5_ctx);
+}
+
+static void jit_cache_block_key(struct jit_cache *cache,
+                                struct jit_block *block, char *key) {
+  struct jit_guest *guest = cache->guest;
+
+  MD5_CTX md5_ctx;
+  MD5_Init(&md5_ctx);
+
+  uint32_t desc[] = {block->guest_addr, (uint32_t)block->guest_size,
+                     (uint32_t)block->guest_extent};
+  MD5_Update(&md5_ctx, desc, sizeof(desc));
+
+  for (int i = 0; i < block->guest_extent; i++) {
+    uint8_t data = guest->r8(guest->mem, block->guest_addr + i);
+    MD5_Update(&md5_ctx, &data, 1);
+  }
+
+  MD5_Final(key, &md5_ctx);
+}
+
+static struct jit_cache_entry *jit_cache_get_entry(struct jit_cache *cache,
+                                                   const char *key) {
+  struct jit_cache_entry search;
+  memcpy(search.key, key, sizeof(search.key));
+
+  return rb_find_entry(&cache->entries, &search, struct jit_cache_entry, it,
+                       &jit_cache_entry_cb);
+}
+
+static void jit_cache_add_entry(struct jit_cache *cache, const char *key) {
+  if (jit_cache_get_entry(cache, key)) {
+    return;
+  }
+
+  struct jit_cache_entry *entry = calloc(1, sizeof(struct jit_cache_entry));
+  memcpy(entry->key, key, sizeof(entry->key));
+
+  rb_insert(&cache->entries, &entry->it, &jit_cache_entry_cb);
+}
+
+static void jit_cache_free_entry(struct jit_cache *cache,
+                                 struct jit_cache_entry *entry) {
+  rb_unlink(&cache->entries, &entry->it, &jit_cache_entry_cb);
+  free(entry);
+}
+
+static void jit_cache_load_index(struct jit_cache *cache) {
+  DIR *dir = opendir(cache->path);
+
+  if (!dir) {
+    return;
+  }
+
+  int num_entries = 0;
+  struct dirent *ent = NULL;
+
+  while ((ent = readdir(dir)) != NULL) {
+    const char *dname = ent->d_name;
+    const char *ext = strrchr(dname, '.');
+
+    /* entries are named after their key, skip anything else, e.g. files
+       left behind by a writer which didn't finish */
+    if (!ext || ext - dname != JIT_CACHE_HASH_SIZE - 1 || strcmp(ext, ".ir")) {
+      continue;
+    }
+
+    char key[JIT_CACHE_HASH_SIZE];
+    memcpy(key, dname, JIT_CACHE_HASH_SIZE - 1);
+    key[JIT_CACHE_HASH_SIZE - 1] = 0;
+
+    jit_cache_add_entry(cache, key);
+    num_entries++;
+  }
+
+  closedir(dir);
+
+  LOG_INFO("jit_cache_load_index found %d cached %s blocks", num_entries,
+           cache->jit->tag);
+}
+
+static int jit_cache_find_region(struct jit_cache *cache, uint64_t v) {
+  for (int i = 0; i < JIT_CACHE_NUM_REGIONS; i++) {
+    struct jit_cache_region *region = &cache->regions[i];
+
+    if (v >= region->begin && v < region->end) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+static void jit_cache_restore(struct jit_cache_fixup *fixups,
+                              int num_fixups) {
+  for (int i = 0; i < num_fixups; i++) {
+    fixups[i].value->i64 = fixups[i].i64;
+  }
+}
+
+/* replace each constant pointing into a region with its offset from the
+   start of it, recording the original in fixups to be restored after. returns
+   the number of relocations, or -1 if the ir can't be relocated */
+static int jit_cache_relocate(struct jit_cache *cache, struct ir *ir,
+                              struct jit_cache_reloc *relocs,
+                              struct jit_cache_fixup *fixups,
+                              int *num_fixups) {
+  int num_relocs = 0;
+  uint32_t n = 0;
+
+  *num_fixups = 0;
+
+  list_for_each_entry(block, &ir->blocks, struct ir_block, it) {
+    list_for_each_entry(instr, &block->instrs, struct ir_instr, it) {
+      for (int i = 0; i < IR_MAX_ARGS; i++) {
+        struct ir_value *value = instr->arg[i];
+
+        if (!value || !ir_is_constant(value) || value->type != VALUE_I64) {
+          continue;
+        }
+
+        /* constants may be shared between instructions, in which case
+           they've already been replaced */
+        int region = -1;
+
+        for (int j = 0; j < *num_fixups; j++) {
+          if (fixups[j].value == value) {
+            region = jit_cache_find_region(cache, (uint64_t)fixups[j].i64);
+            break;
+          }
+        }
+
+        if (region < 0) {
+          uint64_t v = (uint64_t)value->i64;
+          region = jit_cache_find_region(cache, v);
+
+          /* anything outside of the 32-bit range is assumed to be some other
+             host address, which can't be relocated */
+          if (region < 0) {
+            if (v != (uint32_t)v && v != (uint64_t)(int64_t)(int32_t)v) {
+              return -1;
+            }
+            continue;
+          }
+
+          if (num_relocs == JIT_CACHE_MAX_RELOCS) {
+            return -1;
+          }
+
+          struct jit_cache_fixup *fixup = &fixups[(*num_fixups)++];
+          fixup->value = value;
+          fixup->i64 = value->i64;
+          value->i64 = (int64_t)(v - cache->regions[region].begin);
+        }
+
+        if (num_relocs == JIT_CACHE_MAX_RELOCS) {
+          return -1;
+        }
+
+        struct jit_cache_reloc *reloc = &relocs[num_relocs++];
+        reloc->instr = n;
+        reloc->arg = i;
+        reloc->region = region;
+        reloc->pad = 0;
+      }
+
+      n++;
+    }
+  }
+
+  return num_relocs;
+}
+
+static int jit_cache_rebase(struct jit_cache *cache, struct ir *ir,
+                            const struct jit_cache_reloc *relocs,
+                            int num_relocs) {
+  const struct jit_cache_reloc *reloc = relocs;
+  const struct jit_cache_reloc *end = relocs + num_relocs;
+  uint32_t n = 0;
+
+  list_for_each_entry(block, &ir->blocks, struct ir_block, it) {
+    list_for_each_entry(instr, &block->instrs, struct ir_instr, it) {
+      for (; reloc != end && reloc->instr == n; reloc++) {
+        if (reloc->arg >= IR_MAX_ARGS ||
+            reloc->region >= JIT_CACHE_NUM_REGIONS) {
+          return 0;
+        }
+
+        struct ir_value *value = instr->arg[reloc->arg];
+        struct jit_cache_region *region = &cache->regions[reloc->region];
+
+        if (!value || !ir_is_constant(value) || value->type != VALUE_I64 ||
+            (uint64_t)value->i64 >= region->end - region->begin) {
+          return 0;
+        }
+
+        value->i64 = (int64_t)(region->begin + (uint64_t)value->i64);
+      }
+
+      n++;
+    }
+  }
+
+  /* every relocation should have been consumed, in order */
+  return reloc == end;
+}
+
+void jit_cache_save_block(struct jit_cache *cache, struct jit_block *block,
+                          struct ir *ir) {
+  char key[JIT_CACHE_HASH_SIZE];
+  jit_cache_block_key(cache, block, key);
+
+  /* the same code was already persisted, e.g. by an earlier session */
+  if (jit_cache_get_entry(cache, key)) {
+    return;
+  }
+
+  struct jit_cache_reloc relocs[JIT_CACHE_MAX_RELOCS];
+  struct jit_cache_fixup fixups[JIT_CACHE_MAX_RELOCS];
+  int num_fixups = 0;
+  int num_relocs = jit_cache_relocate(cache, ir, relocs, fixups, &num_fixups);
+
+  if (num_relocs < 0) {
+    jit_cache_restore(fixups, num_fixups);
+    return;
+  }
+
+  /* serialize straight into the ring buffer, dropping the block if it
+     doesn't fit in the space left */
+  int fastmem_size = ALIGN_UP(block->guest_size, 4);
+  int prefix = (int)sizeof(struct jit_cache_header) + fastmem_size +
+               num_relocs * (int)sizeof(struct jit_cache_reloc);
+  int remaining = ringbuf_remaining(cache->records) -
+                  jit_cache_record_size(prefix);
+  int ir_size = 0;
+
+  struct jit_cache_record *rec = ringbuf_write_ptr(cache->records);
+  uint8_t *data = (uint8_t *)(rec + 1);
+
+  if (remaining > 0) {
+    ir_size = ir_write_binary(ir, data + prefix, remaining);
+  }
+
+  jit_cache_restore(fixups, num_fixups);
+
+  if (!ir_size) {
+    cache->dropped++;
+    return;
+  }
+
+  struct jit_cache_header header = {0};
+  header.magic = JIT_CACHE_MAGIC;
+  header.version = JIT_CACHE_VERSION;
+  header.guest_addr = block->guest_addr;
+  header.guest_size = block->guest_size;
+  header.guest_extent = block->guest_extent;
+  header.num_relocs = num_relocs;
+  header.ir_size = ir_size;
+
+  memcpy(data, &header, sizeof(header));
+  memset(data + sizeof(header), 0, fastmem_size);
+  memcpy(data + sizeof(header), block->fastmem,
+         block->guest_size * sizeof(int8_t));
+  memcpy(data + sizeof(header) + fastmem_size, relocs,
+         num_relocs * sizeof(struct jit_cache_reloc));
+
+  rec->size = prefix + ir_size;
+  memcpy(rec->key, key, sizeof(rec->key));
+
+  ringbuf_advance_write_ptr(cache->records, jit_cache_record_size(rec->size));
+
+  mutex_lock(cache->mutex);
+  cond_signal(cache->queued_cond);
+  mutex_unlock(cache->mutex);
+
+  jit_cache_add_entry(cache, key);
+}
+
+static int jit_cache_parse_block(struct jit_cache *cache,
+                                 struct jit_block *block, const uint8_t *data,
+                                 int size, struct ir *ir) {
+  struct jit_cache_header header;
+
+  if (size < (int)sizeof(header)) {
+    return 0;
+  }
+
+  memcpy(&header, data, sizeof(header));
+
+  if (header.magic != JIT_CACHE_MAGIC ||
+      header.version != JIT_CACHE_VERSION ||
+      header.guest_addr != block->guest_addr ||
+      header.guest_size != block->guest_size ||
+      header.guest_extent != block->guest_extent || header.num_relocs < 0 ||
+      header.num_relocs > JIT_CACHE_MAX_RELOCS || header.ir_size <= 0) {
+    return 0;
+  }
+
+  int fastmem_size = ALIGN_UP(header.guest_size, 4);
+  const uint8_t *fastmem = data + sizeof(header);
+  const uint8_t *relocs = fastmem + fastmem_size;
+  const uint8_t *ir_data =
+      relocs + header.num_relocs * sizeof(struct jit_cache_reloc);
+
+  if (ir_data + header.ir_size != data + size) {
+    return 0;
+  }
+
+  struct jit_cache_reloc reloc_buf[JIT_CACHE_MAX_RELOCS];
+  memcpy(reloc_buf, relocs,
+         header.num_relocs * sizeof(struct jit_cache_reloc));
+
+  if (!ir_read_binary(ir_data, header.ir_size, ir) ||
+      !jit_cache_rebase(cache, ir, reloc_buf, header.num_relocs)) {
+    return 0;
+  }
+
+  /* the cached ir was compiled with these fastmem flags, persist them to
+     the block so the ir and its metadata remain in sync */
+  memcpy(block->fastmem, fastmem, block->guest_size * sizeof(int8_t));
+
+  return 1;
+}
+
+int jit_cache_load_block(struct jit_cache *cache, struct jit_block *block,
+                         struct ir *ir) {
+  char key[JIT_CACHE_HASH_SIZE];
+  jit_cache_block_key(cache, block, key);
+
+  struct jit_cache_entry *entry = jit_cache_get_entry(cache, key);
+
+  if (!entry) {
+    return 0;
+  }
+
+  char filename[PATH_MAX];
+  jit_cache_block_path(cache, key, "ir", filename, sizeof(filename));
+
+  /* the entry may still be queued to be written */
+  size_t size;
+  uint8_t *data = map_file(filename, &size);
+
+  if (!data) {
+    return 0;
+  }
+
+  int res = jit_cache_parse_block(cache, block, data, (int)size, ir);
+
+  unmap_file(data, size);
+
+  if (!res) {
+    LOG_WARNING("jit_cache_load_block failed to load %s", filename);
+    jit_cache_free_entry(cache, entry);
+    remove(filename);
+    return 0;
+  }
+
+  return 1;
+}
+
+void jit_cache_destroy(struct jit_cache *cache) {
+  if (cache->thread) {
+    mutex_lock(cache->mutex);
+    cache->closing = 1;
+    cond_signal(cache->queued_cond);
+    mutex_unlock(cache->mutex);
+
+    void *result;
+    thread_join(cache->thread, &result);
+  }
+
+  if (cache->dropped) {
+    LOG_WARNING("jit_cache_destroy dropped %d blocks, writer fell behind",
+                cache->dropped);
+  }
+
+  if (cache->mutex) {
+    cond_destroy(cache->queued_cond);
+    mutex_destroy(cache->mutex);
+  }
+
+  if (cache->records) {
+    ringbuf_destroy(cache->records);
+  }
+
+  while (!rb_empty_tree(&cache->entries)) {
+    struct jit_cache_entry *entry =
+        rb_first_entry(&cache->entries, struct jit_cache_entry, it);
+    jit_cache_free_entry(cache, entry);
+  }
+
+  free(cache);
+}
+
+struct jit_cache *jit_cache_create(struct jit *jit) {
+  struct jit_cache *cache = calloc(1, sizeof(struct jit_cache));
+
+  cache->jit = jit;
+  cache->guest = jit->frontend->guest;
+
+  struct jit_cache_region *code = &cache->regions[JIT_CACHE_CODE];
+  struct jit_cache_region *data = &cache->regions[JIT_CACHE_DATA];
+
+  if (!get_image_code(&code->begin, &code->end)) {
+    LOG_WARNING("jit_cache_create failed to find the image's code");
+    jit_cache_destroy(cache);
+    return NULL;
+  }
+
+  data->begin = (uintptr_t)cache->guest->data;
+  data->end = data->begin + cache->guest->data_size;
+
+  char host_hash[JIT_CACHE_HASH_SIZE];
+  jit_cache_host_hash(cache, host_hash);
+
+  const char *appdir = fs_appdir();
+  char root[PATH_MAX];
+  snprintf(root, sizeof(root), "%s" PATH_SEPARATOR "%s-cache", appdir,
+           jit->tag);
+  snprintf(cache->path, sizeof(cache->path), "%s" PATH_SEPARATOR "%s", root,
+           host_hash);
+
+  if (!fs_mkdir(root) || !fs_mkdir(cache->path)) {
+    LOG_WARNING("jit_cache_create failed to create %s", cache->path);
+    jit_cache_destroy(cache);
+    return NULL;
+  }
+
+  jit_cache_load_index(cache);
+
+  cache->records = ringbuf_create(JIT_CACHE_BUFFER_SIZE);
+  cache->mutex = mutex_create();
+  cache->queued_cond = cond_create();
+  cache->thread = thread_create(&jit_cache_thread, "jit_cache", cache);
+
+  if (!cache->thread) {
+    jit_cache_destroy(cache);
+    return NULL;
+  }
+
+  return cache;
+}
@@ -0,0 +1,19 @@
+#ifndef JIT_CACHE_H
+#define JIT_CACHE_H
+
+#include <stdint.h>
+
+struct ir;
+struct jit;
+struct jit_block;
+struct jit_cache;
+
+struct jit_cache *jit_cache_create(struct jit *jit);
+void jit_cache_destroy(struct jit_cache *cache);
+
+int jit_cache_load_block(struct jit_cache *cache, struct jit_block *block,
+                         struct ir *ir);
+void jit_cache_save_block(struct jit_cache *cache, struct jit_block *block,
+                          struct ir *ir);
+
+#endif
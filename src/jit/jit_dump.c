@@ -0,0 +1,220 @@
+/*
+ * ir dumps
+ *
+ * formatting ir, guest and host code as text and writing it to a file per
+ * block is too slow to leave enabled while playing. instead, each block's ir
+ * is serialized with ir_write_binary directly into a ring buffer, which a
+ * background thread appends to a single file for the session. tools such as
+ * recc render the text offline
+ */
+
+#include "jit/jit_dump.h"
+#include "core/core.h"
+#include "core/ringbuf.h"
+#include "core/thread.h"
+#include "jit/ir/ir.h"
+
+#define JIT_DUMP_MAGIC 0x44524931
+#define JIT_DUMP_VERSION 1
+#define JIT_DUMP_BUFFER_SIZE (16 * 1024 * 1024)
+
+struct jit_dump_header {
+  uint32_t magic;
+  uint32_t version;
+  char tag[32];
+};
+
+/* precedes each block's ir, both in the ring buffer and in the file */
+struct jit_dump_record {
+  uint32_t size;
+  uint32_t guest_addr;
+  int32_t guest_size;
+  int32_t type;
+};
+
+struct jit_dump {
+  FILE *file;
+  struct ringbuf *records;
+  int dropped;
+
+  thread_t thread;
+  mutex_t mutex;
+  /* signalled when a record is queued or the dump is closing */
+  cond_t queued_cond;
+  int closing;
+};
+
+static int jit_dump_record_size(int size) {
+  return (int)sizeof(struct jit_dump_record) + ALIGN_UP(size, 8);
+}
+
+static void *jit_dump_thread(void *data) {
+  struct jit_dump *dump = data;
+
+  while (1) {
+    mutex_lock(dump->mutex);
+
+    while (!dump->closing && !ringbuf_available(dump->records)) {
+      cond_wait(dump->queued_cond, dump->mutex);
+    }
+
+    int closing = dump->closing;
+
+    mutex_unlock(dump->mutex);
+
+    /* drain everything queued so far, freeing space as each is written */
+    while (ringbuf_available(dump->records)) {
+      struct jit_dump_record *rec = ringbuf_read_ptr(dump->records);
+      fwrite(rec, sizeof(*rec) + rec->size, 1, dump->file);
+      ringbuf_advance_read_ptr(dump->records,
+                               jit_dump_record_size(rec->size));
+    }
+
+    if (closing) {
+      break;
+    }
+  }
+
+  return NULL;
+}
+
+int jit_dump_write(struct jit_dump *dump, int type, uint32_t guest_addr,
+                   int guest_size, struct ir *ir) {
+  int remaining = ringbuf_remaining(dump->records) -
+                  jit_dump_record_size(0);
+
+  if (remaining <= 0) {
+    dump->dropped++;
+    return 0;
+  }
+
+  /* serialize straight into the ring buffer, dropping the block if it
+     doesn't fit in the space left */
+  struct jit_dump_record *rec = ringbuf_write_ptr(dump->records);
+  int size = ir_write_binary(ir, (uint8_t *)(rec + 1), remaining);
+
+  if (!size) {
+    dump->dropped++;
+    return 0;
+  }
+
+  rec->size = size;
+  rec->guest_addr = guest_addr;
+  rec->guest_size = guest_size;
+  rec->type = type;
+
+  ringbuf_advance_write_ptr(dump->records, jit_dump_record_size(size));
+
+  mutex_lock(dump->mutex);
+  cond_signal(dump->queued_cond);
+  mutex_unlock(dump->mutex);
+
+  return 1;
+}
+
+void jit_dump_close(struct jit_dump *dump) {
+  if (dump->thread) {
+    mutex_lock(dump->mutex);
+    dump->closing = 1;
+    cond_signal(dump->queued_cond);
+    mutex_unlock(dump->mutex);
+
+    void *result;
+    thread_join(dump->thread, &result);
+  }
+
+  if (dump->dropped) {
+    LOG_WARNING("jit_dump_close dropped %d blocks, writer fell behind",
+                dump->dropped);
+  }
+
+  if (dump->file) {
+    fclose(dump->file);
+  }
+
+  if (dump->mutex) {
+    cond_destroy(dump->queued_cond);
+    mutex_destroy(dump->mutex);
+  }
+
+  if (dump->records) {
+    ringbuf_destroy(dump->records);
+  }
+
+  free(dump);
+}
+
+struct jit_dump *jit_dump_open(const char *filename, const char *tag) {
+  struct jit_dump *dump = calloc(1, sizeof(struct jit_dump));
+
+  dump->file = fopen(filename, "wb");
+
+  if (!dump->file) {
+    jit_dump_close(dump);
+    return NULL;
+  }
+
+  struct jit_dump_header header = {0};
+  header.magic = JIT_DUMP_MAGIC;
+  header.version = JIT_DUMP_VERSION;
+  strncpy(header.tag, tag, sizeof(header.tag) - 1);
+
+  if (fwrite(&header, sizeof(header), 1, dump->file) != 1) {
+    jit_dump_close(dump);
+    return NULL;
+  }
+
+  dump->records = ringbuf_create(JIT_DUMP_BUFFER_SIZE);
+  dump->mutex = mutex_create();
+  dump->queued_cond = cond_create();
+  dump->thread = thread_create(&jit_dump_thread, "jit_dump", dump);
+
+  if (!dump->thread) {
+    jit_dump_close(dump);
+    return NULL;
+  }
+
+  return dump;
+}
+
+int jit_dump_next(const uint8_t *data, int size, int *offset,
+                  struct jit_dump_block *block) {
+  if (!*offset) {
+    struct jit_dump_header header;
+
+    if (size < (int)sizeof(header)) {
+      return 0;
+    }
+
+    memcpy(&header, data, sizeof(header));
+
+    if (header.magic != JIT_DUMP_MAGIC ||
+        header.version != JIT_DUMP_VERSION) {
+      return 0;
+    }
+
+    *offset = sizeof(header);
+  }
+
+  struct jit_dump_record rec;
+
+  if (size - *offset < (int)sizeof(rec)) {
+    return 0;
+  }
+
+  memcpy(&rec, data + *offset, sizeof(rec));
+
+  if (rec.size > (uint32_t)(size - *offset - (int)sizeof(rec))) {
+    return 0;
+  }
+
+  block->type = rec.type;
+  block->guest_addr = rec.guest_addr;
+  block->guest_size = rec.guest_size;
+  block->ir = data + *offset + sizeof(rec);
+  block->ir_size = rec.size;
+
+  *offset += sizeof(rec) + rec.size;
+
+  return 1;
+}
@@ -0,0 +1,38 @@
+#ifndef JIT_DUMP_H
+#define JIT_DUMP_H
+
+#include <stdint.h>
+
+struct ir;
+struct jit_dump;
+
+enum jit_dump_type {
+  JIT_DUMP_RAW,
+  JIT_DUMP_OPT,
+};
+
+/* a dumped block, as returned by jit_dump_next */
+struct jit_dump_block {
+  int type;
+  uint32_t guest_addr;
+  int guest_size;
+  const uint8_t *ir;
+  int ir_size;
+};
+
+/* dumps are a single file per session, with each block's ir appended in the
+   binary format by a background thread */
+struct jit_dump *jit_dump_open(const char *filename, const char *tag);
+void jit_dump_close(struct jit_dump *dump);
+
+/* serialize the ir and queue it to be written, returning 0 if it was dropped
+   because the writer has fallen behind. must only be called from one thread */
+int jit_dump_write(struct jit_dump *dump, int type, uint32_t guest_addr,
+                   int guest_size, struct ir *ir);
+
+/* iterate the blocks in a dump file's contents, starting with an offset of
+   0. returns 0 once there are no more blocks, or the data is malformed */
+int jit_dump_next(const uint8_t *data, int size, int *offset,
+                  struct jit_dump_block *block);
+
+#endif
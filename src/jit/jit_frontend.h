@@ -9,6 +9,16 @@ struct jit_block;
 struct jit_guest;
 struct jit_frontend;
 
+/* flags passed to analyze_code */
+enum {
+  /* continue past static branches, forming a trace of multiple ir blocks
+     that exits back to dispatch at any branch not followed */
+  JIT_ANALYZE_TRACE = 0x1,
+};
+
+/* maximum number of targets returned by branch_targets */
+#define JIT_MAX_BRANCH_TARGETS 2
+
 typedef void (*jit_fallback)(struct jit_guest *, uint32_t, uint32_t);
 
 struct jit_opdef {
@@ -26,11 +36,35 @@ struct jit_frontend {
 
   void (*destroy)(struct jit_frontend *);
 
-  void (*analyze_code)(struct jit_frontend *, uint32_t, int *);
+  void (*analyze_code)(struct jit_frontend *, uint32_t, int, int *);
   void (*translate_code)(struct jit_frontend *, uint32_t, int, struct ir *);
   void (*dump_code)(struct jit_frontend *, uint32_t, int, FILE *output);
 
-  const struct jit_opdef *(*lookup_op)(struct jit_frontend *, const void *);
+  /* fetch the instruction at the given address, through any address
+     translation the guest performs, returning its definition. the raw
+     instruction is written to data, to be passed on to the fallback. the
+     fallback fetched for an instruction with a breakpoint traps in place of
+     it */
+  const struct jit_opdef *(*fetch_op)(struct jit_frontend *, uint32_t,
+                                      uint32_t *);
+
+  /* optional interface for frontends which specialize code for the current
+     guest mode (e.g. the sh4's fpscr state). current_mode returns the mode
+     the guest is in, and uses_mode returns if the translation of the given
+     code depends on it. a variant of such code is compiled for each mode it
+     runs in */
+  uint32_t (*current_mode)(struct jit_frontend *);
+  int (*uses_mode)(struct jit_frontend *, uint32_t, int);
+
+  /* optional interface returning the addresses the code analyzed at the given
+     address may statically continue on to, used to find code to compile ahead
+     of it being executed */
+  int (*branch_targets)(struct jit_frontend *, uint32_t, int, uint32_t *);
+
+  /* optional interface returning the number of bytes of guest memory, from
+     the given address, the translation of the code depends on. this is the
+     code's size, plus any data past it which is read at compile time */
+  int (*code_extent)(struct jit_frontend *, uint32_t, int);
 };
 
 #endif
@@ -22,6 +22,16 @@ struct jit_guest {
   struct memory *mem;
   void (*lookup)(struct memory *, uint32_t, void **, uint8_t **, mem_read_cb *,
                  mem_write_cb *);
+  /* optional, returns the backing storage of an mmio register which can be
+     accessed directly by an aligned 32-bit load or store, or NULL if the
+     access has side effects */
+  uint32_t *(*lookup_reg)(struct memory *, uint32_t, int);
+  /* optional, page table of host pointers indexed by addr >> page_shift, with
+     NULL entries for pages serviced by mmio handlers. when set, the backend
+     guards each fastmem access with a check of it rather than relying on the
+     access faulting */
+  uint8_t **page_table;
+  int page_shift;
   uint8_t (*r8)(struct memory *, uint32_t);
   uint16_t (*r16)(struct memory *, uint32_t);
   uint32_t (*r32)(struct memory *, uint32_t);
@@ -33,6 +43,9 @@ struct jit_guest {
 
   /* runtime interface used by the backend and dispatch */
   void *data;
+  /* size of the structure data points to. the persistent cache relocates
+     pointers into it, e.g. to ctx */
+  int data_size;
   int offset_pc;
   int offset_cycles;
   int offset_instrs;
@@ -40,6 +53,16 @@ struct jit_guest {
   jit_compile_cb compile_code;
   jit_link_cb link_code;
   jit_interrupt_cb check_interrupts;
+
+  /* number of debugger breakpoints set. breakpoints are compiled into the
+     code, so while any are set blocks are compiled synchronously and bypass
+     the persistent cache */
+  int num_breakpoints;
+
+  /* set while the guest translates addresses through its mmu. translated
+     code depends on the mappings at the time, so it bypasses the persistent
+     cache as well */
+  int mmu_enabled;
 };
 
 #endif
@@ -0,0 +1,283 @@
+/*
+ * perf jitdump support
+ *
+ * each compiled block is written out to a jitdump file, in the format
+ * described by tools/perf/Documentation/jitdump-specification.txt in the
+ * linux tree. along with the code itself, a debug info record maps each host
+ * instruction back to the guest instruction it was translated from. the
+ * guest disassembly is appended to a listing file which the debug info
+ * records reference as their source file, enabling perf annotate to
+ * attribute samples to individual guest instructions
+ *
+ * perf finds the jitdump file through the mmap of it made here, to use:
+ *   perf record -k mono redream --perf_jitdump=1 ...
+ *   perf inject --jit -i perf.data -o perf.jit.data
+ *   perf annotate -i perf.jit.data
+ */
+
+#include "jit/jit_perf.h"
+#include "core/core.h"
+#include "core/filesystem.h"
+#include "core/time.h"
+#include "jit/jit.h"
+#include "jit/jit_frontend.h"
+
+#if PLATFORM_LINUX
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define JITDUMP_MAGIC 0x4a695444
+#define JITDUMP_VERSION 1
+
+#if ARCH_X64
+#define JITDUMP_ELF_MACH 62 /* EM_X86_64 */
+#elif ARCH_A64
+#define JITDUMP_ELF_MACH 183 /* EM_AARCH64 */
+#else
+#define JITDUMP_ELF_MACH 0
+#endif
+
+enum {
+  JIT_CODE_LOAD = 0,
+  JIT_CODE_DEBUG_INFO = 2,
+};
+
+struct jitdump_header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t total_size;
+  uint32_t elf_mach;
+  uint32_t pad1;
+  uint32_t pid;
+  uint64_t timestamp;
+  uint64_t flags;
+};
+
+struct jitdump_record {
+  uint32_t id;
+  uint32_t total_size;
+  uint64_t timestamp;
+};
+
+/* followed by the null-terminated name and the native code */
+struct jitdump_code_load {
+  struct jitdump_record base;
+  uint32_t pid;
+  uint32_t tid;
+  uint64_t vma;
+  uint64_t code_addr;
+  uint64_t code_size;
+  uint64_t code_index;
+};
+
+/* followed by nr_entry entries */
+struct jitdump_debug_info {
+  struct jitdump_record base;
+  uint64_t code_addr;
+  uint64_t nr_entry;
+};
+
+/* followed by the null-terminated source file name */
+struct jitdump_debug_entry {
+  uint64_t code_addr;
+  int32_t line;
+  int32_t discrim;
+};
+#endif
+
+struct jit_perf {
+  struct jit *jit;
+  uint32_t pid;
+  uint64_t code_index;
+
+  /* jitdump file, and the marker mapping of it perf looks for */
+  FILE *dump;
+  void *marker;
+  size_t marker_size;
+
+  /* guest disassembly referenced by the debug info records */
+  FILE *listing;
+  char listing_path[PATH_MAX];
+  int listing_lines;
+};
+
+#if PLATFORM_LINUX
+static void jit_perf_write_listing(struct jit_perf *perf,
+                                   struct jit_block *block, int *first_line,
+                                   int *instr_size) {
+  struct jit *jit = perf->jit;
+
+  /* disassemble to a temporary file first to find out how many lines were
+     written. the frontends write a three line header, followed by a line for
+     each of their fixed-width instructions */
+  FILE *tmp = tmpfile();
+  CHECK_NOTNULL(tmp);
+  jit->frontend->dump_code(jit->frontend, block->guest_addr, block->guest_size,
+                           tmp);
+  rewind(tmp);
+
+  int num_lines = 0;
+  int c;
+  while ((c = fgetc(tmp)) != EOF) {
+    fputc(c, perf->listing);
+
+    if (c == '\n') {
+      num_lines++;
+    }
+  }
+  fclose(tmp);
+  fflush(perf->listing);
+
+  int num_instrs = MAX(num_lines - 3, 1);
+  *first_line = perf->listing_lines + 4;
+  *instr_size = MAX(block->guest_size / num_instrs, 1);
+
+  perf->listing_lines += num_lines;
+}
+
+static void jit_perf_write_debug_info(struct jit_perf *perf,
+                                      struct jit_block *block,
+                                      uint64_t timestamp) {
+  int first_line, instr_size;
+  jit_perf_write_listing(perf, block, &first_line, &instr_size);
+
+  int name_size = (int)strlen(perf->listing_path) + 1;
+  int entry_size = (int)sizeof(struct jitdump_debug_entry) + name_size;
+  int num_entries = 0;
+
+  for (int i = 0; i < block->guest_size; i++) {
+    if (block->source_map[i]) {
+      num_entries++;
+    }
+  }
+
+  struct jitdump_debug_info info = {0};
+  info.base.id = JIT_CODE_DEBUG_INFO;
+  info.base.total_size = sizeof(info) + num_entries * entry_size;
+  info.base.timestamp = timestamp;
+  info.code_addr = (uint64_t)(uintptr_t)block->host_addr;
+  info.nr_entry = num_entries;
+  fwrite(&info, sizeof(info), 1, perf->dump);
+
+  for (int i = 0; i < block->guest_size; i++) {
+    if (!block->source_map[i]) {
+      continue;
+    }
+
+    struct jitdump_debug_entry entry = {0};
+    entry.code_addr = (uint64_t)(uintptr_t)block->source_map[i];
+    entry.line = first_line + i / instr_size;
+    fwrite(&entry, sizeof(entry), 1, perf->dump);
+    fwrite(perf->listing_path, name_size, 1, perf->dump);
+  }
+}
+
+static void jit_perf_write_code_load(struct jit_perf *perf, const char *name,
+                                     const uint8_t *code, int size,
+                                     uint64_t timestamp) {
+  int name_size = (int)strlen(name) + 1;
+
+  struct jitdump_code_load load = {0};
+  load.base.id = JIT_CODE_LOAD;
+  load.base.total_size = sizeof(load) + name_size + size;
+  load.base.timestamp = timestamp;
+  load.pid = perf->pid;
+  load.tid = (uint32_t)syscall(SYS_gettid);
+  load.vma = (uint64_t)(uintptr_t)code;
+  load.code_addr = (uint64_t)(uintptr_t)code;
+  load.code_size = size;
+  load.code_index = perf->code_index++;
+  fwrite(&load, sizeof(load), 1, perf->dump);
+  fwrite(name, name_size, 1, perf->dump);
+  fwrite(code, size, 1, perf->dump);
+}
+#endif
+
+void jit_perf_add_block(struct jit_perf *perf, struct jit_block *block) {
+#if PLATFORM_LINUX
+  struct jit *jit = perf->jit;
+  uint64_t timestamp = (uint64_t)time_nanoseconds();
+
+  /* the debug info must precede the code it describes */
+  jit_perf_write_debug_info(perf, block, timestamp);
+
+  char name[64];
+  snprintf(name, sizeof(name), "%s_0x%08x", jit->tag, block->guest_addr);
+  jit_perf_write_code_load(perf, name, block->host_addr, block->host_size,
+                           timestamp);
+
+  /* the cold code is loaded as its own symbol */
+  if (block->cold_size) {
+    snprintf(name, sizeof(name), "%s_0x%08x_cold", jit->tag,
+             block->guest_addr);
+    jit_perf_write_code_load(perf, name, block->cold_addr, block->cold_size,
+                             timestamp);
+  }
+
+  fflush(perf->dump);
+#endif
+}
+
+void jit_perf_destroy(struct jit_perf *perf) {
+#if PLATFORM_LINUX
+  if (perf->marker) {
+    munmap(perf->marker, perf->marker_size);
+  }
+  if (perf->listing) {
+    fclose(perf->listing);
+  }
+  if (perf->dump) {
+    fclose(perf->dump);
+  }
+#endif
+
+  free(perf);
+}
+
+struct jit_perf *jit_perf_create(struct jit *jit) {
+#if PLATFORM_LINUX
+  struct jit_perf *perf = calloc(1, sizeof(struct jit_perf));
+  perf->jit = jit;
+  perf->pid = (uint32_t)getpid();
+
+  /* perf inject expects the file to be named jit-<pid>.dump, each jit gets its
+     own directory to avoid clobbering the others */
+  char dir[PATH_MAX];
+  snprintf(dir, sizeof(dir), "/tmp/jitdump-%u-%s", perf->pid, jit->tag);
+  CHECK(fs_mkdir(dir));
+
+  char dump_path[PATH_MAX];
+  snprintf(dump_path, sizeof(dump_path), "%s/jit-%u.dump", dir, perf->pid);
+  perf->dump = fopen(dump_path, "w+b");
+  CHECK_NOTNULL(perf->dump);
+
+  snprintf(perf->listing_path, sizeof(perf->listing_path), "%s/%s.s", dir,
+           jit->tag);
+  perf->listing = fopen(perf->listing_path, "w");
+  CHECK_NOTNULL(perf->listing);
+
+  struct jitdump_header header = {0};
+  header.magic = JITDUMP_MAGIC;
+  header.version = JITDUMP_VERSION;
+  header.total_size = sizeof(header);
+  header.elf_mach = JITDUMP_ELF_MACH;
+  header.pid = perf->pid;
+  header.timestamp = (uint64_t)time_nanoseconds();
+  fwrite(&header, sizeof(header), 1, perf->dump);
+  fflush(perf->dump);
+
+  /* the executable mapping of the file is what records it in perf.data */
+  perf->marker_size = (size_t)sysconf(_SC_PAGESIZE);
+  perf->marker = mmap(NULL, perf->marker_size, PROT_READ | PROT_EXEC,
+                      MAP_PRIVATE, fileno(perf->dump), 0);
+  CHECK_NE(perf->marker, MAP_FAILED);
+
+  LOG_INFO("jit_perf_create writing %s", dump_path);
+
+  return perf;
+#else
+  LOG_WARNING("jit_perf_create jitdump is only supported on linux");
+  return NULL;
+#endif
+}
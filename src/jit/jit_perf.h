@@ -0,0 +1,13 @@
+#ifndef JIT_PERF_H
+#define JIT_PERF_H
+
+struct jit;
+struct jit_block;
+struct jit_perf;
+
+struct jit_perf *jit_perf_create(struct jit *jit);
+void jit_perf_destroy(struct jit_perf *perf);
+
+void jit_perf_add_block(struct jit_perf *perf, struct jit_block *block);
+
+#endif
@@ -0,0 +1,139 @@
+/*
+ * code prescan
+ *
+ * when a binary is loaded, its code is otherwise only compiled as it's first
+ * executed, stalling the guest on each new block. the prescan walks the
+ * control flow reachable from the binary's entry point ahead of time,
+ * following static branches, conditional fall-throughs and call returns,
+ * and queues each block found to be compiled before the guest reaches it.
+ * indirect branches aren't followed, so the walk only finds part of the
+ * binary's code, the rest is compiled on demand as usual
+ */
+
+#include "jit/jit_prescan.h"
+#include "core/core.h"
+#include "jit/jit_frontend.h"
+
+struct jit_prescan {
+  struct jit_frontend *frontend;
+  int max_blocks;
+
+  /* blocks found by the walk, in the order they were found. blocks are
+     popped off of the front as they're compiled, and the blocks yet to be
+     walked are those between next_walk and num_blocks */
+  uint32_t *blocks;
+  int num_blocks;
+  int next_block;
+  int next_walk;
+
+  /* open addressed set of every block queued since the last clear, so code
+     reachable from multiple paths is only queued once */
+  uint32_t *visited;
+  int visited_size;
+};
+
+/* 0 is a valid address, but never the target of a static branch found by a
+   walk. marks an empty entry in the visited set */
+#define PRESCAN_EMPTY 0
+
+static int jit_prescan_visit(struct jit_prescan *prescan, uint32_t addr) {
+  uint32_t mask = prescan->visited_size - 1;
+  uint32_t i = (addr >> 1) & mask;
+
+  while (prescan->visited[i] != PRESCAN_EMPTY) {
+    if (prescan->visited[i] == addr) {
+      return 0;
+    }
+    i = (i + 1) & mask;
+  }
+
+  prescan->visited[i] = addr;
+
+  return 1;
+}
+
+static void jit_prescan_queue(struct jit_prescan *prescan, uint32_t addr) {
+  if (addr == PRESCAN_EMPTY || prescan->num_blocks >= prescan->max_blocks) {
+    return;
+  }
+
+  if (!jit_prescan_visit(prescan, addr)) {
+    return;
+  }
+
+  prescan->blocks[prescan->num_blocks++] = addr;
+}
+
+void jit_prescan_walk(struct jit_prescan *prescan, uint32_t addr) {
+  struct jit_frontend *frontend = prescan->frontend;
+
+  jit_prescan_queue(prescan, addr);
+
+  /* walk breadth first, so the code closest to the entry point is compiled
+     first */
+  while (prescan->next_walk < prescan->num_blocks) {
+    uint32_t block_addr = prescan->blocks[prescan->next_walk++];
+
+    int size;
+    frontend->analyze_code(frontend, block_addr, 0, &size);
+
+    uint32_t targets[JIT_MAX_BRANCH_TARGETS];
+    int num_targets =
+        frontend->branch_targets(frontend, block_addr, size, targets);
+
+    for (int i = 0; i < num_targets; i++) {
+      jit_prescan_queue(prescan, targets[i]);
+    }
+  }
+}
+
+void jit_prescan_clear(struct jit_prescan *prescan) {
+  prescan->num_blocks = 0;
+  prescan->next_block = 0;
+  prescan->next_walk = 0;
+
+  memset(prescan->visited, 0,
+         prescan->visited_size * sizeof(prescan->visited[0]));
+}
+
+int jit_prescan_peek(struct jit_prescan *prescan, uint32_t *addr) {
+  if (prescan->next_block >= prescan->num_blocks) {
+    return 0;
+  }
+
+  *addr = prescan->blocks[prescan->next_block];
+
+  return 1;
+}
+
+void jit_prescan_pop(struct jit_prescan *prescan) {
+  CHECK_LT(prescan->next_block, prescan->num_blocks);
+  prescan->next_block++;
+}
+
+void jit_prescan_destroy(struct jit_prescan *prescan) {
+  free(prescan->visited);
+  free(prescan->blocks);
+  free(prescan);
+}
+
+struct jit_prescan *jit_prescan_create(struct jit_frontend *frontend,
+                                       int max_blocks) {
+  CHECK_NOTNULL(frontend->branch_targets);
+
+  struct jit_prescan *prescan = calloc(1, sizeof(struct jit_prescan));
+
+  prescan->frontend = frontend;
+  prescan->max_blocks = max_blocks;
+  prescan->blocks = calloc(max_blocks, sizeof(prescan->blocks[0]));
+
+  /* keep the visited set's load factor under 1/2 */
+  prescan->visited_size = 1;
+  while (prescan->visited_size < max_blocks * 2) {
+    prescan->visited_size <<= 1;
+  }
+  prescan->visited =
+      calloc(prescan->visited_size, sizeof(prescan->visited[0]));
+
+  return prescan;
+}
@@ -0,0 +1,22 @@
+#ifndef JIT_PRESCAN_H
+#define JIT_PRESCAN_H
+
+#include <stdint.h>
+
+struct jit_frontend;
+struct jit_prescan;
+
+struct jit_prescan *jit_prescan_create(struct jit_frontend *frontend,
+                                       int max_blocks);
+void jit_prescan_destroy(struct jit_prescan *prescan);
+
+/* queue up each block reachable from addr through static branches */
+void jit_prescan_walk(struct jit_prescan *prescan, uint32_t addr);
+void jit_prescan_clear(struct jit_prescan *prescan);
+
+/* returns the next queued block without removing it, returns 0 when there
+   are none */
+int jit_prescan_peek(struct jit_prescan *prescan, uint32_t *addr);
+void jit_prescan_pop(struct jit_prescan *prescan);
+
+#endif
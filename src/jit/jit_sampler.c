@@ -0,0 +1,260 @@
+/*
+ * guest sampling profiler
+ *
+ * a background thread periodically reads the guest's pc out of its context,
+ * building a histogram of where the guest spends its time. compiled code
+ * only writes the pc back to the context when leaving a block, so each
+ * sample attributes to the entry of the block currently executing. samples
+ * taken while the guest isn't running, e.g. while the emulation thread
+ * waits on the video thread, are discarded
+ *
+ * the histogram is exported in the collapsed stack format, e.g.:
+ *   perl flamegraph.pl sh4.samples.txt > sh4.svg
+ *
+ * raw disc images carry no symbols, so samples can only be symbolized when
+ * given a map of "<addr> <name>" lines, or the "<addr> <type> <name>" lines
+ * output by nm for games built with symbols
+ */
+
+#include "jit/jit_sampler.h"
+#include "core/core.h"
+#include "core/sort.h"
+#include "core/thread.h"
+#include "jit/jit.h"
+#include "jit/jit_frontend.h"
+#include "jit/jit_guest.h"
+
+#define SAMPLER_TABLE_SIZE (1 << 16)
+
+struct jit_sample {
+  uint32_t addr;
+  int count;
+};
+
+struct jit_symbol {
+  uint32_t addr;
+  char name[64];
+};
+
+struct jit_sampler {
+  struct jit *jit;
+  int interval_ms;
+
+  thread_t thread;
+  mutex_t mutex;
+  cond_t cond;
+  int shutdown;
+
+  /* open addressed histogram of sampled pcs, guarded by the mutex */
+  struct jit_sample *samples;
+  int num_addrs;
+  int num_samples;
+};
+
+static void jit_sampler_record(struct jit_sampler *sampler, uint32_t addr) {
+  uint32_t mask = SAMPLER_TABLE_SIZE - 1;
+  uint32_t i = (addr >> 1) & mask;
+
+  for (int n = 0; n < SAMPLER_TABLE_SIZE; n++, i = (i + 1) & mask) {
+    struct jit_sample *sample = &sampler->samples[i];
+
+    if (sample->count && sample->addr != addr) {
+      continue;
+    }
+
+    if (!sample->count) {
+      sample->addr = addr;
+      sampler->num_addrs++;
+    }
+
+    sample->count++;
+    sampler->num_samples++;
+    return;
+  }
+
+  /* table is full, drop the sample */
+}
+
+static void *jit_sampler_thread(void *data) {
+  struct jit_sampler *sampler = data;
+  struct jit_guest *guest = sampler->jit->frontend->guest;
+  uint8_t *ctx = guest->ctx;
+
+  uint32_t last_pc = 0;
+  int32_t last_cycles = 0;
+
+  mutex_lock(sampler->mutex);
+
+  while (!sampler->shutdown) {
+    cond_timedwait(sampler->cond, sampler->mutex, sampler->interval_ms);
+
+    if (sampler->shutdown) {
+      break;
+    }
+
+    /* racy reads, the guest keeps running while sampled */
+    uint32_t pc = *(volatile uint32_t *)(ctx + guest->offset_pc);
+    int32_t cycles = *(volatile int32_t *)(ctx + guest->offset_cycles);
+
+    /* the cycle count changes on each block exit, if neither it nor the pc
+       changed since the last sample the guest isn't running */
+    if (pc == last_pc && cycles == last_cycles) {
+      continue;
+    }
+    last_pc = pc;
+    last_cycles = cycles;
+
+    jit_sampler_record(sampler, pc);
+  }
+
+  mutex_unlock(sampler->mutex);
+
+  return NULL;
+}
+
+static int jit_symbol_cmp(const void *a, const void *b) {
+  const struct jit_symbol *lhs = a;
+  const struct jit_symbol *rhs = b;
+  return lhs->addr <= rhs->addr;
+}
+
+static struct jit_symbol *jit_sampler_load_map(const char *path, uint32_t mask,
+                                               int *num_symbols) {
+  *num_symbols = 0;
+
+  FILE *file = fopen(path, "r");
+  if (!file) {
+    LOG_WARNING("jit_sampler_load_map failed to open %s", path);
+    return NULL;
+  }
+
+  struct jit_symbol *symbols = NULL;
+  int max_symbols = 0;
+  char line[256];
+
+  while (fgets(line, sizeof(line), file)) {
+    unsigned addr;
+    char type;
+    char name[64];
+
+    if (sscanf(line, "%x %c %63s", &addr, &type, name) != 3 &&
+        sscanf(line, "%x %63s", &addr, name) != 2) {
+      continue;
+    }
+
+    if (*num_symbols == max_symbols) {
+      max_symbols = MAX(max_symbols * 2, 1024);
+      symbols = realloc(symbols, max_symbols * sizeof(struct jit_symbol));
+    }
+
+    struct jit_symbol *sym = &symbols[(*num_symbols)++];
+    sym->addr = addr & mask;
+    strncpy(sym->name, name, sizeof(sym->name));
+  }
+
+  fclose(file);
+
+  msort(symbols, *num_symbols, sizeof(struct jit_symbol), &jit_symbol_cmp);
+
+  return symbols;
+}
+
+static const char *jit_sampler_symbolize(const struct jit_symbol *symbols,
+                                         int num_symbols, uint32_t addr) {
+  /* find the last symbol starting at or before the address */
+  int lo = 0;
+  int hi = num_symbols;
+
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (symbols[mid].addr <= addr) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  return lo ? symbols[lo - 1].name : NULL;
+}
+
+int jit_sampler_export(struct jit_sampler *sampler, const char *path,
+                       const char *map_path) {
+  struct jit *jit = sampler->jit;
+  uint32_t mask = jit->frontend->guest->addr_mask;
+
+  FILE *file = fopen(path, "w");
+  if (!file) {
+    return 0;
+  }
+
+  int num_symbols = 0;
+  struct jit_symbol *symbols = NULL;
+  if (map_path && *map_path) {
+    symbols = jit_sampler_load_map(map_path, mask, &num_symbols);
+  }
+
+  mutex_lock(sampler->mutex);
+
+  for (int i = 0; i < SAMPLER_TABLE_SIZE; i++) {
+    struct jit_sample *sample = &sampler->samples[i];
+
+    if (!sample->count) {
+      continue;
+    }
+
+    const char *name =
+        jit_sampler_symbolize(symbols, num_symbols, sample->addr & mask);
+
+    if (name) {
+      fprintf(file, "%s;%s;0x%08x %d\n", jit->tag, name, sample->addr,
+              sample->count);
+    } else {
+      fprintf(file, "%s;0x%08x %d\n", jit->tag, sample->addr, sample->count);
+    }
+  }
+
+  LOG_INFO("jit_sampler_export wrote %d samples of %d addresses to %s",
+           sampler->num_samples, sampler->num_addrs, path);
+
+  mutex_unlock(sampler->mutex);
+
+  free(symbols);
+  fclose(file);
+
+  return 1;
+}
+
+int jit_sampler_num_samples(struct jit_sampler *sampler) {
+  return sampler->num_samples;
+}
+
+void jit_sampler_destroy(struct jit_sampler *sampler) {
+  mutex_lock(sampler->mutex);
+  sampler->shutdown = 1;
+  cond_signal(sampler->cond);
+  mutex_unlock(sampler->mutex);
+
+  void *result;
+  thread_join(sampler->thread, &result);
+
+  cond_destroy(sampler->cond);
+  mutex_destroy(sampler->mutex);
+  free(sampler->samples);
+  free(sampler);
+}
+
+struct jit_sampler *jit_sampler_create(struct jit *jit, int interval_ms) {
+  struct jit_sampler *sampler = calloc(1, sizeof(struct jit_sampler));
+  sampler->jit = jit;
+  sampler->interval_ms = MAX(interval_ms, 1);
+  sampler->samples = calloc(SAMPLER_TABLE_SIZE, sizeof(struct jit_sample));
+  sampler->mutex = mutex_create();
+  sampler->cond = cond_create();
+
+  char name[64];
+  snprintf(name, sizeof(name), "%s sampler", jit->tag);
+  sampler->thread = thread_create(&jit_sampler_thread, name, sampler);
+  CHECK_NOTNULL(sampler->thread);
+
+  return sampler;
+}
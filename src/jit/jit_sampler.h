@@ -0,0 +1,17 @@
+#ifndef JIT_SAMPLER_H
+#define JIT_SAMPLER_H
+
+struct jit;
+struct jit_sampler;
+
+struct jit_sampler *jit_sampler_create(struct jit *jit, int interval_ms);
+void jit_sampler_destroy(struct jit_sampler *sampler);
+
+int jit_sampler_num_samples(struct jit_sampler *sampler);
+
+/* write out the samples in the collapsed stack format read by flamegraph.pl
+   and speedscope, symbolized against map_path if set */
+int jit_sampler_export(struct jit_sampler *sampler, const char *path,
+                       const char *map_path);
+
+#endif
@@ -1,8 +1,43 @@
 #include "jit/pass_stats.h"
 #include "core/core.h"
+#include "core/sort.h"
+#include "core/thread.h"
+#include "core/time.h"
+#include "imgui.h"
+
+#define MAX_PASS_TIMES 32
+
+/* context accesses are counted per 32-bit slot. accesses past the last slot
+   are lumped together */
+#define MAX_CONTEXT_SLOTS 256
+#define CONTEXT_STATS_SHOWN 16
+
+/* accesses within this many bytes of the start of the context are reachable
+   with an 8-bit displacement by the x64 backend */
+#define CONTEXT_NEAR_SIZE 256
+
+struct pass_time {
+  const char *name;
+  int64_t runs;
+  int64_t time;
+  int64_t instrs_before;
+  int64_t instrs_after;
+};
 
 static struct list stats;
 
+static mutex_t times_mutex;
+static struct pass_time times[MAX_PASS_TIMES];
+static int num_times;
+static int64_t code_blocks;
+static int64_t code_guest_size;
+static int64_t code_host_size;
+static int context_accesses[MAX_CONTEXT_SLOTS + 1];
+
+CONSTRUCTOR(pass_stats_init) {
+  times_mutex = mutex_create();
+}
+
 void pass_stats_register(struct pass_stat *stat) {
   list_add(&stats, &stat->it);
 }
@@ -28,3 +63,177 @@ void pass_stats_dump() {
 
   LOG_INFO("");
 }
+
+static struct pass_time *pass_stats_lookup(const char *pass) {
+  for (int i = 0; i < num_times; i++) {
+    if (!strcmp(times[i].name, pass)) {
+      return &times[i];
+    }
+  }
+
+  CHECK_LT(num_times, MAX_PASS_TIMES);
+  struct pass_time *t = &times[num_times++];
+  t->name = pass;
+  return t;
+}
+
+void pass_stats_time(const char *pass, int64_t time, int instrs_before,
+                     int instrs_after) {
+  mutex_lock(times_mutex);
+
+  struct pass_time *t = pass_stats_lookup(pass);
+  t->runs++;
+  t->time += time;
+  t->instrs_before += instrs_before;
+  t->instrs_after += instrs_after;
+
+  mutex_unlock(times_mutex);
+}
+
+void pass_stats_code(int guest_size, int host_size) {
+  mutex_lock(times_mutex);
+
+  code_blocks++;
+  code_guest_size += guest_size;
+  code_host_size += host_size;
+
+  mutex_unlock(times_mutex);
+}
+
+void pass_stats_context(int offset) {
+  int slot = MIN(offset >> 2, MAX_CONTEXT_SLOTS);
+  context_accesses[slot]++;
+}
+
+static int pass_stats_context_cmp(const void *a, const void *b) {
+  const int *lhs = *(const int **)a;
+  const int *rhs = *(const int **)b;
+  return *lhs >= *rhs;
+}
+
+static void pass_stats_dump_context() {
+  int64_t total = 0;
+  int64_t near = 0;
+
+  for (int i = 0; i <= MAX_CONTEXT_SLOTS; i++) {
+    total += context_accesses[i];
+
+    if (i < CONTEXT_NEAR_SIZE >> 2) {
+      near += context_accesses[i];
+    }
+  }
+
+  if (!total) {
+    return;
+  }
+
+  int *sorted[MAX_CONTEXT_SLOTS + 1];
+  int num = 0;
+
+  for (int i = 0; i <= MAX_CONTEXT_SLOTS; i++) {
+    if (context_accesses[i]) {
+      sorted[num++] = &context_accesses[i];
+    }
+  }
+
+  msort(sorted, num, sizeof(int *), &pass_stats_context_cmp);
+
+  LOG_INFO("");
+  LOG_INFO("%-10s %10s %8s", "offset", "accesses", "share");
+
+  for (int i = 0; i < MIN(num, CONTEXT_STATS_SHOWN); i++) {
+    int slot = (int)(sorted[i] - context_accesses);
+
+    char offset[16];
+    snprintf(offset, sizeof(offset), "%s0x%x",
+             slot == MAX_CONTEXT_SLOTS ? ">=" : "", slot << 2);
+
+    LOG_INFO("%-10s %10d %7.2f%%", offset, *sorted[i],
+             *sorted[i] * 100.0 / total);
+  }
+
+  LOG_INFO("");
+  LOG_INFO("%" PRId64 " context accesses, %.2f%% within the first %d bytes",
+           total, near * 100.0 / total, CONTEXT_NEAR_SIZE);
+}
+
+static float pass_stats_expansion() {
+  return code_guest_size ? (float)code_host_size / code_guest_size : 0.0f;
+}
+
+void pass_stats_dump_times() {
+  LOG_INFO("===-----------------------------------------------------===");
+  LOG_INFO("pass times");
+  LOG_INFO("===-----------------------------------------------------===");
+
+  mutex_lock(times_mutex);
+
+  LOG_INFO("%-10s %8s %10s %8s %12s %12s", "pass", "runs", "total ms",
+           "avg us", "instrs in", "instrs out");
+
+  for (int i = 0; i < num_times; i++) {
+    struct pass_time *t = &times[i];
+    LOG_INFO("%-10s %8" PRId64 " %10.2f %8.2f %12" PRId64 " %12" PRId64,
+             t->name, t->runs, t->time / 1000000.0,
+             t->runs ? t->time / 1000.0 / t->runs : 0.0, t->instrs_before,
+             t->instrs_after);
+  }
+
+  LOG_INFO("");
+  LOG_INFO("%" PRId64 " blocks, %" PRId64 " guest bytes -> %" PRId64
+           " host bytes (%.2fx)",
+           code_blocks, code_guest_size, code_host_size,
+           pass_stats_expansion());
+
+  mutex_unlock(times_mutex);
+
+  pass_stats_dump_context();
+
+  LOG_INFO("");
+}
+
+#ifdef HAVE_IMGUI
+void pass_stats_debug_window(int *opened) {
+  bool open = true;
+
+  if (igBegin("jit pass stats", &open, ImGuiWindowFlags_AlwaysAutoResize)) {
+    mutex_lock(times_mutex);
+
+    igColumns(5, "pass times", false);
+    igText("pass");
+    igNextColumn();
+    igText("total ms");
+    igNextColumn();
+    igText("avg us");
+    igNextColumn();
+    igText("instrs in");
+    igNextColumn();
+    igText("instrs out");
+    igNextColumn();
+
+    for (int i = 0; i < num_times; i++) {
+      struct pass_time *t = &times[i];
+      igText("%s", t->name);
+      igNextColumn();
+      igText("%.2f", t->time / 1000000.0);
+      igNextColumn();
+      igText("%.2f", t->runs ? t->time / 1000.0 / t->runs : 0.0);
+      igNextColumn();
+      igText("%" PRId64, t->instrs_before);
+      igNextColumn();
+      igText("%" PRId64, t->instrs_after);
+      igNextColumn();
+    }
+
+    igColumns(1, NULL, false);
+
+    igValueInt("blocks", (int)code_blocks);
+    igValueFloat("guest -> host expansion", pass_stats_expansion(), "%.2fx");
+
+    mutex_unlock(times_mutex);
+  }
+  igEnd();
+
+  *opened = (int)open;
+}
+#endif
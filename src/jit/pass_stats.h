@@ -1,9 +1,12 @@
 #ifndef PASS_STATS_H
 #define PASS_STATS_H
 
+#include <stdint.h>
 #include "core/constructor.h"
 #include "core/list.h"
 
+/* counters are plain ints bumped by whichever thread runs the pass, with
+   multiple compile workers they're approximate */
 #define DEFINE_PASS_STAT(name, desc)                                        \
   static int STAT_##name;                                                   \
   static struct pass_stat STAT_T_##name = {#name, desc, &STAT_##name, {0}}; \
@@ -25,4 +28,19 @@ void pass_stats_register(struct pass_stat *stat);
 void pass_stats_unregister(struct pass_stat *stat);
 void pass_stats_dump();
 
+/* wall time and ir instruction counts of each pass, along with the size of
+   the guest code compiled and the host code emitted for it, accumulated
+   across every block compiled. safe to call from any thread */
+void pass_stats_time(const char *pass, int64_t time, int instrs_before,
+                     int instrs_after);
+void pass_stats_code(int guest_size, int host_size);
+
+/* counts each context access emitted by the backend by its offset, auditing
+   how the hottest fields are laid out in the guest's context. like the pass
+   stats, these are bumped without locking */
+void pass_stats_context(int offset);
+
+void pass_stats_dump_times();
+void pass_stats_debug_window(int *opened);
+
 #endif
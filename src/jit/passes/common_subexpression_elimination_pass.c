@@ -0,0 +1,269 @@
+#include "jit/passes/common_subexpression_elimination_pass.h"
+#include "core/hash.h"
+#include "jit/ir/ir.h"
+#include "jit/pass_stats.h"
+
+/* value numbering over extended basic blocks. each pure instruction is hashed
+   by its op and arguments, and if an identical instruction has already been
+   seen, its result is reused in place of recomputing it. values defined in
+   any block of the extended block are available to each of the blocks after
+   it, as the predecessor always runs first */
+
+DEFINE_PASS_STAT(exprs_removed, "common subexpressions eliminated");
+
+#define CSE_HASH_BITS 10
+
+struct cse_entry {
+  struct ir_instr *instr;
+  struct list_node it;
+};
+
+struct cse {
+  DECLARE_HASHTABLE(exprs, CSE_HASH_BITS);
+
+  /* entries are stored in a growable array, the hash table is rebuilt each
+     time the array is reallocated */
+  struct cse_entry *entries;
+  int num_entries;
+  int max_entries;
+};
+
+static int cse_is_pure(enum ir_op op) {
+  switch (op) {
+    case OP_FTOI:
+    case OP_ITOF:
+    case OP_TRUNC:
+    case OP_SEXT:
+    case OP_ZEXT:
+    case OP_FTRUNC:
+    case OP_FEXT:
+    case OP_SELECT:
+    case OP_CMP:
+    case OP_FCMP:
+    case OP_ADD:
+    case OP_SUB:
+    case OP_SMUL:
+    case OP_UMUL:
+    case OP_DIV:
+    case OP_NEG:
+    case OP_ABS:
+    case OP_FADD:
+    case OP_FSUB:
+    case OP_FMUL:
+    case OP_FDIV:
+    case OP_FNEG:
+    case OP_FABS:
+    case OP_SQRT:
+    case OP_VBROADCAST:
+    case OP_VSPLAT:
+    case OP_VADD:
+    case OP_VDOT:
+    case OP_VMUL:
+    case OP_AND:
+    case OP_OR:
+    case OP_XOR:
+    case OP_NOT:
+    case OP_SHL:
+    case OP_ASHR:
+    case OP_LSHR:
+    case OP_ASHD:
+    case OP_LSHD:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+static int cse_is_commutative(enum ir_op op) {
+  switch (op) {
+    case OP_ADD:
+    case OP_SMUL:
+    case OP_UMUL:
+    case OP_FADD:
+    case OP_FMUL:
+    case OP_VADD:
+    case OP_VMUL:
+    case OP_AND:
+    case OP_OR:
+    case OP_XOR:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+static uint64_t cse_constant_bits(const struct ir_value *v) {
+  switch (v->type) {
+    case VALUE_F32: {
+      uint32_t bits;
+      memcpy(&bits, &v->f32, sizeof(bits));
+      return bits;
+    }
+    case VALUE_F64: {
+      uint64_t bits;
+      memcpy(&bits, &v->f64, sizeof(bits));
+      return bits;
+    }
+    case VALUE_BLOCK:
+      return (uint64_t)(uintptr_t)v->blk;
+    default:
+      return ir_zext_constant(v);
+  }
+}
+
+static uint64_t cse_hash_value(const struct ir_value *v) {
+  if (!v) {
+    return 0;
+  }
+
+  /* constants are allocated per use, so hash them by their contents */
+  if (ir_is_constant(v)) {
+    return cse_constant_bits(v) * 31 + v->type + 1;
+  }
+
+  return (uint64_t)(uintptr_t)v;
+}
+
+static int cse_values_equal(const struct ir_value *a,
+                            const struct ir_value *b) {
+  if (a == b) {
+    return 1;
+  }
+
+  if (!a || !b || !ir_is_constant(a) || !ir_is_constant(b)) {
+    return 0;
+  }
+
+  return a->type == b->type && cse_constant_bits(a) == cse_constant_bits(b);
+}
+
+static uint64_t cse_hash_instr(const struct ir_instr *instr) {
+  uint64_t h = instr->op * 31 + instr->result->type;
+
+  /* combine the first two arguments independent of their order for
+     commutative ops, so that swapped expressions share a bucket */
+  if (cse_is_commutative(instr->op)) {
+    h = h * 31 + cse_hash_value(instr->arg[0]) + cse_hash_value(instr->arg[1]);
+  } else {
+    h = h * 31 + cse_hash_value(instr->arg[0]);
+    h = h * 31 + cse_hash_value(instr->arg[1]);
+  }
+
+  for (int i = 2; i < IR_MAX_ARGS; i++) {
+    h = h * 31 + cse_hash_value(instr->arg[i]);
+  }
+
+  return h;
+}
+
+static int cse_instrs_equal(const struct ir_instr *a,
+                            const struct ir_instr *b) {
+  if (a->op != b->op || a->result->type != b->result->type) {
+    return 0;
+  }
+
+  for (int i = 2; i < IR_MAX_ARGS; i++) {
+    if (!cse_values_equal(a->arg[i], b->arg[i])) {
+      return 0;
+    }
+  }
+
+  if (cse_values_equal(a->arg[0], b->arg[0]) &&
+      cse_values_equal(a->arg[1], b->arg[1])) {
+    return 1;
+  }
+
+  return cse_is_commutative(a->op) && cse_values_equal(a->arg[0], b->arg[1]) &&
+         cse_values_equal(a->arg[1], b->arg[0]);
+}
+
+static void cse_clear(struct cse *cse) {
+  memset(cse->exprs, 0, sizeof(cse->exprs));
+  cse->num_entries = 0;
+}
+
+static void cse_add_entry(struct cse *cse, struct ir_instr *instr,
+                          uint64_t hash) {
+  if (cse->num_entries >= cse->max_entries) {
+    /* grow array, and rebuild the hash table to point at the new entries */
+    cse->max_entries = MAX(64, cse->max_entries * 2);
+    cse->entries =
+        realloc(cse->entries, cse->max_entries * sizeof(struct cse_entry));
+
+    int num_entries = cse->num_entries;
+    cse_clear(cse);
+
+    for (int i = 0; i < num_entries; i++) {
+      struct cse_entry *entry = &cse->entries[i];
+      uint64_t entry_hash = cse_hash_instr(entry->instr);
+      hash_add(hash_bkt(cse->exprs, entry_hash), &entry->it);
+    }
+
+    cse->num_entries = num_entries;
+  }
+
+  struct cse_entry *entry = &cse->entries[cse->num_entries++];
+  entry->instr = instr;
+  hash_add(hash_bkt(cse->exprs, hash), &entry->it);
+}
+
+static struct ir_instr *cse_find_entry(struct cse *cse, struct ir_instr *instr,
+                                       uint64_t hash) {
+  struct list *bkt = hash_bkt(cse->exprs, hash);
+
+  hash_bkt_for_each_entry(entry, bkt, struct cse_entry, it) {
+    if (cse_instrs_equal(entry->instr, instr)) {
+      return entry->instr;
+    }
+  }
+
+  return NULL;
+}
+
+static void cse_run_block(struct cse *cse, struct ir *ir,
+                          struct ir_block *block) {
+  list_for_each_entry_safe(instr, &block->instrs, struct ir_instr, it) {
+    if (!instr->result || !cse_is_pure(instr->op)) {
+      continue;
+    }
+
+    uint64_t hash = cse_hash_instr(instr);
+    struct ir_instr *existing = cse_find_entry(cse, instr, hash);
+
+    if (existing) {
+      ir_replace_uses(instr->result, existing->result);
+      ir_remove_instr(ir, instr);
+
+      STAT_exprs_removed++;
+
+      continue;
+    }
+
+    cse_add_entry(cse, instr, hash);
+  }
+}
+
+void cse_run(struct cse *cse, struct ir *ir) {
+  list_for_each_entry(block, &ir->blocks, struct ir_block, it) {
+    /* expressions from the predecessor are only available if it's the sole
+       way into this block */
+    if (!ir_get_extended_pred(ir, block)) {
+      cse_clear(cse);
+    }
+
+    cse_run_block(cse, ir, block);
+  }
+}
+
+void cse_destroy(struct cse *cse) {
+  free(cse->entries);
+  free(cse);
+}
+
+struct cse *cse_create() {
+  struct cse *cse = calloc(1, sizeof(struct cse));
+
+  cse_clear(cse);
+
+  return cse;
+}
@@ -5,6 +5,7 @@
 DEFINE_PASS_STAT(constants_folded, "const operations folded");
 DEFINE_PASS_STAT(could_optimize_binary_op, "const binary operations possible");
 DEFINE_PASS_STAT(could_optimize_unary_op, "const unary operations possible");
+DEFINE_PASS_STAT(guest_accesses_resolved, "const guest accesses resolved");
 
 static void cprop_run_block(struct cprop *cprop, struct ir *ir,
                             struct ir_block *block) {
@@ -13,6 +14,16 @@ static void cprop_run_block(struct cprop *cprop, struct ir *ir,
     struct ir_value *arg1 = instr->arg[1];
     struct ir_value *result = instr->result;
 
+    /* fastmem accesses to a constant address are demoted back to regular
+       guest accesses. the backend resolves these at compile time, directly
+       accessing the backing memory or calling the mmio handler, which avoids
+       both the table walk and the risk of faulting on an mmio page */
+    if ((instr->op == OP_LOAD_FAST || instr->op == OP_STORE_FAST) &&
+        ir_is_constant(arg0)) {
+      instr->op = instr->op == OP_LOAD_FAST ? OP_LOAD_GUEST : OP_STORE_GUEST;
+      STAT_guest_accesses_resolved++;
+    }
+
     /* fold constant binary ops */
     if (arg0 && ir_is_constant(arg0) && ir_is_int(arg0->type) && arg1 &&
         ir_is_constant(arg1) && ir_is_int(arg1->type) && result) {
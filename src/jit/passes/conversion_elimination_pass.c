@@ -17,7 +17,7 @@ static void cve_run_block(struct ir *ir, struct ir_block *block) {
       int all_zext = 1;
 
       list_for_each_entry(use, &instr->result->uses, struct ir_use, it) {
-        struct ir_instr *use_instr = use->instr;
+        struct ir_instr *use_instr = ir_use_instr(use);
         struct ir_value *use_result = use_instr->result;
 
         if (use_instr->op == OP_SEXT || use_instr->op == OP_ZEXT) {
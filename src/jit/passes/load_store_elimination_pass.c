@@ -5,6 +5,8 @@
 DEFINE_PASS_STAT(loads_removed, "context loads eliminated");
 DEFINE_PASS_STAT(stores_removed, "context stores eliminated");
 
+#define LSE_LIVE_WORDS (IR_MAX_CONTEXT / 64)
+
 struct lse_entry {
   /* cache token when this entry was added */
   uint64_t token;
@@ -13,13 +15,42 @@ struct lse_entry {
   struct ir_value *value;
 };
 
+struct lse_constant {
+  int offset;
+  struct ir_value *value;
+};
+
+/* dataflow state for each block, indexed by the block's tag */
+struct lse_block {
+  struct ir_block *block;
+  int yield;
+
+  /* constants available in the context at the end of the block */
+  int first_constant;
+  int num_constants;
+
+  /* bytes of the context which may be read after entering the block, before
+     they're written to */
+  uint64_t live[LSE_LIVE_WORDS];
+};
+
 struct lse {
   /* current cache token */
   uint64_t token;
 
   struct lse_entry available[IR_MAX_CONTEXT];
+
+  struct lse_block *blocks;
+  int num_blocks;
+  int max_blocks;
+
+  struct lse_constant *constants;
+  int num_constants;
+  int max_constants;
 };
 
+#define lse_get_block(b) (&lse->blocks[(b)->tag])
+
 static void lse_clear_available(struct lse *lse) {
   do {
     lse->token++;
@@ -83,30 +114,174 @@ static struct ir_value *lse_get_available(struct lse *lse, int offset) {
   return entry->value;
 }
 
-static int lse_test_available(struct lse *lse, int offset, int size) {
-  int begin = offset;
-  int end = offset + size - 1;
-  CHECK_LT(end, IR_MAX_CONTEXT);
+static void lse_set_live(uint64_t *live, int offset, int size) {
+  CHECK_LT(offset + size - 1, IR_MAX_CONTEXT);
 
-  /* test if any combination of entries cover the entire range */
-  for (; begin <= end; begin++) {
-    struct lse_entry *entry = &lse->available[begin];
-    if (entry->token != lse->token) {
+  for (int i = offset; i < offset + size; i++) {
+    live[i >> 6] |= 1ull << (i & 63);
+  }
+}
+
+static void lse_clear_live(uint64_t *live, int offset, int size) {
+  CHECK_LT(offset + size - 1, IR_MAX_CONTEXT);
+
+  for (int i = offset; i < offset + size; i++) {
+    live[i >> 6] &= ~(1ull << (i & 63));
+  }
+}
+
+static int lse_test_live(const uint64_t *live, int offset, int size) {
+  CHECK_LT(offset + size - 1, IR_MAX_CONTEXT);
+
+  for (int i = offset; i < offset + size; i++) {
+    if (live[i >> 6] & (1ull << (i & 63))) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static int lse_constants_equal(const struct ir_value *a,
+                               const struct ir_value *b) {
+  if (a->type != b->type) {
+    return 0;
+  }
+
+  switch (ir_type_size(a->type)) {
+    case 1:
+      return a->i8 == b->i8;
+    case 2:
+      return a->i16 == b->i16;
+    case 4:
+      return a->i32 == b->i32;
+    case 8:
+      return a->i64 == b->i64;
+    default:
       return 0;
+  }
+}
+
+static void lse_add_constant(struct lse *lse, int offset,
+                             struct ir_value *value) {
+  if (lse->num_constants >= lse->max_constants) {
+    lse->max_constants = MAX(32, lse->max_constants * 2);
+    lse->constants = realloc(lse->constants, lse->max_constants *
+                                                 sizeof(struct lse_constant));
+  }
+
+  struct lse_constant *c = &lse->constants[lse->num_constants++];
+  c->offset = offset;
+  c->value = value;
+}
+
+static struct ir_value *lse_find_constant(struct lse *lse,
+                                          struct lse_block *state,
+                                          int offset) {
+  struct lse_constant *c = &lse->constants[state->first_constant];
+  struct lse_constant *end = c + state->num_constants;
+
+  for (; c != end; c++) {
+    if (c->offset == offset) {
+      return c->value;
     }
   }
 
-  return 1;
+  return NULL;
+}
+
+static void lse_merge_constants(struct lse *lse, struct ir *ir,
+                                struct ir_block *block) {
+  /* constants can be referenced from any block, so a constant stored to the
+     same offset at the end of every predecessor is available on entry. as
+     the block isn't a yield point, each predecessor comes before it and has
+     already been visited */
+  struct lse_block *first = NULL;
+
+  list_for_each_entry(pred, &ir->blocks, struct ir_block, it) {
+    if (pred == block) {
+      break;
+    }
+
+    struct ir_instr *last_instr =
+        list_last_entry(&pred->instrs, struct ir_instr, it);
+
+    if (!last_instr ||
+        (last_instr->op != OP_BRANCH && last_instr->op != OP_BRANCH_COND)) {
+      continue;
+    }
+
+    for (int i = 0; i < 2; i++) {
+      struct ir_value *target = last_instr->arg[i];
+
+      if (!target || target->type != VALUE_BLOCK || target->blk != block) {
+        continue;
+      }
+
+      struct lse_block *state = lse_get_block(pred);
+
+      if (!first) {
+        first = state;
+
+        struct lse_constant *c = &lse->constants[first->first_constant];
+        struct lse_constant *end = c + first->num_constants;
+
+        for (; c != end; c++) {
+          lse_set_available(lse, c->offset, c->value);
+        }
+        continue;
+      }
+
+      /* drop the constants which aren't available from this predecessor */
+      struct lse_constant *c = &lse->constants[first->first_constant];
+      struct lse_constant *end = c + first->num_constants;
+
+      for (; c != end; c++) {
+        struct ir_value *existing = lse_get_available(lse, c->offset);
+        struct ir_value *other = lse_find_constant(lse, state, c->offset);
+
+        if (existing && (!other || !lse_constants_equal(existing, other))) {
+          lse_erase_available(lse, c->offset, ir_type_size(c->value->type));
+        }
+      }
+    }
+  }
+}
+
+static void lse_save_constants(struct lse *lse, struct lse_block *state) {
+  state->first_constant = lse->num_constants;
+
+  for (int offset = 0; offset < IR_MAX_CONTEXT; offset++) {
+    struct ir_value *value = lse_get_available(lse, offset);
+
+    if (value && ir_is_constant(value)) {
+      lse_add_constant(lse, offset, value);
+    }
+  }
+
+  state->num_constants = lse->num_constants - state->first_constant;
 }
 
 static void lse_eliminate_loads(struct lse *lse, struct ir *ir,
                                 struct ir_block *block) {
-  lse_clear_available(lse);
+  struct lse_block *state = lse_get_block(block);
+
+  /* if the block is only entered from its predecessor, the values available at
+     the end of the predecessor are still available. note, the branch between
+     the two only writes the guest pc, which is never loaded through the ir.
+     values defined in any other block can't be referenced, as registers are
+     only allocated across extended basic blocks */
+  if (!ir_get_extended_pred(ir, block)) {
+    lse_clear_available(lse);
+
+    if (!state->yield) {
+      lse_merge_constants(lse, ir, block);
+    }
+  }
 
   list_for_each_entry_safe(instr, &block->instrs, struct ir_instr, it) {
-    if (instr->op == OP_FALLBACK || instr->op == OP_CALL) {
-      lse_clear_available(lse);
-    } else if (instr->op == OP_BRANCH || instr->op == OP_BRANCH_COND) {
+    if (instr->op == OP_FALLBACK || instr->op == OP_CALL ||
+        instr->op == OP_CALL_COND) {
       lse_clear_available(lse);
     } else if (instr->op == OP_LOAD_CONTEXT) {
       /* if there is already a value available for this offset, reuse it and
@@ -131,50 +306,125 @@ static void lse_eliminate_loads(struct lse *lse, struct ir *ir,
       lse_set_available(lse, offset, instr->arg[1]);
     }
   }
+
+  lse_save_constants(lse, state);
+}
+
+static void lse_live_out(struct lse *lse, struct ir_block *block,
+                         uint64_t *live) {
+  struct ir_instr *last_instr =
+      list_last_entry(&block->instrs, struct ir_instr, it);
+  int exits = 0;
+
+  memset(live, 0, sizeof(uint64_t) * LSE_LIVE_WORDS);
+
+  if (!last_instr ||
+      (last_instr->op != OP_BRANCH && last_instr->op != OP_BRANCH_COND)) {
+    exits = 1;
+  } else {
+    int num_targets = last_instr->op == OP_BRANCH ? 1 : 2;
+
+    for (int i = 0; i < num_targets; i++) {
+      struct ir_value *target = last_instr->arg[i];
+
+      /* the context must be up to date when exiting the ir, or entering a
+         block which may yield to the dispatcher */
+      if (target->type != VALUE_BLOCK || lse_get_block(target->blk)->yield) {
+        exits = 1;
+        break;
+      }
+
+      /* successors which aren't yield points come after the block, and have
+         already been visited */
+      struct lse_block *succ = lse_get_block(target->blk);
+
+      for (int j = 0; j < LSE_LIVE_WORDS; j++) {
+        live[j] |= succ->live[j];
+      }
+    }
+  }
+
+  if (exits) {
+    memset(live, 0xff, sizeof(uint64_t) * LSE_LIVE_WORDS);
+  }
 }
 
 static void lse_eliminate_stores(struct lse *lse, struct ir *ir,
                                  struct ir_block *block) {
-  lse_clear_available(lse);
+  struct lse_block *state = lse_get_block(block);
+  uint64_t *live = state->live;
+
+  /* stores are removed when the context they write is overwritten before
+     being read on every path out of the block */
+  lse_live_out(lse, block, live);
 
   list_for_each_entry_safe_reverse(instr, &block->instrs, struct ir_instr, it) {
-    if (instr->op == OP_FALLBACK || instr->op == OP_CALL) {
-      lse_clear_available(lse);
-    } else if (instr->op == OP_BRANCH || instr->op == OP_BRANCH_COND) {
-      lse_clear_available(lse);
+    if (instr->op == OP_FALLBACK || instr->op == OP_CALL ||
+        instr->op == OP_CALL_COND) {
+      memset(live, 0xff, sizeof(uint64_t) * LSE_LIVE_WORDS);
     } else if (instr->op == OP_LOAD_CONTEXT) {
       int offset = instr->arg[0]->i32;
       int size = ir_type_size(instr->result->type);
 
-      lse_erase_available(lse, offset, size);
+      lse_set_live(live, offset, size);
     } else if (instr->op == OP_STORE_CONTEXT) {
-      /* if subsequent stores overwrite this completely, kill it */
       int offset = instr->arg[0]->i32;
       int size = ir_type_size(instr->arg[1]->type);
-      int overwritten = lse_test_available(lse, offset, size);
 
-      if (overwritten) {
+      if (!lse_test_live(live, offset, size)) {
         ir_remove_instr(ir, instr);
         STAT_stores_removed++;
         continue;
       }
 
-      lse_set_available(lse, offset, instr->arg[1]);
+      lse_clear_live(live, offset, size);
     }
   }
 }
 
-void lse_run(struct lse *lse, struct ir *ir) {
+static void lse_init_blocks(struct lse *lse, struct ir *ir) {
+  lse->num_blocks = 0;
+  lse->num_constants = 0;
+
   list_for_each_entry(block, &ir->blocks, struct ir_block, it) {
-    lse_eliminate_loads(lse, ir, block);
+    if (lse->num_blocks >= lse->max_blocks) {
+      lse->max_blocks = MAX(32, lse->max_blocks * 2);
+      lse->blocks =
+          realloc(lse->blocks, lse->max_blocks * sizeof(struct lse_block));
+    }
+
+    struct lse_block *state = &lse->blocks[lse->num_blocks];
+    memset(state, 0, sizeof(*state));
+    state->block = block;
+    block->tag = lse->num_blocks++;
   }
 
-  list_for_each_entry(block, &ir->blocks, struct ir_block, it) {
-    lse_eliminate_stores(lse, ir, block);
+  for (int i = 0; i < lse->num_blocks; i++) {
+    struct lse_block *state = &lse->blocks[i];
+    state->yield = ir_is_yield_point(ir, state->block);
+  }
+}
+
+void lse_run(struct lse *lse, struct ir *ir) {
+  lse_init_blocks(lse, ir);
+
+  /* loads are eliminated going forward through the blocks, and stores going
+     backward, so the predecessors or successors each block depends on have
+     been visited by the time it is. branches going backward only target yield
+     points, which assume nothing about the context on entry and leave all of
+     it live */
+  for (int i = 0; i < lse->num_blocks; i++) {
+    lse_eliminate_loads(lse, ir, lse->blocks[i].block);
+  }
+
+  for (int i = lse->num_blocks - 1; i >= 0; i--) {
+    lse_eliminate_stores(lse, ir, lse->blocks[i].block);
   }
 }
 
 void lse_destroy(struct lse *lse) {
+  free(lse->constants);
+  free(lse->blocks);
   free(lse);
 }
 
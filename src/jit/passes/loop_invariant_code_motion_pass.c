@@ -0,0 +1,177 @@
+#include "jit/passes/loop_invariant_code_motion_pass.h"
+#include "jit/ir/ir.h"
+#include "jit/pass_stats.h"
+
+/* hoists code whose result is the same on each iteration of a loop out of it,
+   and into the loop's preheader. loops are single blocks which branch back to
+   themselves, so each instruction in one runs on every iteration and nothing
+   is executed speculatively by moving it ahead of the loop. the register
+   allocator keeps the hoisted values live in registers across the loop */
+
+DEFINE_PASS_STAT(instrs_hoisted, "loop invariant instructions hoisted");
+
+#define LICM_STORED_WORDS (IR_MAX_CONTEXT / 64)
+
+/* each value hoisted out of the loop occupies a register for the entirety of
+   it, don't take away too many from the loop body */
+#define LICM_MAX_INSTRS 8
+
+struct licm {
+  /* bytes of the context written to inside of the loop */
+  uint64_t stored[LICM_STORED_WORDS];
+};
+
+static int licm_is_pure(enum ir_op op) {
+  switch (op) {
+    case OP_FTOI:
+    case OP_ITOF:
+    case OP_TRUNC:
+    case OP_SEXT:
+    case OP_ZEXT:
+    case OP_FTRUNC:
+    case OP_FEXT:
+    case OP_SELECT:
+    case OP_CMP:
+    case OP_FCMP:
+    case OP_ADD:
+    case OP_SUB:
+    case OP_SMUL:
+    case OP_UMUL:
+    case OP_DIV:
+    case OP_NEG:
+    case OP_ABS:
+    case OP_FADD:
+    case OP_FSUB:
+    case OP_FMUL:
+    case OP_FDIV:
+    case OP_FNEG:
+    case OP_FABS:
+    case OP_SQRT:
+    case OP_VBROADCAST:
+    case OP_VSPLAT:
+    case OP_VADD:
+    case OP_VDOT:
+    case OP_VMUL:
+    case OP_AND:
+    case OP_OR:
+    case OP_XOR:
+    case OP_NOT:
+    case OP_SHL:
+    case OP_ASHR:
+    case OP_LSHR:
+    case OP_ASHD:
+    case OP_LSHD:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+static void licm_mark_stored(struct licm *licm, int offset, int size) {
+  for (int i = offset; i < offset + size; i++) {
+    licm->stored[i / 64] |= 1ull << (i % 64);
+  }
+}
+
+static int licm_test_stored(struct licm *licm, int offset, int size) {
+  for (int i = offset; i < offset + size; i++) {
+    if (licm->stored[i / 64] & (1ull << (i % 64))) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static int licm_is_invariant(struct licm *licm, struct ir_block *loop,
+                             struct ir_instr *instr, int barrier) {
+  if (!instr->result) {
+    return 0;
+  }
+
+  if (instr->op == OP_LOAD_CONTEXT) {
+    /* loads are invariant as long as nothing in the loop may write to the
+       bytes being loaded */
+    int offset = instr->arg[0]->i32;
+    int size = ir_type_size(instr->result->type);
+    return !barrier && !licm_test_stored(licm, offset, size);
+  }
+
+  if (!licm_is_pure(instr->op)) {
+    return 0;
+  }
+
+  /* pure instructions are invariant when their arguments are. hoisted
+     instructions have already been moved out of the loop's block */
+  for (int i = 0; i < IR_MAX_ARGS; i++) {
+    struct ir_value *arg = instr->arg[i];
+
+    if (arg && !ir_is_constant(arg) && arg->def->block == loop) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+static void licm_hoist_loop(struct licm *licm, struct ir *ir,
+                            struct ir_block *preheader,
+                            struct ir_block *loop) {
+  memset(licm->stored, 0, sizeof(licm->stored));
+
+  /* calls and fallbacks may write to any part of the context */
+  int barrier = 0;
+
+  list_for_each_entry(instr, &loop->instrs, struct ir_instr, it) {
+    if (instr->op == OP_FALLBACK || instr->op == OP_CALL ||
+        instr->op == OP_CALL_COND) {
+      barrier = 1;
+    } else if (instr->op == OP_STORE_CONTEXT) {
+      int offset = instr->arg[0]->i32;
+      int size = ir_type_size(instr->arg[1]->type);
+      licm_mark_stored(licm, offset, size);
+    }
+  }
+
+  /* hoisted instructions are appended to the preheader in their original
+     order, ahead of its terminator */
+  struct ir_instr *terminator =
+      list_last_entry(&preheader->instrs, struct ir_instr, it);
+  int num_hoisted = 0;
+
+  list_for_each_entry_safe(instr, &loop->instrs, struct ir_instr, it) {
+    if (num_hoisted >= LICM_MAX_INSTRS) {
+      break;
+    }
+
+    if (!licm_is_invariant(licm, loop, instr, barrier)) {
+      continue;
+    }
+
+    struct ir_instr *after = list_prev_entry(terminator, struct ir_instr, it);
+    struct ir_insert_point point = {preheader, after};
+    ir_move_instr(ir, instr, &point);
+
+    num_hoisted++;
+    STAT_instrs_hoisted++;
+  }
+}
+
+void licm_run(struct licm *licm, struct ir *ir) {
+  list_for_each_entry(block, &ir->blocks, struct ir_block, it) {
+    struct ir_block *preheader = ir_get_loop_preheader(ir, block);
+
+    if (!preheader) {
+      continue;
+    }
+
+    licm_hoist_loop(licm, ir, preheader, block);
+  }
+}
+
+void licm_destroy(struct licm *licm) {
+  free(licm);
+}
+
+struct licm *licm_create() {
+  return calloc(1, sizeof(struct licm));
+}
@@ -0,0 +1,11 @@
+#ifndef LOOP_INVARIANT_CODE_MOTION_PASS_H
+#define LOOP_INVARIANT_CODE_MOTION_PASS_H
+
+struct ir;
+struct licm;
+
+struct licm *licm_create();
+void licm_destroy(struct licm *licm);
+void licm_run(struct licm *licm, struct ir *ir);
+
+#endif
@@ -47,6 +47,10 @@ struct ra_tmp {
   /* current location of temporary */
   struct ir_value *value;
   struct ir_local *slot;
+
+  /* set while allocating a loop the temporary is live across. its register
+     must hold it on each iteration, so it can't be evicted */
+  int pinned;
 };
 
 /* uses represent a use of a temporary by an instruction */
@@ -89,6 +93,12 @@ struct ra {
 #define ra_get_tmp(v) (&ra->tmps[(v)->tag])
 #define ra_set_tmp(v, t) (v)->tag = (int)((t)-ra->tmps)
 
+/* iterate each block in the extended block from head to tail */
+#define ra_for_each_block(block, head, tail)                                   \
+  for (struct ir_block *block = (head); block;                                 \
+       block = block == (tail) ? NULL                                          \
+                               : list_next_entry(block, struct ir_block, it))
+
 static int ra_reg_can_store(const struct jit_register *reg,
                             const struct ir_value *v) {
   if (reg->flags & JIT_ALLOCATE) {
@@ -154,6 +164,7 @@ static struct ra_tmp *ra_create_tmp(struct ra *ra, struct ir_value *value) {
   tmp->next_use_idx = NO_USE;
   tmp->value = NULL;
   tmp->slot = NULL;
+  tmp->pinned = 0;
 
   /* assign the temporary to the value */
   value->tag = ra->num_tmps++;
@@ -198,13 +209,16 @@ static int ra_validate_value(struct ra *ra, struct ir_value *v, int flags) {
   return valid;
 }
 
-static void ra_validate(struct ra *ra, struct ir *ir, struct ir_block *block) {
-  /* validate that overlapping allocations weren't made */
-  {
-    size_t active_size = sizeof(struct ir_value *) * ra->num_registers;
-    struct ir_value **active = alloca(active_size);
-    memset(active, 0, active_size);
+static void ra_validate(struct ra *ra, struct ir *ir, struct ir_block *head,
+                        struct ir_block *tail) {
+  /* validate that overlapping allocations weren't made. registers stay live
+     across the branches inside of the extended block, so the active set is
+     shared between each of its blocks */
+  size_t active_size = sizeof(struct ir_value *) * ra->num_registers;
+  struct ir_value **active = alloca(active_size);
+  memset(active, 0, active_size);
 
+  ra_for_each_block(block, head, tail) {
     list_for_each_entry_safe(instr, &block->instrs, struct ir_instr, it) {
       for (int i = 0; i < IR_MAX_ARGS; i++) {
         struct ir_value *arg = instr->arg[i];
@@ -238,7 +252,7 @@ static void ra_validate(struct ra *ra, struct ir *ir, struct ir_block *block) {
   }
 
   /* validate allocation types */
-  {
+  ra_for_each_block(block, head, tail) {
     list_for_each_entry_safe(instr, &block->instrs, struct ir_instr, it) {
       const struct jit_emitter *emitter = &ra->emitters[instr->op];
       const struct ir_opdef *def = &ir_opdefs[instr->op];
@@ -353,7 +367,7 @@ static int ra_alloc_blocked_reg(struct ra *ra, struct ir *ir,
     struct ra_bin *bin = ra_get_bin(i);
     struct ra_tmp *packed = ra_get_packed(bin);
 
-    if (!packed) {
+    if (!packed || packed->pinned) {
       continue;
     }
 
@@ -470,8 +484,14 @@ static void ra_alloc(struct ra *ra, struct ir *ir, struct ir_value *value) {
   int reuse_arg0 = emitter->res_flags & JIT_REUSE_ARG0;
 
   if (reuse_arg0 && tmp->value->reg != instr->arg[0]->reg) {
+    /* note, blocks entered only from their predecessor may use a value from it
+       in their first instruction */
     struct ir_instr *copy_after = list_prev_entry(instr, struct ir_instr, it);
-    ir_set_current_instr(ir, copy_after);
+    if (copy_after) {
+      ir_set_current_instr(ir, copy_after);
+    } else {
+      ir_set_current_block(ir, instr->block);
+    }
 
     /* allocate the copy the same register as the result being allocated for */
     struct ir_value *copy = ir_copy(ir, instr->arg[0]);
@@ -482,7 +502,7 @@ static void ra_alloc(struct ra *ra, struct ir *ir, struct ir_value *value) {
 static void ra_rewrite_arg(struct ra *ra, struct ir *ir, struct ir_instr *instr,
                            int arg) {
   struct ir_use *use = &instr->used[arg];
-  struct ir_value *value = *use->parg;
+  struct ir_value *value = instr->arg[arg];
 
   if (!value || ir_is_constant(value)) {
     return;
@@ -570,6 +590,103 @@ static void ra_alloc_bins(struct ra *ra, struct ir *ir,
   }
 }
 
+static int ra_loop_has_calls(struct ir_block *loop) {
+  list_for_each_entry(instr, &loop->instrs, struct ir_instr, it) {
+    const struct ir_opdef *def = &ir_opdefs[instr->op];
+
+    if (def->flags & IR_FLAG_CALL) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static int ra_can_pin(struct ra *ra, struct ra_tmp *tmp) {
+  /* leave at least half of the registers which could hold the temporary free
+     for use inside of the loop */
+  int num_regs = 0;
+  int num_pinned = 0;
+
+  for (int i = 0; i < ra->num_registers; i++) {
+    struct ra_bin *bin = ra_get_bin(i);
+    struct ra_tmp *packed = ra_get_packed(bin);
+
+    if (!ra_reg_can_store(bin->reg, tmp->value)) {
+      continue;
+    }
+
+    num_regs++;
+    num_pinned += packed && packed->pinned;
+  }
+
+  return (num_pinned + 1) * 2 <= num_regs;
+}
+
+static void ra_enter_loop(struct ra *ra, struct ir *ir,
+                          struct ir_block *preheader, struct ir_block *loop) {
+  struct ir_instr *first_instr =
+      list_first_entry(&loop->instrs, struct ir_instr, it);
+  struct ir_instr *terminator =
+      list_last_entry(&preheader->instrs, struct ir_instr, it);
+  int has_calls = ra_loop_has_calls(loop);
+
+  ra_expire_tmps(ra, ir, first_instr);
+
+  /* each temporary still in a register is live across the entire loop, and
+     must be in the same register at the top of each iteration. pin it there,
+     or if that isn't possible, spill it before entering the loop, and it'll
+     be filled from the stack on each iteration instead. if the loop makes any
+     calls, only callee-saved registers survive them */
+  for (int i = 0; i < ra->num_registers; i++) {
+    struct ra_bin *bin = ra_get_bin(i);
+    struct ra_tmp *packed = ra_get_packed(bin);
+
+    if (!packed) {
+      continue;
+    }
+
+    int survives_calls = !has_calls || !(bin->reg->flags & JIT_CALLER_SAVE);
+
+    if (survives_calls && ra_can_pin(ra, packed)) {
+      packed->pinned = 1;
+      continue;
+    }
+
+    ra_spill_tmp(ra, ir, packed, terminator);
+    ra_pack_bin(ra, bin, NULL);
+  }
+}
+
+static void ra_leave_loop(struct ra *ra, struct ir *ir) {
+  for (int i = 0; i < ra->num_tmps; i++) {
+    ra->tmps[i].pinned = 0;
+  }
+}
+
+static void ra_extend_loop_tmps(struct ra *ra, struct ir *ir,
+                                struct ir_block *loop, int num_live_tmps) {
+  struct ir_instr *first_instr =
+      list_first_entry(&loop->instrs, struct ir_instr, it);
+  struct ir_instr *last_instr =
+      list_last_entry(&loop->instrs, struct ir_instr, it);
+  int first_ordinal = ra_get_ordinal(first_instr);
+  int last_ordinal = ra_get_ordinal(last_instr);
+
+  /* temporaries defined before the loop and used inside of it are needed
+     again on the next iteration, extend them to the end of the loop so their
+     register isn't reused after what would otherwise be their last use */
+  for (int i = 0; i < num_live_tmps; i++) {
+    struct ra_tmp *tmp = &ra->tmps[i];
+    struct ra_use *last_use = &ra->uses[tmp->last_use_idx];
+
+    if (last_use->ordinal >= first_ordinal &&
+        last_use->ordinal < last_ordinal) {
+      ra_add_use(ra, tmp, last_ordinal);
+    }
+  }
+}
+
 static void ra_create_tmps(struct ra *ra, struct ir *ir,
                            struct ir_block *block) {
   list_for_each_entry(instr, &block->instrs, struct ir_instr, it) {
@@ -594,17 +711,20 @@ static void ra_create_tmps(struct ra *ra, struct ir *ir,
 }
 
 static void ra_assign_ordinals(struct ra *ra, struct ir *ir,
-                               struct ir_block *block) {
+                               struct ir_block *head, struct ir_block *tail) {
   int ordinal = 0;
 
   /* assign each instruction an ordinal. these ordinals are used to describe
-     the live range of a particular value */
-  list_for_each_entry(instr, &block->instrs, struct ir_instr, it) {
-    ra_set_ordinal(instr, ordinal);
-
-    /* each instruction could fill up to IR_MAX_ARGS, space out ordinals
-       enough to allow for this */
-    ordinal += 1 + IR_MAX_ARGS;
+     the live range of a particular value, and continue across each block of
+     the extended block */
+  ra_for_each_block(block, head, tail) {
+    list_for_each_entry(instr, &block->instrs, struct ir_instr, it) {
+      ra_set_ordinal(instr, ordinal);
+
+      /* each instruction could fill up to IR_MAX_ARGS, space out ordinals
+         enough to allow for this */
+      ordinal += 1 + IR_MAX_ARGS;
+    }
   }
 }
 
@@ -653,7 +773,8 @@ static void ra_legalize_args(struct ra *ra, struct ir *ir,
   }
 }
 
-static void ra_reset(struct ra *ra, struct ir *ir, struct ir_block *block) {
+static void ra_reset(struct ra *ra, struct ir *ir, struct ir_block *head,
+                     struct ir_block *tail) {
   /* reset allocation state */
   for (int i = 0; i < ra->num_registers; i++) {
     struct ra_bin *bin = &ra->bins[i];
@@ -664,23 +785,81 @@ static void ra_reset(struct ra *ra, struct ir *ir, struct ir_block *block) {
   ra->num_uses = 0;
 
   /* reset register state */
-  list_for_each_entry(instr, &block->instrs, struct ir_instr, it) {
-    if (instr->result) {
-      instr->result->reg = NO_REGISTER;
+  ra_for_each_block(block, head, tail) {
+    list_for_each_entry(instr, &block->instrs, struct ir_instr, it) {
+      if (instr->result) {
+        instr->result->reg = NO_REGISTER;
+      }
     }
   }
 }
 
-void ra_run(struct ra *ra, struct ir *ir) {
-  list_for_each_entry(block, &ir->blocks, struct ir_block, it) {
-    ra_reset(ra, ir, block);
+static void ra_run_extended(struct ra *ra, struct ir *ir,
+                            struct ir_block *head, struct ir_block *tail) {
+  ra_reset(ra, ir, head, tail);
+
+  ra_for_each_block(block, head, tail) {
     ra_legalize_args(ra, ir, block);
-    ra_assign_ordinals(ra, ir, block);
+  }
+
+  ra_assign_ordinals(ra, ir, head, tail);
+
+  /* create all of the temporaries and their uses before allocating, the
+     allocator relies on each temporary's future uses being known */
+  ra_for_each_block(block, head, tail) {
+    int num_live_tmps = ra->num_tmps;
+
     ra_create_tmps(ra, ir, block);
+
+    if (block != head && ir_get_loop_preheader(ir, block)) {
+      ra_extend_loop_tmps(ra, ir, block, num_live_tmps);
+    }
+  }
+
+  ra_for_each_block(block, head, tail) {
+    struct ir_block *preheader =
+        block != head ? ir_get_loop_preheader(ir, block) : NULL;
+
+    if (preheader) {
+      ra_enter_loop(ra, ir, preheader, block);
+    }
+
     ra_alloc_bins(ra, ir, block);
+
+    if (preheader) {
+      ra_leave_loop(ra, ir);
+    }
+  }
+
 #if 1
-    ra_validate(ra, ir, block);
+  ra_validate(ra, ir, head, tail);
 #endif
+}
+
+void ra_run(struct ra *ra, struct ir *ir) {
+  /* allocate each extended basic block as a whole. a block which is only
+     entered from its predecessor is entered with the predecessor's registers
+     intact, so temporaries can stay in registers across the branch between
+     the two, instead of being reloaded from the guest context. a loop entered
+     from its predecessor is allocated along with it as well, keeping the
+     values live across it in the same registers on each iteration. values
+     only live in registers inside of the extended block, anything needed
+     beyond its exits is stored to the guest context */
+  struct ir_block *head = list_first_entry(&ir->blocks, struct ir_block, it);
+
+  while (head) {
+    struct ir_block *tail = head;
+    struct ir_block *next = list_next_entry(tail, struct ir_block, it);
+
+    while (next && (ir_get_extended_pred(ir, next) ||
+                    ir_get_loop_preheader(ir, next) == tail)) {
+      tail = next;
+      next = list_next_entry(tail, struct ir_block, it);
+    }
+
+    ra_run_extended(ra, ir, head, tail);
+
+    head = next;
   }
 }
 
@@ -0,0 +1,603 @@
+/*
+ * rollback netplay
+ *
+ * each peer runs the guest locally, applying the local player's input after
+ * a fixed delay and predicting the remote player's input to be unchanged
+ * until it arrives. when an input arrives that differs from what a frame was
+ * ran with, the guest is restored to a snapshot from before that frame and
+ * the frames since are re-simulated with the corrected input
+ *
+ * this relies on the guest being deterministic given the same input, so
+ * input is only ever applied between frames, and options which make guest
+ * execution depend on host timing must be disabled by the caller
+ *
+ * input is sent over udp after each frame, each packet carrying all of the
+ * input the peer has yet to acknowledge. peers are assumed to share the same
+ * byte order
+ */
+
+#include "netplay.h"
+#include "core/core.h"
+#include "core/thread.h"
+#include "core/time.h"
+#include "guest/aica/aica.h"
+#include "guest/dreamcast.h"
+#include "guest/gdrom/disc.h"
+#include "guest/gdrom/gdrom.h"
+#include "guest/snapshot.h"
+#include "host/keycode.h"
+#include "options.h"
+
+#if PLATFORM_WINDOWS
+#include <winsock2.h>
+#include <ws2tcpip.h>
+typedef int socklen_t;
+#else
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+typedef int SOCKET;
+#define INVALID_SOCKET -1
+#define closesocket close
+#endif
+
+#define NETPLAY_MAGIC 0x504e4452 /* RDNP */
+#define NETPLAY_NUM_INPUTS (K_CONT_RTRIG - K_CONT_C + 1)
+/* frames the guest may run ahead of the peer's confirmed input */
+#define NETPLAY_MAX_ROLLBACK 8
+#define NETPLAY_MAX_DELAY 16
+/* frames of input carried by each packet */
+#define NETPLAY_MAX_SEND 32
+#define NETPLAY_MAX_FRAMES 64
+#define NETPLAY_NUM_HASHES 16
+#define NETPLAY_HANDSHAKE_MS 60000
+#define NETPLAY_TIMEOUT_MS 5000
+
+enum {
+  NETPLAY_HELLO,
+  NETPLAY_WELCOME,
+  NETPLAY_INPUT,
+};
+
+struct netplay_header {
+  uint32_t magic;
+  uint32_t type;
+};
+
+struct netplay_hello {
+  struct netplay_header hdr;
+  char uid[DISC_UID_SIZE];
+  char settings[64];
+};
+
+struct netplay_welcome {
+  struct netplay_header hdr;
+  uint32_t clock;
+};
+
+struct netplay_packet {
+  struct netplay_header hdr;
+  /* the sender has the receiver's input for frames before ack */
+  int32_t ack;
+  int32_t first;
+  int32_t num;
+  /* hash of guest memory at the start of a frame no longer subject to
+     rollback, or -1 */
+  int32_t hash_frame;
+  uint64_t hash;
+  int16_t inputs[NETPLAY_MAX_SEND][NETPLAY_NUM_INPUTS];
+};
+
+struct netplay_hash {
+  int frame;
+  uint64_t hash;
+};
+
+struct netplay {
+  struct dreamcast *dc;
+  int delay;
+  int check_interval;
+
+  SOCKET sock;
+  struct sockaddr_storage peer;
+  socklen_t peer_len;
+  int connected;
+  int listening;
+  struct netplay_welcome welcome;
+  int64_t last_recv;
+
+  int local_port;
+  int remote_port;
+
+  /* latest state of the local controller, written by the host */
+  mutex_t input_mutex;
+  int16_t input[NETPLAY_NUM_INPUTS];
+
+  /* per-frame input, indexed by frame modulo NETPLAY_MAX_FRAMES. predicted
+     is the remote input each frame was last ran with */
+  int16_t local[NETPLAY_MAX_FRAMES][NETPLAY_NUM_INPUTS];
+  int16_t remote[NETPLAY_MAX_FRAMES][NETPLAY_NUM_INPUTS];
+  int16_t predicted[NETPLAY_MAX_FRAMES][NETPLAY_NUM_INPUTS];
+
+  /* local input is known for frames before local_frame, remote input is
+     confirmed for frames before remote_frame, and the peer has received
+     the local input for frames before peer_ack */
+  int local_frame;
+  int remote_frame;
+  int peer_ack;
+
+  /* next frame to run, and the earliest frame ran with mispredicted input */
+  int frame;
+  int rollback_frame;
+  struct snapshots *snaps;
+
+  struct netplay_hash hashes[NETPLAY_NUM_HASHES];
+  int desynced;
+};
+
+static void netplay_settings(char *settings, int size) {
+  snprintf(settings, size, "%s %s %s", OPTION_region, OPTION_language,
+           OPTION_broadcast);
+}
+
+static int netplay_same_peer(struct netplay *np,
+                             const struct sockaddr_storage *from,
+                             socklen_t from_len) {
+  return from_len == np->peer_len && !memcmp(from, &np->peer, from_len);
+}
+
+static void netplay_send(struct netplay *np, const void *data, int size) {
+  sendto(np->sock, (const char *)data, size, 0,
+         (const struct sockaddr *)&np->peer, np->peer_len);
+}
+
+static int netplay_recv(struct netplay *np, void *data, int size,
+                        struct sockaddr_storage *from, socklen_t *from_len,
+                        int timeout_ms) {
+  fd_set fds;
+  FD_ZERO(&fds);
+  FD_SET(np->sock, &fds);
+
+  struct timeval tv;
+  tv.tv_sec = timeout_ms / 1000;
+  tv.tv_usec = (timeout_ms % 1000) * 1000;
+
+  if (select((int)np->sock + 1, &fds, NULL, NULL, &tv) <= 0) {
+    return -1;
+  }
+
+  *from_len = sizeof(*from);
+
+  return (int)recvfrom(np->sock, (char *)data, size, 0,
+                       (struct sockaddr *)from, from_len);
+}
+
+static void netplay_check_hash(struct netplay *np, int frame, uint64_t hash) {
+  /* only compare hashes that are final on this side as well */
+  if (!np->check_interval || frame < 0 || frame > np->remote_frame ||
+      frame >= np->rollback_frame || np->desynced) {
+    return;
+  }
+
+  struct netplay_hash *h =
+      &np->hashes[(frame / np->check_interval) % NETPLAY_NUM_HASHES];
+
+  if (h->frame != frame) {
+    return;
+  }
+
+  if (h->hash != hash) {
+    LOG_WARNING("netplay_check_hash peers diverged before frame %d", frame);
+    np->desynced = 1;
+  }
+}
+
+static void netplay_recv_input(struct netplay *np,
+                               const struct netplay_packet *pkt) {
+  if (pkt->num < 0 || pkt->num > NETPLAY_MAX_SEND) {
+    return;
+  }
+
+  np->peer_ack = MAX(np->peer_ack, pkt->ack);
+
+  /* input is only accepted in order, anything already received or following
+     a gap is dropped */
+  for (int i = 0; i < pkt->num; i++) {
+    int frame = pkt->first + i;
+
+    if (frame != np->remote_frame) {
+      continue;
+    }
+
+    int16_t *remote = np->remote[frame % NETPLAY_MAX_FRAMES];
+    memcpy(remote, pkt->inputs[i], sizeof(pkt->inputs[i]));
+
+    if (frame < np->frame &&
+        memcmp(remote, np->predicted[frame % NETPLAY_MAX_FRAMES],
+               sizeof(pkt->inputs[i]))) {
+      np->rollback_frame = MIN(np->rollback_frame, frame);
+    }
+
+    np->remote_frame++;
+  }
+
+  netplay_check_hash(np, pkt->hash_frame, pkt->hash);
+}
+
+static int netplay_accept(struct netplay *np,
+                          const struct netplay_hello *hello) {
+  struct disc *disc = gdrom_get_disc(np->dc->gdrom);
+  char settings[64];
+  netplay_settings(settings, sizeof(settings));
+
+  if (strncmp(hello->uid, disc ? disc->uid : "", DISC_UID_SIZE)) {
+    LOG_WARNING("netplay_accept peer is running a different disc");
+    return 0;
+  }
+
+  if (strncmp(hello->settings, settings, sizeof(settings))) {
+    LOG_WARNING("netplay_accept peer has different system settings");
+    return 0;
+  }
+
+  return 1;
+}
+
+static void netplay_poll(struct netplay *np, int timeout_ms) {
+  struct netplay_packet buf;
+  struct sockaddr_storage from;
+  socklen_t from_len;
+  int size;
+
+  while ((size = netplay_recv(np, &buf, (int)sizeof(buf), &from, &from_len,
+                              timeout_ms)) >= 0) {
+    timeout_ms = 0;
+
+    if (size < (int)sizeof(struct netplay_header) ||
+        buf.hdr.magic != NETPLAY_MAGIC) {
+      continue;
+    }
+
+    if (np->connected && !netplay_same_peer(np, &from, from_len)) {
+      continue;
+    }
+
+    switch (buf.hdr.type) {
+      case NETPLAY_HELLO: {
+        /* the welcome is resent for each hello, in case it was lost */
+        const struct netplay_hello *hello = (const struct netplay_hello *)&buf;
+
+        if (!np->listening || size != (int)sizeof(*hello)) {
+          break;
+        }
+
+        if (!np->connected) {
+          if (!netplay_accept(np, hello)) {
+            break;
+          }
+
+          memcpy(&np->peer, &from, from_len);
+          np->peer_len = from_len;
+          np->connected = 1;
+        }
+
+        netplay_send(np, &np->welcome, (int)sizeof(np->welcome));
+      } break;
+
+      case NETPLAY_WELCOME: {
+        const struct netplay_welcome *welcome =
+            (const struct netplay_welcome *)&buf;
+
+        if (np->listening || np->connected || size != (int)sizeof(*welcome)) {
+          break;
+        }
+
+        /* start with the same real-time clock as the peer */
+        aica_set_clock(np->dc->aica, welcome->clock);
+        np->connected = 1;
+      } break;
+
+      case NETPLAY_INPUT: {
+        if (!np->connected || size != (int)sizeof(buf)) {
+          break;
+        }
+
+        netplay_recv_input(np, &buf);
+      } break;
+    }
+
+    if (np->connected) {
+      np->last_recv = time_nanoseconds();
+    }
+  }
+}
+
+static void netplay_send_input(struct netplay *np) {
+  struct netplay_packet pkt = {0};
+  pkt.hdr.magic = NETPLAY_MAGIC;
+  pkt.hdr.type = NETPLAY_INPUT;
+  pkt.ack = np->remote_frame;
+  pkt.first = np->peer_ack;
+  pkt.num = MIN(np->local_frame - np->peer_ack, NETPLAY_MAX_SEND);
+
+  for (int i = 0; i < pkt.num; i++) {
+    int frame = pkt.first + i;
+    memcpy(pkt.inputs[i], np->local[frame % NETPLAY_MAX_FRAMES],
+           sizeof(pkt.inputs[i]));
+  }
+
+  /* send the latest hash which can no longer be changed by a rollback */
+  pkt.hash_frame = -1;
+
+  for (int i = 0; i < NETPLAY_NUM_HASHES; i++) {
+    struct netplay_hash *h = &np->hashes[i];
+
+    if (h->frame > pkt.hash_frame && h->frame <= np->remote_frame &&
+        h->frame < np->rollback_frame) {
+      pkt.hash_frame = h->frame;
+      pkt.hash = h->hash;
+    }
+  }
+
+  netplay_send(np, &pkt, (int)sizeof(pkt));
+}
+
+static void netplay_step(struct netplay *np, int frame, netplay_run_cb run,
+                         void *data, int hidden) {
+  int i = frame % NETPLAY_MAX_FRAMES;
+
+  if (np->check_interval && (frame % np->check_interval) == 0) {
+    struct netplay_hash *h =
+        &np->hashes[(frame / np->check_interval) % NETPLAY_NUM_HASHES];
+    h->frame = frame;
+    h->hash = dc_hash_memory(np->dc);
+  }
+
+  /* use the confirmed remote input if it's arrived, else predict that it's
+     unchanged from the last confirmed input */
+  if (frame < np->remote_frame) {
+    memcpy(np->predicted[i], np->remote[i], sizeof(np->predicted[i]));
+  } else if (np->remote_frame > 0) {
+    int last = (np->remote_frame - 1) % NETPLAY_MAX_FRAMES;
+    memcpy(np->predicted[i], np->remote[last], sizeof(np->predicted[i]));
+  } else {
+    memset(np->predicted[i], 0, sizeof(np->predicted[i]));
+  }
+
+  for (int j = 0; j < NETPLAY_NUM_INPUTS; j++) {
+    dc_input(np->dc, np->local_port, j, np->local[i][j]);
+    dc_input(np->dc, np->remote_port, j, np->predicted[i][j]);
+  }
+
+  run(data, hidden);
+}
+
+int netplay_run_frame(struct netplay *np, netplay_run_cb run, void *data) {
+  /* latch the local input for the frame delay frames from now */
+  mutex_lock(np->input_mutex);
+  memcpy(np->local[np->local_frame % NETPLAY_MAX_FRAMES], np->input,
+         sizeof(np->input));
+  mutex_unlock(np->input_mutex);
+  np->local_frame++;
+
+  /* wait on the peer if running too far ahead of it */
+  netplay_poll(np, 0);
+
+  while (np->frame - np->remote_frame >= NETPLAY_MAX_ROLLBACK ||
+         np->local_frame - np->peer_ack > NETPLAY_MAX_SEND) {
+    int64_t elapsed = time_nanoseconds() - np->last_recv;
+
+    if (elapsed > (int64_t)NETPLAY_TIMEOUT_MS * NS_PER_MS) {
+      LOG_WARNING("netplay_run_frame peer timed out");
+      return 0;
+    }
+
+    netplay_send_input(np);
+    netplay_poll(np, 5);
+  }
+
+  /* re-simulate the frames ran with mispredicted input */
+  if (np->rollback_frame < np->frame) {
+    int first = np->rollback_frame;
+
+    if (!snapshots_restore(np->snaps, np->frame - 1 - first)) {
+      LOG_WARNING("netplay_run_frame failed to roll back to frame %d", first);
+      return 0;
+    }
+
+    np->rollback_frame = INT_MAX;
+
+    for (int frame = first; frame < np->frame; frame++) {
+      if (frame > first) {
+        snapshots_take(np->snaps);
+      }
+
+      netplay_step(np, frame, run, data, 1);
+    }
+  }
+
+  np->rollback_frame = INT_MAX;
+
+  snapshots_take(np->snaps);
+  netplay_step(np, np->frame, run, data, 0);
+  np->frame++;
+
+  netplay_send_input(np);
+
+  return 1;
+}
+
+void netplay_input(struct netplay *np, int button, int16_t value) {
+  CHECK(button >= 0 && button < NETPLAY_NUM_INPUTS);
+
+  mutex_lock(np->input_mutex);
+  np->input[button] = value;
+  mutex_unlock(np->input_mutex);
+}
+
+static int netplay_handshake(struct netplay *np) {
+  struct netplay_hello hello = {0};
+  hello.hdr.magic = NETPLAY_MAGIC;
+  hello.hdr.type = NETPLAY_HELLO;
+
+  struct disc *disc = gdrom_get_disc(np->dc->gdrom);
+  snprintf(hello.uid, sizeof(hello.uid), "%s", disc ? disc->uid : "");
+  netplay_settings(hello.settings, sizeof(hello.settings));
+
+  int64_t start = time_nanoseconds();
+
+  while (!np->connected) {
+    int64_t elapsed = time_nanoseconds() - start;
+
+    if (elapsed > (int64_t)NETPLAY_HANDSHAKE_MS * NS_PER_MS) {
+      return 0;
+    }
+
+    if (!np->listening) {
+      netplay_send(np, &hello, (int)sizeof(hello));
+    }
+
+    netplay_poll(np, 250);
+  }
+
+  return 1;
+}
+
+static int netplay_open(struct netplay *np, const char *addr, int port) {
+  if (addr && *addr) {
+    /* split host:port */
+    char host[256];
+    snprintf(host, sizeof(host), "%s", addr);
+
+    char *sep = strrchr(host, ':');
+    if (!sep) {
+      LOG_WARNING("netplay_open expected host:port, got %s", addr);
+      return 0;
+    }
+    *sep = 0;
+
+    struct addrinfo hints = {0};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+
+    struct addrinfo *info = NULL;
+    if (getaddrinfo(host, sep + 1, &hints, &info) || !info) {
+      LOG_WARNING("netplay_open failed to resolve %s", addr);
+      return 0;
+    }
+
+    memcpy(&np->peer, info->ai_addr, info->ai_addrlen);
+    np->peer_len = (socklen_t)info->ai_addrlen;
+    freeaddrinfo(info);
+  }
+
+  np->sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+
+  if (np->sock == INVALID_SOCKET) {
+    LOG_WARNING("netplay_open failed to create socket");
+    return 0;
+  }
+
+  if (!np->listening) {
+    return 1;
+  }
+
+  struct sockaddr_in local = {0};
+  local.sin_family = AF_INET;
+  local.sin_addr.s_addr = htonl(INADDR_ANY);
+  local.sin_port = htons((uint16_t)port);
+
+  if (bind(np->sock, (struct sockaddr *)&local, sizeof(local))) {
+    LOG_WARNING("netplay_open failed to bind port %d", port);
+    return 0;
+  }
+
+  return 1;
+}
+
+void netplay_destroy(struct netplay *np) {
+  if (np->snaps) {
+    snapshots_destroy(np->snaps);
+  }
+
+  if (np->sock != INVALID_SOCKET) {
+    closesocket(np->sock);
+  }
+
+#if PLATFORM_WINDOWS
+  WSACleanup();
+#endif
+
+  mutex_destroy(np->input_mutex);
+
+  free(np);
+}
+
+struct netplay *netplay_create(struct dreamcast *dc, const char *addr,
+                               int port, int delay, int check_interval) {
+#if PLATFORM_WINDOWS
+  WSADATA wsadata;
+  if (WSAStartup(MAKEWORD(2, 2), &wsadata)) {
+    LOG_WARNING("netplay_create failed to initialize winsock");
+    return NULL;
+  }
+#endif
+
+  struct netplay *np = calloc(1, sizeof(struct netplay));
+
+  np->dc = dc;
+  np->delay = CLAMP(delay, 0, NETPLAY_MAX_DELAY);
+  np->check_interval = MAX(check_interval, 0);
+  np->sock = INVALID_SOCKET;
+  np->listening = !addr || !*addr;
+  np->input_mutex = mutex_create();
+  np->rollback_frame = INT_MAX;
+
+  /* the player that's listening is always on the first port */
+  np->local_port = np->listening ? 0 : 1;
+  np->remote_port = np->listening ? 1 : 0;
+
+  /* input for the first delay frames is neutral */
+  np->local_frame = np->delay;
+
+  for (int i = 0; i < NETPLAY_NUM_HASHES; i++) {
+    np->hashes[i].frame = -1;
+  }
+
+  np->welcome.hdr.magic = NETPLAY_MAGIC;
+  np->welcome.hdr.type = NETPLAY_WELCOME;
+  np->welcome.clock = aica_get_clock(dc->aica);
+
+  if (!netplay_open(np, addr, port)) {
+    netplay_destroy(np);
+    return NULL;
+  }
+
+  if (np->listening) {
+    LOG_INFO("netplay_create waiting for a peer on port %d", port);
+  } else {
+    LOG_INFO("netplay_create connecting to %s", addr);
+  }
+
+  if (!netplay_handshake(np)) {
+    LOG_WARNING("netplay_create timed out waiting for a peer");
+    netplay_destroy(np);
+    return NULL;
+  }
+
+  np->snaps = snapshots_create(dc, NETPLAY_MAX_ROLLBACK, INT64_MAX, 0);
+
+  if (!np->snaps) {
+    netplay_destroy(np);
+    return NULL;
+  }
+
+  np->last_recv = time_nanoseconds();
+
+  LOG_INFO("netplay_create connected as player %d", np->local_port + 1);
+
+  return np;
+}
@@ -0,0 +1,26 @@
+#ifndef NETPLAY_H
+#define NETPLAY_H
+
+#include <stdint.h>
+
+struct dreamcast;
+struct netplay;
+
+typedef void (*netplay_run_cb)(void *, int);
+
+/* connects to a peer listening on host:port if addr is set, else waits for
+   one to connect on port. both peers must have loaded the same disc, and
+   not have started running it yet */
+struct netplay *netplay_create(struct dreamcast *dc, const char *addr,
+                               int port, int delay, int check_interval);
+void netplay_destroy(struct netplay *np);
+
+/* latch the local player's controller state, applied at the next frame */
+void netplay_input(struct netplay *np, int button, int16_t value);
+
+/* run the next frame with run(data, 0), first re-simulating any frames ran
+   with mispredicted input with run(data, 1). returns 0 once the peer has
+   disconnected */
+int netplay_run_frame(struct netplay *np, netplay_run_cb run, void *data);
+
+#endif
@@ -1,5 +1,6 @@
 #include "options.h"
 #include "core/core.h"
+#include "core/thread.h"
 #include "host/keycode.h"
 
 /* default deadzone taken from: https://forums.libsdl.org/viewtopic.php?p=39985
@@ -7,6 +8,15 @@
    also have a default of around this */
 #define DEFAULT_DEADZONE 4096
 
+/* faults are delivered through mach exception ports on mac and vectored
+   exception handlers on windows, both much slower than a posix signal, so
+   fastmem accesses are checked inline there by default */
+#if PLATFORM_DARWIN || PLATFORM_WINDOWS
+#define FASTMEM_CHECKS 1
+#else
+#define FASTMEM_CHECKS 0
+#endif
+
 /* clang-format off */
 const char *BROADCASTS[] = {
   "ntsc",
@@ -78,6 +88,11 @@ int *DEADZONES[] = {
 DEFINE_OPTION_INT(bios,                    0,                 "Boot to bios");
 DEFINE_PERSISTENT_OPTION_STRING(sync,      "audio and video", "Time sync");
 DEFINE_PERSISTENT_OPTION_INT(fullscreen,   0,                 "Start window fullscreen");
+DEFINE_OPTION_INT(audio_rate,              48000,             "Preferred rate of the audio device, audio is resampled to the rate it actually runs at");
+DEFINE_OPTION_INT(audio_low_latency,       0,                 "Use small audio buffers, resampling slightly to keep them filled");
+DEFINE_OPTION_INT(log_async,               1,                 "Write log messages from a background thread, rate limiting repeated ones");
+DEFINE_OPTION_INT(frame_pacing,            0,                 "Delay starting each frame so it finishes just before the next present");
+DEFINE_OPTION_INT(precise_throttle,        0,                 "Spin through the last millisecond of each wait on the audio buffer, trading cpu for timing precision");
 DEFINE_PERSISTENT_OPTION_INT(key_a,        'l',               "A button mapping");
 DEFINE_PERSISTENT_OPTION_INT(key_b,        'p',               "B button mapping");
 DEFINE_PERSISTENT_OPTION_INT(key_x,        'k',               "X button mapping");
@@ -101,6 +116,60 @@ DEFINE_PERSISTENT_OPTION_INT(deadzone_3,   DEFAULT_DEADZONE,  "Deadzone for cont
 
 /* emulator */
 DEFINE_PERSISTENT_OPTION_STRING(aspect,    "4:3",             "Video aspect ratio");
+DEFINE_OPTION_INT(arm7_threaded,           0,                 "Run the ARM7 on its own thread, a quantum behind the SH4");
+DEFINE_OPTION_INT(arm7_quantum,            100,               "Microseconds of ARM7 execution between syncs when threaded");
+DEFINE_OPTION_INT(sh4_clock,               100,               "SH4 clock as a percentage of the original, from 25 to 400. set from the menu, it's saved per title");
+DEFINE_OPTION_INT(sh4_mmu,                 0,                 "Translate addresses through the SH4's UTLB while MMUCR.AT is set, experimental. TLB miss exceptions aren't raised yet, a miss stops emulation");
+DEFINE_OPTION_INT(arm7_clock,              100,               "ARM7 clock as a percentage of the original, from 25 to 400. set from the menu, it's saved per title");
+DEFINE_OPTION_INT(chd_cache,               16,                "Number of decompressed hunks to cache when reading chd images");
+DEFINE_OPTION_INT(chd_prefetch,            4,                 "Number of chd hunks to decompress ahead of reads on a separate thread");
+DEFINE_OPTION_INT(remote_cache,            32,                "Number of 1 MB blocks to cache in memory when reading remote images");
+DEFINE_OPTION_INT(remote_prefetch,         4,                 "Number of remote image blocks to fetch ahead of sequential reads on a separate thread");
+DEFINE_OPTION_INT(gdrom_readahead,         128,               "Number of sectors to read ahead of sequential gd-rom reads on a separate thread");
+DEFINE_OPTION_STRING(gdrom_timing,         "instant",         "GD-ROM timing, \"instant\" to complete reads immediately or \"accurate\" to model seek and transfer times");
+DEFINE_OPTION_INT(gdrom_async,             1,                 "Complete hle GD-ROM reads over the game's polls as they're read ahead, rather than blocking on the disc");
+DEFINE_OPTION_STRING(gdrom_accurate,       "",                "Product numbers of games to always run with accurate GD-ROM timing");
+DEFINE_OPTION_STRING(gdrom_instant,        "",                "Product numbers of games to always run with instant GD-ROM timing");
+DEFINE_OPTION_STRING(gdrom_trace,          "",                "Path to log each gd-rom sector read to, for replaying with rebench");
+DEFINE_OPTION_STRING(profiles,             "profiles.ini",    "Database in the app dir of option overrides applied to each title listed in it as its disc is loaded, empty to disable");
+DEFINE_OPTION_INT(g2_bulk_dma,             0,                 "Copy g2 dma transfers to aram in one go, scheduling a single timer for their completion. Progress read mid-transfer is only predicted, so enable it per title through a profile");
+DEFINE_OPTION_INT(disc_preload,            0,                 "Load the entire disc into memory on a separate thread");
+DEFINE_OPTION_INT(page_merging,            0,                 "Let the kernel merge identical pages of preloaded discs, and of guest memory in builds without fastmem, across the instances running on a host");
+DEFINE_OPTION_INT(huge_pages,              0,                 "Back guest RAM, VRAM and ARAM with huge pages when available");
+DEFINE_OPTION_INT(watch_polling,           0,                 "Track writes to texture sources through the kernel's page tables, polled once per frame, rather than faulting on the first write to each page");
+DEFINE_OPTION_INT(texture_hash,            0,                 "Hash texture data to skip redecoding unchanged textures and share identical ones");
+DEFINE_OPTION_INT(texture_cache,           0,                 "Persist decoded textures to disk between sessions");
+DEFINE_OPTION_INT(video_pipelined,         0,                 "Parse the next frame on a separate thread while the current one is rendered");
+DEFINE_OPTION_INT(ta_stream,               0,                 "Convert ta params to render commands as they're written instead of at render time");
+DEFINE_OPTION_INT(oit_layers,              0,                 "Maximum number of translucent layers sorted per pixel on the gpu, rather than by sorting polygons on the cpu");
+DEFINE_OPTION_INT(gpu_verts,               0,                 "Decode polygon vertices with a compute shader on the gpu rather than on the cpu");
+DEFINE_OPTION_INT(ta_strips,               0,                 "Draw unsorted polygons as triangle strips with primitive restart rather than triangle lists");
+DEFINE_OPTION_INT(shader_cache,            0,                 "Persist compiled shader programs to disk between sessions");
+DEFINE_OPTION_INT(native_textures,         0,                 "Upload 16-bit textures in their native format rather than expanding them to 32 bits");
+DEFINE_OPTION_INT(gpu_palette,             0,                 "Look up paletted textures in a shader rather than redecoding them on palette changes");
+DEFINE_OPTION_INT(reuse_frames,            0,                 "Present the previous frame again when an identical context is submitted, skipping its conversion");
+DEFINE_OPTION_INT(fast_forward,            0,                 "Run unthrottled, skipping the rendering of frames as set by frameskip");
+DEFINE_OPTION_INT(frameskip,               3,                 "Frames not rendered out of every frameskip_period while fast forwarding");
+DEFINE_OPTION_INT(frameskip_period,        4,                 "Period in frames that frameskip applies to");
+DEFINE_OPTION_INT(fb_writeback,            0,                 "Write frames rendered to textures back to vram for games that read them");
+DEFINE_OPTION_STRING(fb_writeback_sync,    "",                "Product numbers of games whose render to texture writebacks must not be delayed");
+DEFINE_OPTION_INT(render_scale,            0,                 "Internal resolution as a percentage of the original, 0 to render at the window's");
+DEFINE_OPTION_INT(msaa,                    0,                 "Number of samples to multisample rendering with");
+DEFINE_OPTION_INT(texture_arrays,          0,                 "Allocate textures as layers of texture arrays so surfaces can be drawn together");
+DEFINE_OPTION_STRING(state,                "",                "Save state to load once the game has booted");
+DEFINE_OPTION_INT(boot_cache,              1,                 "Snapshot each disc as it enters its boot file, skipping the bios on later launches");
+DEFINE_OPTION_INT(rewind,                  0,                 "Seconds of per-frame snapshots to keep for rewinding, 0 to disable");
+DEFINE_OPTION_INT(rewind_size,             256,               "Memory in MB that rewind snapshots may use");
+DEFINE_OPTION_INT(runahead,                0,                 "Frames to run ahead of the guest, hiding its internal input latency");
+DEFINE_OPTION_INT(netplay_listen,          0,                 "Port to wait for a netplay peer on, 0 to disable");
+DEFINE_OPTION_STRING(netplay_connect,      "",                "Netplay peer to connect to, as host:port");
+DEFINE_OPTION_INT(netplay_delay,           1,                 "Frames of input delay during netplay, trading latency for fewer rollbacks");
+DEFINE_OPTION_INT(determinism_check,       0,                 "Hash guest memory every n frames, comparing it with the netplay peer or logging it");
+DEFINE_OPTION_STRING(record_movie,         "",                "Path to record every input to, stamped with guest time, once the game has booted");
+DEFINE_OPTION_STRING(play_movie,           "",                "Movie to play back once the game has booted, reproducing the recorded run exactly");
+DEFINE_OPTION_INT(frame_budget,            0,                 "Export a profile trace whenever a frame takes longer than this many milliseconds");
+DEFINE_OPTION_INT(mmio_histogram,          0,                 "Count mmio accesses per register for the debug menu, at the cost of slower mmio");
+DEFINE_OPTION_STRING(pacing_log,           "",                "Path to log the guest and host time of each frame's events to, for analyzing with repace");
 
 /* bios */
 DEFINE_PERSISTENT_OPTION_STRING(region,    "usa",             "System region");
@@ -109,9 +178,32 @@ DEFINE_PERSISTENT_OPTION_STRING(broadcast, "ntsc",            "System broadcast
 
 /* jit */
 DEFINE_OPTION_INT(perf,                    0,                 "Create maps for compiled code for use with perf");
+DEFINE_OPTION_INT(perf_jitdump,            0,                 "Create jitdump files mapping compiled code back to guest instructions for use with perf");
+DEFINE_OPTION_INT(jit_code_size,           64,                "Size of the sh4's code buffer in megabytes, between 8 and 1024");
+DEFINE_OPTION_INT(jit_a64,                 0,                 "Compile to aarch64 code on aarch64 hosts rather than interpreting, experimental");
+DEFINE_OPTION_INT(jit_cache,               0,                 "Persist optimized code to disk between sessions");
+DEFINE_OPTION_INT(jit_async,               0,                 "Number of background threads compiling code, interpreting it until ready");
+DEFINE_OPTION_INT(jit_tiered,              0,                 "Compile code with cheap passes first, fully optimizing hot code");
+DEFINE_OPTION_INT(jit_prescan,             0,                 "Compile up to n blocks reachable from a loaded binary's entry point before running it");
+DEFINE_OPTION_INT(jit_traces,              0,                 "Form traces across static branches when fully optimizing code");
+DEFINE_OPTION_INT(jit_fold_literals,       0,                 "Read pc-relative literals at compile time, assuming they're only modified along with code");
+DEFINE_OPTION_INT(jit_fastmem_checks,      FASTMEM_CHECKS,    "Check the page table inline on each fastmem access, rather than relying on costly access faults to detect mmio");
+DEFINE_OPTION_INT(jit_sample_interval,     0,                 "Sample the guest pc every n milliseconds, exporting a histogram of the samples on exit");
+DEFINE_OPTION_STRING(jit_sample_map,       "",                "Symbol map to symbolize guest pc samples with");
+
+/* threads */
+DEFINE_OPTION_STRING(emu_cpus,             "",                "Cpus to pin the emulation threads to, as a list like \"2,3\" or \"0-3\"");
+DEFINE_OPTION_INT(emu_priority,            0,                 "Priority of the emulation threads, from -1 (low) to 2 (realtime)");
+DEFINE_OPTION_STRING(video_cpus,           "",                "Cpus to pin the video threads to");
+DEFINE_OPTION_INT(video_priority,          0,                 "Priority of the video threads");
+DEFINE_OPTION_STRING(audio_cpus,           "",                "Cpus to pin the audio thread to");
+DEFINE_OPTION_INT(audio_priority,          0,                 "Priority of the audio thread");
+DEFINE_OPTION_STRING(worker_cpus,          "",                "Cpus to pin background compile and conversion threads to");
+DEFINE_OPTION_INT(worker_priority,         0,                 "Priority of background compile and conversion threads");
 
 /* ui */
 DEFINE_PERSISTENT_OPTION_STRING(gamedir,   "",                "Directories to scan for games");
+DEFINE_OPTION_INT(library_threads,         4,                 "Number of tasks scanning the game directories in parallel");
 
 /* clang-format on */
 
@@ -134,3 +226,84 @@ int video_sync_enabled() {
   }
   return 0;
 }
+
+static uint64_t parse_cpu_list(const char *str) {
+  uint64_t cpus = 0;
+
+  while (*str) {
+    char *end;
+    long first = strtol(str, &end, 10);
+    long last = first;
+
+    if (end == str) {
+      return 0;
+    }
+
+    if (*end == '-') {
+      str = end + 1;
+      last = strtol(str, &end, 10);
+
+      if (end == str) {
+        return 0;
+      }
+    }
+
+    for (long i = MAX(first, 0); i <= MIN(last, 63); i++) {
+      cpus |= 1ull << i;
+    }
+
+    str = end;
+    if (*str == ',') {
+      str++;
+    } else if (*str) {
+      return 0;
+    }
+  }
+
+  return cpus;
+}
+
+void configure_thread(int role) {
+  static const char *role_names[] = {"emu", "video", "audio", "worker"};
+  const char *cpu_list = NULL;
+  int priority = THREAD_PRIO_NORMAL;
+
+  switch (role) {
+    case THREAD_ROLE_EMU:
+      cpu_list = OPTION_emu_cpus;
+      priority = OPTION_emu_priority;
+      break;
+    case THREAD_ROLE_VIDEO:
+      cpu_list = OPTION_video_cpus;
+      priority = OPTION_video_priority;
+      break;
+    case THREAD_ROLE_AUDIO:
+      cpu_list = OPTION_audio_cpus;
+      priority = OPTION_audio_priority;
+      break;
+    case THREAD_ROLE_WORKER:
+      cpu_list = OPTION_worker_cpus;
+      priority = OPTION_worker_priority;
+      break;
+    default:
+      LOG_FATAL("configure_thread unexpected role %d", role);
+  }
+
+  if (*cpu_list) {
+    uint64_t cpus = parse_cpu_list(cpu_list);
+
+    if (!cpus) {
+      LOG_WARNING("configure_thread invalid cpu list \"%s\" for %s threads",
+                  cpu_list, role_names[role]);
+    } else if (!thread_set_affinity(NULL, cpus)) {
+      LOG_WARNING("configure_thread failed to pin %s thread to %s",
+                  role_names[role], cpu_list);
+    }
+  }
+
+  if (priority != THREAD_PRIO_NORMAL &&
+      !thread_set_priority(NULL, priority)) {
+    LOG_WARNING("configure_thread failed to set %s thread priority to %d",
+                role_names[role], priority);
+  }
+}
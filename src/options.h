@@ -40,6 +40,11 @@ extern int *DEADZONES[];
 DECLARE_OPTION_STRING(sync);
 DECLARE_OPTION_INT(bios);
 DECLARE_OPTION_INT(fullscreen);
+DECLARE_OPTION_INT(audio_rate);
+DECLARE_OPTION_INT(audio_low_latency);
+DECLARE_OPTION_INT(log_async);
+DECLARE_OPTION_INT(frame_pacing);
+DECLARE_OPTION_INT(precise_throttle);
 DECLARE_OPTION_INT(key_a);
 DECLARE_OPTION_INT(key_b);
 DECLARE_OPTION_INT(key_x);
@@ -62,6 +67,60 @@ DECLARE_OPTION_INT(deadzone_3);
 
 /* emulator */
 DECLARE_OPTION_STRING(aspect);
+DECLARE_OPTION_INT(arm7_threaded);
+DECLARE_OPTION_INT(arm7_quantum);
+DECLARE_OPTION_INT(sh4_clock);
+DECLARE_OPTION_INT(sh4_mmu);
+DECLARE_OPTION_INT(arm7_clock);
+DECLARE_OPTION_INT(chd_cache);
+DECLARE_OPTION_INT(chd_prefetch);
+DECLARE_OPTION_INT(remote_cache);
+DECLARE_OPTION_INT(remote_prefetch);
+DECLARE_OPTION_INT(gdrom_readahead);
+DECLARE_OPTION_STRING(gdrom_timing);
+DECLARE_OPTION_INT(gdrom_async);
+DECLARE_OPTION_STRING(gdrom_accurate);
+DECLARE_OPTION_STRING(gdrom_instant);
+DECLARE_OPTION_STRING(gdrom_trace);
+DECLARE_OPTION_STRING(profiles);
+DECLARE_OPTION_INT(g2_bulk_dma);
+DECLARE_OPTION_INT(disc_preload);
+DECLARE_OPTION_INT(page_merging);
+DECLARE_OPTION_INT(huge_pages);
+DECLARE_OPTION_INT(watch_polling);
+DECLARE_OPTION_INT(texture_hash);
+DECLARE_OPTION_INT(texture_cache);
+DECLARE_OPTION_INT(video_pipelined);
+DECLARE_OPTION_INT(ta_stream);
+DECLARE_OPTION_INT(ta_strips);
+DECLARE_OPTION_INT(oit_layers);
+DECLARE_OPTION_INT(gpu_verts);
+DECLARE_OPTION_INT(shader_cache);
+DECLARE_OPTION_INT(native_textures);
+DECLARE_OPTION_INT(gpu_palette);
+DECLARE_OPTION_INT(reuse_frames);
+DECLARE_OPTION_INT(fast_forward);
+DECLARE_OPTION_INT(frameskip);
+DECLARE_OPTION_INT(frameskip_period);
+DECLARE_OPTION_INT(fb_writeback);
+DECLARE_OPTION_STRING(fb_writeback_sync);
+DECLARE_OPTION_INT(render_scale);
+DECLARE_OPTION_INT(msaa);
+DECLARE_OPTION_INT(texture_arrays);
+DECLARE_OPTION_STRING(state);
+DECLARE_OPTION_INT(boot_cache);
+DECLARE_OPTION_INT(rewind);
+DECLARE_OPTION_INT(rewind_size);
+DECLARE_OPTION_INT(runahead);
+DECLARE_OPTION_INT(netplay_listen);
+DECLARE_OPTION_STRING(netplay_connect);
+DECLARE_OPTION_INT(netplay_delay);
+DECLARE_OPTION_INT(determinism_check);
+DECLARE_OPTION_STRING(record_movie);
+DECLARE_OPTION_STRING(play_movie);
+DECLARE_OPTION_INT(frame_budget);
+DECLARE_OPTION_INT(mmio_histogram);
+DECLARE_OPTION_STRING(pacing_log);
 
 /* bios */
 DECLARE_OPTION_STRING(region);
@@ -70,11 +129,44 @@ DECLARE_OPTION_STRING(broadcast);
 
 /* jit */
 DECLARE_OPTION_INT(perf);
+DECLARE_OPTION_INT(perf_jitdump);
+DECLARE_OPTION_INT(jit_code_size);
+DECLARE_OPTION_INT(jit_a64);
+DECLARE_OPTION_INT(jit_cache);
+DECLARE_OPTION_INT(jit_async);
+DECLARE_OPTION_INT(jit_tiered);
+DECLARE_OPTION_INT(jit_prescan);
+DECLARE_OPTION_INT(jit_traces);
+DECLARE_OPTION_INT(jit_fold_literals);
+DECLARE_OPTION_INT(jit_fastmem_checks);
+DECLARE_OPTION_INT(jit_sample_interval);
+DECLARE_OPTION_STRING(jit_sample_map);
+
+/* threads */
+DECLARE_OPTION_STRING(emu_cpus);
+DECLARE_OPTION_INT(emu_priority);
+DECLARE_OPTION_STRING(video_cpus);
+DECLARE_OPTION_INT(video_priority);
+DECLARE_OPTION_STRING(audio_cpus);
+DECLARE_OPTION_INT(audio_priority);
+DECLARE_OPTION_STRING(worker_cpus);
+DECLARE_OPTION_INT(worker_priority);
 
 /* ui */
 DECLARE_OPTION_STRING(gamedir);
+DECLARE_OPTION_INT(library_threads);
+
+enum {
+  THREAD_ROLE_EMU,
+  THREAD_ROLE_VIDEO,
+  THREAD_ROLE_AUDIO,
+  THREAD_ROLE_WORKER,
+};
 
 int audio_sync_enabled();
 int video_sync_enabled();
 
+/* pins the calling thread and sets its priority as configured for its role */
+void configure_thread(int role);
+
 #endif
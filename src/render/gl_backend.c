@@ -1,10 +1,21 @@
 #include <glad/glad.h>
 #include "core/core.h"
+#include "core/filesystem.h"
+#include "core/time.h"
+#include "core/xxhash.h"
 #include "host/host.h"
+#include "options.h"
 #include "render/render_backend.h"
+#include "stats.h"
 
 enum texture_map {
   MAP_DIFFUSE,
+  MAP_PALETTE,
+  MAP_OPAQUE_DEPTH,
+  MAP_LAYER_DEPTH,
+  MAP_LAYER_ID,
+  MAP_LAYER_COLOR,
+  NUM_TEXTURE_MAPS,
 };
 
 enum uniform_attr {
@@ -12,11 +23,24 @@ enum uniform_attr {
   UNIFORM_DIFFUSE,
   UNIFORM_VIDEO_SCALE,
   UNIFORM_ALPHA_REF,
+  UNIFORM_PALETTE,
+  UNIFORM_PALETTE_BASE,
+  UNIFORM_LAYER_BASE,
+  UNIFORM_OPAQUE_DEPTH,
+  UNIFORM_LAYER_DEPTH,
+  UNIFORM_LAYER_ID,
+  UNIFORM_LAYER_COLOR,
+  UNIFORM_PRIM_BASE,
+  UNIFORM_BLEND,
+  UNIFORM_NUM_VERTS,
   UNIFORM_NUM_UNIFORMS,
 };
 
 static const char *uniform_names[] = {
-    "u_proj", "u_diffuse", "u_video_scale", "u_alpha_ref",
+    "u_proj",         "u_diffuse",      "u_video_scale", "u_alpha_ref",
+    "u_palette",      "u_palette_base", "u_layer_base",  "u_opaque_depth",
+    "u_layer_depth",  "u_layer_id",     "u_layer_color", "u_prim_base",
+    "u_blend",        "u_num_verts",
 };
 
 enum shader_attr {
@@ -33,27 +57,179 @@ enum shader_attr {
   ATTR_OFFSET_COLOR = 0x20,
   ATTR_ALPHA_TEST = 0x40,
   ATTR_DEBUG_DEPTH_BUFFER = 0x80,
-  ATTR_COUNT = 0x100
+  ATTR_PALETTE = 0x100,
+  ATTR_PALETTE_FILTER = 0x200,
+  ATTR_TEXTURE_ARRAY = 0x400,
+  ATTR_PEEL = 0x800,
+  ATTR_COUNT = 0x1000
 };
 
 struct shader_program {
   GLuint prog;
   GLuint vertex_shader;
   GLuint fragment_shader;
+  GLuint compute_shader;
   GLint loc[UNIFORM_NUM_UNIFORMS];
 
   /* the last global uniforms bound to this program */
   uint64_t uniform_token;
+
+  /* the last alpha reference bound to this program */
+  int alpha_ref;
+
+  /* the last palette base bound to this program */
+  int palette_base;
+
+  /* the last texture array's first handle bound to this program */
+  int layer_base;
+
+  /* the last blend functions bound to this program */
+  int blend;
 };
 
 struct texture {
   GLuint texture;
+
+  /* storage info, textures with matching storage are interchangeable */
+  enum pxl_format format;
+  int width;
+  int height;
+  int mipmaps;
+
+  /* 1-based index of the texture array whose handle range this entry falls
+     in, and the sampler used to emulate the texture's own sampler state */
+  int array;
+  int sampler;
+};
+
+/* when the texture_arrays option is enabled, non-mipmapped power of two
+   textures are allocated as layers of texture arrays, bucketed by format and
+   size. each
+   array owns a contiguous range of texture handles, a layer's index being its
+   handle's offset into the range. ta vertices are tagged with their texture's
+   handle, so surfaces whose textures share an array can be drawn together */
+#define MAX_TEXTURE_ARRAYS 128
+#define MAX_ARRAY_LAYERS 64
+#define MIN_ARRAY_LAYERS 4
+#define ARRAY_LAYER_BUDGET (16 * 1024 * 1024)
+#define MIN_ARRAY_SIZE 8
+#define MAX_ARRAY_SIZE 1024
+
+struct texture_array {
+  GLuint texture;
+  enum pxl_format format;
+  int width;
+  int height;
+  int num_layers;
+  texture_handle_t base;
+  int free_layers[MAX_ARRAY_LAYERS];
+  int num_free_layers;
+};
+
+/* readbacks are started after a frame is rendered and finished once the gpu
+   signals its fence, normally by the next frame */
+#define NUM_READBACKS 2
+
+struct readback {
+  GLuint pbo;
+  GLsync fence;
+  int size;
+  int width;
+  int height;
+};
+
+/* array layers share their array's sampler state, so each texture's own state
+   is applied through one of these sampler objects instead */
+#define NUM_SAMPLERS (NUM_FILTER_MODES * 3 * 3)
+
+/* when the shader_cache option is enabled, the binary for each ta program is
+   appended to a cache file as it's compiled, and every program in the file is
+   loaded up front on future sessions. the file is keyed by the driver and the
+   shader sources, and is started over whenever either changes */
+#define SHADER_CACHE_MAGIC 0x52444853 /* SHDR */
+#define SHADER_CACHE_VERSION 1
+
+struct shader_cache_header {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t key;
+};
+
+struct shader_cache_entry {
+  uint32_t attrs;
+  uint32_t format;
+  int32_t size;
+  int32_t reserved;
 };
 
+/* destroyed texture objects are kept around to be reused by textures with the
+   same storage, avoiding the cost of reallocating them in the driver */
+#define MAX_FREE_TEXTURES 128
+
+/* texture data is streamed through a ring of pixel buffer objects, letting
+   the driver copy it to the texture asynchronously */
+#define NUM_UPLOAD_BUFFERS 4
+
 struct viewport {
   int x, y, w, h;
 };
 
+/* shadowed copy of the gl state, used to skip redundant state changes. -1
+   marks a value as unknown, forcing it to be set */
+struct render_state {
+  int depth_mask;
+  int depth_func;
+  int cull;
+  int src_blend;
+  int dst_blend;
+  int program;
+  int textures[NUM_TEXTURE_MAPS];
+  int texture_array;
+  int sampler;
+  int primitive_restart;
+};
+
+/* when the oit_layers option is enabled, translucent surfaces are sorted per
+   pixel by depth peeling. each layer of fragments is peeled from back to front
+   into one of two framebuffers, alternating such that the previous layer's
+   depth and polygon id can be read while peeling the next. after it's peeled,
+   the layer is blended into the ta target with each blend function the
+   surfaces used. blend functions are packed as src << 4 | dst */
+#define MAX_OIT_BLENDS 256
+
+/* consecutive ta surfaces with identical params are batched together into a
+   single draw call */
+#define MAX_BATCH_DRAWS 256
+
+/* when GL_ARB_buffer_storage is available, ta vertices and indices are written
+   to persistently mapped ring buffers, partitioned into a region per frame in
+   flight. 16-bit indices can't address more vertices than this */
+#define TA_RING_FRAMES 3
+#define TA_RING_VERTS (1 << 16)
+#define TA_RING_INDICES (TA_RING_VERTS * 3)
+
+/* gpu time spent in each stage of rendering is measured by timestamp queries
+   written around it. they're read back once available, generally a couple of
+   frames later, instead of stalling on them. a stage is left untimed if the
+   ring of zones is still full of pending queries when it begins */
+#define MAX_GPU_ZONES 64
+
+enum gpu_stage {
+  /* ta stages come first, matching enum ta_stage */
+  GPU_STAGE_UI = TA_NUM_STAGES,
+  NUM_GPU_STAGES,
+};
+
+static const char *gpu_stage_names[NUM_GPU_STAGES] = {
+    "gpu_background", "gpu_opaque", "gpu_punch_through", "gpu_translucent",
+    "gpu_ui",
+};
+
+struct gpu_zone {
+  int stage;
+  GLuint queries[2];
+};
+
 struct render_backend {
   struct host *host;
   int width, height;
@@ -61,22 +237,116 @@ struct render_backend {
   /* current viewport */
   struct viewport viewport;
 
+  struct render_state state;
+
+  /* pending draws for the current batch of ta surfaces */
+  uint64_t batch_params;
+  GLuint batch_sampler;
+  GLenum batch_mode;
+  struct shader_program *batch_program;
+  GLsizei batch_counts[MAX_BATCH_DRAWS];
+  const GLvoid *batch_offsets[MAX_BATCH_DRAWS];
+  int num_batch_draws;
+
   /* default assets created during intitialization */
   GLuint white_texture;
+  GLuint palette_texture;
   struct shader_program ta_programs[ATTR_COUNT];
   struct shader_program ui_program;
+  struct shader_program oit_program;
+  struct shader_program decode_program;
+
+  /* program binary cache, NULL when disabled */
+  FILE *shader_cache;
 
   /* offscreen framebuffer for blitting raw pixels */
   GLuint pixel_fbo;
   GLuint pixel_texture;
 
+  /* offscreen target ta surfaces are rendered to when the internal resolution
+     is scaled or multisampled. once finished, it's resolved and blitted to the
+     viewport of the framebuffer that was bound when they began */
+  int ta_offscreen;
+  GLint ta_output_fbo;
+  GLuint ta_fbo;
+  GLuint ta_color_rbo;
+  GLuint ta_depth_rbo;
+  GLuint ta_depth_texture;
+  GLuint ta_resolve_fbo;
+  GLuint ta_resolve_rbo;
+  int ta_fbo_width;
+  int ta_fbo_height;
+  int ta_fbo_samples;
+  int ta_fbo_oit;
+  int max_samples;
+
+  /* depth peeling targets, only created along with an oit target. the color
+     attachment is shared, as each layer is composited before the next */
+  GLuint oit_fbos[2];
+  GLuint oit_depth_textures[2];
+  GLuint oit_id_textures[2];
+  GLuint oit_color_texture;
+  GLuint oit_queries[2];
+  int oit_layers;
+  int oit_blends[MAX_OIT_BLENDS];
+  int num_oit_blends;
+  uint8_t oit_blend_used[MAX_OIT_BLENDS];
+
+  /* layer currently being peeled, -1 when not peeling */
+  int ta_layer;
+
+  /* set while the offscreen target still holds the last frame rendered to it,
+     letting it be presented again without redrawing its surfaces */
+  int ta_fbo_valid;
+
+  /* pixel buffers that rendered video is asynchronously read back into, and
+     the offscreen framebuffer it's scaled down to its original resolution in
+     first */
+  struct readback readbacks[NUM_READBACKS];
+  int readback_head;
+  int num_readbacks;
+  GLuint readback_fbo;
+  GLuint readback_rbo;
+  int readback_width;
+  int readback_height;
+
   /* texture cache */
   struct texture textures[MAX_TEXTURES];
+  struct texture free_textures[MAX_FREE_TEXTURES];
+  int num_free_textures;
+
+  struct texture_array arrays[MAX_TEXTURE_ARRAYS];
+  int num_arrays;
+  GLuint samplers[NUM_SAMPLERS];
+
+  GLuint upload_buffers[NUM_UPLOAD_BUFFERS];
+  int upload_sizes[NUM_UPLOAD_BUFFERS];
+  int next_upload_buffer;
 
   /* surface render state */
   GLuint ta_vao;
   GLuint ta_vbo;
   GLuint ta_ibo;
+
+  /* persistently mapped ring buffers, and a vao for each of their regions */
+  int ta_ring;
+  GLuint ta_ring_vaos[TA_RING_FRAMES];
+  GLuint ta_ring_vbo;
+  GLuint ta_ring_ibo;
+  struct ta_vertex *ta_ring_verts;
+  uint16_t *ta_ring_indices;
+  GLsync ta_ring_fences[TA_RING_FRAMES];
+  int ta_ring_next;
+  int ta_ring_frame;
+
+  /* byte offset of the current frame's indices in the bound index buffer */
+  intptr_t ta_index_offset;
+  int ta_num_verts;
+
+  /* buffers the raw ta params and the indices of the vertices encoded in them
+     are uploaded to for decoding, when the gpu_verts option is enabled */
+  GLuint ta_param_ssbo;
+  GLuint ta_encoded_ssbo;
   GLuint ui_vao;
   GLuint ui_vbo;
   GLuint ui_ibo;
@@ -86,6 +356,20 @@ struct render_backend {
      to begin_surfaces and end_surfaces */
   uint64_t uniform_token;
   float uniform_video_scale[4];
+  int video_width;
+  int video_height;
+
+  /* ring of timed zones, those between tail and head are waiting on their
+     queries. gles doesn't support timestamp queries */
+  int gpu_timers;
+  struct gpu_zone gpu_zones[MAX_GPU_ZONES];
+  unsigned gpu_zone_head;
+  unsigned gpu_zone_tail;
+  /* stage of the zone at the head, -1 when no zone is open */
+  int gpu_stage;
+  /* difference between the cpu and gpu clocks, resynced every second */
+  int64_t gpu_clock_offset;
+  int64_t gpu_clock_synced;
 };
 
 #include "render/ta.glsl"
@@ -147,6 +431,23 @@ static GLuint internal_formats[] = {
     GL_RGBA, /* PXL_RGBA4444 */
 };
 
+/* immutable storage requires sized internal formats */
+static GLuint storage_formats[] = {
+    GL_RGB8,    /* PXL_RGB */
+    GL_RGBA8,   /* PXL_RGBA */
+    GL_RGB5_A1, /* PXL_RGBA5551 */
+    GL_RGB565,  /* PXL_RGB565 */
+    GL_RGBA4,   /* PXL_RGBA4444 */
+};
+
+static int pixel_sizes[] = {
+    3, /* PXL_RGB */
+    4, /* PXL_RGBA */
+    2, /* PXL_RGBA5551 */
+    2, /* PXL_RGB565 */
+    2, /* PXL_RGBA4444 */
+};
+
 static GLuint pixel_formats[] = {
     GL_UNSIGNED_BYTE,          /* PXL_RGB */
     GL_UNSIGNED_BYTE,          /* PXL_RGBA */
@@ -155,10 +456,152 @@ static GLuint pixel_formats[] = {
     GL_UNSIGNED_SHORT_4_4_4_4, /* PXL_RGBA4444 */
 };
 
+static void r_reset_state(struct render_backend *r) {
+  /* the host may have modified the gl state since it was last shadowed */
+  memset(&r->state, 0xff, sizeof(r->state));
+}
+
 static inline void r_bind_texture(struct render_backend *r,
                                   enum texture_map map, GLuint tex) {
-  glActiveTexture(GL_TEXTURE0 + map);
-  glBindTexture(GL_TEXTURE_2D, tex);
+  if (r->state.textures[map] == (int)tex) {
+    return;
+  }
+
+  /* the diffuse unit is left active, as textures are created and modified
+     through it */
+  if (map != MAP_DIFFUSE) {
+    glActiveTexture(GL_TEXTURE0 + map);
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glActiveTexture(GL_TEXTURE0 + MAP_DIFFUSE);
+  } else {
+    glActiveTexture(GL_TEXTURE0 + map);
+    glBindTexture(GL_TEXTURE_2D, tex);
+  }
+
+  r->state.textures[map] = (int)tex;
+}
+
+static inline void r_bind_texture_array(struct render_backend *r, GLuint tex) {
+  if (r->state.texture_array == (int)tex) {
+    return;
+  }
+
+  glActiveTexture(GL_TEXTURE0 + MAP_DIFFUSE);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, tex);
+  r->state.texture_array = (int)tex;
+}
+
+static inline void r_bind_sampler(struct render_backend *r, GLuint sampler) {
+  if (r->state.sampler == (int)sampler) {
+    return;
+  }
+
+  glBindSampler(MAP_DIFFUSE, sampler);
+  r->state.sampler = (int)sampler;
+}
+
+static inline void r_use_program(struct render_backend *r, GLuint prog) {
+  if (r->state.program == (int)prog) {
+    return;
+  }
+
+  glUseProgram(prog);
+  r->state.program = (int)prog;
+}
+
+static inline void r_set_depth_mask(struct render_backend *r, int enabled) {
+  if (r->state.depth_mask == enabled) {
+    return;
+  }
+
+  glDepthMask(enabled);
+  r->state.depth_mask = enabled;
+}
+
+static inline void r_set_depth_func(struct render_backend *r,
+                                    enum depth_func func) {
+  if (r->state.depth_func == (int)func) {
+    return;
+  }
+
+  if (func == DEPTH_NONE) {
+    glDisable(GL_DEPTH_TEST);
+  } else {
+    if (r->state.depth_func == DEPTH_NONE || r->state.depth_func == -1) {
+      glEnable(GL_DEPTH_TEST);
+    }
+    glDepthFunc(depth_funcs[func]);
+  }
+
+  r->state.depth_func = (int)func;
+}
+
+static inline void r_set_cull(struct render_backend *r, enum cull_face cull) {
+  if (r->state.cull == (int)cull) {
+    return;
+  }
+
+  if (cull == CULL_NONE) {
+    glDisable(GL_CULL_FACE);
+  } else {
+    if (r->state.cull == CULL_NONE || r->state.cull == -1) {
+      glEnable(GL_CULL_FACE);
+    }
+    glCullFace(cull_face[cull]);
+  }
+
+  r->state.cull = (int)cull;
+}
+
+static inline void r_set_primitive_restart(struct render_backend *r,
+                                           int enabled) {
+  if (r->state.primitive_restart == enabled) {
+    return;
+  }
+
+  /* gles only supports restarting on the maximum index, which desktop gl
+     only supports since 4.3 */
+  if (glPrimitiveRestartIndex) {
+    if (enabled) {
+      glEnable(GL_PRIMITIVE_RESTART);
+      glPrimitiveRestartIndex(RESTART_INDEX);
+    } else {
+      glDisable(GL_PRIMITIVE_RESTART);
+    }
+  } else if (enabled) {
+    glEnable(GL_PRIMITIVE_RESTART_FIXED_INDEX);
+  } else {
+    glDisable(GL_PRIMITIVE_RESTART_FIXED_INDEX);
+  }
+
+  r->state.primitive_restart = enabled;
+}
+
+static inline void r_set_blend(struct render_backend *r,
+                               enum blend_func src_blend,
+                               enum blend_func dst_blend) {
+  /* blending is disabled if either function is none */
+  if (src_blend == BLEND_NONE || dst_blend == BLEND_NONE) {
+    src_blend = BLEND_NONE;
+    dst_blend = BLEND_NONE;
+  }
+
+  if (r->state.src_blend == (int)src_blend &&
+      r->state.dst_blend == (int)dst_blend) {
+    return;
+  }
+
+  if (src_blend == BLEND_NONE) {
+    glDisable(GL_BLEND);
+  } else {
+    if (r->state.src_blend == BLEND_NONE || r->state.src_blend == -1) {
+      glEnable(GL_BLEND);
+    }
+    glBlendFunc(blend_funcs[src_blend], blend_funcs[dst_blend]);
+  }
+
+  r->state.src_blend = (int)src_blend;
+  r->state.dst_blend = (int)dst_blend;
 }
 
 static void r_print_shader_log(GLuint shader) {
@@ -201,11 +644,37 @@ static void r_destroy_program(struct shader_program *program) {
     glDeleteShader(program->fragment_shader);
   }
 
+  if (program->compute_shader) {
+    glDeleteShader(program->compute_shader);
+  }
+
   if (program->prog) {
     glDeleteProgram(program->prog);
   }
 }
 
+static void r_init_program(struct render_backend *r,
+                           struct shader_program *program) {
+  for (int i = 0; i < UNIFORM_NUM_UNIFORMS; i++) {
+    program->loc[i] = glGetUniformLocation(program->prog, uniform_names[i]);
+  }
+
+  program->alpha_ref = -1;
+  program->palette_base = -1;
+  program->layer_base = -1;
+  program->blend = -1;
+
+  /* bind samplers once after compile, these currently never change */
+  r_use_program(r, program->prog);
+  glUniform1i(program->loc[UNIFORM_DIFFUSE], MAP_DIFFUSE);
+  glUniform1i(program->loc[UNIFORM_PALETTE], MAP_PALETTE);
+  glUniform1i(program->loc[UNIFORM_OPAQUE_DEPTH], MAP_OPAQUE_DEPTH);
+  glUniform1i(program->loc[UNIFORM_LAYER_DEPTH], MAP_LAYER_DEPTH);
+  glUniform1i(program->loc[UNIFORM_LAYER_ID], MAP_LAYER_ID);
+  glUniform1i(program->loc[UNIFORM_LAYER_COLOR], MAP_LAYER_COLOR);
+  r_use_program(r, 0);
+}
+
 static int r_compile_program(struct render_backend *r,
                              struct shader_program *program, const char *header,
                              const char *vertex_source,
@@ -252,6 +721,11 @@ static int r_compile_program(struct render_backend *r,
     glAttachShader(program->prog, program->fragment_shader);
   }
 
+  if (r->shader_cache) {
+    glProgramParameteri(program->prog, GL_PROGRAM_BINARY_RETRIEVABLE_HINT,
+                        GL_TRUE);
+  }
+
   glLinkProgram(program->prog);
 
   GLint linked;
@@ -262,179 +736,878 @@ static int r_compile_program(struct render_backend *r,
     return 0;
   }
 
-  for (int i = 0; i < UNIFORM_NUM_UNIFORMS; i++) {
-    program->loc[i] = glGetUniformLocation(program->prog, uniform_names[i]);
-  }
-
-  /* bind diffuse sampler once after compile, this currently never changes */
-  glUseProgram(program->prog);
-  glUniform1i(program->loc[UNIFORM_DIFFUSE], MAP_DIFFUSE);
-  glUseProgram(0);
+  r_init_program(r, program);
 
   return 1;
 }
 
-static void r_destroy_shaders(struct render_backend *r) {
-  for (int i = 0; i < ATTR_COUNT; i++) {
-    r_destroy_program(&r->ta_programs[i]);
+static int r_compile_compute_program(struct render_backend *r,
+                                     struct shader_program *program,
+                                     const char *compute_source) {
+  char buffer[16384] = {0};
+
+  memset(program, 0, sizeof(*program));
+  program->prog = glCreateProgram();
+
+  /* compute shaders are only supported on gl 4.3 and up */
+  snprintf(buffer, sizeof(buffer) - 1, "#version 430 core\n%s",
+           compute_source);
+  buffer[sizeof(buffer) - 1] = 0;
+
+  if (!r_compile_shader(buffer, GL_COMPUTE_SHADER, &program->compute_shader)) {
+    r_destroy_program(program);
+    return 0;
   }
 
-  r_destroy_program(&r->ui_program);
-}
+  glAttachShader(program->prog, program->compute_shader);
+  glLinkProgram(program->prog);
 
-static void r_create_shaders(struct render_backend *r) {
-  /* ta shaders are lazy-compiled in r_get_ta_program to improve startup time */
+  GLint linked;
+  glGetProgramiv(program->prog, GL_LINK_STATUS, &linked);
 
-  if (!r_compile_program(r, &r->ui_program, NULL, ui_vp, ui_fp)) {
-    LOG_FATAL("failed to compile ui shader");
+  if (!linked) {
+    r_destroy_program(program);
+    return 0;
   }
-}
 
-static void r_destroy_textures(struct render_backend *r) {
-  glDeleteTextures(1, &r->white_texture);
+  r_init_program(r, program);
 
-  glDeleteFramebuffers(1, &r->pixel_fbo);
-  glDeleteTextures(1, &r->pixel_texture);
+  return 1;
+}
 
-  for (int i = 0; i < MAX_TEXTURES; i++) {
-    struct texture *tex = &r->textures[i];
+static int r_load_program(struct render_backend *r,
+                          struct shader_program *program, GLenum format,
+                          const void *binary, int size) {
+  memset(program, 0, sizeof(*program));
+  program->prog = glCreateProgram();
 
-    if (!tex->texture) {
-      continue;
-    }
+  /* keep the binary retrievable in case the cache needs to be rewritten */
+  glProgramParameteri(program->prog, GL_PROGRAM_BINARY_RETRIEVABLE_HINT,
+                      GL_TRUE);
+  glProgramBinary(program->prog, format, binary, size);
 
-    glDeleteTextures(1, &tex->texture);
+  /* the driver is free to reject binaries it no longer supports */
+  GLint linked;
+  glGetProgramiv(program->prog, GL_LINK_STATUS, &linked);
+
+  if (!linked) {
+    r_destroy_program(program);
+    return 0;
   }
-}
 
-static void r_create_textures(struct render_backend *r) {
-  /* create default all white texture */
-  uint8_t pixels[64 * 64 * 4];
-  memset(pixels, 0xff, sizeof(pixels));
+  r_init_program(r, program);
 
-  glGenTextures(1, &r->white_texture);
-  glBindTexture(GL_TEXTURE_2D, r->white_texture);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 64, 64, 0, GL_RGBA, GL_UNSIGNED_BYTE,
-               pixels);
-  glBindTexture(GL_TEXTURE_2D, 0);
+  return 1;
+}
 
-  /* create fbo for blitting raw framebuffers to */
-  glGenFramebuffers(1, &r->pixel_fbo);
-  glBindFramebuffer(GL_FRAMEBUFFER, r->pixel_fbo);
+static void r_save_program(struct render_backend *r,
+                           const struct shader_program *program, int attrs) {
+  GLint size = 0;
+  glGetProgramiv(program->prog, GL_PROGRAM_BINARY_LENGTH, &size);
 
-  glGenTextures(1, &r->pixel_texture);
-  glBindTexture(GL_TEXTURE_2D, r->pixel_texture);
+  if (size <= 0) {
+    return;
+  }
 
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 1, 1, 0, GL_RGB,
-               GL_UNSIGNED_SHORT_5_6_5, 0);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  void *binary = malloc(size);
+  GLenum format;
+  glGetProgramBinary(program->prog, size, &size, &format, binary);
 
-  GLenum buffers[] = {GL_COLOR_ATTACHMENT0};
-  glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, r->pixel_texture,
-                       0);
-  glDrawBuffers(ARRAY_SIZE(buffers), buffers);
+  struct shader_cache_entry entry = {0};
+  entry.attrs = attrs;
+  entry.format = format;
+  entry.size = size;
 
-  GLenum res = glCheckFramebufferStatus(GL_FRAMEBUFFER);
-  CHECK_EQ(res, GL_FRAMEBUFFER_COMPLETE);
+  int res = fwrite(&entry, sizeof(entry), 1, r->shader_cache) == 1 &&
+            fwrite(binary, size, 1, r->shader_cache) == 1;
+  fflush(r->shader_cache);
 
-  glBindTexture(GL_TEXTURE_2D, 0);
-  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  if (!res) {
+    LOG_WARNING("r_save_program failed to write program binary");
+  }
+
+  free(binary);
 }
 
-static void r_destroy_vertex_arrays(struct render_backend *r) {
-  glDeleteBuffers(1, &r->ui_ibo);
-  glDeleteBuffers(1, &r->ui_vbo);
-  glDeleteVertexArrays(1, &r->ui_vao);
+static uint64_t r_shader_cache_key() {
+  const char *strings[] = {
+      (const char *)glGetString(GL_VENDOR),
+      (const char *)glGetString(GL_RENDERER),
+      (const char *)glGetString(GL_VERSION), ta_vp, ta_fp,
+  };
 
-  glDeleteBuffers(1, &r->ta_ibo);
-  glDeleteBuffers(1, &r->ta_vbo);
-  glDeleteVertexArrays(1, &r->ta_vao);
+  uint64_t key = 0;
+
+  for (int i = 0; i < ARRAY_SIZE(strings); i++) {
+    const char *str = strings[i] ? strings[i] : "";
+    key = xxh64(str, strlen(str), key);
+  }
+
+  return key;
 }
 
-static void r_create_vertex_arrays(struct render_backend *r) {
-  /* ui vao */
-  {
-    glGenVertexArrays(1, &r->ui_vao);
-    glBindVertexArray(r->ui_vao);
+static int r_read_shader_cache(struct render_backend *r, uint64_t key) {
+  struct shader_cache_header header;
 
-    glGenBuffers(1, &r->ui_vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, r->ui_vbo);
+  if (fread(&header, sizeof(header), 1, r->shader_cache) != 1 ||
+      header.magic != SHADER_CACHE_MAGIC ||
+      header.version != SHADER_CACHE_VERSION || header.key != key) {
+    return 0;
+  }
 
-    glGenBuffers(1, &r->ui_ibo);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, r->ui_ibo);
+  int num_programs = 0;
+  struct shader_cache_entry entry;
 
-    /* xy */
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(struct ui_vertex),
-                          (void *)offsetof(struct ui_vertex, xy));
+  while (fread(&entry, sizeof(entry), 1, r->shader_cache) == 1) {
+    if (entry.attrs >= ATTR_COUNT || entry.size <= 0) {
+      return 0;
+    }
 
-    /* texcoord */
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(struct ui_vertex),
-                          (void *)offsetof(struct ui_vertex, uv));
+    void *binary = malloc(entry.size);
 
-    /* color */
-    glEnableVertexAttribArray(2);
-    glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE,
-                          sizeof(struct ui_vertex),
-                          (void *)offsetof(struct ui_vertex, color));
+    if (fread(binary, entry.size, 1, r->shader_cache) != 1) {
+      free(binary);
+      return 0;
+    }
 
-    glBindVertexArray(0);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    struct shader_program *program = &r->ta_programs[entry.attrs];
+
+    if (!program->prog && r_load_program(r, program, entry.format, binary,
+                                         entry.size)) {
+      num_programs++;
+    }
+
+    free(binary);
   }
 
-  /* ta vao */
-  {
-    glGenVertexArrays(1, &r->ta_vao);
-    glBindVertexArray(r->ta_vao);
+  LOG_INFO("r_read_shader_cache loaded %d programs", num_programs);
 
-    glGenBuffers(1, &r->ta_vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, r->ta_vbo);
+  return feof(r->shader_cache);
+}
 
-    glGenBuffers(1, &r->ta_ibo);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, r->ta_ibo);
+static void r_open_shader_cache(struct render_backend *r) {
+  if (!OPTION_shader_cache) {
+    return;
+  }
 
-    /* xyz */
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(struct ta_vertex),
-                          (void *)offsetof(struct ta_vertex, xyz));
+  /* program binaries are core in gles 3.0, but an extension on desktop */
+  GLint num_formats = 0;
 
-    /* texcoord */
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(struct ta_vertex),
-                          (void *)offsetof(struct ta_vertex, uv));
+  if (glGetProgramBinary && glProgramBinary && glProgramParameteri) {
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &num_formats);
+  }
+
+  if (!num_formats) {
+    LOG_WARNING("r_open_shader_cache program binaries aren't supported");
+    return;
+  }
+
+  char filename[PATH_MAX];
+  snprintf(filename, sizeof(filename), "%s" PATH_SEPARATOR "shader-cache.bin",
+           fs_appdir());
+
+  uint64_t key = r_shader_cache_key();
+
+  r->shader_cache = fopen(filename, "r+b");
+
+  if (r->shader_cache && r_read_shader_cache(r, key)) {
+    /* new programs are appended to the end */
+    fseek(r->shader_cache, 0, SEEK_END);
+    return;
+  }
+
+  /* the cache is missing, stale or corrupt, start it over with the programs
+     that did load */
+  if (r->shader_cache) {
+    fclose(r->shader_cache);
+  }
+
+  r->shader_cache = fopen(filename, "w+b");
+
+  if (!r->shader_cache) {
+    LOG_WARNING("r_open_shader_cache failed to open %s", filename);
+    return;
+  }
+
+  struct shader_cache_header header = {0};
+  header.magic = SHADER_CACHE_MAGIC;
+  header.version = SHADER_CACHE_VERSION;
+  header.key = key;
+  fwrite(&header, sizeof(header), 1, r->shader_cache);
+
+  for (int i = 0; i < ATTR_COUNT; i++) {
+    if (r->ta_programs[i].prog) {
+      r_save_program(r, &r->ta_programs[i], i);
+    }
+  }
+}
+
+static void r_destroy_shaders(struct render_backend *r) {
+  if (r->shader_cache) {
+    fclose(r->shader_cache);
+  }
+
+  for (int i = 0; i < ATTR_COUNT; i++) {
+    r_destroy_program(&r->ta_programs[i]);
+  }
+
+  r_destroy_program(&r->ui_program);
+  r_destroy_program(&r->oit_program);
+  r_destroy_program(&r->decode_program);
+}
+
+static void r_create_shaders(struct render_backend *r) {
+  /* ta shaders are lazy-compiled in r_get_ta_program to improve startup time.
+     when the shader cache is enabled, the programs compiled in previous
+     sessions are loaded up front instead, avoiding hitches the first time
+     they're used */
+  r_open_shader_cache(r);
+
+  if (!r_compile_program(r, &r->ui_program, NULL, ui_vp, ui_fp)) {
+    LOG_FATAL("failed to compile ui shader");
+  }
+
+  if (OPTION_gpu_verts > 0 &&
+      !r_compile_compute_program(r, &r->decode_program, ta_cp)) {
+    LOG_FATAL("failed to compile ta decode shader");
+  }
+}
+
+static void r_destroy_ta_target(struct render_backend *r) {
+  if (!r->ta_fbo) {
+    return;
+  }
+
+  glDeleteFramebuffers(1, &r->ta_fbo);
+  glDeleteRenderbuffers(1, &r->ta_color_rbo);
+  glDeleteRenderbuffers(1, &r->ta_depth_rbo);
+  glDeleteTextures(1, &r->ta_depth_texture);
+  glDeleteFramebuffers(1, &r->ta_resolve_fbo);
+  glDeleteRenderbuffers(1, &r->ta_resolve_rbo);
+
+  if (r->ta_fbo_oit) {
+    glDeleteFramebuffers(2, r->oit_fbos);
+    glDeleteTextures(2, r->oit_depth_textures);
+    glDeleteTextures(2, r->oit_id_textures);
+    glDeleteTextures(1, &r->oit_color_texture);
+    glDeleteQueries(2, r->oit_queries);
+  }
+
+  r->ta_fbo = 0;
+  r->ta_depth_rbo = 0;
+  r->ta_depth_texture = 0;
+  r->ta_fbo_oit = 0;
+  r->ta_resolve_fbo = 0;
+  r->ta_fbo_valid = 0;
+}
+
+static GLuint r_create_target_texture(struct render_backend *r,
+                                      GLint internal_format, GLenum format,
+                                      GLenum type, int width, int height) {
+  GLuint texture;
+  glGenTextures(1, &texture);
+  r_bind_texture(r, MAP_DIFFUSE, texture);
+  glTexImage2D(GL_TEXTURE_2D, 0, internal_format, width, height, 0, format,
+               type, NULL);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  r_bind_texture(r, MAP_DIFFUSE, 0);
+  return texture;
+}
+
+static void r_create_oit_targets(struct render_backend *r, int width,
+                                 int height) {
+  static const GLenum draw_buffers[] = {GL_COLOR_ATTACHMENT0,
+                                        GL_COLOR_ATTACHMENT1};
+
+  if (!r->oit_program.prog &&
+      !r_compile_program(r, &r->oit_program, NULL, oit_vp, oit_fp)) {
+    LOG_FATAL("failed to compile oit shader");
+  }
+
+  r->oit_color_texture = r_create_target_texture(r, GL_RGBA8, GL_RGBA,
+                                                 GL_UNSIGNED_BYTE, width,
+                                                 height);
+
+  glGenFramebuffers(2, r->oit_fbos);
+  glGenQueries(2, r->oit_queries);
+
+  for (int i = 0; i < 2; i++) {
+    r->oit_id_textures[i] = r_create_target_texture(
+        r, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, width, height);
+    r->oit_depth_textures[i] = r_create_target_texture(
+        r, GL_DEPTH_COMPONENT32F, GL_DEPTH_COMPONENT, GL_FLOAT, width, height);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, r->oit_fbos[i]);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                           r->oit_color_texture, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D,
+                           r->oit_id_textures[i], 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D,
+                           r->oit_depth_textures[i], 0);
+    glDrawBuffers(2, draw_buffers);
+
+    GLenum res = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    CHECK_EQ(res, GL_FRAMEBUFFER_COMPLETE);
+  }
+}
+
+static void r_create_ta_target(struct render_backend *r, int width, int height,
+                               int samples, int oit) {
+  r_destroy_ta_target(r);
+
+  /* the opaque depth is sampled while peeling translucent layers */
+  if (oit) {
+    r_create_oit_targets(r, width, height);
+  }
+
+  glGenFramebuffers(1, &r->ta_fbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, r->ta_fbo);
+
+  glGenRenderbuffers(1, &r->ta_color_rbo);
+  glBindRenderbuffer(GL_RENDERBUFFER, r->ta_color_rbo);
+  glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, GL_RGBA8, width,
+                                   height);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                            GL_RENDERBUFFER, r->ta_color_rbo);
+
+  if (oit) {
+    r->ta_depth_texture =
+        r_create_target_texture(r, GL_DEPTH_COMPONENT24, GL_DEPTH_COMPONENT,
+                                GL_UNSIGNED_INT, width, height);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D,
+                           r->ta_depth_texture, 0);
+  } else {
+    glGenRenderbuffers(1, &r->ta_depth_rbo);
+    glBindRenderbuffer(GL_RENDERBUFFER, r->ta_depth_rbo);
+    glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples,
+                                     GL_DEPTH_COMPONENT24, width, height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                              GL_RENDERBUFFER, r->ta_depth_rbo);
+  }
+
+  GLenum res = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+  CHECK_EQ(res, GL_FRAMEBUFFER_COMPLETE);
+
+  /* multisampled framebuffers can only be blitted to one of the same size, so
+     they're resolved to a single sampled one first */
+  if (samples) {
+    glGenFramebuffers(1, &r->ta_resolve_fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, r->ta_resolve_fbo);
+
+    glGenRenderbuffers(1, &r->ta_resolve_rbo);
+    glBindRenderbuffer(GL_RENDERBUFFER, r->ta_resolve_rbo);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                              GL_RENDERBUFFER, r->ta_resolve_rbo);
+
+    res = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    CHECK_EQ(res, GL_FRAMEBUFFER_COMPLETE);
+  }
+
+  glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+  r->ta_fbo_width = width;
+  r->ta_fbo_height = height;
+  r->ta_fbo_samples = samples;
+  r->ta_fbo_oit = oit;
+}
+
+static int r_ta_target_size(struct render_backend *r, int video_width,
+                            int video_height, int *width, int *height,
+                            int *samples) {
+  int scale = OPTION_render_scale;
+  int oit = OPTION_oit_layers > 0;
+  *samples = MIN(MAX(OPTION_msaa, 0), r->max_samples);
+
+  /* layers are peeled per pixel, which isn't done per sample. the opaque depth
+     must also be sampled, so it has to be rendered offscreen */
+  if (oit) {
+    *samples = 0;
+  }
+
+  /* by default, surfaces are rendered directly to the viewport */
+  if (scale <= 0 && *samples <= 0 && !oit) {
+    return 0;
+  }
+
+  /* the scale is a percentage of the original video resolution. the
+     projection is resolution independent, so only the viewport changes */
+  *width = r->viewport.w;
+  *height = r->viewport.h;
+
+  if (scale > 0) {
+    *width = MAX(video_width * scale / 100, 1);
+    *height = MAX(video_height * scale / 100, 1);
+  }
+
+  return 1;
+}
+
+static void r_begin_ta_target(struct render_backend *r, int video_width,
+                              int video_height) {
+  int width, height, samples;
+  int oit = OPTION_oit_layers > 0;
+
+  glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &r->ta_output_fbo);
+
+  r->ta_offscreen = r_ta_target_size(r, video_width, video_height, &width,
+                                     &height, &samples);
+  r->ta_fbo_valid = 0;
+  r->oit_layers = oit ? OPTION_oit_layers : 0;
+
+  if (!r->ta_offscreen) {
+    return;
+  }
+
+  if (!r->ta_fbo || r->ta_fbo_width != width || r->ta_fbo_height != height ||
+      r->ta_fbo_samples != samples || r->ta_fbo_oit != oit) {
+    r_create_ta_target(r, width, height, samples, oit);
+  }
+
+  glBindFramebuffer(GL_FRAMEBUFFER, r->ta_fbo);
+  glViewport(0, 0, width, height);
+
+  r_set_depth_mask(r, 1);
+  glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+  glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
+}
+
+static void r_blit_ta_target(struct render_backend *r) {
+  int width = r->ta_fbo_width;
+  int height = r->ta_fbo_height;
+  GLuint src = r->ta_fbo_samples ? r->ta_resolve_fbo : r->ta_fbo;
+
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, src);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, r->ta_output_fbo);
+  glBlitFramebuffer(0, 0, width, height, r->viewport.x, r->viewport.y,
+                    r->viewport.x + r->viewport.w,
+                    r->viewport.y + r->viewport.h, GL_COLOR_BUFFER_BIT,
+                    GL_LINEAR);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, r->ta_output_fbo);
+  glViewport(r->viewport.x, r->viewport.y, r->viewport.w, r->viewport.h);
+}
+
+static void r_end_ta_target(struct render_backend *r) {
+  if (!r->ta_offscreen) {
+    return;
+  }
+
+  if (r->ta_fbo_samples) {
+    int width = r->ta_fbo_width;
+    int height = r->ta_fbo_height;
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, r->ta_fbo);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, r->ta_resolve_fbo);
+    glBlitFramebuffer(0, 0, width, height, 0, 0, width, height,
+                      GL_COLOR_BUFFER_BIT, GL_NEAREST);
+  }
+
+  r_blit_ta_target(r);
+
+  r->ta_fbo_valid = 1;
+}
+
+int r_present_ta_target(struct render_backend *r) {
+  int width, height, samples;
+
+  if (!r->ta_fbo_valid) {
+    return 0;
+  }
+
+  /* the options or viewport the target was sized by may have changed */
+  if (!r_ta_target_size(r, r->video_width, r->video_height, &width, &height,
+                        &samples) ||
+      width != r->ta_fbo_width || height != r->ta_fbo_height ||
+      samples != r->ta_fbo_samples) {
+    return 0;
+  }
+
+  glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &r->ta_output_fbo);
+
+  r_blit_ta_target(r);
+
+  return 1;
+}
+
+static void r_destroy_textures(struct render_backend *r) {
+  glDeleteTextures(1, &r->white_texture);
+  glDeleteTextures(1, &r->palette_texture);
+
+  glDeleteFramebuffers(1, &r->pixel_fbo);
+  glDeleteTextures(1, &r->pixel_texture);
+
+  for (int i = 0; i < NUM_READBACKS; i++) {
+    struct readback *rb = &r->readbacks[i];
+
+    if (rb->fence) {
+      glDeleteSync(rb->fence);
+    }
+
+    glDeleteBuffers(1, &rb->pbo);
+  }
+
+  glDeleteFramebuffers(1, &r->readback_fbo);
+  glDeleteRenderbuffers(1, &r->readback_rbo);
+
+  r_destroy_ta_target(r);
+
+  for (int i = 0; i < MAX_TEXTURES; i++) {
+    struct texture *tex = &r->textures[i];
+
+    /* array layers are deleted along with their array */
+    if (!tex->texture || tex->array) {
+      continue;
+    }
+
+    glDeleteTextures(1, &tex->texture);
+  }
+
+  for (int i = 0; i < r->num_arrays; i++) {
+    glDeleteTextures(1, &r->arrays[i].texture);
+  }
+
+  glDeleteSamplers(NUM_SAMPLERS, r->samplers);
+
+  for (int i = 0; i < r->num_free_textures; i++) {
+    struct texture *tex = &r->free_textures[i];
+    glDeleteTextures(1, &tex->texture);
+  }
+
+  glDeleteBuffers(NUM_UPLOAD_BUFFERS, r->upload_buffers);
+}
+
+static void r_create_textures(struct render_backend *r) {
+  /* create default all white texture */
+  uint8_t pixels[64 * 64 * 4];
+  memset(pixels, 0xff, sizeof(pixels));
+
+  glGenTextures(1, &r->white_texture);
+  r_bind_texture(r, MAP_DIFFUSE, r->white_texture);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 64, 64, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+               pixels);
+  r_bind_texture(r, MAP_DIFFUSE, 0);
+
+  /* create palette texture, which is filled in by r_set_palette */
+  glGenTextures(1, &r->palette_texture);
+  r_bind_texture(r, MAP_DIFFUSE, r->palette_texture);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, MAX_PALETTE_ENTRIES, 1, 0, GL_RGBA,
+               GL_UNSIGNED_BYTE, NULL);
+  r_bind_texture(r, MAP_DIFFUSE, 0);
+
+  /* create fbo for blitting raw framebuffers to */
+  glGenFramebuffers(1, &r->pixel_fbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, r->pixel_fbo);
+
+  glGenTextures(1, &r->pixel_texture);
+  r_bind_texture(r, MAP_DIFFUSE, r->pixel_texture);
+
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 1, 1, 0, GL_RGB,
+               GL_UNSIGNED_SHORT_5_6_5, 0);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+  GLenum buffers[] = {GL_COLOR_ATTACHMENT0};
+  glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, r->pixel_texture,
+                       0);
+  glDrawBuffers(ARRAY_SIZE(buffers), buffers);
+
+  GLenum res = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+  CHECK_EQ(res, GL_FRAMEBUFFER_COMPLETE);
+
+  r_bind_texture(r, MAP_DIFFUSE, 0);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+  /* create pixel buffers for streaming texture uploads, they're sized on
+     first use */
+  glGenBuffers(NUM_UPLOAD_BUFFERS, r->upload_buffers);
+
+  /* the offscreen ta target is created lazily, its multisampling is limited
+     by the driver */
+  glGetIntegerv(GL_MAX_SAMPLES, &r->max_samples);
+
+  /* create a sampler for each combination of filter and wrap modes */
+  glGenSamplers(NUM_SAMPLERS, r->samplers);
+
+  for (int i = 0; i < NUM_SAMPLERS; i++) {
+    int filter = i / 9;
+    int wrap_u = (i / 3) % 3;
+    int wrap_v = i % 3;
+    GLuint sampler = r->samplers[i];
+    glSamplerParameteri(sampler, GL_TEXTURE_MIN_FILTER, filter_funcs[filter]);
+    glSamplerParameteri(sampler, GL_TEXTURE_MAG_FILTER, filter_funcs[filter]);
+    glSamplerParameteri(sampler, GL_TEXTURE_WRAP_S, wrap_modes[wrap_u]);
+    glSamplerParameteri(sampler, GL_TEXTURE_WRAP_T, wrap_modes[wrap_v]);
+  }
+}
+
+static void r_destroy_vertex_arrays(struct render_backend *r) {
+  glDeleteBuffers(1, &r->ui_ibo);
+  glDeleteBuffers(1, &r->ui_vbo);
+  glDeleteVertexArrays(1, &r->ui_vao);
+
+  glDeleteBuffers(1, &r->ta_ibo);
+  glDeleteBuffers(1, &r->ta_vbo);
+  glDeleteVertexArrays(1, &r->ta_vao);
+
+  for (int i = 0; i < TA_RING_FRAMES; i++) {
+    if (r->ta_ring_fences[i]) {
+      glDeleteSync(r->ta_ring_fences[i]);
+    }
+  }
+
+  if (r->ta_ring) {
+    glDeleteVertexArrays(TA_RING_FRAMES, r->ta_ring_vaos);
+  }
+
+  /* deleting the buffers implicitly unmaps them */
+  glDeleteBuffers(1, &r->ta_ring_ibo);
+  glDeleteBuffers(1, &r->ta_ring_vbo);
+
+  glDeleteBuffers(1, &r->ta_encoded_ssbo);
+  glDeleteBuffers(1, &r->ta_param_ssbo);
+}
+
+static void r_set_ta_vertex_attribs(intptr_t base) {
+  /* xyz */
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(struct ta_vertex),
+                        (void *)(base + offsetof(struct ta_vertex, xyz)));
+
+  /* texcoord */
+  glEnableVertexAttribArray(1);
+  glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(struct ta_vertex),
+                        (void *)(base + offsetof(struct ta_vertex, uv)));
+
+  /* color */
+  glEnableVertexAttribArray(2);
+  glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE,
+                        sizeof(struct ta_vertex),
+                        (void *)(base + offsetof(struct ta_vertex, color)));
+
+  /* offset color */
+  glEnableVertexAttribArray(3);
+  glVertexAttribPointer(
+      3, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(struct ta_vertex),
+      (void *)(base + offsetof(struct ta_vertex, offset_color)));
+
+  /* texture */
+  glEnableVertexAttribArray(4);
+  glVertexAttribIPointer(4, 1, GL_UNSIGNED_INT, sizeof(struct ta_vertex),
+                         (void *)(base + offsetof(struct ta_vertex, texture)));
+}
+
+static void r_create_vertex_arrays(struct render_backend *r) {
+  /* ui vao */
+  {
+    glGenVertexArrays(1, &r->ui_vao);
+    glBindVertexArray(r->ui_vao);
+
+    glGenBuffers(1, &r->ui_vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, r->ui_vbo);
+
+    glGenBuffers(1, &r->ui_ibo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, r->ui_ibo);
+
+    /* xy */
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(struct ui_vertex),
+                          (void *)offsetof(struct ui_vertex, xy));
+
+    /* texcoord */
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(struct ui_vertex),
+                          (void *)offsetof(struct ui_vertex, uv));
 
     /* color */
     glEnableVertexAttribArray(2);
     glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE,
-                          sizeof(struct ta_vertex),
-                          (void *)offsetof(struct ta_vertex, color));
+                          sizeof(struct ui_vertex),
+                          (void *)offsetof(struct ui_vertex, color));
+
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+  }
+
+  /* ta vao */
+  {
+    glGenVertexArrays(1, &r->ta_vao);
+    glBindVertexArray(r->ta_vao);
+
+    glGenBuffers(1, &r->ta_vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, r->ta_vbo);
+
+    glGenBuffers(1, &r->ta_ibo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, r->ta_ibo);
+
+    r_set_ta_vertex_attribs(0);
+
+    glBindVertexArray(0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+  }
+
+  /* ta ring buffers, gles doesn't support GL_ARB_buffer_storage */
+  if (glBufferStorage) {
+    GLbitfield flags =
+        GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    GLsizeiptr vbo_size =
+        sizeof(struct ta_vertex) * TA_RING_VERTS * TA_RING_FRAMES;
+    GLsizeiptr ibo_size = sizeof(uint16_t) * TA_RING_INDICES * TA_RING_FRAMES;
+
+    glGenBuffers(1, &r->ta_ring_vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, r->ta_ring_vbo);
+    glBufferStorage(GL_ARRAY_BUFFER, vbo_size, NULL, flags);
+    r->ta_ring_verts = glMapBufferRange(GL_ARRAY_BUFFER, 0, vbo_size, flags);
+
+    glGenBuffers(1, &r->ta_ring_ibo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, r->ta_ring_ibo);
+    glBufferStorage(GL_ELEMENT_ARRAY_BUFFER, ibo_size, NULL, flags);
+    r->ta_ring_indices =
+        glMapBufferRange(GL_ELEMENT_ARRAY_BUFFER, 0, ibo_size, flags);
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-    /* offset color */
-    glEnableVertexAttribArray(3);
-    glVertexAttribPointer(3, 4, GL_UNSIGNED_BYTE, GL_TRUE,
-                          sizeof(struct ta_vertex),
-                          (void *)offsetof(struct ta_vertex, offset_color));
+    r->ta_ring = r->ta_ring_verts && r->ta_ring_indices;
+  }
+
+  if (r->ta_ring) {
+    glGenVertexArrays(TA_RING_FRAMES, r->ta_ring_vaos);
+
+    for (int i = 0; i < TA_RING_FRAMES; i++) {
+      glBindVertexArray(r->ta_ring_vaos[i]);
+      glBindBuffer(GL_ARRAY_BUFFER, r->ta_ring_vbo);
+      glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, r->ta_ring_ibo);
+
+      r_set_ta_vertex_attribs(sizeof(struct ta_vertex) * TA_RING_VERTS * i);
+    }
 
     glBindVertexArray(0);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
+  } else if (r->ta_ring_vbo) {
+    LOG_WARNING("r_create_vertex_arrays failed to map ta ring buffers");
+  }
+
+  if (OPTION_gpu_verts > 0) {
+    glGenBuffers(1, &r->ta_param_ssbo);
+    glGenBuffers(1, &r->ta_encoded_ssbo);
   }
 }
 
-static void r_set_initial_state(struct render_backend *r) {
-  glDepthMask(1);
-  glDisable(GL_DEPTH_TEST);
+static void r_read_gpu_zones(struct render_backend *r) {
+  prof_token_t tokens[NUM_GPU_STAGES] = {
+      COUNTER_gpu_background_time, COUNTER_gpu_opaque_time,
+      COUNTER_gpu_punch_through_time, COUNTER_gpu_translucent_time,
+      COUNTER_gpu_ui_time,
+  };
+
+  int64_t now = time_nanoseconds();
+
+  if (now - r->gpu_clock_synced > NS_PER_SEC) {
+    GLint64 gpu_now;
+    glGetInteger64v(GL_TIMESTAMP, &gpu_now);
+    r->gpu_clock_offset = now - gpu_now;
+    r->gpu_clock_synced = now;
+  }
+
+  /* queries become available in the order they were written */
+  while (r->gpu_zone_tail != r->gpu_zone_head) {
+    struct gpu_zone *zone = &r->gpu_zones[r->gpu_zone_tail % MAX_GPU_ZONES];
+
+    GLuint available = 0;
+    glGetQueryObjectuiv(zone->queries[1], GL_QUERY_RESULT_AVAILABLE,
+                        &available);
+
+    if (!available) {
+      break;
+    }
+
+    GLuint64 begin, end;
+    glGetQueryObjectui64v(zone->queries[0], GL_QUERY_RESULT, &begin);
+    glGetQueryObjectui64v(zone->queries[1], GL_QUERY_RESULT, &end);
+
+    prof_gpu_zone(gpu_stage_names[zone->stage],
+                  (int64_t)begin + r->gpu_clock_offset,
+                  (int64_t)end + r->gpu_clock_offset);
+    prof_counter_add(tokens[zone->stage], (int64_t)(end - begin));
+
+    r->gpu_zone_tail++;
+  }
+}
+
+static void r_end_gpu_zone(struct render_backend *r) {
+  if (r->gpu_stage < 0) {
+    return;
+  }
+
+  struct gpu_zone *zone = &r->gpu_zones[r->gpu_zone_head % MAX_GPU_ZONES];
+  glQueryCounter(zone->queries[1], GL_TIMESTAMP);
+
+  r->gpu_zone_head++;
+  r->gpu_stage = -1;
+}
+
+static void r_begin_gpu_zone(struct render_backend *r, int stage) {
+  r_end_gpu_zone(r);
+
+  if (!r->gpu_timers) {
+    return;
+  }
+
+  r_read_gpu_zones(r);
+
+  if (r->gpu_zone_head - r->gpu_zone_tail == MAX_GPU_ZONES) {
+    return;
+  }
+
+  struct gpu_zone *zone = &r->gpu_zones[r->gpu_zone_head % MAX_GPU_ZONES];
+  zone->stage = stage;
+  glQueryCounter(zone->queries[0], GL_TIMESTAMP);
+
+  r->gpu_stage = stage;
+}
+
+static void r_destroy_gpu_timers(struct render_backend *r) {
+  if (!r->gpu_timers) {
+    return;
+  }
+
+  for (int i = 0; i < MAX_GPU_ZONES; i++) {
+    glDeleteQueries(2, r->gpu_zones[i].queries);
+  }
+}
+
+static void r_create_gpu_timers(struct render_backend *r) {
+  r->gpu_stage = -1;
+  r->gpu_timers = glQueryCounter && glGetQueryObjectui64v && glGetInteger64v;
+
+  if (!r->gpu_timers) {
+    return;
+  }
+
+  for (int i = 0; i < MAX_GPU_ZONES; i++) {
+    glGenQueries(2, r->gpu_zones[i].queries);
+  }
+}
 
-  glEnable(GL_CULL_FACE);
-  glCullFace(GL_BACK);
+static void r_set_initial_state(struct render_backend *r) {
+  r_reset_state(r);
 
-  glDisable(GL_BLEND);
+  r_set_depth_mask(r, 1);
+  r_set_depth_func(r, DEPTH_NONE);
+  r_set_cull(r, CULL_BACK);
+  r_set_blend(r, BLEND_NONE, BLEND_NONE);
 }
 
 static struct shader_program *r_get_ta_program(struct render_backend *r,
@@ -442,6 +1615,10 @@ static struct shader_program *r_get_ta_program(struct render_backend *r,
   int idx = (int)surf->params.shade;
   if (surf->params.texture) {
     idx |= ATTR_TEXTURE;
+
+    if (r->textures[surf->params.texture].array) {
+      idx |= ATTR_TEXTURE_ARRAY;
+    }
   }
   if (surf->params.ignore_alpha) {
     idx |= ATTR_IGNORE_ALPHA;
@@ -458,6 +1635,15 @@ static struct shader_program *r_get_ta_program(struct render_backend *r,
   if (surf->params.debug_depth) {
     idx |= ATTR_DEBUG_DEPTH_BUFFER;
   }
+  if (surf->params.palette) {
+    idx |= ATTR_PALETTE;
+  }
+  if (surf->params.palette_filter) {
+    idx |= ATTR_PALETTE_FILTER;
+  }
+  if (r->ta_layer >= 0) {
+    idx |= ATTR_PEEL;
+  }
 
   struct shader_program *program = &r->ta_programs[idx];
 
@@ -495,9 +1681,25 @@ static struct shader_program *r_get_ta_program(struct render_backend *r,
     if (idx & ATTR_DEBUG_DEPTH_BUFFER) {
       strcat(header, "#define DEBUG_DEPTH_BUFFER\n");
     }
+    if (idx & ATTR_PALETTE) {
+      strcat(header, "#define PALETTE\n");
+    }
+    if (idx & ATTR_PALETTE_FILTER) {
+      strcat(header, "#define PALETTE_FILTER\n");
+    }
+    if (idx & ATTR_TEXTURE_ARRAY) {
+      strcat(header, "#define TEXTURE_ARRAY\n");
+    }
+    if (idx & ATTR_PEEL) {
+      strcat(header, "#define PEEL\n");
+    }
 
     int res = r_compile_program(r, program, header, ta_vp, ta_fp);
     CHECK(res, "failed to compile ta shader");
+
+    if (r->shader_cache) {
+      r_save_program(r, program, idx);
+    }
   }
 
   return program;
@@ -505,6 +1707,8 @@ static struct shader_program *r_get_ta_program(struct render_backend *r,
 
 void r_end_ui_surfaces(struct render_backend *r) {
   glDisable(GL_SCISSOR_TEST);
+
+  r_end_gpu_zone(r);
 }
 
 void r_draw_ui_surface(struct render_backend *r,
@@ -517,144 +1721,464 @@ void r_draw_ui_surface(struct render_backend *r,
     glDisable(GL_SCISSOR_TEST);
   }
 
-  if (surf->src_blend == BLEND_NONE || surf->dst_blend == BLEND_NONE) {
-    glDisable(GL_BLEND);
-  } else {
-    glEnable(GL_BLEND);
-    glBlendFunc(blend_funcs[surf->src_blend], blend_funcs[surf->dst_blend]);
+  r_set_blend(r, surf->src_blend, surf->dst_blend);
+
+  /* the ui shader can't sample layers of a texture array */
+  if (surf->texture && !r->textures[surf->texture].array) {
+    struct texture *tex = &r->textures[surf->texture];
+    r_bind_texture(r, MAP_DIFFUSE, tex->texture);
+  } else {
+    r_bind_texture(r, MAP_DIFFUSE, r->white_texture);
+  }
+
+  if (r->ui_use_ibo) {
+    glDrawElements(prim_types[surf->prim_type], surf->num_verts,
+                   GL_UNSIGNED_SHORT,
+                   (void *)(intptr_t)(sizeof(uint16_t) * surf->first_vert));
+  } else {
+    glDrawArrays(prim_types[surf->prim_type], surf->first_vert,
+                 surf->num_verts);
+  }
+}
+
+void r_begin_ui_surfaces(struct render_backend *r,
+                         const struct ui_vertex *verts, int num_verts,
+                         const uint16_t *indices, int num_indices) {
+  /* setup projection matrix */
+  float ortho[16];
+  ortho[0] = 2.0f / (float)r->viewport.w;
+  ortho[4] = 0.0f;
+  ortho[8] = 0.0f;
+  ortho[12] = -1.0f;
+
+  ortho[1] = 0.0f;
+  ortho[5] = -2.0f / (float)r->viewport.h;
+  ortho[9] = 0.0f;
+  ortho[13] = 1.0f;
+
+  ortho[2] = 0.0f;
+  ortho[6] = 0.0f;
+  ortho[10] = 0.0f;
+  ortho[14] = 0.0f;
+
+  ortho[3] = 0.0f;
+  ortho[7] = 0.0f;
+  ortho[11] = 0.0f;
+  ortho[15] = 1.0f;
+
+  r_reset_state(r);
+
+  r_begin_gpu_zone(r, GPU_STAGE_UI);
+
+  r_set_depth_mask(r, 0);
+  r_set_depth_func(r, DEPTH_NONE);
+  r_set_cull(r, CULL_NONE);
+
+  struct shader_program *program = &r->ui_program;
+  glBindVertexArray(r->ui_vao);
+  r_use_program(r, program->prog);
+  glUniformMatrix4fv(program->loc[UNIFORM_PROJ], 1, GL_FALSE, ortho);
+
+  /* bind buffers */
+  glBindBuffer(GL_ARRAY_BUFFER, r->ui_vbo);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(struct ui_vertex) * num_verts, verts,
+               GL_DYNAMIC_DRAW);
+
+  if (indices) {
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, r->ui_ibo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint16_t) * num_indices,
+                 indices, GL_DYNAMIC_DRAW);
+    r->ui_use_ibo = 1;
+  } else {
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    r->ui_use_ibo = 0;
+  }
+}
+
+static void r_flush_ta_surfaces(struct render_backend *r) {
+  if (!r->num_batch_draws) {
+    return;
+  }
+
+  GLenum mode = r->batch_mode;
+
+  if (r->ta_layer >= 0) {
+    /* gl_PrimitiveID restarts with each draw, so each is offset by the number
+       of triangles preceding it to identify its triangles while peeling */
+    GLint loc = r->batch_program->loc[UNIFORM_PRIM_BASE];
+
+    for (int i = 0; i < r->num_batch_draws; i++) {
+      intptr_t first = ((intptr_t)r->batch_offsets[i] - r->ta_index_offset) /
+                       sizeof(uint16_t);
+      glUniform1i(loc, (GLint)(first / 3));
+      glDrawElements(mode, r->batch_counts[i], GL_UNSIGNED_SHORT,
+                     r->batch_offsets[i]);
+    }
+  } else if (r->num_batch_draws == 1) {
+    glDrawElements(mode, r->batch_counts[0], GL_UNSIGNED_SHORT,
+                   r->batch_offsets[0]);
+  } else if (glMultiDrawElements) {
+    glMultiDrawElements(mode, r->batch_counts, GL_UNSIGNED_SHORT,
+                        r->batch_offsets, r->num_batch_draws);
+  } else {
+    /* glMultiDrawElements isn't available on gles */
+    for (int i = 0; i < r->num_batch_draws; i++) {
+      glDrawElements(mode, r->batch_counts[i], GL_UNSIGNED_SHORT,
+                     r->batch_offsets[i]);
+    }
+  }
+
+  r->num_batch_draws = 0;
+}
+
+void r_begin_ta_stage(struct render_backend *r, int stage) {
+  /* batched draws belong to the previous stage */
+  r_flush_ta_surfaces(r);
+
+  r_begin_gpu_zone(r, stage);
+}
+
+void r_end_ta_surfaces(struct render_backend *r) {
+  r_flush_ta_surfaces(r);
+
+  r_end_gpu_zone(r);
+
+  /* samplers override the state of any texture bound to the unit */
+  r_bind_sampler(r, 0);
+
+  r_set_primitive_restart(r, 0);
+
+  r_end_ta_target(r);
+
+  /* fence the ring region written this frame, so it isn't overwritten until
+     the gpu is done reading it */
+  if (r->ta_ring_frame >= 0) {
+    r->ta_ring_fences[r->ta_ring_frame] =
+        glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    r->ta_ring_frame = -1;
+  }
+}
+
+void r_draw_ta_surface(struct render_backend *r,
+                       const struct ta_surface *surf) {
+  const GLvoid *offset = (const GLvoid *)(r->ta_index_offset +
+                                          sizeof(uint16_t) * surf->first_vert);
+
+  /* surfaces whose textures are layers of the same array, sampled with the
+     same state, can be batched together */
+  const struct texture *tex =
+      surf->params.texture ? &r->textures[surf->params.texture] : NULL;
+  const struct texture_array *array =
+      tex && tex->array ? &r->arrays[tex->array - 1] : NULL;
+  uint64_t batch_params = surf->params.full;
+  GLuint sampler = 0;
+
+  if (array) {
+    batch_params = (batch_params & ~(uint64_t)(MAX_TEXTURES - 1)) | array->base;
+    sampler = r->samplers[tex->sampler];
+  }
+
+  /* append to the current batch if the params match */
+  if (r->num_batch_draws && r->batch_params == batch_params &&
+      r->batch_sampler == sampler) {
+    int last = r->num_batch_draws - 1;
+    const uint8_t *last_end = (const uint8_t *)r->batch_offsets[last] +
+                              sizeof(uint16_t) * r->batch_counts[last];
+
+    /* merge index ranges which are contiguous */
+    if ((const GLvoid *)last_end == offset) {
+      r->batch_counts[last] += surf->num_verts;
+      return;
+    }
+
+    if (r->num_batch_draws < MAX_BATCH_DRAWS) {
+      r->batch_counts[r->num_batch_draws] = surf->num_verts;
+      r->batch_offsets[r->num_batch_draws] = offset;
+      r->num_batch_draws++;
+      return;
+    }
+  }
+
+  /* draw the previous batch before changing any state */
+  r_flush_ta_surfaces(r);
+
+  /* strips are fed in a CW order, the reverse of the triangle lists, so the
+     opposite face is culled to cull the same triangles */
+  enum cull_face cull = surf->params.cull;
+
+  if (surf->params.strip && cull != CULL_NONE) {
+    cull = cull == CULL_BACK ? CULL_FRONT : CULL_BACK;
+  }
+
+  r_set_cull(r, cull);
+  r_set_primitive_restart(r, surf->params.strip);
+
+  if (r->ta_layer >= 0) {
+    /* while peeling, the depth test keeps the farthest fragment, and blending
+       is deferred until the layer is composited */
+    r_set_depth_mask(r, 1);
+    r_set_depth_func(r, DEPTH_GREATER);
+    r_set_blend(r, BLEND_NONE, BLEND_NONE);
+  } else {
+    r_set_depth_mask(r, surf->params.depth_write);
+    r_set_depth_func(r, surf->params.depth_func);
+    r_set_blend(r, surf->params.src_blend, surf->params.dst_blend);
+  }
+
+  struct shader_program *program = r_get_ta_program(r, surf);
+
+  r_use_program(r, program->prog);
+
+  if (r->ta_layer >= 0) {
+    int blend = (int)(surf->params.src_blend << 4 | surf->params.dst_blend);
+
+    if (program->blend != blend) {
+      glUniform1i(program->loc[UNIFORM_BLEND], blend);
+      program->blend = blend;
+    }
+
+    /* every surface is drawn while peeling the first layer */
+    if (!r->ta_layer && !r->oit_blend_used[blend]) {
+      r->oit_blend_used[blend] = 1;
+      r->oit_blends[r->num_oit_blends++] = blend;
+    }
+  }
+
+  /* bind global uniforms if they've changed */
+  if (program->uniform_token != r->uniform_token) {
+    glUniform4fv(program->loc[UNIFORM_VIDEO_SCALE], 1, r->uniform_video_scale);
+    program->uniform_token = r->uniform_token;
+  }
+
+  if (program->alpha_ref != (int)surf->params.alpha_ref) {
+    float alpha_ref = surf->params.alpha_ref / 255.0f;
+    glUniform1f(program->loc[UNIFORM_ALPHA_REF], alpha_ref);
+    program->alpha_ref = (int)surf->params.alpha_ref;
   }
 
-  if (surf->texture) {
-    struct texture *tex = &r->textures[surf->texture];
+  if (array) {
+    r_bind_texture_array(r, array->texture);
+
+    if (program->layer_base != array->base) {
+      glUniform1i(program->loc[UNIFORM_LAYER_BASE], array->base);
+      program->layer_base = array->base;
+    }
+  } else if (tex) {
     r_bind_texture(r, MAP_DIFFUSE, tex->texture);
-  } else {
-    r_bind_texture(r, MAP_DIFFUSE, r->white_texture);
   }
 
-  if (r->ui_use_ibo) {
-    glDrawElements(prim_types[surf->prim_type], surf->num_verts,
-                   GL_UNSIGNED_SHORT,
-                   (void *)(intptr_t)(sizeof(uint16_t) * surf->first_vert));
-  } else {
-    glDrawArrays(prim_types[surf->prim_type], surf->first_vert,
-                 surf->num_verts);
+  r_bind_sampler(r, sampler);
+
+  if (surf->params.palette) {
+    r_bind_texture(r, MAP_PALETTE, r->palette_texture);
+
+    if (program->palette_base != (int)surf->params.palette_base) {
+      glUniform1i(program->loc[UNIFORM_PALETTE_BASE],
+                  (int)surf->params.palette_base);
+      program->palette_base = (int)surf->params.palette_base;
+    }
   }
-}
 
-void r_begin_ui_surfaces(struct render_backend *r,
-                         const struct ui_vertex *verts, int num_verts,
-                         const uint16_t *indices, int num_indices) {
-  /* setup projection matrix */
-  float ortho[16];
-  ortho[0] = 2.0f / (float)r->viewport.w;
-  ortho[4] = 0.0f;
-  ortho[8] = 0.0f;
-  ortho[12] = -1.0f;
+  r->batch_params = batch_params;
+  r->batch_sampler = sampler;
+  r->batch_program = program;
+  r->batch_mode = surf->params.strip ? GL_TRIANGLE_STRIP : GL_TRIANGLES;
+  r->batch_counts[0] = surf->num_verts;
+  r->batch_offsets[0] = offset;
+  r->num_batch_draws = 1;
+}
 
-  ortho[1] = 0.0f;
-  ortho[5] = -2.0f / (float)r->viewport.h;
-  ortho[9] = 0.0f;
-  ortho[13] = 1.0f;
+int r_begin_ta_layer(struct render_backend *r, int layer) {
+  static const GLuint clear_id[4] = {0};
+  static const GLfloat clear_color[4] = {0.0f};
+  static const GLfloat near_depth = 0.0f;
+  static const GLfloat far_depth = 1.0f;
 
-  ortho[2] = 0.0f;
-  ortho[6] = 0.0f;
-  ortho[10] = 0.0f;
-  ortho[14] = 0.0f;
+  r_flush_ta_surfaces(r);
 
-  ortho[3] = 0.0f;
-  ortho[7] = 0.0f;
-  ortho[11] = 0.0f;
-  ortho[15] = 1.0f;
+  if (!r->ta_offscreen || !r->ta_fbo_oit || layer >= r->oit_layers) {
+    return 0;
+  }
 
-  glDepthMask(0);
-  glDisable(GL_DEPTH_TEST);
-  glDisable(GL_CULL_FACE);
+  int slot = layer & 1;
+  int prev = slot ^ 1;
 
-  struct shader_program *program = &r->ui_program;
-  glBindVertexArray(r->ui_vao);
-  glUseProgram(program->prog);
-  glUniformMatrix4fv(program->loc[UNIFORM_PROJ], 1, GL_FALSE, ortho);
+  /* stop early once the previous layer is known to have come up empty,
+     without waiting on the gpu to find out */
+  if (layer) {
+    GLuint available = 0;
+    GLuint any_samples = 1;
+    glGetQueryObjectuiv(r->oit_queries[prev], GL_QUERY_RESULT_AVAILABLE,
+                        &available);
 
-  /* bind buffers */
-  glBindBuffer(GL_ARRAY_BUFFER, r->ui_vbo);
-  glBufferData(GL_ARRAY_BUFFER, sizeof(struct ui_vertex) * num_verts, verts,
-               GL_DYNAMIC_DRAW);
+    if (available) {
+      glGetQueryObjectuiv(r->oit_queries[prev], GL_QUERY_RESULT,
+                          &any_samples);
+    }
 
-  if (indices) {
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, r->ui_ibo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint16_t) * num_indices,
-                 indices, GL_DYNAMIC_DRAW);
-    r->ui_use_ibo = 1;
-  } else {
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-    r->ui_use_ibo = 0;
+    if (!any_samples) {
+      return 0;
+    }
   }
-}
 
-void r_end_ta_surfaces(struct render_backend *r) {}
+  r_set_depth_mask(r, 1);
 
-void r_draw_ta_surface(struct render_backend *r,
-                       const struct ta_surface *surf) {
-  glDepthMask(!!surf->params.depth_write);
+  /* every fragment is in front of the layer preceding the first */
+  if (!layer) {
+    glBindFramebuffer(GL_FRAMEBUFFER, r->oit_fbos[prev]);
+    glClearBufferuiv(GL_COLOR, 1, clear_id);
+    glClearBufferfv(GL_DEPTH, 0, &far_depth);
 
-  if (surf->params.depth_func == DEPTH_NONE) {
-    glDisable(GL_DEPTH_TEST);
-  } else {
-    glEnable(GL_DEPTH_TEST);
-    glDepthFunc(depth_funcs[surf->params.depth_func]);
+    memset(r->oit_blend_used, 0, sizeof(r->oit_blend_used));
+    r->num_oit_blends = 0;
   }
 
-  if (surf->params.cull == CULL_NONE) {
-    glDisable(GL_CULL_FACE);
-  } else {
-    glEnable(GL_CULL_FACE);
-    glCullFace(cull_face[surf->params.cull]);
+  glBindFramebuffer(GL_FRAMEBUFFER, r->oit_fbos[slot]);
+  glClearBufferfv(GL_COLOR, 0, clear_color);
+  glClearBufferuiv(GL_COLOR, 1, clear_id);
+  glClearBufferfv(GL_DEPTH, 0, &near_depth);
+
+  r_bind_texture(r, MAP_OPAQUE_DEPTH, r->ta_depth_texture);
+  r_bind_texture(r, MAP_LAYER_DEPTH, r->oit_depth_textures[prev]);
+  r_bind_texture(r, MAP_LAYER_ID, r->oit_id_textures[prev]);
+
+  /* conditional rendering isn't available on gles. when it is, the layer is
+     skipped on the gpu if the previous one was empty */
+  if (layer && glBeginConditionalRender) {
+    glBeginConditionalRender(r->oit_queries[prev], GL_QUERY_WAIT);
   }
 
-  if (surf->params.src_blend == BLEND_NONE ||
-      surf->params.dst_blend == BLEND_NONE) {
-    glDisable(GL_BLEND);
-  } else {
-    glEnable(GL_BLEND);
-    glBlendFunc(blend_funcs[surf->params.src_blend],
-                blend_funcs[surf->params.dst_blend]);
+  glBeginQuery(GL_ANY_SAMPLES_PASSED, r->oit_queries[slot]);
+
+  r->ta_layer = layer;
+
+  return 1;
+}
+
+void r_end_ta_layer(struct render_backend *r) {
+  int layer = r->ta_layer;
+  int slot = layer & 1;
+
+  r_flush_ta_surfaces(r);
+
+  glEndQuery(GL_ANY_SAMPLES_PASSED);
+
+  if (layer && glBeginConditionalRender) {
+    glEndConditionalRender();
   }
 
-  struct shader_program *program = r_get_ta_program(r, surf);
+  r->ta_layer = -1;
 
-  glUseProgram(program->prog);
+  /* blend the layer into the target, once for each blend function */
+  glBindFramebuffer(GL_FRAMEBUFFER, r->ta_fbo);
 
-  /* bind global uniforms if they've changed */
-  if (program->uniform_token != r->uniform_token) {
-    glUniform4fv(program->loc[UNIFORM_VIDEO_SCALE], 1, r->uniform_video_scale);
-    program->uniform_token = r->uniform_token;
+  r_set_depth_func(r, DEPTH_NONE);
+  r_set_cull(r, CULL_NONE);
+  r_set_primitive_restart(r, 0);
+  r_use_program(r, r->oit_program.prog);
+  r_bind_texture(r, MAP_LAYER_COLOR, r->oit_color_texture);
+  r_bind_texture(r, MAP_LAYER_ID, r->oit_id_textures[slot]);
+
+  if (glBeginConditionalRender) {
+    glBeginConditionalRender(r->oit_queries[slot], GL_QUERY_WAIT);
   }
 
-  /* bind non-global uniforms every time */
-  float alpha_ref = surf->params.alpha_ref / 255.0f;
-  glUniform1f(program->loc[UNIFORM_ALPHA_REF], alpha_ref);
+  for (int i = 0; i < r->num_oit_blends; i++) {
+    int blend = r->oit_blends[i];
 
-  if (surf->params.texture) {
-    struct texture *tex = &r->textures[surf->params.texture];
-    r_bind_texture(r, MAP_DIFFUSE, tex->texture);
+    r_set_blend(r, blend >> 4, blend & 0xf);
+    glUniform1i(r->oit_program.loc[UNIFORM_BLEND], blend);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+  }
+
+  if (glBeginConditionalRender) {
+    glEndConditionalRender();
+  }
+}
+
+void r_decode_ta_vertices(struct render_backend *r, const uint8_t *params,
+                          int size, const uint32_t *verts, int num_verts) {
+  CHECK(r->decode_program.prog, "gpu_verts option wasn't enabled");
+
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, r->ta_param_ssbo);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, size, params, GL_STREAM_DRAW);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, r->ta_encoded_ssbo);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(uint32_t) * num_verts, verts,
+               GL_STREAM_DRAW);
+
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, r->ta_param_ssbo);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, r->ta_encoded_ssbo);
+
+  /* the vertices are decoded in place, in whichever buffer they were written
+     to by r_begin_ta_surfaces */
+  if (r->ta_ring_frame >= 0) {
+    GLintptr offset =
+        sizeof(struct ta_vertex) * TA_RING_VERTS * r->ta_ring_frame;
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 2, r->ta_ring_vbo, offset,
+                      sizeof(struct ta_vertex) * r->ta_num_verts);
+  } else {
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, r->ta_vbo);
   }
 
-  glDrawElements(GL_TRIANGLES, surf->num_verts, GL_UNSIGNED_SHORT,
-                 (void *)(intptr_t)(sizeof(uint16_t) * surf->first_vert));
+  struct shader_program *program = &r->decode_program;
+  r_use_program(r, program->prog);
+  glUniform1ui(program->loc[UNIFORM_NUM_VERTS], num_verts);
+  glDispatchCompute((num_verts + 63) / 64, 1, 1);
+
+  /* make the writes visible to the vertex fetches of the following draws */
+  glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
 }
 
 void r_begin_ta_surfaces(struct render_backend *r, int video_width,
                          int video_height, const struct ta_vertex *verts,
                          int num_verts, const uint16_t *indices,
                          int num_indices) {
+  r_reset_state(r);
+
   /* uniforms will be lazily bound for each program inside of r_draw_surface */
   r->uniform_token++;
   r->uniform_video_scale[0] = 2.0f / (float)video_width;
   r->uniform_video_scale[1] = -1.0f;
   r->uniform_video_scale[2] = -2.0f / (float)video_height;
   r->uniform_video_scale[3] = 1.0f;
+  r->video_width = video_width;
+  r->video_height = video_height;
+  r->ta_num_verts = num_verts;
+
+  r_begin_ta_target(r, video_width, video_height);
+
+  if (r->ta_ring && num_verts <= TA_RING_VERTS &&
+      num_indices <= TA_RING_INDICES) {
+    int frame = r->ta_ring_next;
+    r->ta_ring_next = (frame + 1) % TA_RING_FRAMES;
+    r->ta_ring_frame = frame;
+
+    /* wait for the gpu to finish reading the region's previous contents */
+    GLsync fence = r->ta_ring_fences[frame];
+
+    if (fence) {
+      while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                              1000000000) == GL_TIMEOUT_EXPIRED) {
+      }
+
+      glDeleteSync(fence);
+      r->ta_ring_fences[frame] = NULL;
+    }
+
+    /* the mapping is coherent, no explicit flush is needed */
+    memcpy(r->ta_ring_verts + TA_RING_VERTS * frame, verts,
+           sizeof(struct ta_vertex) * num_verts);
+    memcpy(r->ta_ring_indices + TA_RING_INDICES * frame, indices,
+           sizeof(uint16_t) * num_indices);
+
+    glBindVertexArray(r->ta_ring_vaos[frame]);
+    r->ta_index_offset = sizeof(uint16_t) * TA_RING_INDICES * frame;
+    return;
+  }
 
   glBindVertexArray(r->ta_vao);
+  r->ta_ring_frame = -1;
+  r->ta_index_offset = 0;
 
   glBindBuffer(GL_ARRAY_BUFFER, r->ta_vbo);
   glBufferData(GL_ARRAY_BUFFER, sizeof(struct ta_vertex) * num_verts, verts,
@@ -667,10 +2191,10 @@ void r_begin_ta_surfaces(struct render_backend *r, int video_width,
 
 void r_draw_pixels(struct render_backend *r, const uint8_t *pixels, int x,
                    int y, int width, int height) {
-  glBindTexture(GL_TEXTURE_2D, r->pixel_texture);
+  r_bind_texture(r, MAP_DIFFUSE, r->pixel_texture);
   glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB,
                GL_UNSIGNED_BYTE, pixels);
-  glBindTexture(GL_TEXTURE_2D, 0);
+  r_bind_texture(r, MAP_DIFFUSE, 0);
 
   glBindFramebuffer(GL_READ_FRAMEBUFFER, r->pixel_fbo);
   glReadBuffer(GL_COLOR_ATTACHMENT0);
@@ -682,6 +2206,109 @@ void r_draw_pixels(struct render_backend *r, const uint8_t *pixels, int x,
   glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
+void r_begin_readback(struct render_backend *r, int x, int y, int width,
+                      int height) {
+  /* if the oldest readback still hasn't been finished, it's dropped */
+  if (r->num_readbacks == NUM_READBACKS) {
+    struct readback *rb = &r->readbacks[r->readback_head];
+    glDeleteSync(rb->fence);
+    rb->fence = NULL;
+    r->readback_head = (r->readback_head + 1) % NUM_READBACKS;
+    r->num_readbacks--;
+  }
+
+  int i = (r->readback_head + r->num_readbacks) % NUM_READBACKS;
+  struct readback *rb = &r->readbacks[i];
+  int size = width * height * 4;
+
+  if (!rb->pbo) {
+    glGenBuffers(1, &rb->pbo);
+  }
+
+  if (!r->readback_fbo) {
+    glGenFramebuffers(1, &r->readback_fbo);
+    glGenRenderbuffers(1, &r->readback_rbo);
+  }
+
+  /* scale the region of the last rendered video frame back down to its
+     original resolution */
+  glBindFramebuffer(GL_FRAMEBUFFER, r->readback_fbo);
+
+  if (r->readback_width != width || r->readback_height != height) {
+    glBindRenderbuffer(GL_RENDERBUFFER, r->readback_rbo);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                              GL_RENDERBUFFER, r->readback_rbo);
+    r->readback_width = width;
+    r->readback_height = height;
+  }
+
+  float scale_x = (float)r->viewport.w / (float)r->video_width;
+  float scale_y = (float)r->viewport.h / (float)r->video_height;
+  int src_x0 = r->viewport.x + (int)(x * scale_x);
+  int src_x1 = r->viewport.x + (int)((x + width) * scale_x);
+  int src_y0 = r->viewport.y + r->viewport.h - (int)(y * scale_y);
+  int src_y1 = r->viewport.y + r->viewport.h - (int)((y + height) * scale_y);
+
+  /* flip vertically while blitting, so rows are read back top to bottom */
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, r->ta_output_fbo);
+  glBlitFramebuffer(src_x0, src_y0, src_x1, src_y1, 0, 0, width, height,
+                    GL_COLOR_BUFFER_BIT, GL_NEAREST);
+
+  /* read into the pixel buffer, the transfer happens asynchronously */
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, r->readback_fbo);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, rb->pbo);
+
+  if (size > rb->size) {
+    glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+    rb->size = size;
+  }
+
+  glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  glBindFramebuffer(GL_FRAMEBUFFER, r->ta_output_fbo);
+
+  rb->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  rb->width = width;
+  rb->height = height;
+  r->num_readbacks++;
+}
+
+int r_end_readback(struct render_backend *r, uint8_t *pixels, int wait) {
+  if (!r->num_readbacks) {
+    return 0;
+  }
+
+  struct readback *rb = &r->readbacks[r->readback_head];
+
+  if (wait) {
+    while (glClientWaitSync(rb->fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                            1000000000) == GL_TIMEOUT_EXPIRED) {
+    }
+  } else if (glClientWaitSync(rb->fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+    return 0;
+  }
+
+  glDeleteSync(rb->fence);
+  rb->fence = NULL;
+  r->readback_head = (r->readback_head + 1) % NUM_READBACKS;
+  r->num_readbacks--;
+
+  int size = rb->width * rb->height * 4;
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, rb->pbo);
+  void *ptr = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+
+  if (ptr) {
+    memcpy(pixels, ptr, size);
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+  }
+
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+  return ptr != NULL;
+}
+
 void r_viewport(struct render_backend *r, int x, int y, int width, int height) {
   r->viewport.x = x;
   r->viewport.y = y;
@@ -691,18 +2318,296 @@ void r_viewport(struct render_backend *r, int x, int y, int width, int height) {
 }
 
 void r_clear(struct render_backend *r) {
-  glDepthMask(1);
+  r_set_depth_mask(r, 1);
   glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
   glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
 }
 
+static int r_texture_levels(int width, int height) {
+  int levels = 1;
+  int size = MAX(width, height);
+
+  while (size > 1) {
+    size >>= 1;
+    levels++;
+  }
+
+  return levels;
+}
+
+static GLuint r_alloc_texture(struct render_backend *r, enum pxl_format format,
+                              int mipmaps, int width, int height) {
+  /* reuse a previously destroyed texture with the same storage if possible */
+  for (int i = r->num_free_textures - 1; i >= 0; i--) {
+    struct texture *tex = &r->free_textures[i];
+
+    if (tex->format != format || tex->mipmaps != mipmaps ||
+        tex->width != width || tex->height != height) {
+      continue;
+    }
+
+    GLuint texture = tex->texture;
+    *tex = r->free_textures[--r->num_free_textures];
+    return texture;
+  }
+
+  GLuint texture;
+  glGenTextures(1, &texture);
+  r_bind_texture(r, MAP_DIFFUSE, texture);
+
+  /* glTexStorage2D is only available with gles 3.0, gl 4.2 or
+     GL_ARB_texture_storage */
+  if (glTexStorage2D) {
+    int levels = mipmaps ? r_texture_levels(width, height) : 1;
+    glTexStorage2D(GL_TEXTURE_2D, levels, storage_formats[format], width,
+                   height);
+  } else {
+    GLuint internal_fmt = internal_formats[format];
+    GLuint pixel_fmt = pixel_formats[format];
+    glTexImage2D(GL_TEXTURE_2D, 0, internal_fmt, width, height, 0,
+                 internal_fmt, pixel_fmt, NULL);
+  }
+
+  return texture;
+}
+
+static void r_free_texture(struct render_backend *r, struct texture *tex) {
+  /* if the free list is full, evict its oldest texture */
+  if (r->num_free_textures == MAX_FREE_TEXTURES) {
+    /* deleting a bound texture unbinds it */
+    if (r->state.textures[MAP_DIFFUSE] == (int)r->free_textures[0].texture) {
+      r->state.textures[MAP_DIFFUSE] = 0;
+    }
+
+    glDeleteTextures(1, &r->free_textures[0].texture);
+    memmove(&r->free_textures[0], &r->free_textures[1],
+            sizeof(r->free_textures[0]) * (MAX_FREE_TEXTURES - 1));
+    r->num_free_textures--;
+  }
+
+  r->free_textures[r->num_free_textures++] = *tex;
+}
+
+static void r_tex_sub_image(GLenum target, int layer, int y, int width,
+                            int height, GLenum internal_fmt, GLenum pixel_fmt,
+                            const void *data) {
+  if (target == GL_TEXTURE_2D_ARRAY) {
+    glTexSubImage3D(target, 0, 0, y, layer, width, height, 1, internal_fmt,
+                    pixel_fmt, data);
+  } else {
+    glTexSubImage2D(target, 0, 0, y, width, height, internal_fmt, pixel_fmt,
+                    data);
+  }
+}
+
+/* upload rows [y, y + height) of the bound texture's base level */
+static void r_upload_texture(struct render_backend *r, GLenum target,
+                             int layer, enum pxl_format format, int y,
+                             int width, int height, const uint8_t *buffer) {
+  GLuint internal_fmt = internal_formats[format];
+  GLuint pixel_fmt = pixel_formats[format];
+  /* rows are aligned to GL_UNPACK_ALIGNMENT, which is left at its default */
+  int size = ALIGN_UP(width * pixel_sizes[format], 4) * height;
+
+  int i = r->next_upload_buffer;
+  r->next_upload_buffer = (i + 1) % NUM_UPLOAD_BUFFERS;
+
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, r->upload_buffers[i]);
+
+  /* grow the buffer if needed. otherwise, the invalidate bit on the mapping
+     orphans the previous contents, so this doesn't wait on the driver to
+     finish reading them */
+  if (size > r->upload_sizes[i]) {
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+    r->upload_sizes[i] = size;
+  }
+
+  void *ptr = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size,
+                               GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+
+  if (ptr) {
+    memcpy(ptr, buffer, size);
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    r_tex_sub_image(target, layer, y, width, height, internal_fmt, pixel_fmt,
+                    NULL);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  } else {
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    r_tex_sub_image(target, layer, y, width, height, internal_fmt, pixel_fmt,
+                    buffer);
+  }
+}
+
+static int r_texture_arrayable(enum pxl_format format, int mipmaps, int width,
+                               int height) {
+  if (!OPTION_texture_arrays) {
+    return 0;
+  }
+
+  /* mipmapped textures are left standalone, as generating mipmaps for a
+     single layer would regenerate them for the entire array */
+  if (mipmaps) {
+    return 0;
+  }
+
+  return width >= MIN_ARRAY_SIZE && width <= MAX_ARRAY_SIZE &&
+         height >= MIN_ARRAY_SIZE && height <= MAX_ARRAY_SIZE &&
+         !(width & (width - 1)) && !(height & (height - 1));
+}
+
+static struct texture_array *r_create_texture_array(struct render_backend *r,
+                                                    enum pxl_format format,
+                                                    int width, int height) {
+  if (r->num_arrays == MAX_TEXTURE_ARRAYS) {
+    return NULL;
+  }
+
+  int num_layers = ARRAY_LAYER_BUDGET / (width * height * pixel_sizes[format]);
+  num_layers = CLAMP(num_layers, MIN_ARRAY_LAYERS, MAX_ARRAY_LAYERS);
+
+  /* reserve a contiguous range of handles for the array's layers, searching
+     down from the end of the handle space to stay clear of standalone
+     textures, which are allocated from the start */
+  int base = MAX_TEXTURES - 1;
+  int run = 0;
+
+  while (base > 0 && run < num_layers) {
+    struct texture *tex = &r->textures[base];
+
+    if (tex->texture || tex->array) {
+      run = 0;
+    } else {
+      run++;
+    }
+
+    base--;
+  }
+
+  if (run < num_layers) {
+    return NULL;
+  }
+
+  base++;
+
+  struct texture_array *array = &r->arrays[r->num_arrays++];
+  array->format = format;
+  array->width = width;
+  array->height = height;
+  array->num_layers = num_layers;
+  array->base = base;
+  array->num_free_layers = 0;
+
+  /* push layers in reverse, so they're handed out from the front */
+  for (int i = num_layers - 1; i >= 0; i--) {
+    array->free_layers[array->num_free_layers++] = i;
+    r->textures[base + i].array = r->num_arrays;
+  }
+
+  glGenTextures(1, &array->texture);
+  r_bind_texture_array(r, array->texture);
+  glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, storage_formats[format], width, height,
+               num_layers, 0, internal_formats[format], pixel_formats[format],
+               NULL);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, 0);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+  return array;
+}
+
+static texture_handle_t r_create_texture_layer(
+    struct render_backend *r, enum pxl_format format, enum filter_mode filter,
+    enum wrap_mode wrap_u, enum wrap_mode wrap_v, int width, int height,
+    const uint8_t *buffer) {
+  struct texture_array *array = NULL;
+
+  for (int i = 0; i < r->num_arrays; i++) {
+    struct texture_array *it = &r->arrays[i];
+
+    if (it->format == format && it->width == width && it->height == height &&
+        it->num_free_layers) {
+      array = it;
+      break;
+    }
+  }
+
+  if (!array) {
+    array = r_create_texture_array(r, format, width, height);
+
+    if (!array) {
+      return 0;
+    }
+  }
+
+  int layer = array->free_layers[--array->num_free_layers];
+  texture_handle_t handle = array->base + layer;
+
+  struct texture *tex = &r->textures[handle];
+  tex->texture = array->texture;
+  tex->format = format;
+  tex->width = width;
+  tex->height = height;
+  tex->mipmaps = 0;
+  tex->sampler = (filter * 3 + wrap_u) * 3 + wrap_v;
+
+  if (buffer) {
+    r_bind_texture_array(r, array->texture);
+    r_upload_texture(r, GL_TEXTURE_2D_ARRAY, layer, format, 0, width, height,
+                     buffer);
+  }
+
+  return handle;
+}
+
+void r_set_palette(struct render_backend *r, const uint8_t *rgba,
+                   int num_entries) {
+  CHECK_LE(num_entries, MAX_PALETTE_ENTRIES);
+
+  r_bind_texture(r, MAP_DIFFUSE, r->palette_texture);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, num_entries, 1, GL_RGBA,
+                  GL_UNSIGNED_BYTE, rgba);
+  r_bind_texture(r, MAP_DIFFUSE, 0);
+}
+
+void r_update_texture(struct render_backend *r, texture_handle_t handle, int y,
+                      int height, const uint8_t *buffer) {
+  struct texture *tex = &r->textures[handle];
+
+  if (tex->array) {
+    struct texture_array *array = &r->arrays[tex->array - 1];
+    r_bind_texture_array(r, array->texture);
+    r_upload_texture(r, GL_TEXTURE_2D_ARRAY, handle - array->base,
+                     tex->format, y, tex->width, height, buffer);
+    return;
+  }
+
+  r_bind_texture(r, MAP_DIFFUSE, tex->texture);
+  r_upload_texture(r, GL_TEXTURE_2D, 0, tex->format, y, tex->width, height,
+                   buffer);
+
+  if (tex->mipmaps) {
+    glGenerateMipmap(GL_TEXTURE_2D);
+  }
+
+  r_bind_texture(r, MAP_DIFFUSE, 0);
+}
+
 void r_destroy_texture(struct render_backend *r, texture_handle_t handle) {
   if (!handle) {
     return;
   }
 
   struct texture *tex = &r->textures[handle];
-  glDeleteTextures(1, &tex->texture);
+
+  /* return array layers to their array, the entry stays reserved for it */
+  if (tex->array) {
+    struct texture_array *array = &r->arrays[tex->array - 1];
+    array->free_layers[array->num_free_layers++] = handle - array->base;
+    tex->texture = 0;
+    return;
+  }
+
+  r_free_texture(r, tex);
   tex->texture = 0;
 }
 
@@ -712,35 +2617,51 @@ texture_handle_t r_create_texture(struct render_backend *r,
                                   enum wrap_mode wrap_u, enum wrap_mode wrap_v,
                                   int mipmaps, int width, int height,
                                   const uint8_t *buffer) {
-  /* find next open texture entry */
+  if (r_texture_arrayable(format, mipmaps, width, height)) {
+    texture_handle_t handle = r_create_texture_layer(
+        r, format, filter, wrap_u, wrap_v, width, height, buffer);
+
+    /* fall back to a standalone texture if the arrays are exhausted */
+    if (handle) {
+      return handle;
+    }
+  }
+
+  /* find next open texture entry, skipping those reserved for arrays */
   texture_handle_t handle;
   for (handle = 1; handle < MAX_TEXTURES; handle++) {
     struct texture *tex = &r->textures[handle];
-    if (!tex->texture) {
+    if (!tex->texture && !tex->array) {
       break;
     }
   }
   CHECK_LT(handle, MAX_TEXTURES);
 
-  GLuint internal_fmt = internal_formats[format];
-  GLuint pixel_fmt = pixel_formats[format];
-
   struct texture *tex = &r->textures[handle];
-  glGenTextures(1, &tex->texture);
-  glBindTexture(GL_TEXTURE_2D, tex->texture);
+  tex->texture = r_alloc_texture(r, format, mipmaps, width, height);
+  tex->format = format;
+  tex->width = width;
+  tex->height = height;
+  tex->mipmaps = mipmaps;
+
+  /* sampler state is always set, as reused textures may have different
+     state */
+  r_bind_texture(r, MAP_DIFFUSE, tex->texture);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
                   filter_funcs[mipmaps * NUM_FILTER_MODES + filter]);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter_funcs[filter]);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap_modes[wrap_u]);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrap_modes[wrap_v]);
-  glTexImage2D(GL_TEXTURE_2D, 0, internal_fmt, width, height, 0, internal_fmt,
-               pixel_fmt, buffer);
 
-  if (mipmaps) {
-    glGenerateMipmap(GL_TEXTURE_2D);
+  if (buffer) {
+    r_upload_texture(r, GL_TEXTURE_2D, 0, format, 0, width, height, buffer);
+
+    if (mipmaps) {
+      glGenerateMipmap(GL_TEXTURE_2D);
+    }
   }
 
-  glBindTexture(GL_TEXTURE_2D, 0);
+  r_bind_texture(r, MAP_DIFFUSE, 0);
 
   return handle;
 }
@@ -754,6 +2675,7 @@ int r_width(struct render_backend *r) {
 }
 
 void r_destroy(struct render_backend *r) {
+  r_destroy_gpu_timers(r);
   r_destroy_vertex_arrays(r);
   r_destroy_shaders(r);
   r_destroy_textures(r);
@@ -766,10 +2688,33 @@ struct render_backend *r_create(int width, int height) {
 
   r->width = width;
   r->height = height;
+  r->ta_ring_frame = -1;
+  r->ta_layer = -1;
+
+#if PLATFORM_ANDROID
+  /* gl_PrimitiveID isn't available to fragment shaders before gles 3.2 */
+  if (OPTION_oit_layers > 0) {
+    LOG_WARNING("r_create oit isn't supported, sorting on the cpu instead");
+    OPTION_oit_layers = 0;
+  }
+#endif
+
+  /* compute shaders are core since gl 4.3, and aren't available on gles 3.0.
+     the option is cleared before any context is parsed with it */
+  int compute = GLVersion.major > 4 ||
+                (GLVersion.major == 4 && GLVersion.minor >= 3);
+
+  if (OPTION_gpu_verts > 0 && (!compute || !glDispatchCompute ||
+                               !glMemoryBarrier)) {
+    LOG_WARNING("r_create compute shaders aren't supported, decoding vertices "
+                "on the cpu instead");
+    OPTION_gpu_verts = 0;
+  }
 
   r_create_textures(r);
   r_create_shaders(r);
   r_create_vertex_arrays(r);
+  r_create_gpu_timers(r);
   r_set_initial_state(r);
 
   return r;
@@ -8,6 +8,12 @@ struct host;
 /* note, this can't be larger than the width of ta_surface's texture param */
 #define MAX_TEXTURES (1 << 13)
 
+/* note, this can't be larger than the width of ta_surface's palette_base */
+#define MAX_PALETTE_ENTRIES 1024
+
+/* index separating the strips of surfaces drawn as triangle strips */
+#define RESTART_INDEX 0xffff
+
 typedef int texture_handle_t;
 
 enum pxl_format {
@@ -74,11 +80,35 @@ enum prim_type {
   PRIM_LINES,
 };
 
+/* stages of rendering a ta frame, timed separately on the gpu */
+enum ta_stage {
+  TA_STAGE_BACKGROUND,
+  TA_STAGE_OPAQUE,
+  TA_STAGE_PUNCH_THROUGH,
+  TA_STAGE_TRANSLUCENT,
+  TA_NUM_STAGES,
+};
+
 struct ta_vertex {
   float xyz[3];
   float uv[2];
   uint32_t color;
   uint32_t offset_color;
+  /* texture of the surface the vertex belongs to, letting surfaces whose
+     textures share a texture array be drawn together */
+  uint32_t texture;
+};
+
+/* vertices left encoded for r_decode_ta_vertices hold the byte offset of
+   their vertex param and the state needed to decode it in place of their uv
+   and colors. the face colors are only used by the intensity vertex types */
+struct ta_vertex_param {
+  float xyz[3];
+  uint32_t offset;
+  uint32_t vert_type;
+  uint32_t face_color;
+  uint32_t face_offset_color;
+  uint32_t texture;
 };
 
 struct ta_surface {
@@ -99,7 +129,15 @@ struct ta_surface {
       uint64_t alpha_test : 1;
       uint64_t alpha_ref : 8;
       uint64_t debug_depth : 1;
-      uint64_t : 19;
+      /* the texture holds palette indices, which are offset by palette_base
+         and looked up in the palette set by r_set_palette */
+      uint64_t palette : 1;
+      uint64_t palette_filter : 1;
+      uint64_t palette_base : 10;
+      /* the surface's indices form triangle strips separated by RESTART_INDEX,
+         rather than a list of triangles */
+      uint64_t strip : 1;
+      uint64_t : 6;
     };
   } params;
 
@@ -143,14 +181,29 @@ texture_handle_t r_create_texture(struct render_backend *r,
                                   enum wrap_mode wrap_u, enum wrap_mode wrap_v,
                                   int mipmaps, int width, int height,
                                   const uint8_t *buffer);
+/* replace rows [y, y + height) of the texture's base level, buffer holding
+   just those rows */
+void r_update_texture(struct render_backend *r, texture_handle_t handle, int y,
+                      int height, const uint8_t *buffer);
 void r_destroy_texture(struct render_backend *r, texture_handle_t handle);
 
+void r_set_palette(struct render_backend *r, const uint8_t *rgba,
+                   int num_entries);
+
 void r_clear(struct render_backend *r);
 void r_viewport(struct render_backend *r, int x, int y, int width, int height);
 
 void r_draw_pixels(struct render_backend *r, const uint8_t *pixels, int x,
                    int y, int width, int height);
 
+/* asynchronously read back a region of the last rendered ta frame, given in
+   video coordinates, as rgba rows from top to bottom. readbacks are finished in
+   the order they were started, r_end_readback returning 0 if the oldest isn't
+   available yet and wait wasn't specified */
+void r_begin_readback(struct render_backend *r, int x, int y, int width,
+                      int height);
+int r_end_readback(struct render_backend *r, uint8_t *pixels, int wait);
+
 void r_begin_ta_surfaces(struct render_backend *r, int video_width,
                          int video_height, const struct ta_vertex *verts,
                          int num_verts, const uint16_t *indices,
@@ -158,6 +211,29 @@ void r_begin_ta_surfaces(struct render_backend *r, int video_width,
 void r_draw_ta_surface(struct render_backend *r, const struct ta_surface *surf);
 void r_end_ta_surfaces(struct render_backend *r);
 
+/* translucent surfaces drawn between r_begin_ta_layer and r_end_ta_layer are
+   sorted per pixel, by peeling a layer of fragments from back to front each
+   time they're drawn. r_begin_ta_layer returns 0 once every layer has been
+   peeled, or if the backend isn't sorting surfaces itself */
+int r_begin_ta_layer(struct render_backend *r, int layer);
+void r_end_ta_layer(struct render_backend *r);
+
+/* surfaces drawn after r_begin_ta_stage, up until the next stage begins or
+   r_end_ta_surfaces, have their gpu time reported to the profiler as part of
+   the stage */
+void r_begin_ta_stage(struct render_backend *r, int stage);
+
+/* decodes the listed vertices of those passed to r_begin_ta_surfaces on the
+   gpu, reading their vertex params from the raw ta param stream. only
+   supported when the backend was created with the gpu_verts option */
+void r_decode_ta_vertices(struct render_backend *r, const uint8_t *params,
+                          int size, const uint32_t *verts, int num_verts);
+
+/* blit the last ta frame rendered to the offscreen target to the viewport
+   again, returning 0 if it was rendered directly to the viewport or the
+   target has since been invalidated */
+int r_present_ta_target(struct render_backend *r);
+
 void r_begin_ui_surfaces(struct render_backend *r,
                          const struct ui_vertex *verts, int num_verts,
                          const uint16_t *indices, int num_indices);
@@ -10,10 +10,21 @@ static const char *ta_vp =
 "out vec4 var_offset_color;\n"
 "out vec2 var_texcoord;\n"
 
+"#ifdef TEXTURE_ARRAY\n"
+"  uniform int u_layer_base;\n"
+"  layout(location = 4) in highp uint attr_texture;\n"
+"  flat out highp float var_layer;\n"
+"#endif\n"
+
 "void main() {\n"
 "  var_color = attr_color;\n"
 "  var_offset_color = attr_offset_color;\n"
 "  var_texcoord = attr_texcoord;\n"
+"  #ifdef TEXTURE_ARRAY\n"
+"    // each texture in an array owns the handle at its layer's offset from\n"
+"    // the array's first handle\n"
+"    var_layer = float(int(attr_texture) - u_layer_base);\n"
+"  #endif\n"
 
 "  // the z coordinate is actually 1/w, convert to w. note, there is no\n"
 "  // actual z coordinate provided to the ta, just this\n"
@@ -43,7 +54,14 @@ static const char *ta_vp =
 "}";
 
 static const char *ta_fp =
-"uniform sampler2D u_diffuse;\n"
+"#ifdef TEXTURE_ARRAY\n"
+"  uniform mediump sampler2DArray u_diffuse;\n"
+"  flat in highp float var_layer;\n"
+"  #define sample_diffuse(uv) texture(u_diffuse, vec3(uv, var_layer))\n"
+"#else\n"
+"  uniform sampler2D u_diffuse;\n"
+"  #define sample_diffuse(uv) texture(u_diffuse, uv)\n"
+"#endif\n"
 "uniform mediump float u_alpha_ref;\n"
 
 "in mediump vec4 var_color;\n"
@@ -52,13 +70,54 @@ static const char *ta_fp =
 
 "layout(location = 0) out mediump vec4 fragcolor;\n"
 
+"#ifdef PEEL\n"
+"  uniform highp sampler2D u_opaque_depth;\n"
+"  uniform highp sampler2D u_layer_depth;\n"
+"  uniform highp usampler2D u_layer_id;\n"
+"  uniform int u_prim_base;\n"
+"  uniform int u_blend;\n"
+"  layout(location = 1) out highp uint fragid;\n"
+"#endif\n"
+
+"#ifdef PALETTE\n"
+"  uniform sampler2D u_palette;\n"
+"  uniform int u_palette_base;\n"
+
+"  // the red channel of the texture holds the palette index\n"
+"  mediump vec4 palette_lookup(highp vec2 uv) {\n"
+"    int index = int(sample_diffuse(uv).r * 255.0 + 0.5);\n"
+"    return texelFetch(u_palette, ivec2(u_palette_base + index, 0), 0);\n"
+"  }\n"
+"#endif\n"
+
+"mediump vec4 sample_texture(highp vec2 uv) {\n"
+"  #if defined(PALETTE) && defined(PALETTE_FILTER)\n"
+"    // indices can't be interpolated, so the index texture is always sampled\n"
+"    // with nearest filtering and the looked up colors are filtered here\n"
+"    highp vec2 size = vec2(textureSize(u_diffuse, 0).xy);\n"
+"    highp vec2 coord = uv * size - 0.5;\n"
+"    highp vec2 base = (floor(coord) + 0.5) / size;\n"
+"    highp vec2 texel = 1.0 / size;\n"
+"    mediump vec2 f = fract(coord);\n"
+"    mediump vec4 a = palette_lookup(base);\n"
+"    mediump vec4 b = palette_lookup(base + vec2(texel.x, 0.0));\n"
+"    mediump vec4 c = palette_lookup(base + vec2(0.0, texel.y));\n"
+"    mediump vec4 d = palette_lookup(base + texel);\n"
+"    return mix(mix(a, b, f.x), mix(c, d, f.x), f.y);\n"
+"  #elif defined(PALETTE)\n"
+"    return palette_lookup(uv);\n"
+"  #else\n"
+"    return sample_diffuse(uv);\n"
+"  #endif\n"
+"}\n"
+
 "void main() {\n"
 "  mediump vec4 col = var_color;\n"
 "  #ifdef IGNORE_ALPHA\n"
 "    col.a = 1.0;\n"
 "  #endif\n"
 "  #ifdef TEXTURE\n"
-"    mediump vec4 tex = texture(u_diffuse, var_texcoord);\n"
+"    mediump vec4 tex = sample_texture(var_texcoord);\n"
 "    #ifdef IGNORE_TEXTURE_ALPHA\n"
 "      tex.a = 1.0;\n"
 "    #endif\n"
@@ -115,4 +174,164 @@ static const char *ta_fp =
 "  #ifdef DEBUG_DEPTH_BUFFER\n"
 "    fragcolor.rgb = vec3(gl_FragDepth);\n"
 "  #endif\n"
+
+"  #ifdef PEEL\n"
+"    // each pass keeps the farthest fragment which is in front of the\n"
+"    // opaque surfaces, and behind the fragment kept by the previous pass.\n"
+"    // fragments at the same depth are ordered by when their polygon was\n"
+"    // submitted, the earliest being drawn first, like the ta's autosort\n"
+"    highp float depth = clamp(log2(1.0 + w) / 17.0, 0.0, 1.0);\n"
+"    ivec2 coord = ivec2(gl_FragCoord.xy);\n"
+
+"    // the opaque depth is quantized to 24 bits, which drivers may round or\n"
+"    // truncate to. allow a step of error, else surfaces coplanar with the\n"
+"    // opaque ones they're drawn over can fail the depth test\n"
+"    highp float opaque = texelFetch(u_opaque_depth, coord, 0).r;\n"
+"    if (depth > opaque + 1.0 / 16777215.0)\n"
+"      discard;\n"
+
+"    highp float last_depth = texelFetch(u_layer_depth, coord, 0).r;\n"
+"    highp uint last_id = texelFetch(u_layer_id, coord, 0).r >> 8;\n"
+"    highp uint id = uint(u_prim_base + gl_PrimitiveID + 1);\n"
+"    if (depth > last_depth || (depth == last_depth && id <= last_id))\n"
+"      discard;\n"
+
+"    // the low byte records the blend functions the layer is composited with\n"
+"    gl_FragDepth = depth;\n"
+"    fragid = (id << 8) | uint(u_blend);\n"
+"  #endif\n"
+"}";
+
+static const char *oit_vp =
+"void main() {\n"
+"  // a single triangle covering the entire target\n"
+"  highp vec2 pos = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);\n"
+"  gl_Position = vec4(pos * 2.0 - 1.0, 0.0, 1.0);\n"
+"}";
+
+static const char *oit_fp =
+"uniform mediump sampler2D u_layer_color;\n"
+"uniform highp usampler2D u_layer_id;\n"
+"uniform int u_blend;\n"
+
+"layout(location = 0) out mediump vec4 fragcolor;\n"
+
+"void main() {\n"
+"  // the layer is composited once for each blend function used by the list,\n"
+"  // an id of 0 marking pixels without a fragment in this layer\n"
+"  ivec2 coord = ivec2(gl_FragCoord.xy);\n"
+"  highp uint id = texelFetch(u_layer_id, coord, 0).r;\n"
+"  if (id == 0u || (id & 0xffu) != uint(u_blend))\n"
+"    discard;\n"
+"  fragcolor = texelFetch(u_layer_color, coord, 0);\n"
+"}";
+
+static const char *ta_cp =
+"layout(local_size_x = 64) in;\n"
+
+"// raw ta params, the encoded vertices' indices and the vertices themselves,\n"
+"// each ta_vertex being 8 words\n"
+"layout(std430, binding = 0) readonly buffer params_block {\n"
+"  uint params[];\n"
+"};\n"
+"layout(std430, binding = 1) readonly buffer encoded_block {\n"
+"  uint encoded[];\n"
+"};\n"
+"layout(std430, binding = 2) buffer verts_block {\n"
+"  uint verts[];\n"
+"};\n"
+
+"uniform uint u_num_verts;\n"
+
+"// saturating float to 8-bit conversion, matching ftou8 in tr.c\n"
+"uint ftou8(uint f) {\n"
+"  return uint(clamp(int(uintBitsToFloat(f) * 255.0), 0, 255));\n"
+"}\n"
+
+"// argb -> rgba byte order\n"
+"uint packed_color(uint c) {\n"
+"  return ((c >> 16) & 0xffu) | (c & 0xff00u) | ((c & 0xffu) << 16) |\n"
+"         (c & 0xff000000u);\n"
+"}\n"
+
+"// float colors are stored as argb\n"
+"uint float_color(uint p) {\n"
+"  return ftou8(params[p + 1u]) | (ftou8(params[p + 2u]) << 8) |\n"
+"         (ftou8(params[p + 3u]) << 16) | (ftou8(params[p]) << 24);\n"
+"}\n"
+
+"// scales the face color's rgb by the intensity, keeping its alpha\n"
+"uint intensity(uint face, uint f) {\n"
+"  uint i = ftou8(f);\n"
+"  uint c = face & 0xff000000u;\n"
+"  for (int shift = 0; shift < 24; shift += 8) {\n"
+"    c |= (((face >> shift) & 0xffu) * i / 255u) << shift;\n"
+"  }\n"
+"  return c;\n"
+"}\n"
+
+"void main() {\n"
+"  uint n = gl_GlobalInvocationID.x;\n"
+"  if (n >= u_num_verts) {\n"
+"    return;\n"
+"  }\n"
+
+"  uint v = encoded[n] * 8u;\n"
+"  uint p = verts[v + 3u] >> 2;\n"
+"  uint vert_type = verts[v + 4u];\n"
+"  uint face_color = verts[v + 5u];\n"
+"  uint face_offset_color = verts[v + 6u];\n"
+
+"  // 16-bit uvs are the upper halves of 32-bit floats, packed as vu\n"
+"  uint uv16 = params[p + 4u];\n"
+"  uvec2 uv = uvec2(0u);\n"
+"  uint color = 0u;\n"
+"  uint offset_color = 0u;\n"
+
+"  switch (vert_type) {\n"
+"    case 0u:\n"
+"      color = packed_color(params[p + 6u]);\n"
+"      break;\n"
+"    case 1u:\n"
+"      color = float_color(p + 4u);\n"
+"      break;\n"
+"    case 2u:\n"
+"      color = intensity(face_color, params[p + 6u]);\n"
+"      break;\n"
+"    case 3u:\n"
+"      uv = uvec2(params[p + 4u], params[p + 5u]);\n"
+"      color = packed_color(params[p + 6u]);\n"
+"      offset_color = packed_color(params[p + 7u]);\n"
+"      break;\n"
+"    case 4u:\n"
+"      uv = uvec2(uv16 & 0xffff0000u, uv16 << 16);\n"
+"      color = packed_color(params[p + 6u]);\n"
+"      offset_color = packed_color(params[p + 7u]);\n"
+"      break;\n"
+"    case 5u:\n"
+"      uv = uvec2(params[p + 4u], params[p + 5u]);\n"
+"      color = float_color(p + 8u);\n"
+"      offset_color = float_color(p + 12u);\n"
+"      break;\n"
+"    case 6u:\n"
+"      uv = uvec2(uv16 & 0xffff0000u, uv16 << 16);\n"
+"      color = float_color(p + 8u);\n"
+"      offset_color = float_color(p + 12u);\n"
+"      break;\n"
+"    case 7u:\n"
+"      uv = uvec2(params[p + 4u], params[p + 5u]);\n"
+"      color = intensity(face_color, params[p + 6u]);\n"
+"      offset_color = intensity(face_offset_color, params[p + 7u]);\n"
+"      break;\n"
+"    case 8u:\n"
+"      uv = uvec2(uv16 & 0xffff0000u, uv16 << 16);\n"
+"      color = intensity(face_color, params[p + 6u]);\n"
+"      offset_color = intensity(face_offset_color, params[p + 7u]);\n"
+"      break;\n"
+"  }\n"
+
+"  verts[v + 3u] = uv.x;\n"
+"  verts[v + 4u] = uv.y;\n"
+"  verts[v + 5u] = color;\n"
+"  verts[v + 6u] = offset_color;\n"
 "}";
@@ -1,10 +1,81 @@
 #include "stats.h"
+#include "core/core.h"
 
 DEFINE_AGGREGATE_COUNTER(frames);
 DEFINE_AGGREGATE_COUNTER(aica_samples);
 DEFINE_AGGREGATE_COUNTER(arm7_instrs);
 DEFINE_AGGREGATE_COUNTER(pvr_vblanks);
+DEFINE_AGGREGATE_COUNTER(pvr_line_events);
 DEFINE_AGGREGATE_COUNTER(ta_renders);
 DEFINE_AGGREGATE_COUNTER(sh4_instrs);
+DEFINE_AGGREGATE_COUNTER(sched_slices);
+DEFINE_AGGREGATE_COUNTER(sched_slice_time);
 DEFINE_AGGREGATE_COUNTER(mmio_read);
 DEFINE_AGGREGATE_COUNTER(mmio_write);
+DEFINE_AGGREGATE_COUNTER(fastmem_patches);
+DEFINE_AGGREGATE_COUNTER(snapshots);
+DEFINE_AGGREGATE_COUNTER(snapshot_time);
+DEFINE_AGGREGATE_COUNTER(jit_blocks);
+DEFINE_AGGREGATE_COUNTER(jit_compile_time);
+DEFINE_AGGREGATE_COUNTER(jit_prescan_blocks);
+DEFINE_COUNTER(sh4_time);
+DEFINE_COUNTER(arm7_time);
+DEFINE_COUNTER(timer_time);
+DEFINE_COUNTER(ta_parse_time);
+DEFINE_COUNTER(texture_time);
+DEFINE_COUNTER(render_time);
+DEFINE_COUNTER(swap_time);
+DEFINE_COUNTER(gpu_background_time);
+DEFINE_COUNTER(gpu_opaque_time);
+DEFINE_COUNTER(gpu_punch_through_time);
+DEFINE_COUNTER(gpu_translucent_time);
+DEFINE_COUNTER(gpu_ui_time);
+DEFINE_COUNTER(textures_decoded);
+DEFINE_COUNTER(texture_hits);
+DEFINE_COUNTER(texture_misses);
+DEFINE_COUNTER(texture_decodes);
+DEFINE_COUNTER(texture_uploads);
+DEFINE_COUNTER(texture_updates);
+DEFINE_COUNTER(texture_evictions);
+DEFINE_COUNTER(texture_bytes);
+DEFINE_COUNTER(fb_writebacks);
+DEFINE_COUNTER(frames_reused);
+DEFINE_COUNTER(gdrom_readahead_hits);
+DEFINE_COUNTER(gdrom_readahead_misses);
+DEFINE_COUNTER(mem_guest);
+DEFINE_COUNTER(mem_jit_code);
+DEFINE_COUNTER(mem_jit_dispatch);
+DEFINE_COUNTER(mem_jit_ir);
+DEFINE_COUNTER(mem_ta_contexts);
+DEFINE_COUNTER(mem_tr_contexts);
+DEFINE_COUNTER(mem_textures);
+DEFINE_COUNTER(mem_audio);
+DEFINE_COUNTER(mem_disc_cache);
+
+int stats_memory_usage(struct mem_usage *usage) {
+  struct {
+    const char *name;
+    prof_token_t tok;
+  } counters[] = {
+      {"guest", COUNTER_mem_guest},
+      {"jit_code", COUNTER_mem_jit_code},
+      {"jit_dispatch", COUNTER_mem_jit_dispatch},
+      {"jit_ir", COUNTER_mem_jit_ir},
+      {"ta_contexts", COUNTER_mem_ta_contexts},
+      {"tr_contexts", COUNTER_mem_tr_contexts},
+      {"textures", COUNTER_mem_textures},
+      {"textures_gpu", COUNTER_texture_bytes},
+      {"audio", COUNTER_mem_audio},
+      {"disc_cache", COUNTER_mem_disc_cache},
+  };
+
+  int n = 0;
+
+  for (int i = 0; i < (int)ARRAY_SIZE(counters); i++) {
+    usage[n].name = counters[i].name;
+    usage[n].bytes = prof_counter_total(counters[i].tok);
+    n++;
+  }
+
+  return n;
+}
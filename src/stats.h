@@ -7,9 +7,64 @@ DECLARE_COUNTER(frames);
 DECLARE_COUNTER(aica_samples);
 DECLARE_COUNTER(arm7_instrs);
 DECLARE_COUNTER(pvr_vblanks);
+DECLARE_COUNTER(pvr_line_events);
 DECLARE_COUNTER(ta_renders);
 DECLARE_COUNTER(sh4_instrs);
+DECLARE_COUNTER(sched_slices);
+DECLARE_COUNTER(sched_slice_time);
 DECLARE_COUNTER(mmio_read);
 DECLARE_COUNTER(mmio_write);
+DECLARE_COUNTER(fastmem_patches);
+DECLARE_COUNTER(snapshots);
+DECLARE_COUNTER(snapshot_time);
+DECLARE_COUNTER(jit_blocks);
+DECLARE_COUNTER(jit_compile_time);
+DECLARE_COUNTER(jit_prescan_blocks);
+DECLARE_COUNTER(sh4_time);
+DECLARE_COUNTER(arm7_time);
+DECLARE_COUNTER(timer_time);
+DECLARE_COUNTER(ta_parse_time);
+DECLARE_COUNTER(texture_time);
+DECLARE_COUNTER(render_time);
+DECLARE_COUNTER(swap_time);
+DECLARE_COUNTER(gpu_background_time);
+DECLARE_COUNTER(gpu_opaque_time);
+DECLARE_COUNTER(gpu_punch_through_time);
+DECLARE_COUNTER(gpu_translucent_time);
+DECLARE_COUNTER(gpu_ui_time);
+DECLARE_COUNTER(textures_decoded);
+DECLARE_COUNTER(texture_hits);
+DECLARE_COUNTER(texture_misses);
+DECLARE_COUNTER(texture_decodes);
+DECLARE_COUNTER(texture_uploads);
+DECLARE_COUNTER(texture_updates);
+DECLARE_COUNTER(texture_evictions);
+DECLARE_COUNTER(texture_bytes);
+DECLARE_COUNTER(fb_writebacks);
+DECLARE_COUNTER(frames_reused);
+DECLARE_COUNTER(gdrom_readahead_hits);
+DECLARE_COUNTER(gdrom_readahead_misses);
+
+/* bytes held by each subsystem, added to as memory is allocated and
+   subtracted from as it's freed */
+DECLARE_COUNTER(mem_guest);
+DECLARE_COUNTER(mem_jit_code);
+DECLARE_COUNTER(mem_jit_dispatch);
+DECLARE_COUNTER(mem_jit_ir);
+DECLARE_COUNTER(mem_ta_contexts);
+DECLARE_COUNTER(mem_tr_contexts);
+DECLARE_COUNTER(mem_textures);
+DECLARE_COUNTER(mem_audio);
+DECLARE_COUNTER(mem_disc_cache);
+
+struct mem_usage {
+  const char *name;
+  int64_t bytes;
+};
+
+/* the memory held by each subsystem, along with the texture cache's estimated
+   gpu memory. returns the number of entries written */
+#define MAX_MEM_USAGE 16
+int stats_memory_usage(struct mem_usage *usage);
 
 #endif
@@ -99,12 +99,13 @@ struct tracer {
   /* trace state */
   struct trace *trace;
   struct ta_context ctx;
-  struct trace_cmd *current_cmd;
+  int current_cmd;
   int frame;
   int current_param;
   int scroll_to_param;
 
   /* render state */
+  struct tr_converter *cv;
   struct tr_context rc;
   int debug_depth;
   struct tracer_texture textures[1024];
@@ -215,85 +216,101 @@ static void tracer_next_param(struct tracer *tracer) {
   }
 }
 
-static void tracer_prev_context(struct tracer *tracer) {
-  struct trace_cmd *begin = tracer->current_cmd->prev;
+static int tracer_step_prev(struct tracer *tracer) {
+  struct trace_cmd cmd;
 
   /* ensure that there is a prev context */
-  struct trace_cmd *prev = begin;
+  int prev = tracer->current_cmd - 1;
 
-  while (prev) {
-    if (prev->type == TRACE_CMD_CONTEXT) {
+  while (trace_get_cmd(tracer->trace, prev, &cmd)) {
+    if (cmd.type == TRACE_CMD_CONTEXT) {
       break;
     }
 
-    prev = prev->prev;
+    prev--;
   }
 
-  if (!prev) {
-    return;
+  if (prev < 0) {
+    return 0;
   }
 
   /* walk back to the prev context, reverting any textures that've been added */
-  struct trace_cmd *curr = begin;
+  for (int i = tracer->current_cmd - 1; i > prev; i--) {
+    CHECK(trace_get_cmd(tracer->trace, i, &cmd));
 
-  while (curr != prev) {
-    if (curr->type == TRACE_CMD_TEXTURE) {
-      struct trace_cmd *override = curr->override;
-
-      if (override) {
-        tracer_add_texture(tracer, override);
-      }
+    if (cmd.type == TRACE_CMD_TEXTURE && cmd.override != -1) {
+      struct trace_cmd override;
+      CHECK(trace_get_cmd(tracer->trace, cmd.override, &override));
+      tracer_add_texture(tracer, &override);
     }
-
-    curr = curr->prev;
   }
 
   tracer->frame = MAX(tracer->frame - 1, 0);
   tracer->current_cmd = prev;
-  tracer->current_param = -1;
-  tracer->scroll_to_param = 0;
-  trace_copy_context(tracer->current_cmd, &tracer->ctx);
+
+  return 1;
 }
 
-static void tracer_next_context(struct tracer *tracer) {
-  struct trace_cmd *begin =
-      tracer->current_cmd ? tracer->current_cmd->next : tracer->trace->cmds;
+static int tracer_step_next(struct tracer *tracer) {
+  struct trace_cmd cmd;
 
   /* ensure that there is a next context */
-  struct trace_cmd *next = begin;
+  int next = tracer->current_cmd + 1;
+  int found = 0;
 
-  while (next) {
-    if (next->type == TRACE_CMD_CONTEXT) {
+  while (trace_get_cmd(tracer->trace, next, &cmd)) {
+    if (cmd.type == TRACE_CMD_CONTEXT) {
+      found = 1;
       break;
     }
 
-    next = next->next;
+    next++;
   }
 
-  if (!next) {
-    return;
+  if (!found) {
+    return 0;
   }
 
   /* walk towards to the next context, adding any new textures */
-  struct trace_cmd *curr = begin;
+  for (int i = tracer->current_cmd + 1; i < next; i++) {
+    CHECK(trace_get_cmd(tracer->trace, i, &cmd));
 
-  while (curr != next) {
-    if (curr->type == TRACE_CMD_TEXTURE) {
-      tracer_add_texture(tracer, curr);
+    if (cmd.type == TRACE_CMD_TEXTURE) {
+      tracer_add_texture(tracer, &cmd);
     }
-
-    curr = curr->next;
   }
 
-  tracer->frame = MIN(tracer->frame + 1, tracer->trace->num_frames - 1);
+  tracer->frame = tracer->current_cmd == -1 ? 0 : tracer->frame + 1;
   tracer->current_cmd = next;
+
+  return 1;
+}
+
+static void tracer_load_context(struct tracer *tracer) {
+  /* only the context being viewed is copied out of the trace */
+  struct trace_cmd cmd;
+  CHECK(trace_get_cmd(tracer->trace, tracer->current_cmd, &cmd));
+
   tracer->current_param = -1;
   tracer->scroll_to_param = 0;
-  trace_copy_context(tracer->current_cmd, &tracer->ctx);
+  trace_copy_context(&cmd, &tracer->ctx);
+}
+
+static void tracer_prev_context(struct tracer *tracer) {
+  if (tracer_step_prev(tracer)) {
+    tracer_load_context(tracer);
+  }
+}
+
+static void tracer_next_context(struct tracer *tracer) {
+  if (tracer_step_next(tracer)) {
+    tracer_load_context(tracer);
+  }
 }
 
 static void tracer_reset_context(struct tracer *tracer) {
-  tracer->current_cmd = NULL;
+  tracer->current_cmd = -1;
+  tracer->frame = 0;
   tracer_next_context(tracer);
 }
 
@@ -326,15 +343,24 @@ static void tracer_render_scrubber_menu(struct tracer *tracer) {
   igPushItemWidth(-1.0f);
 
   int frame = tracer->frame;
-  int num_frames = tracer->trace->num_frames;
+  int num_frames = trace_num_frames(tracer->trace);
 
   if (igSliderInt("", &frame, 0, num_frames - 1, NULL)) {
+    int moved = 0;
+
+    /* step through the textures of the frames in between, copying out only
+       the context being landed on */
     while (tracer->frame != (int)frame) {
-      if (tracer->frame < (int)frame) {
-        tracer_next_context(tracer);
-      } else {
-        tracer_prev_context(tracer);
+      int res = tracer->frame < (int)frame ? tracer_step_next(tracer)
+                                           : tracer_step_prev(tracer);
+      if (!res) {
+        break;
       }
+      moved = 1;
+    }
+
+    if (moved) {
+      tracer_load_context(tracer);
     }
   }
 
@@ -687,8 +713,8 @@ void tracer_render_frame(struct tracer *tracer) {
     end_surf = rp->last_surf;
   }
 
-  tr_convert_context(tracer->r, tracer, &tracer_find_texture, &tracer->ctx,
-                     &tracer->rc);
+  tr_convert_context(tracer->cv, tracer->r, tracer, &tracer_find_texture,
+                     &tracer->ctx, &tracer->rc);
 
   for (int i = 0; i < rc->num_surfs; i++) {
     struct ta_surface *surf = &rc->surfs[i];
@@ -733,8 +759,7 @@ int tracer_keydown(struct tracer *tracer, int key, int16_t value) {
 void tracer_vid_destroyed(struct tracer *tracer) {
   rb_for_each_entry_safe(tex, &tracer->live_textures, struct tracer_texture,
                          live_it) {
-    r_destroy_texture(tracer->r, tex->handle);
-    tex->handle = 0;
+    tr_release_texture(tracer->cv, tracer->r, (struct tr_texture *)tex);
   }
 
   tracer->r = NULL;
@@ -750,6 +775,9 @@ void tracer_destroy(struct tracer *tracer) {
   }
 
   tracer_vid_destroyed(tracer);
+  tr_destroy_context(&tracer->rc);
+  tr_destroy_converter(tracer->cv);
+  ta_free_params(&tracer->ctx);
 
   free(tracer);
 }
@@ -758,6 +786,7 @@ struct tracer *tracer_create(struct host *host) {
   struct tracer *tracer = calloc(1, sizeof(struct tracer));
 
   tracer->host = host;
+  tracer->cv = tr_create_converter();
 
   /* add all textures to free list */
   for (int i = 0, n = ARRAY_SIZE(tracer->textures); i < n; i++) {
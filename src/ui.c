@@ -2,10 +2,13 @@
 #include "ui.h"
 #include "core/assert.h"
 #include "core/filesystem.h"
+#include "core/hash.h"
 #include "core/sort.h"
 #include "core/string.h"
+#include "core/task_pool.h"
 #include "core/thread.h"
 #include "core/time.h"
+#include "core/xxhash.h"
 #include "guest/gdrom/disc.h"
 #include "guest/pvr/tex.h"
 #include "host/host.h"
@@ -16,10 +19,12 @@
 struct ui;
 
 #define UI_MAX_HISTORY 32
-#define UI_MAX_GAMES 1024
+#define UI_MAX_GAMES 4096
 #define UI_MAX_VOLUMES 32
 #define UI_MAX_ENTRIES 512
 #define UI_MAX_GAMEDIRS 32
+#define UI_MAX_SCAN_THREADS 16
+#define UI_GAME_CACHE_VERSION 1
 
 enum {
   UI_DLG_NEW,
@@ -48,6 +53,18 @@ struct game {
   texture_handle_t tex;
 };
 
+struct game_cache_entry {
+  struct list_node it;
+  uint64_t key;
+  int64_t size;
+  int64_t mtime;
+  /* files which failed to load as a disc are cached too */
+  int valid;
+  /* set once the file is found by the current scan */
+  int seen;
+  struct game game;
+};
+
 struct file_dlg {
   int state;
 
@@ -108,11 +125,19 @@ struct ui {
   /* scan state */
   volatile int scanning;
   char scan_status[PATH_MAX * 2];
-  thread_t scan_thread;
+  struct task_group *scan_group;
+
+  /* files found by the scan, handed out to the workers in order */
+  char **scan_files;
+  int num_scan_files;
+  int max_scan_files;
+  int next_scan_file;
 
   /* mutex to control acess to state used by both threads */
   mutex_t scan_mutex;
 
+  DECLARE_HASHTABLE(game_cache, 10);
+
   struct game games[UI_MAX_GAMES];
   int num_games;
 };
@@ -129,7 +154,7 @@ static struct page pages[UI_NUM_PAGES];
 /* clang-format off */
 #define UI_STR_TAB_GAMES     "GAMES"
 #define UI_STR_TAB_OPTIONS   "OPTIONS"
-#define UI_STR_NO_GAMES      "Your game library is currently empty. Add a directory containing valid .cdi, .chd or .gdi image(s) to get started."
+#define UI_STR_NO_GAMES      "Your game library is currently empty. Add a directory containing valid .cdi, .chd, .gdi or .rdz image(s) to get started."
 #define UI_STR_GO_TO_LIBRARY "Go to Library"
 #define UI_STR_BTN_CANCEL    "Cancel"
 #define UI_STR_BTN_ADD       "Add"
@@ -464,7 +489,7 @@ static void ui_begin_page(struct ui *ui, struct page *page) {
 /*
  * game scanning
  */
-static const char *game_exts[] = {".cdi", ".chd", ".gdi"};
+static const char *game_exts[] = {".cdi", ".chd", ".gdi", ".rdz"};
 
 static int ui_has_game_ext(const char *filename, const char **exts,
                            int num_exts) {
@@ -497,8 +522,13 @@ static void ui_insert_game(struct ui *ui, struct game *new_game) {
     }
   }
 
+  if (ui->num_games >= UI_MAX_GAMES) {
+    LOG_WARNING("ui_insert_game library is full, skipping %s",
+                new_game->filename);
+    return;
+  }
+
   /* shift and insert */
-  CHECK_LT(ui->num_games, UI_MAX_GAMES);
   ui->num_games++;
 
   for (int i = ui->num_games - 1; i > pos; i--) {
@@ -511,33 +541,227 @@ static void ui_insert_game(struct ui *ui, struct game *new_game) {
   *game = *new_game;
 }
 
+/*
+ * the results of scanning each file are cached to disk, keyed by the file's
+ * path, size and modification time, so rescanning an unchanged library doesn't
+ * have to open each disc again
+ */
+static uint64_t ui_game_cache_key(const char *filename) {
+  return xxh64(filename, strlen(filename), 0);
+}
+
+static struct game_cache_entry *ui_game_cache_lookup(struct ui *ui,
+                                                     const char *filename) {
+  uint64_t key = ui_game_cache_key(filename);
+  struct list *bkt = hash_bkt(ui->game_cache, key);
+
+  hash_bkt_for_each_entry(entry, bkt, struct game_cache_entry, it) {
+    if (entry->key == key && !strcmp(entry->game.filename, filename)) {
+      return entry;
+    }
+  }
+
+  return NULL;
+}
+
+static struct game_cache_entry *ui_game_cache_add(struct ui *ui,
+                                                  const char *filename) {
+  struct game_cache_entry *entry = ui_game_cache_lookup(ui, filename);
+
+  if (!entry) {
+    entry = calloc(1, sizeof(struct game_cache_entry));
+    entry->key = ui_game_cache_key(filename);
+    strncpy(entry->game.filename, filename, sizeof(entry->game.filename) - 1);
+    hash_add(hash_bkt(ui->game_cache, entry->key), &entry->it);
+  }
+
+  return entry;
+}
+
+static void ui_game_cache_path(char *path, int size) {
+  snprintf(path, size, "%s" PATH_SEPARATOR "games.cache", fs_appdir());
+}
+
+/* reads the next tab-separated field in place, or NULL if there isn't one */
+static char *ui_game_cache_field(char **line) {
+  char *field = *line;
+
+  if (!field) {
+    return NULL;
+  }
+
+  char *end = strpbrk(field, "\t\r\n");
+
+  if (end && *end == '\t') {
+    *end = 0;
+    *line = end + 1;
+  } else {
+    if (end) {
+      *end = 0;
+    }
+    *line = NULL;
+  }
+
+  return field;
+}
+
+static void ui_game_cache_load(struct ui *ui) {
+  char path[PATH_MAX];
+  ui_game_cache_path(path, sizeof(path));
+
+  FILE *file = fopen(path, "r");
+
+  if (!file) {
+    return;
+  }
+
+  char line[PATH_MAX + 1024];
+  int version = 0;
+
+  if (!fgets(line, sizeof(line), file) ||
+      sscanf(line, "version %d", &version) != 1 ||
+      version != UI_GAME_CACHE_VERSION) {
+    LOG_WARNING("ui_game_cache_load ignoring stale cache %s", path);
+    fclose(file);
+    return;
+  }
+
+  while (fgets(line, sizeof(line), file)) {
+    char *ptr = line;
+    char *size = ui_game_cache_field(&ptr);
+    char *mtime = ui_game_cache_field(&ptr);
+    char *valid = ui_game_cache_field(&ptr);
+    char *filename = ui_game_cache_field(&ptr);
+    char *prodname = ui_game_cache_field(&ptr);
+    char *prodmeta = ui_game_cache_field(&ptr);
+
+    if (!prodmeta) {
+      continue;
+    }
+
+    struct game_cache_entry *entry = ui_game_cache_add(ui, filename);
+    entry->size = strtoll(size, NULL, 10);
+    entry->mtime = strtoll(mtime, NULL, 10);
+    entry->valid = atoi(valid);
+    strncpy(entry->game.prodname, prodname, sizeof(entry->game.prodname) - 1);
+    strncpy(entry->game.prodmeta, prodmeta, sizeof(entry->game.prodmeta) - 1);
+  }
+
+  fclose(file);
+}
+
+/* tabs and newlines delimit the fields, make sure none end up in them */
+static void ui_game_cache_write_field(FILE *file, const char *field) {
+  for (const char *ptr = field; *ptr; ptr++) {
+    fputc(strchr("\t\r\n", *ptr) ? ' ' : *ptr, file);
+  }
+}
+
+/* writes out the entries seen during the scan, dropping the rest */
+static void ui_game_cache_save(struct ui *ui) {
+  char path[PATH_MAX];
+  ui_game_cache_path(path, sizeof(path));
+
+  FILE *file = fopen(path, "w");
+
+  if (!file) {
+    LOG_WARNING("ui_game_cache_save failed to open %s", path);
+    return;
+  }
+
+  fprintf(file, "version %d\n", UI_GAME_CACHE_VERSION);
+
+  for (int i = 0; i < (int)HASH_SIZE(ui->game_cache); i++) {
+    struct list *bkt = &ui->game_cache[i];
+
+    hash_bkt_for_each_entry(entry, bkt, struct game_cache_entry, it) {
+      if (!entry->seen) {
+        continue;
+      }
+
+      fprintf(file, "%" PRId64 "\t%" PRId64 "\t%d\t", entry->size,
+              entry->mtime, entry->valid);
+      ui_game_cache_write_field(file, entry->game.filename);
+      fputc('\t', file);
+      ui_game_cache_write_field(file, entry->game.prodname);
+      fputc('\t', file);
+      ui_game_cache_write_field(file, entry->game.prodmeta);
+      fputc('\n', file);
+    }
+  }
+
+  fclose(file);
+}
+
+static void ui_game_cache_clear(struct ui *ui) {
+  for (int i = 0; i < (int)HASH_SIZE(ui->game_cache); i++) {
+    struct list *bkt = &ui->game_cache[i];
+
+    list_for_each_entry_safe(entry, bkt, struct game_cache_entry, it) {
+      hash_del(bkt, &entry->it);
+      free(entry);
+    }
+  }
+}
+
 static void ui_scan_games_f(struct ui *ui, const char *filename) {
+  int64_t size = 0;
+  int64_t mtime = 0;
+
+  if (!fs_stat(filename, &size, &mtime)) {
+    return;
+  }
+
   mutex_lock(ui->scan_mutex);
 
   /* update status */
   snprintf(ui->scan_status, sizeof(ui->scan_status), "scanning %s", filename);
 
-  if (ui_has_game_ext(filename, game_exts, ARRAY_SIZE(game_exts))) {
-
-    struct disc *disc = disc_create(filename, 0);
+  struct game_cache_entry *entry = ui_game_cache_lookup(ui, filename);
 
-    if (disc) {
-      struct game game = {0};
-      strncpy(game.filename, filename, sizeof(game.filename));
-      strncpy(game.prodname, disc->prodnme, sizeof(game.prodname));
-      snprintf(game.prodmeta, sizeof(game.prodmeta), "%s / %s", disc->prodver,
-               disc->prodnum);
-      ui_insert_game(ui, &game);
+  if (entry && entry->size == size && entry->mtime == mtime) {
+    entry->seen = 1;
 
-      disc_destroy(disc);
+    if (entry->valid) {
+      ui_insert_game(ui, &entry->game);
     }
+
+    mutex_unlock(ui->scan_mutex);
+    return;
+  }
+
+  mutex_unlock(ui->scan_mutex);
+
+  /* opening the disc is the slow part, don't hold the lock while doing so */
+  struct disc *disc = disc_create(filename, 0);
+  struct game game = {0};
+
+  if (disc) {
+    strncpy(game.filename, filename, sizeof(game.filename) - 1);
+    strncpy(game.prodname, disc->prodnme, sizeof(game.prodname) - 1);
+    snprintf(game.prodmeta, sizeof(game.prodmeta), "%s / %s", disc->prodver,
+             disc->prodnum);
+
+    disc_destroy(disc);
+  }
+
+  mutex_lock(ui->scan_mutex);
+
+  entry = ui_game_cache_add(ui, filename);
+  entry->size = size;
+  entry->mtime = mtime;
+  entry->valid = disc != NULL;
+  entry->seen = 1;
+
+  if (disc) {
+    entry->game = game;
+    ui_insert_game(ui, &game);
   }
 
   mutex_unlock(ui->scan_mutex);
 }
 
 static void ui_scan_games_d(struct ui *ui, const char *path) {
-  struct games_page *page = &ui->games_page;
   DIR *dir = opendir(path);
 
   if (!dir) {
@@ -560,41 +784,86 @@ static void ui_scan_games_d(struct ui *ui, const char *path) {
 
     if (ent->d_type & DT_DIR) {
       ui_scan_games_d(ui, abspath);
-    } else if (ent->d_type & DT_REG) {
-      ui_scan_games_f(ui, abspath);
+    } else if ((ent->d_type & DT_REG) &&
+               ui_has_game_ext(abspath, game_exts, ARRAY_SIZE(game_exts))) {
+      /* queue up the file for the workers */
+      if (ui->num_scan_files == ui->max_scan_files) {
+        ui->max_scan_files = MAX(ui->max_scan_files * 2, 64);
+        ui->scan_files = realloc(ui->scan_files,
+                                 ui->max_scan_files * sizeof(*ui->scan_files));
+      }
+
+      ui->scan_files[ui->num_scan_files++] = strdup(abspath);
     }
   }
 
   closedir(dir);
 }
 
+static void ui_scan_worker(void *data) {
+  struct ui *ui = data;
+
+  while (1) {
+    mutex_lock(ui->scan_mutex);
+    int i = ui->next_scan_file++;
+    mutex_unlock(ui->scan_mutex);
+
+    if (i >= ui->num_scan_files) {
+      break;
+    }
+
+    ui_scan_games_f(ui, ui->scan_files[i]);
+  }
+}
+
 static void ui_scan_games(struct ui *ui) {
   char dirs[UI_MAX_GAMEDIRS][PATH_MAX];
   int num_dirs = ui_explode_gamedir(ui, dirs[0], UI_MAX_GAMEDIRS, PATH_MAX);
 
+  /* gather up the files to scan */
   for (int i = 0; i < num_dirs; i++) {
     ui_scan_games_d(ui, dirs[i]);
   }
+
+  /* and spread them out over the workers, each inserting games into the
+     library as they're found. waiting on them from inside of the scan task
+     helps run them */
+  struct task_group *workers = task_group_create(task_pool_shared());
+  int num_workers = CLAMP(OPTION_library_threads, 1, UI_MAX_SCAN_THREADS);
+  num_workers = MIN(num_workers, ui->num_scan_files);
+
+  for (int i = 0; i < num_workers; i++) {
+    task_group_run(workers, &ui_scan_worker, ui, TASK_PRIO_LOW);
+  }
+
+  task_group_destroy(workers);
+
+  ui_game_cache_save(ui);
+
+  for (int i = 0; i < ui->num_scan_files; i++) {
+    free(ui->scan_files[i]);
+  }
+  free(ui->scan_files);
+  ui->scan_files = NULL;
+  ui->num_scan_files = 0;
+  ui->max_scan_files = 0;
+  ui->next_scan_file = 0;
 }
 
-static void *ui_scan_thread(void *data) {
+static void ui_scan_task(void *data) {
   struct ui *ui = data;
 
-  ui->scanning = 1;
   ui_scan_games(ui);
   ui->scanning = 0;
-
-  return NULL;
 }
 
 static void ui_stop_game_scan(struct ui *ui) {
-  if (!ui->scan_thread) {
+  if (!ui->scan_group) {
     return;
   }
 
-  void *result;
-  thread_join(ui->scan_thread, &result);
-  ui->scan_thread = NULL;
+  task_group_destroy(ui->scan_group);
+  ui->scan_group = NULL;
 
   mutex_destroy(ui->scan_mutex);
   ui->scan_mutex = NULL;
@@ -609,8 +878,21 @@ static void ui_start_game_scan(struct ui *ui) {
   /* clean up the scan thread */
   ui_stop_game_scan(ui);
 
+  /* forget whatever was seen by the previous scan */
+  for (int i = 0; i < (int)HASH_SIZE(ui->game_cache); i++) {
+    struct list *bkt = &ui->game_cache[i];
+
+    hash_bkt_for_each_entry(entry, bkt, struct game_cache_entry, it) {
+      entry->seen = 0;
+    }
+  }
+
+  /* scanning is flagged before the task is queued, as it may not start
+     before the next check */
+  ui->scanning = 1;
   ui->scan_mutex = mutex_create();
-  ui->scan_thread = thread_create(&ui_scan_thread, NULL, ui);
+  ui->scan_group = task_group_create(task_pool_shared());
+  task_group_run(ui->scan_group, &ui_scan_task, ui, TASK_PRIO_LOW);
 }
 
 /*
@@ -1177,8 +1459,8 @@ static texture_handle_t ui_load_disc_texture(struct ui *ui, struct game *game) {
   const struct pvr_tex_header *header = pvr_tex_header(pvrt);
   const uint8_t *data = pvr_tex_data(pvrt);
   pvr_tex_decode(data, header->width, header->height, header->width,
-                 header->texture_fmt, header->pixel_fmt, NULL, 0, converted,
-                 sizeof(converted));
+                 header->texture_fmt, header->pixel_fmt, NULL, 0, PXL_RGBA,
+                 converted, sizeof(converted));
 
   texture_handle_t tex = r_create_texture(
       ui->r, PXL_RGBA, FILTER_BILINEAR, WRAP_CLAMP_TO_EDGE, WRAP_CLAMP_TO_EDGE,
@@ -1552,6 +1834,7 @@ void ui_vid_created(struct ui *ui, struct render_backend *r) {
 
 void ui_destroy(struct ui *ui) {
   ui_stop_game_scan(ui);
+  ui_game_cache_clear(ui);
 
   free(ui);
 }
@@ -1586,6 +1869,7 @@ struct ui *ui_create(struct host *host) {
   pages[UI_PAGE_KEYBOARD].name = NULL;
   pages[UI_PAGE_KEYBOARD].build = ui_keyboard_build;
 
+  ui_game_cache_load(ui);
   ui_start_game_scan(ui);
 
   return ui;
@@ -0,0 +1,227 @@
+#include "core/core.h"
+#include "core/hash_map.h"
+#include "core/rb_tree.h"
+#include "core/ringbuf.h"
+#include "core/sort.h"
+#include "core/task_pool.h"
+#include "remicro.h"
+
+#define NUM_ELEMENTS 4096
+
+struct bench_node {
+  struct rb_node it;
+  struct hash_map_node map_it;
+  uint32_t key;
+};
+
+static volatile uintptr_t bench_sink;
+
+static uint32_t bench_rand(uint32_t *state) {
+  /* xorshift32 */
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  *state = x;
+  return x;
+}
+
+static int bench_node_cmp(const struct rb_node *a, const struct rb_node *b) {
+  const struct bench_node *lhs = (const struct bench_node *)a;
+  const struct bench_node *rhs = (const struct bench_node *)b;
+  return (lhs->key > rhs->key) - (lhs->key < rhs->key);
+}
+
+static struct rb_callbacks bench_node_cb = {&bench_node_cmp, NULL, NULL};
+
+static void bench_init_nodes(struct bench_node *nodes, int num) {
+  uint32_t seed = 1;
+  for (int i = 0; i < num; i++) {
+    nodes[i].key = bench_rand(&seed);
+  }
+}
+
+/* insert and unlink NUM_ELEMENTS random keys */
+BENCH(rb_tree_insert) {
+  static struct bench_node nodes[NUM_ELEMENTS];
+  bench_init_nodes(nodes, NUM_ELEMENTS);
+  bench_reset_timer(b);
+
+  for (int n = 0; n < b->iters; n++) {
+    struct rb_tree tree = {0};
+
+    for (int i = 0; i < NUM_ELEMENTS; i++) {
+      rb_insert(&tree, &nodes[i].it, &bench_node_cb);
+    }
+    for (int i = 0; i < NUM_ELEMENTS; i++) {
+      rb_unlink(&tree, &nodes[i].it, &bench_node_cb);
+    }
+  }
+}
+
+/* find each of NUM_ELEMENTS keys */
+BENCH(rb_tree_find) {
+  static struct bench_node nodes[NUM_ELEMENTS];
+  bench_init_nodes(nodes, NUM_ELEMENTS);
+
+  struct rb_tree tree = {0};
+  for (int i = 0; i < NUM_ELEMENTS; i++) {
+    rb_insert(&tree, &nodes[i].it, &bench_node_cb);
+  }
+  bench_reset_timer(b);
+
+  for (int n = 0; n < b->iters; n++) {
+    for (int i = 0; i < NUM_ELEMENTS; i++) {
+      bench_sink = (uintptr_t)rb_find(&tree, &nodes[i].it, &bench_node_cb);
+    }
+  }
+}
+
+/* the same as rb_tree_insert, through a hash_map */
+BENCH(hash_map_insert) {
+  static struct bench_node nodes[NUM_ELEMENTS];
+  bench_init_nodes(nodes, NUM_ELEMENTS);
+  bench_reset_timer(b);
+
+  for (int n = 0; n < b->iters; n++) {
+    struct hash_map map = {0};
+
+    for (int i = 0; i < NUM_ELEMENTS; i++) {
+      hash_map_insert(&map, nodes[i].key, &nodes[i].map_it);
+    }
+    for (int i = 0; i < NUM_ELEMENTS; i++) {
+      hash_map_remove(&map, &nodes[i].map_it);
+    }
+
+    hash_map_destroy(&map);
+  }
+}
+
+/* the same as rb_tree_find, through a hash_map */
+BENCH(hash_map_find) {
+  static struct bench_node nodes[NUM_ELEMENTS];
+  bench_init_nodes(nodes, NUM_ELEMENTS);
+
+  struct hash_map map = {0};
+  for (int i = 0; i < NUM_ELEMENTS; i++) {
+    hash_map_insert(&map, nodes[i].key, &nodes[i].map_it);
+  }
+  bench_reset_timer(b);
+
+  for (int n = 0; n < b->iters; n++) {
+    for (int i = 0; i < NUM_ELEMENTS; i++) {
+      bench_sink = (uintptr_t)hash_map_find(&map, nodes[i].key);
+    }
+  }
+
+  hash_map_destroy(&map);
+}
+
+static int bench_key_cmp(const void *a, const void *b) {
+  return *(const uint32_t *)a <= *(const uint32_t *)b;
+}
+
+/* sort NUM_ELEMENTS random keys */
+BENCH(msort_noalloc) {
+  static uint32_t keys[NUM_ELEMENTS];
+  static uint32_t sorted[NUM_ELEMENTS];
+  static uint32_t tmp[NUM_ELEMENTS];
+
+  uint32_t seed = 1;
+  for (int i = 0; i < NUM_ELEMENTS; i++) {
+    keys[i] = bench_rand(&seed);
+  }
+  bench_reset_timer(b);
+
+  for (int n = 0; n < b->iters; n++) {
+    memcpy(sorted, keys, sizeof(keys));
+    msort_noalloc(sorted, tmp, NUM_ELEMENTS, sizeof(sorted[0]),
+                  &bench_key_cmp);
+  }
+
+  bench_sink = sorted[0];
+}
+
+/* sort NUM_ELEMENTS random keys along with their indices */
+BENCH(rsort_noalloc) {
+  static uint32_t keys[NUM_ELEMENTS];
+  static uint32_t sorted[NUM_ELEMENTS];
+  static int values[NUM_ELEMENTS];
+  static uint32_t tmp_keys[NUM_ELEMENTS];
+  static int tmp_values[NUM_ELEMENTS];
+
+  uint32_t seed = 1;
+  for (int i = 0; i < NUM_ELEMENTS; i++) {
+    keys[i] = bench_rand(&seed);
+  }
+  bench_reset_timer(b);
+
+  for (int n = 0; n < b->iters; n++) {
+    memcpy(sorted, keys, sizeof(keys));
+    for (int i = 0; i < NUM_ELEMENTS; i++) {
+      values[i] = i;
+    }
+    rsort_noalloc(sorted, values, tmp_keys, tmp_values, NUM_ELEMENTS);
+  }
+
+  bench_sink = sorted[0];
+}
+
+/* sort a list of NSORT_MAX_SIZE random keys, the size of a short run */
+BENCH(nsort) {
+  uint32_t keys[NSORT_MAX_SIZE];
+  int values[NSORT_MAX_SIZE];
+  uint32_t seed = 1;
+
+  for (int n = 0; n < b->iters; n++) {
+    for (int i = 0; i < NSORT_MAX_SIZE; i++) {
+      keys[i] = bench_rand(&seed);
+      values[i] = i;
+    }
+    nsort(keys, values, NSORT_MAX_SIZE);
+  }
+
+  bench_sink = keys[0];
+}
+
+/* sort enough random keys to be split across the shared task pool */
+BENCH(msort_parallel) {
+  static uint32_t keys[NUM_ELEMENTS * 64];
+  static uint32_t sorted[NUM_ELEMENTS * 64];
+
+  uint32_t seed = 1;
+  for (int i = 0; i < NUM_ELEMENTS * 64; i++) {
+    keys[i] = bench_rand(&seed);
+  }
+
+  /* start up the pool's workers outside of the timed loop */
+  task_pool_shared();
+  bench_reset_timer(b);
+
+  for (int n = 0; n < b->iters; n++) {
+    memcpy(sorted, keys, sizeof(keys));
+    msort_parallel(sorted, NUM_ELEMENTS * 64, sizeof(sorted[0]),
+                   &bench_key_cmp);
+  }
+
+  bench_sink = sorted[0];
+}
+
+/* write and read back a 4kb chunk, the size of an audio frame batch */
+BENCH(ringbuf_throughput) {
+  static uint8_t chunk[4096];
+  struct ringbuf *rb = ringbuf_create(1 << 16);
+  b->bytes = sizeof(chunk);
+  bench_reset_timer(b);
+
+  for (int n = 0; n < b->iters; n++) {
+    memcpy(ringbuf_write_ptr(rb), chunk, sizeof(chunk));
+    ringbuf_advance_write_ptr(rb, sizeof(chunk));
+
+    int available = ringbuf_available(rb);
+    memcpy(chunk, ringbuf_read_ptr(rb), available);
+    ringbuf_advance_read_ptr(rb, available);
+  }
+
+  ringbuf_destroy(rb);
+}
@@ -0,0 +1,335 @@
+#include "core/core.h"
+#include "core/option.h"
+#include "file/trace.h"
+#include "guest/aica/aica.h"
+#include "guest/dreamcast.h"
+#include "guest/memory.h"
+#include "guest/pvr/tex.h"
+#include "guest/pvr/tr.h"
+#include "guest/scheduler.h"
+#include "remicro.h"
+
+DEFINE_OPTION_STRING(trace, "", "Trace to convert the contexts of");
+
+#define NUM_ACCESSES 1024
+
+static volatile uintptr_t bench_sink;
+
+/*
+ * scheduler
+ */
+static void bench_timer(void *data) {
+  bench_sink++;
+}
+
+static void bench_init_dreamcast(struct dreamcast *dc) {
+  memset(dc, 0, sizeof(*dc));
+  dc->running = 1;
+}
+
+/* start and cancel a timer, as devices do when rescheduling */
+BENCH(sched_start_cancel) {
+  struct dreamcast dc;
+  bench_init_dreamcast(&dc);
+  struct scheduler *sched = sched_create(&dc);
+  bench_reset_timer(b);
+
+  for (int n = 0; n < b->iters; n++) {
+    struct timer *timer = sched_start_timer(sched, &bench_timer, NULL, 1000);
+    sched_cancel_timer(sched, timer);
+  }
+
+  sched_destroy(sched);
+}
+
+/* start 8 staggered timers and tick until each has fired */
+BENCH(sched_tick_fire) {
+  struct dreamcast dc;
+  bench_init_dreamcast(&dc);
+  struct scheduler *sched = sched_create(&dc);
+  bench_reset_timer(b);
+
+  for (int n = 0; n < b->iters; n++) {
+    for (int i = 0; i < 8; i++) {
+      sched_start_timer(sched, &bench_timer, NULL, 100 * (i + 1));
+    }
+    sched_tick(sched, 800);
+  }
+
+  sched_destroy(sched);
+}
+
+static void bench_live_timer(void *data) {
+  struct timer **handle = data;
+  *handle = NULL;
+}
+
+/* keep 64 timers live, restarting one of them and ticking each iteration */
+BENCH(sched_restart_live) {
+  struct dreamcast dc;
+  bench_init_dreamcast(&dc);
+  struct scheduler *sched = sched_create(&dc);
+  struct timer *timers[64];
+
+  for (int i = 0; i < 64; i++) {
+    timers[i] =
+        sched_start_timer(sched, &bench_live_timer, &timers[i], 1000000 + i);
+  }
+
+  bench_reset_timer(b);
+
+  for (int n = 0; n < b->iters; n++) {
+    int i = n % 64;
+
+    /* a timer which already fired has been recycled, only cancel live ones */
+    if (timers[i]) {
+      sched_cancel_timer(sched, timers[i]);
+    }
+
+    timers[i] = sched_start_timer(sched, &bench_live_timer, &timers[i],
+                                  1000 + (n * 7) % 997);
+    sched_tick(sched, 1);
+  }
+
+  sched_destroy(sched);
+}
+
+/*
+ * sh4 memory accesses, NUM_ACCESSES per iteration
+ */
+#define BENCH_RAM_ADDR 0x8c010000
+/* holly's id register, read only and without side effects */
+#define BENCH_MMIO_READ_ADDR 0xa05f8000
+/* the pvr's border color */
+#define BENCH_MMIO_WRITE_ADDR 0xa05f8040
+
+static struct dreamcast *bench_create_dreamcast() {
+  struct dreamcast *dc = dc_create();
+  CHECK(dc_load(dc, NULL));
+  return dc;
+}
+
+BENCH(sh4_read32_ram) {
+  struct dreamcast *dc = bench_create_dreamcast();
+  bench_reset_timer(b);
+
+  for (int n = 0; n < b->iters; n++) {
+    for (int i = 0; i < NUM_ACCESSES; i++) {
+      bench_sink = sh4_read32(dc->mem, BENCH_RAM_ADDR + (i << 2));
+    }
+  }
+
+  dc_destroy(dc);
+}
+
+BENCH(sh4_write32_ram) {
+  struct dreamcast *dc = bench_create_dreamcast();
+  bench_reset_timer(b);
+
+  for (int n = 0; n < b->iters; n++) {
+    for (int i = 0; i < NUM_ACCESSES; i++) {
+      sh4_write32(dc->mem, BENCH_RAM_ADDR + (i << 2), i);
+    }
+  }
+
+  dc_destroy(dc);
+}
+
+BENCH(sh4_read32_mmio) {
+  struct dreamcast *dc = bench_create_dreamcast();
+  bench_reset_timer(b);
+
+  for (int n = 0; n < b->iters; n++) {
+    for (int i = 0; i < NUM_ACCESSES; i++) {
+      bench_sink = sh4_read32(dc->mem, BENCH_MMIO_READ_ADDR);
+    }
+  }
+
+  dc_destroy(dc);
+}
+
+BENCH(sh4_write32_mmio) {
+  struct dreamcast *dc = bench_create_dreamcast();
+  bench_reset_timer(b);
+
+  for (int n = 0; n < b->iters; n++) {
+    for (int i = 0; i < NUM_ACCESSES; i++) {
+      sh4_write32(dc->mem, BENCH_MMIO_WRITE_ADDR, i & 0xffffff);
+    }
+  }
+
+  dc_destroy(dc);
+}
+
+/*
+ * texture decoding, a 256x256 texture per iteration
+ */
+#define BENCH_TEX_SIZE 256
+
+static void bench_tex_decode(struct bench_state *b, int texture_fmt,
+                             int pixel_fmt, enum pxl_format dst_fmt) {
+  /* large enough for the codebook and indices of vq textures, as well as
+     the mip chain of mipmapped textures */
+  static uint8_t src[BENCH_TEX_SIZE * BENCH_TEX_SIZE * 4];
+  static uint8_t dst[BENCH_TEX_SIZE * BENCH_TEX_SIZE * 4];
+  static uint8_t palette[1024 * 4];
+
+  for (int i = 0; i < (int)sizeof(src); i++) {
+    src[i] = (uint8_t)(i * 2654435761u >> 24);
+  }
+
+  pvr_init_twiddle_table();
+  b->bytes = BENCH_TEX_SIZE * BENCH_TEX_SIZE * (dst_fmt == PXL_RGBA ? 4 : 2);
+  bench_reset_timer(b);
+
+  for (int n = 0; n < b->iters; n++) {
+    pvr_tex_decode(src, BENCH_TEX_SIZE, BENCH_TEX_SIZE, BENCH_TEX_SIZE,
+                   texture_fmt, pixel_fmt, palette, PVR_PAL_ARGB8888, dst_fmt,
+                   dst, sizeof(dst));
+  }
+}
+
+BENCH(tex_decode_twiddled_argb1555) {
+  bench_tex_decode(b, PVR_TEX_TWIDDLED, PVR_PXL_ARGB1555, PXL_RGBA);
+}
+
+BENCH(tex_decode_twiddled_rgb565) {
+  bench_tex_decode(b, PVR_TEX_TWIDDLED, PVR_PXL_RGB565, PXL_RGBA);
+}
+
+BENCH(tex_decode_twiddled_argb4444) {
+  bench_tex_decode(b, PVR_TEX_TWIDDLED, PVR_PXL_ARGB4444, PXL_RGBA);
+}
+
+BENCH(tex_decode_twiddled_yuv422) {
+  bench_tex_decode(b, PVR_TEX_TWIDDLED, PVR_PXL_YUV422, PXL_RGBA);
+}
+
+BENCH(tex_decode_bitmap_argb1555) {
+  bench_tex_decode(b, PVR_TEX_BITMAP, PVR_PXL_ARGB1555, PXL_RGBA);
+}
+
+BENCH(tex_decode_bitmap_rgb565) {
+  bench_tex_decode(b, PVR_TEX_BITMAP, PVR_PXL_RGB565, PXL_RGBA);
+}
+
+BENCH(tex_decode_bitmap_argb4444) {
+  bench_tex_decode(b, PVR_TEX_BITMAP, PVR_PXL_ARGB4444, PXL_RGBA);
+}
+
+BENCH(tex_decode_bitmap_yuv422) {
+  bench_tex_decode(b, PVR_TEX_BITMAP, PVR_PXL_YUV422, PXL_RGBA);
+}
+
+BENCH(tex_decode_vq_argb1555) {
+  bench_tex_decode(b, PVR_TEX_VQ, PVR_PXL_ARGB1555, PXL_RGBA);
+}
+
+BENCH(tex_decode_vq_rgb565) {
+  bench_tex_decode(b, PVR_TEX_VQ, PVR_PXL_RGB565, PXL_RGBA);
+}
+
+BENCH(tex_decode_vq_argb4444) {
+  bench_tex_decode(b, PVR_TEX_VQ, PVR_PXL_ARGB4444, PXL_RGBA);
+}
+
+BENCH(tex_decode_twiddled_argb1555_native) {
+  bench_tex_decode(b, PVR_TEX_TWIDDLED, PVR_PXL_ARGB1555, PXL_RGBA5551);
+}
+
+BENCH(tex_decode_twiddled_rgb565_native) {
+  bench_tex_decode(b, PVR_TEX_TWIDDLED, PVR_PXL_RGB565, PXL_RGB565);
+}
+
+BENCH(tex_decode_twiddled_argb4444_native) {
+  bench_tex_decode(b, PVR_TEX_TWIDDLED, PVR_PXL_ARGB4444, PXL_RGBA4444);
+}
+
+BENCH(tex_decode_bitmap_argb1555_native) {
+  bench_tex_decode(b, PVR_TEX_BITMAP, PVR_PXL_ARGB1555, PXL_RGBA5551);
+}
+
+BENCH(tex_decode_vq_argb1555_native) {
+  bench_tex_decode(b, PVR_TEX_VQ, PVR_PXL_ARGB1555, PXL_RGBA5551);
+}
+
+BENCH(tex_decode_palette_4bpp) {
+  bench_tex_decode(b, PVR_TEX_PALETTE_4BPP, PVR_PXL_4BPP, PXL_RGBA);
+}
+
+BENCH(tex_decode_palette_8bpp) {
+  bench_tex_decode(b, PVR_TEX_PALETTE_8BPP, PVR_PXL_8BPP, PXL_RGBA);
+}
+
+/*
+ * context conversion, every context of the trace per iteration
+ */
+static struct tr_texture *bench_find_texture(void *userdata, union tsp tsp,
+                                             union tcw tcw) {
+  /* return a valid handle so no texture is created, the render backend is
+     null when only parsing */
+  static struct tr_texture tex;
+  tex.handle = 1;
+  return &tex;
+}
+
+BENCH(tr_convert_context) {
+  if (!*OPTION_trace) {
+    b->skipped = 1;
+    return;
+  }
+
+  struct trace *trace = trace_parse(OPTION_trace);
+  if (!trace) {
+    LOG_WARNING("failed to parse %s", OPTION_trace);
+    b->skipped = 1;
+    return;
+  }
+
+  int num_ctxs = trace_num_frames(trace);
+  struct trace_cmd cmd;
+
+  struct tr_converter *cv = tr_create_converter();
+  struct ta_context *ctxs = calloc(num_ctxs, sizeof(struct ta_context));
+  struct tr_context *rc = calloc(1, sizeof(struct tr_context));
+
+  int i = 0;
+  for (int n = 0; trace_get_cmd(trace, n, &cmd); n++) {
+    if (cmd.type == TRACE_CMD_CONTEXT) {
+      trace_copy_context(&cmd, &ctxs[i++]);
+    }
+  }
+  bench_reset_timer(b);
+
+  for (int n = 0; n < b->iters; n++) {
+    for (i = 0; i < num_ctxs; i++) {
+      tr_convert_context(cv, NULL, NULL, &bench_find_texture, &ctxs[i], rc);
+    }
+  }
+
+  tr_destroy_context(rc);
+  free(rc);
+  free(ctxs);
+  tr_destroy_converter(cv);
+  trace_destroy(trace);
+}
+
+/*
+ * adpcm decoding, a block of 4096 samples per iteration
+ */
+BENCH(adpcm_decode) {
+  static uint8_t data[2048];
+  static int16_t samples[4096];
+
+  for (int i = 0; i < (int)sizeof(data); i++) {
+    data[i] = (uint8_t)(i * 2654435761u >> 24);
+  }
+  b->bytes = sizeof(samples);
+  bench_reset_timer(b);
+
+  for (int n = 0; n < b->iters; n++) {
+    aica_decode_adpcm_stream(data, ARRAY_SIZE(samples), samples);
+  }
+
+  bench_sink = samples[0];
+}
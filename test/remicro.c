@@ -0,0 +1,123 @@
+/*
+ * microbenchmarks
+ *
+ * each benchmark runs its loop for b->iters iterations. the iteration count
+ * is doubled until a run takes at least --min_time ms, after which --runs
+ * more runs are timed. the fastest and median time per iteration of each
+ * benchmark is written as a line of json to --out, or stdout by default:
+ *
+ *   {"name": "msort_noalloc", "iters": 512, "ns_per_op": ..., ...}
+ */
+
+#include <stdlib.h>
+#include "remicro.h"
+#include "core/core.h"
+#include "core/filesystem.h"
+#include "core/option.h"
+#include "core/sort.h"
+#include "core/time.h"
+
+DEFINE_OPTION_STRING(filter, "", "Only run benchmarks containing this");
+DEFINE_OPTION_INT(runs, 5, "Timed runs of each benchmark");
+DEFINE_OPTION_INT(min_time, 100, "Minimum duration of each run in ms");
+DEFINE_OPTION_STRING(out, "", "File to write results to instead of stdout");
+
+#define MAX_RUNS 64
+
+static struct list benches;
+static FILE *out;
+
+void bench_register(struct bench *bench) {
+  list_add(&benches, &bench->it);
+}
+
+void bench_reset_timer(struct bench_state *b) {
+  b->start = time_nanoseconds();
+}
+
+static int64_t bench_run_once(struct bench *bench, struct bench_state *b,
+                              int iters) {
+  b->iters = iters;
+  b->start = time_nanoseconds();
+  bench->run(b);
+  return time_nanoseconds() - b->start;
+}
+
+static int bench_cmp(const void *a, const void *b) {
+  return *(const int64_t *)a <= *(const int64_t *)b;
+}
+
+static void bench_run(struct bench *bench) {
+  struct bench_state b = {0};
+  int64_t min_time = (int64_t)OPTION_min_time * NS_PER_MS;
+  int runs = CLAMP(OPTION_runs, 1, MAX_RUNS);
+
+  /* find an iteration count long enough to time reliably */
+  int iters = 1;
+  while (bench_run_once(bench, &b, iters) < min_time && !b.skipped &&
+         iters < (1 << 30)) {
+    iters *= 2;
+  }
+
+  if (b.skipped) {
+    fprintf(out, "{\"name\": \"%s\", \"skipped\": true}\n", bench->name);
+    return;
+  }
+
+  int64_t times[MAX_RUNS];
+  for (int i = 0; i < runs; i++) {
+    times[i] = bench_run_once(bench, &b, iters);
+  }
+  msort(times, runs, sizeof(times[0]), &bench_cmp);
+
+  double best = times[0] / (double)iters;
+  double median = times[runs / 2] / (double)iters;
+
+  fprintf(out,
+          "{\"name\": \"%s\", \"iters\": %d, \"runs\": %d, "
+          "\"ns_per_op\": %.2f, \"median_ns_per_op\": %.2f",
+          bench->name, iters, runs, best, median);
+  if (b.bytes) {
+    fprintf(out, ", \"mb_per_sec\": %.2f", b.bytes / best * 1000.0);
+  }
+  fprintf(out, "}\n");
+  fflush(out);
+}
+
+int main(int argc, char **argv) {
+  if (!options_parse(&argc, &argv)) {
+    LOG_INFO("remicro [--filter=name] [--runs=n] [--min_time=ms] [--out=file] "
+             "[--trace=file]");
+    return EXIT_FAILURE;
+  }
+
+  /* set application directory */
+  char appdir[PATH_MAX];
+  char userdir[PATH_MAX];
+  int r = fs_userdir(userdir, sizeof(userdir));
+  CHECK(r);
+  snprintf(appdir, sizeof(appdir), "%s" PATH_SEPARATOR ".redream", userdir);
+  fs_set_appdir(appdir);
+
+  out = stdout;
+  if (*OPTION_out) {
+    out = fopen(OPTION_out, "w");
+    if (!out) {
+      LOG_WARNING("failed to open %s", OPTION_out);
+      return EXIT_FAILURE;
+    }
+  }
+
+  list_for_each_entry(bench, &benches, struct bench, it) {
+    if (*OPTION_filter && !strstr(bench->name, OPTION_filter)) {
+      continue;
+    }
+    bench_run(bench);
+  }
+
+  if (out != stdout) {
+    fclose(out);
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,39 @@
+#ifndef REMICRO_H
+#define REMICRO_H
+
+#include <stdint.h>
+#include "core/constructor.h"
+#include "core/list.h"
+
+struct bench_state {
+  /* iterations the benchmark must run */
+  int iters;
+  /* bytes processed by each iteration, reported as throughput if set */
+  int64_t bytes;
+  int64_t start;
+  /* set by the benchmark when it can't run, e.g. a missing input */
+  int skipped;
+};
+
+typedef void (*bench_callback_t)(struct bench_state *);
+
+struct bench {
+  const char *name;
+  bench_callback_t run;
+  struct list_node it;
+};
+
+#define BENCH(name)                                                  \
+  static void bench_##name(struct bench_state *b);                   \
+  CONSTRUCTOR(BENCH_REGISTER_##name) {                               \
+    static struct bench bench = {#name, &bench_##name, {0}};         \
+    bench_register(&bench);                                          \
+  }                                                                  \
+  void bench_##name(struct bench_state *b)
+
+void bench_register(struct bench *bench);
+
+/* exclude setup done by the benchmark before its loop from the timing */
+void bench_reset_timer(struct bench_state *b);
+
+#endif
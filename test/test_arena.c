@@ -0,0 +1,54 @@
+#include "core/arena.h"
+#include "retest.h"
+
+TEST(arena_alloc_zeroed) {
+  struct arena *arena = arena_create(1024);
+
+  uint8_t *a = arena_alloc(arena, 64);
+  memset(a, 0xff, 64);
+  arena_free(arena, a, 64);
+
+  uint8_t *b = arena_alloc(arena, 64);
+  CHECK_EQ(a, b);
+
+  for (int i = 0; i < 64; i++) {
+    CHECK_EQ(b[i], 0);
+  }
+
+  arena_destroy(arena);
+}
+
+TEST(arena_free_size_class) {
+  struct arena *arena = arena_create(1024);
+
+  /* allocations are only reused within their size class */
+  void *a = arena_alloc(arena, 24);
+  arena_free(arena, a, 24);
+
+  void *b = arena_alloc(arena, 100);
+  CHECK_NE(a, b);
+
+  void *c = arena_alloc(arena, 32);
+  CHECK_EQ(a, c);
+
+  arena_destroy(arena);
+}
+
+TEST(arena_reset) {
+  struct arena *arena = arena_create(1024);
+
+  /* allocate across multiple chunks */
+  void *first = arena_alloc(arena, 512);
+
+  for (int i = 0; i < 8; i++) {
+    arena_alloc(arena, 512);
+  }
+
+  /* after a reset, allocations start back at the first chunk */
+  arena_reset(arena);
+
+  void *after = arena_alloc(arena, 512);
+  CHECK_EQ(first, after);
+
+  arena_destroy(arena);
+}
@@ -0,0 +1,142 @@
+#include "jit/ir/ir.h"
+#include "jit/passes/common_subexpression_elimination_pass.h"
+#include "retest.h"
+
+static uint8_t ir_buffer[1024 * 1024];
+static char scratch_buffer[1024 * 1024];
+
+TEST(common_subexpression_elimination) {
+  static const char input_str[] =
+      "%0:\n"
+      "i32 %1 = load_context i32 0x3c\n"
+      "i32 %2 = add i32 %1, i32 0x4\n"
+      "i32 %3 = add i32 %1, i32 0x4\n"
+      "i32 %4 = add i32 0x4, i32 %1\n"
+      "i32 %5 = sub i32 %1, i32 0x4\n"
+      "i32 %6 = sub i32 0x4, i32 %1\n"
+      "i32 %7 = sub i32 %1, i32 0x8\n"
+      "i64 %8 = zext i32 %3\n"
+      "i64 %9 = zext i32 %2\n"
+      "store_context i32 0x40, i32 %2\n"
+      "store_context i32 0x44, i32 %3\n"
+      "store_context i32 0x48, i32 %4\n"
+      "store_context i32 0x4c, i32 %5\n"
+      "store_context i32 0x50, i32 %6\n"
+      "store_context i32 0x54, i32 %7\n"
+      "store_context i32 0x58, i64 %8\n"
+      "store_context i32 0x60, i64 %9\n";
+
+  static const char output_str[] =
+      "#==--------------------------------------------------==#\n"
+      "# ir\n"
+      "#==--------------------------------------------------==#\n"
+      "# predecessors \n"
+      "# successors \n"
+      "%0:\n"
+      "i32 %1 = load_context i32 0x3c\n"
+      "i32 %2 = add i32 %1, i32 0x4\n"
+      "i32 %3 = sub i32 %1, i32 0x4\n"
+      "i32 %4 = sub i32 0x4, i32 %1\n"
+      "i32 %5 = sub i32 %1, i32 0x8\n"
+      "i64 %6 = zext i32 %2\n"
+      "store_context i32 0x40, i32 %2\n"
+      "store_context i32 0x44, i32 %2\n"
+      "store_context i32 0x48, i32 %2\n"
+      "store_context i32 0x4c, i32 %3\n"
+      "store_context i32 0x50, i32 %4\n"
+      "store_context i32 0x54, i32 %5\n"
+      "store_context i32 0x58, i64 %6\n"
+      "store_context i32 0x60, i64 %6\n";
+
+  struct ir ir = {0};
+  ir.buffer = ir_buffer;
+  ir.capacity = sizeof(ir_buffer);
+
+  FILE *input = tmpfile();
+  fwrite(input_str, 1, sizeof(input_str) - 1, input);
+  rewind(input);
+  int res = ir_read(input, &ir);
+  fclose(input);
+  CHECK(res);
+
+  struct cse *cse = cse_create();
+  cse_run(cse, &ir);
+  cse_destroy(cse);
+
+  FILE *output = tmpfile();
+  ir_write(&ir, output);
+  rewind(output);
+  size_t n = fread(&scratch_buffer, 1, sizeof(scratch_buffer), output);
+  fclose(output);
+  CHECK_NE(n, 0u);
+  scratch_buffer[n] = 0;
+
+  CHECK_STREQ(scratch_buffer, output_str);
+}
+
+TEST(common_subexpression_elimination_extended) {
+  /* expressions are reused in a block only entered from its predecessor,
+     but not in a block which can be entered from elsewhere */
+  static const char input_str[] =
+      "%0:\n"
+      "i32 %1 = load_context i32 0x3c\n"
+      "i32 %2 = add i32 %1, i32 0x4\n"
+      "store_context i32 0x40, i32 %2\n"
+      "branch blk %3\n"
+      "%3:\n"
+      "i32 %4 = add i32 %1, i32 0x4\n"
+      "store_context i32 0x44, i32 %4\n"
+      "branch blk %5\n"
+      "%5:\n"
+      "i32 %6 = add i32 %1, i32 0x4\n"
+      "store_context i32 0x48, i32 %6\n"
+      "branch blk %5\n";
+
+  static const char output_str[] =
+      "#==--------------------------------------------------==#\n"
+      "# ir\n"
+      "#==--------------------------------------------------==#\n"
+      "# predecessors \n"
+      "# successors \n"
+      "%0:\n"
+      "i32 %1 = load_context i32 0x3c\n"
+      "i32 %2 = add i32 %1, i32 0x4\n"
+      "store_context i32 0x40, i32 %2\n"
+      "branch blk %5\n"
+      "# predecessors \n"
+      "# successors \n"
+      "%5:\n"
+      "store_context i32 0x44, i32 %2\n"
+      "branch blk %8\n"
+      "# predecessors \n"
+      "# successors \n"
+      "%8:\n"
+      "i32 %9 = add i32 %1, i32 0x4\n"
+      "store_context i32 0x48, i32 %9\n"
+      "branch blk %8\n";
+
+  struct ir ir = {0};
+  ir.buffer = ir_buffer;
+  ir.capacity = sizeof(ir_buffer);
+
+  FILE *input = tmpfile();
+  fwrite(input_str, 1, sizeof(input_str) - 1, input);
+  rewind(input);
+  int res = ir_read(input, &ir);
+  fclose(input);
+  CHECK(res);
+
+  struct cse *cse = cse_create();
+  cse_run(cse, &ir);
+  cse_destroy(cse);
+
+  FILE *output = tmpfile();
+  ir_write(&ir, output);
+  rewind(output);
+  size_t n = fread(&scratch_buffer, 1, sizeof(scratch_buffer), output);
+  fclose(output);
+  CHECK_NE(n, 0u);
+  scratch_buffer[n] = 0;
+
+  CHECK_STREQ(scratch_buffer, output_str);
+}
@@ -0,0 +1,73 @@
+#include "core/core.h"
+#include "core/exception_handler.h"
+#include "retest.h"
+
+struct owner {
+  int calls;
+  int claim;
+};
+
+static int owner_handle(void *data, struct exception_state *ex) {
+  struct owner *owner = data;
+  owner->calls++;
+  return owner->claim;
+}
+
+static int handle(uintptr_t pc, uintptr_t fault_addr) {
+  struct exception_state ex = {0};
+  ex.type = EX_ACCESS_VIOLATION;
+  ex.pc = pc;
+  ex.fault_addr = fault_addr;
+  return exception_handler_handle(&ex);
+}
+
+TEST(exception_handler_ranges) {
+  struct owner code_a = {0, 1};
+  struct owner code_b = {0, 1};
+  struct owner watch = {0, 1};
+  struct exception_range ranges[4];
+
+  struct exception_handler *a =
+      exception_handler_add("test a", &code_a, &owner_handle);
+  struct exception_handler *b =
+      exception_handler_add("test b", &code_b, &owner_handle);
+  struct exception_handler *w =
+      exception_handler_add("test watch", &watch, &owner_handle);
+  exception_handler_add_range(a, &ranges[0], EX_RANGE_PC, 0x1000, 0x2000);
+  exception_handler_add_range(b, &ranges[1], EX_RANGE_PC, 0x2000, 0x3000);
+  exception_handler_add_range(w, &ranges[2], EX_RANGE_FAULT_ADDR, 0x10000,
+                              0x11000);
+  exception_handler_add_range(w, &ranges[3], EX_RANGE_FAULT_ADDR, 0x20000,
+                              0x21000);
+
+  /* each exception only reaches the handler owning it */
+  CHECK(handle(0x1fff, 0));
+  CHECK(handle(0x2000, 0));
+  CHECK_EQ(code_a.calls, 1);
+  CHECK_EQ(code_b.calls, 1);
+  CHECK(handle(0x8000, 0x20010));
+  CHECK_EQ(watch.calls, 1);
+
+  /* nobody owns these */
+  CHECK(!handle(0x3000, 0x11000));
+  CHECK(!handle(0x0fff, 0x0));
+  CHECK_EQ(code_a.calls + code_b.calls + watch.calls, 3);
+
+  /* the owner of the code gets the first chance to claim it */
+  code_a.claim = 0;
+  CHECK(handle(0x1800, 0x10800));
+  CHECK_EQ(code_a.calls, 2);
+  CHECK_EQ(watch.calls, 2);
+
+  exception_handler_remove_range(&ranges[3]);
+  CHECK(!handle(0x8000, 0x20010));
+  CHECK_EQ(watch.calls, 2);
+
+  /* removing a handler removes its remaining ranges */
+  exception_handler_remove(a);
+  CHECK(!handle(0x1800, 0));
+  CHECK_EQ(code_a.calls, 2);
+
+  exception_handler_remove(b);
+  exception_handler_remove(w);
+}
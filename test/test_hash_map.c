@@ -0,0 +1,119 @@
+#include "core/hash_map.h"
+#include "retest.h"
+
+#define NUM_ENTRIES 4096
+
+struct map_entry {
+  struct hash_map_node it;
+  int value;
+};
+
+static uint64_t map_key(int i) {
+  /* spread keys over the high and low bits */
+  return ((uint64_t)i << 40) ^ (uint64_t)(i * 7919);
+}
+
+TEST(hash_map_insert_find) {
+  static struct map_entry entries[NUM_ENTRIES];
+  struct hash_map map = {0};
+
+  CHECK_EQ(hash_map_find(&map, 0), NULL);
+
+  for (int i = 0; i < NUM_ENTRIES; i++) {
+    entries[i].value = i;
+    CHECK_EQ(hash_map_insert(&map, map_key(i), &entries[i].it),
+             &entries[i].it);
+  }
+
+  CHECK_EQ(hash_map_size(&map), NUM_ENTRIES);
+
+  for (int i = 0; i < NUM_ENTRIES; i++) {
+    struct map_entry *entry =
+        hash_map_find_entry(&map, map_key(i), struct map_entry, it);
+    CHECK_EQ(entry, &entries[i]);
+  }
+
+  CHECK_EQ(hash_map_find(&map, map_key(NUM_ENTRIES)), NULL);
+
+  /* inserting an existing key returns the node already in the map */
+  struct map_entry dup;
+  CHECK_EQ(hash_map_insert(&map, map_key(5), &dup.it), &entries[5].it);
+  CHECK_EQ(hash_map_size(&map), NUM_ENTRIES);
+
+  hash_map_destroy(&map);
+}
+
+TEST(hash_map_remove) {
+  static struct map_entry entries[NUM_ENTRIES];
+  struct hash_map map = {0};
+
+  /* repeatedly remove and reinsert entries, exercising the reuse of deleted
+     slots and the rehashing of the map to reclaim them */
+  for (int round = 0; round < 8; round++) {
+    for (int i = 0; i < NUM_ENTRIES; i++) {
+      hash_map_insert(&map, map_key(i + round * NUM_ENTRIES), &entries[i].it);
+    }
+
+    for (int i = 0; i < NUM_ENTRIES; i += 2) {
+      hash_map_remove(&map, &entries[i].it);
+    }
+
+    CHECK_EQ(hash_map_size(&map), NUM_ENTRIES / 2);
+
+    for (int i = 0; i < NUM_ENTRIES; i++) {
+      struct hash_map_node *n =
+          hash_map_find(&map, map_key(i + round * NUM_ENTRIES));
+      CHECK_EQ(n, (i & 1) ? &entries[i].it : NULL);
+    }
+
+    for (int i = 1; i < NUM_ENTRIES; i += 2) {
+      hash_map_remove(&map, &entries[i].it);
+    }
+
+    CHECK_EQ(hash_map_size(&map), 0);
+  }
+
+  hash_map_destroy(&map);
+}
+
+TEST(hash_map_iterate) {
+  static struct map_entry entries[NUM_ENTRIES];
+  struct hash_map map = {0};
+
+  for (int i = 0; i < NUM_ENTRIES; i++) {
+    entries[i].value = i;
+    hash_map_insert(&map, map_key(i), &entries[i].it);
+  }
+
+  /* each entry is visited once, and may be removed as it's visited */
+  int64_t sum = 0;
+  int count = 0;
+
+  hash_map_for_each_entry_safe(entry, &map, struct map_entry, it) {
+    sum += entry->value;
+    count++;
+
+    if (entry->value & 1) {
+      hash_map_remove(&map, &entry->it);
+    }
+  }
+
+  CHECK_EQ(count, NUM_ENTRIES);
+  CHECK_EQ(sum, (int64_t)NUM_ENTRIES * (NUM_ENTRIES - 1) / 2);
+  CHECK_EQ(hash_map_size(&map), NUM_ENTRIES / 2);
+
+  count = 0;
+
+  hash_map_for_each_entry(entry, &map, struct map_entry, it) {
+    CHECK_EQ(entry->value & 1, 0);
+    count++;
+  }
+
+  CHECK_EQ(count, NUM_ENTRIES / 2);
+
+  hash_map_clear(&map);
+  CHECK_EQ(hash_map_size(&map), 0);
+  CHECK_EQ(hash_map_first(&map), NULL);
+
+  hash_map_destroy(&map);
+}
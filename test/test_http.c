@@ -0,0 +1,212 @@
+#include "core/core.h"
+#include "core/http.h"
+#include "core/thread.h"
+#include "retest.h"
+
+#if !PLATFORM_WINDOWS
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define OBJECT_SIZE 100000
+
+struct server {
+  int sock;
+  int port;
+  uint8_t object[OBJECT_SIZE];
+  int num_requests;
+  int num_connections;
+};
+
+static void server_send(int sock, const void *data, int size) {
+  const uint8_t *ptr = data;
+
+  while (size > 0) {
+    int n = (int)send(sock, ptr, size, 0);
+    if (n <= 0) {
+      return;
+    }
+    ptr += n;
+    size -= n;
+  }
+}
+
+/* serves ranges of a single object, keeping each connection alive until the
+   client closes it */
+static void *server_thread(void *data) {
+  struct server *server = data;
+
+  while (1) {
+    int conn = accept(server->sock, NULL, NULL);
+    if (conn < 0) {
+      break;
+    }
+
+    server->num_connections++;
+
+    char req[4096];
+    int len = 0;
+
+    while (1) {
+      int n = (int)recv(conn, req + len, sizeof(req) - len - 1, 0);
+      if (n <= 0) {
+        break;
+      }
+      len += n;
+      req[len] = 0;
+
+      char *end = strstr(req, "\r\n\r\n");
+      if (!end) {
+        continue;
+      }
+
+      server->num_requests++;
+
+      int64_t first = 0, last = OBJECT_SIZE - 1;
+      char *range = strstr(req, "Range: bytes=");
+      if (range) {
+        sscanf(range, "Range: bytes=%" SCNd64 "-%" SCNd64, &first, &last);
+      }
+
+      char headers[256];
+      if (strstr(req, "GET /huge ")) {
+        /* claim a far larger object than is served */
+        int n = snprintf(headers, sizeof(headers),
+                         "HTTP/1.1 206 Partial Content\r\n"
+                         "Content-Range: bytes 0-0/%" PRId64 "\r\n"
+                         "Content-Length: 1\r\n\r\n",
+                         INT64_C(1) << 40);
+        server_send(conn, headers, n);
+        server_send(conn, server->object, 1);
+      } else if (first >= OBJECT_SIZE) {
+        int n = snprintf(headers, sizeof(headers),
+                         "HTTP/1.1 416 Range Not Satisfiable\r\n"
+                         "Content-Range: bytes */%d\r\n"
+                         "Content-Length: 0\r\n\r\n",
+                         OBJECT_SIZE);
+        server_send(conn, headers, n);
+      } else {
+        last = MIN(last, (int64_t)OBJECT_SIZE - 1);
+        int n = snprintf(headers, sizeof(headers),
+                         "HTTP/1.1 206 Partial Content\r\n"
+                         "Content-Range: bytes %" PRId64 "-%" PRId64 "/%d\r\n"
+                         "Content-Length: %" PRId64 "\r\n"
+                         "ETag: \"abc\"\r\n\r\n",
+                         first, last, OBJECT_SIZE, last - first + 1);
+        server_send(conn, headers, n);
+        server_send(conn, server->object + first, (int)(last - first + 1));
+      }
+
+      /* drop the connection without warning the client, as a server timing
+         out a kept-alive connection would */
+      if (strstr(req, "GET /drop ")) {
+        break;
+      }
+
+      /* keep any pipelined data following the request */
+      end += 4;
+      len -= (int)(end - req);
+      memmove(req, end, len);
+      req[len] = 0;
+    }
+
+    close(conn);
+  }
+
+  return NULL;
+}
+
+TEST(http_get_range) {
+  struct server server = {0};
+
+  for (int i = 0; i < OBJECT_SIZE; i++) {
+    server.object[i] = (uint8_t)(i * 7);
+  }
+
+  server.sock = socket(AF_INET, SOCK_STREAM, 0);
+  CHECK_NE(server.sock, -1);
+
+  struct sockaddr_in addr = {0};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  CHECK_EQ(bind(server.sock, (struct sockaddr *)&addr, sizeof(addr)), 0);
+  CHECK_EQ(listen(server.sock, 4), 0);
+
+  socklen_t addr_len = sizeof(addr);
+  getsockname(server.sock, (struct sockaddr *)&addr, &addr_len);
+  server.port = ntohs(addr.sin_port);
+
+  thread_t thread = thread_create(&server_thread, "server", &server);
+
+  struct http *http = http_create("127.0.0.1", server.port);
+  CHECK_NOTNULL(http);
+
+  /* reads return the object's size and etag */
+  struct http_object obj;
+  uint8_t buf[4096];
+  CHECK_EQ(http_get_range(http, "/object", 1000, sizeof(buf), buf, &obj),
+           (int64_t)sizeof(buf));
+  CHECK_EQ(obj.size, OBJECT_SIZE);
+  CHECK_STREQ(obj.etag, "\"abc\"");
+  CHECK(!memcmp(buf, server.object + 1000, sizeof(buf)));
+
+  /* reads are short at the end of the object, and empty past it */
+  CHECK_EQ(http_get_range(http, "/object", OBJECT_SIZE - 10, sizeof(buf), buf,
+                          NULL),
+           10);
+  CHECK(!memcmp(buf, server.object + OBJECT_SIZE - 10, 10));
+  CHECK_EQ(http_get_range(http, "/object", OBJECT_SIZE, 1, buf, NULL), 0);
+
+  /* whole objects are read with a range for their size */
+  int64_t size = 0;
+  uint8_t *data = http_get(http, "/object", &size);
+  CHECK_NOTNULL(data);
+  CHECK_EQ(size, OBJECT_SIZE);
+  CHECK(!memcmp(data, server.object, OBJECT_SIZE));
+  free(data);
+
+  /* each request was made over the same connection */
+  CHECK_EQ(server.num_requests, 5);
+  CHECK_EQ(server.num_connections, 1);
+
+  /* requests are retried on a new connection when the server has closed the
+     kept-alive one */
+  CHECK_EQ(http_get_range(http, "/drop", 0, 1, buf, NULL), 1);
+  CHECK_EQ(http_get_range(http, "/object", 0, 1, buf, NULL), 1);
+  CHECK_EQ(buf[0], server.object[0]);
+  CHECK_EQ(server.num_connections, 2);
+
+  /* the size of an object read whole isn't trusted */
+  CHECK(!http_get(http, "/huge", &size));
+
+  http_destroy(http);
+
+  /* wakes the server thread up from accept */
+  shutdown(server.sock, SHUT_RDWR);
+  thread_join(thread, NULL);
+  close(server.sock);
+}
+#endif
+
+TEST(http_parse_url) {
+  char host[64];
+  char path[64];
+  int port;
+
+  CHECK(http_parse_url("http://example.com:8080/dir/game.gdi", host,
+                       sizeof(host), &port, path, sizeof(path)));
+  CHECK_STREQ(host, "example.com");
+  CHECK_EQ(port, 8080);
+  CHECK_STREQ(path, "/dir/game.gdi");
+
+  CHECK(http_parse_url("http://example.com", host, sizeof(host), &port, path,
+                       sizeof(path)));
+  CHECK_STREQ(host, "example.com");
+  CHECK_EQ(port, 80);
+  CHECK_STREQ(path, "/");
+
+  CHECK(!http_parse_url("https://example.com/game.gdi", host, sizeof(host),
+                        &port, path, sizeof(path)));
+  CHECK(!http_parse_url("http://example.com:80x/game.gdi", host, sizeof(host),
+                        &port, path, sizeof(path)));
+}
@@ -0,0 +1,31 @@
+#include "core/core.h"
+#include "core/filesystem.h"
+#include "file/image_writer.h"
+#include "retest.h"
+
+TEST(image_writer_flush_on_destroy) {
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s" PATH_SEPARATOR "retest.img", fs_appdir());
+
+  uint8_t image[1024];
+  memset(image, 0x11, sizeof(image));
+
+  /* long enough of a delay that only destroying the writer flushes it */
+  struct image_writer *writer =
+      image_writer_create(path, image, sizeof(image), 256, 60000);
+
+  uint8_t data[4] = {1, 2, 3, 4};
+  image_writer_write(writer, 510, data, sizeof(data));
+  image_writer_destroy(writer);
+
+  uint8_t result[1024];
+  FILE *file = fopen(path, "rb");
+  CHECK_NOTNULL(file);
+  CHECK_EQ((int)fread(result, 1, sizeof(result), file), (int)sizeof(result));
+  fclose(file);
+
+  memcpy(&image[510], data, sizeof(data));
+  CHECK(!memcmp(result, image, sizeof(image)));
+
+  remove(path);
+}
@@ -0,0 +1,97 @@
+#include "jit/ir/ir.h"
+#include "retest.h"
+
+static uint8_t ir_buffer[2][1024 * 1024];
+static uint8_t binary[64 * 1024];
+
+static void write_text(struct ir *ir, char *text, int size) {
+  FILE *file = tmpfile();
+  CHECK_NOTNULL(file);
+  ir_write(ir, file);
+
+  int n = (int)ftell(file);
+  CHECK_LT(n, size);
+  fseek(file, 0, SEEK_SET);
+  CHECK_EQ((int)fread(text, 1, n, file), n);
+  text[n] = 0;
+  fclose(file);
+}
+
+TEST(ir_binary_roundtrip) {
+  static const char input_str[] =
+      "%0: !addr i32 0x8c010000\n"
+      "i32 %1 = load_context i32 0x2c\n"
+      "i64 %2 = zext i32 %1\n"
+      "f32 %3 = load_context i32 0x100\n"
+      "f64 %4 = fext f32 %3\n"
+      "f64 %5 = fadd f64 %4, f64 0x3ff0000000000000\n"
+      "store_context i32 0x108, f64 %5\n"
+      "i8 %6 = cmp i32 %1, i32 0x10, i32 0x4\n"
+      "i16 %7 = load_context i32 0x40 !cycles i32 0x3\n"
+      "store_context i32 0x44, i16 %7\n"
+      "store_context i32 0x48, i64 0xfffffffffffffffe\n"
+      "branch_cond i8 %6, blk %8, blk %10\n"
+      "%8:\n"
+      "store_context i32 0x20, i8 0xff\n"
+      "branch blk %10\n"
+      "%10:\n"
+      "i32 %11 = add i32 %1, i32 0x1\n"
+      "store_context i32 0x2c, i32 %11\n"
+      "branch i32 0x8c000100\n";
+
+  struct ir in = {0};
+  in.buffer = ir_buffer[0];
+  in.capacity = sizeof(ir_buffer[0]);
+
+  FILE *input = tmpfile();
+  CHECK_NOTNULL(input);
+  fwrite(input_str, 1, sizeof(input_str) - 1, input);
+  fseek(input, 0, SEEK_SET);
+  CHECK(ir_read(input, &in));
+  fclose(input);
+
+  int size = ir_write_binary(&in, binary, sizeof(binary));
+  CHECK_GT(size, 0);
+
+  /* not enough space */
+  CHECK_EQ(ir_write_binary(&in, binary, size - 1), 0);
+
+  struct ir out = {0};
+  out.buffer = ir_buffer[1];
+  out.capacity = sizeof(ir_buffer[1]);
+  CHECK_EQ(ir_read_binary(binary, size, &out), size);
+
+  static char expected[16 * 1024];
+  static char actual[16 * 1024];
+  write_text(&in, expected, sizeof(expected));
+  write_text(&out, actual, sizeof(actual));
+  CHECK_STREQ(actual, expected);
+}
+
+TEST(ir_binary_truncated) {
+  static const char input_str[] =
+      "i32 %0 = load_context i32 0x2c\n"
+      "i32 %1 = add i32 %0, i32 0x1\n"
+      "store_context i32 0x2c, i32 %1\n";
+
+  struct ir in = {0};
+  in.buffer = ir_buffer[0];
+  in.capacity = sizeof(ir_buffer[0]);
+
+  FILE *input = tmpfile();
+  CHECK_NOTNULL(input);
+  fwrite(input_str, 1, sizeof(input_str) - 1, input);
+  fseek(input, 0, SEEK_SET);
+  CHECK(ir_read(input, &in));
+  fclose(input);
+
+  int size = ir_write_binary(&in, binary, sizeof(binary));
+  CHECK_GT(size, 0);
+
+  for (int n = 0; n < size; n++) {
+    struct ir out = {0};
+    out.buffer = ir_buffer[1];
+    out.capacity = sizeof(ir_buffer[1]);
+    CHECK_EQ(ir_read_binary(binary, n, &out), 0);
+  }
+}
@@ -0,0 +1,99 @@
+#include "jit/jit_frontend.h"
+#include "jit/jit_prescan.h"
+#include "retest.h"
+
+/* fake guest code made up of fixed size blocks, each with up to two static
+   branch targets */
+#define PRESCAN_BLOCK_SIZE 16
+#define PRESCAN_BLOCK_ADDR(i) (uint32_t)(0x1000 + (i) * PRESCAN_BLOCK_SIZE)
+
+static int prescan_targets[][JIT_MAX_BRANCH_TARGETS] = {
+    /* 0 branches to 1 and falls through to 2, both rejoin at 3 */
+    {1, 2},
+    {3, -1},
+    {3, -1},
+    /* 3 loops back to 0, or falls through to 4 which ends in a dynamic
+       branch */
+    {0, 4},
+    {-1, -1},
+};
+
+static void prescan_analyze_code(struct jit_frontend *frontend, uint32_t addr,
+                                 int flags, int *size) {
+  *size = PRESCAN_BLOCK_SIZE;
+}
+
+static int prescan_branch_targets(struct jit_frontend *frontend, uint32_t addr,
+                                  int size, uint32_t *targets) {
+  int i = (addr - PRESCAN_BLOCK_ADDR(0)) / PRESCAN_BLOCK_SIZE;
+  int num_targets = 0;
+
+  for (int j = 0; j < JIT_MAX_BRANCH_TARGETS; j++) {
+    if (prescan_targets[i][j] >= 0) {
+      targets[num_targets++] = PRESCAN_BLOCK_ADDR(prescan_targets[i][j]);
+    }
+  }
+
+  return num_targets;
+}
+
+static struct jit_frontend prescan_frontend = {
+    .analyze_code = &prescan_analyze_code,
+    .branch_targets = &prescan_branch_targets,
+};
+
+static int prescan_drain(struct jit_prescan *prescan, uint32_t *addrs) {
+  int n = 0;
+  uint32_t addr;
+
+  while (jit_prescan_peek(prescan, &addr)) {
+    addrs[n++] = addr;
+    jit_prescan_pop(prescan);
+  }
+
+  return n;
+}
+
+TEST(jit_prescan_walk) {
+  struct jit_prescan *prescan = jit_prescan_create(&prescan_frontend, 64);
+  uint32_t addrs[64];
+
+  /* each block is queued once, closest to the entry first */
+  jit_prescan_walk(prescan, PRESCAN_BLOCK_ADDR(0));
+
+  int n = prescan_drain(prescan, addrs);
+  CHECK_EQ(n, 5);
+
+  for (int i = 0; i < n; i++) {
+    CHECK_EQ(addrs[i], PRESCAN_BLOCK_ADDR(i));
+  }
+
+  /* blocks already queued aren't queued again by later walks */
+  jit_prescan_walk(prescan, PRESCAN_BLOCK_ADDR(3));
+  CHECK_EQ(prescan_drain(prescan, addrs), 0);
+
+  /* until the prescan is cleared */
+  jit_prescan_clear(prescan);
+  jit_prescan_walk(prescan, PRESCAN_BLOCK_ADDR(3));
+
+  n = prescan_drain(prescan, addrs);
+  CHECK_EQ(n, 5);
+  CHECK_EQ(addrs[0], PRESCAN_BLOCK_ADDR(3));
+  CHECK_EQ(addrs[1], PRESCAN_BLOCK_ADDR(0));
+  CHECK_EQ(addrs[2], PRESCAN_BLOCK_ADDR(4));
+
+  jit_prescan_destroy(prescan);
+}
+
+TEST(jit_prescan_max_blocks) {
+  struct jit_prescan *prescan = jit_prescan_create(&prescan_frontend, 3);
+  uint32_t addrs[64];
+
+  jit_prescan_walk(prescan, PRESCAN_BLOCK_ADDR(0));
+
+  int n = prescan_drain(prescan, addrs);
+  CHECK_EQ(n, 3);
+  CHECK_EQ(addrs[2], PRESCAN_BLOCK_ADDR(2));
+
+  jit_prescan_destroy(prescan);
+}
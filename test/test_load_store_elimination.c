@@ -79,3 +79,76 @@ static char scratch_buffer[1024 * 1024];
 
   CHECK_STREQ(scratch_buffer, output_str);
 }*/
+
+TEST(load_store_elimination_cross_block) {
+  /* constants stored on every path into a block are forwarded to its loads,
+     and stores overwritten on every path out of a block are removed */
+  static const char input_str[] =
+      "%0:\n"
+      "i32 %1 = load_context i32 0x20\n"
+      "store_context i32 0x10, i32 0x1\n"
+      "store_context i32 0x14, i32 %1\n"
+      "store_context i32 0x18, i32 %1\n"
+      "branch_cond blk %2, blk %3, i32 %1\n"
+      "%2:\n"
+      "store_context i32 0x14, i32 0x2\n"
+      "store_context i32 0x18, i32 0x3\n"
+      "branch blk %3\n"
+      "%3:\n"
+      "i32 %4 = load_context i32 0x10\n"
+      "i32 %5 = load_context i32 0x14\n"
+      "i32 %6 = add i32 %4, i32 %5\n"
+      "store_context i32 0x14, i32 %6\n"
+      "store_context i32 0x18, i32 0x4\n"
+      "branch i32 0x8c000000\n";
+
+  static const char output_str[] =
+      "#==--------------------------------------------------==#\n"
+      "# ir\n"
+      "#==--------------------------------------------------==#\n"
+      "# predecessors \n"
+      "# successors \n"
+      "%0:\n"
+      "i32 %1 = load_context i32 0x20\n"
+      "store_context i32 0x10, i32 0x1\n"
+      "store_context i32 0x14, i32 %1\n"
+      "branch_cond blk %5, blk %8, i32 %1\n"
+      "# predecessors \n"
+      "# successors \n"
+      "%5:\n"
+      "store_context i32 0x14, i32 0x2\n"
+      "branch blk %8\n"
+      "# predecessors \n"
+      "# successors \n"
+      "%8:\n"
+      "i32 %9 = load_context i32 0x14\n"
+      "i32 %10 = add i32 0x1, i32 %9\n"
+      "store_context i32 0x14, i32 %10\n"
+      "store_context i32 0x18, i32 0x4\n"
+      "branch i32 0x8c000000\n";
+
+  struct ir ir = {0};
+  ir.buffer = ir_buffer;
+  ir.capacity = sizeof(ir_buffer);
+
+  FILE *input = tmpfile();
+  fwrite(input_str, 1, sizeof(input_str) - 1, input);
+  rewind(input);
+  int res = ir_read(input, &ir);
+  fclose(input);
+  CHECK(res);
+
+  struct lse *lse = lse_create();
+  lse_run(lse, &ir);
+  lse_destroy(lse);
+
+  FILE *output = tmpfile();
+  ir_write(&ir, output);
+  rewind(output);
+  size_t n = fread(&scratch_buffer, 1, sizeof(scratch_buffer), output);
+  fclose(output);
+  CHECK_NE(n, 0u);
+  scratch_buffer[n] = 0;
+
+  CHECK_STREQ(scratch_buffer, output_str);
+}
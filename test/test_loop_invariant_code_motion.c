@@ -0,0 +1,70 @@
+#include "jit/ir/ir.h"
+#include "jit/passes/loop_invariant_code_motion_pass.h"
+#include "retest.h"
+
+static uint8_t ir_buffer[1024 * 1024];
+static char scratch_buffer[1024 * 1024];
+
+TEST(loop_invariant_code_motion) {
+  /* loads of context which isn't written to inside of the loop, and the
+     pure expressions computed from them, are hoisted into the preheader */
+  static const char input_str[] =
+      "%0:\n"
+      "branch blk %1\n"
+      "%1:\n"
+      "i32 %2 = load_context i32 0x3c\n"
+      "i32 %3 = add i32 %2, i32 0x4\n"
+      "i32 %4 = load_context i32 0x10\n"
+      "i32 %5 = add i32 %4, i32 %3\n"
+      "i32 %6 = load_context i32 0x14\n"
+      "i32 %7 = sub i32 %6, i32 0x1\n"
+      "store_context i32 0x14, i32 %7\n"
+      "store_context i32 0x10, i32 %5\n"
+      "branch_cond i32 0x8c000000, blk %1, i32 %7\n";
+
+  static const char output_str[] =
+      "#==--------------------------------------------------==#\n"
+      "# ir\n"
+      "#==--------------------------------------------------==#\n"
+      "# predecessors \n"
+      "# successors \n"
+      "%0:\n"
+      "i32 %1 = load_context i32 0x3c\n"
+      "i32 %2 = add i32 %1, i32 0x4\n"
+      "branch blk %4\n"
+      "# predecessors \n"
+      "# successors \n"
+      "%4:\n"
+      "i32 %5 = load_context i32 0x10\n"
+      "i32 %6 = add i32 %5, i32 %2\n"
+      "i32 %7 = load_context i32 0x14\n"
+      "i32 %8 = sub i32 %7, i32 0x1\n"
+      "store_context i32 0x14, i32 %8\n"
+      "store_context i32 0x10, i32 %6\n"
+      "branch_cond i32 0x8c000000, blk %4, i32 %8\n";
+
+  struct ir ir = {0};
+  ir.buffer = ir_buffer;
+  ir.capacity = sizeof(ir_buffer);
+
+  FILE *input = tmpfile();
+  fwrite(input_str, 1, sizeof(input_str) - 1, input);
+  rewind(input);
+  int res = ir_read(input, &ir);
+  fclose(input);
+  CHECK(res);
+
+  struct licm *licm = licm_create();
+  licm_run(licm, &ir);
+  licm_destroy(licm);
+
+  FILE *output = tmpfile();
+  ir_write(&ir, output);
+  rewind(output);
+  size_t n = fread(&scratch_buffer, 1, sizeof(scratch_buffer), output);
+  fclose(output);
+  CHECK_NE(n, 0u);
+  scratch_buffer[n] = 0;
+
+  CHECK_STREQ(scratch_buffer, output_str);
+}
@@ -0,0 +1,131 @@
+#include "core/core.h"
+#include "core/memory.h"
+#include "core/thread.h"
+#include "retest.h"
+
+#define NUM_INSTANCES 4
+#define NUM_ROUNDS 64
+
+struct instance {
+  struct memory_watcher *watcher;
+  volatile uint8_t *page;
+  int fired;
+};
+
+static void watch_fired(const struct exception_state *ex, void *data) {
+  struct instance *inst = data;
+  inst->fired++;
+}
+
+static void *instance_thread(void *data) {
+  struct instance *inst = data;
+
+  /* each write faults once, and is serviced by this instance's watcher */
+  for (int i = 0; i < NUM_ROUNDS; i++) {
+    add_single_write_watch(inst->watcher, (void *)inst->page, 1, &watch_fired,
+                           inst);
+    flush_memory_watches(inst->watcher);
+    inst->page[i] = (uint8_t)i;
+  }
+
+  return NULL;
+}
+
+TEST(memory_watch_instances) {
+  size_t page_size = get_page_size();
+  struct instance insts[NUM_INSTANCES] = {0};
+
+  for (int i = 0; i < NUM_INSTANCES; i++) {
+    insts[i].watcher = memory_watcher_create(0);
+    insts[i].page = alloc_pages(NULL, page_size, ACC_READWRITE);
+    CHECK_NOTNULL(insts[i].page);
+  }
+
+  thread_t threads[NUM_INSTANCES];
+  for (int i = 0; i < NUM_INSTANCES; i++) {
+    threads[i] = thread_create(&instance_thread, "instance", &insts[i]);
+  }
+  for (int i = 0; i < NUM_INSTANCES; i++) {
+    thread_join(threads[i], NULL);
+  }
+
+  for (int i = 0; i < NUM_INSTANCES; i++) {
+    CHECK_EQ(insts[i].fired, NUM_ROUNDS);
+    CHECK_EQ(insts[i].page[NUM_ROUNDS - 1], NUM_ROUNDS - 1);
+  }
+
+  /* destroying a watcher restores access to the pages it still watches */
+  add_single_write_watch(insts[0].watcher, (void *)insts[0].page, 1,
+                         &watch_fired, &insts[0]);
+  flush_memory_watches(insts[0].watcher);
+
+  for (int i = 0; i < NUM_INSTANCES; i++) {
+    memory_watcher_destroy(insts[i].watcher);
+  }
+
+  insts[0].page[0] = 0xff;
+  CHECK_EQ(insts[0].fired, NUM_ROUNDS);
+
+  for (int i = 0; i < NUM_INSTANCES; i++) {
+    release_pages((void *)insts[i].page, page_size);
+  }
+}
+
+static void watch_counted(const struct exception_state *ex, void *data) {
+  int *fired = data;
+  (*fired)++;
+}
+
+TEST(memory_watch_polling) {
+  size_t page_size = get_page_size();
+  struct memory_watcher *watcher = memory_watcher_create(1);
+  volatile uint8_t *pages = alloc_pages(NULL, page_size * 3, ACC_READWRITE);
+  CHECK_NOTNULL(pages);
+
+  /* only the watches on written pages fire, each exactly once. where write
+     tracking is unsupported, the watches fire on the write instead */
+  int fired[3] = {0};
+  add_single_write_watch(watcher, (void *)&pages[0], 1, &watch_counted,
+                         &fired[0]);
+  add_single_write_watch(watcher, (void *)&pages[page_size * 2], 1,
+                         &watch_counted, &fired[2]);
+  flush_memory_watches(watcher);
+
+  pages[page_size * 2] = 1;
+  pages[page_size] = 1;
+  poll_memory_watches(watcher);
+  CHECK_EQ(fired[0], 0);
+  CHECK_EQ(fired[2], 1);
+
+  pages[0] = 1;
+  pages[1] = 1;
+  poll_memory_watches(watcher);
+  poll_memory_watches(watcher);
+  CHECK_EQ(fired[0], 1);
+  CHECK_EQ(fired[2], 1);
+
+  /* flushing a new watch on a page written since the last poll fires the
+     existing watches on it, while the new one only sees later writes */
+  add_single_write_watch(watcher, (void *)&pages[page_size], 1,
+                         &watch_counted, &fired[0]);
+  flush_memory_watches(watcher);
+  pages[page_size] = 2;
+  add_single_write_watch(watcher, (void *)&pages[page_size], 1,
+                         &watch_counted, &fired[1]);
+  flush_memory_watches(watcher);
+  poll_memory_watches(watcher);
+  CHECK_EQ(fired[0], 2);
+  CHECK_EQ(fired[1], 0);
+
+  pages[page_size] = 3;
+  poll_memory_watches(watcher);
+  CHECK_EQ(fired[1], 1);
+
+  memory_watcher_destroy(watcher);
+
+  /* destroying the watcher leaves the pages writable */
+  pages[page_size * 2] = 2;
+  CHECK_EQ(pages[page_size * 2], 2);
+
+  release_pages((void *)pages, page_size * 3);
+}
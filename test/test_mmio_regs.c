@@ -0,0 +1,58 @@
+#include "core/core.h"
+#include "guest/dreamcast.h"
+#include "guest/holly/holly.h"
+#include "guest/memory.h"
+#include "guest/pvr/pvr.h"
+#include "retest.h"
+
+/* p2 mirror of area 0 */
+#define HOLLY_REG_ADDR(name) (0xa05f0000 + (name << 2))
+#define PVR_REG_ADDR(name) (0xa05f8000 + (name << 2))
+
+TEST(mmio_regs_direct) {
+  struct dreamcast *dc = dc_create();
+  CHECK(dc_load(dc, NULL));
+  struct memory *mem = dc->mem;
+
+  /* no callbacks, accessed directly in either direction */
+  uint32_t addr = HOLLY_REG_ADDR(SB_C2DSTAT);
+  CHECK_EQ(sh4_lookup_reg(mem, addr, 0), dc->holly->SB_C2DSTAT);
+  CHECK_EQ(sh4_lookup_reg(mem, addr, 1), dc->holly->SB_C2DSTAT);
+
+  /* the area 0 mirror at p0 resolves to the same storage */
+  CHECK_EQ(sh4_lookup_reg(mem, addr & 0x1fffffff, 0), dc->holly->SB_C2DSTAT);
+
+  /* only plain writes to SB_C2DST are side-effect free */
+  addr = HOLLY_REG_ADDR(SB_C2DST);
+  CHECK_EQ(sh4_lookup_reg(mem, addr, 0), dc->holly->SB_C2DST);
+  CHECK_EQ(sh4_lookup_reg(mem, addr, 1), NULL);
+
+  /* reads compute the pending interrupt bits */
+  CHECK_EQ(sh4_lookup_reg(mem, HOLLY_REG_ADDR(SB_ISTNRM), 0), NULL);
+
+  /* writes to the id register are dropped */
+  addr = PVR_REG_ADDR(ID);
+  CHECK_EQ(sh4_lookup_reg(mem, addr, 0), &dc->pvr->reg[ID]);
+  CHECK_EQ(sh4_lookup_reg(mem, addr, 1), NULL);
+
+  /* sub-word offsets go through the handlers */
+  CHECK_EQ(sh4_lookup_reg(mem, HOLLY_REG_ADDR(SB_C2DSTAT) + 2, 0), NULL);
+
+  /* as does anything outside of the holly / pvr register blocks */
+  CHECK_EQ(sh4_lookup_reg(mem, 0xa0700000, 0), NULL);
+  CHECK_EQ(sh4_lookup_reg(mem, 0x8c000000, 0), NULL);
+
+  dc_destroy(dc);
+}
+
+TEST(mmio_regs_logged) {
+  struct dreamcast *dc = dc_create();
+  CHECK(dc_load(dc, NULL));
+
+  /* logged accesses can't bypass holly_reg_read / holly_reg_write */
+  dc->holly->log_regs = 1;
+  CHECK_EQ(sh4_lookup_reg(dc->mem, HOLLY_REG_ADDR(SB_C2DSTAT), 0), NULL);
+  CHECK_EQ(sh4_lookup_reg(dc->mem, HOLLY_REG_ADDR(SB_C2DSTAT), 1), NULL);
+
+  dc_destroy(dc);
+}
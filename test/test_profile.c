@@ -0,0 +1,72 @@
+#include "core/core.h"
+#include "core/filesystem.h"
+#include "guest/gdrom/disc.h"
+#include "guest/profile.h"
+#include "options.h"
+#include "retest.h"
+
+static void write_profiles(const char *data) {
+  FILE *file = fopen(profile_path(), "w");
+  CHECK_NOTNULL(file);
+  fputs(data, file);
+  fclose(file);
+}
+
+TEST(profile_apply) {
+  char profiles[OPTION_MAX_LENGTH];
+  strncpy(profiles, OPTION_profiles, sizeof(profiles));
+  strncpy(OPTION_profiles, "retest.profiles.ini", OPTION_MAX_LENGTH);
+
+  write_profiles("[T-0000N]\n"
+                 "frameskip: 1\n"
+                 "sh4_clock: 150\n"
+                 "[T-0000N V1.001]\n"
+                 "sh4_clock: 200\n"
+                 "[T-1111N]\n"
+                 "frameskip: 2\n");
+
+  int frameskip = OPTION_frameskip;
+  int sh4_clock = OPTION_sh4_clock;
+
+  /* the section naming the version applies on top of the other */
+  struct disc disc = {0};
+  strncpy(disc.prodnum, "T-0000N", sizeof(disc.prodnum));
+  strncpy(disc.prodver, "V1.001", sizeof(disc.prodver));
+  CHECK_EQ(profile_apply(&disc), 3);
+  CHECK_EQ(OPTION_frameskip, 1);
+  CHECK_EQ(OPTION_sh4_clock, 200);
+
+  /* other versions only get the first */
+  strncpy(disc.prodver, "V1.000", sizeof(disc.prodver));
+  CHECK_EQ(profile_apply(&disc), 2);
+  CHECK_EQ(OPTION_frameskip, 1);
+  CHECK_EQ(OPTION_sh4_clock, 150);
+
+  /* the overrides of one title don't carry over to the next */
+  strncpy(disc.prodnum, "T-1111N", sizeof(disc.prodnum));
+  CHECK_EQ(profile_apply(&disc), 1);
+  CHECK_EQ(OPTION_frameskip, 2);
+  CHECK_EQ(OPTION_sh4_clock, sh4_clock);
+
+  CHECK_EQ(profile_apply(NULL), 0);
+  CHECK_EQ(OPTION_frameskip, frameskip);
+  CHECK_EQ(OPTION_sh4_clock, sh4_clock);
+
+  CHECK_EQ(profile_validate(profile_path()), 3);
+
+  write_profiles("[T-0000N]\n"
+                 "not_an_option: 1\n");
+  CHECK_EQ(profile_validate(profile_path()), -1);
+
+  /* options saved to the config can't be overridden */
+  char region[OPTION_MAX_LENGTH];
+  strncpy(region, OPTION_region, sizeof(region));
+  write_profiles("[T-1111N]\n"
+                 "region: japan\n");
+  CHECK_EQ(profile_validate(profile_path()), -1);
+  CHECK_EQ(profile_apply(&disc), 0);
+  CHECK_STREQ(OPTION_region, region);
+
+  remove(profile_path());
+  strncpy(OPTION_profiles, profiles, OPTION_MAX_LENGTH);
+}
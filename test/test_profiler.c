@@ -0,0 +1,89 @@
+#include "core/core.h"
+#include "core/profiler.h"
+#include "core/thread.h"
+#include "guest/dreamcast.h"
+#include "retest.h"
+#include "stats.h"
+
+#define NUM_THREADS 4
+#define NUM_ADDS 100000
+
+static prof_token_t test_counter;
+
+static void *add_thread(void *data) {
+  for (int i = 0; i < NUM_ADDS; i++) {
+    prof_counter_add(test_counter, 1);
+  }
+  return NULL;
+}
+
+TEST(profiler_counter_shards) {
+  test_counter = prof_get_counter_token("test_counter");
+
+  thread_t threads[NUM_THREADS];
+  for (int i = 0; i < NUM_THREADS; i++) {
+    threads[i] = thread_create(&add_thread, "add_thread", NULL);
+  }
+  for (int i = 0; i < NUM_THREADS; i++) {
+    thread_join(threads[i], NULL);
+  }
+
+  /* shards of exited threads must still be counted */
+  CHECK_EQ(prof_counter_load(test_counter), NUM_THREADS * NUM_ADDS);
+  CHECK_EQ(prof_counter_total(test_counter), NUM_THREADS * NUM_ADDS);
+
+  prof_counter_set(test_counter, 5);
+  CHECK_EQ(prof_counter_load(test_counter), 5);
+}
+
+TEST(profiler_gpu_zones) {
+  prof_gpu_zone("test_gpu_zone", 1000, 3000);
+
+  const char *path = "test_profiler_gpu.json";
+  CHECK(prof_export_trace(path));
+
+  FILE *file = fopen(path, "r");
+  CHECK_NOTNULL(file);
+  char trace[1 << 16];
+  size_t size = fread(trace, 1, sizeof(trace) - 1, file);
+  trace[size] = 0;
+  fclose(file);
+  remove(path);
+
+  /* gpu zones are exported on their own named track, at the times given */
+  CHECK_NOTNULL(strstr(trace, "\"args\":{\"name\":\"gpu\"}"));
+  CHECK_NOTNULL(strstr(trace, "\"ph\":\"B\",\"ts\":1.000,\"pid\":0,\"tid\":0,"
+                              "\"name\":\"test_gpu_zone\""));
+  CHECK_NOTNULL(strstr(trace, "\"ph\":\"E\",\"ts\":3.000,\"pid\":0,\"tid\":0"));
+}
+
+TEST(profiler_memory_usage) {
+  struct mem_usage before[MAX_MEM_USAGE];
+  struct mem_usage during[MAX_MEM_USAGE];
+  struct mem_usage after[MAX_MEM_USAGE];
+
+  int n = stats_memory_usage(before);
+
+  struct dreamcast *dc = dc_create();
+  CHECK(dc_load(dc, NULL));
+  CHECK_EQ(stats_memory_usage(during), n);
+
+  /* the guest's memory is accounted for while the machine is alive */
+  int64_t added = 0;
+  for (int i = 0; i < n; i++) {
+    CHECK_GE(during[i].bytes, before[i].bytes);
+    if (!strcmp(during[i].name, "guest")) {
+      CHECK_GE(during[i].bytes - before[i].bytes, 16 * 1024 * 1024);
+    }
+    added += during[i].bytes - before[i].bytes;
+  }
+  CHECK_GT(added, 0);
+
+  /* and everything it allocated is given back once it's destroyed */
+  dc_destroy(dc);
+  CHECK_EQ(stats_memory_usage(after), n);
+
+  for (int i = 0; i < n; i++) {
+    CHECK_EQ(after[i].bytes, before[i].bytes);
+  }
+}
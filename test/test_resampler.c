@@ -0,0 +1,77 @@
+#include <math.h>
+#include "core/core.h"
+#include "core/resampler.h"
+#include "retest.h"
+
+#define IN_RATE 44100
+#define OUT_RATE 48000
+#define TONE_FREQ 1000.0
+#define TONE_AMP 10000.0
+/* one video frame's worth of input */
+#define CHUNK_FRAMES 735
+
+static int16_t in_frames[IN_RATE * 2];
+static int16_t out_frames[OUT_RATE * 2 * 2];
+
+static void generate_tone() {
+  for (int i = 0; i < IN_RATE; i++) {
+    double t = 2.0 * M_PI * TONE_FREQ * i / IN_RATE;
+    in_frames[i * 2 + 0] = (int16_t)(TONE_AMP * sin(t));
+    in_frames[i * 2 + 1] = (int16_t)(TONE_AMP * cos(t));
+  }
+}
+
+static int resample_tone(struct resampler *rs) {
+  int num_out = 0;
+
+  for (int i = 0; i < IN_RATE; i += CHUNK_FRAMES) {
+    int n = MIN(CHUNK_FRAMES, IN_RATE - i);
+    int max = resampler_max_frames(rs, n);
+    int written =
+        resampler_process(rs, &in_frames[i * 2], n, &out_frames[num_out * 2]);
+    CHECK_LE(written, max);
+    num_out += written;
+  }
+
+  return num_out;
+}
+
+TEST(resampler_tone) {
+  generate_tone();
+
+  struct resampler *rs = resampler_create(IN_RATE, OUT_RATE);
+  int num_out = resample_tone(rs);
+  resampler_destroy(rs);
+
+  /* a second of input produces a second of output, short of the frames held
+     back for the filter's window */
+  CHECK_GT(num_out, OUT_RATE - 32);
+  CHECK_LE(num_out, OUT_RATE);
+
+  /* output frames are centered on the input, so the tone should come out with
+     the same phase, frequency and amplitude once past the initial silence */
+  double max_err = 0.0;
+
+  for (int i = 64; i < num_out - 64; i++) {
+    double t = 2.0 * M_PI * TONE_FREQ * i / OUT_RATE;
+    double err_l = fabs(out_frames[i * 2 + 0] - TONE_AMP * sin(t));
+    double err_r = fabs(out_frames[i * 2 + 1] - TONE_AMP * cos(t));
+    max_err = MAX(max_err, MAX(err_l, err_r));
+  }
+
+  CHECK_LT(max_err, TONE_AMP * 0.005);
+}
+
+TEST(resampler_ratio) {
+  generate_tone();
+
+  struct resampler *rs = resampler_create(IN_RATE, OUT_RATE);
+  resampler_set_ratio(rs, 1.005);
+  int num_out = resample_tone(rs);
+  resampler_destroy(rs);
+
+  /* nudging the ratio produces proportionally more frames */
+  int expected = (int)(OUT_RATE * 1.005);
+  CHECK_GT(num_out, expected - 32);
+  CHECK_LE(num_out, expected);
+}
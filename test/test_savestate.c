@@ -0,0 +1,221 @@
+#include "core/core.h"
+#include "core/filesystem.h"
+#include "guest/dreamcast.h"
+#include "guest/memory.h"
+#include "guest/snapshot.h"
+#include "retest.h"
+
+static void state_path(char *path, int size) {
+  snprintf(path, size, "%s" PATH_SEPARATOR "retest.state", fs_appdir());
+}
+
+static void truncate_state(const char *path, int n) {
+  FILE *file = fopen(path, "rb");
+  CHECK_NOTNULL(file);
+  fseek(file, 0, SEEK_END);
+  int size = (int)ftell(file);
+  fseek(file, 0, SEEK_SET);
+  uint8_t *data = malloc(size);
+  CHECK_EQ((int)fread(data, 1, size, file), size);
+  fclose(file);
+
+  file = fopen(path, "wb");
+  CHECK_NOTNULL(file);
+  CHECK_EQ((int)fwrite(data, 1, size - n, file), size - n);
+  fclose(file);
+  free(data);
+}
+
+TEST(savestate_roundtrip) {
+  char path[PATH_MAX];
+  state_path(path, sizeof(path));
+
+  struct dreamcast *dc = dc_create();
+  CHECK(dc_load(dc, NULL));
+  uint8_t *ram = mem_ram(dc->mem, 0);
+  uint8_t *aram = mem_aram(dc->mem, 0);
+
+  ram[0x1234] = 0xab;
+  aram[0x10] = 0xcd;
+  CHECK(dc_save_state(dc, path));
+
+  ram[0x1234] = 0;
+  aram[0x10] = 0;
+  CHECK(dc_load_state(dc, path));
+  CHECK_EQ(ram[0x1234], 0xab);
+  CHECK_EQ(aram[0x10], 0xcd);
+
+  dc_destroy(dc);
+  remove(path);
+}
+
+TEST(savestate_ocram) {
+  char path[PATH_MAX];
+  state_path(path, sizeof(path));
+
+  struct dreamcast *dc = dc_create();
+  CHECK(dc_load(dc, NULL));
+  struct memory *mem = dc->mem;
+
+  /* enable the operand cache ram through CCR.ORA, its two banks are mirrored
+     every 8kb */
+  sh4_write32(mem, 0xff00001c, 0x20);
+  sh4_write32(mem, 0x7c000010, 0x12345678);
+  sh4_write32(mem, 0x7c002010, 0x9abcdef0);
+  CHECK_EQ(sh4_read32(mem, 0x7c004010), 0x12345678);
+  CHECK(dc_save_state(dc, path));
+
+  sh4_write32(mem, 0x7c000010, 0);
+  sh4_write32(mem, 0xff00001c, 0);
+  CHECK(dc_load_state(dc, path));
+  CHECK_EQ(sh4_read32(mem, 0x7c000010), 0x12345678);
+  CHECK_EQ(sh4_read32(mem, 0x7c006010), 0x9abcdef0);
+
+  dc_destroy(dc);
+  remove(path);
+}
+
+TEST(savestate_reject_truncated) {
+  char path[PATH_MAX];
+  state_path(path, sizeof(path));
+
+  struct dreamcast *dc = dc_create();
+  CHECK(dc_load(dc, NULL));
+  uint8_t *ram = mem_ram(dc->mem, 0);
+
+  CHECK(dc_save_state(dc, path));
+
+  /* drop the tail of the state, nothing should be applied */
+  truncate_state(path, 16);
+
+  ram[0] = 0x5a;
+  CHECK(!dc_load_state(dc, path));
+  CHECK_EQ(ram[0], 0x5a);
+
+  dc_destroy(dc);
+  remove(path);
+}
+
+TEST(savestate_buffer_roundtrip) {
+  struct dreamcast *dc = dc_create();
+  CHECK(dc_load(dc, NULL));
+  uint8_t *ram = mem_ram(dc->mem, 0);
+
+  int64_t size = dc_state_max_size(dc);
+  uint8_t *data = malloc(size);
+  CHECK_NOTNULL(data);
+
+  /* a buffer too small for the state is rejected */
+  CHECK_EQ(dc_save_state_buffer(dc, data, 64), 0);
+
+  ram[0x1234] = 0xab;
+  CHECK_EQ(dc_save_state_buffer(dc, data, size), size);
+
+  /* the whole buffer is handed back, padding and all */
+  ram[0x1234] = 0;
+  CHECK(dc_load_state_buffer(dc, data, size));
+  CHECK_EQ(ram[0x1234], 0xab);
+
+  free(data);
+  dc_destroy(dc);
+}
+
+TEST(snapshots_restore) {
+  struct dreamcast *dc = dc_create();
+  CHECK(dc_load(dc, NULL));
+  uint8_t *ram = mem_ram(dc->mem, 0);
+  uint8_t *vram = mem_vram(dc->mem, 0);
+
+  struct snapshots *snaps = snapshots_create(dc, 4, INT64_MAX, 1);
+  CHECK_NOTNULL(snaps);
+
+  ram[0x100] = 1;
+  CHECK(snapshots_take(snaps));
+
+  ram[0x100] = 2;
+  vram[0x2000] = 0x11;
+  CHECK(snapshots_take(snaps));
+
+  ram[0x100] = 3;
+  CHECK(snapshots_take(snaps));
+
+  /* only pages written since the first snapshot should have been stored */
+  CHECK_LT(snapshots_size(snaps), 1024 * 1024);
+
+  ram[0x100] = 4;
+  vram[0x2000] = 0x22;
+  CHECK(snapshots_restore(snaps, 2));
+  CHECK_EQ(ram[0x100], 1);
+  CHECK_EQ(vram[0x2000], 0);
+  CHECK_EQ(snapshots_count(snaps), 1);
+
+  CHECK(!snapshots_restore(snaps, 1));
+
+  snapshots_destroy(snaps);
+  dc_destroy(dc);
+}
+
+TEST(snapshots_drop_oldest) {
+  struct dreamcast *dc = dc_create();
+  CHECK(dc_load(dc, NULL));
+  uint8_t *ram = mem_ram(dc->mem, 0);
+
+  struct snapshots *snaps = snapshots_create(dc, 2, INT64_MAX, 1);
+  CHECK_NOTNULL(snaps);
+
+  for (int i = 1; i <= 3; i++) {
+    ram[0x100] = i;
+    CHECK(snapshots_take(snaps));
+  }
+
+  CHECK_EQ(snapshots_count(snaps), 2);
+  CHECK(snapshots_restore(snaps, 1));
+  CHECK_EQ(ram[0x100], 2);
+
+  snapshots_destroy(snaps);
+  dc_destroy(dc);
+}
+
+TEST(snapshots_size_limit) {
+  struct dreamcast *dc = dc_create();
+  CHECK(dc_load(dc, NULL));
+  uint8_t *ram = mem_ram(dc->mem, 0);
+
+  /* too small for more than the latest snapshot */
+  struct snapshots *snaps = snapshots_create(dc, 8, 1, 1);
+  CHECK_NOTNULL(snaps);
+
+  for (int i = 1; i <= 3; i++) {
+    ram[0x100] = i;
+    CHECK(snapshots_take(snaps));
+    CHECK_EQ(snapshots_count(snaps), 1);
+  }
+
+  ram[0x100] = 0;
+  CHECK(snapshots_restore(snaps, 0));
+  CHECK_EQ(ram[0x100], 3);
+
+  snapshots_destroy(snaps);
+  dc_destroy(dc);
+}
+
+TEST(snapshots_single_uncompressed) {
+  struct dreamcast *dc = dc_create();
+  CHECK(dc_load(dc, NULL));
+  uint8_t *ram = mem_ram(dc->mem, 0);
+
+  struct snapshots *snaps = snapshots_create(dc, 1, INT64_MAX, 0);
+  CHECK_NOTNULL(snaps);
+
+  /* the memory copy must stay in sync as the only snapshot is replaced */
+  for (int i = 1; i <= 3; i++) {
+    ram[0x100] = i;
+    CHECK(snapshots_take(snaps));
+    ram[0x100] = 0xff;
+    CHECK(snapshots_restore(snaps, 0));
+    CHECK_EQ(ram[0x100], i);
+  }
+
+  snapshots_destroy(snaps);
+  dc_destroy(dc);
+}
@@ -0,0 +1,157 @@
+#include "core/core.h"
+#include "guest/dreamcast.h"
+#include "guest/scheduler.h"
+#include "retest.h"
+
+#define MAX_FIRED 64
+
+struct fired {
+  int order[MAX_FIRED];
+  int num;
+};
+
+static struct fired fired;
+
+static void record_timer(void *data) {
+  int id = (int)(intptr_t)data;
+  CHECK_LT(fired.num, MAX_FIRED);
+  fired.order[fired.num++] = id;
+}
+
+static void init_dreamcast(struct dreamcast *dc) {
+  memset(dc, 0, sizeof(*dc));
+  dc->running = 1;
+}
+
+TEST(scheduler_order) {
+  struct dreamcast dc;
+  init_dreamcast(&dc);
+  struct scheduler *sched = sched_create(&dc);
+
+  memset(&fired, 0, sizeof(fired));
+
+  /* timers expiring at the same time fire in the order they were started */
+  sched_start_timer(sched, &record_timer, (void *)3, 300);
+  sched_start_timer(sched, &record_timer, (void *)1, 100);
+  sched_start_timer(sched, &record_timer, (void *)4, 300);
+  struct timer *cancelled =
+      sched_start_timer(sched, &record_timer, (void *)0, 200);
+  sched_start_timer(sched, &record_timer, (void *)2, 250);
+  sched_start_timer(sched, &record_timer, (void *)5, 400);
+
+  CHECK_EQ(sched_remaining_time(sched, cancelled), 200);
+  sched_cancel_timer(sched, cancelled);
+
+  sched_tick(sched, 350);
+  CHECK_EQ(fired.num, 4);
+  for (int i = 0; i < fired.num; i++) {
+    CHECK_EQ(fired.order[i], i + 1);
+  }
+
+  sched_tick(sched, 50);
+  CHECK_EQ(fired.num, 5);
+  CHECK_EQ(fired.order[4], 5);
+
+  sched_destroy(sched);
+}
+
+static void nop_timer(void *data) {}
+
+static void restart_timer(void *data) {
+  struct scheduler *sched = data;
+  fired.num++;
+  sched_start_timer(sched, &nop_timer, NULL, 1000000);
+}
+
+TEST(scheduler_grow) {
+  struct dreamcast dc;
+  init_dreamcast(&dc);
+  struct scheduler *sched = sched_create(&dc);
+
+  memset(&fired, 0, sizeof(fired));
+
+  /* start many more timers than the initial pool holds */
+  static struct timer *timers[1024];
+  for (int i = 0; i < ARRAY_SIZE(timers); i++) {
+    timers[i] = sched_start_timer(sched, &restart_timer, sched, 1000 + i);
+  }
+  for (int i = 0; i < ARRAY_SIZE(timers); i += 2) {
+    sched_cancel_timer(sched, timers[i]);
+  }
+
+  /* timers starting a new timer from their callback */
+  sched_tick(sched, 1000 + ARRAY_SIZE(timers));
+  CHECK_EQ(fired.num, ARRAY_SIZE(timers) / 2);
+
+  sched_destroy(sched);
+}
+
+static struct scheduler *lazy_sched;
+static struct timer *lazy_probe;
+static int64_t lazy_fired_at[2];
+
+static void lazy_timer(void *data) {
+  int id = (int)(intptr_t)data;
+  lazy_fired_at[id] = INT64_C(1000000000) -
+                      sched_remaining_time(lazy_sched, lazy_probe);
+  record_timer(data);
+}
+
+TEST(scheduler_lazy) {
+  struct dreamcast dc;
+  init_dreamcast(&dc);
+  struct scheduler *sched = sched_create(&dc);
+
+  memset(&fired, 0, sizeof(fired));
+  lazy_sched = sched;
+  lazy_probe = sched_start_timer(sched, &nop_timer, NULL, INT64_C(1000000000));
+
+  /* a lazy timer alone doesn't end the slice until its slack runs out */
+  sched_start_lazy_timer(sched, &lazy_timer, (void *)0, 100);
+  sched_tick(sched, 100 + SCHED_LAZY_SLACK * 2);
+  CHECK_EQ(fired.num, 1);
+  CHECK_EQ(lazy_fired_at[0], 100 + SCHED_LAZY_SLACK);
+
+  /* but it fires along with, and before, a later strict timer */
+  int64_t base = 100 + SCHED_LAZY_SLACK * 2;
+  sched_start_lazy_timer(sched, &lazy_timer, (void *)1, 100);
+  sched_start_timer(sched, &record_timer, (void *)2, 200);
+  sched_tick(sched, 1000);
+  CHECK_EQ(fired.num, 3);
+  CHECK_EQ(fired.order[1], 1);
+  CHECK_EQ(fired.order[2], 2);
+  CHECK_EQ(lazy_fired_at[1], base + 200);
+
+  sched_destroy(sched);
+}
+
+static struct scheduler *late_sched;
+
+static void late_timer(void *data) {
+  /* timers are expired after the slice, where it has no start of its own */
+  CHECK_EQ(sched_slice_start(late_sched), sched_base_time(late_sched));
+
+  record_timer(data);
+
+  /* a timer which expired earlier in the slice still fires */
+  if (fired.num == 1) {
+    sched_start_timer(late_sched, &record_timer, (void *)1, -50);
+  }
+}
+
+TEST(scheduler_late) {
+  struct dreamcast dc;
+  init_dreamcast(&dc);
+  struct scheduler *sched = sched_create(&dc);
+
+  memset(&fired, 0, sizeof(fired));
+  late_sched = sched;
+
+  sched_start_timer(sched, &late_timer, (void *)0, 100);
+  sched_tick(sched, 100);
+  CHECK_EQ(fired.num, 2);
+  CHECK_EQ(fired.order[1], 1);
+  CHECK_EQ(sched_slice_start(sched), 100);
+
+  sched_destroy(sched);
+}
@@ -0,0 +1,70 @@
+#include "guest/dreamcast.h"
+#include "guest/memory.h"
+#include "guest/sh4/sh4.h"
+#include "jit/jit.h"
+#include "retest.h"
+
+#define CODE_A_ADDR 0x8c010000
+#define CODE_B_ADDR 0x8c020000
+#define CCR_ADDR 0xff00001c
+#define CCR_ICI 0x800
+
+static uint32_t run_code(struct sh4 *sh4, uint32_t addr) {
+  sh4->ctx.pc = addr;
+  sh4->ctx.pr = addr;
+  jit_run(sh4->jit, 100);
+  return sh4->ctx.r[0];
+}
+
+/* mov #imm, r0, followed by an rts and its delay slot */
+static void write_code(struct dreamcast *dc, uint32_t addr, uint8_t imm) {
+  sh4_write16(dc->mem, addr, 0xe000 | imm);
+  sh4_write16(dc->mem, addr + 2, 0x000b);
+  sh4_write16(dc->mem, addr + 4, 0x0009);
+}
+
+static int block_valid(struct jit *jit, uint32_t addr) {
+  list_for_each_entry(block, &jit->blocks, struct jit_block, it) {
+    if (block->guest_addr == addr && block->state == JIT_STATE_VALID) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void ignore_write(void *data, uint32_t addr, int size) {}
+
+TEST(sh4_ccn_ici) {
+  struct dreamcast *dc = dc_create();
+  CHECK(dc_load(dc, NULL));
+  struct sh4 *sh4 = dc->sh4;
+
+  write_code(dc, CODE_A_ADDR, 1);
+  write_code(dc, CODE_B_ADDR, 3);
+  CHECK_EQ(run_code(sh4, CODE_A_ADDR), 1u);
+  CHECK_EQ(run_code(sh4, CODE_B_ADDR), 3u);
+
+  /* the code is stale until the instruction cache is reset */
+  write_code(dc, CODE_A_ADDR, 2);
+  CHECK_EQ(run_code(sh4, CODE_A_ADDR), 1u);
+
+  sh4_write32(dc->mem, CCR_ADDR, CCR_ICI);
+  CHECK_EQ(run_code(sh4, CODE_A_ADDR), 2u);
+  CHECK_EQ(run_code(sh4, CODE_B_ADDR), 3u);
+
+  /* once ram writes are tracked, a reset only invalidates the written code */
+  int tracked = sh4_scan_ram_writes(dc->mem, &ignore_write, NULL);
+
+  write_code(dc, CODE_A_ADDR, 4);
+  sh4_write32(dc->mem, CCR_ADDR, CCR_ICI);
+
+  if (tracked) {
+    CHECK(!block_valid(sh4->jit, CODE_A_ADDR));
+    CHECK(block_valid(sh4->jit, CODE_B_ADDR));
+  }
+
+  CHECK_EQ(run_code(sh4, CODE_A_ADDR), 4u);
+  CHECK_EQ(run_code(sh4, CODE_B_ADDR), 3u);
+
+  dc_destroy(dc);
+}
@@ -0,0 +1,133 @@
+#include "guest/dreamcast.h"
+#include "guest/memory.h"
+#include "guest/sh4/sh4.h"
+#include "jit/jit.h"
+#include "jit/jit_frontend.h"
+#include "retest.h"
+
+#define DBG_CODE_ADDR 0x8c010000
+
+/* nop, nop, add #1, r0, nop, followed by an rts and its delay slot */
+static const uint16_t dbg_code[] = {0x0009, 0x0009, 0x7001, 0x0009,
+                                    0x000b, 0x0009};
+
+static int dbg_block_size(struct sh4 *sh4, uint32_t addr) {
+  int size;
+  sh4->frontend->analyze_code(sh4->frontend, addr, 0, &size);
+  return size;
+}
+
+TEST(sh4_dbg_breakpoint) {
+  struct dreamcast *dc = dc_create();
+  CHECK(dc_load(dc, NULL));
+  struct sh4 *sh4 = dc->sh4;
+  struct device *dev = (struct device *)sh4;
+
+  for (int i = 0; i < (int)ARRAY_SIZE(dbg_code); i++) {
+    sh4_write16(dc->mem, DBG_CODE_ADDR + i * 2, dbg_code[i]);
+  }
+
+  uint32_t bp_addr = DBG_CODE_ADDR + 4;
+  CHECK_EQ(dbg_block_size(sh4, DBG_CODE_ADDR), 12);
+
+  /* the block ends before the breakpoint, which begins its own block */
+  sh4_dbg_add_breakpoint(dev, 0, bp_addr);
+  CHECK_EQ(dbg_block_size(sh4, DBG_CODE_ADDR), 4);
+  CHECK_EQ(dbg_block_size(sh4, bp_addr), 2);
+
+  /* guest memory is left untouched */
+  CHECK_EQ(sh4_read16(dc->mem, bp_addr), 0x7001);
+
+  /* execution stops on the breakpoint, before running the instruction */
+  sh4->ctx.pc = DBG_CODE_ADDR;
+  sh4->ctx.pr = DBG_CODE_ADDR;
+  sh4->ctx.r[0] = 0;
+  jit_run(sh4->jit, 1000);
+  CHECK_EQ(sh4->ctx.pc, bp_addr);
+  CHECK_EQ(sh4->ctx.r[0], 0);
+
+  /* and resumes past it once removed */
+  sh4_dbg_remove_breakpoint(dev, 0, bp_addr);
+  CHECK_EQ(dbg_block_size(sh4, DBG_CODE_ADDR), 12);
+
+  jit_run(sh4->jit, 1000);
+  CHECK_GT(sh4->ctx.r[0], 0);
+
+  /* watchpoints are ignored rather than being patched into memory */
+  sh4_dbg_add_breakpoint(dev, 2, bp_addr);
+  CHECK_EQ(dbg_block_size(sh4, DBG_CODE_ADDR), 12);
+  CHECK_EQ(sh4_read16(dc->mem, bp_addr), 0x7001);
+  sh4_dbg_remove_breakpoint(dev, 2, bp_addr);
+
+  dc_destroy(dc);
+}
+
+static void dbg_entry_trap(void *data) {
+  int *hits = data;
+  (*hits)++;
+}
+
+TEST(sh4_dbg_entry_trap) {
+  struct dreamcast *dc = dc_create();
+  CHECK(dc_load(dc, NULL));
+  struct sh4 *sh4 = dc->sh4;
+
+  for (int i = 0; i < (int)ARRAY_SIZE(dbg_code); i++) {
+    sh4_write16(dc->mem, DBG_CODE_ADDR + i * 2, dbg_code[i]);
+  }
+
+  /* entering any mirror of the address traps, before running its
+     instruction */
+  int hits = 0;
+  sh4_set_entry_trap(sh4, DBG_CODE_ADDR | 0x20000000, &dbg_entry_trap, &hits);
+
+  sh4->ctx.pc = DBG_CODE_ADDR;
+  sh4->ctx.pr = DBG_CODE_ADDR;
+  sh4->ctx.r[0] = 0;
+  jit_run(sh4->jit, 1000);
+  CHECK_EQ(hits, 1);
+  CHECK_EQ(sh4->ctx.pc, DBG_CODE_ADDR);
+  CHECK_EQ(sh4->ctx.r[0], 0);
+
+  /* the trap only fires once, leaving the code as it was */
+  jit_run(sh4->jit, 1000);
+  CHECK_EQ(hits, 1);
+  CHECK_GT(sh4->ctx.r[0], 0);
+  CHECK_EQ(dbg_block_size(sh4, DBG_CODE_ADDR), 12);
+
+  dc_destroy(dc);
+}
+
+TEST(sh4_dbg_entry_trap_fetch) {
+  struct dreamcast *dc = dc_create();
+  CHECK(dc_load(dc, NULL));
+  struct sh4 *sh4 = dc->sh4;
+  struct jit_frontend *frontend = sh4->frontend;
+
+  for (int i = 0; i < (int)ARRAY_SIZE(dbg_code); i++) {
+    sh4_write16(dc->mem, DBG_CODE_ADDR + i * 2, dbg_code[i]);
+  }
+
+  int hits = 0;
+  sh4_set_entry_trap(sh4, DBG_CODE_ADDR, &dbg_entry_trap, &hits);
+
+  /* code run without being translated fetches the trap in place of the
+     instruction */
+  uint32_t data;
+  const struct jit_opdef *def =
+      frontend->fetch_op(frontend, DBG_CODE_ADDR, &data);
+  sh4->ctx.pc = 0;
+  sh4->ctx.run_cycles = 100;
+  def->fallback(sh4->guest, DBG_CODE_ADDR, data);
+  CHECK_EQ(hits, 1);
+  CHECK_EQ(sh4->ctx.pc, DBG_CODE_ADDR);
+  CHECK_LT(sh4->ctx.run_cycles, 0);
+
+  /* and the instruction once the trap has fired */
+  def = frontend->fetch_op(frontend, DBG_CODE_ADDR, &data);
+  def->fallback(sh4->guest, DBG_CODE_ADDR, data);
+  CHECK_EQ(hits, 1);
+  CHECK_EQ(data, 0x0009u);
+
+  dc_destroy(dc);
+}
@@ -0,0 +1,52 @@
+#include "guest/dreamcast.h"
+#include "guest/memory.h"
+#include "guest/sh4/sh4.h"
+#include "jit/jit.h"
+#include "jit/jit_frontend.h"
+#include "options.h"
+#include "retest.h"
+
+#define LIT_CODE_ADDR 0x8c010000
+#define LIT_ADDR (LIT_CODE_ADDR + 8)
+
+/* mov.l @(1,pc), r0, followed by an rts and its delay slot, padding, and the
+   literal pool */
+static const uint16_t lit_code[] = {0xd001, 0x000b, 0x0009, 0x0009};
+
+TEST(sh4_literals_folded) {
+  int fold_literals = OPTION_jit_fold_literals;
+  OPTION_jit_fold_literals = 1;
+
+  struct dreamcast *dc = dc_create();
+  CHECK(dc_load(dc, NULL));
+  struct sh4 *sh4 = dc->sh4;
+
+  for (int i = 0; i < (int)ARRAY_SIZE(lit_code); i++) {
+    sh4_write16(dc->mem, LIT_CODE_ADDR + i * 2, lit_code[i]);
+  }
+  sh4_write32(dc->mem, LIT_ADDR, 0x12345678);
+
+  /* the block's extent covers the literal pool */
+  int size;
+  sh4->frontend->analyze_code(sh4->frontend, LIT_CODE_ADDR, 0, &size);
+  CHECK_EQ(size, 6);
+  CHECK_EQ(sh4->frontend->code_extent(sh4->frontend, LIT_CODE_ADDR, size),
+           12);
+
+  sh4->ctx.pc = LIT_CODE_ADDR;
+  sh4->ctx.pr = LIT_CODE_ADDR;
+  jit_run(sh4->jit, 100);
+  CHECK_EQ(sh4->ctx.r[0], 0x12345678);
+
+  /* overwriting only the literal pool, as a dma would, recompiles the code
+     folding it */
+  sh4_write32(dc->mem, LIT_ADDR, 0xdeadbeef);
+  sh4_ccn_invalidate_code(sh4, LIT_ADDR, 4);
+
+  jit_run(sh4->jit, 100);
+  CHECK_EQ(sh4->ctx.r[0], 0xdeadbeef);
+
+  dc_destroy(dc);
+
+  OPTION_jit_fold_literals = fold_literals;
+}
@@ -0,0 +1,130 @@
+#include <math.h>
+#include "core/sort.h"
+#include "retest.h"
+
+#define NUM_ELEMENTS 4096
+
+static float sort_keys[NUM_ELEMENTS];
+
+static int sort_cmp_index(const void *a, const void *b) {
+  return sort_keys[*(const int *)a] <= sort_keys[*(const int *)b];
+}
+
+TEST(rsort_float_key_order) {
+  float values[] = {-INFINITY, -1000.0f, -1.5f, -0.0f, 0.0f,
+                    1e-30f,    0.5f,     1.0f,  1e30f, INFINITY};
+
+  for (int i = 1; i < (int)(sizeof(values) / sizeof(values[0])); i++) {
+    CHECK_LE(rsort_float_key(values[i - 1]), rsort_float_key(values[i]));
+  }
+
+  CHECK_EQ(rsort_float_key(-0.0f), rsort_float_key(0.0f));
+}
+
+TEST(rsort_matches_msort) {
+  static uint32_t keys[NUM_ELEMENTS];
+  static uint32_t tmp_keys[NUM_ELEMENTS];
+  static int values[NUM_ELEMENTS];
+  static int tmp_values[NUM_ELEMENTS];
+  static int expected[NUM_ELEMENTS];
+  static int tmp[NUM_ELEMENTS];
+
+  /* use a small range of keys such that there are plenty of duplicates to
+     verify the sort is stable */
+  uint32_t seed = 1;
+
+  for (int i = 0; i < NUM_ELEMENTS; i++) {
+    seed = seed * 1103515245 + 12345;
+    sort_keys[i] = (float)((int)(seed >> 16) % 512 - 256) / 8.0f;
+    keys[i] = rsort_float_key(sort_keys[i]);
+    values[i] = i;
+    expected[i] = i;
+  }
+
+  msort_noalloc(expected, tmp, NUM_ELEMENTS, sizeof(int), &sort_cmp_index);
+  rsort_noalloc(keys, values, tmp_keys, tmp_values, NUM_ELEMENTS);
+
+  for (int i = 0; i < NUM_ELEMENTS; i++) {
+    CHECK_EQ(values[i], expected[i]);
+    CHECK_EQ(keys[i], rsort_float_key(sort_keys[values[i]]));
+  }
+}
+
+TEST(rsort_equal_keys) {
+  uint32_t keys[] = {7, 7, 7, 7};
+  uint32_t tmp_keys[4];
+  int values[] = {0, 1, 2, 3};
+  int tmp_values[4];
+
+  /* every pass is skipped, leaving the input as is */
+  rsort_noalloc(keys, values, tmp_keys, tmp_values, 4);
+
+  for (int i = 0; i < 4; i++) {
+    CHECK_EQ(values[i], i);
+  }
+}
+
+static void check_sorted_stable(const int *values, int num) {
+  for (int i = 1; i < num; i++) {
+    float prev = sort_keys[values[i - 1]];
+    float curr = sort_keys[values[i]];
+    CHECK(prev < curr || (prev == curr && values[i - 1] < values[i]));
+  }
+}
+
+TEST(nsort_sizes) {
+  /* sort every size the network supports, with plenty of duplicate keys */
+  uint32_t seed = 7;
+
+  for (int num = 0; num <= NSORT_MAX_SIZE; num++) {
+    uint32_t keys[NSORT_MAX_SIZE];
+    int values[NSORT_MAX_SIZE];
+
+    for (int i = 0; i < num; i++) {
+      seed = seed * 1103515245 + 12345;
+      sort_keys[i] = (float)((seed >> 16) % 4);
+      keys[i] = rsort_float_key(sort_keys[i]);
+      values[i] = i;
+    }
+
+    nsort(keys, values, num);
+    check_sorted_stable(values, num);
+
+    for (int i = 0; i < num; i++) {
+      CHECK_EQ(keys[i], rsort_float_key(sort_keys[values[i]]));
+    }
+  }
+}
+
+struct sort_pair {
+  int key;
+  int index;
+};
+
+static int sort_cmp_pair(const void *a, const void *b) {
+  const struct sort_pair *lhs = a;
+  const struct sort_pair *rhs = b;
+  return lhs->key <= rhs->key;
+}
+
+TEST(msort_parallel_stable) {
+  /* the parallel sort only kicks in for large inputs */
+  static struct sort_pair pairs[NUM_ELEMENTS * 16];
+  int num = NUM_ELEMENTS * 16;
+  uint32_t seed = 3;
+
+  for (int i = 0; i < num; i++) {
+    seed = seed * 1103515245 + 12345;
+    pairs[i].key = (int)(seed >> 16) % 64;
+    pairs[i].index = i;
+  }
+
+  msort_parallel(pairs, num, sizeof(struct sort_pair), &sort_cmp_pair);
+
+  for (int i = 1; i < num; i++) {
+    struct sort_pair *prev = &pairs[i - 1];
+    struct sort_pair *curr = &pairs[i];
+    CHECK(prev->key < curr->key ||
+          (prev->key == curr->key && prev->index < curr->index));
+  }
+}
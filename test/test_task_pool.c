@@ -0,0 +1,117 @@
+#include "core/task_pool.h"
+#include "core/thread.h"
+#include "retest.h"
+
+#define NUM_TASKS 1024
+#define NUM_CHILDREN 16
+
+struct task_test {
+  struct task_group *group;
+  volatile int count;
+  int order[8];
+  volatile int num_order;
+};
+
+static void task_test_count(void *data) {
+  struct task_test *test = data;
+  atomic_fetch_add_int(&test->count, 1);
+}
+
+static void task_test_spawn(void *data) {
+  struct task_test *test = data;
+
+  /* tasks run from inside of the pool are waited on with the group */
+  for (int i = 0; i < NUM_CHILDREN; i++) {
+    task_group_run(test->group, &task_test_count, test, TASK_PRIO_NORMAL);
+  }
+}
+
+struct task_test_arg {
+  struct task_test *test;
+  int prio;
+};
+
+static void task_test_record(void *data) {
+  struct task_test_arg *arg = data;
+  struct task_test *test = arg->test;
+  test->order[test->num_order++] = arg->prio;
+}
+
+TEST(task_group_wait) {
+  struct task_pool *pool = task_pool_create(4, NULL);
+  struct task_test test = {0};
+  test.group = task_group_create(pool);
+
+  for (int i = 0; i < NUM_TASKS; i++) {
+    task_group_run(test.group, &task_test_count, &test, i % TASK_NUM_PRIOS);
+  }
+
+  task_group_wait(test.group);
+  CHECK(task_group_done(test.group));
+  CHECK_EQ(test.count, NUM_TASKS);
+
+  /* groups can be reused once waited on */
+  for (int i = 0; i < NUM_TASKS; i++) {
+    task_group_run(test.group, &task_test_spawn, &test, TASK_PRIO_LOW);
+  }
+
+  task_group_wait(test.group);
+  CHECK_EQ(test.count, NUM_TASKS + NUM_TASKS * NUM_CHILDREN);
+
+  task_group_destroy(test.group);
+  task_pool_destroy(pool);
+}
+
+TEST(task_group_continue) {
+  struct task_pool *pool = task_pool_create(2, NULL);
+  struct task_test test = {0};
+  test.group = task_group_create(pool);
+
+  /* with nothing running, the continuation runs immediately */
+  task_group_continue(test.group, &task_test_count, &test);
+  CHECK_EQ(test.count, 1);
+  CHECK(task_group_done(test.group));
+
+  /* otherwise it runs after each task, and may run more of its own */
+  for (int i = 0; i < NUM_TASKS; i++) {
+    task_group_run(test.group, &task_test_count, &test, TASK_PRIO_NORMAL);
+  }
+  task_group_continue(test.group, &task_test_spawn, &test);
+
+  task_group_wait(test.group);
+  CHECK_EQ(test.count, 1 + NUM_TASKS + NUM_CHILDREN);
+
+  task_group_destroy(test.group);
+  task_pool_destroy(pool);
+}
+
+TEST(task_group_priority) {
+  /* without any workers, tasks only run on the waiting thread, which takes
+     them in order of priority */
+  struct task_pool *pool = task_pool_create(0, NULL);
+  struct task_test test = {0};
+  test.group = task_group_create(pool);
+
+  struct task_test_arg args[] = {
+      {&test, TASK_PRIO_LOW},
+      {&test, TASK_PRIO_NORMAL},
+      {&test, TASK_PRIO_HIGH},
+      {&test, TASK_PRIO_NORMAL},
+  };
+
+  for (int i = 0; i < 4; i++) {
+    task_group_run(test.group, &task_test_record, &args[i], args[i].prio);
+  }
+
+  CHECK(!task_group_done(test.group));
+  task_group_wait(test.group);
+
+  CHECK_EQ(test.num_order, 4);
+  CHECK_EQ(test.order[0], TASK_PRIO_HIGH);
+  CHECK_EQ(test.order[1], TASK_PRIO_NORMAL);
+  CHECK_EQ(test.order[2], TASK_PRIO_NORMAL);
+  CHECK_EQ(test.order[3], TASK_PRIO_LOW);
+
+  task_group_destroy(test.group);
+  task_pool_destroy(pool);
+}
@@ -0,0 +1,77 @@
+#include "core/core.h"
+#include "guest/pvr/tex.h"
+#include "retest.h"
+
+#define TEX_SIZE 64
+
+static uint8_t extend(int c, int bits) {
+  /* gl expands normalized components by replicating their bits */
+  int v = c << (8 - bits);
+  while (bits < 8) {
+    v |= v >> bits;
+    bits *= 2;
+  }
+  return (uint8_t)v;
+}
+
+static void native_to_rgba(enum pxl_format fmt, uint16_t t, uint8_t *rgba) {
+  switch (fmt) {
+    case PXL_RGBA5551:
+      rgba[0] = extend(t >> 11, 5);
+      rgba[1] = extend((t >> 6) & 0x1f, 5);
+      rgba[2] = extend((t >> 1) & 0x1f, 5);
+      rgba[3] = (t & 1) ? 0xff : 0;
+      break;
+    case PXL_RGB565:
+      rgba[0] = extend(t >> 11, 5);
+      rgba[1] = extend((t >> 5) & 0x3f, 6);
+      rgba[2] = extend(t & 0x1f, 5);
+      rgba[3] = 0xff;
+      break;
+    case PXL_RGBA4444:
+      rgba[0] = extend(t >> 12, 4);
+      rgba[1] = extend((t >> 8) & 0xf, 4);
+      rgba[2] = extend((t >> 4) & 0xf, 4);
+      rgba[3] = extend(t & 0xf, 4);
+      break;
+    default:
+      LOG_FATAL("unexpected format %d", fmt);
+  }
+}
+
+TEST(tex_decode_native) {
+  static uint8_t src[TEX_SIZE * TEX_SIZE * 4];
+  static uint8_t rgba[TEX_SIZE * TEX_SIZE * 4];
+  static uint16_t native[TEX_SIZE * TEX_SIZE];
+
+  for (int i = 0; i < (int)sizeof(src); i++) {
+    src[i] = (uint8_t)(i * 2654435761u >> 24);
+  }
+
+  int texture_fmts[] = {PVR_TEX_TWIDDLED, PVR_TEX_BITMAP, PVR_TEX_VQ};
+  int pixel_fmts[] = {PVR_PXL_ARGB1555, PVR_PXL_RGB565, PVR_PXL_ARGB4444};
+
+  for (int i = 0; i < (int)ARRAY_SIZE(texture_fmts); i++) {
+    for (int j = 0; j < (int)ARRAY_SIZE(pixel_fmts); j++) {
+      enum pxl_format fmt = pvr_tex_native_format(pixel_fmts[j]);
+      CHECK_NE(fmt, PXL_RGBA);
+
+      pvr_tex_decode(src, TEX_SIZE, TEX_SIZE, TEX_SIZE, texture_fmts[i],
+                     pixel_fmts[j], NULL, 0, PXL_RGBA, rgba, sizeof(rgba));
+      pvr_tex_decode(src, TEX_SIZE, TEX_SIZE, TEX_SIZE, texture_fmts[i],
+                     pixel_fmts[j], NULL, 0, fmt, (uint8_t *)native,
+                     sizeof(native));
+
+      /* each native texel must sample as the expanded texel does */
+      for (int k = 0; k < TEX_SIZE * TEX_SIZE; k++) {
+        uint8_t expected[4];
+        native_to_rgba(fmt, native[k], expected);
+        CHECK_EQ(memcmp(expected, &rgba[k * 4], 4), 0);
+      }
+    }
+  }
+
+  /* everything else is always expanded */
+  CHECK_EQ(pvr_tex_native_format(PVR_PXL_YUV422), PXL_RGBA);
+  CHECK_EQ(pvr_tex_native_format(PVR_PXL_8BPP), PXL_RGBA);
+}
@@ -0,0 +1,65 @@
+#include "core/core.h"
+#include "core/filesystem.h"
+#include "file/trace.h"
+#include "guest/pvr/ta.h"
+#include "retest.h"
+
+TEST(trace_lazy_index) {
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s" PATH_SEPARATOR "retest.trace",
+           fs_appdir());
+
+  static struct ta_context ctx;
+  uint8_t texture[64];
+  union tsp tsp = {0};
+  union tcw a = {0};
+  union tcw b = {0};
+  b.texture_addr = 1;
+
+  /* texture a is written twice, the second write overriding the first */
+  struct trace_writer *writer = trace_writer_open(path);
+  CHECK_NOTNULL(writer);
+  memset(texture, 1, sizeof(texture));
+  trace_writer_insert_texture(writer, tsp, a, 0, NULL, 0, texture,
+                              sizeof(texture));
+  trace_writer_insert_texture(writer, tsp, b, 0, NULL, 0, texture,
+                              sizeof(texture));
+  ctx.video_width = 640;
+  trace_writer_render_context(writer, &ctx);
+  memset(texture, 2, sizeof(texture));
+  trace_writer_insert_texture(writer, tsp, a, 1, NULL, 0, texture,
+                              sizeof(texture));
+  ctx.video_width = 320;
+  trace_writer_render_context(writer, &ctx);
+  trace_writer_close(writer);
+
+  struct trace *trace = trace_parse(path);
+  CHECK_NOTNULL(trace);
+
+  /* commands resolve without the rest of the trace being indexed */
+  struct trace_cmd cmd;
+  CHECK(trace_get_cmd(trace, 2, &cmd));
+  CHECK_EQ(cmd.type, TRACE_CMD_CONTEXT);
+  CHECK_EQ(cmd.context.video_width, 640);
+
+  CHECK(trace_get_cmd(trace, 3, &cmd));
+  CHECK_EQ(cmd.type, TRACE_CMD_TEXTURE);
+  CHECK_EQ(cmd.override, 0);
+  CHECK_EQ(cmd.texture.texture[0], 2);
+
+  /* identical texture data is only stored once */
+  struct trace_cmd first;
+  CHECK(trace_get_cmd(trace, 0, &first));
+  CHECK(trace_get_cmd(trace, 1, &cmd));
+  CHECK_EQ(cmd.override, -1);
+  CHECK_EQ(cmd.texture.texture[63], 1);
+  CHECK_EQ(cmd.texture.texture, first.texture.texture);
+
+  CHECK(trace_get_cmd(trace, 4, &cmd));
+  CHECK_EQ(cmd.context.video_width, 320);
+  CHECK(!trace_get_cmd(trace, 5, &cmd));
+  CHECK_EQ(trace_num_frames(trace), 2);
+
+  trace_destroy(trace);
+  remove(path);
+}
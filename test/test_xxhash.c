@@ -0,0 +1,36 @@
+#include <string.h>
+#include "core/xxhash.h"
+#include "retest.h"
+
+static uint64_t hash_str(const char *str, uint64_t seed) {
+  return xxh64(str, strlen(str), seed);
+}
+
+TEST(xxh64_reference) {
+  /* short inputs only exercise the tail processing */
+  CHECK_EQ(hash_str("", 0), UINT64_C(0xef46db3751d8e999));
+  CHECK_EQ(hash_str("a", 0), UINT64_C(0xd24ec4f1a98c6e5b));
+  CHECK_EQ(hash_str("abc", 0), UINT64_C(0x44bc2cf5ad770999));
+
+  /* inputs of at least 32 bytes go through the striped loop */
+  CHECK_EQ(hash_str("Nobody inspects the spammish repetition", 0),
+           UINT64_C(0xfbcea83c8a378bf1));
+}
+
+TEST(xxh64_seed) {
+  CHECK_NE(hash_str("abc", 0), hash_str("abc", 1));
+}
+
+TEST(xxh64_unaligned) {
+  uint8_t buffer[257];
+
+  for (int i = 0; i < (int)sizeof(buffer); i++) {
+    buffer[i] = (uint8_t)(i * 7);
+  }
+
+  uint8_t copy[258];
+  memcpy(copy + 1, buffer, sizeof(buffer));
+
+  CHECK_EQ(xxh64(buffer, sizeof(buffer), 0),
+           xxh64(copy + 1, sizeof(buffer), 0));
+}
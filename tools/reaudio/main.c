@@ -0,0 +1,134 @@
+/*
+ * headless audio-only runner
+ *
+ * runs a game without a render client for a fixed amount of guest time,
+ * hashing the aica output and optionally dumping it to a wav file, so sound
+ * driver regressions can be checked without a gpu
+ *
+ * with no client attached, dc_start_render returns immediately and the ta's
+ * end of render interrupts are raised by ta_render_context_end as usual, so
+ * contexts are never converted or rendered
+ */
+
+#include "core/core.h"
+#include "core/filesystem.h"
+#include "core/option.h"
+#include "core/time.h"
+#include "core/xxhash.h"
+#include "file/async_writer.h"
+#include "file/wav.h"
+#include "guest/aica/aica.h"
+#include "guest/dreamcast.h"
+
+DEFINE_OPTION_INT(seconds, 60, "Seconds of guest time to run for");
+DEFINE_OPTION_STRING(wav, "", "Path to dump the audio output to");
+
+/* audio is hashed in fixed size blocks, so the result doesn't depend on the
+   batch sizes the aica happens to push frames in */
+#define HASH_BLOCK_FRAMES 4096
+#define WAV_BUFFER_SIZE (AICA_SAMPLE_FREQ * 4 * 4)
+
+static struct {
+  int16_t block[HASH_BLOCK_FRAMES * 2];
+  int block_frames;
+  uint64_t hash;
+  int64_t total_frames;
+  struct async_writer *wav;
+} audio;
+
+static void hash_block() {
+  audio.hash = xxh64(audio.block, audio.block_frames * 4, audio.hash);
+  audio.block_frames = 0;
+}
+
+static void push_audio(void *userdata, const int16_t *data, int frames) {
+  if (audio.wav) {
+    async_writer_write(audio.wav, data, frames * 4);
+  }
+
+  audio.total_frames += frames;
+
+  while (frames) {
+    int n = MIN(frames, HASH_BLOCK_FRAMES - audio.block_frames);
+    memcpy(&audio.block[audio.block_frames * 2], data, n * 4);
+    audio.block_frames += n;
+    data += n * 2;
+    frames -= n;
+
+    if (audio.block_frames == HASH_BLOCK_FRAMES) {
+      hash_block();
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  if (!options_parse(&argc, &argv)) {
+    LOG_INFO("reaudio [--seconds=n] [--wav=out.wav] [/path/to/game]");
+    return EXIT_FAILURE;
+  }
+
+  /* set application directory so the bios and flash are found */
+  char appdir[PATH_MAX];
+  char userdir[PATH_MAX];
+  int r = fs_userdir(userdir, sizeof(userdir));
+  CHECK(r);
+  snprintf(appdir, sizeof(appdir), "%s" PATH_SEPARATOR ".redream", userdir);
+  fs_set_appdir(appdir);
+
+  struct dreamcast *dc = dc_create();
+  if (!dc) {
+    LOG_WARNING("failed to create machine");
+    return EXIT_FAILURE;
+  }
+
+  dc->push_audio = &push_audio;
+
+  if (OPTION_wav[0]) {
+    audio.wav = async_writer_open(OPTION_wav, WAV_BUFFER_SIZE, 1);
+    CHECK_NOTNULL(audio.wav, "failed to open %s", OPTION_wav);
+
+    /* placeholder, rewritten once the final size is known */
+    struct wav_header header;
+    wav_init_header(&header, 2, AICA_SAMPLE_FREQ, 0);
+    async_writer_write(audio.wav, &header, sizeof(header));
+  }
+
+  /* boot to the bios when no game is supplied */
+  const char *path = argc > 1 ? argv[1] : NULL;
+
+  if (!dc_load(dc, path)) {
+    LOG_WARNING("failed to load %s", path);
+    dc_destroy(dc);
+    return EXIT_FAILURE;
+  }
+
+  /* run in 1 ms slices */
+  int64_t start = time_nanoseconds();
+  int64_t slice = NS_PER_SEC / 1000;
+  int64_t end = OPTION_seconds * NS_PER_SEC;
+
+  for (int64_t t = 0; t < end && dc_running(dc); t += slice) {
+    dc_tick(dc, slice);
+  }
+
+  int64_t elapsed = time_nanoseconds() - start;
+
+  if (audio.block_frames) {
+    hash_block();
+  }
+
+  if (audio.wav) {
+    struct wav_header header;
+    int data_size = (int)(async_writer_size(audio.wav) - sizeof(header));
+    wav_init_header(&header, 2, AICA_SAMPLE_FREQ, data_size);
+    async_writer_close(audio.wav, &header, sizeof(header));
+  }
+
+  dc_destroy(dc);
+
+  LOG_INFO("frames=%" PRId64 " hash=%016" PRIx64 " speed=%.2fx",
+           audio.total_frames, audio.hash,
+           (double)end / (double)MAX(elapsed, 1));
+
+  return EXIT_SUCCESS;
+}
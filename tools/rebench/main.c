@@ -0,0 +1,229 @@
+/*
+ * disc read benchmark
+ *
+ * measures sector read throughput and latency for disc images in isolation
+ * from the rest of the emulator. reads either follow a synthetic sequential
+ * or random pattern, or replay a trace recorded by running a game with
+ * --gdrom_trace
+ */
+
+#include "core/core.h"
+#include "core/option.h"
+#include "core/time.h"
+#include "guest/gdrom/disc.h"
+
+DEFINE_OPTION_STRING(pattern, "seq", "Access pattern, \"seq\" or \"random\"");
+DEFINE_OPTION_STRING(trace, "", "Trace recorded with --gdrom_trace to replay");
+DEFINE_OPTION_INT(reads, 10000, "Number of reads for synthetic patterns");
+DEFINE_OPTION_INT(sectors, 16, "Number of sectors per synthetic read");
+DEFINE_OPTION_INT(seed, 1, "Seed for the random pattern");
+
+struct bench_read {
+  int fad;
+  int num_sectors;
+  int fmt;
+  int mask;
+};
+
+struct bench {
+  struct bench_read *reads;
+  int num_reads;
+  int max_reads;
+};
+
+static void bench_add_read(struct bench *bench, int fad, int num_sectors,
+                           int fmt, int mask) {
+  if (bench->num_reads == bench->max_reads) {
+    bench->max_reads = MAX(bench->max_reads * 2, 1024);
+    bench->reads =
+        realloc(bench->reads, bench->max_reads * sizeof(struct bench_read));
+  }
+
+  struct bench_read *read = &bench->reads[bench->num_reads++];
+  read->fad = fad;
+  read->num_sectors = num_sectors;
+  read->fmt = fmt;
+  read->mask = mask;
+}
+
+static uint32_t bench_rand(uint32_t *state) {
+  /* xorshift32 */
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  *state = x;
+  return x;
+}
+
+static int bench_load_trace(struct bench *bench, struct disc *disc,
+                            const char *filename) {
+  FILE *file = fopen(filename, "r");
+
+  if (!file) {
+    return 0;
+  }
+
+  char line[256];
+
+  while (fgets(line, sizeof(line), file)) {
+    int fad, num_sectors, fmt, mask;
+
+    if (line[0] == '#' ||
+        sscanf(line, "%d %d %d %d", &fad, &num_sectors, &fmt, &mask) != 4) {
+      continue;
+    }
+
+    /* skip reads of sectors this image doesn't have */
+    struct track *track = disc_lookup_track(disc, fad);
+    if (!track || fad + num_sectors > track->fad + track->num_sectors) {
+      continue;
+    }
+
+    bench_add_read(bench, fad, num_sectors, fmt, mask);
+  }
+
+  fclose(file);
+
+  return 1;
+}
+
+static void bench_gen_pattern(struct bench *bench, struct disc *disc,
+                              int random) {
+  int num_tracks = disc_get_num_tracks(disc);
+  int num_sectors = MAX(OPTION_sectors, 1);
+  uint32_t state = OPTION_seed ? (uint32_t)OPTION_seed : 1;
+  int track_num = 0;
+  int offset = 0;
+
+  for (int i = 0; i < OPTION_reads; i++) {
+    struct track *track = NULL;
+
+    if (random) {
+      track = disc_get_track(disc, bench_rand(&state) % num_tracks);
+      int max_offset = MAX(track->num_sectors - num_sectors, 1);
+      offset = bench_rand(&state) % max_offset;
+    } else {
+      /* read through each track in order, wrapping around at the end */
+      track = disc_get_track(disc, track_num);
+
+      if (offset + num_sectors > track->num_sectors) {
+        track_num = (track_num + 1) % num_tracks;
+        track = disc_get_track(disc, track_num);
+        offset = 0;
+      }
+    }
+
+    int n = MIN(num_sectors, track->num_sectors - offset);
+
+    if (n > 0) {
+      bench_add_read(bench, track->fad + offset, n, GD_SECTOR_ANY,
+                     GD_MASK_DATA);
+    }
+
+    offset += num_sectors;
+  }
+}
+
+static int bench_cmp_latency(const void *a, const void *b) {
+  int64_t lhs = *(const int64_t *)a;
+  int64_t rhs = *(const int64_t *)b;
+  return (lhs > rhs) - (lhs < rhs);
+}
+
+static int64_t bench_percentile(int64_t *latencies, int num, int p) {
+  int i = (int)(((int64_t)num * p) / 100);
+  return latencies[MIN(i, num - 1)];
+}
+
+static int bench_run(const char *filename) {
+  struct disc *disc = disc_create(filename, 0);
+
+  if (!disc) {
+    LOG_WARNING("failed to load %s", filename);
+    return 0;
+  }
+
+  struct bench bench = {0};
+
+  if (*OPTION_trace) {
+    if (!bench_load_trace(&bench, disc, OPTION_trace)) {
+      LOG_WARNING("failed to load trace %s", OPTION_trace);
+      disc_destroy(disc);
+      return 0;
+    }
+  } else {
+    bench_gen_pattern(&bench, disc, !strcmp(OPTION_pattern, "random"));
+  }
+
+  if (!bench.num_reads) {
+    LOG_WARNING("no reads to replay for %s", filename);
+    disc_destroy(disc);
+    return 0;
+  }
+
+  int max_size = 0;
+  for (int i = 0; i < bench.num_reads; i++) {
+    max_size = MAX(max_size, bench.reads[i].num_sectors);
+  }
+  max_size *= DISC_MAX_SECTOR_SIZE;
+
+  uint8_t *data = malloc(max_size);
+  int64_t *latencies = malloc(bench.num_reads * sizeof(int64_t));
+  int64_t total_sectors = 0;
+  int64_t total_bytes = 0;
+  int64_t start = time_nanoseconds();
+
+  for (int i = 0; i < bench.num_reads; i++) {
+    struct bench_read *read = &bench.reads[i];
+    int64_t read_start = time_nanoseconds();
+
+    total_bytes += disc_read_sectors(disc, read->fad, read->num_sectors,
+                                     read->fmt, read->mask, data, max_size);
+    total_sectors += read->num_sectors;
+
+    latencies[i] = time_nanoseconds() - read_start;
+  }
+
+  int64_t elapsed = MAX(time_nanoseconds() - start, 1);
+
+  qsort(latencies, bench.num_reads, sizeof(int64_t), &bench_cmp_latency);
+
+  const char *ext = strrchr(filename, '.');
+  double secs = elapsed / (double)NS_PER_SEC;
+
+  LOG_INFO("%s (%s, %s)", filename, ext ? ext + 1 : "?",
+           *OPTION_trace ? "trace" : OPTION_pattern);
+  LOG_INFO("  %d reads, %" PRId64 " sectors in %.3f s", bench.num_reads,
+           total_sectors, secs);
+  LOG_INFO("  %.0f sectors/s, %.2f MB/s", total_sectors / secs,
+           (total_bytes / secs) / (1024.0 * 1024.0));
+  LOG_INFO("  latency us p50 %.1f, p90 %.1f, p99 %.1f, max %.1f",
+           bench_percentile(latencies, bench.num_reads, 50) / 1000.0,
+           bench_percentile(latencies, bench.num_reads, 90) / 1000.0,
+           bench_percentile(latencies, bench.num_reads, 99) / 1000.0,
+           latencies[bench.num_reads - 1] / 1000.0);
+
+  free(latencies);
+  free(data);
+  free(bench.reads);
+  disc_destroy(disc);
+
+  return 1;
+}
+
+int main(int argc, char **argv) {
+  if (!options_parse(&argc, &argv) || argc < 2) {
+    LOG_INFO("rebench [--pattern=seq|random] [--trace=file] [--reads=n] "
+             "[--sectors=n] [--seed=n] image...");
+    return EXIT_FAILURE;
+  }
+
+  int res = 1;
+
+  for (int i = 1; i < argc; i++) {
+    res &= bench_run(argv[i]);
+  }
+
+  return res ? EXIT_SUCCESS : EXIT_FAILURE;
+}
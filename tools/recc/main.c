@@ -1,41 +1,88 @@
 #include "core/core.h"
 #include "core/filesystem.h"
+#include "core/memory.h"
 #include "core/option.h"
+#include "core/time.h"
 #include "jit/backend/x64/x64_backend.h"
 #include "jit/ir/ir.h"
 #include "jit/jit.h"
+#include "jit/jit_dump.h"
 #include "jit/jit_guest.h"
 #include "jit/pass_stats.h"
+#include "jit/passes/common_subexpression_elimination_pass.h"
 #include "jit/passes/constant_propagation_pass.h"
 #include "jit/passes/control_flow_analysis_pass.h"
 #include "jit/passes/dead_code_elimination_pass.h"
 #include "jit/passes/expression_simplification_pass.h"
 #include "jit/passes/load_store_elimination_pass.h"
+#include "jit/passes/loop_invariant_code_motion_pass.h"
 #include "jit/passes/register_allocation_pass.h"
 
-DEFINE_OPTION_STRING(pass, "cfa,lse,cprop,esimp,dce,ra",
+DEFINE_OPTION_STRING(pass, "cfa,lse,licm,cprop,esimp,cse,dce,ra",
                      "Comma-separated list of passes to run");
+DEFINE_OPTION_STRING(compare, "",
+                     "Comma-separated list of passes to compare against");
+DEFINE_OPTION_INT(loops, 1, "Number of times to compile each block");
+DEFINE_OPTION_STRING(dump_type, "raw",
+                     "Blocks to compile from a .irdump file, raw or opt");
+DEFINE_OPTION_STRING(render, "",
+                     "Directory to write a .irdump file's blocks to as text");
+DEFINE_OPTION_INT(stats, 0,
+                  "Print the time taken by each pass and the code expansion");
 
 DEFINE_PASS_STAT(ir_instrs_total, "total ir instructions");
 DEFINE_PASS_STAT(ir_instrs_removed, "removed ir instructions");
 
-DEFINE_JIT_CODE_BUFFER(code);
 static uint8_t ir_buffer[1024 * 1024];
 
-static int get_num_instrs(const struct ir *ir) {
+/* compiled code is never ran, these only exist to give the calls emitted by
+   the backend and its dispatch thunks a target within range of the code
+   buffer */
+static void stub_compile_code(void *data, uint32_t addr) {}
+static void stub_link_code(void *data, uint32_t addr) {}
+static void stub_check_interrupts(void *data) {}
+/* no guest memory is mapped, so accesses to constant addresses are emitted
+   through the generic handlers */
+static void stub_lookup(struct memory *mem, uint32_t addr, void **userdata,
+                        uint8_t **ptr, mem_read_cb *read, mem_write_cb *write) {
+  if (ptr) {
+    *ptr = NULL;
+  }
+}
+static uint8_t stub_r8(struct memory *mem, uint32_t addr) {
+  return 0;
+}
+static uint16_t stub_r16(struct memory *mem, uint32_t addr) {
+  return 0;
+}
+static uint32_t stub_r32(struct memory *mem, uint32_t addr) {
+  return 0;
+}
+static uint64_t stub_r64(struct memory *mem, uint32_t addr) {
+  return 0;
+}
+static void stub_w8(struct memory *mem, uint32_t addr, uint8_t data) {}
+static void stub_w16(struct memory *mem, uint32_t addr, uint16_t data) {}
+static void stub_w32(struct memory *mem, uint32_t addr, uint32_t data) {}
+static void stub_w64(struct memory *mem, uint32_t addr, uint64_t data) {}
+
+/* the dumped ir is expected to have been translated from sh4 code, each
+   guest instruction being 2 bytes and starting with its source info */
+static int get_guest_size(const struct ir *ir) {
   int n = 0;
 
   list_for_each_entry(block, &ir->blocks, struct ir_block, it) {
     list_for_each_entry(instr, &block->instrs, struct ir_instr, it) {
-      ((void)instr);
-      n++;
+      if (instr->op == OP_SOURCE_INFO) {
+        n += 2;
+      }
     }
   }
 
   return n;
 }
 
-static void sanitize_ir(struct ir *ir) {
+static void sanitize_ir(struct jit_backend *backend, struct ir *ir) {
   list_for_each_entry(block, &ir->blocks, struct ir_block, it) {
     list_for_each_entry(instr, &block->instrs, struct ir_instr, it) {
       if (instr->op != OP_CALL && instr->op != OP_FALLBACK) {
@@ -44,64 +91,160 @@ static void sanitize_ir(struct ir *ir) {
 
       /* ensure that address are within 2 GB of the code buffer */
       uint64_t addr = instr->arg[0]->i64;
-      addr = (uint64_t)code | (addr & 0x7fffffff);
+      addr = (uint64_t)backend->code | (addr & 0x7fffffff);
       ir_set_arg0(ir, instr, ir_alloc_i64(ir, addr));
     }
   }
 }
 
-static void process_file(struct jit_backend *backend, const char *filename,
-                         int disable_dumps) {
+#define MAX_PASSES 16
+#define MAX_PASS_NAME 32
+
+/* a list of passes to compile each block with, along with the totals across
+   every block it has compiled */
+struct pipeline {
+  const char *label;
+  int num_passes;
+  /* pass names as reported to pass_stats, prefixed with the label when
+     comparing two pipelines */
+  char names[MAX_PASSES][MAX_PASS_NAME];
+  char assemble[MAX_PASS_NAME];
+  int prefix;
+  /* only the primary pipeline feeds the global pass stats, the other is
+     reported on its own by print_summary */
+  int primary;
+
+  int64_t blocks;
+  int64_t time;
+  int64_t instrs;
+  int64_t host_size;
+  int64_t ir_size;
+};
+
+/* a block to compile, either a text ir file or binary ir from a dump */
+struct block_input {
+  const char *name;
+  const char *filename;
+  const uint8_t *data;
+  int size;
+};
+
+struct block_result {
+  int instrs;
+  int host_size;
+};
+
+static void pipeline_init(struct pipeline *pl, const char *label,
+                          const char *passes, int prefix) {
+  char tmp[OPTION_MAX_LENGTH];
+  strncpy(tmp, passes, sizeof(tmp) - 1);
+  tmp[sizeof(tmp) - 1] = 0;
+
+  memset(pl, 0, sizeof(*pl));
+  pl->label = label;
+  pl->prefix = prefix ? (int)strlen(label) + 1 : 0;
+
+  char *name = strtok(tmp, ",");
+  while (name) {
+    CHECK_LT(pl->num_passes, MAX_PASSES);
+    char *dst = pl->names[pl->num_passes++];
+    if (prefix) {
+      snprintf(dst, MAX_PASS_NAME, "%s:%s", label, name);
+    } else {
+      snprintf(dst, MAX_PASS_NAME, "%s", name);
+    }
+    name = strtok(NULL, ",");
+  }
+
+  if (prefix) {
+    snprintf(pl->assemble, MAX_PASS_NAME, "%s:assemble", label);
+  } else {
+    snprintf(pl->assemble, MAX_PASS_NAME, "assemble");
+  }
+}
+
+static void run_pass(struct jit_backend *backend, struct ir *ir,
+                     const char *name) {
+  if (!strcmp(name, "cfa")) {
+    struct cfa *cfa = cfa_create();
+    cfa_run(cfa, ir);
+    cfa_destroy(cfa);
+  } else if (!strcmp(name, "lse")) {
+    struct lse *lse = lse_create();
+    lse_run(lse, ir);
+    lse_destroy(lse);
+  } else if (!strcmp(name, "licm")) {
+    struct licm *licm = licm_create();
+    licm_run(licm, ir);
+    licm_destroy(licm);
+  } else if (!strcmp(name, "cprop")) {
+    struct cprop *cprop = cprop_create();
+    cprop_run(cprop, ir);
+    cprop_destroy(cprop);
+  } else if (!strcmp(name, "dce")) {
+    struct dce *dce = dce_create();
+    dce_run(dce, ir);
+    dce_destroy(dce);
+  } else if (!strcmp(name, "esimp")) {
+    struct esimp *esimp = esimp_create();
+    esimp_run(esimp, ir);
+    esimp_destroy(esimp);
+  } else if (!strcmp(name, "cse")) {
+    struct cse *cse = cse_create();
+    cse_run(cse, ir);
+    cse_destroy(cse);
+  } else if (!strcmp(name, "ra")) {
+    struct ra *ra = ra_create(backend->registers, backend->num_registers,
+                              backend->emitters, backend->num_emitters);
+    ra_run(ra, ir);
+    ra_destroy(ra);
+  } else {
+    LOG_WARNING("unknown pass %s", name);
+  }
+}
+
+static int read_block(const struct block_input *in, struct ir *ir) {
+  if (in->data) {
+    return ir_read_binary(in->data, in->size, ir) != 0;
+  }
+
+  FILE *input = fopen(in->filename, "r");
+  CHECK(input);
+  int r = ir_read(input, ir);
+  fclose(input);
+  return r;
+}
+
+static void compile_block(struct jit_backend *backend, struct pipeline *pl,
+                          const struct block_input *in, int disable_dumps,
+                          struct block_result *res) {
   struct ir ir = {0};
   ir.buffer = ir_buffer;
   ir.capacity = sizeof(ir_buffer);
 
   /* read in the input ir */
-  FILE *input = fopen(filename, "r");
-  CHECK(input);
-  int r = ir_read(input, &ir);
-  fclose(input);
-  CHECK(r);
+  int r = read_block(in, &ir);
+  CHECK(r, "failed to read %s", in->name);
 
   /* sanitize absolute addresses in the ir */
-  sanitize_ir(&ir);
+  sanitize_ir(backend, &ir);
 
   /* run optimization passes */
-  char passes[OPTION_MAX_LENGTH];
-  strncpy(passes, OPTION_pass, sizeof(passes));
+  int num_instrs_before = ir_num_instrs(&ir);
+  int num_instrs = num_instrs_before;
+  int64_t total = 0;
 
-  int num_instrs_before = get_num_instrs(&ir);
+  for (int i = 0; i < pl->num_passes; i++) {
+    const char *name = pl->names[i];
+    int64_t start = time_nanoseconds();
 
-  char *name = strtok(passes, ",");
-  while (name) {
-    if (!strcmp(name, "cfa")) {
-      struct cfa *cfa = cfa_create();
-      cfa_run(cfa, &ir);
-      cfa_destroy(cfa);
-    } else if (!strcmp(name, "lse")) {
-      struct lse *lse = lse_create();
-      lse_run(lse, &ir);
-      lse_destroy(lse);
-    } else if (!strcmp(name, "cprop")) {
-      struct cprop *cprop = cprop_create();
-      cprop_run(cprop, &ir);
-      cprop_destroy(cprop);
-    } else if (!strcmp(name, "dce")) {
-      struct dce *dce = dce_create();
-      dce_run(dce, &ir);
-      dce_destroy(dce);
-    } else if (!strcmp(name, "esimp")) {
-      struct esimp *esimp = esimp_create();
-      esimp_run(esimp, &ir);
-      esimp_destroy(esimp);
-    } else if (!strcmp(name, "ra")) {
-      struct ra *ra = ra_create(backend->registers, backend->num_registers,
-                                backend->emitters, backend->num_emitters);
-      ra_run(ra, &ir);
-      ra_destroy(ra);
-    } else {
-      LOG_WARNING("unknown pass %s", name);
-    }
+    run_pass(backend, &ir, name + pl->prefix);
+
+    int64_t elapsed = time_nanoseconds() - start;
+    int n = ir_num_instrs(&ir);
+    pass_stats_time(name, elapsed, num_instrs, n);
+    num_instrs = n;
+    total += elapsed;
 
     /* print ir after each pass if requested */
     if (!disable_dumps) {
@@ -111,19 +254,23 @@ static void process_file(struct jit_backend *backend, const char *filename,
       ir_write(&ir, stdout);
       LOG_INFO("");
     }
-
-    name = strtok(NULL, ",");
   }
 
-  int num_instrs_after = get_num_instrs(&ir);
+  int num_instrs_after = ir_num_instrs(&ir);
 
   /* assemble backend code */
-  backend->reset(backend);
+  backend->reset(backend, backend->code, backend->code_size);
   uint8_t *host_addr = NULL;
   int host_size = 0;
-  int res =
-      backend->assemble_code(backend, &ir, &host_addr, &host_size, NULL, NULL);
-  CHECK(res);
+  uint8_t *cold_addr = NULL;
+  int cold_size = 0;
+  int64_t start = time_nanoseconds();
+  int ok = backend->assemble_code(backend, &ir, &host_addr, &host_size,
+                                  &cold_addr, &cold_size, NULL, NULL);
+  CHECK(ok);
+  int64_t elapsed = time_nanoseconds() - start;
+  pass_stats_time(pl->assemble, elapsed, num_instrs_after, num_instrs_after);
+  total += elapsed;
 
   if (!disable_dumps) {
     LOG_INFO("===-----------------------------------------------------===");
@@ -131,14 +278,60 @@ static void process_file(struct jit_backend *backend, const char *filename,
     LOG_INFO("===-----------------------------------------------------===");
     backend->dump_code(backend, host_addr, host_size, stdout);
     LOG_INFO("");
+
+    if (cold_size) {
+      LOG_INFO("===-----------------------------------------------------===");
+      LOG_INFO("x64 cold code");
+      LOG_INFO("===-----------------------------------------------------===");
+      backend->dump_code(backend, cold_addr, cold_size, stdout);
+      LOG_INFO("");
+    }
+  }
+
+  host_size += cold_size;
+
+  pl->blocks++;
+  pl->time += total;
+  pl->instrs += num_instrs_after;
+  pl->host_size += host_size;
+  pl->ir_size += ir.used;
+
+  if (pl->primary) {
+    pass_stats_code(get_guest_size(&ir), host_size);
+    STAT_ir_instrs_total += num_instrs_before;
+    STAT_ir_instrs_removed += num_instrs_before - num_instrs_after;
+  }
+
+  res->instrs = num_instrs_after;
+  res->host_size = host_size;
+}
+
+static void process_block(struct jit_backend *backend, struct pipeline *a,
+                          struct pipeline *b, const struct block_input *in,
+                          int disable_dumps) {
+  struct block_result res_a = {0};
+  struct block_result res_b = {0};
+
+  for (int i = 0; i < OPTION_loops; i++) {
+    compile_block(backend, a, in, disable_dumps || i, &res_a);
+  }
+
+  if (!b) {
+    return;
+  }
+
+  for (int i = 0; i < OPTION_loops; i++) {
+    compile_block(backend, b, in, disable_dumps || i, &res_b);
   }
 
-  /* update stats */
-  STAT_ir_instrs_total += num_instrs_before;
-  STAT_ir_instrs_removed += num_instrs_before - num_instrs_after;
+  LOG_INFO("%-32s instrs %5d -> %5d (%+5d)  host %6d -> %6d (%+6d)", in->name,
+           res_a.instrs, res_b.instrs, res_b.instrs - res_a.instrs,
+           res_a.host_size, res_b.host_size,
+           res_b.host_size - res_a.host_size);
 }
 
-static void process_dir(struct jit_backend *backend, const char *path) {
+static void process_dir(struct jit_backend *backend, struct pipeline *a,
+                        struct pipeline *b, const char *path) {
   DIR *dir = opendir(path);
 
   if (!dir) {
@@ -157,14 +350,141 @@ static void process_dir(struct jit_backend *backend, const char *path) {
     snprintf(filename, sizeof(filename), "%s" PATH_SEPARATOR "%s", path,
              ent->d_name);
 
-    LOG_INFO("processing %s", filename);
+    if (!b) {
+      LOG_INFO("processing %s", filename);
+    }
 
-    process_file(backend, filename, 1);
+    struct block_input in = {ent->d_name, filename, NULL, 0};
+    process_block(backend, a, b, &in, 1);
   }
 
   closedir(dir);
 }
 
+static int is_dump(const char *path) {
+  const char *ext = strrchr(path, '.');
+  return ext && !strcmp(ext, ".irdump");
+}
+
+static const char *dump_type_name(int type) {
+  return type == JIT_DUMP_OPT ? "opt" : "raw";
+}
+
+/* compile every block of the requested type from a session's dump file */
+static void process_dump(struct jit_backend *backend, struct pipeline *a,
+                         struct pipeline *b, const char *path) {
+  size_t size;
+  uint8_t *data = map_file(path, &size);
+
+  if (!data) {
+    LOG_WARNING("failed to map %s", path);
+    return;
+  }
+
+  int type = strcmp(OPTION_dump_type, "opt") ? JIT_DUMP_RAW : JIT_DUMP_OPT;
+  struct jit_dump_block block;
+  int offset = 0;
+
+  while (jit_dump_next(data, (int)size, &offset, &block)) {
+    if (block.type != type) {
+      continue;
+    }
+
+    char name[32];
+    snprintf(name, sizeof(name), "0x%08x.%s", block.guest_addr,
+             dump_type_name(block.type));
+
+    struct block_input in = {name, NULL, block.ir, block.ir_size};
+    process_block(backend, a, b, &in, 1);
+  }
+
+  unmap_file(data, size);
+}
+
+/* write out each block in a session's dump file as text, using the layout
+   blocks were once dumped with at runtime */
+static void render_dump(const char *path, const char *outdir) {
+  size_t size;
+  uint8_t *data = map_file(path, &size);
+
+  if (!data) {
+    LOG_WARNING("failed to map %s", path);
+    return;
+  }
+
+  struct jit_dump_block block;
+  int offset = 0;
+  int num_blocks = 0;
+
+  while (jit_dump_next(data, (int)size, &offset, &block)) {
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s" PATH_SEPARATOR "%s", outdir,
+             dump_type_name(block.type));
+    CHECK(fs_mkdir(outdir) && fs_mkdir(dir));
+
+    char filename[PATH_MAX];
+    snprintf(filename, sizeof(filename), "%s" PATH_SEPARATOR "0x%08x.ir", dir,
+             block.guest_addr);
+
+    struct ir ir = {0};
+    ir.buffer = ir_buffer;
+    ir.capacity = sizeof(ir_buffer);
+
+    if (!ir_read_binary(block.ir, block.ir_size, &ir)) {
+      LOG_WARNING("failed to read block 0x%08x", block.guest_addr);
+      continue;
+    }
+
+    FILE *output = fopen(filename, "w");
+    CHECK_NOTNULL(output);
+    ir_write(&ir, output);
+    fclose(output);
+
+    num_blocks++;
+  }
+
+  LOG_INFO("rendered %d blocks to %s", num_blocks, outdir);
+
+  unmap_file(data, size);
+}
+
+static void print_pipeline(const struct pipeline *pl, const char *passes) {
+  double secs = pl->time / (double)NS_PER_SEC;
+  LOG_INFO("%s: %s", pl->label, passes);
+  LOG_INFO("  %" PRId64 " blocks in %.2f ms, %.0f blocks/sec, %.2f us/block",
+           pl->blocks, pl->time / (double)NS_PER_MS,
+           secs > 0.0 ? pl->blocks / secs : 0.0,
+           pl->blocks ? pl->time / 1000.0 / pl->blocks : 0.0);
+  LOG_INFO("  %" PRId64 " ir instructions, %" PRId64 " host bytes",
+           pl->instrs, pl->host_size);
+  LOG_INFO("  %.0f ir bytes/block",
+           pl->blocks ? pl->ir_size / (double)pl->blocks : 0.0);
+}
+
+static void print_summary(const struct pipeline *a, const struct pipeline *b) {
+  LOG_INFO("===-----------------------------------------------------===");
+  LOG_INFO("compile throughput");
+  LOG_INFO("===-----------------------------------------------------===");
+
+  print_pipeline(a, OPTION_pass);
+
+  if (b) {
+    print_pipeline(b, OPTION_compare);
+
+    LOG_INFO("");
+    LOG_INFO("b vs a: %+" PRId64 " ir instructions (%+.2f%%), %+" PRId64
+             " host bytes (%+.2f%%), %.2fx compile time",
+             b->instrs - a->instrs,
+             a->instrs ? (b->instrs - a->instrs) * 100.0 / a->instrs : 0.0,
+             b->host_size - a->host_size,
+             a->host_size ? (b->host_size - a->host_size) * 100.0 / a->host_size
+                          : 0.0,
+             a->time ? b->time / (double)a->time : 0.0);
+  }
+
+  LOG_INFO("");
+}
+
 int main(int argc, char **argv) {
   if (!options_parse(&argc, &argv)) {
     return EXIT_FAILURE;
@@ -174,17 +494,55 @@ int main(int argc, char **argv) {
 
   struct jit_guest guest = {0};
   guest.addr_mask = 0xff;
+  guest.lookup = &stub_lookup;
+  guest.r8 = &stub_r8;
+  guest.r16 = &stub_r16;
+  guest.r32 = &stub_r32;
+  guest.r64 = &stub_r64;
+  guest.w8 = &stub_w8;
+  guest.w16 = &stub_w16;
+  guest.w32 = &stub_w32;
+  guest.w64 = &stub_w64;
+  guest.compile_code = &stub_compile_code;
+  guest.link_code = &stub_link_code;
+  guest.check_interrupts = &stub_check_interrupts;
+
+  if (OPTION_render[0]) {
+    render_dump(path, OPTION_render);
+    return EXIT_SUCCESS;
+  }
+
+  struct jit_backend *backend =
+      x64_backend_create(&guest, NULL, JIT_CODE_BUFFER_SIZE);
+
+  /* when comparing, prefix each pipeline's passes so their times are
+     reported separately */
+  int compare = OPTION_compare[0] != 0;
+  struct pipeline a, b;
+  pipeline_init(&a, "a", OPTION_pass, compare);
+  pipeline_init(&b, "b", OPTION_compare, compare);
+  a.primary = 1;
 
-  struct jit_backend *backend = x64_backend_create(&guest, code, sizeof(code));
+  if (OPTION_loops < 1) {
+    OPTION_loops = 1;
+  }
 
-  if (fs_isfile(path)) {
-    process_file(backend, path, 0);
+  if (is_dump(path)) {
+    process_dump(backend, &a, compare ? &b : NULL, path);
+  } else if (fs_isfile(path)) {
+    struct block_input in = {path, path, NULL, 0};
+    process_block(backend, &a, compare ? &b : NULL, &in, compare);
   } else {
-    process_dir(backend, path);
+    process_dir(backend, &a, compare ? &b : NULL, path);
   }
 
   LOG_INFO("");
   pass_stats_dump();
+  print_summary(&a, compare ? &b : NULL);
+
+  if (OPTION_stats) {
+    pass_stats_dump_times();
+  }
 
   backend->destroy(backend);
 
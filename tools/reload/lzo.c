@@ -0,0 +1,270 @@
+#include "lzo.h"
+#include "core/core.h"
+
+/*
+ * lzo1x streams are a sequence of literal runs and matches. the two low bits
+ * of each match encode the number of literals (0-3) following it, which
+ * changes how the next instruction is interpreted:
+ *
+ *   0000LLLL  state 0: copy 3 + L literals (L=0 extends the length)
+ *             state 1-3: copy 2 bytes from a distance of up to 1 kB
+ *             state 4: copy 3 bytes from a distance of 2 kB - 3 kB
+ *   0001HLLL  copy 2 + L bytes from a distance of 16 kB - 48 kB, a distance
+ *             of 16 kB ends the stream
+ *   001LLLLL  copy 2 + L bytes from a distance of up to 16 kB
+ *   01LDDDSS  copy 3 - 4 bytes from a distance of up to 2 kB
+ *   1LLDDDSS  copy 5 - 8 bytes from a distance of up to 2 kB
+ *
+ * the compressor only emits the last four instructions and long literal
+ * runs, which is enough to compress comparably to lzo1x_1
+ */
+
+#define LZO_HASH_BITS 14
+#define LZO_MIN_MATCH 4
+#define LZO_M2_MAX_OFFSET 0x0800
+#define LZO_M3_MAX_OFFSET 0x4000
+#define LZO_M4_MAX_OFFSET 0xbfff
+
+struct lzo_writer {
+  uint8_t *dst;
+  int size;
+  int pos;
+  /* offset of the byte holding the last match's trailing literal count */
+  int state_pos;
+};
+
+static void lzo_emit(struct lzo_writer *w, int byte) {
+  if (w->pos < w->size) {
+    w->dst[w->pos] = (uint8_t)byte;
+  }
+  w->pos++;
+}
+
+/* lengths that don't fit in an instruction are extended by a run of zero
+   bytes, each adding 255, followed by the remaining non-zero value */
+static void lzo_emit_length(struct lzo_writer *w, int n) {
+  while (n > 255) {
+    lzo_emit(w, 0);
+    n -= 255;
+  }
+  lzo_emit(w, n);
+}
+
+static void lzo_emit_literals(struct lzo_writer *w, const uint8_t *src,
+                              int n) {
+  if (!n) {
+    return;
+  }
+
+  if (!w->pos && n <= 238) {
+    /* the first byte of a stream can encode a literal run directly */
+    lzo_emit(w, 17 + n);
+  } else if (w->pos && n <= 3) {
+    /* short runs are folded into the preceding match */
+    if (w->state_pos < w->size) {
+      w->dst[w->state_pos] |= n;
+    }
+  } else if (n <= 18) {
+    lzo_emit(w, n - 3);
+  } else {
+    lzo_emit(w, 0);
+    lzo_emit_length(w, n - 18);
+  }
+
+  for (int i = 0; i < n; i++) {
+    lzo_emit(w, src[i]);
+  }
+}
+
+static void lzo_emit_match(struct lzo_writer *w, int len, int dist) {
+  if (len <= 8 && dist <= LZO_M2_MAX_OFFSET) {
+    int d = dist - 1;
+    if (len <= 4) {
+      lzo_emit(w, 0x40 | ((len - 3) << 5) | ((d & 7) << 2));
+    } else {
+      lzo_emit(w, 0x80 | ((len - 5) << 5) | ((d & 7) << 2));
+    }
+    w->state_pos = w->pos - 1;
+    lzo_emit(w, d >> 3);
+  } else if (dist <= LZO_M3_MAX_OFFSET) {
+    int d = dist - 1;
+    if (len <= 33) {
+      lzo_emit(w, 0x20 | (len - 2));
+    } else {
+      lzo_emit(w, 0x20);
+      lzo_emit_length(w, len - 33);
+    }
+    w->state_pos = w->pos;
+    lzo_emit(w, (d & 0x3f) << 2);
+    lzo_emit(w, d >> 6);
+  } else {
+    int d = dist - LZO_M3_MAX_OFFSET;
+    int h = (d >> 11) & 8;
+    if (len <= 9) {
+      lzo_emit(w, 0x10 | h | (len - 2));
+    } else {
+      lzo_emit(w, 0x10 | h);
+      lzo_emit_length(w, len - 9);
+    }
+    w->state_pos = w->pos;
+    lzo_emit(w, (d & 0x3f) << 2);
+    lzo_emit(w, (d >> 6) & 0xff);
+  }
+}
+
+static uint32_t lzo_hash(const uint8_t *src) {
+  uint32_t v;
+  memcpy(&v, src, 4);
+  return (v * 2654435761u) >> (32 - LZO_HASH_BITS);
+}
+
+int lzo1x_compress(const uint8_t *src, int src_size, uint8_t *dst,
+                   int dst_size) {
+  struct lzo_writer w = {dst, dst_size, 0, 0};
+  int *table = malloc(sizeof(int) << LZO_HASH_BITS);
+  memset(table, 0xff, sizeof(int) << LZO_HASH_BITS);
+
+  int ip = 0;
+  int lit = 0;
+
+  while (ip + LZO_MIN_MATCH <= src_size) {
+    uint32_t h = lzo_hash(&src[ip]);
+    int cand = table[h];
+    table[h] = ip;
+
+    if (cand < 0 || ip - cand > LZO_M4_MAX_OFFSET ||
+        memcmp(&src[cand], &src[ip], LZO_MIN_MATCH)) {
+      ip++;
+      continue;
+    }
+
+    int len = LZO_MIN_MATCH;
+    while (ip + len < src_size && src[cand + len] == src[ip + len]) {
+      len++;
+    }
+
+    lzo_emit_literals(&w, &src[lit], ip - lit);
+    lzo_emit_match(&w, len, ip - cand);
+
+    ip += len;
+    lit = ip;
+  }
+
+  lzo_emit_literals(&w, &src[lit], src_size - lit);
+
+  /* end of stream */
+  lzo_emit(&w, 0x11);
+  lzo_emit(&w, 0);
+  lzo_emit(&w, 0);
+
+  free(table);
+
+  return w.pos <= w.size ? w.pos : 0;
+}
+
+static int lzo_read_length(const uint8_t *src, int src_size, int *ip,
+                           int base) {
+  int n = base;
+
+  while (*ip < src_size && !src[*ip]) {
+    n += 255;
+    (*ip)++;
+  }
+
+  if (*ip >= src_size) {
+    return -1;
+  }
+
+  return n + src[(*ip)++];
+}
+
+int lzo1x_decompress(const uint8_t *src, int src_size, uint8_t *dst,
+                     int dst_size) {
+  int ip = 0;
+  int op = 0;
+  int state = 0;
+
+  if (src_size && src[0] > 17) {
+    int n = src[ip++] - 17;
+    if (ip + n > src_size || op + n > dst_size) {
+      return -1;
+    }
+    memcpy(&dst[op], &src[ip], n);
+    ip += n;
+    op += n;
+    state = MIN(n, 4);
+  }
+
+  while (ip < src_size) {
+    int t = src[ip++];
+    int len = 0;
+    int dist = 0;
+
+    if (t < 16 && !state) {
+      len = t ? t + 3 : lzo_read_length(src, src_size, &ip, 18);
+      if (len < 0 || ip + len > src_size || op + len > dst_size) {
+        return -1;
+      }
+      memcpy(&dst[op], &src[ip], len);
+      ip += len;
+      op += len;
+      state = 4;
+      continue;
+    }
+
+    if (t < 16) {
+      if (ip >= src_size) {
+        return -1;
+      }
+      len = state < 4 ? 2 : 3;
+      dist = (src[ip++] << 2) + (t >> 2) + (state < 4 ? 1 : 2049);
+    } else if (t < 32) {
+      len = (t & 7) ? (t & 7) + 2 : lzo_read_length(src, src_size, &ip, 9);
+      if (len < 0 || ip + 2 > src_size) {
+        return -1;
+      }
+      int v = src[ip] | (src[ip + 1] << 8);
+      ip += 2;
+      dist = LZO_M3_MAX_OFFSET + ((t & 8) << 11) + (v >> 2);
+      if (dist == LZO_M3_MAX_OFFSET) {
+        return op;
+      }
+      t = v;
+    } else if (t < 64) {
+      len = (t & 31) ? (t & 31) + 2 : lzo_read_length(src, src_size, &ip, 33);
+      if (len < 0 || ip + 2 > src_size) {
+        return -1;
+      }
+      int v = src[ip] | (src[ip + 1] << 8);
+      ip += 2;
+      dist = (v >> 2) + 1;
+      t = v;
+    } else {
+      if (ip >= src_size) {
+        return -1;
+      }
+      len = t < 128 ? 3 + ((t >> 5) & 1) : 5 + ((t >> 5) & 3);
+      dist = (src[ip++] << 3) + ((t >> 2) & 7) + 1;
+    }
+
+    /* matches may overlap the output being written */
+    if (dist > op || op + len > dst_size) {
+      return -1;
+    }
+    for (int i = 0; i < len; i++, op++) {
+      dst[op] = dst[op - dist];
+    }
+
+    /* copy the literals trailing the match */
+    state = t & 3;
+    if (ip + state > src_size || op + state > dst_size) {
+      return -1;
+    }
+    memcpy(&dst[op], &src[ip], state);
+    ip += state;
+    op += state;
+  }
+
+  /* ran out of input before the end of stream marker */
+  return -1;
+}
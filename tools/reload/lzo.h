@@ -0,0 +1,19 @@
+#ifndef RELOAD_LZO_H
+#define RELOAD_LZO_H
+
+#include <stdint.h>
+
+/* worst case size of compressing size bytes */
+#define LZO1X_BOUND(size) ((size) + ((size) / 16) + 64 + 3)
+
+/* greedy lzo1x compressor, producing streams dcload's lzo1x_decompress
+   can unpack. returns the compressed size, or 0 if dst was too small */
+int lzo1x_compress(const uint8_t *src, int src_size, uint8_t *dst,
+                   int dst_size);
+
+/* returns the decompressed size, or -1 if the stream is malformed or dst is
+   too small */
+int lzo1x_decompress(const uint8_t *src, int src_size, uint8_t *dst,
+                     int dst_size);
+
+#endif
@@ -1,9 +1,11 @@
 #include "core/core.h"
 #include "core/filesystem.h"
 #include "core/thread.h"
+#include "core/time.h"
 #include "guest/dreamcast.h"
 #include "guest/serial/serial.h"
 #include "guest/sh4/sh4.h"
+#include "lzo.h"
 
 enum {
   STATE_LOADING,
@@ -163,6 +165,50 @@ static void dev_write_checked(const void *ptr, int size) {
   CHECK(memcmp(ptr, tmp, size) == 0);
 }
 
+/* dcload echoes back each command and its arguments, and acknowledges each
+   blob it receives. rather than waiting on each response before writing the
+   next, the bytes expected back can be queued up and verified later, letting
+   the responses overlap with the writes that follow */
+static uint8_t *dev_pending;
+static int dev_pending_read;
+static int dev_pending_write;
+static int dev_pending_max;
+
+static void dev_expect(const void *ptr, int size) {
+  if (dev_pending_write + size > dev_pending_max) {
+    dev_pending_max = MAX(dev_pending_max * 2, dev_pending_write + size);
+    dev_pending = realloc(dev_pending, dev_pending_max);
+  }
+
+  memcpy(&dev_pending[dev_pending_write], ptr, size);
+  dev_pending_write += size;
+}
+
+static void dev_write_echoed(const void *ptr, int size) {
+  dev_write_raw(ptr, size);
+  dev_expect(ptr, size);
+}
+
+static void dev_check_pending(int size) {
+  CHECK_LE(dev_pending_read + size, dev_pending_write);
+
+  while (size) {
+    uint8_t tmp[64];
+    int n = MIN(size, (int)sizeof(tmp));
+
+    dev_read_raw(tmp, n);
+    CHECK(memcmp(&dev_pending[dev_pending_read], tmp, n) == 0,
+          "unexpected response from dcload");
+
+    dev_pending_read += n;
+    size -= n;
+  }
+
+  if (dev_pending_read == dev_pending_write) {
+    dev_pending_read = dev_pending_write = 0;
+  }
+}
+
 /*
  * dcload syscalls
  */
@@ -224,6 +270,55 @@ static void run_code(uint32_t addr) {
   }
 }
 
+/* binaries are sent in chunks, each loaded by its own command. this bounds
+   the size of the compressed blobs dcload has to buffer, and lets chunks be
+   pipelined */
+#define LOAD_CHUNK_SIZE 8192
+
+/* bytes dcload sends back for each chunk, the echoed command, address, size
+   and blob size, followed by the blob's acknowledgement */
+#define LOAD_CHUNK_RESPONSE (1 + 4 + 4 + 4 + 1)
+
+static int load_compress;
+static int load_window = 4;
+
+static int load_chunk(uint32_t addr, const uint8_t *data, int size) {
+  static uint8_t compressed[LZO1X_BOUND(LOAD_CHUNK_SIZE)];
+
+  /* write load binary command */
+  char cmd = 'B';
+  dev_write_echoed(&cmd, 1);
+  dev_write_echoed(&addr, 4);
+  dev_write_echoed(&size, 4);
+
+  /* write payload, compressed if it helps. dcload decompresses 'C' blobs
+     with lzo1x */
+  char type = 'U';
+  const uint8_t *payload = data;
+  int payload_size = size;
+
+  if (load_compress) {
+    int n = lzo1x_compress(data, size, compressed, sizeof(compressed));
+
+    if (n && n < size) {
+      type = 'C';
+      payload = compressed;
+      payload_size = n;
+    }
+  }
+
+  char sum = checksum(payload, payload_size);
+  dev_write_raw(&type, 1);
+  dev_write_echoed(&payload_size, 4);
+  dev_write_raw(payload, payload_size);
+  dev_write_raw(&sum, 1);
+
+  char ok = 'G';
+  dev_expect(&ok, 1);
+
+  return payload_size;
+}
+
 static void load_code(uint32_t addr, const char *path) {
   uint8_t *bin = NULL;
   int bin_size = 0;
@@ -244,23 +339,33 @@ static void load_code(uint32_t addr, const char *path) {
     fclose(fp);
   }
 
-  /* send over serial if */
+  /* send over serial if, keeping up to load_window chunks in flight before
+     checking their responses */
   {
-    /* write load binary command */
-    char cmd = 'B';
-    dev_write_checked(&cmd, 1);
-    dev_write_checked(&addr, 4);
-    dev_write_checked(&bin_size, 4);
-
-    /* write payload */
-    char type = 'U';
-    char sum = checksum(bin, bin_size);
-    dev_write_raw(&type, 1);
-    dev_write_checked(&bin_size, 4);
-    dev_write_raw(bin, bin_size);
-    dev_write_raw(&sum, 1);
-    dev_read_raw(&type, 1);
-    CHECK_EQ(type, 'G');
+    int64_t start = time_nanoseconds();
+    int in_flight = 0;
+    int num_chunks = 0;
+    int sent = 0;
+
+    for (int offset = 0; offset < bin_size; offset += LOAD_CHUNK_SIZE) {
+      int size = MIN(bin_size - offset, LOAD_CHUNK_SIZE);
+      sent += load_chunk(addr + offset, bin + offset, size);
+      num_chunks++;
+
+      if (++in_flight > load_window) {
+        dev_check_pending(LOAD_CHUNK_RESPONSE);
+        in_flight--;
+      }
+    }
+
+    dev_check_pending(in_flight * LOAD_CHUNK_RESPONSE);
+
+    int64_t elapsed = time_nanoseconds() - start;
+    LOG_INFO("loaded %s, %d bytes in %d chunks, %d bytes sent (%.1f%%) in "
+             "%.2f s",
+             path, bin_size, num_chunks, sent,
+             bin_size ? sent * 100.0f / bin_size : 0.0f,
+             elapsed / (double)NS_PER_SEC);
   }
 
   free(bin);
@@ -303,8 +408,21 @@ static void *dc_main(void *data) {
 }
 
 int main(int argc, char **argv) {
-  if (argc < 3) {
-    LOG_INFO("reload /path/to/dcload-serial.cdi /path/to/test.bin ...");
+  int arg = 1;
+
+  for (; arg < argc && !strncmp(argv[arg], "--", 2); arg++) {
+    if (!strcmp(argv[arg], "--compress")) {
+      load_compress = 1;
+    } else if (!strcmp(argv[arg], "--window") && arg + 1 < argc) {
+      load_window = atoi(argv[++arg]);
+    } else {
+      break;
+    }
+  }
+
+  if (argc - arg < 2 || load_window < 0) {
+    LOG_INFO("reload [--compress] [--window n] /path/to/dcload-serial.cdi "
+             "/path/to/test.bin ...");
     return EXIT_FAILURE;
   }
 
@@ -320,7 +438,7 @@ int main(int argc, char **argv) {
   dev_mutex = mutex_create();
   CHECK_NOTNULL(dev_mutex);
 
-  dc_thread = thread_create(&dc_main, NULL, argv[1]);
+  dc_thread = thread_create(&dc_main, NULL, argv[arg]);
   CHECK_NOTNULL(dc_thread);
 
   /* wait for it to initialize */
@@ -330,7 +448,7 @@ int main(int argc, char **argv) {
   /* run each binary */
   const uint32_t code_addr = 0x8c010000;
 
-  for (int i = 2; i < argc; i++) {
+  for (int i = arg + 1; i < argc; i++) {
     load_code(code_addr, argv[i]);
     run_code(code_addr);
   }
@@ -346,5 +464,8 @@ int main(int argc, char **argv) {
   mutex_destroy(dev_mutex);
   dev_mutex = NULL;
 
+  free(dev_pending);
+  dev_pending = NULL;
+
   return EXIT_SUCCESS;
 }
@@ -0,0 +1,315 @@
+/*
+ * frame pacing analyzer
+ *
+ * reads a log recorded with --pacing_log and splits each host frame into the
+ * time the emulation thread spent running the guest, and the time the video
+ * thread spent rendering and syncing to the host afterwards. frames taking
+ * longer than --budget are reported as stalls, attributed to whichever of
+ * the two dominated. the drift between guest and host time is plotted over
+ * the log, and per-frame values are optionally written out as csv for
+ * plotting elsewhere
+ *
+ * each frame is delimited by the video thread's PACING_FRAME events:
+ *
+ *   FRAME ... START_RENDER .. FINISH_RENDER .. VBLANK_IN .. VBLANK_OUT ...
+ *   |------------------ emulation ------------------------|-- video ---| FRAME
+ */
+
+#include "core/core.h"
+#include "core/option.h"
+#include "core/sort.h"
+#include "core/time.h"
+#include "file/pacing_log.h"
+
+DEFINE_OPTION_STRING(csv, "", "Path to write per-frame values to");
+DEFINE_OPTION_INT(budget, 17, "Frame time in ms over which a frame stalled");
+DEFINE_OPTION_INT(width, 72, "Width of the drift plot");
+
+#define PLOT_HEIGHT 12
+
+enum {
+  STALL_EMULATION,
+  STALL_VIDEO,
+  STALL_UNDERRUN,
+  NUM_STALLS,
+};
+
+static const char *STALL_NAMES[NUM_STALLS] = {"emulation", "video",
+                                              "audio underrun"};
+
+struct frame {
+  int64_t host_start;
+  int64_t host_time;
+  int64_t guest_time;
+  int64_t emu_time;
+  int64_t render_time;
+  int64_t video_time;
+  int64_t drift;
+  int audio_frames;
+  int stall;
+};
+
+static int record_cmp(const void *a, const void *b) {
+  const struct pacing_record *lhs = a;
+  const struct pacing_record *rhs = b;
+  return lhs->host_time <= rhs->host_time;
+}
+
+static int time_cmp(const void *a, const void *b) {
+  return *(const int64_t *)a <= *(const int64_t *)b;
+}
+
+static int build_frames(struct pacing_record *recs, int num_recs,
+                        struct frame *frames) {
+  int num_frames = 0;
+  struct frame *frame = NULL;
+  int64_t guest_start = 0;
+  int64_t host_start = 0;
+  int64_t render_start = 0;
+  int64_t vblank_out = 0;
+
+  for (int i = 0; i < num_recs; i++) {
+    struct pacing_record *rec = &recs[i];
+
+    if (!host_start) {
+      host_start = rec->host_time;
+      guest_start = rec->guest_time;
+    }
+
+    switch (rec->event) {
+      case PACING_FRAME:
+        /* close out the previous frame */
+        if (frame) {
+          frame->host_time = rec->host_time - frame->host_start;
+          if (vblank_out) {
+            frame->video_time = rec->host_time - vblank_out;
+          }
+        }
+
+        frame = &frames[num_frames++];
+        memset(frame, 0, sizeof(*frame));
+        frame->host_start = rec->host_time;
+        frame->guest_time = rec->guest_time;
+        frame->audio_frames = rec->audio_frames;
+        frame->drift = (rec->host_time - host_start) -
+                       (rec->guest_time - guest_start);
+        vblank_out = 0;
+        break;
+
+      case PACING_START_RENDER:
+        render_start = rec->host_time;
+        break;
+
+      case PACING_FINISH_RENDER:
+        if (frame && render_start) {
+          frame->render_time += rec->host_time - render_start;
+        }
+        render_start = 0;
+        break;
+
+      case PACING_VBLANK_OUT:
+        if (frame) {
+          frame->emu_time = rec->host_time - frame->host_start;
+        }
+        vblank_out = rec->host_time;
+        break;
+
+      default:
+        break;
+    }
+  }
+
+  /* the last frame is incomplete */
+  if (num_frames) {
+    num_frames--;
+  }
+
+  /* guest time is sampled at the start of each frame, make it relative */
+  for (int i = 0; i < num_frames; i++) {
+    frames[i].guest_time = frames[i + 1].guest_time - frames[i].guest_time;
+  }
+
+  return num_frames;
+}
+
+static void classify_stalls(struct frame *frames, int num_frames,
+                            int *stalls) {
+  int64_t budget = (int64_t)OPTION_budget * NS_PER_MS;
+
+  for (int i = 0; i < num_frames; i++) {
+    struct frame *frame = &frames[i];
+    frame->stall = -1;
+
+    if (frame->host_time <= budget) {
+      continue;
+    }
+
+    /* an empty buffer at the start of the next frame means audio ran dry
+       while this one was produced */
+    if (i + 1 < num_frames && frame->audio_frames &&
+        !frames[i + 1].audio_frames) {
+      frame->stall = STALL_UNDERRUN;
+    } else if (frame->emu_time >= frame->video_time) {
+      frame->stall = STALL_EMULATION;
+    } else {
+      frame->stall = STALL_VIDEO;
+    }
+
+    stalls[frame->stall]++;
+  }
+}
+
+static void plot_drift(const struct frame *frames, int num_frames) {
+  int width = MAX(OPTION_width, 8);
+  int64_t min = INT64_MAX;
+  int64_t max = INT64_MIN;
+
+  for (int i = 0; i < num_frames; i++) {
+    min = MIN(min, frames[i].drift);
+    max = MAX(max, frames[i].drift);
+  }
+
+  int64_t range = MAX(max - min, 1);
+  char grid[PLOT_HEIGHT][256];
+  width = MIN(width, (int)sizeof(grid[0]) - 1);
+
+  for (int y = 0; y < PLOT_HEIGHT; y++) {
+    memset(grid[y], ' ', width);
+    grid[y][width] = 0;
+  }
+
+  /* each column shows the drift at the end of its frames, and is marked
+     with an x when one of its frames stalled */
+  for (int x = 0; x < width; x++) {
+    int begin = (int)((int64_t)num_frames * x / width);
+    int end = (int)((int64_t)num_frames * (x + 1) / width);
+    if (begin >= end) {
+      continue;
+    }
+
+    int stalled = 0;
+    for (int i = begin; i < end; i++) {
+      stalled |= frames[i].stall != -1;
+    }
+
+    int64_t drift = frames[end - 1].drift;
+    int y = (int)((max - drift) * (PLOT_HEIGHT - 1) / range);
+    grid[y][x] = stalled ? 'x' : '*';
+  }
+
+  printf("drift (host - guest time), %d frames per column\n",
+         MAX(num_frames / width, 1));
+  for (int y = 0; y < PLOT_HEIGHT; y++) {
+    int64_t value = max - range * y / (PLOT_HEIGHT - 1);
+    printf("%9.2f ms |%s\n", value / (double)NS_PER_MS, grid[y]);
+  }
+  printf("\n");
+}
+
+static double percentile(int64_t *sorted, int num, int p) {
+  if (!num) {
+    return 0.0;
+  }
+  return sorted[MIN(num * p / 100, num - 1)] / (double)NS_PER_MS;
+}
+
+static int write_csv(const char *path, const struct frame *frames,
+                     int num_frames) {
+  FILE *file = fopen(path, "w");
+  if (!file) {
+    return 0;
+  }
+
+  fprintf(file, "frame,host_ms,guest_ms,drift_ms,emu_ms,render_ms,video_ms,"
+                "audio_frames,stall\n");
+
+  for (int i = 0; i < num_frames; i++) {
+    const struct frame *f = &frames[i];
+    fprintf(file, "%d,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%d,%s\n", i,
+            f->host_time / (double)NS_PER_MS,
+            f->guest_time / (double)NS_PER_MS, f->drift / (double)NS_PER_MS,
+            f->emu_time / (double)NS_PER_MS,
+            f->render_time / (double)NS_PER_MS,
+            f->video_time / (double)NS_PER_MS, f->audio_frames,
+            f->stall == -1 ? "" : STALL_NAMES[f->stall]);
+  }
+
+  fclose(file);
+
+  return 1;
+}
+
+int main(int argc, char **argv) {
+  if (!options_parse(&argc, &argv) || argc < 2) {
+    LOG_INFO("repace [--csv=path] [--budget=ms] [--width=n] <pacing log>");
+    return EXIT_FAILURE;
+  }
+
+  struct pacing_record *recs;
+  int num_recs;
+  if (!pacing_log_read(argv[1], &recs, &num_recs)) {
+    LOG_WARNING("failed to read pacing log %s", argv[1]);
+    return EXIT_FAILURE;
+  }
+
+  /* records of the emulation and video threads may be written slightly out
+     of order */
+  msort_parallel(recs, num_recs, sizeof(struct pacing_record), &record_cmp);
+
+  struct frame *frames = calloc(MAX(num_recs, 1), sizeof(struct frame));
+  int num_frames = build_frames(recs, num_recs, frames);
+  int stalls[NUM_STALLS] = {0};
+  classify_stalls(frames, num_frames, stalls);
+
+  if (!num_frames) {
+    LOG_WARNING("no complete frames in %s", argv[1]);
+    return EXIT_FAILURE;
+  }
+
+  int64_t *host_times = calloc(num_frames, sizeof(int64_t));
+  int64_t *emu_times = calloc(num_frames, sizeof(int64_t));
+  int64_t *video_times = calloc(num_frames, sizeof(int64_t));
+  for (int i = 0; i < num_frames; i++) {
+    host_times[i] = frames[i].host_time;
+    emu_times[i] = frames[i].emu_time;
+    video_times[i] = frames[i].video_time;
+  }
+  msort(host_times, num_frames, sizeof(int64_t), &time_cmp);
+  msort(emu_times, num_frames, sizeof(int64_t), &time_cmp);
+  msort(video_times, num_frames, sizeof(int64_t), &time_cmp);
+
+  plot_drift(frames, num_frames);
+
+  printf("%-10s %8s %8s %8s\n", "", "p50", "p99", "max");
+  printf("%-10s %8.2f %8.2f %8.2f\n", "frame ms",
+         percentile(host_times, num_frames, 50),
+         percentile(host_times, num_frames, 99),
+         host_times[num_frames - 1] / (double)NS_PER_MS);
+  printf("%-10s %8.2f %8.2f %8.2f\n", "emu ms",
+         percentile(emu_times, num_frames, 50),
+         percentile(emu_times, num_frames, 99),
+         emu_times[num_frames - 1] / (double)NS_PER_MS);
+  printf("%-10s %8.2f %8.2f %8.2f\n", "video ms",
+         percentile(video_times, num_frames, 50),
+         percentile(video_times, num_frames, 99),
+         video_times[num_frames - 1] / (double)NS_PER_MS);
+  printf("\n");
+
+  printf("%d frames, %.2f ms final drift\n", num_frames,
+         frames[num_frames - 1].drift / (double)NS_PER_MS);
+  for (int i = 0; i < NUM_STALLS; i++) {
+    printf("%-16s %d stalls\n", STALL_NAMES[i], stalls[i]);
+  }
+
+  if (*OPTION_csv && !write_csv(OPTION_csv, frames, num_frames)) {
+    LOG_WARNING("failed to write %s", OPTION_csv);
+  }
+
+  free(host_times);
+  free(emu_times);
+  free(video_times);
+  free(frames);
+  free(recs);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,50 @@
+/*
+ * disc image converter
+ *
+ * converts cdi, chd and gdi images to the seekable rdz format, which keeps
+ * the image compressed on disk while still allowing any sector to be read
+ * without decompressing more than a single block
+ */
+
+#include "core/core.h"
+#include "core/option.h"
+#include "core/time.h"
+#include "guest/gdrom/disc.h"
+#include "guest/gdrom/rdz.h"
+
+DEFINE_OPTION_INT(block_sectors, 8, "Number of sectors compressed per block");
+DEFINE_OPTION_INT(level, 9, "Compression level, from 1 to 9");
+
+int main(int argc, char **argv) {
+  if (!options_parse(&argc, &argv) || argc != 3) {
+    LOG_INFO("repack [--block_sectors=n] [--level=n] in.gdi out.rdz");
+    return EXIT_FAILURE;
+  }
+
+  const char *src = argv[1];
+  const char *dst = argv[2];
+
+  struct disc *disc = disc_create(src, 1);
+  if (!disc) {
+    LOG_WARNING("failed to load %s", src);
+    return EXIT_FAILURE;
+  }
+
+  int block_sectors = CLAMP(OPTION_block_sectors, 1, 1024);
+  int level = CLAMP(OPTION_level, 1, 9);
+  int64_t start = time_nanoseconds();
+
+  int res = rdz_write(disc, dst, block_sectors, level);
+
+  disc_destroy(disc);
+
+  if (!res) {
+    LOG_WARNING("failed to write %s", dst);
+    return EXIT_FAILURE;
+  }
+
+  int64_t elapsed = time_nanoseconds() - start;
+  LOG_INFO("wrote %s in %d ms", dst, (int)(elapsed / NS_PER_MS));
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,443 @@
+/*
+ * headless throughput benchmark
+ *
+ * boots a game without any host or render client attached, runs a fixed
+ * number of guest frames as fast as possible and prints a json report, so
+ * throughput can be compared between builds
+ *
+ * input can optionally be scripted from a file with lines of the form:
+ *
+ *   <frame> <port> <button> <value>
+ *
+ * where button is one of the names in BUTTON_NAMES and value is in the range
+ * of int16_t, e.g. "300 0 start 32767". lines starting with # are ignored
+ *
+ * alternatively, a movie recorded with --record_movie can be played back,
+ * reproducing the recorded run exactly. the report's memory hash can be used
+ * to check that two runs executed identically
+ *
+ * the benchmark also maintains the per-title profiles in profiles.ini. with
+ * --sweep, it reruns the game for each candidate value of the listed options,
+ * e.g. --sweep="texture_hash=0|1,gdrom_timing=instant|accurate", keeping the
+ * fastest value of each in turn and printing the resulting profile section.
+ * with --validate_profiles, it checks the database for unknown options
+ */
+
+#include "core/core.h"
+#include "core/exception_handler.h"
+#include "core/filesystem.h"
+#include "core/option.h"
+#include "core/time.h"
+#include "guest/aica/aica.h"
+#include "guest/dreamcast.h"
+#include "guest/gdrom/disc.h"
+#include "guest/profile.h"
+#include "options.h"
+#include "stats.h"
+
+#if PLATFORM_WINDOWS
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+DEFINE_OPTION_INT(frames, 3600, "Guest frames to run for");
+DEFINE_OPTION_STRING(input, "", "Input script to replay");
+DEFINE_OPTION_STRING(movie, "", "Input movie to play back");
+DEFINE_OPTION_STRING(sweep, "",
+                     "Options to generate a profile for, as "
+                     "\"name=a|b,name=c|d\"");
+DEFINE_OPTION_INT(validate_profiles, 0,
+                  "Check the profile database for unknown options and exit");
+
+#define BENCH_MAX_SWEEP 32
+
+static const char *BUTTON_NAMES[] = {
+    "c",     "b",     "a",     "start",  "up",    "down",  "left",
+    "right", "z",     "y",     "x",      "d",     "up2",   "down2",
+    "left2", "right2", "joyx", "joyy",   "ltrig", "rtrig",
+};
+struct bench_input {
+  int frame;
+  int port;
+  int button;
+  int16_t value;
+};
+
+static struct {
+  int64_t frames;
+  /* time the first guest frame was completed at */
+  int64_t first_frame;
+  struct bench_input *inputs;
+  int num_inputs;
+  int max_inputs;
+} bench;
+
+static void vblank_in(void *userdata, int video_disabled) {
+  if (!bench.frames++) {
+    bench.first_frame = time_nanoseconds();
+  }
+}
+
+static int bench_find_button(const char *name) {
+  for (int i = 0; i < ARRAY_SIZE(BUTTON_NAMES); i++) {
+    if (!strcmp(BUTTON_NAMES[i], name)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static int bench_load_input(const char *filename) {
+  FILE *file = fopen(filename, "r");
+
+  if (!file) {
+    return 0;
+  }
+
+  char line[256];
+
+  while (fgets(line, sizeof(line), file)) {
+    int frame, port, value;
+    char name[32];
+
+    if (line[0] == '#' ||
+        sscanf(line, "%d %d %31s %d", &frame, &port, name, &value) != 4) {
+      continue;
+    }
+
+    int button = bench_find_button(name);
+
+    if (button == -1 || port < 0 || port >= 4) {
+      LOG_WARNING("bench_load_input skipping invalid input '%s'", line);
+      continue;
+    }
+
+    if (bench.num_inputs == bench.max_inputs) {
+      bench.max_inputs = MAX(bench.max_inputs * 2, 64);
+      bench.inputs = realloc(bench.inputs,
+                             bench.max_inputs * sizeof(struct bench_input));
+    }
+
+    struct bench_input *input = &bench.inputs[bench.num_inputs++];
+    input->frame = frame;
+    input->port = port;
+    input->button = button;
+    input->value = (int16_t)CLAMP(value, INT16_MIN, INT16_MAX);
+  }
+
+  fclose(file);
+
+  return 1;
+}
+
+static void bench_print_sites(const char *name,
+                              const struct exception_site *sites) {
+  printf("      \"%s\": [", name);
+  for (int i = 0; i < EXCEPTION_MAX_SITES && sites[i].count; i++) {
+    printf("%s{\"addr\": \"0x%" PRIxPTR "\", \"count\": %" PRId64 "}",
+           i ? ", " : "", sites[i].addr, sites[i].count);
+  }
+  printf("]");
+}
+
+static void bench_print_exceptions(const struct exception_stats *stats,
+                                   int num_stats, double secs) {
+  printf("  \"exceptions\": [");
+
+  for (int i = 0; i < num_stats; i++) {
+    const struct exception_stats *s = &stats[i];
+    printf("%s\n    {\n", i ? "," : "");
+    printf("      \"handler\": \"%s\",\n", s->name);
+    printf("      \"count\": %" PRId64 ",\n", s->count);
+    printf("      \"per_sec\": %.2f,\n", s->count / secs);
+    printf("      \"ms\": %.3f,\n", s->time / (double)NS_PER_MS);
+    bench_print_sites("pcs", s->pcs);
+    printf(",\n");
+    bench_print_sites("guest_pcs", s->guest_pcs);
+    printf(",\n");
+    bench_print_sites("fault_addrs", s->fault_addrs);
+    printf("\n    }");
+  }
+
+  printf("%s],\n", num_stats ? "\n  " : "");
+}
+
+/* run in 1 ms slices, applying scripted input at the start of each frame */
+static void bench_run_frames(struct dreamcast *dc) {
+  int64_t slice = NS_PER_SEC / 1000;
+  int next_input = 0;
+
+  while (bench.frames < OPTION_frames && dc_running(dc)) {
+    while (next_input < bench.num_inputs &&
+           bench.inputs[next_input].frame <= bench.frames) {
+      struct bench_input *input = &bench.inputs[next_input++];
+      dc_input(dc, input->port, input->button, input->value);
+    }
+
+    dc_tick(dc, slice);
+  }
+}
+
+/* boot the game on a new machine with the current options, returning the
+   rate it ran at, or 0 if it didn't make it through every frame */
+static double bench_sweep_fps(const char *path) {
+  struct dreamcast *dc = dc_create();
+  if (!dc) {
+    return 0.0;
+  }
+
+  dc->vblank_in = &vblank_in;
+  bench.frames = 0;
+
+  if (!dc_load(dc, path)) {
+    dc_destroy(dc);
+    return 0.0;
+  }
+
+  int64_t start = time_nanoseconds();
+  bench_run_frames(dc);
+  int64_t elapsed = MAX(time_nanoseconds() - start, 1);
+
+  dc_destroy(dc);
+
+  if (bench.frames < OPTION_frames) {
+    return 0.0;
+  }
+
+  return bench.frames / (elapsed / (double)NS_PER_SEC);
+}
+
+static int bench_generate_profile(const char *path) {
+  struct disc *disc = path ? disc_create(path, 0) : NULL;
+  if (!disc) {
+    LOG_WARNING("bench_generate_profile %s isn't a disc", path);
+    return 0;
+  }
+
+  char section[64];
+  profile_section(disc, section, sizeof(section));
+  disc_destroy(disc);
+
+  /* each candidate is measured against the defaults, not the title's
+     existing profile */
+  OPTION_profiles[0] = 0;
+
+  char spec[OPTION_MAX_LENGTH];
+  strncpy(spec, OPTION_sweep, sizeof(spec));
+
+  const char *names[BENCH_MAX_SWEEP];
+  char values[BENCH_MAX_SWEEP][OPTION_MAX_LENGTH];
+  int num_swept = 0;
+
+  double default_fps = bench_sweep_fps(path);
+  double best_fps = default_fps;
+  LOG_INFO("bench_generate_profile defaults %.2f fps", default_fps);
+
+  /* tune one option at a time, each on top of the best values found for the
+     ones before it */
+  char *entry = spec;
+
+  while (entry && *entry && num_swept < BENCH_MAX_SWEEP) {
+    char *next = strchr(entry, ',');
+    if (next) {
+      *(next++) = 0;
+    }
+
+    char *value = strchr(entry, '=');
+    if (!value) {
+      LOG_WARNING("bench_generate_profile invalid sweep '%s'", entry);
+      return 0;
+    }
+    *(value++) = 0;
+
+    char *best = values[num_swept];
+    if (!option_get(entry, best, OPTION_MAX_LENGTH)) {
+      LOG_WARNING("bench_generate_profile unknown option %s", entry);
+      return 0;
+    }
+
+    while (value) {
+      char *next_value = strchr(value, '|');
+      if (next_value) {
+        *(next_value++) = 0;
+      }
+
+      option_set(entry, value);
+
+      double fps = bench_sweep_fps(path);
+      LOG_INFO("bench_generate_profile %s: %s %.2f fps", entry, value, fps);
+
+      if (fps > best_fps) {
+        best_fps = fps;
+        strncpy(best, value, OPTION_MAX_LENGTH);
+      }
+
+      value = next_value;
+    }
+
+    option_set(entry, best);
+    names[num_swept++] = entry;
+    entry = next;
+  }
+
+  printf("[%s]\n", section);
+  printf("; %.2f fps, %.2f with the defaults\n", best_fps, default_fps);
+  for (int i = 0; i < num_swept; i++) {
+    printf("%s: %s\n", names[i], values[i]);
+  }
+
+  return 1;
+}
+
+static int64_t bench_peak_rss() {
+#if PLATFORM_WINDOWS
+  PROCESS_MEMORY_COUNTERS counters;
+  if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters,
+                            sizeof(counters))) {
+    return 0;
+  }
+  return (int64_t)counters.PeakWorkingSetSize;
+#else
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage)) {
+    return 0;
+  }
+#if PLATFORM_DARWIN
+  return (int64_t)usage.ru_maxrss;
+#else
+  /* reported in kilobytes everywhere but mac */
+  return (int64_t)usage.ru_maxrss * 1024;
+#endif
+#endif
+}
+
+int main(int argc, char **argv) {
+  if (!options_parse(&argc, &argv)) {
+    LOG_INFO("reperf [--frames=n] [--input=script] [--movie=movie] "
+             "[--sweep=options] [--validate_profiles] [/path/to/game]");
+    return EXIT_FAILURE;
+  }
+
+  /* set application directory so the bios and flash are found */
+  char appdir[PATH_MAX];
+  char userdir[PATH_MAX];
+  int r = fs_userdir(userdir, sizeof(userdir));
+  CHECK(r);
+  snprintf(appdir, sizeof(appdir), "%s" PATH_SEPARATOR ".redream", userdir);
+  fs_set_appdir(appdir);
+
+  if (OPTION_validate_profiles) {
+    int num_sections = profile_validate(profile_path());
+    printf("{\"profiles\": \"%s\", \"sections\": %d, \"valid\": %s}\n",
+           profile_path(), MAX(num_sections, 0),
+           num_sections >= 0 ? "true" : "false");
+    return num_sections >= 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  if (*OPTION_input && !bench_load_input(OPTION_input)) {
+    LOG_WARNING("failed to load input script %s", OPTION_input);
+    return EXIT_FAILURE;
+  }
+
+  if (*OPTION_sweep) {
+    int res = bench_generate_profile(argc > 1 ? argv[1] : NULL);
+    free(bench.inputs);
+    return res ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  /* movies only play back as recorded when guest execution depends on
+     nothing but its input */
+  if (*OPTION_movie) {
+    OPTION_arm7_threaded = 0;
+    OPTION_fb_writeback = 0;
+  }
+
+  /* time each step of startup up until the first guest frame */
+  int64_t create_start = time_nanoseconds();
+
+  struct dreamcast *dc = dc_create();
+  if (!dc) {
+    LOG_WARNING("failed to create machine");
+    return EXIT_FAILURE;
+  }
+
+  dc->vblank_in = &vblank_in;
+
+  int64_t load_start = time_nanoseconds();
+
+  /* boot to the bios when no game is supplied */
+  const char *path = argc > 1 ? argv[1] : NULL;
+
+  if (!dc_load(dc, path)) {
+    LOG_WARNING("failed to load %s", path);
+    dc_destroy(dc);
+    return EXIT_FAILURE;
+  }
+
+  if (*OPTION_movie) {
+    /* start the clock where the emulator does when recording */
+    aica_set_clock(dc->aica, 0x5e0be100);
+
+    if (!dc_play_movie(dc, OPTION_movie)) {
+      LOG_WARNING("failed to play movie %s", OPTION_movie);
+      dc_destroy(dc);
+      return EXIT_FAILURE;
+    }
+  }
+
+  int64_t start = time_nanoseconds();
+  int64_t create_time = load_start - create_start;
+  int64_t load_time = start - load_start;
+
+  bench_run_frames(dc);
+
+  int64_t elapsed = MAX(time_nanoseconds() - start, 1);
+  double secs = elapsed / (double)NS_PER_SEC;
+
+  int64_t sh4_instrs = prof_counter_total(COUNTER_sh4_instrs);
+  int64_t arm7_instrs = prof_counter_total(COUNTER_arm7_instrs);
+  int64_t jit_blocks = prof_counter_total(COUNTER_jit_blocks);
+  int64_t jit_time = prof_counter_total(COUNTER_jit_compile_time);
+
+  /* the handlers are removed along with the machine */
+  struct exception_stats exc_stats[8];
+  int num_exc_stats = exception_handler_stats(exc_stats, ARRAY_SIZE(exc_stats));
+
+  uint64_t memory_hash = dc_hash_memory(dc);
+
+  /* sample memory usage while the machine is still alive */
+  struct mem_usage usage[MAX_MEM_USAGE];
+  int num_usage = stats_memory_usage(usage);
+
+  dc_destroy(dc);
+  free(bench.inputs);
+
+  printf("{\n");
+  printf("  \"game\": \"%s\",\n", path ? path : "bios");
+  printf("  \"frames\": %" PRId64 ",\n", bench.frames);
+  printf("  \"seconds\": %.3f,\n", secs);
+  printf("  \"fps\": %.2f,\n", bench.frames / secs);
+  printf("  \"sh4_mips\": %.2f,\n", sh4_instrs / secs / 1000000.0);
+  printf("  \"arm7_mips\": %.2f,\n", arm7_instrs / secs / 1000000.0);
+  printf("  \"memory_hash\": \"%016" PRIx64 "\",\n", memory_hash);
+  printf("  \"jit_blocks\": %" PRId64 ",\n", jit_blocks);
+  printf("  \"jit_compile_ms\": %.2f,\n", jit_time / (double)NS_PER_MS);
+  printf("  \"startup\": {\"create_ms\": %.2f, \"load_ms\": %.2f, "
+         "\"first_frame_ms\": %.2f},\n",
+         create_time / (double)NS_PER_MS, load_time / (double)NS_PER_MS,
+         bench.frames ? (bench.first_frame - create_start) / (double)NS_PER_MS
+                      : 0.0);
+  bench_print_exceptions(exc_stats, num_exc_stats, secs);
+  printf("  \"memory_mb\": {");
+  for (int i = 0; i < num_usage; i++) {
+    printf("%s\"%s\": %.2f", i ? ", " : "", usage[i].name,
+           usage[i].bytes / (1024.0 * 1024.0));
+  }
+  printf("},\n");
+  printf("  \"peak_rss_mb\": %.1f\n", bench_peak_rss() / (1024.0 * 1024.0));
+  printf("}\n");
+
+  return bench.frames >= OPTION_frames ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,345 @@
+#!/usr/bin/env python3
+
+"""
+performance regression harness
+
+runs a suite of benchmark cases through reperf, retrace bench and rebench,
+several times each, pinned to a single cpu. the median of each metric is
+written out as json, and optionally compared against a baseline written by
+a previous run, failing when a metric regresses by more than its threshold.
+
+the run to run noise of each metric is reported as its coefficient of
+variation. a regression is only flagged when the change is larger than both
+the threshold and the noise of the baseline and current runs, so a noisy
+machine produces warnings rather than false regressions.
+
+suites are json files of the form:
+
+  {
+    "threshold": 5.0,
+    "cases": [
+      {"name": "sonic", "tool": "reperf",
+       "args": ["--frames=3600", "--input=sonic.input", "sonic.gdi"]},
+      {"name": "sonic_ta", "tool": "retrace", "args": ["--gl", "sonic.trace"]},
+      {"name": "sonic_disc", "tool": "rebench", "args": ["sonic.gdi"],
+       "threshold": 10.0}
+    ]
+  }
+
+relative paths in args are resolved against the suite's directory
+"""
+
+import argparse
+import json
+import os
+import platform
+import re
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+HIGHER = "higher"
+LOWER = "lower"
+
+RETRACE_STAGES = ["copy", "texture", "parse", "render"]
+
+
+class CaseError(Exception):
+  pass
+
+
+def run_tool(cmd, cpu):
+  def pin():
+    if cpu is not None and hasattr(os, "sched_setaffinity"):
+      os.sched_setaffinity(0, {cpu})
+
+  res = subprocess.run(cmd, stdout=subprocess.PIPE, stderr=subprocess.STDOUT,
+                       universal_newlines=True, preexec_fn=pin)
+  if res.returncode:
+    raise CaseError("%s exited with %d:\n%s" %
+                    (" ".join(cmd), res.returncode, res.stdout[-2000:]))
+  return res.stdout
+
+
+def run_reperf(tool, args, cpu):
+  out = run_tool([tool] + args, cpu)
+
+  # the report is the last thing written, after any log output
+  start = out.rfind("\n{")
+  try:
+    report = json.loads(out[start + 1:] if start >= 0 else out)
+  except ValueError:
+    raise CaseError("failed to parse reperf report:\n%s" % out[-2000:])
+
+  return {
+      "fps": (report["fps"], HIGHER),
+      "sh4_mips": (report["sh4_mips"], HIGHER),
+      "arm7_mips": (report["arm7_mips"], HIGHER),
+      "jit_compile_ms": (report["jit_compile_ms"], LOWER),
+      "peak_rss_mb": (report["peak_rss_mb"], LOWER),
+  }
+
+
+def run_retrace(tool, args, cpu):
+  fd, csv = tempfile.mkstemp(suffix=".csv")
+  os.close(fd)
+
+  try:
+    run_tool([tool, "bench", "--csv", csv] + args, cpu)
+
+    with open(csv) as f:
+      rows = [line.strip().split(",") for line in f if line.strip()]
+  finally:
+    os.remove(csv)
+
+  if len(rows) < 2:
+    raise CaseError("retrace bench didn't render any frames")
+
+  header = rows[0]
+  metrics = {}
+
+  for stage in RETRACE_STAGES:
+    col = header.index(stage + "_ms")
+    times = sorted(float(row[col]) for row in rows[1:])
+    p99 = times[min(len(times) * 99 // 100, len(times) - 1)]
+    metrics[stage + "_mean_ms"] = (statistics.mean(times), LOWER)
+    metrics[stage + "_p99_ms"] = (p99, LOWER)
+
+  return metrics
+
+
+def run_rebench(tool, args, cpu):
+  out = run_tool([tool] + args, cpu)
+
+  rate = re.search(r"([\d.]+) sectors/s, ([\d.]+) MB/s", out)
+  latency = re.search(r"latency us p50 ([\d.]+), p90 ([\d.]+), p99 ([\d.]+)",
+                      out)
+  if not rate or not latency:
+    raise CaseError("failed to parse rebench output:\n%s" % out[-2000:])
+
+  return {
+      "mb_per_sec": (float(rate.group(2)), HIGHER),
+      "p50_latency_us": (float(latency.group(1)), LOWER),
+      "p99_latency_us": (float(latency.group(3)), LOWER),
+  }
+
+
+RUNNERS = {
+    "reperf": run_reperf,
+    "retrace": run_retrace,
+    "rebench": run_rebench,
+}
+
+
+def resolve_args(args, base):
+  # only rewrite arguments that name an existing file relative to the suite,
+  # leaving options alone
+  resolved = []
+  for arg in args:
+    key, sep, value = arg.partition("=")
+    if arg.startswith("--") and sep:
+      path = os.path.join(base, value)
+      resolved.append(key + sep + path if value and os.path.exists(path) else
+                      arg)
+    else:
+      path = os.path.join(base, arg)
+      resolved.append(path if not arg.startswith("-") and
+                      os.path.exists(path) else arg)
+  return resolved
+
+
+def summarize(samples, better):
+  median = statistics.median(samples)
+  mean = statistics.mean(samples)
+  stdev = statistics.stdev(samples) if len(samples) > 1 else 0.0
+  return {
+      "median": median,
+      "min": min(samples),
+      "max": max(samples),
+      "cv": 100.0 * stdev / mean if mean else 0.0,
+      "better": better,
+      "samples": samples,
+  }
+
+
+def run_case(case, tools, base, runs, warmup, cpu):
+  tool = case["tool"]
+  if tool not in RUNNERS:
+    raise CaseError("unknown tool %s" % tool)
+
+  path = tools[tool]
+  if not path:
+    raise CaseError("no path to %s, pass --%s" % (tool, tool))
+
+  args = resolve_args(case.get("args", []), base)
+  samples = {}
+  better = {}
+
+  for i in range(warmup + runs):
+    metrics = RUNNERS[tool](path, args, cpu)
+    if i < warmup:
+      continue
+    for name, (value, direction) in metrics.items():
+      samples.setdefault(name, []).append(value)
+      better[name] = direction
+
+  return {name: summarize(samples[name], better[name]) for name in samples}
+
+
+def machine_state(cpu):
+  state = {
+      "host": platform.node(),
+      "platform": platform.platform(),
+      "cpu": cpu,
+      "time": time.strftime("%Y-%m-%dT%H:%M:%S"),
+  }
+  warnings = []
+
+  if hasattr(os, "getloadavg"):
+    load = os.getloadavg()[0]
+    state["load"] = load
+    if load > 0.5:
+      warnings.append("load average is %.2f, results may be noisy" % load)
+
+  if cpu is not None:
+    governor = "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_governor" % cpu
+    if os.path.exists(governor):
+      with open(governor) as f:
+        state["governor"] = f.read().strip()
+      if state["governor"] != "performance":
+        warnings.append("cpu %d uses the %s governor, not performance" %
+                        (cpu, state["governor"]))
+
+    if not hasattr(os, "sched_setaffinity"):
+      warnings.append("cpu pinning isn't supported on this platform")
+
+  return state, warnings
+
+
+def compare(results, baseline, default_threshold, thresholds):
+  regressions = []
+  lines = []
+
+  for case, metrics in sorted(results["cases"].items()):
+    base_metrics = baseline["cases"].get(case)
+    if not base_metrics:
+      lines.append("%s: not in baseline" % case)
+      continue
+
+    threshold = thresholds.get(case, default_threshold)
+
+    for name, cur in sorted(metrics.items()):
+      base = base_metrics.get(name)
+      if not base or not base["median"]:
+        continue
+
+      delta = 100.0 * (cur["median"] - base["median"]) / base["median"]
+      worse = -delta if cur["better"] == HIGHER else delta
+      noise = max(cur["cv"], base["cv"])
+      limit = max(threshold, 2.0 * noise)
+
+      status = "ok"
+      if worse > limit:
+        status = "REGRESSION"
+        regressions.append("%s.%s" % (case, name))
+      elif worse > threshold:
+        status = "noisy"
+      elif -worse > limit:
+        status = "improved"
+
+      lines.append("%-40s %12.3f -> %12.3f %+7.2f%%  noise %5.2f%%  %s" %
+                   ("%s.%s" % (case, name), base["median"], cur["median"],
+                    delta, noise, status))
+
+  return lines, regressions
+
+
+def main():
+  parser = argparse.ArgumentParser(
+      description="run a benchmark suite and compare it against a baseline")
+  parser.add_argument("--suite", required=True, help="suite json file")
+  parser.add_argument("--out", help="write results json to this file")
+  parser.add_argument("--baseline", help="results json to compare against")
+  parser.add_argument("--runs", type=int, default=5,
+                      help="timed runs per case")
+  parser.add_argument("--warmup", type=int, default=1,
+                      help="untimed runs per case")
+  parser.add_argument("--cpu", type=int, default=None,
+                      help="cpu to pin each run to")
+  parser.add_argument("--threshold", type=float, default=None,
+                      help="default regression threshold, in percent")
+  parser.add_argument("--only", help="comma-separated list of cases to run")
+  for tool in sorted(RUNNERS):
+    parser.add_argument("--" + tool, help="path to " + tool)
+  opts = parser.parse_args()
+
+  with open(opts.suite) as f:
+    suite = json.load(f)
+
+  base = os.path.dirname(os.path.abspath(opts.suite))
+  tools = {tool: getattr(opts, tool) for tool in RUNNERS}
+  only = set(opts.only.split(",")) if opts.only else None
+  default_threshold = (opts.threshold if opts.threshold is not None else
+                       suite.get("threshold", 5.0))
+
+  state, warnings = machine_state(opts.cpu)
+  for warning in warnings:
+    print("warning: %s" % warning)
+
+  results = {"machine": state, "runs": opts.runs, "cases": {}}
+  thresholds = {}
+  failed = []
+
+  for case in suite["cases"]:
+    name = case["name"]
+    if only and name not in only:
+      continue
+
+    if "threshold" in case:
+      thresholds[name] = case["threshold"]
+
+    print("running %s (%s, %d runs)" % (name, case["tool"], opts.runs))
+    try:
+      metrics = run_case(case, tools, base, opts.runs, opts.warmup, opts.cpu)
+    except CaseError as e:
+      print("  failed: %s" % e)
+      failed.append(name)
+      continue
+
+    results["cases"][name] = metrics
+    for metric, s in sorted(metrics.items()):
+      print("  %-24s %12.3f  noise %5.2f%%" % (metric, s["median"], s["cv"]))
+
+  if opts.out:
+    with open(opts.out, "w") as f:
+      json.dump(results, f, indent=2, sort_keys=True)
+    print("wrote %s" % opts.out)
+
+  regressions = []
+
+  if opts.baseline:
+    with open(opts.baseline) as f:
+      baseline = json.load(f)
+
+    print("")
+    print("compared to %s (threshold %.1f%%)" % (opts.baseline,
+                                                 default_threshold))
+    lines, regressions = compare(results, baseline, default_threshold,
+                                 thresholds)
+    for line in lines:
+      print(line)
+
+    if regressions:
+      print("")
+      print("%d regressions: %s" % (len(regressions), ", ".join(regressions)))
+
+  if failed:
+    print("%d cases failed: %s" % (len(failed), ", ".join(failed)))
+
+  return 1 if failed or regressions else 0
+
+
+if __name__ == "__main__":
+  sys.exit(main())
@@ -1,6 +1,8 @@
 #include <stdio.h>
 #include "core/core.h"
 #include "core/filesystem.h"
+#include "core/thread.h"
+#include "core/time.h"
 #include "guest/pvr/tex.h"
 
 #define STB_IMAGE_WRITE_IMPLEMENTATION
@@ -27,7 +29,21 @@ char *pixel_fmt_names[] = {
     "ARGB1555", "RGB565", "ARGB4444", "YUV422",
 };
 
-uint8_t *read_tex(const char *filename) {
+#define MAX_TEX_SIZE (1024 * 1024 * 4)
+
+/* totals across every texture converted, in batch mode each worker keeps
+   its own and merges them once it's done */
+struct tex_stats {
+  int textures;
+  int failed;
+  int levels;
+  int64_t bytes;
+  int64_t pixels;
+  int64_t decode_time;
+  int64_t write_time;
+};
+
+uint8_t *read_tex(const char *filename, int *size_out) {
   FILE *fp = fopen(filename, "rb");
   if (!fp) {
     LOG_WARNING("failed to open '%s'", filename);
@@ -43,20 +59,90 @@ uint8_t *read_tex(const char *filename) {
   CHECK_EQ(n, size);
   fclose(fp);
 
+  *size_out = size;
   return buffer;
 }
 
+/* decode each mip level of the texture and write it out as a png named
+   after the texture and level dimensions, in outdir if set */
+static int write_levels(const char *texname, const char *outdir,
+                        const struct pvr_tex_header *header,
+                        const uint8_t *data, uint8_t *converted,
+                        int converted_size, int verbose,
+                        struct tex_stats *stats) {
+  int mipmaps = pvr_tex_mipmaps(header->texture_fmt);
+  int levels = mipmaps ? ctz32(header->width) + 1 : 1;
+
+  if (header->width * header->height * 4 > converted_size) {
+    LOG_WARNING("%s is too large to convert (%dx%d)", texname, header->width,
+                header->height);
+    return 0;
+  }
+
+  char basename[PATH_MAX];
+  if (outdir) {
+    char base[PATH_MAX];
+    fs_basename(texname, base, sizeof(base));
+    snprintf(basename, sizeof(basename), "%s" PATH_SEPARATOR "%s", outdir,
+             base);
+  } else {
+    snprintf(basename, sizeof(basename), "%s", texname);
+  }
+
+  while (levels--) {
+    int mip_width = header->width >> levels;
+    int mip_height = header->height >> levels;
+
+    int64_t start = time_nanoseconds();
+    pvr_tex_decode(data, mip_width, mip_height, mip_width, header->texture_fmt,
+                   header->pixel_fmt, NULL, 0, PXL_RGBA, converted,
+                   converted_size);
+    int64_t decoded = time_nanoseconds();
+
+    char pngname[PATH_MAX];
+    snprintf(pngname, sizeof(pngname), "%s.%dx%d.png", basename, mip_width,
+             mip_height);
+
+    if (verbose) {
+      LOG_INFO("writing %s", pngname);
+    }
+
+    int stride = mip_width * 4;
+    int res =
+        stbi_write_png(pngname, mip_width, mip_height, 4, converted, stride);
+    int64_t written = time_nanoseconds();
+
+    if (!res) {
+      LOG_WARNING("failed to write %s", pngname);
+      return 0;
+    }
+
+    stats->levels++;
+    stats->pixels += mip_width * mip_height;
+    stats->decode_time += decoded - start;
+    stats->write_time += written - decoded;
+  }
+
+  return 1;
+}
+
 void convert_tex(const char *texname) {
   LOG_INFO("#==--------------------------------------------------==#");
   LOG_INFO("# %s", texname);
   LOG_INFO("#==--------------------------------------------------==#");
 
-  uint8_t *buffer = read_tex(texname);
+  int size = 0;
+  uint8_t *buffer = read_tex(texname, &size);
+
+  if (!buffer) {
+    return;
+  }
 
   const struct pvr_tex_header *header = pvr_tex_header(buffer);
 
   if (!header) {
     LOG_WARNING("convert_tex failed to find a valid PVRT header");
+    free(buffer);
     return;
   }
 
@@ -74,32 +160,218 @@ void convert_tex(const char *texname) {
   LOG_INFO("");
 
   /* convert each mip level to png */
-  static uint8_t converted[1024 * 1024 * 4];
-  int mipmaps = pvr_tex_mipmaps(header->texture_fmt);
-  int levels = mipmaps ? ctz32(header->width) + 1 : 1;
+  static uint8_t converted[MAX_TEX_SIZE];
+  struct tex_stats stats = {0};
+  write_levels(texname, NULL, header, data, converted, sizeof(converted), 1,
+               &stats);
 
-  while (levels--) {
-    int mip_width = header->width >> levels;
-    int mip_height = header->height >> levels;
-    pvr_tex_decode(data, mip_width, mip_height, mip_width, header->texture_fmt,
-                   header->pixel_fmt, NULL, 0, converted, sizeof(converted));
+  free(buffer);
+}
 
-    char pngname[PATH_MAX];
-    snprintf(pngname, sizeof(pngname), "%s.%dx%d.png", texname, mip_width,
-             mip_height);
+/*
+ * batch mode, converting every texture found in the input files and
+ * directories across a pool of worker threads
+ */
+struct batch {
+  const char *outdir;
+  char **files;
+  int num_files;
+  int max_files;
 
-    LOG_INFO("writing %s", pngname);
+  mutex_t mutex;
+  int next_file;
+  struct tex_stats stats;
+};
 
-    int stride = mip_width * 4;
-    int res =
-        stbi_write_png(pngname, mip_width, mip_height, 4, converted, stride);
-    CHECK_NE(res, 0);
+static int has_pvr_ext(const char *filename) {
+  const char *ext = strrchr(filename, '.');
+  return ext && !strcasecmp(ext, ".pvr");
+}
+
+static void batch_add_file(struct batch *batch, const char *filename) {
+  if (batch->num_files == batch->max_files) {
+    batch->max_files = MAX(batch->max_files * 2, 256);
+    batch->files = realloc(batch->files, batch->max_files * sizeof(char *));
+  }
+
+  batch->files[batch->num_files++] = strdup(filename);
+}
+
+static void batch_add_dir(struct batch *batch, const char *path) {
+  DIR *dir = opendir(path);
+
+  if (!dir) {
+    LOG_WARNING("failed to open directory %s", path);
+    return;
+  }
+
+  struct dirent *ent = NULL;
+
+  while ((ent = readdir(dir)) != NULL) {
+    if (ent->d_name[0] == '.') {
+      continue;
+    }
+
+    char filename[PATH_MAX];
+    snprintf(filename, sizeof(filename), "%s" PATH_SEPARATOR "%s", path,
+             ent->d_name);
+
+    if (fs_isdir(filename)) {
+      batch_add_dir(batch, filename);
+    } else if (has_pvr_ext(filename)) {
+      batch_add_file(batch, filename);
+    }
+  }
+
+  closedir(dir);
+}
+
+static void batch_convert(struct batch *batch, const char *texname,
+                          uint8_t *converted, struct tex_stats *stats) {
+  int size = 0;
+  uint8_t *buffer = read_tex(texname, &size);
+
+  if (!buffer) {
+    stats->failed++;
+    return;
+  }
+
+  const struct pvr_tex_header *header = pvr_tex_header(buffer);
+
+  if (!header || header->pixel_fmt >= ARRAY_SIZE(pixel_fmt_names)) {
+    LOG_WARNING("%s doesn't contain a valid PVRT header", texname);
+    stats->failed++;
+  } else if (!write_levels(texname, batch->outdir, header,
+                           pvr_tex_data(buffer), converted, MAX_TEX_SIZE, 0,
+                           stats)) {
+    stats->failed++;
+  } else {
+    stats->textures++;
+    stats->bytes += size;
   }
 
   free(buffer);
 }
 
+static void *batch_worker(void *data) {
+  struct batch *batch = data;
+  struct tex_stats stats = {0};
+  uint8_t *converted = malloc(MAX_TEX_SIZE);
+
+  while (1) {
+    mutex_lock(batch->mutex);
+    int n = batch->next_file++;
+    mutex_unlock(batch->mutex);
+
+    if (n >= batch->num_files) {
+      break;
+    }
+
+    batch_convert(batch, batch->files[n], converted, &stats);
+  }
+
+  free(converted);
+
+  mutex_lock(batch->mutex);
+  batch->stats.textures += stats.textures;
+  batch->stats.failed += stats.failed;
+  batch->stats.levels += stats.levels;
+  batch->stats.bytes += stats.bytes;
+  batch->stats.pixels += stats.pixels;
+  batch->stats.decode_time += stats.decode_time;
+  batch->stats.write_time += stats.write_time;
+  mutex_unlock(batch->mutex);
+
+  return NULL;
+}
+
+static void batch_print(const struct batch *batch, int num_threads,
+                        int64_t elapsed) {
+  const struct tex_stats *stats = &batch->stats;
+  double secs = elapsed / (double)NS_PER_SEC;
+
+  LOG_INFO("converted %d textures (%d levels), %d failed, in %.2f s using "
+           "%d threads",
+           stats->textures, stats->levels, stats->failed, secs, num_threads);
+  LOG_INFO("%.1f textures/sec, %.2f MB/sec read, %.2f Mpixels/sec decoded",
+           stats->textures / secs, stats->bytes / secs / (1024.0 * 1024.0),
+           stats->pixels / secs / 1000000.0);
+
+  /* decode and write times are summed across threads */
+  int64_t busy = stats->decode_time + stats->write_time;
+  LOG_INFO("decode %.2f ms (%.1f%%), write %.2f ms (%.1f%%) of thread time",
+           stats->decode_time / (double)NS_PER_MS,
+           busy ? stats->decode_time * 100.0 / busy : 0.0,
+           stats->write_time / (double)NS_PER_MS,
+           busy ? stats->write_time * 100.0 / busy : 0.0);
+}
+
+static int batch_run(int argc, char **argv) {
+  struct batch batch = {0};
+  int num_threads = 4;
+
+  for (int i = 0; i < argc; i++) {
+    if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+      num_threads = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--out") && i + 1 < argc) {
+      batch.outdir = argv[++i];
+    } else if (fs_isdir(argv[i])) {
+      batch_add_dir(&batch, argv[i]);
+    } else {
+      /* globs are expected to have been expanded by the shell */
+      batch_add_file(&batch, argv[i]);
+    }
+  }
+
+  if (num_threads < 1) {
+    LOG_WARNING("invalid thread count %d", num_threads);
+    return EXIT_FAILURE;
+  }
+
+  if (batch.outdir && !fs_mkdir(batch.outdir)) {
+    LOG_WARNING("failed to create output directory %s", batch.outdir);
+    return EXIT_FAILURE;
+  }
+
+  /* the twiddle table is lazily initialized on first use, do so before
+     the workers would race to */
+  pvr_init_twiddle_table();
+
+  num_threads = MIN(num_threads, MAX(batch.num_files, 1));
+  thread_t *threads = calloc(num_threads, sizeof(thread_t));
+  batch.mutex = mutex_create();
+
+  int64_t start = time_nanoseconds();
+
+  for (int i = 0; i < num_threads; i++) {
+    threads[i] = thread_create(&batch_worker, "retex", &batch);
+    CHECK_NOTNULL(threads[i]);
+  }
+
+  for (int i = 0; i < num_threads; i++) {
+    void *result;
+    thread_join(threads[i], &result);
+  }
+
+  int64_t elapsed = time_nanoseconds() - start;
+  batch_print(&batch, num_threads, elapsed);
+
+  mutex_destroy(batch.mutex);
+  free(threads);
+
+  for (int i = 0; i < batch.num_files; i++) {
+    free(batch.files[i]);
+  }
+  free(batch.files);
+
+  return batch.stats.failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
 int main(int argc, char **argv) {
+  if (argc > 1 && !strcmp(argv[1], "--batch")) {
+    return batch_run(argc - 2, argv + 2);
+  }
+
   for (int i = 1; i < argc; i++) {
     convert_tex(argv[i]);
   }
@@ -0,0 +1,357 @@
+#include <glad/glad.h>
+#define SDL_MAIN_HANDLED
+#include <SDL.h>
+#include "core/core.h"
+#include "core/rb_tree.h"
+#include "core/sort.h"
+#include "core/time.h"
+#include "file/trace.h"
+#include "guest/pvr/tr.h"
+#include "render/render_backend.h"
+
+/*
+ * replays each context in a trace through the same stages the video thread
+ * runs them through, timing each stage per frame:
+ *
+ *   copy     trace_copy_context, standing in for the ta's context copy
+ *   texture  tr_convert_textures, decoding and uploading dirty textures
+ *   parse    tr_parse_context
+ *   render   tr_render_context, waiting on the gpu to finish the frame
+ *
+ * without --gl, contexts are converted without a render backend, in which
+ * case textures are never decoded and only the copy and parse stages run
+ */
+
+enum {
+  STAGE_COPY,
+  STAGE_TEXTURE,
+  STAGE_PARSE,
+  STAGE_RENDER,
+  NUM_STAGES,
+};
+
+static const char *stage_names[NUM_STAGES] = {"copy", "texture", "parse",
+                                              "render"};
+
+struct bench_texture {
+  struct tr_texture;
+  struct rb_node it;
+};
+
+struct bench {
+  struct trace *trace;
+  struct render_backend *r;
+  struct tr_converter *cv;
+  struct rb_tree textures;
+
+  /* per-frame stage times */
+  int64_t *times[NUM_STAGES];
+  int num_frames;
+  int max_frames;
+};
+
+static int bench_texture_cmp(const struct rb_node *rb_lhs,
+                             const struct rb_node *rb_rhs) {
+  const struct bench_texture *lhs =
+      rb_entry(rb_lhs, const struct bench_texture, it);
+  tr_texture_key_t lhs_key = tr_texture_key(lhs->tsp, lhs->tcw);
+
+  const struct bench_texture *rhs =
+      rb_entry(rb_rhs, const struct bench_texture, it);
+  tr_texture_key_t rhs_key = tr_texture_key(rhs->tsp, rhs->tcw);
+
+  if (lhs_key < rhs_key) {
+    return -1;
+  } else if (lhs_key > rhs_key) {
+    return 1;
+  } else {
+    return 0;
+  }
+}
+
+static struct rb_callbacks bench_texture_cb = {&bench_texture_cmp, NULL,
+                                               NULL};
+
+static struct tr_texture *bench_find_texture(void *userdata, union tsp tsp,
+                                             union tcw tcw) {
+  struct bench *bench = userdata;
+
+  struct bench_texture search;
+  search.tsp = tsp;
+  search.tcw = tcw;
+
+  return (struct tr_texture *)rb_find_entry(&bench->textures, &search,
+                                            struct bench_texture, it,
+                                            &bench_texture_cb);
+}
+
+static void bench_add_texture(struct bench *bench,
+                              const struct trace_cmd *cmd) {
+  struct bench_texture *tex = (struct bench_texture *)bench_find_texture(
+      bench, cmd->texture.tsp, cmd->texture.tcw);
+
+  if (!tex) {
+    tex = calloc(1, sizeof(struct bench_texture));
+    tex->tsp = cmd->texture.tsp;
+    tex->tcw = cmd->texture.tcw;
+    rb_insert(&bench->textures, &tex->it, &bench_texture_cb);
+  }
+
+  tex->frame = cmd->texture.frame;
+  tex->texture = cmd->texture.texture;
+  tex->texture_size = cmd->texture.texture_size;
+  tex->palette = cmd->texture.palette;
+  tex->palette_size = cmd->texture.palette_size;
+
+  /* without a render backend, give the texture a non-zero handle so parsing
+     doesn't consider it missing */
+  if (bench->r) {
+    tex->dirty = 1;
+  } else {
+    tex->handle = 1;
+  }
+}
+
+static void bench_destroy_textures(struct bench *bench) {
+  rb_for_each_entry_safe(tex, &bench->textures, struct bench_texture, it) {
+    if (bench->r) {
+      tr_release_texture(bench->cv, bench->r, (struct tr_texture *)tex);
+    }
+    rb_unlink(&bench->textures, &tex->it, &bench_texture_cb);
+    free(tex);
+  }
+}
+
+static void bench_run_context(struct bench *bench, const struct trace_cmd *cmd,
+                              struct ta_context *ctx, struct tr_context *rc) {
+  if (bench->num_frames == bench->max_frames) {
+    bench->max_frames = MAX(bench->max_frames * 2, 1024);
+    for (int i = 0; i < NUM_STAGES; i++) {
+      bench->times[i] =
+          realloc(bench->times[i], bench->max_frames * sizeof(int64_t));
+    }
+  }
+
+  int frame = bench->num_frames++;
+  int64_t start = time_nanoseconds();
+
+  trace_copy_context(cmd, ctx);
+  int64_t copied = time_nanoseconds();
+
+  if (bench->r) {
+    tr_convert_textures(bench->cv, bench->r, bench, &bench_find_texture, ctx);
+  }
+  int64_t converted = time_nanoseconds();
+
+  tr_parse_context(bench->cv, bench, &bench_find_texture, ctx, rc);
+  int64_t parsed = time_nanoseconds();
+
+  if (bench->r) {
+    uint8_t pixel[4];
+    r_clear(bench->r);
+    tr_render_context(bench->r, rc);
+
+    /* read back a single pixel to wait on the gpu to finish rendering */
+    r_begin_readback(bench->r, 0, 0, 1, 1);
+    r_end_readback(bench->r, pixel, 1);
+  }
+  int64_t rendered = time_nanoseconds();
+
+  bench->times[STAGE_COPY][frame] = copied - start;
+  bench->times[STAGE_TEXTURE][frame] = converted - copied;
+  bench->times[STAGE_PARSE][frame] = parsed - converted;
+  bench->times[STAGE_RENDER][frame] = rendered - parsed;
+}
+
+static void bench_run(struct bench *bench, int loops) {
+  struct ta_context *ctx = calloc(1, sizeof(struct ta_context));
+  struct tr_context *rc = calloc(1, sizeof(struct tr_context));
+
+  bench->cv = tr_create_converter();
+
+  for (int i = 0; i < loops; i++) {
+    struct trace_cmd cmd;
+
+    for (int n = 0; trace_get_cmd(bench->trace, n, &cmd); n++) {
+      if (cmd.type == TRACE_CMD_TEXTURE) {
+        bench_add_texture(bench, &cmd);
+      } else if (cmd.type == TRACE_CMD_CONTEXT) {
+        bench_run_context(bench, &cmd, ctx, rc);
+      }
+    }
+  }
+
+  /* shared textures are tracked by the converter, release them first */
+  bench_destroy_textures(bench);
+  tr_destroy_converter(bench->cv);
+  bench->cv = NULL;
+
+  tr_destroy_context(rc);
+  free(rc);
+  free(ctx);
+}
+
+static int time_cmp(const void *a, const void *b) {
+  return *(const int64_t *)a <= *(const int64_t *)b;
+}
+
+static void bench_write_csv(struct bench *bench, const char *path) {
+  FILE *file = fopen(path, "w");
+  if (!file) {
+    LOG_WARNING("failed to open %s", path);
+    return;
+  }
+
+  fprintf(file, "frame");
+  for (int i = 0; i < NUM_STAGES; i++) {
+    fprintf(file, ",%s_ms", stage_names[i]);
+  }
+  fprintf(file, "\n");
+
+  for (int n = 0; n < bench->num_frames; n++) {
+    fprintf(file, "%d", n);
+    for (int i = 0; i < NUM_STAGES; i++) {
+      fprintf(file, ",%.4f", bench->times[i][n] / (double)NS_PER_MS);
+    }
+    fprintf(file, "\n");
+  }
+
+  fclose(file);
+}
+
+static void bench_print(struct bench *bench) {
+  int num = bench->num_frames;
+  int64_t *sorted = malloc(num * sizeof(int64_t));
+
+  LOG_INFO("===-----------------------------------------------------===");
+  LOG_INFO("%d frames, %s", num,
+           bench->r ? "gl backend" : "no render backend");
+  LOG_INFO("===-----------------------------------------------------===");
+  LOG_INFO("");
+  LOG_INFO("%-10s %10s %10s %10s %10s", "stage (ms)", "mean", "p50", "p99",
+           "max");
+
+  for (int i = 0; i < NUM_STAGES; i++) {
+    int64_t total = 0;
+    for (int n = 0; n < num; n++) {
+      sorted[n] = bench->times[i][n];
+      total += sorted[n];
+    }
+    msort(sorted, num, sizeof(int64_t), &time_cmp);
+
+    LOG_INFO("%-10s %10.4f %10.4f %10.4f %10.4f", stage_names[i],
+             total / (double)num / NS_PER_MS,
+             sorted[num / 2] / (double)NS_PER_MS,
+             sorted[MIN(num * 99 / 100, num - 1)] / (double)NS_PER_MS,
+             sorted[num - 1] / (double)NS_PER_MS);
+  }
+
+  free(sorted);
+}
+
+static SDL_Window *bench_create_window(SDL_GLContext *ctx) {
+  if (SDL_Init(SDL_INIT_VIDEO) < 0) {
+    LOG_WARNING("failed to initialize sdl: %s", SDL_GetError());
+    return NULL;
+  }
+
+  SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
+  SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
+  SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
+  SDL_GL_SetAttribute(SDL_GL_DEPTH_SIZE, 24);
+
+  /* rendering is done to the backend's own framebuffers, the window only
+     exists to own the context */
+  SDL_Window *win =
+      SDL_CreateWindow("retrace", SDL_WINDOWPOS_UNDEFINED,
+                       SDL_WINDOWPOS_UNDEFINED, 640, 480,
+                       SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN);
+  if (!win) {
+    LOG_WARNING("failed to create window: %s", SDL_GetError());
+    SDL_Quit();
+    return NULL;
+  }
+
+  *ctx = SDL_GL_CreateContext(win);
+  if (!*ctx || !gladLoadGLLoader((GLADloadproc)&SDL_GL_GetProcAddress)) {
+    LOG_WARNING("failed to create gl context: %s", SDL_GetError());
+    SDL_DestroyWindow(win);
+    SDL_Quit();
+    return NULL;
+  }
+
+  SDL_GL_SetSwapInterval(0);
+
+  return win;
+}
+
+int cmd_bench(int argc, const char **argv) {
+  const char *filename = NULL;
+  const char *csv = NULL;
+  int gl = 0;
+  int loops = 1;
+
+  for (int i = 0; i < argc; i++) {
+    if (!strcmp(argv[i], "--gl")) {
+      gl = 1;
+    } else if (!strcmp(argv[i], "--loops") && i + 1 < argc) {
+      loops = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--csv") && i + 1 < argc) {
+      csv = argv[++i];
+    } else {
+      filename = argv[i];
+    }
+  }
+
+  if (!filename || loops < 1) {
+    return 0;
+  }
+
+  struct bench bench = {0};
+  bench.trace = trace_parse(filename);
+
+  if (!bench.trace) {
+    LOG_WARNING("failed to parse %s", filename);
+    return 0;
+  }
+
+  SDL_Window *win = NULL;
+  SDL_GLContext ctx = NULL;
+
+  if (gl) {
+    win = bench_create_window(&ctx);
+
+    if (!win) {
+      trace_destroy(bench.trace);
+      return 0;
+    }
+
+    bench.r = r_create(640, 480);
+  }
+
+  bench_run(&bench, loops);
+
+  if (bench.num_frames) {
+    bench_print(&bench);
+
+    if (csv) {
+      bench_write_csv(&bench, csv);
+    }
+  } else {
+    LOG_WARNING("no contexts in %s", filename);
+  }
+
+  if (bench.r) {
+    r_destroy(bench.r);
+    SDL_GL_DeleteContext(ctx);
+    SDL_DestroyWindow(win);
+    SDL_Quit();
+  }
+
+  for (int i = 0; i < NUM_STAGES; i++) {
+    free(bench.times[i]);
+  }
+  trace_destroy(bench.trace);
+
+  return 1;
+}
@@ -21,7 +21,8 @@ typedef void (*depth_cb)(float, float, float, struct depth_entry *);
 struct test {
   const char *name;
   depth_cb depth;
-  sort_cmp cmp;
+  /* the depth values are floats rather than ints */
+  int flt;
   int match;
   int total;
 };
@@ -35,28 +36,43 @@ static struct tr_texture *find_texture(void *userdata, union tsp tsp,
   return &tex;
 }
 
-static int depth_cmp(const void *a, const void *b) {
-  const struct depth_entry *ea = (const struct depth_entry *)a;
-  const struct depth_entry *eb = (const struct depth_entry *)b;
-  return ea->d.i <= eb->d.i;
-}
+static void depth_sort(struct depth_entry *entries, int num, int flt) {
+  uint32_t *keys = malloc(num * sizeof(uint32_t) * 2);
+  int *values = malloc(num * sizeof(int) * 2);
+
+  for (int i = 0; i < num; i++) {
+    struct depth_entry *entry = &entries[i];
+    keys[i] = flt ? rsort_float_key(entry->d.f) : entry->d.i;
+    values[i] = i;
+  }
+
+  rsort_noalloc(keys, values, keys + num, values + num, num);
+
+  /* reorder the entries by their sorted indices */
+  struct depth_entry *sorted = malloc(num * sizeof(struct depth_entry));
+
+  for (int i = 0; i < num; i++) {
+    sorted[i] = entries[values[i]];
+  }
+
+  memcpy(entries, sorted, num * sizeof(struct depth_entry));
 
-static int depth_cmpf(const void *a, const void *b) {
-  const struct depth_entry *ea = (const struct depth_entry *)a;
-  const struct depth_entry *eb = (const struct depth_entry *)b;
-  return ea->d.f <= eb->d.f;
+  free(sorted);
+  free(values);
+  free(keys);
 }
 
 static void test_context(struct trace_cmd *cmd, struct test *tests,
                          int num_tests) {
   CHECK_EQ(cmd->type, TRACE_CMD_CONTEXT);
 
+  struct tr_converter *cv = tr_create_converter();
   struct ta_context *ctx = calloc(1, sizeof(struct ta_context));
   struct tr_context *rc = calloc(1, sizeof(struct tr_context));
 
   /* parse the context */
   trace_copy_context(cmd, ctx);
-  tr_convert_context(NULL, NULL, &find_texture, ctx, rc);
+  tr_convert_context(cv, NULL, NULL, &find_texture, ctx, rc);
 
   /* sort each vertex by the original w */
   struct depth_entry *original =
@@ -74,7 +90,7 @@ static void test_context(struct trace_cmd *cmd, struct test *tests,
     maxw = MAX(maxw, entry->d.f);
   }
 
-  msort(original, rc->num_verts, sizeof(struct depth_entry), &depth_cmpf);
+  depth_sort(original, rc->num_verts, 1);
 
   for (int i = 0; i < num_tests; i++) {
     struct test *test = &tests[i];
@@ -90,7 +106,7 @@ static void test_context(struct trace_cmd *cmd, struct test *tests,
     }
 
     /* sort the vertices based on the depth value */
-    msort(tmp, rc->num_verts, sizeof(struct depth_entry), test->cmp);
+    depth_sort(tmp, rc->num_verts, test->flt);
 
     /* compare sorted results with original results */
     for (int j = 0; j < rc->num_verts; j++) {
@@ -105,8 +121,10 @@ static void test_context(struct trace_cmd *cmd, struct test *tests,
   }
 
   free(original);
+  tr_destroy_context(rc);
   free(rc);
   free(ctx);
+  tr_destroy_converter(cv);
 }
 
 static void test_flt(float w, float minw, float maxw,
@@ -138,22 +156,20 @@ int cmd_depth(int argc, const char **argv) {
   struct trace *trace = trace_parse(filename);
 
   struct test tests[] = {
-      {"32-bit float", &test_flt, &depth_cmpf, 0, 0},
-      {"24-bit int", &test_int, &depth_cmp, 0, 0},
-      {"24-bit int using log2", &test_log2, &depth_cmp, 0, 0},
-      {"24-bit int using log2 w/ fixed max", &test_log2_fixed, &depth_cmp, 0,
-       0},
+      {"32-bit float", &test_flt, 1, 0, 0},
+      {"24-bit int", &test_int, 0, 0, 0},
+      {"24-bit int using log2", &test_log2, 0, 0, 0},
+      {"24-bit int using log2 w/ fixed max", &test_log2_fixed, 0, 0, 0},
   };
   int num_tests = ARRAY_SIZE(tests);
 
   /* check each context in the trace */
-  struct trace_cmd *next = trace->cmds;
-  while (next) {
-    if (next->type == TRACE_CMD_CONTEXT) {
-      test_context(next, tests, num_tests);
+  struct trace_cmd cmd;
+  for (int i = 0; trace_get_cmd(trace, i, &cmd); i++) {
+    if (cmd.type == TRACE_CMD_CONTEXT) {
+      test_context(&cmd, tests, num_tests);
       break;
     }
-    next = next->next;
   }
 
   trace_destroy(trace);